@@ -55,6 +55,11 @@ exit0:
     return file;
 }
 
+// Files are read in transfers of this size. Fewer, larger reads are much
+// faster on USB and slow firmware storage, but some firmware fails reads
+// that are too large, so each one is bounded.
+#define READ_CHUNK (16 * 1024 * 1024)
+
 void* xefi_read_file(efi_file_protocol* file, size_t* _sz) {
     efi_status r;
     size_t pages = 0;
@@ -76,17 +81,25 @@ void* xefi_read_file(efi_file_protocol* file, size_t* _sz) {
         return NULL;
     }
 
-    sz = finfo->FileSize;
-    r = file->Read(file, &sz, data);
-    if (r) {
-        printf("LoadFile: Error reading file (%s)\n", xefi_strerror(r));
-        gBS->FreePages((efi_physical_addr)data, pages);
-        return NULL;
-    }
-    if (sz != finfo->FileSize) {
-        printf("LoadFile: Short read\n");
-        gBS->FreePages((efi_physical_addr)data, pages);
-        return NULL;
+    // Read straight into the pages, which keeps each transfer page aligned.
+    size_t off = 0;
+    while (off < finfo->FileSize) {
+        sz = finfo->FileSize - off;
+        if (sz > READ_CHUNK) {
+            sz = READ_CHUNK;
+        }
+        r = file->Read(file, &sz, (uint8_t*)data + off);
+        if (r) {
+            printf("LoadFile: Error reading file (%s)\n", xefi_strerror(r));
+            gBS->FreePages((efi_physical_addr)data, pages);
+            return NULL;
+        }
+        if (sz == 0) {
+            printf("LoadFile: Short read\n");
+            gBS->FreePages((efi_physical_addr)data, pages);
+            return NULL;
+        }
+        off += sz;
     }
     *_sz = finfo->FileSize;
 
@@ -130,15 +130,34 @@ static int resolve_ip6(mac_addr* _mac, const ip6_addr* _ip) {
     return -1;
 }
 
+// The one's complement sum of 16 bit words is that of 32 bit words folded
+// down, so this adds 16 bytes per iteration into 64 bits, which cannot carry
+// out for a packet of any size, and folds once at the end.
 static uint16_t checksum(const void* _data, size_t len, uint16_t _sum) {
-    uint32_t sum = _sum;
-    const uint16_t* data = _data;
-    while (len > 1) {
-        sum += *data++;
+    uint64_t sum = _sum;
+    const uint8_t* data = _data;
+    uint32_t w[4];
+    while (len >= 16) {
+        memcpy(w, data, 16);
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        data += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        memcpy(w, data, 4);
+        sum += w[0];
+        data += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t h;
+        memcpy(&h, data, 2);
+        sum += h;
+        data += 2;
         len -= 2;
     }
     if (len) {
-        sum += (*data & 0xFF);
+        sum += *data;
     }
     while (sum > 0xFFFF) {
         sum = (sum & 0xFFFF) + (sum >> 16);
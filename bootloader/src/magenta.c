@@ -6,6 +6,7 @@
 
 #include <efi/protocol/graphics-output.h>
 
+#include <cmdline.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
@@ -247,6 +248,41 @@ static int get_mx_pixel_format(efi_graphics_output_protocol* gop) {
     }
 }
 
+#define BOOT_MARKS 8
+
+static struct {
+    const char* name;
+    uint64_t tsc;
+} boot_marks[BOOT_MARKS];
+static int boot_mark_count;
+
+void boot_mark(const char* name) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    if (boot_mark_count < BOOT_MARKS) {
+        boot_marks[boot_mark_count].name = name;
+        boot_marks[boot_mark_count].tsc = ((uint64_t)hi << 32) | lo;
+        boot_mark_count++;
+    }
+}
+
+// Appends the marks to the kernel's command line, if they fit.
+static void append_boot_marks(kernel_t* k) {
+    size_t len = strlen((char*)k->cmdline);
+    const char* sep = " bootloader.timestamps=";
+    for (int i = 0; i < boot_mark_count; i++) {
+        int n = snprintf((char*)k->cmdline + len, 4096 - len, "%s%s:%" PRIu64,
+                         sep, boot_marks[i].name, boot_marks[i].tsc);
+        if (n < 0 || (size_t)n >= 4096 - len) {
+            // drop the mark that did not fit, so the rest still parse
+            k->cmdline[len] = 0;
+            return;
+        }
+        len += n;
+        sep = ",";
+    }
+}
+
 static void start_kernel(kernel_t* k) {
     // 64bit entry is at offset 0x200
     uint64_t entry = (uint64_t)(k->image + 0x200);
@@ -363,6 +399,8 @@ int boot_kernel(efi_handle img, efi_system_table* sys,
     size_t key;
     int n, i;
 
+    boot_mark("load_kernel");
+
     efi_graphics_output_protocol* gop;
     bs->LocateProtocol(&GraphicsOutputProtocol, NULL, (void**)&gop);
 
@@ -411,12 +449,18 @@ int boot_kernel(efi_handle img, efi_system_table* sys,
     }
     n = process_memory_map(sys, &key, 0);
 
-    for (i = 0; i < n; i++) {
-        struct e820entry* e = e820table + i;
-        printf("%016" PRIx64 " %016" PRIx64 " %s\n",
-               e->addr, e->size, e820name(e->type));
+    // Text on the firmware's framebuffer console is slow to draw, so the
+    // memory map is only shown when asked for.
+    char verbose[2];
+    if (cmdline_get((char*)kernel.cmdline, "bootloader.verbose", verbose, sizeof(verbose)) >= 0) {
+        for (i = 0; i < n; i++) {
+            struct e820entry* e = e820table + i;
+            printf("%016" PRIx64 " %016" PRIx64 " %s\n",
+                   e->addr, e->size, e820name(e->type));
+        }
     }
 
+    boot_mark("exit_boot_services");
     r = sys->BootServices->ExitBootServices(img, key);
     if (r == EFI_INVALID_PARAMETER) {
         n = process_memory_map(sys, &key, 1);
@@ -431,6 +475,8 @@ int boot_kernel(efi_handle img, efi_system_table* sys,
     }
 
     install_memmap(&kernel, e820table, n);
+    boot_mark("start_kernel");
+    append_boot_marks(&kernel);
     start_kernel(&kernel);
 
     return 0;
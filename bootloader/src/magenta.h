@@ -15,3 +15,8 @@ typedef struct {
 int boot_kernel(efi_handle img, efi_system_table* sys,
                 void* image, size_t sz, void* ramdisk, size_t rsz,
                 void* cmdline, size_t csz, void* cmdline2, size_t csz2);
+
+// Notes that a boot stage starts now. The stages are passed to the kernel
+// on its command line as bootloader.timestamps=name:tsc,..., for the boot
+// timeline, each lasting until the next one starts.
+void boot_mark(const char* name);
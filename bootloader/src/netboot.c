@@ -19,6 +19,13 @@ static uint32_t last_ack_arg = 0;
 static int nb_boot_now = 0;
 static int nb_active = 0;
 
+// Windowed transfers (see NB_SEND_FILE_WINDOW): we ack every few in order
+// blocks, and advertise a window (below) of no more blocks in flight than
+// an EFI network stack holds for us between polls.
+#define NB_WINDOW_ACK_EVERY 8
+static int nb_windowed = 0;
+static int nb_unacked = 0;
+
 // item being downloaded
 static nbfile* item;
 
@@ -62,7 +69,12 @@ void udp6_recv(void* data, size_t len,
         if (len == 0)
             return;
         msg->data[len - 1] = 0;
-        for (int i = 0; i < (len - 1); i++) {
+        size_t namelen = strlen((const char*)msg->data);
+        nb_windowed = ((len - namelen - 1) == sizeof(NB_SEND_FILE_WINDOW)) &&
+                      !memcmp(msg->data + namelen + 1, NB_SEND_FILE_WINDOW,
+                              sizeof(NB_SEND_FILE_WINDOW));
+        nb_unacked = 0;
+        for (size_t i = 0; i < namelen; i++) {
             if ((msg->data[i] < ' ') || (msg->data[i] > 127)) {
                 msg->data[i] = '.';
             }
@@ -95,7 +107,14 @@ void udp6_recv(void* data, size_t len,
             memcpy(item->data + item->offset, msg->data, len);
             item->offset += len;
             ack.cmd = msg->cmd == NB_LAST_DATA ? NB_FILE_RECEIVED : NB_ACK;
-            if (msg->cmd != NB_LAST_DATA) {
+            if (nb_windowed && (msg->cmd != NB_LAST_DATA)) {
+                ack.arg = item->offset;
+                if (++nb_unacked < NB_WINDOW_ACK_EVERY) {
+                    do_transmit = 0;
+                } else {
+                    nb_unacked = 0;
+                }
+            } else if (msg->cmd != NB_LAST_DATA) {
                 do_transmit = 0;
             }
         }
@@ -127,10 +146,12 @@ transmit:
     }
 }
 
+// "\0" "1.1": "\01.1" would be \001 and ".1"
 static char advertise_data[] =
-    "version\01.1\0"
+    "version\0" "1.1\0"
     "serialno\0unknown\0"
-    "board\0unknown\0";
+    "board\0unknown\0"
+    "window\0" "32\0";
 
 static void advertise(void) {
     uint8_t buffer[256];
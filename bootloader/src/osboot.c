@@ -306,6 +306,7 @@ void do_netboot() {
 }
 
 EFIAPI efi_status efi_main(efi_handle img, efi_system_table* sys) {
+    boot_mark("efi_main");
     xefi_init(img, sys);
     gConOut->ClearScreen(gConOut);
 
@@ -356,6 +357,7 @@ EFIAPI efi_status efi_main(efi_handle img, efi_system_table* sys) {
     // Look for a kernel image on disk
     // TODO: use the filesystem protocol
     size_t ksz = 0;
+    boot_mark("read_kernel");
     void* kernel = xefi_load_file(L"magenta.bin", &ksz);
 
     if (!have_network && kernel == NULL) {
@@ -390,6 +392,7 @@ EFIAPI efi_status efi_main(efi_handle img, efi_system_table* sys) {
     if (key_idx >= sizeof(valid_keys)) goto fail;
 
     int timeout_s = cmdline_get_uint32(cmdline, "bootloader.timeout", DEFAULT_TIMEOUT);
+    boot_mark("menu");
     while (true) {
         printf("\nPress (b) for the boot menu");
         if (have_network) {
@@ -416,6 +419,7 @@ EFIAPI efi_status efi_main(efi_handle img, efi_system_table* sys) {
         case 'm': {
             size_t rsz = 0;
             void* ramdisk = NULL;
+            boot_mark("read_ramdisk");
             efi_file_protocol* ramdisk_file = xefi_open_file(L"ramdisk.bin");
             if (ramdisk_file) {
                 printf("Loading ramdisk.bin...\n");
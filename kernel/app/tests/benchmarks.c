@@ -93,6 +93,25 @@ __NO_INLINE static void bench_zero_page(void)
     free(buf);
 }
 
+__NO_INLINE static void bench_copy_page(void)
+{
+    uint8_t *buf = memalign(PAGE_SIZE, BUFSIZE);
+
+    uint count = arch_cycle_count();
+    for (uint i = 0; i < ITER; i++) {
+        for (uint j = PAGE_SIZE; j < BUFSIZE; j += PAGE_SIZE) {
+            arch_copy_page(buf + j, buf + j - PAGE_SIZE);
+        }
+    }
+    count = arch_cycle_count() - count;
+
+    uint64_t bytes_cycle = ((BUFSIZE - PAGE_SIZE) * ITER * 1000ULL) / count;
+    printf("took %u cycles to arch_copy_page a buffer of size %u %d times (%u bytes), %llu.%03llu bytes/cycle\n",
+           count, BUFSIZE, ITER, (BUFSIZE - PAGE_SIZE) * ITER, bytes_cycle / 1000, bytes_cycle % 1000);
+
+    free(buf);
+}
+
 #define bench_cset(type) \
 __NO_INLINE static void bench_cset_##type(void) \
 { \
@@ -210,6 +229,7 @@ void benchmarks(void)
 
     bench_memset_per_page();
     bench_zero_page();
+    bench_copy_page();
 
     bench_cset_uint8_t();
     bench_cset_uint16_t();
@@ -15,6 +15,7 @@ __BEGIN_CDECLS
 
 int thread_tests(void);
 int sleep_tests(void);
+int timer_tests(void);
 int port_tests(void);
 void printf_tests(void);
 void clock_tests(void);
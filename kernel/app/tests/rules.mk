@@ -16,10 +16,13 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/fibo.c \
     $(LOCAL_DIR)/mem_tests.c \
     $(LOCAL_DIR)/printf_tests.c \
+    $(LOCAL_DIR)/sched_benchmarks.c \
     $(LOCAL_DIR)/sync_ipi_tests.c \
     $(LOCAL_DIR)/sleep_tests.c \
+    $(LOCAL_DIR)/string_tests.c \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
+    $(LOCAL_DIR)/timer_tests.c \
     $(LOCAL_DIR)/alloc_checker_tests.cpp \
 
 
@@ -27,6 +30,7 @@ MODULE_DEPS += \
     lib/crypto \
     lib/header_tests \
     lib/mxtl \
+    lib/pool \
     lib/safeint \
     lib/unittest \
 
@@ -0,0 +1,198 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <err.h>
+#include <stdint.h>
+#include <unittest.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+
+static bool cpu_online(uint cpu)
+{
+    return (mp_get_online_mask() & (1u << cpu)) != 0;
+}
+
+struct pingpong {
+    event_t ping;
+    event_t pong;
+    unittest_bench_state_t *state;
+};
+
+static int pong_thread(void *arg)
+{
+    struct pingpong *pp = arg;
+
+    for (uint64_t i = 0; i < pp->state->iterations; i++) {
+        event_wait(&pp->ping);
+        event_signal(&pp->pong, true);
+    }
+    return 0;
+}
+
+static int ping_thread(void *arg)
+{
+    struct pingpong *pp = arg;
+
+    unittest_bench_start(pp->state);
+    for (uint64_t i = 0; i < pp->state->iterations; i++) {
+        event_signal(&pp->ping, true);
+        event_wait(&pp->pong);
+    }
+    unittest_bench_stop(pp->state);
+    return 0;
+}
+
+// Times the round trips of two threads, one on each of the cpus given, each
+// of which blocks until the other wakes it.
+static status_t pingpong(unittest_bench_state_t *state, uint ping_cpu, uint pong_cpu)
+{
+    if (!cpu_online(ping_cpu) || !cpu_online(pong_cpu))
+        return ERR_NOT_SUPPORTED;
+
+    struct pingpong pp = { .state = state };
+    event_init(&pp.ping, false, EVENT_FLAG_AUTOUNSIGNAL);
+    event_init(&pp.pong, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    status_t status = NO_ERROR;
+    thread_t *pong = thread_create("bench pong", &pong_thread, &pp,
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!pong) {
+        status = ERR_NO_MEMORY;
+        goto done;
+    }
+    thread_t *ping = thread_create("bench ping", &ping_thread, &pp,
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!ping) {
+        // let the one there is run to its end straight away
+        state->iterations = 0;
+        thread_resume(pong);
+        thread_join(pong, NULL, INFINITE_TIME);
+        status = ERR_NO_MEMORY;
+        goto done;
+    }
+    thread_set_pinned_cpu(pong, pong_cpu);
+    thread_set_pinned_cpu(ping, ping_cpu);
+    thread_resume(pong);
+    thread_resume(ping);
+
+    thread_join(ping, NULL, INFINITE_TIME);
+    thread_join(pong, NULL, INFINITE_TIME);
+
+done:
+    event_destroy(&pp.ping);
+    event_destroy(&pp.pong);
+    return status;
+}
+
+static status_t bench_context_switch(unittest_bench_state_t *state)
+{
+    return pingpong(state, 0, 0);
+}
+
+static status_t bench_cross_cpu_wakeup(unittest_bench_state_t *state)
+{
+    return pingpong(state, 0, 1);
+}
+
+static status_t bench_mutex_uncontended(unittest_bench_state_t *state)
+{
+    mutex_t m;
+    mutex_init(&m);
+
+    unittest_bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        mutex_acquire(&m);
+        mutex_release(&m);
+    }
+    unittest_bench_stop(state);
+
+    mutex_destroy(&m);
+    return NO_ERROR;
+}
+
+struct contender {
+    mutex_t m;
+    volatile bool stop;
+    event_t started;
+};
+
+static int contender_thread(void *arg)
+{
+    struct contender *c = arg;
+
+    event_signal(&c->started, false);
+    while (!c->stop) {
+        mutex_acquire(&c->m);
+        mutex_release(&c->m);
+    }
+    return 0;
+}
+
+static status_t bench_mutex_contended(unittest_bench_state_t *state)
+{
+    uint cpu = arch_curr_cpu_num();
+    uint other = cpu == 0 ? 1 : 0;
+    if (!cpu_online(other))
+        return ERR_NOT_SUPPORTED;
+
+    struct contender c = { .stop = false };
+    mutex_init(&c.m);
+    event_init(&c.started, false, 0);
+    thread_t *t = thread_create("bench contender", &contender_thread, &c,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t) {
+        mutex_destroy(&c.m);
+        event_destroy(&c.started);
+        return ERR_NO_MEMORY;
+    }
+    thread_set_pinned_cpu(t, other);
+    thread_resume(t);
+    event_wait(&c.started);
+
+    unittest_bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        mutex_acquire(&c.m);
+        mutex_release(&c.m);
+    }
+    unittest_bench_stop(state);
+
+    c.stop = true;
+    thread_join(t, NULL, INFINITE_TIME);
+    mutex_destroy(&c.m);
+    event_destroy(&c.started);
+    return NO_ERROR;
+}
+
+static enum handler_return timer_never_cb(struct timer *t, lk_time_t now, void *arg)
+{
+    return INT_NO_RESCHEDULE;
+}
+
+static status_t bench_timer_set_cancel(unittest_bench_state_t *state)
+{
+    timer_t t;
+    timer_initialize(&t);
+
+    unittest_bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        // far enough out that it is always canceled before it fires
+        timer_set_oneshot(&t, 10000, &timer_never_cb, NULL);
+        timer_cancel(&t);
+    }
+    unittest_bench_stop(state);
+    return NO_ERROR;
+}
+
+BENCHMARK_START_SUITE(sched_benchmarks)
+BENCHMARK("context switch", bench_context_switch)
+BENCHMARK("cross cpu wakeup", bench_cross_cpu_wakeup)
+BENCHMARK("mutex uncontended", bench_mutex_uncontended)
+BENCHMARK("mutex contended", bench_mutex_contended)
+BENCHMARK("timer set/cancel", bench_timer_set_cancel)
+BENCHMARK_END_SUITE(sched_benchmarks, "sched", "Scheduler and synchronization benchmarks");
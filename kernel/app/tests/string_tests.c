@@ -0,0 +1,105 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/ops.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <unittest.h>
+
+// big enough to take every length through both the short and the long paths
+#define STRING_TEST_MAX_LEN 300
+#define STRING_TEST_MAX_ALIGN 16
+#define STRING_TEST_BUF_SIZE (STRING_TEST_MAX_LEN + 2 * STRING_TEST_MAX_ALIGN)
+
+static void fill_pattern(uint8_t* buf, size_t len, uint8_t seed)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (uint8_t)(seed + i * 7);
+}
+
+static bool memcpy_test(void* context)
+{
+    BEGIN_TEST;
+
+    static uint8_t src[STRING_TEST_BUF_SIZE];
+    static uint8_t dst[STRING_TEST_BUF_SIZE];
+    static uint8_t expected[STRING_TEST_BUF_SIZE];
+    fill_pattern(src, sizeof(src), 1);
+
+    for (size_t src_align = 0; src_align < STRING_TEST_MAX_ALIGN; src_align += 3) {
+        for (size_t dst_align = 0; dst_align < STRING_TEST_MAX_ALIGN; dst_align += 5) {
+            for (size_t len = 0; len <= STRING_TEST_MAX_LEN; len++) {
+                memset(dst, 0xaa, sizeof(dst));
+                memset(expected, 0xaa, sizeof(expected));
+                for (size_t i = 0; i < len; i++)
+                    expected[dst_align + i] = src[src_align + i];
+
+                void* ret = memcpy(dst + dst_align, src + src_align, len);
+                REQUIRE_EQ(dst + dst_align, ret, "return value");
+                REQUIRE_BYTES_EQ(expected, dst, sizeof(dst), "copied bytes");
+            }
+        }
+    }
+
+    END_TEST;
+}
+
+static bool memset_test(void* context)
+{
+    BEGIN_TEST;
+
+    static uint8_t buf[STRING_TEST_BUF_SIZE];
+    static uint8_t expected[STRING_TEST_BUF_SIZE];
+
+    for (size_t align = 0; align < STRING_TEST_MAX_ALIGN; align++) {
+        for (size_t len = 0; len <= STRING_TEST_MAX_LEN; len++) {
+            memset(expected, 0x55, sizeof(expected));
+            for (size_t i = 0; i < len; i++)
+                expected[align + i] = 0xc3;
+            for (size_t i = 0; i < sizeof(buf); i++)
+                buf[i] = 0x55;
+
+            // only the low byte of the value counts
+            void* ret = memset(buf + align, 0x7c3, len);
+            REQUIRE_EQ(buf + align, ret, "return value");
+            REQUIRE_BYTES_EQ(expected, buf, sizeof(buf), "filled bytes");
+        }
+    }
+
+    END_TEST;
+}
+
+static bool page_ops_test(void* context)
+{
+    BEGIN_TEST;
+
+    uint8_t* src = memalign(PAGE_SIZE, PAGE_SIZE);
+    uint8_t* dst = memalign(PAGE_SIZE, PAGE_SIZE);
+    REQUIRE_NONNULL(src, "allocating page");
+    REQUIRE_NONNULL(dst, "allocating page");
+
+    fill_pattern(src, PAGE_SIZE, 3);
+    arch_copy_page(dst, src);
+    EXPECT_BYTES_EQ(src, dst, PAGE_SIZE, "copied page");
+
+    arch_zero_page(dst);
+    bool zero = true;
+    for (size_t i = 0; i < PAGE_SIZE; i++)
+        zero = zero && dst[i] == 0;
+    EXPECT_TRUE(zero, "zeroed page");
+
+    free(src);
+    free(dst);
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(string_tests)
+UNITTEST("memcpy", memcpy_test)
+UNITTEST("memset", memset_test)
+UNITTEST("page copy and zero", page_ops_test)
+UNITTEST_END_TESTCASE(string_tests, "string", "string routine tests", NULL, NULL);
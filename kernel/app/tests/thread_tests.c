@@ -263,7 +263,7 @@ static void event_test(void)
 static int quantum_tester(void *arg)
 {
     for (;;) {
-        printf("%p: in this thread. rq %d\n", get_current_thread(), get_current_thread()->remaining_quantum);
+        printf("%p: in this thread. rq %" PRId64 "\n", get_current_thread(), get_current_thread()->remaining_quantum);
     }
     return 0;
 }
@@ -334,6 +334,141 @@ static void context_switch_test(void)
     thread_sleep(100);
 }
 
+static event_t handoff_ping_event;
+static event_t handoff_pong_event;
+static volatile uint handoff_caller_cpu;
+
+static int handoff_server(void *arg)
+{
+    int iter = (intptr_t)arg;
+    int on_caller_cpu = 0;
+
+    /* replies are plain wakeups: the server doesn't block right after them */
+    for (int i = 0; i < iter; i++) {
+        event_wait(&handoff_ping_event);
+        if (arch_curr_cpu_num() == handoff_caller_cpu)
+            on_caller_cpu++;
+        event_signal(&handoff_pong_event, false);
+    }
+
+    return on_caller_cpu;
+}
+
+static bool handoff_test_run(bool handoff)
+{
+    const int iter = 10000;
+
+    event_init(&handoff_ping_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    event_init(&handoff_pong_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    thread_t *t = thread_create("handoff server", &handoff_server, (void *)(intptr_t)iter,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(t);
+    thread_sleep(100);
+
+    uint count = arch_cycle_count();
+    for (int i = 0; i < iter; i++) {
+        handoff_caller_cpu = arch_curr_cpu_num();
+
+        if (handoff)
+            thread_handoff_begin();
+        event_signal(&handoff_ping_event, false);
+        if (handoff)
+            thread_handoff_end();
+        event_wait(&handoff_pong_event);
+    }
+    count = arch_cycle_count() - count;
+
+    int on_caller_cpu;
+    thread_join(t, &on_caller_cpu, INFINITE_TIME);
+    printf("%s handoff: %u cycles per round trip, %d/%d calls ran on the caller's cpu\n",
+           handoff ? "with" : "without", count / iter, on_caller_cpu, iter);
+
+    event_destroy(&handoff_ping_event);
+    event_destroy(&handoff_pong_event);
+
+    /* the odd call can still be preempted or migrated between the handoff and
+     * the server running
+     */
+    if (handoff && on_caller_cpu < iter * 9 / 10) {
+        printf("handoff test failed: calls didn't run on the caller's cpu\n");
+        return false;
+    }
+    return true;
+}
+
+static int handoff_waiter(void *arg)
+{
+    event_wait(&handoff_ping_event);
+    event_signal(&handoff_pong_event, false);
+    return 0;
+}
+
+static ulong handoff_count(void)
+{
+    ulong count = 0;
+#if THREAD_STATS
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        count += thread_stats[i].handoffs;
+#endif
+    return count;
+}
+
+/* checks that a handoff happens, and is forgotten at the waker's next reschedule
+ * whether it blocked or not
+ */
+static bool handoff_state_test(void)
+{
+    thread_t *current_thread = get_current_thread();
+    bool ok = true;
+
+    event_init(&handoff_ping_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    event_init(&handoff_pong_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    for (int blocking = 1; blocking >= 0; blocking--) {
+        thread_t *t = thread_create("handoff waiter", &handoff_waiter, NULL,
+                                    DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(t);
+        while (t->state != THREAD_BLOCKED)
+            thread_sleep(1);
+
+        ulong handoffs = handoff_count();
+        thread_handoff_begin();
+        event_signal(&handoff_ping_event, false);
+        thread_handoff_end();
+        if (THREAD_STATS && handoff_count() == handoffs) {
+            printf("handoff test failed: woken thread wasn't handed off to\n");
+            ok = false;
+        }
+
+        if (!blocking)
+            thread_yield();
+        event_wait(&handoff_pong_event);
+        if (current_thread->handoff || current_thread->handoff_wanted) {
+            printf("handoff test failed: handoff outlived a %s reschedule\n",
+                   blocking ? "blocking" : "yielding");
+            ok = false;
+        }
+
+        thread_join(t, NULL, INFINITE_TIME);
+    }
+
+    event_destroy(&handoff_ping_event);
+    event_destroy(&handoff_pong_event);
+    return ok;
+}
+
+static void handoff_test(void)
+{
+    printf("testing direct handoff\n");
+
+    bool ok = handoff_state_test();
+    ok = handoff_test_run(false) && ok;
+    ok = handoff_test_run(true) && ok;
+    if (ok)
+        printf("handoff tests successfully complete\n");
+}
+
 static volatile int atomic;
 static volatile int atomic_count;
 
@@ -528,6 +663,17 @@ static void spinlock_test(void)
     spin_unlock_irqrestore(&lock, state);
     ASSERT(!spin_lock_held(&lock));
     ASSERT(!arch_ints_disabled());
+
+    // trylock takes a free lock, refuses a held one, and leaves it usable
+    ASSERT(spin_trylock(&lock) == 0);
+    ASSERT(spin_lock_held(&lock));
+    ASSERT(spin_trylock(&lock) != 0);
+    spin_unlock(&lock);
+    ASSERT(!spin_lock_held(&lock));
+    spin_lock(&lock);
+    ASSERT(spin_lock_held(&lock));
+    spin_unlock(&lock);
+    ASSERT(!spin_lock_held(&lock));
     printf("seems to work\n");
 
 #define COUNT (1024*1024)
@@ -681,6 +827,7 @@ int thread_tests(void)
 
     thread_sleep(200);
     context_switch_test();
+    handoff_test();
 
     preempt_test();
 
@@ -0,0 +1,104 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <stdio.h>
+#include <rand.h>
+#include <app/tests.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <platform.h>
+
+#define TIMER_TEST_COUNT 500
+#define TIMER_TEST_MAX_DELAY 5000
+#define TIMER_TEST_LATE_MS 20
+
+struct timer_test_entry {
+    timer_t timer;
+    lk_time_t armed;
+    lk_time_t delay;
+    lk_time_t slack;
+    lk_time_t fired;
+    bool cancelled;
+};
+
+static struct timer_test_entry entries[TIMER_TEST_COUNT];
+static volatile int fired_count;
+
+static enum handler_return timer_test_callback(timer_t *timer, lk_time_t now, void *arg)
+{
+    struct timer_test_entry *e = arg;
+    e->fired = now;
+    atomic_add(&fired_count, 1);
+    return INT_NO_RESCHEDULE;
+}
+
+// Arms a spread of timers across the levels of the timer wheel, cancels
+// some of them, and checks that the rest fire once, in their window.
+static int timer_wheel_test(void)
+{
+    int errors = 0;
+    int expected = 0;
+
+    fired_count = 0;
+    for (int i = 0; i < TIMER_TEST_COUNT; i++) {
+        struct timer_test_entry *e = &entries[i];
+        timer_initialize(&e->timer);
+        e->delay = rand() % TIMER_TEST_MAX_DELAY;
+        e->slack = (i % 3 == 0) ? (lk_time_t)(rand() % 100) : 0;
+        e->fired = 0;
+        e->cancelled = false;
+        e->armed = current_time();
+        timer_set_oneshot_etc(&e->timer, e->delay, e->slack, timer_test_callback, e);
+    }
+
+    for (int i = 0; i < TIMER_TEST_COUNT; i += 5) {
+        timer_cancel(&entries[i].timer);
+        entries[i].cancelled = true;
+    }
+
+    thread_sleep(TIMER_TEST_MAX_DELAY + 100 + TIMER_TEST_LATE_MS * 2);
+
+    for (int i = 0; i < TIMER_TEST_COUNT; i++) {
+        struct timer_test_entry *e = &entries[i];
+        timer_cancel(&e->timer);
+
+        if (e->cancelled) {
+            // it may have legitimately fired before we got to cancel it.
+            if (e->fired == 0 || TIME_GTE(e->fired, e->armed + e->delay))
+                continue;
+        } else {
+            expected++;
+            if (e->fired == 0) {
+                printf("timer %d (delay %u) never fired\n", i, e->delay);
+                errors++;
+                continue;
+            }
+        }
+
+        if (TIME_LT(e->fired, e->armed + e->delay)) {
+            printf("timer %d fired early: armed %u delay %u fired %u\n",
+                   i, e->armed, e->delay, e->fired);
+            errors++;
+        } else if (TIME_GT(e->fired, e->armed + e->delay + e->slack + TIMER_TEST_LATE_MS)) {
+            printf("timer %d fired late: armed %u delay %u slack %u fired %u\n",
+                   i, e->armed, e->delay, e->slack, e->fired);
+            errors++;
+        }
+    }
+
+    if (fired_count < expected) {
+        printf("only %d of %d timers fired\n", fired_count, expected);
+        errors++;
+    }
+
+    printf("timer wheel test: %d timers fired, %d errors\n", fired_count, errors);
+    return errors;
+}
+
+int timer_tests(void)
+{
+    return timer_wheel_test();
+}
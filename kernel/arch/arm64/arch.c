@@ -30,8 +30,9 @@ enum {
 };
 
 #if WITH_SMP
-/* smp boot lock */
-static spin_lock_t arm_boot_cpu_lock = 1;
+/* set once the secondary cpus may proceed; they poll it with their caches
+ * off, so it is a plain flag rather than a spinlock */
+static volatile int arm_boot_cpus_released = 0;
 static volatile int secondaries_to_init = 0;
 uint arm_num_cpus = 1;
 static thread_t _init_thread[SMP_MAX_CPUS - 1];
@@ -107,10 +108,11 @@ void arch_init(void)
     LTRACEF("releasing %d secondary cpus\n", secondaries_to_init);
 
     /* release the secondary cpus */
-    spin_unlock(&arm_boot_cpu_lock);
+    arm_boot_cpus_released = 1;
 
-    /* flush the release of the lock, since the secondary cpus are running without cache on */
-    arch_clean_cache_range((addr_t)&arm_boot_cpu_lock, sizeof(arm_boot_cpu_lock));
+    /* flush the release, since the secondary cpus are running without cache on */
+    arch_clean_cache_range((addr_t)&arm_boot_cpus_released, sizeof(arm_boot_cpus_released));
+    __asm__ volatile("sev");
 #endif
 }
 
@@ -161,8 +163,8 @@ void arm64_secondary_entry(ulong asm_cpu_num)
 
     arm64_cpu_early_init();
 
-    spin_lock(&arm_boot_cpu_lock);
-    spin_unlock(&arm_boot_cpu_lock);
+    while (!arm_boot_cpus_released)
+        __asm__ volatile("wfe");
 
     thread_secondary_cpu_init_early(&_init_thread[cpu - 1]);
     /* run early secondary cpu init routines up to the threading level */
@@ -33,6 +33,7 @@ extern struct fault_handler_table_entry __fault_handler_table_start[];
 extern struct fault_handler_table_entry __fault_handler_table_end[];
 
 bool arm64_in_int_handler[SMP_MAX_CPUS];
+struct arm64_irq_context arm64_irq_context[SMP_MAX_CPUS];
 
 static void dump_iframe(const struct arm64_iframe_long *iframe)
 {
@@ -264,8 +265,16 @@ void arm64_irq(struct arm64_iframe_short *iframe, uint exception_flags)
     uint32_t curr_cpu = arch_curr_cpu_num();
     arm64_in_int_handler[curr_cpu] = true;
 
+    /* the entry code leaves x29 alone, so the frame record of this function
+     * links to the interrupted one */
+    struct arm64_irq_context *context = &arm64_irq_context[curr_cpu];
+    context->frame = iframe;
+    context->fp = *(void **)__GET_FRAME(0);
+    context->from_user = !!(exception_flags & ARM64_EXCEPTION_FLAG_LOWER_EL);
+
     enum handler_return ret = platform_irq(iframe);
 
+    context->frame = NULL;
     arm64_in_int_handler[curr_cpu] = false;
 
     /* if we came from user space, check to see if we have any signals to handle */
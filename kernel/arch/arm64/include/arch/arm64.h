@@ -71,6 +71,17 @@ void arm64_sync_exception(struct arm64_iframe_long *iframe, uint exception_flags
 enum handler_return platform_irq(struct arm64_iframe_short* frame);
 enum handler_return platform_fiq(struct arm64_iframe_short* frame);
 
+/* what the irq being handled on a cpu interrupted, for the profiler */
+struct arm64_irq_context {
+    struct arm64_iframe_short *frame;
+    void *fp;
+    bool from_user;
+};
+extern struct arm64_irq_context arm64_irq_context[SMP_MAX_CPUS];
+
+/* sample with the cycle counter, whose overflow raises the per cpu irq */
+void arm64_pmu_init(unsigned int irq);
+
 /* fpu routines */
 void arm64_fpu_exception(struct arm64_iframe_long *iframe, uint exception_flags);
 void arm64_fpu_context_switch(struct thread *oldthread, struct thread *newthread);
@@ -19,7 +19,9 @@ struct arch_aspace {
     /* magic value for use-after-free detection */
     uint32_t magic;
 
-    uint16_t asid;
+    /* asid in the low MMU_ARM64_ASID_BITS, allocation generation above them;
+     * assigned at context switch time, see mmu.c */
+    uint64_t asid;
 
     /* pointer to the translation table */
     paddr_t tt_phys;
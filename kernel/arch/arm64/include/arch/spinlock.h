@@ -15,6 +15,9 @@ __BEGIN_CDECLS
 
 #define SPIN_LOCK_INITIAL_VALUE (0)
 
+/* With WITH_TICKET_SPINLOCKS the low 32 bits are the ticket now being served
+ * and the high 32 bits the next ticket to hand out, so cpus get the lock in
+ * the order they asked for it. Otherwise it is a plain test-and-set flag. */
 typedef unsigned long spin_lock_t;
 
 typedef unsigned int spin_lock_saved_state_t;
@@ -52,7 +55,12 @@ static inline void arch_spin_lock_init(spin_lock_t *lock)
 
 static inline bool arch_spin_lock_held(spin_lock_t *lock)
 {
+#if WITH_SMP && WITH_TICKET_SPINLOCKS
+    spin_lock_t val = *(volatile spin_lock_t *)lock;
+    return (uint32_t)val != (uint32_t)(val >> 32);
+#else
     return *lock != 0;
+#endif
 }
 
 enum {
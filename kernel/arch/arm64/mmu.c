@@ -7,13 +7,13 @@
 
 
 #include <arch/arm64/mmu.h>
-#include <rand.h>
+#include <arch/ops.h>
 #include <assert.h>
 #include <debug.h>
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/vm.h>
-#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <lib/heap.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,9 +28,6 @@ static_assert(((long)KERNEL_ASPACE_BASE >> MMU_KERNEL_SIZE_SHIFT) == -1, "");
 static_assert(MMU_KERNEL_SIZE_SHIFT <= 48, "");
 static_assert(MMU_KERNEL_SIZE_SHIFT >= 25, "");
 
-static uint64_t asid_pool[  (1 << MMU_ARM64_ASID_BITS) / 64 ];
-static mutex_t asid_lock = MUTEX_INITIAL_VALUE(asid_lock);
-
 uint32_t arm64_zva_shift;
 
 /* the main translation table */
@@ -38,39 +35,164 @@ pte_t arm64_kernel_translation_table[MMU_KERNEL_PAGE_TABLE_ENTRIES_TOP]
     __ALIGNED(MMU_KERNEL_PAGE_TABLE_ENTRIES_TOP * 8)
     __SECTION(".bss.prebss.translation_table");
 
-static status_t arm64_mmu_alloc_asid(uint16_t* asid) {
+/*
+ * ASID allocation
+ *
+ * User aspaces are tagged with an ASID so that switching between them needs no
+ * TLB maintenance. ASIDs are handed out lazily at context switch time, and the
+ * value kept in arch_aspace_t holds the generation it was allocated in above
+ * the low MMU_ARM64_ASID_BITS.
+ *
+ * When the bitmap runs dry the generation is bumped and the bitmap cleared,
+ * except for the ASIDs currently live on some cpu, which are carried over
+ * ("reserved") so that the aspaces using them keep them. Every cpu then
+ * flushes its local TLB before it installs an ASID from the new generation,
+ * and aspaces from an older generation pick up a fresh ASID the next time
+ * they are switched to. ASIDs are never returned to the bitmap individually;
+ * the rollover reclaims them all at once.
+ *
+ * The common case, switching to an aspace whose ASID is from the current
+ * generation, takes no lock: it just publishes the ASID in active_asids for
+ * this cpu. A rollover on another cpu zeroes active_asids under the lock, which
+ * makes the compare and swap below fail and sends us down the slow path.
+ */
+#define ASID_COUNT          (1UL << MMU_ARM64_ASID_BITS)
+#define ASID_MASK           (ASID_COUNT - 1)
+#define ASID_GENERATION_INC ASID_COUNT
+
+static spin_lock_t asid_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint64_t asid_generation = ASID_GENERATION_INC;
+static uint64_t asid_map[ASID_COUNT / 64];
+static uint64_t asid_next = 1; /* asid 0 is never handed out */
+static uint64_t active_asids[SMP_MAX_CPUS];
+static uint64_t reserved_asids[SMP_MAX_CPUS];
+static bool asid_tlb_flush_pending[SMP_MAX_CPUS];
+
+static bool asid_test_and_set_locked(uint64_t asid)
+{
+    uint64_t bit = 1UL << (asid % 64);
+    bool was_set = (asid_map[asid / 64] & bit) != 0;
 
-    uint16_t new_asid;
-    uint32_t retry = 1 << MMU_ARM64_ASID_BITS;
+    asid_map[asid / 64] |= bit;
+    return was_set;
+}
 
-    mutex_acquire(&asid_lock);
-    do {
-        new_asid = rand() & ~(-(1 << MMU_ARM64_ASID_BITS));
-        retry--;
-        if (retry == 0) {
-            mutex_release(&asid_lock);
-            return ERR_NO_MEMORY;
-        }
-    } while ((asid_pool[new_asid >> 6] & (1 << (new_asid % 64))) || (new_asid == 0));
+static uint64_t asid_find_free_locked(uint64_t start)
+{
+    for (uint64_t asid = start; asid < ASID_COUNT; asid++) {
+        if (!(asid_map[asid / 64] & (1UL << (asid % 64))))
+            return asid;
+    }
+    return 0;
+}
 
-    asid_pool[new_asid >> 6] = asid_pool[new_asid >> 6] | (1 << (new_asid % 64));
+static void asid_rollover_locked(void)
+{
+    memset(asid_map, 0, sizeof(asid_map));
+    asid_map[0] = 1;
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        uint64_t asid = __atomic_exchange_n(&active_asids[i], 0, __ATOMIC_RELAXED);
+
+        /* a cpu that has not switched since the last rollover is still
+         * running with the asid it had reserved then */
+        if (asid == 0)
+            asid = reserved_asids[i];
+        if (asid != 0)
+            asid_test_and_set_locked(asid & ASID_MASK);
+        reserved_asids[i] = asid;
+        asid_tlb_flush_pending[i] = true;
+    }
+}
 
-    mutex_release(&asid_lock);
+static uint64_t asid_new_locked(uint64_t old_asid)
+{
+    uint64_t generation = __atomic_load_n(&asid_generation, __ATOMIC_RELAXED);
 
-    *asid = new_asid;
+    if (old_asid != 0) {
+        uint64_t asid = generation | (old_asid & ASID_MASK);
 
-    return NO_ERROR;
+        /* if the old asid was live at the rollover, it was carried over */
+        bool reserved = false;
+        for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+            if (reserved_asids[i] == old_asid) {
+                reserved_asids[i] = asid;
+                reserved = true;
+            }
+        }
+        if (reserved)
+            return asid;
+
+        /* otherwise try to keep the same number if nobody has claimed it yet */
+        if (!asid_test_and_set_locked(old_asid & ASID_MASK))
+            return asid;
+    }
+
+    uint64_t asid = asid_find_free_locked(asid_next);
+    if (asid == 0) {
+        generation += ASID_GENERATION_INC;
+        __atomic_store_n(&asid_generation, generation, __ATOMIC_RELAXED);
+        asid_rollover_locked();
+        asid = asid_find_free_locked(1);
+        DEBUG_ASSERT(asid != 0);
+    }
+
+    asid_test_and_set_locked(asid);
+    asid_next = asid + 1;
+    return generation | asid;
 }
 
-static status_t arm64_mmu_free_asid(uint16_t asid) {
+/* returns the asid to load into ttbr0 for aspace on the current cpu */
+static uint64_t arm64_mmu_asid_for_switch(arch_aspace_t *aspace)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
 
-    mutex_acquire(&asid_lock);
+    uint cpu = arch_curr_cpu_num();
+    uint64_t asid = __atomic_load_n(&aspace->asid, __ATOMIC_RELAXED);
+    uint64_t old_active = __atomic_load_n(&active_asids[cpu], __ATOMIC_RELAXED);
+    uint64_t generation = __atomic_load_n(&asid_generation, __ATOMIC_RELAXED);
 
-    asid_pool[asid >> 6] = asid_pool[asid >> 6] & ~(1 << (asid % 64));
+    if (old_active != 0 && ((asid ^ generation) >> MMU_ARM64_ASID_BITS) == 0 &&
+        __atomic_compare_exchange_n(&active_asids[cpu], &old_active, asid, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return asid & ASID_MASK;
 
-    mutex_release(&asid_lock);
+    spin_lock(&asid_lock);
 
-    return NO_ERROR;
+    asid = __atomic_load_n(&aspace->asid, __ATOMIC_RELAXED);
+    generation = __atomic_load_n(&asid_generation, __ATOMIC_RELAXED);
+    if (((asid ^ generation) >> MMU_ARM64_ASID_BITS) != 0) {
+        asid = asid_new_locked(asid);
+        __atomic_store_n(&aspace->asid, asid, __ATOMIC_RELAXED);
+    }
+
+    if (asid_tlb_flush_pending[cpu]) {
+        asid_tlb_flush_pending[cpu] = false;
+        ARM64_TLBI_NOADDR(vmalle1);
+        DSB;
+    }
+
+    __atomic_store_n(&active_asids[cpu], asid, __ATOMIC_RELAXED);
+
+    spin_unlock(&asid_lock);
+
+    return asid & ASID_MASK;
+}
+
+/*
+ * A context switch on another cpu may move an aspace to a new asid while its
+ * page tables are being changed, in which case the per page invalidates went
+ * to the old asid. Catch that after the fact by dropping everything tagged
+ * with the new one.
+ */
+static void arm64_mmu_asid_recheck(arch_aspace_t *aspace, uint64_t asid)
+{
+    DSB;
+    uint64_t now = __atomic_load_n(&aspace->asid, __ATOMIC_RELAXED);
+    if ((now & ASID_MASK) != (asid & ASID_MASK)) {
+        ARM64_TLBI(aside1is, (now & ASID_MASK) << 48);
+        DSB;
+    }
 }
 
 static inline bool is_valid_vaddr(arch_aspace_t *aspace, vaddr_t vaddr)
@@ -326,6 +448,55 @@ static pte_t *arm64_mmu_get_page_table(vaddr_t index, uint page_size_shift, pte_
     }
 }
 
+/*
+ * Replace the block mapping at page_table[index] with a page table of next level
+ * entries mapping the same range with the same attributes, so that part of the
+ * block can be unmapped or have its permissions changed.
+ */
+static pte_t *arm64_mmu_split_block(vaddr_t block_vaddr, vaddr_t index,
+                                    uint index_shift, uint page_size_shift,
+                                    pte_t *page_table, uint asid)
+{
+    pte_t pte = page_table[index];
+    paddr_t block_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+    pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    uint next_shift = index_shift - (page_size_shift - 3);
+    pte_t next_descriptor = (next_shift > page_size_shift) ?
+                            MMU_PTE_L012_DESCRIPTOR_BLOCK :
+                            MMU_PTE_L3_DESCRIPTOR_PAGE;
+    paddr_t page_table_paddr;
+    pte_t *next_page_table;
+    uint count = 1U << (page_size_shift - 3);
+    uint i;
+
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+
+    LTRACEF("splitting block at vaddr %#" PRIxPTR ", pte %#" PRIx64 "\n", block_vaddr, pte);
+
+    if (alloc_page_table(&page_table_paddr, page_size_shift)) {
+        TRACEF("failed to allocate page table\n");
+        return NULL;
+    }
+    next_page_table = paddr_to_kvaddr(page_table_paddr);
+
+    for (i = 0; i < count; i++)
+        next_page_table[i] = (block_paddr + ((paddr_t)i << next_shift)) | attrs | next_descriptor;
+
+    /* break before make: the block has to be gone from the tlbs before the table replaces it */
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    CF;
+    if (asid == MMU_ARM64_GLOBAL_ASID)
+        ARM64_TLBI(vaae1is, block_vaddr >> 12);
+    else
+        ARM64_TLBI(vae1is, block_vaddr >> 12 | (vaddr_t)asid << 48);
+    DSB;
+
+    page_table[index] = page_table_paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+    __asm__ volatile("dmb ishst" ::: "memory");
+
+    return next_page_table;
+}
+
 static bool page_table_is_clear(pte_t *page_table, uint page_size_shift)
 {
     int i;
@@ -374,14 +545,28 @@ static int arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
 
         pte = page_table[index];
 
+        /* only unmapping part of a block means splitting it first. the rest
+         * of the block may be a physical or kernel mapping that can't be
+         * faulted back in, so if that fails, so does the unmap. */
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+                (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (!arm64_mmu_split_block(vaddr - vaddr_rem, index, index_shift,
+                                       page_size_shift, page_table, asid)) {
+                return ERR_NO_MEMORY;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
                 (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
             next_page_table = paddr_to_kvaddr(page_table_paddr);
-            arm64_mmu_unmap_pt(vaddr, vaddr_rem, chunk_size,
-                               index_shift - (page_size_shift - 3),
-                               page_size_shift,
-                               next_page_table, asid);
+            int ret = arm64_mmu_unmap_pt(vaddr, vaddr_rem, chunk_size,
+                                         index_shift - (page_size_shift - 3),
+                                         page_size_shift,
+                                         next_page_table, asid);
+            if (ret < 0)
+                return ret;
             if (chunk_size == block_size ||
                     page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
@@ -533,6 +718,16 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        /* changing part of a block means splitting it first */
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+                (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (!arm64_mmu_split_block(vaddr - vaddr_rem, index, index_shift,
+                                       page_size_shift, page_table, asid)) {
+                goto err;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
                 (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
@@ -691,11 +886,13 @@ int arch_mmu_map(arch_aspace_t *aspace, vaddr_t vaddr, paddr_t paddr, size_t cou
                          MMU_KERNEL_TOP_SHIFT, MMU_KERNEL_PAGE_SIZE_SHIFT,
                          aspace->tt_virt, MMU_ARM64_GLOBAL_ASID);
     } else {
+        uint64_t asid = __atomic_load_n(&aspace->asid, __ATOMIC_RELAXED);
         ret = arm64_mmu_map(vaddr, paddr, count * PAGE_SIZE,
                          mmu_flags_to_pte_attr(flags),
                          0, MMU_USER_SIZE_SHIFT,
                          MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
-                         aspace->tt_virt, aspace->asid);
+                         aspace->tt_virt, (uint)(asid & ASID_MASK));
+        arm64_mmu_asid_recheck(aspace, asid);
     }
 
     return (ret < 0) ? ret : (ret / (int)PAGE_SIZE);
@@ -726,11 +923,13 @@ int arch_mmu_unmap(arch_aspace_t *aspace, vaddr_t vaddr, size_t count)
                            aspace->tt_virt,
                            MMU_ARM64_GLOBAL_ASID);
     } else {
+        uint64_t asid = __atomic_load_n(&aspace->asid, __ATOMIC_RELAXED);
         ret = arm64_mmu_unmap(vaddr, count * PAGE_SIZE,
                            0, MMU_USER_SIZE_SHIFT,
                            MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
                            aspace->tt_virt,
-                           aspace->asid);
+                           (uint)(asid & ASID_MASK));
+        arm64_mmu_asid_recheck(aspace, asid);
     }
 
     return (ret < 0) ? ret : (ret / (int)PAGE_SIZE);
@@ -759,12 +958,14 @@ int arch_mmu_protect(arch_aspace_t *aspace, vaddr_t vaddr, size_t count, uint fl
                                 aspace->tt_virt,
                                 MMU_ARM64_GLOBAL_ASID);
     } else {
+        uint64_t asid = __atomic_load_n(&aspace->asid, __ATOMIC_RELAXED);
         ret = arm64_mmu_protect(vaddr, count * PAGE_SIZE,
                                 mmu_flags_to_pte_attr(flags),
                                 0, MMU_USER_SIZE_SHIFT,
                                 MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
                                 aspace->tt_virt,
-                                aspace->asid);
+                                (uint)(asid & ASID_MASK));
+        arm64_mmu_asid_recheck(aspace, asid);
     }
 
     return ret;
@@ -793,13 +994,13 @@ status_t arch_mmu_init_aspace(arch_aspace_t *aspace, vaddr_t base, size_t size,
         aspace->size = size;
         aspace->tt_virt = arm64_kernel_translation_table;
         aspace->tt_phys = vaddr_to_paddr(aspace->tt_virt);
-        aspace->asid = (uint16_t)MMU_ARM64_GLOBAL_ASID;
+        aspace->asid = 0;
     } else {
         //DEBUG_ASSERT(base >= 0);
         DEBUG_ASSERT(base + size <= 1UL << MMU_USER_SIZE_SHIFT);
 
-        if ( arm64_mmu_alloc_asid( &aspace->asid ) != NO_ERROR)
-            return ERR_NO_MEMORY;
+        /* an asid is assigned on first context switch */
+        aspace->asid = 0;
 
         aspace->base = base;
         aspace->size = size;
@@ -837,9 +1038,10 @@ status_t arch_mmu_destroy_aspace(arch_aspace_t *aspace)
     DEBUG_ASSERT(page);
     pmm_free_page(page);
 
-    ARM64_TLBI(ASIDE1IS,aspace->asid);
-
-    arm64_mmu_free_asid(aspace->asid);
+    /* the asid itself goes back to the pool at the next rollover, but nothing
+     * may still be cached against it once the page tables are gone */
+    ARM64_TLBI(ASIDE1IS, (aspace->asid & ASID_MASK) << 48);
+    DSB;
     aspace->asid = 0;
 
     aspace->magic = 0;
@@ -859,7 +1061,7 @@ void arch_mmu_context_switch(arch_aspace_t *old_aspace, arch_aspace_t *aspace)
         DEBUG_ASSERT((aspace->flags & ARCH_ASPACE_FLAG_KERNEL) == 0);
 
         tcr = MMU_TCR_FLAGS_USER;
-        ttbr = ((uint64_t)aspace->asid << 48) | aspace->tt_phys;
+        ttbr = (arm64_mmu_asid_for_switch(aspace) << 48) | aspace->tt_phys;
         ARM64_WRITE_SYSREG(ttbr0_el1, ttbr);
 
         if (TRACE_CONTEXT_SWITCH)
@@ -888,3 +1090,8 @@ void arch_zero_page(void *_ptr)
     } while (ptr != end_ptr);
 }
 
+void arch_copy_page(void *dst, const void *src)
+{
+    memcpy(dst, src, PAGE_SIZE);
+}
+
@@ -0,0 +1,73 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/arch_ops.h>
+#include <arch/arm64.h>
+#include <arch/pmu.h>
+#include <assert.h>
+#include <dev/interrupt.h>
+#include <err.h>
+#include <lib/ktrace.h>
+
+/* Sampling with the cycle counter, which arch_init() leaves counting as a
+ * 64 bit counter, by starting it period cycles short of overflowing. */
+
+#define PMU_CYCLE_COUNTER_BIT (1UL << 31)
+
+static unsigned int pmu_irq;
+static bool pmu_present;
+static uint32_t pmu_period;
+
+static enum handler_return arm64_pmu_irq(void *arg)
+{
+    ARM64_WRITE_SYSREG(pmovsclr_el0, PMU_CYCLE_COUNTER_BIT);
+    ARM64_WRITE_SYSREG(pmccntr_el0, -(uint64_t)pmu_period);
+
+    const struct arm64_irq_context *context = &arm64_irq_context[arch_curr_cpu_num()];
+    if (context->frame) {
+        ktrace_profile_sample(context->frame->elr, context->fp, context->from_user);
+    }
+    return INT_NO_RESCHEDULE;
+}
+
+void arm64_pmu_init(unsigned int irq)
+{
+    pmu_irq = irq;
+    pmu_present = true;
+}
+
+status_t arch_pmu_start(uint32_t period)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    if (!pmu_present)
+        return ERR_NOT_SUPPORTED;
+    if (period == 0)
+        return ERR_INVALID_ARGS;
+
+    pmu_period = period;
+    ARM64_WRITE_SYSREG(pmintenclr_el1, PMU_CYCLE_COUNTER_BIT);
+    ARM64_WRITE_SYSREG(pmovsclr_el0, PMU_CYCLE_COUNTER_BIT);
+    ARM64_WRITE_SYSREG(pmccntr_el0, -(uint64_t)period);
+
+    /* the irq is a per cpu one, so each cpu has its own handler and enable */
+    register_int_handler(pmu_irq, arm64_pmu_irq, NULL);
+    unmask_interrupt(pmu_irq);
+    ARM64_WRITE_SYSREG(pmintenset_el1, PMU_CYCLE_COUNTER_BIT);
+    return NO_ERROR;
+}
+
+void arch_pmu_stop(void)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    if (!pmu_present)
+        return;
+
+    ARM64_WRITE_SYSREG(pmintenclr_el1, PMU_CYCLE_COUNTER_BIT);
+    ARM64_WRITE_SYSREG(pmovsclr_el0, PMU_CYCLE_COUNTER_BIT);
+    mask_interrupt(pmu_irq);
+}
@@ -25,6 +25,7 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/exceptions_c.c \
 	$(LOCAL_DIR)/fpu.c \
 	$(LOCAL_DIR)/mmu.c \
+	$(LOCAL_DIR)/perf.c \
 	$(LOCAL_DIR)/spinlock.S \
 	$(LOCAL_DIR)/start.S \
 	$(LOCAL_DIR)/thread.c \
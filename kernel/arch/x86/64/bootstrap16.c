@@ -118,7 +118,8 @@ status_t x86_bootstrap16_prep(
 
     bootstrap_data->phys_bootstrap_pml4 =
             vmm_get_arch_aspace(bootstrap_aspace)->pt_phys;
-    bootstrap_data->phys_kernel_pml4 = x86_get_cr3();
+    /* strip the PCID, if any */
+    bootstrap_data->phys_kernel_pml4 = x86_get_cr3() & X86_PG_FRAME;
     memcpy(bootstrap_data->phys_gdtr,
            &_gdtr_phys,
            sizeof(bootstrap_data->phys_gdtr));
@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <debug.h>
 #include <err.h>
 #include <trace.h>
 #include <arch/mmu.h>
@@ -33,7 +34,7 @@ void x86_init_smp(uint32_t *apic_ids, uint32_t num_cpus)
     lk_init_secondary_cpus(num_cpus - 1);
 }
 
-status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
+status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count, bool broadcast)
 {
     volatile int aps_still_booting = 0;
     status_t status = ERR_INTERNAL;
@@ -84,9 +85,13 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
     // visible on the APs when they come up
     smp_wmb();
 
-    for (unsigned int i = 0; i < count; ++i) {
-        uint32_t apic_id = apic_ids[i];
-        apic_send_ipi(0, apic_id, DELIVERY_MODE_INIT);
+    if (broadcast) {
+        apic_send_broadcast_ipi(0, DELIVERY_MODE_INIT);
+    } else {
+        for (unsigned int i = 0; i < count; ++i) {
+            uint32_t apic_id = apic_ids[i];
+            apic_send_ipi(0, apic_id, DELIVERY_MODE_INIT);
+        }
     }
 
     // Wait 10 ms and then send the startup signals
@@ -95,31 +100,35 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
     // Actually send the startups
     ASSERT(PHYS_BOOTSTRAP_PAGE < 1 * MB);
     uint8_t vec = PHYS_BOOTSTRAP_PAGE >> PAGE_SIZE_SHIFT;
-    // Try up to two times per CPU, as Intel 3A recommends.
+    // Try up to two times per CPU, as Intel 3A recommends.  A CPU that is
+    // already running ignores the second STARTUP.
     for (int tries = 0; tries < 2; ++tries) {
-        for (unsigned int i = 0; i < count; ++i) {
-            uint32_t apic_id = apic_ids[i];
-
-            // This will cause the APs to begin executing at PHYS_BOOTSTRAP_PAGE in
-            // physical memory.
-            apic_send_ipi(vec, apic_id, DELIVERY_MODE_STARTUP);
+        // This will cause the APs to begin executing at PHYS_BOOTSTRAP_PAGE in
+        // physical memory.
+        if (broadcast) {
+            apic_send_broadcast_ipi(vec, DELIVERY_MODE_STARTUP);
+        } else {
+            for (unsigned int i = 0; i < count; ++i) {
+                uint32_t apic_id = apic_ids[i];
+                apic_send_ipi(vec, apic_id, DELIVERY_MODE_STARTUP);
+            }
         }
 
         if (aps_still_booting == 0) {
             break;
         }
-        // Wait 1ms for cores to boot.  The docs recommend 200us between STARTUP
-        // IPIs.
-        thread_sleep(1);
+        // The docs recommend 200us between STARTUP IPIs.
+        spin(200);
     }
 
-    // The docs recommend waiting 200us for cores to boot.  We do a bit more
-    // work before the cores report in, so wait longer (up to 1 second).
-    for (int tries_left = 200;
+    // The APs run their per-cpu init concurrently and each reports in as soon
+    // as it is done, so poll at a fine grain rather than sleeping a fixed
+    // amount per CPU (up to 1 second in all).
+    for (int tries_left = 1000;
          aps_still_booting != 0 && tries_left > 0;
          --tries_left) {
 
-        thread_sleep(5);
+        thread_sleep(1);
     }
 
     uint failed_aps = (uint)atomic_swap(&aps_still_booting, 0);
@@ -12,9 +12,11 @@
 #include <arch/x86/apic.h>
 #include <arch/x86/interrupts.h>
 #include <arch/x86/descriptor.h>
+#include <arch/x86/perf.h>
 #include <kernel/thread.h>
 #include <platform.h>
 
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <lib/user_copy.h>
 
@@ -22,6 +24,8 @@
 #include <magenta/exception.h>
 #endif
 
+KCOUNTER(interrupts, "kernel.interrupts");
+
 static void dump_fault_frame(x86_iframe_t *frame)
 {
 #if ARCH_X86_32
@@ -287,6 +291,7 @@ out_good:
 void x86_exception_handler(x86_iframe_t *frame)
 {
     THREAD_STATS_INC(interrupts);
+    kcounter_add(&interrupts, 1);
 
     // are we recursing?
     if (unlikely(arch_in_int_handler()) && frame->vector != X86_INT_NMI) {
@@ -357,6 +362,11 @@ void x86_exception_handler(x86_iframe_t *frame)
             apic_issue_eoi();
             break;
         }
+        case X86_INT_APIC_PMI: {
+            ret = x86_pmi_handler(frame);
+            apic_issue_eoi();
+            break;
+        }
 #if WITH_SMP
         case X86_INT_IPI_GENERIC: {
             ret = x86_ipi_generic_handler();
@@ -23,6 +23,9 @@ uint32_t max_ext_cpuid = 0;
 
 enum x86_vendor_list x86_vendor;
 
+bool x86_string_erms;
+bool x86_string_fsrm;
+
 static struct x86_model_info model_info;
 
 static int initialized = 0;
@@ -95,6 +98,10 @@ void x86_feature_init(void)
             model_info.display_model += BITS_SHIFT(leaf->a, 19, 16) << 4;
         }
     }
+
+    /* pick the string routines' strategy */
+    x86_string_erms = x86_feature_test(X86_FEATURE_ERMS);
+    x86_string_fsrm = x86_string_erms && x86_feature_test(X86_FEATURE_FSRM);
 }
 
 bool x86_get_cpuid_subleaf(
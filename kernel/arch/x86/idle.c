@@ -0,0 +1,134 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/ops.h>
+#include <arch/x86.h>
+#include <arch/x86/feature.h>
+#include <arch/x86/mp.h>
+#include <debug.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+// Idle cpus wait in MWAIT on a word of their own, armed with MONITOR, when
+// the cpu can wake from MWAIT for interrupts it has masked.  Waking one for
+// new work is then a store to the word rather than a reschedule ipi:
+// arch_mp_send_ipi() passes the cpus it is about to interrupt through
+// x86_idle_wake(), which takes off those it woke this way.
+//
+// The word only reads IDLE_WAITING while the cpu is in arch_idle() with
+// interrupts off, so a cpu that takes an interrupt and switches to another
+// thread can't be mistaken for an idle one.
+//
+// The C-state asked for depends on how long the cpu is expected to stay
+// idle, going by a running average of how long its last naps were: short
+// ones get C1, which is quick to leave, and longer ones the deepest of the
+// first four MWAIT C-states the cpu lists.
+
+#define IDLE_RUNNING 0
+#define IDLE_WAITING 1
+#define IDLE_WOKEN 2
+
+// naps expected to be at least this long, in microseconds, go deep
+#define IDLE_DEEP_MIN_US 500
+
+// the average is kept in 1/8ths of its weight to the latest nap
+#define IDLE_AVG_SHIFT 3
+
+struct idle_state {
+    volatile int monitor;
+    uint32_t avg_us;
+} __ALIGNED(64);
+
+static struct idle_state idle_states[SMP_MAX_CPUS];
+
+static bool idle_mwait;
+static uint32_t idle_deep_hint;
+
+KCOUNTER(monitor_wakeups, "kernel.ipis.monitor_wakeups");
+
+static void x86_idle_init(uint level) {
+    if (!cmdline_get_bool("kernel.x86.mwait", true))
+        return;
+    if (!x86_feature_test(X86_FEATURE_MON))
+        return;
+
+    // ECX bit 0: the extensions are listed; bit 1: masked interrupts wake MWAIT
+    const struct cpuid_leaf *leaf = x86_get_cpuid_leaf(X86_CPUID_MWAIT);
+    if (!leaf || (leaf->c & 0x3) != 0x3)
+        return;
+
+    // EDX lists the sub-states of each MWAIT C-state, four bits apiece, from
+    // C0; hints count from C1 as 0, in bits 7:4
+    for (uint32_t cstate = 4; cstate > 1; cstate--) {
+        if ((leaf->d >> (cstate * 4)) & 0xf) {
+            idle_deep_hint = (cstate - 1) << 4;
+            break;
+        }
+    }
+
+    dprintf(INFO, "x86: idling in mwait, deep hint %#x\n", idle_deep_hint);
+    idle_mwait = true;
+}
+
+LK_INIT_HOOK(x86_idle, x86_idle_init, LK_INIT_LEVEL_ARCH);
+
+void arch_idle(void) {
+    // don't halt if local interrupts are disabled
+    if (arch_ints_disabled())
+        return;
+
+    if (!idle_mwait) {
+        x86_hlt();
+        return;
+    }
+
+    arch_disable_ints();
+
+    struct idle_state *state = &idle_states[arch_curr_cpu_num()];
+    uint32_t hint = (state->avg_us >= IDLE_DEEP_MIN_US) ? idle_deep_hint : 0;
+    lk_bigtime_t start = current_time_hires();
+
+    atomic_store(&state->monitor, IDLE_WAITING);
+    x86_monitor(&state->monitor);
+    if (atomic_load(&state->monitor) == IDLE_WAITING)
+        x86_mwait(hint, 1);
+    int woken = atomic_swap(&state->monitor, IDLE_RUNNING);
+
+    uint32_t slept = (uint32_t)MIN(current_time_hires() - start, UINT32_MAX);
+    state->avg_us = (uint32_t)((((uint64_t)state->avg_us << IDLE_AVG_SHIFT) - state->avg_us + slept) >>
+                               IDLE_AVG_SHIFT);
+
+    // whatever interrupt woke us is taken here
+    arch_enable_ints();
+
+    if (woken == IDLE_WOKEN) {
+        LTRACEF("cpu %u woken through its monitor\n", arch_curr_cpu_num());
+        kcounter_add(&monitor_wakeups, 1);
+        thread_reschedule();
+    }
+}
+
+uint32_t x86_idle_wake(uint32_t target) {
+    if (!idle_mwait)
+        return target;
+
+    uint32_t remaining = target;
+    for (uint cpu = 0; target; cpu++, target >>= 1) {
+        if (!(target & 1))
+            continue;
+        int expected = IDLE_WAITING;
+        if (atomic_cmpxchg(&idle_states[cpu].monitor, &expected, IDLE_WOKEN))
+            remaining &= ~(1u << cpu);
+    }
+    return remaining;
+}
@@ -33,10 +33,17 @@ struct arch_aspace {
      * actually an mp_cpu_mask_t, but header dependencies. */
     volatile int active_cpus;
 
+    /* process-context identifier tagging this aspace's TLB entries, or 0
+     * if it doesn't have one of its own */
+    uint16_t pcid;
+
     /* Pointer to a bitmap::RleBitmap representing the range of ports
      * enabled in this aspace. */
     void *io_bitmap;
     spin_lock_t io_bitmap_lock;
+
+    /* cpus whose TSS has this aspace's io ports open, an mp_cpu_mask_t */
+    volatile int io_bitmap_cpus;
 };
 
 __END_CDECLS
@@ -95,12 +95,15 @@ void x86_init_smp(uint32_t *apic_ids, uint32_t num_cpus);
  *
  * @param apic_ids A list of all APIC IDs to launch.
  * @param count The number of entries in the apic_ids list.
+ * @param broadcast Start the APs with one INIT and SIPI sent to all other
+ * CPUs, rather than one per APIC ID.  Only valid when apic_ids lists every
+ * CPU in the system besides the caller's, since the broadcast wakes them all.
  *
  * @return ERR_INVALID_ARGS if an unknown APIC ID was provided.
  * @return ERR_BAD_STATE if one of the targets is currently online
  * @return ERR_TIMED_OUT if one of the targets failed to launch
  */
-status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count);
+status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count, bool broadcast);
 
 #define IO_BITMAP_BITS      65536
 #define IO_BITMAP_BYTES     (IO_BITMAP_BITS/8)
@@ -178,6 +181,14 @@ static inline void x86_clts(void) {__asm__ __volatile__ ("clts"); }
 static inline void x86_hlt(void) {__asm__ __volatile__ ("hlt"); }
 static inline void x86_sti(void) {__asm__ __volatile__ ("sti"); }
 static inline void x86_cli(void) {__asm__ __volatile__ ("cli"); }
+static inline void x86_monitor(const volatile void *addr)
+{
+    __asm__ __volatile__ ("monitor" :: "a" (addr), "c" (0), "d" (0));
+}
+static inline void x86_mwait(uint32_t hints, uint32_t extensions)
+{
+    __asm__ __volatile__ ("mwait" :: "a" (hints), "c" (extensions) : "memory");
+}
 static inline void x86_ltr(uint16_t sel)
 {
     __asm__ __volatile__ ("ltr %%ax" :: "a" (sel));
@@ -56,6 +56,9 @@ void apic_timer_mask(void);
 void apic_timer_unmask(void);
 void apic_timer_stop(void);
 
+void apic_pmi_mask(void);
+void apic_pmi_unmask(void);
+
 enum handler_return apic_error_interrupt_handler(void);
 enum handler_return apic_timer_interrupt_handler(void);
 
@@ -110,6 +113,7 @@ void apic_io_configure_irq_vector(
         uint32_t global_irq,
         uint8_t vector);
 uint8_t apic_io_fetch_irq_vector(uint32_t global_irq);
+void apic_io_configure_irq_dst(uint32_t global_irq, uint8_t dst);
 
 void apic_io_mask_isa_irq(uint8_t isa_irq, bool mask);
 // For ISA configuration, we don't need to specify the trigger mode
@@ -26,6 +26,8 @@ struct cpuid_leaf {
 enum x86_cpuid_leaf_num {
     X86_CPUID_BASE = 0,
     X86_CPUID_MODEL_FEATURES = 0x1,
+    X86_CPUID_MWAIT = 0x5,
+    X86_CPUID_PERFORMANCE_MONITORING = 0xa,
     X86_CPUID_TOPOLOGY = 0xb,
     X86_CPUID_XSAVE = 0xd,
 
@@ -44,6 +46,12 @@ struct x86_cpuid_bit {
 
 void x86_feature_init(void);
 
+/* how the string routines (memcpy, memset, user copies, page copy and zero)
+ * should move memory, set up by x86_feature_init from ERMS and FSRM. until then
+ * they use the conservative quadword loops. */
+extern bool x86_string_erms; /* rep movsb/stosb beats quadword moves for long runs */
+extern bool x86_string_fsrm; /* ... and for short ones too */
+
 static inline const struct cpuid_leaf *x86_get_cpuid_leaf(enum x86_cpuid_leaf_num leaf)
 {
     extern struct cpuid_leaf _cpuid[MAX_SUPPORTED_CPUID + 1];
@@ -92,9 +100,11 @@ void x86_feature_debug(void);
 
 /* add feature bits to test here */
 #define X86_FEATURE_SSE3         X86_CPUID_BIT(0x1, 2, 0)
+#define X86_FEATURE_MON          X86_CPUID_BIT(0x1, 2, 3)
 #define X86_FEATURE_SSSE3        X86_CPUID_BIT(0x1, 2, 9)
 #define X86_FEATURE_SSE4_1       X86_CPUID_BIT(0x1, 2, 19)
 #define X86_FEATURE_SSE4_2       X86_CPUID_BIT(0x1, 2, 20)
+#define X86_FEATURE_PCID         X86_CPUID_BIT(0x1, 2, 17)
 #define X86_FEATURE_TSC_DEADLINE X86_CPUID_BIT(0x1, 2, 24)
 #define X86_FEATURE_AESNI        X86_CPUID_BIT(0x1, 2, 25)
 #define X86_FEATURE_XSAVE        X86_CPUID_BIT(0x1, 2, 26)
@@ -109,9 +119,11 @@ void x86_feature_debug(void);
 #define X86_FEATURE_TSC_ADJUST   X86_CPUID_BIT(0x7, 1, 1)
 #define X86_FEATURE_AVX2         X86_CPUID_BIT(0x7, 1, 5)
 #define X86_FEATURE_SMEP         X86_CPUID_BIT(0x7, 1, 7)
+#define X86_FEATURE_ERMS         X86_CPUID_BIT(0x7, 1, 9)
 #define X86_FEATURE_RDSEED       X86_CPUID_BIT(0x7, 1, 18)
 #define X86_FEATURE_SMAP         X86_CPUID_BIT(0x7, 1, 20)
 #define X86_FEATURE_PKU          X86_CPUID_BIT(0x7, 2, 3)
+#define X86_FEATURE_FSRM         X86_CPUID_BIT(0x7, 3, 4)
 #define X86_FEATURE_SYSCALL      X86_CPUID_BIT(0x80000001, 3, 11)
 #define X86_FEATURE_NX           X86_CPUID_BIT(0x80000001, 3, 20)
 #define X86_FEATURE_HUGE_PAGE    X86_CPUID_BIT(0x80000001, 3, 26)
@@ -9,7 +9,14 @@
 
 __BEGIN_CDECLS
 
+struct arch_aspace;
+
 /* io port stuff */
 int x86_set_io_bitmap(uint32_t port, uint32_t len, bool enable);
 
+/* open the io ports of aspace in this cpu's TSS, closing any others */
+void x86_load_io_bitmap(struct arch_aspace *aspace);
+/* close the io ports of aspace on every cpu, before it is destroyed */
+void x86_release_io_bitmap(struct arch_aspace *aspace);
+
 __END_CDECLS
@@ -38,6 +38,7 @@
 __BEGIN_CDECLS
 
 struct thread;
+struct arch_aspace;
 
 struct x86_percpu {
     /* a direct pointer to ourselves */
@@ -68,6 +69,9 @@ struct x86_percpu {
 
     /* The IDT for this CPU */
     struct idt idt;
+
+    /* the aspace whose io ports are open in default_tss, if any */
+    struct arch_aspace *io_bitmap_aspace;
 #ifdef ARCH_X86_64
     /* Reserved space for interrupt stacks */
     uint8_t interrupt_stacks[NUM_ASSIGNED_IST_ENTRIES][PAGE_SIZE];
@@ -89,6 +93,9 @@ void x86_set_local_apic_id(uint32_t apic_id);
 
 int x86_apic_id_to_cpu_num(uint32_t apic_id);
 
+/* returns INVALID_APIC_ID if cpu_num does not name a known cpu */
+uint32_t x86_cpu_num_to_apic_id(uint cpu_num);
+
 // Allocate all of the necessary structures for all of the APs to run.
 status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count);
 
@@ -185,6 +192,9 @@ static void arch_set_in_int_handler(bool in_irq)
 
 enum handler_return x86_ipi_generic_handler(void);
 enum handler_return x86_ipi_reschedule_handler(void);
+/* wakes those of the target cpus that are idle in mwait, returning the rest,
+ * which still need a reschedule ipi */
+uint32_t x86_idle_wake(uint32_t target);
 void x86_ipi_halt_handler(void) __NO_RETURN;
 void x86_secondary_entry(volatile int *aps_still_booting, thread_t *thread);
 
@@ -0,0 +1,16 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+#pragma once
+
+#include <arch/x86.h>
+#include <kernel/thread.h>
+#include <magenta/compiler.h>
+
+__BEGIN_CDECLS
+
+enum handler_return x86_pmi_handler(x86_iframe_t *frame);
+
+__END_CDECLS
@@ -407,6 +407,24 @@ uint8_t apic_io_fetch_irq_vector(uint32_t global_irq)
     return vector;
 }
 
+/* Retarget the IRQ at a different local APIC (physical destination mode),
+ * leaving the rest of the redirection entry as it is. */
+void apic_io_configure_irq_dst(uint32_t global_irq, uint8_t dst)
+{
+    struct io_apic *io_apic = apic_io_resolve_global_irq(global_irq);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&lock, state);
+
+    uint64_t reg = apic_io_read_redirection_entry(io_apic, global_irq);
+    reg &= ~(IO_APIC_RTE_DST(0xff) | IO_APIC_RTE_DST_MODE(1));
+    reg |= IO_APIC_RTE_DST_MODE(DST_MODE_PHYSICAL);
+    reg |= IO_APIC_RTE_DST(dst);
+    apic_io_write_redirection_entry(io_apic, global_irq, reg);
+
+    spin_unlock_irqrestore(&lock, state);
+}
+
 void apic_io_mask_isa_irq(uint8_t isa_irq, bool mask)
 {
     ASSERT(isa_irq < NUM_ISA_IRQS);
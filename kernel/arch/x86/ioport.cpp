@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/arch_ops.h>
 #include <arch/x86.h>
 #include <arch/x86/descriptor.h>
 #include <arch/x86/ioport.h>
@@ -21,33 +22,100 @@
 #include <mxtl/unique_ptr.h>
 #include <new.h>
 
+// Each cpu's TSS has open the io ports of the last user aspace it ran that
+// had any, its percpu io_bitmap_aspace, and the aspace has the cpu's bit set
+// in its io_bitmap_cpus.  Kernel threads can't use the ports, so running one
+// leaves them as they are, and going back to the same aspace costs nothing.
+
+// Closes the ports this cpu has open.
+static void io_bitmap_unload(struct x86_percpu* percpu) {
+    struct arch_aspace* as = percpu->io_bitmap_aspace;
+    if (!as) {
+        return;
+    }
+
+    spin_lock(&as->io_bitmap_lock);
+    x86_clear_tss_io_bitmap(*static_cast<bitmap::RleBitmap*>(as->io_bitmap));
+    spin_unlock(&as->io_bitmap_lock);
+
+    atomic_and(&as->io_bitmap_cpus, ~(1 << percpu->cpu_num));
+    percpu->io_bitmap_aspace = nullptr;
+}
+
+void x86_load_io_bitmap(struct arch_aspace* aspace) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    struct x86_percpu* percpu = x86_get_percpu();
+    if (percpu->io_bitmap_aspace == aspace) {
+        return;
+    }
+
+    io_bitmap_unload(percpu);
+
+    // If a bitmap is being given to the aspace as we look, this cpu is
+    // already in its active_cpus, so x86_set_io_bitmap() will call back.
+    if (!aspace->io_bitmap) {
+        return;
+    }
+
+    spin_lock(&aspace->io_bitmap_lock);
+    x86_set_tss_io_bitmap(*static_cast<bitmap::RleBitmap*>(aspace->io_bitmap));
+    atomic_or(&aspace->io_bitmap_cpus, 1 << percpu->cpu_num);
+    percpu->io_bitmap_aspace = aspace;
+    spin_unlock(&aspace->io_bitmap_lock);
+}
+
+// Brings ports [port, port + len) of this cpu's TSS in line with bitmap.
+static void tss_io_bitmap_update(const bitmap::RleBitmap& bitmap, uint32_t port, uint32_t len) {
+    tss_t* tss = &x86_get_percpu()->default_tss;
+    auto tss_bitmap = reinterpret_cast<unsigned long*>(tss->tss_bitmap);
+
+    // close the range, then open what the bitmap has open of it
+    // (the tss IO bitmap has reversed polarity)
+    bitmap_set(tss_bitmap, port, len);
+    size_t end = port + len;
+    for (const auto& extent : bitmap) {
+        if (extent.bitoff >= end) {
+            break;
+        }
+        size_t from = extent.bitoff > port ? extent.bitoff : port;
+        size_t to = extent.bitoff + extent.bitlen < end ? extent.bitoff + extent.bitlen : end;
+        if (from < to) {
+            bitmap_clear(tss_bitmap, static_cast<int>(from), static_cast<int>(to - from));
+        }
+    }
+}
+
 /* Task used for updating IO permissions on each CPU */
 struct ioport_update_context {
     // aspace that we're trying to update
     arch_aspace_t* aspace;
+    // the ports that changed
+    uint32_t port;
+    uint32_t len;
 };
 static void ioport_update_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
     struct ioport_update_context* context =
         (struct ioport_update_context*)raw_context;
-
-    thread_t* t = get_current_thread();
-    if (!t->aspace) {
+    struct arch_aspace* as = context->aspace;
+
+    if (x86_get_percpu()->io_bitmap_aspace == as) {
+        // Only the range that changed is rewritten.  It is read back from
+        // the bitmap under the lock, so that updates racing each other
+        // leave the TSS as the bitmap ends up, in whatever order they land.
+        spin_lock(&as->io_bitmap_lock);
+        tss_io_bitmap_update(*static_cast<bitmap::RleBitmap*>(as->io_bitmap),
+                             context->port, context->len);
+        spin_unlock(&as->io_bitmap_lock);
         return;
     }
 
-    struct arch_aspace* as = vmm_get_arch_aspace(t->aspace);
-    if (as != context->aspace) {
-        return;
+    // Running in the aspace without having its ports loaded happens when
+    // it had none when this cpu switched to it.
+    thread_t* t = get_current_thread();
+    if (t->aspace && vmm_get_arch_aspace(t->aspace) == as) {
+        x86_load_io_bitmap(as);
     }
-
-    spin_lock(&as->io_bitmap_lock);
-
-    // This is overkill, but it's much simpler to reason about
-    x86_reset_tss_io_bitmap();
-    x86_set_tss_io_bitmap(*static_cast<bitmap::RleBitmap*>(as->io_bitmap));
-
-    spin_unlock(&as->io_bitmap_lock);
 }
 
 int x86_set_io_bitmap(uint32_t port, uint32_t len, bool enable) {
@@ -105,29 +173,38 @@ int x86_set_io_bitmap(uint32_t port, uint32_t len, bool enable) {
         status = enable ?
                 bitmap->SetNoAlloc(port, port + len, &bitmap_freelist) :
                 bitmap->ClearNoAlloc(port, port + len, &bitmap_freelist);
-        if (status != NO_ERROR) {
-            break;
-        }
-
-        // Set the io bitmap in the tss (the tss IO bitmap has reversed polarity)
-        tss_t* tss = &x86_get_percpu()->default_tss;
-        if (enable) {
-            bitmap_clear(reinterpret_cast<unsigned long*>(tss->tss_bitmap), port, len);
-        } else {
-            bitmap_set(reinterpret_cast<unsigned long*>(tss->tss_bitmap), port, len);
-        }
     } while (0);
 
-    // Let all other CPUs know about the update
+    // Let the cpus that have the ports open, or are running in the aspace
+    // (including this one), know about the update.  The fence orders the
+    // bitmap's publication before reading who to tell.
     if (status == NO_ERROR) {
-        struct ioport_update_context task_context = {.aspace = as};
-        mp_sync_exec(MP_CPU_ALL_BUT_LOCAL, ioport_update_task, &task_context);
+        smp_mb();
+        mp_cpu_mask_t target = static_cast<mp_cpu_mask_t>(as->io_bitmap_cpus | as->active_cpus);
+        struct ioport_update_context task_context = {.aspace = as, .port = port, .len = len};
+        mp_sync_exec(target, ioport_update_task, &task_context);
     }
 
     arch_interrupt_restore(state, 0);
     return status;
 }
 
+static void ioport_release_task(void* raw_context) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    struct x86_percpu* percpu = x86_get_percpu();
+    if (percpu->io_bitmap_aspace == raw_context) {
+        io_bitmap_unload(percpu);
+    }
+}
+
+void x86_release_io_bitmap(struct arch_aspace* aspace) {
+    DEBUG_ASSERT(aspace->active_cpus == 0);
+    mp_cpu_mask_t target = static_cast<mp_cpu_mask_t>(aspace->io_bitmap_cpus);
+    if (target != 0) {
+        mp_sync_exec(target, ioport_release_task, aspace);
+    }
+}
+
 void x86_set_tss_io_bitmap(const bitmap::RleBitmap& bitmap)
 {
     DEBUG_ASSERT(arch_ints_disabled());
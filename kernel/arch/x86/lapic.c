@@ -93,6 +93,7 @@ static void *apic_virt_base;
 
 static void apic_error_init(void);
 static void apic_timer_init(void);
+static void apic_pmi_init(void);
 
 // This function must be called once on the kernel address space
 void apic_vm_init(void)
@@ -140,6 +141,7 @@ void apic_local_init(void)
 
     apic_error_init();
     apic_timer_init();
+    apic_pmi_init();
 }
 
 uint8_t apic_local_id(void)
@@ -331,6 +333,26 @@ enum handler_return apic_timer_interrupt_handler(void) {
     return platform_handle_apic_timer_tick();
 }
 
+static void apic_pmi_init(void) {
+    *LVT_PERF_ADDR = LVT_VECTOR(X86_INT_APIC_PMI) | LVT_MASKED;
+}
+
+void apic_pmi_mask(void) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, 0);
+    *LVT_PERF_ADDR |= LVT_MASKED;
+    arch_interrupt_restore(state, 0);
+}
+
+// Delivering a PMI masks it again, so the handler has to call this to get
+// the next one.
+void apic_pmi_unmask(void) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, 0);
+    *LVT_PERF_ADDR &= ~LVT_MASKED;
+    arch_interrupt_restore(state, 0);
+}
+
 static void apic_error_init(void) {
     *LVT_ERROR_ADDR = LVT_VECTOR(X86_INT_APIC_ERROR);
     // Re-arm the error interrupt triggering mechanism
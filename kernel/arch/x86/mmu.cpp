@@ -14,6 +14,7 @@
 #include <arch/x86.h>
 #include <arch/x86/descriptor.h>
 #include <arch/x86/feature.h>
+#include <arch/x86/ioport.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
 #include <kernel/mp.h>
@@ -36,6 +37,79 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+#if ARCH_X86_64
+/* True if user aspaces are tagged with process-context identifiers, so that
+ * switching between them doesn't need to flush the TLB. */
+static bool use_pcid = false;
+
+/* Set in a cr3 load to keep the TLB entries tagged with the new PCID */
+#define X86_CR3_NOFLUSH (1UL << 63)
+
+/* PCID 0 is used by the kernel aspace and by any aspace that couldn't get
+ * one of its own; it is flushed on every load.
+ *
+ * A cpu may hold TLB entries for an aspace it is no longer running.  Rather
+ * than interrupting it on every shootdown, such a cpu gets its bit in
+ * pcid_stale set and flushes the PCID the next time it switches to it. */
+static constexpr uint kNumPcids = 4096;
+static spin_lock_t pcid_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint64_t pcid_allocated[kNumPcids / 64];
+static uint pcid_next = 1;
+static uint64_t pcid_stale[SMP_MAX_CPUS][kNumPcids / 64];
+
+static uint16_t x86_pcid_alloc(void) {
+    uint16_t pcid = 0;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&pcid_lock, state);
+    for (uint i = 0; i < kNumPcids - 1; i++) {
+        uint candidate = pcid_next;
+        pcid_next = (pcid_next == kNumPcids - 1) ? 1 : pcid_next + 1;
+        if (!(pcid_allocated[candidate / 64] & (1ULL << (candidate % 64)))) {
+            pcid_allocated[candidate / 64] |= 1ULL << (candidate % 64);
+            pcid = (uint16_t)candidate;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pcid_lock, state);
+
+    return pcid;
+}
+
+/* Marks |pcid| as possibly holding stale translations on the cpus in |mask| */
+static void x86_pcid_mark_stale(uint16_t pcid, mp_cpu_mask_t mask) {
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (mask & (1U << cpu)) {
+            __atomic_fetch_or(&pcid_stale[cpu][pcid / 64], 1ULL << (pcid % 64),
+                              __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+static bool x86_pcid_test_and_clear_stale(uint cpu, uint16_t pcid) {
+    uint64_t bit = 1ULL << (pcid % 64);
+    if (!(__atomic_load_n(&pcid_stale[cpu][pcid / 64], __ATOMIC_SEQ_CST) & bit)) {
+        return false;
+    }
+    __atomic_fetch_and(&pcid_stale[cpu][pcid / 64], ~bit, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+static void x86_pcid_free(uint16_t pcid) {
+    if (pcid == 0) {
+        return;
+    }
+
+    /* whoever gets it next must not see this aspace's translations */
+    x86_pcid_mark_stale(pcid, ~(mp_cpu_mask_t)0);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&pcid_lock, state);
+    pcid_allocated[pcid / 64] &= ~(1ULL << (pcid % 64));
+    spin_unlock_irqrestore(&pcid_lock, state);
+}
+#endif
+
 #if ARCH_X86_64
 /* top level kernel page tables, initialized in start.S */
 pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
@@ -340,73 +414,289 @@ static void tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+// Number of pages a PendingTlbInvalidation will invalidate one at a time.
+// Past this it's cheaper to flush the whole TLB than to invlpg every page.
+static constexpr size_t kMaxPendingTlbInvalidations = 32;
+
+// Collects the TLB invalidations needed by a whole map/unmap/protect operation
+// so they can be done with a single round of IPIs once the page tables have
+// been updated. Page tables unlinked by the operation are held here as well, and
+// only freed once no cpu can still be walking them through a stale paging
+// structure cache entry.
+//
+// A large map operation also sets aside the new page tables it is going to
+// need up front, so they are allocated in one batch rather than one at a time
+// as the walk finds it needs them. Whatever it doesn't use goes back to the
+// page table cache along with the freed tables.
+struct PendingTlbInvalidation {
+    PendingTlbInvalidation() {
+        list_initialize(&freed_page_tables);
+        list_initialize(&reserved_page_tables);
+    }
+    ~PendingTlbInvalidation() { DEBUG_ASSERT(is_empty()); }
+
+    // Queue the invalidation of a vaddr mapped at the given level.
+    void enqueue(vaddr_t vaddr, page_table_levels level, bool is_global_page);
+    // Free a page table after the invalidations have been performed.
+    void free_page_table(pt_entry_t* table);
+    // Set aside count zeroed page tables for the operation to use.
+    void reserve_page_tables(size_t count);
+
+    bool is_empty() {
+        return count == 0 && !full_shootdown && list_is_empty(&freed_page_tables) &&
+               list_is_empty(&reserved_page_tables);
+    }
+
+    // Number of valid entries in vaddrs.
+    size_t count = 0;
+    // If true, ignore vaddrs and flush everything.
+    bool full_shootdown = false;
+    // If true, at least one of the entries is a global mapping.
+    bool contains_global = false;
+    vaddr_t vaddrs[kMaxPendingTlbInvalidations];
+    struct list_node freed_page_tables;
+    struct list_node reserved_page_tables;
+};
+
+// Each cpu keeps a stock of zeroed page tables, so that building up an address
+// space doesn't go to the pmm for every table it adds, and tables freed by
+// unmaps and destroyed address spaces get reused without a trip back through
+// it. A cache is only touched by its own cpu, with interrupts disabled.
+struct PageTableCache {
+    struct list_node pages;
+    size_t count;
+} __CPU_ALIGN;
+
+static PageTableCache page_table_cache[SMP_MAX_CPUS];
+
+// Most tables a cpu holds on to, and how many it takes from the pmm at once
+// when it runs out.
+static constexpr size_t kPageTableCacheMax = 64;
+static constexpr size_t kPageTableCacheRefill = 16;
+
+// Maps of at least this many pages count the page tables they need and
+// reserve them before walking.
+static constexpr size_t kPageTableReserveMinPages = 512;
+
+static void page_table_cache_init() {
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        list_initialize(&page_table_cache[i].pages);
+        page_table_cache[i].count = 0;
+    }
+}
+
+// Take up to count tables from this cpu's cache, adding them to list.
+static size_t page_table_cache_take(size_t count, struct list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, 0);
+
+    PageTableCache* cache = &page_table_cache[arch_curr_cpu_num()];
+    size_t taken = 0;
+    vm_page_t* p;
+    while (taken < count &&
+           (p = list_remove_head_type(&cache->pages, vm_page_t, free.node)) != nullptr) {
+        list_add_tail(list, &p->free.node);
+        cache->count--;
+        taken++;
+    }
+
+    arch_interrupt_restore(state, 0);
+    return taken;
+}
+
+// Give zeroed page tables back to this cpu's cache, freeing any it has no room for.
+static void page_table_cache_put(struct list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, 0);
+
+    PageTableCache* cache = &page_table_cache[arch_curr_cpu_num()];
+    vm_page_t* p;
+    while (cache->count < kPageTableCacheMax &&
+           (p = list_remove_head_type(list, vm_page_t, free.node)) != nullptr) {
+        p->state = VM_PAGE_STATE_MMU;
+        list_add_head(&cache->pages, &p->free.node);
+        cache->count++;
+    }
+
+    arch_interrupt_restore(state, 0);
+
+    if (!list_is_empty(list)) {
+        pmm_free(list);
+    }
+}
+
+// Get count zeroed page tables from this cpu's cache and then the pmm, adding
+// them to list. Returns how many it got.
+static size_t page_table_cache_get(size_t count, struct list_node* list) {
+    size_t got = page_table_cache_take(count, list);
+    if (got == count) {
+        return got;
+    }
+
+    // Refill the cache in the same trip to the pmm.
+    struct list_node fresh = LIST_INITIAL_VALUE(fresh);
+    size_t want = count - got;
+    size_t allocated = pmm_alloc_pages(want + kPageTableCacheRefill, PMM_ALLOC_FLAG_ZEROED,
+                                       &fresh);
+    vm_page_t* p;
+    while (got < count && (p = list_remove_head_type(&fresh, vm_page_t, free.node)) != nullptr) {
+        p->state = VM_PAGE_STATE_MMU;
+        list_add_tail(list, &p->free.node);
+        got++;
+    }
+    if (allocated > want) {
+        page_table_cache_put(&fresh);
+    }
+    return got;
+}
+
+void PendingTlbInvalidation::enqueue(vaddr_t vaddr, page_table_levels level,
+                                     bool is_global_page) {
+    if (is_global_page) {
+        contains_global = true;
+    }
+
+#if X86_PAGING_LEVELS > 3
+    // invlpg can't be targeted at a whole pml4 entry
+    if (level == PML4_L) {
+        full_shootdown = true;
+    }
+#endif
+
+    if (full_shootdown) {
+        return;
+    }
+    if (count == kMaxPendingTlbInvalidations) {
+        full_shootdown = true;
+        return;
+    }
+    vaddrs[count++] = vaddr;
+}
+
+void PendingTlbInvalidation::free_page_table(pt_entry_t* table) {
+    vm_page_t* page = paddr_to_vm_page(X86_VIRT_TO_PHYS(table));
+    DEBUG_ASSERT(page);
+
+#if LK_DEBUGLEVEL > 1
+    // Tables are only unlinked once everything in them has been unmapped,
+    // which is what lets them go back in the cache as they are.
+    for (uint i = 0; i < NO_OF_PT_ENTRIES; ++i) {
+        DEBUG_ASSERT(table[i] == 0);
+    }
+#endif
+
+    list_add_tail(&freed_page_tables, &page->free.node);
+}
+
+void PendingTlbInvalidation::reserve_page_tables(size_t count) {
+    page_table_cache_get(count, &reserved_page_tables);
+}
+
+/* Task used for invalidating TLB entries on each CPU */
+struct tlb_invalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    uint16_t target_pcid;
+    const PendingTlbInvalidation* pending;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+static void tlb_invalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    tlb_invalidate_context* context = (tlb_invalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    if (context->target_cr3 != (cr3 & X86_PG_FRAME) && !pending->contains_global) {
+#if ARCH_X86_64
+        /* This cpu left the aspace after it was targeted, but may still have
+         * its translations cached under its PCID. */
+        if (context->target_pcid != 0) {
+            x86_pcid_mark_stale(context->target_pcid, 1U << arch_curr_cpu_num());
+        }
+#endif
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-#if X86_PAGING_LEVELS > 3
-        case PML4_L:
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
             tlb_global_invalidate();
-            break;
-#endif
-#if X86_PAGING_LEVELS > 2
-        case PDP_L:
-#endif
-        case PD_L:
-        case PT_L:
-            __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-            break;
+        } else {
+            /* reloading cr3 drops all of the non-global entries */
+            x86_set_cr3(cr3);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pending->count; ++i) {
+        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)pending->vaddrs[i]));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of TLB invalidations
  *
- * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * Sends at most one IPI to each cpu that might be caching the entries, then
+ * frees any page tables the operation unlinked.  Leaves |pending| empty.
  *
- * TODO(teisenbe): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
+ * @param pending The invalidations to perform
  */
-void x86_tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
+static void x86_tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
+#if ARCH_X86_64
+    /* Kernel translations may be cached under every PCID, and invlpg only
+     * drops the paging-structure caches of the current one, so freeing a
+     * kernel page table needs a flush of all of them. */
+    if (use_pcid && !list_is_empty(&pending->freed_page_tables) &&
+        (aspace == NULL || (aspace->flags & ARCH_ASPACE_FLAG_KERNEL))) {
+        pending->full_shootdown = true;
+        pending->contains_global = true;
+    }
+#endif
 
-    /* Target only CPUs this aspace is active on.  It may be the case that some
-     * other CPU will become active in it after this load, or will have left it
-     * just before this load.  In the former case, it is becoming active after
-     * the write to the page table, so it will see the change.  In the latter
-     * case, it will get a spurious request to flush. */
-    mp_cpu_mask_t targets;
-    if (global_page || aspace == NULL) {
-        targets = MP_CPU_ALL;
-    } else {
-        targets = atomic_load(&aspace->active_cpus);
-        static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+    if (pending->count > 0 || pending->full_shootdown) {
+        ulong cr3 = aspace ? aspace->pt_phys : (x86_get_cr3() & X86_PG_FRAME);
+        uint16_t pcid = aspace ? aspace->pcid : 0;
+        struct tlb_invalidate_context task_context = {
+            .target_cr3 = cr3, .target_pcid = pcid, .pending = pending,
+        };
+
+        /* Target only CPUs this aspace is active on.  It may be the case that some
+         * other CPU will become active in it after this load, or will have left it
+         * just before this load.  In the former case, it is becoming active after
+         * the write to the page table, so it will see the change.  In the latter
+         * case, it will get a spurious request to flush. */
+        mp_cpu_mask_t targets;
+        if (pending->contains_global || aspace == NULL) {
+            targets = MP_CPU_ALL;
+        } else {
+            targets = atomic_load(&aspace->active_cpus);
+            static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+#if ARCH_X86_64
+            if (pcid != 0) {
+                /* Every other cpu may still have entries tagged with this
+                 * PCID; make them flush before using it again.  A cpu that
+                 * joins before the mark lands is caught by the second load
+                 * of active_cpus, and one that leaves in between is still
+                 * targeted and marks itself in tlb_invalidate_task. */
+                x86_pcid_mark_stale(pcid, ~targets);
+                smp_mb();
+                targets |= atomic_load(&aspace->active_cpus);
+            }
+#endif
+        }
+
+        mp_sync_exec(targets, tlb_invalidate_task, &task_context);
+    }
+
+    if (!list_is_empty(&pending->freed_page_tables)) {
+        page_table_cache_put(&pending->freed_page_tables);
+    }
+    if (!list_is_empty(&pending->reserved_page_tables)) {
+        page_table_cache_put(&pending->reserved_page_tables);
     }
 
-    mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
+    pending->count = 0;
+    pending->full_shootdown = false;
+    pending->contains_global = false;
 }
 
 struct MappingCursor {
@@ -417,7 +707,7 @@ struct MappingCursor {
 
 template <int Level>
 static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, paddr_t paddr,
-                         arch_flags_t flags) {
+                         arch_flags_t flags, PendingTlbInvalidation* pending) {
 
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
@@ -430,12 +720,13 @@ static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte,
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        x86_tlb_invalidate_page(aspace, vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
+        pending->enqueue(vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
     }
 }
 
 template <int Level>
-static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, bool flush) {
+static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, bool flush,
+                        PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
@@ -444,32 +735,36 @@ static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, b
 
     /* attempt to invalidate the page */
     if (flush && IS_PAGE_PRESENT(olde)) {
-        x86_tlb_invalidate_page(aspace, vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
+        pending->enqueue(vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
     }
 }
 
 /**
  * @brief Allocating a new page table
+ *
+ * Comes out of the operation's reserve if it made one, and otherwise the
+ * page table cache.
  */
-static pt_entry_t* _map_alloc_page(void) {
-    vm_page_t *p;
-
-    pt_entry_t* page_ptr = static_cast<pt_entry_t*>(pmm_alloc_kpage(nullptr, &p));
-    DEBUG_ASSERT(page_ptr);
-    if (!page_ptr)
-        return nullptr;
-
-    arch_zero_page(page_ptr);
-    p->state = VM_PAGE_STATE_MMU;
+static pt_entry_t* _map_alloc_page(PendingTlbInvalidation* pending) {
+    vm_page_t* p = list_remove_head_type(&pending->reserved_page_tables, vm_page_t, free.node);
+    if (!p) {
+        struct list_node list = LIST_INITIAL_VALUE(list);
+        if (page_table_cache_get(1, &list) == 0) {
+            return nullptr;
+        }
+        p = list_remove_head_type(&list, vm_page_t, free.node);
+    }
+    DEBUG_ASSERT(p->state == VM_PAGE_STATE_MMU);
 
-    return page_ptr;
+    return static_cast<pt_entry_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
 }
 
 /*
  * @brief Split the given large page into smaller pages
  */
 template <int Level>
-static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte,
+                              PendingTlbInvalidation* pending) {
     static_assert(Level != PT_L, "tried splitting PT_L");
 #if X86_PAGING_LEVELS > 3
     // This can't easily be a static assert without duplicating
@@ -479,7 +774,7 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t*
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, Level);
 
     DEBUG_ASSERT(IS_PAGE_PRESENT(*pte) && IS_LARGE_PAGE(*pte));
-    pt_entry_t* m = _map_alloc_page();
+    pt_entry_t* m = _map_alloc_page(pending);
     if (m == NULL) {
         return ERR_NO_MEMORY;
     }
@@ -508,14 +803,14 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t*
         pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<Level - 1>(aspace, new_vaddr, e, new_paddr, flags);
+        update_entry<Level - 1>(aspace, new_vaddr, e, new_paddr, flags, pending);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + page_size<Level>());
 
     flags = get_x86_intermediate_arch_flags();
-    update_entry<Level>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<Level>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags, pending);
     return NO_ERROR;
 }
 
@@ -612,7 +907,7 @@ status_t x86_mmu_get_mapping<PT_L>(pt_entry_t* table, vaddr_t vaddr,
  */
 template <int Level>
 static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table, const MappingCursor& start_cursor,
-                                   MappingCursor* new_cursor) {
+                                   MappingCursor* new_cursor, PendingTlbInvalidation* pending) {
     static_assert(Level >= 0, "level too low");
     static_assert(Level < X86_PAGING_LEVELS, "level too high");
 
@@ -648,7 +943,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table, con
             bool vaddr_level_aligned = page_aligned<Level>(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<Level>(aspace, new_cursor->vaddr, e, true);
+                unmap_entry<Level>(aspace, new_cursor->vaddr, e, true, pending);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -658,7 +953,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table, con
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<Level>(aspace, page_vaddr, e);
+            status_t status = x86_mmu_split<Level>(aspace, page_vaddr, e, pending);
             if (status != NO_ERROR) {
                 panic("Need to implement recovery from split failure");
             }
@@ -667,7 +962,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table, con
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         bool lower_unmapped = x86_mmu_remove_mapping<Level - 1>(
-                aspace, next_table, *new_cursor, &cursor);
+                aspace, next_table, *new_cursor, &cursor, pending);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -687,8 +982,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table, con
             }
         }
         if (unmap_page_table) {
-            unmap_entry<Level>(aspace, new_cursor->vaddr, e, false);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<Level>(aspace, new_cursor->vaddr, e, false, pending);
+            pending->free_page_table(next_table);
             unmapped = true;
         }
         *new_cursor = cursor;
@@ -703,7 +998,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table, con
 // Base case of x86_remove_mapping for smallest page size
 template <>
 bool x86_mmu_remove_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, const MappingCursor& start_cursor,
-                                  MappingCursor* new_cursor) {
+                                  MappingCursor* new_cursor, PendingTlbInvalidation* pending) {
 
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -715,7 +1010,7 @@ bool x86_mmu_remove_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, cons
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PT_L>(aspace, new_cursor->vaddr, e, true);
+            unmap_entry<PT_L>(aspace, new_cursor->vaddr, e, true, pending);
             unmapped = true;
         }
 
@@ -744,7 +1039,8 @@ bool x86_mmu_remove_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, cons
  */
 template <int Level>
 static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
-                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                    PendingTlbInvalidation* pending) {
     static_assert(Level >= 0, "level too low");
     static_assert(Level < X86_PAGING_LEVELS, "level too high");
 
@@ -776,7 +1072,7 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
             level_paligned && new_cursor->size >= ps) {
 
             update_entry<Level>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
-                                arch_flags | X86_MMU_PG_PS);
+                                arch_flags | X86_MMU_PG_PS, pending);
 
             new_cursor->paddr += ps;
             new_cursor->vaddr += ps;
@@ -785,7 +1081,7 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
         } else {
             // See if we need to create a new table
             if (!IS_PAGE_PRESENT(*e)) {
-                pt_entry_t* m = _map_alloc_page();
+                pt_entry_t* m = _map_alloc_page(pending);
                 if (m == NULL) {
                     ret = ERR_NO_MEMORY;
                     goto err;
@@ -794,12 +1090,12 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, Level);
 
                 update_entry<Level>(aspace, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
-                                    interm_arch_flags);
+                                    interm_arch_flags, pending);
             }
 
             MappingCursor cursor;
             ret = x86_mmu_add_mapping<Level - 1>(aspace, get_next_table_from_entry(*e), mmu_flags,
-                                                 *new_cursor, &cursor);
+                                                 *new_cursor, &cursor, pending);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != NO_ERROR) {
@@ -815,7 +1111,7 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(aspace, table, cursor, &result);
+            x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(aspace, table, cursor, &result, pending);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -825,7 +1121,8 @@ err:
 // Base case of x86_mmu_add_mapping for smallest page size
 template <>
 status_t x86_mmu_add_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
-                                   const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                   const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                   PendingTlbInvalidation* pending) {
 
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -840,7 +1137,8 @@ status_t x86_mmu_add_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, uin
             return ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PT_L>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr, arch_flags);
+        update_entry<PT_L>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr, arch_flags,
+                           pending);
 
         new_cursor->paddr += PAGE_SIZE;
         new_cursor->vaddr += PAGE_SIZE;
@@ -851,6 +1149,59 @@ status_t x86_mmu_add_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, uin
     return NO_ERROR;
 }
 
+/**
+ * @brief Count the page tables x86_mmu_add_mapping would have to add
+ *
+ * Makes the same choices between large pages and tables that
+ * x86_mmu_add_mapping does, without changing anything.
+ *
+ * @param table The paging structure at this level, or NULL if it would be new
+ * @param start_cursor The range that is going to be mapped
+ *
+ * @return The number of new page tables below table
+ */
+template <int Level>
+static size_t x86_mmu_count_new_tables(pt_entry_t* table, const MappingCursor& start_cursor) {
+    MappingCursor cursor = start_cursor;
+    size_t count = 0;
+
+    size_t ps = page_size<Level>();
+    bool level_supports_large_pages = level_supports_ps(static_cast<page_table_levels>(Level));
+    uint index = vaddr_to_index<Level>(cursor.vaddr);
+    for (; index != NO_OF_PT_ENTRIES && cursor.size != 0; ++index) {
+        pt_entry_t e = table ? table[index] : 0;
+        // The mapping is going to fail here
+        if (IS_PAGE_PRESENT(e) && IS_LARGE_PAGE(e)) {
+            break;
+        }
+
+        size_t chunk = MIN(ps - (cursor.vaddr & (ps - 1)), cursor.size);
+        bool large_page = level_supports_large_pages && !IS_PAGE_PRESENT(e) &&
+                          page_aligned<Level>(cursor.vaddr) &&
+                          page_aligned<Level>(cursor.paddr) && cursor.size >= ps;
+        if (!large_page) {
+            if (!IS_PAGE_PRESENT(e)) {
+                count++;
+            }
+            MappingCursor sub_cursor = {
+                .paddr = cursor.paddr, .vaddr = cursor.vaddr, .size = chunk,
+            };
+            count += x86_mmu_count_new_tables<Level - 1>(get_next_table_from_entry(e), sub_cursor);
+        }
+
+        cursor.paddr += chunk;
+        cursor.vaddr += chunk;
+        cursor.size -= chunk;
+    }
+    return count;
+}
+
+// Base case of x86_mmu_count_new_tables, page table entries map pages
+template <>
+size_t x86_mmu_count_new_tables<PT_L>(pt_entry_t* table, const MappingCursor& start_cursor) {
+    return 0;
+}
+
 /**
  * @brief Changes the permissions/caching of the range specified by start_cursor
  *
@@ -866,7 +1217,8 @@ status_t x86_mmu_add_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, uin
 template <int Level>
 static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     static_assert(Level >= 0, "level too low");
     static_assert(Level < X86_PAGING_LEVELS, "level too high");
 
@@ -903,7 +1255,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
                 update_entry<Level>(aspace, new_cursor->vaddr, e, paddr_from_pte<Level>(*e),
-                                    arch_flags | X86_MMU_PG_PS);
+                                    arch_flags | X86_MMU_PG_PS, pending);
 
                 new_cursor->vaddr += ps;
                 new_cursor->size -= ps;
@@ -912,7 +1264,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<Level>(aspace, page_vaddr, e);
+            ret = x86_mmu_split<Level>(aspace, page_vaddr, e, pending);
             if (ret != NO_ERROR) {
                 goto err;
             }
@@ -920,7 +1272,8 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
 
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
-        ret = x86_mmu_update_mapping<Level - 1>(aspace, next_table, mmu_flags, *new_cursor, &cursor);
+        ret = x86_mmu_update_mapping<Level - 1>(aspace, next_table, mmu_flags, *new_cursor, &cursor,
+                                                pending);
         *new_cursor = cursor;
         if (ret != NO_ERROR) {
             goto err;
@@ -939,7 +1292,8 @@ err:
 template <>
 status_t x86_mmu_update_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                       const MappingCursor& start_cursor,
-                                      MappingCursor* new_cursor) {
+                                      MappingCursor* new_cursor,
+                                      PendingTlbInvalidation* pending) {
 
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -953,7 +1307,8 @@ status_t x86_mmu_update_mapping<PT_L>(arch_aspace_t* aspace, pt_entry_t* table,
         pt_entry_t* e = table + index;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(*e)) {
-            update_entry<PT_L>(aspace, new_cursor->vaddr, e, paddr_from_pte<PT_L>(*e), arch_flags);
+            update_entry<PT_L>(aspace, new_cursor->vaddr, e, paddr_from_pte<PT_L>(*e), arch_flags,
+                               pending);
         }
 
         new_cursor->vaddr += PAGE_SIZE;
@@ -980,7 +1335,9 @@ int arch_mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, size_t count) {
     };
 
     MappingCursor result;
-    x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(aspace, aspace->pt_virt, start, &result);
+    PendingTlbInvalidation pending;
+    x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(aspace, aspace->pt_virt, start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     DEBUG_ASSERT(result.size == 0);
     return NO_ERROR;
 }
@@ -1006,8 +1363,14 @@ int arch_mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, size_t cou
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
+    if (count >= kPageTableReserveMinPages) {
+        pending.reserve_page_tables(
+            x86_mmu_count_new_tables<MAX_PAGING_LEVEL>(aspace->pt_virt, start));
+    }
     status_t status = x86_mmu_add_mapping<MAX_PAGING_LEVEL>(aspace, aspace->pt_virt, flags,
-                                                            start, &result);
+                                                            start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1033,8 +1396,10 @@ int arch_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count, uint fl
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     status_t status = x86_mmu_update_mapping<MAX_PAGING_LEVEL>(aspace, aspace->pt_virt,
-                                                               flags, start, &result);
+                                                               flags, start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         return status;
     }
@@ -1043,12 +1408,18 @@ int arch_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count, uint fl
 }
 
 void x86_mmu_early_init() {
+    page_table_cache_init();
     x86_mmu_mem_type_init();
+#if ARCH_X86_64
+    use_pcid = x86_feature_test(X86_FEATURE_PCID);
+#endif
     x86_mmu_percpu_init();
 
 #if ARCH_X86_64
     /* unmap the lower identity mapping */
-    unmap_entry<PML4_L>(nullptr, 0, &pml4[0], true);
+    PendingTlbInvalidation pending;
+    unmap_entry<PML4_L>(nullptr, 0, &pml4[0], true, &pending);
+    x86_tlb_invalidate(nullptr, &pending);
 #else
     /* unmap the lower identity mapping */
     for (uint i = 0; i < (1 * GB) / (4 * MB); i++) {
@@ -1089,6 +1460,7 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
     aspace->flags = flags;
     aspace->base = base;
     aspace->size = size;
+    aspace->pcid = 0;
     if (flags & ARCH_ASPACE_FLAG_KERNEL) {
         aspace->pt_phys = kernel_pt_phys;
         aspace->pt_virt = (pt_entry_t*)X86_PHYS_TO_VIRT(aspace->pt_phys);
@@ -1098,31 +1470,31 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
         /* not fully functional on 32bit x86 */
         return ERR_NOT_SUPPORTED;
 #else
-        /* allocate a top level page table for the new address space */
-        paddr_t pa;
-        vm_page_t *p;
-        aspace->pt_virt = (pt_entry_t*)pmm_alloc_kpage(&pa, &p);
-        if (!aspace->pt_virt) {
+        /* allocate a top level page table for the new address space, its
+         * user space half comes zeroed out of the page table cache */
+        struct list_node list = LIST_INITIAL_VALUE(list);
+        if (page_table_cache_get(1, &list) == 0) {
             TRACEF("error allocating top level page directory\n");
             return ERR_NO_MEMORY;
         }
-        aspace->pt_phys = pa;
-
-        p->state = VM_PAGE_STATE_MMU;
-
-        /* zero out the user space half of it */
-        memset(aspace->pt_virt, 0, sizeof(pt_entry_t) * NO_OF_PT_ENTRIES / 2);
+        vm_page_t* p = list_remove_head_type(&list, vm_page_t, free.node);
+        aspace->pt_phys = vm_page_to_paddr(p);
+        aspace->pt_virt = (pt_entry_t*)paddr_to_kvaddr(aspace->pt_phys);
 
         /* copy the kernel portion of it from the master kernel pt */
         memcpy(aspace->pt_virt + NO_OF_PT_ENTRIES / 2, &KERNEL_PT[NO_OF_PT_ENTRIES / 2],
                sizeof(pt_entry_t) * NO_OF_PT_ENTRIES / 2);
 
+        /* running out of PCIDs isn't fatal, the aspace just flushes on every switch */
+        aspace->pcid = use_pcid ? x86_pcid_alloc() : 0;
+
         LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p\n", aspace->pt_phys, aspace->pt_virt);
 #endif
     }
     aspace->io_bitmap = nullptr;
     aspace->active_cpus = 0;
     spin_lock_init(&aspace->io_bitmap_lock);
+    aspace->io_bitmap_cpus = 0;
 
     return NO_ERROR;
 }
@@ -1151,10 +1523,20 @@ status_t arch_mmu_destroy_aspace(arch_aspace_t* aspace) {
 #endif
 
     if (aspace->io_bitmap) {
+        x86_release_io_bitmap(aspace);
         delete static_cast<bitmap::RleBitmap*>(aspace->io_bitmap);
     }
 
-    pmm_free_page(paddr_to_vm_page(aspace->pt_phys));
+#if ARCH_X86_64
+    x86_pcid_free(aspace->pcid);
+    aspace->pcid = 0;
+#endif
+
+    /* clear out the kernel half and keep the table around for the next aspace */
+    arch_zero_page(aspace->pt_virt);
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    list_add_tail(&list, &paddr_to_vm_page(aspace->pt_phys)->free.node);
+    page_table_cache_put(&list);
 
     aspace->magic = 0;
 
@@ -1166,12 +1548,24 @@ void arch_mmu_context_switch(arch_aspace_t *old_aspace, arch_aspace_t *aspace) {
     if (aspace != NULL) {
         DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
         LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, aspace->pt_phys);
-        x86_set_cr3(aspace->pt_phys);
+        ulong cr3 = aspace->pt_phys;
 
-        if (old_aspace != NULL) {
+        /* Become visible to shootdowns before deciding whether the cached
+         * translations are still good. */
+        atomic_or(&aspace->active_cpus, cpu_bit);
+#if ARCH_X86_64
+        if (aspace->pcid != 0) {
+            cr3 |= aspace->pcid;
+            if (!x86_pcid_test_and_clear_stale(arch_curr_cpu_num(), aspace->pcid)) {
+                cr3 |= X86_CR3_NOFLUSH;
+            }
+        }
+#endif
+        x86_set_cr3(cr3);
+
+        if (old_aspace != NULL && old_aspace != aspace) {
             atomic_and(&old_aspace->active_cpus, ~cpu_bit);
         }
-        atomic_or(&aspace->active_cpus, cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
         x86_set_cr3(kernel_pt_phys);
@@ -1180,18 +1574,10 @@ void arch_mmu_context_switch(arch_aspace_t *old_aspace, arch_aspace_t *aspace) {
         }
     }
 
-    /* Cleanup io bitmap entries from previous thread */
-    if (old_aspace && old_aspace->io_bitmap) {
-        spin_lock(&old_aspace->io_bitmap_lock);
-        x86_clear_tss_io_bitmap(*static_cast<bitmap::RleBitmap*>(old_aspace->io_bitmap));
-        spin_unlock(&old_aspace->io_bitmap_lock);
-    }
-
-    /* Set the io bitmap for this thread */
-    if (aspace && aspace->io_bitmap) {
-        spin_lock(&aspace->io_bitmap_lock);
-        x86_set_tss_io_bitmap(*static_cast<bitmap::RleBitmap*>(aspace->io_bitmap));
-        spin_unlock(&aspace->io_bitmap_lock);
+    /* Kernel threads can't use the io ports, so whichever are open stay
+     * open until the next user aspace, which is often the one they are for. */
+    if (aspace) {
+        x86_load_io_bitmap(aspace);
     }
 }
 
@@ -1259,6 +1645,11 @@ void x86_mmu_percpu_init(void) {
     ulong cr4 = x86_get_cr4();
     if (x86_feature_test(X86_FEATURE_SMEP)) cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP)) cr4 |= X86_CR4_SMAP;
+#if ARCH_X86_64
+    /* cr3 must not carry a PCID yet, which holds since only the kernel
+     * aspace has been loaded at this point */
+    if (use_pcid) cr4 |= X86_CR4_PCIDE;
+#endif
     x86_set_cr4(cr4);
 
     /* Set NXE bit in MSR_EFER*/
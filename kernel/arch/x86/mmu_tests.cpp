@@ -93,6 +93,47 @@ static bool mmu_tests(void* context) {
         err = arch_mmu_destroy_aspace(&aspace);
         EXPECT_EQ(err, NO_ERROR, "destroy aspace");
     }
+
+    unittest_printf("protecting and unmapping more pages than fit in one shootdown batch\n");
+    {
+        arch_aspace_t aspace;
+        vaddr_t base = 1UL << 20;
+        size_t size = (1UL << 47) - base - (1UL << 20);
+        status_t err = arch_mmu_init_aspace(&aspace, 1UL << 20, size, 0);
+        EXPECT_EQ(err, NO_ERROR, "init aspace");
+
+        const uint arch_rw_flags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+
+        // Enough 4k pages to spill into the full flush fallback, and to span
+        // two page tables.
+        vaddr_t va = (1UL << PD_SHIFT) - 8 * PAGE_SIZE;
+        static const size_t count = 100;
+
+        err = arch_mmu_map(&aspace, va, 0, count, arch_rw_flags);
+        EXPECT_EQ(err, NO_ERROR, "map pages");
+
+        err = arch_mmu_protect(&aspace, va, count, ARCH_MMU_FLAG_PERM_READ);
+        EXPECT_EQ(err, NO_ERROR, "protect pages");
+
+        paddr_t pa;
+        uint flags;
+        for (size_t i = 0; i < count; i++) {
+            err = arch_mmu_query(&aspace, va + i * PAGE_SIZE, &pa, &flags);
+            EXPECT_EQ(err, NO_ERROR, "page is mapped");
+            EXPECT_EQ(flags & ARCH_MMU_FLAG_PERM_WRITE, 0u, "page is read only");
+        }
+
+        err = arch_mmu_unmap(&aspace, va, count);
+        EXPECT_EQ(err, NO_ERROR, "unmap pages");
+
+        for (size_t i = 0; i < count; i++) {
+            err = arch_mmu_query(&aspace, va + i * PAGE_SIZE, &pa, &flags);
+            EXPECT_EQ(err, ERR_NOT_FOUND, "page is not mapped anymore");
+        }
+
+        err = arch_mmu_destroy_aspace(&aspace);
+        EXPECT_EQ(err, NO_ERROR, "destroy aspace");
+    }
 #endif
 
     unittest_printf("done with mmu tests\n");
@@ -26,6 +26,7 @@
 #include <arch/x86/tsc.h>
 #include <dev/interrupt.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/timer.h>
 #include <platform.h>
 
@@ -40,6 +41,34 @@ struct x86_percpu bp_percpu = {
 static struct x86_percpu *ap_percpus;
 uint8_t x86_num_cpus = 1;
 
+#if WITH_SMP
+/* tell the scheduler which cpus share a core and which share a package */
+static void x86_init_cpu_domains(uint32_t bootstrap_apic_id, uint cpu_count)
+{
+    x86_cpu_topology_t topo[SMP_MAX_CPUS];
+
+    DEBUG_ASSERT(cpu_count <= SMP_MAX_CPUS);
+
+    for (uint i = 0; i < cpu_count; ++i) {
+        uint32_t apic_id = (i == 0) ? bootstrap_apic_id : ap_percpus[i - 1].apic_id;
+        x86_cpu_topology_decode(apic_id, &topo[i]);
+    }
+
+    for (uint i = 0; i < cpu_count; ++i) {
+        mp_cpu_mask_t smt = 0;
+        mp_cpu_mask_t package = 0;
+        for (uint j = 0; j < cpu_count; ++j) {
+            if (topo[j].package_id != topo[i].package_id)
+                continue;
+            package |= 1u << j;
+            if (topo[j].core_id == topo[i].core_id)
+                smt |= 1u << j;
+        }
+        mp_set_cpu_domains(i, smt, package);
+    }
+}
+#endif
+
 status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count)
 {
     ASSERT(ap_percpus == NULL);
@@ -75,6 +104,9 @@ status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count)
     }
 
     x86_num_cpus = cpu_count;
+#if WITH_SMP
+    x86_init_cpu_domains(bootstrap_ap, cpu_count);
+#endif
     return NO_ERROR;
 }
 
@@ -109,6 +141,7 @@ void x86_init_percpu(uint8_t cpu_num)
     idt_load(&percpu->idt);
 
     x86_initialize_percpu_tss();
+    percpu->io_bitmap_aspace = NULL;
 
     // Apply any timestamp counter adjustment to keep a continuous clock across
     // suspend/resume.
@@ -178,6 +211,17 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id)
     return -1;
 }
 
+uint32_t x86_cpu_num_to_apic_id(uint cpu_num)
+{
+    if (cpu_num == 0) {
+        return bp_percpu.apic_id;
+    }
+    if (cpu_num >= x86_num_cpus) {
+        return INVALID_APIC_ID;
+    }
+    return ap_percpus[cpu_num - 1].apic_id;
+}
+
 #if WITH_SMP
 status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
 {
@@ -196,6 +240,13 @@ status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
             panic("Unexpected MP IPI value: %u", ipi);
     }
 
+    /* idle cpus waiting on their monitor only need a store to wake them */
+    if (ipi == MP_IPI_RESCHEDULE && target != MP_CPU_ALL && target != MP_CPU_ALL_BUT_LOCAL) {
+        target = x86_idle_wake(target);
+        if (!target)
+            return NO_ERROR;
+    }
+
     if (target == MP_CPU_ALL_BUT_LOCAL) {
         apic_send_broadcast_ipi(vector, DELIVERY_MODE_FIXED);
         return NO_ERROR;
@@ -298,7 +349,7 @@ status_t arch_mp_cpu_hotplug(uint cpu_id)
 
     struct x86_percpu *percpu = &ap_percpus[cpu_id - 1];
     DEBUG_ASSERT(percpu->apic_id != INVALID_APIC_ID);
-    return x86_bringup_aps(&percpu->apic_id, 1);
+    return x86_bringup_aps(&percpu->apic_id, 1, false);
 }
 
 /* Used to suspend work on a CPU until it is further shutdown */
@@ -0,0 +1,109 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/pmu.h>
+#include <arch/x86.h>
+#include <arch/x86/apic.h>
+#include <arch/x86/feature.h>
+#include <arch/x86/perf.h>
+#include <assert.h>
+#include <err.h>
+#include <lib/ktrace.h>
+
+// Sampling with the first general purpose counter of Intel's architectural
+// performance monitoring, counting unhalted core cycles.
+
+#define IA32_PMC0                   0x0c1
+#define IA32_PERFEVTSEL0            0x186
+#define IA32_PERF_GLOBAL_CTRL       0x38f
+#define IA32_PERF_GLOBAL_OVF_CTRL   0x390
+
+#define PERFEVTSEL_UNHALTED_CYCLES  0x3c
+#define PERFEVTSEL_USR              (1u << 16)
+#define PERFEVTSEL_OS               (1u << 17)
+#define PERFEVTSEL_INT              (1u << 20)
+#define PERFEVTSEL_EN               (1u << 22)
+
+static uint32_t pmu_period;
+
+// The architectural performance monitoring version, 0 if there is no
+// counter for unhalted core cycles.
+static uint pmu_version(void)
+{
+    if (x86_vendor != X86_VENDOR_INTEL)
+        return 0;
+    const struct cpuid_leaf *leaf = x86_get_cpuid_leaf(X86_CPUID_PERFORMANCE_MONITORING);
+    if (!leaf)
+        return 0;
+    uint version = leaf->a & 0xff;
+    uint counters = (leaf->a >> 8) & 0xff;
+    // a set bit 0 of ebx says the unhalted core cycles event is missing
+    if (counters == 0 || (leaf->b & 1))
+        return 0;
+    return version;
+}
+
+// Writing the low 32 bits of the counter sign extends them, so this
+// overflows after period cycles for any period up to 2^31.
+static void pmu_reload(void)
+{
+    write_msr(IA32_PMC0, (uint32_t)-pmu_period);
+}
+
+status_t arch_pmu_start(uint32_t period)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    uint version = pmu_version();
+    if (version == 0)
+        return ERR_NOT_SUPPORTED;
+    if (period == 0 || period > INT32_MAX)
+        return ERR_INVALID_ARGS;
+
+    pmu_period = period;
+    write_msr(IA32_PERFEVTSEL0, 0);
+    pmu_reload();
+    if (version >= 2) {
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+        write_msr(IA32_PERF_GLOBAL_CTRL, read_msr(IA32_PERF_GLOBAL_CTRL) | 1);
+    }
+    apic_pmi_unmask();
+    write_msr(IA32_PERFEVTSEL0, PERFEVTSEL_UNHALTED_CYCLES | PERFEVTSEL_USR |
+              PERFEVTSEL_OS | PERFEVTSEL_INT | PERFEVTSEL_EN);
+    return NO_ERROR;
+}
+
+void arch_pmu_stop(void)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    uint version = pmu_version();
+    if (version == 0)
+        return;
+
+    write_msr(IA32_PERFEVTSEL0, 0);
+    apic_pmi_mask();
+    if (version >= 2) {
+        write_msr(IA32_PERF_GLOBAL_CTRL, read_msr(IA32_PERF_GLOBAL_CTRL) & ~1ull);
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    }
+}
+
+enum handler_return x86_pmi_handler(x86_iframe_t *frame)
+{
+    // one may still arrive after the counter was stopped
+    if (!(read_msr(IA32_PERFEVTSEL0) & PERFEVTSEL_EN))
+        return INT_NO_RESCHEDULE;
+
+    bool from_user = (frame->cs & 3) != 0;
+    ktrace_profile_sample(frame->ip, (void *)frame->rbp, from_user);
+
+    pmu_reload();
+    if (pmu_version() >= 2)
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    apic_pmi_unmask();
+    return INT_NO_RESCHEDULE;
+}
@@ -62,7 +62,6 @@ MODULE_SRCS += \
 	$(SUBARCH_DIR)/start.S \
 	$(SUBARCH_DIR)/asm.S \
 	$(SUBARCH_DIR)/exceptions.S \
-	$(SUBARCH_DIR)/ops.S \
 \
 	$(LOCAL_DIR)/arch.c \
 	$(LOCAL_DIR)/cache.c \
@@ -73,6 +72,7 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/feature.c \
 	$(LOCAL_DIR)/gdt.S \
 	$(LOCAL_DIR)/header.S \
+	$(LOCAL_DIR)/idle.c \
 	$(LOCAL_DIR)/idt.c \
 	$(LOCAL_DIR)/ioapic.c \
 	$(LOCAL_DIR)/ioport.cpp \
@@ -81,6 +81,7 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/mmu_mem_types.c \
 	$(LOCAL_DIR)/mmu_tests.cpp \
 	$(LOCAL_DIR)/mp.c \
+	$(LOCAL_DIR)/perf.c \
 	$(LOCAL_DIR)/registers.c \
 	$(LOCAL_DIR)/thread.c \
 	$(LOCAL_DIR)/tsc.c \
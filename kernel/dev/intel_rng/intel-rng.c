@@ -52,11 +52,11 @@ static ssize_t get_entropy_from_cpu(void* buf, size_t len, bool block) {
             }
             continue;
         }
-        const size_t to_copy = (len < sizeof(val)) ? len : sizeof(val);
+        const size_t to_copy = (len - written < sizeof(val)) ? len - written : sizeof(val);
         memcpy(buf + written, &val, to_copy);
         written += to_copy;
     }
-    DEBUG_ASSERT(written == len);
+    DEBUG_ASSERT(!block || written == len);
     return (ssize_t)written;
 }
 
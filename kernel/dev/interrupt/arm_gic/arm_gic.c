@@ -14,15 +14,19 @@
 #include <dev/interrupt/arm_gic.h>
 #include <dev/interrupt/arm_gic_regs.h>
 #include <reg.h>
+#include <kernel/mp.h>
 #include <kernel/thread.h>
 #include <lk/init.h>
 #include <dev/interrupt.h>
 #include <arch/ops.h>
 #include <trace.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 
 #define LOCAL_TRACE 0
 
+KCOUNTER(interrupts, "kernel.interrupts");
+
 #include <arch/arm64.h>
 #define iframe arm64_iframe_short
 #define IFRAME_PC(frame) ((frame)->elr)
@@ -250,6 +254,35 @@ status_t get_interrupt_config(unsigned int vector,
     return NO_ERROR;
 }
 
+status_t set_interrupt_affinity(unsigned int vector, uint cpu)
+{
+    if (vector >= MAX_INT)
+        return ERR_INVALID_ARGS;
+
+    /* Per-cpu interrupts always arrive at their own cpu. */
+    if (vector < GIC_MAX_PER_CPU_INT)
+        return ERR_NOT_SUPPORTED;
+
+    /* GICD_ITARGETSR holds one bit per cpu interface, eight at most. */
+    if (cpu > (uint)arm_gic_max_cpu() || !mp_is_cpu_online(cpu))
+        return ERR_INVALID_ARGS;
+
+    spin_lock_saved_state_t state;
+    spin_lock_save(&gicd_lock, &state, GICD_LOCK_FLAGS);
+
+    if (arm_gic_interrupt_change_allowed(vector)) {
+        uint reg = vector / 4;
+        uint shift = (vector % 4) * 8;
+        gicd_itargetsr[reg] &= ~(0xffu << shift);
+        gicd_itargetsr[reg] |= (1u << cpu) << shift;
+        GICREG(0, GICD_ITARGETSR(reg)) = gicd_itargetsr[reg];
+    }
+
+    spin_unlock_restore(&gicd_lock, state, GICD_LOCK_FLAGS);
+
+    return NO_ERROR;
+}
+
 unsigned int remap_interrupt(unsigned int vector)
 {
     return vector;
@@ -272,6 +305,7 @@ enum handler_return platform_irq(struct iframe *frame)
     }
 
     THREAD_STATS_INC(interrupts);
+    kcounter_add(&interrupts, 1);
 
     uint cpu = arch_curr_cpu_num();
 
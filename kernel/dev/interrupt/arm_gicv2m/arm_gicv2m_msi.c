@@ -167,4 +167,21 @@ void arm_gicv2m_mask_unmask_msi(const pcie_msi_block_t* block,
     else      unmask_interrupt(block->base_irq_id + msi_id);
 }
 
+status_t arm_gicv2m_set_msi_affinity(const pcie_msi_block_t* block,
+                                     uint                    msi_id,
+                                     uint                    cpu,
+                                     uint64_t*               out_tgt_addr) {
+    DEBUG_ASSERT(block && block->allocated);
+    DEBUG_ASSERT(msi_id < block->num_irq);
+    DEBUG_ASSERT(out_tgt_addr);
+
+    /* Each MSI lands on its own SPI, so steer it at the distributor.  The
+     * doorbell the device writes to stays the same. */
+    status_t res = set_interrupt_affinity(block->base_irq_id + msi_id, cpu);
+    if (res == NO_ERROR)
+        *out_tgt_addr = block->tgt_addr;
+
+    return res;
+}
+
 #endif  // WITH_DEV_PCIE
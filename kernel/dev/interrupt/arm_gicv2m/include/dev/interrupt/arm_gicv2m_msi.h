@@ -51,6 +51,14 @@ void arm_gicv2m_mask_unmask_msi(const pcie_msi_block_t* block,
                                 uint                    msi_id,
                                 bool                    mask);
 
+/**
+ * @see PciePlatformInterface::SetMsiAffinity in dev/pcie_platform.h
+ */
+status_t arm_gicv2m_set_msi_affinity(const pcie_msi_block_t* block,
+                                     uint                    msi_id,
+                                     uint                    cpu,
+                                     uint64_t*               out_tgt_addr);
+
 __END_CDECLS
 #endif  // WITH_DEV_PCIE
 
@@ -35,6 +35,11 @@ status_t get_interrupt_config(unsigned int vector,
                               enum interrupt_trigger_mode* tm,
                               enum interrupt_polarity* pol);
 
+// Steer the specified interrupt vector so that it is delivered to |cpu|.
+// Returns ERR_NOT_SUPPORTED on interrupt controllers which cannot route
+// individual vectors.
+status_t set_interrupt_affinity(unsigned int vector, uint cpu);
+
 typedef enum handler_return (*int_handler)(void* arg);
 
 void register_int_handler(unsigned int vector, int_handler handler, void* arg);
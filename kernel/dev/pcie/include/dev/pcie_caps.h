@@ -125,6 +125,18 @@ typedef struct pcie_msix_vector_entry {
     uint32_t vector_ctrl;
 } __PACKED pcie_msix_vector_entry_t;
 
+#define PCIE_CAP_MSIX_CTRL_GET_TABLE_SIZE(ctrl)   (((ctrl) & 0x07FF) + 1)
+#define PCIE_CAP_MSIX_CTRL_FUNCTION_MASK          ((uint16_t)0x4000)
+#define PCIE_CAP_MSIX_CTRL_ENABLE                 ((uint16_t)0x8000)
+#define PCIE_CAP_MSIX_CTRL_SET_ENB(val, ctrl) \
+    (uint16_t)(((ctrl) & ~PCIE_CAP_MSIX_CTRL_ENABLE) | ((val) ? PCIE_CAP_MSIX_CTRL_ENABLE : 0))
+#define PCIE_CAP_MSIX_CTRL_SET_FUNCTION_MASK(val, ctrl) \
+    (uint16_t)(((ctrl) & ~PCIE_CAP_MSIX_CTRL_FUNCTION_MASK) | \
+               ((val) ? PCIE_CAP_MSIX_CTRL_FUNCTION_MASK : 0))
+#define PCIE_CAP_MSIX_BIR(bir_offset)             ((bir_offset) & 0x7)
+#define PCIE_CAP_MSIX_OFFSET(bir_offset)          ((bir_offset) & ~0x7u)
+#define PCIE_MSIX_VECTOR_CTRL_MASKED              (0x1u)
+
 /**
  * Structure and type definitions for capability PCIE_CAP_ID_PCI_EXPRESS
  *
@@ -271,11 +271,35 @@ public:
      */
     status_t MaskUnmaskIrq(uint irq_id, bool mask);
 
+    /**
+     * Steer one of the device's IRQs so that it is delivered to a particular
+     * CPU.
+     *
+     * @param irq_id The ID of the IRQ to steer.
+     * @param cpu The CPU which should take the IRQ.
+     *
+     * @return A status_t indicating the success or failure of the operation.
+     * Status codes may include (but are not limited to)...
+     *
+     * ++ ERR_BAD_STATE
+     *    The device is in the DISABLED mode.
+     * ++ ERR_INVALID_ARGS
+     *    The irq_id parameter is out of range for the currently configured
+     *    mode, or cpu is not an online CPU.
+     * ++ ERR_NOT_SUPPORTED
+     *    The device is in legacy mode (where the pin may be shared with other
+     *    devices), the platform cannot steer MSIs, or the device is in MSI mode
+     *    with more than one vector and steering would change the target
+     *    address they all share.
+     */
+    status_t SetIrqAffinity(uint irq_id, uint cpu);
+
     // Capability parsing
     //
     // TODO(johngro): these need to be refactored to use non-static methods,
     // and to be private.
     static status_t ParseMsiCaps(PcieDevice* dev, void* hdr, uint version, uint space_left);
+    static status_t ParseMsixCaps(PcieDevice* dev, void* hdr, uint version, uint space_left);
     static status_t ParsePciExpressCaps(PcieDevice* dev, void* hdr, uint version, uint space_left);
     static status_t ParsePciAdvFeatures(PcieDevice* dev, void* hdr, uint version, uint space_left);
 
@@ -382,6 +406,7 @@ private:
     status_t SetIrqModeLocked(pcie_irq_mode_t mode, uint requested_irqs);
     status_t RegisterIrqHandlerLocked(uint irq_id, pcie_irq_handler_fn_t handler, void* ctx);
     status_t MaskUnmaskIrqLocked(uint irq_id, bool mask);
+    status_t SetIrqAffinityLocked(uint irq_id, uint cpu);
 
     // Internal Legacy IRQ support.
     status_t MaskUnmaskLegacyIrq(bool mask);
@@ -399,11 +424,37 @@ private:
     status_t MaskUnmaskMsiIrq(uint irq_id, bool mask);
     void     MaskAllMsiVectors();
     void     SetMsiTarget(uint64_t tgt_addr, uint32_t tgt_data);
-    void     FreeMsiBlock();
+    void     FreeMsiBlock(pcie_msi_block_t* block);
     void     SetMsiMultiMessageEnb(uint requested_irqs);
     void     LeaveMsiIrqMode();
     status_t EnterMsiIrqMode(uint requested_irqs);
+    status_t SetMsiIrqAffinity(uint irq_id, uint cpu);
+
+    // Internal MSI-X IRQ support.
+    void SetMsixCtrl(bool enb, bool function_mask) {
+        DEBUG_ASSERT(irq_.msi_x.cfg);
+        volatile uint16_t* ctrl_reg = &irq_.msi_x.cfg->ctrl;
+        uint16_t ctrl = pcie_read16(ctrl_reg);
+        ctrl = PCIE_CAP_MSIX_CTRL_SET_ENB(enb, ctrl);
+        ctrl = PCIE_CAP_MSIX_CTRL_SET_FUNCTION_MASK(function_mask, ctrl);
+        pcie_write16(ctrl_reg, ctrl);
+    }
 
+    bool     MaskUnmaskMsixIrqLocked(uint irq_id, bool mask);
+    status_t MaskUnmaskMsixIrq(uint irq_id, bool mask);
+    status_t MapMsixTable();
+    void     UnmapMsixTable();
+    void     LeaveMsixIrqMode();
+    status_t EnterMsixIrqMode(uint requested_irqs);
+    status_t SetMsixIrqAffinity(uint irq_id, uint cpu);
+
+    // Masks or unmasks a vector in whichever of MSI or MSI-X mode we are in.
+    bool MaskUnmaskMsiVectorLocked(uint irq_id, bool mask) {
+        return (irq_.mode == PCIE_IRQ_MODE_MSI_X) ? MaskUnmaskMsixIrqLocked(irq_id, mask)
+                                                  : MaskUnmaskMsiIrqLocked(irq_id, mask);
+    }
+
+    // The interrupt handler for both MSI and MSI-X vectors.
     enum handler_return        MsiIrqHandler(pcie_irq_handler_state_t& hstate);
     static enum handler_return MsiIrqHandlerThunk(void *arg);
 
@@ -460,7 +511,16 @@ private:
             pcie_msi_block_t   irq_block;
         } msi;
 
-        /* TODO(johngro) : Add MSI-X state */
-        struct { } msi_x;
+        /* MSI-X state.  The vector table lives in one of the device's BARs,
+         * and is mapped into the kernel only while in MSI-X mode. */
+        struct {
+            pcie_cap_msix_t*                   cfg = nullptr;
+            uint                               max_irqs = 0;
+            uint                               table_bir;
+            uint32_t                           table_offset;
+            vaddr_t                            table_mapping = 0;
+            volatile pcie_msix_vector_entry_t* table = nullptr;
+            pcie_msi_block_t                   irq_block;
+        } msi_x;
     } irq_;
 };
@@ -146,6 +146,26 @@ public:
         DEBUG_ASSERT(false);
     }
 
+    /**
+     * Method used to steer a single MSI of a block at a particular CPU.
+     *
+     * @param block A pointer to a block of MSIs allocated using a platform supplied
+     *        platform_alloc_msi_block_t callback.
+     * @param msi_id The ID (indexed from 0) with the block of MSIs to steer.
+     * @param cpu The CPU which should take the interrupt.
+     * @param out_tgt_addr The target address the device must write to for the
+     *        MSI to arrive at |cpu|.  Platforms which steer at the interrupt
+     *        controller return the block's tgt_addr unchanged.
+     *
+     * @return A status code indicating the success or failure of the operation.
+     */
+    virtual status_t SetMsiAffinity(const pcie_msi_block_t* block,
+                                    uint                    msi_id,
+                                    uint                    cpu,
+                                    uint64_t*               out_tgt_addr) {
+        return ERR_NOT_SUPPORTED;
+    }
+
 protected:
     enum class MsiSupportLevel { NONE, MSI, MSI_WITH_MASKING };
     explicit PciePlatformInterface(MsiSupportLevel msi_support)
@@ -338,6 +338,66 @@ status_t PcieDevice::ParseMsiCaps(PcieDevice* dev,
     return NO_ERROR;
 }
 
+/*
+ * PCI Local Bus Specification 3.0 Section 6.8.2
+ */
+status_t PcieDevice::ParseMsixCaps(PcieDevice* dev,
+                                   void*       hdr,
+                                   uint        version,
+                                   uint        space_left) {
+    DEBUG_ASSERT(dev);
+
+    /* Zero out the devices MSI-X IRQ state */
+    memset(&dev->irq_.msi_x, 0, sizeof(dev->irq_.msi_x));
+
+    if (space_left < sizeof(pcie_cap_msix_t)) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has illegally positioned MSI-X "
+               "capability structure.  Structure is %zu bytes long, but only %u "
+               "bytes remain in ECAM standard config.\n",
+               dev->bus_id(), dev->dev_id(), dev->func_id(),
+               dev->vendor_id(), dev->device_id(),
+               sizeof(pcie_cap_msix_t), space_left);
+        return ERR_INVALID_ARGS;
+    }
+
+    pcie_cap_msix_t* msix_cap = (pcie_cap_msix_t*)hdr;
+    uint16_t         ctrl     = pcie_read16(&msix_cap->ctrl);
+    uint32_t         table    = pcie_read32(&msix_cap->vector_table_bir_offset);
+    uint             max_irqs = PCIE_CAP_MSIX_CTRL_GET_TABLE_SIZE(ctrl);
+    uint             bir      = PCIE_CAP_MSIX_BIR(table);
+    uint32_t         offset   = PCIE_CAP_MSIX_OFFSET(table);
+
+    /* Make sure that MSI-X is disabled, and that all of the vectors are masked
+     * at the function level until someone asks for MSI-X mode. */
+    pcie_write16(&msix_cap->ctrl, PCIE_CAP_MSIX_CTRL_SET_FUNCTION_MASK(1,
+                                  PCIE_CAP_MSIX_CTRL_SET_ENB(0, ctrl)));
+
+    /* The vector table has to fit within a memory BAR we know about.  If it
+     * does not, leave MSI-X unsupported rather than failing the device; it may
+     * still be driven with MSI or legacy IRQs. */
+    uint64_t table_end = static_cast<uint64_t>(offset) +
+                         (max_irqs * sizeof(pcie_msix_vector_entry_t));
+    if ((bir >= dev->bar_count_) ||
+        !dev->bars_[bir].size ||
+        !dev->bars_[bir].is_mmio ||
+        (table_end > dev->bars_[bir].size)) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has an MSI-X vector table "
+               "(BAR %u, offset 0x%x, %u vectors) which does not fit in a memory "
+               "BAR.  MSI-X will not be supported.\n",
+               dev->bus_id(), dev->dev_id(), dev->func_id(),
+               dev->vendor_id(), dev->device_id(),
+               bir, offset, max_irqs);
+        return NO_ERROR;
+    }
+
+    dev->irq_.msi_x.cfg          = msix_cap;
+    dev->irq_.msi_x.max_irqs     = max_irqs;
+    dev->irq_.msi_x.table_bir    = bir;
+    dev->irq_.msi_x.table_offset = offset;
+
+    return NO_ERROR;
+}
+
 /*
  * Advanced Capabilities for Conventional PCI ECN
  */
@@ -596,7 +656,7 @@ static const pcie_caps_parse_table_entry_t PCIE_STANDARD_CAPS_PARSE_TABLE[] = {
     PTE(PCIE_CAP_ID_AGP_8X,                   NULL),
     PTE(PCIE_CAP_ID_SECURE_DEVICE,            NULL),
     PTE(PCIE_CAP_ID_PCI_EXPRESS,              PcieDevice::ParsePciExpressCaps),
-    PTE(PCIE_CAP_ID_MSIX,                     NULL),
+    PTE(PCIE_CAP_ID_MSIX,                     PcieDevice::ParseMsixCaps),
     PTE(PCIE_CAP_ID_SATA_DATA_NDX_CFG,        NULL),
     PTE(PCIE_CAP_ID_ADVANCED_FEATURES,        PcieDevice::ParsePciAdvFeatures),
     PTE(PCIE_CAP_ID_ENHANCED_ALLOCATION,      NULL),
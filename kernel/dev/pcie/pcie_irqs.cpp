@@ -16,8 +16,11 @@
 #include <kernel/spinlock.h>
 #include <kernel/vm.h>
 #include <list.h>
+#include <mxtl/algorithm.h>
 #include <new.h>
 #include <pow2.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <trace.h>
 
@@ -362,26 +365,27 @@ void PcieDevice::SetMsiTarget(uint64_t tgt_addr, uint32_t tgt_data) {
     }
 }
 
-void PcieDevice::FreeMsiBlock() {
+void PcieDevice::FreeMsiBlock(pcie_msi_block_t* block) {
+    DEBUG_ASSERT(block);
+
     /* If no block has been allocated, there is nothing to do */
-    if (!irq_.msi.irq_block.allocated)
+    if (!block->allocated)
         return;
 
     DEBUG_ASSERT(bus_drv_.platform().supports_msi());
 
     /* Mask the IRQ at the platform interrupt controller level if we can, and
      * unregister any registered handler. */
-    const pcie_msi_block_t* b = &irq_.msi.irq_block;
-    for (uint i = 0; i < b->num_irq; i++) {
+    for (uint i = 0; i < block->num_irq; i++) {
         if (bus_drv_.platform().supports_msi_masking()) {
-            bus_drv_.platform().MaskUnmaskMsi(b, i, true);
+            bus_drv_.platform().MaskUnmaskMsi(block, i, true);
         }
-        bus_drv_.platform().RegisterMsiHandler(b, i, NULL, NULL);
+        bus_drv_.platform().RegisterMsiHandler(block, i, NULL, NULL);
     }
 
     /* Give the block of IRQs back to the plaform */
-    bus_drv_.platform().FreeMsiBlock(&irq_.msi.irq_block);
-    DEBUG_ASSERT(!irq_.msi.irq_block.allocated);
+    bus_drv_.platform().FreeMsiBlock(block);
+    DEBUG_ASSERT(!block->allocated);
 }
 
 void PcieDevice::SetMsiMultiMessageEnb(uint requested_irqs) {
@@ -405,7 +409,7 @@ void PcieDevice::LeaveMsiIrqMode() {
     /* Return any allocated irq_ block to the platform, unregistering with
      * the interrupt controller and synchronizing with the dispatchers in
      * the process. */
-    FreeMsiBlock();
+    FreeMsiBlock(&irq_.msi.irq_block);
 
     /* Reset our common state, free any allocated handlers */
     ResetCommonIrqBookkeeping();
@@ -489,14 +493,56 @@ bailout:
     return res;
 }
 
+status_t PcieDevice::SetMsiIrqAffinity(uint irq_id, uint cpu) {
+    DEBUG_ASSERT(irq_.msi.irq_block.allocated);
+
+    uint64_t tgt_addr;
+    status_t res = bus_drv_.platform().SetMsiAffinity(&irq_.msi.irq_block,
+                                                      irq_id, cpu, &tgt_addr);
+    if (res != NO_ERROR)
+        return res;
+
+    /* Platforms which steer at the interrupt controller leave the target
+     * address alone, and we are done. */
+    if (tgt_addr == irq_.msi.irq_block.tgt_addr)
+        return NO_ERROR;
+
+    /* Every vector in an MSI block writes to the same address, so we can only
+     * move the address when there is a single vector behind it. */
+    if ((irq_.handler_count != 1) || (!irq_.msi.is64bit && (tgt_addr >> 32)))
+        return ERR_NOT_SUPPORTED;
+
+    /* Keep the vector masked while the address changes (if we can mask it),
+     * then put the mask back the way we found it. */
+    pcie_irq_handler_state_t& hstate = irq_.handlers[irq_id];
+    AutoSpinLockIrqSave handler_lock(hstate.lock);
+
+    bool can_mask = bus_drv_.platform().supports_msi_masking() || irq_.msi.pvm_mask_reg;
+    bool was_masked = can_mask ? MaskUnmaskMsiIrqLocked(irq_id, true) : hstate.masked;
+
+    pcie_write32(&irq_.msi.cfg->addr, static_cast<uint32_t>(tgt_addr & 0xFFFFFFFF));
+    if (irq_.msi.is64bit)
+        pcie_write32(&irq_.msi.cfg->nopvm_64bit.addr_upper, static_cast<uint32_t>(tgt_addr >> 32));
+    irq_.msi.irq_block.tgt_addr = tgt_addr;
+
+    if (can_mask)
+        MaskUnmaskMsiIrqLocked(irq_id, was_masked);
+
+    return NO_ERROR;
+}
+
 enum handler_return PcieDevice::MsiIrqHandler(pcie_irq_handler_state_t& hstate) {
     /* No need to save IRQ state; we are in an IRQ handler at the moment. */
     AutoSpinLock handler_lock(hstate.lock);
 
-    /* Mask our IRQ if we can. */
+    /* Mask our IRQ if we can.  MSI-X vectors can always be masked in the
+     * vector table. */
+    bool can_mask = (irq_.mode == PCIE_IRQ_MODE_MSI_X)       ||
+                    bus_drv_.platform().supports_msi_masking() ||
+                    irq_.msi.pvm_mask_reg;
     bool was_masked;
-    if (bus_drv_.platform().supports_msi_masking() || irq_.msi.pvm_mask_reg) {
-        was_masked = MaskUnmaskMsiIrqLocked(hstate.pci_irq_id, true);
+    if (can_mask) {
+        was_masked = MaskUnmaskMsiVectorLocked(hstate.pci_irq_id, true);
     } else {
         DEBUG_ASSERT(!hstate.masked);
         was_masked = false;
@@ -512,7 +558,7 @@ enum handler_return PcieDevice::MsiIrqHandler(pcie_irq_handler_state_t& hstate)
 
     /* Re-enable the IRQ if asked to do so */
     if (!(irq_ret & PCIE_IRQRET_MASK))
-        MaskUnmaskMsiIrqLocked(hstate.pci_irq_id, false);
+        MaskUnmaskMsiVectorLocked(hstate.pci_irq_id, false);
 
     /* Request a reschedule if asked to do so */
     return (irq_ret & PCIE_IRQRET_RESCHED) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
@@ -525,6 +571,231 @@ enum handler_return PcieDevice::MsiIrqHandlerThunk(void *arg) {
     return hstate.dev->MsiIrqHandler(hstate);
 }
 
+/******************************************************************************
+ *
+ * MSI-X IRQ mode routines.
+ *
+ ******************************************************************************/
+bool PcieDevice::MaskUnmaskMsixIrqLocked(uint irq_id, bool mask) {
+    DEBUG_ASSERT(irq_.mode == PCIE_IRQ_MODE_MSI_X);
+    DEBUG_ASSERT(irq_id < irq_.handler_count);
+    DEBUG_ASSERT(irq_.handlers);
+    DEBUG_ASSERT(irq_.msi_x.table);
+
+    pcie_irq_handler_state_t& hstate = irq_.handlers[irq_id];
+    DEBUG_ASSERT(hstate.lock.IsHeld());
+
+    /* Every MSI-X vector has a mask bit of its own in the vector table.  Read
+     * the control word back after writing it so that the write has reached the
+     * device before we return. */
+    volatile uint32_t* ctrl_reg = &irq_.msi_x.table[irq_id].vector_ctrl;
+    uint32_t val = pcie_read32(ctrl_reg);
+    if (mask) val |=  PCIE_MSIX_VECTOR_CTRL_MASKED;
+    else      val &= ~PCIE_MSIX_VECTOR_CTRL_MASKED;
+    pcie_write32(ctrl_reg, val);
+    pcie_read32(ctrl_reg);
+
+    bool ret = hstate.masked;
+    hstate.masked = mask;
+    return ret;
+}
+
+status_t PcieDevice::MaskUnmaskMsixIrq(uint irq_id, bool mask) {
+    if (irq_id >= irq_.handler_count)
+        return ERR_INVALID_ARGS;
+
+    DEBUG_ASSERT(irq_.handlers);
+
+    {
+        AutoSpinLockIrqSave handler_lock(irq_.handlers[irq_id].lock);
+        MaskUnmaskMsixIrqLocked(irq_id, mask);
+    }
+
+    return NO_ERROR;
+}
+
+status_t PcieDevice::MapMsixTable() {
+    DEBUG_ASSERT(irq_.msi_x.cfg);
+    DEBUG_ASSERT(!irq_.msi_x.table_mapping);
+
+    /* The vector table lives in a memory BAR, which needs to have been given a
+     * place on the bus before we can reach it. */
+    const pcie_bar_info_t& bar = bars_[irq_.msi_x.table_bir];
+    if (!bar.is_mmio || !bar.bus_addr || !bar.allocation)
+        return ERR_BAD_STATE;
+
+    paddr_t table_start = bar.bus_addr + irq_.msi_x.table_offset;
+    paddr_t table_end   = table_start + (irq_.msi_x.max_irqs * sizeof(pcie_msix_vector_entry_t));
+    paddr_t map_start   = ROUNDDOWN(table_start, PAGE_SIZE);
+    size_t  map_size    = ROUNDUP(table_end, PAGE_SIZE) - map_start;
+
+    char name_buf[32];
+    snprintf(name_buf, sizeof(name_buf), "pcie_msix_%02x:%02x.%01x", bus_id_, dev_id_, func_id_);
+
+    void* vaddr;
+    status_t res = vmm_alloc_physical(vmm_get_kernel_aspace(),
+                                      name_buf,
+                                      map_size,
+                                      &vaddr,
+                                      PAGE_SIZE_SHIFT,
+                                      0 /* min alloc gap */,
+                                      map_start,
+                                      0 /* vmm flags */,
+                                      ARCH_MMU_FLAG_UNCACHED_DEVICE |
+                                      ARCH_MMU_FLAG_PERM_READ |
+                                      ARCH_MMU_FLAG_PERM_WRITE);
+    if (res != NO_ERROR)
+        return res;
+
+    /* The device only decodes accesses to the table if memory space is enabled */
+    ModifyCmdLocked(0, PCI_COMMAND_MEM_EN);
+
+    irq_.msi_x.table_mapping = reinterpret_cast<vaddr_t>(vaddr);
+    irq_.msi_x.table = reinterpret_cast<volatile pcie_msix_vector_entry_t*>(
+            irq_.msi_x.table_mapping + (table_start - map_start));
+    return NO_ERROR;
+}
+
+void PcieDevice::UnmapMsixTable() {
+    if (!irq_.msi_x.table_mapping)
+        return;
+
+    vmm_free_region(vmm_get_kernel_aspace(), irq_.msi_x.table_mapping);
+    irq_.msi_x.table_mapping = 0;
+    irq_.msi_x.table = nullptr;
+}
+
+void PcieDevice::LeaveMsixIrqMode() {
+    /* Mask everything at the function level and disable MSI-X, then mask and
+     * clear out each of the vectors in the table before letting it go. */
+    SetMsixCtrl(false, true);
+    if (irq_.msi_x.table) {
+        for (uint i = 0; i < irq_.msi_x.max_irqs; ++i) {
+            volatile pcie_msix_vector_entry_t* entry = &irq_.msi_x.table[i];
+            pcie_write32(&entry->vector_ctrl, PCIE_MSIX_VECTOR_CTRL_MASKED);
+            pcie_write32(&entry->addr, 0);
+            pcie_write32(&entry->addr_upper, 0);
+            pcie_write32(&entry->data, 0);
+        }
+    }
+    UnmapMsixTable();
+
+    /* Return any allocated irq_ block to the platform, unregistering with
+     * the interrupt controller and synchronizing with the dispatchers in
+     * the process. */
+    FreeMsiBlock(&irq_.msi_x.irq_block);
+
+    /* Reset our common state, free any allocated handlers */
+    ResetCommonIrqBookkeeping();
+}
+
+status_t PcieDevice::EnterMsixIrqMode(uint requested_irqs) {
+    DEBUG_ASSERT(requested_irqs);
+
+    status_t res = NO_ERROR;
+
+    // We cannot go into MSI-X mode if we don't support MSI-X at all, or we
+    // don't support the number of IRQs requested.  The platform hands out
+    // blocks of no more than PCIE_MAX_MSI_IRQS at a time, which limits us even
+    // when the device's table is larger.
+    if (!irq_.msi_x.cfg                                           ||
+        !bus_drv_.platform().supports_msi()                       ||
+        (requested_irqs > mxtl::min(irq_.msi_x.max_irqs, PCIE_MAX_MSI_IRQS)))
+        return ERR_NOT_SUPPORTED;
+
+    // Keep every vector masked at the function level while we set up.
+    SetMsixCtrl(false, true);
+
+    res = MapMsixTable();
+    if (res != NO_ERROR) {
+        LTRACEF("Failed to map the MSI-X vector table for device "
+                "%02x:%02x.%01x (res %d)\n",
+                bus_id_, dev_id_, func_id_, res);
+        return res;
+    }
+
+    /* Ask the platform for a chunk of MSI compatible IRQs.  Table entries take
+     * a full 64 bit address. */
+    DEBUG_ASSERT(!irq_.msi_x.irq_block.allocated);
+    res = bus_drv_.platform().AllocMsiBlock(requested_irqs,
+                                            true,   /* can_target_64bit */
+                                            true,   /* is_msix == true */
+                                            &irq_.msi_x.irq_block);
+    if (res != NO_ERROR) {
+        LTRACEF("Failed to allocate a block of %u MSI-X IRQs for device "
+                "%02x:%02x.%01x (res %d)\n",
+                requested_irqs, bus_id_, dev_id_, func_id_, res);
+        goto bailout;
+    }
+
+    /* Allocate our handler table.  Every vector starts out masked. */
+    res = AllocIrqHandlers(requested_irqs, true);
+    if (res != NO_ERROR)
+        goto bailout;
+
+    /* Record our new IRQ mode */
+    irq_.mode = PCIE_IRQ_MODE_MSI_X;
+
+    /* Program each entry of the vector table with its own message, masking
+     * the entries we are not going to use. */
+    DEBUG_ASSERT(irq_.handler_count <= irq_.msi_x.irq_block.num_irq);
+    for (uint i = 0; i < irq_.msi_x.max_irqs; ++i) {
+        volatile pcie_msix_vector_entry_t* entry = &irq_.msi_x.table[i];
+        pcie_write32(&entry->vector_ctrl, PCIE_MSIX_VECTOR_CTRL_MASKED);
+        if (i >= irq_.handler_count)
+            continue;
+
+        uint64_t tgt_addr = irq_.msi_x.irq_block.tgt_addr;
+        pcie_write32(&entry->addr,       static_cast<uint32_t>(tgt_addr & 0xFFFFFFFF));
+        pcie_write32(&entry->addr_upper, static_cast<uint32_t>(tgt_addr >> 32));
+        pcie_write32(&entry->data,       irq_.msi_x.irq_block.tgt_data + i);
+    }
+
+    /* Register each IRQ with the dispatcher */
+    for (uint i = 0; i < irq_.handler_count; ++i) {
+        bus_drv_.platform().RegisterMsiHandler(&irq_.msi_x.irq_block,
+                                               i,
+                                               PcieDevice::MsiIrqHandlerThunk,
+                                               irq_.handlers + i);
+    }
+
+    /* Enable MSI-X at the top level.  Each vector stays masked in the table
+     * until its handler is registered and it is unmasked. */
+    SetMsixCtrl(true, false);
+
+bailout:
+    if (res != NO_ERROR)
+        LeaveMsixIrqMode();
+
+    return res;
+}
+
+status_t PcieDevice::SetMsixIrqAffinity(uint irq_id, uint cpu) {
+    DEBUG_ASSERT(irq_.msi_x.irq_block.allocated);
+    DEBUG_ASSERT(irq_.msi_x.table);
+
+    uint64_t tgt_addr;
+    status_t res = bus_drv_.platform().SetMsiAffinity(&irq_.msi_x.irq_block,
+                                                      irq_id, cpu, &tgt_addr);
+    if (res != NO_ERROR)
+        return res;
+
+    /* Each table entry has an address of its own.  Mask the entry while we
+     * rewrite it so that the device never sends a torn message. */
+    pcie_irq_handler_state_t& hstate = irq_.handlers[irq_id];
+    AutoSpinLockIrqSave handler_lock(hstate.lock);
+
+    bool was_masked = MaskUnmaskMsixIrqLocked(irq_id, true);
+
+    volatile pcie_msix_vector_entry_t* entry = &irq_.msi_x.table[irq_id];
+    pcie_write32(&entry->addr,       static_cast<uint32_t>(tgt_addr & 0xFFFFFFFF));
+    pcie_write32(&entry->addr_upper, static_cast<uint32_t>(tgt_addr >> 32));
+
+    MaskUnmaskMsixIrqLocked(irq_id, was_masked);
+
+    return NO_ERROR;
+}
+
 /******************************************************************************
  *
  * Internal implementation of the Kernel facing API.
@@ -578,8 +849,13 @@ status_t PcieDevice::QueryIrqModeCapabilitiesLocked(pcie_irq_mode_t mode,
         if (!bus_drv_.platform().supports_msi())
             return ERR_NOT_SUPPORTED;
 
-        /* TODO(johngro) : finish MSI-X implementation. */
-        return ERR_NOT_SUPPORTED;
+        if (!irq_.msi_x.cfg)
+            return ERR_NOT_SUPPORTED;
+
+        /* Every MSI-X vector can be masked in the vector table. */
+        out_caps->max_irqs = mxtl::min(irq_.msi_x.max_irqs, PCIE_MAX_MSI_IRQS);
+        out_caps->per_vector_masking_supported = true;
+        break;
 
     default:
         return ERR_INVALID_ARGS;
@@ -634,10 +910,14 @@ status_t PcieDevice::SetIrqModeLocked(pcie_irq_mode_t mode, uint requested_irqs)
             DEBUG_ASSERT(!irq_.registered_handler_count);
             return NO_ERROR;
 
-        /* Right now, there should be no way to get into MSI-X mode */
         case PCIE_IRQ_MODE_MSI_X:
-            DEBUG_ASSERT(false);
-            return ERR_NOT_SUPPORTED;
+            DEBUG_ASSERT(irq_.msi_x.cfg);
+            DEBUG_ASSERT(irq_.msi_x.irq_block.allocated);
+
+            LeaveMsixIrqMode();
+
+            DEBUG_ASSERT(!irq_.registered_handler_count);
+            return NO_ERROR;
 
         default:
             /* mode is not one of the valid enum values, this should be impossible */
@@ -658,7 +938,7 @@ status_t PcieDevice::SetIrqModeLocked(pcie_irq_mode_t mode, uint requested_irqs)
     switch (mode) {
     case PCIE_IRQ_MODE_LEGACY: return EnterLegacyIrqMode(requested_irqs);
     case PCIE_IRQ_MODE_MSI:    return EnterMsiIrqMode   (requested_irqs);
-    case PCIE_IRQ_MODE_MSI_X:  return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI_X:  return EnterMsixIrqMode  (requested_irqs);
     default:                   return ERR_INVALID_ARGS;
     }
 }
@@ -729,7 +1009,7 @@ status_t PcieDevice::MaskUnmaskIrqLocked(uint irq_id, bool mask) {
     switch (irq_.mode) {
     case PCIE_IRQ_MODE_LEGACY: return MaskUnmaskLegacyIrq(mask);
     case PCIE_IRQ_MODE_MSI:    return MaskUnmaskMsiIrq(irq_id, mask);
-    case PCIE_IRQ_MODE_MSI_X:  return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI_X:  return MaskUnmaskMsixIrq(irq_id, mask);
     default:
         DEBUG_ASSERT(false); /* This should be un-possible! */
         return ERR_INTERNAL;
@@ -738,6 +1018,33 @@ status_t PcieDevice::MaskUnmaskIrqLocked(uint irq_id, bool mask) {
     return NO_ERROR;
 }
 
+status_t PcieDevice::SetIrqAffinityLocked(uint irq_id, uint cpu) {
+    DEBUG_ASSERT(plugged_in_);
+    DEBUG_ASSERT(dev_lock_.IsHeld());
+
+    /* Cannot steer anything while in the DISABLED state */
+    if (irq_.mode == PCIE_IRQ_MODE_DISABLED)
+        return ERR_BAD_STATE;
+
+    DEBUG_ASSERT(irq_.handlers);
+    DEBUG_ASSERT(irq_.handler_count);
+
+    /* Make sure that the IRQ ID is within range */
+    if (irq_id >= irq_.handler_count)
+        return ERR_INVALID_ARGS;
+
+    switch (irq_.mode) {
+    /* Legacy IRQs may be shared with other devices; they go where the
+     * platform put them. */
+    case PCIE_IRQ_MODE_LEGACY: return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI:    return SetMsiIrqAffinity(irq_id, cpu);
+    case PCIE_IRQ_MODE_MSI_X:  return SetMsixIrqAffinity(irq_id, cpu);
+    default:
+        DEBUG_ASSERT(false); /* This should be un-possible! */
+        return ERR_INTERNAL;
+    }
+}
+
 /******************************************************************************
  *
  * Kernel API; prototypes in dev/pcie_irqs.h
@@ -790,6 +1097,14 @@ status_t PcieDevice::MaskUnmaskIrq(uint irq_id, bool mask) {
         : ERR_BAD_STATE;
 }
 
+status_t PcieDevice::SetIrqAffinity(uint irq_id, uint cpu) {
+    AutoLock dev_lock(dev_lock_);
+
+    return (plugged_in_ && !disabled_)
+        ? SetIrqAffinityLocked(irq_id, cpu)
+        : ERR_BAD_STATE;
+}
+
 
 // Map from a device's interrupt pin ID to the proper system IRQ ID.  Follow the
 // PCIe graph up to the root, swizzling as we traverse PCIe switches,
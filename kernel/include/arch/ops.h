@@ -63,6 +63,9 @@ static void arch_spinloop_signal(void);
 /* arch optimized version of a page zero routine against a page aligned buffer */
 void arch_zero_page(void *);
 
+/* arch optimized version of a page copy routine between page aligned buffers */
+void arch_copy_page(void *dst, const void *src);
+
 /* give the specific arch a chance to override some routines */
 #include <arch/arch_ops.h>
 
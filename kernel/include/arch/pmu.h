@@ -0,0 +1,20 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS
+
+/* Count cycles on the current cpu, interrupting every period of them to
+ * hand the interrupted context to ktrace_profile_sample(). Both are called
+ * on each cpu in turn with interrupts disabled. */
+status_t arch_pmu_start(uint32_t period);
+void arch_pmu_stop(void);
+
+__END_CDECLS
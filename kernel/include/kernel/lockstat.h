@@ -0,0 +1,55 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <arch/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS
+
+/* Lock contention profiling.
+ *
+ * Built in with WITH_LOCKSTAT=true and switched on at runtime with the
+ * "lockstat" console command or kernel.lockstat=true on the command line.
+ * Every lock that has been contended at least once gets a class, keyed by
+ * its address, holding its wait and hold time histograms and the call sites
+ * that contended on it the most.  Contention events are also emitted as
+ * TAG_LOCK_CONTEND ktrace records.
+ */
+
+#define LOCKSTAT_TYPE_SPIN  0
+#define LOCKSTAT_TYPE_MUTEX 1
+
+#if WITH_LOCKSTAT
+
+extern int lockstat_enabled;
+
+static inline bool lockstat_active(void)
+{
+    return __atomic_load_n(&lockstat_enabled, __ATOMIC_RELAXED) != 0;
+}
+
+/* account |wait_ns| spent by |caller| getting |lock| */
+void lockstat_record_wait(const void *lock, uint type, lk_bigtime_t wait_ns, uintptr_t caller);
+
+/* account |hold_ns| spent holding |lock|, if it has ever been contended */
+void lockstat_record_hold(const void *lock, lk_bigtime_t hold_ns);
+
+/* instrumented versions of spin_lock()/spin_unlock(), used while active */
+void lockstat_spin_lock(spin_lock_t *lock);
+void lockstat_spin_unlock(spin_lock_t *lock);
+
+#else
+
+static inline bool lockstat_active(void) { return false; }
+
+#endif
+
+__END_CDECLS
@@ -77,6 +77,11 @@ struct mp_state {
 
     /* lock for serializing CPU hotplug/unplug operations */
     mutex_t hotplug_lock;
+
+    /* cache domains, filled in by the arch once it knows the topology. a zero
+     * entry means unknown. */
+    mp_cpu_mask_t smt_cpus[SMP_MAX_CPUS];
+    mp_cpu_mask_t package_cpus[SMP_MAX_CPUS];
 };
 
 extern struct mp_state mp;
@@ -136,6 +141,25 @@ static inline mp_cpu_mask_t mp_get_realtime_mask(void)
 {
     return mp.realtime_cpus;
 }
+
+/* record the cpus sharing a core (smt siblings) and a package with cpu, both
+ * including cpu itself. called by arch code before the secondary cpus start.
+ */
+void mp_set_cpu_domains(uint cpu, mp_cpu_mask_t smt, mp_cpu_mask_t package);
+
+/* cpus sharing a core with cpu, just cpu itself if unknown */
+static inline mp_cpu_mask_t mp_get_smt_mask(uint cpu)
+{
+    mp_cpu_mask_t mask = mp.smt_cpus[cpu];
+    return mask ? mask : (1U << cpu);
+}
+
+/* cpus sharing a package (and so its last level cache) with cpu, all of them if unknown */
+static inline mp_cpu_mask_t mp_get_package_mask(uint cpu)
+{
+    mp_cpu_mask_t mask = mp.package_cpus[cpu];
+    return mask ? mask : ~0U;
+}
 #else
 static inline void mp_init(void) {}
 static inline void mp_reschedule(mp_cpu_mask_t target, uint flags) {}
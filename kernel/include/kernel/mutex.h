@@ -19,19 +19,36 @@ __BEGIN_CDECLS;
 
 #define MUTEX_MAGIC (0x6D757478)  // 'mutx'
 
+/* the low bit of the mutex value is set when other threads are blocked on the
+ * wait queue; the rest of the value is the holding thread (or 0 if unowned).
+ */
+#define MUTEX_FLAG_QUEUED ((uintptr_t)1)
+
 typedef struct TA_CAP("mutex") mutex {
     uint32_t magic;
-    thread_t *holder;
-    int count;
+    uintptr_t val;
     wait_queue_t wait;
+    /* lends the highest waiter's priority to the holder while contended */
+    thread_pi_link_t pi_link;
+#if WITH_LOCKSTAT
+    /* when the holder got it, if lockstat was running at the time */
+    lk_bigtime_t lockstat_acquired;
+#endif
 } mutex_t;
 
+#if WITH_LOCKSTAT
+#define MUTEX_LOCKSTAT_INITIAL_VALUE .lockstat_acquired = 0,
+#else
+#define MUTEX_LOCKSTAT_INITIAL_VALUE
+#endif
+
 #define MUTEX_INITIAL_VALUE(m) \
 { \
     .magic = MUTEX_MAGIC, \
-    .holder = NULL, \
-    .count = 0, \
+    .val = 0, \
     .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
+    .pi_link = THREAD_PI_LINK_INITIAL_VALUE, \
+    MUTEX_LOCKSTAT_INITIAL_VALUE \
 }
 
 /* Rules for Mutexes:
@@ -44,14 +61,19 @@ void mutex_destroy(mutex_t *);
 status_t mutex_acquire(mutex_t *m) TA_ACQ(m);
 void mutex_release(mutex_t *m) TA_REL(m);
 
-/* Internal functions for use by condvar implementation. */
-status_t mutex_acquire_internal(mutex_t *m) TA_ACQ(m);
+/* Internal function for use by condvar implementation. */
 void mutex_release_internal(mutex_t *m, bool reschedule) TA_REL(m);
 
+/* the thread currently holding the mutex, or NULL */
+static inline thread_t *mutex_holder(const mutex_t *m)
+{
+    return (thread_t *)(__atomic_load_n(&m->val, __ATOMIC_RELAXED) & ~MUTEX_FLAG_QUEUED);
+}
+
 /* does the current thread hold the mutex? */
 static bool is_mutex_held(const mutex_t *m)
 {
-    return m->holder == get_current_thread();
+    return mutex_holder(m) == get_current_thread();
 }
 
 __END_CDECLS;
@@ -10,12 +10,20 @@
 #include <magenta/compiler.h>
 #include <magenta/thread_annotations.h>
 #include <arch/spinlock.h>
+#include <kernel/lockstat.h>
+#include <kernel/stall_detector.h>
 
 __BEGIN_CDECLS
 
 /* interrupts should already be disabled */
 static inline void spin_lock(spin_lock_t *lock)
 {
+#if WITH_LOCKSTAT
+    if (unlikely(lockstat_active())) {
+        lockstat_spin_lock(lock);
+        return;
+    }
+#endif
     arch_spin_lock(lock);
 }
 
@@ -28,6 +36,10 @@ static inline int spin_trylock(spin_lock_t *lock)
 /* interrupts should already be disabled */
 static inline void spin_unlock(spin_lock_t *lock)
 {
+#if WITH_LOCKSTAT
+    if (unlikely(lockstat_active()))
+        lockstat_spin_unlock(lock);
+#endif
     arch_spin_unlock(lock);
 }
 
@@ -58,6 +70,12 @@ static inline void spin_lock_save(
     spin_lock_saved_state_t *statep,
     spin_lock_save_flags_t flags)
 {
+#if WITH_STALL_DETECTOR
+    if (unlikely(stall_detector_active())) {
+        stall_detector_spin_lock_save(lock, statep, flags);
+        return;
+    }
+#endif
     arch_interrupt_save(statep, flags);
     spin_lock(lock);
 }
@@ -68,6 +86,12 @@ static inline void spin_unlock_restore(
     spin_lock_saved_state_t old_state,
     spin_lock_save_flags_t flags)
 {
+#if WITH_STALL_DETECTOR
+    if (unlikely(stall_detector_active())) {
+        stall_detector_spin_unlock_restore(lock, old_state, flags);
+        return;
+    }
+#endif
     spin_unlock(lock);
     arch_interrupt_restore(old_state, flags);
 }
@@ -0,0 +1,83 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <arch/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS
+
+/* Interrupt latency and soft lockup detection.
+ *
+ * Built in with WITH_STALL_DETECTOR=true and switched on at runtime with the
+ * "stalls" console command or kernel.stall_detector=true on the command line.
+ * While on, two things watch for a cpu going without interrupts for longer
+ * than the threshold (kernel.stall_threshold_us):
+ *
+ *  - a timer on every cpu, which measures how late it fires, and so catches
+ *    every kind of stall, but only knows which thread was running;
+ *  - spin_lock_irqsave() and spin_unlock_irqrestore(), which time the
+ *    stretches with interrupts off that they begin and end, and remember
+ *    where they began and a backtrace from where they ended.
+ *
+ * The most recent stalls are kept in a ring, which userspace reads with
+ * MX_INFO_KERNEL_STALLS on the root resource.
+ */
+
+#define STALL_TYPE_TIMER    0
+#define STALL_TYPE_IRQS_OFF 1
+
+#define STALL_BACKTRACE_DEPTH 8
+
+struct stall_record {
+    /* counts up from 0 across every stall, including those overwritten */
+    uint64_t seq;
+    lk_bigtime_t end_time;
+    lk_bigtime_t duration;
+    uint cpu;
+    uint type;
+    /* user_tid of the thread that was running, 0 for kernel threads */
+    uint64_t tid;
+    /* where interrupts were disabled, for STALL_TYPE_IRQS_OFF */
+    uintptr_t start_pc;
+    uint backtrace_count;
+    uintptr_t backtrace[STALL_BACKTRACE_DEPTH];
+};
+
+#if WITH_STALL_DETECTOR
+
+extern int stall_detector_enabled;
+
+static inline bool stall_detector_active(void)
+{
+    return __atomic_load_n(&stall_detector_enabled, __ATOMIC_RELAXED) != 0;
+}
+
+/* instrumented versions of spin_lock_save()/spin_unlock_restore(), used
+ * while active */
+void stall_detector_spin_lock_save(spin_lock_t *lock, spin_lock_saved_state_t *statep,
+                                   spin_lock_save_flags_t flags);
+void stall_detector_spin_unlock_restore(spin_lock_t *lock, spin_lock_saved_state_t old_state,
+                                        spin_lock_save_flags_t flags);
+
+/* the ring holds the records numbered from *first up to, not including, the
+ * return value */
+uint64_t stall_detector_get_range(uint64_t *first);
+
+/* copies out record |seq|; false if it has been overwritten since */
+bool stall_detector_get(uint64_t seq, struct stall_record *out);
+
+#else
+
+static inline bool stall_detector_active(void) { return false; }
+
+#endif
+
+__END_CDECLS
@@ -16,6 +16,7 @@
 #include <arch/thread.h>
 #include <kernel/wait.h>
 #include <kernel/spinlock.h>
+#include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <debug.h>
 
@@ -61,6 +62,7 @@ enum thread_tls_list {
 #define THREAD_FLAG_IDLE                      (1<<4)
 #define THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK  (1<<5)
 #define THREAD_FLAG_STOPPED_FOR_EXCEPTION     (1<<6)
+#define THREAD_FLAG_DEADLINE                  (1<<7)
 
 #define THREAD_SIGNAL_KILL                    (1<<0)
 
@@ -72,20 +74,86 @@ enum thread_tls_list {
 
 #define THREAD_LINEBUFFER_LENGTH 128
 
+struct thread;
+
+/* a priority inheritance link: while threads are blocked behind owner on some lock,
+ * owner runs at no less than priority. links are protected by the thread lock.
+ */
+typedef struct thread_pi_link {
+    struct list_node node;  /* on owner's pi_links */
+    struct thread *owner;
+    int priority;
+} thread_pi_link_t;
+
+#define THREAD_PI_LINK_INITIAL_VALUE \
+{ \
+    .node = LIST_INITIAL_CLEARED_VALUE, \
+    .owner = NULL, \
+    .priority = -1, \
+}
+
+/* a scheduling group, shared by all the threads of some container (a job) and
+ * nested inside its parent's group. the weight scales the quanta of member threads
+ * relative to SCHED_GROUP_DEFAULT_WEIGHT, and if quota_ns is non-zero the group's
+ * threads may only run for quota_ns (summed over all cpus) every period_ns.
+ * the fields are protected by the thread lock.
+ */
+typedef struct sched_group {
+    struct sched_group *parent;
+    uint32_t weight;
+
+    /* bandwidth control */
+    lk_bigtime_t period_ns;
+    lk_bigtime_t quota_ns;
+    lk_bigtime_t period_start_ns;
+    lk_bigtime_t used_ns;
+    bool throttled;
+    timer_t refill_timer;
+} sched_group_t;
+
+#define SCHED_GROUP_DEFAULT_WEIGHT 100
+#define SCHED_GROUP_MAX_WEIGHT 1000
+
+/* a thread in the deadline class (THREAD_FLAG_DEADLINE) is owed runtime_ns of
+ * cpu time in every period_ns, on the cpu it was admitted on. it may run for
+ * runtime_ns before deadline_ns, after which it is throttled until deadline_ns
+ * starts its next period. the fields are protected by the thread lock.
+ */
+typedef struct thread_deadline {
+    lk_bigtime_t runtime_ns;
+    lk_bigtime_t period_ns;
+    uint32_t util; /* runtime_ns / period_ns, in parts per million */
+    int cpu;
+
+    /* the current period */
+    lk_bigtime_t deadline_ns;
+    lk_bigtime_t used_ns;
+    bool throttled;
+    timer_t replenish_timer;
+
+    /* budget overrun accounting: how many periods the thread ran out of budget
+     * in, and the total time it ran past its budget before it was stopped */
+    uint64_t overruns;
+    lk_bigtime_t overrun_ns;
+} thread_deadline_t;
+
 typedef struct thread {
     int magic;
     struct list_node thread_list_node;
 
     /* active bits */
     struct list_node queue_node;
-    int priority;
+    int priority; /* effective priority, including any inherited boost */
+    int base_priority;
     enum thread_state state;
-    int remaining_quantum;
+    int64_t remaining_quantum; /* ns left in the time slice */
     unsigned int flags;
     unsigned int signals;
 #if WITH_SMP
     int curr_cpu;
+    int last_cpu; /* cpu the thread last ran on, used for run queue selection */
     int pinned_cpu; /* only run on pinned_cpu if >= 0 */
+    int queued_cpu; /* run queue the thread is on while ready */
 #endif
 
     /* pointer to the kernel address space this thread is associated with */
@@ -98,6 +166,11 @@ typedef struct thread {
 
     /* accounting information */
     lk_bigtime_t last_started_running_ns;
+    /* when the thread last became ready, how, and who woke it; used for the
+     * scheduler latency histograms. ready_ns is 0 unless the thread is queued. */
+    lk_bigtime_t ready_ns;
+    uint32_t ready_reason;
+    uint32_t waker_tid;
     /* Total time in THREAD_RUNNING state.  If the thread is currently in
      * THREAD_RUNNING state, this excludes the time it has accrued since it
      * left the scheduler. */
@@ -106,6 +179,22 @@ typedef struct thread {
     /* if blocked, a pointer to the wait queue */
     struct wait_queue *blocking_wait_queue;
 
+    /* priority inheritance links to this thread, and the one this thread is
+     * lending its priority through while blocked (if any) */
+    struct list_node pi_links;
+    thread_pi_link_t *blocking_pi_link;
+
+    /* scheduling group the thread's cpu time is charged to, if any */
+    sched_group_t *sched_group;
+
+    /* only used while THREAD_FLAG_DEADLINE is set */
+    thread_deadline_t deadline;
+
+    /* direct handoff, see thread_handoff_begin(). handoff_wanted is only touched by
+     * the thread itself, handoff by the thread itself with the thread lock held. */
+    bool handoff_wanted;
+    struct thread *handoff;
+
     /* return code if woken up abnormally from suspend, sleep, or block */
     status_t blocked_status;
 
@@ -145,14 +234,22 @@ typedef struct thread {
 
 #if WITH_SMP
 #define thread_curr_cpu(t) ((t)->curr_cpu)
+#define thread_last_cpu(t) ((t)->last_cpu)
 #define thread_pinned_cpu(t) ((t)->pinned_cpu)
 #define thread_set_curr_cpu(t,c) ((t)->curr_cpu = (c))
+#define thread_set_last_cpu(t,c) ((t)->last_cpu = (c))
 #define thread_set_pinned_cpu(t, c) ((t)->pinned_cpu = (c))
+#define thread_queued_cpu(t) ((t)->queued_cpu)
+#define thread_set_queued_cpu(t, c) ((t)->queued_cpu = (c))
 #else
 #define thread_curr_cpu(t) (0)
+#define thread_last_cpu(t) (0)
 #define thread_pinned_cpu(t) (-1)
 #define thread_set_curr_cpu(t,c) do {} while(0)
+#define thread_set_last_cpu(t,c) do {} while(0)
 #define thread_set_pinned_cpu(t, c) do {} while(0)
+#define thread_queued_cpu(t) (0)
+#define thread_set_queued_cpu(t, c) do {} while(0)
 #endif
 
 /* thread priority */
@@ -197,6 +294,85 @@ status_t thread_set_real_time(thread_t *t);
 void thread_owner_name(thread_t *t, char out_name[THREAD_NAME_LENGTH]);
 void thread_print_backtrace(thread_t* t, void* fp);
 
+/* walk the frame pointers on the kernel stack of t from fp, putting at most max
+ * return addresses in pcs; returns how many */
+size_t thread_get_backtrace(thread_t* t, void* fp, uintptr_t* pcs, size_t max);
+
+/* priority inheritance, all called with the thread lock held.
+ * thread_pi_link_block: the current thread is about to block behind owner. links it
+ *   to owner (if it isn't already) and raises owner, and anything owner is itself
+ *   blocked behind, to at least the current thread's priority.
+ * thread_pi_link_set_owner: move a link to a new owner (or NULL to drop it) with the
+ *   given priority, recomputing both the old and new owners' priorities.
+ * thread_pi_unblock: the thread is no longer blocked behind its link.
+ */
+void thread_pi_link_block(thread_pi_link_t *link, thread_t *owner);
+void thread_pi_link_set_owner(thread_pi_link_t *link, thread_t *owner, int priority);
+void thread_pi_unblock(thread_t *t);
+
+/* scheduling groups. a group must outlive the threads placed in it, and
+ * sched_group_destroy must only be called once it has no threads left.
+ * sched_group_set_bandwidth: cap the group at quota_ns of cpu time every period_ns,
+ *   or lift the cap if period_ns is 0.
+ * thread_set_sched_group: must be called before the thread is first resumed.
+ */
+void sched_group_init(sched_group_t *group, sched_group_t *parent);
+void sched_group_destroy(sched_group_t *group);
+status_t sched_group_set_weight(sched_group_t *group, uint32_t weight);
+status_t sched_group_set_bandwidth(sched_group_t *group, lk_bigtime_t period_ns, lk_bigtime_t quota_ns);
+void thread_set_sched_group(thread_t *t, sched_group_t *group);
+
+/* put t in the deadline class: it is guaranteed runtime_ns of cpu time in every
+ * period_ns, ahead of all priority scheduled threads, and runs earliest deadline
+ * first against the other deadline threads of its cpu. threads are only admitted
+ * onto a cpu that has the bandwidth for them, ERR_NO_RESOURCES if none does.
+ * a runtime_ns of 0 returns t to priority scheduling.
+ */
+status_t thread_set_deadline(thread_t *t, lk_bigtime_t runtime_ns, lk_bigtime_t period_ns);
+
+/* move all of the threads queued on an offline cpu's run queue to active cpus */
+void thread_migrate_run_queue(uint old_cpu);
+
+/* whether t is what some cpu other than the current one is running right now.
+ * only compares against a per-cpu record of the running thread and never
+ * dereferences t, so t may be a thread that has since exited and been freed.
+ */
+bool thread_running_elsewhere(const thread_t *t);
+
+/* direct handoff for synchronous ipc. between thread_handoff_begin() and
+ * thread_handoff_end(), the first thread the current thread wakes is queued on
+ * this cpu instead of wherever it would otherwise go, so that it runs in the
+ * current thread's place as soon as that blocks, on the rest of its time slice.
+ * only use it when the current thread is certain to block right afterwards:
+ * nothing else moves the woken thread to another, possibly idle, cpu.
+ */
+void thread_handoff_begin(void);
+void thread_handoff_end(void);
+
+/* scheduler latency, the time threads spend ready before they get to run, kept
+ * per cpu (the one the thread ends up running on) in log2 nanosecond buckets.
+ * bucket i counts latencies in [2^(i-1), 2^i) ns, the last one everything longer.
+ */
+#define SCHED_LATENCY_BUCKETS 32
+
+#define SCHED_READY_WAKEUP  1 /* woken from blocked, sleeping or suspended */
+#define SCHED_READY_PREEMPT 2 /* preempted or yielded while running */
+
+struct sched_latency_hist {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[SCHED_LATENCY_BUCKETS];
+};
+
+struct sched_latency_stats {
+    struct sched_latency_hist wakeup;
+    struct sched_latency_hist preempt;
+};
+
+/* copy out a cpu's latency histograms, ERR_INVALID_ARGS if there's no such cpu */
+status_t thread_get_sched_latency(uint cpu, struct sched_latency_stats *stats);
+
 /* wait for at least delay amount of time. interruptable may return early with ERR_INTERRUPTED
  * if thread is signaled for kill.
  */
@@ -221,6 +397,7 @@ void dump_all_threads(bool full);
 /* scheduler routines */
 void thread_yield(void);             /* give up the cpu and time slice voluntarily */
 void thread_preempt(bool interrupt); /* get preempted (return to head of queue and reschedule) */
+void thread_reschedule(void);      /* let threads woken on this cpu run first (current goes to head of queue) */
 
 #ifdef WITH_LIB_UTHREAD
 void uthread_context_switch(thread_t *oldthread, thread_t *newthread);
@@ -254,12 +431,14 @@ struct thread_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong handoffs; /* threads woken to run next on the waker's cpu */
     ulong interrupts; /* platform code increment this */
     ulong timer_ints; /* timer code increment this */
     ulong timers; /* timer code increment this */
 
 #if WITH_SMP
     ulong reschedule_ipis;
+    ulong steals; /* threads pulled from another cpu's run queue */
 #endif
 };
 
@@ -27,6 +27,7 @@ typedef struct timer {
 
     lk_time_t scheduled_time;
     lk_time_t periodic_time;
+    lk_time_t slack;         // how late the timer may fire, for coalescing
 
     timer_callback callback;
     void *arg;
@@ -41,6 +42,7 @@ typedef struct timer {
     .node = LIST_INITIAL_CLEARED_VALUE, \
     .scheduled_time = 0, \
     .periodic_time = 0, \
+    .slack = 0, \
     .callback = NULL, \
     .arg = NULL, \
     .active_cpu = -1, \
@@ -56,6 +58,7 @@ typedef struct timer {
 */
 void timer_initialize(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t delay, timer_callback, void *arg);
+void timer_set_oneshot_etc(timer_t *, lk_time_t delay, lk_time_t slack, timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 void timer_cancel(timer_t *);
 
@@ -46,6 +46,11 @@ __BEGIN_CDECLS
 #define ROUNDUP_PAGE_SIZE(x) ROUNDUP((x), PAGE_SIZE)
 #define IS_PAGE_ALIGNED(x) IS_ALIGNED((x), PAGE_SIZE)
 
+/* smallest large page the mmu can map a suitably aligned, contiguous run of pages with,
+ * one page table's worth of pages */
+#define LARGE_PAGE_SIZE_SHIFT (PAGE_SIZE_SHIFT + (PAGE_SIZE_SHIFT - 3))
+#define LARGE_PAGE_SIZE (1UL << LARGE_PAGE_SIZE_SHIFT)
+
 struct mmu_initial_mapping {
     paddr_t phys;
     vaddr_t virt;
@@ -110,16 +115,29 @@ typedef struct pmm_arena_info {
 
     paddr_t base;
     size_t size;
+
+    uint node; /* numa node the memory is attached to */
 } pmm_arena_info_t;
 
 #define PMM_ARENA_FLAG_KMAP (0x1) /* this arena is already mapped and useful for kallocs */
 
+#define PMM_MAX_NUMA_NODES (8)
+
 /* Add a pre-filled memory arena to the physical allocator. */
 status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 
 /* flags for allocation routines below */
 #define PMM_ALLOC_FLAG_ANY (0x0)  /* no restrictions on which arena to allocate from */
 #define PMM_ALLOC_FLAG_KMAP (0x1) /* allocate only from arenas marked KMAP */
+#define PMM_ALLOC_FLAG_ZEROED (0x2) /* return zero filled pages, from KMAP arenas */
+#define PMM_ALLOC_FLAG_BIND (0x4) /* never fall back to another node than the preferred one */
+
+/* Allocations prefer the numa node of the cpu they run on, falling back to the
+ * other nodes in turn, unless a node is passed in the flags with this. */
+#define PMM_ALLOC_FLAG_NODE_VALID (0x8)
+#define PMM_ALLOC_FLAG_NODE_SHIFT (8)
+#define PMM_ALLOC_FLAG_NODE(n) (PMM_ALLOC_FLAG_NODE_VALID | ((uint)(n) << PMM_ALLOC_FLAG_NODE_SHIFT))
+#define PMM_ALLOC_FLAG_NODE_MASK (PMM_ALLOC_FLAG_NODE_VALID | (0xffu << PMM_ALLOC_FLAG_NODE_SHIFT))
 
 /* Allocate count pages of physical memory, adding to the tail of the passed list.
  * The list must be initialized.
@@ -151,9 +169,35 @@ size_t pmm_free(struct list_node* list) __NONNULL((1));
 /* Helper routine for the above. */
 size_t pmm_free_page(vm_page_t* page) __NONNULL((1));
 
+/* Free a list of count physical pages some time later, from a background thread.
+ * For tearing down large allocations without paying for it up front.
+ */
+void pmm_free_deferred(struct list_node* list, size_t count) __NONNULL((1));
+
 /* Return count of unallocated physical pages in system */
 size_t pmm_count_free_pages(void);
 
+/* Number of numa nodes with memory in them, at least one. */
+uint pmm_numa_node_count(void);
+
+/* Record which numa node a cpu is on, for its allocations to prefer. */
+void pmm_set_cpu_numa_node(uint cpu, uint node);
+
+/* The numa node a cpu is on. */
+uint pmm_cpu_numa_node(uint cpu);
+
+/* Whether free memory has dropped below the low watermark and not yet recovered
+ * past the high one.
+ */
+bool pmm_memory_pressure(void);
+
+/* Register a function to be called, from a dedicated thread, whenever the memory
+ * pressure state changes. It is also called once with the current state if that
+ * is under pressure.
+ */
+typedef void (*pmm_pressure_callback_t)(bool pressure);
+void pmm_set_pressure_callback(pmm_pressure_callback_t callback);
+
 /* Allocate a run of pages out of the kernel area and return the pointer in kernel space.
  * If the optional list is passed, append the allocate page structures to the tail of the list.
  * If the optional physical address pointer is passed, return the address.
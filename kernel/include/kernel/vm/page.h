@@ -29,6 +29,10 @@ typedef struct vm_page {
         struct {
             // in allocated/just freed state, use a linked list to hold the page in a queue
             struct list_node node;
+            // while free in a pmm arena, whether this page heads a buddy block
+            // on one of the arena's free lists, and if so the block's order
+            uint8_t order;
+            bool block_head;
         } free;
 #if __cplusplus
         struct {
@@ -53,10 +57,16 @@ enum vm_page_state {
     VM_PAGE_STATE_HEAP,
     VM_PAGE_STATE_OBJECT,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* free, but parked in a per-cpu pmm cache or the zero pool */
 
     _VM_PAGE_STATE_COUNT
 };
 
+// flags
+// set on the pages of a compressible vm object by an aging pass, and cleared when
+// they are next faulted in, so those still set at the next pass are cold
+#define VM_PAGE_FLAG_AGED (1u << 0)
+
 // helpers
 static inline bool page_is_free(const vm_page_t* page) {
     return page->state == VM_PAGE_STATE_FREE;
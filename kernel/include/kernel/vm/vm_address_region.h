@@ -41,6 +41,9 @@
 // with execute permissions.  When on a VmMapping, controls whether or not the
 // mapping can gain this permission.
 #define VMAR_FLAG_CAN_MAP_EXECUTE (1 << 6)
+// On a VmMapping, hint that it will mostly be accessed sequentially, so faults
+// should map a larger window of already resident pages ahead of the fault.
+#define VMAR_FLAG_MAP_SEQUENTIAL (1 << 7)
 
 #define VMAR_CAN_RWX_FLAGS (VMAR_FLAG_CAN_MAP_READ | \
                             VMAR_FLAG_CAN_MAP_WRITE | \
@@ -66,6 +69,8 @@ class VmMapping;
 // DEAD, then the VmAddressRegion is invalid and has no meaning.
 //
 // All VmAddressRegion and VmMapping state is protected by the aspace lock.
+// VmMapping state is additionally only changed with its object's lock held, so
+// that page faults can work on a mapping while holding just the latter.
 class VmAddressRegionOrMapping : public mxtl::RefCounted<VmAddressRegionOrMapping> {
 public:
     // If a VMO-mapping, unmap all pages and remove dependency on vm object it has a ref to.
@@ -242,6 +247,10 @@ private:
     // Version of FindRegion() that does not acquire the aspace lock
     mxtl::RefPtr<VmAddressRegionOrMapping> FindRegionLocked(vaddr_t addr);
 
+    // Find the mapping, at any depth below this VMAR, that includes *addr*.
+    // Does not acquire the aspace lock.
+    mxtl::RefPtr<VmMapping> FindMappingLocked(vaddr_t addr);
+
     // Version of Destroy() that does not acquire the aspace lock
     status_t DestroyLocked() override;
 
@@ -380,6 +389,17 @@ public:
     void Dump(uint depth, bool verbose) const override;
     status_t PageFault(vaddr_t va, uint pf_flags) override;
 
+    // Version of PageFault() called with the object's lock held rather than the
+    // aspace lock.  Everything that changes a mapping holds its object's lock,
+    // so that alone keeps the mapping stable for the duration of the fault.
+    // The caller must have checked CoversLocked(va) under the same hold of the lock.
+    status_t PageFaultLocked(vaddr_t va, uint pf_flags);
+
+    // True if the mapping is still alive and includes *va*.  Called with the
+    // object's lock held, after a lookup under the aspace lock that may since
+    // have been invalidated by an unmap, protect or destroy.
+    bool CoversLocked(vaddr_t va) const;
+
 protected:
     static const uint32_t kMagic = 0x564d4150; // VMAP
 
@@ -387,9 +407,11 @@ protected:
     friend mxtl::RefPtr<VmMapping>;
 
     // private apis from VmObject land
+    friend class VmObject;
     friend class VmObjectPaged;
 
-    // unmap any pages that map the passed in vmo range. May not intersect with this range
+    // unmap any pages that map the passed in vmo range. May not intersect with this range.
+    // Called with the object's lock held; does not need the aspace lock.
     status_t UnmapVmoRangeLocked(uint64_t start, uint64_t size);
 
 private:
@@ -414,6 +436,20 @@ private:
     // Implementation for Protect().  This does not acquire the aspace lock.
     status_t ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_flags);
 
+    // Map a physically contiguous run of pages, possibly with large pages.
+    void MapRun(vaddr_t va, paddr_t pa, size_t len);
+
+    // Try to satisfy a fault at va by mapping the whole large page around it.
+    bool MapLargePageLocked(vaddr_t va, uint64_t vmo_offset, uint mmu_flags);
+
+    // Map any already resident pages in a window around a fault at va that
+    // aren't mapped yet.
+    void FaultAroundLocked(vaddr_t va);
+
+    // arch_mmu_protect() a range, or unmap it if that would make pages borrowed by a
+    // copy-on-write clone writable.
+    status_t ProtectOrUnmap(vaddr_t base, size_t size, uint new_arch_mmu_flags);
+
     // Version of AllocatedPages() that does not acquire the aspace lock
     size_t AllocatedPagesLocked() const override;
 
@@ -428,6 +464,10 @@ private:
     mxtl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
 
+    // whether the object's pages are counted in our aspace's page counters through
+    // this mapping, guarded by the object's lock
+    bool counts_pages_ = false;
+
     // cached mapping flags (read/write/user/etc)
     uint arch_mmu_flags_;
 };
@@ -20,6 +20,41 @@
 
 class VmObject;
 
+// Counts of the pages owned by the vm objects mapped into an address space, split by
+// whether the object is also mapped into another address space. An object counts once
+// however many times it is mapped, and in full however much of it is mapped. Counters
+// can be chained to a parent that keeps the totals of all of its children, so owners
+// of many address spaces can read their usage in O(1) too.
+class VmPageCounters {
+public:
+    VmPageCounters() = default;
+    explicit VmPageCounters(VmPageCounters* parent) : parent_(parent) {}
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageCounters);
+
+    // must be set before any pages are counted
+    void set_parent(VmPageCounters* parent) {
+        DEBUG_ASSERT(private_pages() == 0 && shared_pages() == 0);
+        parent_ = parent;
+    }
+
+    // add to this and every parent's counts
+    void Add(ssize_t private_delta, ssize_t shared_delta) {
+        for (VmPageCounters* c = this; c; c = c->parent_) {
+            __atomic_fetch_add(&c->private_pages_, private_delta, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&c->shared_pages_, shared_delta, __ATOMIC_RELAXED);
+        }
+    }
+
+    size_t private_pages() const { return __atomic_load_n(&private_pages_, __ATOMIC_RELAXED); }
+    size_t shared_pages() const { return __atomic_load_n(&shared_pages_, __ATOMIC_RELAXED); }
+
+private:
+    VmPageCounters* parent_ = nullptr;
+    size_t private_pages_ = 0;
+    size_t shared_pages_ = 0;
+};
+
 class VmAspace : public mxtl::DoublyLinkedListable<VmAspace*>, public mxtl::RefCounted<VmAspace> {
 public:
     // complete initialization, may fail in OOM cases
@@ -62,6 +97,10 @@ public:
 
     size_t AllocatedPages() const;
 
+    // incrementally maintained counts of the pages of the objects mapped in
+    VmPageCounters& page_counters() { return page_counters_; }
+    const VmPageCounters& page_counters() const { return page_counters_; }
+
     // Convenience method for traversing the tree of VMARs to find the deepest
     // VMAR in the tree that includes *va*.
     mxtl::RefPtr<VmAddressRegionOrMapping> FindRegion(vaddr_t va);
@@ -91,6 +130,15 @@ protected:
     friend class VmMapping;
     mutex_t& lock() { return lock_; }
 
+    // Wrappers for the arch_mmu_*() calls on this aspace.  Page faults do not
+    // hold the aspace lock while they update the page tables, only the lock of
+    // the object being faulted on, so mappings of different objects may change
+    // the page tables concurrently.  These serialize on pt_lock_ instead.
+    int ArchMap(vaddr_t va, paddr_t pa, size_t count, uint mmu_flags);
+    int ArchUnmap(vaddr_t va, size_t count);
+    int ArchProtect(vaddr_t va, size_t count, uint mmu_flags);
+    status_t ArchQuery(vaddr_t va, paddr_t* pa, uint* mmu_flags);
+
     void AslrDraw(uint8_t* buf, size_t len);
 
 private:
@@ -123,6 +171,13 @@ private:
 
     mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
+    // serializes changes to the arch page tables, see ArchMap()
+    mutex_t pt_lock_ = MUTEX_INITIAL_VALUE(pt_lock_);
+
+    // set by Destroy() once it has cleared the page tables, after which
+    // the Arch*() wrappers leave them alone.  guarded by pt_lock_.
+    bool pt_destroyed_ = false;
+
     // root of virtual address space
     // Access to this reference is guarded by lock_.
     mxtl::RefPtr<VmAddressRegion> root_vmar_;
@@ -135,6 +190,8 @@ private:
     // architecturally specific part of the aspace
     arch_aspace_t arch_aspace_ = {};
 
+    VmPageCounters page_counters_;
+
     // initialization routines need to construct the singleton kernel address space
     // at a particular points in the bootup process
     static void KernelAspaceInitPreHeap();
@@ -0,0 +1,49 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <mxtl/intrusive_wavl_tree.h>
+#include <mxtl/macros.h>
+#include <mxtl/unique_ptr.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An LZ4 compressed copy of a page of a vm object, held in the kernel heap in
+// place of the page itself, keyed by its offset in the object.
+class VmCompressedPage final
+    : public mxtl::WAVLTreeContainable<mxtl::unique_ptr<VmCompressedPage>> {
+public:
+    // compress the page at the kernel address page, returning null if it doesn't
+    // compress well enough to be worth keeping this way or there's no memory
+    static mxtl::unique_ptr<VmCompressedPage> Create(const void* page, uint64_t offset);
+
+    ~VmCompressedPage();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(VmCompressedPage);
+
+    // fill the page at the kernel address page with the original contents
+    void Decompress(void* page) const;
+
+    uint64_t GetKey() const { return offset_; }
+
+    // heap bytes held, and pages compressed in all objects
+    static size_t total_bytes();
+    static size_t total_pages();
+
+    static void operator delete(void* ptr);
+
+private:
+    VmCompressedPage(uint64_t offset, uint32_t len) : offset_(offset), len_(len) {}
+
+    static void* operator new(size_t size, size_t data_len) noexcept;
+
+    const uint64_t offset_;
+    const uint32_t len_;
+    uint8_t data_[];
+};
+
+using VmCompressedPageTree = mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<VmCompressedPage>>;
@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_compressed_page.h>
 #include <kernel/vm/vm_page_list.h>
 #include <lib/user_copy/user_ptr.h>
 #include <list.h>
@@ -22,6 +23,64 @@
 
 class VmMapping;
 
+// A count of the pages committed to the vm objects charged to it, held to optional
+// soft and hard limits. Charges nest: a charge's pages count against its parent and
+// every charge above that too, and a commit is refused if it would take any of them
+// past its hard limit. The counts are atomics, so charging takes no locks unless a
+// limit is crossed.
+//
+// An observer hears when the pages go over or back under the soft limit, and when a
+// commit is refused by the hard limit, which stays reported until the pages drop
+// back under the soft limit (or under the hard limit if there is no soft one).
+class VmCommitCharge : public mxtl::RefCounted<VmCommitCharge> {
+public:
+    class Observer {
+    public:
+        // called with vm object locks held, so must not call back into the vm
+        virtual void OnCommitLimitChange(bool over_soft, bool over_hard) = 0;
+
+    protected:
+        ~Observer() = default;
+    };
+
+    explicit VmCommitCharge(mxtl::RefPtr<VmCommitCharge> parent) : parent_(mxtl::move(parent)) {}
+    ~VmCommitCharge();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(VmCommitCharge);
+
+    // whether pages more pages may be committed without going past the hard limit of
+    // this charge or any of its parents. if not, the one whose limit it is reports it.
+    bool CanCommit(size_t pages);
+
+    // add to the committed pages of this charge and every parent
+    void Add(ssize_t delta);
+
+    // limits in pages, zero for none. the soft limit may not be above the hard one.
+    // if tighten_only, neither limit may be raised or removed.
+    status_t SetLimits(size_t soft_pages, size_t hard_pages, bool tighten_only);
+
+    size_t committed_pages() const { return __atomic_load_n(&committed_, __ATOMIC_RELAXED); }
+
+    void set_observer(Observer* observer);
+
+private:
+    // tell the observer where things stand now
+    void Notify();
+
+    const mxtl::RefPtr<VmCommitCharge> parent_;
+
+    // serializes setting the limits, which are read without it
+    Mutex limits_lock_;
+
+    size_t committed_ = 0;
+    size_t soft_limit_ = 0;
+    size_t hard_limit_ = 0;
+    bool hard_hit_ = false;
+
+    Mutex observer_lock_;
+    Observer* observer_ TA_GUARDED(observer_lock_) = nullptr;
+};
+
 // The base vm object that holds a range of bytes of data
 //
 // Can be created without mapping and used as a container of data, or mappable
@@ -50,6 +109,16 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // commit a range and keep the object's pages where they are until a matching
+    // Unpin(), so their physical addresses may be handed to devices. while pinned,
+    // no page may be decommitted, discarded, moved or cut off by shrinking.
+    virtual status_t Pin(uint64_t offset, uint64_t len) {
+        return ERR_NOT_SUPPORTED;
+    }
+    virtual status_t Unpin() {
+        return ERR_NOT_SUPPORTED;
+    }
+
     // read/write operators against kernel pointers only
     virtual status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) {
         return ERR_NOT_SUPPORTED;
@@ -72,6 +141,28 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // create a copy-on-write clone of a range of the vmo
+    virtual status_t CloneCOW(uint64_t offset, uint64_t size, mxtl::RefPtr<VmObject>* clone_vmo) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // whether pages may be borrowed from a copy-on-write parent, which must never be
+    // mapped writable
+    virtual bool is_cow_clone() const { return false; }
+
+    // move the pages backing a range of src into a range of this object without
+    // copying them, replacing whatever was there and leaving the source range decommitted
+    virtual status_t MovePagesFrom(uint64_t offset, VmObject* src, uint64_t src_offset,
+                                   uint64_t len) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // whether this is a VmObjectPaged
+    virtual bool is_paged() const { return false; }
+
+    // charge the pages committed to this object, now and from here on, to charge
+    void SetCommitCharge(mxtl::RefPtr<VmCommitCharge> charge);
+
     virtual void Dump(uint depth, bool verbose) = 0;
 
     // cache maintainence operations.
@@ -88,8 +179,10 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 protected:
-    // private constructor (use Create())
+    // private constructors (use Create()). a clone shares the lock of the object it
+    // was cloned from, so the whole clone hierarchy is covered by the root's lock.
     VmObject();
+    explicit VmObject(VmObject& parent);
 
     // private destructor, only called from refptr
     virtual ~VmObject();
@@ -101,6 +194,9 @@ protected:
     // get a pointer to a page at a given offset
     friend class VmMapping;
 
+    // VmAspace takes lock() to hand a page fault off to a mapping
+    friend class VmAspace;
+
     virtual vm_page_t* GetPageLocked(uint64_t offset) TA_REQ(lock_) { return nullptr; }
 
     // get the physical address of a page at offset
@@ -126,28 +222,95 @@ protected:
         return NO_ERROR;
     }
 
+    // if a page aligned range of the object is fully committed and physically
+    // contiguous, so it could be mapped as a single run, return its physical address
+    virtual bool GetContiguousRunLocked(uint64_t offset, uint64_t len, paddr_t* pa) TA_REQ(lock_);
+
     Mutex& lock() TA_RET_CAP(lock_) { return lock_; }
 
     // TODO(teisenbe): Rename these to s/Region/Mapping/
     void AddRegionLocked(VmMapping* r) TA_REQ(lock_);
     void RemoveRegionLocked(VmMapping* r) TA_REQ(lock_);
 
+    // record that the object now owns pages pages, passing the change on to the page
+    // counters of the address spaces it is mapped into and to its commit charge
+    void UpdatePageCountLocked(size_t pages) TA_REQ(lock_);
+
+    // whether the commit charge allows pages more pages to be committed
+    bool CanCommitLocked(size_t pages) TA_REQ(lock_) {
+        return !commit_charge_ || commit_charge_->CanCommit(pages);
+    }
+
     // magic value
     static const uint32_t MAGIC = 0x564d4f5f; // VMO_
     uint32_t magic_ = MAGIC;
 
     // members
-    mutable Mutex lock_;
+    mutable Mutex local_lock_;
+    Mutex& lock_;
     mxtl::DoublyLinkedList<VmMapping*> region_list_ TA_GUARDED(lock_);
+
+    // pages owned as last counted, and the number of distinct address spaces the object
+    // is mapped into, each of which has one of its mappings of the object marked as the
+    // one to count the pages through
+    size_t counted_pages_ TA_GUARDED(lock_) = 0;
+    uint32_t mapped_aspaces_ TA_GUARDED(lock_) = 0;
+
+    // what counted_pages_ is charged to, if anything
+    mxtl::RefPtr<VmCommitCharge> commit_charge_ TA_GUARDED(lock_);
 };
 
 // the main VM object type, holding a list of pages
-class VmObjectPaged final : public VmObject {
+class VmObjectPaged final : public VmObject,
+                            public mxtl::DoublyLinkedListable<VmObjectPaged*> {
 public:
-    static mxtl::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size);
+    // create options
+    // back the object with physically contiguous, large page aligned runs of pages where
+    // possible, committing a whole run on first fault, so mappings of it can use large pages
+    static const uint32_t CREATE_OPT_LARGE_PAGES = (1u << 0);
+    // the contents are a cache the owner can regenerate, so the pages may be dropped
+    // under memory pressure, reading back as zeroes afterwards
+    static const uint32_t CREATE_OPT_DISCARDABLE = (1u << 1);
+    // spread the pages round robin over the numa nodes by offset, a large page run at
+    // a time with CREATE_OPT_LARGE_PAGES, rather than allocating them on the node of
+    // the cpu that faults them in. binding to a node is done through pmm_alloc_flags.
+    static const uint32_t CREATE_OPT_NUMA_INTERLEAVE = (1u << 2);
+    // anonymous memory of a user process: under memory pressure, pages that go
+    // untouched for a while are compressed into the kernel heap, and decompressed
+    // when next faulted in. not for objects the kernel maps or hands to devices
+    // without pinning.
+    static const uint32_t CREATE_OPT_COMPRESSIBLE = (1u << 3);
+
+    // traits to belong to the global list of discardable objects
+    struct DiscardableListTraits {
+        static mxtl::DoublyLinkedListNodeState<VmObjectPaged*>& node_state(VmObjectPaged& obj) {
+            return obj.discardable_node_;
+        }
+    };
+
+    // traits to belong to the global list of compressible objects
+    struct CompressibleListTraits {
+        static mxtl::DoublyLinkedListNodeState<VmObjectPaged*>& node_state(VmObjectPaged& obj) {
+            return obj.compressible_node_;
+        }
+    };
+
+    static mxtl::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                         uint32_t options = 0);
 
     static mxtl::RefPtr<VmObject> CreateFromROData(const void* data, size_t size);
 
+    // drop the pages of discardable objects, a whole object at a time, until at least
+    // count pages have been freed or every object has been visited. returns the number
+    // freed. takes object and address space locks, so must be called with no vm locks held.
+    static size_t DiscardPages(size_t count);
+
+    // make an aging pass over compressible objects, compressing the pages that
+    // haven't been touched since the last pass and marking the rest, until at least
+    // count pages have been freed or every object has been visited. returns the
+    // number freed. has the same locking requirements as DiscardPages().
+    static size_t CompressPages(size_t count);
+
     status_t Resize(uint64_t size) override;
 
     uint64_t size() const override { return size_; }
@@ -157,6 +320,8 @@ public:
     status_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint64_t* committed,
                                            uint8_t alignment_log2) override;
     status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
+    status_t Pin(uint64_t offset, uint64_t len) override;
+    status_t Unpin() override;
 
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) override;
     status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written) override;
@@ -168,6 +333,13 @@ public:
 
     status_t Lookup(uint64_t offset, uint64_t len, user_ptr<paddr_t>, size_t) override;
 
+    status_t CloneCOW(uint64_t offset, uint64_t size, mxtl::RefPtr<VmObject>* clone_vmo) override;
+    bool is_cow_clone() const override { return parent_ != nullptr; }
+
+    status_t MovePagesFrom(uint64_t offset, VmObject* src, uint64_t src_offset,
+                           uint64_t len) override;
+    bool is_paged() const override { return true; }
+
     void Dump(uint depth, bool verbose) override;
 
     status_t InvalidateCache(const uint64_t offset, const uint64_t len) override;
@@ -179,11 +351,13 @@ public:
     vm_page_t* FaultPageLocked(uint64_t offset, uint pf_flags) override TA_REQ(lock_);
 
 private:
-    // private constructor (use Create())
-    explicit VmObjectPaged(uint32_t pmm_alloc_flags);
+    // private constructors (use Create() or CloneCOW())
+    VmObjectPaged(uint32_t pmm_alloc_flags, uint32_t options);
+    VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObjectPaged> parent, uint64_t parent_offset);
 
     // private destructor, only called from refptr
     ~VmObjectPaged() override;
+    friend mxtl::RefPtr<VmObjectPaged>;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmObjectPaged);
 
@@ -197,6 +371,41 @@ private:
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
+    // the pmm flags to allocate the page at offset with, applying the numa policy
+    uint32_t AllocFlagsForOffset(uint64_t offset) const;
+    bool interleaved() const {
+        return (options_ & CREATE_OPT_NUMA_INTERLEAVE) && pmm_numa_node_count() > 1;
+    }
+
+    // commit the whole large page run around offset with a contiguous run of pages, if
+    // none of it is committed yet, returning the page at offset
+    vm_page_t* FaultLargePageLocked(uint64_t offset) TA_REQ(lock_);
+
+    // find the page backing offset in the nearest ancestor that has one
+    vm_page_t* GetParentPageLocked(uint64_t offset) TA_REQ(lock_);
+
+    // bring back the page at offset from its compressed copy, if it has one,
+    // returning ERR_NOT_FOUND if not. compressed pages aren't charged, so this
+    // is checked against the commit limits.
+    status_t DecompressPageLocked(uint64_t offset, vm_page_t** page) TA_REQ(lock_);
+
+    // bring back every compressed page with an offset in [start, end)
+    status_t DecompressRangeLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
+    // forget the compressed pages with offsets in [start, end)
+    void DropCompressedLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
+    // one aging pass for CompressPages(), returning the pages freed
+    size_t AgePagesLocked() TA_REQ(lock_);
+
+    // move pages from src, with both objects' locks held
+    status_t MovePagesFromLocked(uint64_t offset, VmObjectPaged* src, uint64_t src_offset,
+                                 uint64_t len) TA_REQ(lock_);
+
+    // unmap a range of the object from every mapping of it and of its clones,
+    // which may have the pages mapped through them
+    void RangeChangeUpdateLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
+
     // internal read/write routine that takes a templated copy function to help share some code
     template <typename T>
     status_t ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_copied, bool write,
@@ -212,9 +421,33 @@ private:
     // members
     uint64_t size_ = 0;
     uint32_t pmm_alloc_flags_ = PMM_ALLOC_FLAG_ANY;
+    const uint32_t options_ = 0;
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // the object this is a copy-on-write clone of, and where in it the clone starts.
+    // pages not present here are read from the parent until first written.
+    const mxtl::RefPtr<VmObjectPaged> parent_;
+    const uint64_t parent_offset_ = 0;
+
+    // clones of this object, each holding a reference to it
+    mxtl::DoublyLinkedList<VmObjectPaged*> children_list_ TA_GUARDED(lock_);
+
+    // outstanding Pin()s
+    uint32_t pin_count_ TA_GUARDED(lock_) = 0;
+
+    // pages compressed by AgePagesLocked(), which are in compressed_ instead of
+    // page_list_. compression is given up on for good once the physical
+    // addresses of the pages have been handed out by Lookup().
+    VmCompressedPageTree compressed_ TA_GUARDED(lock_);
+    bool compression_disabled_ TA_GUARDED(lock_) = false;
+
+    // guarded by the global discardable list lock
+    mxtl::DoublyLinkedListNodeState<VmObjectPaged*> discardable_node_;
+
+    // guarded by the global compressible list lock
+    mxtl::DoublyLinkedListNodeState<VmObjectPaged*> compressible_node_;
 };
 
 // VMO representing a physical range of memory
@@ -228,6 +461,7 @@ public:
 
     status_t GetPageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
     status_t FaultPageLocked(uint64_t offset, uint pf_flags, paddr_t* pa) override TA_REQ(lock_);
+    bool GetContiguousRunLocked(uint64_t offset, uint64_t len, paddr_t* pa) override TA_REQ(lock_);
 
 private:
     // private constructor (use Create())
@@ -6,63 +6,42 @@
 
 #pragma once
 
-#include <mxtl/intrusive_wavl_tree.h>
+#include <kernel/vm.h>
 #include <mxtl/macros.h>
-#include <mxtl/unique_ptr.h>
+#include <stdint.h>
 
 struct vm_page;
 
-class VmPageListNode final : public mxtl::WAVLTreeContainable<mxtl::unique_ptr<VmPageListNode>> {
+// a node in the page list's radix tree. leaf nodes hold page pointers, inner
+// nodes hold pointers to the nodes one level down.
+class VmPageListNode final {
 public:
-    explicit VmPageListNode(uint64_t offset);
+    VmPageListNode();
     ~VmPageListNode();
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageListNode);
 
-    static const size_t kPageFanOut = 16;
-
-    // accessors
-    uint64_t offset() const { return obj_offset_; }
-    uint64_t GetKey() const { return obj_offset_; }
-
-    // for every valid page in the node call the passed in function
-    template <typename T> void ForEveryPage(T func) {
-        for (size_t i = 0; i < kPageFanOut; i++) {
-            if (pages_[i]) {
-                func(pages_[i], obj_offset_ + i * PAGE_SIZE);
-            }
-        }
-    }
-
-    // for every valid page in the node call the passed in function
-    template <typename T> void ForEveryPage(T func) const {
-        for (size_t i = 0; i < kPageFanOut; i++) {
-            if (pages_[i]) {
-                func(pages_[i], obj_offset_ + i * PAGE_SIZE);
-            }
-        }
-    }
-
-    vm_page* GetPage(size_t index);
-    vm_page* RemovePage(size_t index);
-    status_t AddPage(vm_page* p, size_t index);
-
-    bool IsEmpty() const {
-        for (const auto p : pages_) {
-            if (p)
-                return false;
-        }
-        return true;
-    }
+    static const size_t kFanOutShift = 6;
+    static const size_t kFanOut = 1u << kFanOutShift;
 
 private:
+    friend class VmPageList;
+
     static const uint32_t kMagic = 0x504c5354; // 'PLST'
     uint32_t magic_ = kMagic;
 
-    uint64_t obj_offset_ = 0;
-    vm_page* pages_[kPageFanOut] = {};
+    // number of non null slots
+    uint32_t populated_ = 0;
+
+    union Slot {
+        vm_page* page;
+        VmPageListNode* node;
+    };
+    Slot slots_[kFanOut] = {};
 };
 
+// set of pages of a vm object, indexed by offset in a radix tree of
+// VmPageListNodes that grows in height as higher offsets are added
 class VmPageList final {
 public:
     VmPageList();
@@ -70,25 +49,88 @@ public:
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageList);
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the pages in offset order, calling the passed in function on every page
     template <typename T> void ForEveryPage(T per_page_func) {
-        for (auto& pl : list_) {
-            pl.ForEveryPage(per_page_func);
-        }
+        ForEveryPageInRange(per_page_func, 0, UINT64_MAX);
     }
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the pages in offset order, calling the passed in function on every page
     template <typename T> void ForEveryPage(T per_page_func) const {
-        for (auto& pl : list_) {
-            pl.ForEveryPage(per_page_func);
-        }
+        ForEveryPageInRange(per_page_func, 0, UINT64_MAX);
+    }
+
+    // walk the pages with offsets in [start_offset, end_offset), in offset order,
+    // only visiting the parts of the tree that cover the range
+    template <typename T>
+    void ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) {
+        if (!root_ || end_offset <= start_offset)
+            return;
+        WalkNode(root_, levels_ - 1, 0, start_offset >> PAGE_SIZE_SHIFT,
+                 ((end_offset - 1) >> PAGE_SIZE_SHIFT) + 1, per_page_func);
+    }
+
+    template <typename T>
+    void ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) const {
+        auto func = [&per_page_func](vm_page*& p, uint64_t offset) { per_page_func(p, offset); };
+        const_cast<VmPageList*>(this)->ForEveryPageInRange(func, start_offset, end_offset);
     }
 
     status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
     status_t FreePage(uint64_t offset);
+
+    // free every page with an offset in [start_offset, end_offset), returning how many
+    size_t FreeRange(uint64_t start_offset, uint64_t end_offset);
+
+    // remove every page with an offset in [start_offset, end_offset) without freeing
+    // them, adding them to pages in offset order, or just dropping them if pages is
+    // null because something else owns them now. returns how many were removed.
+    size_t TakeRange(uint64_t start_offset, uint64_t end_offset, list_node* pages);
     size_t FreeAllPages();
 
+    size_t page_count() const { return page_count_; }
+
 private:
-    mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<VmPageListNode>> list_;
+    // visit the pages under node, which is at level (0 being leaves) and covers page
+    // indexes from base, that fall in [start, end)
+    template <typename T>
+    static void WalkNode(VmPageListNode* node, uint level, uint64_t base, uint64_t start,
+                         uint64_t end, T& func) {
+        const uint shift = static_cast<uint>(level * VmPageListNode::kFanOutShift);
+        for (size_t i = IndexInRange(base, start, shift); i < VmPageListNode::kFanOut; i++) {
+            uint64_t child_base = base + (static_cast<uint64_t>(i) << shift);
+            if (child_base >= end)
+                return;
+            auto& slot = node->slots_[i];
+            if (level == 0) {
+                if (slot.page)
+                    func(slot.page, child_base << PAGE_SIZE_SHIFT);
+            } else if (slot.node) {
+                WalkNode(slot.node, level - 1, child_base, start, end, func);
+            }
+        }
+    }
+
+    // first slot of a node covering page indexes from base whose subtree can hold start
+    static size_t IndexInRange(uint64_t base, uint64_t start, uint shift) {
+        return (start > base) ? static_cast<size_t>((start - base) >> shift) : 0;
+    }
+
+    static size_t SlotIndex(uint64_t index, uint level) {
+        return (index >> (level * VmPageListNode::kFanOutShift)) & (VmPageListNode::kFanOut - 1);
+    }
+
+    // whether a tree levels deep can hold page index
+    static bool FitsInLevels(uint64_t index, uint levels) {
+        uint shift = levels * VmPageListNode::kFanOutShift;
+        return shift >= 64 || (index >> shift) == 0;
+    }
+
+    size_t TakeRangeInNode(VmPageListNode* node, uint level, uint64_t base, uint64_t start,
+                           uint64_t end, list_node* pages);
+    static void DeleteNode(VmPageListNode* node, uint level);
+
+    VmPageListNode* root_ = nullptr;
+    uint levels_ = 0;
+    size_t page_count_ = 0;
 };
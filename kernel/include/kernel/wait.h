@@ -14,6 +14,7 @@
 #include <arch/defines.h>
 #include <arch/ops.h>
 #include <arch/thread.h>
+#include <kernel/spinlock.h>
 
 __BEGIN_CDECLS;
 
@@ -22,6 +23,7 @@ __BEGIN_CDECLS;
 
 typedef struct wait_queue {
     int magic;
+    spin_lock_t lock;
     struct list_node list;
     int count;
 } wait_queue_t;
@@ -29,18 +31,34 @@ typedef struct wait_queue {
 #define WAIT_QUEUE_INITIAL_VALUE(q) \
 { \
     .magic = WAIT_QUEUE_MAGIC, \
+    .lock = SPIN_LOCK_INITIAL_VALUE, \
     .list = LIST_INITIAL_VALUE((q).list), \
     .count = 0 \
 }
 
+/* Locking rules for wait queues:
+ * - each wait queue is protected by its own spinlock, which also protects
+ *   whatever state the owning primitive (event, semaphore, etc) keeps next to it.
+ * - lock ordering is wait queue lock -> thread_lock. thread_lock (the run queue
+ *   lock) may be taken while holding a wait queue lock, never the other way
+ *   around.
+ * - if two wait queue locks must be nested (condition variable -> mutex, futex ->
+ *   mutex), the mutex's wait queue lock is always the inner one.
+ * - the wait queue must stay valid until every thread blocked on it has returned
+ *   from wait_queue_block().
+ */
+#define WAIT_QUEUE_LOCK(wait, state) spin_lock_saved_state_t state; spin_lock_irqsave(&(wait)->lock, state)
+#define WAIT_QUEUE_UNLOCK(wait, state) spin_unlock_irqrestore(&(wait)->lock, state)
+
 /* wait queue primitive */
-/* NOTE: must be inside critical section when using these */
 void wait_queue_init(wait_queue_t *wait);
 
+/* must be called with the wait queue lock held */
 void wait_queue_destroy(wait_queue_t *);
 
 /*
- * block on a wait queue.
+ * block on a wait queue. must be called with the wait queue lock held, which is
+ * dropped while blocked and reacquired before returning.
  * return status is whatever the caller of wait_queue_wake_*() specifies.
  * a timeout other than INFINITE_TIME will set abort after the specified time
  * and return ERR_TIMED_OUT. a timeout of 0 will immediately return.
@@ -48,15 +66,18 @@ void wait_queue_destroy(wait_queue_t *);
 status_t wait_queue_block(wait_queue_t *, lk_time_t timeout);
 
 /*
- * release one or more threads from the wait queue.
- * reschedule = should the system reschedule if any is released.
+ * release one or more threads from the wait queue. must be called with the wait
+ * queue lock held.
+ * reschedule = the caller intends to call thread_reschedule() once it has dropped
+ *              the wait queue lock, so keep the woken threads on this cpu.
  * wait_queue_error = what wait_queue_block() should return for the blocking thread.
  */
 int wait_queue_wake_one(wait_queue_t *, bool reschedule, status_t wait_queue_error);
 int wait_queue_wake_all(wait_queue_t *, bool reschedule, status_t wait_queue_error);
 
 /*
- * remove the thread from whatever wait queue it's in.
+ * remove the thread from whatever wait queue it's in. must be called with the lock
+ * of the wait queue the thread is blocked on held.
  * return an error if the thread is not currently blocked (or is the current thread)
  */
 status_t thread_unblock_from_wait_queue(struct thread *t, status_t wait_queue_error);
@@ -9,6 +9,7 @@
 #include <err.h>
 #include <magenta/compiler.h>
 #include <magenta/ktrace.h>
+#include <stdbool.h>
 
 __BEGIN_CDECLS
 
@@ -22,32 +23,40 @@ struct ktrace_probe_info {
     uint32_t num;
 };
 
-void* ktrace_open(uint32_t tag);
+// Records are written whole, so a reader of a stream never sees one half
+// filled in. The record's size comes from its tag, taking as many of the
+// arguments as fit. Returns false if the record was not written.
+bool ktrace_record(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+// Like ktrace_record() but with len bytes of data, at most 104, setting the
+// size in the tag.
+bool ktrace_record_data(uint32_t tag, const void* data, uint32_t len);
 void ktrace_tiny(uint32_t tag, uint32_t arg);
+// Called from the arch's counter overflow interrupt with the interrupted
+// pc and frame pointer, while the profiler is running.
+void ktrace_profile_sample(uintptr_t pc, void* fp, bool from_user);
 static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
-    uint32_t* data = (uint32_t*) ktrace_open(tag);
-    if (data) {
-        data[0] = a; data[1] = b; data[2] = c; data[3] = d;
-    }
+    ktrace_record(tag, a, b, c, d);
 }
 #define ktrace_probe0(_name) { \
     static __SECTION("ktrace_probe") ktrace_probe_info_t info = { .name = _name }; \
-    ktrace_open(TAG_PROBE_16(info.num)); \
+    ktrace_record(TAG_PROBE_16(info.num), 0, 0, 0, 0); \
 }
 #define ktrace_probe2(_name,arg0,arg1) { \
     static __SECTION("ktrace_probe") ktrace_probe_info_t info = { .name = _name }; \
-    uint32_t* args = ktrace_open(TAG_PROBE_24(info.num)); \
-    if (args) { \
-        args[0] = arg0; \
-        args[1] = arg1; \
-    } \
+    ktrace_record(TAG_PROBE_24(info.num), arg0, arg1, 0, 0); \
 }
 void ktrace_name(uint32_t tag, uint32_t id, uint32_t arg, const char* name);
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len);
 status_t ktrace_control(uint32_t action, uint32_t options, void* ptr);
 #else
-static inline void* ktrace_open(uint32_t tag) { return NULL; }
+static inline bool ktrace_record(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    return false;
+}
+static inline bool ktrace_record_data(uint32_t tag, const void* data, uint32_t len) {
+    return false;
+}
 static inline void ktrace_tiny(uint32_t tag, uint32_t arg) {}
+static inline void ktrace_profile_sample(uintptr_t pc, void* fp, bool from_user) {}
 static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {}
 static inline void ktrace_probe0(const char* name) {}
 static inline void ktrace_probe2(const char* name, uint32_t arg0, uint32_t arg1) {}
@@ -66,7 +75,25 @@ static inline status_t ktrace_control(uint32_t action, uint32_t options, void* p
 
 #define KTRACE_DEFAULT_BUFSIZE 32 // MB
 #define KTRACE_DEFAULT_GRPMASK 0xFFF
+#define KTRACE_DEFAULT_STREAMSIZE 1024 // KB per cpu
 
 void ktrace_report_live_threads(void);
 
 __END_CDECLS
+
+#ifdef __cplusplus
+#include <mxtl/ref_ptr.h>
+
+class VmObject;
+
+#if WITH_LIB_KTRACE
+// The VMO holding the stream of |cpu|, once KTRACE_ACTION_START_STREAM
+// has set the streams up.
+status_t ktrace_stream_vmo(uint32_t cpu, mxtl::RefPtr<VmObject>* vmo);
+#else
+static inline status_t ktrace_stream_vmo(uint32_t cpu, mxtl::RefPtr<VmObject>* vmo) {
+    return ERR_NOT_SUPPORTED;
+}
+#endif
+#endif
+
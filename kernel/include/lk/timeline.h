@@ -0,0 +1,36 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+/*
+ * Boot timeline.
+ *
+ * Stages of boot, from the bootloader through each init hook, are recorded
+ * here with their start and end times on the ktrace clock.  Until tracing is
+ * up they are kept in a fixed table; ktrace_init() then replays the table as
+ * TAG_BOOT_NAME/TAG_BOOT_BEGIN/TAG_BOOT_END records, and stages marked after
+ * that are written to the trace as they end.  The bootloader passes the times
+ * it took on the command line, as
+ * bootloader.timestamps=name:ticks,name:ticks,... in the order they happened,
+ * each stage running up to the next one.
+ */
+
+/* the current time on the clock the marks are taken with */
+uint64_t lk_timeline_now(void);
+
+/* record that |name| ran from |start| to |end|; |name| must stay valid */
+void lk_timeline_mark(const char *name, uint64_t start, uint64_t end);
+
+/* write every stage recorded so far to the trace, as at the start of one */
+void lk_timeline_report(void);
+
+__END_CDECLS
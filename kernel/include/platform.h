@@ -42,6 +42,11 @@ lk_bigtime_t current_time_hires(void);
 /* high-precision timer ticks per second */
 uint64_t ticks_per_second(void);
 
+/* if current_time_hires() is the high-precision timer ticks, as userspace reads
+ * them, scaled by a constant, store the nanoseconds per tick and return true */
+struct fp_32_64;
+bool platform_hires_per_tick(struct fp_32_64 *ns_per_tick);
+
 /* super early platform initialization, before almost everything */
 void platform_early_init(void);
 
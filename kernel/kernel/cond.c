@@ -21,12 +21,12 @@ void cond_destroy(cond_t *cond)
 {
     DEBUG_ASSERT(cond->magic == COND_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&cond->wait, state);
 
     cond->magic = 0;
     wait_queue_destroy(&cond->wait);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&cond->wait, state);
 }
 
 status_t cond_wait_timeout(cond_t *cond, mutex_t *mutex, lk_time_t timeout)
@@ -35,18 +35,19 @@ status_t cond_wait_timeout(cond_t *cond, mutex_t *mutex, lk_time_t timeout)
     DEBUG_ASSERT(mutex->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&cond->wait, state);
 
     // We specifically want reschedule=false here, otherwise the
     // combination of releasing the mutex and enqueuing the current thread
     // would not be atomic, which would mean that we could miss wakeups.
+    // The mutex's wait queue lock nests inside the cond's.
     mutex_release_internal(mutex, /* reschedule= */ false);
 
     status_t result = wait_queue_block(&cond->wait, timeout);
 
-    mutex_acquire_internal(mutex);
+    WAIT_QUEUE_UNLOCK(&cond->wait, state);
 
-    THREAD_UNLOCK(state);
+    mutex_acquire(mutex);
 
     return result;
 }
@@ -56,11 +57,14 @@ void cond_signal(cond_t *cond)
     DEBUG_ASSERT(cond->magic == COND_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&cond->wait, state);
 
-    wait_queue_wake_one(&cond->wait, true, NO_ERROR);
+    int woken = wait_queue_wake_one(&cond->wait, true, NO_ERROR);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&cond->wait, state);
+
+    if (woken > 0)
+        thread_reschedule();
 }
 
 void cond_broadcast(cond_t *cond)
@@ -68,9 +72,12 @@ void cond_broadcast(cond_t *cond)
     DEBUG_ASSERT(cond->magic == COND_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&cond->wait, state);
+
+    int woken = wait_queue_wake_all(&cond->wait, true, NO_ERROR);
 
-    wait_queue_wake_all(&cond->wait, true, NO_ERROR);
+    WAIT_QUEUE_UNLOCK(&cond->wait, state);
 
-    THREAD_UNLOCK(state);
+    if (woken > 0)
+        thread_reschedule();
 }
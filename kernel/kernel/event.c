@@ -56,14 +56,14 @@ void event_destroy(event_t *e)
 {
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     e->magic = 0;
     e->signaled = false;
     e->flags = 0;
     wait_queue_destroy(&e->wait);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 }
 
 /**
@@ -91,7 +91,7 @@ status_t event_wait_timeout(event_t *e, lk_time_t timeout, bool interruptable)
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     /* if we've been killed and going in interruptable, abort here */
     if (interruptable && unlikely((current_thread->signals & THREAD_SIGNAL_KILL))) {
@@ -115,7 +115,7 @@ status_t event_wait_timeout(event_t *e, lk_time_t timeout, bool interruptable)
     current_thread->interruptable = false;
 
 out:
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 
     return ret;
 }
@@ -144,7 +144,7 @@ int event_signal_etc(event_t *e, bool reschedule, status_t wait_result)
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
     DEBUG_ASSERT(!reschedule || !arch_in_int_handler());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     int wake_count = 0;
 
@@ -166,7 +166,10 @@ int event_signal_etc(event_t *e, bool reschedule, status_t wait_result)
         }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
+
+    if (reschedule && wake_count > 0)
+        thread_reschedule();
 
     return wake_count;
 }
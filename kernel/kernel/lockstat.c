@@ -0,0 +1,390 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/**
+ * @file
+ * @brief  Lock contention profiling
+ *
+ * Everything here runs from inside spin_lock() and mutex_acquire(), so it
+ * must not take any locks itself: classes are claimed and counters bumped
+ * with atomics only, and losing a race just means a sample lands somewhere
+ * slightly less precise.
+ */
+
+#include <kernel/lockstat.h>
+
+#if WITH_LOCKSTAT
+
+#include <arch/ops.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <lib/ktrace.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of distinct contended locks tracked */
+#define LOCKSTAT_NUM_CLASSES 256
+/* bucket i counts times in [2^(i-1), 2^i) ns, the last one everything longer */
+#define LOCKSTAT_HIST_BUCKETS 32
+/* call sites remembered per class, past this they're lumped together */
+#define LOCKSTAT_NUM_CALLERS 4
+/* spinlocks a cpu can hold at once and still have their hold time measured */
+#define LOCKSTAT_SPIN_DEPTH 8
+
+struct lockstat_caller {
+    uintptr_t pc;
+    uint64_t count;
+};
+
+struct lockstat_class {
+    /* address of the lock, 0 if the slot is free */
+    uintptr_t lock;
+    uint type;
+
+    uint64_t contentions;
+    uint64_t wait_total_ns;
+    uint64_t wait_max_ns;
+    uint64_t wait_hist[LOCKSTAT_HIST_BUCKETS];
+
+    uint64_t holds;
+    uint64_t hold_total_ns;
+    uint64_t hold_max_ns;
+    uint64_t hold_hist[LOCKSTAT_HIST_BUCKETS];
+
+    struct lockstat_caller callers[LOCKSTAT_NUM_CALLERS];
+    uint64_t other_callers;
+};
+
+struct lockstat_held_spinlock {
+    spin_lock_t *lock;
+    lk_bigtime_t start;
+    uint epoch;
+};
+
+int lockstat_enabled;
+
+static struct lockstat_class lockstat_classes[LOCKSTAT_NUM_CLASSES];
+static uint64_t lockstat_dropped;
+
+/* bumped each time collection starts, so that spinlocks that were pushed on
+ * a cpu's held stack during an earlier run can be told apart and dropped */
+static uint lockstat_epoch;
+
+/* spinlocks are held with interrupts disabled and released on the cpu that
+ * took them, so their acquire times can live in a per-cpu stack */
+static struct lockstat_held_spinlock lockstat_held[SMP_MAX_CPUS][LOCKSTAT_SPIN_DEPTH];
+static uint lockstat_held_depth[SMP_MAX_CPUS];
+
+static inline uint lockstat_hash(uintptr_t lock)
+{
+    return (uint)(((lock >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) % LOCKSTAT_NUM_CLASSES;
+}
+
+static struct lockstat_class *lockstat_find_class(const void *lock, bool create, uint type)
+{
+    uintptr_t key = (uintptr_t)lock;
+    uint index = lockstat_hash(key);
+
+    for (uint i = 0; i < LOCKSTAT_NUM_CLASSES; i++) {
+        struct lockstat_class *c = &lockstat_classes[(index + i) % LOCKSTAT_NUM_CLASSES];
+        uintptr_t cur = __atomic_load_n(&c->lock, __ATOMIC_ACQUIRE);
+        if (cur == key)
+            return c;
+        if (cur != 0)
+            continue;
+        if (!create)
+            return NULL;
+
+        if (__atomic_compare_exchange_n(&c->lock, &cur, key, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            c->type = type;
+            return c;
+        }
+        /* somebody beat us to this slot, maybe for the same lock */
+        if (cur == key)
+            return c;
+    }
+
+    if (create)
+        __atomic_fetch_add(&lockstat_dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static inline uint lockstat_bucket(lk_bigtime_t ns)
+{
+    uint bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+    return MIN(bucket, LOCKSTAT_HIST_BUCKETS - 1);
+}
+
+static void lockstat_update_max(uint64_t *max, uint64_t val)
+{
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (val > cur) {
+        if (__atomic_compare_exchange_n(max, &cur, val, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+}
+
+static void lockstat_count_caller(struct lockstat_class *c, uintptr_t caller)
+{
+    for (uint i = 0; i < LOCKSTAT_NUM_CALLERS; i++) {
+        uintptr_t cur = __atomic_load_n(&c->callers[i].pc, __ATOMIC_RELAXED);
+        if (cur == 0 && __atomic_compare_exchange_n(&c->callers[i].pc, &cur, caller, false,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            cur = caller;
+        if (cur == caller) {
+            __atomic_fetch_add(&c->callers[i].count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_fetch_add(&c->other_callers, 1, __ATOMIC_RELAXED);
+}
+
+void lockstat_record_wait(const void *lock, uint type, lk_bigtime_t wait_ns, uintptr_t caller)
+{
+    struct lockstat_class *c = lockstat_find_class(lock, true, type);
+    if (c == NULL)
+        return;
+
+    __atomic_fetch_add(&c->contentions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->wait_total_ns, wait_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->wait_hist[lockstat_bucket(wait_ns)], 1, __ATOMIC_RELAXED);
+    lockstat_update_max(&c->wait_max_ns, wait_ns);
+    lockstat_count_caller(c, caller);
+
+    uint64_t key = (uintptr_t)lock;
+    ktrace(TAG_LOCK_CONTEND, (uint32_t)key, (uint32_t)(key >> 32),
+           (uint32_t)MIN(wait_ns, UINT32_MAX), (uint32_t)caller);
+}
+
+void lockstat_record_hold(const void *lock, lk_bigtime_t hold_ns)
+{
+    struct lockstat_class *c = lockstat_find_class(lock, false, 0);
+    if (c == NULL)
+        return;
+
+    __atomic_fetch_add(&c->holds, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->hold_total_ns, hold_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->hold_hist[lockstat_bucket(hold_ns)], 1, __ATOMIC_RELAXED);
+    lockstat_update_max(&c->hold_max_ns, hold_ns);
+}
+
+void lockstat_spin_lock(spin_lock_t *lock)
+{
+    if (arch_spin_trylock(lock)) {
+        lk_bigtime_t start = current_time_hires();
+        arch_spin_lock(lock);
+        lockstat_record_wait(lock, LOCKSTAT_TYPE_SPIN, current_time_hires() - start,
+                             (uintptr_t)__GET_CALLER());
+    }
+
+    /* the per-cpu stack is only safe to touch with interrupts off */
+    if (!arch_ints_disabled())
+        return;
+
+    uint cpu = arch_curr_cpu_num();
+    uint epoch = __atomic_load_n(&lockstat_epoch, __ATOMIC_RELAXED);
+    struct lockstat_held_spinlock *held = lockstat_held[cpu];
+    uint depth = lockstat_held_depth[cpu];
+
+    /* anything left over from a previous run sits at the bottom */
+    if (depth > 0 && held[0].epoch != epoch) {
+        uint keep = 0;
+        for (uint i = 0; i < depth; i++) {
+            if (held[i].epoch == epoch)
+                held[keep++] = held[i];
+        }
+        depth = keep;
+    }
+
+    if (depth < LOCKSTAT_SPIN_DEPTH) {
+        held[depth].lock = lock;
+        held[depth].start = current_time_hires();
+        held[depth].epoch = epoch;
+        depth++;
+    }
+    lockstat_held_depth[cpu] = depth;
+}
+
+void lockstat_spin_unlock(spin_lock_t *lock)
+{
+    if (!arch_ints_disabled())
+        return;
+
+    uint cpu = arch_curr_cpu_num();
+    struct lockstat_held_spinlock *held = lockstat_held[cpu];
+    uint depth = lockstat_held_depth[cpu];
+
+    /* usually the most recent one, but locks needn't be released in order */
+    for (uint i = depth; i > 0; i--) {
+        if (held[i - 1].lock != lock)
+            continue;
+
+        lockstat_record_hold(lock, current_time_hires() - held[i - 1].start);
+        memmove(&held[i - 1], &held[i], (depth - i) * sizeof(held[0]));
+        lockstat_held_depth[cpu] = depth - 1;
+        return;
+    }
+}
+
+static void lockstat_start(void)
+{
+    __atomic_fetch_add(&lockstat_epoch, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&lockstat_enabled, 1, __ATOMIC_RELEASE);
+}
+
+static void lockstat_stop(void)
+{
+    __atomic_store_n(&lockstat_enabled, 0, __ATOMIC_RELEASE);
+}
+
+/* samples recorded by cpus that were in the middle of an update when this ran
+ * may survive it; good enough for a debugging aid */
+static void lockstat_reset(void)
+{
+    bool was_enabled = lockstat_active();
+    lockstat_stop();
+    memset(lockstat_classes, 0, sizeof(lockstat_classes));
+    lockstat_dropped = 0;
+    if (was_enabled)
+        lockstat_start();
+}
+
+static int lockstat_compare_wait(const void *a, const void *b)
+{
+    uint64_t wa = (*(const struct lockstat_class *const *)a)->wait_total_ns;
+    uint64_t wb = (*(const struct lockstat_class *const *)b)->wait_total_ns;
+    return (wa < wb) - (wa > wb);
+}
+
+/* fills |sorted| with the in-use classes, most total wait time first */
+static uint lockstat_sorted_classes(struct lockstat_class **sorted)
+{
+    uint count = 0;
+    for (uint i = 0; i < LOCKSTAT_NUM_CLASSES; i++) {
+        if (lockstat_classes[i].lock != 0)
+            sorted[count++] = &lockstat_classes[i];
+    }
+    qsort(sorted, count, sizeof(sorted[0]), lockstat_compare_wait);
+    return count;
+}
+
+static void lockstat_dump_hist(const char *what, const uint64_t *hist)
+{
+    printf("\t%s:", what);
+    for (uint i = 0; i < LOCKSTAT_HIST_BUCKETS; i++) {
+        if (hist[i] != 0)
+            printf(" <2^%u:%" PRIu64, i, hist[i]);
+    }
+    printf("\n");
+}
+
+static void lockstat_dump(uint max)
+{
+    static struct lockstat_class *sorted[LOCKSTAT_NUM_CLASSES];
+    uint count = lockstat_sorted_classes(sorted);
+
+    printf("lockstat: %s, %u contended locks, %" PRIu64 " dropped\n",
+           lockstat_active() ? "running" : "stopped", count, lockstat_dropped);
+
+    for (uint i = 0; i < MIN(count, max); i++) {
+        const struct lockstat_class *c = sorted[i];
+        printf("%s %#" PRIxPTR ": %" PRIu64 " contentions, wait total %" PRIu64
+               " ns max %" PRIu64 " ns, %" PRIu64 " holds, hold total %" PRIu64
+               " ns max %" PRIu64 " ns\n",
+               c->type == LOCKSTAT_TYPE_MUTEX ? "mutex" : "spin", c->lock,
+               c->contentions, c->wait_total_ns, c->wait_max_ns,
+               c->holds, c->hold_total_ns, c->hold_max_ns);
+        lockstat_dump_hist("wait ns", c->wait_hist);
+        lockstat_dump_hist("hold ns", c->hold_hist);
+        for (uint j = 0; j < LOCKSTAT_NUM_CALLERS; j++) {
+            if (c->callers[j].pc != 0)
+                printf("\tcaller %#" PRIxPTR ": %" PRIu64 "\n", c->callers[j].pc, c->callers[j].count);
+        }
+        if (c->other_callers != 0)
+            printf("\tother callers: %" PRIu64 "\n", c->other_callers);
+    }
+}
+
+/* writes a summary of every class into the trace buffer */
+static void lockstat_ktrace(void)
+{
+    for (uint i = 0; i < LOCKSTAT_NUM_CLASSES; i++) {
+        const struct lockstat_class *c = &lockstat_classes[i];
+        uint64_t key = c->lock;
+        if (key == 0)
+            continue;
+
+        ktrace(TAG_LOCK_STAT, (uint32_t)key, (uint32_t)(key >> 32),
+               (uint32_t)MIN(c->contentions, UINT32_MAX),
+               (uint32_t)MIN(c->wait_total_ns / 1000, UINT32_MAX));
+        ktrace(TAG_LOCK_HOLD_STAT, (uint32_t)key, (uint32_t)(key >> 32),
+               (uint32_t)MIN(c->holds, UINT32_MAX),
+               (uint32_t)MIN(c->hold_total_ns / 1000, UINT32_MAX));
+        for (uint j = 0; j < LOCKSTAT_NUM_CALLERS; j++) {
+            if (c->callers[j].pc == 0)
+                continue;
+            ktrace(TAG_LOCK_CALLER, (uint32_t)key, (uint32_t)(key >> 32),
+                   (uint32_t)c->callers[j].pc, (uint32_t)MIN(c->callers[j].count, UINT32_MAX));
+        }
+    }
+}
+
+static void lockstat_init(uint level)
+{
+    if (cmdline_get_bool("kernel.lockstat", false))
+        lockstat_start();
+}
+
+LK_INIT_HOOK(lockstat, lockstat_init, LK_INIT_LEVEL_THREADING);
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+
+static int cmd_lockstat(int argc, const cmd_args *argv)
+{
+    if (argc < 2) {
+usage:
+        printf("usage:\n");
+        printf("%s start\n", argv[0].str);
+        printf("%s stop\n", argv[0].str);
+        printf("%s reset\n", argv[0].str);
+        printf("%s dump [count]\n", argv[0].str);
+        printf("%s ktrace\n", argv[0].str);
+        return -1;
+    }
+
+    if (!strcmp(argv[1].str, "start")) {
+        lockstat_start();
+    } else if (!strcmp(argv[1].str, "stop")) {
+        lockstat_stop();
+    } else if (!strcmp(argv[1].str, "reset")) {
+        lockstat_reset();
+    } else if (!strcmp(argv[1].str, "dump")) {
+        lockstat_dump(argc > 2 ? (uint)argv[2].u : 10);
+    } else if (!strcmp(argv[1].str, "ktrace")) {
+        lockstat_ktrace();
+    } else {
+        printf("unrecognized subcommand\n");
+        goto usage;
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("lockstat", "lock contention statistics", &cmd_lockstat)
+STATIC_COMMAND_END(lockstat);
+
+#endif // WITH_LIB_CONSOLE
+
+#endif // WITH_LOCKSTAT
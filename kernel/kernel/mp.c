@@ -20,9 +20,13 @@
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
 #include <kernel/timer.h>
+#include <lib/counters.h>
 
 #define LOCAL_TRACE 0
 
+KCOUNTER(generic_ipis, "kernel.ipis.generic");
+KCOUNTER(reschedule_ipis, "kernel.ipis.reschedule");
+
 #if WITH_SMP
 /* a global state structure, aligned on cpu cache line to minimize aliasing */
 struct mp_state mp __CPU_ALIGN = {
@@ -42,6 +46,16 @@ void mp_init(void)
     }
 }
 
+void mp_set_cpu_domains(uint cpu, mp_cpu_mask_t smt, mp_cpu_mask_t package)
+{
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    DEBUG_ASSERT(smt & (1U << cpu));
+    DEBUG_ASSERT((smt & package) == smt);
+
+    mp.smt_cpus[cpu] = smt;
+    mp.package_cpus[cpu] = package;
+}
+
 void mp_reschedule(mp_cpu_mask_t target, uint flags)
 {
     uint local_cpu = arch_curr_cpu_num();
@@ -307,8 +321,10 @@ status_t mp_unplug_cpu(uint cpu_id) {
         status = event_wait(&unplug_done);
     } while (status < 0);
 
-    /* Now that the CPU is no longer processing tasks, move all of its timers */
+    /* Now that the CPU is no longer processing tasks, move all of its timers
+     * and any threads still sitting in its run queue */
     timer_transition_off_cpu(cpu_id);
+    thread_migrate_run_queue(cpu_id);
 
     status = platform_mp_cpu_unplug(cpu_id);
     if (status != NO_ERROR) {
@@ -352,6 +368,8 @@ enum handler_return mp_mbx_generic_irq(void)
     DEBUG_ASSERT(arch_ints_disabled());
     uint local_cpu = arch_curr_cpu_num();
 
+    kcounter_add(&generic_ipis, 1);
+
     while (1) {
         struct mp_ipi_task *task;
         spin_lock(&mp.ipi_task_lock);
@@ -373,6 +391,7 @@ enum handler_return mp_mbx_reschedule_irq(void)
     LTRACEF("cpu %u\n", cpu);
 
     THREAD_STATS_INC(reschedule_ipis);
+    kcounter_add(&reschedule_ipis, 1);
 
     return (mp.active_cpus & (1U << cpu)) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
@@ -19,7 +19,52 @@
 #include <debug.h>
 #include <assert.h>
 #include <err.h>
+#include <kernel/lockstat.h>
 #include <kernel/thread.h>
+#include <platform.h>
+
+/* number of times to poll a mutex held by a thread running on another cpu
+ * before giving up and blocking */
+#define MUTEX_SPIN_MAX_ITERATIONS 1000
+
+static_assert(__alignof(thread_t) > MUTEX_FLAG_QUEUED, "thread_t alignment too small for mutex flags");
+
+static inline bool mutex_cmpxchg(mutex_t *m, uintptr_t *oldval, uintptr_t newval)
+{
+    return __atomic_compare_exchange_n(&m->val, oldval, newval, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static inline uintptr_t mutex_val(const mutex_t *m)
+{
+    return __atomic_load_n(&m->val, __ATOMIC_RELAXED);
+}
+
+/* try to grab an unowned mutex without touching the thread lock */
+static inline bool mutex_trylock_fast(mutex_t *m, thread_t *ct)
+{
+    uintptr_t old = 0;
+    return mutex_cmpxchg(m, &old, (uintptr_t)ct);
+}
+
+#if WITH_LOCKSTAT
+/* note when the mutex changed hands, so the release can account the hold time */
+static inline void mutex_lockstat_acquired(mutex_t *m)
+{
+    m->lockstat_acquired = lockstat_active() ? current_time_hires() : 0;
+}
+
+static inline void mutex_lockstat_releasing(mutex_t *m)
+{
+    if (m->lockstat_acquired != 0) {
+        lockstat_record_hold(m, current_time_hires() - m->lockstat_acquired);
+        m->lockstat_acquired = 0;
+    }
+}
+#else
+static inline void mutex_lockstat_acquired(mutex_t *m) {}
+static inline void mutex_lockstat_releasing(mutex_t *m) {}
+#endif
 
 /**
  * @brief  Initialize a mutex_t
@@ -39,45 +84,107 @@ void mutex_destroy(mutex_t *m)
 {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&m->wait, state);
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(m->count > 0)) {
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(holder != NULL)) {
         panic("mutex_destroy: thread %p (%s) tried to destroy locked mutex %p,"
               " locked by %p (%s)\n",
               get_current_thread(), get_current_thread()->name, m,
-              m->holder, m->holder->name);
+              holder, holder->name);
     }
 #endif
+    DEBUG_ASSERT(!list_in_list(&m->pi_link.node));
     m->magic = 0;
-    m->count = 0;
+    m->val = 0;
     wait_queue_destroy(&m->wait);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
 }
 
-status_t mutex_acquire_internal(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
+/* block until ownership of the mutex is handed to us. must be called with the
+ * mutex's wait queue lock held.
+ */
+static status_t mutex_acquire_wait_queue_locked(mutex_t *m)
 {
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
-    if (unlikely(++m->count > 1)) {
-        status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
-        if (unlikely(ret < NO_ERROR)) {
-            /* mutexes are not interruptable and cannot time out, so it
-             * is illegal to return with any error state.
-             */
-            panic("mutex_acquire_internal: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
-                   ret, m, get_current_thread(), __GET_FRAME());
+    DEBUG_ASSERT(spin_lock_held(&m->wait.lock));
+
+    thread_t *ct = get_current_thread();
+
+    uintptr_t old = mutex_val(m);
+    for (;;) {
+        if (old == 0) {
+            /* the holder released it while we were on our way in */
+            if (mutex_cmpxchg(m, &old, (uintptr_t)ct))
+                return NO_ERROR;
+            continue;
         }
+
+        /* mark the mutex contended so the holder takes the slow release path.
+         * the bit can only be cleared by a releaser holding the wait queue lock, so
+         * once it is set we are guaranteed a wakeup.
+         */
+        if ((old & MUTEX_FLAG_QUEUED) || mutex_cmpxchg(m, &old, old | MUTEX_FLAG_QUEUED))
+            break;
+    }
+
+    /* lend our priority to the holder until it hands the mutex on */
+    spin_lock(&thread_lock);
+    thread_pi_link_block(&m->pi_link, (thread_t *)(old & ~MUTEX_FLAG_QUEUED));
+    spin_unlock(&thread_lock);
+
+    status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
+    if (unlikely(ret < NO_ERROR)) {
+        /* mutexes are not interruptable and cannot time out, so it
+         * is illegal to return with any error state.
+         */
+        panic("mutex_acquire: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
+               ret, m, ct, __GET_FRAME());
     }
 
-    m->holder = get_current_thread();
+    /* the releasing thread handed ownership directly to us */
+    DEBUG_ASSERT(mutex_holder(m) == ct);
 
     return NO_ERROR;
 }
 
+#if WITH_SMP
+/* spin for a bounded amount of time while the holder is running on another cpu,
+ * on the theory that it will release the mutex soon. the holder may have released
+ * the mutex and exited by the time we look, so its thread struct is never read;
+ * whether it's running comes from the scheduler's per-cpu record instead.
+ */
+static bool mutex_acquire_spin(mutex_t *m, thread_t *ct)
+{
+    for (uint i = 0; i < MUTEX_SPIN_MAX_ITERATIONS; i++) {
+        uintptr_t old = mutex_val(m);
+        if (old == 0) {
+            if (mutex_cmpxchg(m, &old, (uintptr_t)ct))
+                return true;
+            continue;
+        }
+
+        /* somebody is already blocked, don't jump the queue */
+        if (old & MUTEX_FLAG_QUEUED)
+            return false;
+
+        if (!thread_running_elsewhere((thread_t *)old))
+            return false;
+
+        arch_spinloop_pause();
+    }
+
+    return false;
+}
+#endif
+
 /**
  * @brief  Acquire the mutex
  *
+ * The uncontended case is a single compare-and-swap.  If the mutex is held by a
+ * thread running on another cpu, spin briefly before falling back to blocking
+ * on the mutex's wait queue.
+ *
  * @return  NO_ERROR on success, other values on error
  */
 status_t mutex_acquire(mutex_t *m)
@@ -85,48 +192,143 @@ status_t mutex_acquire(mutex_t *m)
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    thread_t *ct = get_current_thread();
+
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() == m->holder))
+    if (unlikely(ct == mutex_holder(m)))
         panic("mutex_acquire: thread %p (%s) tried to acquire mutex %p it already owns.\n",
-              get_current_thread(), get_current_thread()->name, m);
+              ct, ct->name, m);
+#endif
+
+    if (likely(mutex_trylock_fast(m, ct))) {
+        mutex_lockstat_acquired(m);
+        return NO_ERROR;
+    }
+
+#if WITH_LOCKSTAT
+    lk_bigtime_t wait_start = lockstat_active() ? current_time_hires() : 0;
 #endif
 
-    THREAD_LOCK(state);
-    status_t ret = mutex_acquire_internal(m);
-    THREAD_UNLOCK(state);
+    status_t ret = NO_ERROR;
+#if WITH_SMP
+    if (!mutex_acquire_spin(m, ct))
+#endif
+    {
+        WAIT_QUEUE_LOCK(&m->wait, state);
+        ret = mutex_acquire_wait_queue_locked(m);
+        WAIT_QUEUE_UNLOCK(&m->wait, state);
+    }
+
+#if WITH_LOCKSTAT
+    if (wait_start != 0) {
+        lockstat_record_wait(m, LOCKSTAT_TYPE_MUTEX, current_time_hires() - wait_start,
+                             (uintptr_t)__GET_CALLER());
+    }
+#endif
+    mutex_lockstat_acquired(m);
     return ret;
 }
 
+/* pick the highest priority waiter, oldest first among equals, and move it to
+ * the head of the wait queue so wait_queue_wake_one hands the mutex to it.
+ * returns the priority of the highest waiter left behind, or -1 if none.
+ */
+static int mutex_pick_next_waiter_locked(mutex_t *m, thread_t **nextp)
+{
+    thread_t *next = NULL;
+    int rest = -1;
+
+    thread_t *t;
+    list_for_every_entry(&m->wait.list, t, thread_t, queue_node) {
+        if (next == NULL || t->priority > next->priority) {
+            if (next != NULL)
+                rest = MAX(rest, next->priority);
+            next = t;
+        } else {
+            rest = MAX(rest, t->priority);
+        }
+    }
+
+    if (next != NULL && list_peek_head_type(&m->wait.list, thread_t, queue_node) != next) {
+        list_delete(&next->queue_node);
+        list_add_head(&m->wait.list, &next->queue_node);
+    }
+
+    *nextp = next;
+    return rest;
+}
+
+/* release the mutex, handing it to the first waiter if there is one. may be
+ * called with another wait queue lock held, in which case reschedule must be
+ * false; the mutex's wait queue lock always nests inside it.
+ */
 void mutex_release_internal(mutex_t *m, bool reschedule) TA_NO_THREAD_SAFETY_ANALYSIS
 {
-    DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    mutex_lockstat_releasing(m);
 
-    m->holder = 0;
+    uintptr_t old = (uintptr_t)get_current_thread();
+    if (likely(mutex_cmpxchg(m, &old, 0)))
+        return;
+
+    /* contended: the queued bit is set and waiters can't come or go while we
+     * hold the wait queue lock. pass ownership to the highest priority waiter,
+     * along with the priority the others are lending through the mutex.
+     */
+    WAIT_QUEUE_LOCK(&m->wait, state);
+
+    DEBUG_ASSERT(mutex_val(m) & MUTEX_FLAG_QUEUED);
+
+    int woken = 0;
+    spin_lock(&thread_lock);
+    thread_t *next;
+    int rest = mutex_pick_next_waiter_locked(m, &next);
+    if (unlikely(next == NULL)) {
+        __atomic_store_n(&m->val, 0, __ATOMIC_RELEASE);
+        thread_pi_link_set_owner(&m->pi_link, NULL, -1);
+        spin_unlock(&thread_lock);
+    } else {
+        uintptr_t newval = (uintptr_t)next;
+        if (m->wait.count > 1)
+            newval |= MUTEX_FLAG_QUEUED;
+        __atomic_store_n(&m->val, newval, __ATOMIC_RELEASE);
+
+        thread_pi_unblock(next);
+        if (m->wait.count > 1)
+            thread_pi_link_set_owner(&m->pi_link, next, rest);
+        else
+            thread_pi_link_set_owner(&m->pi_link, NULL, -1);
+        spin_unlock(&thread_lock);
 
-    if (unlikely(--m->count >= 1)) {
         /* release a thread */
-        wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
+        woken = wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
     }
+
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
+
+    if (reschedule && woken > 0)
+        thread_reschedule();
 }
 
 /**
  * @brief  Release mutex
+ *
+ * Only takes the wait queue lock if another thread is blocked on the mutex.
  */
 void mutex_release(mutex_t *m)
 {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    thread_t *ct = get_current_thread();
+
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() != m->holder)) {
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(ct != holder)) {
         panic("mutex_release: thread %p (%s) tried to release mutex %p it doesn't own. owned by %p (%s)\n",
-              get_current_thread(), get_current_thread()->name, m, m->holder, m->holder ? m->holder->name : "none");
+              ct, ct->name, m, holder, holder ? holder->name : "none");
     }
 #endif
 
-    THREAD_LOCK(state);
     mutex_release_internal(m, true);
-    THREAD_UNLOCK(state);
 }
 
@@ -13,6 +13,7 @@ MODULE_DEPS := \
 	lib/libc \
 	lib/debug \
 	lib/heap \
+	lib/counters \
     lib/mxtl \
 
 
@@ -21,13 +22,33 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/debug.c \
 	$(LOCAL_DIR)/event.c \
 	$(LOCAL_DIR)/init.c \
+	$(LOCAL_DIR)/lockstat.c \
 	$(LOCAL_DIR)/mutex.c \
 	$(LOCAL_DIR)/thread.c \
 	$(LOCAL_DIR)/timer.c \
 	$(LOCAL_DIR)/semaphore.c \
+	$(LOCAL_DIR)/stall_detector.c \
 	$(LOCAL_DIR)/mp.c \
 	$(LOCAL_DIR)/cmdline.c \
 
 MODULE_DEPS += kernel/vm
 
+# lock contention profiling, see include/kernel/lockstat.h
+WITH_LOCKSTAT ?= false
+ifeq ($(call TOBOOL,$(WITH_LOCKSTAT)),true)
+KERNEL_DEFINES += WITH_LOCKSTAT=1
+endif
+
+# interrupt latency and soft lockup detection, see include/kernel/stall_detector.h
+WITH_STALL_DETECTOR ?= false
+ifeq ($(call TOBOOL,$(WITH_STALL_DETECTOR)),true)
+KERNEL_DEFINES += WITH_STALL_DETECTOR=1
+endif
+
+# fair, first-come first-served spinlocks; set to false for plain test-and-set
+WITH_TICKET_SPINLOCKS ?= true
+ifeq ($(call TOBOOL,$(WITH_TICKET_SPINLOCKS)),true)
+KERNEL_DEFINES += WITH_TICKET_SPINLOCKS=1
+endif
+
 include make/module.mk
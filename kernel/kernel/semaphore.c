@@ -18,17 +18,17 @@ void sem_init(semaphore_t *sem, unsigned int value)
 
 void sem_destroy(semaphore_t *sem)
 {
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
     sem->count = 0;
     wait_queue_destroy(&sem->wait);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
 }
 
 int sem_post(semaphore_t *sem, bool resched)
 {
     int ret = 0;
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     /*
      * If the count is or was negative then a thread is waiting for a resource, otherwise
@@ -37,7 +37,10 @@ int sem_post(semaphore_t *sem, bool resched)
     if (unlikely(++sem->count <= 0))
         ret = wait_queue_wake_one(&sem->wait, resched, NO_ERROR);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
+
+    if (resched && ret > 0)
+        thread_reschedule();
 
     return ret;
 }
@@ -45,7 +48,7 @@ int sem_post(semaphore_t *sem, bool resched)
 status_t sem_wait(semaphore_t *sem)
 {
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     /*
      * If there are no resources available then we need to
@@ -54,28 +57,28 @@ status_t sem_wait(semaphore_t *sem)
     if (unlikely(--sem->count < 0))
         ret = wait_queue_block(&sem->wait, INFINITE_TIME);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
     return ret;
 }
 
 status_t sem_trywait(semaphore_t *sem)
 {
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     if (unlikely(sem->count <= 0))
         ret = ERR_UNAVAILABLE;
     else
         sem->count--;
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
     return ret;
 }
 
 status_t sem_timedwait(semaphore_t *sem, lk_time_t timeout)
 {
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     if (unlikely(--sem->count < 0)) {
         ret = wait_queue_block(&sem->wait, timeout);
@@ -86,6 +89,6 @@ status_t sem_timedwait(semaphore_t *sem, lk_time_t timeout)
         }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
     return ret;
 }
@@ -0,0 +1,285 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/**
+ * @file
+ * @brief  Interrupt latency and soft lockup detection
+ *
+ * The irqsave hooks run inside every spin_lock_irqsave(), so their per-cpu
+ * state is only touched with interrupts off, and the ring is only locked when
+ * there is a stall to put in it.
+ */
+
+#include <kernel/stall_detector.h>
+
+#if WITH_STALL_DETECTOR
+
+#include <arch/ops.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <stdio.h>
+#include <string.h>
+
+/* stalls remembered, must be a power of two */
+#define STALL_RING_SIZE 64
+/* how often each cpu's timer checks in */
+#define STALL_TIMER_PERIOD_MS 10
+#define STALL_DEFAULT_THRESHOLD_US 1000
+
+/* the outermost irqsave region open on a cpu */
+struct stall_irqs_off {
+    spin_lock_t *lock;
+    lk_bigtime_t start;
+    uintptr_t start_pc;
+    uint epoch;
+};
+
+int stall_detector_enabled;
+
+static lk_bigtime_t stall_threshold_ns = STALL_DEFAULT_THRESHOLD_US * 1000ULL;
+
+/* bumped each time detection starts, so that regions opened during an earlier
+ * run aren't closed against this one */
+static uint stall_epoch;
+
+static struct stall_irqs_off stall_irqs_off[SMP_MAX_CPUS];
+
+static timer_t stall_timers[SMP_MAX_CPUS];
+static bool stall_timer_armed[SMP_MAX_CPUS];
+
+static spin_lock_t stall_ring_lock = SPIN_LOCK_INITIAL_VALUE;
+static struct stall_record stall_ring[STALL_RING_SIZE];
+static uint64_t stall_next_seq;
+
+/* called with interrupts disabled */
+static void stall_record(uint type, lk_bigtime_t end, lk_bigtime_t duration, uintptr_t start_pc,
+                         const uintptr_t *backtrace, uint backtrace_count)
+{
+    thread_t *t = get_current_thread();
+
+    spin_lock(&stall_ring_lock);
+
+    uint64_t seq = stall_next_seq++;
+    struct stall_record *r = &stall_ring[seq & (STALL_RING_SIZE - 1)];
+    r->seq = seq;
+    r->end_time = end;
+    r->duration = duration;
+    r->cpu = arch_curr_cpu_num();
+    r->type = type;
+    r->tid = t ? t->user_tid : 0;
+    r->start_pc = start_pc;
+    r->backtrace_count = backtrace_count;
+    if (backtrace_count > 0)
+        memcpy(r->backtrace, backtrace, backtrace_count * sizeof(backtrace[0]));
+
+    spin_unlock(&stall_ring_lock);
+}
+
+void stall_detector_spin_lock_save(spin_lock_t *lock, spin_lock_saved_state_t *statep,
+                                   spin_lock_save_flags_t flags)
+{
+    bool were_enabled = !arch_ints_disabled();
+    arch_interrupt_save(statep, flags);
+
+    if (were_enabled) {
+        struct stall_irqs_off *region = &stall_irqs_off[arch_curr_cpu_num()];
+        region->lock = lock;
+        region->start = current_time_hires();
+        region->start_pc = (uintptr_t)__GET_CALLER();
+        region->epoch = __atomic_load_n(&stall_epoch, __ATOMIC_RELAXED);
+    }
+
+    spin_lock(lock);
+}
+
+void stall_detector_spin_unlock_restore(spin_lock_t *lock, spin_lock_saved_state_t old_state,
+                                        spin_lock_save_flags_t flags)
+{
+    /* the region is closed by releasing the lock that opened it, while still
+     * on the cpu it was opened on */
+    struct stall_irqs_off *region = &stall_irqs_off[arch_curr_cpu_num()];
+    if (region->lock == lock) {
+        region->lock = NULL;
+
+        lk_bigtime_t now = current_time_hires();
+        lk_bigtime_t duration = now - region->start;
+        if (duration > stall_threshold_ns &&
+            region->epoch == __atomic_load_n(&stall_epoch, __ATOMIC_RELAXED)) {
+            uintptr_t pcs[STALL_BACKTRACE_DEPTH];
+            uint count = (uint)thread_get_backtrace(get_current_thread(), __GET_FRAME(0),
+                                                    pcs, countof(pcs));
+            stall_record(STALL_TYPE_IRQS_OFF, now, duration, region->start_pc, pcs, count);
+        }
+    }
+
+    spin_unlock(lock);
+    arch_interrupt_restore(old_state, flags);
+}
+
+static enum handler_return stall_timer_callback(struct timer *t, lk_time_t now, void *arg)
+{
+    /* normally the cpu we're on, unless the timer was moved off an offlined cpu */
+    uint index = (uint)(t - stall_timers);
+
+    lk_bigtime_t time = current_time_hires();
+    lk_bigtime_t due = (lk_bigtime_t)t->scheduled_time * 1000000ULL;
+    if (time > due && time - due > stall_threshold_ns)
+        stall_record(STALL_TYPE_TIMER, time, time - due, 0, NULL, 0);
+
+    if (stall_detector_active())
+        timer_set_oneshot(t, STALL_TIMER_PERIOD_MS, stall_timer_callback, NULL);
+    else
+        stall_timer_armed[index] = false;
+
+    return INT_NO_RESCHEDULE;
+}
+
+/* runs on each cpu with interrupts disabled */
+static void stall_timer_arm(void *arg)
+{
+    uint cpu = arch_curr_cpu_num();
+    if (stall_timer_armed[cpu])
+        return;
+
+    stall_timer_armed[cpu] = true;
+    timer_set_oneshot(&stall_timers[cpu], STALL_TIMER_PERIOD_MS, stall_timer_callback, NULL);
+}
+
+/* each cpu's timer stops itself the next time it fires after this */
+static void stall_detector_stop(void)
+{
+    __atomic_store_n(&stall_detector_enabled, 0, __ATOMIC_RELEASE);
+}
+
+static void stall_detector_start(void)
+{
+    __atomic_fetch_add(&stall_epoch, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&stall_detector_enabled, 1, __ATOMIC_RELEASE);
+    mp_sync_exec(MP_CPU_ALL, stall_timer_arm, NULL);
+}
+
+uint64_t stall_detector_get_range(uint64_t *first)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    spin_lock(&stall_ring_lock);
+    uint64_t next = stall_next_seq;
+    spin_unlock(&stall_ring_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    *first = (next > STALL_RING_SIZE) ? next - STALL_RING_SIZE : 0;
+    return next;
+}
+
+bool stall_detector_get(uint64_t seq, struct stall_record *out)
+{
+    bool found = false;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    spin_lock(&stall_ring_lock);
+    const struct stall_record *r = &stall_ring[seq & (STALL_RING_SIZE - 1)];
+    if (seq < stall_next_seq && r->seq == seq) {
+        *out = *r;
+        found = true;
+    }
+    spin_unlock(&stall_ring_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return found;
+}
+
+static void stall_dump(void)
+{
+    uint64_t first;
+    uint64_t next = stall_detector_get_range(&first);
+
+    printf("stalls: %s, threshold %" PRIu64 " us, %" PRIu64 " recorded\n",
+           stall_detector_active() ? "running" : "stopped", stall_threshold_ns / 1000, next);
+
+    for (uint64_t seq = first; seq < next; seq++) {
+        struct stall_record r;
+        if (!stall_detector_get(seq, &r))
+            continue;
+        printf("#%" PRIu64 " cpu %u %s %" PRIu64 " us at %" PRIu64 " us, tid %" PRIu64,
+               r.seq, r.cpu, r.type == STALL_TYPE_TIMER ? "timer late" : "irqs off",
+               r.duration / 1000, r.end_time / 1000, r.tid);
+        if (r.type == STALL_TYPE_IRQS_OFF)
+            printf(", from %#" PRIxPTR, r.start_pc);
+        printf("\n");
+        for (uint i = 0; i < r.backtrace_count; i++)
+            printf("\tbt#%02u: %#" PRIxPTR "\n", i, r.backtrace[i]);
+    }
+}
+
+/* all cpus, so that secondaries that come up after the primary has started
+ * detection arm their own timer */
+static void stall_detector_init(uint level)
+{
+    uint cpu = arch_curr_cpu_num();
+    timer_initialize(&stall_timers[cpu]);
+
+    if (cpu == 0) {
+        uint32_t threshold_us = cmdline_get_uint32("kernel.stall_threshold_us",
+                                                   STALL_DEFAULT_THRESHOLD_US);
+        stall_threshold_ns = threshold_us * 1000ULL;
+        if (cmdline_get_bool("kernel.stall_detector", false))
+            stall_detector_start();
+    } else if (stall_detector_active()) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        stall_timer_arm(NULL);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    }
+}
+
+LK_INIT_HOOK_FLAGS(stall_detector, stall_detector_init, LK_INIT_LEVEL_THREADING,
+                   LK_INIT_FLAG_ALL_CPUS);
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+
+static int cmd_stalls(int argc, const cmd_args *argv)
+{
+    if (argc < 2) {
+usage:
+        printf("usage:\n");
+        printf("%s start [threshold us]\n", argv[0].str);
+        printf("%s stop\n", argv[0].str);
+        printf("%s dump\n", argv[0].str);
+        return -1;
+    }
+
+    if (!strcmp(argv[1].str, "start")) {
+        if (argc > 2)
+            stall_threshold_ns = argv[2].u * 1000ULL;
+        stall_detector_start();
+    } else if (!strcmp(argv[1].str, "stop")) {
+        stall_detector_stop();
+    } else if (!strcmp(argv[1].str, "dump")) {
+        stall_dump();
+    } else {
+        printf("unrecognized subcommand\n");
+        goto usage;
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("stalls", "interrupt latency and soft lockup detection", &cmd_stalls)
+STATIC_COMMAND_END(stalls);
+
+#endif // WITH_LIB_CONSOLE
+
+#endif // WITH_STALL_DETECTOR
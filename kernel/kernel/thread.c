@@ -30,6 +30,7 @@
 #include <platform.h>
 #include <target.h>
 #include <lib/heap.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 
 #if WITH_LIB_MAGENTA
@@ -40,6 +41,8 @@
 struct thread_stats thread_stats[SMP_MAX_CPUS];
 #endif
 
+KCOUNTER(context_switches, "kernel.context_switches");
+
 #define STACK_DEBUG_BYTE (0x99)
 #define STACK_DEBUG_WORD (0x99999999)
 
@@ -51,12 +54,29 @@ static struct list_node thread_list;
 /* master thread spinlock */
 spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* per cpu run queues.
+ * each cpu has its own set of priority queues and bitmap so that threads tend to stay
+ * on the cpu they last ran on. cpus that run out of work steal from their neighbours.
+ * all of the run queues are currently protected by thread_lock.
+ */
+struct run_queue {
+    struct list_node list[NUM_PRIORITIES];
+    uint32_t bitmap;
+    uint32_t count;
+    /* deadline threads admitted onto this cpu, in order of deadline. they aren't
+     * counted in count, which is only for priority scheduled threads */
+    struct list_node deadline_list;
+    /* only touched by the owning cpu from the timer tick */
+    uint32_t balance_ticks;
+} __CPU_ALIGN;
+
+static struct run_queue run_queue[SMP_MAX_CPUS];
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * 8, "");
+static_assert(NUM_PRIORITIES <= sizeof(run_queue[0].bitmap) * 8, "");
+
+/* ticks between periodic load balancing checks in thread_timer_tick() */
+#define RUN_QUEUE_BALANCE_TICKS 4
 
 /* the idle thread(s) (statically allocated) */
 #if WITH_SMP
@@ -73,35 +93,559 @@ static int idle_thread_routine(void *) __NO_RETURN;
 static void thread_exit_locked(thread_t *current_thread, int retcode) __NO_RETURN;
 static void thread_block(void);
 static void thread_unblock(thread_t *t, bool resched);
+static int wait_queue_wake_all_thread_locked(wait_queue_t *wait, bool reschedule,
+                                             status_t wait_queue_error);
+static status_t thread_unblock_from_wait_queue_thread_locked(thread_t *t, status_t wait_queue_error);
+
+/* length of a scheduler tick, and of a fresh quantum. quanta are charged in
+ * nanoseconds of the time actually run, the tick only decides how often a
+ * periodic timer gets to check on them.
+ */
+#define THREAD_TICK_MS 10
+#define THREAD_QUANTUM_NS (50 * 1000000LL)
+
+/* group weights can stretch a quantum to at most this many times the default */
+#define THREAD_QUANTUM_MAX_SCALE 8
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-/* preemption timer */
-static timer_t preempt_timer[SMP_MAX_CPUS];
+/* one-shot preemption timer, only armed while the running thread has
+ * something queued behind it to be preempted in favor of. only touched by
+ * the owning cpu with interrupts disabled.
+ */
+struct preempt_timer_state {
+    timer_t timer;
+    bool armed;
+} __CPU_ALIGN;
+
+static struct preempt_timer_state preempt_timer[SMP_MAX_CPUS];
+
+static void preempt_timer_update(uint cpu, thread_t *t);
+#endif
+
+static bool thread_is_deadline(const thread_t *t)
+{
+    return !!(t->flags & THREAD_FLAG_DEADLINE);
+}
+
+/* index of the highest priority queue with a thread in it, or -1 if empty */
+static inline int run_queue_top_priority(uint32_t bitmap)
+{
+    if (bitmap == 0)
+        return -1;
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap) - (sizeof(bitmap) * 8 - NUM_PRIORITIES);
+}
+
+#if WITH_SMP
+/* pick the cpu out of mask closest to cpu in the cache hierarchy: cpu itself,
+ * then an smt sibling, then a cpu in the same package, then any. mask must be
+ * non-empty.
+ */
+static uint find_cpu_near(uint cpu, mp_cpu_mask_t mask)
+{
+    DEBUG_ASSERT(mask);
+
+    if (mask & (1u << cpu))
+        return cpu;
+    mp_cpu_mask_t near = mask & mp_get_smt_mask(cpu);
+    if (near)
+        return __builtin_ctz(near);
+    near = mask & mp_get_package_mask(cpu);
+    if (near)
+        return __builtin_ctz(near);
+    return __builtin_ctz(mask);
+}
+
+/* how much cache cpus a and b share: 2 for the same core, 1 for the same package */
+static int cpu_cache_affinity(uint a, uint b)
+{
+    if (mp_get_smt_mask(a) & (1u << b))
+        return 2;
+    if (mp_get_package_mask(a) & (1u << b))
+        return 1;
+    return 0;
+}
+#endif
+
+/* pick a cpu to queue a newly ready thread on.
+ * deadline threads always go on the cpu they were admitted onto. otherwise
+ * prefer an idle cpu as close as possible to the one the thread last ran on (or
+ * to the local cpu if it hasn't run yet): the last cpu itself, an smt sibling,
+ * then a core in the same package. failing that, any idle cpu, then the last
+ * cpu, and finally the local cpu.
+ */
+static uint find_cpu_for_thread(thread_t *t)
+{
+#if WITH_SMP
+    uint local_cpu = arch_curr_cpu_num();
+    mp_cpu_mask_t active = mp_get_active_mask();
+
+    if (thread_is_deadline(t))
+        return t->deadline.cpu;
+    if (t->pinned_cpu >= 0)
+        return t->pinned_cpu;
+
+    mp_cpu_mask_t idle = mp_get_idle_mask() & active;
+    int last_cpu = t->last_cpu;
+
+    if (idle) {
+        if (last_cpu >= 0 && (active & (1u << last_cpu)))
+            return find_cpu_near(last_cpu, idle);
+        return find_cpu_near(local_cpu, idle);
+    }
+    if (last_cpu >= 0 && (active & (1u << last_cpu)))
+        return last_cpu;
+    return local_cpu;
+#else
+    return 0;
+#endif
+}
+
+/* per cpu scheduler latency, protected by the thread lock */
+static struct sched_latency_stats sched_latency[SMP_MAX_CPUS];
+
+/* start the clock on a thread that just became ready */
+static void thread_mark_ready(thread_t *t, uint32_t reason, uint cpu)
+{
+    t->ready_ns = current_time_hires();
+    t->ready_reason = reason;
+    /* a timer or irq firing on top of some thread didn't wake it on that thread's behalf */
+    t->waker_tid = arch_in_int_handler() ? 0 : (uint32_t)get_current_thread()->user_tid;
+
+#if WITH_LIB_KTRACE
+    if (reason == SCHED_READY_WAKEUP) {
+        ktrace(TAG_THREAD_WAKEUP, (uint32_t)t->user_tid, t->waker_tid, cpu,
+               (uint32_t)(uintptr_t)t);
+    }
+#endif
+}
+
+static void sched_latency_record(struct sched_latency_hist *hist, lk_bigtime_t latency)
+{
+    uint bucket = (latency == 0) ? 0 : 64 - __builtin_clzll(latency);
+
+    hist->count++;
+    hist->total_ns += latency;
+    hist->max_ns = MAX(hist->max_ns, latency);
+    hist->buckets[MIN(bucket, SCHED_LATENCY_BUCKETS - 1)]++;
+}
+
+/* stop the clock on a thread that is about to run on cpu */
+static void thread_account_ready_time(thread_t *t, uint cpu, lk_bigtime_t now)
+{
+    if (t->ready_ns == 0)
+        return;
+
+    lk_bigtime_t latency = now - t->ready_ns;
+    t->ready_ns = 0;
+
+    if (t->ready_reason == SCHED_READY_WAKEUP)
+        sched_latency_record(&sched_latency[cpu].wakeup, latency);
+    else
+        sched_latency_record(&sched_latency[cpu].preempt, latency);
+
+#if WITH_LIB_KTRACE
+    ktrace(TAG_SCHED_LATENCY, (uint32_t)t->user_tid, t->waker_tid,
+           (uint32_t)MIN(latency, UINT32_MAX), cpu | (t->ready_reason << 16));
+#endif
+}
+
+status_t thread_get_sched_latency(uint cpu, struct sched_latency_stats *stats)
+{
+    if (cpu >= SMP_MAX_CPUS)
+        return ERR_INVALID_ARGS;
+
+    THREAD_LOCK(state);
+    *stats = sched_latency[cpu];
+    THREAD_UNLOCK(state);
+
+    return NO_ERROR;
+}
+
+/* deadline class.
+ * deadline threads are partitioned: each one is admitted onto a cpu with the
+ * bandwidth to spare for it, and is only ever queued there, on a list of its own
+ * kept in order of deadline. the first thread on that list with budget left runs
+ * ahead of the priority queues, which makes each cpu earliest deadline first.
+ * admission keeps each cpu's total deadline utilization under DEADLINE_MAX_UTIL,
+ * so every thread gets its runtime by the end of each period and the priority
+ * scheduled threads keep the rest of the cpu.
+ */
+#define DEADLINE_UTIL_SCALE 1000000u
+#define DEADLINE_MAX_UTIL 900000u
+
+/* periods and budgets are counted out by millisecond timers, so a budget of
+ * less than one would be rounded up to one and overrun every period */
+#define DEADLINE_MIN_RUNTIME_NS 1000000ull
+#define DEADLINE_MIN_PERIOD_NS 1000000ull
+#define DEADLINE_MAX_PERIOD_NS 10000000000ull
+
+/* the utilization admitted onto each cpu, protected by the thread lock */
+static uint32_t deadline_util[SMP_MAX_CPUS];
+
+/* one-shot timer that stops the running deadline thread when its budget runs
+ * out, or preempts the running thread for a deadline thread queued ahead of it.
+ * only touched by the owning cpu with interrupts disabled.
+ */
+struct deadline_timer_state {
+    timer_t timer;
+    bool armed;
+} __CPU_ALIGN;
+
+static struct deadline_timer_state deadline_timer[SMP_MAX_CPUS];
+
+/* a millisecond timer delay covering at least ns */
+static lk_time_t deadline_ns_to_delay(lk_bigtime_t ns)
+{
+    return (lk_time_t)MIN(MAX((ns + 999999) / 1000000, 1u), (lk_bigtime_t)UINT32_MAX - 1);
+}
+
+static enum handler_return deadline_timer_handler(timer_t *timer, lk_time_t now, void *arg)
+{
+    struct deadline_timer_state *dt = containerof(timer, struct deadline_timer_state, timer);
+    uint cpu = dt - deadline_timer;
+
+    dt->armed = false;
+
+    /* the timer may have been moved here off of an unplugged cpu */
+    if (cpu != arch_curr_cpu_num())
+        return INT_NO_RESCHEDULE;
+
+    /* thread_resched() charges the running thread and picks what runs next */
+    return INT_RESCHEDULE;
+}
+
+static void deadline_timer_arm(uint cpu, lk_time_t delay)
+{
+    struct deadline_timer_state *dt = &deadline_timer[cpu];
+
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(cpu == arch_curr_cpu_num());
+
+    if (dt->armed)
+        timer_cancel(&dt->timer);
+    dt->armed = true;
+    timer_set_oneshot(&dt->timer, delay, deadline_timer_handler, NULL);
+}
+
+/* arm the budget timer for t, about to run on this cpu, or stop it if t isn't a
+ * deadline thread.
+ */
+static void deadline_timer_update(uint cpu, thread_t *t)
+{
+    struct deadline_timer_state *dt = &deadline_timer[cpu];
+
+    if (thread_is_deadline(t)) {
+        const thread_deadline_t *dl = &t->deadline;
+        lk_bigtime_t left = dl->runtime_ns > dl->used_ns ? dl->runtime_ns - dl->used_ns : 0;
+        deadline_timer_arm(cpu, deadline_ns_to_delay(left));
+    } else if (dt->armed) {
+        timer_cancel(&dt->timer);
+        dt->armed = false;
+    }
+}
+
+/* t was just queued on cpu, make sure it preempts whatever is running there if
+ * its deadline is earlier. the local cpu is preempted by its timer, at the next
+ * millisecond, since we can't reschedule from under the caller.
+ */
+static void deadline_kick(thread_t *t, uint cpu)
+{
+    if (t->deadline.throttled)
+        return;
+
+    if (cpu != arch_curr_cpu_num()) {
+        mp_reschedule(1u << cpu, MP_RESCHEDULE_FLAG_REALTIME);
+        return;
+    }
+
+    /* requeues of the current thread are sorted out by the thread_resched() that follows */
+    thread_t *current_thread = get_current_thread();
+    if (current_thread->state != THREAD_RUNNING)
+        return;
+    if (thread_is_deadline(current_thread) &&
+            current_thread->deadline.deadline_ns <= t->deadline.deadline_ns)
+        return;
+
+    deadline_timer_arm(cpu, 0);
+}
+
+/* queue a deadline thread on its cpu, behind the ones with the same or an earlier deadline */
+static void deadline_queue_insert(thread_t *t)
+{
+    uint cpu = t->deadline.cpu;
+    struct run_queue *rq = &run_queue[cpu];
+    thread_t *entry;
+    bool queued = false;
+
+    list_for_every_entry(&rq->deadline_list, entry, thread_t, queue_node) {
+        if (entry->deadline.deadline_ns > t->deadline.deadline_ns) {
+            list_add_before(&entry->queue_node, &t->queue_node);
+            queued = true;
+            break;
+        }
+    }
+    if (!queued)
+        list_add_tail(&rq->deadline_list, &t->queue_node);
+    thread_set_queued_cpu(t, cpu);
+
+    deadline_kick(t, cpu);
+}
+
+/* the earliest deadline thread on a cpu that has budget left */
+static thread_t *deadline_queue_pick(struct run_queue *rq)
+{
+    thread_t *t;
+
+    list_for_every_entry(&rq->deadline_list, t, thread_t, queue_node) {
+        if (!t->deadline.throttled) {
+            list_delete(&t->queue_node);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* move a queued deadline thread whose deadline changed to its new place */
+static void deadline_requeue(thread_t *t)
+{
+    if (t->state == THREAD_READY && list_in_list(&t->queue_node)) {
+        list_delete(&t->queue_node);
+        deadline_queue_insert(t);
+    }
+}
+
+static void deadline_new_period(thread_t *t, lk_bigtime_t now)
+{
+    t->deadline.deadline_ns = now + t->deadline.period_ns;
+    t->deadline.used_ns = 0;
+}
+
+/* a deadline thread is waking up. if it couldn't use what's left of its budget by
+ * its deadline without running above its reserved bandwidth, start a new period
+ * now, so that a thread that slept through most of a period can't crowd out the
+ * others by catching up (the constant bandwidth server wakeup rule).
+ */
+static void deadline_wakeup(thread_t *t, lk_bigtime_t now)
+{
+    thread_deadline_t *dl = &t->deadline;
+
+    if (dl->throttled)
+        return;
+
+    if (now < dl->deadline_ns) {
+        lk_bigtime_t left = dl->runtime_ns > dl->used_ns ? dl->runtime_ns - dl->used_ns : 0;
+
+        /* left / (deadline - now) <= runtime / period, in microseconds to stay in 64 bits */
+        if ((left / 1000) * (dl->period_ns / 1000) <=
+                ((dl->deadline_ns - now) / 1000) * (dl->runtime_ns / 1000))
+            return;
+    }
+    deadline_new_period(t, now);
+}
+
+/* start of a throttled thread's next period */
+static enum handler_return deadline_replenish_handler(timer_t *timer, lk_time_t now, void *arg)
+{
+    thread_t *t = (thread_t *)arg;
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    /* thread_set_deadline and thread exit cancel this timer with the thread lock
+     * held, same as thread_sleep_handler.
+     */
+    while (unlikely(spin_trylock(&thread_lock))) {
+        if (timer->cancel)
+            return INT_NO_RESCHEDULE;
+    }
+
+    /* the overrun was accounted when the budget ran out, it isn't carried over */
+    thread_deadline_t *dl = &t->deadline;
+    dl->throttled = false;
+    dl->deadline_ns += dl->period_ns;
+    dl->used_ns = 0;
+    deadline_requeue(t);
+
+    spin_unlock(&thread_lock);
+
+    return INT_NO_RESCHEDULE;
+}
+
+/* charge a deadline thread for time it ran. once its budget is gone it is
+ * throttled until its deadline, when the next period starts.
+ */
+static void deadline_charge(thread_t *t, lk_bigtime_t ran, lk_bigtime_t now)
+{
+    thread_deadline_t *dl = &t->deadline;
+
+    /* only the part of it since the current period started counts */
+    lk_bigtime_t period_start = dl->deadline_ns - dl->period_ns;
+    if (now - ran < period_start)
+        ran = now > period_start ? now - period_start : 0;
+
+    dl->used_ns += ran;
+    if (dl->throttled || dl->used_ns < dl->runtime_ns)
+        return;
+
+    /* the budget timer only stops threads to the millisecond */
+    lk_bigtime_t overrun = dl->used_ns - dl->runtime_ns;
+    dl->overruns++;
+    dl->overrun_ns += overrun;
+
+#if WITH_LIB_KTRACE
+    ktrace(TAG_DEADLINE_OVERRUN, (uint32_t)t->user_tid, (uint32_t)MIN(overrun, UINT32_MAX),
+           (uint32_t)dl->overruns, dl->cpu);
 #endif
 
+    if (now >= dl->deadline_ns) {
+        /* the period is already over, go straight on to the next */
+        deadline_new_period(t, now);
+        deadline_requeue(t);
+    } else {
+        dl->throttled = true;
+        timer_set_oneshot(&dl->replenish_timer, deadline_ns_to_delay(dl->deadline_ns - now),
+                          deadline_replenish_handler, t);
+    }
+}
+
+/* the cpu to admit a thread needing util onto, or -1 if none has the room: the
+ * active cpu with the least deadline utilization, the one the thread last ran on
+ * between equals. a pinned thread can only go on its own cpu.
+ */
+static int deadline_pick_cpu(thread_t *t, uint32_t util)
+{
+    mp_cpu_mask_t cpus = mp_get_active_mask();
+    if (thread_pinned_cpu(t) >= 0)
+        cpus &= 1u << thread_pinned_cpu(t);
+
+    int best = -1;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!(cpus & (1u << cpu)) || deadline_util[cpu] + util > DEADLINE_MAX_UTIL)
+            continue;
+        if (best < 0 || deadline_util[cpu] < deadline_util[best] ||
+                (deadline_util[cpu] == deadline_util[best] && (int)cpu == thread_last_cpu(t)))
+            best = cpu;
+    }
+    return best;
+}
+
+/* take t out of the deadline class, giving its bandwidth back */
+static void deadline_release(thread_t *t)
+{
+    deadline_util[t->deadline.cpu] -= t->deadline.util;
+    timer_cancel(&t->deadline.replenish_timer);
+    t->deadline.throttled = false;
+    t->flags &= ~THREAD_FLAG_DEADLINE;
+}
+
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static void insert_in_run_queue_head_cpu(thread_t *t, uint cpu)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    if (thread_is_deadline(t)) {
+        deadline_queue_insert(t);
+        return;
+    }
+
+    struct run_queue *rq = &run_queue[cpu];
+    list_add_head(&rq->list[t->priority], &t->queue_node);
+    rq->bitmap |= (1<<t->priority);
+    rq->count++;
+    thread_set_queued_cpu(t, cpu);
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* the running thread may have been alone with its tick stopped. requeues of the
+     * current thread itself are sorted out by the thread_resched() that follows.
+     */
+    if (cpu == arch_curr_cpu_num() && get_current_thread()->state == THREAD_RUNNING)
+        preempt_timer_update(cpu, get_current_thread());
+#endif
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void insert_in_run_queue_tail_cpu(thread_t *t, uint cpu)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    if (thread_is_deadline(t)) {
+        deadline_queue_insert(t);
+        return;
+    }
+
+    struct run_queue *rq = &run_queue[cpu];
+    list_add_tail(&rq->list[t->priority], &t->queue_node);
+    rq->bitmap |= (1<<t->priority);
+    rq->count++;
+    thread_set_queued_cpu(t, cpu);
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* the running thread may have been alone with its tick stopped. requeues of the
+     * current thread itself are sorted out by the thread_resched() that follows.
+     */
+    if (cpu == arch_curr_cpu_num() && get_current_thread()->state == THREAD_RUNNING)
+        preempt_timer_update(cpu, get_current_thread());
+#endif
+}
+
+/* queue a thread at the head of the best cpu's run queue.
+ * returns a mask of the cpu it was queued on, suitable for mp_reschedule().
+ */
+static mp_cpu_mask_t insert_in_run_queue_head(thread_t *t)
+{
+    uint cpu = find_cpu_for_thread(t);
+    thread_mark_ready(t, SCHED_READY_WAKEUP, cpu);
+    if (thread_is_deadline(t))
+        deadline_wakeup(t, t->ready_ns);
+    insert_in_run_queue_head_cpu(t, cpu);
+    return 1u << cpu;
+}
+
+/* queue a thread on the local cpu (unless pinned or admitted elsewhere), used
+ * when the caller is about to reschedule and wants the thread to run right away.
+ */
+static mp_cpu_mask_t insert_in_run_queue_head_local(thread_t *t)
+{
+    uint cpu = arch_curr_cpu_num();
+    if (thread_is_deadline(t))
+        cpu = t->deadline.cpu;
+    else if (thread_pinned_cpu(t) >= 0)
+        cpu = thread_pinned_cpu(t);
+    thread_mark_ready(t, SCHED_READY_WAKEUP, cpu);
+    if (thread_is_deadline(t))
+        deadline_wakeup(t, t->ready_ns);
+    insert_in_run_queue_head_cpu(t, cpu);
+    return 1u << cpu;
+}
+
+/* requeue the currently running thread on its own cpu */
+static void insert_current_in_run_queue_head(thread_t *t)
+{
+    thread_mark_ready(t, SCHED_READY_PREEMPT, arch_curr_cpu_num());
+    insert_in_run_queue_head_cpu(t, arch_curr_cpu_num());
+}
+
+static void insert_current_in_run_queue_tail(thread_t *t)
+{
+    thread_mark_ready(t, SCHED_READY_PREEMPT, arch_curr_cpu_num());
+    insert_in_run_queue_tail_cpu(t, arch_curr_cpu_num());
+}
+
+static void remove_from_run_queue(struct run_queue *rq, thread_t *t, uint priority)
+{
+    list_delete(&t->queue_node);
+    rq->count--;
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    if (list_is_empty(&rq->list[priority]))
+        rq->bitmap &= ~(1<<priority);
 }
 
 static void init_thread_struct(thread_t *t, const char *name)
@@ -109,8 +653,11 @@ static void init_thread_struct(thread_t *t, const char *name)
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
     thread_set_pinned_cpu(t, -1);
+    thread_set_last_cpu(t, -1);
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
+    list_initialize(&t->pi_links);
+    timer_initialize(&t->deadline.replenish_timer);
 }
 
 static void initial_thread_func(void) __NO_RETURN;
@@ -179,6 +726,7 @@ thread_t *thread_create_etc(
     t->entry = entry;
     t->arg = arg;
     t->priority = priority;
+    t->base_priority = priority;
     t->state = THREAD_SUSPENDED;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
@@ -249,13 +797,13 @@ status_t thread_set_real_time(thread_t *t)
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
     THREAD_LOCK(state);
+    t->flags |= THREAD_FLAG_REAL_TIME;
 #if PLATFORM_HAS_DYNAMIC_TIMER
     if (t == get_current_thread()) {
         /* if we're currently running, cancel the preemption timer. */
-        timer_cancel(&preempt_timer[arch_curr_cpu_num()]);
+        preempt_timer_update(arch_curr_cpu_num(), t);
     }
 #endif
-    t->flags |= THREAD_FLAG_REAL_TIME;
     THREAD_UNLOCK(state);
 
     return NO_ERROR;
@@ -271,9 +819,11 @@ static bool thread_is_idle(thread_t *t)
     return !!(t->flags & THREAD_FLAG_IDLE);
 }
 
+/* threads that aren't preempted at the end of a quantum. deadline threads are
+ * stopped by their budget timer instead. */
 static bool thread_is_real_time_or_idle(thread_t *t)
 {
-    return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
+    return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE | THREAD_FLAG_DEADLINE));
 }
 
 /**
@@ -296,13 +846,11 @@ status_t thread_resume(thread_t *t)
     THREAD_LOCK(state);
     if (t->state == THREAD_SUSPENDED) {
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
+        mp_reschedule(insert_in_run_queue_head(t), 0);
         if (!ints_disabled) /* HACK, don't resced into bootstrap thread before idle thread is set up */
             resched = true;
     }
 
-    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-
     THREAD_UNLOCK(state);
 
     if (resched)
@@ -324,11 +872,11 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&t->retcode_wait_queue, state);
 
     if (t->flags & THREAD_FLAG_DETACHED) {
         /* the thread is detached, go ahead and exit */
-        THREAD_UNLOCK(state);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return ERR_BAD_STATE;
     }
 
@@ -336,7 +884,7 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout)
     if (t->state != THREAD_DEATH) {
         status_t err = wait_queue_block(&t->retcode_wait_queue, timeout);
         if (err < 0) {
-            THREAD_UNLOCK(state);
+            WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
             return err;
         }
     }
@@ -350,13 +898,20 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout)
     if (retcode)
         *retcode = t->retcode;
 
+    WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
+
+    /* the dead thread may still be finishing its last reschedule with the thread lock
+     * held, so taking the thread lock here also guarantees it's off its stack.
+     */
+    THREAD_LOCK(tstate);
+
     /* remove it from the master thread list */
     list_delete(&t->thread_list_node);
 
     /* clear the structure's magic */
     t->magic = 0;
 
-    THREAD_UNLOCK(state);
+    THREAD_UNLOCK(tstate);
 
     /* free its stack and the thread structure itself */
     if (t->flags & THREAD_FLAG_FREE_STACK && t->stack)
@@ -372,26 +927,36 @@ status_t thread_detach(thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&t->retcode_wait_queue, state);
 
     /* if another thread is blocked inside thread_join() on this thread,
      * wake them up with a specific return code */
     wait_queue_wake_all(&t->retcode_wait_queue, false, ERR_BAD_STATE);
 
+    /* the flags word is shared with fields protected by the thread lock */
+    spin_lock(&thread_lock);
+
     /* if it's already dead, then just do what join would have and exit */
     if (t->state == THREAD_DEATH) {
         t->flags &= ~THREAD_FLAG_DETACHED; /* makes sure thread_join continues */
-        THREAD_UNLOCK(state);
+        spin_unlock(&thread_lock);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return thread_join(t, NULL, 0);
     } else {
         t->flags |= THREAD_FLAG_DETACHED;
-        THREAD_UNLOCK(state);
+        spin_unlock(&thread_lock);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return NO_ERROR;
     }
 }
 
+/* called with the current thread's retcode wait queue lock and the thread lock held */
 __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode)
 {
+    /* give back any bandwidth reserved for it */
+    if (thread_is_deadline(current_thread))
+        deadline_release(current_thread);
+
     /* enter the dead state */
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
@@ -404,6 +969,9 @@ __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode
         /* clear the structure's magic */
         current_thread->magic = 0;
 
+        /* the wait queue lives inside the structure we're about to free */
+        spin_unlock(&current_thread->retcode_wait_queue.lock);
+
         /* free its stack and the thread structure itself */
         if (current_thread->flags & THREAD_FLAG_FREE_STACK && current_thread->stack) {
             heap_delayed_free(current_thread->stack);
@@ -416,7 +984,8 @@ __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode
             heap_delayed_free(current_thread);
     } else {
         /* signal if anyone is waiting */
-        wait_queue_wake_all(&current_thread->retcode_wait_queue, false, 0);
+        wait_queue_wake_all_thread_locked(&current_thread->retcode_wait_queue, false, 0);
+        spin_unlock(&current_thread->retcode_wait_queue.lock);
     }
 
     /* reschedule */
@@ -473,7 +1042,10 @@ void thread_exit(int retcode)
         current_thread->exit_callback(current_thread->exit_callback_arg);
     }
 
-    THREAD_LOCK(state);
+    /* lock ordering: the retcode wait queue before the thread lock */
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&current_thread->retcode_wait_queue.lock, state);
+    spin_lock(&thread_lock);
 
     thread_exit_locked(current_thread, retcode);
 }
@@ -483,7 +1055,9 @@ void thread_kill(thread_t *t, bool block)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    spin_lock_saved_state_t state;
+retry:
+    spin_lock_irqsave(&thread_lock, state);
 
     /* deliver a signal to the thread */
     /* NOTE: it's not important to do this atomically, since we're inside
@@ -520,15 +1094,29 @@ void thread_kill(thread_t *t, bool block)
             break;
         case THREAD_BLOCKED:
             /* thread is blocked on something and marked interruptable */
-            if (t->interruptable)
-                thread_unblock_from_wait_queue(t, ERR_INTERRUPTED);
+            if (t->interruptable) {
+                /* the wait queue lock orders before the thread lock, so only try for it
+                 * and back off if somebody else has it. the wait queue can't go away
+                 * while the thread is blocked on it and we hold the thread lock.
+                 */
+                wait_queue_t *wait = *(wait_queue_t * volatile *)&t->blocking_wait_queue;
+                if (wait) {
+                    if (spin_trylock(&wait->lock)) {
+                        spin_unlock_irqrestore(&thread_lock, state);
+                        arch_spinloop_pause();
+                        goto retry;
+                    }
+                    thread_unblock_from_wait_queue_thread_locked(t, ERR_INTERRUPTED);
+                    spin_unlock(&wait->lock);
+                }
+            }
             break;
         case THREAD_SLEEPING:
             /* thread is sleeping */
             if (t->interruptable) {
                 t->state = THREAD_READY;
                 t->blocked_status = ERR_INTERRUPTED;
-                insert_in_run_queue_head(t);
+                mp_reschedule(insert_in_run_queue_head(t), 0);
             }
             break;
         case THREAD_DEATH:
@@ -536,13 +1124,20 @@ void thread_kill(thread_t *t, bool block)
             goto done;
     }
 
+    spin_unlock_irqrestore(&thread_lock, state);
+
     /* wait for the thread to exit */
-    if (block && !(t->flags & THREAD_FLAG_DETACHED)) {
-        wait_queue_block(&t->retcode_wait_queue, INFINITE_TIME);
+    if (block) {
+        WAIT_QUEUE_LOCK(&t->retcode_wait_queue, wstate);
+        if (t->state != THREAD_DEATH && !(t->flags & THREAD_FLAG_DETACHED)) {
+            wait_queue_block(&t->retcode_wait_queue, INFINITE_TIME);
+        }
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, wstate);
     }
+    return;
 
 done:
-    THREAD_UNLOCK(state);
+    spin_unlock_irqrestore(&thread_lock, state);
 }
 
 /* check for any pending signals and handle them */
@@ -572,32 +1167,210 @@ __NO_RETURN static int idle_thread_routine(void *arg)
         arch_idle();
 }
 
-static thread_t *get_top_thread(int cpu)
+/* true if the group, or any group it's nested in, has used up its cpu quota */
+static bool sched_group_throttled(const sched_group_t *group)
+{
+    for (; group; group = group->parent) {
+        if (group->throttled)
+            return true;
+    }
+    return false;
+}
+
+/* true if the group, or any group it's nested in, has a cpu quota */
+static bool sched_group_capped(const sched_group_t *group)
+{
+    for (; group; group = group->parent) {
+        if (group->quota_ns)
+            return true;
+    }
+    return false;
+}
+
+/* true if the run queue has a thread that could be picked now. throttled threads
+ * stay queued until their group is refilled, but don't count as work waiting,
+ * so they neither keep the preemption timer armed nor wake idle cpus to steal.
+ */
+static bool run_queue_has_runnable(const struct run_queue *rq)
+{
+    if (rq->count == 0)
+        return false;
+
+    thread_t *t;
+    for (int i = 0; i < NUM_PRIORITIES; i++) {
+        if (!(rq->bitmap & (1u << i)))
+            continue;
+        list_for_every_entry(&rq->list[i], t, thread_t, queue_node) {
+            if (!sched_group_throttled(t->sched_group))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* charge cpu time to the group and the groups it's nested in, throttling any
+ * that run over their quota until the next period refills them.
+ */
+static void sched_group_charge(sched_group_t *group, lk_bigtime_t delta)
+{
+    for (; group; group = group->parent) {
+        if (group->quota_ns == 0)
+            continue;
+        group->used_ns += delta;
+        if (group->used_ns >= group->quota_ns)
+            group->throttled = true;
+    }
+}
+
+/* how long a thread in the group can run before some group runs out of quota */
+static lk_time_t sched_group_runtime_left(const sched_group_t *group)
+{
+    lk_bigtime_t left = UINT64_MAX;
+
+    for (; group; group = group->parent) {
+        if (group->quota_ns == 0)
+            continue;
+        lk_bigtime_t group_left = 0;
+        if (group->used_ns < group->quota_ns)
+            group_left = group->quota_ns - group->used_ns;
+        left = MIN(left, group_left);
+    }
+
+    if (left == UINT64_MAX)
+        return INFINITE_TIME;
+    return (lk_time_t)MIN(MAX(left / 1000000, 1u), (lk_bigtime_t)UINT32_MAX - 1);
+}
+
+/* a fresh quantum for t, stretched or shrunk by the weights of its groups */
+static int64_t thread_quantum_ns(const thread_t *t)
+{
+    const uint64_t max = THREAD_QUANTUM_NS * THREAD_QUANTUM_MAX_SCALE;
+    uint64_t scaled = THREAD_QUANTUM_NS;
+
+    for (const sched_group_t *group = t->sched_group; group; group = group->parent)
+        scaled = MIN(scaled * group->weight / SCHED_GROUP_DEFAULT_WEIGHT, max);
+
+    return MAX((int64_t)scaled, (int64_t)THREAD_TICK_MS * 1000000);
+}
+
+/* what's left of the running thread t's quantum as of now */
+static int64_t thread_quantum_left(const thread_t *t, lk_bigtime_t now)
+{
+    return t->remaining_quantum - (int64_t)(now - t->last_started_running_ns);
+}
+
+/* find the highest priority thread in a run queue that is allowed to run on cpu */
+static thread_t *run_queue_pick(struct run_queue *rq, int cpu, int min_priority)
 {
     thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    uint32_t local_run_queue_bitmap = rq->bitmap;
 
     while (local_run_queue_bitmap) {
         /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * 8 - NUM_PRIORITIES);
+        int next_queue = run_queue_top_priority(local_run_queue_bitmap);
+        if (next_queue < min_priority)
+            break;
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
+        list_for_every_entry(&rq->list[next_queue], newthread, thread_t, queue_node) {
 #if WITH_SMP
             if (newthread->pinned_cpu < 0 || newthread->pinned_cpu == cpu)
 #endif
+            if (likely(!sched_group_throttled(newthread->sched_group)))
             {
-                list_delete(&newthread->queue_node);
-
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
-
+                remove_from_run_queue(rq, newthread, next_queue);
                 return newthread;
             }
         }
 
         local_run_queue_bitmap &= ~(1<<next_queue);
     }
+
+    return NULL;
+}
+
+#if WITH_SMP
+/* the thread each cpu last switched to, for thread_running_elsewhere() */
+static thread_t *running_thread[SMP_MAX_CPUS];
+
+bool thread_running_elsewhere(const thread_t *t)
+{
+    uint cpu = arch_curr_cpu_num();
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i != cpu && __atomic_load_n(&running_thread[i], __ATOMIC_RELAXED) == t)
+            return true;
+    }
+    return false;
+}
+#else
+bool thread_running_elsewhere(const thread_t *t)
+{
+    return false;
+}
+#endif
+
+#if WITH_SMP
+/* look through the other online cpus' run queues for a thread with a priority
+ * strictly higher than min_priority and pull it over to this cpu. the queues are
+ * only scanned by bitmap so this stays cheap when there's nothing to steal.
+ * between queues with the same top priority, steal from the one sharing the most
+ * cache with this cpu, so work stays inside a core or package when it can.
+ */
+static thread_t *run_queue_steal(int cpu, int min_priority)
+{
+    int best_cpu = -1;
+    int best_priority = min_priority;
+    int best_affinity = -1;
+
+    mp_cpu_mask_t others = mp_get_online_mask() & ~(1u << cpu);
+    while (others) {
+        uint i = __builtin_ctz(others);
+        others &= ~(1u << i);
+
+        int pri = run_queue_top_priority(run_queue[i].bitmap);
+        if (pri < best_priority || pri <= min_priority)
+            continue;
+
+        int affinity = cpu_cache_affinity(cpu, i);
+        if (pri > best_priority || affinity > best_affinity) {
+            best_priority = pri;
+            best_cpu = i;
+            best_affinity = affinity;
+        }
+    }
+
+    if (best_cpu < 0)
+        return NULL;
+
+    thread_t *t = run_queue_pick(&run_queue[best_cpu], cpu, min_priority + 1);
+    if (t)
+        THREAD_STATS_INC(steals);
+    return t;
+}
+#endif
+
+static thread_t *get_top_thread(int cpu)
+{
+    struct run_queue *rq = &run_queue[cpu];
+
+    /* deadline threads with budget left run ahead of everything else */
+    thread_t *newthread = deadline_queue_pick(rq);
+    if (newthread)
+        return newthread;
+
+    newthread = run_queue_pick(rq, cpu, 0);
+    if (newthread)
+        return newthread;
+
+#if WITH_SMP
+    /* only a cpu that is about to go idle goes looking in the other run queues,
+     * so a busy cpu's reschedule never touches them. higher priority threads
+     * readied elsewhere are sent to an idle cpu or IPI their target cpu instead.
+     */
+    newthread = run_queue_steal(cpu, -1);
+    if (newthread)
+        return newthread;
+#endif
+
     /* no threads to run, select the idle thread for this cpu */
     return idle_thread(cpu);
 }
@@ -626,44 +1399,77 @@ static void thread_resched(void)
 
     THREAD_STATS_INC(reschedules);
 
+    /* charge the outgoing thread before picking, so that it can't be picked
+     * again if that ran its group over quota.
+     */
+    oldthread = current_thread;
+    lk_bigtime_t now = current_time_hires();
+    lk_bigtime_t ran = now - oldthread->last_started_running_ns;
+    oldthread->runtime_ns += ran;
+    oldthread->remaining_quantum -= ran;
+    if (oldthread->sched_group)
+        sched_group_charge(oldthread->sched_group, ran);
+    if (thread_is_deadline(oldthread))
+        deadline_charge(oldthread, ran, now);
+
     newthread = get_top_thread(cpu);
 
     DEBUG_ASSERT(newthread);
 
     newthread->state = THREAD_RUNNING;
+    newthread->last_started_running_ns = now;
+    thread_account_ready_time(newthread, cpu, now);
 
-    oldthread = current_thread;
+    /* a thread handed off to carries on with the time slice of the one that woke
+     * it, if that blocked and it runs next. either way the handoff is over, so
+     * the pointer never outlives this reschedule.
+     */
+    thread_t *handoff = oldthread->handoff;
+    oldthread->handoff = NULL;
 
-    if (newthread == oldthread)
+    if (newthread == oldthread) {
+        deadline_timer_update(cpu, newthread);
+#if PLATFORM_HAS_DYNAMIC_TIMER
+        /* the set of threads queued behind us may have changed */
+        preempt_timer_update(cpu, newthread);
+#endif
         return;
+    }
 
-    lk_bigtime_t now = current_time_hires();
-    oldthread->runtime_ns += now - oldthread->last_started_running_ns;
-    newthread->last_started_running_ns = now;
+    if (newthread == handoff && oldthread->state == THREAD_BLOCKED &&
+            oldthread->remaining_quantum > 0) {
+        newthread->remaining_quantum = oldthread->remaining_quantum;
+        oldthread->remaining_quantum = 0;
+    }
 
     /* set up quantum for the new thread if it was consumed */
     if (newthread->remaining_quantum <= 0) {
-        newthread->remaining_quantum = 5; // XXX make this smarter
+        newthread->remaining_quantum = thread_quantum_ns(newthread);
     }
 
     /* mark the cpu ownership of the threads */
     thread_set_curr_cpu(oldthread, -1);
+    thread_set_last_cpu(oldthread, cpu);
     thread_set_curr_cpu(newthread, cpu);
 
 #if WITH_SMP
+    __atomic_store_n(&running_thread[cpu], newthread, __ATOMIC_RELAXED);
+
     if (thread_is_idle(newthread)) {
         mp_set_cpu_idle(cpu);
     } else {
         mp_set_cpu_busy(cpu);
     }
 
-    if (thread_is_realtime(newthread)) {
+    if (thread_is_realtime(newthread) || thread_is_deadline(newthread)) {
         mp_set_cpu_realtime(cpu);
     } else {
         mp_set_cpu_non_realtime(cpu);
     }
 #endif
 
+    kcounter_add(&context_switches, 1);
+
 #if THREAD_STATS
     THREAD_STATS_INC(context_switches);
 
@@ -680,26 +1486,14 @@ static void thread_resched(void)
            (uint32_t)(uintptr_t)oldthread, (uint32_t)(uintptr_t)newthread);
 #endif
 
+    deadline_timer_update(cpu, newthread);
+
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (thread_is_real_time_or_idle(newthread)) {
-        if (!thread_is_real_time_or_idle(oldthread)) {
-            /* if we're switching from a non real time to a real time, cancel
-             * the preemption timer. */
-#if DEBUG_THREAD_CONTEXT_SWITCH
-            dprintf(ALWAYS, "arch_context_switch: stop preempt, cpu %u, old %p (%s), new %p (%s)\n",
-                    cpu, oldthread, oldthread->name, newthread, newthread->name);
-#endif
-            timer_cancel(&preempt_timer[cpu]);
-        }
-    } else if (thread_is_real_time_or_idle(oldthread)) {
-        /* if we're switching from a real time (or idle thread) to a regular one,
-         * set up a periodic timer to run our preemption tick. */
-#if DEBUG_THREAD_CONTEXT_SWITCH
-        dprintf(ALWAYS, "arch_context_switch: start preempt, cpu %u, old %p (%s), new %p (%s)\n",
-                cpu, oldthread, oldthread->name, newthread, newthread->name);
-#endif
-        timer_set_periodic(&preempt_timer[cpu], 10, (timer_callback)thread_timer_tick, NULL);
-    }
+    /* charge the outgoing thread for the time it ran and rearm the preemption
+     * timer for the incoming one, if there's anything to preempt it for.
+     */
+    preempt_timer_update(cpu, oldthread);
+    preempt_timer_update(cpu, newthread);
 #endif
 
     /* set some optional target debug leds */
@@ -745,6 +1539,28 @@ static void thread_resched(void)
     arch_context_switch(oldthread, newthread);
 }
 
+void thread_handoff_begin(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(!arch_in_int_handler());
+    DEBUG_ASSERT(!current_thread->handoff_wanted);
+
+    current_thread->handoff_wanted = true;
+}
+
+void thread_handoff_end(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->handoff_wanted);
+
+    /* the thread handed off to, if any, stays queued here until this one blocks,
+     * which the caller promised to do next, or is preempted.
+     */
+    current_thread->handoff_wanted = false;
+}
+
 /**
  * @brief Yield the cpu to another thread
  *
@@ -770,7 +1586,7 @@ void thread_yield(void)
     current_thread->state = THREAD_READY;
     current_thread->remaining_quantum = 0;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        insert_in_run_queue_tail(current_thread);
+        insert_current_in_run_queue_tail(current_thread);
     }
     thread_resched();
 
@@ -812,56 +1628,383 @@ void thread_preempt(bool interrupt)
     }
 #endif
 
-    THREAD_LOCK(state);
+    THREAD_LOCK(state);
+
+    /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
+    current_thread->state = THREAD_READY;
+    if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        if (thread_quantum_left(current_thread, current_time_hires()) > 0)
+            insert_current_in_run_queue_head(current_thread);
+        else
+            insert_current_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+    }
+    thread_resched();
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief Let any threads just made ready on this cpu run first
+ *
+ * This function places the current thread at the head of the run queue
+ * and reschedules. It is meant to be called after waking threads through
+ * a wait queue with reschedule set, once the wait queue lock is dropped.
+ */
+void thread_reschedule(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    THREAD_LOCK(state);
+
+    current_thread->state = THREAD_READY;
+    if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        insert_current_in_run_queue_head(current_thread);
+    }
+    thread_resched();
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Suspend thread until woken.
+ *
+ * This function schedules another thread to execute.  This function does not
+ * return until the thread is made runable again by some other module.
+ *
+ * You probably don't want to call this function directly; it's meant to be called
+ * from other modules, such as mutex, which will presumably set the thread's
+ * state to blocked and add it to some queue or another.
+ */
+static void thread_block(void)
+{
+    __UNUSED thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(current_thread->state == THREAD_BLOCKED);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(!thread_is_idle(current_thread));
+
+    /* we are blocking on something. the blocking code should have already stuck us on a queue */
+    thread_resched();
+}
+
+static void thread_unblock(thread_t *t, bool resched)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(!thread_is_idle(t));
+
+    t->state = THREAD_READY;
+    if (resched) {
+        mp_reschedule(insert_in_run_queue_head_local(t), 0);
+        thread_resched();
+    } else {
+        mp_reschedule(insert_in_run_queue_head(t), 0);
+    }
+}
+
+/* priority inheritance chains are followed at most this far */
+#define THREAD_PI_MAX_DEPTH 16
+
+/* the priority owed to t: its own, or the highest lent to it through its links */
+static int thread_pi_inherited_priority(thread_t *t)
+{
+    int priority = t->base_priority;
+    thread_pi_link_t *link;
+
+    list_for_every_entry(&t->pi_links, link, thread_pi_link_t, node) {
+        if (link->priority > priority)
+            priority = link->priority;
+    }
+    return priority;
+}
+
+/* change t's effective priority, moving it to the matching run queue if it's waiting to run */
+static void thread_set_effective_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (t->priority == priority || thread_is_idle(t))
+        return;
+
+    /* deadline threads are queued by deadline, not priority */
+    if (t->state == THREAD_READY && list_in_list(&t->queue_node) && !thread_is_deadline(t)) {
+        uint cpu = thread_queued_cpu(t);
+        remove_from_run_queue(&run_queue[cpu], t, t->priority);
+        t->priority = priority;
+        insert_in_run_queue_head_cpu(t, cpu);
+        mp_reschedule(1u << cpu, 0);
+    } else {
+        t->priority = priority;
+#if WITH_SMP
+        /* let a cpu running a lowered thread see if something else should run */
+        if (t->state == THREAD_RUNNING && t != get_current_thread())
+            mp_reschedule(1u << thread_curr_cpu(t), 0);
+#endif
+    }
+}
+
+/* recompute t's priority from its links. if that raised it, pass the raise on to
+ * whatever t is blocked behind. lowering doesn't propagate; the links up the chain
+ * are recomputed when their locks change hands.
+ */
+static void thread_pi_update(thread_t *t)
+{
+    for (int depth = 0; t && depth < THREAD_PI_MAX_DEPTH; depth++) {
+        int priority = thread_pi_inherited_priority(t);
+        bool raised = priority > t->priority;
+
+        thread_set_effective_priority(t, priority);
+        if (!raised)
+            break;
+
+        thread_pi_link_t *link = t->blocking_pi_link;
+        if (!link)
+            break;
+        if (priority > link->priority)
+            link->priority = priority;
+        t = link->owner;
+    }
+}
+
+void thread_pi_link_block(thread_pi_link_t *link, thread_t *owner)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(owner);
+    DEBUG_ASSERT(owner != current_thread);
+
+    if (link->owner != owner) {
+        if (list_in_list(&link->node))
+            list_delete(&link->node);
+        link->owner = owner;
+        list_add_tail(&owner->pi_links, &link->node);
+    }
+
+    if (current_thread->priority > link->priority)
+        link->priority = current_thread->priority;
+    current_thread->blocking_pi_link = link;
+
+    thread_pi_update(owner);
+}
+
+void thread_pi_link_set_owner(thread_pi_link_t *link, thread_t *owner, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    thread_t *old_owner = link->owner;
+
+    if (list_in_list(&link->node))
+        list_delete(&link->node);
+    link->owner = owner;
+    link->priority = owner ? priority : -1;
+    if (owner)
+        list_add_tail(&owner->pi_links, &link->node);
+
+    if (old_owner && old_owner != owner)
+        thread_pi_update(old_owner);
+    if (owner)
+        thread_pi_update(owner);
+}
+
+void thread_pi_unblock(thread_t *t)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    t->blocking_pi_link = NULL;
+}
+
+void sched_group_init(sched_group_t *group, sched_group_t *parent)
+{
+    memset(group, 0, sizeof(*group));
+    group->parent = parent;
+    group->weight = SCHED_GROUP_DEFAULT_WEIGHT;
+    timer_initialize(&group->refill_timer);
+}
+
+void sched_group_destroy(sched_group_t *group)
+{
+    THREAD_LOCK(state);
+    timer_cancel(&group->refill_timer);
+    group->quota_ns = 0;
+    group->throttled = false;
+    THREAD_UNLOCK(state);
+}
+
+status_t sched_group_set_weight(sched_group_t *group, uint32_t weight)
+{
+    if (weight == 0 || weight > SCHED_GROUP_MAX_WEIGHT)
+        return ERR_INVALID_ARGS;
+
+    /* takes effect as member threads pick up fresh quanta */
+    THREAD_LOCK(state);
+    group->weight = weight;
+    THREAD_UNLOCK(state);
+
+    return NO_ERROR;
+}
+
+/* start of each bandwidth period: forgive the quota's worth of time used in the last one */
+static enum handler_return sched_group_refill_handler(timer_t *timer, lk_time_t now, void *arg)
+{
+    sched_group_t *group = (sched_group_t *)arg;
+
+    /* sched_group_set_bandwidth and sched_group_destroy cancel this timer with
+     * the thread lock held, same as thread_sleep_handler.
+     */
+    while (unlikely(spin_trylock(&thread_lock))) {
+        if (timer->cancel)
+            return INT_NO_RESCHEDULE;
+    }
+
+    /* carry over any overrun from the last period */
+    if (group->used_ns > group->quota_ns)
+        group->used_ns -= group->quota_ns;
+    else
+        group->used_ns = 0;
+
+    bool was_throttled = group->throttled;
+    group->throttled = group->used_ns >= group->quota_ns;
+
+    enum handler_return ret = INT_NO_RESCHEDULE;
+    if (was_throttled && !group->throttled) {
+        /* its threads may be sitting in any cpu's run queue */
+        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+        ret = INT_RESCHEDULE;
+    }
+
+    spin_unlock(&thread_lock);
+
+    return ret;
+}
+
+status_t sched_group_set_bandwidth(sched_group_t *group, lk_bigtime_t period_ns, lk_bigtime_t quota_ns)
+{
+    if (period_ns == 0) {
+        quota_ns = 0;
+    } else if (period_ns < 1000000 || period_ns / 1000000 >= UINT32_MAX || quota_ns == 0) {
+        /* the period is counted out by a millisecond timer */
+        return ERR_INVALID_ARGS;
+    }
+
+    THREAD_LOCK(state);
+
+    timer_cancel(&group->refill_timer);
+
+    bool was_throttled = group->throttled;
+    group->period_ns = period_ns;
+    group->quota_ns = quota_ns;
+    group->used_ns = 0;
+    group->throttled = false;
 
-    /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
-    current_thread->state = THREAD_READY;
-    if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        if (current_thread->remaining_quantum > 0)
-            insert_in_run_queue_head(current_thread);
-        else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
-    }
-    thread_resched();
+    if (quota_ns)
+        timer_set_periodic(&group->refill_timer, (lk_time_t)(period_ns / 1000000),
+                           sched_group_refill_handler, group);
+
+    if (was_throttled)
+        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
 
     THREAD_UNLOCK(state);
+
+    return NO_ERROR;
 }
 
-/**
- * @brief  Suspend thread until woken.
- *
- * This function schedules another thread to execute.  This function does not
- * return until the thread is made runable again by some other module.
- *
- * You probably don't want to call this function directly; it's meant to be called
- * from other modules, such as mutex, which will presumably set the thread's
- * state to blocked and add it to some queue or another.
- */
-static void thread_block(void)
+void thread_set_sched_group(thread_t *t, sched_group_t *group)
 {
-    __UNUSED thread_t *current_thread = get_current_thread();
-
-    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
-    DEBUG_ASSERT(current_thread->state == THREAD_BLOCKED);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-    DEBUG_ASSERT(!thread_is_idle(current_thread));
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(t->state == THREAD_SUSPENDED);
 
-    /* we are blocking on something. the blocking code should have already stuck us on a queue */
-    thread_resched();
+    THREAD_LOCK(state);
+    t->sched_group = group;
+    THREAD_UNLOCK(state);
 }
 
-static void thread_unblock(thread_t *t, bool resched)
+status_t thread_set_deadline(thread_t *t, lk_bigtime_t runtime_ns, lk_bigtime_t period_ns)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
-    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-    DEBUG_ASSERT(!thread_is_idle(t));
 
-    t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-    if (resched)
+    uint32_t util = 0;
+    if (runtime_ns) {
+        if (runtime_ns < DEADLINE_MIN_RUNTIME_NS ||
+                period_ns < DEADLINE_MIN_PERIOD_NS || period_ns > DEADLINE_MAX_PERIOD_NS ||
+                runtime_ns > period_ns)
+            return ERR_INVALID_ARGS;
+        /* rounded up, so that no cpu is promised more than it has */
+        util = (uint32_t)((runtime_ns * DEADLINE_UTIL_SCALE + period_ns - 1) / period_ns);
+    }
+
+    THREAD_LOCK(state);
+
+    if (t->state == THREAD_DEATH || thread_is_idle(t)) {
+        THREAD_UNLOCK(state);
+        return ERR_BAD_STATE;
+    }
+
+    /* admit it as if it had no bandwidth yet, so it can change cpus */
+    bool was_deadline = thread_is_deadline(t);
+    if (was_deadline)
+        deadline_util[t->deadline.cpu] -= t->deadline.util;
+
+    int cpu = -1;
+    if (runtime_ns) {
+        cpu = deadline_pick_cpu(t, util);
+        if (cpu < 0) {
+            if (was_deadline)
+                deadline_util[t->deadline.cpu] += t->deadline.util;
+            THREAD_UNLOCK(state);
+            return ERR_NO_RESOURCES;
+        }
+    }
+
+    /* take it off its run queue while its class changes */
+    bool queued = t->state == THREAD_READY && list_in_list(&t->queue_node);
+    if (queued) {
+        if (was_deadline)
+            list_delete(&t->queue_node);
+        else
+            remove_from_run_queue(&run_queue[thread_queued_cpu(t)], t, t->priority);
+    }
+
+    if (was_deadline) {
+        timer_cancel(&t->deadline.replenish_timer);
+        t->deadline.throttled = false;
+    }
+
+    if (runtime_ns) {
+        thread_deadline_t *dl = &t->deadline;
+        dl->runtime_ns = runtime_ns;
+        dl->period_ns = period_ns;
+        dl->util = util;
+        dl->cpu = cpu;
+        deadline_new_period(t, current_time_hires());
+        deadline_util[cpu] += util;
+        t->flags |= THREAD_FLAG_DEADLINE;
+    } else {
+        t->flags &= ~THREAD_FLAG_DEADLINE;
+    }
+
+    if (queued) {
+        uint queue_cpu = find_cpu_for_thread(t);
+        insert_in_run_queue_head_cpu(t, queue_cpu);
+        mp_reschedule(1u << queue_cpu, 0);
+    } else if (t == get_current_thread()) {
+        /* go through the scheduler to move to the right cpu and timers */
+        t->state = THREAD_READY;
+        insert_current_in_run_queue_head(t);
         thread_resched();
+    } else if (t->state == THREAD_RUNNING) {
+        mp_reschedule(1u << thread_curr_cpu(t), MP_RESCHEDULE_FLAG_REALTIME);
+    }
+
+    THREAD_UNLOCK(state);
+
+    return NO_ERROR;
 }
 
 enum handler_return thread_timer_tick(void)
@@ -871,14 +2014,95 @@ enum handler_return thread_timer_tick(void)
     if (thread_is_real_time_or_idle(current_thread))
         return INT_NO_RESCHEDULE;
 
-    current_thread->remaining_quantum--;
-    if (current_thread->remaining_quantum <= 0) {
+#if WITH_SMP
+    /* periodically look for idle cpus while we have work queued behind us and
+     * kick them so they pull it over. the unlocked reads are only a hint, real
+     * decisions are made by the stealing cpu under the thread lock.
+     */
+    struct run_queue *rq = &run_queue[arch_curr_cpu_num()];
+    if (++rq->balance_ticks >= RUN_QUEUE_BALANCE_TICKS) {
+        rq->balance_ticks = 0;
+        if (run_queue_has_runnable(rq)) {
+            mp_cpu_mask_t idle = mp_get_idle_mask() & mp_get_active_mask();
+            if (idle)
+                mp_reschedule(1u << find_cpu_near(arch_curr_cpu_num(), idle), 0);
+        }
+    }
+#endif
+
+    /* capped threads are only charged when they go through the scheduler */
+    if (current_thread->sched_group && sched_group_capped(current_thread->sched_group))
+        return INT_RESCHEDULE;
+
+    if (thread_quantum_left(current_thread, current_time_hires()) <= 0) {
         return INT_RESCHEDULE;
     } else {
         return INT_NO_RESCHEDULE;
     }
 }
 
+#if PLATFORM_HAS_DYNAMIC_TIMER
+/* the running thread used up its quantum while other threads were waiting */
+static enum handler_return preempt_timer_handler(timer_t *timer, lk_time_t now, void *arg)
+{
+    struct preempt_timer_state *pt = containerof(timer, struct preempt_timer_state, timer);
+    uint cpu = pt - preempt_timer;
+
+    pt->armed = false;
+
+    /* the timer may have been moved here off of an unplugged cpu */
+    if (cpu != arch_curr_cpu_num())
+        return INT_NO_RESCHEDULE;
+
+    thread_t *current_thread = get_current_thread();
+    if (thread_is_real_time_or_idle(current_thread))
+        return INT_NO_RESCHEDULE;
+
+#if WITH_SMP
+    /* there's work queued behind us, see if an idle cpu can pull it over */
+    if (run_queue_has_runnable(&run_queue[cpu])) {
+        mp_cpu_mask_t idle = mp_get_idle_mask() & mp_get_active_mask();
+        if (idle)
+            mp_reschedule(1u << find_cpu_near(cpu, idle), 0);
+    }
+#endif
+
+    current_thread->remaining_quantum = 0;
+    return INT_RESCHEDULE;
+}
+
+/* arm or stop the preemption timer on this cpu for thread t. the timer only runs
+ * while t is a regular thread with something else waiting on the local run queue,
+ * or with a group quota to enforce, so an idle cpu, or one running a single
+ * uncapped thread, takes no scheduler interrupts. t is charged for the time it
+ * ran by thread_resched(), whether or not the timer was running.
+ */
+static void preempt_timer_update(uint cpu, thread_t *t)
+{
+    struct preempt_timer_state *pt = &preempt_timer[cpu];
+
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(cpu == arch_curr_cpu_num());
+
+    bool capped = t->sched_group && sched_group_capped(t->sched_group);
+    bool need = t->state == THREAD_RUNNING && !thread_is_real_time_or_idle(t) &&
+                (run_queue_has_runnable(&run_queue[cpu]) || capped);
+
+    if (need && !pt->armed) {
+        int64_t left = thread_quantum_left(t, current_time_hires());
+        lk_time_t delay = (lk_time_t)MIN(MAX((left + 999999) / 1000000, 1),
+                                         (int64_t)UINT32_MAX - 1);
+        if (capped)
+            delay = MIN(delay, sched_group_runtime_left(t->sched_group));
+        pt->armed = true;
+        timer_set_oneshot(&pt->timer, delay, preempt_timer_handler, NULL);
+    } else if (!need && pt->armed) {
+        timer_cancel(&pt->timer);
+        pt->armed = false;
+    }
+}
+#endif
+
 /* timer callback to wake up a sleeping thread */
 static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, void *arg)
 {
@@ -905,7 +2129,7 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
 
     t->state = THREAD_READY;
     t->blocked_status = NO_ERROR;
-    insert_in_run_queue_head(t);
+    mp_reschedule(insert_in_run_queue_head(t), 0);
 
     spin_unlock(&thread_lock);
 
@@ -986,6 +2210,71 @@ lk_bigtime_t thread_runtime(const thread_t *t)
     return runtime;
 }
 
+/**
+ * @brief Move all threads queued on a cpu's run queue to other cpus.
+ *
+ * Called once a cpu has been taken out of the active set, so that threads that
+ * were queued on it don't get stranded.  Threads pinned to the cpu stay put.
+ */
+void thread_migrate_run_queue(uint old_cpu)
+{
+    DEBUG_ASSERT(old_cpu < SMP_MAX_CPUS);
+    DEBUG_ASSERT(!mp_is_cpu_active(old_cpu));
+
+    THREAD_LOCK(state);
+
+    struct run_queue *rq = &run_queue[old_cpu];
+    mp_cpu_mask_t cpus = 0;
+    for (int pri = 0; pri < NUM_PRIORITIES; pri++) {
+        thread_t *t;
+        thread_t *temp;
+        list_for_every_entry_safe(&rq->list[pri], t, temp, thread_t, queue_node) {
+            if (thread_pinned_cpu(t) == (int)old_cpu)
+                continue;
+
+            remove_from_run_queue(rq, t, pri);
+            thread_set_last_cpu(t, -1);
+
+            /* still waiting since it was first made ready, keep its clock running */
+            uint cpu = find_cpu_for_thread(t);
+            insert_in_run_queue_head_cpu(t, cpu);
+            cpus |= 1u << cpu;
+        }
+    }
+
+    /* readmit the deadline threads admitted onto it, queued or not, or failing
+     * that put them back to priority scheduling */
+    thread_t *t;
+    list_for_every_entry(&thread_list, t, thread_t, thread_list_node) {
+        if (!thread_is_deadline(t) || t->deadline.cpu != (int)old_cpu ||
+                thread_pinned_cpu(t) == (int)old_cpu)
+            continue;
+
+        bool queued = t->state == THREAD_READY && list_in_list(&t->queue_node);
+        if (queued)
+            list_delete(&t->queue_node);
+
+        deadline_util[old_cpu] -= t->deadline.util;
+        int cpu = deadline_pick_cpu(t, t->deadline.util);
+        if (cpu >= 0) {
+            t->deadline.cpu = cpu;
+            deadline_util[cpu] += t->deadline.util;
+        } else {
+            deadline_util[old_cpu] += t->deadline.util;
+            deadline_release(t);
+        }
+
+        if (queued) {
+            cpu = find_cpu_for_thread(t);
+            insert_in_run_queue_head_cpu(t, cpu);
+            cpus |= 1u << cpu;
+        }
+    }
+    mp_reschedule(cpus, 0);
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief Construct a thread t around the current running state
  *
@@ -1002,6 +2291,7 @@ void thread_construct_first(thread_t *t, const char *name)
 
     init_thread_struct(t, name);
     t->priority = HIGHEST_PRIORITY;
+    t->base_priority = HIGHEST_PRIORITY;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -1026,8 +2316,11 @@ void thread_init_early(void)
     DEBUG_ASSERT(arch_curr_cpu_num() == 0);
 
     /* initialize the run queues */
-    for (i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (i=0; i < NUM_PRIORITIES; i++)
+            list_initialize(&run_queue[cpu].list[i]);
+        list_initialize(&run_queue[cpu].deadline_list);
+    }
 
     /* initialize the thread list */
     list_initialize(&thread_list);
@@ -1044,9 +2337,13 @@ void thread_init_early(void)
  */
 void thread_init(void)
 {
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        timer_initialize(&deadline_timer[i].timer);
+    }
+
 #if PLATFORM_HAS_DYNAMIC_TIMER
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        timer_initialize(&preempt_timer[i]);
+        timer_initialize(&preempt_timer[i].timer);
     }
 #endif
 }
@@ -1084,10 +2381,11 @@ void thread_set_priority(int priority)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
-    current_thread->priority = priority;
+    current_thread->base_priority = priority;
+    current_thread->priority = thread_pi_inherited_priority(current_thread);
 
     current_thread->state = THREAD_READY;
-    insert_in_run_queue_head(current_thread);
+    insert_current_in_run_queue_head(current_thread);
     thread_resched();
 
     THREAD_UNLOCK(state);
@@ -1116,6 +2414,7 @@ void thread_become_idle(void)
 
     /* mark ourself as idle */
     t->priority = IDLE_PRIORITY;
+    t->base_priority = IDLE_PRIORITY;
     t->flags |= THREAD_FLAG_IDLE;
     thread_set_pinned_cpu(t, arch_curr_cpu_num());
 
@@ -1235,22 +2534,30 @@ void dump_thread(thread_t *t, bool full_dump)
     if (full_dump) {
         dprintf(INFO, "dump_thread: t %p (%s:%s)\n", t, oname, t->name);
 #if WITH_SMP
-        dprintf(INFO, "\tstate %s, curr_cpu %d, pinned_cpu %d, priority %d, remaining quantum %d\n",
-                thread_state_to_str(t->state), t->curr_cpu, t->pinned_cpu, t->priority, t->remaining_quantum);
+        dprintf(INFO, "\tstate %s, curr_cpu %d, last_cpu %d, pinned_cpu %d, priority %d, remaining quantum %" PRId64 "\n",
+                thread_state_to_str(t->state), t->curr_cpu, t->last_cpu, t->pinned_cpu, t->priority,
+                t->remaining_quantum);
 #else
-        dprintf(INFO, "\tstate %s, priority %d, remaining quantum %d\n",
+        dprintf(INFO, "\tstate %s, priority %d, remaining quantum %" PRId64 "\n",
                 thread_state_to_str(t->state), t->priority, t->remaining_quantum);
 #endif
         dprintf(INFO, "\truntime_ns %" PRIu64 ", runtime_s %" PRIu64 "\n",
                 runtime, runtime / 1000000000);
         dprintf(INFO, "\tstack %p, stack_size %zu\n", t->stack, t->stack_size);
-        dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
+        dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
                 (t->flags & THREAD_FLAG_DETACHED) ? "Dt" :"",
                 (t->flags & THREAD_FLAG_FREE_STACK) ? "Fs" :"",
                 (t->flags & THREAD_FLAG_FREE_STRUCT) ? "Ft" :"",
                 (t->flags & THREAD_FLAG_REAL_TIME) ? "Rt" :"",
                 (t->flags & THREAD_FLAG_IDLE) ? "Id" :"",
-                (t->flags & THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK) ? "Sc" :"");
+                (t->flags & THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK) ? "Sc" :"",
+                (t->flags & THREAD_FLAG_DEADLINE) ? "Dl" :"");
+        if (t->flags & THREAD_FLAG_DEADLINE) {
+            dprintf(INFO, "\tdeadline runtime %" PRIu64 " period %" PRIu64 " cpu %d, "
+                    "overruns %" PRIu64 " (%" PRIu64 " ns)\n",
+                    t->deadline.runtime_ns, t->deadline.period_ns, t->deadline.cpu,
+                    t->deadline.overruns, t->deadline.overrun_ns);
+        }
         dprintf(INFO, "\twait queue %p, blocked_status %d, interruptable %d\n",
                 t->blocking_wait_queue, t->blocked_status, t->interruptable);
         dprintf(INFO, "\taspace %p\n", t->aspace);
@@ -1317,11 +2624,19 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
 
     DEBUG_ASSERT(thread->magic == THREAD_MAGIC);
 
-    /* spin trylocking on the thread lock since the routine that set up the callback,
+    /* the thread can't leave wait_queue_block() until this timer is cancelled, so
+     * if it's still on a wait queue, that queue remains valid for the duration of
+     * this callback.
+     */
+    wait_queue_t *wait = *(wait_queue_t * volatile *)&thread->blocking_wait_queue;
+    if (!wait)
+        return INT_NO_RESCHEDULE;
+
+    /* spin trylocking on the wait queue lock since the routine that set up the callback,
      * wait_queue_block, may be trying to simultaneously cancel this timer while holding the
-     * thread_lock.
+     * wait queue lock.
      */
-    while (unlikely(spin_trylock(&thread_lock))) {
+    while (unlikely(spin_trylock(&wait->lock))) {
         /* we failed to grab it, check for cancel */
         if (timer->cancel) {
             /* we were cancelled, so bail immediately */
@@ -1330,11 +2645,15 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
     }
 
     enum handler_return ret = INT_NO_RESCHEDULE;
-    if (thread_unblock_from_wait_queue(thread, ERR_TIMED_OUT) >= NO_ERROR) {
-        ret = INT_RESCHEDULE;
+    if (thread->blocking_wait_queue == wait) {
+        spin_lock(&thread_lock);
+        if (thread_unblock_from_wait_queue_thread_locked(thread, ERR_TIMED_OUT) >= NO_ERROR) {
+            ret = INT_RESCHEDULE;
+        }
+        spin_unlock(&thread_lock);
     }
 
-    spin_unlock(&thread_lock);
+    spin_unlock(&wait->lock);
 
     return ret;
 }
@@ -1346,6 +2665,9 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
  * queue and then blocks until some other thread wakes the queue
  * up again.
  *
+ * Must be called with the wait queue lock held. The lock is dropped while the
+ * thread is blocked and reacquired before returning.
+ *
  * @param  wait     The wait queue to enter
  * @param  timeout  The maximum time, in ms, to wait
  *
@@ -1366,14 +2688,14 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+    DEBUG_ASSERT(!spin_lock_held(&thread_lock));
 
     if (timeout == 0)
         return ERR_TIMED_OUT;
 
     list_add_tail(&wait->list, &current_thread->queue_node);
     wait->count++;
-    current_thread->state = THREAD_BLOCKED;
     current_thread->blocking_wait_queue = wait;
     current_thread->blocked_status = NO_ERROR;
 
@@ -1383,7 +2705,31 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
         timer_set_oneshot(&timer, timeout, wait_queue_timeout_handler, (void *)current_thread);
     }
 
-    thread_resched();
+    /* wakers take the wait queue lock before the thread lock, so once we hold the
+     * thread lock it's safe to let go of the wait queue. nobody can make us runnable
+     * until thread_resched() has switched away and released the thread lock.
+     */
+    spin_lock(&thread_lock);
+
+    /* thread_kill() delivers its signal under the thread lock only, so recheck it here
+     * where we can't miss it, rather than in the caller.
+     */
+    if (current_thread->interruptable &&
+        unlikely(current_thread->signals & THREAD_SIGNAL_KILL)) {
+        spin_unlock(&thread_lock);
+        list_delete(&current_thread->queue_node);
+        wait->count--;
+        current_thread->blocking_wait_queue = NULL;
+        current_thread->blocked_status = ERR_INTERRUPTED;
+    } else {
+        current_thread->state = THREAD_BLOCKED;
+        spin_unlock(&wait->lock);
+
+        thread_resched();
+
+        spin_unlock(&thread_lock);
+        spin_lock(&wait->lock);
+    }
 
     /* we don't really know if the timer fired or not, so it's better safe to try to cancel it */
     if (timeout != INFINITE_TIME) {
@@ -1393,6 +2739,41 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
     return current_thread->blocked_status;
 }
 
+/* pull one thread off the wait queue and ready it. called with the wait queue lock and
+ * the thread lock held. returns the cpus that need a reschedule kick.
+ */
+static mp_cpu_mask_t wait_queue_wake_thread_locked(wait_queue_t *wait, thread_t *t,
+                                                   bool reschedule, status_t wait_queue_error)
+{
+    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
+    DEBUG_ASSERT(t->blocking_wait_queue == wait);
+
+    wait->count--;
+    t->state = THREAD_READY;
+    t->blocked_status = wait_queue_error;
+    t->blocking_wait_queue = NULL;
+
+    /* if the caller is going to reschedule after dropping its locks, keep the woken
+     * thread local so it gets a chance to run before the current one.
+     */
+    if (reschedule)
+        return insert_in_run_queue_head_local(t);
+
+    /* likewise if the caller is about to block waiting for it, as long as the
+     * thread may run here at all
+     */
+    thread_t *current_thread = get_current_thread();
+    if (current_thread->handoff_wanted && !current_thread->handoff && !arch_in_int_handler() &&
+            !thread_is_deadline(t) &&
+            (thread_pinned_cpu(t) < 0 || thread_pinned_cpu(t) == (int)arch_curr_cpu_num())) {
+        THREAD_STATS_INC(handoffs);
+        current_thread->handoff = t;
+        return insert_in_run_queue_head_local(t);
+    }
+
+    return insert_in_run_queue_head(t);
+}
+
 /**
  * @brief  Wake up one thread sleeping on a wait queue
  *
@@ -1400,8 +2781,11 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
  * makes it executable.  The new thread will be placed at the head of the
  * run queue.
  *
+ * Must be called with the wait queue lock held.
+ *
  * @param wait  The wait queue to wake
- * @param reschedule  If true, the newly-woken thread will run immediately.
+ * @param reschedule  If true, the caller will call thread_reschedule() after
+ * dropping the wait queue lock, so the newly-woken thread is kept on the local cpu.
  * @param wait_queue_error  The return value which the new thread will receive
  * from wait_queue_block().
  *
@@ -1410,43 +2794,47 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
 int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue_error)
 {
     thread_t *t;
-    int ret = 0;
-
-    thread_t *current_thread = get_current_thread();
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     t = list_remove_head_type(&wait->list, thread_t, queue_node);
-    if (t) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->state = THREAD_READY;
-        t->blocked_status = wait_queue_error;
-        t->blocking_wait_queue = NULL;
-
-        /* if we're instructed to reschedule, stick the current thread on the head
-         * of the run queue first, so that the newly awakened thread gets a chance to run
-         * before the current one, but the current one doesn't get unnecessarilly punished.
-         */
-        if (reschedule) {
-            current_thread->state = THREAD_READY;
-            insert_in_run_queue_head(current_thread);
-        }
-        insert_in_run_queue_head(t);
-        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-        if (reschedule) {
-            thread_resched();
-        }
-        ret = 1;
+    if (!t)
+        return 0;
 
+    spin_lock(&thread_lock);
+    mp_reschedule(wait_queue_wake_thread_locked(wait, t, reschedule, wait_queue_error), 0);
+    spin_unlock(&thread_lock);
+
+    return 1;
+}
+
+/* wake all variant for callers that already hold the thread lock */
+static int wait_queue_wake_all_thread_locked(wait_queue_t *wait, bool reschedule,
+                                             status_t wait_queue_error)
+{
+    thread_t *t;
+    int ret = 0;
+    mp_cpu_mask_t cpus = 0;
+
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    /* pop all the threads off the wait queue into the run queue */
+    while ((t = list_remove_head_type(&wait->list, thread_t, queue_node))) {
+        cpus |= wait_queue_wake_thread_locked(wait, t, reschedule, wait_queue_error);
+        ret++;
     }
 
+    DEBUG_ASSERT(wait->count == 0);
+
+    if (ret > 0)
+        mp_reschedule(cpus, 0);
+
     return ret;
 }
 
-
 /**
  * @brief  Wake all threads sleeping on a wait queue
  *
@@ -1454,8 +2842,11 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
  * makes them executable.  The new threads will be placed at the head of the
  * run queue.
  *
+ * Must be called with the wait queue lock held.
+ *
  * @param wait  The wait queue to wake
- * @param reschedule  If true, the newly-woken threads will run immediately.
+ * @param reschedule  If true, the caller will call thread_reschedule() after
+ * dropping the wait queue lock, so the newly-woken threads are kept on the local cpu.
  * @param wait_queue_error  The return value which the new thread will receive
  * from wait_queue_block().
  *
@@ -1463,44 +2854,16 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
  */
 int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue_error)
 {
-    thread_t *t;
-    int ret = 0;
-
-    thread_t *current_thread = get_current_thread();
-
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
-    if (reschedule && wait->count > 0) {
-        /* if we're instructed to reschedule, stick the current thread on the head
-         * of the run queue first, so that the newly awakened threads get a chance to run
-         * before the current one, but the current one doesn't get unnecessarilly punished.
-         */
-        current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
-    }
-
-    /* pop all the threads off the wait queue into the run queue */
-    while ((t = list_remove_head_type(&wait->list, thread_t, queue_node))) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->state = THREAD_READY;
-        t->blocked_status = wait_queue_error;
-        t->blocking_wait_queue = NULL;
-
-        insert_in_run_queue_head(t);
-        ret++;
-    }
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
-    DEBUG_ASSERT(wait->count == 0);
+    if (wait->count == 0)
+        return 0;
 
-    if (ret > 0) {
-        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-        if (reschedule) {
-            thread_resched();
-        }
-    }
+    spin_lock(&thread_lock);
+    int ret = wait_queue_wake_all_thread_locked(wait, reschedule, wait_queue_error);
+    spin_unlock(&thread_lock);
 
     return ret;
 }
@@ -1513,12 +2876,14 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
  * thread is currently waiting, it could have been scheduled later, in
  * which case it would have called wait_queue_block() on an invalid wait
  * queue.
+ *
+ * Must be called with the wait queue lock held.
  */
 void wait_queue_destroy(wait_queue_t *wait)
 {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     if (!list_is_empty(&wait->list)) {
         panic("wait_queue_destroy() called on non-empty wait_queue_t\n");
@@ -1527,12 +2892,34 @@ void wait_queue_destroy(wait_queue_t *wait)
     wait->magic = 0;
 }
 
+/* called with both the thread's wait queue lock and the thread lock held */
+static status_t thread_unblock_from_wait_queue_thread_locked(thread_t *t, status_t wait_queue_error)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (t->state != THREAD_BLOCKED || t->blocking_wait_queue == NULL)
+        return ERR_BAD_STATE;
+
+    DEBUG_ASSERT(t->blocking_wait_queue->magic == WAIT_QUEUE_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&t->blocking_wait_queue->lock));
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+
+    list_delete(&t->queue_node);
+    mp_reschedule(wait_queue_wake_thread_locked(t->blocking_wait_queue, t, false, wait_queue_error), 0);
+
+    return NO_ERROR;
+}
+
 /**
  * @brief  Wake a specific thread in a wait queue
  *
  * This function extracts a specific thread from a wait queue, wakes it, and
  * puts it at the head of the run queue.
  *
+ * Must be called with the lock of the wait queue the thread is blocked on held.
+ *
  * @param t  The thread to wake
  * @param wait_queue_error  The return value which the new thread will receive
  *   from wait_queue_block().
@@ -1541,29 +2928,15 @@ void wait_queue_destroy(wait_queue_t *wait)
  */
 status_t thread_unblock_from_wait_queue(thread_t *t, status_t wait_queue_error)
 {
-    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
-    if (t->state != THREAD_BLOCKED)
-        return ERR_BAD_STATE;
-
-    DEBUG_ASSERT(t->blocking_wait_queue != NULL);
-    DEBUG_ASSERT(t->blocking_wait_queue->magic == WAIT_QUEUE_MAGIC);
-    DEBUG_ASSERT(list_in_list(&t->queue_node));
 
-    list_delete(&t->queue_node);
-    t->blocking_wait_queue->count--;
-    t->blocking_wait_queue = NULL;
-    t->state = THREAD_READY;
-    t->blocked_status = wait_queue_error;
-    insert_in_run_queue_head(t);
-    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+    spin_lock(&thread_lock);
+    status_t ret = thread_unblock_from_wait_queue_thread_locked(t, wait_queue_error);
+    spin_unlock(&thread_lock);
 
-    return NO_ERROR;
+    return ret;
 }
 
-#if WITH_PANIC_BACKTRACE
 static status_t thread_read_stack(thread_t* t, void* ptr, void* out, size_t sz)
 {
     if (!is_kernel_address((uintptr_t)ptr) ||
@@ -1575,20 +2948,32 @@ static status_t thread_read_stack(thread_t* t, void* ptr, void* out, size_t sz)
     return NO_ERROR;
 }
 
-void thread_print_backtrace(thread_t* t, void* fp)
+size_t thread_get_backtrace(thread_t* t, void* fp, uintptr_t* pcs, size_t max)
 {
     void* pc;
+    size_t n = 0;
     if (t == NULL) {
-        return;
+        return 0;
     }
-    for (int n = 0; n < 10; n++) {
+    while (n < max) {
         if (thread_read_stack(t, fp + 8, &pc, sizeof(void*))) {
             break;
         }
-        printf("bt#%02d: %p\n", n, pc);
+        pcs[n++] = (uintptr_t)pc;
         if (thread_read_stack(t, fp, &fp, sizeof(void*))) {
             break;
         }
     }
+    return n;
+}
+
+#if WITH_PANIC_BACKTRACE
+void thread_print_backtrace(thread_t* t, void* fp)
+{
+    uintptr_t pcs[10];
+    size_t n = thread_get_backtrace(t, fp, pcs, countof(pcs));
+    for (size_t i = 0; i < n; i++) {
+        printf("bt#%02zu: %p\n", i, (void*)pcs[i]);
+    }
 }
 #endif
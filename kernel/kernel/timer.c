@@ -28,13 +28,49 @@
 #include <kernel/spinlock.h>
 #include <platform/timer.h>
 #include <platform.h>
+#include <lib/counters.h>
 
 #define LOCAL_TRACE 0
 
+KCOUNTER(timer_fires, "kernel.timer_fires");
+
 spin_lock_t timer_lock;
 
+/* Each cpu keeps its timers in a hierarchical timing wheel. Level 0 has one slot
+ * per millisecond, and each level above it has slots TIMER_WHEEL_SLOTS times
+ * coarser than the one below. A timer goes in the lowest level whose span covers
+ * its deadline and is cascaded down when the wheel clock reaches the start of its
+ * slot, so it always fires out of a level 0 slot on the millisecond it was
+ * scheduled for. Arming and cancelling a timer are O(1).
+ *
+ * Each level keeps a bitmap of slots that may have timers in them. Cancelling
+ * doesn't know which slot a timer was in, so bits are cleared lazily once the
+ * slot is found to be empty.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 5
+
+#define TIMER_WHEEL_SHIFT(level) ((level) * TIMER_WHEEL_BITS)
+
+/* timers further out than this are parked at the far end of the top level and
+ * placed again once they get there.
+ */
+#define TIMER_WHEEL_MAX_DELTA ((1u << TIMER_WHEEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1)
+
+static_assert(TIMER_WHEEL_SLOTS <= 64, "slot bitmap too small");
+static_assert(TIMER_WHEEL_SHIFT(TIMER_WHEEL_LEVELS) < 31, "wheel range exceeds what TIME_GT handles");
+
+struct timer_wheel_level {
+    uint64_t bitmap;
+    struct list_node slot[TIMER_WHEEL_SLOTS];
+};
+
 struct timer_state {
-    struct list_node timer_queue;
+    /* the first millisecond that hasn't been processed yet */
+    lk_time_t clk;
+    struct timer_wheel_level level[TIMER_WHEEL_LEVELS];
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -49,30 +85,189 @@ void timer_initialize(timer_t *timer)
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
+/* the time the wheel files a timer under. a timer with slack is pushed out to
+ * the coarsest boundary within its slack so it can fire along with others.
+ */
+static lk_time_t timer_wheel_deadline(const timer_t *timer)
+{
+    lk_time_t deadline = timer->scheduled_time;
+    if (timer->slack > 0) {
+        lk_time_t align = 1u << (31 - __builtin_clz(timer->slack));
+        deadline = (deadline + align - 1) & ~(align - 1);
+    }
+    return deadline;
+}
+
 static void insert_timer_in_queue(uint cpu, timer_t *timer)
 {
-    timer_t *entry;
+    struct timer_state *ts = &timers[cpu];
 
     DEBUG_ASSERT(arch_ints_disabled());
 
     LTRACEF("timer %p, cpu %u, scheduled %u, periodic %u\n", timer, cpu, timer->scheduled_time, timer->periodic_time);
 
-    list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
+    lk_time_t deadline = timer_wheel_deadline(timer);
+    lk_time_t delta;
+
+    if (TIME_LT(deadline, ts->clk)) {
+        /* already due, goes in the slot that's processed next */
+        deadline = ts->clk;
+        delta = 0;
+    } else {
+        delta = deadline - ts->clk;
+        if (delta > TIMER_WHEEL_MAX_DELTA) {
+            delta = TIMER_WHEEL_MAX_DELTA;
+            deadline = ts->clk + delta;
         }
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&timers[cpu].timer_queue, &timer->node);
+    uint level = 0;
+    while (delta >= (1u << TIMER_WHEEL_SHIFT(level + 1)))
+        level++;
+
+    uint slot = (deadline >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEEL_MASK;
+    list_add_tail(&ts->level[level].slot[slot], &timer->node);
+    ts->level[level].bitmap |= (1ull << slot);
 }
 
-static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_callback callback, void *arg)
+/* find the first occupied slot of a level, starting at first and wrapping around.
+ * returns its distance in slots from first, or -1 if the level is empty.
+ */
+static int timer_wheel_next_slot(struct timer_wheel_level *lvl, uint first)
+{
+    while (lvl->bitmap != 0) {
+        uint64_t rotated = lvl->bitmap >> first;
+        if (first)
+            rotated |= lvl->bitmap << (TIMER_WHEEL_SLOTS - first);
+
+        uint dist = __builtin_ctzll(rotated);
+        uint slot = (first + dist) & TIMER_WHEEL_MASK;
+
+        if (likely(!list_is_empty(&lvl->slot[slot])))
+            return dist;
+
+        /* left behind by timer_cancel() */
+        lvl->bitmap &= ~(1ull << slot);
+    }
+
+    return -1;
+}
+
+/* the next time this cpu's wheel needs attention, either for a level 0 slot
+ * coming due or a higher level slot to cascade. returns false if it's empty.
+ */
+static bool timer_wheel_next_event(struct timer_state *ts, lk_time_t *next)
+{
+    bool found = false;
+
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint shift = TIMER_WHEEL_SHIFT(level);
+        lk_time_t block = ts->clk >> shift;
+
+        /* the current slot of a higher level has already been cascaded, so
+         * anything in it belongs to the next trip around the wheel.
+         */
+        lk_time_t first = block + (level ? 1 : 0);
+        int dist = timer_wheel_next_slot(&ts->level[level], first & TIMER_WHEEL_MASK);
+        if (dist < 0)
+            continue;
+
+        lk_time_t t = (first + dist) << shift;
+        if (!found || TIME_LT(t, *next))
+            *next = t;
+        found = true;
+    }
+
+    return found;
+}
+
+/* move the wheel clock to t, cascading every higher level slot that starts at t */
+static void timer_wheel_advance(uint cpu, lk_time_t t)
+{
+    struct timer_state *ts = &timers[cpu];
+
+    ts->clk = t;
+
+    uint top = 0;
+    while (top + 1 < TIMER_WHEEL_LEVELS &&
+           (t & ((1u << TIMER_WHEEL_SHIFT(top + 1)) - 1)) == 0)
+        top++;
+
+    for (uint level = top; level > 0; level--) {
+        struct timer_wheel_level *lvl = &ts->level[level];
+        uint slot = (t >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEEL_MASK;
+
+        struct list_node list = LIST_INITIAL_VALUE(list);
+        timer_t *timer;
+        while ((timer = list_remove_head_type(&lvl->slot[slot], timer_t, node)) != NULL)
+            list_add_tail(&list, &timer->node);
+        lvl->bitmap &= ~(1ull << slot);
+
+        while ((timer = list_remove_head_type(&list, timer_t, node)) != NULL)
+            insert_timer_in_queue(cpu, timer);
+    }
+}
+
+/* pull the next timer that's due at or before now off this cpu's wheel */
+static timer_t *timer_wheel_pop_due(uint cpu, lk_time_t now)
+{
+    struct timer_state *ts = &timers[cpu];
+    lk_time_t next;
+
+    while (timer_wheel_next_event(ts, &next) && TIME_LTE(next, now)) {
+        if (next != ts->clk)
+            timer_wheel_advance(cpu, next);
+
+        struct timer_wheel_level *lvl = &ts->level[0];
+        uint slot = ts->clk & TIMER_WHEEL_MASK;
+        timer_t *timer = list_remove_head_type(&lvl->slot[slot], timer_t, node);
+        if (timer) {
+            if (unlikely(TIME_GT(timer->scheduled_time, now))) {
+                /* parked at the end of the wheel, place it again */
+                insert_timer_in_queue(cpu, timer);
+                continue;
+            }
+            return timer;
+        }
+
+        /* this millisecond is drained, move on */
+        lvl->bitmap &= ~(1ull << slot);
+        timer_wheel_advance(cpu, ts->clk + 1);
+    }
+
+    /* nothing else is due, catch the clock up */
+    if (TIME_LTE(ts->clk, now))
+        timer_wheel_advance(cpu, now + 1);
+
+    return NULL;
+}
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+/* program the hardware timer for the local wheel's next event, or stop it */
+static void timer_wheel_program(uint cpu, lk_time_t now)
+{
+    lk_time_t next;
+
+    if (!timer_wheel_next_event(&timers[cpu], &next)) {
+        LTRACEF("clearing old hw timer, nothing in the queue\n");
+        platform_stop_timer();
+        return;
+    }
+
+    lk_time_t delay = TIME_LT(next, now) ? 0 : next - now;
+
+    LTRACEF("setting new timer for %u msecs\n", (uint)delay);
+    platform_set_oneshot_timer(timer_tick, NULL, delay);
+}
+#endif
+
+static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, lk_time_t slack,
+                      timer_callback callback, void *arg)
 {
     lk_time_t now;
 
-    LTRACEF("timer %p, delay %u, period %u, callback %p, arg %p\n", timer, delay, period, callback, arg);
+    LTRACEF("timer %p, delay %u, period %u, slack %u, callback %p, arg %p\n",
+            timer, delay, period, slack, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
@@ -101,6 +296,7 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
     /* set up the structure */
     timer->scheduled_time = now + delay;
     timer->periodic_time = period;
+    timer->slack = slack;
     timer->callback = callback;
     timer->arg = arg;
     timer->active_cpu = -1;
@@ -108,13 +304,17 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
 
     LTRACEF("scheduled time %u\n", timer->scheduled_time);
 
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    lk_time_t old_next;
+    bool had_next = timer_wheel_next_event(&timers[cpu], &old_next);
+#endif
+
     insert_timer_in_queue(cpu, timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+    if (!had_next || TIME_LT(timer_wheel_deadline(timer), old_next)) {
+        /* we just moved up the next event on this cpu */
+        timer_wheel_program(cpu, now);
     }
 #endif
 
@@ -140,7 +340,27 @@ void timer_set_oneshot(timer_t *timer, lk_time_t delay, timer_callback callback,
 {
     if (delay == 0)
         delay = 1;
-    timer_set(timer, delay, 0, callback, arg);
+    timer_set(timer, delay, 0, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, with some slack
+ *
+ * Like timer_set_oneshot(), but the callback may run up to slack ms late so
+ * that it can be coalesced with other timers into a single interrupt.
+ *
+ * @param  timer The timer to use
+ * @param  delay The delay, in ms, before the timer is executed
+ * @param  slack How late, in ms, the timer is allowed to fire
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_etc(timer_t *timer, lk_time_t delay, lk_time_t slack,
+                           timer_callback callback, void *arg)
+{
+    if (delay == 0)
+        delay = 1;
+    timer_set(timer, delay, 0, slack, callback, arg);
 }
 
 /**
@@ -161,7 +381,7 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 {
     if (period == 0)
         period = 1;
-    timer_set(timer, period, period, callback, arg);
+    timer_set(timer, period, period, 0, callback, arg);
 }
 
 /**
@@ -194,31 +414,17 @@ void timer_cancel(timer_t *timer)
 
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
     if (list_in_list(&timer->node)) {
-#if PLATFORM_HAS_DYNAMIC_TIMER
-        timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-#endif
-
-        /* remove it from the queue */
+        /* remove it from the queue, the wheel notices the emptied slot later */
         list_delete(&timer->node);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-        /* see if we've just modified the head of this cpu's timer queue */
-        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-        if (newhead == NULL) {
+        /* if we emptied this cpu's wheel, stop the hardware timer. otherwise, or if
+         * we modified another cpu's queue, we'll just let it fire and sort itself out.
+         */
+        lk_time_t next;
+        if (!timer_wheel_next_event(&timers[cpu], &next)) {
             LTRACEF("clearing old hw timer, nothing in the queue\n");
             platform_stop_timer();
-        } else if (newhead != oldhead) {
-            lk_time_t delay;
-            lk_time_t now = current_time();
-
-            if (TIME_LT(newhead->scheduled_time, now))
-                delay = 0;
-            else
-                delay = newhead->scheduled_time - now;
-
-            LTRACEF("setting new timer to %u\n", (uint) delay);
-            platform_set_oneshot_timer(timer_tick, NULL, delay);
         }
 #endif
     }
@@ -254,19 +460,16 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+        timer = timer_wheel_pop_due(cpu, now);
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
-        if (likely(TIME_LT(now, timer->scheduled_time)))
-            break;
 
         /* process it */
         LTRACEF("timer %p\n", timer);
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -278,6 +481,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
 
         THREAD_STATS_INC(timers);
+        kcounter_add(&timer_fires, 1);
 
         LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
         if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
@@ -309,16 +513,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (timer) {
-        /* has to be the case or it would have fired already */
-        DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
-
-        lk_time_t delay = timer->scheduled_time - now;
-
-        LTRACEF("setting new timer for %u msecs for event %p\n", (uint)delay, timer);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
+    timer_wheel_program(cpu, now);
 
     /* we're done manipulating the timer queue */
     spin_unlock(&timer_lock);
@@ -341,28 +536,19 @@ void timer_transition_off_cpu(uint old_cpu)
     spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&timers[old_cpu].timer_queue, timer_t, node);
-
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&timers[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
-        insert_timer_in_queue(cpu, entry);
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        struct timer_wheel_level *lvl = &timers[old_cpu].level[level];
+        for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_t *entry;
+            while ((entry = list_remove_head_type(&lvl->slot[slot], timer_t, node)) != NULL)
+                insert_timer_in_queue(cpu, entry);
+        }
+        lvl->bitmap = 0;
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    timer_t *new_head = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (new_head != NULL && new_head != old_head) {
-        lk_time_t now = current_time();
-        lk_time_t delay = 0;
-        if (TIME_LT(now, new_head->scheduled_time)) {
-            delay = new_head->scheduled_time - now;
-        }
-
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
+    timer_wheel_program(cpu, current_time());
 #endif
 
     spin_unlock_irqrestore(&timer_lock, state);
@@ -378,15 +564,10 @@ void timer_thaw_percpu(void)
 
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *t = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (t) {
-        lk_time_t now = current_time();
-        lk_time_t delay = 0;
-        if (TIME_LT(now, t->scheduled_time)) {
-            delay = t->scheduled_time - now;
-        }
-        LTRACEF("rescheduling timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+    lk_time_t next;
+    if (timer_wheel_next_event(&timers[cpu], &next)) {
+        LTRACEF("rescheduling timer\n");
+        timer_wheel_program(cpu, current_time());
     }
 
     spin_unlock(&timer_lock);
@@ -396,8 +577,15 @@ void timer_thaw_percpu(void)
 void timer_init(void)
 {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
+    lk_time_t now = current_time();
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&timers[i].timer_queue);
+        timers[i].clk = now;
+        for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            timers[i].level[level].bitmap = 0;
+            for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+                list_initialize(&timers[i].level[level].slot[slot]);
+            }
+        }
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     /* register for a periodic timer tick */
@@ -9,14 +9,22 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_object.h>
 #include <lib/console.h>
 #include <list.h>
+#include <lk/init.h>
 #include <new.h>
 #include <pow2.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <trace.h>
@@ -31,6 +39,181 @@
 static mxtl::DoublyLinkedList<PmmArena*> arena_list;
 static Mutex arena_lock;
 
+// Per-cpu caches of free pages from KMAP arenas, so that most single page
+// allocations and frees don't have to take arena_lock.  A cpu's cache is only
+// ever touched by that cpu with interrupts disabled.  Caches are refilled from
+// and drained to the arenas kPageCacheBatch pages at a time, and are emptied
+// out entirely if an allocation can't otherwise be satisfied.
+static constexpr size_t kPageCacheBatch = 32;
+static constexpr size_t kPageCacheMax = 2 * kPageCacheBatch;
+
+struct pmm_page_cache {
+    list_node pages;
+    size_t count;
+};
+
+static pmm_page_cache page_cache[SMP_MAX_CPUS];
+static bool page_cache_enabled = false;
+
+// Pool of free KMAP pages that the zeroing thread has filled with zeroes ahead
+// of time, for PMM_ALLOC_FLAG_ZEROED allocations.  Like the per-cpu caches the
+// pages are in the CACHED state and still count as free.  The thread tops the
+// pool back up whenever it drops below kZeroPoolLow.
+static constexpr size_t kZeroPoolMax = 1024;
+static constexpr size_t kZeroPoolLow = kZeroPoolMax / 2;
+
+static spin_lock_t zero_pool_lock = SPIN_LOCK_INITIAL_VALUE;
+static list_node zero_pool = LIST_INITIAL_VALUE(zero_pool);
+static size_t zero_pool_count;
+static event_t zero_pool_event = EVENT_INITIAL_VALUE(zero_pool_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// Zeroing more pages than kParallelZeroMin for one allocation, which is what
+// committing a large vm object comes to once the zero pool has run dry, is
+// shared with the idle cpus.  It goes in rounds of kParallelZeroRound pages per
+// cpu, taking kParallelZeroChunk pages at a time so that they all finish at
+// about the same time.  The cpus zero with interrupts off, so none takes more
+// than kParallelZeroRound in a round, whether or not the others showed up.
+// Only threads that could take interrupts send the IPIs; anything else, such
+// as an allocation with a spinlock held, zeroes its pages itself.
+static constexpr size_t kParallelZeroMin = 256;
+static constexpr size_t kParallelZeroRound = 128;
+static constexpr size_t kParallelZeroChunk = 16;
+
+struct parallel_zero_context {
+    spin_lock_t lock;
+    list_node todo;
+    list_node done;
+};
+
+// Pages freed by tearing down large vm objects, typically when a process exits,
+// are queued on the current cpu and returned to the arenas by that cpu's freeing
+// thread, so that the exit doesn't have to walk every page it had.  Queued pages
+// aren't free yet; an allocation that comes up short takes them back inline along
+// with the per-cpu caches.
+static constexpr size_t kDeferredFreeMin = 64;
+static constexpr size_t kDeferredFreeBatch = 256;
+
+struct pmm_deferred_free {
+    spin_lock_t lock;
+    list_node pages;
+    // pages queued, and pages taken off the queue by the freeing thread but not
+    // yet back in the arenas; they count as free, as they soon will be
+    size_t count;
+    size_t freeing;
+    event_t event;
+};
+
+static pmm_deferred_free deferred_free[SMP_MAX_CPUS];
+static bool deferred_free_enabled = false;
+
+// Memory pressure is raised when the free pages in the arenas drop below the low
+// watermark and lowered once they climb back above the high one.  Changes wake
+// the pressure thread, which discards pages from discardable vm objects, then
+// compresses cold pages of anonymous ones, and passes the news on to the
+// registered callback.  Pages are only found cold by an aging pass that left them
+// untouched, so while the pressure lasts the thread makes another pass every
+// kPressureAgingInterval.  The watermarks are zero until the thread is running,
+// which keeps the state from changing before then.
+static constexpr size_t kPressureLowDivisor = 16;
+static constexpr size_t kPressureHighDivisor = 8;
+static constexpr lk_time_t kPressureAgingInterval = 1000;
+
+static size_t pressure_low_pages;
+static size_t pressure_high_pages;
+static bool memory_pressure;
+static event_t pressure_event = EVENT_INITIAL_VALUE(pressure_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+static pmm_pressure_callback_t pressure_callback;
+
+// Arenas are tagged with the numa node their memory is attached to.  Allocations
+// go to the arenas on their preferred node first, by default the node of the cpu
+// doing the allocating, so a page fault is satisfied with memory local to the cpu
+// that took it.  The per-cpu caches and the zero pool hold pages of any node, so
+// allocations asking for another node than the local one bypass them.
+static uint numa_node_count = 1;
+static uint8_t cpu_numa_node[SMP_MAX_CPUS];
+
+uint pmm_numa_node_count() {
+    return numa_node_count;
+}
+
+void pmm_set_cpu_numa_node(uint cpu, uint node) {
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    DEBUG_ASSERT(node < PMM_MAX_NUMA_NODES);
+    cpu_numa_node[cpu] = static_cast<uint8_t>(node);
+}
+
+uint pmm_cpu_numa_node(uint cpu) {
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    return cpu_numa_node[cpu];
+}
+
+/* the node an allocation with alloc_flags should come from first */
+static uint alloc_node(uint alloc_flags) {
+    if (alloc_flags & PMM_ALLOC_FLAG_NODE_VALID)
+        return (alloc_flags & ~PMM_ALLOC_FLAG_NODE_VALID & PMM_ALLOC_FLAG_NODE_MASK) >>
+               PMM_ALLOC_FLAG_NODE_SHIFT;
+    return cpu_numa_node[arch_curr_cpu_num()];
+}
+
+/* whether an allocation may be satisfied out of the per-cpu caches and zero pool */
+static bool alloc_is_local(uint alloc_flags) {
+    if (numa_node_count == 1 || !(alloc_flags & PMM_ALLOC_FLAG_NODE_VALID))
+        return true;
+    if (alloc_flags & PMM_ALLOC_FLAG_BIND)
+        return false;
+    return alloc_node(alloc_flags) == cpu_numa_node[arch_curr_cpu_num()];
+}
+
+/* call func on each arena an allocation with alloc_flags may come from, the ones
+ * on its preferred node first, until func returns true */
+template <typename F>
+static void for_each_alloc_arena(uint alloc_flags, F func) TA_REQ(arena_lock) {
+    const uint node = alloc_node(alloc_flags);
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            if (numa_node_count > 1 && (a.node() == node) != (pass == 0))
+                continue;
+
+            if (func(a))
+                return;
+        }
+
+        if (numa_node_count == 1 || (alloc_flags & PMM_ALLOC_FLAG_BIND))
+            return;
+    }
+}
+
+static size_t arena_free_count_locked() TA_REQ(arena_lock) {
+    size_t free = 0;
+    for (const auto& a : arena_list)
+        free += a.free_count();
+    return free;
+}
+
+static void pmm_update_pressure_locked() TA_REQ(arena_lock) {
+    if (pressure_low_pages == 0)
+        return;
+
+    size_t free = arena_free_count_locked();
+    bool pressure = memory_pressure;
+    if (!pressure && free < pressure_low_pages) {
+        pressure = true;
+    } else if (pressure && free > pressure_high_pages) {
+        pressure = false;
+    } else {
+        return;
+    }
+
+    __atomic_store_n(&memory_pressure, pressure, __ATOMIC_RELAXED);
+    event_signal(&pressure_event, false);
+}
+
 paddr_t vm_page_to_paddr(const vm_page_t* page) {
     for (const auto& a : arena_list) {
         // LTRACEF("testing page %p against arena %p\n", page, &a);
@@ -57,6 +240,10 @@ status_t pmm_add_arena(const pmm_arena_info_t* info) {
     DEBUG_ASSERT(IS_PAGE_ALIGNED(info->base));
     DEBUG_ASSERT(IS_PAGE_ALIGNED(info->size));
     DEBUG_ASSERT(info->size > 0);
+    DEBUG_ASSERT(info->node < PMM_MAX_NUMA_NODES);
+
+    if (info->node >= numa_node_count)
+        numa_node_count = info->node + 1;
 
     // allocate a c++ arena object
     PmmArena* arena = new (boot_alloc_mem(sizeof(PmmArena))) PmmArena(info);
@@ -79,69 +266,413 @@ done_add:
     return NO_ERROR;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
-    AutoLock al(arena_lock);
+/* cached pages all come from KMAP arenas, so can satisfy any allocation */
+static bool page_is_cacheable(const vm_page_t* page) {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page))
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+    }
+    return false;
+}
 
-    /* walk the arenas in order until we find one with a free page */
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+/* move up to count pages from the current cpu's cache to list */
+static size_t page_cache_alloc(size_t count, list_node* list) {
+    if (!page_cache_enabled)
+        return 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_page_cache* cache = &page_cache[arch_curr_cpu_num()];
+    size_t allocated = 0;
+    while (allocated < count && cache->count > 0) {
+        vm_page_t* page = list_remove_head_type(&cache->pages, vm_page_t, free.node);
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        cache->count--;
+
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->free.node);
+        allocated++;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return allocated;
+}
+
+/* put the cacheable pages in list into the current cpu's cache, leaving the rest
+ * behind in list. if the cache overflows its coldest pages are moved to spill,
+ * to be returned to the arenas by the caller. returns the number of pages taken
+ * from list.
+ */
+static size_t page_cache_free(list_node* list, list_node* spill) {
+    if (!page_cache_enabled)
+        return 0;
+
+    list_node uncached = LIST_INITIAL_VALUE(uncached);
+    size_t cached = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    pmm_page_cache* cache = &page_cache[arch_curr_cpu_num()];
+    vm_page_t* page;
+    while ((page = list_remove_head_type(list, vm_page_t, free.node)) != nullptr) {
+        if (!page_is_cacheable(page)) {
+            list_add_tail(&uncached, &page->free.node);
+            continue;
         }
 
-        // try to allocate the page out of the arena
-        vm_page_t* page = a.AllocPage(pa);
-        if (page)
-            return page;
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_head(&cache->pages, &page->free.node);
+        cache->count++;
+        cached++;
+
+        if (cache->count > kPageCacheMax) {
+            for (size_t i = 0; i < kPageCacheBatch; i++) {
+                vm_page_t* cold = list_remove_tail_type(&cache->pages, vm_page_t, free.node);
+                cold->state = VM_PAGE_STATE_ALLOC;
+                list_add_tail(spill, &cold->free.node);
+            }
+            cache->count -= kPageCacheBatch;
+        }
     }
 
-    LTRACEF("failed to allocate page\n");
-    return nullptr;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    DEBUG_ASSERT(list_is_empty(list));
+    while ((page = list_remove_head_type(&uncached, vm_page_t, free.node)) != nullptr)
+        list_add_tail(list, &page->free.node);
+
+    return cached;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
+static size_t page_cache_count() {
+    if (!page_cache_enabled)
+        return 0;
 
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
+    size_t count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        count += __atomic_load_n(&page_cache[i].count, __ATOMIC_RELAXED);
+    return count;
+}
 
-    if (count == 0)
+struct page_cache_drain_context {
+    spin_lock_t lock;
+    list_node pages;
+};
+
+static void page_cache_drain_task(void* raw_context) {
+    auto context = static_cast<page_cache_drain_context*>(raw_context);
+    pmm_page_cache* cache = &page_cache[arch_curr_cpu_num()];
+
+    spin_lock(&context->lock);
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&cache->pages, vm_page_t, free.node)) != nullptr) {
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(&context->pages, &page->free.node);
+    }
+    cache->count = 0;
+    spin_unlock(&context->lock);
+}
+
+static size_t pmm_free_locked(list_node* list) TA_REQ(arena_lock);
+
+/* move up to count pages from the zero pool to list */
+static size_t zero_pool_alloc(size_t count, list_node* list) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&zero_pool_lock, state);
+
+    size_t allocated = 0;
+    while (allocated < count && zero_pool_count > 0) {
+        vm_page_t* page = list_remove_head_type(&zero_pool, vm_page_t, free.node);
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        zero_pool_count--;
+
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->free.node);
+        allocated++;
+    }
+    bool refill = zero_pool_count < kZeroPoolLow;
+
+    spin_unlock_irqrestore(&zero_pool_lock, state);
+
+    if (refill)
+        event_signal(&zero_pool_event, false);
+    return allocated;
+}
+
+static size_t deferred_free_count() {
+    if (!deferred_free_enabled)
         return 0;
 
+    size_t count = 0;
+    for (const auto& queue : deferred_free) {
+        count += __atomic_load_n(&queue.count, __ATOMIC_RELAXED) +
+                 __atomic_load_n(&queue.freeing, __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+/* move every cpu's queue of pages waiting to be freed to list */
+static void deferred_free_take_all(list_node* list) {
+    if (!deferred_free_enabled)
+        return;
+
+    for (auto& queue : deferred_free) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&queue.lock, state);
+        list_splice_after(&queue.pages, list->prev);
+        __atomic_store_n(&queue.count, 0, __ATOMIC_RELAXED);
+        spin_unlock_irqrestore(&queue.lock, state);
+    }
+}
+
+/* return every cpu's cached pages, the pages waiting to be freed and the zero
+ * pool to the arenas. returns false if there were none */
+static bool page_cache_drain_all() {
+    page_cache_drain_context context;
+    spin_lock_init(&context.lock);
+    list_initialize(&context.pages);
+
+    deferred_free_take_all(&context.pages);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&zero_pool_lock, state);
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&zero_pool, vm_page_t, free.node)) != nullptr) {
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(&context.pages, &page->free.node);
+    }
+    zero_pool_count = 0;
+    spin_unlock_irqrestore(&zero_pool_lock, state);
+
+    if (page_cache_count() > 0)
+        mp_sync_exec(MP_CPU_ALL, page_cache_drain_task, &context);
+
+    if (list_is_empty(&context.pages))
+        return false;
+
     AutoLock al(arena_lock);
+    pmm_free_locked(&context.pages);
+    return true;
+}
 
+static vm_page_t* pmm_alloc_page_locked(uint alloc_flags, paddr_t* pa) TA_REQ(arena_lock) {
+    /* walk the arenas in order until we find one with a free page */
+    vm_page_t* page = nullptr;
+    for_each_alloc_arena(alloc_flags, [&](PmmArena& a) {
+        // try to allocate the page out of the arena
+        page = a.AllocPage(pa);
+        return page != nullptr;
+    });
+
+    if (page)
+        pmm_update_pressure_locked();
+    return page;
+}
+
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, struct list_node* list)
+    TA_REQ(arena_lock) {
     /* walk the arenas in order, allocating as many pages as we can from each */
     size_t allocated = 0;
-    for (auto& a : arena_list) {
+    for_each_alloc_arena(alloc_flags, [&](PmmArena& a) {
         DEBUG_ASSERT(count > allocated);
 
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
-
         // ask the arena to allocate some pages
         allocated += a.AllocPages(count - allocated, list);
         DEBUG_ASSERT(allocated <= count);
-        if (allocated == count)
+        return allocated == count;
+    });
+
+    pmm_update_pressure_locked();
+    return allocated;
+}
+
+static vm_page_t* pmm_alloc_page_cached(uint alloc_flags, paddr_t* pa) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    vm_page_t* page = nullptr;
+
+    const bool local = alloc_is_local(alloc_flags);
+    if (!local || page_cache_alloc(1, &list) == 0) {
+        /* the local cache is empty, grab a batch for it while we have the lock */
+        bool drained = false;
+        for (;;) {
+            {
+                AutoLock al(arena_lock);
+                if (page_cache_enabled && local)
+                    pmm_alloc_pages_locked(kPageCacheBatch, PMM_ALLOC_FLAG_KMAP, &list);
+                if (!list_is_empty(&list))
+                    break;
+
+                page = pmm_alloc_page_locked(alloc_flags, pa);
+                if (page)
+                    return page;
+            }
+
+            /* pages may be sitting in other cpus' caches */
+            if (drained || !page_cache_drain_all()) {
+                LTRACEF("failed to allocate page\n");
+                return nullptr;
+            }
+            drained = true;
+        }
+    }
+
+    page = list_remove_head_type(&list, vm_page_t, free.node);
+    if (!list_is_empty(&list)) {
+        list_node spill = LIST_INITIAL_VALUE(spill);
+        page_cache_free(&list, &spill);
+        if (!list_is_empty(&list) || !list_is_empty(&spill)) {
+            AutoLock al(arena_lock);
+            pmm_free_locked(&list);
+            pmm_free_locked(&spill);
+        }
+    }
+
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+    return page;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (!(alloc_flags & PMM_ALLOC_FLAG_ZEROED))
+        return pmm_alloc_page_cached(alloc_flags, pa);
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (alloc_is_local(alloc_flags) && zero_pool_alloc(1, &list) > 0) {
+        vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+        if (pa)
+            *pa = vm_page_to_paddr(page);
+        return page;
+    }
+
+    /* the pool has run dry, zero one ourselves */
+    paddr_t page_pa;
+    vm_page_t* page = pmm_alloc_page_cached(alloc_flags | PMM_ALLOC_FLAG_KMAP, &page_pa);
+    if (!page)
+        return nullptr;
+
+    arch_zero_page(paddr_to_kvaddr(page_pa));
+
+    if (pa)
+        *pa = page_pa;
+    return page;
+}
+
+static void parallel_zero_task(void* _context) {
+    auto context = static_cast<parallel_zero_context*>(_context);
+
+    for (size_t taken = 0; taken < kParallelZeroRound; taken += kParallelZeroChunk) {
+        list_node chunk = LIST_INITIAL_VALUE(chunk);
+        vm_page_t* page;
+
+        spin_lock(&context->lock);
+        for (size_t i = 0; i < kParallelZeroChunk; i++) {
+            page = list_remove_head_type(&context->todo, vm_page_t, free.node);
+            if (!page)
+                break;
+            list_add_tail(&chunk, &page->free.node);
+        }
+        spin_unlock(&context->lock);
+
+        if (list_is_empty(&chunk))
+            return;
+
+        list_for_every_entry (&chunk, page, vm_page_t, free.node) {
+            arch_zero_page(paddr_to_kvaddr(vm_page_to_paddr(page)));
+        }
+
+        spin_lock(&context->lock);
+        list_splice_after(&chunk, context->done.prev);
+        spin_unlock(&context->lock);
+    }
+}
+
+/* zero the count KMAP pages on list */
+static void pmm_zero_pages(list_node* list, size_t count) {
+    parallel_zero_context context;
+    spin_lock_init(&context.lock);
+    list_initialize(&context.todo);
+    list_initialize(&context.done);
+
+    while (count >= kParallelZeroMin && !arch_ints_disabled() && !arch_in_int_handler()) {
+        /* whoever is idle right now, and us */
+        mp_cpu_mask_t target = mp_get_idle_mask() | (1u << arch_curr_cpu_num());
+        target &= mp_get_active_mask();
+        size_t cpus = __builtin_popcount(target);
+        if (cpus < 2)
             break;
+
+        size_t round = MIN(count, kParallelZeroRound * cpus);
+        for (size_t i = 0; i < round; i++) {
+            vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+            list_add_tail(&context.todo, &page->free.node);
+        }
+        count -= round;
+
+        mp_sync_exec(target, parallel_zero_task, &context);
+
+        /* the shares of any cpus that went away before taking them go back on
+         * the list, for the next round or for us */
+        count += list_length(&context.todo);
+        list_splice_after(&context.todo, list);
     }
 
-    return allocated;
+    vm_page_t* page;
+    list_for_every_entry (list, page, vm_page_t, free.node) {
+        arch_zero_page(paddr_to_kvaddr(vm_page_to_paddr(page)));
+    }
+
+    list_splice_after(&context.done, list->prev);
 }
 
-size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
-    LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
 
-    uint allocated = 0;
     if (count == 0)
         return 0;
 
-    address = ROUNDDOWN(address, PAGE_SIZE);
+    const bool local = alloc_is_local(alloc_flags);
 
-    AutoLock al(arena_lock);
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        size_t allocated = local ? zero_pool_alloc(count, list) : 0;
+        if (allocated == count)
+            return allocated;
+
+        /* zero whatever the pool couldn't supply ourselves */
+        list_node fresh = LIST_INITIAL_VALUE(fresh);
+        size_t zeroing = pmm_alloc_pages(count - allocated,
+                                         (alloc_flags & ~PMM_ALLOC_FLAG_ZEROED) | PMM_ALLOC_FLAG_KMAP,
+                                         &fresh);
+        pmm_zero_pages(&fresh, zeroing);
+        list_splice_after(&fresh, list->prev);
+        return allocated + zeroing;
+    }
+
+    size_t allocated = local ? page_cache_alloc(count, list) : 0;
+    if (allocated == count)
+        return allocated;
+
+    {
+        AutoLock al(arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+    }
+
+    /* pages may be sitting in other cpus' caches */
+    if (allocated < count && page_cache_drain_all()) {
+        AutoLock al(arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+    }
+
+    return allocated;
+}
+
+static size_t pmm_alloc_range_locked(paddr_t address, size_t count, struct list_node* list)
+    TA_REQ(arena_lock) {
+    size_t allocated = 0;
 
     /* walk through the arenas, looking to see if the physical page belongs to it */
     for (auto& a : arena_list) {
@@ -161,6 +692,45 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
             break;
     }
 
+    pmm_update_pressure_locked();
+    return allocated;
+}
+
+size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
+    LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
+
+    if (count == 0)
+        return 0;
+
+    address = ROUNDDOWN(address, PAGE_SIZE);
+
+    size_t allocated;
+    {
+        AutoLock al(arena_lock);
+        allocated = pmm_alloc_range_locked(address, count, list);
+    }
+
+    /* the rest of the range may be sitting in per-cpu caches */
+    if (allocated < count && page_cache_drain_all()) {
+        AutoLock al(arena_lock);
+        allocated += pmm_alloc_range_locked(address + allocated * PAGE_SIZE, count - allocated, list);
+    }
+
+    return allocated;
+}
+
+static size_t pmm_alloc_contiguous_locked(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                          paddr_t* pa, struct list_node* list) TA_REQ(arena_lock) {
+    size_t allocated = 0;
+    for_each_alloc_arena(alloc_flags, [&](PmmArena& a) {
+        allocated = a.AllocContiguous(count, alignment_log2, pa, list);
+        return allocated > 0;
+    });
+
+    if (allocated > 0) {
+        DEBUG_ASSERT(allocated == count);
+        pmm_update_pressure_locked();
+    }
     return allocated;
 }
 
@@ -173,20 +743,17 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
     if (alignment_log2 < PAGE_SIZE_SHIFT)
         alignment_log2 = PAGE_SIZE_SHIFT;
 
-    AutoLock al(arena_lock);
-
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+    for (bool drained = false;; drained = true) {
+        {
+            AutoLock al(arena_lock);
+            size_t allocated = pmm_alloc_contiguous_locked(count, alloc_flags, alignment_log2, pa, list);
+            if (allocated > 0)
+                return allocated;
         }
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
-        }
+        /* cached pages may be breaking up the runs */
+        if (drained || !page_cache_drain_all())
+            break;
     }
 
     LTRACEF("couldn't find run\n");
@@ -262,18 +829,13 @@ size_t pmm_free_kpages(void* _ptr, size_t count) {
     return pmm_free(&list);
 }
 
-size_t pmm_free(struct list_node* list) {
-    LTRACEF("list %p\n", list);
-
-    DEBUG_ASSERT(list);
-
-    AutoLock al(arena_lock);
-
-    uint count = 0;
+static size_t pmm_free_locked(list_node* list) TA_REQ(arena_lock) {
+    size_t count = 0;
     while (!list_is_empty(list)) {
         vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
 
         DEBUG_ASSERT(!page_is_free(page));
+        DEBUG_ASSERT(page->state != VM_PAGE_STATE_CACHED);
 
         /* see which arena this page belongs to and add it */
         for (auto& a : arena_list) {
@@ -284,7 +846,25 @@ size_t pmm_free(struct list_node* list) {
         }
     }
 
-    LTRACEF("returning count %u\n", count);
+    pmm_update_pressure_locked();
+    return count;
+}
+
+size_t pmm_free(struct list_node* list) {
+    LTRACEF("list %p\n", list);
+
+    DEBUG_ASSERT(list);
+
+    /* pages that fit in the local cache never touch the arena lock */
+    list_node spill = LIST_INITIAL_VALUE(spill);
+    size_t count = page_cache_free(list, &spill);
+    if (!list_is_empty(list) || !list_is_empty(&spill)) {
+        AutoLock al(arena_lock);
+        count += pmm_free_locked(list);
+        pmm_free_locked(&spill);
+    }
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -298,11 +878,33 @@ size_t pmm_free_page(vm_page_t* page) {
     return pmm_free(&list);
 }
 
+void pmm_free_deferred(struct list_node* list, size_t count) {
+    LTRACEF("list %p count %zu\n", list, count);
+
+    if (!deferred_free_enabled || count < kDeferredFreeMin) {
+        pmm_free(list);
+        return;
+    }
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pmm_deferred_free* queue = &deferred_free[arch_curr_cpu_num()];
+
+    spin_lock(&queue->lock);
+    list_splice_after(list, queue->pages.prev);
+    __atomic_store_n(&queue->count, queue->count + count, __ATOMIC_RELAXED);
+    event_signal(&queue->event, false);
+    spin_unlock(&queue->lock);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
 void pmm_dump_free() {
     size_t free = 0u;
     for (const auto& a : arena_list) {
         free += a.free_count();
     }
+    free += page_cache_count() + zero_pool_count + deferred_free_count();
     auto megabytes_free = free / 256u;
     printf(" %zu free MBs\n", megabytes_free);
 }
@@ -313,9 +915,186 @@ size_t pmm_count_free_pages() {
     for (const auto& a : arena_list) {
         free += a.free_count();
     }
-    return free;
+    return free + page_cache_count() + zero_pool_count + deferred_free_count();
 }
 
+/* keeps the zero pool topped up, only running when nothing else wants the cpu */
+static int pmm_zero_thread(void*) {
+    for (;;) {
+        event_wait(&zero_pool_event);
+
+        /* don't hoard the last of the free memory */
+        if (pmm_count_free_pages() < 4 * kZeroPoolMax)
+            continue;
+
+        while (__atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED) < kZeroPoolMax) {
+            paddr_t pa;
+            vm_page_t* page = pmm_alloc_page_cached(PMM_ALLOC_FLAG_KMAP, &pa);
+            if (!page)
+                break;
+
+            arch_zero_page(paddr_to_kvaddr(pa));
+
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&zero_pool_lock, state);
+            page->state = VM_PAGE_STATE_CACHED;
+            list_add_head(&zero_pool, &page->free.node);
+            zero_pool_count++;
+            spin_unlock_irqrestore(&zero_pool_lock, state);
+        }
+    }
+
+    return 0;
+}
+
+/* returns the pages queued by pmm_free_deferred() on one cpu to the arenas */
+static int pmm_deferred_free_thread(void* arg) {
+    auto queue = static_cast<pmm_deferred_free*>(arg);
+    for (;;) {
+        event_wait(&queue->event);
+
+        list_node pages = LIST_INITIAL_VALUE(pages);
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&queue->lock, state);
+        list_splice_after(&queue->pages, &pages);
+        __atomic_store_n(&queue->freeing, queue->count, __ATOMIC_RELAXED);
+        __atomic_store_n(&queue->count, 0, __ATOMIC_RELAXED);
+        event_unsignal(&queue->event);
+        spin_unlock_irqrestore(&queue->lock, state);
+
+        /* a batch at a time, so allocators don't wait long on the arena lock */
+        while (!list_is_empty(&pages)) {
+            list_node batch = LIST_INITIAL_VALUE(batch);
+            vm_page_t* page;
+            size_t n;
+            for (n = 0; n < kDeferredFreeBatch; n++) {
+                if ((page = list_remove_head_type(&pages, vm_page_t, free.node)) == nullptr)
+                    break;
+                list_add_tail(&batch, &page->free.node);
+            }
+            pmm_free(&batch);
+            __atomic_fetch_sub(&queue->freeing, n, __ATOMIC_RELAXED);
+        }
+    }
+
+    return 0;
+}
+
+static void pmm_page_cache_init(uint level) {
+    for (auto& cache : page_cache) {
+        list_initialize(&cache.pages);
+        cache.count = 0;
+    }
+    page_cache_enabled = true;
+
+    /* every queue is set up here, since draining walks them all, but each cpu
+     * starts its own thread as it comes up */
+    for (auto& queue : deferred_free) {
+        spin_lock_init(&queue.lock);
+        list_initialize(&queue.pages);
+        queue.count = 0;
+        queue.freeing = 0;
+        event_init(&queue.event, false, 0);
+    }
+    deferred_free_enabled = true;
+
+    thread_t* t = thread_create("pmm zeroer", &pmm_zero_thread, nullptr, IDLE_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+    event_signal(&zero_pool_event, false);
+}
+
+LK_INIT_HOOK(pmm_page_cache, &pmm_page_cache_init, LK_INIT_LEVEL_THREADING);
+
+/* runs on each cpu as it comes up, so only cpus that are present get a thread to
+ * free the pages they defer. a cpu can't defer any before it gets here */
+static void pmm_deferred_free_init(uint level) {
+    uint cpu = arch_curr_cpu_num();
+    char name[32];
+    snprintf(name, sizeof(name), "pmm free %u", cpu);
+    thread_t* t = thread_create(name, &pmm_deferred_free_thread, &deferred_free[cpu],
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK_FLAGS(pmm_deferred_free, &pmm_deferred_free_init, LK_INIT_LEVEL_THREADING + 1,
+                   LK_INIT_FLAG_ALL_CPUS);
+
+bool pmm_memory_pressure() {
+    return __atomic_load_n(&memory_pressure, __ATOMIC_RELAXED);
+}
+
+void pmm_set_pressure_callback(pmm_pressure_callback_t callback) {
+    __atomic_store_n(&pressure_callback, callback, __ATOMIC_RELEASE);
+
+    /* have the thread tell the new callback where things stand */
+    event_signal(&pressure_event, true);
+}
+
+static int pmm_pressure_thread(void*) {
+    bool notified = false;
+    bool pressure = false;
+    for (;;) {
+        event_wait_timeout(&pressure_event, pressure ? kPressureAgingInterval : INFINITE_TIME,
+                           false);
+
+        pressure = pmm_memory_pressure();
+        if (pressure) {
+            /* drop cache pages to get back above the high watermark, which may be
+             * enough to lift the pressure before anyone has to hear about it */
+            size_t free = pmm_count_free_pages();
+            if (free < pressure_high_pages) {
+                __UNUSED size_t discarded = VmObjectPaged::DiscardPages(pressure_high_pages - free);
+                LTRACEF("discarded %zu pages\n", discarded);
+                free = pmm_count_free_pages();
+            }
+            /* then squeeze the anonymous memory nobody has touched lately */
+            if (free < pressure_high_pages) {
+                __UNUSED size_t compressed = VmObjectPaged::CompressPages(pressure_high_pages - free);
+                LTRACEF("compressed %zu pages\n", compressed);
+            }
+            pressure = pmm_memory_pressure();
+        }
+
+        pmm_pressure_callback_t callback = __atomic_load_n(&pressure_callback, __ATOMIC_ACQUIRE);
+        if (callback && pressure != notified) {
+            notified = pressure;
+            callback(pressure);
+        }
+    }
+
+    return 0;
+}
+
+static void pmm_pressure_init(uint level) {
+    size_t total = 0;
+    {
+        AutoLock al(arena_lock);
+        for (const auto& a : arena_list)
+            total += a.page_count();
+    }
+
+    /* the watermarks are given in megabytes */
+    constexpr size_t kPagesPerMB = (1024 * 1024) / PAGE_SIZE;
+    size_t low = cmdline_get_uint32("vm.pressure_low", 0) * kPagesPerMB;
+    size_t high = cmdline_get_uint32("vm.pressure_high", 0) * kPagesPerMB;
+    if (low == 0)
+        low = total / kPressureLowDivisor;
+    if (high <= low)
+        high = MAX(low + 1, total / kPressureHighDivisor);
+
+    thread_t* t = thread_create("pmm pressure", &pmm_pressure_thread, nullptr, HIGH_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+
+    AutoLock al(arena_lock);
+    pressure_low_pages = low;
+    pressure_high_pages = high;
+    pmm_update_pressure_locked();
+}
+
+LK_INIT_HOOK(pmm_pressure, &pmm_pressure_init, LK_INIT_LEVEL_THREADING);
+
 extern "C"
 enum handler_return pmm_dump_timer(struct timer *t, lk_time_t, void *) {
     pmm_dump_free();
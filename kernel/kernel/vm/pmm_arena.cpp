@@ -9,13 +9,17 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <string.h>
 #include <trace.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
 PmmArena::PmmArena(const pmm_arena_info_t* info)
-    : info_(info) {}
+    : info_(info) {
+    for (auto& list : free_lists_)
+        list_initialize(&list);
+}
 
 PmmArena::~PmmArena() {}
 
@@ -32,25 +36,136 @@ void PmmArena::BootAllocArray() {
 
     page_array_ = (vm_page_t*)raw_page_array;
 
-    /* add them to the free list */
-    for (size_t i = 0; i < page_count; i++) {
-        auto& p = page_array_[i];
+    /* add them to the free lists */
+    FreeRange(0, page_count);
+}
+
+/* put the free block of 2^order pages starting at index on its free list */
+void PmmArena::AddFreeBlock(size_t index, uint order) {
+    DEBUG_ASSERT(order < kNumOrders);
+    DEBUG_ASSERT(IS_ALIGNED(index, 1UL << order));
+    DEBUG_ASSERT(index + (1UL << order) <= page_count());
+
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(!page->free.block_head);
+
+    page->free.order = static_cast<uint8_t>(order);
+    page->free.block_head = true;
+    list_add_head(&free_lists_[order], &page->free.node);
+    free_blocks_[order]++;
+}
+
+void PmmArena::RemoveFreeBlock(vm_page_t* page) {
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(page->free.block_head);
+
+    list_delete(&page->free.node);
+    page->free.block_head = false;
+    DEBUG_ASSERT(free_blocks_[page->free.order] > 0);
+    free_blocks_[page->free.order]--;
+}
+
+/* add a run of pages to the free lists as the fewest aligned blocks that cover it,
+ * without trying to coalesce them with their neighbors */
+void PmmArena::FreeRange(size_t index, size_t count) {
+    for (size_t i = index; i < index + count; i++) {
+        page_array_[i].state = VM_PAGE_STATE_FREE;
+        page_array_[i].free.block_head = false;
+    }
+    free_count_ += count;
+
+    while (count > 0) {
+        uint order = 0;
+        while (order + 1 < kNumOrders && IS_ALIGNED(index, 1UL << (order + 1)) &&
+               (1UL << (order + 1)) <= count)
+            order++;
+
+        AddFreeBlock(index, order);
+        index += 1UL << order;
+        count -= 1UL << order;
+    }
+}
+
+/* take a free block of 2^order pages off the free lists, splitting a larger one if
+ * need be, and return the index of its first page. the pages are left marked free. */
+bool PmmArena::AllocBlock(uint order, size_t* index) {
+    uint o = order;
+    while (o < kNumOrders && list_is_empty(&free_lists_[o]))
+        o++;
+    if (o == kNumOrders)
+        return false;
+
+    vm_page_t* page = list_peek_head_type(&free_lists_[o], vm_page_t, free.node);
+    RemoveFreeBlock(page);
+
+    /* give back the top half until the block is the right size */
+    size_t i = page - page_array_;
+    while (o > order) {
+        o--;
+        AddFreeBlock(i + (1UL << o), o);
+    }
 
-        list_add_tail(&free_list_, &p.free.node);
+    *index = i;
+    return true;
+}
+
+/* find the head of the free block containing the page at index, if any */
+vm_page_t* PmmArena::FindFreeBlock(size_t index) {
+    if (!page_is_free(&page_array_[index]))
+        return nullptr;
+
+    for (uint o = 0; o < kNumOrders; o++) {
+        vm_page_t* head = &page_array_[ROUNDDOWN(index, 1UL << o)];
+        if (page_is_free(head) && head->free.block_head)
+            return (head->free.order >= o) ? head : nullptr;
     }
 
-    free_count_ += page_count;
+    return nullptr;
+}
+
+/* pull the page at index out of whatever free block it's in, returning the rest of
+ * the block to the free lists */
+vm_page_t* PmmArena::TakeFreePage(size_t index) {
+    vm_page_t* head = FindFreeBlock(index);
+    if (!head)
+        return nullptr;
+
+    size_t start = head - page_array_;
+    uint order = head->free.order;
+    RemoveFreeBlock(head);
+
+    while (order > 0) {
+        order--;
+        size_t half = start + (1UL << order);
+        if (index >= half) {
+            AddFreeBlock(start, order);
+            start = half;
+        } else {
+            AddFreeBlock(half, order);
+        }
+    }
+    DEBUG_ASSERT(start == index);
+
+    vm_page_t* page = &page_array_[index];
+    page->state = VM_PAGE_STATE_ALLOC;
+
+    DEBUG_ASSERT(free_count_ > 0);
+    free_count_--;
+
+    return page;
 }
 
 vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-    if (!page)
+    size_t index;
+    if (!AllocBlock(0, &index))
         return nullptr;
 
     DEBUG_ASSERT(free_count_ > 0);
 
     free_count_--;
 
+    vm_page_t* page = &page_array_[index];
     DEBUG_ASSERT(page_is_free(page));
 
     page->state = VM_PAGE_STATE_ALLOC;
@@ -74,40 +189,18 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
 
     DEBUG_ASSERT(index < size() / PAGE_SIZE);
 
-    vm_page_t* page = get_page(index);
-    if (!page_is_free(page)) {
-        /* we hit an allocated page */
-        return nullptr;
-    }
-
-    list_delete(&page->free.node);
-
-    page->state = VM_PAGE_STATE_ALLOC;
-
-    DEBUG_ASSERT(free_count_ > 0);
-
-    free_count_--;
-
-    return page;
+    /* returns null if we hit an allocated page */
+    return TakeFreePage(index);
 }
 
 size_t PmmArena::AllocPages(size_t count, list_node* list) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+        vm_page_t* page = AllocPage(nullptr);
         if (!page)
             return allocated;
 
-        LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
-
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
-
-        DEBUG_ASSERT(page_is_free(page));
-
-        page->state = VM_PAGE_STATE_ALLOC;
         list_add_tail(list, &page->free.node);
 
         allocated++;
@@ -117,6 +210,39 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
 }
 
 size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
+    /* blocks of 2^order pages are aligned to 2^order pages relative to the start of
+     * the arena, so can satisfy the request directly if the arena itself is aligned */
+    uint order = MAX(log2_ulong_ceil(count), static_cast<uint>(alignment_log2 - PAGE_SIZE_SHIFT));
+    size_t index;
+    if (order >= kNumOrders || !IS_ALIGNED(base(), 1UL << alignment_log2) || !AllocBlock(order, &index)) {
+        /* too big, unaligned arena, or too fragmented for a whole block. a run that
+         * straddles blocks may still be found the slow way. */
+        return AllocContiguousScan(count, alignment_log2, pa, list);
+    }
+
+    LTRACEF("found block of order %u at pn %zu\n", order, index);
+
+    DEBUG_ASSERT(free_count_ >= (1UL << order));
+    free_count_ -= 1UL << order;
+
+    for (size_t i = index; i < index + count; i++) {
+        vm_page_t* p = &page_array_[i];
+        DEBUG_ASSERT(page_is_free(p));
+        p->state = VM_PAGE_STATE_ALLOC;
+        if (list)
+            list_add_tail(list, &p->free.node);
+    }
+
+    /* return the unused tail of the block */
+    FreeRange(index + count, (1UL << order) - count);
+
+    if (pa)
+        *pa = base() + index * PAGE_SIZE;
+
+    return count;
+}
+
+size_t PmmArena::AllocContiguousScan(size_t count, uint8_t alignment_log2, paddr_t* pa, list_node* list) {
     /* walk the list starting at alignment boundaries.
      * calculate the starting offset into this arena, based on the
      * base address of the arena to handle the case where the arena
@@ -151,18 +277,10 @@ retry:
         /* we found a run */
         LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
 
-        /* remove the pages from the run out of the free list */
+        /* carve the pages of the run out of their free blocks */
         for (paddr_t i = start; i < start + count; i++) {
-            p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
-
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
-
-            DEBUG_ASSERT(free_count_ > 0);
-
-            free_count_--;
+            p = TakeFreePage(i);
+            DEBUG_ASSERT(p);
 
             if (list)
                 list_add_tail(list, &p->free.node);
@@ -183,15 +301,33 @@ status_t PmmArena::FreePage(vm_page_t* page) {
         return ERR_NOT_FOUND;
 
     page->state = VM_PAGE_STATE_FREE;
+    page->free.block_head = false;
+
+    /* merge with the buddy for as long as it's free and whole */
+    size_t index = page - page_array_;
+    uint order = 0;
+    while (order + 1 < kNumOrders) {
+        size_t buddy_index = index ^ (1UL << order);
+        if (buddy_index >= page_count())
+            break;
+
+        vm_page_t* buddy = &page_array_[buddy_index];
+        if (!page_is_free(buddy) || !buddy->free.block_head || buddy->free.order != order)
+            break;
+
+        RemoveFreeBlock(buddy);
+        index &= ~(1UL << order);
+        order++;
+    }
 
-    list_add_head(&free_list_, &page->free.node);
+    AddFreeBlock(index, order);
     free_count_++;
     return NO_ERROR;
 }
 
 void PmmArena::Dump(bool dump_pages) {
-    printf("arena %p: name '%s' base %#" PRIxPTR " size 0x%zx priority %u flags 0x%x\n", this, name(), base(),
-           size(), priority(), flags());
+    printf("arena %p: name '%s' base %#" PRIxPTR " size 0x%zx priority %u flags 0x%x node %u\n", this,
+           name(), base(), size(), priority(), flags(), node());
     printf("\tpage_array %p, free_count %zu\n", page_array_, free_count_);
 
     /* dump all of the pages */
@@ -213,6 +349,17 @@ void PmmArena::Dump(bool dump_pages) {
                state_count[i] * PAGE_SIZE);
     }
 
+    /* for each order, how many free blocks there are and how much of the free memory
+     * is in blocks too small to satisfy an allocation of that order */
+    printf("\tfree blocks:\n");
+    size_t smaller_pages = 0;
+    for (uint order = 0; order < kNumOrders; order++) {
+        size_t unusable = free_count_ ? (smaller_pages * 100) / free_count_ : 0;
+        printf("\t\torder %-2u %-10zu (%zu%% of free memory unusable at this order)\n", order,
+               free_blocks_[order], unusable);
+        smaller_pages += free_blocks_[order] << order;
+    }
+
     /* dump the free pages */
     printf("\tfree ranges:\n");
     ssize_t last = -1;
@@ -23,6 +23,10 @@ public:
 
     void Dump(bool dump_pages);
 
+    // free pages are kept in naturally aligned power of two blocks of up to
+    // 2^(kNumOrders - 1) pages, buddy allocator style
+    static constexpr uint kNumOrders = 16;
+
     // accessors
     const pmm_arena_info_t* info() const { return info_; }
     const char* name() const { return info_->name; }
@@ -30,7 +34,12 @@ public:
     size_t size() const { return info_->size; }
     unsigned int flags() const { return info_->flags; }
     unsigned int priority() const { return info_->priority; }
+    unsigned int node() const { return info_->node; }
     size_t free_count() const { return free_count_; };
+    size_t page_count() const { return info_->size / PAGE_SIZE; }
+
+    // number of free blocks of 2^order pages
+    size_t free_blocks(uint order) const { return free_blocks_[order]; }
 
     vm_page_t* get_page(size_t index) { return &page_array_[index]; }
 
@@ -62,10 +71,19 @@ public:
     }
 
 private:
+    void AddFreeBlock(size_t index, uint order);
+    void RemoveFreeBlock(vm_page_t* page);
+    void FreeRange(size_t index, size_t count);
+    bool AllocBlock(uint order, size_t* index);
+    vm_page_t* FindFreeBlock(size_t index);
+    vm_page_t* TakeFreePage(size_t index);
+    size_t AllocContiguousScan(size_t count, uint8_t alignment_log2, paddr_t* pa, list_node* list);
+
     const pmm_arena_info_t* info_ = nullptr;
 
     vm_page_t* page_array_ = nullptr;
 
     size_t free_count_ = 0;
-    list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
+    list_node free_lists_[kNumOrders];
+    size_t free_blocks_[kNumOrders] = {};
 };
@@ -11,6 +11,7 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS += \
     lib/cryptolib \
+    lib/lz4 \
     lib/mxtl \
     lib/user_copy
 
@@ -23,6 +24,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/vm_address_region.cpp \
     $(LOCAL_DIR)/vm_address_region_or_mapping.cpp \
     $(LOCAL_DIR)/vm_aspace.cpp \
+    $(LOCAL_DIR)/vm_benchmark.cpp \
     $(LOCAL_DIR)/vm_mapping.cpp \
     $(LOCAL_DIR)/vm_object.cpp \
     $(LOCAL_DIR)/vm_object_paged.cpp \
@@ -14,6 +14,7 @@
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_compressed_page.h>
 #include <lib/console.h>
 #include <lk/init.h>
 #include <string.h>
@@ -256,6 +257,7 @@ static int cmd_vm(int argc, const cmd_args* argv) {
         printf("%s virt2phys <address>\n", argv[0].str);
         printf("%s map <phys> <virt> <count> <flags>\n", argv[0].str);
         printf("%s unmap <virt> <count>\n", argv[0].str);
+        printf("%s compressed\n", argv[0].str);
         return ERR_INTERNAL;
     }
 
@@ -313,6 +315,13 @@ static int cmd_vm(int argc, const cmd_args* argv) {
 
         int err = arch_mmu_unmap(&aspace->arch_aspace(), argv[2].u, (uint)argv[3].u);
         printf("arch_mmu_unmap returns %d\n", err);
+    } else if (!strcmp(argv[1].str, "compressed")) {
+        size_t pages = VmCompressedPage::total_pages();
+        size_t bytes = VmCompressedPage::total_bytes();
+        printf("%zu pages compressed into %zu bytes", pages, bytes);
+        if (pages > 0)
+            printf(" (%zu%%)", bytes * 100 / (pages * PAGE_SIZE));
+        printf("\n");
     } else {
         printf("unknown command\n");
         goto usage;
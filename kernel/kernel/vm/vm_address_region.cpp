@@ -191,7 +191,7 @@ status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size, ui
 
     // Check that only allowed flags have been set
     if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE |
-                       VMAR_CAN_RWX_FLAGS)) {
+                       VMAR_FLAG_MAP_SEQUENTIAL | VMAR_CAN_RWX_FLAGS)) {
         return ERR_INVALID_ARGS;
     }
 
@@ -336,15 +336,27 @@ status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
     DEBUG_ASSERT(magic_ == kMagic);
     DEBUG_ASSERT(is_mutex_held(&aspace_->lock()));
 
+    mxtl::RefPtr<VmMapping> mapping = FindMappingLocked(va);
+    if (!mapping) {
+        return ERR_NOT_FOUND;
+    }
+
+    return mapping->PageFault(va, pf_flags);
+}
+
+mxtl::RefPtr<VmMapping> VmAddressRegion::FindMappingLocked(vaddr_t va) {
+    DEBUG_ASSERT(magic_ == kMagic);
+    DEBUG_ASSERT(is_mutex_held(&aspace_->lock()));
+
     mxtl::RefPtr<VmAddressRegion> vmar(this);
     while (1) {
         mxtl::RefPtr<VmAddressRegionOrMapping> next(vmar->FindRegionLocked(va));
         if (!next) {
-            return ERR_NOT_FOUND;
+            return nullptr;
         }
 
         if (next->is_mapping()) {
-            return next->PageFault(va, pf_flags);
+            return next->as_vm_mapping();
         }
 
         vmar = next->as_vm_address_region();
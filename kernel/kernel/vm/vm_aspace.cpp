@@ -229,6 +229,17 @@ status_t VmAspace::Destroy() {
     LTRACEF("%p '%s'\n", this, name_);
 
     AutoLock guard(lock_);
+
+    // clear the page tables in one pass, with a single round of tlb invalidation,
+    // rather than once per mapping as the regions go away.  from here on nothing
+    // can be mapped into them again, see ArchMap().
+    {
+        AutoLock a(pt_lock_);
+        if (!pt_destroyed_ && size_ > 0)
+            arch_mmu_unmap(&arch_aspace_, base_, size_ / PAGE_SIZE);
+        pt_destroyed_ = true;
+    }
+
     // tear down and free all of the regions in our address space
     status_t status = root_vmar_->DestroyLocked();
     if (status != NO_ERROR && status != ERR_BAD_STATE) {
@@ -349,7 +360,7 @@ status_t VmAspace::ReserveSpace(const char* name, size_t size, vaddr_t vaddr) {
 
     // lookup how it's already mapped
     uint arch_mmu_flags = 0;
-    auto err = arch_mmu_query(&arch_aspace_, vaddr, nullptr, &arch_mmu_flags);
+    auto err = ArchQuery(vaddr, nullptr, &arch_mmu_flags);
     if (err) {
         // if it wasn't already mapped, use some sort of strict default
         arch_mmu_flags = ARCH_MMU_FLAG_CACHED | ARCH_MMU_FLAG_PERM_READ;
@@ -503,12 +514,53 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(!aspace_destroyed_);
     LTRACEF("va %#" PRIxPTR ", flags %#x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(lock_);
+    // only hold the aspace lock long enough to find the mapping, and then fault
+    // under the lock of the object it maps.  anything that changes a mapping
+    // holds both, so faults on different objects in the same aspace can run
+    // concurrently with each other.  if the mapping changed in between, look
+    // it up again.
+    for (;;) {
+        mutex_acquire(&lock_);
+        mxtl::RefPtr<VmMapping> mapping = root_vmar_->FindMappingLocked(va);
+        if (!mapping) {
+            mutex_release(&lock_);
+            return ERR_NOT_FOUND;
+        }
+
+        mxtl::RefPtr<VmObject> vmo = mapping->vmo();
+        AutoLock al(vmo->lock());
+        mutex_release(&lock_);
+
+        if (mapping->CoversLocked(va))
+            return mapping->PageFaultLocked(va, flags);
+    }
+}
+
+int VmAspace::ArchMap(vaddr_t va, paddr_t pa, size_t count, uint mmu_flags) {
+    AutoLock a(pt_lock_);
+    // a fault that raced with Destroy() must not repopulate the page tables
+    if (pt_destroyed_)
+        return ERR_BAD_STATE;
+    return arch_mmu_map(&arch_aspace_, va, pa, count, mmu_flags);
+}
+
+int VmAspace::ArchUnmap(vaddr_t va, size_t count) {
+    AutoLock a(pt_lock_);
+    if (pt_destroyed_)
+        return NO_ERROR;
+    return arch_mmu_unmap(&arch_aspace_, va, count);
+}
+
+int VmAspace::ArchProtect(vaddr_t va, size_t count, uint mmu_flags) {
+    AutoLock a(pt_lock_);
+    if (pt_destroyed_)
+        return NO_ERROR;
+    return arch_mmu_protect(&arch_aspace_, va, count, mmu_flags);
+}
 
-    return root_vmar_->PageFault(va, flags);
+status_t VmAspace::ArchQuery(vaddr_t va, paddr_t* pa, uint* mmu_flags) {
+    AutoLock a(pt_lock_);
+    return arch_mmu_query(&arch_aspace_, va, pa, mmu_flags);
 }
 
 void VmAspace::Dump(bool verbose) const {
@@ -537,7 +589,7 @@ size_t VmAspace::AllocatedPages() const {
 }
 
 void VmAspace::InitializeAslr() {
-    crypto::GlobalPRNG::GetInstance()->Draw(aslr_seed_, sizeof(aslr_seed_));
+    crypto::GlobalPRNG::Draw(aslr_seed_, sizeof(aslr_seed_));
     aslr_prng_.AddEntropy(aslr_seed_, sizeof(aslr_seed_));
 }
 
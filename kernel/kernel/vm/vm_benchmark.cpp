@@ -0,0 +1,112 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/mmu.h>
+#include <err.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <stdlib.h>
+#include <unittest.h>
+
+static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
+
+static status_t bench_pmm_alloc_free(unittest_bench_state_t* state) {
+    unittest_bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_page(0, &pa);
+        if (!page) {
+            unittest_bench_stop(state);
+            return ERR_NO_MEMORY;
+        }
+        pmm_free_page(page);
+    }
+    unittest_bench_stop(state);
+    return NO_ERROR;
+}
+
+static status_t bench_malloc_free(unittest_bench_state_t* state) {
+    unittest_bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        void* p = malloc(64);
+        if (!p) {
+            unittest_bench_stop(state);
+            return ERR_NO_MEMORY;
+        }
+        // keeps the pair from being optimized away
+        __asm__ volatile("" :: "r"(p) : "memory");
+        free(p);
+    }
+    unittest_bench_stop(state);
+    return NO_ERROR;
+}
+
+// One iteration is the first touch of a page of an uncommitted mapping. The
+// mappings are made and freed outside of the timing, a chunk at a time.
+static status_t bench_page_fault(unittest_bench_state_t* state) {
+    static const uint64_t kChunkPages = 256;
+    VmAspace* ka = VmAspace::kernel_aspace();
+
+    for (uint64_t done = 0; done < state->iterations;) {
+        uint64_t pages = state->iterations - done;
+        if (pages > kChunkPages)
+            pages = kChunkPages;
+
+        void* ptr;
+        status_t status = ka->Alloc("bench fault", pages * PAGE_SIZE, &ptr, 0, 0, 0,
+                                    kArchRwFlags);
+        if (status != NO_ERROR)
+            return status;
+
+        volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+        unittest_bench_start(state);
+        for (uint64_t i = 0; i < pages; i++)
+            p[i * PAGE_SIZE] = 1;
+        unittest_bench_stop(state);
+
+        ka->FreeRegion(reinterpret_cast<vaddr_t>(ptr));
+        done += pages;
+    }
+    return NO_ERROR;
+}
+
+// One iteration is a change of the protection of a page of the kernel
+// aspace, which every cpu may have cached, so with more than one cpu each
+// is a shootdown.
+static status_t bench_tlb_shootdown(unittest_bench_state_t* state) {
+    VmAspace* ka = VmAspace::kernel_aspace();
+
+    void* ptr;
+    status_t status = ka->Alloc("bench shootdown", PAGE_SIZE, &ptr, 0, 0, VMM_FLAG_COMMIT,
+                                kArchRwFlags);
+    if (status != NO_ERROR)
+        return status;
+    vaddr_t va = reinterpret_cast<vaddr_t>(ptr);
+
+    unittest_bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        uint flags = (i & 1) ? kArchRwFlags : ARCH_MMU_FLAG_PERM_READ;
+        int ret = arch_mmu_protect(&ka->arch_aspace(), va, 1, flags);
+        if (ret < 0) {
+            unittest_bench_stop(state);
+            ka->FreeRegion(va);
+            return ret;
+        }
+    }
+    unittest_bench_stop(state);
+
+    // the region is freed with the protection it was made with
+    arch_mmu_protect(&ka->arch_aspace(), va, 1, kArchRwFlags);
+    ka->FreeRegion(va);
+    return NO_ERROR;
+}
+
+BENCHMARK_START_SUITE(vm_benchmarks)
+BENCHMARK("pmm alloc/free page", bench_pmm_alloc_free)
+BENCHMARK("malloc/free 64 bytes", bench_malloc_free)
+BENCHMARK("page fault", bench_page_fault)
+BENCHMARK("tlb shootdown", bench_tlb_shootdown)
+BENCHMARK_END_SUITE(vm_benchmarks, "vm", "Virtual memory benchmarks");
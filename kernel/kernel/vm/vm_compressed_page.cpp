@@ -0,0 +1,81 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/vm/vm_compressed_page.h>
+
+#include <assert.h>
+#include <kernel/auto_lock.h>
+#include <kernel/mutex.h>
+#include <kernel/vm.h>
+#include <lz4/lz4.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+// a page is only kept compressed if it shrinks to this or less, so that the
+// heap ends up holding at least two of them for every page freed
+constexpr int kMaxCompressedLen = PAGE_SIZE / 2;
+
+// LZ4's compression state is too big for a kernel stack, so there is one, used
+// under compress_lock. compression only happens on the pmm pressure thread, so
+// there is nothing to gain from more.
+Mutex compress_lock;
+uint64_t compress_state[16384 / sizeof(uint64_t)] TA_GUARDED(compress_lock);
+uint8_t compress_buffer[kMaxCompressedLen] TA_GUARDED(compress_lock);
+
+size_t compressed_bytes;
+size_t compressed_pages;
+
+} // namespace
+
+void* VmCompressedPage::operator new(size_t size, size_t data_len) noexcept {
+    return malloc(size + data_len);
+}
+
+void VmCompressedPage::operator delete(void* ptr) {
+    free(ptr);
+}
+
+mxtl::unique_ptr<VmCompressedPage> VmCompressedPage::Create(const void* page, uint64_t offset) {
+    AutoLock a(compress_lock);
+    DEBUG_ASSERT(static_cast<size_t>(LZ4_sizeofState()) <= sizeof(compress_state));
+
+    int len = LZ4_compress_fast_extState(compress_state, static_cast<const char*>(page),
+                                         reinterpret_cast<char*>(compress_buffer), PAGE_SIZE,
+                                         kMaxCompressedLen, 1);
+    if (len <= 0)
+        return nullptr;
+
+    auto cp = new (static_cast<size_t>(len)) VmCompressedPage(offset, static_cast<uint32_t>(len));
+    if (!cp)
+        return nullptr;
+    memcpy(cp->data_, compress_buffer, len);
+
+    __atomic_fetch_add(&compressed_bytes, len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&compressed_pages, 1, __ATOMIC_RELAXED);
+    return mxtl::unique_ptr<VmCompressedPage>(cp);
+}
+
+VmCompressedPage::~VmCompressedPage() {
+    __atomic_fetch_sub(&compressed_bytes, len_, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&compressed_pages, 1, __ATOMIC_RELAXED);
+}
+
+void VmCompressedPage::Decompress(void* page) const {
+    __UNUSED int len = LZ4_decompress_safe(reinterpret_cast<const char*>(data_),
+                                           static_cast<char*>(page), len_, PAGE_SIZE);
+    // the data never leaves the kernel, so can only be what Create() made
+    ASSERT(len == PAGE_SIZE);
+}
+
+size_t VmCompressedPage::total_bytes() {
+    return __atomic_load_n(&compressed_bytes, __ATOMIC_RELAXED);
+}
+
+size_t VmCompressedPage::total_pages() {
+    return __atomic_load_n(&compressed_pages, __ATOMIC_RELAXED);
+}
@@ -10,17 +10,53 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <lib/counters.h>
 #include <mxtl/auto_call.h>
 #include <mxtl/auto_lock.h>
+#include <lk/init.h>
 #include <new.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// how many already resident pages around a faulting page to map along with it,
+// split evenly either side of it, and how many to map ahead of it in
+// mappings hinted as sequential. set with vm.fault_around and
+// vm.fault_around_sequential on the kernel command line.
+#define DEFAULT_FAULT_AROUND_PAGES 16
+#define DEFAULT_FAULT_AROUND_SEQUENTIAL_PAGES 64
+
+KCOUNTER(fault_around_pages_mapped, "vm.fault_around_pages");
+
+namespace {
+
+uint32_t fault_around_pages = DEFAULT_FAULT_AROUND_PAGES;
+uint32_t fault_around_sequential_pages = DEFAULT_FAULT_AROUND_SEQUENTIAL_PAGES;
+
+void fault_around_init(uint level) {
+    fault_around_pages = cmdline_get_uint32("vm.fault_around", DEFAULT_FAULT_AROUND_PAGES);
+    fault_around_sequential_pages = cmdline_get_uint32("vm.fault_around_sequential",
+                                                       DEFAULT_FAULT_AROUND_SEQUENTIAL_PAGES);
+}
+
+// arm64 doesn't keep the instruction cache coherent with stores, so freshly
+// mapped code has to be cleaned out to where instruction fetches will see it.
+void SyncIfExecutable(vaddr_t va, size_t len, uint mmu_flags) {
+#if ARCH_ARM64
+    if (len > 0 && (mmu_flags & ARCH_MMU_FLAG_PERM_EXECUTE))
+        arch_sync_cache_range(va, len);
+#endif
+}
+
+} // namespace
+
+LK_INIT_HOOK(vm_fault_around, fault_around_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags,
                      const char* name)
@@ -80,6 +116,16 @@ status_t VmMapping::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flags)
 }
 
 
+// a copy-on-write clone may have pages it borrows from its parent mapped, which must
+// never become writable, so rather than granting write access to them in place drop
+// them and let them fault back in with the right permissions
+status_t VmMapping::ProtectOrUnmap(vaddr_t base, size_t size, uint new_arch_mmu_flags) {
+    if (object_->is_cow_clone() && (new_arch_mmu_flags & ARCH_MMU_FLAG_PERM_WRITE))
+        return aspace_->ArchUnmap(base, size / PAGE_SIZE);
+
+    return aspace_->ArchProtect(base, size / PAGE_SIZE, new_arch_mmu_flags);
+}
+
 status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_flags) {
     DEBUG_ASSERT(is_mutex_held(&aspace_->lock()));
     DEBUG_ASSERT(size != 0 && IS_PAGE_ALIGNED(base) && IS_PAGE_ALIGNED(size));
@@ -109,9 +155,8 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
 
     // If we're changing the whole mapping, just make the change.
     if (base_ == base && size_ == size) {
-        status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                           new_arch_mmu_flags);
-        LTRACEF("arch_mmu_protect returns %d\n", status);
+        status_t status = ProtectOrUnmap(base, size, new_arch_mmu_flags);
+        LTRACEF("ProtectOrUnmap returns %d\n", status);
         arch_mmu_flags_ = new_arch_mmu_flags;
         return NO_ERROR;
     }
@@ -127,9 +172,8 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
             return ERR_NO_MEMORY;
         }
 
-        status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                           new_arch_mmu_flags);
-        LTRACEF("arch_mmu_protect returns %d\n", status);
+        status_t status = ProtectOrUnmap(base, size, new_arch_mmu_flags);
+        LTRACEF("ProtectOrUnmap returns %d\n", status);
         arch_mmu_flags_ = new_arch_mmu_flags;
 
         size_ = size;
@@ -150,9 +194,8 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
             return ERR_NO_MEMORY;
         }
 
-        status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                           new_arch_mmu_flags);
-        LTRACEF("arch_mmu_protect returns %d\n", status);
+        status_t status = ProtectOrUnmap(base, size, new_arch_mmu_flags);
+        LTRACEF("ProtectOrUnmap returns %d\n", status);
 
         size_ -= size;
         mapping->ActivateLocked();
@@ -179,9 +222,8 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
         return ERR_NO_MEMORY;
     }
 
-    status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
-                                       new_arch_mmu_flags);
-    LTRACEF("arch_mmu_protect returns %d\n", status);
+    status_t status = ProtectOrUnmap(base, size, new_arch_mmu_flags);
+    LTRACEF("ProtectOrUnmap returns %d\n", status);
 
     // Turn us into the left half
     size_ = left_size;
@@ -245,7 +287,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 
     // Check if unmapping from one of the ends
     if (base_ == base || base + size == base_ + size_) {
-        status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE);
+        status_t status = aspace_->ArchUnmap(base, size / PAGE_SIZE);
         if (status < 0) {
             return status;
         }
@@ -279,7 +321,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     }
 
     // Unmap the middle segment
-    status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE);
+    status_t status = aspace_->ArchUnmap(base, size / PAGE_SIZE);
     if (status < 0) {
         return status;
     }
@@ -293,7 +335,8 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) {
     DEBUG_ASSERT(magic_ == kMagic);
 
-    AutoLock guard(aspace_->lock());
+    // the object's lock is enough to keep this mapping from changing underneath us,
+    // and the page table update is serialized by the aspace itself
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -328,8 +371,8 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) {
 
     LTRACEF("going to unmap %#" PRIxPTR ", len %#" PRIx64 "\n", unmap_base.ValueOrDie(), len_new);
 
-    status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), unmap_base.ValueOrDie(),
-                                     static_cast<size_t>(len_new));
+    status_t status = aspace_->ArchUnmap(unmap_base.ValueOrDie(),
+                                     static_cast<size_t>(len_new) / PAGE_SIZE);
     if (status < 0)
         return status;
 
@@ -354,7 +397,11 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     AutoLock al(object_->lock());
 
     // iterate through the range, grabbing a page from the underlying object and
-    // mapping it in
+    // mapping it in. physically contiguous pages are mapped as a single run so the
+    // arch layer can use large pages for whatever parts of it are suitably aligned.
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_len = 0;
     size_t o;
     for (o = offset; o < offset + len; o += PAGE_SIZE) {
         uint64_t vmo_offset = object_offset_ + o;
@@ -372,17 +419,110 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
-
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_);
-        if (ret < 0) {
-            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+        if (run_len > 0 && va == run_va + run_len && pa == run_pa + run_len) {
+            run_len += PAGE_SIZE;
+            continue;
         }
+
+        MapRun(run_va, run_pa, run_len);
+        run_va = va;
+        run_pa = pa;
+        run_len = PAGE_SIZE;
     }
+    MapRun(run_va, run_pa, run_len);
 
     return NO_ERROR;
 }
 
+void VmMapping::MapRun(vaddr_t va, paddr_t pa, size_t len) {
+    if (len == 0)
+        return;
+
+    LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR ", len %#zx\n", pa, va, len);
+
+    auto ret = aspace_->ArchMap(va, pa, len / PAGE_SIZE, arch_mmu_flags_);
+    if (ret < 0) {
+        TRACEF("error %d mapping run at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+    }
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va) {
+    DEBUG_ASSERT(object_->lock().IsHeld());
+
+    size_t behind, ahead;
+    if (flags_ & VMAR_FLAG_MAP_SEQUENTIAL) {
+        behind = 0;
+        ahead = fault_around_sequential_pages;
+    } else {
+        behind = fault_around_pages / 2;
+        ahead = fault_around_pages - behind;
+    }
+
+    // clip the window to the mapping
+    vaddr_t start = va - MIN(behind, (va - base_) / PAGE_SIZE) * PAGE_SIZE;
+    vaddr_t end = va + PAGE_SIZE + MIN(ahead, (base_ + size_ - va) / PAGE_SIZE - 1) * PAGE_SIZE;
+
+    // only map pages the object already has, which it would hand out with full
+    // permissions anyway, and not anything already mapped
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_len = 0;
+    auto flush_run = [&]() {
+        MapRun(run_va, run_pa, run_len);
+        SyncIfExecutable(run_va, run_len, arch_mmu_flags_);
+        kcounter_add(&fault_around_pages_mapped, run_len / PAGE_SIZE);
+    };
+    for (vaddr_t v = start; v < end; v += PAGE_SIZE) {
+        paddr_t pa, mapped_pa;
+        uint page_flags;
+        if (v == va ||
+            object_->GetPageLocked(v - base_ + object_offset_, &pa) < 0 ||
+            aspace_->ArchQuery(v, &mapped_pa, &page_flags) >= 0) {
+            continue;
+        }
+
+        if (run_len > 0 && v == run_va + run_len && pa == run_pa + run_len) {
+            run_len += PAGE_SIZE;
+            continue;
+        }
+
+        flush_run();
+        run_va = v;
+        run_pa = pa;
+        run_len = PAGE_SIZE;
+    }
+    flush_run();
+}
+
+// if the large page around va is wholly inside the mapping and backed by a physically
+// contiguous, suitably aligned run of the object, try to map all of it at once
+bool VmMapping::MapLargePageLocked(vaddr_t va, uint64_t vmo_offset, uint mmu_flags) {
+    DEBUG_ASSERT(object_->lock().IsHeld());
+
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    if (large_va < base_ || large_va + LARGE_PAGE_SIZE - 1 > base_ + size_ - 1)
+        return false;
+
+    const uint64_t large_offset = vmo_offset - (va - large_va);
+    paddr_t pa;
+    if (!object_->GetContiguousRunLocked(large_offset, LARGE_PAGE_SIZE, &pa))
+        return false;
+    if (!IS_ALIGNED(pa, LARGE_PAGE_SIZE))
+        return false;
+
+    // this fails if any of the range is already mapped, in which case the caller
+    // falls back to mapping a single page
+    auto ret = aspace_->ArchMap(large_va, pa, LARGE_PAGE_SIZE / PAGE_SIZE,
+                            mmu_flags);
+    if (ret < 0)
+        return false;
+
+    LTRACEF("mapped large page pa %#" PRIxPTR " at va %#" PRIxPTR "\n", pa, large_va);
+
+    SyncIfExecutable(large_va, LARGE_PAGE_SIZE, mmu_flags);
+    return true;
+}
+
 status_t VmMapping::DestroyLocked() {
     DEBUG_ASSERT(magic_ == kMagic);
     DEBUG_ASSERT(is_mutex_held(&aspace_->lock()));
@@ -401,6 +541,10 @@ status_t VmMapping::DestroyLocked() {
     {
         AutoLock al(object_->lock());
         object_->RemoveRegionLocked(this);
+
+        // a page fault may have looked us up before we took the aspace lock and
+        // be waiting for the object's lock, see CoversLocked()
+        state_ = LifeCycleState::DEAD;
     }
 
     // detach from any object we have mapped
@@ -413,14 +557,31 @@ status_t VmMapping::DestroyLocked() {
     }
 
     parent_ = nullptr;
-    state_ = LifeCycleState::DEAD;
     return NO_ERROR;
 }
 
+bool VmMapping::CoversLocked(vaddr_t va) const {
+    DEBUG_ASSERT(magic_ == kMagic);
+
+    if (state_ != LifeCycleState::ALIVE)
+        return false;
+
+    DEBUG_ASSERT(object_->lock().IsHeld());
+    return va >= base_ && va <= base_ + size_ - 1;
+}
+
 status_t VmMapping::PageFault(vaddr_t va, uint pf_flags) {
     DEBUG_ASSERT(magic_ == kMagic);
     DEBUG_ASSERT(is_mutex_held(&aspace_->lock()));
 
+    AutoLock al(object_->lock());
+    return PageFaultLocked(va, pf_flags);
+}
+
+status_t VmMapping::PageFaultLocked(vaddr_t va, uint pf_flags) {
+    DEBUG_ASSERT(magic_ == kMagic);
+    DEBUG_ASSERT(object_->lock().IsHeld());
+
     DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
 
     va = ROUNDDOWN(va, PAGE_SIZE);
@@ -454,9 +615,6 @@ status_t VmMapping::PageFault(vaddr_t va, uint pf_flags) {
         }
     }
 
-    // grab the lock for the vmo
-    AutoLock al(object_->lock());
-
     // fault in or grab an existing page
     paddr_t new_pa;
     auto status = object_->FaultPageLocked(vmo_offset, pf_flags, &new_pa);
@@ -466,52 +624,69 @@ status_t VmMapping::PageFault(vaddr_t va, uint pf_flags) {
         return status;
     }
 
+    // a read from a copy-on-write clone may have been handed a page borrowed from its
+    // parent, which has to be mapped read only so that a write faults and copies it
+    uint mmu_flags = arch_mmu_flags_;
+    if (!(pf_flags & VMM_PF_FLAG_WRITE) && object_->is_cow_clone()) {
+        paddr_t own_pa;
+        if (object_->GetPageLocked(vmo_offset, &own_pa) < 0 || own_pa != new_pa)
+            mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
+    }
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single
     // address
     uint page_flags;
     paddr_t pa;
-    status_t err = arch_mmu_query(&aspace_->arch_aspace(), va, &pa, &page_flags);
+    status_t err = aspace_->ArchQuery(va, &pa, &page_flags);
     if (err >= 0) {
         LTRACEF("queried va, page at pa %#" PRIxPTR ", flags %#x is already there\n", pa,
                 page_flags);
         if (pa == new_pa) {
             // page was already mapped, are the permissions compatible?
-            if (page_flags == arch_mmu_flags_)
+            if (page_flags == mmu_flags)
                 return NO_ERROR;
 
             // same page, different permission
-            auto ret = arch_mmu_protect(&aspace_->arch_aspace(), va, 1, arch_mmu_flags_);
+            auto ret = aspace_->ArchProtect(va, 1, mmu_flags);
             if (ret < 0) {
                 TRACEF("failed to modify permissions on existing mapping\n");
                 return ERR_NO_MEMORY;
             }
         } else {
-            // some other page is mapped there already
-            // currently this is an error situation, since there's no way for this to
-            // have
-            // happened, but in the future this will be a path for copy-on-write.
-            // TODO: implement
-            printf("KERN: thread %s faulted on va %#" PRIxPTR
-                   ", different page was present, unhandled\n",
-                   get_current_thread()->name, va);
-            return ERR_NOT_SUPPORTED;
+            // some other page is mapped there already, which happens when a
+            // copy-on-write clone replaces a page borrowed from its parent.
+            // swap in the new page.
+            LTRACEF("replacing pa %#" PRIxPTR " with %#" PRIxPTR " at va %#" PRIxPTR "\n", pa,
+                    new_pa, va);
+            auto ret = aspace_->ArchUnmap(va, 1);
+            if (ret < 0) {
+                TRACEF("failed to unmap existing page\n");
+                return ERR_NO_MEMORY;
+            }
+            ret = aspace_->ArchMap(va, new_pa, 1, mmu_flags);
+            if (ret < 0) {
+                TRACEF("failed to map page\n");
+                return ERR_NO_MEMORY;
+            }
         }
     } else {
-        // nothing was mapped there before, map it now
+        // nothing was mapped there before. map the whole large page around it if we
+        // can, and the single page otherwise.
+        if (mmu_flags == arch_mmu_flags_ && MapLargePageLocked(va, vmo_offset, mmu_flags))
+            return NO_ERROR;
+
         LTRACEF("mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", new_pa, va);
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, new_pa, 1, arch_mmu_flags_);
+        auto ret = aspace_->ArchMap(va, new_pa, 1, mmu_flags);
         if (ret < 0) {
             TRACEF("failed to map page\n");
             return ERR_NO_MEMORY;
         }
+
+        FaultAroundLocked(va);
     }
 
-// TODO: figure out what to do with this
-#if ARCH_ARM64
-    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
-        arch_sync_cache_range(va, PAGE_SIZE);
-#endif
+    SyncIfExecutable(va, PAGE_SIZE, arch_mmu_flags_);
     return NO_ERROR;
 }
 
@@ -14,6 +14,7 @@
 #include <kernel/auto_lock.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
 #include <lib/console.h>
 #include <lib/user_copy.h>
 #include <new.h>
@@ -23,14 +24,24 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
-VmObject::VmObject() {
+VmObject::VmObject()
+    : lock_(local_lock_) {
     LTRACEF("%p\n", this);
 }
 
+VmObject::VmObject(VmObject& parent)
+    : lock_(parent.lock_) {
+    LTRACEF("%p, parent %p\n", this, &parent);
+}
+
 VmObject::~VmObject() {
     LTRACEF("%p\n", this);
     DEBUG_ASSERT(region_list_.is_empty());
 
+    // subclasses free their pages without recounting them
+    if (commit_charge_)
+        commit_charge_->Add(-static_cast<ssize_t>(counted_pages_));
+
     // clear our magic value
     magic_ = 0;
 }
@@ -39,12 +50,185 @@ void VmObject::AddRegionLocked(VmMapping* r) {
     DEBUG_ASSERT(lock_.IsHeld());
 
     region_list_.push_front(r);
+
+    // the pages are already counted if the aspace maps us elsewhere
+    VmAspace* aspace = r->aspace_.get();
+    for (const auto& m : region_list_) {
+        if (m.counts_pages_ && m.aspace_.get() == aspace)
+            return;
+    }
+
+    r->counts_pages_ = true;
+    const ssize_t pages = static_cast<ssize_t>(counted_pages_);
+    if (++mapped_aspaces_ == 1) {
+        aspace->page_counters().Add(pages, 0);
+        return;
+    }
+
+    // mapped into a second aspace, what was private to the first is shared now
+    if (mapped_aspaces_ == 2) {
+        for (auto& m : region_list_) {
+            if (m.counts_pages_ && &m != r)
+                m.aspace_->page_counters().Add(-pages, pages);
+        }
+    }
+    aspace->page_counters().Add(0, pages);
 }
 
 void VmObject::RemoveRegionLocked(VmMapping* r) {
     DEBUG_ASSERT(lock_.IsHeld());
 
     region_list_.erase(*r);
+
+    if (!r->counts_pages_)
+        return;
+    r->counts_pages_ = false;
+
+    // hand the counting over to another mapping in the same aspace, if there is one
+    VmAspace* aspace = r->aspace_.get();
+    for (auto& m : region_list_) {
+        if (m.aspace_.get() == aspace) {
+            m.counts_pages_ = true;
+            return;
+        }
+    }
+
+    const ssize_t pages = static_cast<ssize_t>(counted_pages_);
+    if (mapped_aspaces_-- == 1) {
+        aspace->page_counters().Add(-pages, 0);
+        return;
+    }
+    aspace->page_counters().Add(0, -pages);
+
+    // down to a single aspace, which has it all to itself again
+    if (mapped_aspaces_ == 1) {
+        for (auto& m : region_list_) {
+            if (m.counts_pages_)
+                m.aspace_->page_counters().Add(pages, -pages);
+        }
+    }
+}
+
+void VmObject::UpdatePageCountLocked(size_t pages) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    const ssize_t delta = static_cast<ssize_t>(pages - counted_pages_);
+    if (delta == 0)
+        return;
+    counted_pages_ = pages;
+
+    if (commit_charge_)
+        commit_charge_->Add(delta);
+
+    const bool shared = mapped_aspaces_ > 1;
+    for (auto& m : region_list_) {
+        if (m.counts_pages_)
+            m.aspace_->page_counters().Add(shared ? 0 : delta, shared ? delta : 0);
+    }
+}
+
+void VmObject::SetCommitCharge(mxtl::RefPtr<VmCommitCharge> charge) {
+    AutoLock a(lock_);
+
+    if (commit_charge_)
+        commit_charge_->Add(-static_cast<ssize_t>(counted_pages_));
+    commit_charge_ = mxtl::move(charge);
+    if (commit_charge_)
+        commit_charge_->Add(counted_pages_);
+}
+
+VmCommitCharge::~VmCommitCharge() {
+    // every object charged to us holds a reference
+    DEBUG_ASSERT(committed_pages() == 0);
+}
+
+bool VmCommitCharge::CanCommit(size_t pages) {
+    for (VmCommitCharge* c = this; c; c = c->parent_.get()) {
+        const size_t hard = __atomic_load_n(&c->hard_limit_, __ATOMIC_RELAXED);
+        if (hard == 0 || c->committed_pages() + pages <= hard)
+            continue;
+
+        if (!__atomic_exchange_n(&c->hard_hit_, true, __ATOMIC_RELAXED))
+            c->Notify();
+        return false;
+    }
+    return true;
+}
+
+void VmCommitCharge::Add(ssize_t delta) {
+    for (VmCommitCharge* c = this; c; c = c->parent_.get()) {
+        const size_t before = __atomic_fetch_add(&c->committed_, delta, __ATOMIC_RELAXED);
+        const size_t after = before + delta;
+
+        // only going over or back under a limit is worth the observer's lock
+        const size_t soft = __atomic_load_n(&c->soft_limit_, __ATOMIC_RELAXED);
+        const size_t hard = __atomic_load_n(&c->hard_limit_, __ATOMIC_RELAXED);
+        const size_t reset = soft ? soft : hard;
+        bool changed = soft != 0 && ((before > soft) != (after > soft));
+        if (after <= reset && __atomic_load_n(&c->hard_hit_, __ATOMIC_RELAXED))
+            changed |= __atomic_exchange_n(&c->hard_hit_, false, __ATOMIC_RELAXED);
+        if (changed)
+            c->Notify();
+    }
+}
+
+status_t VmCommitCharge::SetLimits(size_t soft_pages, size_t hard_pages, bool tighten_only) {
+    if (hard_pages != 0 && soft_pages > hard_pages)
+        return ERR_INVALID_ARGS;
+
+    AutoLock a(limits_lock_);
+    if (tighten_only) {
+        auto looser = [](size_t now, size_t next) { return now != 0 && (next == 0 || next > now); };
+        if (looser(__atomic_load_n(&soft_limit_, __ATOMIC_RELAXED), soft_pages) ||
+            looser(__atomic_load_n(&hard_limit_, __ATOMIC_RELAXED), hard_pages))
+            return ERR_ACCESS_DENIED;
+    }
+
+    __atomic_store_n(&soft_limit_, soft_pages, __ATOMIC_RELAXED);
+    __atomic_store_n(&hard_limit_, hard_pages, __ATOMIC_RELAXED);
+    if (hard_pages == 0 || committed_pages() <= (soft_pages ? soft_pages : hard_pages))
+        __atomic_store_n(&hard_hit_, false, __ATOMIC_RELAXED);
+    Notify();
+    return NO_ERROR;
+}
+
+void VmCommitCharge::set_observer(Observer* observer) {
+    {
+        AutoLock a(observer_lock_);
+        observer_ = observer;
+    }
+    if (observer)
+        Notify();
+}
+
+void VmCommitCharge::Notify() {
+    // work out the state under the lock, so that racing notifications can't leave
+    // the observer with an older one
+    AutoLock a(observer_lock_);
+    if (!observer_)
+        return;
+
+    const size_t soft = __atomic_load_n(&soft_limit_, __ATOMIC_RELAXED);
+    observer_->OnCommitLimitChange(soft != 0 && committed_pages() > soft,
+                                   __atomic_load_n(&hard_hit_, __ATOMIC_RELAXED));
+}
+
+bool VmObject::GetContiguousRunLocked(uint64_t offset, uint64_t len, paddr_t* pa) {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len) && len > 0);
+
+    paddr_t base;
+    if (GetPageLocked(offset, &base) < 0)
+        return false;
+
+    for (uint64_t o = PAGE_SIZE; o < len; o += PAGE_SIZE) {
+        paddr_t next;
+        if (GetPageLocked(offset + o, &next) < 0 || next != base + o)
+            return false;
+    }
+
+    *pa = base;
+    return true;
 }
 
 static int cmd_vm_object(int argc, const cmd_args* argv) {
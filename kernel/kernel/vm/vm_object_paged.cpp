@@ -38,30 +38,89 @@ void ZeroPage(vm_page_t* p) {
     ZeroPage(pa);
 }
 
+// objects created with CREATE_OPT_DISCARDABLE, in the order they'll next be discarded
+Mutex discardable_lock;
+mxtl::DoublyLinkedList<VmObjectPaged*, VmObjectPaged::DiscardableListTraits>
+    discardable_list TA_GUARDED(discardable_lock);
+
+// objects created with CREATE_OPT_COMPRESSIBLE, in the order they'll next be aged
+Mutex compressible_lock;
+mxtl::DoublyLinkedList<VmObjectPaged*, VmObjectPaged::CompressibleListTraits>
+    compressible_list TA_GUARDED(compressible_lock);
+
+// pages compressed by an aging pass, or taken out by a move, before the page
+// list is walked again
+constexpr size_t kCompressBatch = 64;
+
 } // namespace
 
-VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags)
-    : pmm_alloc_flags_(pmm_alloc_flags) {
+VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, uint32_t options)
+    : pmm_alloc_flags_(pmm_alloc_flags), options_(options) {
     LTRACEF("%p\n", this);
 }
 
+VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObjectPaged> parent,
+                             uint64_t parent_offset)
+    : VmObject(*parent), pmm_alloc_flags_(pmm_alloc_flags), parent_(mxtl::move(parent)),
+      parent_offset_(parent_offset) {
+    LTRACEF("%p, parent %p offset %#" PRIx64 "\n", this, parent_.get(), parent_offset_);
+}
+
 VmObjectPaged::~VmObjectPaged() {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p\n", this);
 
+    if (options_ & CREATE_OPT_DISCARDABLE) {
+        AutoLock a(discardable_lock);
+        if (DiscardableListTraits::node_state(*this).InContainer())
+            discardable_list.erase(*this);
+    }
+
+    if (options_ & CREATE_OPT_COMPRESSIBLE) {
+        AutoLock a(compressible_lock);
+        if (CompressibleListTraits::node_state(*this).InContainer())
+            compressible_list.erase(*this);
+    }
+
+    {
+        AutoLock a(lock_);
+
+        // every clone holds a reference to us, so none can be left
+        DEBUG_ASSERT(children_list_.is_empty());
+
+        if (parent_)
+            parent_->children_list_.erase(*this);
+
+        compressed_.clear();
+    }
+
     // free all of the pages attached to us
     page_list_.FreeAllPages();
 }
 
-mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size) {
+mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                             uint32_t options) {
     // there's a max size to keep indexes within range
     if (size > MAX_SIZE)
         return nullptr;
 
+    if (options & ~(CREATE_OPT_LARGE_PAGES | CREATE_OPT_DISCARDABLE | CREATE_OPT_NUMA_INTERLEAVE |
+                    CREATE_OPT_COMPRESSIBLE))
+        return nullptr;
+
+    // discardable pages are dropped rather than compressed
+    if ((options & CREATE_OPT_DISCARDABLE) && (options & CREATE_OPT_COMPRESSIBLE))
+        return nullptr;
+
+    // interleaving and a node to allocate from are mutually exclusive
+    if ((options & CREATE_OPT_NUMA_INTERLEAVE) && (pmm_alloc_flags & PMM_ALLOC_FLAG_NODE_VALID))
+        return nullptr;
+
     AllocChecker ac;
-    auto vmo = mxtl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags));
+    auto paged = new (&ac) VmObjectPaged(pmm_alloc_flags, options);
     if (!ac.check())
         return nullptr;
+    auto vmo = mxtl::AdoptRef<VmObject>(paged);
 
     auto err = vmo->Resize(size);
     if (err == ERR_NO_MEMORY)
@@ -71,9 +130,240 @@ mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t
     if (err != NO_ERROR)
         return nullptr;
 
+    if (options & CREATE_OPT_DISCARDABLE) {
+        AutoLock a(discardable_lock);
+        discardable_list.push_back(paged);
+    }
+
+    if (options & CREATE_OPT_COMPRESSIBLE) {
+        AutoLock a(compressible_lock);
+        compressible_list.push_back(paged);
+    }
+
     return vmo;
 }
 
+size_t VmObjectPaged::DiscardPages(size_t count) {
+    LTRACEF("count %zu\n", count);
+
+    // visit each object at most once, moving it to the back of the list so the
+    // next call starts with the ones that have gone longest without losing pages.
+    // discardable_lock is only held to pick the next object: unmapping its pages
+    // takes aspace locks, under which the last reference to another object may be
+    // dropped and its destructor take discardable_lock.
+    size_t discarded = 0;
+    size_t n;
+    {
+        AutoLock a(discardable_lock);
+        n = discardable_list.size_slow();
+    }
+    for (; n > 0 && discarded < count; n--) {
+        mxtl::RefPtr<VmObjectPaged> vmo;
+        {
+            AutoLock a(discardable_lock);
+            if (discardable_list.is_empty())
+                break;
+            VmObjectPaged* raw = discardable_list.pop_front();
+            discardable_list.push_back(raw);
+
+            // one being destroyed is still on the list until its destructor gets
+            // discardable_lock, so the raw pointer is valid here but may not upgrade
+            vmo = mxtl::MakeRefPtrUpgradeFromRaw(raw);
+            if (!vmo)
+                continue;
+        }
+
+        AutoLock al(vmo->lock_);
+
+        // clones may be reading the pages through it, and devices through pins
+        if (!vmo->children_list_.is_empty() || vmo->pin_count_ > 0 ||
+            vmo->page_list_.page_count() == 0)
+            continue;
+
+        vmo->RangeChangeUpdateLocked(0, vmo->size_);
+        discarded += vmo->page_list_.FreeAllPages();
+        vmo->UpdatePageCountLocked(0);
+    }
+
+    LTRACEF("discarded %zu pages\n", discarded);
+    return discarded;
+}
+
+size_t VmObjectPaged::CompressPages(size_t count) {
+    LTRACEF("count %zu\n", count);
+
+    // visit objects round robin, the same way DiscardPages() does, and for the
+    // same reason only hold compressible_lock while picking the next one
+    size_t freed = 0;
+    size_t n;
+    {
+        AutoLock a(compressible_lock);
+        n = compressible_list.size_slow();
+    }
+    for (; n > 0 && freed < count; n--) {
+        mxtl::RefPtr<VmObjectPaged> vmo;
+        {
+            AutoLock a(compressible_lock);
+            if (compressible_list.is_empty())
+                break;
+            VmObjectPaged* raw = compressible_list.pop_front();
+            compressible_list.push_back(raw);
+            vmo = mxtl::MakeRefPtrUpgradeFromRaw(raw);
+            if (!vmo)
+                continue;
+        }
+
+        AutoLock al(vmo->lock_);
+
+        // clones read their parent's pages straight from its page list, and devices
+        // may be using the pages of pinned objects and of ones they were looked up in
+        if (!vmo->children_list_.is_empty() || vmo->pin_count_ > 0 ||
+            vmo->compression_disabled_ || vmo->page_list_.page_count() == 0)
+            continue;
+
+        freed += vmo->AgePagesLocked();
+    }
+
+    LTRACEF("freed %zu pages, %zu compressed into %zu bytes\n", freed,
+            VmCompressedPage::total_pages(), VmCompressedPage::total_bytes());
+    return freed;
+}
+
+size_t VmObjectPaged::AgePagesLocked() {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // unmap everything, so the pages touched from here to the next pass fault and
+    // lose their mark. pages still marked from the last pass went untouched since.
+    RangeChangeUpdateLocked(0, ROUNDUP_PAGE_SIZE(size_));
+
+    size_t freed = 0;
+    uint64_t next = 0;
+    for (;;) {
+        uint64_t offsets[kCompressBatch];
+        size_t batch = 0;
+        page_list_.ForEveryPageInRange([&](vm_page*& p, uint64_t offset) {
+            if (batch == kCompressBatch)
+                return;
+            next = offset + PAGE_SIZE;
+            if (!(p->flags & VM_PAGE_FLAG_AGED)) {
+                p->flags |= VM_PAGE_FLAG_AGED;
+                return;
+            }
+            auto cp = VmCompressedPage::Create(paddr_to_kvaddr(vm_page_to_paddr(p)), offset);
+            if (!cp)
+                return;
+            compressed_.insert(mxtl::move(cp));
+            offsets[batch++] = offset;
+        }, next, UINT64_MAX);
+
+        for (size_t i = 0; i < batch; i++)
+            page_list_.FreePage(offsets[i]);
+        freed += batch;
+
+        if (batch < kCompressBatch)
+            break;
+    }
+
+    if (freed > 0)
+        UpdatePageCountLocked(page_list_.page_count());
+    return freed;
+}
+
+status_t VmObjectPaged::DecompressPageLocked(uint64_t offset, vm_page_t** page) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    offset = ROUNDDOWN(offset, PAGE_SIZE);
+    auto iter = compressed_.find(offset);
+    if (!iter.IsValid())
+        return ERR_NOT_FOUND;
+
+    // compressing the page dropped it from the charge, so bringing it back is a
+    // commit like any other, and may be refused by the limits
+    if (!CanCommitLocked(1))
+        return ERR_NO_MEMORY;
+
+    paddr_t pa;
+    vm_page_t* p = pmm_alloc_page(AllocFlagsForOffset(offset) | PMM_ALLOC_FLAG_KMAP, &pa);
+    if (!p)
+        return ERR_NO_MEMORY;
+
+    iter->Decompress(paddr_to_kvaddr(pa));
+    compressed_.erase(iter);
+
+    p->state = VM_PAGE_STATE_OBJECT;
+    p->flags = 0;
+
+    __UNUSED auto status = page_list_.AddPage(p, offset);
+    DEBUG_ASSERT(status == NO_ERROR);
+    UpdatePageCountLocked(page_list_.page_count());
+
+    *page = p;
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::DecompressRangeLocked(uint64_t start, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (;;) {
+        auto iter = compressed_.lower_bound(start);
+        if (!iter.IsValid() || iter->GetKey() >= end)
+            return NO_ERROR;
+
+        vm_page_t* p;
+        status_t status = DecompressPageLocked(iter->GetKey(), &p);
+        if (status != NO_ERROR)
+            return status;
+    }
+}
+
+void VmObjectPaged::DropCompressedLocked(uint64_t start, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (;;) {
+        auto iter = compressed_.lower_bound(start);
+        if (!iter.IsValid() || iter->GetKey() >= end)
+            return;
+        compressed_.erase(iter);
+    }
+}
+
+status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, mxtl::RefPtr<VmObject>* clone_vmo) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("vmo %p offset %#" PRIx64 " size %#" PRIx64 "\n", this, offset, size);
+
+    if (!IS_PAGE_ALIGNED(offset))
+        return ERR_INVALID_ARGS;
+
+    // there's a max size to keep indexes within range
+    if (size > MAX_SIZE)
+        return ERR_OUT_OF_RANGE;
+
+    AllocChecker ac;
+    auto vmo = mxtl::AdoptRef<VmObjectPaged>(
+        new (&ac) VmObjectPaged(pmm_alloc_flags_, mxtl::RefPtr<VmObjectPaged>(this), offset));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    {
+        // the clone shares our lock, so set its size directly rather than through Resize()
+        AutoLock a(lock_);
+
+        vmo->size_ = size;
+        children_list_.push_front(vmo.get());
+
+        // the clone reads our pages straight from the page list, and with a clone
+        // we won't be compressing any more of them. on failure the clone goes away
+        // again once the lock is dropped.
+        status_t status = DecompressRangeLocked(0, UINT64_MAX);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    *clone_vmo = mxtl::move(vmo);
+
+    return NO_ERROR;
+}
+
 void VmObjectPaged::Dump(uint depth, bool verbose) {
     if (magic_ != MAGIC) {
         printf("VmObjectPaged at %p has bad magic\n", this);
@@ -82,13 +372,15 @@ void VmObjectPaged::Dump(uint depth, bool verbose) {
 
     AutoLock a(lock_);
 
-    size_t count = 0;
-    page_list_.ForEveryPage([&count](const auto p, uint64_t) { count++; });
+    size_t count = page_list_.page_count();
 
     for (uint i = 0; i < depth; ++i) {
         printf("  ");
     }
-    printf("object %p size %#" PRIx64 " pages %zu ref %d\n", this, size_, count, ref_count_debug());
+    printf("object %p size %#" PRIx64 " pages %zu ref %d", this, size_, count, ref_count_debug());
+    if (parent_)
+        printf(" parent %p offset %#" PRIx64, parent_.get(), parent_offset_);
+    printf("\n");
 
     if (verbose) {
         auto f = [depth](const auto p, uint64_t offset) {
@@ -104,9 +396,7 @@ void VmObjectPaged::Dump(uint depth, bool verbose) {
 size_t VmObjectPaged::AllocatedPages() const {
     DEBUG_ASSERT(magic_ == MAGIC);
     AutoLock a(lock_);
-    size_t count = 0;
-    page_list_.ForEveryPage([&count](const auto p, uint64_t) { count++; });
-    return count;
+    return page_list_.page_count();
 }
 
 status_t VmObjectPaged::AddPage(vm_page_t* p, uint64_t offset) {
@@ -120,7 +410,18 @@ status_t VmObjectPaged::AddPage(vm_page_t* p, uint64_t offset) {
     if (offset >= size_)
         return ERR_OUT_OF_RANGE;
 
-    return page_list_.AddPage(p, offset);
+    status_t status = page_list_.AddPage(p, offset);
+    UpdatePageCountLocked(page_list_.page_count());
+    return status;
+}
+
+uint32_t VmObjectPaged::AllocFlagsForOffset(uint64_t offset) const {
+    if (!interleaved())
+        return pmm_alloc_flags_;
+
+    // keep large page runs in one piece on their node
+    uint shift = (options_ & CREATE_OPT_LARGE_PAGES) ? LARGE_PAGE_SIZE_SHIFT : PAGE_SIZE_SHIFT;
+    return pmm_alloc_flags_ | PMM_ALLOC_FLAG_NODE((offset >> shift) % pmm_numa_node_count());
 }
 
 mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t size) {
@@ -192,28 +493,168 @@ vm_page_t* VmObjectPaged::FaultPageLocked(uint64_t offset, uint pf_flags) {
         return nullptr;
 
     vm_page_t* p = page_list_.GetPage(offset);
-    if (p)
+    if (p) {
+        // touched since the last aging pass
+        p->flags &= (uint8_t)~VM_PAGE_FLAG_AGED;
         return p;
+    }
+
+    if (!compressed_.is_empty()) {
+        status_t status = DecompressPageLocked(offset, &p);
+        if (status == NO_ERROR)
+            return p;
+        if (status != ERR_NOT_FOUND)
+            return nullptr;
+    }
 
-    // allocate a page
     paddr_t pa;
-    p = pmm_alloc_page(pmm_alloc_flags_, &pa);
-    if (!p)
-        return nullptr;
+    vm_page_t* parent_page = GetParentPageLocked(offset);
+    if (parent_page) {
+        // reads can be satisfied by the parent's page until we first write to it
+        if (!(pf_flags & VMM_PF_FLAG_WRITE))
+            return parent_page;
 
-    p->state = VM_PAGE_STATE_OBJECT;
+        if (!CanCommitLocked(1))
+            return nullptr;
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
+        // allocate a page and copy the parent's contents into it
+        p = pmm_alloc_page(AllocFlagsForOffset(offset) | PMM_ALLOC_FLAG_KMAP, &pa);
+        if (!p)
+            return nullptr;
+
+        arch_copy_page(paddr_to_kvaddr(pa), paddr_to_kvaddr(vm_page_to_paddr(parent_page)));
+    } else {
+        if (options_ & CREATE_OPT_LARGE_PAGES) {
+            p = FaultLargePageLocked(offset);
+            if (p)
+                return p;
+        }
+
+        if (!CanCommitLocked(1))
+            return nullptr;
+
+        // allocate a page, ideally one zeroed ahead of time
+        p = pmm_alloc_page(AllocFlagsForOffset(offset) | PMM_ALLOC_FLAG_ZEROED, &pa);
+        if (!p)
+            return nullptr;
+    }
+
+    p->state = VM_PAGE_STATE_OBJECT;
+    p->flags = 0;
 
     __UNUSED auto status = page_list_.AddPage(p, offset);
     DEBUG_ASSERT(status == NO_ERROR);
+    UpdatePageCountLocked(page_list_.page_count());
 
     LTRACEF("faulted in page %p, pa %#" PRIxPTR "\n", p, pa);
 
+    // anything that had the parent's page mapped read only must fault again to see ours
+    if (parent_page)
+        RangeChangeUpdateLocked(ROUNDDOWN(offset, PAGE_SIZE), PAGE_SIZE);
+
     return p;
 }
 
+vm_page_t* VmObjectPaged::FaultLargePageLocked(uint64_t offset) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // a clone's untouched pages read through to its parent, they can't be zero filled
+    if (parent_)
+        return nullptr;
+
+    const uint64_t start = ROUNDDOWN(offset, LARGE_PAGE_SIZE);
+    const uint64_t end = start + LARGE_PAGE_SIZE;
+    if (end > size_)
+        return nullptr;
+
+    // only take over a run none of which is committed yet
+    bool empty = true;
+    page_list_.ForEveryPageInRange([&empty](const auto p, uint64_t) { empty = false; }, start, end);
+    if (!empty)
+        return nullptr;
+
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    if (!CanCommitLocked(count))
+        return nullptr;
+
+    list_node page_list;
+    list_initialize(&page_list);
+
+    size_t allocated = pmm_alloc_contiguous(count, AllocFlagsForOffset(start) | PMM_ALLOC_FLAG_KMAP,
+                                            LARGE_PAGE_SIZE_SHIFT, nullptr, &page_list);
+    if (allocated < count) {
+        LTRACEF("failed to allocate a large page run (got %zu pages)\n", allocated);
+        pmm_free(&page_list);
+        return nullptr;
+    }
+
+    for (uint64_t o = start; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, free.node);
+        ASSERT(p);
+
+        p->state = VM_PAGE_STATE_OBJECT;
+        p->flags = 0;
+
+        ZeroPage(p);
+
+        __UNUSED auto status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == NO_ERROR);
+    }
+    UpdatePageCountLocked(page_list_.page_count());
+
+    LTRACEF("faulted in large page run at offset %#" PRIx64 "\n", start);
+
+    return page_list_.GetPage(offset);
+}
+
+vm_page_t* VmObjectPaged::GetParentPageLocked(uint64_t offset) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // walk up the clone chain looking for the nearest ancestor with a page at offset
+    for (VmObjectPaged* vmo = this; vmo->parent_; ) {
+        offset += vmo->parent_offset_;
+        vmo = vmo->parent_.get();
+
+        if (offset >= vmo->size_)
+            return nullptr;
+
+        vm_page_t* p = vmo->page_list_.GetPage(offset);
+        if (p)
+            return p;
+    }
+
+    return nullptr;
+}
+
+void VmObjectPaged::RangeChangeUpdateLocked(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    // unmap all of the pages in this range on all the mapping regions
+    for (auto& r : region_list_) {
+        // unmap any pages the region may have mapped that intersect this range
+        r.UnmapVmoRangeLocked(offset, len);
+    }
+
+    // clones may have our pages mapped as well, in their own offsets
+    for (auto& child : children_list_) {
+        if (offset + len <= child.parent_offset_)
+            continue;
+
+        uint64_t child_offset = 0;
+        uint64_t child_len = offset + len - child.parent_offset_;
+        if (offset > child.parent_offset_) {
+            child_offset = offset - child.parent_offset_;
+            child_len = len;
+        }
+
+        if (!TrimRange(child_offset, child_len, ROUNDUP_PAGE_SIZE(child.size_)) || child_len == 0)
+            continue;
+
+        child.RangeChangeUpdateLocked(child_offset, child_len);
+    }
+}
+
 status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
@@ -235,20 +676,54 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     uint64_t end = ROUNDUP_PAGE_SIZE(offset + len);
     DEBUG_ASSERT(end > offset);
 
-    // make a pass through the list, counting the number of pages we need to allocate
-    size_t count = 0;
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        if (!page_list_.GetPage(o))
-            count++;
+    // commit any untouched large page runs wholly inside the range as contiguous runs first
+    uint64_t large_committed = 0;
+    if (options_ & CREATE_OPT_LARGE_PAGES) {
+        for (uint64_t o = ROUNDUP(offset, LARGE_PAGE_SIZE); o + LARGE_PAGE_SIZE <= end;
+             o += LARGE_PAGE_SIZE) {
+            if (FaultLargePageLocked(o))
+                large_committed += LARGE_PAGE_SIZE;
+        }
+        if (committed)
+            *committed = large_committed;
     }
+
+    // compressed pages are committed, but have to be brought back to count as present
+    if (!compressed_.is_empty()) {
+        status_t status = DecompressRangeLocked(ROUNDDOWN(offset, PAGE_SIZE), end);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    // count the pages already present in the range to find how many we need to allocate
+    size_t count = (end - ROUNDDOWN(offset, PAGE_SIZE)) / PAGE_SIZE;
+    page_list_.ForEveryPageInRange([&count](const auto p, uint64_t) { count--; },
+                                   ROUNDDOWN(offset, PAGE_SIZE), end);
     if (count == 0)
         return NO_ERROR;
 
+    if (!CanCommitLocked(count))
+        return ERR_NO_MEMORY;
+
     // allocate count number of pages
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    size_t allocated = 0;
+    if (interleaved()) {
+        // every page may come from a different node, so allocate them one at a time
+        for (uint64_t o = ROUNDDOWN(offset, PAGE_SIZE); o < end && allocated < count; o += PAGE_SIZE) {
+            if (page_list_.GetPage(o))
+                continue;
+            vm_page_t* p = pmm_alloc_page(AllocFlagsForOffset(o) | PMM_ALLOC_FLAG_ZEROED, nullptr);
+            if (!p)
+                break;
+            list_add_tail(&page_list, &p->free.node);
+            allocated++;
+        }
+    } else {
+        allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &page_list);
+    }
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -265,9 +740,16 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
         ASSERT(p);
 
         p->state = VM_PAGE_STATE_OBJECT;
-
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
+        p->flags = 0;
+
+        // a clone commits a copy of what it was reading from its parent, and
+        // whatever had the parent's page mapped has to fault again to see it
+        vm_page_t* parent_page = GetParentPageLocked(o);
+        if (parent_page) {
+            arch_copy_page(paddr_to_kvaddr(vm_page_to_paddr(p)),
+                           paddr_to_kvaddr(vm_page_to_paddr(parent_page)));
+            RangeChangeUpdateLocked(ROUNDDOWN(o, PAGE_SIZE), PAGE_SIZE);
+        }
 
         __UNUSED auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
@@ -277,9 +759,10 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     }
 
     DEBUG_ASSERT(list_is_empty(&page_list));
+    UpdatePageCountLocked(page_list_.page_count());
 
     // for now we only support committing as much as we were asked for
-    DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
+    DEBUG_ASSERT(!committed || *committed == large_committed + count * PAGE_SIZE);
 
     return NO_ERROR;
 }
@@ -315,11 +798,15 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
     DEBUG_ASSERT(count == len / PAGE_SIZE);
 
+    if (!CanCommitLocked(count))
+        return ERR_NO_MEMORY;
+
     // allocate count number of pages
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, alignment_log2, nullptr, &page_list);
+    size_t allocated = pmm_alloc_contiguous(count, AllocFlagsForOffset(offset), alignment_log2,
+                                            nullptr, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -345,6 +832,8 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
             *committed += PAGE_SIZE;
     }
 
+    UpdatePageCountLocked(page_list_.page_count());
+
     // for now we only support committing as much as we were asked for
     DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
 
@@ -360,6 +849,9 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
 
     AutoLock a(lock_);
 
+    if (pin_count_ > 0)
+        return ERR_BAD_STATE;
+
     // trim the size
     if (!TrimRange(offset, len, size_))
         return ERR_OUT_OF_RANGE;
@@ -378,20 +870,201 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
     LTRACEF("start offset %#" PRIx64 ", end %#" PRIx64 ", page_aliged_len %#" PRIx64 "\n", start, end,
             page_aligned_len);
 
-    // unmap all of the pages in this range on all the mapping regions
-    for (auto& r : region_list_) {
-        // unmap any pages the region may have mapped that intersect this range
-        r.UnmapVmoRangeLocked(start, page_aligned_len);
+    // unmap all of the pages in this range on all the mapping regions, including clones'
+    RangeChangeUpdateLocked(start, page_aligned_len);
+
+    // free the pages in the range
+    size_t freed = page_list_.FreeRange(start, end);
+    DropCompressedLocked(start, end);
+    UpdatePageCountLocked(page_list_.page_count());
+    if (decommitted)
+        *decommitted = freed * PAGE_SIZE;
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::Pin(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    // pinning is only supported on vmos that own all of their pages
+    if (parent_)
+        return ERR_NOT_SUPPORTED;
+    if (len == 0)
+        return ERR_INVALID_ARGS;
+
+    status_t status = CommitRange(offset, len, nullptr);
+    if (status != NO_ERROR)
+        return status;
+
+    AutoLock a(lock_);
+
+    if (!InRange(offset, len, size_))
+        return ERR_OUT_OF_RANGE;
+
+    // the range may have been decommitted again since
+    uint64_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    uint64_t end = ROUNDUP_PAGE_SIZE(offset + len);
+    size_t missing = (end - start) / PAGE_SIZE;
+    page_list_.ForEveryPageInRange([&missing](const auto p, uint64_t) { missing--; },
+                                   start, end);
+    if (missing > 0)
+        return ERR_BAD_STATE;
+
+    pin_count_++;
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::Unpin() {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    AutoLock a(lock_);
+
+    if (pin_count_ == 0)
+        return ERR_BAD_STATE;
+    pin_count_--;
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::MovePagesFrom(uint64_t offset, VmObject* src_vmo, uint64_t src_offset,
+                                     uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset %#" PRIx64 ", src %p offset %#" PRIx64 ", len %#" PRIx64 "\n", offset,
+            src_vmo, src_offset, len);
+
+    if (!src_vmo->is_paged())
+        return ERR_NOT_SUPPORTED;
+    auto src = static_cast<VmObjectPaged*>(src_vmo);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(src_offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+
+    // take both locks in address order, so moves going the other way can't deadlock
+    // against us. objects in the same clone hierarchy share the one lock.
+    Mutex* first = &lock_;
+    Mutex* second = &src->lock_;
+    if (second < first) {
+        Mutex* tmp = first;
+        first = second;
+        second = tmp;
+    }
+
+    first->Acquire();
+    if (second != first)
+        second->Acquire();
+
+    status_t status = MovePagesFromLocked(offset, src, src_offset, len);
+
+    if (second != first)
+        second->Release();
+    first->Release();
+
+    return status;
+}
+
+status_t VmObjectPaged::MovePagesFromLocked(uint64_t offset, VmObjectPaged* src,
+                                           uint64_t src_offset, uint64_t len) {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(src->lock_.IsHeld());
+
+    if (offset + len < offset || offset + len > size_)
+        return ERR_OUT_OF_RANGE;
+    if (src_offset + len < src_offset || src_offset + len > src->size_)
+        return ERR_OUT_OF_RANGE;
+
+    if (len == 0)
+        return NO_ERROR;
+
+    if (src == this && offset < src_offset + len && src_offset < offset + len)
+        return ERR_INVALID_ARGS;
+
+    // devices may be using the pages on either side
+    if (pin_count_ > 0 || src->pin_count_ > 0)
+        return ERR_BAD_STATE;
+
+    // pages missing from a clone are read from its parent, and clones of the
+    // source may be reading its pages, so in either case taking the pages away
+    // would change what the source range reads as to something other than zeroes
+    if (src->parent_ || !src->children_list_.is_empty())
+        return ERR_NOT_SUPPORTED;
+
+    // the source's compressed pages have to move as pages
+    status_t status = src->DecompressRangeLocked(src_offset, src_offset + len);
+    if (status != NO_ERROR)
+        return status;
+
+    // the pages may be charged to something else than ours are
+    size_t moving = 0;
+    src->page_list_.ForEveryPageInRange([&moving](const auto p, uint64_t) { moving++; },
+                                        src_offset, src_offset + len);
+    if (!CanCommitLocked(moving))
+        return ERR_NO_MEMORY;
+
+    // nothing may still be mapping the pages on either side
+    RangeChangeUpdateLocked(offset, len);
+    src->RangeChangeUpdateLocked(src_offset, len);
+
+    auto dst_offset = [offset, src_offset](uint64_t o) { return offset + (o - src_offset); };
+    auto src_page = [src, offset, src_offset](uint64_t o) {
+        return src->page_list_.GetPage(src_offset + (o - offset));
+    };
+
+    // share the source's pages with this object where it has no page yet. this is
+    // the only step that can fail, running out of memory for the page list, and
+    // backing out of it leaves both objects as they were.
+    src->page_list_.ForEveryPageInRange([&](vm_page*& p, uint64_t o) {
+        if (status == NO_ERROR && !page_list_.GetPage(dst_offset(o)))
+            status = page_list_.AddPage(p, dst_offset(o));
+    }, src_offset, src_offset + len);
+
+    if (status != NO_ERROR) {
+        // the source still owns every page
+        src->page_list_.ForEveryPageInRange([&](vm_page*& p, uint64_t o) {
+            if (page_list_.GetPage(dst_offset(o)) == p)
+                page_list_.TakeRange(dst_offset(o), dst_offset(o) + PAGE_SIZE, nullptr);
+        }, src_offset, src_offset + len);
+        return status;
     }
 
-    // iterate through the pages, freeing them
-    while (start < end) {
-        auto status = page_list_.FreePage(start);
-        if (status == NO_ERROR && decommitted) {
-            *decommitted += PAGE_SIZE;
+    // from here on nothing allocates. swap the source's pages in over the ones
+    // being replaced...
+    list_node old_pages;
+    list_initialize(&old_pages);
+    page_list_.ForEveryPageInRange([&](vm_page*& p, uint64_t o) {
+        vm_page* sp = src_page(o);
+        if (sp && sp != p) {
+            list_add_tail(&old_pages, &p->free.node);
+            p = sp;
         }
-        start += PAGE_SIZE;
+    }, offset, offset + len);
+
+    // ...and take out the ones where the source has no page, a batch at a time
+    // since the list can't change while it's being walked
+    uint64_t next = offset;
+    for (;;) {
+        uint64_t offsets[kCompressBatch];
+        size_t batch = 0;
+        page_list_.ForEveryPageInRange([&](vm_page*& p, uint64_t o) {
+            if (batch == kCompressBatch)
+                return;
+            next = o + PAGE_SIZE;
+            if (!src_page(o))
+                offsets[batch++] = o;
+        }, next, offset + len);
+
+        for (size_t i = 0; i < batch; i++)
+            page_list_.TakeRange(offsets[i], offsets[i] + PAGE_SIZE, &old_pages);
+
+        if (batch < kCompressBatch)
+            break;
     }
+    DropCompressedLocked(offset, offset + len);
+    pmm_free(&old_pages);
+
+    // this object owns the source's pages now
+    src->page_list_.TakeRange(src_offset, src_offset + len, nullptr);
+    UpdatePageCountLocked(page_list_.page_count());
+    src->UpdatePageCountLocked(src->page_list_.page_count());
 
     return NO_ERROR;
 }
@@ -408,6 +1081,9 @@ status_t VmObjectPaged::Resize(uint64_t s) {
 
     // see if we're shrinking the vmo
     if (s < size_) {
+        if (pin_count_ > 0)
+            return ERR_BAD_STATE;
+
         // figure the starting and ending page offset that is affected
         uint64_t start = ROUNDUP_PAGE_SIZE(s);
         uint64_t end = ROUNDUP_PAGE_SIZE(size_);
@@ -415,17 +1091,13 @@ status_t VmObjectPaged::Resize(uint64_t s) {
 
         // we're only worried about whole pages to be removed
         if (page_aligned_len > 0) {
-            // unmap all of the pages in this range on all the mapping regions
-            for (auto& r : region_list_) {
-                // unmap any pages the region may have mapped that intersect this range
-                r.UnmapVmoRangeLocked(start, page_aligned_len);
-            }
+            // unmap all of the pages in this range on all the mapping regions, including clones'
+            RangeChangeUpdateLocked(start, page_aligned_len);
 
-            // iterate through the pages, freeing them
-            while (start < end) {
-                page_list_.FreePage(start);
-                start += PAGE_SIZE;
-            }
+            // free the pages in the range
+            page_list_.FreeRange(start, end);
+            DropCompressedLocked(start, end);
+            UpdatePageCountLocked(page_list_.page_count());
         }
     }
 
@@ -574,6 +1246,12 @@ status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, user_ptr<paddr_t>
     if (unlikely(table_size > buffer_size))
         return ERR_BUFFER_TOO_SMALL;
 
+    // whoever asked may hand the addresses to a device, so the pages have to stay put
+    compression_disabled_ = true;
+    status_t status = DecompressRangeLocked(start_page_offset, end_page_offset);
+    if (status != NO_ERROR)
+        return status;
+
     size_t index = 0;
     for (uint64_t off = start_page_offset; off != end_page_offset; off += PAGE_SIZE, index++) {
         // grab a pointer to the page only if it's already present
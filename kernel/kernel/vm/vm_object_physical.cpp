@@ -93,6 +93,21 @@ status_t VmObjectPhysical::FaultPageLocked(uint64_t offset, uint pf_flags, paddr
     return NO_ERROR;
 }
 
+// the whole object is contiguous, so any range within it is
+bool VmObjectPhysical::GetContiguousRunLocked(uint64_t offset, uint64_t len, paddr_t* _pa) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (offset >= size_ || len > size_ - offset)
+        return false;
+
+    uint64_t pa = base_ + ROUNDDOWN(offset, PAGE_SIZE);
+    if (pa + len - 1 > UINTPTR_MAX)
+        return false;
+
+    *_pa = (paddr_t)pa;
+    return true;
+}
+
 status_t VmObjectPhysical::Lookup(uint64_t offset, uint64_t len, user_ptr<paddr_t> buffer,
                                   size_t buffer_size) {
     DEBUG_ASSERT(magic_ == MAGIC);
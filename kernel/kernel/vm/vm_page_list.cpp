@@ -16,128 +16,182 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
-VmPageListNode::VmPageListNode(uint64_t offset)
-    : obj_offset_(offset) {
-    LTRACEF("%p offset %#" PRIx64 "\n", this, obj_offset_);
+VmPageListNode::VmPageListNode() {
+    LTRACEF("%p\n", this);
 }
 
 VmPageListNode::~VmPageListNode() {
-    LTRACEF("%p offset %#" PRIx64 "\n", this, obj_offset_);
+    LTRACEF("%p\n", this);
     DEBUG_ASSERT(magic_ == kMagic);
+    DEBUG_ASSERT(populated_ == 0);
 
-    for (__UNUSED auto p : pages_) {
-        DEBUG_ASSERT(p == nullptr);
-    }
     magic_ = 0;
 }
 
-vm_page* VmPageListNode::GetPage(size_t index) {
-    DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(index < kPageFanOut);
-    return pages_[index];
-}
-
-vm_page* VmPageListNode::RemovePage(size_t index) {
-    DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(index < kPageFanOut);
-
-    auto p = pages_[index];
-    if (!p)
-        return nullptr;
-
-    pages_[index] = nullptr;
-
-    return p;
-}
-
-status_t VmPageListNode::AddPage(vm_page* p, size_t index) {
-    DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(index < kPageFanOut);
-    if (pages_[index])
-        return ERR_ALREADY_EXISTS;
-    pages_[index] = p;
-    return NO_ERROR;
-}
-
 VmPageList::VmPageList() {
     LTRACEF("%p\n", this);
 }
 
 VmPageList::~VmPageList() {
     LTRACEF("%p\n", this);
-    DEBUG_ASSERT(list_.is_empty());
+    DEBUG_ASSERT(!root_);
+    DEBUG_ASSERT(page_count_ == 0);
 }
 
 status_t VmPageList::AddPage(vm_page* p, uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
-
-    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, p, offset,
-                  node_offset, index);
-
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        AllocChecker ac;
-        mxtl::unique_ptr<VmPageListNode> pl =
-            mxtl::unique_ptr<VmPageListNode>(new (&ac) VmPageListNode(node_offset));
+    uint64_t index = offset >> PAGE_SIZE_SHIFT;
+
+    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " index %#" PRIx64 "\n", this, p, offset, index);
+
+    AllocChecker ac;
+    if (!root_) {
+        root_ = new (&ac) VmPageListNode();
         if (!ac.check())
             return ERR_NO_MEMORY;
+        levels_ = 1;
+    }
 
-        LTRACEF("allocating new inner node %p\n", pl.get());
-        __UNUSED auto status = pl->AddPage(p, index);
-        DEBUG_ASSERT(status == NO_ERROR);
+    // grow the tree upwards until it can hold this offset
+    while (!FitsInLevels(index, levels_)) {
+        VmPageListNode* node = new (&ac) VmPageListNode();
+        if (!ac.check())
+            return ERR_NO_MEMORY;
 
-        list_.insert(mxtl::move(pl));
-    } else {
-        pln->AddPage(p, index);
+        LTRACEF("growing tree to %u levels\n", levels_ + 1);
+        node->slots_[0].node = root_;
+        node->populated_ = 1;
+        root_ = node;
+        levels_++;
     }
 
+    // walk down to the leaf, filling in any missing inner nodes
+    VmPageListNode* node = root_;
+    for (uint level = levels_ - 1; level > 0; level--) {
+        auto& slot = node->slots_[SlotIndex(index, level)];
+        if (!slot.node) {
+            slot.node = new (&ac) VmPageListNode();
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+            node->populated_++;
+        }
+        node = slot.node;
+    }
+
+    auto& slot = node->slots_[SlotIndex(index, 0)];
+    if (slot.page)
+        return ERR_ALREADY_EXISTS;
+
+    slot.page = p;
+    node->populated_++;
+    page_count_++;
+
     return NO_ERROR;
 }
 
 vm_page* VmPageList::GetPage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+    uint64_t index = offset >> PAGE_SIZE_SHIFT;
 
-    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
-                  index);
+    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " index %#" PRIx64 "\n", this, offset, index);
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
+    if (!root_ || !FitsInLevels(index, levels_))
         return nullptr;
+
+    VmPageListNode* node = root_;
+    for (uint level = levels_ - 1; level > 0; level--) {
+        node = node->slots_[SlotIndex(index, level)].node;
+        if (!node)
+            return nullptr;
     }
 
-    return pln->GetPage(index);
+    return node->slots_[SlotIndex(index, 0)].page;
 }
 
 status_t VmPageList::FreePage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 "\n", this, offset);
+
+    return (FreeRange(offset, offset + PAGE_SIZE) > 0) ? NO_ERROR : ERR_NOT_FOUND;
+}
+
+size_t VmPageList::FreeRange(uint64_t start_offset, uint64_t end_offset) {
+    LTRACEF("%p start %#" PRIx64 " end %#" PRIx64 "\n", this, start_offset, end_offset);
+
+    list_node list;
+    list_initialize(&list);
+
+    size_t count = TakeRange(start_offset, end_offset, &list);
+
+    // return all the pages to the pmm at once
+    __UNUSED auto freed = pmm_free(&list);
+    DEBUG_ASSERT(freed == count);
+
+    return count;
+}
+
+size_t VmPageList::TakeRange(uint64_t start_offset, uint64_t end_offset, list_node* pages) {
+    LTRACEF("%p start %#" PRIx64 " end %#" PRIx64 "\n", this, start_offset, end_offset);
 
-    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
-                  index);
+    if (!root_ || end_offset <= start_offset)
+        return 0;
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        return ERR_NOT_FOUND;
+    size_t count = TakeRangeInNode(root_, levels_ - 1, 0, start_offset >> PAGE_SIZE_SHIFT,
+                                   ((end_offset - 1) >> PAGE_SIZE_SHIFT) + 1, pages);
+
+    // drop the tree entirely once it's empty
+    if (root_->populated_ == 0) {
+        delete root_;
+        root_ = nullptr;
+        levels_ = 0;
     }
 
-    // free this page
-    auto page = pln->RemovePage(index);
-    if (page) {
-        // if it was the last page in the node, remove the node from the tree
-        if (pln->IsEmpty()) {
-            LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
-            list_.erase(*pln);
-        }
+    page_count_ -= count;
 
-        pmm_free_page(page);
+    return count;
+}
+
+// remove the pages under node in [start, end), adding them to pages if it isn't
+// null, and delete any nodes below it that become empty
+size_t VmPageList::TakeRangeInNode(VmPageListNode* node, uint level, uint64_t base, uint64_t start,
+                                   uint64_t end, list_node* pages) {
+    DEBUG_ASSERT(node->magic_ == VmPageListNode::kMagic);
+
+    const uint shift = static_cast<uint>(level * VmPageListNode::kFanOutShift);
+    size_t count = 0;
+    for (size_t i = IndexInRange(base, start, shift); i < VmPageListNode::kFanOut; i++) {
+        uint64_t child_base = base + (static_cast<uint64_t>(i) << shift);
+        if (child_base >= end)
+            break;
+
+        auto& slot = node->slots_[i];
+        if (level == 0) {
+            if (slot.page) {
+                if (pages)
+                    list_add_tail(pages, &slot.page->free.node);
+                slot.page = nullptr;
+                node->populated_--;
+                count++;
+            }
+        } else if (slot.node) {
+            count += TakeRangeInNode(slot.node, level - 1, child_base, start, end, pages);
+            if (slot.node->populated_ == 0) {
+                delete slot.node;
+                slot.node = nullptr;
+                node->populated_--;
+            }
+        }
     }
 
-    return NO_ERROR;
+    return count;
+}
+
+void VmPageList::DeleteNode(VmPageListNode* node, uint level) {
+    if (level > 0) {
+        for (auto& slot : node->slots_) {
+            if (slot.node)
+                DeleteNode(slot.node, level - 1);
+        }
+    }
+    node->populated_ = 0;
+    delete node;
 }
 
 size_t VmPageList::FreeAllPages() {
@@ -159,12 +213,17 @@ size_t VmPageList::FreeAllPages() {
     // walk the tree in order, freeing all the pages on every node
     ForEveryPage(per_page_func);
 
-    // return all the pages to the pmm at once
-    __UNUSED auto freed = pmm_free(&list);
-    DEBUG_ASSERT(freed == count);
+    // return all the pages to the pmm at once.  large lists are freed in the
+    // background, so that destroying a big object doesn't wait for it.
+    DEBUG_ASSERT(count == page_count_);
+    pmm_free_deferred(&list, count);
 
     // empty the tree
-    list_.clear();
+    if (root_)
+        DeleteNode(root_, levels_ - 1);
+    root_ = nullptr;
+    levels_ = 0;
+    page_count_ = 0;
 
     return count;
 }
@@ -11,6 +11,7 @@
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_page_list.h>
 #include <mxtl/array.h>
 #include <new.h>
 #include <unittest.h>
@@ -33,6 +34,55 @@ static bool pmm_tests(void* context) {
         EXPECT_EQ(1u, ret, "pmm_free_page on single page");
     }
 
+    // allocate zeroed pages, both singly and in bulk, and make sure they are
+    unittest_printf("allocating zeroed pages, then freeing them\n");
+    {
+        list_node list = LIST_INITIAL_VALUE(list);
+
+        static const size_t alloc_count = 64;
+
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_ZEROED, &pa);
+        EXPECT_NEQ(nullptr, page, "pmm_alloc zeroed page");
+        if (page)
+            list_add_tail(&list, &page->free.node);
+
+        auto count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_ZEROED, &list);
+        EXPECT_EQ(alloc_count, count, "pmm_alloc_pages zeroed pages count");
+
+        vm_page_t* p;
+        list_for_every_entry (&list, p, vm_page_t, free.node) {
+            auto ptr = static_cast<const uint64_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
+            bool zero = true;
+            for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+                zero = zero && ptr[i] == 0;
+            EXPECT_TRUE(zero, "page is zeroed");
+        }
+
+        pmm_free(&list);
+    }
+
+    // allocate and free enough single pages to overflow the per-cpu page cache
+    unittest_printf("allocating single pages, then freeing them one at a time\n");
+    {
+        static const size_t alloc_count = 256;
+        vm_page_t* pages[alloc_count];
+
+        for (size_t i = 0; i < alloc_count; i++) {
+            pages[i] = pmm_alloc_page(0, nullptr);
+            EXPECT_NEQ(nullptr, pages[i], "pmm_alloc single page");
+            if (i > 0)
+                EXPECT_NEQ(pages[i - 1], pages[i], "pmm_alloc distinct pages");
+        }
+
+        for (size_t i = 0; i < alloc_count; i++) {
+            if (pages[i]) {
+                auto ret = pmm_free_page(pages[i]);
+                EXPECT_EQ(1u, ret, "pmm_free_page on single page");
+            }
+        }
+    }
+
     // allocate a bunch of pages then free them
     unittest_printf("allocating a lot of pages, then freeing them\n");
     {
@@ -48,6 +98,66 @@ static bool pmm_tests(void* context) {
         EXPECT_EQ(alloc_count, ret, "pmm_free_page on a list of pages");
     }
 
+    // allocate contiguous runs of various sizes and alignments then free them
+    unittest_printf("allocating contiguous runs, then freeing them\n");
+    {
+        static const size_t counts[] = { 1, 3, 16, 33, 256 };
+        static const uint8_t alignments[] = { PAGE_SIZE_SHIFT, PAGE_SIZE_SHIFT + 4, 20 };
+
+        for (auto count : counts) {
+            for (auto alignment_log2 : alignments) {
+                list_node list = LIST_INITIAL_VALUE(list);
+                paddr_t pa;
+
+                auto ret = pmm_alloc_contiguous(count, 0, alignment_log2, &pa, &list);
+                EXPECT_EQ(count, ret, "pmm_alloc_contiguous count");
+                EXPECT_EQ(count, list_length(&list), "pmm_alloc_contiguous list count");
+                EXPECT_TRUE(IS_ALIGNED(pa, 1UL << alignment_log2), "pmm_alloc_contiguous alignment");
+
+                // the pages must be in order and physically contiguous
+                paddr_t expected = pa;
+                vm_page_t* p;
+                list_for_every_entry (&list, p, vm_page_t, free.node) {
+                    EXPECT_EQ(expected, vm_page_to_paddr(p), "pmm_alloc_contiguous run");
+                    expected += PAGE_SIZE;
+                }
+
+                ret = pmm_free(&list);
+                EXPECT_EQ(count, ret, "pmm_free on a contiguous run");
+            }
+        }
+    }
+
+    // allocate pages from each numa node, and from one there is no memory on
+    unittest_printf("allocating pages by numa node, then freeing them\n");
+    {
+        list_node list = LIST_INITIAL_VALUE(list);
+
+        static const size_t alloc_count = 16;
+        const uint nodes = pmm_numa_node_count();
+        EXPECT_GE(nodes, 1u, "pmm_numa_node_count");
+
+        for (uint node = 0; node < nodes; node++) {
+            auto count = pmm_alloc_pages(alloc_count,
+                                         PMM_ALLOC_FLAG_NODE(node) | PMM_ALLOC_FLAG_BIND, &list);
+            EXPECT_EQ(alloc_count, count, "pmm_alloc_pages bound to a node");
+            vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_NODE(node) | PMM_ALLOC_FLAG_ZEROED,
+                                             nullptr);
+            EXPECT_NEQ(nullptr, page, "pmm_alloc_page preferring a node");
+            if (page)
+                list_add_tail(&list, &page->free.node);
+        }
+
+        // a preference for a node without memory falls back, a binding to one fails
+        auto count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_NODE(nodes), &list);
+        EXPECT_EQ(alloc_count, count, "pmm_alloc_pages preferring an empty node");
+        count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_NODE(nodes) | PMM_ALLOC_FLAG_BIND,
+                                &list);
+        EXPECT_EQ(0u, count, "pmm_alloc_pages bound to an empty node");
+
+        pmm_free(&list);
+    }
+
     // allocate too many pages and make sure it fails nicely
     unittest_printf("allocating too many pages, then freeing them\n");
     {
@@ -620,12 +730,207 @@ static bool vmm_object_tests(void* context) {
         EXPECT_EQ(0, cmpres, "reading from object");
     }
 
+    {
+        unittest_printf("copy-on-write clone of a vm object\n");
+        static const size_t alloc_size = PAGE_SIZE * 4;
+        auto vmo = VmObjectPaged::Create(0, alloc_size);
+        REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+        uint32_t val = 1;
+        size_t bytes = 0;
+        status_t err = vmo->Write(&val, PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "writing to object");
+
+        // clone from the second page on
+        mxtl::RefPtr<VmObject> clone;
+        err = vmo->CloneCOW(PAGE_SIZE, alloc_size, &clone);
+        EXPECT_EQ(NO_ERROR, err, "cloning object");
+        REQUIRE_TRUE(clone, "clone creation\n");
+        EXPECT_EQ(alloc_size, clone->size(), "clone size");
+
+        // reads see the parent's pages without copying them
+        val = 0;
+        err = clone->Read(&val, 0, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "reading from clone");
+        EXPECT_EQ(1u, val, "clone contents");
+        EXPECT_EQ(0u, clone->AllocatedPages(), "clone pages after read");
+
+        // writes to the clone copy the page and leave the parent alone
+        val = 2;
+        err = clone->Write(&val, 0, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "writing to clone");
+        EXPECT_EQ(1u, clone->AllocatedPages(), "clone pages after write");
+
+        err = vmo->Read(&val, PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "reading from object");
+        EXPECT_EQ(1u, val, "parent contents after clone write");
+
+        // and writes to the parent no longer show up in the clone's copy
+        val = 3;
+        err = vmo->Write(&val, PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "writing to object");
+        err = clone->Read(&val, 0, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "reading from clone");
+        EXPECT_EQ(2u, val, "clone contents after parent write");
+
+        // the clone keeps the parent alive
+        vmo.reset();
+        err = clone->Read(&val, 0, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "reading from clone");
+        EXPECT_EQ(2u, val, "clone contents after parent release");
+    }
+
+    {
+        unittest_printf("large page backed vm object\n");
+        static const size_t alloc_size = LARGE_PAGE_SIZE * 2;
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size,
+                                         VmObjectPaged::CREATE_OPT_LARGE_PAGES);
+        REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+        // touching one page commits the whole contiguous run around it
+        uint32_t val = 1;
+        size_t bytes = 0;
+        status_t err = vmo->Write(&val, LARGE_PAGE_SIZE + PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "writing to object");
+        EXPECT_EQ(LARGE_PAGE_SIZE / PAGE_SIZE, vmo->AllocatedPages(), "committed run");
+
+        // map it and check it reads back through what should be a large page mapping
+        auto ka = VmAspace::kernel_aspace();
+        uint8_t* ptr;
+        err = ka->MapObject(vmo, "test", 0, alloc_size, (void**)&ptr, LARGE_PAGE_SIZE_SHIFT, 0, 0,
+                            ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
+        EXPECT_EQ(NO_ERROR, err, "mapping object");
+        EXPECT_EQ(1u, *reinterpret_cast<volatile uint32_t*>(ptr + LARGE_PAGE_SIZE + PAGE_SIZE),
+                  "reading through mapping");
+
+        // writing through the mapping faults in the other run
+        *reinterpret_cast<volatile uint32_t*>(ptr + 3 * PAGE_SIZE) = 2;
+        EXPECT_EQ(2 * LARGE_PAGE_SIZE / PAGE_SIZE, vmo->AllocatedPages(), "committed runs");
+        err = vmo->Read(&val, 3 * PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "reading from object");
+        EXPECT_EQ(2u, val, "reading from object");
+
+        ka->FreeRegion((vaddr_t)ptr);
+    }
+
+    {
+        unittest_printf("discardable vm object\n");
+        static const size_t alloc_size = PAGE_SIZE * 4;
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size,
+                                         VmObjectPaged::CREATE_OPT_DISCARDABLE);
+        REQUIRE_TRUE(vmo, "vmobject creation\n");
+        auto keep = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+        REQUIRE_TRUE(keep, "vmobject creation\n");
+
+        uint64_t committed;
+        status_t err = vmo->CommitRange(0, alloc_size, &committed);
+        EXPECT_EQ(NO_ERROR, err, "committing object");
+        err = keep->CommitRange(0, alloc_size, &committed);
+        EXPECT_EQ(NO_ERROR, err, "committing object");
+
+        uint32_t val = 1;
+        size_t bytes = 0;
+        err = vmo->Write(&val, PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "writing to object");
+
+        // other discardable objects in the system may go along with ours
+        size_t discarded = VmObjectPaged::DiscardPages(SIZE_MAX);
+        EXPECT_GE(discarded, alloc_size / PAGE_SIZE, "discarded pages");
+        EXPECT_EQ(0u, vmo->AllocatedPages(), "discardable object pages");
+        EXPECT_EQ(alloc_size / PAGE_SIZE, keep->AllocatedPages(), "other object pages");
+
+        // the contents are gone but the object is still usable
+        err = vmo->Read(&val, PAGE_SIZE, sizeof(val), &bytes);
+        EXPECT_EQ(NO_ERROR, err, "reading from object");
+        EXPECT_EQ(0u, val, "contents after discard");
+    }
+
+    {
+        unittest_printf("pinned vm object\n");
+        static const size_t alloc_size = PAGE_SIZE * 4;
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+        REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+        // pinning commits the range
+        status_t err = vmo->Pin(PAGE_SIZE, PAGE_SIZE * 2);
+        EXPECT_EQ(NO_ERROR, err, "pinning object");
+        EXPECT_EQ(2u, vmo->AllocatedPages(), "pinned pages");
+
+        // and keeps the pages in place until unpinned
+        uint64_t decommitted;
+        err = vmo->DecommitRange(0, alloc_size, &decommitted);
+        EXPECT_EQ(ERR_BAD_STATE, err, "decommitting pinned object");
+        err = vmo->Resize(PAGE_SIZE);
+        EXPECT_EQ(ERR_BAD_STATE, err, "shrinking pinned object");
+        EXPECT_EQ(2u, vmo->AllocatedPages(), "pinned pages");
+
+        err = vmo->Pin(alloc_size, PAGE_SIZE);
+        EXPECT_EQ(ERR_OUT_OF_RANGE, err, "pinning past the end");
+
+        err = vmo->Unpin();
+        EXPECT_EQ(NO_ERROR, err, "unpinning object");
+        err = vmo->Unpin();
+        EXPECT_EQ(ERR_BAD_STATE, err, "unpinning unpinned object");
+        err = vmo->DecommitRange(0, alloc_size, &decommitted);
+        EXPECT_EQ(NO_ERROR, err, "decommitting object");
+        EXPECT_EQ(0u, vmo->AllocatedPages(), "pages after unpin");
+    }
+
     unittest_printf("done with vmm object based tests\n");
     END_TEST;
 }
 
+static bool vm_page_list_tests(void* context) {
+    BEGIN_TEST;
+
+    // spread some pages across leaves and far enough apart to grow the tree
+    static const uint64_t offsets[] = {
+        0, PAGE_SIZE * 63, PAGE_SIZE * 64, 1ull << 40,
+    };
+    static const size_t count = countof(offsets);
+
+    VmPageList pl;
+    vm_page_t* pages[count];
+    for (size_t i = 0; i < count; i++) {
+        pages[i] = pmm_alloc_page(0, nullptr);
+        REQUIRE_NONNULL(pages[i], "allocating page");
+        EXPECT_EQ(NO_ERROR, pl.AddPage(pages[i], offsets[i]), "adding page");
+    }
+    EXPECT_EQ(count, pl.page_count(), "page count");
+    EXPECT_EQ(ERR_ALREADY_EXISTS, pl.AddPage(pages[0], offsets[0]), "adding page twice");
+
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(pages[i], pl.GetPage(offsets[i]), "looking up page");
+    }
+    EXPECT_NULL(pl.GetPage(PAGE_SIZE), "looking up missing page");
+    EXPECT_NULL(pl.GetPage(1ull << 50), "looking up page past the tree");
+
+    // a range walk only sees the pages in the range, in order
+    size_t seen = 0;
+    bool in_order = true;
+    pl.ForEveryPageInRange([&](const auto p, uint64_t offset) {
+        in_order = in_order && (offset == offsets[seen + 1]) && (p == pages[seen + 1]);
+        seen++;
+    }, PAGE_SIZE, PAGE_SIZE * 65);
+    EXPECT_EQ(2u, seen, "pages in range");
+    EXPECT_TRUE(in_order, "pages in range");
+
+    // free that range and make sure the rest is intact
+    EXPECT_EQ(2u, pl.FreeRange(PAGE_SIZE, PAGE_SIZE * 65), "freeing range");
+    EXPECT_EQ(count - 2, pl.page_count(), "page count");
+    EXPECT_NULL(pl.GetPage(offsets[1]), "looking up freed page");
+    EXPECT_EQ(pages[3], pl.GetPage(offsets[3]), "looking up page");
+
+    EXPECT_EQ(count - 2, pl.FreeAllPages(), "freeing all pages");
+    EXPECT_EQ(0u, pl.page_count(), "page count");
+    EXPECT_NULL(pl.GetPage(offsets[0]), "looking up freed page");
+
+    END_TEST;
+}
+
 UNITTEST_START_TESTCASE(vm_tests)
 UNITTEST("pmm tests", pmm_tests)
 UNITTEST("vmm tests", vmm_tests)
 UNITTEST("vm object based test", vmm_object_tests)
+UNITTEST("vm page list tests", vm_page_list_tests)
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", NULL, NULL);
@@ -15,11 +15,14 @@
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_address_region.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <string.h>
 #include <trace.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+KCOUNTER(page_faults, "vm.page_faults");
 #define TRACE_PAGE_FAULT 0
 
 // This file mostly contains C wrappers around the underlying C++ objects, conforming to
@@ -146,6 +149,8 @@ status_t vmm_page_fault_handler(vaddr_t addr, uint flags) {
     TRACEF("thread %s va %#" PRIxPTR ", flags 0x%x\n", current_thread->name, addr, flags);
 #endif
 
+    kcounter_add(&page_faults, 1);
+
 #if _LP64
     ktrace(TAG_PAGE_FAULT, (uint32_t)(addr >> 32), (uint32_t)addr, flags, arch_curr_cpu_num());
 #else
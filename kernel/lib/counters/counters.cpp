@@ -0,0 +1,50 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/counters.h>
+
+#include <arch/ops.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <lib/console.h>
+#include <lk/init.h>
+
+int64_t kcounters_arena[SMP_MAX_CPUS][KCOUNTER_MAX] __CPU_ALIGN;
+
+static_assert((KCOUNTER_MAX * sizeof(int64_t)) % CACHE_LINE == 0,
+              "each cpu's counters do not start a cache line");
+
+size_t kcounter_count(void) {
+    return static_cast<size_t>(__stop_kcounter_desc - __start_kcounter_desc);
+}
+
+const char* kcounter_name(size_t index) {
+    return __start_kcounter_desc[index].name;
+}
+
+int64_t kcounter_sum(size_t index) {
+    int64_t sum = 0;
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++)
+        sum += __atomic_load_n(&kcounters_arena[cpu][index], __ATOMIC_RELAXED);
+    return sum;
+}
+
+static void kcounters_init(uint level) {
+    if (kcounter_count() > KCOUNTER_MAX)
+        panic("%zu kernel counters declared, KCOUNTER_MAX is %d\n", kcounter_count(), KCOUNTER_MAX);
+}
+
+LK_INIT_HOOK(kcounters, kcounters_init, LK_INIT_LEVEL_EARLIEST);
+
+static int cmd_counters(int argc, const cmd_args* argv) {
+    for (size_t i = 0; i < kcounter_count(); i++)
+        printf("%-32s %" PRId64 "\n", kcounter_name(i), kcounter_sum(i));
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("counters", "print the kernel counters", &cmd_counters)
+STATIC_COMMAND_END(counters);
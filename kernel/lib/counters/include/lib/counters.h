@@ -0,0 +1,57 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/ops.h>
+#include <magenta/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+// Kernel counters: cheap per-cpu event counts that can be declared anywhere
+// in the kernel and are read summed over the cpus through
+// mx_object_get_info(MX_INFO_KCOUNTERS).
+//
+//   KCOUNTER(timer_fires, "kernel.timer_fires");
+//   ...
+//   kcounter_add(&timer_fires, 1);
+//
+// The descriptors are collected in the kcounter_desc section and a
+// counter's slot is its index in there. Each cpu's slots are a cache line
+// aligned block of their own, so counting never bounces a line between
+// cpus.
+
+// Most counters the kernel can have.
+#define KCOUNTER_MAX 256
+
+typedef struct kcounter_desc {
+    const char* name;
+} kcounter_desc_t;
+
+#define KCOUNTER(var, _name) \
+    static const kcounter_desc_t var __SECTION("kcounter_desc") __attribute__((used)) = { .name = _name }
+
+extern const kcounter_desc_t __start_kcounter_desc[] __WEAK;
+extern const kcounter_desc_t __stop_kcounter_desc[] __WEAK;
+
+extern int64_t kcounters_arena[SMP_MAX_CPUS][KCOUNTER_MAX];
+
+static inline void kcounter_add(const kcounter_desc_t* counter, int64_t delta) {
+    size_t index = (size_t)(counter - __start_kcounter_desc);
+    // relaxed atomic so that being moved to another cpu part way through
+    // can't lose a count; the line is only contended in that case
+    __atomic_fetch_add(&kcounters_arena[arch_curr_cpu_num()][index], delta, __ATOMIC_RELAXED);
+}
+
+// The number of counters and, for the one at |index|, its name and value
+// summed over every cpu.
+size_t kcounter_count(void);
+const char* kcounter_name(size_t index);
+int64_t kcounter_sum(size_t index);
+
+__END_CDECLS
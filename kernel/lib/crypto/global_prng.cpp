@@ -6,14 +6,20 @@
 
 #include <lib/crypto/global_prng.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <dev/hw_rng.h>
 #include <err.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <lib/crypto/prng.h>
+#include <mxtl/algorithm.h>
 #include <new.h>
 #include <lk/init.h>
+#include <string.h>
 
 namespace crypto {
 
@@ -26,6 +32,159 @@ PRNG* GetInstance() {
     return kGlobalPrng;
 }
 
+// A cpu's PRNG reseeds from the global one after this many bytes of output.
+static constexpr uint64_t kPerCpuReseedBytes = 1024 * 1024;
+
+// The per-cpu PRNGs are not thread-safe; each is only used by its own cpu,
+// with interrupts disabled so that the draw cannot migrate or be preempted.
+struct PerCpuPRNG {
+    PRNG* prng;
+    uint64_t drawn;
+    int generation;
+};
+
+static PerCpuPRNG per_cpu[SMP_MAX_CPUS];
+alignas(alignof(PRNG))static uint8_t per_cpu_space[SMP_MAX_CPUS][sizeof(PRNG)];
+
+// Bumped whenever entropy is added, so the per-cpu PRNGs know to reseed.
+static int entropy_generation;
+
+// Hardware entropy is gathered ahead of need by a low-priority thread, so
+// that reseeding takes what is already there rather than waiting on the
+// source.  The thread reads the source without blocking, backs off while it
+// has nothing to give, and sleeps while the ring is full.  On platforms with
+// no source it exits after its first read.
+static constexpr size_t kHarvestRingSize = 256;
+static constexpr size_t kHarvestChunk = 32;
+static constexpr lk_time_t kHarvestMinBackoff = 1;
+static constexpr lk_time_t kHarvestMaxBackoff = 1000;
+
+static spin_lock_t harvest_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint8_t harvest_ring[kHarvestRingSize];
+static size_t harvest_head;
+static size_t harvest_count;
+// Signaled when bytes are taken out of the ring.
+static event_t harvest_event = EVENT_INITIAL_VALUE(harvest_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// Moves up to |len| harvested bytes into |out|, without waiting for more.
+// Returns how many were moved.
+static size_t TakeHarvested(uint8_t* out, size_t len) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&harvest_lock, state);
+    size_t n = mxtl::min(len, harvest_count);
+    for (size_t i = 0; i < n; i++) {
+        size_t pos = (harvest_head + i) % kHarvestRingSize;
+        out[i] = harvest_ring[pos];
+        harvest_ring[pos] = 0;
+    }
+    harvest_head = (harvest_head + n) % kHarvestRingSize;
+    harvest_count -= n;
+    spin_unlock_irqrestore(&harvest_lock, state);
+
+    if (n > 0) {
+        event_signal(&harvest_event, false);
+    }
+    return n;
+}
+
+static int HarvestThread(void*) {
+    lk_time_t backoff = kHarvestMinBackoff;
+    bool probed = false;
+    for (;;) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&harvest_lock, state);
+        size_t want = mxtl::min(kHarvestChunk, kHarvestRingSize - harvest_count);
+        spin_unlock_irqrestore(&harvest_lock, state);
+        if (want == 0) {
+            event_wait(&harvest_event);
+            continue;
+        }
+
+        // The first request blocks, and only comes back empty if there is no
+        // hardware source at all, in which case there's nothing to harvest.
+        uint8_t chunk[kHarvestChunk];
+        size_t got = hw_rng_get_entropy(chunk, want, !probed);
+        if (got == 0 && !probed) {
+            return 0;
+        }
+        probed = true;
+        if (got == 0) {
+            thread_sleep(backoff);
+            backoff = mxtl::min(backoff * 2, kHarvestMaxBackoff);
+            continue;
+        }
+        backoff = kHarvestMinBackoff;
+
+        // Only this thread adds to the ring, so the room seen above is
+        // still there.
+        spin_lock_irqsave(&harvest_lock, state);
+        for (size_t i = 0; i < got; i++) {
+            harvest_ring[(harvest_head + harvest_count + i) % kHarvestRingSize] = chunk[i];
+        }
+        harvest_count += got;
+        spin_unlock_irqrestore(&harvest_lock, state);
+        memset(chunk, 0, sizeof(chunk));
+    }
+
+    return 0;
+}
+
+void Draw(void* out, int size) {
+    PRNG* global = GetInstance();
+    // Before the scheduler runs there is only this cpu, and no contention.
+    if (unlikely(!global->is_thread_safe())) {
+        global->Draw(out, size);
+        return;
+    }
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PerCpuPRNG* pc = &per_cpu[arch_curr_cpu_num()];
+    if (likely(pc->prng && pc->generation == atomic_load(&entropy_generation) &&
+               pc->drawn < kPerCpuReseedBytes)) {
+        pc->prng->Draw(out, size);
+        pc->drawn += size;
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return;
+    }
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Drawing the seed may block on the global PRNG's lock or on its having
+    // enough entropy, so do it with interrupts enabled.  The thread may land
+    // on another cpu meanwhile, which is then the one that gets the seed.
+    // Mix in whatever hardware entropy was harvested since the last reseed.
+    uint8_t seed[PRNG::kMinEntropy];
+    size_t harvested = TakeHarvested(seed, sizeof(seed));
+    if (harvested > 0) {
+        global->AddEntropy(seed, static_cast<int>(harvested));
+    }
+
+    int generation = atomic_load(&entropy_generation);
+    global->Draw(seed, sizeof(seed));
+
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    uint cpu = arch_curr_cpu_num();
+    pc = &per_cpu[cpu];
+    if (pc->prng) {
+        pc->prng->AddEntropy(seed, sizeof(seed));
+    } else {
+        pc->prng = new (&per_cpu_space[cpu]) PRNG(seed, sizeof(seed),
+                                                  PRNG::NonThreadSafeTag());
+    }
+    pc->generation = generation;
+    pc->drawn = size;
+    pc->prng->Draw(out, size);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Get rid of the stack copy of the seed
+    memset(seed, 0, sizeof(seed));
+}
+
+void AddEntropy(const void* data, int size) {
+    GetInstance()->AddEntropy(data, size);
+    atomic_add(&entropy_generation, 1);
+}
+
 // Instantiates the global PRNG (in non-thread-safe mode) and seeds it.
 static void EarlyBootSeed(uint level) {
     ASSERT(kGlobalPrng == nullptr);
@@ -67,6 +226,12 @@ static void BecomeThreadSafe(uint level) {
     GetInstance()->BecomeThreadSafe();
 }
 
+static void StartHarvesting(uint level) {
+    thread_t* t = thread_create("entropy harvest", &HarvestThread, nullptr, LOW_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
 } //namespace GlobalPRNG
 
 } // namespace crypto
@@ -76,3 +241,6 @@ LK_INIT_HOOK(global_prng_seed, crypto::GlobalPRNG::EarlyBootSeed,
 
 LK_INIT_HOOK(global_prng_thread_safe, crypto::GlobalPRNG::BecomeThreadSafe,
              LK_INIT_LEVEL_THREADING - 1)
+
+LK_INIT_HOOK(global_prng_harvest, crypto::GlobalPRNG::StartHarvesting,
+             LK_INIT_LEVEL_THREADING)
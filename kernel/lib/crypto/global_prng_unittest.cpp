@@ -7,6 +7,7 @@
 #include <lib/crypto/global_prng.h>
 
 #include <stdint.h>
+#include <string.h>
 #include <unittest.h>
 
 namespace crypto {
@@ -24,10 +25,29 @@ bool identical(void*) {
     END_TEST;
 }
 
+bool per_cpu_draw(void*) {
+    BEGIN_TEST;
+
+    uint8_t a[32] = {0};
+    uint8_t b[32] = {0};
+    GlobalPRNG::Draw(a, sizeof(a));
+    GlobalPRNG::Draw(b, sizeof(b));
+    EXPECT_NEQ(0, memcmp(a, b, sizeof(a)), "successive draws repeated");
+
+    // Adding entropy makes the per-cpu PRNGs reseed; draws keep differing.
+    static const uint8_t entropy[] = "global_prng per-cpu test";
+    GlobalPRNG::AddEntropy(entropy, sizeof(entropy));
+    GlobalPRNG::Draw(a, sizeof(a));
+    EXPECT_NEQ(0, memcmp(a, b, sizeof(a)), "draw after reseed repeated");
+
+    END_TEST;
+}
+
 } // namespace
 
 UNITTEST_START_TESTCASE(global_prng_tests)
 UNITTEST("Identical", identical)
+UNITTEST("PerCpuDraw", per_cpu_draw)
 UNITTEST_END_TESTCASE(global_prng_tests, "global_prng",
                       "Validate global PRNG singleton",
                       NULL, NULL);
@@ -16,6 +16,17 @@ namespace GlobalPRNG {
 // guaranteed to be non-null.
 PRNG* GetInstance();
 
+// Get pseudo-random output of |size| bytes from the current cpu's PRNG,
+// which is seeded from the global one and reseeded from it periodically
+// and after AddEntropy.  Unlike drawing from GetInstance(), concurrent
+// draws on different cpus do not contend with each other.  Blocks until
+// the global PRNG has enough entropy.
+void Draw(void* out, int size);
+
+// Mix new entropy into the global PRNG, and have each cpu's PRNG reseed
+// from it before its next draw.  |size| is in bytes.
+void AddEntropy(const void* data, int size);
+
 } //namespace GlobalPRNG
 
 } // namespace crypto
@@ -19,12 +19,21 @@
 
 #define DLOG_SIZE (64 * 1024)
 
+// Records never straddle a multiple of DLOG_SYNC_SIZE, so a reader that has
+// lost its place or is just starting can pick up at the next one.
+#define DLOG_SYNC_SIZE (4 * 1024)
+
+// Writers with interrupts disabled can't wake the notifier, so it also
+// looks for their records this often.
+#define DLOG_NOTIFY_POLL_MS 1000
+
 static uint8_t DLOG_DATA[DLOG_SIZE];
 
 static dlog_t DLOG = {
-    .lock = MUTEX_INITIAL_VALUE(DLOG.lock),
     .size = DLOG_SIZE,
     .data = DLOG_DATA,
+    .notify = EVENT_INITIAL_VALUE(DLOG.notify, false, EVENT_FLAG_AUTOUNSIGNAL),
+    .readers_lock = MUTEX_INITIAL_VALUE(DLOG.readers_lock),
     .readers = LIST_INITIAL_VALUE(DLOG.readers),
 };
 
@@ -32,17 +41,34 @@ static dlog_t DLOG = {
 
 #define ALIGN8(n) (((n) + 7) & (~7))
 
-#define REC(ptr, off) ((dlog_record_t*)((ptr) + (off)))
+// Each record in the ring starts with a header. |pos| is stored last, once
+// the rest is written: a header whose pos is not the position it is at is
+// still being written, or is left over from an earlier trip round the ring.
+typedef struct dlog_header {
+    uint64_t pos;
+    uint32_t size;      // bytes the record takes in the ring, header included
+    uint32_t padding;   // nonzero if the rest of the sync block is unused
+} dlog_header_t;
+
+#define HDR(log, pos) ((dlog_header_t*)((uint8_t*)(log)->data + ((pos) & ((log)->size - 1))))
+
+static uint64_t round_up_sync(uint64_t pos) {
+    return (pos + DLOG_SYNC_SIZE - 1) & ~(uint64_t)(DLOG_SYNC_SIZE - 1);
+}
+
+// Space left in the sync block holding pos.
+static uint32_t sync_space(uint64_t pos) {
+    return DLOG_SYNC_SIZE - (uint32_t)(pos & (DLOG_SYNC_SIZE - 1));
+}
+
+static uint64_t dlog_head(dlog_t* log) {
+    return __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+}
 
-// To avoid complexity with splitting record headers, this is
-// a mostly-circular buffer -- each record has a next index
-// that can be used to advance to the next record, allowing the
-// leftover space not large enough for a full record at the end
-// to be skipped easily.
 status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     dlog_t* log = &DLOG;
 
-    if (arch_ints_disabled() || log->paused) {
+    if (log->paused) {
         return ERR_BAD_STATE;
     }
 
@@ -51,46 +77,32 @@ status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     }
 
     // Keep record headers uint64 aligned
-    size_t sz = ALIGN8(len + sizeof(dlog_record_t));
-
-    mutex_acquire(&log->lock);
-
-    // Determine location of new record and next record after it
-    uint32_t dst = log->head;
-    uint32_t end = log->head + sz;
-    uint32_t nxt = end;
-    if ((nxt + DLOG_MAX_ENTRY) > log->size) {
-        nxt = 0;
-    }
-
-    // Advance our tail if we write past it.
-    if (log->head != log->tail) {
-        while ((log->tail >= dst) && (log->tail < end)) {
-            log->tail = REC(log->data, log->tail)->next;
-        }
-    }
-
-    // Notify readers and advance their tails if necessary
-    dlog_reader_t* rdr;
-    list_for_every_entry (&log->readers, rdr, dlog_reader_t, node) {
-        if (rdr->tail == log->head) {
-            // Reader view was empty, point reader's tail
-            // at the message we're writing now
-            rdr->tail = dst;
-        } else {
-            // If we're about to overwrite the message at
-            // the reader's tail, advance that tail.
-            // This will never cause the reader view to be "empty".
-            while ((rdr->tail >= dst) && (rdr->tail < end)) {
-                rdr->tail = REC(log->data, rdr->tail)->next;
-            }
-        }
-        event_signal(&rdr->event, false);
+    uint32_t sz = ALIGN8(sizeof(dlog_header_t) + sizeof(dlog_record_t) + len);
+
+    // Reserve the space, skipping the rest of the sync block if the record
+    // doesn't fit in it.
+    uint64_t pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+    uint64_t dst;
+    do {
+        dst = (sync_space(pos) < sz) ? round_up_sync(pos) : pos;
+    } while (!__atomic_compare_exchange_n(&log->head, &pos, dst + sz, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // Mark what was skipped, if it has room for a header. Readers skip
+    // anything smaller on their own.
+    if (dst != pos && sync_space(pos) >= sizeof(dlog_header_t)) {
+        dlog_header_t* pad = HDR(log, pos);
+        pad->size = sync_space(pos);
+        pad->padding = 1;
+        __atomic_store_n(&pad->pos, pos, __ATOMIC_RELEASE);
     }
 
     // Write the new record
-    dlog_record_t* rec = REC(log->data, dst);
-    rec->next = nxt;
+    dlog_header_t* hdr = HDR(log, dst);
+    hdr->size = sz;
+    hdr->padding = 0;
+    dlog_record_t* rec = (dlog_record_t*)(hdr + 1);
+    rec->reserved = 0;
     rec->datalen = len;
     rec->flags = flags;
     rec->timestamp = current_time_hires();
@@ -98,45 +110,119 @@ status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     rec->pid = t->user_pid;
     rec->tid = t->user_tid;
     memcpy(rec->data, ptr, len);
+    __atomic_store_n(&hdr->pos, dst, __ATOMIC_RELEASE);
 
-    // Advance the head pointer
-    log->head = nxt;
-
-    mutex_release(&log->lock);
+    // Wake the notifier to signal the readers, unless a writer already has.
+    // With interrupts disabled this could be inside the scheduler holding
+    // the thread lock, so leave it to the notifier to find the record.
+    if (!arch_ints_disabled() && !__atomic_exchange_n(&log->notify_pending, 1, __ATOMIC_ACQ_REL)) {
+        event_signal(&log->notify, false);
+    }
     return NO_ERROR;
 }
 
-// TODO: support reading multiple messages at a time
-// TODO: filter with flags
+// Copies the record at *tail into rec, at most DLOG_MAX_ENTRY bytes, and
+// advances *tail past it. Returns the record's size, 0 if there is nothing
+// to read yet, or skips over padding and records lost to writers lapping
+// the reader until it finds one.
+static size_t dlog_read_record(dlog_t* log, uint64_t* tail, dlog_record_t* rec) {
+    for (;;) {
+        uint64_t head = dlog_head(log);
+        uint64_t pos = *tail;
+        if (head - pos > log->size) {
+            // lapped: start again at the oldest sync point still there
+            pos = round_up_sync(head - log->size);
+        }
+        if (sync_space(pos) < sizeof(dlog_header_t)) {
+            pos = round_up_sync(pos);
+        }
+        *tail = pos;
+        if (pos >= head) {
+            return 0;
+        }
+
+        dlog_header_t* hdr = HDR(log, pos);
+        if (__atomic_load_n(&hdr->pos, __ATOMIC_ACQUIRE) != pos) {
+            // still being written
+            return 0;
+        }
+        uint32_t size = hdr->size;
+        uint32_t padding = hdr->padding;
+        size_t reclen = 0;
+        if (!padding && size >= sizeof(dlog_header_t) + sizeof(dlog_record_t)) {
+            reclen = MIN(size - sizeof(dlog_header_t), DLOG_MAX_ENTRY);
+            memcpy(rec, hdr + 1, reclen);
+        }
+
+        // anything a writer reserved while we were copying is garbage
+        if (dlog_head(log) - pos > log->size) {
+            continue;
+        }
+        if (size < sizeof(dlog_header_t) || size > sync_space(pos)) {
+            // can't happen for a record that wasn't overwritten
+            *tail = round_up_sync(pos + 1);
+            continue;
+        }
+        *tail = pos + size;
+        if (reclen) {
+            return MIN(sizeof(dlog_record_t) + rec->datalen, reclen);
+        }
+    }
+}
+
 status_t dlog_read_etc(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, bool user) {
     dlog_t* log = rdr->log;
-    status_t r = ERR_BAD_STATE;
-
-    mutex_acquire(&log->lock);
-    if (rdr->tail != log->head) {
-        dlog_record_t* rec = REC(log->data, rdr->tail);
-        size_t copylen = rec->datalen + sizeof(dlog_record_t);
-        if (copylen > len) {
-            r = ERR_BUFFER_TOO_SMALL;
-        } else {
-            if (user) {
-                r = copy_to_user_unsafe(ptr, rec, copylen);
-                if (r == NO_ERROR) {
-                    r = copylen;
+    union {
+        dlog_record_t rec;
+        uint8_t raw[DLOG_MAX_ENTRY];
+    } u;
+    size_t actual = 0;
+    status_t r = NO_ERROR;
+
+    mutex_acquire(&rdr->lock);
+    for (;;) {
+        uint64_t tail = rdr->tail;
+        size_t copylen = dlog_read_record(log, &tail, &u.rec);
+        if (copylen == 0) {
+            rdr->tail = tail;
+            if (actual == 0) {
+                // Nothing left to read. A record committed since we looked
+                // may have been signaled already, so look again after.
+                event_unsignal(&rdr->event);
+                if (dlog_read_record(log, &tail, &u.rec)) {
+                    event_signal(&rdr->event, false);
                 }
-            } else {
-                memcpy(ptr, rec, copylen);
-                r = copylen;
+                r = ERR_BAD_STATE;
             }
-            rdr->tail = rec->next;
-            if (rdr->tail == log->head) {
-                // Nothing left to read, we're in the "empty" state now.
-                event_unsignal(&rdr->event);
+            break;
+        }
+        if (actual + copylen > len) {
+            if (actual == 0) {
+                r = ERR_BUFFER_TOO_SMALL;
             }
+            break;
         }
+        if (user) {
+            r = copy_to_user_unsafe((uint8_t*)ptr + actual, &u.rec, copylen);
+            if (r != NO_ERROR) {
+                break;
+            }
+        } else {
+            memcpy((uint8_t*)ptr + actual, &u.rec, copylen);
+        }
+        rdr->tail = tail;
+        actual += ALIGN8(copylen);
+        if (!(flags & DLOG_FLAG_BATCH) || actual >= len) {
+            break;
+        }
+    }
+    mutex_release(&rdr->lock);
+
+    if (r < 0) {
+        return r;
     }
-    mutex_release(&log->lock);
-    return r;
+    // the last record doesn't need its padding
+    return (status_t)MIN(actual, len);
 }
 
 void dlog_reader_init(dlog_reader_t* rdr) {
@@ -144,29 +230,67 @@ void dlog_reader_init(dlog_reader_t* rdr) {
 
     rdr->log = log;
     event_init(&rdr->event, false, 0);
+    mutex_init(&rdr->lock);
 
-    mutex_acquire(&log->lock);
+    mutex_acquire(&log->readers_lock);
     list_add_tail(&log->readers, &rdr->node);
-    rdr->tail = log->tail;
-    if (log->head != log->tail) {
+    uint64_t head = dlog_head(log);
+    rdr->tail = (head > log->size) ? round_up_sync(head - log->size) : 0;
+    if (head != rdr->tail) {
         event_signal(&rdr->event, false);
     }
-    mutex_release(&log->lock);
+    mutex_release(&log->readers_lock);
 }
 
 void dlog_reader_destroy(dlog_reader_t* rdr) {
     dlog_t* log = rdr->log;
 
-    mutex_acquire(&log->lock);
+    mutex_acquire(&log->readers_lock);
     list_delete(&rdr->node);
     event_destroy(&rdr->event);
-    mutex_release(&log->lock);
+    mutex_destroy(&rdr->lock);
+    mutex_release(&log->readers_lock);
 }
 
 void dlog_wait(dlog_reader_t* rdr) {
     event_wait(&rdr->event);
 }
 
+// Signals the readers on behalf of the writers, which may not be able to.
+// It follows the log like a reader, so it signals only once records are
+// committed: a record reserved but not yet committed when it looks is found
+// on the wakeup its writer sends after committing, or on the next poll.
+static int debuglog_notifier(void* arg) {
+    dlog_t* log = &DLOG;
+    union {
+        dlog_record_t rec;
+        uint8_t raw[DLOG_MAX_ENTRY];
+    } u;
+    uint64_t tail = 0;
+
+    for (;;) {
+        event_wait_timeout(&log->notify, DLOG_NOTIFY_POLL_MS, false);
+        // pairs with the writers' exchange, so their records are visible below
+        __atomic_exchange_n(&log->notify_pending, 0, __ATOMIC_ACQ_REL);
+
+        bool committed = false;
+        while (dlog_read_record(log, &tail, &u.rec)) {
+            committed = true;
+        }
+        if (!committed) {
+            continue;
+        }
+
+        dlog_reader_t* rdr;
+        mutex_acquire(&log->readers_lock);
+        list_for_every_entry (&log->readers, rdr, dlog_reader_t, node) {
+            event_signal(&rdr->event, false);
+        }
+        mutex_release(&log->readers_lock);
+    }
+    return NO_ERROR;
+}
+
 static void cputs(const char* data, size_t len) {
     while (len-- > 0) {
         char c = *data++;
@@ -187,6 +311,9 @@ static int debuglog_reader(void* arg) {
     for (;;) {
         dlog_wait(&reader);
         while (dlog_read(&reader, 0, rec, DLOG_MAX_ENTRY) > 0) {
+            if (rec->flags & DLOG_FLAG_ECHOED) {
+                continue;
+            }
             if (rec->datalen && (rec->data[rec->datalen - 1] == '\n')) {
                 rec->data[rec->datalen - 1] = 0;
             } else {
@@ -210,28 +337,16 @@ static int debuglog_reader(void* arg) {
 
 #if REPLAY_LOG
 static status_t dlog_read_unsafe(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len) {
-    dlog_t* log = rdr->log;
-    status_t r = ERR_BAD_STATE;
-
-    if (rdr->tail != log->head) {
-        dlog_record_t* rec = REC(log->data, rdr->tail);
-        size_t copylen = rec->datalen + sizeof(dlog_record_t);
-        if (copylen > len) {
-            r = ERR_BUFFER_TOO_SMALL;
-        } else {
-            memcpy(ptr, rec, copylen);
-            r = copylen;
-            rdr->tail = rec->next;
-        }
-    }
-    return r;
+    size_t copylen = dlog_read_record(rdr->log, &rdr->tail, ptr);
+    return copylen ? (status_t)copylen : ERR_BAD_STATE;
 }
 
 static void dlog_reader_init_unsafe(dlog_reader_t* rdr) {
     dlog_t* log = &DLOG;
     memset(rdr, 0, sizeof(dlog_reader_t));
     rdr->log = log;
-    rdr->tail = log->tail;
+    uint64_t head = dlog_head(log);
+    rdr->tail = (head > log->size) ? round_up_sync(head - log->size) : 0;
 }
 #endif
 
@@ -264,6 +379,11 @@ void dlog_bluescreen_init(void) {
 }
 
 static void dlog_init_hook(uint level) {
+    thread_t* nthread = thread_create("debuglog-notifier", debuglog_notifier, NULL,
+                                      HIGH_PRIORITY - 1, DEFAULT_STACK_SIZE);
+    if (nthread) {
+        thread_resume(nthread);
+    }
     thread_t* rthread = thread_create("debuglog-reader", debuglog_reader, NULL,
                                       HIGH_PRIORITY - 1, DEFAULT_STACK_SIZE);
     if (rthread) {
@@ -29,6 +29,11 @@ __BEGIN_CDECLS
 #define DLOG_FLAG_MASK      0x0F00
 
 #define DLOG_FLAG_WAIT      0x80000000
+#define DLOG_FLAG_BATCH     0x20000000
+
+// The record was printed to the console when it was written, so the
+// debuglog reader thread leaves it out.
+#define DLOG_FLAG_ECHOED    0x1000
 
 #define DLOG_MAX_ENTRY      256
 // clang-format on
@@ -37,15 +42,22 @@ typedef struct dlog dlog_t;
 typedef struct dlog_record dlog_record_t;
 typedef struct dlog_reader dlog_reader_t;
 
+// The log is a ring that writers reserve space in without taking a lock,
+// so any number of cpus can write at once, interrupt handlers included.
+// |head| counts the bytes ever reserved, the record at position p being at
+// offset p % size. Each record is committed once it is written, and readers
+// stop at the first one still being written.
 struct dlog {
-    mutex_t lock;
-
     uint32_t size;
-    uint32_t head;
-    uint32_t tail;
+    uint64_t head;
     bool paused;
     void* data;
 
+    // set by the writer that signals |notify|, cleared by the notifier thread
+    int notify_pending;
+    event_t notify;
+
+    mutex_t readers_lock;
     struct list_node readers;
 };
 
@@ -53,11 +65,15 @@ struct dlog_reader {
     struct list_node node;
     event_t event;
     dlog_t* log;
-    uint32_t tail;
+
+    // serializes readers sharing the reader
+    mutex_t lock;
+    // position of the next record to read
+    uint64_t tail;
 };
 
 struct dlog_record {
-    uint32_t next;
+    uint32_t reserved;
     uint16_t datalen;
     uint16_t flags;
     uint64_t timestamp;
@@ -69,6 +85,9 @@ struct dlog_record {
 void dlog_reader_init(dlog_reader_t* rdr);
 void dlog_reader_destroy(dlog_reader_t* rdr);
 status_t dlog_write(uint32_t flags, const void* ptr, size_t len);
+// Copies out the next record, or with DLOG_FLAG_BATCH as many as fit in |len|,
+// each starting 8 byte aligned. Returns the bytes copied out, or ERR_BAD_STATE
+// if there is nothing to read.
 status_t dlog_read_etc(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, bool user);
 static inline status_t dlog_read(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len) {
     return dlog_read_etc(rdr, flags, ptr, len, false);
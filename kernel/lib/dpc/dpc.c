@@ -12,25 +12,40 @@
 
 #include <kernel/event.h>
 #include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <lk/init.h>
+#include <stdio.h>
 
-static spin_lock_t dpc_lock = SPIN_LOCK_INITIAL_VALUE;
-static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
-static event_t dpc_event = EVENT_INITIAL_VALUE(dpc_event, false, 0);
+// Each cpu queues dpcs on its own list, worked by its own thread, so that
+// deferred work queued from interrupt handlers on different cpus doesn't
+// serialize on one lock and one thread.  A dpc thread isn't pinned, but being
+// woken from its cpu it tends to run there.
+struct dpc_queue {
+    spin_lock_t lock;
+    struct list_node list;
+    event_t event;
+};
+
+static struct dpc_queue dpc_queues[SMP_MAX_CPUS];
 
 status_t dpc_queue(dpc_t *dpc, bool reschedule)
 {
     DEBUG_ASSERT(dpc);
     DEBUG_ASSERT(dpc->func);
 
+    // disable interrupts so that we stay on this cpu until the dpc is queued
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&dpc_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    struct dpc_queue *q = &dpc_queues[arch_curr_cpu_num()];
+
+    spin_lock(&q->lock);
 
     // put the dpc at the tail of the list and signal the worker
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal(&dpc_event, false);
+    list_add_tail(&q->list, &dpc->node);
+    event_signal(&q->event, false);
 
-    spin_unlock_irqrestore(&dpc_lock, state);
+    spin_unlock(&q->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     // reschedule here if asked to
     if (reschedule)
@@ -41,22 +56,24 @@ status_t dpc_queue(dpc_t *dpc, bool reschedule)
 
 static int dpc_thread(void *arg)
 {
+    struct dpc_queue *q = arg;
+
     for (;;) {
         // wait for a dpc to fire
-        __UNUSED status_t err = event_wait(&dpc_event);
+        __UNUSED status_t err = event_wait(&q->event);
         DEBUG_ASSERT(err == NO_ERROR);
 
         spin_lock_saved_state_t state;
-        spin_lock_irqsave(&dpc_lock, state);
+        spin_lock_irqsave(&q->lock, state);
 
         // pop a dpc off the list
-        dpc_t *dpc = list_remove_head_type(&dpc_list, dpc_t, node);
+        dpc_t *dpc = list_remove_head_type(&q->list, dpc_t, node);
 
         // if the list is now empty, unsignal the event so we block until it is
         if (!dpc)
-            event_unsignal(&dpc_event);
+            event_unsignal(&q->event);
 
-        spin_unlock_irqrestore(&dpc_lock, state);
+        spin_unlock_irqrestore(&q->lock, state);
 
         // call the dpc
         if (dpc && dpc->func)
@@ -67,10 +84,20 @@ static int dpc_thread(void *arg)
     return 0;
 }
 
+// runs on each cpu as it comes up, so only cpus that are present get a dpc
+// thread.  a cpu can't queue a dpc before it gets here.
 static void dpc_init(unsigned int level)
 {
-    thread_t *t = thread_create("dpc", &dpc_thread, NULL, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    uint cpu = arch_curr_cpu_num();
+    struct dpc_queue *q = &dpc_queues[cpu];
+    spin_lock_init(&q->lock);
+    list_initialize(&q->list);
+    event_init(&q->event, false, 0);
+
+    char name[16];
+    snprintf(name, sizeof(name), "dpc %u", cpu);
+    thread_t *t = thread_create(name, &dpc_thread, q, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
     thread_detach_and_resume(t);
 }
 
-LK_INIT_HOOK(dpc, dpc_init, LK_INIT_LEVEL_THREADING);
+LK_INIT_HOOK_FLAGS(dpc, dpc_init, LK_INIT_LEVEL_THREADING, LK_INIT_FLAG_ALL_CPUS);
@@ -172,160 +172,94 @@ static void putpixel8(gfx_surface *surface, uint x, uint y, uint color)
     *dest = (uint8_t)(surface->translate_color(color));
 }
 
-static void copyrect8(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
-{
-    // copy
-    const uint8_t *src = &((const uint8_t *)surface->ptr)[x + y * surface->stride];
-    uint8_t *dest = &((uint8_t *)surface->ptr)[x2 + y2 * surface->stride];
-    uint stride_diff = surface->stride - width;
+// Row kernels. The kernel is built without the FPU, so these work a row at
+// a time with memmove()/memset() and word stores rather than vector code.
 
-    if (dest < src) {
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
+static void fill32(uint32_t *dest, uint32_t color, size_t count)
+{
+    if (count && ((uintptr_t)dest & 4)) {
+        *dest++ = color;
+        count--;
+    }
+    uint64_t *dest64 = (uint64_t *)dest;
+    uint64_t color64 = color | ((uint64_t)color << 32);
+    for (size_t i = 0; i < count / 2; i++) {
+        *dest64++ = color64;
+    }
+    if (count & 1) {
+        dest[count - 1] = color;
     }
 }
 
-static void fillrect8(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
+static void fill16(uint16_t *dest, uint16_t color, size_t count)
 {
-    uint8_t *dest = &((uint8_t *)surface->ptr)[x + y * surface->stride];
-    uint stride_diff = surface->stride - width;
-
-    uint8_t color8 = (uint8_t)(surface->translate_color(color));
-
-    uint i, j;
-    for (i=0; i < height; i++) {
-        for (j=0; j < width; j++) {
-            *dest = color8;
-            dest++;
-        }
-        dest += stride_diff;
+    if (count && ((uintptr_t)dest & 2)) {
+        *dest++ = color;
+        count--;
+    }
+    fill32((uint32_t *)dest, color | ((uint32_t)color << 16), count / 2);
+    if (count & 1) {
+        dest[count - 1] = color;
     }
 }
 
-static void copyrect16(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
+// Copies a rectangle within a surface a row at a time, in the order that
+// keeps overlapping source rows intact.
+static void copyrect(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
 {
-    // copy
-    const uint16_t *src = &((const uint16_t *)surface->ptr)[x + y * surface->stride];
-    uint16_t *dest = &((uint16_t *)surface->ptr)[x2 + y2 * surface->stride];
-    uint stride_diff = surface->stride - width;
+    size_t stride = surface->stride * surface->pixelsize;
+    size_t len = width * surface->pixelsize;
+    const uint8_t *src = (const uint8_t *)surface->ptr + x * surface->pixelsize + y * stride;
+    uint8_t *dest = (uint8_t *)surface->ptr + x2 * surface->pixelsize + y2 * stride;
 
     if (dest < src) {
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
+        for (uint i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest += stride;
+            src += stride;
         }
     } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
+        src += (height - 1) * stride;
+        dest += (height - 1) * stride;
+        for (uint i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest -= stride;
+            src -= stride;
         }
     }
 }
 
-static void fillrect16(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
+static void fillrect8(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
 {
-    uint16_t *dest = &((uint16_t *)surface->ptr)[x + y * surface->stride];
-    uint stride_diff = surface->stride - width;
+    uint8_t *dest = &((uint8_t *)surface->ptr)[x + y * surface->stride];
 
-    uint16_t color16 = (uint16_t)(surface->translate_color(color));
+    uint8_t color8 = (uint8_t)(surface->translate_color(color));
 
-    uint i, j;
-    for (i=0; i < height; i++) {
-        for (j=0; j < width; j++) {
-            *dest = color16;
-            dest++;
-        }
-        dest += stride_diff;
+    for (uint i = 0; i < height; i++) {
+        memset(dest, color8, width);
+        dest += surface->stride;
     }
 }
 
-static void copyrect32(gfx_surface *surface, uint x, uint y, uint width, uint height, uint x2, uint y2)
+static void fillrect16(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
 {
-    // copy
-    const uint32_t *src = &((const uint32_t *)surface->ptr)[x + y * surface->stride];
-    uint32_t *dest = &((uint32_t *)surface->ptr)[x2 + y2 * surface->stride];
-    uint stride_diff = surface->stride - width;
+    uint16_t *dest = &((uint16_t *)surface->ptr)[x + y * surface->stride];
 
-    if (dest < src) {
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
+    uint16_t color16 = (uint16_t)(surface->translate_color(color));
 
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
+    for (uint i = 0; i < height; i++) {
+        fill16(dest, color16, width);
+        dest += surface->stride;
     }
 }
 
 static void fillrect32(gfx_surface *surface, uint x, uint y, uint width, uint height, uint color)
 {
     uint32_t *dest = &((uint32_t *)surface->ptr)[x + y * surface->stride];
-    uint stride_diff = surface->stride - width;
 
-    uint i, j;
-    for (i=0; i < height; i++) {
-        for (j=0; j < width; j++) {
-            *dest = color;
-            dest++;
-        }
-        dest += stride_diff;
+    for (uint i = 0; i < height; i++) {
+        fill32(dest, color, width);
+        dest += surface->stride;
     }
 }
 
@@ -443,26 +377,7 @@ void gfx_surface_blend(struct gfx_surface *target, struct gfx_surface *source, u
         height = target->height - desty;
 
     // XXX total hack to deal with various blends
-    if (source->format == GFX_FORMAT_RGB_565 && target->format == GFX_FORMAT_RGB_565) {
-        // 16 bit to 16 bit
-        const uint16_t *src = (const uint16_t *)source->ptr;
-        uint16_t *dest = &((uint16_t *)target->ptr)[destx + desty * target->stride];
-        uint dest_stride_diff = target->stride - width;
-        uint source_stride_diff = source->stride - width;
-
-        LTRACEF("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
-    } else if (source->format == GFX_FORMAT_ARGB_8888 && target->format == GFX_FORMAT_ARGB_8888) {
+    if (source->format == GFX_FORMAT_ARGB_8888 && target->format == GFX_FORMAT_ARGB_8888) {
         // both are 32 bit modes, both alpha
         const uint32_t *src = (const uint32_t *)source->ptr;
         uint32_t *dest = &((uint32_t *)target->ptr)[destx + desty * target->stride];
@@ -482,43 +397,22 @@ void gfx_surface_blend(struct gfx_surface *target, struct gfx_surface *source, u
             dest += dest_stride_diff;
             src += source_stride_diff;
         }
-    } else if (source->format == GFX_FORMAT_RGB_x888 && target->format == GFX_FORMAT_RGB_x888) {
-        // both are 32 bit modes, no alpha
-        const uint32_t *src = (const uint32_t *)source->ptr;
-        uint32_t *dest = &((uint32_t *)target->ptr)[destx + desty * target->stride];
-        uint dest_stride_diff = target->stride - width;
-        uint source_stride_diff = source->stride - width;
-
-        LTRACEF("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
-    } else if (source->format == GFX_FORMAT_MONO && target->format == GFX_FORMAT_MONO) {
-        // both are 8 bit modes, no alpha
+    } else if ((source->format == target->format) &&
+               ((source->format == GFX_FORMAT_RGB_565) ||
+                (source->format == GFX_FORMAT_RGB_x888) ||
+                (source->format == GFX_FORMAT_MONO))) {
+        // same format, no alpha
+        size_t dest_stride = target->stride * target->pixelsize;
+        size_t source_stride = source->stride * source->pixelsize;
         const uint8_t *src = (const uint8_t *)source->ptr;
-        uint8_t *dest = &((uint8_t *)target->ptr)[destx + desty * target->stride];
-        uint dest_stride_diff = target->stride - width;
-        uint source_stride_diff = source->stride - width;
+        uint8_t *dest = (uint8_t *)target->ptr + destx * target->pixelsize + desty * dest_stride;
 
-        LTRACEF("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
+        LTRACEF("w %u h %u dstride %zu sstride %zu\n", width, height, dest_stride, source_stride);
 
-        uint i, j;
-        for (i=0; i < height; i++) {
-            for (j=0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+        for (uint i = 0; i < height; i++) {
+            memcpy(dest, src, width * source->pixelsize);
+            dest += dest_stride;
+            src += source_stride;
         }
     } else {
         panic("gfx_surface_blend: unimplemented colorspace combination (source %u target %u)\n", source->format, target->format);
@@ -594,7 +488,7 @@ int gfx_init_surface(gfx_surface *surface, void *ptr, uint width, uint height, u
     switch (format) {
         case GFX_FORMAT_RGB_565:
             surface->translate_color = &ARGB8888_to_RGB565;
-            surface->copyrect = &copyrect16;
+            surface->copyrect = &copyrect;
             surface->fillrect = &fillrect16;
             surface->putpixel = &putpixel16;
             surface->pixelsize = 2;
@@ -603,7 +497,7 @@ int gfx_init_surface(gfx_surface *surface, void *ptr, uint width, uint height, u
         case GFX_FORMAT_RGB_x888:
         case GFX_FORMAT_ARGB_8888:
             surface->translate_color = NULL;
-            surface->copyrect = &copyrect32;
+            surface->copyrect = &copyrect;
             surface->fillrect = &fillrect32;
             surface->putpixel = &putpixel32;
             surface->pixelsize = 4;
@@ -611,7 +505,7 @@ int gfx_init_surface(gfx_surface *surface, void *ptr, uint width, uint height, u
             break;
         case GFX_FORMAT_MONO:
             surface->translate_color = &ARGB8888_to_Luma;
-            surface->copyrect = &copyrect8;
+            surface->copyrect = &copyrect;
             surface->fillrect = &fillrect8;
             surface->putpixel = &putpixel8;
             surface->pixelsize = 1;
@@ -619,7 +513,7 @@ int gfx_init_surface(gfx_surface *surface, void *ptr, uint width, uint height, u
             break;
         case GFX_FORMAT_RGB_332:
             surface->translate_color = &ARGB8888_to_RGB332;
-            surface->copyrect = &copyrect8;
+            surface->copyrect = &copyrect;
             surface->fillrect = &fillrect8;
             surface->putpixel = &putpixel8;
             surface->pixelsize = 1;
@@ -627,7 +521,7 @@ int gfx_init_surface(gfx_surface *surface, void *ptr, uint width, uint height, u
             break;
         case GFX_FORMAT_RGB_2220:
             surface->translate_color = &ARGB8888_to_RGB2220;
-            surface->copyrect = &copyrect8;
+            surface->copyrect = &copyrect;
             surface->fillrect = &fillrect8;
             surface->putpixel = &putpixel8;
             surface->pixelsize = 1;
@@ -44,7 +44,7 @@ static struct {
     // underlying hw surface, if different from above
     gfx_surface *hw_surface;
 
-    // surface to do single line sub-region flushing with
+    // surface to do sub-region flushing of the dirty rows with
     gfx_surface line;
     uint linestride;
 
@@ -53,25 +53,36 @@ static struct {
 
     uint x, y;
 
+    // text rows drawn since the last flush, [dirty_y0, dirty_y1)
+    uint dirty_y0, dirty_y1;
+
     uint32_t front_color;
     uint32_t back_color;
 } gfxconsole;
 
+static void mark_dirty(uint y0, uint y1)
+{
+    if (y0 < gfxconsole.dirty_y0)
+        gfxconsole.dirty_y0 = y0;
+    if (y1 > gfxconsole.dirty_y1)
+        gfxconsole.dirty_y1 = y1;
+}
+
 static void draw_char(char c)
 {
     font_draw_char(gfxconsole.surface, c, gfxconsole.x * FONT_X, gfxconsole.y * FONT_Y,
                    gfxconsole.front_color, gfxconsole.back_color);
+    mark_dirty(gfxconsole.y, gfxconsole.y + 1);
 }
 
 void gfxconsole_putpixel(unsigned x, unsigned y, unsigned color) {
     gfx_putpixel(gfxconsole.surface, x, y, color);
 }
 
-static bool gfxconsole_putc(char c)
+static void gfxconsole_putc(char c)
 {
     static enum { NORMAL, ESCAPE } state = NORMAL;
     static uint32_t p_num = 0;
-    bool inval = 0;
 
     if (state == NORMAL) {
         switch (c) {
@@ -80,7 +91,6 @@ static bool gfxconsole_putc(char c)
                 break;
             case '\n':
                 gfxconsole.y++;
-                inval = 1;
                 break;
             case '\b':
                 // back up one character unless we're at the left side
@@ -119,7 +129,6 @@ static bool gfxconsole_putc(char c)
     if (gfxconsole.x >= gfxconsole.columns) {
         gfxconsole.x = 0;
         gfxconsole.y++;
-        inval = 1;
     }
     if (gfxconsole.y >= gfxconsole.rows) {
         // scroll up
@@ -130,36 +139,38 @@ static bool gfxconsole_putc(char c)
         // clear the bottom line
         gfx_fillrect(gfxconsole.surface, 0, gfxconsole.surface->height - FONT_Y - gfxconsole.extray,
                      gfxconsole.surface->width, FONT_Y, gfxconsole.back_color);
-        gfx_flush(gfxconsole.surface);
-        inval = 1;
+        mark_dirty(0, gfxconsole.rows);
     }
-    return inval;
 }
 
 static void gfxconsole_print_callback(print_callback_t *cb, const char *str, size_t len)
 {
-    int refresh_full_screen = 0;
     for (size_t i = 0; i < len; i++) {
         if (str[i] == '\n')
             gfxconsole_putc('\r');
-        refresh_full_screen |= gfxconsole_putc(str[i]);
+        gfxconsole_putc(str[i]);
     }
 
+    // Only the rows drawn into since the last call go out. This runs on
+    // every print, including from panic, so it flushes right away rather
+    // than waiting for a later frame.
+    uint y0 = gfxconsole.dirty_y0;
+    uint y1 = gfxconsole.dirty_y1;
+    if (y0 >= y1)
+        return;
+    gfxconsole.dirty_y0 = gfxconsole.rows;
+    gfxconsole.dirty_y1 = 0;
+
     // blit from the software surface to the hardware
     if (gfxconsole.surface != gfxconsole.hw_surface) {
-        if (refresh_full_screen) {
-            gfx_surface_blend(gfxconsole.hw_surface, gfxconsole.surface, 0, 0);
-        } else {
-            // Only re-blit the active console line.
-            // Since blend only works in whole surfaces, configure a sub-surface
-            // to use as the blend source.
-            gfxconsole.line.ptr = ((uint8_t*) gfxconsole.surface->ptr) +
-                (gfxconsole.y * gfxconsole.linestride);
-            gfx_surface_blend(gfxconsole.hw_surface, &gfxconsole.line,
-                0, gfxconsole.y * FONT_Y);
-        }
-        gfx_flush(gfxconsole.hw_surface);
+        // Since blend only works in whole surfaces, configure a sub-surface
+        // of the dirty rows to use as the blend source.
+        gfxconsole.line.ptr = ((uint8_t*) gfxconsole.surface->ptr) +
+            (y0 * gfxconsole.linestride);
+        gfxconsole.line.height = (y1 - y0) * FONT_Y;
+        gfx_surface_blend(gfxconsole.hw_surface, &gfxconsole.line, 0, y0 * FONT_Y);
     }
+    gfx_flush_rows(gfxconsole.hw_surface, y0 * FONT_Y, y1 * FONT_Y - 1);
 }
 
 static print_callback_t cb = {
@@ -184,6 +195,9 @@ static void gfxconsole_setup(gfx_surface *surface, gfx_surface *hw_surface)
     gfxconsole.columns = surface->width / FONT_X;
     gfxconsole.extray = surface->height - (gfxconsole.rows * FONT_Y);
 
+    gfxconsole.dirty_y0 = gfxconsole.rows;
+    gfxconsole.dirty_y1 = 0;
+
     dprintf(SPEW, "gfxconsole: rows %u, columns %u, extray %u\n", gfxconsole.rows,
             gfxconsole.columns, gfxconsole.extray);
 }
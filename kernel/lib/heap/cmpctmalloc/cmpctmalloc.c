@@ -13,18 +13,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
+#include <arch/mmu.h>
+#include <arch/ops.h>
+#include <kernel/mp.h>
 #include <kernel/thread.h>
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
+#include <kernel/vm.h>
 #include <lib/cmpctmalloc.h>
 #include <lib/heap.h>
 #include <lib/page_alloc.h>
+#include <lk/init.h>
 
 // Malloc implementation tuned for space.
 //
 // Allocation strategy takes place with a global mutex.  Freelist entries are
 // kept in linked lists with 8 different sizes per binary order of magnitude
-// and the header size is two words with eager coalescing on free.
+// and the header size is two words with eager coalescing on free.  Small
+// allocations are cached in per-cpu magazines in front of the global free
+// lists, see below.  Allocations of HEAP_MAPPED_ALLOC_THRESHOLD and up bypass
+// all that and get a kernel mapping of their own.
 
 #if defined(DEBUG) || LK_DEBUGLEVEL > 2
 #define CMPCT_DEBUG
@@ -46,6 +54,15 @@ static_assert(IS_PAGE_ALIGNED(HEAP_GROW_SIZE), "");
 // block allocator.
 #define HEAP_ALLOC_VIRTUAL_BITS 22
 
+// Once the VM is up, allocations this large get their own mapping of freshly
+// allocated pages in the kernel address space, which go straight back to the
+// pmm when freed, rather than being carved out of the heap where they would
+// fragment it and keep it from shrinking.  The pages needn't be physically
+// contiguous either.
+#if !defined(HEAP_MAPPED_ALLOC_THRESHOLD)
+#define HEAP_MAPPED_ALLOC_THRESHOLD (64 * 1024)
+#endif
+
 // When we grow the heap we have to have somewhere in the freelist to put the
 // resulting freelist entry, so the freelist has to have a certain number of
 // buckets.
@@ -80,12 +97,51 @@ struct heap {
     // freelist.
 #define BUCKET_WORDS (((NUMBER_OF_BUCKETS) + 31) >> 5)
     uint32_t free_list_bits[BUCKET_WORDS];
+    // Mapped allocations, updated atomically without the lock.
+    size_t mapped_count;
+    size_t mapped_size;
 };
 
 // Heap static vars.
 static struct heap theheap;
 
+// Per-cpu magazines.
+//
+// Each cpu keeps a magazine of recently freed allocations for every bucket up
+// to MAGAZINE_MAX_SIZE bytes, so that most small malloc/free pairs never take
+// theheap.lock.  The rounds in a magazine are still allocations as far as the
+// free lists are concerned, so they don't coalesce until they are spilled back
+// or drained by cmpct_trim().  A magazine is only touched by its own cpu, with
+// interrupts disabled.  Empty magazines are refilled and full ones spilled
+// MAGAZINE_BATCH rounds at a time under a single lock acquisition.
+#define MAGAZINE_MAX_SIZE 256
+#define MAGAZINE_ROUNDS 16
+#define MAGAZINE_BATCH (MAGAZINE_ROUNDS / 2)
+// The buckets up to and including the one for MAGAZINE_MAX_SIZE.
+#define NUMBER_OF_MAGAZINES 24
+
+typedef struct magazine {
+    size_t count;
+    void *rounds[MAGAZINE_ROUNDS];
+} magazine_t;
+
+static magazine_t magazines[SMP_MAX_CPUS][NUMBER_OF_MAGAZINES];
+static bool magazines_enabled;
+
+// The header in front of a mapped allocation has this for its left pointer,
+// which can't be mistaken for a real one, nor for a free area's tagged one,
+// and the size of the whole mapping for its size.
+#define MAPPED_ALLOCATION_LEFT ((header_t *)2)
+
+static bool mapped_allocs_enabled;
+
 static ssize_t heap_grow(size_t len, free_t **bucket);
+static void *heap_alloc(size_t size);
+static void *mapped_alloc(size_t size, size_t alignment);
+static bool is_mapped_allocation(void *payload);
+static void *alloc_locked(size_t size) TA_REQ(theheap.lock);
+static void free_locked(void *payload) TA_REQ(theheap.lock);
+static size_t magazine_count_rounds(void);
 
 static void lock(void) TA_ACQ(theheap.lock)
 {
@@ -110,6 +166,10 @@ void cmpct_dump(void)
     dprintf(INFO, "\tsize %lu, remaining %lu\n",
             (unsigned long)theheap.size,
             (unsigned long)theheap.remaining);
+    dprintf(INFO, "\tcached in magazines %zu\n", magazine_count_rounds());
+    dprintf(INFO, "\tmapped allocations %zu, size %zu\n",
+            __atomic_load_n(&theheap.mapped_count, __ATOMIC_RELAXED),
+            __atomic_load_n(&theheap.mapped_size, __ATOMIC_RELAXED));
 
     dprintf(INFO, "\tfree list:\n");
     for (int i = 0; i < NUMBER_OF_BUCKETS; i++) {
@@ -449,6 +509,9 @@ static void cmpct_test_buckets(void)
 {
     size_t rounded;
     unsigned bucket;
+    // Every size that can be cached has a magazine.
+    ASSERT(size_to_index_allocating(MAGAZINE_MAX_SIZE, &rounded) == NUMBER_OF_MAGAZINES - 1);
+    ASSERT(rounded == MAGAZINE_MAX_SIZE);
     // Check for the 8-spaced buckets up to 128.
     for (unsigned i = 1; i <= 128; i++) {
         // Round up when allocating.
@@ -538,6 +601,23 @@ static void cmpct_test_get_back_newly_freed(void)
     }
 }
 
+static void cmpct_test_magazines(void)
+{
+    // Enough to fill, spill and refill a magazine a few times over.
+    void *ptr[MAGAZINE_ROUNDS * 3];
+    for (size_t size = 8; size <= MAGAZINE_MAX_SIZE; size += 40) {
+        for (size_t i = 0; i < countof(ptr); i++) {
+            ptr[i] = cmpct_alloc(size);
+            ASSERT(ptr[i] != NULL);
+            ASSERT(i == 0 || ptr[i] != ptr[i - 1]);
+            memset(ptr[i], 0, size);
+        }
+        for (size_t i = 0; i < countof(ptr); i++) {
+            cmpct_free(ptr[i]);
+        }
+    }
+}
+
 static void cmpct_test_return_to_os(void)
 {
     cmpct_trim();
@@ -558,10 +638,43 @@ static void cmpct_test_return_to_os(void)
     ASSERT(remaining == theheap.remaining);
 }
 
+static void cmpct_test_mapped(void)
+{
+    if (!mapped_allocs_enabled) return;
+    size_t mapped_count = theheap.mapped_count;
+
+    char *a = cmpct_alloc(HEAP_MAPPED_ALLOC_THRESHOLD);
+    ASSERT(is_mapped_allocation(a));
+    memset(a, 0x11, HEAP_MAPPED_ALLOC_THRESHOLD);
+    char *b = cmpct_memalign(HEAP_MAPPED_ALLOC_THRESHOLD + 1, PAGE_SIZE);
+    ASSERT(is_mapped_allocation(b));
+    ASSERT(IS_PAGE_ALIGNED(b));
+    memset(b, 0x22, HEAP_MAPPED_ALLOC_THRESHOLD + 1);
+    ASSERT(theheap.mapped_count == mapped_count + 2);
+
+    // Growing into and shrinking out of a mapping keeps the contents.
+    char *c = cmpct_alloc(100);
+    memset(c, 0x33, 100);
+    c = cmpct_realloc(c, HEAP_MAPPED_ALLOC_THRESHOLD * 2);
+    ASSERT(is_mapped_allocation(c));
+    ASSERT(c[0] == 0x33 && c[99] == 0x33);
+    c = cmpct_realloc(c, 50);
+    ASSERT(!is_mapped_allocation(c));
+    ASSERT(c[0] == 0x33 && c[49] == 0x33);
+
+    ASSERT(a[HEAP_MAPPED_ALLOC_THRESHOLD - 1] == 0x11);
+    ASSERT(b[HEAP_MAPPED_ALLOC_THRESHOLD] == 0x22);
+    cmpct_free(a);
+    cmpct_free(b);
+    cmpct_free(c);
+}
+
 void cmpct_test(void)
 {
     cmpct_test_buckets();
     cmpct_test_get_back_newly_freed();
+    cmpct_test_magazines();
+    cmpct_test_mapped();
     cmpct_test_return_to_os();
     cmpct_test_trim();
     cmpct_dump();
@@ -618,6 +731,139 @@ void cmpct_test(void)
     cmpct_dump();
 }
 
+// The magazine serving allocations of |size|, or -1 if they bypass them.
+static int size_to_magazine(size_t size)
+{
+    if (!magazines_enabled || size > MAGAZINE_MAX_SIZE) return -1;
+    size_t rounded_up;
+    size_to_index_allocating(size, &rounded_up);
+    return size_to_index_freeing(rounded_up);
+}
+
+// The magazine an allocation can be cached in, or -1 if it isn't exactly the
+// size of a bucket that can be.
+static int allocation_to_magazine(void *payload)
+{
+    if (!magazines_enabled) return -1;
+    size_t size = ((header_t *)payload - 1)->size - sizeof(header_t);
+    if (size > MAGAZINE_MAX_SIZE) return -1;
+    size_t rounded_up;
+    size_to_index_allocating(size, &rounded_up);
+    if (rounded_up != size) return -1;
+    return size_to_index_freeing(size);
+}
+
+static void *magazine_alloc(int index)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    magazine_t *magazine = &magazines[arch_curr_cpu_num()][index];
+    void *result = NULL;
+    if (magazine->count > 0) result = magazine->rounds[--magazine->count];
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return result;
+}
+
+// Put |payload| in the current cpu's magazine.  If the magazine was full its
+// oldest MAGAZINE_BATCH rounds are moved to |flushed| for the caller to free,
+// and the number of them is returned.
+static size_t magazine_free(int index, void *payload, void **flushed)
+{
+    size_t flush_count = 0;
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    magazine_t *magazine = &magazines[arch_curr_cpu_num()][index];
+    if (magazine->count == MAGAZINE_ROUNDS) {
+        flush_count = MAGAZINE_BATCH;
+        memcpy(flushed, magazine->rounds, flush_count * sizeof(void *));
+        memmove(magazine->rounds, magazine->rounds + flush_count,
+                (MAGAZINE_ROUNDS - flush_count) * sizeof(void *));
+        magazine->count -= flush_count;
+    }
+    magazine->rounds[magazine->count++] = payload;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return flush_count;
+}
+
+// Load up to MAGAZINE_BATCH more allocations of |size| into the current cpu's
+// magazine.
+static void magazine_fill(int index, size_t size) TA_REQ(theheap.lock)
+{
+    size_t rounded_up;
+    size_to_index_allocating(size, &rounded_up);
+
+    void *rounds[MAGAZINE_BATCH];
+    size_t count = 0;
+    while (count < MAGAZINE_BATCH) {
+        void *round = alloc_locked(size);
+        if (round == NULL) break;
+        // Only exact fits can go in the magazine, since that's what the free
+        // path expects.
+        if (((header_t *)round - 1)->size != rounded_up + sizeof(header_t)) {
+            free_locked(round);
+            break;
+        }
+        rounds[count++] = round;
+    }
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    magazine_t *magazine = &magazines[arch_curr_cpu_num()][index];
+    while (count > 0 && magazine->count < MAGAZINE_ROUNDS)
+        magazine->rounds[magazine->count++] = rounds[--count];
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // We may have migrated to a cpu whose magazine had less room.
+    while (count > 0) free_locked(rounds[--count]);
+}
+
+typedef struct magazine_drain {
+    spin_lock_t lock;
+    void *rounds;  // Chained through their first word.
+} magazine_drain_t;
+
+static void magazine_drain_task(void *context)
+{
+    magazine_drain_t *drain = context;
+    spin_lock(&drain->lock);
+    for (int i = 0; i < NUMBER_OF_MAGAZINES; i++) {
+        magazine_t *magazine = &magazines[arch_curr_cpu_num()][i];
+        while (magazine->count > 0) {
+            void *round = magazine->rounds[--magazine->count];
+            *(void **)round = drain->rounds;
+            drain->rounds = round;
+        }
+    }
+    spin_unlock(&drain->lock);
+}
+
+// Return every cpu's cached rounds to the free lists.
+static void magazine_drain_all(void)
+{
+    if (!magazines_enabled) return;
+
+    magazine_drain_t drain = { .lock = SPIN_LOCK_INITIAL_VALUE, .rounds = NULL };
+    mp_sync_exec(MP_CPU_ALL, magazine_drain_task, &drain);
+
+    lock();
+    while (drain.rounds != NULL) {
+        void *next = *(void **)drain.rounds;
+        free_locked(drain.rounds);
+        drain.rounds = next;
+    }
+    unlock();
+}
+
+static size_t magazine_count_rounds(void)
+{
+    size_t count = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (int i = 0; i < NUMBER_OF_MAGAZINES; i++)
+            count += magazines[cpu][i].count;
+    }
+    return count;
+}
+
 static void *large_alloc(size_t size)
 {
 #ifdef CMPCT_DEBUG
@@ -648,6 +894,9 @@ static void *large_alloc(size_t size)
 
 void cmpct_trim(void)
 {
+    // Cached rounds may be all that is keeping some pages from being trimmed.
+    magazine_drain_all();
+
     // Look at free list entries that are at least as large as one page plus a
     // header. They might be at the start or the end of a block, so we can trim
     // them and free the page(s).
@@ -718,18 +967,15 @@ void cmpct_trim(void)
     unlock();
 }
 
-void *cmpct_alloc(size_t size)
+// Carve an allocation out of the free lists.  |size| must not need a
+// large_alloc().
+static void *alloc_locked(size_t size) TA_REQ(theheap.lock)
 {
-    if (size == 0u) return NULL;
-
-    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
-
     size_t rounded_up;
     int start_bucket = size_to_index_allocating(size, &rounded_up);
 
     rounded_up += sizeof(header_t);
 
-    lock();
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
         // Grow heap by at least 12% if we can.
@@ -738,7 +984,6 @@ void *cmpct_alloc(size_t size)
                                 MAX(HEAP_GROW_SIZE, rounded_up)));
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -768,6 +1013,90 @@ void *cmpct_alloc(size_t size)
     memset(result, ALLOC_FILL, size);
     memset(((char *)result) + size, PADDING_FILL, rounded_up - size - sizeof(header_t));
 #endif
+    return result;
+}
+
+static bool is_mapped_allocation(void *payload)
+{
+    return ((header_t *)payload - 1)->left == MAPPED_ALLOCATION_LEFT;
+}
+
+// The header goes right in front of the payload, which for |alignment| up to
+// PAGE_SIZE keeps it in the first page of the mapping.
+static void *mapped_alloc(size_t size, size_t alignment)
+{
+    DEBUG_ASSERT(alignment <= PAGE_SIZE);
+    size_t offset = ROUNDUP(sizeof(header_t), MAX(alignment, sizeof(header_t)));
+    size_t mapping_size = ROUNDUP(offset + size, PAGE_SIZE);
+
+    void *base;
+    status_t status = vmm_alloc(vmm_get_kernel_aspace(), "kernel heap", mapping_size, &base,
+                                0, 0, VMM_FLAG_COMMIT,
+                                ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
+    if (status != NO_ERROR) return NULL;
+
+    void *result = create_allocation_header(base, offset - sizeof(header_t), mapping_size,
+                                            MAPPED_ALLOCATION_LEFT);
+    __atomic_fetch_add(&theheap.mapped_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&theheap.mapped_size, mapping_size, __ATOMIC_RELAXED);
+#ifdef CMPCT_DEBUG
+    memset(result, ALLOC_FILL, size);
+#endif
+    return result;
+}
+
+static size_t mapped_usable_size(void *payload)
+{
+    header_t *header = (header_t *)payload - 1;
+    uintptr_t base = ROUNDDOWN((uintptr_t)header, PAGE_SIZE);
+    return header->size - ((uintptr_t)payload - base);
+}
+
+static void mapped_free(void *payload)
+{
+    header_t *header = (header_t *)payload - 1;
+    size_t mapping_size = header->size;
+    status_t status = vmm_free_region(vmm_get_kernel_aspace(),
+                                      ROUNDDOWN((vaddr_t)header, PAGE_SIZE));
+    DEBUG_ASSERT(status == NO_ERROR);
+    __atomic_fetch_sub(&theheap.mapped_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&theheap.mapped_size, mapping_size, __ATOMIC_RELAXED);
+}
+
+void *cmpct_alloc(size_t size)
+{
+    if (size == 0u) return NULL;
+
+    if (size >= HEAP_MAPPED_ALLOC_THRESHOLD && mapped_allocs_enabled)
+        return mapped_alloc(size, 0);
+
+    return heap_alloc(size);
+}
+
+// Never a mapped allocation.
+static void *heap_alloc(size_t size)
+{
+    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
+
+    int magazine = size_to_magazine(size);
+    if (magazine >= 0) {
+        void *result = magazine_alloc(magazine);
+        if (result != NULL) {
+#ifdef CMPCT_DEBUG
+            size_t rounded_up = ((header_t *)result - 1)->size - sizeof(header_t);
+            memset(result, ALLOC_FILL, size);
+            memset(((char *)result) + size, PADDING_FILL, rounded_up - size);
+#endif
+            return result;
+        }
+    }
+
+    lock();
+    void *result = alloc_locked(size);
+    if (result != NULL && magazine >= 0) {
+        // Our magazine was empty, so load it up while we have the lock.
+        magazine_fill(magazine, size);
+    }
     unlock();
     return result;
 }
@@ -775,9 +1104,13 @@ void *cmpct_alloc(size_t size)
 void *cmpct_memalign(size_t size, size_t alignment)
 {
     if (alignment < 8) return cmpct_alloc(size);
+    if (size >= HEAP_MAPPED_ALLOC_THRESHOLD && alignment <= PAGE_SIZE && mapped_allocs_enabled)
+        return mapped_alloc(size, alignment);
     size_t padded_size =
         size + alignment + sizeof(free_t) + sizeof(header_t);
-    char *unaligned = (char *)cmpct_alloc(padded_size);
+    // The carving below needs a heap allocation, whatever the size.
+    char *unaligned = (char *)heap_alloc(padded_size);
+    if (unaligned == NULL) return NULL;
     lock();
     size_t mask = alignment - 1;
     uintptr_t payload_int = (uintptr_t)unaligned + sizeof(free_t) +
@@ -801,13 +1134,11 @@ void *cmpct_memalign(size_t size, size_t alignment)
     return payload;
 }
 
-void cmpct_free(void *payload)
+static void free_locked(void *payload) TA_REQ(theheap.lock)
 {
-    if (payload == NULL) return;
     header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
     size_t size = header->size;
-    lock();
     header_t *left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -836,6 +1167,34 @@ void cmpct_free(void *payload)
             free_memory(header, left, size);
         }
     }
+}
+
+void cmpct_free(void *payload)
+{
+    if (payload == NULL) return;
+    if (is_mapped_allocation(payload)) {
+        mapped_free(payload);
+        return;
+    }
+    DEBUG_ASSERT(!is_tagged_as_free((header_t *)payload - 1));  // Double free!
+
+    int magazine = allocation_to_magazine(payload);
+    void *flushed[MAGAZINE_BATCH];
+    size_t flush_count = 0;
+    if (magazine >= 0) {
+#ifdef CMPCT_DEBUG
+        memset(payload, FREE_FILL, ((header_t *)payload - 1)->size - sizeof(header_t));
+#endif
+        flush_count = magazine_free(magazine, payload, flushed);
+        if (flush_count == 0) return;
+        // The magazine was full, so the oldest rounds go back to the heap
+        // instead.
+        payload = NULL;
+    }
+
+    lock();
+    if (payload != NULL) free_locked(payload);
+    for (size_t i = 0; i < flush_count; i++) free_locked(flushed[i]);
     unlock();
 }
 
@@ -843,7 +1202,8 @@ void *cmpct_realloc(void *payload, size_t size)
 {
     if (payload == NULL) return cmpct_alloc(size);
     header_t *header = (header_t *)payload - 1;
-    size_t old_size = header->size - sizeof(header_t);
+    size_t old_size = is_mapped_allocation(payload) ? mapped_usable_size(payload)
+                                                    : header->size - sizeof(header_t);
     void *new_payload = cmpct_alloc(size);
     memcpy(new_payload, payload, MIN(size, old_size));
     cmpct_free(payload);
@@ -906,3 +1266,13 @@ void cmpct_init(void)
 
     heap_grow(initial_alloc, NULL);
 }
+
+// Per-cpu state isn't usable until the kernel proper is up, nor are kernel
+// mappings until the VM is.
+static void cmpct_magazine_init(uint level)
+{
+    magazines_enabled = true;
+    mapped_allocs_enabled = true;
+}
+
+LK_INIT_HOOK(cmpct_magazines, &cmpct_magazine_init, LK_INIT_LEVEL_THREADING);
@@ -73,6 +73,14 @@ void __kernel_console_write(const char *str, size_t len)
 static void __kernel_stdout_write(const char *str, size_t len)
 {
 #if WITH_LIB_DEBUGLOG && !ENABLE_KERNEL_LL_DEBUG
+    // With interrupts disabled the reader thread may not get to run for a
+    // while, or at all if this is a panic, so print it now as well.
+    if (arch_ints_disabled()) {
+        __kernel_console_write(str, len);
+        __kernel_serial_write(str, len);
+        dlog_write(DLOG_FLAG_KERNEL | DLOG_FLAG_ECHOED, str, len);
+        return;
+    }
     if (dlog_write(DLOG_FLAG_KERNEL, str, len)) {
         __kernel_console_write(str, len);
         __kernel_serial_write(str, len);
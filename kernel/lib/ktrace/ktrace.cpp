@@ -9,12 +9,19 @@
 #include <string.h>
 
 #include <arch/ops.h>
+#include <arch/pmu.h>
 #include <arch/user_copy.h>
 #include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
 #include <lib/ktrace.h>
 #include <lk/init.h>
+#include <lk/timeline.h>
 #include <magenta/user_thread.h>
+#include <mxtl/algorithm.h>
+#include <pow2.h>
 
 #if __x86_64__
 extern "C" uint64_t get_tsc_ticks_per_ms(void);
@@ -97,10 +104,208 @@ typedef struct ktrace_state {
 
     // raw trace buffer
     uint8_t* buffer;
+
+    // nonzero when records go to the per-cpu streams instead of buffer
+    int streaming;
 } ktrace_state_t;
 
 static ktrace_state_t KTRACE_STATE;
 
+// A cpu's ring of records for KTRACE_ACTION_START_STREAM, only ever
+// written by that cpu with interrupts disabled.
+typedef struct ktrace_stream {
+    ktrace_stream_header_t* hdr;
+    uint8_t* data;
+} ktrace_stream_t;
+
+static ktrace_stream_t ktrace_streams[SMP_MAX_CPUS];
+static mxtl::RefPtr<VmObject> ktrace_stream_vmos[SMP_MAX_CPUS];
+static uint ktrace_stream_count;
+static mutex_t ktrace_stream_lock = MUTEX_INITIAL_VALUE(ktrace_stream_lock);
+
+static void ktrace_stream_write(ktrace_stream_t* ks, const void* rec, uint32_t len) {
+    ktrace_stream_header_t* hdr = ks->hdr;
+    const uint32_t size = hdr->size;
+    uint64_t head = hdr->head;
+    uint32_t off = static_cast<uint32_t>(head & (size - 1));
+    if (size - off < len) {
+        // records never straddle the end of the ring
+        *reinterpret_cast<uint32_t*>(ks->data + off) = 0;
+        head += size - off;
+        off = 0;
+    }
+    memcpy(ks->data + off, rec, len);
+    __atomic_store_n(&hdr->head, head + len, __ATOMIC_RELEASE);
+}
+
+// Copies a complete record into the trace, returning false if it did not fit.
+static bool ktrace_emit(const void* rec, uint32_t len) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (__atomic_load_n(&ks->streaming, __ATOMIC_ACQUIRE)) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        uint cpu = arch_curr_cpu_num();
+        if (cpu < ktrace_stream_count)
+            ktrace_stream_write(&ktrace_streams[cpu], rec, len);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return true;
+    }
+
+    int off;
+    if ((off = atomic_add(&ks->offset, len)) >= (int)ks->bufsize) {
+        // if we arrive at the end, stop
+        atomic_store(&ks->grpmask, 0);
+        return false;
+    }
+    memcpy(ks->buffer + off, rec, len);
+    return true;
+}
+
+// Sets up a stream for every cpu, the first time streaming starts.
+static status_t ktrace_stream_init(void) {
+    mutex_acquire(&ktrace_stream_lock);
+    if (ktrace_stream_count) {
+        mutex_release(&ktrace_stream_lock);
+        return NO_ERROR;
+    }
+
+    uint32_t kb = cmdline_get_uint32("ktrace.streamsize", KTRACE_DEFAULT_STREAMSIZE);
+    kb = mxtl::max(kb, 4u);
+    uint32_t size = 1u << log2_uint_ceil(kb * 1024);
+    size_t vmo_size = ROUNDUP_PAGE_SIZE(KTRACE_STREAM_DATA_OFFSET + size);
+
+    uint cpus = mxtl::min<uint>(arch_max_num_cpus(), SMP_MAX_CPUS);
+    for (uint cpu = 0; cpu < cpus; cpu++) {
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, vmo_size);
+        if (!vmo) {
+            mutex_release(&ktrace_stream_lock);
+            return ERR_NO_MEMORY;
+        }
+
+        // Readers get a handle to the vmo, and the pages the kernel writes
+        // through its own mapping must not be decommitted or cut off. Streams
+        // live forever, so the pin is never dropped.
+        status_t status = vmo->Pin(0u, vmo_size);
+        if (status != NO_ERROR) {
+            mutex_release(&ktrace_stream_lock);
+            return status;
+        }
+
+        void* ptr = nullptr;
+        status = VmAspace::kernel_aspace()->MapObject(
+            vmo, "ktrace stream", 0u, vmo_size, &ptr, PAGE_SIZE_SHIFT, 0,
+            VMM_FLAG_COMMIT, ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
+        if (status != NO_ERROR) {
+            vmo->Unpin();
+            mutex_release(&ktrace_stream_lock);
+            return status;
+        }
+
+        ktrace_stream_t* ks = &ktrace_streams[cpu];
+        ks->hdr = reinterpret_cast<ktrace_stream_header_t*>(ptr);
+        ks->hdr->size = size;
+        ks->hdr->cpu = cpu;
+        ks->data = reinterpret_cast<uint8_t*>(ptr) + KTRACE_STREAM_DATA_OFFSET;
+        ktrace_stream_vmos[cpu] = mxtl::move(vmo);
+    }
+
+    dprintf(INFO, "ktrace: %u streams of %u bytes\n", cpus, size);
+    __atomic_store_n(&ktrace_stream_count, cpus, __ATOMIC_RELEASE);
+    mutex_release(&ktrace_stream_lock);
+    return NO_ERROR;
+}
+
+status_t ktrace_stream_vmo(uint32_t cpu, mxtl::RefPtr<VmObject>* vmo) {
+    mutex_acquire(&ktrace_stream_lock);
+    status_t status = NO_ERROR;
+    if (!ktrace_stream_count) {
+        status = ERR_BAD_STATE;
+    } else if (cpu >= ktrace_stream_count) {
+        status = ERR_INVALID_ARGS;
+    } else {
+        *vmo = ktrace_stream_vmos[cpu];
+    }
+    mutex_release(&ktrace_stream_lock);
+    return status;
+}
+
+// The version and tick rate records, which lead the global buffer, but
+// are emitted like any other record into a stream.
+static void ktrace_report_metadata(void) {
+    uint64_t n = ktrace_ticks_per_ms();
+    ktrace_rec_32b_t rec[2] = {};
+    rec[0].tag = TAG_VERSION;
+    rec[0].a = KTRACE_VERSION;
+    rec[1].tag = TAG_TICKS_PER_MS;
+    rec[1].a = (uint32_t)n;
+    rec[1].b = (uint32_t)(n >> 32);
+    ktrace_emit(&rec[0], sizeof(rec[0]));
+    ktrace_emit(&rec[1], sizeof(rec[1]));
+}
+
+// Fewest cycles between profiler samples, so that they can't swamp a cpu.
+constexpr uint32_t kProfileMinPeriod = 10000u;
+
+static mutex_t profile_lock = MUTEX_INITIAL_VALUE(profile_lock);
+static bool profile_running;
+
+struct profile_start_args {
+    uint32_t period;
+    // the last failure of any cpu to start
+    status_t status;
+};
+
+static void ktrace_profile_start_task(void* context) {
+    auto args = static_cast<profile_start_args*>(context);
+    status_t status = arch_pmu_start(args->period);
+    if (status != NO_ERROR)
+        __atomic_store_n(&args->status, status, __ATOMIC_RELAXED);
+}
+
+static void ktrace_profile_stop_task(void* context) {
+    arch_pmu_stop();
+}
+
+static status_t ktrace_profile_start(uint32_t period) {
+    if (period < kProfileMinPeriod || period > INT32_MAX)
+        return ERR_INVALID_ARGS;
+
+    mutex_acquire(&profile_lock);
+    if (profile_running)
+        mp_sync_exec(MP_CPU_ALL, ktrace_profile_stop_task, nullptr);
+
+    profile_start_args args = { period, NO_ERROR };
+    mp_sync_exec(MP_CPU_ALL, ktrace_profile_start_task, &args);
+    profile_running = (args.status == NO_ERROR);
+    if (!profile_running)
+        mp_sync_exec(MP_CPU_ALL, ktrace_profile_stop_task, nullptr);
+    mutex_release(&profile_lock);
+    return args.status;
+}
+
+static void ktrace_profile_stop(void) {
+    mutex_acquire(&profile_lock);
+    if (profile_running) {
+        mp_sync_exec(MP_CPU_ALL, ktrace_profile_stop_task, nullptr);
+        profile_running = false;
+    }
+    mutex_release(&profile_lock);
+}
+
+void ktrace_profile_sample(uintptr_t pc, void* fp, bool from_user) {
+    uint64_t pcs[KTRACE_SAMPLE_MAX_PCS];
+    uintptr_t callers[KTRACE_SAMPLE_MAX_PCS - 1];
+    size_t n = 0;
+    if (!from_user) {
+        n = thread_get_backtrace(get_current_thread(), fp, callers, countof(callers));
+    }
+    pcs[0] = pc;
+    for (size_t i = 0; i < n; i++) {
+        pcs[i + 1] = callers[i];
+    }
+    ktrace_record_data(TAG_PROFILE_SAMPLE, pcs, static_cast<uint32_t>((n + 1) * sizeof(pcs[0])));
+}
+
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
     ktrace_state_t* ks = &KTRACE_STATE;
 
@@ -143,9 +348,25 @@ status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     case KTRACE_ACTION_START:
         options = KTRACE_GRP_TO_MASK(options);
         ks->marker = 0;
+        __atomic_store_n(&ks->streaming, 0, __ATOMIC_RELEASE);
+        atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
+        ktrace_report_live_threads();
+        break;
+    case KTRACE_ACTION_START_STREAM: {
+        status_t status = ktrace_stream_init();
+        if (status != NO_ERROR)
+            return status;
+        options = KTRACE_GRP_TO_MASK(options);
+        __atomic_store_n(&ks->streaming, 1, __ATOMIC_RELEASE);
+        // a reader may have missed the names given so far, so give them again
+        ktrace_report_metadata();
+        ktrace_report_syscalls(kt_syscall_info);
+        ktrace_report_probes();
         atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
         ktrace_report_live_threads();
+        lk_timeline_report();
         break;
+    }
     case KTRACE_ACTION_STOP: {
         atomic_store(&ks->grpmask, 0);
         uint32_t n = ks->offset;
@@ -161,6 +382,12 @@ status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
         atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
         ktrace_report_syscalls(kt_syscall_info);
         ktrace_report_probes();
+        lk_timeline_report();
+        break;
+    case KTRACE_ACTION_PROFILE_START:
+        return ktrace_profile_start(options);
+    case KTRACE_ACTION_PROFILE_STOP:
+        ktrace_profile_stop();
         break;
     case KTRACE_ACTION_NEW_PROBE: {
         ktrace_probe_info_t* probe;
@@ -240,45 +467,58 @@ void ktrace_init(unsigned level) {
 
     // report names of existing threads
     ktrace_report_live_threads();
+
+    // and how boot went up to here, the rest following as it happens
+    lk_timeline_report();
 }
 
 void ktrace_tiny(uint32_t tag, uint32_t arg) {
     uint64_t ts = ktrace_timestamp();
     ktrace_state_t* ks = &KTRACE_STATE;
     if (tag & atomic_load(&ks->grpmask)) {
-        tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-            hdr->ts = ts;
-            hdr->tag = tag;
-            hdr->tid = arg;
-        }
+        ktrace_header_t hdr;
+        hdr.ts = ts;
+        hdr.tag = (tag & 0xFFFFFFF0) | 2;
+        hdr.tid = arg;
+        ktrace_emit(&hdr, sizeof(hdr));
     }
 }
 
-void* ktrace_open(uint32_t tag) {
+bool ktrace_record(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
     uint64_t ts = ktrace_timestamp();
     ktrace_state_t* ks = &KTRACE_STATE;
     if (!(tag & atomic_load(&ks->grpmask))) {
-        return NULL;
+        return false;
     }
 
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
-        return NULL;
+    ktrace_rec_32b_t rec;
+    rec.tag = tag;
+    rec.tid = (uint32_t)get_current_thread()->user_tid;
+    rec.ts = ts;
+    rec.a = a;
+    rec.b = b;
+    rec.c = c;
+    rec.d = d;
+    return ktrace_emit(&rec, mxtl::min<uint32_t>(KTRACE_LEN(tag), sizeof(rec)));
+}
+
+bool ktrace_record_data(uint32_t tag, const void* data, uint32_t len) {
+    uint64_t ts = ktrace_timestamp();
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (!(tag & atomic_load(&ks->grpmask))) {
+        return false;
     }
 
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ts;
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
-    return hdr + 1;
+    ktrace_rec_sample_t rec;
+    len = mxtl::min<uint32_t>(len, sizeof(rec) - KTRACE_HDRSIZE);
+    tag = (tag & 0xFFFFFFF0) | ((KTRACE_HDRSIZE + len + 7) >> 3);
+    rec.tag = tag;
+    rec.tid = (uint32_t)get_current_thread()->user_tid;
+    rec.ts = ts;
+    memcpy(rec.pc, data, len);
+    memset(reinterpret_cast<uint8_t*>(&rec) + KTRACE_HDRSIZE + len, 0,
+           KTRACE_LEN(tag) - KTRACE_HDRSIZE - len);
+    return ktrace_emit(&rec, KTRACE_LEN(tag));
 }
 
 static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
@@ -289,18 +529,16 @@ static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char*
         // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
         tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
 
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
-            rec->tag = tag;
-            rec->id = id;
-            rec->arg = arg;
-            memcpy(rec->name, name, len);
-            rec->name[len] = 0;
-        }
+        union {
+            ktrace_rec_name_t rec;
+            uint8_t raw[KTRACE_NAMESIZE + 32 + 7];
+        } u;
+        u.rec.tag = tag;
+        u.rec.id = id;
+        u.rec.arg = arg;
+        memcpy(u.rec.name, name, len);
+        memset(u.rec.name + len, 0, KTRACE_LEN(tag) - KTRACE_NAMESIZE - len);
+        ktrace_emit(&u.rec, KTRACE_LEN(tag));
     }
 }
 
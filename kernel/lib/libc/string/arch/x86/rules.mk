@@ -7,6 +7,13 @@
 
 LOCAL_DIR := $(GET_LOCAL_DIR)
 
+ifeq ($(SUBARCH),x86-64)
+
+# the 64 bit routines live in their own directory
+include $(dir $(LOCAL_DIR))x86-64/rules.mk
+
+else
+
 ASM_STRING_OPS := #bcopy bzero memcpy memmove memset
 
 MODULE_SRCS += \
@@ -16,3 +23,4 @@ MODULE_SRCS += \
 # filter out the C implementation
 C_STRING_OPS := $(filter-out $(ASM_STRING_OPS),$(C_STRING_OPS))
 
+endif
@@ -14,6 +14,7 @@
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <kernel/thread.h>
 
 #include <magenta/handle.h>
 #include <magenta/message_packet.h>
@@ -226,8 +227,11 @@ status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
         waiters_.push_back(&waiter);
     }
 
-    // (1) Write outbound message to opposing endpoint.
-    other->WriteSelf(mxtl::move(msg));
+    // (1) Write outbound message to opposing endpoint, handing
+    // the cpu straight to a thread waiting to read it if we are
+    // about to block. The reply can't have arrived yet, so we do
+    // unless the timeout has already expired.
+    other->WriteSelf(mxtl::move(msg), timeout != 0);
 
     // (2) Wait for notification via waiter's event or
     // timeout to occur.
@@ -254,7 +258,7 @@ status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
     return status;
 }
 
-void ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
+void ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg, bool handoff) {
     AutoLock lock(&lock_);
     auto size = msg->data_size();
 
@@ -267,6 +271,8 @@ void ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
             // (3C) Deliver message to waiter.
             // Remove waiter from list.
             if (waiter.get_txid() == txid) {
+                // No handoff: the server need not block after
+                // replying, and would strand the caller here.
                 waiter.Deliver(mxtl::move(msg));
                 waiters_.erase(waiter);
                 return;
@@ -275,9 +281,13 @@ void ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
     }
     messages_.push_back(mxtl::move(msg));
 
+    if (handoff)
+        thread_handoff_begin();
     state_tracker_.UpdateState(0u, MX_CHANNEL_READABLE);
     if (iopc_)
         iopc_->Signal(MX_CHANNEL_READABLE, size, &lock_);
+    if (handoff)
+        thread_handoff_end();
 }
 
 status_t ChannelDispatcher::set_port_client(mxtl::unique_ptr<PortClient> client) {
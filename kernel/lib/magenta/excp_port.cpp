@@ -3,6 +3,10 @@
 #include <new.h>
 #include <string.h>
 
+#include <arch/debugger.h>
+#include <kernel/vm.h>
+#include <lib/user_copy/user_ptr.h>
+
 #include <magenta/excp_port.h>
 #include <magenta/magenta.h>
 #include <magenta/port_dispatcher.h>
@@ -32,17 +36,18 @@ static IOP_Packet* MakePacket(uint64_t key, const mx_exception_report_t* report,
 
 // static
 mx_status_t ExceptionPort::Create(mxtl::RefPtr<PortDispatcher> port, uint64_t port_key,
-                                  mxtl::RefPtr<ExceptionPort>* out_eport) {
+                                  bool snapshot, mxtl::RefPtr<ExceptionPort>* out_eport) {
     AllocChecker ac;
-    auto eport = new (&ac) ExceptionPort(mxtl::move(port), port_key);
+    auto eport = new (&ac) ExceptionPort(mxtl::move(port), port_key, snapshot);
     if (!ac.check())
         return ERR_NO_MEMORY;
     *out_eport = mxtl::AdoptRef<ExceptionPort>(eport);
     return NO_ERROR;
 }
 
-ExceptionPort::ExceptionPort(mxtl::RefPtr<PortDispatcher> port, uint64_t port_key)
-    : port_(port), port_key_(port_key) {
+ExceptionPort::ExceptionPort(mxtl::RefPtr<PortDispatcher> port, uint64_t port_key,
+                             bool snapshot)
+    : port_(port), port_key_(port_key), snapshot_(snapshot) {
     LTRACE_ENTRY_OBJ;
 }
 
@@ -76,6 +81,67 @@ mx_status_t ExceptionPort::SendReport(const mx_exception_report_t* report) {
     return port_->Queue(iopk);
 }
 
+// Fills in |snapshot| with the registers of the current thread, stopped for an
+// exception, and the top of its stack.
+static void BuildSnapshot(UserThread* thread, mx_exception_snapshot_t* snapshot) {
+    uint32_t size = sizeof(snapshot->regs);
+    if (arch_get_regset(thread->kernel_thread(), 0, &snapshot->regs, &size) != NO_ERROR)
+        return;
+
+#if ARCH_X86_64
+    snapshot->stack_addr = snapshot->regs.x86_64.rsp;
+#elif ARCH_ARM64
+    snapshot->stack_addr = snapshot->regs.arm_64.sp;
+#else
+    return;
+#endif
+    snapshot->flags = MX_EXCEPTION_SNAPSHOT_REGS;
+
+    // We're on the faulting thread, so its stack is the user address space
+    // we can copy from.  Go a page at a time so that a stack ending partway
+    // through still gives what there is.
+    auto stack = make_user_ptr(reinterpret_cast<const uint8_t*>(snapshot->stack_addr));
+    size_t copied = 0;
+    while (copied < MX_EXCEPTION_SNAPSHOT_STACK_SIZE) {
+        size_t page_left = PAGE_SIZE - ((snapshot->stack_addr + copied) & (PAGE_SIZE - 1));
+        size_t len = MIN(MX_EXCEPTION_SNAPSHOT_STACK_SIZE - copied, page_left);
+        if (stack.copy_array_from_user(snapshot->stack + copied, len, copied) != NO_ERROR)
+            break;
+        copied += len;
+    }
+    snapshot->stack_size = static_cast<uint32_t>(copied);
+}
+
+mx_status_t ExceptionPort::SendExceptionReport(const mx_exception_report_t* report,
+                                               UserThread* thread) {
+    if (!snapshot_ || !MX_EXCP_IS_ARCH(report->header.type))
+        return SendReport(report);
+
+    DEBUG_ASSERT(thread == UserThread::GetCurrent());
+
+    // Build the snapshot straight into the packet; it is too big for the
+    // kernel stack.
+    auto iopk = IOP_Packet::Alloc(sizeof(mx_exception_snapshot_packet_t));
+    if (!iopk)
+        return ERR_NO_MEMORY;
+
+    auto pkt_data = reinterpret_cast<mx_exception_snapshot_packet_t*>(
+        reinterpret_cast<char*>(iopk) + sizeof(IOP_Packet));
+    memset(pkt_data, 0, sizeof(*pkt_data));
+    pkt_data->hdr.key = port_key_;
+    pkt_data->hdr.type = MX_PORT_PKT_TYPE_EXCEPTION;
+    pkt_data->report = *report;
+    pkt_data->report.header.size = sizeof(pkt_data->report) + sizeof(pkt_data->snapshot);
+    BuildSnapshot(thread, &pkt_data->snapshot);
+
+    LTRACEF("Sending exception report with snapshot, type %u, pid %"
+            PRIu64 ", tid %" PRIu64 ", %u bytes of stack\n",
+            report->header.type, report->context.pid, report->context.tid,
+            pkt_data->snapshot.stack_size);
+
+    return port_->Queue(iopk);
+}
+
 void ExceptionPort::BuildThreadStartReport(mx_exception_report_t* report,
                                            mx_koid_t pid, mx_koid_t tid) {
     memset(report, 0, sizeof(*report));
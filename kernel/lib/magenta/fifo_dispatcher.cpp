@@ -8,16 +8,18 @@
 
 #include <new.h>
 #include <kernel/auto_lock.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
 
 constexpr mx_rights_t kDefaultFifoRights = MX_FIFO_PRODUCER_RIGHTS | MX_FIFO_CONSUMER_RIGHTS;
 
 class FifoDispatcher::StateUpdater {
 public:
     StateUpdater(const FifoDispatcher* fifo, mx_fifo_state_t* state)
-        : fifo_(fifo), state_(state) {}
-    ~StateUpdater() {
+        TA_REQ(fifo->lock_) : fifo_(fifo), state_(state) {}
+    ~StateUpdater() TA_NO_THREAD_SAFETY_ANALYSIS {
         if (fifo_ && state_) {
-            *state_ = fifo_->state_;
+            *state_ = fifo_->LoadStateLocked();
         }
     }
 
@@ -44,7 +46,43 @@ FifoDispatcher::FifoDispatcher(uint64_t count)
     state_tracker_.set_initial_signals_state(MX_FIFO_EMPTY|MX_FIFO_NOT_FULL);
 }
 
-FifoDispatcher::~FifoDispatcher() {}
+FifoDispatcher::~FifoDispatcher() {
+    if (mapped_state_) {
+        VmAspace::kernel_aspace()->FreeRegion(reinterpret_cast<vaddr_t>(mapped_state_));
+        state_vmo_->Unpin();
+    }
+}
+
+mx_fifo_state_t FifoDispatcher::LoadStateLocked() const {
+    if (!mapped_state_)
+        return state_;
+    mx_fifo_state_t state;
+    state.head = __atomic_load_n(&mapped_state_->head, __ATOMIC_SEQ_CST);
+    state.tail = __atomic_load_n(&mapped_state_->tail, __ATOMIC_SEQ_CST);
+    return state;
+}
+
+void FifoDispatcher::StoreHeadLocked(uint64_t head) {
+    if (mapped_state_)
+        __atomic_store_n(&mapped_state_->head, head, __ATOMIC_SEQ_CST);
+    else
+        state_.head = head;
+}
+
+void FifoDispatcher::StoreTailLocked(uint64_t tail) {
+    if (mapped_state_)
+        __atomic_store_n(&mapped_state_->tail, tail, __ATOMIC_SEQ_CST);
+    else
+        state_.tail = tail;
+}
+
+void FifoDispatcher::UpdateSignalsLocked(const mx_fifo_state_t& state) {
+    mx_signals_t set = 0u;
+    set |= (state.head == state.tail) ? MX_FIFO_EMPTY : MX_FIFO_NOT_EMPTY;
+    set |= (state.head - state.tail == count_) ? MX_FIFO_FULL : MX_FIFO_NOT_FULL;
+    state_tracker_.UpdateState(
+        (MX_FIFO_EMPTY | MX_FIFO_NOT_EMPTY | MX_FIFO_FULL | MX_FIFO_NOT_FULL) & ~set, set);
+}
 
 void FifoDispatcher::GetState(mx_fifo_state_t* out) const {
     AutoLock lock(&lock_);
@@ -57,17 +95,12 @@ status_t FifoDispatcher::AdvanceHead(uint64_t count, mx_fifo_state_t* out) {
     StateUpdater updater(this, out);
 
     if (!count) return NO_ERROR;
-    if (state_.head + count - state_.tail > count_) return ERR_OUT_OF_RANGE;
+    auto state = LoadStateLocked();
+    if (state.head + count - state.tail > count_) return ERR_OUT_OF_RANGE;
 
-    auto prev_head = state_.head;
-    state_.head += count;
-
-    if (prev_head == state_.tail) {
-        state_tracker_.UpdateState(MX_FIFO_EMPTY, MX_FIFO_NOT_EMPTY);
-    }
-    if (state_.head - state_.tail == count_) {
-        state_tracker_.UpdateState(MX_FIFO_NOT_FULL, MX_FIFO_FULL);
-    }
+    state.head += count;
+    StoreHeadLocked(state.head);
+    UpdateSignalsLocked(state);
 
     return NO_ERROR;
 }
@@ -77,17 +110,12 @@ status_t FifoDispatcher::AdvanceTail(uint64_t count, mx_fifo_state_t* out) {
     StateUpdater updater(this, out);
 
     if (!count) return NO_ERROR;
-    if (state_.tail + count > state_.head) return ERR_OUT_OF_RANGE;
-
-    auto prev_tail = state_.tail;
-    state_.tail += count;
+    auto state = LoadStateLocked();
+    if (state.tail + count > state.head) return ERR_OUT_OF_RANGE;
 
-    if (state_.head - prev_tail == count_) {
-        state_tracker_.UpdateState(MX_FIFO_FULL, MX_FIFO_NOT_FULL);
-    }
-    if (state_.head == state_.tail) {
-        state_tracker_.UpdateState(MX_FIFO_NOT_EMPTY, MX_FIFO_EMPTY);
-    }
+    state.tail += count;
+    StoreTailLocked(state.tail);
+    UpdateSignalsLocked(state);
 
     return NO_ERROR;
 }
@@ -108,3 +136,48 @@ status_t FifoDispatcher::SetException(mx_signals_t signal, bool set, mx_fifo_sta
     }
     return NO_ERROR;
 }
+
+status_t FifoDispatcher::GetStateVmo(mxtl::RefPtr<VmObject>* vmo) {
+    AutoLock lock(&lock_);
+
+    if (!state_vmo_) {
+        auto state_vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE);
+        if (!state_vmo)
+            return ERR_NO_MEMORY;
+
+        // Users may hold the vmo writable, and the page the kernel works on
+        // through its own mapping must not be decommitted or cut off.
+        status_t status = state_vmo->Pin(0u, PAGE_SIZE);
+        if (status != NO_ERROR)
+            return status;
+
+        void* ptr = nullptr;
+        status = VmAspace::kernel_aspace()->MapObject(
+            state_vmo, "fifo state", 0u, PAGE_SIZE, &ptr, PAGE_SIZE_SHIFT, 0,
+            VMM_FLAG_COMMIT, ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
+        if (status != NO_ERROR) {
+            state_vmo->Unpin();
+            return status;
+        }
+
+        mapped_state_ = reinterpret_cast<mx_fifo_state_t*>(ptr);
+        *mapped_state_ = state_;
+        state_vmo_ = mxtl::move(state_vmo);
+    }
+
+    *vmo = state_vmo_;
+    return NO_ERROR;
+}
+
+status_t FifoDispatcher::Sync(mx_fifo_state_t* out) {
+    AutoLock lock(&lock_);
+    StateUpdater updater(this, out);
+
+    // The mapped state is only as trustworthy as the fifo's users, so leave the signals alone
+    // rather than act on an impossible one.
+    auto state = LoadStateLocked();
+    if (state.head - state.tail > count_) return ERR_OUT_OF_RANGE;
+
+    UpdateSignalsLocked(state);
+    return NO_ERROR;
+}
@@ -24,17 +24,44 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (auto& shard : shards_) {
+        AutoLock lock(shard.lock);
+        DEBUG_ASSERT(shard.futex_table.is_empty());
+    }
+}
+
+FutexContext::Shard* FutexContext::GetShard(uintptr_t futex_key) {
+    // Mix the address bits so that futexes packed next to each other, like the fields of
+    // one structure, still spread over the shards.
+    uint64_t hash = (static_cast<uint64_t>(futex_key) >> 2) * 0x9e3779b97f4a7c15ull;
+    return &shards_[hash >> (64 - kNumShardsShift)];
 }
 
 status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t timeout) {
     LTRACE_ENTRY;
 
+    return FutexWaitInternal(value_ptr, current_value, nullptr, timeout);
+}
+
+status_t FutexContext::FutexWaitPI(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                                   mx_time_t timeout) {
+    LTRACE_ENTRY;
+
+    UserThread* thread = UserThread::GetCurrent();
+    if (owner == thread)
+        return ERR_INVALID_ARGS;
+
+    return FutexWaitInternal(value_ptr, current_value, owner->kernel_thread(), timeout);
+}
+
+status_t FutexContext::FutexWaitInternal(user_ptr<int> value_ptr, int current_value,
+                                         thread_t* owner, mx_time_t timeout) {
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
     FutexNode* node;
+    Shard* shard = GetShard(futex_key);
 
     // FutexWait() checks that the address value_ptr still contains
     // current_value, and if so it sleeps awaiting a FutexWake() on value_ptr.
@@ -42,16 +69,16 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    shard->lock.Acquire();
 
     int value;
     status_t result = value_ptr.copy_from_user(&value);
     if (result != NO_ERROR) {
-        lock_.Release();
+        shard->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        shard->lock.Release();
         return ERR_BAD_STATE;
     }
 
@@ -60,19 +87,18 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(shard, node);
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, timeout);
+    // Block current thread.  This releases the shard lock and does not reacquire it.
+    result = node->BlockThread(&shard->lock, timeout, owner);
     if (result == NO_ERROR) {
         // All the work necessary for removing us from the hash table was done by FutexWake()
         return NO_ERROR;
     }
 
-    AutoLock lock(lock_);
     // If we got a timeout, we need to remove the thread's node from the
     // wait queue, since FutexWake() didn't do that.
-    if (UnqueueNodeLocked(node)) {
+    if (UnqueueNode(node)) {
         return ERR_TIMED_OUT;
     }
     // The current thread was not found on the wait queue.  This means
@@ -107,22 +133,25 @@ status_t FutexContext::FutexWake(user_ptr<int> value_ptr, uint32_t count) {
         return ERR_INVALID_ARGS;
 
     {
-        AutoLock lock(lock_);
+        Shard* shard = GetShard(futex_key);
+        AutoLock lock(shard->lock);
 
-        FutexNode* node = futex_table_.erase(futex_key);
+        FutexNode* node = shard->futex_table.erase(futex_key);
         if (!node) {
             // nothing blocked on this futex if we can't find it
             return NO_ERROR;
         }
         DEBUG_ASSERT(node->GetKey() == futex_key);
 
+        // The woken nodes keep their key until WakeThreads() takes them off the queue, so
+        // that a timed out waiter looks for them under this shard's lock.
         FutexNode* wake_head = node;
-        node = FutexNode::RemoveFromHead(node, count, futex_key, 0u);
+        node = FutexNode::RemoveFromHead(node, count, futex_key, futex_key);
         // node is now the new blocked thread list head
 
         if (node != nullptr) {
             DEBUG_ASSERT(node->GetKey() == futex_key);
-            futex_table_.insert(node);
+            shard->futex_table.insert(node);
         }
 
         // Traversing this list of threads must be done while holding the
@@ -136,29 +165,53 @@ status_t FutexContext::FutexWake(user_ptr<int> value_ptr, uint32_t count) {
 }
 
 status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
-                                    user_ptr<int> requeue_ptr, uint32_t requeue_count) {
+                                    user_ptr<int> requeue_ptr,
+                                    uint32_t requeue_count) TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return ERR_INVALID_ARGS;
 
-    AutoLock lock(lock_);
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
+    if (wake_key == requeue_key) return ERR_INVALID_ARGS;
+    if (wake_key % sizeof(int) || requeue_key % sizeof(int))
+        return ERR_INVALID_ARGS;
+
+    // Moving waiters between the two futexes needs both of their shards, always taken in
+    // the same order so that two requeues in opposite directions can't deadlock.
+    Shard* wake_shard = GetShard(wake_key);
+    Shard* requeue_shard = GetShard(requeue_key);
+    Shard* first = (wake_shard < requeue_shard) ? wake_shard : requeue_shard;
+    Shard* second = (wake_shard < requeue_shard) ? requeue_shard : wake_shard;
+    first->lock.Acquire();
+    if (second != first)
+        second->lock.Acquire();
+
+    status_t result = RequeueLocked(wake_shard, wake_ptr, wake_count, current_value,
+                                    requeue_shard, requeue_key, requeue_count);
+
+    if (second != first)
+        second->lock.Release();
+    first->lock.Release();
+    return result;
+}
 
+status_t FutexContext::RequeueLocked(Shard* wake_shard, user_ptr<int> wake_ptr,
+                                     uint32_t wake_count, int current_value,
+                                     Shard* requeue_shard, uintptr_t requeue_key,
+                                     uint32_t requeue_count) {
     int value;
     status_t result = wake_ptr.copy_from_user(&value);
     if (result != NO_ERROR) return result;
     if (value != current_value) return ERR_BAD_STATE;
 
     uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
-    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
-    if (wake_key == requeue_key) return ERR_INVALID_ARGS;
-    if (wake_key % sizeof(int) || requeue_key % sizeof(int))
-        return ERR_INVALID_ARGS;
 
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on futex_table look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_shard->futex_table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return NO_ERROR;
@@ -169,7 +222,7 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, 0u);
+        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, wake_key);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -180,24 +233,24 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
             node = FutexNode::RemoveFromHead(node, requeue_count,
                                              wake_key, requeue_key);
 
-            // now requeue our nodes to requeue_ptr mutex
+            // now requeue our nodes to requeue_ptr mutex, without waking them
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_shard, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_shard->futex_table.insert(node);
     }
 
     FutexNode::WakeThreads(wake_head);
     return NO_ERROR;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+void FutexContext::QueueNodesLocked(Shard* shard, FutexNode* head) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
     FutexNode::HashTable::iterator iter;
 
@@ -205,15 +258,26 @@ void FutexContext::QueueNodesLocked(FutexNode* head) {
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!shard->futex_table.insert_or_find(head, &iter))
         iter->AppendList(head);
 }
 
+bool FutexContext::UnqueueNode(FutexNode* node) {
+    // A node's key only changes with the lock of its current shard held, so once we hold
+    // the lock of the shard the key maps to, it stays put.
+    for (;;) {
+        Shard* shard = GetShard(node->GetKey());
+        AutoLock lock(shard->lock);
+        if (GetShard(node->GetKey()) == shard)
+            return UnqueueNodeLocked(shard, node);
+    }
+}
+
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
+bool FutexContext::UnqueueNodeLocked(Shard* shard, FutexNode* node) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
     if (!node->IsInQueue())
         return false;
@@ -224,10 +288,10 @@ bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
     // FutexRequeue(), so we need to re-get the hash table key here.
     uintptr_t futex_key = node->GetKey();
 
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = shard->futex_table.erase(futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
+        shard->futex_table.insert(new_head);
     return true;
 }
@@ -21,9 +21,9 @@ FutexNode::FutexNode() {
 FutexNode::~FutexNode() {
     LTRACE_ENTRY;
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&wait_queue_, state);
     wait_queue_destroy(&wait_queue_);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&wait_queue_, state);
 }
 
 bool FutexNode::IsInQueue() const {
@@ -102,10 +102,11 @@ FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
 // This blocks the current thread.  This releases the given mutex (which
 // must be held when BlockThread() is called).  To reduce contention, it
 // does not reclaim the mutex on return.
-status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t timeout) TA_NO_THREAD_SAFETY_ANALYSIS {
+status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t timeout,
+                                thread_t* owner) TA_NO_THREAD_SAFETY_ANALYSIS {
     lk_time_t t = mx_time_to_lk(timeout);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&wait_queue_, state);
 
     // We specifically want reschedule=false here, otherwise the
     // combination of releasing the mutex and enqueuing the current thread
@@ -113,19 +114,34 @@ status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t timeout) TA_NO_THREAD_SA
     mutex_release_internal(mutex->GetInternal(), /* reschedule= */ false);
 
     // Check whether a kill has been initiated, and block if not.  This
-    // check+wait must be done atomically (with respect to THREAD_LOCK),
-    // otherwise we could miss a thread termination.
+    // check+wait must be done atomically (with respect to the wait queue
+    // lock), otherwise we could miss a thread termination.
     thread_t* current_thread = get_current_thread();
     status_t result;
     if (current_thread->signals & THREAD_SIGNAL_KILL) {
         result = ERR_INTERRUPTED;
     } else {
+        if (owner) {
+            THREAD_LOCK(pi_state);
+            thread_pi_link_block(&pi_link_, owner);
+            THREAD_UNLOCK(pi_state);
+        }
+
         current_thread->interruptable = true;
         result = wait_queue_block(&wait_queue_, t);
         current_thread->interruptable = false;
+
+        if (owner) {
+            // Woken, timed out or killed: either way, stop lending our
+            // priority to the owner.
+            THREAD_LOCK(pi_state);
+            thread_pi_unblock(current_thread);
+            thread_pi_link_set_owner(&pi_link_, nullptr, -1);
+            THREAD_UNLOCK(pi_state);
+        }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&wait_queue_, state);
 
     return result;
 }
@@ -136,10 +152,14 @@ void FutexNode::WakeThreads(FutexNode* head) {
     FutexNode* node = head;
     do {
         FutexNode* next = node->queue_next_;
-        THREAD_LOCK(state);
-        wait_queue_wake_one(&node->wait_queue_, true, NO_ERROR);
-        THREAD_UNLOCK(state);
+        // Done before the wake, as once woken the thread may wait again on a futex in
+        // another shard and reuse its node.
         node->MarkAsNotInQueue();
+        WAIT_QUEUE_LOCK(&node->wait_queue_, state);
+        int woken = wait_queue_wake_one(&node->wait_queue_, true, NO_ERROR);
+        WAIT_QUEUE_UNLOCK(&node->wait_queue_, state);
+        if (woken > 0)
+            thread_reschedule();
         node = next;
     } while (node != head);
 }
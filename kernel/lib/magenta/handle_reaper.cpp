@@ -4,25 +4,85 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
-#include <lib/dpc.h>
-#include <kernel/mutex.h>
 #include <magenta/handle_reaper.h>
 
-static void ReaperRoutine(dpc_t* dpc);
+#include <arch/ops.h>
+#include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lk/init.h>
+#include <magenta/delete_handle.h>
+#include <stdio.h>
 
-static mutex_t reaper_mutex = MUTEX_INITIAL_VALUE(reaper_mutex);
-static mxtl::DoublyLinkedList<Handle*> reaper_handles TA_GUARDED(reaper_mutex);
-static dpc_t reaper_dpc = {
-    .node = LIST_INITIAL_CLEARED_VALUE,
-    .func = ReaperRoutine,
-    .arg = nullptr,
+// Each cpu queues handles on its own reaper, so that tearing down many processes at once
+// doesn't funnel through a single lock and thread. A reaper thread isn't pinned, but being
+// woken from its cpu it tends to run there.
+namespace {
+
+// How many handles a reaper returns to the handle arena per trip through its lock.
+constexpr size_t kReapBatch = 64u;
+
+struct Reaper {
+    spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+    mxtl::DoublyLinkedList<Handle*> handles;
+    event_t event;
 };
 
+Reaper reapers[SMP_MAX_CPUS];
+
+int ReaperThread(void* arg) {
+    Reaper* reaper = static_cast<Reaper*>(arg);
+    for (;;) {
+        event_wait(&reaper->event);
+
+        mxtl::DoublyLinkedList<Handle*> list;
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&reaper->lock, state);
+        list.swap(reaper->handles);
+        event_unsignal(&reaper->event);
+        spin_unlock_irqrestore(&reaper->lock, state);
+
+        Handle* batch[kReapBatch];
+        size_t count = 0u;
+        Handle* handle;
+        while ((handle = list.pop_front()) != nullptr) {
+            batch[count++] = handle;
+            if (count == kReapBatch) {
+                DeleteHandles(batch, count);
+                count = 0u;
+            }
+        }
+        if (count)
+            DeleteHandles(batch, count);
+    }
+    return 0;
+}
+
+// Runs on each cpu as it comes up, so only cpus that are present get a reaper thread. Nothing
+// reaps on a cpu before it gets here.
+void ReaperInit(uint level) {
+    uint cpu = arch_curr_cpu_num();
+    event_init(&reapers[cpu].event, false, 0);
+    char name[16];
+    snprintf(name, sizeof(name), "reaper %u", cpu);
+    thread_t* t = thread_create(name, ReaperThread, &reapers[cpu], DEFAULT_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+
+} // namespace
+
 void ReapHandles(mxtl::DoublyLinkedList<Handle*>* handles) {
-    AutoLock lock(reaper_mutex);
-    reaper_handles.splice(reaper_handles.end(), *handles);
-    if (!list_in_list(&reaper_dpc.node))
-        dpc_queue(&reaper_dpc, false);
+    spin_lock_saved_state_t irq_state;
+    arch_interrupt_save(&irq_state, SPIN_LOCK_FLAG_INTERRUPTS);
+    Reaper* reaper = &reapers[arch_curr_cpu_num()];
+
+    spin_lock(&reaper->lock);
+    reaper->handles.splice(reaper->handles.end(), *handles);
+    event_signal(&reaper->event, false);
+    spin_unlock(&reaper->lock);
+
+    arch_interrupt_restore(irq_state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 void ReapHandles(Handle** handles, uint32_t num_handles) {
@@ -32,13 +92,4 @@ void ReapHandles(Handle** handles, uint32_t num_handles) {
     ReapHandles(&list);
 }
 
-static void ReaperRoutine(dpc_t* dpc) {
-    mxtl::DoublyLinkedList<Handle*> list;
-    {
-        AutoLock lock(reaper_mutex);
-        list.swap(reaper_handles);
-    }
-    Handle* handle;
-    while ((handle = list.pop_front()) != nullptr)
-        DeleteHandle(handle);
-}
+LK_INIT_HOOK_FLAGS(handle_reaper, ReaperInit, LK_INIT_LEVEL_THREADING, LK_INIT_FLAG_ALL_CPUS);
@@ -56,7 +56,9 @@ private:
 
     ChannelDispatcher(uint32_t flags);
     void Init(mxtl::RefPtr<ChannelDispatcher> other);
-    void WriteSelf(mxtl::unique_ptr<MessagePacket> msg);
+    // |handoff| is set when the writer is about to block for a reply, and
+    // hands the cpu to a reader woken by the write.
+    void WriteSelf(mxtl::unique_ptr<MessagePacket> msg, bool handoff = false);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
@@ -6,7 +6,12 @@
 
 #pragma once
 
+#include <stddef.h>
+
 class Handle;
 
 // Deletes a |handle| made by MakeHandle() or DupHandle().
 void DeleteHandle(Handle* handle);
+
+// Deletes |count| such handles, returning them all to the arena in one go.
+void DeleteHandles(Handle* const* handles, size_t count);
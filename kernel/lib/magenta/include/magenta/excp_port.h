@@ -16,19 +16,25 @@ class PortDispatcher;
 
 class ExceptionPort : public mxtl::RefCounted<ExceptionPort> {
 public:
+    // If |snapshot| is true, architectural exceptions are sent with an
+    // mx_exception_snapshot_t of the faulting thread.
     static mx_status_t Create(mxtl::RefPtr<PortDispatcher> port, uint64_t port_key,
-                              mxtl::RefPtr<ExceptionPort>* eport);
+                              bool snapshot, mxtl::RefPtr<ExceptionPort>* eport);
     ~ExceptionPort();
 
     mx_status_t SendReport(const mx_exception_report_t* packet);
 
+    // Sends the report of an exception |thread| has taken. Must be called
+    // on |thread|, while it is stopped for the exception.
+    mx_status_t SendExceptionReport(const mx_exception_report_t* report, UserThread* thread);
+
     void OnThreadStart(UserThread* thread);
 
     void OnProcessExit(ProcessDispatcher* process);
     void OnThreadExit(UserThread* thread);
 
 private:
-    ExceptionPort(mxtl::RefPtr<PortDispatcher> port, uint64_t port_key);
+    ExceptionPort(mxtl::RefPtr<PortDispatcher> port, uint64_t port_key, bool snapshot);
 
     ExceptionPort(const ExceptionPort&) = delete;
     ExceptionPort& operator=(const ExceptionPort&) = delete;
@@ -44,4 +50,5 @@ private:
     // immutable (the io port itself has its own locking though).
     mxtl::RefPtr<PortDispatcher> port_;
     const uint64_t port_key_;
+    const bool snapshot_;
 };
@@ -13,6 +13,9 @@
 #include <sys/types.h>
 
 #include <mxtl/ref_counted.h>
+#include <mxtl/ref_ptr.h>
+
+class VmObject;
 
 class FifoDispatcher : public Dispatcher {
 public:
@@ -30,14 +33,30 @@ public:
     status_t AdvanceTail(uint64_t count, mx_fifo_state_t* out);
     status_t SetException(mx_signals_t signal, bool set, mx_fifo_state_t* out);
 
+    // Moves the state into a page of a VMO that the fifo's users can map, the first time it is
+    // called, and returns that VMO. From then on the producer and consumer may advance the head
+    // and tail in place, calling Sync() on the transitions that change the signals.
+    status_t GetStateVmo(mxtl::RefPtr<VmObject>* vmo);
+
+    // Updates the signals from the state, after the users of a mapped fifo moved it.
+    status_t Sync(mx_fifo_state_t* out);
+
 private:
     explicit FifoDispatcher(uint64_t count);
 
     // simple RAII class for returning mx_fifo_state_t
     class StateUpdater;
 
+    // the state lives in |state_| until it's mapped, and in the page at |mapped_state_| after
+    mx_fifo_state_t LoadStateLocked() const TA_REQ(lock_);
+    void StoreHeadLocked(uint64_t head) TA_REQ(lock_);
+    void StoreTailLocked(uint64_t tail) TA_REQ(lock_);
+    void UpdateSignalsLocked(const mx_fifo_state_t& state) TA_REQ(lock_);
+
     mutable Mutex lock_;
     const uint64_t count_;
     mx_fifo_state_t state_ TA_GUARDED(lock_);
+    mx_fifo_state_t* mapped_state_ TA_GUARDED(lock_) = nullptr;
+    mxtl::RefPtr<VmObject> state_vmo_ TA_GUARDED(lock_);
     StateTracker state_tracker_ TA_GUARDED(lock_);
 };
@@ -11,9 +11,12 @@
 #include <magenta/futex_node.h>
 #include <magenta/types.h>
 
+class UserThread;
+
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
-// to contain all active futexes.
+// to contain all active futexes. The table is split into shards by futex address, each with
+// its own lock, so that operations on unrelated futexes don't contend.
 // A futex is considered active if there is one or more threads blocked on the futex.
 // After no threads are left blocked on a futex it is removed from the hash table.
 // The value in the futex hash table is the FutexNode object associated with the head
@@ -35,6 +38,12 @@ public:
     // on the same |value_ptr| futex.
     status_t FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t timeout);
 
+    // FutexWaitPI is FutexWait, except that while the current thread is blocked
+    // it lends its priority to |owner|, the thread the caller believes holds the
+    // lock guarded by the futex. |owner| must belong to this futex context's process.
+    status_t FutexWaitPI(user_ptr<int> value_ptr, int current_value, UserThread* owner,
+                         mx_time_t timeout);
+
     // FutexWake will wake up to |count| number of threads blocked on the |value_ptr| futex.
     status_t FutexWake(user_ptr<int> value_ptr, uint32_t count);
 
@@ -49,16 +58,37 @@ public:
 
 private:
     FutexContext(const FutexContext&) = delete;
+
+    status_t FutexWaitInternal(user_ptr<int> value_ptr, int current_value, thread_t* owner,
+                               mx_time_t timeout);
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr uint kNumShardsShift = 4u;
+    static constexpr size_t kNumShards = 1u << kNumShardsShift;
+
+    struct Shard {
+        // protects futex_table
+        Mutex lock;
+
+        // Hash table for the futexes of this shard.
+        // Key is futex address, value is the FutexNode for the head of futex's blocked thread
+        // list.
+        FutexNode::HashTable futex_table TA_GUARDED(lock);
+    };
+
+    Shard* GetShard(uintptr_t futex_key);
+
+    void QueueNodesLocked(Shard* shard, FutexNode* head) TA_REQ(shard->lock);
+
+    bool UnqueueNodeLocked(Shard* shard, FutexNode* node) TA_REQ(shard->lock);
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    // FutexRequeue() with the locks of both shards held.
+    status_t RequeueLocked(Shard* wake_shard, user_ptr<int> wake_ptr, uint32_t wake_count,
+                           int current_value, Shard* requeue_shard, uintptr_t requeue_key,
+                           uint32_t requeue_count) TA_NO_THREAD_SAFETY_ANALYSIS;
 
-    // protects futex_table_
-    Mutex lock_;
+    // Removes |node| from whichever futex it now waits on, which a requeue may have changed.
+    bool UnqueueNode(FutexNode* node);
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    Shard shards_[kNumShards];
 };
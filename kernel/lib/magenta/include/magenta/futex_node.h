@@ -39,7 +39,9 @@ public:
                                      uintptr_t new_hash_key);
 
     // This must be called with |mutex| held and returns without |mutex| held.
-    status_t BlockThread(Mutex* mutex, mx_time_t timeout) TA_REL(mutex);
+    // If |owner| is not null, the current thread's priority is lent to it
+    // for as long as the current thread stays blocked.
+    status_t BlockThread(Mutex* mutex, mx_time_t timeout, thread_t* owner = nullptr) TA_REL(mutex);
 
     // wakes the list of threads starting with node |head|
     static void WakeThreads(FutexNode* head);
@@ -69,6 +71,9 @@ private:
     // Used for waking the thread corresponding to the FutexNode.
     wait_queue_t wait_queue_;
 
+    // Links the thread's priority to the futex owner named by a PI wait.
+    thread_pi_link_t pi_link_ = THREAD_PI_LINK_INITIAL_VALUE;
+
     // queue_prev_ and queue_next_ are used for maintaining a circular
     // doubly-linked list of threads that are waiting on one futex address.
     //  * When the list contains only this node, queue_prev_ and
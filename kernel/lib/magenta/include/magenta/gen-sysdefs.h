@@ -1,4 +1,4 @@
-// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Copyright 2026 The Fuchsia Authors. All rights reserved.
 // This is a GENERATED file. The license governing this file can be found in the LICENSE file.
 
 mx_time_t sys_time_get(
@@ -111,6 +111,19 @@ mx_status_t sys_channel_write(
     const mx_handle_t handles[],
     uint32_t num_handles);
 
+mx_status_t sys_channel_read_many(
+    mx_handle_t handle,
+    uint32_t options,
+    mx_channel_msg_t msgs[],
+    uint32_t count,
+    uint32_t actual[1]);
+
+mx_status_t sys_channel_write_many(
+    uint32_t options,
+    const mx_channel_msg_t msgs[],
+    uint32_t count,
+    uint32_t actual[1]);
+
 mx_status_t sys_channel_call(
     mx_handle_t handle,
     uint32_t options,
@@ -139,6 +152,11 @@ mx_status_t sys_socket_read(
     size_t size,
     size_t actual[1]);
 
+mx_status_t sys_socket_get_ring(
+    mx_handle_t handle,
+    uint32_t options,
+    mx_handle_t out[1]);
+
 void sys_thread_exit();
 
 mx_status_t sys_thread_create(
@@ -168,6 +186,12 @@ mx_status_t sys_thread_write_state(
     const void* buffer,
     uint32_t buffer_len);
 
+mx_status_t sys_thread_set_deadline(
+    mx_handle_t rsrc_handle,
+    mx_handle_t handle,
+    mx_time_t runtime,
+    mx_time_t period);
+
 void sys_process_exit(
     int retcode);
 
@@ -206,6 +230,17 @@ mx_status_t sys_job_create(
     uint32_t options,
     mx_handle_t out[1]);
 
+mx_status_t sys_job_set_cpu_limits(
+    mx_handle_t job,
+    uint32_t weight,
+    mx_time_t period,
+    mx_time_t quota);
+
+mx_status_t sys_job_set_memory_limits(
+    mx_handle_t job,
+    uint64_t soft_limit,
+    uint64_t hard_limit);
+
 mx_status_t sys_task_resume(
     mx_handle_t task_handle,
     uint32_t options);
@@ -227,6 +262,12 @@ mx_status_t sys_futex_wait(
     int current_value,
     mx_time_t timeout);
 
+mx_status_t sys_futex_wait_pi(
+    mx_futex_t value_ptr[1],
+    int current_value,
+    mx_handle_t owner,
+    mx_time_t timeout);
+
 mx_status_t sys_futex_wake(
     mx_futex_t value_ptr[1],
     uint32_t count);
@@ -273,12 +314,26 @@ mx_status_t sys_port_wait(
     void* packet,
     size_t size);
 
+mx_status_t sys_port_wait_many(
+    mx_handle_t handle,
+    mx_time_t timeout,
+    void* packets,
+    size_t size,
+    size_t packet_size,
+    uint32_t actual[1]);
+
 mx_status_t sys_port_bind(
     mx_handle_t handle,
     uint64_t key,
     mx_handle_t source,
     mx_signals_t signals);
 
+mx_status_t sys_batch_submit(
+    mx_handle_t ring,
+    mx_handle_t port,
+    uint32_t max_ops,
+    uint32_t actual[1]);
+
 mx_status_t sys_vmo_create(
     uint64_t size,
     uint32_t options,
@@ -314,6 +369,20 @@ mx_status_t sys_vmo_op_range(
     void* buffer,
     size_t buffer_size);
 
+mx_status_t sys_vmo_clone(
+    mx_handle_t handle,
+    uint32_t options,
+    uint64_t offset,
+    uint64_t size,
+    mx_handle_t out[1]);
+
+mx_status_t sys_vmo_move_pages(
+    mx_handle_t handle,
+    uint64_t offset,
+    mx_handle_t src_handle,
+    uint64_t src_offset,
+    uint64_t len);
+
 mx_status_t sys_cprng_draw(
     void* buffer,
     size_t len,
@@ -333,6 +402,10 @@ mx_status_t sys_fifo_op(
     uint64_t val,
     mx_fifo_state_t out[1]);
 
+mx_status_t sys_fifo_get_state_vmo(
+    mx_handle_t handle,
+    mx_handle_t out[1]);
+
 mx_status_t sys_log_create(
     uint32_t options,
     mx_handle_t out[1]);
@@ -368,6 +441,11 @@ mx_status_t sys_ktrace_write(
     uint32_t arg0,
     uint32_t arg1);
 
+mx_status_t sys_ktrace_stream_vmo(
+    mx_handle_t handle,
+    uint32_t cpu,
+    mx_handle_t out[1]);
+
 mx_handle_t sys_debug_transfer_handle(
     mx_handle_t proc,
     mx_handle_t handle);
@@ -397,6 +475,11 @@ mx_status_t sys_interrupt_complete(
 mx_status_t sys_interrupt_wait(
     mx_handle_t handle);
 
+mx_status_t sys_interrupt_set_affinity(
+    mx_handle_t handle,
+    uint32_t cpu,
+    uint32_t options);
+
 mx_status_t sys_mmap_device_io(
     mx_handle_t handle,
     uint32_t io_addr,
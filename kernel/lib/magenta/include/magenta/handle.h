@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <magenta/types.h>
@@ -24,12 +25,13 @@ public:
 
     mxtl::RefPtr<Dispatcher> dispatcher() const;
 
+    // Atomic, as handle lookups read it without the handle table lock.
     mx_koid_t process_id() const {
-        return process_id_;
+        return __atomic_load_n(&process_id_, __ATOMIC_ACQUIRE);
     }
 
     void set_process_id(mx_koid_t pid) {
-        process_id_ = pid;
+        __atomic_store_n(&process_id_, pid, __ATOMIC_SEQ_CST);
     }
 
     uint32_t rights() const {
@@ -37,8 +39,8 @@ public:
     }
 
 private:
-    // Handle should never be destroyed by anything other than the DeleteHandle function.
-    friend void DeleteHandle(Handle* handle);
+    // Handle should never be destroyed by anything other than the DeleteHandles function.
+    friend void DeleteHandles(Handle* const* handles, size_t count);
     ~Handle();
 
     mx_koid_t process_id_;
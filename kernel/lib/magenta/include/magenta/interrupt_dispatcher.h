@@ -7,6 +7,7 @@
 #pragma once
 
 #include <kernel/event.h>
+#include <kernel/thread.h>
 
 #include <magenta/dispatcher.h>
 #include <sys/types.h>
@@ -30,8 +31,43 @@ public:
     // Required before the handle can be waited upon again.
     virtual status_t InterruptComplete() = 0;
 
+    // Steer the interrupt so that it is delivered to |cpu|.  With
+    // MX_INTERRUPT_AFFINITY_BIND_WAITER, threads which go on to wait for the
+    // interrupt are pinned to |cpu| as well, so that they wake up where the
+    // interrupt was taken.
+    status_t SetAffinity(uint32_t cpu, uint32_t options) {
+        if (options & ~MX_INTERRUPT_AFFINITY_BIND_WAITER)
+            return ERR_INVALID_ARGS;
+        if (cpu >= SMP_MAX_CPUS)
+            return ERR_INVALID_ARGS;
+
+        status_t status = RouteToCpu(cpu);
+        if (status != NO_ERROR)
+            return status;
+
+        int waiter_cpu = (options & MX_INTERRUPT_AFFINITY_BIND_WAITER) ? (int)cpu : -1;
+        __atomic_store_n(&waiter_cpu_, waiter_cpu, __ATOMIC_RELEASE);
+        return NO_ERROR;
+    }
+
+    // The pin only lasts for the wait, however it ends.
     status_t WaitForInterrupt() {
-        return event_wait(&event_);
+        int waiter_cpu = __atomic_load_n(&waiter_cpu_, __ATOMIC_ACQUIRE);
+        thread_t* t = get_current_thread();
+        int prev_cpu = thread_pinned_cpu(t);
+        bool pin = (waiter_cpu >= 0) && (prev_cpu != waiter_cpu);
+        if (pin) {
+            THREAD_LOCK(state);
+            thread_set_pinned_cpu(t, waiter_cpu);
+            THREAD_UNLOCK(state);
+        }
+        status_t status = event_wait(&event_);
+        if (pin) {
+            THREAD_LOCK(state);
+            thread_set_pinned_cpu(t, prev_cpu);
+            THREAD_UNLOCK(state);
+        }
+        return status;
     }
 
     virtual void on_zero_handles() final {
@@ -50,6 +86,10 @@ protected:
         event_unsignal(&event_);
     }
 
+    // Route the underlying interrupt to |cpu|.
+    virtual status_t RouteToCpu(uint cpu) = 0;
+
 private:
     event_t event_;
+    int waiter_cpu_ = -1;
 };
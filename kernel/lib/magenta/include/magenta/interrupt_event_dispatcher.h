@@ -34,6 +34,7 @@ private:
     explicit InterruptEventDispatcher(uint32_t vector) : vector_(vector) { }
 
     static enum handler_return IrqHandler(void* ctx);
+    status_t RouteToCpu(uint cpu) final;
 
     const uint32_t vector_;
     mxtl::WAVLTreeNodeState<InterruptEventDispatcher*> wavl_node_state_;
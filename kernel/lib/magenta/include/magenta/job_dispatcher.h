@@ -9,6 +9,9 @@
 #include <stdint.h>
 
 #include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
 
 #include <magenta/dispatcher.h>
 #include <magenta/process_dispatcher.h>
@@ -28,7 +31,7 @@ public:
     virtual bool OnProcess(ProcessDispatcher* proc, uint32_t index) = 0;
 };
 
-class JobDispatcher final : public Dispatcher {
+class JobDispatcher final : public Dispatcher, private VmCommitCharge::Observer {
 public:
     // Traits to belong to the parent's job list.
     struct ListTraits {
@@ -59,8 +62,40 @@ public:
     bool AddChildProcess(ProcessDispatcher* process);
     void RemoveChildProcess(ProcessDispatcher* process);
     bool EnumerateChildren(JobEnumerator* je);
+
+    // Appends the MX_INFO_JOB_TASKS records of the job and of every job,
+    // process and thread below it. Each record is taken separately, so tasks
+    // created or destroyed meanwhile may or may not show up.
+    status_t GetTaskRecords(TaskRecordWriter* writer);
     void Kill();
 
+    // Scheduling. The threads of the job's processes, and of its child jobs'
+    // processes, share this job's cpu weight and bandwidth limit. If
+    // tighten_only, the weight may be lowered and the quota lowered or its
+    // period lengthened, but a cap may not be loosened or removed.
+    sched_group_t* sched_group() { return &sched_group_; }
+    status_t SetCpuLimits(uint32_t weight, mx_time_t period, mx_time_t quota,
+                          bool tighten_only);
+
+    // Asserts or deasserts MX_JOB_MEMORY_PRESSURE on this job and every job
+    // below it.
+    void SetMemoryPressure(bool pressure);
+
+    // Totals of the page counters of the address spaces of the job's processes,
+    // and of its child jobs' processes.
+    VmPageCounters& page_counters() { return page_counters_; }
+
+    // The pages committed to the VMOs created by the job's processes, and by
+    // its child jobs' processes, and the limits on them. Crossing the limits
+    // raises MX_JOB_MEMORY_SOFT_LIMIT and MX_JOB_MEMORY_HARD_LIMIT. If
+    // tighten_only, the limits may be lowered or added but not raised or
+    // removed.
+    const mxtl::RefPtr<VmCommitCharge>& commit_charge() const { return commit_charge_; }
+    status_t SetMemoryLimits(uint64_t soft_bytes, uint64_t hard_bytes, bool tighten_only);
+
+    // Whether job is this job or one of its ancestors.
+    bool IsWithin(const JobDispatcher* job);
+
 private:
     enum class State {
         READY,
@@ -68,11 +103,29 @@ private:
         DEAD
     };
 
-    JobDispatcher(uint32_t flags, mxtl::RefPtr<JobDispatcher> parent);
+    JobDispatcher(uint32_t flags, mxtl::RefPtr<JobDispatcher> parent,
+                  mxtl::RefPtr<VmCommitCharge> commit_charge);
+    static mxtl::RefPtr<VmCommitCharge> CreateCommitCharge(JobDispatcher* parent);
+
+    // VmCommitCharge::Observer implementation.
+    void OnCommitLimitChange(bool over_soft, bool over_hard) final;
     bool AddChildJob(JobDispatcher* job);
     void RemoveChildJob(JobDispatcher* job);
     void MaybeUpdateSignalsLocked(bool is_decrement) TA_REQ(lock_);
 
+    // Appends the records of the job itself and of its processes.
+    status_t GetOwnTaskRecords(TaskRecordWriter* writer);
+
+    // Returns the job after this one in a depth first walk of the tree below
+    // |root|, or null at the end. Only one job's lock is held at a time, and
+    // the walk doesn't recurse, so deep trees can't overflow the stack.
+    mxtl::RefPtr<JobDispatcher> NextJobInWalk(JobDispatcher* root);
+
+    // Returns a reference to the first child job after |after|, or to the first
+    // one if |after| is null, skipping any being destroyed. Returns null if
+    // there's none, or if |after| is no longer our child.
+    mxtl::RefPtr<JobDispatcher> NextChildJobLocked(JobDispatcher* after) TA_REQ(lock_);
+
     const mxtl::RefPtr<JobDispatcher> parent_;
 
     mxtl::DoublyLinkedListNodeState<JobDispatcher*> dll_job_;
@@ -84,6 +137,16 @@ private:
     uint32_t job_count_ TA_GUARDED(lock_);
     StateTracker state_tracker_;
 
+    // Protected by the thread lock rather than |lock_|. Its limits are only
+    // changed with |cpu_limits_lock_| held as well, so they may be read under
+    // either.
+    Mutex cpu_limits_lock_;
+    sched_group_t sched_group_;
+
+    // Updated atomically.
+    VmPageCounters page_counters_;
+    const mxtl::RefPtr<VmCommitCharge> commit_charge_;
+
     using WeakJobList =
         mxtl::DoublyLinkedList<JobDispatcher*, ListTraits>;
     using WeakProcessList =
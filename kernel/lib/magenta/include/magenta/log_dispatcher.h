@@ -18,6 +18,8 @@ public:
     mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_LOG; }
 
     status_t Write(const void* ptr, size_t len, uint32_t flags);
+    // Writes each '\n' separated line of the user buffer as its own record.
+    status_t WriteBatchFromUser(const void* userptr, size_t len);
     status_t Read(void* ptr, size_t len, uint32_t flags);
     status_t ReadFromUser(void* userptr, size_t len, uint32_t flags);
 
@@ -8,11 +8,14 @@
 
 #include <stdint.h>
 
+#include <lib/user_copy/user_ptr.h>
 #include <magenta/types.h>
 #include <mxtl/intrusive_double_list.h>
+#include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 
 class Handle;
+class VmObject;
 
 class MessagePacket : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<MessagePacket>> {
 public:
@@ -20,11 +23,28 @@ public:
     static mx_status_t Create(uint32_t data_size, uint32_t num_handles,
                               mxtl::unique_ptr<MessagePacket>* msg);
 
+    // Whether a payload is large and page aligned enough to be sent by moving the
+    // pages backing it instead of copying it.
+    static bool CanMovePages(const void* data, uint32_t data_size);
+
+    // Creates a message packet whose payload is the pages backing |data| in the
+    // current process, moved into an object owned by the packet. If they can't be
+    // moved the payload is copied into the object instead. Either way the
+    // caller's copy of the payload is left undefined.
+    static mx_status_t CreateFromUserPages(user_ptr<const void> data, uint32_t data_size,
+                                           uint32_t num_handles,
+                                           mxtl::unique_ptr<MessagePacket>* msg);
+
     uint32_t data_size() const { return data_size_; }
     uint32_t num_handles() const { return num_handles_; }
 
     void set_owns_handles(bool own_handles) { owns_handles_ = own_handles; }
 
+    // Copies the payload out to the current process. Payloads held in pages are
+    // moved into the destination instead when it is page aligned.
+    mx_status_t CopyDataToUser(user_ptr<void> dst);
+
+    // Only valid for packets that aren't holding their payload in pages.
     const void* data() const { return static_cast<void*>(handles_ + num_handles_); }
     void* mutable_data() { return static_cast<void*>(handles_ + num_handles_); }
     Handle* const* handles() const { return handles_; }
@@ -32,25 +52,21 @@ public:
 
     // channel calls treat the leading uint32_t of the payload as
     // a transaction id
-    uint32_t get_txid() const {
-        if (data_size_ < sizeof(uint32_t)) {
-            return 0;
-        } else {
-            return *(reinterpret_cast<const uint32_t*>(data()));
-        }
-    }
+    uint32_t get_txid() const;
 
 private:
     MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
     ~MessagePacket();
 
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    // Returns the storage to the per cpu packet cache it came from.
+    static void operator delete(void* ptr);
     friend class mxtl::unique_ptr<MessagePacket>;
 
     bool owns_handles_;
     uint32_t data_size_;
     uint32_t num_handles_;
     Handle** handles_;
+
+    // The payload, if it was sent with MX_CHANNEL_WRITE_MOVE_PAGES.
+    mxtl::RefPtr<VmObject> pages_;
 };
@@ -29,6 +29,8 @@ private:
     static pcie_irq_handler_retval_t IrqThunk(const PcieDevice& dev,
                                               uint irq_id,
                                               void* ctx);
+    status_t RouteToCpu(uint cpu) final;
+
     PciInterruptDispatcher(uint32_t irq_id, bool maskable)
         : irq_id_(irq_id),
           maskable_(maskable) { }
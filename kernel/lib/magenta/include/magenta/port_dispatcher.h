@@ -9,6 +9,7 @@
 #include <new.h>
 #include <kernel/mutex.h>
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
 
 #include <magenta/dispatcher.h>
 #include <magenta/syscalls/port.h>
@@ -19,12 +20,17 @@
 #include <sys/types.h>
 
 
+class IOP_PacketCache;
+
 struct IOP_Packet : public mxtl::DoublyLinkedListable<IOP_Packet*> {
     friend struct IOP_PacketListTraits;
 
     static IOP_Packet* Alloc(size_t size);
     static IOP_Packet* Make(const void* data, size_t size);
-    static IOP_Packet* MakeFromUser(const void* data, size_t size);
+    // If |cache| is given the packet is taken from it, or allocated to go
+    // back to it when deleted.
+    static IOP_Packet* MakeFromUser(const void* data, size_t size,
+                                    IOP_PacketCache* cache = nullptr);
     static void Delete(IOP_Packet* packet);
 
     IOP_Packet(size_t data_size)
@@ -37,6 +43,29 @@ struct IOP_Packet : public mxtl::DoublyLinkedListable<IOP_Packet*> {
 
     bool is_signal;
     size_t data_size;
+
+    // The cache the packet returns to, if any.
+    IOP_PacketCache* cache = nullptr;
+    // Link in the port's queue of newly queued packets.
+    IOP_Packet* queue_next = nullptr;
+};
+
+// A free list of packets big enough for any packet queued from user
+// space, so that queuing and waiting don't have to go to the heap.
+class IOP_PacketCache {
+public:
+    IOP_PacketCache();
+    ~IOP_PacketCache();
+
+    // A cached packet for |size| bytes, or null if there are none.
+    IOP_Packet* Get(size_t size);
+    // Takes a packet back, returning false if the cache is full.
+    bool Put(IOP_Packet* packet);
+
+private:
+    spin_lock_t lock_;
+    mxtl::DoublyLinkedList<IOP_Packet*> free_;
+    size_t count_;
 };
 
 struct IOP_Signal : public IOP_Packet {
@@ -49,10 +78,11 @@ struct IOP_Signal : public IOP_Packet {
 // Port job is to deliver packets to threads waiting in Wait(). There
 // are two types of packets:
 //
-// 1- Manually posted via Queue(), they are allocated in the
-//    heap by the caller and freed in the syscall layer at the bottom
-//    of mx_port_wait(). These Packets are of type IOP_Packet and only
-//    live in the |packets| list.
+// 1- Manually posted via Queue(), they are allocated by the caller,
+//    usually from the port's |packet_cache_|, and freed back to it in
+//    the syscall layer at the bottom of mx_port_wait(). These Packets are
+//    of type IOP_Packet. Queue() pushes them onto the lock free
+//    |queued_| stack, and Wait() moves them to the |packets_| list.
 //
 // 2- Posted by bound dispatchers via Signal(), they are allocated once
 //    during their first Signal() call and only freed when the IO port
@@ -84,13 +114,29 @@ public:
 
     mx_status_t Wait(mx_time_t timeout, IOP_Packet** packet);
 
+    // Waits like Wait() for a packet, then takes up to |count| of those queued
+    // without waiting for more. Packets of more than |max_size| bytes are left
+    // queued, and if the first is one ERR_BUFFER_TOO_SMALL is returned.
+    mx_status_t WaitMany(mx_time_t timeout, IOP_Packet** packets, size_t count,
+                         size_t max_size, size_t* actual);
+
+    IOP_PacketCache* packet_cache() { return &packet_cache_; }
+
 private:
     PortDispatcher(uint32_t options);
     void FreePacketsLocked() TA_REQ(lock_);
+    // Moves the packets pushed by Queue() to the end of |packets_|, oldest first.
+    void TakeQueuedLocked() TA_REQ(lock_);
+    IOP_Packet* PopLocked() TA_REQ(lock_);
+
+    IOP_PacketCache packet_cache_;
 
     Mutex lock_;
-    bool no_clients_ TA_GUARDED(lock_);
+    // Set under |lock_|, but read by Queue() without it.
+    bool no_clients_;
+    // Stack of packets from Queue(), pushed and taken atomically.
+    IOP_Packet* queued_;
     mxtl::DoublyLinkedList<IOP_Packet*> packets_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<IOP_Packet*> at_zero_ TA_GUARDED(lock_);
-    event_t event_ TA_GUARDED(lock_);
+    event_t event_;
 };
@@ -6,10 +6,14 @@
 
 #pragma once
 
+#include <arch/defines.h>
+#include <arch/ops.h>
 #include <kernel/event.h>
 #include <kernel/mutex.h>
 #include <kernel/thread.h>
 #include <kernel/vm/vm_aspace.h>
+#include <lib/user_copy/user_ptr.h>
+#include <new.h>
 
 #include <magenta/dispatcher.h>
 #include <magenta/futex_context.h>
@@ -28,6 +32,27 @@
 
 class JobDispatcher;
 
+// Copies the records of MX_INFO_JOB_TASKS out to the user's buffer as they are
+// produced, keeping count of those that did not fit.
+class TaskRecordWriter {
+public:
+    TaskRecordWriter(user_ptr<mx_info_task_record_t> records, size_t max)
+        : records_(records), max_(max) {}
+
+    void Append(const mx_info_task_record_t& record);
+
+    size_t actual() const { return actual_; }
+    size_t avail() const { return avail_; }
+    status_t status() const { return status_; }
+
+private:
+    user_ptr<mx_info_task_record_t> records_;
+    const size_t max_;
+    size_t actual_ = 0;
+    size_t avail_ = 0;
+    status_t status_ = NO_ERROR;
+};
+
 class ProcessDispatcher : public Dispatcher {
 public:
     static mx_status_t Create(
@@ -101,6 +126,7 @@ public:
     // back into this process.
     void UndoRemoveHandleLocked(mx_handle_t handle_value) TA_REQ(handle_table_lock_);
 
+    // Doesn't take |handle_table_lock_|, see WaitForLookupsLocked().
     bool GetDispatcher(mx_handle_t handle_value, mxtl::RefPtr<Dispatcher>* dispatcher,
                        uint32_t* rights);
 
@@ -155,6 +181,9 @@ public:
 
     status_t GetThreads(mxtl::Array<mx_koid_t>* threads);
 
+    // Appends the MX_INFO_JOB_TASKS records of the process and its threads.
+    void GetTaskRecords(TaskRecordWriter* writer);
+
     // exception handling support
     status_t SetExceptionPort(mxtl::RefPtr<ExceptionPort> eport, bool debugger);
     void ResetExceptionPort(bool debugger);
@@ -187,6 +216,9 @@ private:
 
     ProcessDispatcher(mxtl::RefPtr<JobDispatcher> job, mxtl::StringPiece name, uint32_t flags);
 
+    // Allocates cache line aligned, which |lookups_| relies on.
+    static void* operator new(size_t size, AllocChecker* ac) noexcept;
+
     ProcessDispatcher(const ProcessDispatcher&) = delete;
     ProcessDispatcher& operator=(const ProcessDispatcher&) = delete;
 
@@ -221,10 +253,23 @@ private:
     // the enclosing job
     const mxtl::RefPtr<JobDispatcher> job_;
 
+    // Waits until every lock-free lookup that could still see a handle just removed from the
+    // table has finished with it.
+    void WaitForLookupsLocked() TA_REQ(handle_table_lock_);
+
     // our list of handles
     mutable Mutex handle_table_lock_; // protects |handles_|.
     mxtl::DoublyLinkedList<Handle*> handles_ TA_GUARDED(handle_table_lock_);
 
+    // GetDispatcher() lookups in flight, per cpu and per epoch. A lookup counts itself in
+    // the current epoch, and a removal moves to the next epoch and waits for the count of the
+    // previous one to drain. Each cpu's counts get their own cache line.
+    struct LookupCounts {
+        uint32_t count[2];
+    } __CPU_ALIGN;
+    LookupCounts lookups_[SMP_MAX_CPUS] = {};
+    uint32_t lookup_epoch_ = 0u;
+
     StateTracker state_tracker_;
 
     FutexContext futex_context_;
@@ -42,29 +42,51 @@ public:
     mx_status_t Read(void* dest, size_t len, bool from_user,
                      size_t* nread);
 
+    // The VMO holding the ring this end reads from, or with |peer| the one it writes to. Only
+    // sockets created with MX_SOCKET_SHARED_RING have one.
+    status_t GetRing(bool peer, mxtl::RefPtr<VmObject>* vmo);
+
+    // Brings the signals in line with a shared ring that userspace has moved the indices of, for
+    // the ring this end reads from or with |peer| the one it writes to.
+    status_t SyncRing(bool peer);
+
     void OnPeerZeroHandles();
 
 private:
     class CBuf {
     public:
         ~CBuf();
-        bool Init(uint32_t len);
+        // With |shared| the indices live in a mx_socket_ring_t at the front of the VMO, where
+        // the peers can move them without trapping into the kernel.
+        bool Init(uint32_t len, bool shared);
         size_t Write(const void* src, size_t len, bool from_user);
         size_t Read(void* dest, size_t len, bool from_user);
         size_t CouldRead() const;
         size_t free() const;
         bool empty() const;
 
+        const mxtl::RefPtr<VmObject>& vmo() const { return vmo_; }
+        bool shared() const { return ring_ != nullptr; }
+
     private:
+        // userspace may scribble on a shared ring's indices, so they're masked when loaded
+        size_t head() const;
+        size_t tail() const;
+        void set_head(size_t head);
+        void set_tail(size_t tail);
+
         size_t head_ = 0u;
         size_t tail_ = 0u;
         uint32_t len_pow2_ = 0u;
+        size_t data_offset_ = 0u;
         char* buf_ = nullptr;
+        mx_socket_ring_t* ring_ = nullptr;
         mxtl::RefPtr<VmObject> vmo_;
     };
 
     SocketDispatcher(uint32_t flags);
-    mx_status_t Init(mxtl::RefPtr<SocketDispatcher> other);
+    mx_status_t Init(mxtl::RefPtr<SocketDispatcher> other, uint32_t size);
+    void SyncRingLocked() TA_REQ(lock_);
     mx_status_t WriteSelf(const void* src, size_t len, bool from_user,
                           size_t* nwritten);
     status_t  UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
@@ -74,6 +96,7 @@ private:
 
     // The |lock_| protects all members below.
     Mutex lock_;
+    const uint32_t flags_;
     CBuf cbuf_ TA_GUARDED(lock_);
     mxtl::RefPtr<SocketDispatcher> other_ TA_GUARDED(lock_);
     mxtl::unique_ptr<PortClient> iopc_ TA_GUARDED(lock_);
@@ -22,8 +22,8 @@ public:
     // WARNING: This is called under StateTracker's mutex.
     virtual bool OnInitialize(mx_signals_t initial_state) = 0;
 
-    // Called whenever the state changes, to give it the new state. Returns true if a thread was
-    // awoken.
+    // Called whenever signals the observer is interested in (see set_interest()) change, to give
+    // it the new state. Returns true if a thread was awoken.
     // WARNING: This is called under StateTracker's mutex
     virtual bool OnStateChange(mx_signals_t new_state) = 0;
 
@@ -39,9 +39,18 @@ public:
 protected:
     ~StateObserver() {}
 
+    // The signals whose changes OnStateChange() is called for. Changes to other signals are
+    // skipped. This must not change while the observer is added to a StateTracker.
+    void set_interest(mx_signals_t interest) { interest_ = interest; }
+
 private:
+    friend class StateTracker;
     friend struct StateObserverListTraits;
     mxtl::DoublyLinkedListNodeState<StateObserver*> state_observer_list_node_state_;
+
+    mx_signals_t interest_ = 0u;
+    // The StateTracker observer group this is on.
+    uint32_t group_ = 0u;
 };
 
 // For use by StateTracker to maintain a list of StateObservers. (We don't use the default traits so
@@ -41,15 +41,27 @@ public:
     void Cancel(Handle* handle);
 
     // Notify others of a change in state (possibly waking them). (Clearing satisfied signals or
-    // setting satisfiable signals should not wake anyone.)
+    // setting satisfiable signals should not wake anyone.) Only observers interested in one of
+    // the changed signals are notified.
     void UpdateState(mx_signals_t clear_mask, mx_signals_t set_mask);
 
     mx_signals_t GetSignalsState() { return signals_; }
 
 private:
+    // Observers are grouped by the signals they are interested in, so that a state change
+    // only walks the groups it concerns. Observers that don't find a group of their own share
+    // the last one, whose interest is the union of theirs.
+    static constexpr uint32_t kNumGroups = 4u;
+    struct ObserverGroup {
+        mx_signals_t interest = 0u;
+        mxtl::DoublyLinkedList<StateObserver*, StateObserverListTraits> observers;
+    };
+
+    uint32_t FindGroupLocked(mx_signals_t interest) TA_REQ(lock_);
+
     mx_signals_t signals_;
     Mutex lock_;
 
-    // Active observers are elements in |observers_|.
-    mxtl::DoublyLinkedList<StateObserver*, StateObserverListTraits> observers_ TA_GUARDED(lock_);
+    // Active observers are elements of the groups' lists.
+    ObserverGroup groups_[kNumGroups] TA_GUARDED(lock_);
 };
@@ -62,11 +62,17 @@ public:
     ThreadDispatcher* dispatcher() { return dispatcher_; }
 
     FutexNode* futex_node() { return &futex_node_; }
+    thread_t* kernel_thread() { return &thread_; }
     StateTracker* state_tracker() { return &state_tracker_; }
     const char* name() const { return thread_.name; }
     status_t set_name(const char* name, size_t len);
     void get_name(char out_name[MX_MAX_NAME_LEN]);
     uint64_t runtime_ns() const { return thread_runtime(&thread_); }
+    State state();
+
+    // Moves the thread into the deadline scheduling class, or back out of it
+    // if |runtime| is 0. See thread_set_deadline().
+    status_t SetDeadline(mx_time_t runtime, mx_time_t period);
 
     status_t SetExceptionPort(ThreadDispatcher* td, mxtl::RefPtr<ExceptionPort> eport);
     void ResetExceptionPort();
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <kernel/mutex.h>
+
 #include <magenta/dispatcher.h>
 #include <magenta/state_tracker.h>
 
@@ -38,6 +40,20 @@ public:
 private:
     explicit VmObjectDispatcher(mxtl::RefPtr<VmObject> vmo);
 
+    mx_status_t Lock(uint64_t offset, uint64_t size);
+    mx_status_t Unlock();
+
+    // LOCKs taken through this object, by process, so that one process
+    // cannot UNLOCK what another locked. Left over ones go with the object.
+    static constexpr size_t kMaxLockers = 8;
+    struct Locker {
+        mx_koid_t koid;
+        uint32_t count;
+    };
+
     mxtl::RefPtr<VmObject> vmo_;
     StateTracker state_tracker_;
+
+    Mutex lock_;
+    Locker lockers_[kMaxLockers] TA_GUARDED(lock_) = {};
 };
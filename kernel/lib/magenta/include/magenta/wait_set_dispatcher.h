@@ -79,6 +79,10 @@ public:
             return triggered_entries_node_state_.InContainer();
         }
 
+        // Undoes the triggering (including removal from the triggered list), unsignaling the
+        // wait set if it was the last triggered entry. It must be triggered.
+        void UntriggerLocked();
+
         // Used to be in the |entries_| tree.
         uint64_t GetKey() const { return cookie_; }
 
@@ -115,7 +119,12 @@ public:
         mxtl::WAVLTreeNodeState<WAVLTreePtrType> wavl_node_state_;
     };
 
-    static status_t Create(mxtl::RefPtr<Dispatcher>* dispatcher, mx_rights_t* rights);
+    // In an |edge_triggered| wait set an entry only triggers when one of its watched signals
+    // becomes asserted, and Wait() consumes the triggers it reports. Otherwise entries stay
+    // triggered for as long as a watched signal is asserted.
+    static status_t Create(bool edge_triggered,
+                           mxtl::RefPtr<Dispatcher>* dispatcher,
+                           mx_rights_t* rights);
 
     ~WaitSetDispatcher() final;
     mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_WAIT_SET; }
@@ -139,7 +148,7 @@ private:
     using WAVLTreeKeyTraits = mxtl::DefaultKeyedObjectTraits<uint64_t, Entry>;
     using WAVLTreeNodeTraits = Entry::WAVLTreeNodeTraits;
 
-    WaitSetDispatcher();
+    explicit WaitSetDispatcher(bool edge_triggered);
 
     WaitSetDispatcher(const WaitSetDispatcher&) = delete;
     WaitSetDispatcher& operator=(const WaitSetDispatcher&) = delete;
@@ -152,6 +161,8 @@ private:
     // We are *not* waitable, but we need to observe handle "cancellation".
     StateTracker state_tracker_;
 
+    const bool edge_triggered_;
+
     // WARNING: No other locks may be taken under |mutex_|.
     Mutex mutex_;  // Protects the following members.
 
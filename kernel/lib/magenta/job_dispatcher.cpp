@@ -9,7 +9,10 @@
 #include <err.h>
 #include <new.h>
 
+#include <arch/ops.h>
+
 #include <kernel/auto_lock.h>
+#include <kernel/vm.h>
 
 #include <magenta/process_dispatcher.h>
 
@@ -17,9 +20,20 @@ constexpr mx_rights_t kDefaultJobRights =
     MX_RIGHT_TRANSFER | MX_RIGHT_DUPLICATE | MX_RIGHT_READ | MX_RIGHT_WRITE |
     MX_RIGHT_ENUMERATE;
 
+mxtl::RefPtr<VmCommitCharge> JobDispatcher::CreateCommitCharge(JobDispatcher* parent) {
+    AllocChecker ac;
+    auto charge = mxtl::AdoptRef(new (&ac) VmCommitCharge(parent ? parent->commit_charge_
+                                                                 : nullptr));
+    return ac.check() ? charge : nullptr;
+}
+
 mxtl::RefPtr<JobDispatcher> JobDispatcher::CreateRootJob() {
+    auto charge = CreateCommitCharge(nullptr);
+    if (!charge)
+        return nullptr;
+
     AllocChecker ac;
-    auto job = mxtl::AdoptRef(new (&ac) JobDispatcher(0u, nullptr));
+    auto job = mxtl::AdoptRef(new (&ac) JobDispatcher(0u, nullptr, mxtl::move(charge)));
     return ac.check() ? job  : nullptr;
 }
 
@@ -27,34 +41,100 @@ status_t JobDispatcher::Create(uint32_t flags,
                                mxtl::RefPtr<JobDispatcher> parent,
                                mxtl::RefPtr<Dispatcher>* dispatcher,
                                mx_rights_t* rights) {
+    auto charge = CreateCommitCharge(parent.get());
+    if (!charge)
+        return ERR_NO_MEMORY;
+
     AllocChecker ac;
-    auto job = new (&ac) JobDispatcher(flags, parent);
+    auto job = mxtl::AdoptRef(new (&ac) JobDispatcher(flags, parent, mxtl::move(charge)));
     if (!ac.check())
         return ERR_NO_MEMORY;
 
-    if (!parent->AddChildJob(job)) {
-        delete job;
+    // Adopted before it goes on the list, where SetMemoryPressure() takes
+    // references to it.
+    if (!parent->AddChildJob(job.get()))
         return ERR_BAD_STATE;
-    }
 
     *rights = kDefaultJobRights;
-    *dispatcher = mxtl::AdoptRef<Dispatcher>(job);
+    *dispatcher = mxtl::move(job);
     return NO_ERROR;
 }
 
 JobDispatcher::JobDispatcher(uint32_t /*flags*/,
-                             mxtl::RefPtr<JobDispatcher> parent)
+                             mxtl::RefPtr<JobDispatcher> parent,
+                             mxtl::RefPtr<VmCommitCharge> commit_charge)
     : parent_(mxtl::move(parent)),
       state_(State::READY),
       process_count_(0u), job_count_(0u),
-      state_tracker_(MX_JOB_NO_PROCESSES|MX_JOB_NO_JOBS) {
+      state_tracker_(MX_JOB_NO_PROCESSES|MX_JOB_NO_JOBS|
+                     (pmm_memory_pressure() ? MX_JOB_MEMORY_PRESSURE : 0u)),
+      page_counters_(parent_ ? &parent_->page_counters_ : nullptr),
+      commit_charge_(mxtl::move(commit_charge)) {
+    sched_group_init(&sched_group_, parent_ ? parent_->sched_group() : nullptr);
+    commit_charge_->set_observer(this);
 }
 
 JobDispatcher::~JobDispatcher() {
+    // VMOs charged to us may outlive us.
+    commit_charge_->set_observer(nullptr);
+
+    // Our processes and child jobs hold references to us, so no thread can
+    // still be in the scheduling group.
+    sched_group_destroy(&sched_group_);
     if (parent_)
         parent_->RemoveChildJob(this);
 }
 
+status_t JobDispatcher::SetCpuLimits(uint32_t weight, mx_time_t period, mx_time_t quota,
+                                     bool tighten_only) {
+    // Check everything up front so a failure leaves the limits as they were.
+    if (weight == 0 || weight > SCHED_GROUP_MAX_WEIGHT)
+        return ERR_INVALID_ARGS;
+    if (period != 0 && quota > period * arch_max_num_cpus())
+        return ERR_INVALID_ARGS;
+
+    AutoLock lock(&cpu_limits_lock_);
+
+    if (tighten_only) {
+        if (weight > sched_group_.weight)
+            return ERR_ACCESS_DENIED;
+        // Comparing quota and period separately, rather than their ratio,
+        // also keeps the longest burst from growing.
+        if (sched_group_.period_ns != 0 &&
+            (period == 0 || quota > sched_group_.quota_ns || period < sched_group_.period_ns))
+            return ERR_ACCESS_DENIED;
+    }
+
+    status_t status = sched_group_set_bandwidth(&sched_group_, period, quota);
+    if (status != NO_ERROR)
+        return status;
+    return sched_group_set_weight(&sched_group_, weight);
+}
+
+status_t JobDispatcher::SetMemoryLimits(uint64_t soft_bytes, uint64_t hard_bytes,
+                                        bool tighten_only) {
+    if (soft_bytes > SIZE_MAX - PAGE_SIZE || hard_bytes > SIZE_MAX - PAGE_SIZE)
+        return ERR_OUT_OF_RANGE;
+    return commit_charge_->SetLimits(ROUNDUP_PAGE_SIZE(soft_bytes) / PAGE_SIZE,
+                                     ROUNDUP_PAGE_SIZE(hard_bytes) / PAGE_SIZE,
+                                     tighten_only);
+}
+
+bool JobDispatcher::IsWithin(const JobDispatcher* job) {
+    for (JobDispatcher* j = this; j != nullptr; j = j->parent_.get()) {
+        if (j == job)
+            return true;
+    }
+    return false;
+}
+
+void JobDispatcher::OnCommitLimitChange(bool over_soft, bool over_hard) {
+    mx_signals_t set = (over_soft ? MX_JOB_MEMORY_SOFT_LIMIT : 0u) |
+                       (over_hard ? MX_JOB_MEMORY_HARD_LIMIT : 0u);
+    mx_signals_t clear = (MX_JOB_MEMORY_SOFT_LIMIT | MX_JOB_MEMORY_HARD_LIMIT) & ~set;
+    state_tracker_.UpdateState(clear, set);
+}
+
 void JobDispatcher::on_zero_handles() {
 }
 
@@ -79,6 +159,10 @@ bool JobDispatcher::AddChildJob(JobDispatcher* job) {
     jobs_.push_back(job);
     ++job_count_;
     MaybeUpdateSignalsLocked(false);
+
+    // The pressure may have changed since |job| was constructed, while it wasn't
+    // on our list for SetMemoryPressure() to find.
+    job->SetMemoryPressure(pmm_memory_pressure());
     return true;
 }
 
@@ -98,6 +182,9 @@ void JobDispatcher::RemoveChildJob(JobDispatcher* job) {
     AutoLock lock(&lock_);
     if (state_ != State::READY)
         return;
+    // A job that failed to be added calls us from its destructor too.
+    if (!ListTraits::node_state(*job).InContainer())
+        return;
     jobs_.erase(*job);
     --job_count_;
     MaybeUpdateSignalsLocked(true);
@@ -184,6 +271,115 @@ void JobDispatcher::Kill() {
     }
 }
 
+void JobDispatcher::SetMemoryPressure(bool pressure) {
+    // Jobs created meanwhile pick the pressure up in AddChildJob().
+    for (auto job = mxtl::WrapRefPtr(this); job; job = job->NextJobInWalk(this)) {
+        AutoLock lock(&job->lock_);
+        if (pressure)
+            job->state_tracker_.UpdateState(0u, MX_JOB_MEMORY_PRESSURE);
+        else
+            job->state_tracker_.UpdateState(MX_JOB_MEMORY_PRESSURE, 0u);
+    }
+}
+
+mxtl::RefPtr<JobDispatcher> JobDispatcher::NextJobInWalk(JobDispatcher* root) {
+    mxtl::RefPtr<JobDispatcher> next;
+    {
+        AutoLock lock(&lock_);
+        next = NextChildJobLocked(nullptr);
+    }
+
+    // Out of children: go back up to the nearest job with a next sibling.
+    // References are dropped outside of the locks, since the last one takes
+    // the parent's lock to leave its list.
+    mxtl::RefPtr<JobDispatcher> job = mxtl::WrapRefPtr(this);
+    while (!next && job.get() != root) {
+        mxtl::RefPtr<JobDispatcher> parent = job->parent_;
+        {
+            AutoLock lock(&parent->lock_);
+            next = parent->NextChildJobLocked(job.get());
+        }
+        job = mxtl::move(parent);
+    }
+    return next;
+}
+
+mxtl::RefPtr<JobDispatcher> JobDispatcher::NextChildJobLocked(JobDispatcher* after) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // While we aren't READY the children are on Kill()'s list instead.
+    if (state_ != State::READY)
+        return nullptr;
+
+    auto it = jobs_.begin();
+    if (after) {
+        if (!ListTraits::node_state(*after).InContainer())
+            return nullptr;
+        it = ++jobs_.make_iterator(*after);
+    }
+
+    // Children being destroyed stay on the list until they get our lock.
+    for (; it != jobs_.end(); ++it) {
+        auto job = mxtl::MakeRefPtrUpgradeFromRaw(&*it);
+        if (job)
+            return job;
+    }
+    return nullptr;
+}
+
+status_t JobDispatcher::GetTaskRecords(TaskRecordWriter* writer) {
+    for (auto job = mxtl::WrapRefPtr(this); job; job = job->NextJobInWalk(this)) {
+        status_t status = job->GetOwnTaskRecords(writer);
+        if (status != NO_ERROR)
+            return status;
+    }
+    return writer->status();
+}
+
+status_t JobDispatcher::GetOwnTaskRecords(TaskRecordWriter* writer) {
+    mx_info_task_record_t record = {};
+    record.type = MX_OBJ_TYPE_JOB;
+    record.koid = get_koid();
+    record.parent_koid = get_inner_koid();
+    get_name(record.name);
+    record.private_bytes = page_counters_.private_pages() * PAGE_SIZE;
+    record.shared_bytes = page_counters_.shared_pages() * PAGE_SIZE;
+    record.committed_bytes = record.private_bytes + record.shared_bytes;
+
+    // Take references to the processes and drop the lock before visiting
+    // them: processes take their own lock before ours when they die.
+    mxtl::Array<mxtl::RefPtr<ProcessDispatcher>> procs;
+    {
+        AutoLock lock(&lock_);
+        switch (state_) {
+        case State::READY:
+            record.state = MX_TASK_STATE_RUNNING;
+            break;
+        case State::DYING:
+            record.state = MX_TASK_STATE_DYING;
+            break;
+        case State::DEAD:
+            record.state = MX_TASK_STATE_DEAD;
+            break;
+        }
+
+        AllocChecker ac;
+        procs.reset(new (&ac) mxtl::RefPtr<ProcessDispatcher>[process_count_], process_count_);
+        if (!ac.check())
+            return ERR_NO_MEMORY;
+
+        size_t i = 0;
+        for (auto& proc : procs_)
+            procs[i++] = mxtl::WrapRefPtr(&proc);
+    }
+
+    writer->Append(record);
+    for (size_t i = 0; i < procs.size(); i++)
+        procs[i]->GetTaskRecords(writer);
+
+    return writer->status();
+}
+
 bool JobDispatcher::EnumerateChildren(JobEnumerator* je) {
     AutoLock lock(&lock_);
 
@@ -6,9 +6,13 @@
 
 #include <magenta/log_dispatcher.h>
 #include <magenta/syscalls/log.h>
+#include <magenta/user_copy.h>
 
 #include <err.h>
 #include <new.h>
+#include <string.h>
+
+static_assert(MX_LOG_FLAG_BATCH == DLOG_FLAG_BATCH, "");
 
 constexpr mx_rights_t kDefaultEventRights =
     MX_RIGHT_TRANSFER | MX_RIGHT_WRITE | MX_RIGHT_DUPLICATE;
@@ -40,6 +44,44 @@ status_t LogDispatcher::Write(const void* ptr, size_t len, uint32_t flags) {
     return dlog_write(flags_, ptr, len);
 }
 
+status_t LogDispatcher::WriteBatchFromUser(const void* userptr, size_t len) {
+    // Longer lines are split over several records.
+    constexpr size_t kMaxLine = DLOG_MAX_ENTRY - sizeof(dlog_record_t);
+    const char* uptr = static_cast<const char*>(userptr);
+    char buf[kMaxLine];
+    size_t fill = 0;
+
+    while ((len > 0) || (fill > 0)) {
+        size_t n = (len < (kMaxLine - fill)) ? len : (kMaxLine - fill);
+        if (magenta_copy_from_user(uptr, buf + fill, n) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        uptr += n;
+        len -= n;
+        fill += n;
+
+        size_t start = 0;
+        for (size_t i = 0; i < fill; i++) {
+            if (buf[i] == '\n') {
+                status_t r = dlog_write(flags_, buf + start, i - start);
+                if (r != NO_ERROR)
+                    return r;
+                start = i + 1;
+            }
+        }
+        // flush a partial line once the buffer is full of it
+        // or there is nothing more to come
+        if ((start < fill) && ((start == 0 && fill == kMaxLine) || (len == 0))) {
+            status_t r = dlog_write(flags_, buf + start, fill - start);
+            if (r != NO_ERROR)
+                return r;
+            start = fill;
+        }
+        memmove(buf, buf + start, fill - start);
+        fill -= start;
+    }
+    return NO_ERROR;
+}
+
 status_t LogDispatcher::Read(void* ptr, size_t len, uint32_t flags) {
     if (flags_ & MX_LOG_FLAG_READABLE) {
         return dlog_read(&reader_, 0, ptr, len);
@@ -53,7 +95,7 @@ status_t LogDispatcher::ReadFromUser(void* ptr, size_t len, uint32_t flags) {
         return ERR_BAD_STATE;
     }
     for (;;) {
-        mx_status_t r = dlog_read_user(&reader_, 0, ptr, len);
+        mx_status_t r = dlog_read_user(&reader_, flags & MX_LOG_FLAG_BATCH, ptr, len);
         if ((r == ERR_BAD_STATE) && (flags & MX_LOG_FLAG_WAIT)) {
             dlog_wait(&reader_);
             continue;
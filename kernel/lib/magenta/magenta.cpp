@@ -10,11 +10,13 @@
 
 #include <kernel/auto_lock.h>
 #include <kernel/mutex.h>
+#include <kernel/vm.h>
 
 #include <lk/init.h>
 
 #include <lib/console.h>
 
+#include <magenta/delete_handle.h>
 #include <magenta/dispatcher.h>
 #include <magenta/excp_port.h>
 #include <magenta/job_dispatcher.h>
@@ -48,9 +50,15 @@ static mutex_t system_exception_mutex = MUTEX_INITIAL_VALUE(system_exception_mut
 // All jobs and processes are rooted at the |root_job|.
 static mxtl::RefPtr<JobDispatcher> root_job;
 
+// Called by the pmm whenever the memory pressure state changes.
+static void memory_pressure_changed(bool pressure) {
+    root_job->SetMemoryPressure(pressure);
+}
+
 void magenta_init(uint level) {
     handle_arena.Init("handles", kMaxHandleCount);
     root_job = JobDispatcher::CreateRootJob();
+    pmm_set_pressure_callback(&memory_pressure_changed);
 }
 
 static void high_handle_count(size_t count) {
@@ -72,39 +80,47 @@ Handle* DupHandle(Handle* source, mx_rights_t rights) {
 }
 
 void DeleteHandle(Handle* handle) {
-    StateTracker* state_tracker = handle->dispatcher()->get_state_tracker();
-    if (state_tracker) {
-        state_tracker->Cancel(handle);
-    } else {
-        auto disp = handle->dispatcher();
-        // This code is sad but necessary because certain dispatchers
-        // have complicated Close() logic which cannot be untangled at
-        // this time.
-        switch (disp->get_type()) {
-            case MX_OBJ_TYPE_IOMAP: {
-                auto iodisp = DownCastDispatcher<IoMappingDispatcher>(&disp);
-                if (iodisp)
-                    iodisp->Close();
-                break;
-            }
-            default:  break;
-                // This is fine. See for example the LogDispatcher.
-        };
+    DeleteHandles(&handle, 1u);
+}
+
+void DeleteHandles(Handle* const* handles, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Handle* handle = handles[i];
+        StateTracker* state_tracker = handle->dispatcher()->get_state_tracker();
+        if (state_tracker) {
+            state_tracker->Cancel(handle);
+        } else {
+            auto disp = handle->dispatcher();
+            // This code is sad but necessary because certain dispatchers
+            // have complicated Close() logic which cannot be untangled at
+            // this time.
+            switch (disp->get_type()) {
+                case MX_OBJ_TYPE_IOMAP: {
+                    auto iodisp = DownCastDispatcher<IoMappingDispatcher>(&disp);
+                    if (iodisp)
+                        iodisp->Close();
+                    break;
+                }
+                default:  break;
+                    // This is fine. See for example the LogDispatcher.
+            };
+        }
+        // Calling the handle dtor can cause many things to happen, so it is important
+        // to call it outside the lock.
+        handle->~Handle();
+        // Setting the memory to zero is critical for the safe operation of the handle
+        // table lookup.
+        memset(handle, 0, sizeof(Handle));
     }
-    // Calling the handle dtor can cause many things to happen, so it is important
-    // to call it outside the lock.
-    handle->~Handle();
-    // Setting the memory to zero is critical for the safe operation of the handle
-    // table lookup.
-    memset(handle, 0, sizeof(Handle));
 
     AutoLock lock(&handle_mutex);
-    --outstanding_handles;
-    handle_arena.RawFree(handle);
+    outstanding_handles -= count;
+    for (size_t i = 0; i < count; i++)
+        handle_arena.RawFree(handles[i]);
 }
 
 bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
+    // No need for |handle_mutex|, this is on the lock-free lookup path.
     return handle_arena.in_range(addr);
 }
 
@@ -7,13 +7,150 @@
 #include <err.h>
 #include <new.h>
 
+#include <arch/ops.h>
+#include <kernel/spinlock.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+
 #include <magenta/handle_reaper.h>
 #include <magenta/magenta.h>
 #include <magenta/message_packet.h>
+#include <magenta/process_dispatcher.h>
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 1024u;
 
+// Below this moving pages around costs more than copying them.
+constexpr uint32_t kMinMovePagesSize = 4u * PAGE_SIZE;
+
+// Packets for the common message sizes are recycled through per cpu caches of
+// fixed size blocks rather than going back and forth to the heap, one cache for
+// each of the payload sizes below, the largest being MXIO_CHUNK_SIZE. Each size
+// class also has room for a few handles.
+constexpr uint32_t kPacketClassDataSize[] = { 64u, 512u, 8192u };
+constexpr size_t kPacketClassMaxCached[] = { 64u, 32u, 8u };
+constexpr size_t kPacketClassHandles = 4u;
+constexpr size_t kPacketClassCount = countof(kPacketClassDataSize);
+constexpr uint8_t kPacketNoClass = 0xff;
+
+// Every block starts with this, which says where to return it.
+struct alignas(16) PacketBlockHeader {
+    uint8_t size_class;
+};
+
+struct PacketBlockCache {
+    void* free[kPacketClassCount];   // singly linked through the blocks
+    size_t count[kPacketClassCount];
+};
+
+static PacketBlockCache packet_block_cache[SMP_MAX_CPUS];
+
+static size_t packet_class_alloc_size(size_t size_class) {
+    return sizeof(PacketBlockHeader) + sizeof(MessagePacket) +
+           kPacketClassHandles * sizeof(Handle*) + kPacketClassDataSize[size_class];
+}
+
+static void* packet_block_alloc(size_t size) {
+    size += sizeof(PacketBlockHeader);
+
+    uint8_t size_class = kPacketNoClass;
+    for (size_t i = 0; i < kPacketClassCount; i++) {
+        if (size <= packet_class_alloc_size(i)) {
+            size_class = static_cast<uint8_t>(i);
+            break;
+        }
+    }
+
+    void* block = nullptr;
+    if (size_class != kPacketNoClass) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        PacketBlockCache* cache = &packet_block_cache[arch_curr_cpu_num()];
+        block = cache->free[size_class];
+        if (block) {
+            cache->free[size_class] = *static_cast<void**>(block);
+            cache->count[size_class]--;
+        }
+
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        if (!block)
+            block = malloc(packet_class_alloc_size(size_class));
+    } else {
+        block = malloc(size);
+    }
+    if (!block)
+        return nullptr;
+
+    auto header = static_cast<PacketBlockHeader*>(block);
+    header->size_class = size_class;
+    return header + 1;
+}
+
+static void packet_block_free(void* ptr) {
+    auto header = static_cast<PacketBlockHeader*>(ptr) - 1;
+    uint8_t size_class = header->size_class;
+    void* block = header;
+
+    if (size_class != kPacketNoClass) {
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        PacketBlockCache* cache = &packet_block_cache[arch_curr_cpu_num()];
+        if (cache->count[size_class] < kPacketClassMaxCached[size_class]) {
+            *static_cast<void**>(block) = cache->free[size_class];
+            cache->free[size_class] = block;
+            cache->count[size_class]++;
+            block = nullptr;
+        }
+
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    }
+
+    // the cache is full, or it is too big to cache
+    free(block);
+}
+
+// Finds the object and offset backing [va, va + len) in the current process,
+// which must all be in one writable mapping.
+static mx_status_t LookupUserPages(vaddr_t va, size_t len, mxtl::RefPtr<VmObject>* vmo,
+                                   uint64_t* offset) {
+    auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+    if (!aspace)
+        return ERR_BAD_STATE;
+
+    auto region = aspace->FindRegion(va);
+    if (!region)
+        return ERR_NOT_FOUND;
+
+    auto mapping = region->as_vm_mapping();
+    if (!mapping)
+        return ERR_NOT_FOUND;
+
+    if (va < mapping->base() || len > mapping->size() - (va - mapping->base()))
+        return ERR_OUT_OF_RANGE;
+
+    // moving pages in or out changes what the range reads as, so it takes the
+    // right to write the range
+    if (!(mapping->arch_mmu_flags() & ARCH_MMU_FLAG_PERM_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    *vmo = mapping->vmo();
+    if (!*vmo)
+        return ERR_NOT_FOUND;
+    *offset = mapping->object_offset() + (va - mapping->base());
+    return NO_ERROR;
+}
+
+// static
+bool MessagePacket::CanMovePages(const void* data, uint32_t data_size) {
+    return data_size >= kMinMovePagesSize && IS_PAGE_ALIGNED(data_size) &&
+           IS_PAGE_ALIGNED(reinterpret_cast<uintptr_t>(data));
+}
+
 // static
 mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
                                   mxtl::unique_ptr<MessagePacket>* msg) {
@@ -24,9 +161,9 @@ mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
 
     // Allocate space for the MessagePacket object followed by num_handles
     // Handle*s followed by data_size bytes.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    char* ptr = static_cast<char*>(packet_block_alloc(sizeof(MessagePacket) +
+                                                      num_handles * sizeof(Handle*) +
+                                                      data_size));
     if (ptr == NULL)
         return ERR_NO_MEMORY;
 
@@ -38,6 +175,75 @@ mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
     return NO_ERROR;
 }
 
+// static
+mx_status_t MessagePacket::CreateFromUserPages(user_ptr<const void> data, uint32_t data_size,
+                                               uint32_t num_handles,
+                                               mxtl::unique_ptr<MessagePacket>* msg) {
+    DEBUG_ASSERT(CanMovePages(data.get(), data_size));
+
+    if (data_size > kMaxMessageSize)
+        return ERR_OUT_OF_RANGE;
+
+    auto pages = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, data_size);
+    if (!pages)
+        return ERR_NO_MEMORY;
+
+    mxtl::RefPtr<VmObject> src;
+    uint64_t src_offset;
+    mx_status_t status = LookupUserPages(reinterpret_cast<vaddr_t>(data.get()), data_size,
+                                         &src, &src_offset);
+    if (status == NO_ERROR)
+        status = pages->MovePagesFrom(0, src.get(), src_offset, data_size);
+    if (status != NO_ERROR) {
+        // not pages we can take, so fall back to a single copy
+        size_t written;
+        if (pages->WriteUser(data, 0, data_size, &written) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+
+    status = Create(0u, num_handles, msg);
+    if (status != NO_ERROR)
+        return status;
+
+    (*msg)->data_size_ = data_size;
+    (*msg)->pages_ = mxtl::move(pages);
+    return NO_ERROR;
+}
+
+mx_status_t MessagePacket::CopyDataToUser(user_ptr<void> dst) {
+    if (!pages_)
+        return dst.copy_array_to_user(data(), data_size_);
+
+    if (CanMovePages(dst.get(), data_size_)) {
+        mxtl::RefPtr<VmObject> vmo;
+        uint64_t offset;
+        if (LookupUserPages(reinterpret_cast<vaddr_t>(dst.get()), data_size_,
+                            &vmo, &offset) == NO_ERROR &&
+            vmo->MovePagesFrom(offset, pages_.get(), 0, data_size_) == NO_ERROR)
+            return NO_ERROR;
+    }
+
+    size_t read;
+    return pages_->ReadUser(dst, 0, data_size_, &read);
+}
+
+uint32_t MessagePacket::get_txid() const {
+    if (data_size_ < sizeof(uint32_t))
+        return 0;
+    if (!pages_)
+        return *(reinterpret_cast<const uint32_t*>(data()));
+
+    uint32_t txid = 0;
+    size_t read;
+    pages_->Read(&txid, 0, sizeof(txid), &read);
+    return txid;
+}
+
+// static
+void MessagePacket::operator delete(void* ptr) {
+    packet_block_free(ptr);
+}
+
 MessagePacket::~MessagePacket() {
     if (owns_handles_) {
         // Delete handles out-of-band to avoid the worst case recursive
@@ -93,4 +93,9 @@ status_t PciInterruptDispatcher::InterruptComplete() {
     return NO_ERROR;
 }
 
+status_t PciInterruptDispatcher::RouteToCpu(uint cpu) {
+    DEBUG_ASSERT(device_ != nullptr);
+    return device_->device()->SetIrqAffinity(irq_id_, cpu);
+}
+
 #endif  // if WITH_DEV_PCIE
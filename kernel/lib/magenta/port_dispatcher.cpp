@@ -22,6 +22,9 @@
 constexpr mx_rights_t kDefaultIOPortRights =
     MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE;
 
+// Packets kept by each port's packet cache, beyond which they go back to the heap.
+constexpr size_t kPacketCacheMax = 32u;
+
 IOP_Packet* IOP_Packet::Alloc(size_t size) {
     AllocChecker ac;
     auto mem = new (&ac) char [sizeof(IOP_Packet) + size];
@@ -38,8 +41,24 @@ IOP_Packet* IOP_Packet::Make(const void* data, size_t size) {
     return pk;
 }
 
-IOP_Packet* IOP_Packet::MakeFromUser(const void* data, size_t size) {
-    auto pk = Alloc(size);
+IOP_Packet* IOP_Packet::MakeFromUser(const void* data, size_t size,
+                                     IOP_PacketCache* cache) {
+    DEBUG_ASSERT(size <= MX_PORT_MAX_PKT_SIZE);
+
+    IOP_Packet* pk = nullptr;
+    if (cache) {
+        pk = cache->Get(size);
+        if (!pk) {
+            // big enough to be reused for any user packet
+            pk = Alloc(MX_PORT_MAX_PKT_SIZE);
+            if (pk) {
+                pk->data_size = size;
+                pk->cache = cache;
+            }
+        }
+    } else {
+        pk = Alloc(size);
+    }
     if (!pk)
         return nullptr;
 
@@ -49,12 +68,18 @@ IOP_Packet* IOP_Packet::MakeFromUser(const void* data, size_t size) {
     auto status = magenta_copy_from_user(data, header, size);
     header->type = MX_PORT_PKT_TYPE_USER;
 
-    return (status == NO_ERROR) ? pk : nullptr;
+    if (status != NO_ERROR) {
+        Delete(pk);
+        return nullptr;
+    }
+    return pk;
 }
 
 void IOP_Packet::Delete(IOP_Packet* packet) {
     if (!packet || packet->is_signal)
         return;
+    if (packet->cache && packet->cache->Put(packet))
+        return;
     packet->~IOP_Packet();
     delete [] reinterpret_cast<char*>(packet);
 }
@@ -67,6 +92,45 @@ bool IOP_Packet::CopyToUser(void* data, size_t* size) {
         data, reinterpret_cast<char*>(this) + sizeof(IOP_Packet), data_size) == NO_ERROR;
 }
 
+IOP_PacketCache::IOP_PacketCache()
+    : lock_(SPIN_LOCK_INITIAL_VALUE), count_(0u) {
+}
+
+IOP_PacketCache::~IOP_PacketCache() {
+    while (!free_.is_empty()) {
+        auto packet = free_.pop_front();
+        packet->~IOP_Packet();
+        delete [] reinterpret_cast<char*>(packet);
+    }
+}
+
+IOP_Packet* IOP_PacketCache::Get(size_t size) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&lock_, state);
+    IOP_Packet* packet = free_.pop_front();
+    if (packet)
+        count_--;
+    spin_unlock_irqrestore(&lock_, state);
+
+    if (packet)
+        packet->data_size = size;
+    return packet;
+}
+
+bool IOP_PacketCache::Put(IOP_Packet* packet) {
+    DEBUG_ASSERT(packet->cache == this);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&lock_, state);
+    bool cached = count_ < kPacketCacheMax;
+    if (cached) {
+        free_.push_front(packet);
+        count_++;
+    }
+    spin_unlock_irqrestore(&lock_, state);
+    return cached;
+}
+
 IOP_Signal::IOP_Signal(uint64_t key, mx_signals_t signal)
     : IOP_Packet(sizeof(payload), true),
       payload {{key, MX_PORT_PKT_TYPE_IOSN, 0u}, 0u, 0u, signal, 0u},
@@ -87,7 +151,7 @@ mx_status_t PortDispatcher::Create(uint32_t options,
 }
 
 PortDispatcher::PortDispatcher(uint32_t /*options*/)
-    : no_clients_(false) {
+    : no_clients_(false), queued_(nullptr) {
     event_init(&event_, false, EVENT_FLAG_AUTOUNSIGNAL);
 }
 
@@ -97,7 +161,27 @@ PortDispatcher::~PortDispatcher() {
     event_destroy(&event_);
 }
 
+void PortDispatcher::TakeQueuedLocked() {
+    IOP_Packet* stack = __atomic_exchange_n(&queued_, nullptr, __ATOMIC_ACQUIRE);
+
+    // the stack is newest first
+    IOP_Packet* fifo = nullptr;
+    while (stack) {
+        IOP_Packet* next = stack->queue_next;
+        stack->queue_next = fifo;
+        fifo = stack;
+        stack = next;
+    }
+    while (fifo) {
+        IOP_Packet* next = fifo->queue_next;
+        fifo->queue_next = nullptr;
+        packets_.push_back(fifo);
+        fifo = next;
+    }
+}
+
 void PortDispatcher::FreePacketsLocked() {
+    TakeQueuedLocked();
     while (!packets_.is_empty()) {
         IOP_Packet::Delete(packets_.pop_front());
     }
@@ -112,29 +196,25 @@ void PortDispatcher::FreePacketsLocked() {
 
 void PortDispatcher::on_zero_handles() {
     AutoLock al(&lock_);
-    no_clients_ = true;
+    __atomic_store_n(&no_clients_, true, __ATOMIC_RELEASE);
     FreePacketsLocked();
 }
 
 mx_status_t PortDispatcher::Queue(IOP_Packet* packet) {
-    int wake_count = 0;
-    mx_status_t status = NO_ERROR;
-    {
-        AutoLock al(&lock_);
-        if (no_clients_) {
-            status = ERR_UNAVAILABLE;
-        } else {
-            packets_.push_back(packet);
-            wake_count = event_signal_etc(&event_, false, status);
-        }
-    }
-
-    if (status != NO_ERROR) {
+    // A packet racing with on_zero_handles() may still get queued after
+    // it has freed the others, in which case the destructor frees it.
+    if (__atomic_load_n(&no_clients_, __ATOMIC_ACQUIRE)) {
         IOP_Packet::Delete(packet);
-        return status;
+        return ERR_UNAVAILABLE;
     }
 
-    if (wake_count)
+    IOP_Packet* head = __atomic_load_n(&queued_, __ATOMIC_RELAXED);
+    do {
+        packet->queue_next = head;
+    } while (!__atomic_compare_exchange_n(&queued_, &head, packet, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (event_signal_etc(&event_, false, NO_ERROR))
         thread_preempt(false);
 
     return NO_ERROR;
@@ -176,28 +256,47 @@ void* PortDispatcher::Signal(void* cookie, uint64_t key, mx_signals_t signal) {
     return node;
 }
 
+IOP_Packet* PortDispatcher::PopLocked() {
+    auto pk = packets_.pop_front();
+    ASSERT(pk);
+
+    if (pk->is_signal) {
+        auto signal = static_cast<IOP_Signal*>(pk);
+        auto prev = atomic_add(&signal->count, -1);
+        if (prev == 1)
+            at_zero_.push_back(signal);
+        else
+            packets_.push_back(signal);
+    }
+    return pk;
+}
+
 mx_status_t PortDispatcher::Wait(mx_time_t timeout, IOP_Packet** packet) {
+    size_t actual;
+    return WaitMany(timeout, packet, 1u, SIZE_MAX, &actual);
+}
+
+mx_status_t PortDispatcher::WaitMany(mx_time_t timeout, IOP_Packet** packets, size_t count,
+                                     size_t max_size, size_t* actual) {
+    DEBUG_ASSERT(count > 0u);
+
     while (true) {
         {
             AutoLock al(&lock_);
-            if (!packets_.is_empty()) {
-                auto pk = packets_.pop_front();
-                ASSERT(pk);
-
-                if (!pk->is_signal) {
-                    *packet = pk;
-                } else {
-                    auto signal = static_cast<IOP_Signal*>(pk);
-                    auto prev = atomic_add(&signal->count, -1);
-                    if (prev == 1)
-                        at_zero_.push_back(signal);
-                    else
-                        packets_.push_back(signal);
-                    *packet = signal;
-                }
+            TakeQueuedLocked();
+
+            // stop short of a packet that won't fit, leaving it queued
+            size_t taken = 0u;
+            while (taken < count && !packets_.is_empty() &&
+                   packets_.front().data_size <= max_size) {
+                packets[taken++] = PopLocked();
+            }
+            if (taken > 0u) {
+                *actual = taken;
                 return NO_ERROR;
             }
-
+            if (!packets_.is_empty())
+                return ERR_BUFFER_TOO_SMALL;
         }
 
         if (timeout == 0ull)
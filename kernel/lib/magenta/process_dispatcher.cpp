@@ -14,13 +14,16 @@
 #include <string.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 
 #include <lib/crypto/global_prng.h>
+#include <lib/heap.h>
 
 #include <magenta/futex_context.h>
 #include <magenta/handle_owner.h>
@@ -99,6 +102,12 @@ mx_status_t ProcessDispatcher::Create(
     return result;
 }
 
+void* ProcessDispatcher::operator new(size_t size, AllocChecker* ac) noexcept {
+    void* mem = memalign(CACHE_LINE, size);
+    ac->arm(size, mem != nullptr);
+    return mem;
+}
+
 ProcessDispatcher::ProcessDispatcher(mxtl::RefPtr<JobDispatcher> job,
                                      mxtl::StringPiece name,
                                      uint32_t flags)
@@ -110,8 +119,7 @@ ProcessDispatcher::ProcessDispatcher(mxtl::RefPtr<JobDispatcher> job,
 
     // Generate handle XOR mask with top bit and bottom two bits cleared
     uint32_t secret;
-    auto prng = crypto::GlobalPRNG::GetInstance();
-    prng->Draw(&secret, sizeof(secret));
+    crypto::GlobalPRNG::Draw(&secret, sizeof(secret));
 
     // Handle values cannot be negative values, so we mask the high bit.
     handle_rand_ = (secret << 2) & INT_MAX;
@@ -168,6 +176,10 @@ status_t ProcessDispatcher::Initialize() {
         return ERR_NO_MEMORY;
     }
 
+    // roll our memory usage up into the job's
+    if (job_)
+        aspace_->page_counters().set_parent(&job_->page_counters());
+
     return NO_ERROR;
 }
 
@@ -397,6 +409,9 @@ HandleOwner ProcessDispatcher::RemoveHandleLocked(mx_handle_t handle_value) {
     handles_.erase(*handle);
     handle->set_process_id(0u);
 
+    // The handle may be destroyed or handed to another process as soon as we return.
+    WaitForLookupsLocked();
+
     return HandleOwner(handle);
 }
 
@@ -405,16 +420,49 @@ void ProcessDispatcher::UndoRemoveHandleLocked(mx_handle_t handle_value) {
     AddHandleLocked(HandleOwner(handle));
 }
 
+void ProcessDispatcher::WaitForLookupsLocked() {
+    uint32_t epoch = __atomic_fetch_add(&lookup_epoch_, 1u, __ATOMIC_SEQ_CST) & 1u;
+    for (auto& lookups : lookups_) {
+        while (__atomic_load_n(&lookups.count[epoch], __ATOMIC_ACQUIRE))
+            arch_spinloop_pause();
+    }
+}
+
 bool ProcessDispatcher::GetDispatcher(mx_handle_t handle_value,
                                       mxtl::RefPtr<Dispatcher>* dispatcher,
                                       uint32_t* rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
-        return false;
+    // With interrupts off the lookup stays on this cpu and is never held up for long, so
+    // removals only ever wait briefly for it.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Count the lookup in the current epoch. If a removal moved to the next one meanwhile, it
+    // may have missed our count, so count again in the new epoch.
+    auto& lookups = lookups_[arch_curr_cpu_num()];
+    uint32_t epoch;
+    while (true) {
+        epoch = __atomic_load_n(&lookup_epoch_, __ATOMIC_RELAXED) & 1u;
+        __atomic_fetch_add(&lookups.count[epoch], 1u, __ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(&lookup_epoch_, __ATOMIC_SEQ_CST) & 1u) == epoch)
+            break;
+        __atomic_fetch_sub(&lookups.count[epoch], 1u, __ATOMIC_RELEASE);
+    }
+
+    // A handle removed before our count was seen has its process id cleared, and one removed
+    // after it is kept alive until we are done.
+    mxtl::RefPtr<Dispatcher> found;
+    Handle* handle = map_value_to_handle(handle_value, handle_rand_);
+    if (handle && handle->process_id() == get_koid()) {
+        *rights = handle->rights();
+        found = handle->dispatcher();
+    }
+
+    __atomic_fetch_sub(&lookups.count[epoch], 1u, __ATOMIC_RELEASE);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    *rights = handle->rights();
-    *dispatcher = handle->dispatcher();
+    if (!found)
+        return false;
+    *dispatcher = mxtl::move(found);
     return true;
 }
 
@@ -486,6 +534,78 @@ status_t ProcessDispatcher::GetThreads(mxtl::Array<mx_koid_t>* out_threads) {
     return NO_ERROR;
 }
 
+static uint32_t TaskStateOf(ProcessDispatcher::State state) {
+    switch (state) {
+    case ProcessDispatcher::State::INITIAL:
+        return MX_TASK_STATE_NEW;
+    case ProcessDispatcher::State::RUNNING:
+        return MX_TASK_STATE_RUNNING;
+    case ProcessDispatcher::State::DYING:
+        return MX_TASK_STATE_DYING;
+    case ProcessDispatcher::State::DEAD:
+        return MX_TASK_STATE_DEAD;
+    }
+    return MX_TASK_STATE_DEAD;
+}
+
+static uint32_t TaskStateOf(UserThread::State state) {
+    switch (state) {
+    case UserThread::State::INITIAL:
+    case UserThread::State::INITIALIZED:
+        return MX_TASK_STATE_NEW;
+    case UserThread::State::RUNNING:
+        return MX_TASK_STATE_RUNNING;
+    case UserThread::State::DYING:
+        return MX_TASK_STATE_DYING;
+    case UserThread::State::DEAD:
+        return MX_TASK_STATE_DEAD;
+    }
+    return MX_TASK_STATE_DEAD;
+}
+
+void TaskRecordWriter::Append(const mx_info_task_record_t& record) {
+    if (actual_ < max_ && status_ == NO_ERROR) {
+        if (records_.copy_array_to_user(&record, 1, actual_) != NO_ERROR)
+            status_ = ERR_INVALID_ARGS;
+        else
+            ++actual_;
+    }
+    ++avail_;
+}
+
+void ProcessDispatcher::GetTaskRecords(TaskRecordWriter* writer) {
+    mx_info_task_record_t record = {};
+    record.type = MX_OBJ_TYPE_PROCESS;
+    record.koid = get_koid();
+    record.parent_koid = get_inner_koid();
+    get_name(record.name);
+    if (aspace_) {
+        const VmPageCounters& counters = aspace_->page_counters();
+        record.private_bytes = counters.private_pages() * PAGE_SIZE;
+        record.shared_bytes = counters.shared_pages() * PAGE_SIZE;
+        record.committed_bytes = record.private_bytes + record.shared_bytes;
+    }
+
+    // Hold the state lock throughout, so the process's record and those of
+    // its threads agree with each other.
+    AutoLock lock(&state_lock_);
+    record.state = TaskStateOf(state_);
+    for (auto& thread : thread_list_)
+        record.runtime_ns += thread.runtime_ns();
+    writer->Append(record);
+
+    for (auto& thread : thread_list_) {
+        mx_info_task_record_t thread_record = {};
+        thread_record.type = MX_OBJ_TYPE_THREAD;
+        thread_record.state = TaskStateOf(thread.state());
+        thread_record.koid = thread.get_koid();
+        thread_record.parent_koid = record.koid;
+        thread.get_name(thread_record.name);
+        thread_record.runtime_ns = thread.runtime_ns();
+        writer->Append(thread_record);
+    }
+}
+
 status_t ProcessDispatcher::SetExceptionPort(mxtl::RefPtr<ExceptionPort> eport, bool debugger) {
     // Lock both |state_lock_| and |exception_lock_| to ensure the process
     // doesn't transition to dead while we're setting the exception handler.
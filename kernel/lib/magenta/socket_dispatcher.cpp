@@ -30,6 +30,9 @@ constexpr mx_rights_t kDefaultSocketRights =
 
 constexpr size_t kDeFaultSocketBufferSize = 256 * 1024u;
 
+static_assert(MX_SOCKET_RING_DATA_OFFSET == PAGE_SIZE, "");
+static_assert(sizeof(mx_socket_ring_t) <= MX_SOCKET_RING_DATA_OFFSET, "");
+
 constexpr mx_signals_t kValidSignalMask =
     MX_SOCKET_READABLE | MX_SOCKET_PEER_CLOSED | MX_USER_SIGNAL_ALL;
 
@@ -41,58 +44,104 @@ template <typename T> T vmodpow2(T val, uint modp2) { return val & ((1U << modp2
 #define INC_POINTER(len_pow2, ptr, inc) vmodpow2(((ptr) + (inc)), len_pow2)
 
 SocketDispatcher::CBuf::~CBuf() {
-    VmAspace::kernel_aspace()->FreeRegion(reinterpret_cast<vaddr_t>(buf_));
+    if (ring_) {
+        VmAspace::kernel_aspace()->FreeRegion(reinterpret_cast<vaddr_t>(ring_));
+        vmo_->Unpin();
+    } else
+        VmAspace::kernel_aspace()->FreeRegion(reinterpret_cast<vaddr_t>(buf_));
 }
 
-bool SocketDispatcher::CBuf::Init(uint32_t len) {
-    vmo_ = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, len);
+bool SocketDispatcher::CBuf::Init(uint32_t len, bool shared) {
+    data_offset_ = shared ? MX_SOCKET_RING_DATA_OFFSET : 0u;
+
+    vmo_ = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, data_offset_ + len);
     if (!vmo_)
         return false;
 
+    // a shared ring's vmo is handed out writable, and the pages the kernel
+    // works on through its own mapping must not be decommitted or cut off
+    if (shared && vmo_->Pin(0u, data_offset_ + len) != NO_ERROR)
+        return false;
+
     void* start = nullptr;
     auto st = VmAspace::kernel_aspace()->MapObject(
-        vmo_, "socket", 0u, len, &start, PAGE_SIZE_SHIFT, 0,
+        vmo_, "socket", 0u, data_offset_ + len, &start, PAGE_SIZE_SHIFT, 0,
         0, ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
 
-    if (st < 0)
-        return false;
-
-    buf_ = reinterpret_cast<char*>(start);
-
-    if (!buf_)
+    if (st < 0 || !start) {
+        if (shared)
+            vmo_->Unpin();
         return false;
+    }
+    buf_ = reinterpret_cast<char*>(start) + data_offset_;
     len_pow2_ = log2_uint_floor(len);
+
+    if (shared) {
+        ring_ = reinterpret_cast<mx_socket_ring_t*>(start);
+        ring_->size = len;
+    }
     return true;
 }
 
+size_t SocketDispatcher::CBuf::head() const {
+    if (!ring_)
+        return head_;
+    return vmodpow2(static_cast<size_t>(__atomic_load_n(&ring_->head, __ATOMIC_ACQUIRE)),
+                    len_pow2_);
+}
+
+size_t SocketDispatcher::CBuf::tail() const {
+    if (!ring_)
+        return tail_;
+    return vmodpow2(static_cast<size_t>(__atomic_load_n(&ring_->tail, __ATOMIC_ACQUIRE)),
+                    len_pow2_);
+}
+
+void SocketDispatcher::CBuf::set_head(size_t head) {
+    if (ring_)
+        __atomic_store_n(&ring_->head, head, __ATOMIC_RELEASE);
+    else
+        head_ = head;
+}
+
+void SocketDispatcher::CBuf::set_tail(size_t tail) {
+    if (ring_)
+        __atomic_store_n(&ring_->tail, tail, __ATOMIC_RELEASE);
+    else
+        tail_ = tail;
+}
+
 size_t SocketDispatcher::CBuf::free() const {
-    uint consumed = modpow2((uint)(head_ - tail_), len_pow2_);
+    uint consumed = modpow2((uint)(head() - tail()), len_pow2_);
     return valpow2(len_pow2_) - consumed - 1;
 }
 
 bool SocketDispatcher::CBuf::empty() const {
-    return tail_ == head_;
+    return tail() == head();
 }
 
 size_t SocketDispatcher::CBuf::Write(const void* src, size_t len, bool from_user) {
 
     size_t write_len;
     size_t pos = 0;
+    size_t head = this->head();
 
     while (pos < len && (free() > 0)) {
-        if (head_ >= tail_) {
-            if (tail_ == 0) {
+        // the reader may advance the tail under us, which only frees more room
+        size_t tail = this->tail();
+        if (head >= tail) {
+            if (tail == 0) {
                 // Special case - if tail is at position 0, we can't write all
                 // the way to the end of the buffer. Otherwise, head ends up at
                 // 0, head == tail, and buffer is considered "empty" again.
-                write_len = MIN(valpow2(len_pow2_) - head_ - 1, len - pos);
+                write_len = MIN(valpow2(len_pow2_) - head - 1, len - pos);
             } else {
                 // Write to the end of the buffer.
-                write_len = MIN(valpow2(len_pow2_) - head_, len - pos);
+                write_len = MIN(valpow2(len_pow2_) - head, len - pos);
             }
         } else {
             // Write from head to tail-1.
-            write_len = MIN(tail_ - head_ - 1, len - pos);
+            write_len = MIN(tail - head - 1, len - pos);
         }
 
         // if it's full, abort and return how much we've written
@@ -105,12 +154,13 @@ size_t SocketDispatcher::CBuf::Write(const void* src, size_t len, bool from_user
         if (from_user) {
             // TODO: find a safer way to do this
             user_ptr<const void> uptr(ptr);
-            vmo_->WriteUser(uptr, head_, write_len, nullptr);
+            vmo_->WriteUser(uptr, data_offset_ + head, write_len, nullptr);
         } else {
-            memcpy(buf_ + head_, ptr, write_len);
+            memcpy(buf_ + head, ptr, write_len);
         }
 
-        head_ = INC_POINTER(len_pow2_, head_, write_len);
+        head = INC_POINTER(len_pow2_, head, write_len);
+        set_head(head);
         pos += write_len;
     }
     return pos;
@@ -118,19 +168,23 @@ size_t SocketDispatcher::CBuf::Write(const void* src, size_t len, bool from_user
 
 size_t SocketDispatcher::CBuf::Read(void* dest, size_t len, bool from_user) {
     size_t ret = 0;
+    size_t tail = this->tail();
+    size_t head = this->head();
 
-    if (tail_ != head_) {
+    if (tail != head) {
         size_t pos = 0;
         // loop until we've read everything we need
-        // at most this will make two passes to deal with wraparound
-        while (pos < len && tail_ != head_) {
+        // at most this will make two passes to deal with wraparound.
+        // the head is sampled once, anything the writer adds meanwhile waits
+        // for the next read.
+        while (pos < len && tail != head) {
             size_t read_len;
-            if (head_ > tail_) {
+            if (head > tail) {
                 // simple case where there is no wraparound
-                read_len = MIN(head_ - tail_, len - pos);
+                read_len = MIN(head - tail, len - pos);
             } else {
                 // read to the end of buffer in this pass
-                read_len = MIN(valpow2(len_pow2_) - tail_, len - pos);
+                read_len = MIN(valpow2(len_pow2_) - tail, len - pos);
             }
 
             char *ptr = (char*)dest;
@@ -138,12 +192,13 @@ size_t SocketDispatcher::CBuf::Read(void* dest, size_t len, bool from_user) {
             if (from_user) {
                 // TODO: find a safer way to do this
                 user_ptr<void> uptr(ptr);
-                vmo_->ReadUser(uptr, tail_, read_len, nullptr);
+                vmo_->ReadUser(uptr, data_offset_ + tail, read_len, nullptr);
             } else {
-                memcpy(ptr, buf_ + tail_, read_len);
+                memcpy(ptr, buf_ + tail, read_len);
             }
 
-            tail_ = INC_POINTER(len_pow2_, tail_, read_len);
+            tail = INC_POINTER(len_pow2_, tail, read_len);
+            set_tail(tail);
             pos += read_len;
         }
         ret = pos;
@@ -152,7 +207,7 @@ size_t SocketDispatcher::CBuf::Read(void* dest, size_t len, bool from_user) {
 }
 
 size_t SocketDispatcher::CBuf::CouldRead() const {
-    return modpow2((uint)(head_ - tail_), len_pow2_);
+    return modpow2((uint)(head() - tail()), len_pow2_);
 }
 
 // static
@@ -162,6 +217,14 @@ status_t SocketDispatcher::Create(uint32_t flags,
                                   mx_rights_t* rights) {
     LTRACE_ENTRY;
 
+    uint32_t size_log2 = (flags & MX_SOCKET_SIZE_MASK) >> MX_SOCKET_SIZE_SHIFT;
+    uint32_t size = kDeFaultSocketBufferSize;
+    if (size_log2) {
+        if (size_log2 < MX_SOCKET_SIZE_MIN_LOG2 || size_log2 > MX_SOCKET_SIZE_MAX_LOG2)
+            return ERR_INVALID_ARGS;
+        size = 1u << size_log2;
+    }
+
     AllocChecker ac;
     auto socket0 = mxtl::AdoptRef(new (&ac) SocketDispatcher(flags));
     if (!ac.check())
@@ -172,9 +235,9 @@ status_t SocketDispatcher::Create(uint32_t flags,
         return ERR_NO_MEMORY;
 
     mx_status_t status;
-    if ((status = socket0->Init(socket1)) != NO_ERROR)
+    if ((status = socket0->Init(socket1, size)) != NO_ERROR)
         return status;
-    if ((status = socket1->Init(socket0)) != NO_ERROR)
+    if ((status = socket1->Init(socket0, size)) != NO_ERROR)
         return status;
 
     *rights = kDefaultSocketRights;
@@ -183,8 +246,8 @@ status_t SocketDispatcher::Create(uint32_t flags,
     return NO_ERROR;
 }
 
-SocketDispatcher::SocketDispatcher(uint32_t /*flags*/)
-    : half_closed_{false, false} {
+SocketDispatcher::SocketDispatcher(uint32_t flags)
+    : flags_(flags), half_closed_{false, false} {
 
     state_tracker_.set_initial_signals_state(MX_SOCKET_WRITABLE);
 }
@@ -194,9 +257,11 @@ SocketDispatcher::~SocketDispatcher() {
 
 // This is called before either SocketDispatcher is accessible from threads other than the one
 // initializing the socket, so it does not need locking.
-mx_status_t SocketDispatcher::Init(mxtl::RefPtr<SocketDispatcher> other) TA_NO_THREAD_SAFETY_ANALYSIS {
+mx_status_t SocketDispatcher::Init(mxtl::RefPtr<SocketDispatcher> other,
+                                   uint32_t size) TA_NO_THREAD_SAFETY_ANALYSIS {
     other_ = mxtl::move(other);
-    return cbuf_.Init(kDeFaultSocketBufferSize) ? NO_ERROR : ERR_NO_MEMORY;
+    bool shared = (flags_ & MX_SOCKET_SHARED_RING) != 0u;
+    return cbuf_.Init(size, shared) ? NO_ERROR : ERR_NO_MEMORY;
 }
 
 void SocketDispatcher::on_zero_handles() {
@@ -327,6 +392,10 @@ mx_status_t SocketDispatcher::WriteSelf(const void* src, size_t len,
     if (!cbuf_.free())
         other_->state_tracker_.UpdateState(MX_SOCKET_WRITABLE, 0u);
 
+    // userspace may have moved a shared ring's indices since the signals were last updated
+    if (cbuf_.shared())
+        SyncRingLocked();
+
     *written = st;
     return NO_ERROR;
 }
@@ -357,6 +426,70 @@ mx_status_t SocketDispatcher::Read(void* dest, size_t len,
     if (!closed && was_full && (st > 0))
         other_->state_tracker_.UpdateState(0u, MX_SOCKET_WRITABLE);
 
+    if (cbuf_.shared())
+        SyncRingLocked();
+
     *nread = static_cast<size_t>(st);
     return NO_ERROR;
 }
+
+status_t SocketDispatcher::GetRing(bool peer, mxtl::RefPtr<VmObject>* vmo) {
+    if (!(flags_ & MX_SOCKET_SHARED_RING))
+        return ERR_NOT_SUPPORTED;
+
+    if (!peer) {
+        AutoLock lock(&lock_);
+        *vmo = cbuf_.vmo();
+        return NO_ERROR;
+    }
+
+    mxtl::RefPtr<SocketDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_)
+            return ERR_REMOTE_CLOSED;
+        other = other_;
+    }
+    AutoLock lock(&other->lock_);
+    *vmo = other->cbuf_.vmo();
+    return NO_ERROR;
+}
+
+status_t SocketDispatcher::SyncRing(bool peer) {
+    if (!(flags_ & MX_SOCKET_SHARED_RING))
+        return ERR_NOT_SUPPORTED;
+
+    if (!peer) {
+        AutoLock lock(&lock_);
+        SyncRingLocked();
+        return NO_ERROR;
+    }
+
+    mxtl::RefPtr<SocketDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_)
+            return ERR_REMOTE_CLOSED;
+        other = other_;
+    }
+    AutoLock lock(&other->lock_);
+    other->SyncRingLocked();
+    return NO_ERROR;
+}
+
+void SocketDispatcher::SyncRingLocked() {
+    if (cbuf_.empty()) {
+        state_tracker_.UpdateState(MX_SOCKET_READABLE, 0u);
+    } else if (!(state_tracker_.GetSignalsState() & MX_SOCKET_READABLE)) {
+        state_tracker_.UpdateState(0u, MX_SOCKET_READABLE);
+        if (iopc_)
+            iopc_->Signal(MX_SOCKET_READABLE, cbuf_.CouldRead(), &lock_);
+    }
+
+    if (!other_ || half_closed_[1])
+        return;
+    if (cbuf_.free())
+        other_->state_tracker_.UpdateState(0u, MX_SOCKET_WRITABLE);
+    else
+        other_->state_tracker_.UpdateState(MX_SOCKET_WRITABLE, 0u);
+}
@@ -9,6 +9,28 @@
 #include <kernel/auto_lock.h>
 #include <magenta/wait_event.h>
 
+uint32_t StateTracker::FindGroupLocked(mx_signals_t interest) {
+    uint32_t empty = kNumGroups;
+    for (uint32_t i = 0; i < kNumGroups - 1; i++) {
+        if (groups_[i].observers.is_empty()) {
+            if (empty == kNumGroups)
+                empty = i;
+        } else if (groups_[i].interest == interest) {
+            return i;
+        }
+    }
+    if (empty != kNumGroups) {
+        groups_[empty].interest = interest;
+        return empty;
+    }
+
+    auto& shared = groups_[kNumGroups - 1];
+    if (shared.observers.is_empty())
+        shared.interest = 0u;
+    shared.interest |= interest;
+    return kNumGroups - 1;
+}
+
 void StateTracker::AddObserver(StateObserver* observer) {
     DEBUG_ASSERT(observer != nullptr);
 
@@ -16,7 +38,8 @@ void StateTracker::AddObserver(StateObserver* observer) {
     {
         AutoLock lock(&lock_);
 
-        observers_.push_front(observer);
+        observer->group_ = FindGroupLocked(observer->interest_);
+        groups_[observer->group_].observers.push_front(observer);
         awoke_threads = observer->OnInitialize(signals_);
     }
     if (awoke_threads)
@@ -26,7 +49,7 @@ void StateTracker::AddObserver(StateObserver* observer) {
 void StateTracker::RemoveObserver(StateObserver* observer) {
     AutoLock lock(&lock_);
     DEBUG_ASSERT(observer != nullptr);
-    observers_.erase(*observer);
+    groups_[observer->group_].observers.erase(*observer);
 }
 
 void StateTracker::Cancel(Handle* handle) {
@@ -34,15 +57,18 @@ void StateTracker::Cancel(Handle* handle) {
 
     {
         AutoLock lock(&lock_);
-        for (auto it = observers_.begin(); it != observers_.end();) {
-            bool should_remove = false;
-            awoke_threads = it->OnCancel(handle, &should_remove) || awoke_threads;
-            if (should_remove) {
-                auto to_remove = it;
-                ++it;
-                observers_.erase(to_remove);
-            } else {
-                ++it;
+        for (auto& group : groups_) {
+            auto& observers = group.observers;
+            for (auto it = observers.begin(); it != observers.end();) {
+                bool should_remove = false;
+                awoke_threads = it->OnCancel(handle, &should_remove) || awoke_threads;
+                if (should_remove) {
+                    auto to_remove = it;
+                    ++it;
+                    observers.erase(to_remove);
+                } else {
+                    ++it;
+                }
             }
         }
     }
@@ -65,8 +91,14 @@ void StateTracker::UpdateState(mx_signals_t clear_mask,
         if (previous_signals == signals_)
             return;
 
-        for (auto& observer : observers_) {
-            awoke_threads = observer.OnStateChange(signals_) || awoke_threads;
+        const mx_signals_t changed = previous_signals ^ signals_;
+        for (auto& group : groups_) {
+            if (!(group.interest & changed))
+                continue;
+            for (auto& observer : group.observers) {
+                if (observer.interest_ & changed)
+                    awoke_threads = observer.OnStateChange(signals_) || awoke_threads;
+            }
         }
     }
 
@@ -25,6 +25,7 @@
 
 #include <magenta/c_user_thread.h>
 #include <magenta/exception.h>
+#include <magenta/job_dispatcher.h>
 #include <magenta/excp_port.h>
 #include <magenta/magenta.h>
 #include <magenta/process_dispatcher.h>
@@ -118,6 +119,11 @@ status_t UserThread::Initialize(const char* name, size_t len) {
     // associate the proc's address space with this thread
     process_->aspace()->AttachToThread(lkthread);
 
+    // charge the thread's cpu time to the job it runs under
+    auto job = process_->job();
+    if (job)
+        thread_set_sched_group(lkthread, job->sched_group());
+
     // we've entered the initialized state
     SetState(State::INITIALIZED);
 
@@ -139,6 +145,23 @@ void UserThread::get_name(char out_name[MX_MAX_NAME_LEN]) {
     memcpy(out_name, thread_.name, MX_MAX_NAME_LEN);
 }
 
+UserThread::State UserThread::state() {
+    AutoLock lock(state_lock_);
+    return state_;
+}
+
+status_t UserThread::SetDeadline(mx_time_t runtime, mx_time_t period) {
+    LTRACE_ENTRY_OBJ;
+
+    // holding the state lock keeps the thread from exiting under us
+    AutoLock lock(state_lock_);
+
+    if (state_ == State::DYING || state_ == State::DEAD)
+        return ERR_BAD_STATE;
+
+    return thread_set_deadline(&thread_, runtime, period);
+}
+
 // start a thread
 status_t UserThread::Start(uintptr_t entry, uintptr_t sp,
                            uintptr_t arg1, uintptr_t arg2,
@@ -374,9 +397,9 @@ status_t UserThread::ExceptionHandlerExchange(
     // locking exception_wait_lock_ in places where the handler can see/modify
     // thread state.
 
-    status_t status = eport->SendReport(report);
+    status_t status = eport->SendExceptionReport(report, this);
     if (status != NO_ERROR) {
-        LTRACEF("SendReport returned %d\n", status);
+        LTRACEF("SendExceptionReport returned %d\n", status);
         exception_status_ = MX_EXCEPTION_STATUS_NOT_HANDLED;
         thread_.exception_context = NULL;
         thread_.flags &= ~THREAD_FLAG_STOPPED_FOR_EXCEPTION;
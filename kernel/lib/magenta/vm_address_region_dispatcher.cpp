@@ -72,6 +72,10 @@ status_t split_syscall_flags(uint32_t flags, uint32_t* vmar_flags, uint* arch_mm
         vmar |= VMAR_FLAG_CAN_MAP_EXECUTE;
         flags &= ~MX_VM_FLAG_CAN_MAP_EXECUTE;
     }
+    if (flags & MX_VM_FLAG_MAP_SEQUENTIAL) {
+        vmar |= VMAR_FLAG_MAP_SEQUENTIAL;
+        flags &= ~MX_VM_FLAG_MAP_SEQUENTIAL;
+    }
 
     if (flags != 0)
         return ERR_INVALID_ARGS;
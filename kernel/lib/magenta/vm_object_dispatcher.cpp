@@ -6,9 +6,13 @@
 
 #include <magenta/vm_object_dispatcher.h>
 
+#include <kernel/auto_lock.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 
+#include <magenta/magenta.h>
+#include <magenta/process_dispatcher.h>
+
 #include <assert.h>
 #include <new.h>
 #include <err.h>
@@ -36,7 +40,12 @@ status_t VmObjectDispatcher::Create(mxtl::RefPtr<VmObject> vmo,
 VmObjectDispatcher::VmObjectDispatcher(mxtl::RefPtr<VmObject> vmo)
     : vmo_(vmo), state_tracker_(0u) {}
 
-VmObjectDispatcher::~VmObjectDispatcher() {}
+VmObjectDispatcher::~VmObjectDispatcher() {
+    for (const auto& locker : lockers_) {
+        for (uint32_t n = 0; n < locker.count; n++)
+            vmo_->Unpin();
+    }
+}
 
 mx_status_t VmObjectDispatcher::Read(user_ptr<void> user_data,
                                      size_t length,
@@ -69,23 +78,28 @@ mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
             " buffer %p buffer_size %zu rights %#x\n",
             op, offset, size, buffer.get(), buffer_size, rights);
 
-    // TODO: test rights
-
     switch (op) {
         case MX_VMO_OP_COMMIT: {
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
             // TODO: handle partial commits
             auto status = vmo_->CommitRange(offset, size, nullptr);
             return status;
         }
         case MX_VMO_OP_DECOMMIT: {
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
             // TODO: handle partial decommits
             auto status = vmo_->DecommitRange(offset, size, nullptr);
             return status;
         }
         case MX_VMO_OP_LOCK:
+            // pinning pages affects every other holder of the vmo
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
+            return Lock(offset, size);
         case MX_VMO_OP_UNLOCK:
-            // TODO: handle
-            return ERR_NOT_SUPPORTED;
+            return Unlock();
         case MX_VMO_OP_LOOKUP:
             // we will be using the user pointer
             if (!buffer)
@@ -108,3 +122,43 @@ mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
     }
 }
 
+
+mx_status_t VmObjectDispatcher::Lock(uint64_t offset, uint64_t size) {
+    mx_koid_t koid = ProcessDispatcher::GetCurrent()->get_koid();
+
+    AutoLock lock(&lock_);
+
+    Locker* slot = nullptr;
+    for (auto& locker : lockers_) {
+        if (locker.count > 0 && locker.koid == koid) {
+            slot = &locker;
+            break;
+        }
+        if (locker.count == 0 && !slot)
+            slot = &locker;
+    }
+    if (!slot)
+        return ERR_NO_RESOURCES;
+
+    auto status = vmo_->Pin(offset, size);
+    if (status != NO_ERROR)
+        return status;
+
+    slot->koid = koid;
+    slot->count++;
+    return NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::Unlock() {
+    mx_koid_t koid = ProcessDispatcher::GetCurrent()->get_koid();
+
+    AutoLock lock(&lock_);
+
+    for (auto& locker : lockers_) {
+        if (locker.count > 0 && locker.koid == koid) {
+            locker.count--;
+            return vmo_->Unpin();
+        }
+    }
+    return ERR_BAD_STATE;
+}
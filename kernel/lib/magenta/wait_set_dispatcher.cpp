@@ -84,11 +84,18 @@ bool WaitSetDispatcher::Entry::IsTriggeredLocked() const {
 
 mx_signals_t WaitSetDispatcher::Entry::GetSignalsStateLocked() const {
     DEBUG_ASSERT(wait_set_->mutex_.IsHeld());
-    return signals_;
+    // We only hear about changes to the watched signals, the others come from the object's
+    // current state.
+    auto state_tracker = dispatcher_ ? dispatcher_->get_state_tracker() : nullptr;
+    if (!state_tracker)
+        return signals_;
+    return (signals_ & watched_signals_) | (state_tracker->GetSignalsState() & ~watched_signals_);
 }
 
 WaitSetDispatcher::Entry::Entry(mx_signals_t watched_signals, uint64_t cookie)
-    : StateObserver(), watched_signals_(watched_signals), cookie_(cookie) {}
+    : StateObserver(), watched_signals_(watched_signals), cookie_(cookie) {
+    set_interest(watched_signals);
+}
 
 bool WaitSetDispatcher::Entry::OnInitialize(mx_signals_t initial_state) {
     AutoLock lock(&wait_set_->mutex_);
@@ -112,27 +119,20 @@ bool WaitSetDispatcher::Entry::OnStateChange(mx_signals_t new_state) {
 
     DEBUG_ASSERT(state_ == State::ADDED);
 
+    mx_signals_t asserted = new_state & ~signals_;
     signals_= new_state;
 
     if (watched_signals_ & signals_) {
         if (is_triggered_)
             return false;  // Already triggered.
+        // An edge-triggered entry that was consumed only triggers again on a fresh assertion.
+        if (wait_set_->edge_triggered_ && !(watched_signals_ & asserted))
+            return false;
         return TriggerLocked();
     }
 
-    if (is_triggered_) {
-        DEBUG_ASSERT(InTriggeredEntriesListLocked());
-        is_triggered_ = false;
-        wait_set_->triggered_entries_.erase(*this);
-
-        DEBUG_ASSERT(wait_set_->num_triggered_entries_ > 0u);
-        wait_set_->num_triggered_entries_--;
-
-        if ((wait_set_->num_triggered_entries_ == 0) &&
-            (!wait_set_->cancelled_)) {
-            event_unsignal(&wait_set_->event_);
-        }
-    }
+    if (is_triggered_)
+        UntriggerLocked();
     return false;
 }
 
@@ -181,14 +181,33 @@ bool WaitSetDispatcher::Entry::TriggerLocked() {
     return false;
 }
 
+void WaitSetDispatcher::Entry::UntriggerLocked() {
+    DEBUG_ASSERT(wait_set_->mutex_.IsHeld());
+
+    DEBUG_ASSERT(is_triggered_);
+    DEBUG_ASSERT(InTriggeredEntriesListLocked());
+    is_triggered_ = false;
+    wait_set_->triggered_entries_.erase(*this);
+
+    DEBUG_ASSERT(wait_set_->num_triggered_entries_ > 0u);
+    wait_set_->num_triggered_entries_--;
+
+    if ((wait_set_->num_triggered_entries_ == 0) &&
+        (!wait_set_->cancelled_)) {
+        event_unsignal(&wait_set_->event_);
+    }
+}
+
 // WaitSetDispatcher -------------------------------------------------------------------------------
 
 constexpr mx_rights_t kDefaultWaitSetRights = MX_RIGHT_READ | MX_RIGHT_WRITE;
 
 // static
-status_t WaitSetDispatcher::Create(mxtl::RefPtr<Dispatcher>* dispatcher, mx_rights_t* rights) {
+status_t WaitSetDispatcher::Create(bool edge_triggered,
+                                   mxtl::RefPtr<Dispatcher>* dispatcher,
+                                   mx_rights_t* rights) {
     AllocChecker ac;
-    Dispatcher* d = new (&ac) WaitSetDispatcher();
+    Dispatcher* d = new (&ac) WaitSetDispatcher(edge_triggered);
     if (!ac.check())
         return ERR_NO_MEMORY;
 
@@ -322,29 +341,39 @@ status_t WaitSetDispatcher::Wait(mx_time_t timeout,
     if (num_triggered_entries_ < *num_results)
         *num_results = num_triggered_entries_;
 
-    auto it = triggered_entries_.cbegin();
-    for (uint32_t i = 0; i < *num_results; i++, ++it) {
-        DEBUG_ASSERT(it != triggered_entries_.cend());
+    *max_results = num_triggered_entries_;
+
+    // This only ever visits the entries being reported. Each one leaves the front of the list:
+    // edge-triggered entries are consumed and level-triggered ones go to the back, so that a
+    // caller asking for fewer results than are available still gets to all of them in turn.
+    for (uint32_t i = 0; i < *num_results; i++) {
+        DEBUG_ASSERT(!triggered_entries_.is_empty());
+        Entry& entry = triggered_entries_.front();
 
-        results[i].cookie = it->GetKey();
-        if (it->GetHandleLocked()) {
+        results[i].cookie = entry.GetKey();
+        if (entry.GetHandleLocked()) {
             // Not cancelled
             results[i].status = NO_ERROR;
-            results[i].observed = it->GetSignalsStateLocked();
+            results[i].observed = entry.GetSignalsStateLocked();
         } else {
             // Cancelled.
             results[i].status = ERR_HANDLE_CLOSED;
             results[i].observed = 0;
         }
-    }
 
-    *max_results = num_triggered_entries_;
+        if (edge_triggered_) {
+            entry.UntriggerLocked();
+        } else {
+            triggered_entries_.pop_front();
+            triggered_entries_.push_back(&entry);
+        }
+    }
 
     return result;
 }
 
-WaitSetDispatcher::WaitSetDispatcher()
-    : StateObserver(), state_tracker_(false) {
+WaitSetDispatcher::WaitSetDispatcher(bool edge_triggered)
+    : StateObserver(), state_tracker_(false), edge_triggered_(edge_triggered) {
     event_init(&event_, false, 0);
 
     // This is just so we can observe our own handle's cancellation.
@@ -25,6 +25,7 @@ mx_status_t WaitStateObserver::Begin(WaitEvent* event,
     event_ = event;
     handle_ = handle;
     watched_signals_ = watched_signals;
+    set_interest(watched_signals);
     dispatcher_ = handle->dispatcher();
     wakeup_reasons_ = 0u;
 
@@ -43,8 +44,12 @@ mx_signals_t WaitStateObserver::End() {
 
     auto tracker = dispatcher_->get_state_tracker();
     DEBUG_ASSERT(tracker);
-    if (tracker)
+    if (tracker) {
         tracker->RemoveObserver(this);
+        // We only hear about changes to the watched signals, so pick up the others as they
+        // are now.
+        wakeup_reasons_ |= tracker->GetSignalsState();
+    }
     dispatcher_.reset();
 
     // Return the set of reasons that we may have been woken.  Basically, this
@@ -128,7 +128,7 @@ void* Arena::Alloc() {
         return node->slot;
     } else if (d_top_ < d_end_) {
         auto slot = d_top_;
-        d_top_ += ob_size_;
+        __atomic_store_n(&d_top_, d_top_ + ob_size_, __ATOMIC_RELEASE);
         return slot;
     } else {
         return nullptr;
@@ -34,9 +34,10 @@ public:
     status_t Init(const char* name, size_t ob_size, size_t max_count);
     void* Alloc();
     void Free(void* addr);
+    // Safe to call without the lock serializing Alloc(), the arena only ever grows.
     bool in_range(void* addr) const {
         return ((addr >= static_cast<void*>(d_start_)) &&
-                (addr < static_cast<void*>(d_top_)));
+                (addr < static_cast<void*>(__atomic_load_n(&d_top_, __ATOMIC_ACQUIRE))));
     }
 
     void* start() const { return d_start_; }
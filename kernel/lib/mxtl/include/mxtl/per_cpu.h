@@ -0,0 +1,99 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <kernel/spinlock.h>
+#include <mxtl/macros.h>
+
+namespace mxtl {
+
+// PerCpu<T> holds one T for every cpu the kernel can run on, each on its own
+// cache line(s) so that cpus updating their own slot do not contend with each
+// other.
+//
+// The current cpu's slot may only be touched while the caller cannot migrate
+// to another cpu.  WithCurrent() and CurrentGuard take care of that by
+// disabling interrupts (and with them, preemption) for the duration of the
+// access.  Keep such accesses short, and do not block in them.
+//
+// Slots for other cpus (or for any cpu when the caller knows it cannot
+// migrate) are reachable through Get() and ForEach(); any synchronization with
+// the owning cpu is up to the user.
+//
+//    struct Stats { uint64_t packets; };
+//    static mxtl::PerCpu<Stats> stats;
+//
+//    stats.WithCurrent([](Stats& s) { s.packets++; });
+//
+//    uint64_t total = 0;
+//    stats.ForEach([&total](uint cpu, Stats& s) { total += s.packets; });
+template <typename T>
+class PerCpu {
+public:
+    constexpr PerCpu() { }
+
+    // Run fn(T&) on the current cpu's slot with interrupts disabled, and return
+    // whatever it returns.
+    template <typename Fn>
+    auto WithCurrent(Fn fn) -> decltype(fn(*static_cast<T*>(nullptr))) {
+        CurrentGuard guard(this);
+        return fn(*guard);
+    }
+
+    // RAII access to the current cpu's slot.  Interrupts are disabled for the
+    // lifetime of the guard.
+    class CurrentGuard {
+    public:
+        explicit CurrentGuard(PerCpu* per_cpu) {
+            arch_interrupt_save(&irq_state_, SPIN_LOCK_FLAG_INTERRUPTS);
+            value_ = &per_cpu->slots_[arch_curr_cpu_num()].value;
+        }
+        ~CurrentGuard() { arch_interrupt_restore(irq_state_, SPIN_LOCK_FLAG_INTERRUPTS); }
+
+        T& operator*() const  { return *value_; }
+        T* operator->() const { return value_; }
+
+        DISALLOW_COPY_ASSIGN_AND_MOVE(CurrentGuard);
+
+    private:
+        spin_lock_saved_state_t irq_state_;
+        T* value_;
+    };
+
+    // The slot of a specific cpu.
+    T& Get(uint cpu) {
+        DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+        return slots_[cpu].value;
+    }
+
+    const T& Get(uint cpu) const {
+        DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+        return slots_[cpu].value;
+    }
+
+    // Call fn(cpu, T&) on every cpu's slot.
+    template <typename Fn>
+    void ForEach(Fn fn) {
+        for (uint i = 0; i < SMP_MAX_CPUS; i++)
+            fn(i, slots_[i].value);
+    }
+
+    static constexpr uint size() { return SMP_MAX_CPUS; }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PerCpu);
+
+private:
+    struct Slot {
+        T value;
+    } __CPU_ALIGN;
+
+    Slot slots_[SMP_MAX_CPUS];
+};
+
+}  // namespace mxtl
@@ -0,0 +1,111 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <app/tests.h>
+#include <unittest.h>
+
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <mxtl/intrusive_mpsc_queue.h>
+#include <mxtl/per_cpu.h>
+
+namespace {
+
+constexpr uint kIncrementsPerThread = 10000u;
+
+struct Counter {
+    uint64_t count;
+    uint last_cpu;
+};
+
+struct QueueItem : public mxtl::MpscQueueable<QueueItem*> {
+    uint cpu;
+};
+
+struct WorkerArgs {
+    mxtl::PerCpu<Counter>* counters;
+    mxtl::MpscQueue<QueueItem*>* queue;
+    QueueItem item;
+};
+
+int per_cpu_worker(void* arg) {
+    WorkerArgs* args = static_cast<WorkerArgs*>(arg);
+    for (uint i = 0; i < kIncrementsPerThread; i++) {
+        args->counters->WithCurrent([](Counter& c) {
+            c.count++;
+            c.last_cpu = arch_curr_cpu_num();
+        });
+    }
+
+    args->item.cpu = arch_curr_cpu_num();
+    args->queue->push(&args->item);
+    return 0;
+}
+
+bool per_cpu_test(void* context) {
+    BEGIN_TEST;
+
+    // Slots must not share cache lines.
+    static mxtl::PerCpu<Counter> counters;
+    if (SMP_MAX_CPUS > 1) {
+        uintptr_t a = reinterpret_cast<uintptr_t>(&counters.Get(0));
+        uintptr_t b = reinterpret_cast<uintptr_t>(&counters.Get(1));
+        EXPECT_EQ(0u, a % CACHE_LINE, "slot misaligned");
+        EXPECT_EQ(0u, (b - a) % CACHE_LINE, "slots share a cache line");
+    }
+    counters.ForEach([](uint cpu, Counter& c) { c.count = 0; c.last_cpu = cpu; });
+
+    // Run one worker pinned to each online cpu, each counting into its cpu's
+    // slot and then reporting in through a shared MpscQueue.
+    mxtl::MpscQueue<QueueItem*> queue;
+    WorkerArgs args[SMP_MAX_CPUS];
+    thread_t* threads[SMP_MAX_CPUS] = { };
+    uint thread_count = 0;
+    mp_cpu_mask_t online = mp_get_online_mask();
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!(online & (1u << cpu)))
+            continue;
+        args[cpu].counters = &counters;
+        args[cpu].queue = &queue;
+        threads[cpu] = thread_create("per_cpu_test", per_cpu_worker, &args[cpu],
+                                     DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        REQUIRE_NONNULL(threads[cpu], "thread_create failed");
+        thread_set_pinned_cpu(threads[cpu], cpu);
+        thread_resume(threads[cpu]);
+        thread_count++;
+    }
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (threads[cpu])
+            thread_join(threads[cpu], nullptr, INFINITE_TIME);
+    }
+
+    // Each pinned worker's increments must have landed in its own cpu's slot.
+    uint64_t total = 0;
+    counters.ForEach([&total](uint, Counter& c) {
+        total += c.count;
+    });
+    EXPECT_EQ(static_cast<uint64_t>(thread_count) * kIncrementsPerThread, total, "lost increments");
+
+    uint reported = 0;
+    QueueItem* item;
+    while ((item = queue.pop()) != nullptr) {
+        EXPECT_EQ(kIncrementsPerThread, counters.Get(item->cpu).count, "count on wrong cpu");
+        EXPECT_EQ(item->cpu, counters.Get(item->cpu).last_cpu, "slot touched from wrong cpu");
+        reported++;
+    }
+    EXPECT_EQ(thread_count, reported, "");
+    EXPECT_TRUE(queue.is_empty(), "");
+
+    END_TEST;
+}
+
+} // namespace
+
+UNITTEST_START_TESTCASE(per_cpu_tests)
+UNITTEST("PerCpu and MpscQueue", per_cpu_test)
+UNITTEST_END_TESTCASE(per_cpu_tests, "percputests", "PerCpu/MpscQueue tests", NULL, NULL);
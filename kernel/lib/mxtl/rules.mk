@@ -17,6 +17,8 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/arena.cpp \
     $(LOCAL_DIR)/arena_tests.cpp \
     $(LOCAL_DIR)/fifo_buffer_tests.cpp \
+    $(LOCAL_DIR)/per_cpu_tests.cpp \
+    $(LOCAL_DIR)/slab_allocator_tests.cpp \
 
 include make/module.mk
 
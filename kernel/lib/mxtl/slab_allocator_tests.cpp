@@ -0,0 +1,115 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <app/tests.h>
+#include <unittest.h>
+
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <mxtl/slab_allocator.h>
+
+// Kernel side tests of the slab allocator's magazines, which use per-cpu
+// spinlocked magazines here rather than the thread-hashed ones of user mode.
+
+namespace {
+
+constexpr size_t kMagazineSize = 8;
+constexpr size_t kMaxSlabs = 4;
+constexpr uint kPasses = 1000;
+
+struct TestObj;
+using TestAllocTraits = mxtl::SlabAllocatorTraits<TestObj*, 1024, mxtl::Mutex,
+                                                  false, kMagazineSize>;
+using TestAllocator = mxtl::SlabAllocator<TestAllocTraits>;
+
+struct TestObj : public mxtl::SlabAllocated<TestAllocTraits> {
+    uint64_t val = 0;
+};
+
+constexpr size_t kMaxAllocs = TestAllocator::AllocsPerSlab * kMaxSlabs;
+
+struct WorkerArgs {
+    TestAllocator* allocator;
+    size_t count;
+    bool ok;
+};
+
+// Allocates its share of the allocator's capacity and frees it again, over
+// and over, on the cpu it is pinned to.
+int slab_worker(void* arg) {
+    WorkerArgs* args = static_cast<WorkerArgs*>(arg);
+    TestObj* objs[kMaxAllocs];
+
+    args->ok = true;
+    for (uint pass = 0; pass < kPasses; pass++) {
+        for (size_t i = 0; i < args->count; i++) {
+            objs[i] = args->allocator->New();
+            if (objs[i] == nullptr)
+                args->ok = false;
+        }
+        for (size_t i = 0; i < args->count; i++)
+            delete objs[i];
+    }
+    return 0;
+}
+
+bool slab_magazine_test(void* context) {
+    BEGIN_TEST;
+
+    TestAllocator allocator(kMaxSlabs);
+
+    // One worker per online cpu, holding the whole capacity between them, so
+    // allocations keep having to find objects freed into other cpus'
+    // magazines.
+    WorkerArgs args[SMP_MAX_CPUS];
+    thread_t* threads[SMP_MAX_CPUS] = { };
+    uint cpus[SMP_MAX_CPUS];
+    uint cpu_count = 0;
+    mp_cpu_mask_t online = mp_get_online_mask();
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (online & (1u << cpu))
+            cpus[cpu_count++] = cpu;
+    }
+    REQUIRE_GT(cpu_count, 0u, "no cpus online");
+
+    for (uint n = 0; n < cpu_count; n++) {
+        args[n].allocator = &allocator;
+        args[n].count = kMaxAllocs / cpu_count + ((n == 0) ? kMaxAllocs % cpu_count : 0);
+        args[n].ok = false;
+        threads[n] = thread_create("slab_test", slab_worker, &args[n],
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        REQUIRE_NONNULL(threads[n], "thread_create failed");
+        thread_set_pinned_cpu(threads[n], cpus[n]);
+        thread_resume(threads[n]);
+    }
+
+    for (uint n = 0; n < cpu_count; n++) {
+        thread_join(threads[n], nullptr, INFINITE_TIME);
+        EXPECT_TRUE(args[n].ok, "allocation failed below the limit");
+    }
+
+    // Whatever is left cached in the magazines must still be allocatable,
+    // right up to the limit and no further.
+    TestObj* objs[kMaxAllocs];
+    for (size_t i = 0; i < kMaxAllocs; i++) {
+        objs[i] = allocator.New();
+        EXPECT_NONNULL(objs[i], "allocation failed below the limit");
+    }
+    TestObj* extra = allocator.New();
+    EXPECT_NULL(extra, "allocation succeeded past the limit");
+    if (extra != nullptr)
+        delete extra;
+    for (size_t i = 0; i < kMaxAllocs; i++)
+        delete objs[i];
+
+    END_TEST;
+}
+
+} // namespace
+
+UNITTEST_START_TESTCASE(slab_allocator_tests)
+UNITTEST("SlabAllocator magazines", slab_magazine_test)
+UNITTEST_END_TESTCASE(slab_allocator_tests, "slabtests", "SlabAllocator tests", NULL, NULL);
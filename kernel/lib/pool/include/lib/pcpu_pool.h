@@ -0,0 +1,103 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+/**
+ * A concurrent, per-cpu variant of the pool allocator in lib/pool.h.
+ *
+ * Objects of a fixed size and alignment are carved out of caller supplied storage, as with
+ * pool_t, but a pcpu_pool_t may be used from any thread or interrupt handler without external
+ * locking.  Each cpu keeps a small cache of free objects which it allocates from and frees to
+ * with interrupts disabled.  When a cache runs dry or overflows, half a cache worth of objects
+ * moves to or from a global depot, which is a lock-free stack.
+ *
+ * Storage is sized and aligned with the POOL_STORAGE_* macros from lib/pool.h.  Objects freed on
+ * one cpu may be allocated on another, and objects sitting in other cpus' caches are not
+ * available to an allocation which finds both its cache and the depot empty.
+ *
+ * Typical usage:
+ *
+ * DEFINE_TYPED_POOL_STORAGE(foo_t, foo_pool_storage, 100);
+ * pcpu_pool_t foo_pool;
+ * TYPED_PCPU_POOL_INIT(foo_t, &foo_pool, 100, foo_pool_storage);
+ *
+ * foo_t *foo = TYPED_PCPU_POOL_ALLOC(foo_t, &foo_pool);
+ * ...
+ * TYPED_PCPU_POOL_FREE(foo_t, &foo_pool, foo);
+ */
+
+#include <arch/ops.h>
+#include <lib/pool.h>
+#include <magenta/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+/**
+ * The most objects a cpu keeps in its cache.
+ */
+#define PCPU_POOL_CACHE_SIZE 16
+
+/**
+ * Helper type, not for public usage.
+ */
+typedef struct {
+    uint32_t count;
+    void *objects[PCPU_POOL_CACHE_SIZE];
+} __CPU_ALIGN pcpu_pool_cache_t;
+
+/**
+ * Pool type.
+ */
+typedef struct {
+    // Private:
+    uint8_t *storage;
+    size_t object_size;
+    size_t object_count;
+
+    // The depot is a stack of free objects linked through their first 32 bits by index.  The head
+    // holds the index of the top object plus one (zero when empty) in its low 32 bits, and a tag
+    // bumped by every push and pop in its high 32 bits so that a pop racing with a pop and push of
+    // the same object fails its compare and swap.
+    uint64_t depot_head __CPU_ALIGN;
+
+    pcpu_pool_cache_t caches[SMP_MAX_CPUS];
+} pcpu_pool_t;
+
+/**
+ * Initialize the pool object.
+ * Provided storage must be aligned to POOL_STORAGE_ALIGN(object_size, object_align) and of size of
+ * at least POOL_STORAGE_SIZE(object_size, object_align, object_count).  Every object starts out in
+ * the depot.
+ */
+void pcpu_pool_init(pcpu_pool_t *pool,
+                    size_t object_size,
+                    size_t object_align,
+                    size_t object_count,
+                    void *storage);
+
+/**
+ * Allocate an object from the pool.
+ * Returns NULL if neither this cpu's cache nor the depot has a free object.
+ */
+void *pcpu_pool_alloc(pcpu_pool_t *pool);
+
+/**
+ * Free an object previously allocated with pcpu_pool_alloc.
+ */
+void pcpu_pool_free(pcpu_pool_t *pool, void *object);
+
+#define TYPED_PCPU_POOL_INIT(type, pool, count, storage) \
+    pcpu_pool_init(pool, sizeof(type), __alignof(type), count, storage)
+
+#define TYPED_PCPU_POOL_ALLOC(type, pool) \
+    ((type*) pcpu_pool_alloc(pool))
+
+#define TYPED_PCPU_POOL_FREE(type, pool, object) \
+    pcpu_pool_free(pool, object)
+
+__END_CDECLS
@@ -0,0 +1,127 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/pcpu_pool.h>
+
+#include <assert.h>
+#include <debug.h>
+#include <kernel/spinlock.h>
+#include <string.h>
+
+#define DEPOT_INDEX(head) ((uint32_t)(head))
+#define DEPOT_TAG(head) ((uint32_t)((head) >> 32))
+#define DEPOT_HEAD(tag, index) (((uint64_t)(tag) << 32) | (index))
+
+static void *object_at(pcpu_pool_t *pool, uint32_t index)
+{
+    return pool->storage + (size_t)index * pool->object_size;
+}
+
+static uint32_t index_of(pcpu_pool_t *pool, void *object)
+{
+    uintptr_t offset = (uintptr_t)object - (uintptr_t)pool->storage;
+    DEBUG_ASSERT(offset % pool->object_size == 0);
+    DEBUG_ASSERT(offset / pool->object_size < pool->object_count);
+    return (uint32_t)(offset / pool->object_size);
+}
+
+static void depot_push(pcpu_pool_t *pool, void *object)
+{
+    uint32_t *link = object;
+    uint32_t index = index_of(pool, object) + 1;
+
+    uint64_t old_head = __atomic_load_n(&pool->depot_head, __ATOMIC_RELAXED);
+    uint64_t new_head;
+    do {
+        __atomic_store_n(link, DEPOT_INDEX(old_head), __ATOMIC_RELAXED);
+        new_head = DEPOT_HEAD(DEPOT_TAG(old_head) + 1, index);
+    } while (!__atomic_compare_exchange_n(&pool->depot_head, &old_head, new_head, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void *depot_pop(pcpu_pool_t *pool)
+{
+    uint64_t old_head = __atomic_load_n(&pool->depot_head, __ATOMIC_ACQUIRE);
+    uint64_t new_head;
+    void *object;
+    do {
+        if (!DEPOT_INDEX(old_head))
+            return NULL;
+
+        // The object may be popped and handed out by another cpu while we read its link; the tag
+        // makes our compare and swap fail if so.  Storage is never freed, so the read is safe.
+        object = object_at(pool, DEPOT_INDEX(old_head) - 1);
+        uint32_t next = __atomic_load_n((uint32_t *)object, __ATOMIC_RELAXED);
+        new_head = DEPOT_HEAD(DEPOT_TAG(old_head) + 1, next);
+    } while (!__atomic_compare_exchange_n(&pool->depot_head, &old_head, new_head, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return object;
+}
+
+void pcpu_pool_init(pcpu_pool_t *pool,
+                    size_t object_size,
+                    size_t object_align,
+                    size_t object_count,
+                    void *storage)
+{
+    assert(pool);
+    assert(!object_count || storage);
+    assert((intptr_t) storage % POOL_STORAGE_ALIGN(object_size, object_align) == 0);
+    assert(object_count < UINT32_MAX);
+
+    memset(pool, 0, sizeof(*pool));
+    pool->storage = storage;
+    pool->object_size = POOL_PADDED_OBJECT_SIZE(object_size, object_align);
+    pool->object_count = object_count;
+
+    // Push in reverse so that allocations come out in address order.
+    for (size_t i = object_count; i > 0; --i)
+        depot_push(pool, object_at(pool, (uint32_t)(i - 1)));
+}
+
+void *pcpu_pool_alloc(pcpu_pool_t *pool)
+{
+    assert(pool);
+
+    // With interrupts off nothing else can touch this cpu's cache.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pcpu_pool_cache_t *cache = &pool->caches[arch_curr_cpu_num()];
+
+    if (!cache->count) {
+        while (cache->count < PCPU_POOL_CACHE_SIZE / 2) {
+            void *object = depot_pop(pool);
+            if (!object)
+                break;
+            cache->objects[cache->count++] = object;
+        }
+    }
+
+    void *result = cache->count ? cache->objects[--cache->count] : NULL;
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return result;
+}
+
+void pcpu_pool_free(pcpu_pool_t *pool, void *object)
+{
+    assert(pool);
+    assert(object);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pcpu_pool_cache_t *cache = &pool->caches[arch_curr_cpu_num()];
+
+    if (cache->count == PCPU_POOL_CACHE_SIZE) {
+        while (cache->count > PCPU_POOL_CACHE_SIZE / 2)
+            depot_push(pool, cache->objects[--cache->count]);
+    }
+
+    cache->objects[cache->count++] = object;
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
@@ -0,0 +1,119 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/pcpu_pool.h>
+
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <unittest.h>
+
+#define TEST_OBJECTS 64
+
+typedef struct {
+    uint64_t owner;
+    uint64_t pad;
+} test_object_t;
+
+static pcpu_pool_t test_pool;
+static DEFINE_TYPED_POOL_STORAGE(test_object_t, test_storage, TEST_OBJECTS);
+
+static bool pcpu_pool_basic_test(void* context)
+{
+    BEGIN_TEST;
+
+    TYPED_PCPU_POOL_INIT(test_object_t, &test_pool, TEST_OBJECTS, test_storage);
+
+    // Every object can be allocated, once, from a single cpu.
+    test_object_t* objects[TEST_OBJECTS];
+    for (size_t i = 0; i < TEST_OBJECTS; i++) {
+        objects[i] = TYPED_PCPU_POOL_ALLOC(test_object_t, &test_pool);
+        REQUIRE_NONNULL(objects[i], "");
+        EXPECT_EQ(0u, (uintptr_t)objects[i] % __alignof(test_object_t), "");
+        for (size_t j = 0; j < i; j++)
+            EXPECT_NEQ(objects[j], objects[i], "");
+    }
+    EXPECT_NULL(TYPED_PCPU_POOL_ALLOC(test_object_t, &test_pool), "");
+
+    // Freeing more than a cache worth sends objects back through the depot.
+    for (size_t i = 0; i < TEST_OBJECTS; i++)
+        TYPED_PCPU_POOL_FREE(test_object_t, &test_pool, objects[i]);
+    for (size_t i = 0; i < TEST_OBJECTS; i++)
+        EXPECT_NONNULL(TYPED_PCPU_POOL_ALLOC(test_object_t, &test_pool), "");
+    EXPECT_NULL(TYPED_PCPU_POOL_ALLOC(test_object_t, &test_pool), "");
+
+    END_TEST;
+}
+
+#define CHURN_ITERATIONS 10000
+#define CHURN_BATCH 8
+
+static volatile int churn_errors;
+
+static int churn_thread(void* arg)
+{
+    uint64_t id = (uintptr_t)arg;
+    test_object_t* held[CHURN_BATCH];
+
+    for (int i = 0; i < CHURN_ITERATIONS; i++) {
+        size_t count = 0;
+        while (count < CHURN_BATCH) {
+            test_object_t* object = TYPED_PCPU_POOL_ALLOC(test_object_t, &test_pool);
+            if (!object)
+                break;
+            // No one else may own an object we were just handed.
+            if (__atomic_exchange_n(&object->owner, id, __ATOMIC_RELAXED) != 0)
+                __atomic_add_fetch(&churn_errors, 1, __ATOMIC_RELAXED);
+            held[count++] = object;
+        }
+        while (count) {
+            test_object_t* object = held[--count];
+            if (__atomic_exchange_n(&object->owner, 0, __ATOMIC_RELAXED) != id)
+                __atomic_add_fetch(&churn_errors, 1, __ATOMIC_RELAXED);
+            TYPED_PCPU_POOL_FREE(test_object_t, &test_pool, object);
+        }
+    }
+    return 0;
+}
+
+static bool pcpu_pool_churn_test(void* context)
+{
+    BEGIN_TEST;
+
+    TYPED_PCPU_POOL_INIT(test_object_t, &test_pool, TEST_OBJECTS, test_storage);
+    for (size_t i = 0; i < TEST_OBJECTS; i++)
+        ((test_object_t*)test_storage)[i].owner = 0;
+    churn_errors = 0;
+
+    // One thread per online cpu, each churning through batches of objects.
+    thread_t* threads[SMP_MAX_CPUS];
+    uint count = 0;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!mp_is_cpu_online(cpu))
+            continue;
+        threads[count] = thread_create("pcpu pool churn", churn_thread,
+                                       (void*)(uintptr_t)(count + 1),
+                                       DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        REQUIRE_NONNULL(threads[count], "");
+        thread_set_pinned_cpu(threads[count], cpu);
+        thread_resume(threads[count]);
+        count++;
+    }
+    for (uint i = 0; i < count; i++)
+        thread_join(threads[i], NULL, INFINITE_TIME);
+
+    EXPECT_EQ(0, churn_errors, "");
+
+    // Everything went back to the pool.
+    for (size_t i = 0; i < TEST_OBJECTS; i++)
+        EXPECT_EQ(0u, ((test_object_t*)test_storage)[i].owner, "");
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(pcpu_pool_tests)
+UNITTEST("basic", pcpu_pool_basic_test)
+UNITTEST("churn", pcpu_pool_churn_test)
+UNITTEST_END_TESTCASE(pcpu_pool_tests, "pcpu_pool", "per-cpu pool tests", NULL, NULL);
@@ -10,6 +10,11 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
+	$(LOCAL_DIR)/pcpu_pool.c \
+	$(LOCAL_DIR)/pcpu_pool_tests.c \
 	$(LOCAL_DIR)/pool.c
 
+MODULE_DEPS += \
+	lib/unittest
+
 include make/module.mk
@@ -17,6 +17,7 @@ MODULE_DEPS := \
 
 MODULE_SRCS := \
     $(LOCAL_DIR)/syscalls.cpp \
+    $(LOCAL_DIR)/syscalls_batch.cpp \
     $(LOCAL_DIR)/syscalls_channel.cpp \
     $(LOCAL_DIR)/syscalls_debug.cpp \
     $(LOCAL_DIR)/syscalls_ddk.cpp \
@@ -33,4 +34,11 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/syscalls_vmar.cpp \
     $(LOCAL_DIR)/syscalls_vmo.cpp \
 
+# per-syscall call counts and latency histograms, see syscalls_stats.cpp
+WITH_SYSCALL_STATS ?= false
+ifeq ($(call TOBOOL,$(WITH_SYSCALL_STATS)),true)
+KERNEL_DEFINES += WITH_SYSCALL_STATS=1
+MODULE_SRCS += $(LOCAL_DIR)/syscalls_stats.cpp
+endif
+
 include make/module.mk
@@ -6,6 +6,7 @@
 
 #include <err.h>
 
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <lib/user_copy.h>
 
@@ -26,6 +27,8 @@
 
 #define LOCAL_TRACE 0
 
+KCOUNTER(syscalls, "kernel.syscalls");
+
 int sys_invalid_syscall(void) {
     LTRACEF("invalid syscall\n");
     return ERR_BAD_SYSCALL;
@@ -33,6 +36,10 @@ int sys_invalid_syscall(void) {
 
 #define MAGENTA_VDSOCALL_DEF(ret, name, args...) // Nothing to do here.
 
+#if WITH_SYSCALL_STATS
+#include <magenta/gen-stats.inc>
+#endif
+
 #if ARCH_ARM64
 #include <arch/arm64.h>
 
@@ -55,6 +62,8 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
     /* re-enable interrupts to maintain kernel preemptiveness */
     arch_enable_ints();
 
+    kcounter_add(&syscalls, 1);
+
     LTRACEF_LEVEL(2, "num %" PRIu64 "\n", syscall_num);
 
     /* build a function pointer to call the routine.
@@ -68,7 +77,11 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
     case n:                                                                                        \
         sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
         break;
+#if WITH_SYSCALL_STATS
+#include <magenta/gen-stats-switch.inc>
+#else
 #include <magenta/gen-switch.inc>
+#endif
         default:
             sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
     }
@@ -116,6 +129,8 @@ uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t ar
     /* re-enable interrupts to maintain kernel preemptiveness */
     arch_enable_ints();
 
+    kcounter_add(&syscalls, 1);
+
     LTRACEF_LEVEL(2, "t %p syscall num %" PRIu64 " ip %#" PRIx64 "\n",
                   get_current_thread(), syscall_num, ip);
 
@@ -130,7 +145,11 @@ uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t ar
     case n:                                                                                        \
         sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
         break;
+#if WITH_SYSCALL_STATS
+#include <magenta/gen-stats-switch.inc>
+#else
 #include <magenta/gen-switch.inc>
+#endif
         default:
             sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
     }
@@ -0,0 +1,119 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <err.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <trace.h>
+
+#include <kernel/vm/vm_object.h>
+
+#include <lib/user_copy.h>
+
+#include <magenta/magenta.h>
+#include <magenta/port_dispatcher.h>
+#include <magenta/process_dispatcher.h>
+#include <magenta/syscalls/batch.h>
+#include <magenta/user_copy.h>
+#include <magenta/vm_object_dispatcher.h>
+
+#include <mxtl/algorithm.h>
+#include <mxtl/ref_ptr.h>
+
+#include "syscalls_priv.h"
+
+#define LOCAL_TRACE 0
+
+// Operations read from the ring at a time.
+constexpr size_t kBatchChunk = 8u;
+
+static int64_t run_batch_op(const mx_batch_op_t& op) {
+    const uint64_t* args = op.args;
+    int64_t result;
+    switch (op.op) {
+#include <magenta/gen-batch.inc>
+    default:
+        result = ERR_NOT_SUPPORTED;
+        break;
+    }
+    return result;
+}
+
+mx_status_t sys_batch_submit(mx_handle_t ring_handle, mx_handle_t port_handle, uint32_t max_ops,
+                             uint32_t* _actual) {
+    LTRACEF("ring %d port %d max_ops %u\n", ring_handle, port_handle, max_ops);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<VmObjectDispatcher> ring;
+    mx_status_t status = up->GetDispatcher(ring_handle, &ring,
+                                           MX_RIGHT_READ | MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<PortDispatcher> port;
+    if (port_handle != MX_HANDLE_INVALID) {
+        status = up->GetDispatcher(port_handle, &port, MX_RIGHT_WRITE);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    auto vmo = ring->vmo();
+    mx_batch_ring_t header;
+    size_t len;
+    status = vmo->Read(&header, 0u, sizeof(header), &len);
+    if (status != NO_ERROR || len != sizeof(header))
+        return ERR_INVALID_ARGS;
+
+    const uint32_t size = header.size;
+    if (size == 0u || (size & (size - 1)) != 0u || vmo->size() < MX_BATCH_RING_OPS_OFFSET ||
+        size > (vmo->size() - MX_BATCH_RING_OPS_OFFSET) / sizeof(mx_batch_op_t))
+        return ERR_INVALID_ARGS;
+
+    uint32_t head = header.head;
+    const uint32_t pending = header.tail - head;
+    if (pending > size)
+        return ERR_BAD_STATE;
+
+    // Each operation's completion is queued before the next one runs, so the
+    // first failure to post one leaves the operations after it in the ring.
+    const uint32_t count = mxtl::min(pending, max_ops);
+    uint32_t done = 0u;
+    status = NO_ERROR;
+    while (done < count && status == NO_ERROR) {
+        // Stop each chunk at the end of the ring so it is one contiguous read.
+        uint32_t slot = (head + done) & (size - 1);
+        size_t chunk = mxtl::min<size_t>(mxtl::min<size_t>(count - done, kBatchChunk),
+                                         size - slot);
+        mx_batch_op_t ops[kBatchChunk];
+        status = vmo->Read(ops, MX_BATCH_RING_OPS_OFFSET + slot * sizeof(mx_batch_op_t),
+                           chunk * sizeof(mx_batch_op_t), &len);
+        if (status == NO_ERROR && len != chunk * sizeof(mx_batch_op_t))
+            status = ERR_IO;
+
+        for (size_t i = 0; i < chunk && status == NO_ERROR; i++) {
+            mx_batch_packet_t packet = {};
+            packet.hdr.key = ops[i].user_data;
+            packet.hdr.type = MX_PORT_PKT_TYPE_BATCH;
+            packet.op = ops[i].op;
+            packet.result = run_batch_op(ops[i]);
+            done++;
+            if (port) {
+                auto iopk = IOP_Packet::Make(&packet, sizeof(packet));
+                status = iopk ? port->Queue(iopk) : ERR_NO_MEMORY;
+            }
+        }
+    }
+
+    head += done;
+    vmo->Write(&head, offsetof(mx_batch_ring_t, head), sizeof(head), &len);
+
+    if (_actual) {
+        if (make_user_ptr(_actual).copy_to_user(done) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+    return status;
+}
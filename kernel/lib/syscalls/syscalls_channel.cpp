@@ -32,6 +32,7 @@
 
 constexpr size_t kChannelReadHandlesChunkCount = 16u;
 constexpr size_t kChannelWriteHandlesInlineCount = 8u;
+constexpr uint32_t kChannelBatchMax = 64u;
 
 mx_status_t sys_channel_create(uint32_t flags, mx_handle_t* _out0, mx_handle_t* _out1) {
     LTRACEF("out_handles %p,%p\n", _out0, _out1);
@@ -96,6 +97,30 @@ void msg_get_handles(ProcessDispatcher* up, MessagePacket* msg,
     }
 }
 
+// Reads the next message into the caller's buffers, or on ERR_BUFFER_TOO_SMALL
+// reports the sizes they would need to be through |num_bytes| and |num_handles|.
+static mx_status_t msg_read(ProcessDispatcher* up, ChannelDispatcher* channel, uint32_t flags,
+                            void* _bytes, uint32_t* num_bytes,
+                            mx_handle_t* _handles, uint32_t* num_handles) {
+    mxtl::unique_ptr<MessagePacket> msg;
+    mx_status_t result = channel->Read(num_bytes, num_handles, &msg,
+                                       flags & MX_CHANNEL_READ_MAY_DISCARD);
+    if (result != NO_ERROR)
+        return result;
+
+    if (*num_bytes > 0u) {
+        if (msg->CopyDataToUser(make_user_ptr(_bytes)) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+
+    if (*num_handles > 0u) {
+        msg_get_handles(up, msg.get(), _handles, *num_handles);
+    }
+
+    ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(), *num_bytes, *num_handles, 0);
+    return NO_ERROR;
+}
+
 mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t flags,
                              void* _bytes,
                              uint32_t num_bytes, uint32_t* _num_bytes,
@@ -114,9 +139,7 @@ mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t flags,
     if (flags & ~MX_CHANNEL_READ_MASK)
         return ERR_NOT_SUPPORTED;
 
-    mxtl::unique_ptr<MessagePacket> msg;
-    result = channel->Read(&num_bytes, &num_handles, &msg,
-                           flags & MX_CHANNEL_READ_MAY_DISCARD);
+    result = msg_read(up, channel.get(), flags, _bytes, &num_bytes, _handles, &num_handles);
     if (result != NO_ERROR && result != ERR_BUFFER_TOO_SMALL)
         return result;
 
@@ -130,20 +153,56 @@ mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t flags,
         if (make_user_ptr(_num_handles).copy_to_user(num_handles) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
-    if (result == ERR_BUFFER_TOO_SMALL)
+    return result;
+}
+
+mx_status_t sys_channel_read_many(mx_handle_t handle_value, uint32_t flags,
+                                  mx_channel_msg_t* _msgs, uint32_t count, uint32_t* _actual) {
+    LTRACEF("handle %d msgs %p count %u\n", handle_value, _msgs, count);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcher(handle_value, &channel, MX_RIGHT_READ);
+    if (result != NO_ERROR)
         return result;
 
-    if (num_bytes > 0u) {
-        if (make_user_ptr(_bytes).copy_array_to_user(msg->data(), num_bytes) != NO_ERROR)
-            return ERR_INVALID_ARGS;
+    if (flags & ~MX_CHANNEL_READ_MASK)
+        return ERR_NOT_SUPPORTED;
+    if (count > kChannelBatchMax)
+        return ERR_OUT_OF_RANGE;
+
+    user_ptr<mx_channel_msg_t> msgs(_msgs);
+    uint32_t read = 0u;
+    while (read < count) {
+        mx_channel_msg_t msg;
+        if (msgs.element_offset(read).copy_from_user(&msg) != NO_ERROR) {
+            result = ERR_INVALID_ARGS;
+            break;
+        }
+
+        result = msg_read(up, channel.get(), flags, msg.bytes, &msg.num_bytes,
+                          msg.handles, &msg.num_handles);
+        if (result != NO_ERROR && result != ERR_BUFFER_TOO_SMALL)
+            break;
+
+        // the sizes of the message, or of the buffers it needs
+        if (msgs.element_offset(read).copy_to_user(msg) != NO_ERROR) {
+            result = ERR_INVALID_ARGS;
+            break;
+        }
+        if (result == ERR_BUFFER_TOO_SMALL)
+            break;
+        read++;
     }
 
-    if (num_handles > 0u) {
-        msg_get_handles(up, msg.get(), _handles, num_handles);
+    if (_actual) {
+        if (make_user_ptr(_actual).copy_to_user(read) != NO_ERROR)
+            return ERR_INVALID_ARGS;
     }
 
-    ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(), num_bytes, num_handles, 0);
-    return result;
+    // running out of messages, or room for them, after reading some is not an error
+    return (read > 0u) ? NO_ERROR : result;
 }
 
 static mx_status_t msg_put_handles(ProcessDispatcher* up, MessagePacket* msg, mx_handle_t* handles,
@@ -195,28 +254,25 @@ static mx_status_t msg_put_handles(ProcessDispatcher* up, MessagePacket* msg, mx
     return NO_ERROR;
 }
 
-mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t flags,
-                              const void* _bytes, uint32_t num_bytes,
-                              const mx_handle_t* _handles, uint32_t num_handles) {
-    LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u flags 0x%x\n",
-            handle_value, _bytes, num_bytes, _handles, num_handles, flags);
-
-    auto up = ProcessDispatcher::GetCurrent();
-
-    mxtl::RefPtr<ChannelDispatcher> channel;
-    mx_status_t result = up->GetDispatcher(handle_value, &channel, MX_RIGHT_WRITE);
-    if (result != NO_ERROR)
-        return result;
-
-
+static mx_status_t msg_write(ProcessDispatcher* up, ChannelDispatcher* channel, uint32_t flags,
+                             const void* _bytes, uint32_t num_bytes,
+                             const mx_handle_t* _handles, uint32_t num_handles) {
+    mx_status_t result;
     mxtl::unique_ptr<MessagePacket> msg;
-    result = MessagePacket::Create(num_bytes, num_handles, &msg);
-    if (result != NO_ERROR)
-        return result;
+    if ((flags & MX_CHANNEL_WRITE_MOVE_PAGES) && MessagePacket::CanMovePages(_bytes, num_bytes)) {
+        result = MessagePacket::CreateFromUserPages(make_user_ptr(_bytes), num_bytes,
+                                                    num_handles, &msg);
+        if (result != NO_ERROR)
+            return result;
+    } else {
+        result = MessagePacket::Create(num_bytes, num_handles, &msg);
+        if (result != NO_ERROR)
+            return result;
 
-    if (num_bytes > 0u) {
-        if (make_user_ptr(_bytes).copy_array_from_user(msg->mutable_data(), num_bytes) != NO_ERROR)
-            return ERR_INVALID_ARGS;
+        if (num_bytes > 0u) {
+            if (make_user_ptr(_bytes).copy_array_from_user(msg->mutable_data(), num_bytes) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+        }
     }
 
     AllocChecker ac;
@@ -225,7 +281,7 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t flags,
         return ERR_NO_MEMORY;
     if (num_handles > 0u) {
         result = msg_put_handles(up, msg.get(), handles.get(), _handles, num_handles,
-                                 static_cast<Dispatcher*>(channel.get()));
+                                 static_cast<Dispatcher*>(channel));
         if (result)
             return result;
     }
@@ -243,6 +299,72 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t flags,
     return result;
 }
 
+mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t flags,
+                              const void* _bytes, uint32_t num_bytes,
+                              const mx_handle_t* _handles, uint32_t num_handles) {
+    LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u flags 0x%x\n",
+            handle_value, _bytes, num_bytes, _handles, num_handles, flags);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcher(handle_value, &channel, MX_RIGHT_WRITE);
+    if (result != NO_ERROR)
+        return result;
+
+    if (flags & ~MX_CHANNEL_WRITE_MASK)
+        return ERR_NOT_SUPPORTED;
+
+    return msg_write(up, channel.get(), flags, _bytes, num_bytes, _handles, num_handles);
+}
+
+mx_status_t sys_channel_write_many(uint32_t flags, const mx_channel_msg_t* _msgs, uint32_t count,
+                                   uint32_t* _actual) {
+    LTRACEF("msgs %p count %u flags 0x%x\n", _msgs, count, flags);
+
+    if (count > kChannelBatchMax)
+        return ERR_OUT_OF_RANGE;
+
+    if (flags & ~MX_CHANNEL_WRITE_MASK)
+        return ERR_NOT_SUPPORTED;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // consecutive messages to the same channel only look it up once
+    mx_handle_t channel_value = MX_HANDLE_INVALID;
+    mxtl::RefPtr<ChannelDispatcher> channel;
+
+    user_ptr<const mx_channel_msg_t> msgs(_msgs);
+    mx_status_t result = NO_ERROR;
+    uint32_t written = 0u;
+    for (; written < count; written++) {
+        mx_channel_msg_t msg;
+        if (msgs.element_offset(written).copy_from_user(&msg) != NO_ERROR) {
+            result = ERR_INVALID_ARGS;
+            break;
+        }
+
+        if (!channel || msg.channel != channel_value) {
+            channel.reset();
+            result = up->GetDispatcher(msg.channel, &channel, MX_RIGHT_WRITE);
+            if (result != NO_ERROR)
+                break;
+            channel_value = msg.channel;
+        }
+
+        result = msg_write(up, channel.get(), flags, msg.bytes, msg.num_bytes,
+                           msg.handles, msg.num_handles);
+        if (result != NO_ERROR)
+            break;
+    }
+
+    if (_actual) {
+        if (make_user_ptr(_actual).copy_to_user(written) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+    return result;
+}
+
 mx_status_t sys_channel_call(mx_handle_t handle_value, uint32_t flags,
                              mx_time_t timeout, const mx_channel_call_args_t* _args,
                              uint32_t* actual_bytes, uint32_t* actual_handles,
@@ -329,7 +451,7 @@ mx_status_t sys_channel_call(mx_handle_t handle_value, uint32_t flags,
     }
 
     if (num_bytes > 0u) {
-        if (make_user_ptr(args.rd_bytes).copy_array_to_user(reply->data(), num_bytes) != NO_ERROR) {
+        if (reply->CopyDataToUser(make_user_ptr(args.rd_bytes)) != NO_ERROR) {
             result = ERR_INVALID_ARGS;
             goto read_failed;
         }
@@ -89,6 +89,18 @@ mx_status_t sys_interrupt_wait(mx_handle_t handle_value) {
     return interrupt->WaitForInterrupt();
 }
 
+mx_status_t sys_interrupt_set_affinity(mx_handle_t handle_value, uint32_t cpu, uint32_t options) {
+    LTRACEF("handle %d cpu %u options 0x%x\n", handle_value, cpu, options);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    mxtl::RefPtr<InterruptDispatcher> interrupt;
+    mx_status_t status = up->GetDispatcher(handle_value, &interrupt, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    return interrupt->SetAffinity(cpu, options);
+}
+
 mx_status_t sys_mmap_device_memory(mx_handle_t hrsrc, uintptr_t paddr, uint32_t len,
                                    mx_cache_policy_t cache_policy,
                                    uintptr_t* _out_vaddr) {
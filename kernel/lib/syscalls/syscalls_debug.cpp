@@ -29,6 +29,7 @@
 #include <magenta/process_dispatcher.h>
 #include <magenta/syscalls/debug.h>
 #include <magenta/thread_dispatcher.h>
+#include <magenta/vm_object_dispatcher.h>
 #include <magenta/user_copy.h>
 
 #include <mxtl/array.h>
@@ -269,14 +270,44 @@ mx_status_t sys_ktrace_write(mx_handle_t handle, uint32_t event_id, uint32_t arg
         return ERR_INVALID_ARGS;
     }
 
-    uint32_t* args = static_cast<uint32_t*>(ktrace_open(TAG_PROBE_24(event_id)));
-    if (!args) {
+    if (!ktrace_record(TAG_PROBE_24(event_id), arg0, arg1, 0, 0)) {
         //  There is not a single reason for failure. Assume it reached the end.
         return ERR_UNAVAILABLE;
     }
+    return NO_ERROR;
+}
+
+mx_status_t sys_ktrace_stream_vmo(mx_handle_t handle, uint32_t cpu, mx_handle_t* _out) {
+    // TODO: finer grained validation
+    mx_status_t status;
+    if ((status = validate_resource_handle(handle)) < 0) {
+        return status;
+    }
+
+    mxtl::RefPtr<VmObject> vmo;
+    status = ktrace_stream_vmo(cpu, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    status = VmObjectDispatcher::Create(mxtl::move(vmo), &dispatcher, &rights);
+    if (status != NO_ERROR)
+        return status;
+
+    // The kernel is the only writer of a stream, and readers can't resize it
+    // or change what is committed.
+    rights &= MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP |
+              MX_RIGHT_GET_PROPERTY;
+    HandleOwner stream_handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!stream_handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    if (make_user_ptr(_out).copy_to_user(up->MapHandleToValue(stream_handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    up->AddHandle(mxtl::move(stream_handle));
 
-    args[0] = arg0;
-    args[1] = arg1;
     return NO_ERROR;
 }
 
@@ -65,7 +65,7 @@ static mx_status_t object_unbind_exception_port(mx_handle_t obj_handle, bool deb
     return ERR_WRONG_TYPE;
 }
 
-static mx_status_t object_bind_exception_port(mx_handle_t obj_handle, mx_handle_t eport_handle, uint64_t key, bool debugger) {
+static mx_status_t object_bind_exception_port(mx_handle_t obj_handle, mx_handle_t eport_handle, uint64_t key, bool debugger, bool snapshot) {
     //TODO: check rights once appropriate right is determined
     auto up = ProcessDispatcher::GetCurrent();
 
@@ -75,7 +75,7 @@ static mx_status_t object_bind_exception_port(mx_handle_t obj_handle, mx_handle_
         return status;
 
     mxtl::RefPtr<ExceptionPort> eport;
-    status = ExceptionPort::Create(mxtl::move(ioport), key, &eport);
+    status = ExceptionPort::Create(mxtl::move(ioport), key, snapshot, &eport);
     if (status != NO_ERROR)
         return status;
 
@@ -110,14 +110,15 @@ mx_status_t sys_object_bind_exception_port(mx_handle_t obj_handle, mx_handle_t e
                                            uint64_t key, uint32_t options) {
     LTRACE_ENTRY;
 
-    if (options & ~MX_EXCEPTION_PORT_DEBUGGER)
+    if (options & ~(MX_EXCEPTION_PORT_DEBUGGER | MX_EXCEPTION_PORT_SNAPSHOT))
         return ERR_INVALID_ARGS;
     bool debugger = (options & MX_EXCEPTION_PORT_DEBUGGER) != 0;
+    bool snapshot = (options & MX_EXCEPTION_PORT_SNAPSHOT) != 0;
 
     if (eport_handle == MX_HANDLE_INVALID) {
         return object_unbind_exception_port(obj_handle, debugger);
     } else {
-        return object_bind_exception_port(obj_handle, eport_handle, key, debugger);
+        return object_bind_exception_port(obj_handle, eport_handle, key, debugger, snapshot);
     }
 }
 
@@ -34,11 +34,14 @@
 #include <magenta/process_dispatcher.h>
 #include <magenta/socket_dispatcher.h>
 #include <magenta/state_tracker.h>
+#include <magenta/thread_dispatcher.h>
 #include <magenta/syscalls/log.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
+#include <magenta/vm_object_dispatcher.h>
 #include <magenta/wait_set_dispatcher.h>
 
+#include <mxtl/inline_array.h>
 #include <mxtl/ref_ptr.h>
 
 #include "syscalls_priv.h"
@@ -49,6 +52,7 @@ constexpr size_t kMaxCPRNGDraw = MX_CPRNG_DRAW_MAX_LEN;
 constexpr size_t kMaxCPRNGSeed = MX_CPRNG_ADD_ENTROPY_MAX_LEN;
 
 constexpr uint32_t kMaxWaitSetWaitResults = 1024u;
+constexpr size_t kWaitSetWaitInlineCount = 16u;
 
 mx_status_t sys_nanosleep(mx_time_t nanoseconds) {
     LTRACEF("nseconds %" PRIu64 "\n", nanoseconds);
@@ -158,6 +162,24 @@ mx_status_t sys_futex_wait(mx_futex_t* _value_ptr, int current_value, mx_time_t
         make_user_ptr(_value_ptr), current_value, timeout);
 }
 
+mx_status_t sys_futex_wait_pi(mx_futex_t* _value_ptr, int current_value, mx_handle_t owner,
+                              mx_time_t timeout) {
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ThreadDispatcher> thread;
+    mx_status_t status = up->GetDispatcher(owner, &thread, MX_RIGHT_READ);
+    if (status != NO_ERROR)
+        return status;
+
+    // Priority is only lent within a process; the owner must share the futex.
+    if (thread->thread()->process() != up)
+        return ERR_INVALID_ARGS;
+
+    // |thread| keeps the owner alive until the wait is over.
+    return up->futex_context()->FutexWaitPI(
+        make_user_ptr(_value_ptr), current_value, thread->thread(), timeout);
+}
+
 mx_status_t sys_futex_wake(mx_futex_t* _value_ptr, uint32_t count) {
     return ProcessDispatcher::GetCurrent()->futex_context()->FutexWake(
         make_user_ptr(_value_ptr), count);
@@ -173,8 +195,8 @@ mx_status_t sys_futex_requeue(mx_futex_t* _wake_ptr, uint32_t wake_count, int cu
 mx_status_t sys_log_create(uint32_t flags, mx_handle_t* out) {
     LTRACEF("flags 0x%x\n", flags);
 
-    // kernel flag is forbidden to userspace
-    flags &= (~DLOG_FLAG_KERNEL);
+    // kernel and echoed flags are forbidden to userspace
+    flags &= ~(DLOG_FLAG_KERNEL | DLOG_FLAG_ECHOED);
 
     // create a Log dispatcher
     mxtl::RefPtr<Dispatcher> dispatcher;
@@ -207,7 +229,8 @@ mx_status_t sys_log_create(uint32_t flags, mx_handle_t* out) {
 mx_status_t sys_log_write(mx_handle_t log_handle, uint32_t len, const void* _ptr, uint32_t flags) {
     LTRACEF("log handle %d, len 0x%x, ptr 0x%p\n", log_handle, len, _ptr);
 
-    if (len > DLOG_MAX_ENTRY)
+    bool batch = (flags & MX_LOG_FLAG_BATCH) != 0;
+    if (len > (batch ? MX_LOG_WRITE_BATCH_MAX : DLOG_MAX_ENTRY))
         return ERR_OUT_OF_RANGE;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -217,6 +240,9 @@ mx_status_t sys_log_write(mx_handle_t log_handle, uint32_t len, const void* _ptr
     if (status != NO_ERROR)
         return status;
 
+    if (batch)
+        return log->WriteBatchFromUser(_ptr, len);
+
     char buf[DLOG_MAX_ENTRY];
     if (magenta_copy_from_user(_ptr, buf, len) != NO_ERROR)
         return ERR_INVALID_ARGS;
@@ -243,9 +269,8 @@ mx_status_t sys_cprng_draw(void* _buffer, size_t len, size_t* _actual) {
 
     uint8_t kernel_buf[kMaxCPRNGDraw];
 
-    auto prng = crypto::GlobalPRNG::GetInstance();
-    ASSERT(prng->is_thread_safe());
-    prng->Draw(kernel_buf, static_cast<int>(len));
+    ASSERT(crypto::GlobalPRNG::GetInstance()->is_thread_safe());
+    crypto::GlobalPRNG::Draw(kernel_buf, static_cast<int>(len));
 
     if (make_user_ptr(_buffer).copy_array_to_user(kernel_buf, len) != NO_ERROR)
         return ERR_INVALID_ARGS;
@@ -266,9 +291,8 @@ mx_status_t sys_cprng_add_entropy(const void* _buffer, size_t len) {
     if (make_user_ptr(_buffer).copy_array_from_user(kernel_buf, len) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
-    auto prng = crypto::GlobalPRNG::GetInstance();
-    ASSERT(prng->is_thread_safe());
-    prng->AddEntropy(kernel_buf, static_cast<int>(len));
+    ASSERT(crypto::GlobalPRNG::GetInstance()->is_thread_safe());
+    crypto::GlobalPRNG::AddEntropy(kernel_buf, static_cast<int>(len));
 
     // Get rid of the stack copy of the random data
     memset(kernel_buf, 0, sizeof(kernel_buf));
@@ -277,12 +301,13 @@ mx_status_t sys_cprng_add_entropy(const void* _buffer, size_t len) {
 }
 
 mx_status_t sys_waitset_create(uint32_t options, mx_handle_t* _out) {
-    if (options != 0)
+    if (options & ~MX_WAITSET_EDGE_TRIGGERED)
         return ERR_INVALID_ARGS;
 
     mxtl::RefPtr<Dispatcher> dispatcher;
     mx_rights_t rights;
-    mx_status_t result = WaitSetDispatcher::Create(&dispatcher, &rights);
+    mx_status_t result = WaitSetDispatcher::Create((options & MX_WAITSET_EDGE_TRIGGERED) != 0u,
+                                                   &dispatcher, &rights);
     if (result != NO_ERROR)
         return result;
 
@@ -358,19 +383,15 @@ mx_status_t sys_waitset_wait(mx_handle_t ws_handle,
     if (make_user_ptr(_count).copy_from_user(&count) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
-    //TODO: use inline array here
-    mxtl::unique_ptr<mx_waitset_result_t[]> results;
-    if (count > 0u) {
-        if (count > kMaxWaitSetWaitResults)
-            return ERR_OUT_OF_RANGE;
-
-        // TODO(vtl): It kind of sucks that we always have to allocate the indicated maximum size
-        // here (namely, |count|).
-        AllocChecker ac;
-        results.reset(new (&ac) mx_waitset_result_t[count]);
-        if (!ac.check())
-            return ERR_NO_MEMORY;
-    }
+    if (count > kMaxWaitSetWaitResults)
+        return ERR_OUT_OF_RANGE;
+
+    // TODO(vtl): It kind of sucks that we always have to allocate the indicated maximum size
+    // here (namely, |count|), though small waits at least stay on the stack.
+    AllocChecker ac;
+    mxtl::InlineArray<mx_waitset_result_t, kWaitSetWaitInlineCount> results(&ac, count);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
 
     auto up = ProcessDispatcher::GetCurrent();
 
@@ -397,7 +418,7 @@ mx_status_t sys_waitset_wait(mx_handle_t ws_handle,
 mx_status_t sys_socket_create(uint32_t flags, mx_handle_t* _out0, mx_handle_t* _out1) {
     LTRACEF("entry out_handles %p, %p\n", _out0, _out1);
 
-    if (flags != 0u)
+    if (flags & ~(MX_SOCKET_SHARED_RING | MX_SOCKET_SIZE_MASK))
         return ERR_INVALID_ARGS;
 
     mxtl::RefPtr<Dispatcher> socket0, socket1;
@@ -457,7 +478,11 @@ mx_status_t sys_socket_write(mx_handle_t handle, uint32_t flags,
     case MX_SOCKET_HALF_CLOSE:
         if (size == 0)
             return socket->HalfClose();
-    // fall thru if size != 0.
+        return ERR_INVALID_ARGS;
+    case MX_SOCKET_RING_SYNC:
+        if (size == 0)
+            return socket->SyncRing(true);
+        return ERR_INVALID_ARGS;
     default:
         return ERR_INVALID_ARGS;
     }
@@ -468,7 +493,7 @@ mx_status_t sys_socket_read(mx_handle_t handle, uint32_t flags,
                             size_t* _actual) {
     LTRACEF("handle %d\n", handle);
 
-    if (flags)
+    if (flags & ~MX_SOCKET_RING_SYNC)
         return ERR_INVALID_ARGS;
 
     if (!_buffer && size > 0)
@@ -481,6 +506,9 @@ mx_status_t sys_socket_read(mx_handle_t handle, uint32_t flags,
     if (status != NO_ERROR)
         return status;
 
+    if (flags == MX_SOCKET_RING_SYNC)
+        return size == 0 ? socket->SyncRing(false) : ERR_INVALID_ARGS;
+
     size_t nread;
     status = socket->Read(_buffer, size, true, &nread);
 
@@ -491,6 +519,43 @@ mx_status_t sys_socket_read(mx_handle_t handle, uint32_t flags,
     return status;
 }
 
+mx_status_t sys_socket_get_ring(mx_handle_t handle, uint32_t options, mx_handle_t* _out) {
+    LTRACEF("handle %d options %u\n", handle, options);
+
+    if (options != MX_SOCKET_RING_RX && options != MX_SOCKET_RING_TX)
+        return ERR_INVALID_ARGS;
+    bool tx = options == MX_SOCKET_RING_TX;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<SocketDispatcher> socket;
+    mx_status_t status = up->GetDispatcher(handle, &socket, tx ? MX_RIGHT_WRITE : MX_RIGHT_READ);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmObject> vmo;
+    status = socket->GetRing(tx, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    status = VmObjectDispatcher::Create(mxtl::move(vmo), &dispatcher, &rights);
+    if (status != NO_ERROR)
+        return status;
+
+    // the ring is for mapping and sharing, not for running
+    HandleOwner ring_handle(MakeHandle(mxtl::move(dispatcher), rights & ~MX_RIGHT_EXECUTE));
+    if (!ring_handle)
+        return ERR_NO_MEMORY;
+
+    if (make_user_ptr(_out).copy_to_user(up->MapHandleToValue(ring_handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    up->AddHandle(mxtl::move(ring_handle));
+
+    return NO_ERROR;
+}
+
 mx_status_t sys_fifo_create(uint64_t count, mx_handle_t* _out) {
     // Must be a power of 2
     if (!count || (count & (count - 1))) {
@@ -521,6 +586,9 @@ mx_status_t sys_fifo_op(mx_handle_t handle, uint32_t op, uint64_t val, mx_fifo_s
     case MX_FIFO_OP_READ_STATE:
         if (!_out) return ERR_INVALID_ARGS;
         break;
+    case MX_FIFO_OP_SYNC:
+        // Either side may sync; checked below.
+        break;
     case MX_FIFO_OP_ADVANCE_HEAD:
     case MX_FIFO_OP_PRODUCER_EXCEPTION:
         rights |= MX_RIGHT_FIFO_PRODUCER;
@@ -536,9 +604,15 @@ mx_status_t sys_fifo_op(mx_handle_t handle, uint32_t op, uint64_t val, mx_fifo_s
     auto up = ProcessDispatcher::GetCurrent();
 
     mxtl::RefPtr<FifoDispatcher> fifo;
-    mx_status_t status = up->GetDispatcher(handle, &fifo, rights);
+    mx_rights_t handle_rights;
+    mx_status_t status = up->GetDispatcher(handle, &fifo, &handle_rights);
     if (status != NO_ERROR)
         return status;
+    if (!magenta_rights_check(handle_rights, rights))
+        return up->BadHandle(handle, ERR_ACCESS_DENIED);
+    if (op == MX_FIFO_OP_SYNC &&
+        !(handle_rights & (MX_RIGHT_FIFO_PRODUCER | MX_RIGHT_FIFO_CONSUMER)))
+        return up->BadHandle(handle, ERR_ACCESS_DENIED);
 
     mx_fifo_state_t state;
     switch (op) {
@@ -557,6 +631,9 @@ mx_status_t sys_fifo_op(mx_handle_t handle, uint32_t op, uint64_t val, mx_fifo_s
     case MX_FIFO_OP_CONSUMER_EXCEPTION:
         status = fifo->SetException(MX_FIFO_CONSUMER_EXCEPTION, val > 0, &state);
         break;
+    case MX_FIFO_OP_SYNC:
+        status = fifo->Sync(&state);
+        break;
     }
 
     if (_out) {
@@ -567,3 +644,42 @@ mx_status_t sys_fifo_op(mx_handle_t handle, uint32_t op, uint64_t val, mx_fifo_s
 
     return status;
 }
+
+mx_status_t sys_fifo_get_state_vmo(mx_handle_t handle, mx_handle_t* _out) {
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<FifoDispatcher> fifo;
+    mx_rights_t fifo_rights;
+    mx_status_t status = up->GetDispatcher(handle, &fifo, &fifo_rights);
+    if (status != NO_ERROR)
+        return status;
+    if (!magenta_rights_check(fifo_rights, MX_RIGHT_READ))
+        return up->BadHandle(handle, ERR_ACCESS_DENIED);
+
+    mxtl::RefPtr<VmObject> vmo;
+    status = fifo->GetStateVmo(&vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    status = VmObjectDispatcher::Create(mxtl::move(vmo), &dispatcher, &rights);
+    if (status != NO_ERROR)
+        return status;
+
+    // Only a producer or consumer may move the indices in place.
+    rights &= MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP |
+              MX_RIGHT_GET_PROPERTY;
+    if (fifo_rights & (MX_RIGHT_FIFO_PRODUCER | MX_RIGHT_FIFO_CONSUMER))
+        rights |= MX_RIGHT_WRITE;
+
+    HandleOwner state_handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!state_handle)
+        return ERR_NO_MEMORY;
+
+    if (make_user_ptr(_out).copy_to_user(up->MapHandleToValue(state_handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    up->AddHandle(mxtl::move(state_handle));
+
+    return NO_ERROR;
+}
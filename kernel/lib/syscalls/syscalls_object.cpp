@@ -6,11 +6,18 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <string.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
+#include <kernel/stall_detector.h>
+#include <kernel/thread.h>
+#include <lib/counters.h>
 
+#include <kernel/vm/vm_aspace.h>
 #include <magenta/handle_owner.h>
+#include <magenta/job_dispatcher.h>
 #include <magenta/magenta.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/resource_dispatcher.h>
@@ -23,6 +30,16 @@
 
 #define LOCAL_TRACE 0
 
+static_assert(MX_SCHED_LATENCY_BUCKETS == SCHED_LATENCY_BUCKETS, "");
+
+static void copy_sched_latency_hist(mx_sched_latency_hist_t* out,
+                                    const sched_latency_hist& in) {
+    out->count = in.count;
+    out->total_ns = in.total_ns;
+    out->max_ns = in.max_ns;
+    memcpy(out->buckets, in.buckets, sizeof(out->buckets));
+}
+
 // actual is an optional return parameter for the number of records returned
 // avail is an optional return parameter for the number of records available
 
@@ -195,6 +212,186 @@ mx_status_t sys_object_get_info(mx_handle_t handle, uint32_t topic,
                 return ERR_BUFFER_TOO_SMALL;
             return NO_ERROR;
         }
+        case MX_INFO_TASK_MEMORY: {
+            size_t actual = (buffer_size < sizeof(mx_info_task_memory_t)) ? 0 : 1;
+            size_t avail = 1;
+
+            mxtl::RefPtr<Dispatcher> dispatcher;
+            mx_rights_t rights;
+            if (!up->GetDispatcher(handle, &dispatcher, &rights))
+                return up->BadHandle(handle, ERR_BAD_HANDLE);
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            // the counters are kept up to date as pages come and go, so this is O(1)
+            const VmPageCounters* counters = nullptr;
+            auto process = DownCastDispatcher<ProcessDispatcher>(&dispatcher);
+            auto job = process ? nullptr : DownCastDispatcher<JobDispatcher>(&dispatcher);
+            if (process) {
+                counters = &process->aspace()->page_counters();
+            } else if (job) {
+                counters = &job->page_counters();
+            } else {
+                return ERR_WRONG_TYPE;
+            }
+
+            if (actual > 0) {
+                mx_info_task_memory_t info = {};
+                info.private_bytes = counters->private_pages() * PAGE_SIZE;
+                info.shared_bytes = counters->shared_pages() * PAGE_SIZE;
+                info.committed_bytes = info.private_bytes + info.shared_bytes;
+
+                if (buffer.copy_array_to_user(&info, sizeof(info)) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+            }
+            if (_actual && (make_user_ptr(_actual).copy_to_user(actual) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (make_user_ptr(_avail).copy_to_user(avail) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (actual == 0)
+                return ERR_BUFFER_TOO_SMALL;
+            return NO_ERROR;
+        }
+        case MX_INFO_JOB_TASKS: {
+            mxtl::RefPtr<JobDispatcher> job;
+            mx_status_t status = up->GetDispatcher<JobDispatcher>(handle, &job, MX_RIGHT_ENUMERATE);
+            if (status < 0)
+                return status;
+
+            // One pass over the tree, copying out as it goes, rather than a
+            // get_info call per job, process and thread.
+            TaskRecordWriter writer(buffer.reinterpret<mx_info_task_record_t>(),
+                                    buffer_size / sizeof(mx_info_task_record_t));
+            status = job->GetTaskRecords(&writer);
+            if (status != NO_ERROR)
+                return status;
+
+            if (_actual && (make_user_ptr(_actual).copy_to_user(writer.actual()) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (make_user_ptr(_avail).copy_to_user(writer.avail()) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
+        case MX_INFO_CPU_SCHED_LATENCY: {
+            mx_status_t status = validate_resource_handle(handle);
+            if (status < 0)
+                return status;
+
+            auto records = buffer.reinterpret<mx_info_cpu_sched_latency_t>();
+            size_t num_cpus = arch_max_num_cpus();
+            size_t num_to_copy = MIN(num_cpus, buffer_size / sizeof(mx_info_cpu_sched_latency_t));
+
+            for (size_t i = 0; i < num_to_copy; i++) {
+                sched_latency_stats stats;
+                status = thread_get_sched_latency(static_cast<uint>(i), &stats);
+                if (status != NO_ERROR)
+                    return status;
+
+                mx_info_cpu_sched_latency_t info = {};
+                info.cpu = static_cast<uint32_t>(i);
+                copy_sched_latency_hist(&info.wakeup, stats.wakeup);
+                copy_sched_latency_hist(&info.preempt, stats.preempt);
+                if (records.element_offset(i).copy_to_user(info) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+            }
+
+            if (_actual && (make_user_ptr(_actual).copy_to_user(num_to_copy) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (make_user_ptr(_avail).copy_to_user(num_cpus) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
+        case MX_INFO_KCOUNTERS: {
+            mx_status_t status = validate_resource_handle(handle);
+            if (status < 0)
+                return status;
+
+            auto records = buffer.reinterpret<mx_info_kcounter_t>();
+            size_t count = kcounter_count();
+            size_t num_to_copy = MIN(count, buffer_size / sizeof(mx_info_kcounter_t));
+
+            for (size_t i = 0; i < num_to_copy; i++) {
+                mx_info_kcounter_t info = {};
+                strlcpy(info.name, kcounter_name(i), sizeof(info.name));
+                info.value = kcounter_sum(i);
+                if (records.element_offset(i).copy_to_user(info) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+            }
+
+            if (_actual && (make_user_ptr(_actual).copy_to_user(num_to_copy) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (make_user_ptr(_avail).copy_to_user(count) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
+#if WITH_SYSCALL_STATS
+        case MX_INFO_SYSCALL_STATS: {
+            mx_status_t status = validate_resource_handle(handle);
+            if (status < 0)
+                return status;
+
+            auto records = buffer.reinterpret<mx_info_syscall_stats_t>();
+            size_t count = syscall_stats_count();
+            size_t num_to_copy = MIN(count, buffer_size / sizeof(mx_info_syscall_stats_t));
+
+            for (size_t i = 0; i < num_to_copy; i++) {
+                mx_info_syscall_stats_t info;
+                syscall_stats_get(i, &info);
+                if (records.element_offset(i).copy_to_user(info) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+            }
+
+            if (_actual && (make_user_ptr(_actual).copy_to_user(num_to_copy) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (make_user_ptr(_avail).copy_to_user(count) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
+#endif
+#if WITH_STALL_DETECTOR
+        case MX_INFO_KERNEL_STALLS: {
+            static_assert(MX_KERNEL_STALL_BACKTRACE_DEPTH == STALL_BACKTRACE_DEPTH, "");
+
+            mx_status_t status = validate_resource_handle(handle);
+            if (status < 0)
+                return status;
+
+            auto records = buffer.reinterpret<mx_info_kernel_stall_t>();
+            size_t max = buffer_size / sizeof(mx_info_kernel_stall_t);
+            uint64_t first;
+            uint64_t next = stall_detector_get_range(&first);
+
+            // Records overwritten while we copy are skipped rather than
+            // left as holes.
+            size_t num_copied = 0;
+            for (uint64_t seq = first; seq < next && num_copied < max; seq++) {
+                stall_record r;
+                if (!stall_detector_get(seq, &r))
+                    continue;
+
+                mx_info_kernel_stall_t info = {};
+                info.seq = r.seq;
+                info.end_time = r.end_time;
+                info.duration_ns = r.duration;
+                info.cpu = r.cpu;
+                info.type = r.type;
+                info.tid = r.tid;
+                info.start_pc = r.start_pc;
+                info.backtrace_count = r.backtrace_count;
+                for (uint i = 0; i < r.backtrace_count; i++)
+                    info.backtrace[i] = r.backtrace[i];
+                if (records.element_offset(num_copied).copy_to_user(info) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+                num_copied++;
+            }
+
+            if (_actual && (make_user_ptr(_actual).copy_to_user(num_copied) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (make_user_ptr(_avail).copy_to_user(static_cast<size_t>(next - first)) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
+#endif
         default:
             return ERR_NOT_SUPPORTED;
     }
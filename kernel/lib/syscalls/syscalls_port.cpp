@@ -11,18 +11,24 @@
 #include <kernel/auto_lock.h>
 
 #include <lib/ktrace.h>
+#include <lib/user_copy.h>
 
 #include <magenta/handle_owner.h>
 #include <magenta/magenta.h>
 #include <magenta/port_dispatcher.h>
 #include <magenta/process_dispatcher.h>
+#include <magenta/user_copy.h>
 
+#include <mxtl/algorithm.h>
 #include <mxtl/ref_ptr.h>
 
 #include "syscalls_priv.h"
 
 #define LOCAL_TRACE 0
 
+// Most packets a single mx_port_wait_many() returns.
+constexpr size_t kPortWaitManyMax = 32u;
+
 mx_status_t sys_port_create(uint32_t options, mx_handle_t* _out) {
     LTRACEF("options %u\n", options);
 
@@ -66,7 +72,7 @@ mx_status_t sys_port_queue(mx_handle_t handle, const void* _packet, size_t size)
     if (status != NO_ERROR)
         return status;
 
-    auto iopk = IOP_Packet::MakeFromUser(_packet, size);
+    auto iopk = IOP_Packet::MakeFromUser(_packet, size, port->packet_cache());
     if (!iopk)
         return ERR_NO_MEMORY;
 
@@ -105,6 +111,54 @@ mx_status_t sys_port_wait(mx_handle_t handle, mx_time_t timeout,
     return NO_ERROR;
 }
 
+mx_status_t sys_port_wait_many(mx_handle_t handle, mx_time_t timeout,
+                               void* _packets, size_t size, size_t packet_size,
+                               uint32_t* _actual) {
+    LTRACEF("handle %d size %zu packet_size %zu\n", handle, size, packet_size);
+
+    if (!_packets || packet_size < sizeof(mx_packet_header_t))
+        return ERR_INVALID_ARGS;
+
+    size_t count = mxtl::min(size / packet_size, kPortWaitManyMax);
+    if (count == 0u)
+        return ERR_BUFFER_TOO_SMALL;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PortDispatcher> port;
+    mx_status_t status = up->GetDispatcher(handle, &port, MX_RIGHT_READ);
+    if (status != NO_ERROR)
+        return status;
+
+    ktrace(TAG_PORT_WAIT, (uint32_t)port->get_koid(), 0, 0, 0);
+
+    IOP_Packet* iopks[kPortWaitManyMax];
+    size_t actual = 0u;
+    status = port->WaitMany(timeout, iopks, count, packet_size, &actual);
+
+    ktrace(TAG_PORT_WAIT_DONE, (uint32_t)port->get_koid(), status, 0, 0);
+    if (status < 0)
+        return status;
+
+    // the packets are gone from the port either way, so copy them all out
+    // before reporting any fault
+    bool copied = true;
+    char* slot = static_cast<char*>(_packets);
+    for (size_t ix = 0; ix != actual; ++ix, slot += packet_size) {
+        size_t pk_size = packet_size;
+        copied = iopks[ix]->CopyToUser(slot, &pk_size) && copied;
+        IOP_Packet::Delete(iopks[ix]);
+    }
+    if (!copied)
+        return ERR_INVALID_ARGS;
+
+    if (_actual) {
+        if (make_user_ptr(_actual).copy_to_user(static_cast<uint32_t>(actual)) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
 mx_status_t sys_port_bind(mx_handle_t handle, uint64_t key,
                           mx_handle_t source, mx_signals_t signals) {
     LTRACEF("handle %d source %d\n", handle, source);
@@ -11,3 +11,17 @@
 #include <lib/user_copy/user_ptr.h>
 
 #include <magenta/gen-sysdefs.h>
+
+#if WITH_SYSCALL_STATS
+#include <magenta/syscalls/object.h>
+
+// Used by the generated wrappers in gen-stats.inc. syscall_stats_end() records
+// a call to syscall |num| that started at |start|.
+uint64_t syscall_stats_begin();
+void syscall_stats_end(uint32_t num, uint64_t start);
+
+// The number of syscalls with stats, and the stats of the one at |index|
+// summed over every cpu.
+size_t syscall_stats_count();
+void syscall_stats_get(size_t index, mx_info_syscall_stats_t* info);
+#endif
@@ -0,0 +1,96 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/ops.h>
+#include <kernel/spinlock.h>
+#include <mxtl/algorithm.h>
+#include <platform.h>
+#include <string.h>
+
+#include "syscalls_priv.h"
+
+// Per-syscall call counts and latency histograms, for kernels built with
+// WITH_SYSCALL_STATS=true. The syscall switch then calls the wrappers in
+// gen-stats.inc, which time each call into syscall_stats_end().
+
+namespace {
+
+struct SyscallInfo {
+    uint32_t id;
+    uint32_t nargs;
+    const char* name;
+};
+
+constexpr SyscallInfo kSyscalls[] = {
+#include <magenta/gen-trace.inc>
+};
+
+// the numbers are handed out in order, so the last one is the largest
+constexpr size_t kNumSyscalls = kSyscalls[countof(kSyscalls) - 1].id + 1;
+
+struct SyscallHist {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[MX_SCHED_LATENCY_BUCKETS];
+};
+
+// each cpu only ever updates its own histograms, but holds the lock while it
+// does so that readers see each call fully counted or not at all
+struct CpuSyscallStats {
+    spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+    SyscallHist hists[kNumSyscalls];
+};
+
+CpuSyscallStats syscall_stats[SMP_MAX_CPUS];
+
+} // namespace
+
+uint64_t syscall_stats_begin() {
+    return current_time_hires();
+}
+
+void syscall_stats_end(uint32_t num, uint64_t start) {
+    uint64_t latency = current_time_hires() - start;
+    uint bucket = (latency == 0) ? 0 : 64 - __builtin_clzll(latency);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    CpuSyscallStats* stats = &syscall_stats[arch_curr_cpu_num()];
+    spin_lock(&stats->lock);
+    SyscallHist* hist = &stats->hists[num];
+    hist->count++;
+    hist->total_ns += latency;
+    hist->max_ns = mxtl::max(hist->max_ns, latency);
+    hist->buckets[mxtl::min<uint>(bucket, MX_SCHED_LATENCY_BUCKETS - 1)]++;
+    spin_unlock(&stats->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+size_t syscall_stats_count() {
+    return countof(kSyscalls);
+}
+
+void syscall_stats_get(size_t index, mx_info_syscall_stats_t* info) {
+    const SyscallInfo& call = kSyscalls[index];
+    memset(info, 0, sizeof(*info));
+    info->syscall = call.id;
+    strlcpy(info->name, call.name, sizeof(info->name));
+
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        CpuSyscallStats* stats = &syscall_stats[cpu];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&stats->lock, state);
+        SyscallHist hist = stats->hists[call.id];
+        spin_unlock_irqrestore(&stats->lock, state);
+
+        info->latency.count += hist.count;
+        info->latency.total_ns += hist.total_ns;
+        info->latency.max_ns = mxtl::max(info->latency.max_ns, hist.max_ns);
+        for (int b = 0; b < MX_SCHED_LATENCY_BUCKETS; b++)
+            info->latency.buckets[b] += hist.buckets[b];
+    }
+}
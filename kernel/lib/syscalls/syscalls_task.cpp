@@ -114,6 +114,27 @@ mx_status_t sys_thread_start(mx_handle_t thread_handle, uintptr_t entry,
     return thread->Start(entry, stack, arg1, arg2, /* initial_thread= */ false);
 }
 
+mx_status_t sys_thread_set_deadline(mx_handle_t rsrc_handle, mx_handle_t thread_handle,
+                                    mx_time_t runtime, mx_time_t period) {
+    LTRACEF("handle %d runtime %" PRIu64 " period %" PRIu64 "\n", thread_handle, runtime, period);
+
+    // reservations run ahead of every priority scheduled thread, so they take
+    // a resource rather than just a thread handle
+    // TODO: finer grained validation
+    mx_status_t status;
+    if ((status = validate_resource_handle(rsrc_handle)) < 0)
+        return status;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ThreadDispatcher> thread;
+    status = up->GetDispatcher(thread_handle, &thread, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    return thread->thread()->SetDeadline(runtime, period);
+}
+
 void sys_thread_exit() {
     LTRACE_ENTRY;
     UserThread::GetCurrent()->Exit();
@@ -309,3 +330,40 @@ mx_status_t sys_job_create(mx_handle_t parent_job, uint32_t flags, mx_handle_t*
     up->AddHandle(mxtl::move(job_handle));
     return NO_ERROR;
 }
+
+mx_status_t sys_job_set_cpu_limits(mx_handle_t job_handle, uint32_t weight,
+                                   mx_time_t period, mx_time_t quota) {
+    LTRACEF("job %d weight %u period %" PRIu64 " quota %" PRIu64 "\n",
+            job_handle, weight, period, quota);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<JobDispatcher> job;
+    mx_status_t status = up->GetDispatcher(job_handle, &job, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    // As with the memory limits, only a process outside the job may loosen
+    // them.
+    auto own_job = up->job();
+    bool within = own_job && own_job->IsWithin(job.get());
+    return job->SetCpuLimits(weight, period, quota, within);
+}
+
+mx_status_t sys_job_set_memory_limits(mx_handle_t job_handle, uint64_t soft_limit,
+                                      uint64_t hard_limit) {
+    LTRACEF("job %d soft %#" PRIx64 " hard %#" PRIx64 "\n", job_handle, soft_limit, hard_limit);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<JobDispatcher> job;
+    mx_status_t status = up->GetDispatcher(job_handle, &job, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    // A process may tighten the limits it is held to, but only a process
+    // outside the job, holding a handle from above, may loosen them.
+    auto own_job = up->job();
+    bool within = own_job && own_job->IsWithin(job.get());
+    return job->SetMemoryLimits(soft_limit, hard_limit, within);
+}
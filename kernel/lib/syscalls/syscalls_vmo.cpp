@@ -15,6 +15,7 @@
 #include <lib/user_copy/user_ptr.h>
 
 #include <magenta/handle_owner.h>
+#include <magenta/job_dispatcher.h>
 #include <magenta/magenta.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
@@ -29,14 +30,44 @@
 mx_status_t sys_vmo_create(uint64_t size, uint32_t options, mx_handle_t* _out) {
     LTRACEF("size %#" PRIx64 "\n", size);
 
-    if (options)
+    if (options & ~(MX_VMO_CREATE_LARGE_PAGES | MX_VMO_CREATE_DISCARDABLE |
+                    MX_VMO_CREATE_NUMA_INTERLEAVE | MX_VMO_CREATE_NUMA_BIND |
+                    MX_VMO_CREATE_NUMA_NODE_MASK))
         return ERR_INVALID_ARGS;
 
+    uint32_t create_options = 0;
+    if (options & MX_VMO_CREATE_LARGE_PAGES)
+        create_options |= VmObjectPaged::CREATE_OPT_LARGE_PAGES;
+    // anonymous memory is compressed when memory runs low, unless it can be dropped
+    // instead, or is backed by large pages that compression would break up
+    if (options & MX_VMO_CREATE_DISCARDABLE)
+        create_options |= VmObjectPaged::CREATE_OPT_DISCARDABLE;
+    else if (!(options & MX_VMO_CREATE_LARGE_PAGES))
+        create_options |= VmObjectPaged::CREATE_OPT_COMPRESSIBLE;
+    if (options & MX_VMO_CREATE_NUMA_INTERLEAVE)
+        create_options |= VmObjectPaged::CREATE_OPT_NUMA_INTERLEAVE;
+
+    // a node is only meaningful to bind to, and only one policy applies at a time
+    uint32_t pmm_alloc_flags = PMM_ALLOC_FLAG_ANY;
+    uint32_t node = (options & MX_VMO_CREATE_NUMA_NODE_MASK) >> 24;
+    if (options & MX_VMO_CREATE_NUMA_BIND) {
+        if ((options & MX_VMO_CREATE_NUMA_INTERLEAVE) || node >= pmm_numa_node_count())
+            return ERR_INVALID_ARGS;
+        pmm_alloc_flags = PMM_ALLOC_FLAG_NODE(node) | PMM_ALLOC_FLAG_BIND;
+    } else if (node != 0) {
+        return ERR_INVALID_ARGS;
+    }
+
     // create a vm object
-    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::Create(0, size);
+    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::Create(pmm_alloc_flags, size, create_options);
     if (!vmo)
         return ERR_NO_MEMORY;
 
+    // the pages it commits count against the limits of the creator's job
+    auto up = ProcessDispatcher::GetCurrent();
+    if (auto job = up->job())
+        vmo->SetCommitCharge(job->commit_charge());
+
     // create a Vm Object dispatcher
     mxtl::RefPtr<Dispatcher> dispatcher;
     mx_rights_t rights;
@@ -49,8 +80,6 @@ mx_status_t sys_vmo_create(uint64_t size, uint32_t options, mx_handle_t* _out) {
     if (!handle)
         return ERR_NO_MEMORY;
 
-    auto up = ProcessDispatcher::GetCurrent();
-
     if (make_user_ptr(_out).copy_to_user(up->MapHandleToValue(handle)) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
@@ -159,3 +188,72 @@ mx_status_t sys_vmo_op_range(mx_handle_t handle, uint32_t op, uint64_t offset, u
 
     return vmo->RangeOp(op, offset, size, make_user_ptr(_buffer), buffer_size, vmo_rights);
 }
+
+mx_status_t sys_vmo_clone(mx_handle_t handle, uint32_t options, uint64_t offset, uint64_t size,
+                          mx_handle_t* _out) {
+    LTRACEF("handle %d options %#x offset %#" PRIx64 " size %#" PRIx64 "\n",
+            handle, options, offset, size);
+
+    // copy-on-write is the only kind of clone there is
+    if (options != MX_VMO_CLONE_COPY_ON_WRITE)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // lookup the dispatcher from handle
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    mx_status_t status = up->GetDispatcher(handle, &vmo, MX_RIGHT_READ);
+    if (status != NO_ERROR)
+        return status;
+
+    // clone the vm object
+    mxtl::RefPtr<VmObject> clone_vmo;
+    status = vmo->vmo()->CloneCOW(offset, size, &clone_vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    // pages copied on write count against the limits of the cloner's job
+    if (auto job = up->job())
+        clone_vmo->SetCommitCharge(job->commit_charge());
+
+    // create a Vm Object dispatcher
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    status = VmObjectDispatcher::Create(mxtl::move(clone_vmo), &dispatcher, &rights);
+    if (status != NO_ERROR)
+        return status;
+
+    // create a handle and attach the dispatcher to it
+    HandleOwner clone_handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!clone_handle)
+        return ERR_NO_MEMORY;
+
+    if (make_user_ptr(_out).copy_to_user(up->MapHandleToValue(clone_handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(clone_handle));
+
+    return NO_ERROR;
+}
+
+mx_status_t sys_vmo_move_pages(mx_handle_t handle, uint64_t offset, mx_handle_t src_handle,
+                               uint64_t src_offset, uint64_t len) {
+    LTRACEF("handle %d offset %#" PRIx64 " src %d offset %#" PRIx64 " len %#" PRIx64 "\n",
+            handle, offset, src_handle, src_offset, len);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // lookup the dispatchers from the handles
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    mx_status_t status = up->GetDispatcher(handle, &vmo, MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    // the source loses its contents, so it has to be writable too
+    mxtl::RefPtr<VmObjectDispatcher> src_vmo;
+    status = up->GetDispatcher(src_handle, &src_vmo, MX_RIGHT_READ | MX_RIGHT_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    return vmo->vmo()->MovePagesFrom(offset, src_vmo->vmo().get(), src_offset, len);
+}
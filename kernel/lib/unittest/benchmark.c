@@ -0,0 +1,221 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/*
+ * The harness for benchmarks.  See lib/unittest/include/unittest.h for usage.
+ */
+#include <debug.h>
+#include <err.h>
+#include <inttypes.h>
+#include <platform.h>
+#include <stdio.h>
+#include <string.h>
+#include <unittest.h>
+#include <kernel/mp.h>
+
+#if ARCH_X86_64
+#include <arch/x86.h>
+#define HAVE_CYCLES 1
+static inline uint64_t read_cycles(void) { return rdtsc(); }
+#else
+#define HAVE_CYCLES 0
+static inline uint64_t read_cycles(void) { return 0; }
+#endif
+
+// each timed run is made to take about this long
+#define TARGET_NS   (10 * 1000 * 1000ull)
+// of which there are this many, after the one that finds the iterations
+#define NUM_RUNS    5
+#define MAX_ITERATIONS (1ull << 32)
+
+void unittest_bench_start(unittest_bench_state_t* state)
+{
+    state->start_ns = current_time_hires();
+    state->start_cycles = read_cycles();
+}
+
+void unittest_bench_stop(unittest_bench_state_t* state)
+{
+    uint64_t cycles = read_cycles();
+    uint64_t ns = current_time_hires();
+    state->cycles += cycles - state->start_cycles;
+    state->ns += ns - state->start_ns;
+}
+
+static status_t run_once(const unittest_benchmark_t* bench, uint64_t iterations,
+                         unittest_bench_state_t* state)
+{
+    memset(state, 0, sizeof(*state));
+    state->iterations = iterations;
+    return bench->fn(state);
+}
+
+static void sort(uint64_t* v, size_t n)
+{
+    for (size_t i = 1; i < n; i++) {
+        for (size_t j = i; j > 0 && v[j - 1] > v[j]; j--) {
+            uint64_t t = v[j];
+            v[j] = v[j - 1];
+            v[j - 1] = t;
+        }
+    }
+}
+
+// prints |total| / |iterations| to a tenth
+static void print_per_op(uint64_t total, uint64_t iterations)
+{
+    uint64_t tenths = (total * 10 + iterations / 2) / iterations;
+    printf("%" PRIu64 ".%" PRIu64, tenths / 10, tenths % 10);
+}
+
+static bool run_benchmark(const unittest_benchmark_t* bench, const char* fmt_string)
+{
+    unittest_bench_state_t state;
+    status_t status;
+
+    printf(fmt_string, bench->name);
+
+    // Grow the iterations until a run takes the target time.
+    uint64_t iterations = 1;
+    for (;;) {
+        status = run_once(bench, iterations, &state);
+        if (status == ERR_NOT_SUPPORTED) {
+            // e.g. one that needs more cpus than there are
+            printf("skipped\n");
+            return true;
+        }
+        if (status != NO_ERROR) {
+            printf("FAILED (status %d)\n", status);
+            return false;
+        }
+        if (state.ns >= TARGET_NS || iterations >= MAX_ITERATIONS)
+            break;
+        uint64_t scale = state.ns ? TARGET_NS * 12 / 10 / state.ns + 1 : 100;
+        if (scale > 100)
+            scale = 100;
+        if (scale < 2)
+            scale = 2;
+        iterations *= scale;
+    }
+
+    uint64_t ns[NUM_RUNS];
+    uint64_t cycles[NUM_RUNS];
+    for (int i = 0; i < NUM_RUNS; i++) {
+        status = run_once(bench, iterations, &state);
+        if (status != NO_ERROR) {
+            printf("FAILED (status %d)\n", status);
+            return false;
+        }
+        ns[i] = state.ns;
+        cycles[i] = state.cycles;
+    }
+    sort(ns, NUM_RUNS);
+    sort(cycles, NUM_RUNS);
+
+    // The least of the runs is the one the least disturbed, and the median
+    // shows how much the rest were.
+    print_per_op(ns[0], iterations);
+    printf(" ns (median ");
+    print_per_op(ns[NUM_RUNS / 2], iterations);
+    printf(")");
+    if (HAVE_CYCLES) {
+        printf(", ");
+        print_per_op(cycles[0], iterations);
+        printf(" cycles (median ");
+        print_per_op(cycles[NUM_RUNS / 2], iterations);
+        printf(")");
+    }
+    printf(", %" PRIu64 " iterations\n", iterations);
+    return true;
+}
+
+static bool run_suite(const unittest_bench_suite_t* suite)
+{
+    char fmt_string[32];
+    size_t max_namelen = 0;
+    size_t passed = 0;
+
+    for (size_t i = 0; i < suite->count; i++) {
+        size_t namelen = strlen(suite->benchmarks[i].name);
+        if (max_namelen < namelen)
+            max_namelen = namelen;
+    }
+    snprintf(fmt_string, sizeof(fmt_string), "  %%-%zus : ", max_namelen);
+
+    int cpus = __builtin_popcount(mp_get_online_mask());
+    printf("%s : Running %zu benchmark%s on %d cpu%s...\n",
+           suite->name, suite->count, suite->count == 1 ? "" : "s",
+           cpus, cpus == 1 ? "" : "s");
+    for (size_t i = 0; i < suite->count; i++)
+        passed += run_benchmark(&suite->benchmarks[i], fmt_string) ? 1 : 0;
+    return passed == suite->count;
+}
+
+#if defined(WITH_LIB_CONSOLE)
+#include <lib/console.h>
+
+// External references to the benchmark registration tables.
+extern unittest_bench_suite_t __start_unittest_benchmarks[] __WEAK;
+extern unittest_bench_suite_t __stop_unittest_benchmarks[] __WEAK;
+
+static void usage(const char* progname)
+{
+    printf("Usage:\n"
+           "%s <suite>\n"
+           "  where suite is a specific benchmark suite name, or...\n"
+           "  all : run all benchmarks\n"
+           "  ?   : list benchmarks\n",
+           progname);
+}
+
+static void list_suites(void)
+{
+    for (const unittest_bench_suite_t* suite = __start_unittest_benchmarks;
+         suite != __stop_unittest_benchmarks; ++suite) {
+        printf("  %-12s : %s\n", suite->name, suite->desc);
+        for (size_t i = 0; i < suite->count; i++)
+            printf("    %s\n", suite->benchmarks[i].name);
+    }
+}
+
+static int run_benchmarks(int argc, const cmd_args* argv)
+{
+    if (argc != 2) {
+        usage(argv[0].str);
+        return 0;
+    }
+
+    const char* name = argv[1].str;
+    if (!strcmp(name, "?")) {
+        list_suites();
+        return 0;
+    }
+
+    bool run_all = !strcmp(name, "all");
+    size_t chosen = 0;
+    size_t passed = 0;
+    for (const unittest_bench_suite_t* suite = __start_unittest_benchmarks;
+         suite != __stop_unittest_benchmarks; ++suite) {
+        if (run_all || !strcmp(name, suite->name)) {
+            chosen++;
+            passed += run_suite(suite) ? 1 : 0;
+            printf("\n");
+        }
+    }
+
+    if (!chosen) {
+        printf("Benchmark suite \"%s\" not found!\n", name);
+        list_suites();
+        return ERR_NOT_FOUND;
+    }
+    return passed == chosen ? NO_ERROR : ERR_INTERNAL;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("kb", "Run kernel benchmarks", run_benchmarks)
+STATIC_COMMAND_END(benchmarks);
+
+#endif
@@ -231,7 +231,7 @@ int unittest_printf(const char* format, ...);
 #define UTCHECK_BYTES_EQ(expected, actual, length, msg, term)                  \
     if (!unittest_expect_bytes((expected), #expected,                          \
                                (actual), #actual,                              \
-                               (len), msg, __PRETTY_FUNCTION__, __LINE__,      \
+                               (length), msg, __PRETTY_FUNCTION__, __LINE__,   \
                                true)) {                                        \
         if (term) return false; else all_ok = false;                           \
     }
@@ -239,7 +239,7 @@ int unittest_printf(const char* format, ...);
 #define UTCHECK_BYTES_NE(expected, actual, length, msg, term)                  \
     if (!unittest_expect_bytes((expected), #expected,                          \
                                (actual), #actual,                              \
-                               (len), msg, __PRETTY_FUNCTION__, __LINE__,      \
+                               (length), msg, __PRETTY_FUNCTION__, __LINE__,   \
                                false)) {                                       \
         if (term) return false; else all_ok = false;                           \
     }
@@ -359,6 +359,81 @@ typedef struct unitest_testcase_registration {
 #define UNITTEST_END_TESTCASE(_global_id, _name, _desc, _init, _cleanup)
 #endif  // WITH_LIB_UNITTEST
 
+/*
+ * Benchmarks, run with the "kb" console command.
+ *
+ * A benchmark does what it measures state->iterations times, timing it with
+ * unittest_bench_start() and unittest_bench_stop(), which may be called
+ * around each part of it to leave any setup out. The harness picks the
+ * number of iterations so that a run takes a while, and reports the time and
+ * cycles (the TSC, on x86) per iteration over several runs.
+ *
+ * Example:
+ *
+ * static status_t bench_thing(unittest_bench_state_t* state) {
+ *     set_up_thing();
+ *     unittest_bench_start(state);
+ *     for (uint64_t i = 0; i < state->iterations; i++)
+ *         do_thing();
+ *     unittest_bench_stop(state);
+ *     tear_down_thing();
+ *     return NO_ERROR;
+ * }
+ *
+ * BENCHMARK_START_SUITE(thing_benchmarks)
+ * BENCHMARK("thing", bench_thing)
+ * BENCHMARK_END_SUITE(thing_benchmarks, "thing", "Thing benchmarks");
+ */
+typedef struct unittest_bench_state {
+    uint64_t iterations;
+    // what has been timed so far
+    uint64_t cycles;
+    uint64_t ns;
+    uint64_t start_cycles;
+    uint64_t start_ns;
+} unittest_bench_state_t;
+
+void unittest_bench_start(unittest_bench_state_t* state);
+void unittest_bench_stop(unittest_bench_state_t* state);
+
+typedef status_t (*unittest_bench_fn_t)(unittest_bench_state_t* state);
+
+typedef struct unittest_benchmark {
+    const char*         name;
+    unittest_bench_fn_t fn;
+} unittest_benchmark_t;
+
+typedef struct unittest_bench_suite {
+    const char*                 name;
+    const char*                 desc;
+    const unittest_benchmark_t* benchmarks;
+    size_t                      count;
+} unittest_bench_suite_t;
+
+#ifdef WITH_LIB_UNITTEST
+#define BENCHMARK_START_SUITE(_global_id)  \
+    static const unittest_benchmark_t __unittest_bench_table_##_global_id[] = {
+
+#define BENCHMARK(_name, _fn) \
+    { .name = _name, .fn = _fn },
+
+#define BENCHMARK_END_SUITE(_global_id, _name, _desc)                              \
+    };  /* __unittest_bench_table_##_global_id */                                  \
+    extern const unittest_bench_suite_t __unittest_bench_##_global_id;             \
+    const unittest_bench_suite_t __unittest_bench_##_global_id                     \
+    __ALIGNED(sizeof(void *)) __SECTION("unittest_benchmarks") =                   \
+    {                                                                              \
+        .name = _name,                                                             \
+        .desc = _desc,                                                             \
+        .benchmarks = __unittest_bench_table_##_global_id,                         \
+        .count = countof(__unittest_bench_table_##_global_id),                     \
+    }
+#else   // WITH_LIB_UNITTEST
+#define BENCHMARK_START_SUITE(_global_id)
+#define BENCHMARK(_name, _fn)
+#define BENCHMARK_END_SUITE(_global_id, _name, _desc)
+#endif  // WITH_LIB_UNITTEST
+
 __END_CDECLS
 
 #endif /* _LIB_UNITTEST_INCLUDE_UNITTEST_H_ */
@@ -10,6 +10,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS := \
+	$(LOCAL_DIR)/benchmark.c \
 	$(LOCAL_DIR)/unittest.c
 
 MODULE_COMPILEFLAGS := -Wno-format-nonliteral
@@ -29,4 +29,13 @@ struct vdso_constants {
 
     // Conversion factor for mx_ticks_get return values to seconds.
     uint64_t ticks_per_second;
+
+    // Nonzero if MX_CLOCK_MONOTONIC is mx_ticks_get return values times
+    // ns_per_tick, in which case the vDSO reads that clock without a syscall.
+    uint32_t monotonic_from_ticks;
+
+    // Nanoseconds per tick in 32.64 fixed point: ns_per_tick_int whole
+    // nanoseconds plus ns_per_tick_frac / 2^64.
+    uint32_t ns_per_tick_int;
+    uint64_t ns_per_tick_frac;
 };
@@ -9,6 +9,7 @@
 
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <lib/fixed_point.h>
 #include <platform.h>
 
 #include "vdso-code.h"
@@ -61,6 +62,9 @@ VDso::VDso() : RoDso("vdso", vdso_image, VDSO_CODE_END, VDSO_CODE_START) {
     KernelVmoWindow<vdso_constants> constants_window(
         "vDSO constants", vmo()->vmo(), VDSO_DATA_CONSTANTS);
 
+    struct fp_32_64 ns_per_tick = {};
+    bool monotonic_from_ticks = platform_hires_per_tick(&ns_per_tick);
+
     // Initialize the constants that should be visible to the vDSO.
     // Rather than assigning each member individually, do this with
     // struct assignment and a compound literal so that the compiler
@@ -69,5 +73,8 @@ VDso::VDso() : RoDso("vdso", vdso_image, VDSO_CODE_END, VDSO_CODE_START) {
         arch_max_num_cpus(),
         arch_dcache_line_size(),
         ticks_per_second(),
+        monotonic_from_ticks,
+        ns_per_tick.l0,
+        (static_cast<uint64_t>(ns_per_tick.l32) << 32) | ns_per_tick.l64,
     };
 }
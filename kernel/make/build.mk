@@ -118,7 +118,7 @@ $(info MKBOOTFS $(MKBOOTFS))
 $(USER_BOOTFS): $(MKBOOTFS) $(USER_MANIFEST) $(USER_MANIFEST_DEPS)
 	@echo generating $@
 	@$(MKDIR)
-	$(NOECHO)$(MKBOOTFS) -c -o $(USER_BOOTFS) $(USER_MANIFEST)
+	$(NOECHO)$(MKBOOTFS) -f -o $(USER_BOOTFS) $(USER_MANIFEST)
 
 GENERATED += $(USER_BOOTFS)
 
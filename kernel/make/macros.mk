@@ -20,7 +20,7 @@ TOBOOL = $(if $(filter-out 0 false,$1),true,false)
 
 COMMA := ,
 SPACE :=
-SPACE +=
+SPACE := $(SPACE) $(SPACE)
 
 # lower case and upper case translation
 LC = $(subst A,a,$(subst B,b,$(subst C,c,$(subst D,d,$(subst E,e,$(subst F,f,$(subst G,g,$(subst H,h,$(subst I,i,$(subst J,j,$(subst K,k,$(subst L,l,$(subst M,m,$(subst N,n,$(subst O,o,$(subst P,p,$(subst Q,q,$(subst R,r,$(subst S,s,$(subst T,t,$(subst U,u,$(subst V,v,$(subst W,w,$(subst X,x,$(subst Y,y,$(subst Z,z,$1))))))))))))))))))))))))))
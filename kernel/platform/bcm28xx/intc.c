@@ -135,6 +135,14 @@ status_t get_interrupt_config(unsigned int vector,
     return NO_ERROR;
 }
 
+/*
+ *  The local interrupt controller routes all GPU interrupts to one core.
+ */
+status_t set_interrupt_affinity(unsigned int vector, uint cpu)
+{
+    return ERR_NOT_SUPPORTED;
+}
+
 void register_int_handler(unsigned int vector, int_handler handler, void* arg) {
     if (vector >= MAX_INT)
         panic("register_int_handler: vector out of range %u\n", vector);
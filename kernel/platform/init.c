@@ -34,6 +34,11 @@ __WEAK void platform_panic_start(void)
 {
 }
 
+__WEAK bool platform_hires_per_tick(struct fp_32_64 *ns_per_tick)
+{
+    return false;
+}
+
 __WEAK void *platform_get_ramdisk(size_t *size)
 {
     *size = 0;
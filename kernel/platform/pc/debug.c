@@ -31,6 +31,44 @@ static const int uart_io_port = 0x3f8;
 cbuf_t console_input_buf;
 static bool output_enabled = false;
 
+/* Once interrupts are up, output is queued here and fed to the uart from its
+ * transmit interrupt, so that printing doesn't wait on the serial line.  When
+ * the queue is full output is dropped, and counted, rather than waited for. */
+#define UART_TX_BUF_SIZE (16 * 1024)
+#define UART_FIFO_DEPTH 16
+static cbuf_t uart_tx_buf;
+static bool uart_tx_async = false;
+static spin_lock_t uart_tx_lock = SPIN_LOCK_INITIAL_VALUE;
+static bool uart_tx_irq_enabled = false;    /* guarded by uart_tx_lock */
+static size_t uart_tx_dropped = 0;          /* guarded by uart_tx_lock */
+
+static void uart_tx_fill_locked(void)
+{
+    /* only refill once the transmit fifo has emptied, then it takes a full load */
+    if ((inp(uart_io_port + 5) & (1<<5)) == 0)
+        return;
+
+    char buf[UART_FIFO_DEPTH];
+    size_t len = cbuf_read(&uart_tx_buf, buf, sizeof(buf), false);
+    for (size_t i = 0; i < len; i++)
+        outp(uart_io_port + 0, buf[i]);
+
+    if (len == 0 && uart_tx_irq_enabled) {
+        outp(uart_io_port + 1, 0x1); // receive data available interrupt only
+        uart_tx_irq_enabled = false;
+    }
+}
+
+static void uart_tx_drain(void)
+{
+    if (!uart_tx_async)
+        return;
+
+    spin_lock(&uart_tx_lock);
+    uart_tx_fill_locked();
+    spin_unlock(&uart_tx_lock);
+}
+
 static enum handler_return platform_drain_debug_uart_rx(void)
 {
     unsigned char c;
@@ -47,12 +85,14 @@ static enum handler_return platform_drain_debug_uart_rx(void)
 
 static enum handler_return uart_irq_handler(void *arg)
 {
+    uart_tx_drain();
     return platform_drain_debug_uart_rx();
 }
 
 // for devices where the uart rx interrupt doesn't seem to work
 static enum handler_return uart_rx_poll(struct timer *t, lk_time_t now, void *arg)
 {
+    uart_tx_drain();
     return platform_drain_debug_uart_rx();
 }
 
@@ -102,6 +142,29 @@ void platform_init_debug(void)
     if (cmdline_get_bool("kernel.debug_uart_poll", false)) {
         platform_debug_start_uart_timer();
     }
+
+    if (!cmdline_get_bool("kernel.debug_uart_sync", false)) {
+        cbuf_initialize(&uart_tx_buf, UART_TX_BUF_SIZE);
+        uart_tx_async = true;
+    }
+}
+
+void platform_debug_output_sync(void)
+{
+    if (!uart_tx_async)
+        return;
+
+    /* Another cpu may have been stopped holding uart_tx_lock, so don't take
+     * it; we're the only one left running anyway. */
+    uart_tx_async = false;
+    outp(uart_io_port + 1, 0x1);
+
+    char c;
+    while (cbuf_read_char(&uart_tx_buf, &c, false) == 1) {
+        while ((inp(uart_io_port + 5) & (1<<6)) == 0)
+            ;
+        outp(uart_io_port + 0, c);
+    }
 }
 
 static void debug_uart_putc(char c)
@@ -117,8 +180,65 @@ static void debug_uart_putc(char c)
     outp(uart_io_port + 0, c);
 }
 
+static void uart_tx_queue(const char* str, size_t len)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&uart_tx_lock, state);
+
+    if (unlikely(uart_tx_dropped > 0)) {
+        char note[64];
+        int n = snprintf(note, sizeof(note), "\r\n[%zu bytes of output dropped]\r\n",
+                         uart_tx_dropped);
+        if (n > 0 && (size_t)n < sizeof(note) && cbuf_space_avail(&uart_tx_buf) > (size_t)n) {
+            cbuf_write(&uart_tx_buf, note, n, false);
+            uart_tx_dropped = 0;
+        }
+    }
+
+    /* translate newlines a chunk at a time */
+    char buf[64];
+    while (len > 0) {
+        size_t pos = 0;
+        while (len > 0 && pos < sizeof(buf) - 1) {
+            char c = *str++;
+            len--;
+            if (c == '\n')
+                buf[pos++] = '\r';
+            buf[pos++] = c;
+        }
+        if (uart_tx_dropped == 0)
+            uart_tx_dropped += pos - cbuf_write(&uart_tx_buf, buf, pos, false);
+        else
+            uart_tx_dropped += pos; /* keep the note ahead of later output */
+    }
+
+    /* the transmit interrupt fires as soon as it is enabled if the uart is
+     * idle, and keeps firing until the queue is empty */
+    if (!uart_tx_irq_enabled) {
+        uart_tx_irq_enabled = true;
+        outp(uart_io_port + 1, 0x3); // receive data available and transmit empty
+    }
+
+    spin_unlock_irqrestore(&uart_tx_lock, state);
+}
+
 void platform_dputs(const char* str, size_t len)
 {
+#if WITH_LEGACY_PC_CONSOLE
+    /* the legacy console is only memory writes, no need to queue it */
+    if (uart_tx_async) {
+        for (size_t i = 0; i < len; i++) {
+            if (str[i] == '\n')
+                cputc('\r');
+            cputc(str[i]);
+        }
+    }
+#endif
+    if (uart_tx_async && output_enabled) {
+        uart_tx_queue(str, len);
+        return;
+    }
+
     while (len-- > 0) {
         char c = *str++;
         if (c == '\n') {
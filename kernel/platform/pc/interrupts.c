@@ -16,6 +16,8 @@
 #include <arch/x86.h>
 #include <arch/x86/interrupts.h>
 #include <arch/x86/apic.h>
+#include <arch/x86/mp.h>
+#include <kernel/mp.h>
 #include <lk/init.h>
 #include <kernel/spinlock.h>
 #include "platform_p.h"
@@ -188,6 +190,30 @@ status_t get_interrupt_config(unsigned int vector,
     return ret;
 }
 
+status_t set_interrupt_affinity(unsigned int vector, uint cpu)
+{
+    if (!is_valid_interrupt(vector, 0))
+        return ERR_INVALID_ARGS;
+
+    if (cpu >= SMP_MAX_CPUS || !mp_is_cpu_online(cpu))
+        return ERR_INVALID_ARGS;
+
+    // Redirection entries in physical destination mode only hold an 8 bit
+    // APIC ID.
+    uint32_t apic_id = x86_cpu_num_to_apic_id(cpu);
+    if (apic_id > 0xff)
+        return ERR_NOT_SUPPORTED;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&lock, state);
+
+    apic_io_configure_irq_dst(vector, (uint8_t)apic_id);
+
+    spin_unlock_irqrestore(&lock, state);
+
+    return NO_ERROR;
+}
+
 enum handler_return platform_irq(x86_iframe_t *frame)
 {
     // get the current vector
@@ -334,6 +360,28 @@ status_t x86_alloc_msi_block(uint requested_irqs,
     return res;
 }
 
+status_t x86_get_msi_target_for_cpu(const pcie_msi_block_t* block,
+                                    uint cpu,
+                                    uint64_t* out_tgt_addr) {
+    DEBUG_ASSERT(block && block->allocated);
+    DEBUG_ASSERT(out_tgt_addr);
+
+    if (cpu >= SMP_MAX_CPUS || !mp_is_cpu_online(cpu))
+        return ERR_INVALID_ARGS;
+
+    uint32_t apic_id = x86_cpu_num_to_apic_id(cpu);
+    if (apic_id > 0xff)
+        return ERR_NOT_SUPPORTED;
+
+    // Swap the Dest ID field (bits 19:12) of the block's physical mode target
+    // address for the APIC ID of the requested CPU.
+    uint64_t tgt_addr = block->tgt_addr & ~((uint64_t)0xFF << 12);
+    tgt_addr |= ((uint64_t)apic_id) << 12;
+
+    *out_tgt_addr = tgt_addr;
+    return NO_ERROR;
+}
+
 void x86_free_msi_block(pcie_msi_block_t* block) {
     DEBUG_ASSERT(block);
     DEBUG_ASSERT(block->allocated);
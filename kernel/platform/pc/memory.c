@@ -120,24 +120,29 @@ static int mem_arena_init(boot_addr_range_t *range)
         while (size && used < PMM_ARENAS) {
             pmm_arena_info_t *arena = &mem_arenas[used];
 
+            /* split the range where it crosses from one numa node to another */
+            uint64_t node_size = size;
+            arena->node = platform_numa_mem_node(base, &node_size);
+            node_size = MIN(ROUNDUP(node_size, PAGE_SIZE), size);
+
             arena->base = base;
-            arena->size = size;
+            arena->size = node_size;
 
             if ((uint64_t)arena->base != base) {
                 LTRACEF("Range base %#" PRIx64 " is too high.\n", base);
                 break;
             }
-            if ((uint64_t)arena->size != size) {
+            if ((uint64_t)arena->size != node_size) {
                 LTRACEF("Range size %#" PRIx64 " is too large, splitting it.\n",
-                        size);
+                        node_size);
                 arena->size = -PAGE_SIZE;
             }
 
             size -= arena->size;
             base += arena->size;
 
-            LTRACEF("Adding pmm range at %#" PRIxPTR " of %#zx bytes.\n",
-                    arena->base, arena->size);
+            LTRACEF("Adding pmm range at %#" PRIxPTR " of %#zx bytes on node %u.\n",
+                    arena->base, arena->size, arena->node);
 
             arena->name = "memory";
             arena->priority = 1;
@@ -372,6 +377,8 @@ status_t enumerate_e820(enumerate_e820_callback callback, void* ctx) {
 /* Discover the basic memory map */
 void platform_mem_init(void)
 {
+    platform_numa_init();
+
     int arena_count = platform_mem_range_init();
     for (int i = 0; i < arena_count; i++)
         pmm_add_arena(&mem_arenas[i]);
@@ -0,0 +1,232 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <acpica/acpi.h>
+
+#include <arch/x86/mmu.h>
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/vm.h>
+#include <string.h>
+#include <trace.h>
+
+#include "platform_p.h"
+
+#define LOCAL_TRACE 0
+
+/* The NUMA topology comes from the ACPI SRAT, which has to be read before the
+ * pmm arenas are added and so long before the ACPICA table manager is up. The
+ * tables are found by hand here through the boot time physical map instead.
+ */
+
+extern uint32_t bootloader_acpi_rsdp;
+
+#define NUMA_MAX_MEM_RANGES 32
+#define NUMA_MAX_CPUS 256
+
+struct numa_mem_range {
+    uint64_t base;
+    uint64_t size;
+    uint node;
+};
+
+struct numa_cpu {
+    uint32_t apic_id;
+    uint node;
+};
+
+static struct numa_mem_range numa_mem_ranges[NUMA_MAX_MEM_RANGES];
+static uint numa_mem_range_count;
+static struct numa_cpu numa_cpus[NUMA_MAX_CPUS];
+static uint numa_cpu_count;
+
+/* proximity domain of each node, nodes being numbered in order of discovery */
+static uint32_t numa_domains[PMM_MAX_NUMA_NODES];
+static uint numa_node_count;
+
+static bool acpi_checksum_ok(const void *table, size_t len)
+{
+    const uint8_t *p = table;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++)
+        sum += p[i];
+    return sum == 0;
+}
+
+static const ACPI_TABLE_RSDP *find_rsdp_in(paddr_t base, size_t len)
+{
+    for (paddr_t pa = base; pa < base + len; pa += ACPI_RSDP_SCAN_STEP) {
+        const ACPI_TABLE_RSDP *rsdp = (const ACPI_TABLE_RSDP *)X86_PHYS_TO_VIRT(pa);
+        if (!memcmp(rsdp->Signature, ACPI_SIG_RSDP, 8) &&
+                acpi_checksum_ok(rsdp, ACPI_RSDP_CHECKSUM_LENGTH))
+            return rsdp;
+    }
+    return NULL;
+}
+
+static const ACPI_TABLE_RSDP *find_rsdp(void)
+{
+    if (bootloader_acpi_rsdp)
+        return (const ACPI_TABLE_RSDP *)X86_PHYS_TO_VIRT(bootloader_acpi_rsdp);
+
+    /* the first 1KB of the EBDA, then the BIOS read only area */
+    paddr_t ebda = (paddr_t)*(const uint16_t *)X86_PHYS_TO_VIRT(ACPI_EBDA_PTR_LOCATION) << 4;
+    const ACPI_TABLE_RSDP *rsdp = NULL;
+    if (ebda > 0x400)
+        rsdp = find_rsdp_in(ebda, ACPI_EBDA_WINDOW_SIZE);
+    if (!rsdp)
+        rsdp = find_rsdp_in(ACPI_HI_RSDP_WINDOW_BASE, ACPI_HI_RSDP_WINDOW_SIZE);
+    return rsdp;
+}
+
+static const ACPI_TABLE_HEADER *find_table(const char *sig)
+{
+    const ACPI_TABLE_RSDP *rsdp = find_rsdp();
+    if (!rsdp)
+        return NULL;
+
+    /* prefer the XSDT with its 64 bit entries when there is one */
+    paddr_t root_pa;
+    size_t entry_size;
+    if (rsdp->Revision >= 2 && rsdp->XsdtPhysicalAddress) {
+        root_pa = rsdp->XsdtPhysicalAddress;
+        entry_size = ACPI_XSDT_ENTRY_SIZE;
+    } else {
+        root_pa = rsdp->RsdtPhysicalAddress;
+        entry_size = ACPI_RSDT_ENTRY_SIZE;
+    }
+
+    const ACPI_TABLE_HEADER *root = (const ACPI_TABLE_HEADER *)X86_PHYS_TO_VIRT(root_pa);
+    if (root->Length < sizeof(*root))
+        return NULL;
+
+    const uint8_t *entries = (const uint8_t *)(root + 1);
+    size_t count = (root->Length - sizeof(*root)) / entry_size;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t table_pa;
+        if (entry_size == ACPI_XSDT_ENTRY_SIZE) {
+            memcpy(&table_pa, entries + i * entry_size, sizeof(uint64_t));
+        } else {
+            uint32_t pa32;
+            memcpy(&pa32, entries + i * entry_size, sizeof(uint32_t));
+            table_pa = pa32;
+        }
+
+        const ACPI_TABLE_HEADER *table = (const ACPI_TABLE_HEADER *)X86_PHYS_TO_VIRT(table_pa);
+        if (!memcmp(table->Signature, sig, ACPI_NAME_SIZE) &&
+                acpi_checksum_ok(table, table->Length))
+            return table;
+    }
+    return NULL;
+}
+
+static uint domain_to_node(uint32_t domain)
+{
+    for (uint i = 0; i < numa_node_count; i++) {
+        if (numa_domains[i] == domain)
+            return i;
+    }
+    if (numa_node_count == PMM_MAX_NUMA_NODES) {
+        TRACEF("too many proximity domains, folding domain %u into node 0\n", domain);
+        return 0;
+    }
+    numa_domains[numa_node_count] = domain;
+    return numa_node_count++;
+}
+
+void platform_numa_init(void)
+{
+    const ACPI_TABLE_SRAT *srat = (const ACPI_TABLE_SRAT *)find_table(ACPI_SIG_SRAT);
+    if (!srat) {
+        LTRACEF("no SRAT, treating memory as a single node\n");
+        return;
+    }
+
+    uintptr_t addr = (uintptr_t)(srat + 1);
+    uintptr_t end = (uintptr_t)srat + srat->Header.Length;
+    const ACPI_SUBTABLE_HEADER *hdr;
+    for (; addr + sizeof(*hdr) <= end; addr += hdr->Length) {
+        hdr = (const ACPI_SUBTABLE_HEADER *)addr;
+        if (hdr->Length == 0 || addr + hdr->Length > end) {
+            TRACEF("malformed SRAT\n");
+            break;
+        }
+
+        switch (hdr->Type) {
+            case ACPI_SRAT_TYPE_CPU_AFFINITY: {
+                const ACPI_SRAT_CPU_AFFINITY *cpu = (const ACPI_SRAT_CPU_AFFINITY *)hdr;
+                if (!(cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY) || numa_cpu_count == NUMA_MAX_CPUS)
+                    break;
+                uint32_t domain = cpu->ProximityDomainLo |
+                        ((uint32_t)cpu->ProximityDomainHi[0] << 8) |
+                        ((uint32_t)cpu->ProximityDomainHi[1] << 16) |
+                        ((uint32_t)cpu->ProximityDomainHi[2] << 24);
+                numa_cpus[numa_cpu_count].apic_id = cpu->ApicId;
+                numa_cpus[numa_cpu_count].node = domain_to_node(domain);
+                numa_cpu_count++;
+                break;
+            }
+            case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY: {
+                const ACPI_SRAT_X2APIC_CPU_AFFINITY *cpu =
+                        (const ACPI_SRAT_X2APIC_CPU_AFFINITY *)hdr;
+                if (!(cpu->Flags & ACPI_SRAT_CPU_ENABLED) || numa_cpu_count == NUMA_MAX_CPUS)
+                    break;
+                numa_cpus[numa_cpu_count].apic_id = cpu->ApicId;
+                numa_cpus[numa_cpu_count].node = domain_to_node(cpu->ProximityDomain);
+                numa_cpu_count++;
+                break;
+            }
+            case ACPI_SRAT_TYPE_MEMORY_AFFINITY: {
+                const ACPI_SRAT_MEM_AFFINITY *mem = (const ACPI_SRAT_MEM_AFFINITY *)hdr;
+                if (!(mem->Flags & ACPI_SRAT_MEM_ENABLED) || mem->Length == 0)
+                    break;
+                if (numa_mem_range_count == NUMA_MAX_MEM_RANGES) {
+                    TRACEF("too many SRAT memory ranges, ignoring %#" PRIx64 "\n",
+                           mem->BaseAddress);
+                    break;
+                }
+                struct numa_mem_range *range = &numa_mem_ranges[numa_mem_range_count++];
+                range->base = mem->BaseAddress;
+                range->size = mem->Length;
+                range->node = domain_to_node(mem->ProximityDomain);
+                LTRACEF("memory %#" PRIx64 " size %#" PRIx64 " node %u\n",
+                        range->base, range->size, range->node);
+                break;
+            }
+        }
+    }
+
+    dprintf(INFO, "numa: %u node(s), %u memory range(s), %u cpu(s)\n",
+            numa_node_count, numa_mem_range_count, numa_cpu_count);
+}
+
+uint platform_numa_mem_node(uint64_t base, uint64_t *size)
+{
+    uint node = 0;
+    uint64_t end = base + *size;
+    for (uint i = 0; i < numa_mem_range_count; i++) {
+        const struct numa_mem_range *range = &numa_mem_ranges[i];
+        if (base >= range->base && base - range->base < range->size) {
+            node = range->node;
+            end = MIN(end, range->base + range->size);
+        } else if (range->base > base && range->base < end) {
+            /* another node's memory starts part way through, stop short of it */
+            end = range->base;
+        }
+    }
+    *size = end - base;
+    return node;
+}
+
+uint platform_numa_apic_node(uint32_t apic_id)
+{
+    for (uint i = 0; i < numa_cpu_count; i++) {
+        if (numa_cpus[i].apic_id == apic_id)
+            return numa_cpus[i].node;
+    }
+    return 0;
+}
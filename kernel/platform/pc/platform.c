@@ -333,6 +333,13 @@ static void platform_init_smp(void)
 
     x86_init_smp(apic_ids, num_cpus);
 
+    // let the pmm know which numa node each cpu is on
+    for (uint i = 0; i < num_cpus; ++i) {
+        int cpu = x86_apic_id_to_cpu_num(apic_ids[i]);
+        if (cpu >= 0)
+            pmm_set_cpu_numa_node(cpu, platform_numa_apic_node(apic_ids[i]));
+    }
+
     for (uint i = 0; i < num_cpus - 1; ++i) {
         if (apic_ids[i] == bsp_apic_id) {
             apic_ids[i] = apic_ids[num_cpus - 1];
@@ -340,7 +347,11 @@ static void platform_init_smp(void)
             break;
         }
     }
-    x86_bringup_aps(apic_ids, num_cpus - 1);
+    // If every cpu the platform knows of is being started, they can all be
+    // sent one broadcast INIT/STARTUP; otherwise the ones being left down
+    // would wake too and contend for the bootstrap resources.
+    bool broadcast = (num_cpus == real_num_cpus);
+    x86_bringup_aps(apic_ids, num_cpus - 1, broadcast);
 
     free(apic_ids);
 }
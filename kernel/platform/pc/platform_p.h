@@ -28,9 +28,19 @@ extern uint16_t pcie_pio_size;
 
 void platform_init_debug_early(void);
 void platform_init_debug(void);
+/* stop queueing debug uart output, and write out what is queued; for when
+ * interrupts are off for good */
+void platform_debug_output_sync(void);
 void platform_init_timer_percpu(void);
 void platform_mem_init(void);
 
+/* read the NUMA topology out of the ACPI SRAT, before the pmm arenas are added */
+void platform_numa_init(void);
+/* the node of the memory at base, trimming size to where the node's memory ends */
+uint platform_numa_mem_node(uint64_t base, uint64_t* size);
+/* the node of the cpu with the given local apic id */
+uint platform_numa_apic_node(uint32_t apic_id);
+
 status_t x86_alloc_msi_block(uint requested_irqs, bool can_target_64bit,
                              bool is_msix, pcie_msi_block_t* out_block);
 void x86_free_msi_block(pcie_msi_block_t* block);
@@ -38,6 +48,9 @@ void x86_register_msi_handler(const pcie_msi_block_t* block,
                               uint msi_id,
                               int_handler handler,
                               void* ctx);
+status_t x86_get_msi_target_for_cpu(const pcie_msi_block_t* block,
+                                    uint cpu,
+                                    uint64_t* out_tgt_addr);
 
 status_t platform_configure_watchdog(uint32_t frequency);
 
@@ -40,6 +40,13 @@ public:
                             void*                   ctx) override {
         x86_register_msi_handler(block, msi_id, handler, ctx);
     }
+
+    status_t SetMsiAffinity(const pcie_msi_block_t* block,
+                            uint                    msi_id,
+                            uint                    cpu,
+                            uint64_t*               out_tgt_addr) override {
+        return x86_get_msi_target_for_cpu(block, cpu, out_tgt_addr);
+    }
 };
 
 X86PciePlatformSupport platform_pcie_support;
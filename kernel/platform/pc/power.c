@@ -13,6 +13,8 @@
 #include <platform/keyboard.h>
 #include <lib/console.h>
 
+#include "platform_p.h"
+
 #if WITH_LIB_DEBUGLOG
 #include <lib/debuglog.h>
 #endif
@@ -42,6 +44,8 @@ void platform_panic_start(void) {
 
     halt_other_cpus();
 
+    platform_debug_output_sync();
+
     if (atomic_swap(&panic_started, 1) == 0) {
 #if WITH_LIB_DEBUGLOG
         dlog_bluescreen_init();
@@ -56,6 +60,7 @@ void platform_halt(
     printf("platform_halt suggested_action %u reason %u\n", suggested_action, reason);
 
     arch_disable_ints();
+    platform_debug_output_sync();
 
     switch (suggested_action) {
         case HALT_ACTION_SHUTDOWN:
@@ -22,6 +22,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/interrupts.c \
     $(LOCAL_DIR)/keyboard.c \
     $(LOCAL_DIR)/memory.c \
+    $(LOCAL_DIR)/numa.c \
     $(LOCAL_DIR)/pcie_quirks.cpp \
     $(LOCAL_DIR)/pic.c \
     $(LOCAL_DIR)/platform.c \
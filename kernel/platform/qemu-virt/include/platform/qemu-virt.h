@@ -74,6 +74,7 @@ static const int a15irqmap[] = {
 /* interrupts */
 #define ARM_GENERIC_TIMER_VIRTUAL_INT 27
 #define ARM_GENERIC_TIMER_PHYSICAL_INT 30
+#define ARM_PMU_INT     23
 #define UART0_INT       (32 + 1)
 #define PCIE_INT_BASE   (32 + 3)
 #define PCIE_INT_COUNT  (4)
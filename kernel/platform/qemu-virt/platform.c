@@ -6,6 +6,7 @@
 // https://opensource.org/licenses/MIT
 
 #include <arch.h>
+#include <arch/arm64.h>
 #include <err.h>
 #include <debug.h>
 #include <trace.h>
@@ -110,6 +111,8 @@ void platform_early_init(void)
 
     arm_generic_timer_init(ARM_GENERIC_TIMER_PHYSICAL_INT, 0);
 
+    arm64_pmu_init(ARM_PMU_INT);
+
     uart_init_early();
 
     /* look for a flattened device tree just before the kernel */
@@ -46,6 +46,13 @@ public:
                        bool                    mask) override {
         arm_gicv2m_mask_unmask_msi(block, msi_id, mask);
     }
+
+    status_t SetMsiAffinity(const pcie_msi_block_t* block,
+                            uint                    msi_id,
+                            uint                    cpu,
+                            uint64_t*               out_tgt_addr) override {
+        return arm_gicv2m_set_msi_affinity(block, msi_id, cpu, out_tgt_addr);
+    }
 };
 
 class QemuPcieRoot : public PcieRoot {
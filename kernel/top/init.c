@@ -13,6 +13,7 @@
  */
 #include <arch/ops.h>
 #include <lk/init.h>
+#include <lk/timeline.h>
 
 #include <assert.h>
 #include <magenta/compiler.h>
@@ -83,7 +84,11 @@ void lk_init_level(enum lk_init_flags required_flag, uint start_level, uint stop
                    arch_curr_cpu_num(), found->hook, found->name, found->level, found->flags);
         }
 #endif
+        uint64_t start = lk_timeline_now();
         found->hook(found->level);
+        /* the secondaries run the same hooks alongside, only time the first */
+        if (required_flag & LK_INIT_FLAG_PRIMARY_CPU)
+            lk_timeline_mark(found->name, start, lk_timeline_now());
         last_called_level = found->level;
         last = found;
     }
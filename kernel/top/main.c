@@ -22,6 +22,7 @@
 #include <kernel/thread.h>
 #include <lk/init.h>
 #include <lk/main.h>
+#include <lk/timeline.h>
 
 #include "git-version.h"
 
@@ -39,6 +40,14 @@ static uint secondary_idle_thread_count;
 
 static int bootstrap2(void *arg);
 
+/* run one of the boot phases, putting it on the boot timeline */
+static void timeline_call(const char *name, void (*phase)(void))
+{
+    uint64_t start = lk_timeline_now();
+    phase();
+    lk_timeline_mark(name, start, lk_timeline_now());
+}
+
 extern void kernel_init(void);
 
 static void call_constructors(void)
@@ -73,15 +82,15 @@ void lk_main(ulong arg0, ulong arg1, ulong arg2, ulong arg3)
 
     // early arch stuff
     lk_primary_cpu_init_level(LK_INIT_LEVEL_EARLIEST, LK_INIT_LEVEL_ARCH_EARLY - 1);
-    arch_early_init();
+    timeline_call("arch_early_init", arch_early_init);
 
     // do any super early platform initialization
     lk_primary_cpu_init_level(LK_INIT_LEVEL_ARCH_EARLY, LK_INIT_LEVEL_PLATFORM_EARLY - 1);
-    platform_early_init();
+    timeline_call("platform_early_init", platform_early_init);
 
     // do any super early target initialization
     lk_primary_cpu_init_level(LK_INIT_LEVEL_PLATFORM_EARLY, LK_INIT_LEVEL_TARGET_EARLY - 1);
-    target_early_init();
+    timeline_call("target_early_init", target_early_init);
 
 #if WITH_SMP
     dprintf(INFO, "\nwelcome to lk/MP\n\n");
@@ -96,11 +105,11 @@ void lk_main(ulong arg0, ulong arg1, ulong arg2, ulong arg3)
     // bring up the kernel heap
     lk_primary_cpu_init_level(LK_INIT_LEVEL_TARGET_EARLY, LK_INIT_LEVEL_HEAP - 1);
     dprintf(SPEW, "initializing heap\n");
-    heap_init();
+    timeline_call("heap_init", heap_init);
 
     // initialize the kernel
     lk_primary_cpu_init_level(LK_INIT_LEVEL_HEAP, LK_INIT_LEVEL_KERNEL - 1);
-    kernel_init();
+    timeline_call("kernel_init", kernel_init);
 
     lk_primary_cpu_init_level(LK_INIT_LEVEL_KERNEL, LK_INIT_LEVEL_THREADING - 1);
 
@@ -120,21 +129,21 @@ static int bootstrap2(void *arg)
     dprintf(SPEW, "top of bootstrap2()\n");
 
     lk_primary_cpu_init_level(LK_INIT_LEVEL_THREADING, LK_INIT_LEVEL_ARCH - 1);
-    arch_init();
+    timeline_call("arch_init", arch_init);
 
     // initialize the rest of the platform
     dprintf(SPEW, "initializing platform\n");
     lk_primary_cpu_init_level(LK_INIT_LEVEL_ARCH, LK_INIT_LEVEL_PLATFORM - 1);
-    platform_init();
+    timeline_call("platform_init", platform_init);
 
     // initialize the target
     dprintf(SPEW, "initializing target\n");
     lk_primary_cpu_init_level(LK_INIT_LEVEL_PLATFORM, LK_INIT_LEVEL_TARGET - 1);
-    target_init();
+    timeline_call("target_init", target_init);
 
     dprintf(SPEW, "calling apps_init()\n");
     lk_primary_cpu_init_level(LK_INIT_LEVEL_TARGET, LK_INIT_LEVEL_APPS - 1);
-    apps_init();
+    timeline_call("apps_init", apps_init);
 
     lk_primary_cpu_init_level(LK_INIT_LEVEL_APPS, LK_INIT_LEVEL_LAST);
 
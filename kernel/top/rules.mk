@@ -19,6 +19,7 @@ MODULE_DEPS := \
 MODULE_SRCS := \
 	$(LOCAL_DIR)/init.c \
 	$(LOCAL_DIR)/main.c \
+	$(LOCAL_DIR)/timeline.c \
 
 MODULE_SRCDEPS := $(GIT_VERSION_HEADER)
 
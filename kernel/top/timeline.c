@@ -0,0 +1,176 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lk/timeline.h>
+
+#include <debug.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/spinlock.h>
+#include <lib/ktrace.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __x86_64__
+#include <arch/x86.h>
+extern uint64_t get_tsc_ticks_per_ms(void);
+#else
+#include <platform.h>
+#endif
+
+/* stages kept for replay; past this they only reach a running trace */
+#define TIMELINE_MAX_ENTRIES 256
+/* room for the names of the bootloader's stages */
+#define TIMELINE_LOADER_NAMES 256
+
+struct timeline_entry {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+static struct timeline_entry timeline[TIMELINE_MAX_ENTRIES];
+static uint timeline_count;
+/* ids given out, which keep counting once the table is full */
+static uint timeline_ids;
+/* set once the table has been replayed into the trace */
+static bool timeline_live;
+static spin_lock_t timeline_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static char loader_names[TIMELINE_LOADER_NAMES];
+
+uint64_t lk_timeline_now(void)
+{
+#if __x86_64__
+    return rdtsc();
+#else
+    return current_time_hires();
+#endif
+}
+
+static uint64_t timeline_ticks_per_ms(void)
+{
+#if __x86_64__
+    return get_tsc_ticks_per_ms();
+#else
+    return 1000000;
+#endif
+}
+
+static void timeline_emit(uint id, const struct timeline_entry *e)
+{
+    ktrace_name(TAG_BOOT_NAME, id, 0, e->name);
+    ktrace(TAG_BOOT_BEGIN, id, 0, (uint32_t)e->start, (uint32_t)(e->start >> 32));
+    ktrace(TAG_BOOT_END, id, 0, (uint32_t)e->end, (uint32_t)(e->end >> 32));
+}
+
+void lk_timeline_mark(const char *name, uint64_t start, uint64_t end)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&timeline_lock, state);
+
+    uint id = ++timeline_ids;
+    struct timeline_entry e = { name, start, end };
+    if (timeline_count < TIMELINE_MAX_ENTRIES) {
+        timeline[timeline_count++] = e;
+    }
+    bool live = timeline_live;
+
+    spin_unlock_irqrestore(&timeline_lock, state);
+
+    if (live)
+        timeline_emit(id, &e);
+}
+
+/* turn bootloader.timestamps into stages, each lasting until the next mark */
+static void timeline_parse_loader(void)
+{
+    const char *str = cmdline_get("bootloader.timestamps");
+    if (str == NULL)
+        return;
+
+    char *names = loader_names;
+    char *names_end = loader_names + sizeof(loader_names);
+    const char *prev_name = NULL;
+    uint64_t prev_ts = 0;
+    for (;;) {
+        const char *colon = strchr(str, ':');
+        if (colon == NULL)
+            break;
+        size_t len = colon - str;
+        char *end;
+        uint64_t ts = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1)
+            break;
+
+        if (prev_name)
+            lk_timeline_mark(prev_name, prev_ts, ts);
+
+        if (names + len + 1 > names_end)
+            break;
+        memcpy(names, str, len);
+        names[len] = 0;
+        prev_name = names;
+        prev_ts = ts;
+        names += len + 1;
+
+        if (*end != ',')
+            break;
+        str = end + 1;
+    }
+
+    /* the last one runs until the kernel took over */
+    if (prev_name)
+        lk_timeline_mark(prev_name, prev_ts, prev_ts);
+}
+
+void lk_timeline_report(void)
+{
+    if (!__atomic_load_n(&timeline_live, __ATOMIC_ACQUIRE))
+        timeline_parse_loader();
+
+    /* stages marked from here on are written as they end */
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&timeline_lock, state);
+    timeline_live = true;
+    uint count = timeline_count;
+    spin_unlock_irqrestore(&timeline_lock, state);
+
+    /* entries are only ever appended, so those counted are stable */
+    for (uint i = 0; i < count; i++)
+        timeline_emit(i + 1, &timeline[i]);
+}
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+
+static int cmd_timeline(int argc, const cmd_args *argv)
+{
+    uint64_t per_us = timeline_ticks_per_ms() / 1000;
+    if (per_us == 0)
+        per_us = 1;
+
+    uint count = __atomic_load_n(&timeline_count, __ATOMIC_ACQUIRE);
+    uint64_t base = count ? timeline[0].start : 0;
+    for (uint i = 0; i < count; i++) {
+        if (timeline[i].start < base)
+            base = timeline[i].start;
+    }
+
+    printf("%12s %10s  stage\n", "start us", "us");
+    for (uint i = 0; i < count; i++) {
+        const struct timeline_entry *e = &timeline[i];
+        printf("%12" PRIu64 " %10" PRIu64 "  %s\n",
+               (e->start - base) / per_us, (e->end - e->start) / per_us, e->name);
+    }
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("timeline", "boot stages and how long they took", &cmd_timeline)
+STATIC_COMMAND_END(timeline);
+
+#endif // WITH_LIB_CONSOLE
@@ -0,0 +1,143 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cache.h"
+
+#include <acpisvc/protocol.h>
+#include <magenta/syscalls.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+typedef struct cache_entry {
+    struct cache_entry* next;
+    ACPI_HANDLE node;
+    uint16_t cmd;
+    mx_time_t stored;
+    uint32_t len;
+    uint8_t rsp[];
+} cache_entry_t;
+
+// Notify values (ACPI 6.1, 5.6.6) after which anything in the namespace
+// may be different: bus check, device check, device wake and eject request.
+#define NOTIFY_NAMESPACE_MAX 0x03
+
+// Notify handlers run on a thread of ACPICA's, so the list is locked.
+static mtx_t cache_lock = MTX_INIT;
+static cache_entry_t* cache;
+static uint32_t cache_generation;
+// nothing is cached unless the Notifys that invalidate it can be heard
+static bool cache_enabled;
+
+// Called with cache_lock held.  Drops the entries for node, or for every
+// node if node is NULL.
+static void cache_drop_locked(ACPI_HANDLE node) {
+    cache_entry_t** link = &cache;
+    while (*link != NULL) {
+        cache_entry_t* e = *link;
+        if (node == NULL || e->node == node) {
+            *link = e->next;
+            free(e);
+        } else {
+            link = &e->next;
+        }
+    }
+}
+
+static void cache_notify(ACPI_HANDLE node, uint32_t value, void* ctx) {
+    mtx_lock(&cache_lock);
+    cache_drop_locked(value <= NOTIFY_NAMESPACE_MAX ? NULL : node);
+    cache_generation++;
+    mtx_unlock(&cache_lock);
+}
+
+mx_status_t acpi_cache_init(void) {
+    // A handler on the root object hears every Notify, whichever node it is
+    // for, alongside the handlers of the node itself.
+    ACPI_STATUS status = AcpiInstallNotifyHandler(ACPI_ROOT_OBJECT, ACPI_ALL_NOTIFY,
+                                                  cache_notify, NULL);
+    if (status != AE_OK) {
+        return ERR_INTERNAL;
+    }
+    cache_enabled = true;
+    return NO_ERROR;
+}
+
+mx_status_t acpi_cache_reply(mx_handle_t h, ACPI_HANDLE node, uint16_t cmd,
+                             uint32_t request_id, mx_time_t max_age) {
+    if (!cache_enabled) {
+        return ERR_NOT_FOUND;
+    }
+    mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+    acpi_rsp_hdr_t* rsp = NULL;
+    uint32_t len = 0;
+
+    mtx_lock(&cache_lock);
+    for (cache_entry_t* e = cache; e != NULL; e = e->next) {
+        if (e->node != node || e->cmd != cmd) {
+            continue;
+        }
+        if (max_age == 0 || now - e->stored <= max_age) {
+            if ((rsp = malloc(e->len)) != NULL) {
+                memcpy(rsp, e->rsp, e->len);
+                len = e->len;
+            }
+        }
+        break;
+    }
+    mtx_unlock(&cache_lock);
+
+    if (rsp == NULL) {
+        return ERR_NOT_FOUND;
+    }
+    rsp->request_id = request_id;
+    mx_status_t status = mx_channel_write(h, 0, rsp, len, NULL, 0);
+    free(rsp);
+    return status;
+}
+
+uint32_t acpi_cache_generation(void) {
+    mtx_lock(&cache_lock);
+    uint32_t generation = cache_generation;
+    mtx_unlock(&cache_lock);
+    return generation;
+}
+
+void acpi_cache_store(ACPI_HANDLE node, uint16_t cmd, uint32_t generation,
+                      const void* rsp, uint32_t len) {
+    if (!cache_enabled) {
+        return;
+    }
+    cache_entry_t* entry = malloc(sizeof(*entry) + len);
+    if (entry == NULL) {
+        return;
+    }
+    entry->node = node;
+    entry->cmd = cmd;
+    entry->stored = mx_time_get(MX_CLOCK_MONOTONIC);
+    entry->len = len;
+    memcpy(entry->rsp, rsp, len);
+
+    mtx_lock(&cache_lock);
+    if (generation != cache_generation) {
+        // what was evaluated may already be out of date
+        mtx_unlock(&cache_lock);
+        free(entry);
+        return;
+    }
+    cache_entry_t** link = &cache;
+    while (*link != NULL) {
+        cache_entry_t* e = *link;
+        if (e->node == node && e->cmd == cmd) {
+            *link = e->next;
+            free(e);
+            break;
+        }
+        link = &e->next;
+    }
+    entry->next = cache;
+    cache = entry;
+    mtx_unlock(&cache_lock);
+}
@@ -0,0 +1,30 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <acpica/acpi.h>
+#include <magenta/types.h>
+
+// Responses to commands that evaluate AML, kept so that clients polling for
+// the same thing don't run the interpreter each time.  Entries are keyed by
+// namespace node and command, and are dropped when the node is sent a
+// Notify, or every entry is when the namespace may have changed.
+
+mx_status_t acpi_cache_init(void);
+
+// Replies to request_id on h with the cached response to cmd on node, if
+// there is one no older than max_age (0 for any age).  Returns
+// ERR_NOT_FOUND, having sent nothing, if there is none.
+mx_status_t acpi_cache_reply(mx_handle_t h, ACPI_HANDLE node, uint16_t cmd,
+                             uint32_t request_id, mx_time_t max_age);
+
+// Returns a count of the Notifys seen so far, to be read before evaluating
+// the AML behind a response and passed to acpi_cache_store().
+uint32_t acpi_cache_generation(void);
+
+// Keeps a copy of the response rsp, which is len bytes, to cmd on node,
+// unless a Notify has come in since generation was read.
+void acpi_cache_store(ACPI_HANDLE node, uint16_t cmd, uint32_t generation,
+                      const void* rsp, uint32_t len);
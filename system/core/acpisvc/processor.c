@@ -14,9 +14,14 @@
 #include <magenta/syscalls.h>
 #include <mxio/dispatcher.h>
 
+#include "cache.h"
 #include "pci.h"
 #include "power.h"
 
+// Battery status changes continuously, but firmware only sends a Notify
+// when it changes state, so cached status is refreshed at least this often.
+#define BST_MAX_AGE MX_SEC(5)
+
 // Data associated with each message pipe handle
 typedef struct {
     // The namespace node associated with this handle.  The
@@ -209,6 +214,11 @@ mx_status_t begin_processing(mx_handle_t acpi_root) {
     }
     root_context->root_node = true;
 
+    // without it, everything is evaluated afresh
+    if (acpi_cache_init() != NO_ERROR) {
+        printf("acpisvc: cannot hear Notifys, results will not be cached\n");
+    }
+
     status = mxio_dispatcher_create(&dispatcher, dispatch);
     if (status != NO_ERROR) {
         goto fail;
@@ -450,6 +460,12 @@ static mx_status_t cmd_get_pci_init_arg(mx_handle_t h, acpi_handle_ctx_t* ctx, v
         return send_error(h, cmd->hdr.request_id, ERR_INVALID_ARGS);
     }
 
+    // only root bridges have an entry, so the checks below have been passed
+    if (acpi_cache_reply(h, ctx->ns_node, cmd->hdr.cmd, cmd->hdr.request_id, 0) == NO_ERROR) {
+        return NO_ERROR;
+    }
+    uint32_t generation = acpi_cache_generation();
+
     ACPI_DEVICE_INFO* info = NULL;
     ACPI_STATUS acpi_status = AcpiGetObjectInfo(ctx->ns_node, &info);
     if (acpi_status == AE_NO_MEMORY) {
@@ -486,6 +502,7 @@ static mx_status_t cmd_get_pci_init_arg(mx_handle_t h, acpi_handle_ctx_t* ctx, v
     rsp->hdr.request_id = cmd->hdr.request_id,
     memcpy(&rsp->arg, arg, arg_size);
 
+    acpi_cache_store(ctx->ns_node, cmd->hdr.cmd, generation, rsp, len);
     status = mx_channel_write(h, 0, rsp, len, NULL, 0);
 
 cleanup:
@@ -563,6 +580,12 @@ static mx_status_t cmd_bst(mx_handle_t h, acpi_handle_ctx_t* ctx, void* _cmd) {
         .Length = ACPI_ALLOCATE_BUFFER,
         .Pointer = NULL,
     };
+    if (acpi_cache_reply(h, ctx->ns_node, cmd->hdr.cmd, cmd->hdr.request_id,
+                         BST_MAX_AGE) == NO_ERROR) {
+        return NO_ERROR;
+    }
+    uint32_t generation = acpi_cache_generation();
+
     mx_status_t status = AcpiEvaluateObject(ctx->ns_node, (char*)"_BST", NULL, &buffer);
     if (status != AE_OK) {
         printf("Failed to find object's BST method\n");
@@ -595,6 +618,7 @@ static mx_status_t cmd_bst(mx_handle_t h, acpi_handle_ctx_t* ctx, void* _cmd) {
     };
     ACPI_FREE(obj);
 
+    acpi_cache_store(ctx->ns_node, cmd->hdr.cmd, generation, &rsp, sizeof(rsp));
     return mx_channel_write(h, 0, &rsp, sizeof(rsp), NULL, 0);
 }
 
@@ -608,6 +632,12 @@ static mx_status_t cmd_bif(mx_handle_t h, acpi_handle_ctx_t* ctx, void* _cmd) {
         .Length = ACPI_ALLOCATE_BUFFER,
         .Pointer = NULL,
     };
+    if (acpi_cache_reply(h, ctx->ns_node, cmd->hdr.cmd, cmd->hdr.request_id,
+                         0) == NO_ERROR) {
+        return NO_ERROR;
+    }
+    uint32_t generation = acpi_cache_generation();
+
     mx_status_t status = AcpiEvaluateObject(ctx->ns_node, (char*)"_BIF", NULL, &buffer);
     if (status != AE_OK) {
         printf("Failed to find object's BIF method\n");
@@ -659,6 +689,7 @@ static mx_status_t cmd_bif(mx_handle_t h, acpi_handle_ctx_t* ctx, void* _cmd) {
     rsp.oem[sizeof(rsp.oem)-1] = '\0';
     ACPI_FREE(obj);
 
+    acpi_cache_store(ctx->ns_node, cmd->hdr.cmd, generation, &rsp, sizeof(rsp));
     return mx_channel_write(h, 0, &rsp, sizeof(rsp), NULL, 0);
 }
 
@@ -14,6 +14,7 @@ MODULE_CFLAGS += -Wno-strict-aliasing -Ithird_party/lib/acpica/source/include
 
 ifeq ($(ARCH),x86)
 MODULE_SRCS += \
+    $(LOCAL_DIR)/cache.c \
     $(LOCAL_DIR)/debug.c \
     $(LOCAL_DIR)/ec.c \
     $(LOCAL_DIR)/main.c \
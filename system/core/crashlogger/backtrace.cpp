@@ -265,8 +265,21 @@ static int dso_lookup_for_unw(dsoinfo_t* dso_list, unw_word_t pc,
     return 1;
 }
 
+// Read stack memory, from |snapshot| if it has it.
+static mx_status_t read_stack(mx_handle_t process, const mx_exception_snapshot_t* snapshot,
+                              uintptr_t addr, void* ptr, size_t len) {
+    if (snapshot != nullptr && addr >= snapshot->stack_addr &&
+        addr - snapshot->stack_addr <= snapshot->stack_size &&
+        len <= snapshot->stack_size - (addr - snapshot->stack_addr)) {
+        memcpy(ptr, snapshot->stack + (addr - snapshot->stack_addr), len);
+        return NO_ERROR;
+    }
+    return read_mem(process, addr, ptr, len);
+}
+
 void backtrace(mx_handle_t process, mx_handle_t thread,
                uintptr_t pc, uintptr_t sp, uintptr_t fp,
+               const mx_exception_snapshot_t* snapshot,
                bool use_libunwind) {
     // Prepend "app:" to the name we print for the process binary to tell the
     // reader (and the symbolize script!) that the name is the process's.
@@ -362,10 +375,10 @@ void backtrace(mx_handle_t process, mx_handle_t thread,
             sp = val;
         } else {
             sp = fp;
-            if (read_mem(process, fp + 8, &pc, sizeof(pc))) {
+            if (read_stack(process, snapshot, fp + 8, &pc, sizeof(pc))) {
                 break;
             }
-            if (read_mem(process, fp, &fp, sizeof(fp))) {
+            if (read_stack(process, snapshot, fp, &fp, sizeof(fp))) {
                 break;
             }
         }
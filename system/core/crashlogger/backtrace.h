@@ -10,8 +10,13 @@ __BEGIN_CDECLS;
 
 #include <inttypes.h>
 
+#include <magenta/syscalls/exception.h>
+
+// |snapshot|, if not null, is the thread's state sent with the exception;
+// stack reads it covers are served from it rather than from the process.
 void backtrace(mx_handle_t process, mx_handle_t thread,
                uintptr_t pc, uintptr_t sp, uintptr_t fp,
+               const mx_exception_snapshot_t* snapshot,
                bool use_libunwind);
 
 __END_CDECLS;
@@ -172,10 +172,17 @@ bool write_general_regs(mx_handle_t thread, void* buf, size_t buf_size) {
     return true;
 }
 
-void dump_memory(mx_handle_t proc, uintptr_t start, size_t len) {
+void dump_memory(mx_handle_t proc, uintptr_t start, size_t len,
+                 const mx_exception_snapshot_t* snapshot) {
     // Make sure we're not allocating an excessive amount of stack.
     DEBUG_ASSERT(len <= kMemoryDumpSize);
 
+    // The snapshot starts at the stack pointer, which is where we dump from.
+    if (snapshot != nullptr && start == snapshot->stack_addr && snapshot->stack_size > 0) {
+        hexdump_ex(snapshot->stack, len < snapshot->stack_size ? len : snapshot->stack_size, start);
+        return;
+    }
+
     uint8_t buf[len];
     auto res = mx_process_read_memory(proc, start, buf, len, &len);
     if (res < 0) {
@@ -224,7 +231,9 @@ void resume_thread_from_exception(mx_handle_t thread,
     resume_thread(thread, false);
 }
 
-void process_report(const mx_exception_report_t* report, bool use_libunwind) {
+// |snapshot| is null if the report came without one.
+void process_report(const mx_exception_report_t* report,
+                    const mx_exception_snapshot_t* snapshot, bool use_libunwind) {
     if (!MX_EXCP_IS_ARCH(report->header.type))
         return;
 
@@ -261,8 +270,18 @@ void process_report(const mx_exception_report_t* report, bool use_libunwind) {
     mx_vaddr_t pc = 0, sp = 0, fp = 0;
     const char* arch = "unknown";
 
-    if (!read_general_regs(thread, &reg_buf, sizeof(reg_buf)))
-        goto Fail;
+    if (snapshot != nullptr && (snapshot->flags & MX_EXCEPTION_SNAPSHOT_REGS)) {
+        // The kernel sent the registers along, no need to ask.
+#if defined(__x86_64__)
+        reg_buf = snapshot->regs.x86_64;
+#elif defined(__aarch64__)
+        reg_buf = snapshot->regs.arm_64;
+#endif
+    } else {
+        snapshot = nullptr;
+        if (!read_general_regs(thread, &reg_buf, sizeof(reg_buf)))
+            goto Fail;
+    }
     // Delay setting this until here so Fail will know we now have the regs.
     regs = &reg_buf;
 
@@ -295,9 +314,9 @@ void process_report(const mx_exception_report_t* report, bool use_libunwind) {
     }
 
     printf("bottom of user stack:\n");
-    dump_memory(process, sp, kMemoryDumpSize);
+    dump_memory(process, sp, kMemoryDumpSize, snapshot);
     printf("arch: %s\n", arch);
-    backtrace(process, thread, pc, sp, fp, use_libunwind);
+    backtrace(process, thread, pc, sp, fp, snapshot, use_libunwind);
 
 Fail:
     debugf(1, "Done handling thread %" PRIu64 ".%" PRIu64 ".\n", get_koid(process), get_koid(thread));
@@ -316,7 +335,8 @@ Fail:
 // the request.
 
 mx_status_t bind_system_exception_port(mx_handle_t eport) {
-    return mx_object_bind_exception_port(MX_HANDLE_INVALID, eport, kSysExceptionKey, 0);
+    return mx_object_bind_exception_port(MX_HANDLE_INVALID, eport, kSysExceptionKey,
+                                         MX_EXCEPTION_PORT_SNAPSHOT);
 }
 
 // A small wrapper to provide a useful name to the API call used to effect
@@ -374,7 +394,7 @@ int self_dump_func(void* arg) {
     // situation crashlogger,libunwind,libbacktrace are compiled with frame
     // pointers. This decision needs to be revisited if/when we need/want
     // to compile any of these without frame pointers.
-    process_report(&packet.report, false);
+    process_report(&packet.report, nullptr, false);
 
     exit(1);
 }
@@ -496,15 +516,20 @@ int main(int argc, char** argv) {
 
     printf("crashlogger service ready\n");
 
+    // Too big for the stack of a thread that may be short on it.
+    static mx_exception_snapshot_packet_t packet;
     while (true) {
-        mx_exception_packet_t packet;
         mx_port_wait(ex_port, MX_TIME_INFINITE, &packet, sizeof(packet));
         if (packet.hdr.key != kSysExceptionKey) {
             print_error("invalid crash key");
             return 1;
         }
 
-        process_report(&packet.report, use_libunwind);
+        // Architectural exceptions come with a snapshot of the thread.
+        bool has_snapshot = packet.report.header.size >=
+                            sizeof(packet.report) + sizeof(packet.snapshot);
+        process_report(&packet.report, has_snapshot ? &packet.snapshot : nullptr,
+                       use_libunwind);
     }
 
     return 0;
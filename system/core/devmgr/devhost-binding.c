@@ -165,3 +165,34 @@ bool devhost_is_bindable(magenta_driver_info_t* di, uint32_t protocol_id,
     ctx.name = di->note->name;
     return is_bindable(&ctx);
 }
+
+uint32_t devhost_get_bind_prop(mx_device_t* dev, uint32_t id) {
+    bpctx_t ctx;
+    ctx.props = dev->props;
+    ctx.end = dev->props + dev->prop_count;
+    ctx.protocol_id = dev->protocol_id;
+    return dev_get_prop(&ctx, id);
+}
+
+// A binding program that opens with BI_ABORT_IF(NE, id, value) cannot match
+// a device whose property id is not value, so those leading instructions
+// give properties a device must have for the program to be worth running.
+size_t devhost_get_bind_reqs(mx_driver_t* drv, mx_device_prop_t* reqs, size_t max) {
+    const mx_bind_inst_t* ip = drv->binding;
+    const mx_bind_inst_t* end = ip + (drv->binding_size / sizeof(mx_bind_inst_t));
+    size_t count = 0;
+
+    while ((ip < end) && (count < max)) {
+        uint32_t inst = ip->op;
+        if ((BINDINST_OP(inst) != OP_ABORT) || (BINDINST_CC(inst) != COND_NE) ||
+            (BINDINST_PB(inst) == BIND_FLAGS)) {
+            break;
+        }
+        reqs[count].id = BINDINST_PB(inst);
+        reqs[count].reserved = 0;
+        reqs[count].value = ip->arg;
+        count++;
+        ip++;
+    }
+    return count;
+}
@@ -4,10 +4,12 @@
 
 #include "acpi.h"
 #include "devhost.h"
+#include "devmgr.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -122,6 +124,175 @@ static struct list_node driver_list = LIST_INITIAL_VALUE(driver_list);
 
 #define device_is_bound(dev) (!!dev->owner)
 
+// Drivers indexed by the protocol their binding program requires, so that a
+// new device is matched against only the drivers that could bind to it. The
+// other properties the program requires up front (PCI VID, USB class, ...)
+// are checked before the program is run. Programs that don't start by
+// requiring a protocol are on the wildcard list, and ones with no
+// instructions, which never match, are not indexed at all. Entries are
+// kept in the order drivers were added, which is the order they are tried.
+#define BIND_INDEX_BUCKETS 31
+#define BIND_INDEX_MAX_REQS 4
+
+typedef struct {
+    list_node_t node;
+    mx_driver_t* drv;
+    uint32_t seq;
+    uint32_t req_count;
+    mx_device_prop_t reqs[BIND_INDEX_MAX_REQS];
+} bind_index_entry_t;
+
+static struct list_node bind_index[BIND_INDEX_BUCKETS];
+static struct list_node bind_index_wildcard = LIST_INITIAL_VALUE(bind_index_wildcard);
+static uint32_t bind_index_seq;
+
+static struct list_node* bind_index_bucket(uint32_t protocol_id) {
+    struct list_node* bucket = &bind_index[protocol_id % BIND_INDEX_BUCKETS];
+    if (bucket->next == NULL) {
+        list_initialize(bucket);
+    }
+    return bucket;
+}
+
+static mx_status_t bind_index_add(mx_driver_t* drv, bind_index_entry_t** out) {
+    *out = NULL;
+    if (drv->binding_size == 0) {
+        return NO_ERROR;
+    }
+    bind_index_entry_t* entry = calloc(1, sizeof(bind_index_entry_t));
+    if (entry == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    entry->drv = drv;
+    entry->seq = bind_index_seq++;
+    entry->req_count = devhost_get_bind_reqs(drv, entry->reqs, BIND_INDEX_MAX_REQS);
+
+    struct list_node* list = &bind_index_wildcard;
+    for (uint32_t i = 0; i < entry->req_count; i++) {
+        if (entry->reqs[i].id == BIND_PROTOCOL) {
+            list = bind_index_bucket(entry->reqs[i].value);
+            break;
+        }
+    }
+    list_add_tail(list, &entry->node);
+    *out = entry;
+    return NO_ERROR;
+}
+
+static bool bind_index_may_match(bind_index_entry_t* entry, mx_device_t* dev) {
+    for (uint32_t i = 0; i < entry->req_count; i++) {
+        if (devhost_get_bind_prop(dev, entry->reqs[i].id) != entry->reqs[i].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bind_index_entry_t* bind_index_next(struct list_node* list, bind_index_entry_t* entry) {
+    struct list_node* node = entry ? list_next(list, &entry->node) : list_peek_head(list);
+    return node ? containerof(node, bind_index_entry_t, node) : NULL;
+}
+
+static void bind_index_replace_list(struct list_node* list, mx_driver_t* old, mx_driver_t* drv) {
+    bind_index_entry_t* entry;
+    list_for_every_entry (list, entry, bind_index_entry_t, node) {
+        if (entry->drv == old) {
+            entry->drv = drv;
+        }
+    }
+}
+
+// Once a DRV_FLAG_LAZY stand-in is loaded, index entries point at the
+// library's driver instead. The stand-in stays on driver_list, for binds by
+// name, which resolve it again.
+static mx_driver_t* devhost_driver_resolve(mx_driver_t* drv) {
+    DM_UNLOCK();
+    mx_driver_t* loaded = devhost_load_driver(drv);
+    DM_LOCK();
+    if (loaded == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < BIND_INDEX_BUCKETS; i++) {
+        if (bind_index[i].next != NULL) {
+            bind_index_replace_list(&bind_index[i], drv, loaded);
+        }
+    }
+    bind_index_replace_list(&bind_index_wildcard, drv, loaded);
+    return loaded;
+}
+
+// Binding is done by a pool of worker threads, so that a slow bind (bus
+// enumeration, disk spin-up) does not hold up the rest of the tree. Each
+// work item probes one device, with one driver or all of them. A device is
+// probed by one worker at a time (DEV_FLAG_BINDING), in the order its items
+// were queued, while other devices, and so the subtrees under them, bind
+// in parallel.
+#define BIND_THREADS 4
+
+typedef struct {
+    list_node_t node;
+    mx_device_t* dev;
+    // NULL to probe all drivers
+    mx_driver_t* drv;
+    bool autobind;
+} bind_work_t;
+
+static struct list_node bind_work_list = LIST_INITIAL_VALUE(bind_work_list);
+static cnd_t bind_work_cnd;
+static int bind_threads;
+// work items queued or being run
+static uint32_t bind_work_pending;
+static bool bind_report_due;
+
+// time spent in each driver's bind op
+typedef struct {
+    list_node_t node;
+    mx_driver_t* drv;
+    uint32_t attempts;
+    uint32_t bound;
+    mx_time_t total;
+    mx_time_t max;
+} bind_stat_t;
+
+static struct list_node bind_stat_list = LIST_INITIAL_VALUE(bind_stat_list);
+
+static void bind_stat_record(mx_driver_t* drv, mx_time_t duration, bool bound) {
+    bind_stat_t* stat;
+    list_for_every_entry (&bind_stat_list, stat, bind_stat_t, node) {
+        if (stat->drv == drv) {
+            goto found;
+        }
+    }
+    if ((stat = calloc(1, sizeof(bind_stat_t))) == NULL) {
+        return;
+    }
+    stat->drv = drv;
+    list_add_tail(&bind_stat_list, &stat->node);
+found:
+    stat->attempts++;
+    if (bound) {
+        stat->bound++;
+    }
+    stat->total += duration;
+    if (duration > stat->max) {
+        stat->max = duration;
+    }
+}
+
+static void bind_stat_report(void) {
+    const char* name = root_dev ? root_dev->name : "?";
+    bind_stat_t* stat;
+    list_for_every_entry (&bind_stat_list, stat, bind_stat_t, node) {
+        // skip drivers that quickly declined
+        if (stat->bound == 0 && stat->total < MX_MSEC(1)) {
+            continue;
+        }
+        printf("devhost[%s]: bind %s: %u/%u bound, %" PRIu64 "ms total, %" PRIu64 "ms max\n",
+               name, stat->drv->name ? stat->drv->name : "<NULL>", stat->bound,
+               stat->attempts, stat->total / MX_MSEC(1), stat->max / MX_MSEC(1));
+    }
+}
+
 void dev_ref_release(mx_device_t* dev) {
     dev->refcount--;
     if (dev->refcount == 0) {
@@ -153,7 +324,7 @@ void dev_ref_release(mx_device_t* dev) {
     }
 }
 
-static mx_status_t devhost_device_probe(mx_device_t* dev, mx_driver_t* drv) {
+static mx_status_t devhost_device_probe(mx_device_t* dev, mx_driver_t* drv, bool autobind) {
     mx_status_t status;
 
     xprintf("devhost: probe dev=%p(%s) drv=%p(%s)\n",
@@ -169,9 +340,23 @@ static mx_status_t devhost_device_probe(mx_device_t* dev, mx_driver_t* drv) {
         return ERR_NOT_SUPPORTED;
     }
 
+    // it matches, so the driver's library is needed now
+    if (drv->flags & DRV_FLAG_LAZY) {
+        if ((drv = devhost_driver_resolve(drv)) == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        if ((drv == dev->driver) || (autobind && (drv->flags & DRV_FLAG_NO_AUTOBIND))) {
+            return ERR_NOT_SUPPORTED;
+        }
+    }
+
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
     DM_UNLOCK();
+    devmgr_boot_mark("bind", drv->name ? drv->name : "?", false);
     status = drv->ops.bind(drv, dev);
+    devmgr_boot_mark("bind", drv->name ? drv->name : "?", true);
     DM_LOCK();
+    bind_stat_record(drv, mx_time_get(MX_CLOCK_MONOTONIC) - start, status == NO_ERROR);
     if (status < 0) {
         return status;
     }
@@ -188,24 +373,140 @@ static mx_status_t devhost_device_probe(mx_device_t* dev, mx_driver_t* drv) {
 static void devhost_device_probe_all(mx_device_t* dev, bool autobind) {
     if ((dev->flags & DEV_FLAG_UNBINDABLE) == 0) {
         if (!device_is_bound(dev)) {
-            mx_driver_t* drv = NULL;
-            list_for_every_entry (&driver_list, drv, mx_driver_t, node) {
+            // walk the device's protocol bucket and the wildcard list
+            // together, in the order the drivers were added
+            struct list_node* bucket =
+                bind_index_bucket(devhost_get_bind_prop(dev, BIND_PROTOCOL));
+            bind_index_entry_t* b = bind_index_next(bucket, NULL);
+            bind_index_entry_t* w = bind_index_next(&bind_index_wildcard, NULL);
+            while (b || w) {
+                bind_index_entry_t* entry;
+                if (b && (!w || b->seq < w->seq)) {
+                    entry = b;
+                    b = bind_index_next(bucket, b);
+                } else {
+                    entry = w;
+                    w = bind_index_next(&bind_index_wildcard, w);
+                }
+                mx_driver_t* drv = entry->drv;
                 if (autobind && drv->flags & DRV_FLAG_NO_AUTOBIND) {
                     continue;
                 }
-                if (devhost_device_probe(dev, drv) == NO_ERROR) {
+                if (!bind_index_may_match(entry, dev)) {
+                    continue;
+                }
+                if (devhost_device_probe(dev, drv, autobind) == NO_ERROR) {
                     break;
                 }
             }
         }
 
         // if no driver is bound, add the device to the unmatched list
-        if (!device_is_bound(dev)) {
+        if (!device_is_bound(dev) && !list_in_list(&dev->unode)) {
             list_add_tail(&unmatched_device_list, &dev->unode);
         }
     }
 }
 
+static void bind_work_run(bind_work_t* work) {
+    mx_device_t* dev = work->dev;
+    if (dev->flags & DEV_FLAG_DEAD) {
+        return;
+    }
+    if (work->drv == NULL) {
+        devhost_device_probe_all(dev, work->autobind);
+    } else if (!device_is_bound(dev) && !(dev->flags & DEV_FLAG_UNBINDABLE)) {
+        devhost_device_probe(dev, work->drv, false);
+    }
+}
+
+static void bind_work_done(void) {
+    if (--bind_work_pending == 0 && bind_report_due) {
+        bind_report_due = false;
+        bind_stat_report();
+    }
+}
+
+static int bind_worker(void* arg) {
+    DM_LOCK();
+    for (;;) {
+        // take the first item for a device no other worker is probing
+        bind_work_t* work;
+        list_for_every_entry (&bind_work_list, work, bind_work_t, node) {
+            if (!(work->dev->flags & DEV_FLAG_BINDING)) {
+                goto found;
+            }
+        }
+        cnd_wait(&bind_work_cnd, &__devhost_api_lock);
+        continue;
+found:
+        list_delete(&work->node);
+        mx_device_t* dev = work->dev;
+        dev->flags |= DEV_FLAG_BINDING;
+        bind_work_run(work);
+        dev->flags &= ~DEV_FLAG_BINDING;
+        free(work);
+        // items for this device may have been passed over while it was busy
+        cnd_broadcast(&bind_work_cnd);
+        dev_ref_release(dev);
+        bind_work_done();
+    }
+    return 0;
+}
+
+static void bind_threads_start(void) {
+    if (cnd_init(&bind_work_cnd) != thrd_success) {
+        bind_threads = -1;
+        return;
+    }
+    for (int i = 0; i < BIND_THREADS; i++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, bind_worker, NULL, "devhost-bind") != thrd_success) {
+            break;
+        }
+        thrd_detach(t);
+        bind_threads++;
+    }
+    if (bind_threads == 0) {
+        bind_threads = -1;
+    }
+}
+
+// Queues a probe of dev by drv, or by all drivers if drv is NULL. Without
+// workers to run it, the probe is done right away.
+static void devhost_device_queue_probe(mx_device_t* dev, mx_driver_t* drv, bool autobind) {
+    if (bind_threads == 0) {
+        bind_threads_start();
+    }
+    bind_work_t* work;
+    if (bind_threads < 0 || (work = malloc(sizeof(bind_work_t))) == NULL) {
+        bind_work_t sync = {
+            .dev = dev,
+            .drv = drv,
+            .autobind = autobind,
+        };
+        bind_work_run(&sync);
+        return;
+    }
+    dev_ref_acquire(dev);
+    work->dev = dev;
+    work->drv = drv;
+    work->autobind = autobind;
+    list_add_tail(&bind_work_list, &work->node);
+    bind_work_pending++;
+    cnd_signal(&bind_work_cnd);
+}
+
+void devhost_drivers_loaded(void) {
+    DM_LOCK();
+    if (bind_work_pending == 0) {
+        bind_stat_report();
+    } else {
+        bind_report_due = true;
+    }
+    DM_UNLOCK();
+}
+
 void devhost_device_init(mx_device_t* dev, mx_driver_t* driver,
                         const char* name, mx_protocol_device_t* ops) {
     xprintf("devhost: init '%s' drv=%p, ops=%p\n",
@@ -216,6 +517,7 @@ void devhost_device_init(mx_device_t* dev, mx_driver_t* driver,
     dev->ops = ops;
     dev->driver = driver;
     list_initialize(&dev->children);
+    mtx_init(&dev->rpc_lock, mtx_plain);
 
     if (name == NULL) {
         printf("devhost: dev=%p has null name.\n", dev);
@@ -364,8 +666,13 @@ mx_status_t devhost_device_add(mx_device_t* dev, mx_device_t* parent) {
         }
     }
 
-    // probe the device
-    devhost_device_probe_all(dev, true);
+    // probe the device; instances, created on open, are probed right away
+    // so that they don't outlive their last close on the bind queue
+    if (dev->flags & DEV_FLAG_INSTANCE) {
+        devhost_device_probe_all(dev, true);
+    } else {
+        devhost_device_queue_probe(dev, NULL, true);
+    }
 
     dev->flags &= (~DEV_FLAG_BUSY);
     return NO_ERROR;
@@ -452,6 +759,9 @@ mx_status_t devhost_device_bind(mx_device_t* dev, const char* drv_name) {
     if (device_is_bound(dev)) {
         return ERR_INVALID_ARGS;
     }
+    if (dev->flags & DEV_FLAG_BINDING) {
+        return ERR_BAD_STATE;
+    }
     if (dev->flags & DEV_FLAG_UNBINDABLE) {
         return NO_ERROR;
     }
@@ -465,7 +775,7 @@ mx_status_t devhost_device_bind(mx_device_t* dev, const char* drv_name) {
             if (strcmp(drv->name, drv_name)) {
                 continue;
             }
-            if (devhost_device_probe(dev, drv) == NO_ERROR) {
+            if (devhost_device_probe(dev, drv, false) == NO_ERROR) {
                 break;
             }
         }
@@ -475,6 +785,9 @@ mx_status_t devhost_device_bind(mx_device_t* dev, const char* drv_name) {
 }
 
 mx_status_t devhost_device_rebind(mx_device_t* dev) {
+    if (dev->flags & DEV_FLAG_BINDING) {
+        return ERR_BAD_STATE;
+    }
     dev->flags |= DEV_FLAG_REBIND;
 
     // remove children
@@ -550,14 +863,27 @@ mx_status_t devhost_driver_add(mx_driver_t* drv) {
             return r;
     }
 
+    bind_index_entry_t* entry;
+    mx_status_t status;
+    if ((status = bind_index_add(drv, &entry)) < 0) {
+        return status;
+    }
+
     // add the driver to the driver list
     list_add_tail(&driver_list, &drv->node);
 
+    if (entry == NULL) {
+        // no binding program, so it cannot bind to anything
+        return NO_ERROR;
+    }
+
     // probe unmatched devices with the driver and initialize if the probe is successful
     mx_device_t* dev = NULL;
     mx_device_t* temp = NULL;
     list_for_every_entry_safe (&unmatched_device_list, dev, temp, mx_device_t, unode) {
-        devhost_device_probe(dev, drv);
+        if (bind_index_may_match(entry, dev)) {
+            devhost_device_queue_probe(dev, drv, false);
+        }
     }
     return NO_ERROR;
 }
@@ -26,6 +26,10 @@
 
 #include <dirent.h>
 #include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <threads.h>
+#include <unistd.h>
 
 #define DRIVER_NAME_LEN_MAX 64
 
@@ -75,6 +79,151 @@ static void init_from_driver_info(magenta_driver_info_t* di, bool for_root) {
 
 static list_node_t driver_list = LIST_INITIAL_VALUE(driver_list);
 
+// A loadable driver whose library is not opened until a device matches its
+// binding program. Its note, which the build puts in the library, gives the
+// name and binding program without loading it.
+typedef struct {
+    magenta_driver_info_t di;
+    mx_driver_t drv;
+    magenta_note_driver_t note;
+    char libname[256 + 32];
+
+    mtx_t lock;
+    mx_driver_t* loaded;
+    bool failed;
+
+    mx_bind_inst_t binding[];
+} lazy_driver_t;
+
+// dlopen() is not done by several threads at once
+static mtx_t dlopen_lock = MTX_INIT;
+
+typedef struct {
+    uint32_t namesz;
+    uint32_t descsz;
+    uint32_t type;
+    char name[0];
+} notehdr_t;
+
+#define NOTE_BUF_SIZE 4096
+
+// Finds the driver note in a PT_NOTE segment's contents.
+static const magenta_note_driver_t* find_driver_note(const uint8_t* data, size_t size,
+                                                     size_t* descsz) {
+    while (size >= sizeof(notehdr_t)) {
+        // ignore padding between notes
+        if (*((uint32_t*)data) == 0) {
+            size -= sizeof(uint32_t);
+            data += sizeof(uint32_t);
+            continue;
+        }
+        const notehdr_t* hdr = (const notehdr_t*)data;
+        uint32_t nsz = (hdr->namesz + 3) & (~3);
+        uint32_t dsz = (hdr->descsz + 3) & (~3);
+        if (sizeof(notehdr_t) + nsz + dsz > size) {
+            break;
+        }
+        const uint8_t* desc = data + sizeof(notehdr_t) + nsz;
+        if ((hdr->type == MAGENTA_NOTE_DRIVER) && (hdr->namesz == 8) &&
+            !memcmp(hdr->name, "Magenta", 8) && (hdr->descsz >= sizeof(magenta_note_driver_t))) {
+            *descsz = hdr->descsz;
+            return (const magenta_note_driver_t*)desc;
+        }
+        data = desc + dsz;
+        size -= sizeof(notehdr_t) + nsz + dsz;
+    }
+    return NULL;
+}
+
+// Reads the driver note out of a driver library, into a lazy_driver_t.
+static lazy_driver_t* read_driver_note(int fd) {
+    Elf64_Ehdr eh;
+    Elf64_Phdr ph[64];
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh)) {
+        return NULL;
+    }
+    if (memcmp(&eh, ELFMAG, SELFMAG) || (eh.e_ehsize != sizeof(Elf64_Ehdr)) ||
+        (eh.e_phentsize != sizeof(Elf64_Phdr)) || (eh.e_phnum > countof(ph))) {
+        return NULL;
+    }
+    size_t sz = sizeof(Elf64_Phdr) * eh.e_phnum;
+    if (pread(fd, ph, sz, eh.e_phoff) != (ssize_t)sz) {
+        return NULL;
+    }
+    uint8_t* data = malloc(NOTE_BUF_SIZE);
+    if (data == NULL) {
+        return NULL;
+    }
+    lazy_driver_t* ld = NULL;
+    for (int i = 0; i < eh.e_phnum; i++) {
+        if ((ph[i].p_type != PT_NOTE) || (ph[i].p_filesz > NOTE_BUF_SIZE)) {
+            continue;
+        }
+        if (pread(fd, data, ph[i].p_filesz, ph[i].p_offset) != (ssize_t)ph[i].p_filesz) {
+            break;
+        }
+        size_t descsz;
+        const magenta_note_driver_t* note = find_driver_note(data, ph[i].p_filesz, &descsz);
+        if (note == NULL) {
+            continue;
+        }
+        size_t max = (descsz - sizeof(magenta_note_driver_t)) / sizeof(mx_bind_inst_t);
+        if (note->bindcount > max) {
+            break;
+        }
+        size_t binding_size = note->bindcount * sizeof(mx_bind_inst_t);
+        if ((ld = calloc(1, sizeof(lazy_driver_t) + binding_size)) == NULL) {
+            break;
+        }
+        memcpy(&ld->note, note, sizeof(magenta_note_driver_t));
+        ld->note.name[sizeof(ld->note.name) - 1] = 0;
+        memcpy(ld->binding, note + 1, binding_size);
+        ld->di.driver = &ld->drv;
+        ld->di.note = &ld->note;
+        ld->di.binding = ld->binding;
+        ld->di.binding_size = binding_size;
+        ld->drv.flags = DRV_FLAG_LAZY;
+        mtx_init(&ld->lock, mtx_plain);
+        break;
+    }
+    free(data);
+    return ld;
+}
+
+mx_driver_t* devhost_load_driver(mx_driver_t* drv) {
+    lazy_driver_t* ld = containerof(drv, lazy_driver_t, drv);
+    mtx_lock(&ld->lock);
+    if ((ld->loaded == NULL) && !ld->failed) {
+        mtx_lock(&dlopen_lock);
+        void* dl = dlopen(ld->libname, RTLD_NOW);
+        mtx_unlock(&dlopen_lock);
+        magenta_driver_info_t* di = NULL;
+        if (dl == NULL) {
+            printf("devhost: cannot load '%s': %s\n", ld->libname, dlerror());
+        } else if ((di = dlsym(dl, "__magenta_driver__")) == NULL) {
+            printf("devhost: driver '%s' missing __magenta_driver__ symbol\n", ld->libname);
+        } else {
+            mx_driver_t* loaded = di->driver;
+            loaded->name = di->note->name;
+            loaded->binding = di->binding;
+            loaded->binding_size = di->binding_size;
+            mx_status_t r = NO_ERROR;
+            if (loaded->ops.init) {
+                r = loaded->ops.init(loaded);
+            }
+            if (r < 0) {
+                printf("devhost: driver '%s' init failed: %d\n", ld->libname, r);
+            } else {
+                ld->loaded = loaded;
+            }
+        }
+        ld->failed = (ld->loaded == NULL);
+    }
+    mx_driver_t* loaded = ld->loaded;
+    mtx_unlock(&ld->lock);
+    return loaded;
+}
+
 static void load_loadable_drivers(const char* path) {
     DIR* dir = opendir(path);
     if (dir == NULL) {
@@ -90,6 +239,35 @@ static void load_loadable_drivers(const char* path) {
         if ((r < 0) || (r >= (int)sizeof(libname))) {
             continue;
         }
+
+        // drivers with binding programs wait to be loaded until something
+        // matches; ones without must be initialized now
+        char filename[512];
+        lazy_driver_t* ld = NULL;
+        r = snprintf(filename, sizeof(filename), "%s/%s", path, de->d_name);
+        if ((r >= 0) && (r < (int)sizeof(filename))) {
+            int fd = open(filename, O_RDONLY);
+            if (fd >= 0) {
+                ld = read_driver_note(fd);
+                close(fd);
+            }
+        }
+        if ((ld != NULL) && (ld->note.bindcount > 0)) {
+            memcpy(ld->libname, libname, sizeof(libname));
+            magenta_driver_info_t* di = &ld->di;
+            if (is_driver_disabled(di)) {
+                free(ld);
+                continue;
+            }
+            if (di->note->version[0] == '!') {
+                list_add_head(&driver_list, &di->node);
+            } else {
+                list_add_tail(&driver_list, &di->node);
+            }
+            continue;
+        }
+        free(ld);
+
         void* dl = dlopen(libname, RTLD_NOW);
         if (dl == NULL) {
             printf("devhost: cannot load '%s': %s\n", libname, dlerror());
@@ -113,9 +291,10 @@ static void load_loadable_drivers(const char* path) {
 }
 
 static void init_loaded_drivers(bool for_root) {
-    // We have to dlopen() all drivers before init'ing them, because
-    // drivers can start threads that map memory which can interfere
-    // with further dlopen() operations.
+    // We have to dlopen() all eagerly loaded drivers before init'ing them,
+    // because drivers can start threads that map memory which can interfere
+    // with further dlopen() operations. Lazily loaded ones are opened under
+    // dlopen_lock.
     magenta_driver_info_t* di;
     list_for_every_entry(&driver_list, di, magenta_driver_info_t, node) {
         init_from_driver_info(di, for_root);
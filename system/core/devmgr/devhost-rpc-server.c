@@ -7,6 +7,8 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +22,7 @@
 #include <ddk/iotxn.h>
 #include <ddk/protocol/device.h>
 
+#include <magenta/device/block.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
@@ -32,6 +35,8 @@
 #define CAN_WRITE(ios) (((03 & ios->flags) == O_RDWR) || ((03 & ios->flags) == O_WRONLY))
 #define CAN_READ(ios) (((03 & ios->flags) == O_RDWR) || ((03 & ios->flags) == O_RDONLY))
 
+#define ROUNDUP(a, b) (((a) + ((b)-1)) & ~((b)-1))
+
 mxio_dispatcher_t* devhost_rio_dispatcher;
 
 devhost_iostate_t* create_devhost_iostate(mx_device_t* dev) {
@@ -106,9 +111,26 @@ static void sync_io_complete(iotxn_t* txn, void* cookie) {
     completion_signal((completion_t*)cookie);
 }
 
+// iotxns for MXRIO_READ/WRITE, which every device in the devhost shares
+#define SYNC_IO_POOL_COUNT 4
+
+static iotxn_pool_t* sync_io_pool;
+static once_flag sync_io_pool_once = ONCE_FLAG_INIT;
+
+static void sync_io_pool_init(void) {
+    // failing which, iotxns are allocated as needed
+    iotxn_pool_create(&sync_io_pool, SYNC_IO_POOL_COUNT, MXIO_CHUNK_SIZE, 0);
+}
+
 static ssize_t do_sync_io(mx_device_t* dev, uint32_t opcode, void* buf, size_t count, mx_off_t off) {
     iotxn_t* txn;
-    mx_status_t status = iotxn_alloc(&txn, 0, MXIO_CHUNK_SIZE, 0);
+    mx_status_t status;
+    call_once(&sync_io_pool_once, sync_io_pool_init);
+    if (sync_io_pool != NULL) {
+        status = iotxn_pool_alloc(sync_io_pool, &txn);
+    } else {
+        status = iotxn_alloc(&txn, 0, MXIO_CHUNK_SIZE, 0);
+    }
     if (status != NO_ERROR) {
         return status;
     }
@@ -147,6 +169,395 @@ static ssize_t do_sync_io(mx_device_t* dev, uint32_t opcode, void* buf, size_t c
     return actual;
 }
 
+// merged requests are capped so the buffers drivers bounce them through
+// stay modest
+#define BLOCK_TXN_MERGE_MAX (64 * 1024)
+
+// most requests run together, from an IOCTL_BLOCK_TXN_VMO batch or a fifo
+#define BLOCK_TXN_RUN_MAX 64
+
+static_assert(BLOCK_TXN_MAX <= BLOCK_TXN_RUN_MAX, "");
+
+typedef struct {
+    atomic_int pending;
+    completion_t completion;
+} block_txn_wait_t;
+
+static void block_txn_complete(iotxn_t* txn, void* cookie) {
+    block_txn_wait_t* wait = cookie;
+    if (atomic_fetch_sub(&wait->pending, 1) == 1) {
+        completion_signal(&wait->completion);
+    }
+}
+
+// Checks a request against the size of its VMO and how the device was opened.
+static mx_status_t block_txn_check(devhost_iostate_t* ios, const block_txn_t* bt,
+                                   uint64_t size) {
+    if ((bt->length == 0) || (bt->vmo_offset > size) || (bt->length > (size - bt->vmo_offset))) {
+        return ERR_INVALID_ARGS;
+    }
+    if (bt->opcode == BLOCK_TXN_OP_READ) {
+        return CAN_READ(ios) ? NO_ERROR : ERR_ACCESS_DENIED;
+    } else if (bt->opcode == BLOCK_TXN_OP_WRITE) {
+        return CAN_WRITE(ios) ? NO_ERROR : ERR_ACCESS_DENIED;
+    }
+    return ERR_INVALID_ARGS;
+}
+
+// Runs checked requests between the device and the VMO, leaving the
+// outcome of each in status[].  Every request is queued before waiting on
+// any, so the device may work on all of them at once, and those that follow
+// on from the one before are merged.  The iotxns are made over the VMO's
+// own pages, so the data is not copied on the way.
+static void block_txn_run(mx_device_t* dev, mx_handle_t vmo, const block_txn_t* bts,
+                          uint32_t count, mx_status_t* status) {
+    iotxn_t* txns[BLOCK_TXN_RUN_MAX];
+    // the requests merged into txns[t] are firsts[t] up to firsts[t + 1]
+    uint32_t firsts[BLOCK_TXN_RUN_MAX + 1];
+    uint32_t ntxns = 0;
+    block_txn_wait_t wait;
+    mx_status_t r = NO_ERROR;
+
+    uint32_t i = 0;
+    while (i < count) {
+        const block_txn_t* bt = &bts[i];
+        uint64_t length = bt->length;
+        uint32_t n = 1;
+        while ((i + n) < count) {
+            const block_txn_t* next = &bts[i + n];
+            if ((next->opcode != bt->opcode) ||
+                (next->dev_offset != bt->dev_offset + length) ||
+                (next->vmo_offset != bt->vmo_offset + length) ||
+                ((length + next->length) > BLOCK_TXN_MERGE_MAX)) {
+                break;
+            }
+            length += next->length;
+            n++;
+        }
+
+        iotxn_t* txn;
+        if ((r = iotxn_alloc_vmo(&txn, vmo, length, bt->vmo_offset, 0)) < 0) {
+            break;
+        }
+        txn->opcode = (bt->opcode == BLOCK_TXN_OP_READ) ? IOTXN_OP_READ : IOTXN_OP_WRITE;
+        txn->offset = bt->dev_offset;
+        txn->length = length;
+        txn->complete_cb = block_txn_complete;
+        firsts[ntxns] = i;
+        txns[ntxns++] = txn;
+        i += n;
+    }
+    firsts[ntxns] = i;
+
+    if (ntxns > 0) {
+        atomic_init(&wait.pending, ntxns);
+        wait.completion = COMPLETION_INIT;
+        for (uint32_t t = 0; t < ntxns; t++) {
+            txns[t]->cookie = &wait;
+            dev->ops->iotxn_queue(dev, txns[t]);
+        }
+        completion_wait(&wait.completion, MX_TIME_INFINITE);
+    }
+
+    for (uint32_t t = 0; t < ntxns; t++) {
+        iotxn_t* txn = txns[t];
+        mx_status_t st = txn->status;
+        if ((st == NO_ERROR) && (txn->actual != txn->length)) {
+            st = ERR_IO;
+        }
+        for (uint32_t j = firsts[t]; j < firsts[t + 1]; j++) {
+            status[j] = st;
+        }
+        txn->ops->release(txn);
+    }
+    // those left when iotxns ran out
+    for (uint32_t j = firsts[ntxns]; j < count; j++) {
+        status[j] = r;
+    }
+}
+
+// Runs an IOCTL_BLOCK_TXN_VMO batch.
+static mx_status_t do_block_txn_vmo(mx_device_t* dev, devhost_iostate_t* ios,
+                                    const void* in_buf, size_t in_len) {
+    const block_txn_batch_t* batch = in_buf;
+    mx_handle_t vmo = batch->vmo;
+    mx_status_t status[BLOCK_TXN_MAX];
+    uint64_t size = 0;
+    mx_status_t r;
+
+    if ((in_len < BLOCK_TXN_BATCH_SIZE(0)) || (batch->count > BLOCK_TXN_MAX) ||
+        (in_len < BLOCK_TXN_BATCH_SIZE(batch->count))) {
+        r = ERR_INVALID_ARGS;
+        goto done;
+    }
+    if ((r = mx_vmo_get_size(vmo, &size)) < 0) {
+        goto done;
+    }
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if ((r = block_txn_check(ios, &batch->txns[i], size)) < 0) {
+            goto done;
+        }
+    }
+    if (batch->count == 0) {
+        r = NO_ERROR;
+        goto done;
+    }
+
+    block_txn_run(dev, vmo, batch->txns, batch->count, status);
+    r = NO_ERROR;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if (status[i] != NO_ERROR) {
+            r = status[i];
+            break;
+        }
+    }
+
+done:
+    mx_handle_close(vmo);
+    return r;
+}
+
+// Serves the block fifo (see block_fifo_t) of an open device on a thread of
+// its own, which the client keeps busy without a round trip per request.
+struct block_fifo_server {
+    devhost_iostate_t* ios;
+
+    // consumer of the requests and producer of the responses
+    mx_handle_t req_fifo;
+    mx_handle_t rsp_fifo;
+    uint32_t count;
+    uintptr_t entries;
+    size_t entries_size;
+    const block_fifo_request_t* reqs;
+    block_fifo_response_t* rsps;
+
+    // signaled to stop the thread
+    mx_handle_t stop;
+    thrd_t thread;
+
+    // the VMO set with IOCTL_BLOCK_SET_FIFO_VMO
+    mtx_t vmo_lock;
+    mx_handle_t vmo;
+    uint64_t size;
+};
+
+static void block_fifo_free(block_fifo_server_t* bfs) {
+    if (bfs->entries != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), bfs->entries, bfs->entries_size);
+    }
+    mx_handle_t handles[] = { bfs->req_fifo, bfs->rsp_fifo, bfs->stop, bfs->vmo };
+    for (unsigned i = 0; i < countof(handles); i++) {
+        if (handles[i] != MX_HANDLE_INVALID) {
+            mx_handle_close(handles[i]);
+        }
+    }
+    free(bfs);
+}
+
+// Waits for the fifo to assert signal, or for the server to be stopped,
+// in which case it returns false.
+static bool block_fifo_wait(block_fifo_server_t* bfs, mx_handle_t fifo, mx_signals_t signal) {
+    mx_wait_item_t items[2] = {
+        { .handle = fifo, .waitfor = signal },
+        { .handle = bfs->stop, .waitfor = MX_EVENT_SIGNALED },
+    };
+    if (mx_handle_wait_many(items, countof(items), MX_TIME_INFINITE) < 0) {
+        return false;
+    }
+    return !(items[1].pending & MX_EVENT_SIGNALED);
+}
+
+static int block_fifo_thread(void* arg) {
+    block_fifo_server_t* bfs = arg;
+    block_txn_t bts[BLOCK_TXN_RUN_MAX];
+    uint64_t cookies[BLOCK_TXN_RUN_MAX];
+    mx_status_t status[BLOCK_TXN_RUN_MAX];
+    // the requests that pass their checks, and where they came from
+    block_txn_t run[BLOCK_TXN_RUN_MAX];
+    mx_status_t run_status[BLOCK_TXN_RUN_MAX];
+    uint32_t run_from[BLOCK_TXN_RUN_MAX];
+    uint64_t mask = bfs->count - 1;
+
+    while (block_fifo_wait(bfs, bfs->req_fifo, MX_FIFO_NOT_EMPTY)) {
+        mx_fifo_state_t req, rsp;
+        if ((mx_fifo_op(bfs->req_fifo, MX_FIFO_OP_READ_STATE, 0, &req) < 0) ||
+            (mx_fifo_op(bfs->rsp_fifo, MX_FIFO_OP_READ_STATE, 0, &rsp) < 0)) {
+            break;
+        }
+        // take no more requests than there is room to respond to
+        uint64_t room = bfs->count - (rsp.head - rsp.tail);
+        if (room == 0) {
+            if (!block_fifo_wait(bfs, bfs->rsp_fifo, MX_FIFO_NOT_FULL)) {
+                break;
+            }
+            continue;
+        }
+        uint64_t n = req.head - req.tail;
+        if (n > room) {
+            n = room;
+        }
+        if (n > BLOCK_TXN_RUN_MAX) {
+            n = BLOCK_TXN_RUN_MAX;
+        }
+        // copied, as the client may rewrite them once the tail moves on
+        for (uint32_t i = 0; i < n; i++) {
+            const block_fifo_request_t* r = &bfs->reqs[(req.tail + i) & mask];
+            bts[i] = r->txn;
+            cookies[i] = r->cookie;
+        }
+        if (mx_fifo_op(bfs->req_fifo, MX_FIFO_OP_ADVANCE_TAIL, n, &req) < 0) {
+            break;
+        }
+
+        mtx_lock(&bfs->vmo_lock);
+        uint32_t nrun = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (bfs->vmo == MX_HANDLE_INVALID) {
+                status[i] = ERR_BAD_STATE;
+            } else if ((status[i] = block_txn_check(bfs->ios, &bts[i], bfs->size)) == NO_ERROR) {
+                run[nrun] = bts[i];
+                run_from[nrun++] = i;
+            }
+        }
+        if (nrun > 0) {
+            block_txn_run(bfs->ios->dev, bfs->vmo, run, nrun, run_status);
+            for (uint32_t j = 0; j < nrun; j++) {
+                status[run_from[j]] = run_status[j];
+            }
+        }
+        mtx_unlock(&bfs->vmo_lock);
+
+        for (uint32_t i = 0; i < n; i++) {
+            block_fifo_response_t* r = &bfs->rsps[(rsp.head + i) & mask];
+            r->status = status[i];
+            r->reserved = 0;
+            r->cookie = cookies[i];
+        }
+        if (mx_fifo_op(bfs->rsp_fifo, MX_FIFO_OP_ADVANCE_HEAD, n, &rsp) < 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static ssize_t do_block_get_fifo(devhost_iostate_t* ios, const void* in_buf, size_t in_len,
+                                 void* out_buf, size_t out_len) {
+    if ((in_len < sizeof(block_get_fifo_args_t)) || (out_len < sizeof(block_fifo_t))) {
+        return ERR_INVALID_ARGS;
+    }
+    const block_get_fifo_args_t* args = in_buf;
+    uint32_t count = args->entries_count;
+    if ((count == 0) || (count > BLOCK_FIFO_MAX_ENTRIES) || (count & (count - 1))) {
+        return ERR_INVALID_ARGS;
+    }
+    // one fifo per open device
+    if (ios->block_fifo != NULL) {
+        return ERR_ALREADY_BOUND;
+    }
+
+    block_fifo_server_t* bfs;
+    if ((bfs = calloc(1, sizeof(*bfs))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    bfs->ios = ios;
+    bfs->count = count;
+    mtx_init(&bfs->vmo_lock, mtx_plain);
+
+    block_fifo_t* reply = out_buf;
+    memset(reply, 0, sizeof(*reply));
+    uint64_t rsp_offset = ROUNDUP(count * sizeof(block_fifo_request_t), PAGE_SIZE);
+    bfs->entries_size = rsp_offset + ROUNDUP(count * sizeof(block_fifo_response_t), PAGE_SIZE);
+
+    mx_status_t r;
+    if ((r = mx_vmo_create(bfs->entries_size, 0, &reply->entries_vmo)) < 0) {
+        goto fail;
+    }
+    if ((r = mx_vmar_map(mx_vmar_root_self(), 0, reply->entries_vmo, 0, bfs->entries_size,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &bfs->entries)) < 0) {
+        bfs->entries = 0;
+        goto fail;
+    }
+    bfs->reqs = (const void*)bfs->entries;
+    bfs->rsps = (void*)(bfs->entries + rsp_offset);
+    if (((r = mx_fifo_create(count, &bfs->req_fifo)) < 0) ||
+        ((r = mx_fifo_create(count, &bfs->rsp_fifo)) < 0) ||
+        ((r = mx_event_create(0, &bfs->stop)) < 0)) {
+        goto fail;
+    }
+    if (((r = mx_handle_duplicate(bfs->req_fifo, MX_FIFO_PRODUCER_RIGHTS, &reply->req_fifo)) < 0) ||
+        ((r = mx_handle_duplicate(bfs->rsp_fifo, MX_FIFO_CONSUMER_RIGHTS, &reply->rsp_fifo)) < 0)) {
+        goto fail;
+    }
+    reply->entries_count = count;
+    reply->rsp_offset = rsp_offset;
+
+    if (thrd_create_with_name(&bfs->thread, block_fifo_thread, bfs, "block-fifo") != thrd_success) {
+        r = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    ios->block_fifo = bfs;
+    return sizeof(*reply);
+
+fail:
+    if (reply->entries_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(reply->entries_vmo);
+    }
+    if (reply->req_fifo != MX_HANDLE_INVALID) {
+        mx_handle_close(reply->req_fifo);
+    }
+    if (reply->rsp_fifo != MX_HANDLE_INVALID) {
+        mx_handle_close(reply->rsp_fifo);
+    }
+    block_fifo_free(bfs);
+    return r;
+}
+
+static mx_status_t do_block_set_fifo_vmo(devhost_iostate_t* ios, const void* in_buf) {
+    mx_handle_t vmo = *(const mx_handle_t*)in_buf;
+    block_fifo_server_t* bfs = ios->block_fifo;
+    uint64_t size;
+    mx_status_t r;
+
+    if (bfs == NULL) {
+        r = ERR_BAD_STATE;
+        goto fail;
+    }
+    if ((r = mx_vmo_get_size(vmo, &size)) < 0) {
+        goto fail;
+    }
+    if (size == 0) {
+        r = ERR_INVALID_ARGS;
+        goto fail;
+    }
+
+    // once the batch running, if any, is done with the old VMO
+    mtx_lock(&bfs->vmo_lock);
+    mx_handle_t old_vmo = bfs->vmo;
+    bfs->vmo = vmo;
+    bfs->size = size;
+    mtx_unlock(&bfs->vmo_lock);
+
+    if (old_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(old_vmo);
+    }
+    return NO_ERROR;
+
+fail:
+    mx_handle_close(vmo);
+    return r;
+}
+
+static void block_fifo_stop(devhost_iostate_t* ios) {
+    block_fifo_server_t* bfs = ios->block_fifo;
+    if (bfs == NULL) {
+        return;
+    }
+    mx_object_signal(bfs->stop, 0, MX_EVENT_SIGNALED);
+    thrd_join(bfs->thread, NULL);
+    block_fifo_free(bfs);
+    ios->block_fifo = NULL;
+}
+
 static ssize_t do_ioctl(mx_device_t* dev, uint32_t op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len) {
     mx_status_t r;
     switch (op) {
@@ -229,6 +640,7 @@ static mx_status_t _devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh,
 
     switch (MXRIO_OP(msg->op)) {
     case MXRIO_CLOSE:
+        block_fifo_stop(ios);
         device_close(dev, ios->flags);
         *should_free_ios = true;
         return NO_ERROR;
@@ -396,6 +808,13 @@ static mx_status_t _devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh,
         memcpy(in_buf + sizeof(mx_handle_t), msg->data + sizeof(mx_handle_t),
                len - sizeof(mx_handle_t));
 
+        if (msg->arg2.op == IOCTL_BLOCK_TXN_VMO) {
+            return do_block_txn_vmo(dev, ios, in_buf, len);
+        }
+        if (msg->arg2.op == IOCTL_BLOCK_SET_FIFO_VMO) {
+            return do_block_set_fifo_vmo(ios, in_buf);
+        }
+
         mx_status_t r = do_ioctl(dev, msg->arg2.op, in_buf, len, msg->data, arg);
 
         if (r == ERR_NOT_SUPPORTED) {
@@ -414,7 +833,12 @@ static mx_status_t _devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh,
         char in_buf[MXIO_IOCTL_MAX_INPUT];
         memcpy(in_buf, msg->data, len);
 
-        mx_status_t r = do_ioctl(dev, msg->arg2.op, in_buf, len, msg->data, arg);
+        mx_status_t r;
+        if (msg->arg2.op == IOCTL_BLOCK_GET_FIFO) {
+            r = do_block_get_fifo(ios, in_buf, len, msg->data, arg);
+        } else {
+            r = do_ioctl(dev, msg->arg2.op, in_buf, len, msg->data, arg);
+        }
         if (r >= 0) {
             switch (IOCTL_KIND(msg->arg2.op)) {
             case IOCTL_KIND_GET_HANDLE:
@@ -444,10 +868,28 @@ static mx_status_t _devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh,
     }
 }
 
+// Requests are handled on several dispatcher threads. The dispatcher keeps
+// each handle's requests in order, and dev->rpc_lock keeps requests to one
+// device, across all of its connections, from running at once, so a slow
+// request only holds up the device it is for.
 mx_status_t devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
     devhost_iostate_t* ios = cookie;
     mx_status_t status;
     bool should_free_ios = false;
+
+    // devhost_remove() clears ios->dev with the DM lock held; the reference
+    // keeps the device around until its lock is dropped, even if this
+    // request closes the last connection to it
+    DM_LOCK();
+    mx_device_t* dev = ios->dev;
+    if (dev != NULL) {
+        dev_ref_acquire(dev);
+    }
+    DM_UNLOCK();
+
+    if (dev != NULL) {
+        mtx_lock(&dev->rpc_lock);
+    }
     mtx_lock(&ios->lock);
     // if ios->dev is NULL, this is the "root" iostate of the
     // device (where OPEN transactions are passed from devfs)
@@ -460,6 +902,12 @@ mx_status_t devhost_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         status = ERR_REMOTE_CLOSED;
     }
     mtx_unlock(&ios->lock);
+    if (dev != NULL) {
+        mtx_unlock(&dev->rpc_lock);
+        DM_LOCK();
+        dev_ref_release(dev);
+        DM_UNLOCK();
+    }
     // TODO(swetland): pretty sure we sometimes leak these.
     if (should_free_ios) {
         free(ios);
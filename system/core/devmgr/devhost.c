@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #include <ddk/device.h>
 #include <ddk/driver.h>
@@ -27,6 +28,9 @@
 
 #include "acpi.h"
 
+// threads handling rpc requests to the devhost's devices
+#define DEVHOST_RIO_THREADS 4
+
 static void devhost_io_init(void) {
     mx_handle_t h;
     if (mx_log_create(MX_LOG_FLAG_DEVICE, &h) < 0) {
@@ -278,7 +282,22 @@ __EXPORT int devhost_cmdline(int argc, char** argv) {
     return 0;
 }
 
+static int devhost_rio_thread(void* arg) {
+    mxio_dispatcher_run(devhost_rio_dispatcher);
+    return 0;
+}
+
 __EXPORT int devhost_start(void) {
+    devhost_drivers_loaded();
+    // the current thread makes up the rest of DEVHOST_RIO_THREADS
+    for (int i = 1; i < DEVHOST_RIO_THREADS; i++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, devhost_rio_thread, NULL, "devhost-rio") != thrd_success) {
+            printf("devhost: cannot start rio thread\n");
+            break;
+        }
+        thrd_detach(t);
+    }
     mxio_dispatcher_run(devhost_rio_dispatcher);
     printf("devhost: rio dispatcher exited?\n");
     return 0;
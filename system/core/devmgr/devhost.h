@@ -32,6 +32,10 @@
 
 // Safe external APIs are in device.h and device_internal.h
 
+// A driver known only from the note in its library, standing in for the
+// library's own driver until a device matches its binding program.
+#define DRV_FLAG_LAZY 0x80000000
+
 mx_status_t devhost_driver_add(mx_driver_t* driver);
 mx_status_t devhost_driver_remove(mx_driver_t* driver);
 mx_status_t devhost_driver_unbind(mx_driver_t* driver, mx_device_t* dev);
@@ -54,16 +58,30 @@ bool devhost_is_bindable_drv(mx_driver_t* drv, mx_device_t* dev);
 bool devhost_is_bindable_di(magenta_driver_info_t* di, mx_device_t* dev);
 bool devhost_is_bindable(magenta_driver_info_t* di, uint32_t protocol_id,
                          mx_device_prop_t* props, uint32_t prop_count);
+uint32_t devhost_get_bind_prop(mx_device_t* dev, uint32_t id);
+size_t devhost_get_bind_reqs(mx_driver_t* drv, mx_device_prop_t* reqs, size_t max);
+
+// called once all drivers are added, to report bind times when the binds
+// queued for them are done
+void devhost_drivers_loaded(void);
+
+// loads the library behind a DRV_FLAG_LAZY driver and initializes its
+// driver, the first time; returns that driver or NULL if it cannot be loaded
+mx_driver_t* devhost_load_driver(mx_driver_t* drv);
 
 mx_status_t devhost_load_firmware(mx_driver_t* drv, const char* path,
                                   mx_handle_t* fw, size_t* size);
 
+typedef struct block_fifo_server block_fifo_server_t;
+
 // shared between devhost.c and rpc-device.c
 typedef struct devhost_iostate {
     mx_device_t* dev;
     size_t io_off;
     uint32_t flags;
     mtx_t lock;
+    // set up by IOCTL_BLOCK_GET_FIFO
+    block_fifo_server_t* block_fifo;
 } devhost_iostate_t;
 
 devhost_iostate_t* create_devhost_iostate(mx_device_t* dev);
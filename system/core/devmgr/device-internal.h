@@ -12,6 +12,7 @@
 #define DEV_FLAG_BUSY           0x00000010  // device being created
 #define DEV_FLAG_INSTANCE       0x00000020  // this device was created-on-open
 #define DEV_FLAG_REBIND         0x00000040  // this device is being rebound
+#define DEV_FLAG_BINDING        0x00000080  // a bind worker is probing this device
 
 #define DEV_MAGIC 'MDEV'
 
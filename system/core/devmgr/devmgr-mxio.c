@@ -10,6 +10,7 @@
 #include <launchpad/launchpad.h>
 #include <launchpad/vmo.h>
 
+#include <magenta/bootdata.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 
@@ -35,13 +36,15 @@ struct bootfile {
 struct callback_data {
     mx_handle_t vmo;
     unsigned int file_count;
-    mx_status_t (*add_file)(const char* path, mx_handle_t vmo, mx_off_t off, size_t len);
+    bool compressed;
+    mx_status_t (*add_file)(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                            bool compressed);
 };
 
 static void callback(void* arg, const char* path, size_t off, size_t len) {
     struct callback_data* cd = arg;
     //printf("bootfs: %s @%zd (%zd bytes)\n", path, off, len);
-    cd->add_file(path, cd->vmo, off, len);
+    cd->add_file(path, cd->vmo, off, len, cd->compressed);
     ++cd->file_count;
 }
 
@@ -60,6 +63,8 @@ void devmgr_launch(mx_handle_t job,
         NULL
     };
 
+    devmgr_boot_mark("launch", name, false);
+
     mx_handle_t job_copy = MX_HANDLE_INVALID;;
     mx_handle_duplicate(job, MX_RIGHT_SAME_RIGHTS, &job_copy);
 
@@ -94,6 +99,7 @@ void devmgr_launch(mx_handle_t job,
     } else {
         printf("devmgr: launch %s (%s) OK\n", argv[0], name);
     }
+    devmgr_boot_mark("launch", name, true);
 }
 
 static bool has_secondary_bootfs = false;
@@ -106,8 +112,14 @@ static ssize_t setup_bootfs_vmo(unsigned int n, mx_handle_t vmo) {
     }
     if (size == 0)
         return 0;
+    // files compressed each are decompressed as they are first used
+    bootdata_t hdr;
+    size_t actual;
+    status = mx_vmo_read(vmo, &hdr, 0, sizeof(hdr), &actual);
     struct callback_data cd = {
         .vmo = vmo,
+        .compressed = (status == NO_ERROR) && (actual == sizeof(hdr)) &&
+                      (hdr.flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED_FILES),
         .add_file = (n > 0) ? systemfs_add_file : bootfs_add_file,
     };
     if (n > 0) {
@@ -275,6 +275,7 @@ int main(int argc, char** argv) {
     root_job_handle = mx_job_default();
 
     printf("devmgr: main()\n");
+    devmgr_boot_mark("devmgr", "init", false);
 
     char** e = environ;
     while (*e) {
@@ -316,6 +317,7 @@ int main(int argc, char** argv) {
         }
     }
 
+    devmgr_boot_mark("devmgr", "init", true);
     devmgr_handle_messages();
     printf("devmgr: message handler returned?!\n");
     return 0;
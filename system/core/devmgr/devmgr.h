@@ -11,6 +11,9 @@ void devmgr_init(mx_handle_t root_job);
 void devmgr_handle_messages(void);
 
 void devmgr_io_init(void);
+// Marks the beginning or end of a boot stage in the kernel trace, as the
+// probe "<kind>:<name>", where the boot timeline picks it up.
+void devmgr_boot_mark(const char* kind, const char* name, bool end);
 void devmgr_vfs_init(void);
 void devmgr_vfs_exit(void);
 void devmgr_launch(mx_handle_t job,
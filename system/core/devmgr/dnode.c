@@ -138,7 +138,24 @@ void dn_print_children(dnode_t* parent, int indent) {
     }
 }
 
-mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
+// Fill in one record for dn, with the attributes of its vnode if plus.
+static mx_status_t dn_fill_dirent(void* de, size_t len, dnode_t* dn,
+                                  const char* name, size_t namelen,
+                                  uint32_t vtype, bool plus) {
+    if (!plus) {
+        return vfs_fill_dirent(de, len, name, namelen, VTYPE_TO_DTYPE(vtype));
+    }
+    vnattr_t attr;
+    vnode_t* vn = (dn != NULL) ? dn->vnode : NULL;
+    if ((vn == NULL) || (vn->ops->getattr(vn, &attr) < 0)) {
+        memset(&attr, 0, sizeof(attr));
+        attr.mode = vtype;
+    }
+    return vfs_fill_dirent_plus(de, len, name, namelen, &attr);
+}
+
+static mx_status_t dn_readdir_common(dnode_t* parent, void* cookie, void* data, size_t len,
+                                     bool plus) {
     vdircookie_t* c = cookie;
     dnode_t* last = c->p;
     size_t pos = 0;
@@ -150,8 +167,7 @@ mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
     // Use 'c->p' to point to the last seen vnode.
     // Use 'c->n' to count the number of entries we've already returned.
     if (c->n == 0) {
-        r = vfs_fill_dirent((void*)(ptr + pos), len - pos, ".", 1,
-                            VTYPE_TO_DTYPE(V_TYPE_DIR));
+        r = dn_fill_dirent(ptr + pos, len - pos, parent, ".", 1, V_TYPE_DIR, plus);
         if (r < 0) {
             return pos;
         }
@@ -159,8 +175,7 @@ mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
         c->n++;
     }
     if (c->n == 1) {
-        r = vfs_fill_dirent((void*)(ptr + pos), len - pos, "..", 2,
-                            VTYPE_TO_DTYPE(V_TYPE_DIR));
+        r = dn_fill_dirent(ptr + pos, len - pos, parent->parent, "..", 2, V_TYPE_DIR, plus);
         if (r < 0) {
             return pos;
         }
@@ -175,9 +190,8 @@ mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
             }
         } else {
             uint32_t vtype = DNODE_IS_DIR(dn) ? V_TYPE_DIR : V_TYPE_FILE;
-            r = vfs_fill_dirent((void*)(ptr + pos), len - pos,
-                                dn->name, DN_NAME_LEN(dn->flags),
-                                VTYPE_TO_DTYPE(vtype));
+            r = dn_fill_dirent(ptr + pos, len - pos, dn,
+                               dn->name, DN_NAME_LEN(dn->flags), vtype, plus);
             if (r < 0) {
                 break;
             }
@@ -190,3 +204,11 @@ mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
     c->p = last;
     return pos;
 }
+
+mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
+    return dn_readdir_common(parent, cookie, data, len, false);
+}
+
+mx_status_t dn_readdir_plus(dnode_t* parent, void* cookie, void* data, size_t len) {
+    return dn_readdir_common(parent, cookie, data, len, true);
+}
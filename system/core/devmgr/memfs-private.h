@@ -20,6 +20,7 @@ typedef struct dnode dnode_t;
 #define MEMFS_TYPE_DEVICE 3
 #define MEMFS_TYPE_MASK 0x3
 #define MEMFS_FLAG_VMO_REUSE 4
+#define MEMFS_FLAG_VMO_COMPRESSED 8
 
 struct vnode {
     VNODE_BASE_FIELDS
@@ -36,8 +37,10 @@ struct vnode {
     list_node_t watch_list;
 
     mx_handle_t vmo;
-    mx_off_t length; // TYPE_VMO: Size of data within vmo. TYPE_DATA: Size of vmo
+    mx_off_t length; // TYPE_VMO: Size of data within vmo. TYPE_DATA: Size of file
     mx_off_t offset; // TYPE_VMO: Offset into vmo which contains data.
+    mx_off_t capacity; // TYPE_DATA: Size of vmo, whose contents past length are zero
+                       // TYPE_VMO, compressed: Size of the LZ4 frame at offset
 };
 
 typedef struct vnode_watcher {
@@ -57,6 +60,9 @@ mx_handle_t vfs_create_root_handle(vnode_t* vn);
 ssize_t vmo_read(vnode_t* vn, void* data, size_t len, size_t off);
 mx_status_t vmo_getattr(vnode_t* vn, vnattr_t* attr);
 void vmo_release(vnode_t* vn);
+// Decompresses a file added compressed into a VMO of its own, the first time
+// its contents are needed.
+mx_status_t vmo_inflate(vnode_t* vn);
 
 // device fs
 vnode_t* devfs_get_root(void);
@@ -65,11 +71,13 @@ mx_status_t devfs_remove(vnode_t* vn);
 
 // boot fs
 vnode_t* bootfs_get_root(void);
-mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len);
+mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                            bool compressed);
 
 // system fs
 vnode_t* systemfs_get_root(void);
-mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len);
+mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                              bool compressed);
 
 // memory fs
 vnode_t* memfs_get_root(void);
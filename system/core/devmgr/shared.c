@@ -12,6 +12,7 @@
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/log.h>
+#include <magenta/ktrace.h>
 #include <mxio/remoteio.h>
 #include <mxio/util.h>
 
@@ -37,6 +38,17 @@ void devmgr_io_init(void) {
     mxio_bind_to_fd(logger, 1, 0);
 }
 
+void devmgr_boot_mark(const char* kind, const char* name, bool end) {
+    // the kernel takes a whole name's worth of bytes, however short
+    char probe[MX_MAX_NAME_LEN] = {};
+    snprintf(probe, sizeof(probe), "%s:%s", kind, name);
+    mx_status_t id = mx_ktrace_control(get_root_resource(), KTRACE_ACTION_NEW_PROBE, 0, probe);
+    if (id < 0) {
+        return;
+    }
+    mx_ktrace_write(get_root_resource(), id, end ? 1 : 0, 0);
+}
+
 extern mx_handle_t application_launcher;
 
 void devmgr_launch_devhost(mx_handle_t job,
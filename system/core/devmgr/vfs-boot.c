@@ -5,6 +5,7 @@
 #include "dnode.h"
 #include "memfs-private.h"
 
+#include <bootdata/decompress.h>
 #include <fs/vfs.h>
 
 #include <magenta/listnode.h>
@@ -22,8 +23,11 @@
 
 
 mx_handle_t vfs_get_vmofile(vnode_t* vn, mx_off_t* off, mx_off_t* len) {
+    mx_status_t status = vmo_inflate(vn);
+    if (status < 0)
+        return status;
     mx_handle_t vmo;
-    mx_status_t status = mx_handle_duplicate(vn->vmo, MX_RIGHT_READ | MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER, &vmo);
+    status = mx_handle_duplicate(vn->vmo, MX_RIGHT_READ | MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER, &vmo);
     if (status < 0)
         return status;
     xprintf("vmofile: %x (%x) off=%" PRIu64 " len=%" PRIu64 "\n", vmo, vn->vmo, vn->offset, vn->length);
@@ -35,13 +39,40 @@ mx_handle_t vfs_get_vmofile(vnode_t* vn, mx_off_t* off, mx_off_t* len) {
 
 static mx_status_t _vnb_create(vnode_t* parent, vnode_t** out,
                                const char* name, size_t namelen,
-                               mx_handle_t h, mx_off_t off, size_t datalen) {
+                               mx_handle_t h, mx_off_t off, size_t datalen,
+                               bool compressed) {
     if (parent->dnode == NULL) {
         return ERR_NOT_DIR;
     }
 
+    // a compressed file is as big as its frame says, and only decompressed
+    // once it is used
+    uint64_t size = datalen;
+    if (datalen == 0) {
+        // an empty file is stored as nothing at all
+        compressed = false;
+    } else if (compressed) {
+        uint8_t frame[16];
+        size_t actual;
+        const char* errmsg;
+        mx_status_t r = mx_vmo_read(h, frame, off,
+                                    datalen < sizeof(frame) ? datalen : sizeof(frame), &actual);
+        if (r == NO_ERROR) {
+            r = lz4_frame_content_size(frame, actual, &size, &errmsg);
+            if (r < 0) {
+                printf("bootfs: '%.*s': %s", (int)namelen, name, errmsg);
+            }
+        }
+        if (r < 0) {
+            // the vmo is shared by every file of the bootfs, so keep it
+            return r;
+        }
+    }
+
     vnode_t* vnb;
-    mx_status_t r = _mem_create(parent, &vnb, name, namelen, MEMFS_TYPE_VMO|MEMFS_FLAG_VMO_REUSE);
+    mx_status_t r = _mem_create(parent, &vnb, name, namelen,
+                                MEMFS_TYPE_VMO | MEMFS_FLAG_VMO_REUSE |
+                                (compressed ? MEMFS_FLAG_VMO_COMPRESSED : 0));
     if (r < 0) {
         if (mx_handle_close(h) < 0) {
             printf("memfs_create_from_vmo: unexpected error closing handle\n");
@@ -51,9 +82,12 @@ static mx_status_t _vnb_create(vnode_t* parent, vnode_t** out,
     xprintf("vnb_create: vn=%p, parent=%p name='%.*s' datalen=%zd\n",
             vnb, parent, (int)namelen, name, datalen);
 
-    vnb->length = datalen;
+    vnb->length = size;
     vnb->vmo = h;
     vnb->offset = off;
+    if (compressed) {
+        vnb->capacity = datalen;
+    }
 
     if (h) {
         vnb->flags |= V_FLAG_VMOFILE;
@@ -89,7 +123,7 @@ static mx_status_t _vnb_mkdir(vnode_t* parent, vnode_t** out, const char* name,
 }
 
 static mx_status_t _add_file(vnode_t* vnb, const char* path, mx_handle_t vmo,
-                             mx_off_t off, size_t len) {
+                             mx_off_t off, size_t len, bool compressed) {
     mx_status_t r;
     if ((path[0] == '/') || (path[0] == 0))
         return ERR_INVALID_ARGS;
@@ -99,7 +133,7 @@ static mx_status_t _add_file(vnode_t* vnb, const char* path, mx_handle_t vmo,
             if (path[0] == 0) {
                 return ERR_INVALID_ARGS;
             }
-            return _vnb_create(vnb, &vnb, path, strlen(path), vmo, off, len);
+            return _vnb_create(vnb, &vnb, path, strlen(path), vmo, off, len, compressed);
         } else {
             if (nextpath == path)
                 return ERR_INVALID_ARGS;
@@ -112,11 +146,13 @@ static mx_status_t _add_file(vnode_t* vnb, const char* path, mx_handle_t vmo,
     }
 }
 
-mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len) {
-    return _add_file(bootfs_get_root(), path, vmo, off, len);
+mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                            bool compressed) {
+    return _add_file(bootfs_get_root(), path, vmo, off, len, compressed);
 }
 
-mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len) {
-    return _add_file(systemfs_get_root(), path, vmo, off, len);
+mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                              bool compressed) {
+    return _add_file(systemfs_get_root(), path, vmo, off, len, compressed);
 }
 
@@ -5,6 +5,7 @@
 #include "dnode.h"
 #include "memfs-private.h"
 
+#include <bootdata/decompress.h>
 #include <fs/vfs.h>
 
 #include <magenta/device/devmgr.h>
@@ -25,6 +26,8 @@
 
 #define MINFS_MAX_FILE_SIZE (8192 * 8192)
 
+#define ROUNDUP(a, b) (((a) + ((b)-1)) & ~((b)-1))
+
 mx_status_t mem_get_node(vnode_t** out, mx_device_t* dev);
 mx_status_t mem_can_unlink(dnode_t* dn);
 
@@ -63,27 +66,47 @@ static ssize_t mem_read(vnode_t* vn, void* data, size_t len, size_t off) {
     return actual;
 }
 
-static ssize_t mem_write(vnode_t* vn, const void* data, size_t len, size_t off) {
+// Makes the VMO behind a file at least len bytes.  It grows by whole pages,
+// at least doubling each time, so a run of small appends only resizes it
+// now and then; pages are only committed as they are written, in any case.
+static mx_status_t mem_reserve(vnode_t* vn, size_t len) {
+    if ((vn->vmo != MX_HANDLE_INVALID) && (len <= vn->capacity)) {
+        return NO_ERROR;
+    }
+    size_t capacity = ROUNDUP(len, PAGE_SIZE);
+    if (capacity < 2 * vn->capacity) {
+        capacity = 2 * vn->capacity;
+    }
+    if (capacity > ROUNDUP(MINFS_MAX_FILE_SIZE, PAGE_SIZE)) {
+        capacity = ROUNDUP(MINFS_MAX_FILE_SIZE, PAGE_SIZE);
+    }
     mx_status_t status;
-    size_t newlen = off + len;
-    newlen = newlen > MINFS_MAX_FILE_SIZE ? MINFS_MAX_FILE_SIZE : newlen;
-
-    // TODO(smklein): Round up to PAGE_SIZE increments to reduce overhead on a series of small
-    // writes.
     if (vn->vmo == MX_HANDLE_INVALID) {
         // First access to the file? Allocate it.
-        if ((status = mx_vmo_create(newlen, 0, &vn->vmo)) != NO_ERROR) {
-            return status;
-        }
-    } else if (newlen > vn->length) {
-        // Accessing beyond the end of the file? Extend it.
-        if ((status = mx_vmo_set_size(vn->vmo, newlen)) != NO_ERROR) {
+        if ((status = mx_vmo_create(capacity, 0, &vn->vmo)) != NO_ERROR) {
             return status;
         }
+    } else if ((status = mx_vmo_set_size(vn->vmo, capacity)) != NO_ERROR) {
+        return status;
     }
+    vn->capacity = capacity;
+    return NO_ERROR;
+}
 
-    size_t actual;
-    if ((status = mx_vmo_write(vn->vmo, data, off, len, &actual)) != NO_ERROR) {
+static ssize_t mem_write(vnode_t* vn, const void* data, size_t len, size_t off) {
+    mx_status_t status;
+    size_t newlen = off + len;
+    newlen = newlen > MINFS_MAX_FILE_SIZE ? MINFS_MAX_FILE_SIZE : newlen;
+
+    if ((status = mem_reserve(vn, newlen)) != NO_ERROR) {
+        return status;
+    }
+
+    // the vmo may be larger than the file, but the file may not grow past
+    // its maximum size
+    size_t actual = 0;
+    if ((off < newlen) &&
+        ((status = mx_vmo_write(vn->vmo, data, off, newlen - off, &actual)) != NO_ERROR)) {
         return status;
     }
 
@@ -101,32 +124,32 @@ mx_status_t memfs_truncate(vnode_t* vn, size_t len) {
     mx_status_t status;
     len = len > MINFS_MAX_FILE_SIZE ? MINFS_MAX_FILE_SIZE : len;
 
-    if (vn->vmo == MX_HANDLE_INVALID) {
-        // First access to the file? Allocate it.
-        if ((status = mx_vmo_create(len, 0, &vn->vmo)) != NO_ERROR) {
+    if (len > vn->length) {
+        // the file grows into zeros
+        if ((status = mem_reserve(vn, len)) != NO_ERROR) {
             return status;
         }
-    } else if ((len < vn->length) && (len % PAGE_SIZE != 0)) {
-        // TODO(smklein): Remove this case when the VMO system causes 'shrinking to a partial page'
-        // to fill the end of that page with zeroes.
-        //
-        // Currently, if the file is truncated to a 'partial page', an later re-expanded, then the
-        // partial page is *not necessarily* filled with zeroes. As a consequence, we manually must
-        // fill the portion between "len" and the next highest page (or vn->length, whichever
-        // is smaller) with zeroes.
-        char buf[PAGE_SIZE];
-        size_t ppage_size = PAGE_SIZE - (len % PAGE_SIZE);
-        ppage_size = len + ppage_size < vn->length ? ppage_size : vn->length - len;
-        memset(buf, 0, ppage_size);
-        size_t actual;
-        status = mx_vmo_write(vn->vmo, buf, len, ppage_size, &actual);
-        if ((status != NO_ERROR) || (actual != ppage_size)) {
-            return status != NO_ERROR ? ERR_IO : status;
-        } else if ((status = mx_vmo_set_size(vn->vmo, len)) != NO_ERROR) {
-            return status;
+    } else if (len < vn->length) {
+        // Keep the vmo zero past the end of the file, for it to grow into
+        // again: the pages wholly past the end are dropped, and the rest of
+        // the last page is cleared.
+        size_t keep = ROUNDUP(len, PAGE_SIZE);
+        size_t clear = (keep < vn->length ? keep : vn->length) - len;
+        if (clear > 0) {
+            char buf[PAGE_SIZE];
+            memset(buf, 0, clear);
+            size_t actual;
+            status = mx_vmo_write(vn->vmo, buf, len, clear, &actual);
+            if ((status != NO_ERROR) || (actual != clear)) {
+                return status != NO_ERROR ? status : ERR_IO;
+            }
+        }
+        if (keep < vn->capacity) {
+            if ((status = mx_vmo_set_size(vn->vmo, keep)) != NO_ERROR) {
+                return status;
+            }
+            vn->capacity = keep;
         }
-    } else if ((status = mx_vmo_set_size(vn->vmo, len)) != NO_ERROR) {
-        return status;
     }
 
     vn->length = len;
@@ -281,6 +304,13 @@ mx_status_t memfs_readdir(vnode_t* parent, void* cookie, void* data, size_t len)
     return dn_readdir(parent->dnode, cookie, data, len);
 }
 
+static mx_status_t memfs_readdir_plus(vnode_t* parent, void* cookie, void* data, size_t len) {
+    if (parent->dnode == NULL) {
+        return ERR_NOT_DIR;
+    }
+    return dn_readdir_plus(parent->dnode, cookie, data, len);
+}
+
 mx_status_t mem_readdir_none(vnode_t* parent, void* cookie, void* data, size_t len) {
     return ERR_NOT_SUPPORTED;
 }
@@ -374,9 +404,62 @@ void vmo_release(vnode_t* vn) {
     free(vn);
 }
 
+mx_status_t vmo_inflate(vnode_t* vn) {
+    if ((vn->memfs_flags & MEMFS_FLAG_VMO_COMPRESSED) == 0) {
+        return NO_ERROR;
+    }
+
+    mx_handle_t vmo;
+    mx_status_t r = mx_vmo_create(vn->length, 0, &vmo);
+    if (r < 0) {
+        return r;
+    }
+    size_t srclen = ROUNDUP(vn->capacity, PAGE_SIZE);
+    size_t dstlen = ROUNDUP(vn->length, PAGE_SIZE);
+    uintptr_t src = 0;
+    uintptr_t dst = 0;
+    if ((r = mx_vmar_map(mx_vmar_root_self(), 0, vn->vmo, vn->offset, srclen,
+                         MX_VM_FLAG_PERM_READ, &src)) < 0) {
+        goto done;
+    }
+    if ((dstlen > 0) &&
+        (r = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, dstlen,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &dst)) < 0) {
+        goto done;
+    }
+    const char* errmsg;
+    if ((r = lz4_frame_decompress((void*)src, vn->capacity, (void*)dst, vn->length,
+                                  &errmsg)) < 0) {
+        printf("memfs: cannot decompress file: %s", errmsg);
+    }
+
+done:
+    if (src) {
+        mx_vmar_unmap(mx_vmar_root_self(), src, srclen);
+    }
+    if (dst) {
+        mx_vmar_unmap(mx_vmar_root_self(), dst, dstlen);
+    }
+    if (r < 0) {
+        mx_handle_close(vmo);
+        return r;
+    }
+
+    // the file has a vmo of its own now, which goes with it
+    vn->vmo = vmo;
+    vn->offset = 0;
+    vn->capacity = 0;
+    vn->memfs_flags = (vn->memfs_flags & ~MEMFS_FLAG_VMO_COMPRESSED) | MEMFS_FLAG_VMO_REUSE;
+    return NO_ERROR;
+}
+
 ssize_t vmo_read(vnode_t* vn, void* data, size_t len, size_t off) {
     if (off > vn->length)
         return 0;
+    mx_status_t status = vmo_inflate(vn);
+    if (status < 0) {
+        return status;
+    }
     size_t rlen = vn->length - off;
     if (len > rlen)
         len = rlen;
@@ -400,6 +483,10 @@ static ssize_t vmo_write(vnode_t* vn, const void* data, size_t len, size_t off)
         // TODO(orr): grow vmo to support extending length
         return ERR_NOT_SUPPORTED;
     }
+    mx_status_t status = vmo_inflate(vn);
+    if (status < 0) {
+        return status;
+    }
     mx_status_t r = mx_vmo_write(vn->vmo, data, vn->offset+off, len, &rlen);
     if (r < 0) {
         return r;
@@ -407,6 +494,55 @@ static ssize_t vmo_write(vnode_t* vn, const void* data, size_t len, size_t off)
     return rlen;
 }
 
+#define GET_VMO_RIGHTS (MX_RIGHT_READ | MX_RIGHT_EXECUTE | MX_RIGHT_MAP | \
+                        MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_GET_PROPERTY)
+
+// Hands out a read-only copy-on-write clone of the part of vmo which
+// holds the len bytes at base + off.  Clone offsets must be page aligned,
+// so the data may start part way into the clone.
+static ssize_t clone_file_range(vnode_t* vn, mx_handle_t vmo, size_t base,
+                                size_t off, size_t len, mx_handle_t* out, size_t* vmo_off) {
+    mx_status_t status;
+    if (off > vn->length) {
+        off = vn->length;
+    }
+    if (len > vn->length - off) {
+        len = vn->length - off;
+    }
+
+    mx_handle_t clone;
+    if ((vmo == MX_HANDLE_INVALID) || (len == 0)) {
+        // nothing to share, an empty vmo will do
+        status = mx_vmo_create(0, 0, &clone);
+        *vmo_off = 0;
+    } else {
+        size_t start = (base + off) & ~(PAGE_SIZE - 1);
+        status = mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, start,
+                              base + off + len - start, &clone);
+        *vmo_off = base + off - start;
+    }
+    if (status != NO_ERROR) {
+        return status;
+    }
+    if ((status = mx_handle_replace(clone, GET_VMO_RIGHTS, out)) != NO_ERROR) {
+        mx_handle_close(clone);
+        return status;
+    }
+    return len;
+}
+
+static ssize_t mem_get_vmo(vnode_t* vn, size_t off, size_t len, mx_handle_t* out, size_t* vmo_off) {
+    return clone_file_range(vn, vn->vmo, 0, off, len, out, vmo_off);
+}
+
+static ssize_t vmo_get_vmo(vnode_t* vn, size_t off, size_t len, mx_handle_t* out, size_t* vmo_off) {
+    mx_status_t status = vmo_inflate(vn);
+    if (status < 0) {
+        return status;
+    }
+    return clone_file_range(vn, vn->vmo, vn->offset, off, len, out, vmo_off);
+}
+
 static void device_release(vnode_t* vn) {
     xprintf("devfs: vn %p destroyed\n", vn);
     if (vn->remote) {
@@ -443,6 +579,7 @@ static vnode_ops_t vn_mem_ops = {
     .truncate = memfs_truncate,
     .rename = mem_rename_none,
     .sync = memfs_sync,
+    .get_vmo = mem_get_vmo,
 };
 
 static vnode_ops_t vn_vmo_ops = {
@@ -459,6 +596,7 @@ static vnode_ops_t vn_vmo_ops = {
     .truncate = mem_truncate_none,
     .rename = mem_rename_none,
     .sync = memfs_sync,
+    .get_vmo = vmo_get_vmo,
 };
 
 static vnode_ops_t vn_mem_ops_dir = {
@@ -470,6 +608,7 @@ static vnode_ops_t vn_mem_ops_dir = {
     .lookup = memfs_lookup,
     .getattr = mem_getattr,
     .readdir = memfs_readdir,
+    .readdir_plus = memfs_readdir_plus,
     .create = mem_create,
     .unlink = memfs_unlink,
     .truncate = mem_truncate_none,
@@ -486,6 +625,7 @@ static vnode_ops_t vn_device_ops = {
     .lookup = memfs_lookup,
     .getattr = device_getattr,
     .readdir = memfs_readdir,
+    .readdir_plus = memfs_readdir_plus,
     .create = mem_create_none,
     .ioctl = memfs_ioctl,
     .unlink = mem_unlink_none,
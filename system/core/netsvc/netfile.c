@@ -49,6 +49,16 @@ static int netfile_mkdir(const char* filename) {
     }
 }
 
+// Puts the file at a block of a windowed transfer.
+static int netfile_seek(uint32_t blocknum) {
+    off_t offset = (off_t)blocknum * NB_WINDOW_BLOCK_SIZE;
+    if ((offset != netfile.offset) && (lseek(netfile.fd, offset, SEEK_SET) != offset)) {
+        return -1;
+    }
+    netfile.offset = offset;
+    return 0;
+}
+
 void netfile_open(const char *filename, uint32_t cookie, uint32_t arg,
                   const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
     nbmsg m;
@@ -64,6 +74,9 @@ void netfile_open(const char *filename, uint32_t cookie, uint32_t arg,
     }
     netfile.blocknum = 0;
     netfile.cookie = cookie;
+    netfile.windowed = (arg & NB_OPEN_WINDOW) != 0;
+    netfile.offset = 0;
+    arg &= ~NB_OPEN_WINDOW;
 
     struct stat st;
 again: // label here to catch filename=/path/to/new/directory/
@@ -95,6 +108,9 @@ again: // label here to catch filename=/path/to/new/directory/
         strlcpy(netfile.filename, filename, sizeof(netfile.filename));
     }
 
+    if (netfile.windowed) {
+        m.arg = NETFILE_WINDOW;
+    }
     udp6_send(&m, sizeof(m), saddr, sport, dport);
     return;
 err:
@@ -115,6 +131,23 @@ void netfile_read(uint32_t cookie, uint32_t arg,
         udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
         return;
     }
+    if (netfile.windowed) {
+        // any block, as the host asks again for those lost
+        ssize_t n;
+        if ((netfile_seek(arg) < 0) ||
+            ((n = read(netfile.fd, m.data, NB_WINDOW_BLOCK_SIZE)) < 0)) {
+            printf("netsvc: error reading '%s': %d\n", netfile.filename, errno);
+            m.hdr.arg = -errno;
+            close(netfile.fd);
+            netfile.fd = -1;
+            udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
+            return;
+        }
+        netfile.offset += n;
+        m.hdr.arg = arg;
+        udp6_send(&m, sizeof(m.hdr) + n, saddr, sport, dport);
+        return;
+    }
     if (arg == (netfile.blocknum - 1)) {
         // repeat of last block read, probably due to dropped packet
         // unless cookie doesn't match, in which case it's an error
@@ -162,6 +195,27 @@ void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
         return;
     }
 
+    if (netfile.windowed) {
+        // any block, as the host sends again those not acked: a repeat is
+        // written again, where it was
+        if ((len > NB_WINDOW_BLOCK_SIZE) || (netfile_seek(arg) < 0) ||
+            (write(netfile.fd, data, len) != (ssize_t)len)) {
+            printf("netsvc: error writing %s: %d\n", netfile.filename, errno);
+            m.arg = -errno;
+            if (m.arg == 0) {
+                m.arg = -EIO;
+            }
+            close(netfile.fd);
+            netfile.fd = -1;
+            udp6_send(&m, sizeof(m), saddr, sport, dport);
+            return;
+        }
+        netfile.offset += len;
+        m.arg = arg;
+        udp6_send(&m, sizeof(m), saddr, sport, dport);
+        return;
+    }
+
     if (arg == (netfile.blocknum - 1)) {
         // repeat of last block write, probably due to dropped packet
         // unless cookie doesn't match, in which case it's an error
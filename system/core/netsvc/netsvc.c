@@ -28,25 +28,37 @@
 
 static mx_handle_t loghandle;
 
+// records read from the log a batch at a time, each starting 8 byte aligned
+static uint64_t logbuf[8 * MX_LOG_RECORD_MAX / sizeof(uint64_t)];
+static size_t logbuf_off;
+static size_t logbuf_len;
+
 int get_log_line(char* out) {
-    char buf[MX_LOG_RECORD_MAX + 1];
-    mx_log_record_t* rec = (mx_log_record_t*)buf;
-    if (mx_log_read(loghandle, MX_LOG_RECORD_MAX, rec, 0) > 0) {
-        if (rec->datalen && (rec->data[rec->datalen - 1] == '\n')) {
-            rec->datalen--;
+    if (logbuf_off + sizeof(mx_log_record_t) > logbuf_len) {
+        mx_status_t r = mx_log_read(loghandle, sizeof(logbuf), logbuf, MX_LOG_FLAG_BATCH);
+        logbuf_off = 0;
+        logbuf_len = (r > 0) ? (size_t)r : 0;
+        if (logbuf_len < sizeof(mx_log_record_t)) {
+            return 0;
         }
-        rec->data[rec->datalen] = 0;
-        snprintf(out, MAX_LOG_LINE, "[%05d.%03d] %05" PRIu64 ".%05" PRIu64 "> %s\n",
-                 (int)(rec->timestamp / 1000000000ULL),
-                 (int)((rec->timestamp / 1000000ULL) % 1000ULL),
-                 rec->pid, rec->tid, rec->data);
-        return strlen(out);
-    } else {
-        return 0;
     }
+    mx_log_record_t* rec = (mx_log_record_t*)((char*)logbuf + logbuf_off);
+    logbuf_off += (sizeof(mx_log_record_t) + rec->datalen + 7) & ~7;
+
+    int datalen = rec->datalen;
+    if (datalen && (rec->data[datalen - 1] == '\n')) {
+        datalen--;
+    }
+    snprintf(out, MAX_LOG_LINE, "[%05d.%03d] %05" PRIu64 ".%05" PRIu64 "> %.*s\n",
+             (int)(rec->timestamp / 1000000000ULL),
+             (int)((rec->timestamp / 1000000ULL) % 1000ULL),
+             rec->pid, rec->tid, datalen, rec->data);
+    return strlen(out);
 }
 
-#define MAX_LOG_DATA 1280
+// Sized to fill an ethernet frame: udp6_send() does not go past ETH_MTU,
+// so links with a larger mtu still get packets of this size.
+#define MAX_LOG_DATA 1440
 
 typedef struct logpacket {
     uint32_t magic;
@@ -54,8 +66,53 @@ typedef struct logpacket {
     char data[MAX_LOG_DATA];
 } logpacket_t;
 
-static volatile uint32_t seqno = 1;
-static volatile uint32_t pending = 0;
+// Up to LOG_WINDOW packets are in flight at once.  The listener acks the
+// newest packet it has printed in order, and whatever is past that goes
+// out again once LOG_RESEND_MS pass without the window moving.
+#define LOG_WINDOW 8
+#define LOG_RESEND_MS 100
+
+typedef struct logslot {
+    logpacket_t pkt;
+    size_t len;
+} logslot_t;
+
+static logslot_t logwin[LOG_WINDOW];
+static uint32_t log_next;
+static volatile uint32_t log_acked = 0;
+static mx_time_t log_resend_at;
+
+// a line read from the log that did not fit in the last packet
+static char logline[MAX_LOG_LINE];
+static size_t logline_len;
+
+static size_t log_inflight(void) {
+    return log_next - log_acked - 1;
+}
+
+static size_t fill_log_packet(logpacket_t* pkt, size_t max) {
+    size_t len = 0;
+    for (;;) {
+        if (logline_len == 0) {
+            int r = get_log_line(logline);
+            if (r <= 0) {
+                break;
+            }
+            logline_len = r;
+        }
+        if ((len + logline_len) > max) {
+            break;
+        }
+        memcpy(pkt->data + len, logline, logline_len);
+        len += logline_len;
+        logline_len = 0;
+    }
+    return len;
+}
+
+static void send_log_packet(logslot_t* slot) {
+    udp6_send(&slot->pkt, 8 + slot->len, &ip6_ll_all_nodes, DEBUGLOG_PORT, DEBUGLOG_ACK_PORT);
+}
 
 static void run_program(const char *progname, int argc, const char** argv, mx_handle_t h) {
 
@@ -151,15 +208,18 @@ void udp6_recv(void* data, size_t len,
             return;
         }
         logpacket_t* pkt = data;
-        if ((pkt->magic != 0xaeae1123) || (pkt->seqno != seqno)) {
+        if (pkt->magic != 0xaeae1123) {
             return;
         }
-        if (pending) {
-            seqno++;
-            pending = 0;
-            // ensure we stop polling
-            netifc_set_timer(0);
+        // acks are cumulative; ignore any for packets already acked or not yet sent
+        uint32_t n = pkt->seqno - log_acked;
+        if ((n == 0) || (n > log_inflight())) {
+            return;
         }
+        log_acked = pkt->seqno;
+        log_resend_at = mx_time_get(MX_CLOCK_MONOTONIC) + MX_MSEC(LOG_RESEND_MS);
+        // stop polling so the window gets refilled
+        netifc_set_timer(0);
     }
 }
 
@@ -192,8 +252,8 @@ static int ipc_thread(void* arg) {
     return 0;
 }
 
-void netifc_recv(void* data, size_t len) {
-    eth_recv(data, len);
+void netifc_recv(void* data, size_t len, uint32_t flags) {
+    eth_recv(data, len, flags);
 
     if (ipc_handle) {
 #if FILTER_IPV6
@@ -207,8 +267,6 @@ void netifc_recv(void* data, size_t len) {
 }
 
 int main(int argc, char** argv) {
-    logpacket_t pkt;
-    int len = 0;
     if (mx_log_create(MX_LOG_FLAG_READABLE, &loghandle) < 0) {
         return -1;
     }
@@ -225,42 +283,53 @@ int main(int argc, char** argv) {
             ipc_handle = 0;
         }
     }
+
+    // start where a listener that heard our last run will not mistake
+    // our packets for ones it has already printed
+    size_t actual;
+    mx_cprng_draw(&log_next, sizeof(log_next), &actual);
+    log_acked = log_next - 1;
+
     for (;;) {
         if (netifc_open() != 0) {
             printf("netsvc: fatal error initializing network\n");
             return -1;
         }
 
+        uint8_t info[8];
+        netifc_get_info(info, (uint16_t*) (info + 6));
         if (ipc_handle) {
-            uint8_t info[8];
-            netifc_get_info(info, (uint16_t*) (info + 6));
             mx_channel_write(ipc_handle, 0, info, 8, NULL, 0);
         }
 
+        // as many lines as fit in one frame on this link
+        size_t mtu = *(uint16_t*) (info + 6);
+        size_t log_data_max = MAX_LOG_DATA;
+        if ((mtu > (IP6_HDR_LEN + UDP_HDR_LEN + 8 + MAX_LOG_LINE)) &&
+            ((mtu - (IP6_HDR_LEN + UDP_HDR_LEN + 8)) < log_data_max)) {
+            log_data_max = mtu - (IP6_HDR_LEN + UDP_HDR_LEN + 8);
+        }
+
         printf("netsvc: start\n");
         for (;;) {
-            if (pending == 0) {
-                pkt.magic = 0xaeae1123;
-                pkt.seqno = seqno;
-                len = 0;
-                while (len < (MAX_LOG_DATA - MAX_LOG_LINE)) {
-                    int r = get_log_line(pkt.data + len);
-                    if (r > 0) {
-                        len += r;
-                    } else {
-                        break;
-                    }
+            while (log_inflight() < LOG_WINDOW) {
+                logslot_t* slot = &logwin[log_next % LOG_WINDOW];
+                slot->len = fill_log_packet(&slot->pkt, log_data_max);
+                if (slot->len == 0) {
+                    break;
                 }
-                if (len) {
-                    pending = 1;
-                    goto transmit;
+                if (log_inflight() == 0) {
+                    log_resend_at = mx_time_get(MX_CLOCK_MONOTONIC) + MX_MSEC(LOG_RESEND_MS);
                 }
+                slot->pkt.magic = 0xaeae1123;
+                slot->pkt.seqno = log_next++;
+                send_log_packet(slot);
             }
-            if (netifc_timer_expired()) {
-            transmit:
-                if (pending) {
-                    udp6_send(&pkt, 8 + len, &ip6_ll_all_nodes, DEBUGLOG_PORT, DEBUGLOG_ACK_PORT);
+            if (log_inflight() && (mx_time_get(MX_CLOCK_MONOTONIC) >= log_resend_at)) {
+                for (uint32_t n = log_acked + 1; n != log_next; n++) {
+                    send_log_packet(&logwin[n % LOG_WINDOW]);
                 }
+                log_resend_at = mx_time_get(MX_CLOCK_MONOTONIC) + MX_MSEC(LOG_RESEND_MS);
             }
             //TODO: wakeup early for log traffic too
             netifc_set_timer(100);
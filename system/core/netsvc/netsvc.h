@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #include <inet6/inet6.h>
 
@@ -17,13 +19,21 @@ typedef struct netfile_state_t {
     uint32_t cookie;
     uint8_t  data[1024];
     size_t   datasize;
+    // NB_OPEN_WINDOW: blocks are read and written where they are, the file
+    // being at offset
+    bool     windowed;
+    off_t    offset;
 } netfile_state;
 
 extern netfile_state netfile;
 
+// blocks the host may have in flight, in a windowed transfer: what
+// arrives at once has to fit the rx fifo
+#define NETFILE_WINDOW 16
+
 typedef struct netfilemsg_t {
     nbmsg   hdr;
-    uint8_t data[1024];
+    uint8_t data[NB_WINDOW_BLOCK_SIZE];
 } netfilemsg;
 
 void netfile_open(const char* filename, uint32_t cookie, uint32_t arg,
@@ -7,7 +7,9 @@
 
 #pragma GCC visibility push(hidden)
 
+#include <bootdata/decompress.h>
 #include <magenta/bootdata.h>
+#include <magenta/bootfs.h>
 #include <magenta/syscalls.h>
 #include <string.h>
 
@@ -20,6 +22,8 @@ void bootfs_mount(mx_handle_t vmar, mx_handle_t log, mx_handle_t vmo, struct boo
     uintptr_t addr = 0;
     status = mx_vmar_map(vmar, 0, vmo, 0, size, MX_VM_FLAG_PERM_READ, &addr);
     check(log, status, "mx_vmar_map failed on bootfs vmo\n");
+    fs->vmar = vmar;
+    fs->vmo = vmo;
     fs->contents =  (const void*)addr;
     fs->len = size;
 }
@@ -35,7 +39,7 @@ void bootfs_unmount(mx_handle_t vmar, mx_handle_t log, mx_handle_t vmo, struct b
 
 struct bootfs_magic {
     bootdata_t boothdr;
-    char fsmagic[16];
+    bootfs_header_t fshdr;
 };
 
 struct bootfs_file {
@@ -47,10 +51,50 @@ struct bootfs_header {
     struct bootfs_file file;
 };
 
+static const struct bootfs_file bootfs_runt = { 0, 0 };
+
+// Looks the name up in the image's index of its records.
+static struct bootfs_file bootfs_lookup(mx_handle_t log,
+                                        struct bootfs *fs,
+                                        const bootfs_header_t* fshdr,
+                                        const char* filename,
+                                        size_t filename_len) {
+    uint32_t slots = fshdr->index_slots;
+    if ((slots & (slots - 1)) != 0 || fshdr->index_offset > fs->len ||
+        (fs->len - fshdr->index_offset) / sizeof(bootfs_index_slot_t) < slots)
+        fail(log, ERR_INVALID_ARGS, "bootfs has bogus index\n");
+    const uint8_t* index = &fs->contents[fshdr->index_offset];
+
+    uint32_t hash = bootfs_hash(filename, filename_len - 1);
+    for (uint32_t i = 0, n = hash & (slots - 1); i < slots;
+         i++, n = (n + 1) & (slots - 1)) {
+        bootfs_index_slot_t slot;
+        memcpy(&slot, &index[n * sizeof(slot)], sizeof(slot));
+        if (slot.dirent == 0)
+            break;
+        if (slot.hash != hash)
+            continue;
+
+        struct bootfs_header header;
+        if (slot.dirent > fs->len - sizeof(header))
+            fail(log, ERR_INVALID_ARGS, "bootfs has bogus index entry\n");
+        memcpy(&header, &fs->contents[slot.dirent], sizeof(header));
+        size_t left = fs->len - slot.dirent - sizeof(header);
+        if (header.namelen > left)
+            fail(log, ERR_INVALID_ARGS,
+                 "bootfs has bogus namelen in header\n");
+
+        const char* name = (const void*)&fs->contents[slot.dirent + sizeof(header)];
+        if (header.namelen == filename_len && !memcmp(name, filename, filename_len))
+            return header.file;
+    }
+
+    return bootfs_runt;
+}
+
 static struct bootfs_file bootfs_search(mx_handle_t log,
                                         struct bootfs *fs,
                                         const char* filename) {
-    static const char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
     size_t magic_size = sizeof(bootdata_t);
     if (fs->len < sizeof(struct bootfs_magic))
         fail(log, ERR_INVALID_ARGS, "bootfs image too small!\n");
@@ -59,14 +103,18 @@ static struct bootfs_file bootfs_search(mx_handle_t log,
         fail(log, ERR_INVALID_ARGS, "bootdata has bad magic number!\n");
     if (magic->boothdr.type != BOOTDATA_TYPE_BOOTFS)
         fail(log, ERR_INVALID_ARGS, "bootdata is not a bootfs!\n");
-    // This field is obsolete, so we can skip it if it doesn't exist.
-    if (!memcmp(magic->fsmagic, FSMAGIC, sizeof(FSMAGIC))) {
+
+    size_t filename_len = strlen(filename) + 1;
+
+    // Older images may lack the header, so we can skip it if it doesn't exist.
+    if (!memcmp(magic->fshdr.magic, BOOTFS_MAGIC, BOOTFS_MAGIC_LEN)) {
         magic_size = sizeof(struct bootfs_magic);
+        // Images without an index are walked, as below.
+        if (magic->fshdr.index_slots > 0)
+            return bootfs_lookup(log, fs, &magic->fshdr, filename, filename_len);
     }
     const uint8_t* p = &fs->contents[magic_size];
 
-    size_t filename_len = strlen(filename) + 1;
-
     while ((size_t)(p - fs->contents) < fs->len) {
         struct bootfs_header header;
         memcpy(&header, p, sizeof(header));
@@ -87,8 +135,43 @@ static struct bootfs_file bootfs_search(mx_handle_t log,
             return header.file;
     }
 
-    struct bootfs_file runt = { 0, 0 };
-    return runt;
+    return bootfs_runt;
+}
+
+// Decompresses a file of an image whose files are compressed each.
+static mx_handle_t bootfs_inflate(mx_handle_t log, struct bootfs *fs,
+                                  struct bootfs_file file) {
+    const uint8_t* src = &fs->contents[file.offset];
+    const char* errmsg;
+    uint64_t size = 0;
+    mx_status_t status;
+    if (file.size > 0) {
+        status = lz4_frame_content_size(src, file.size, &size, &errmsg);
+        if (status < 0)
+            fail(log, status, errmsg);
+    }
+    if (size > SIZE_MAX - 4095)
+        fail(log, ERR_INVALID_ARGS, "bogus content size in bootfs file\n");
+    size_t mapsize = (size + 4095) & ~4095;
+
+    mx_handle_t vmo;
+    status = mx_vmo_create(size, 0, &vmo);
+    if (status < 0)
+        fail(log, status, "mx_vmo_create failed\n");
+    if (size == 0)
+        return vmo;
+    uintptr_t addr;
+    status = mx_vmar_map(fs->vmar, 0, vmo, 0, mapsize,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr);
+    if (status < 0)
+        fail(log, status, "mx_vmar_map failed on bootfs file\n");
+    status = lz4_frame_decompress(src, file.size, (void*)addr, size, &errmsg);
+    if (status < 0)
+        fail(log, status, errmsg);
+    status = mx_vmar_unmap(fs->vmar, addr, mapsize);
+    if (status < 0)
+        fail(log, status, "mx_vmar_unmap failed\n");
+    return vmo;
 }
 
 mx_handle_t bootfs_open(mx_handle_t log,
@@ -103,16 +186,19 @@ mx_handle_t bootfs_open(mx_handle_t log,
     if (fs->len - file.offset < file.size)
         fail(log, ERR_INVALID_ARGS, "bogus size in bootfs header!\n");
 
+    const bootdata_t* boothdr = (const bootdata_t*)fs->contents;
+    if (boothdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED_FILES)
+        return bootfs_inflate(log, fs, file);
+
+    // Files start on page boundaries, so each one can share the image's
+    // pages through a clone rather than being copied out of it.
+    if (file.offset & 4095)
+        fail(log, ERR_INVALID_ARGS, "unaligned offset in bootfs header!\n");
     mx_handle_t vmo;
-    mx_status_t status = mx_vmo_create(file.size, 0, &vmo);
-    if (status < 0)
-        fail(log, status, "mx_vmo_create failed\n");
-    size_t n;
-    status = mx_vmo_write(vmo, &fs->contents[file.offset], 0, file.size, &n);
+    mx_status_t status = mx_vmo_clone(fs->vmo, MX_VMO_CLONE_COPY_ON_WRITE,
+                                      file.offset, file.size, &vmo);
     if (status < 0)
-        fail(log, status, "mx_vmo_write failed\n");
-    if (n != file.size)
-        fail(log, ERR_IO, "mx_vmo_write short write\n");
+        fail(log, status, "mx_vmo_clone failed\n");
 
     return vmo;
 }
@@ -11,6 +11,8 @@
 #include <stdint.h>
 
 struct bootfs {
+    mx_handle_t vmar;
+    mx_handle_t vmo;
     const uint8_t* contents;
     size_t len;
 };
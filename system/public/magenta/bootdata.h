@@ -17,6 +17,11 @@ __BEGIN_CDECLS;
 // Flag indicating that the bootfs is compressed.
 #define BOOTDATA_BOOTFS_FLAG_COMPRESSED  (1 << 0)
 
+// Flag indicating that each of the bootfs's files is compressed on its own,
+// so it can be decompressed when it is first used. The records and index
+// are not. See <magenta/bootfs.h>.
+#define BOOTDATA_BOOTFS_FLAG_COMPRESSED_FILES  (1 << 1)
+
 // Boot data header, describing the type and size of data used to initialize the
 // system. All fields are little-endian. Any changes to this struct must change
 // the magic number as well.
@@ -0,0 +1,67 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS;
+
+// BOOTFS is a trivial "filesystem" format
+//
+// Following its bootdata_t header, it has a 16 byte bootfs_header_t,
+// followed by a series of records of:
+//   namelength (32bit le)
+//   filesize   (32bit le)
+//   fileoffset (32bit le)
+//   namedata   (namelength bytes, includes \0)
+// ending with a record whose namelength is zero.
+//
+// An index may follow the records: a hash table of bootfs_index_slot_t,
+// which finds a record by name without walking those before it.
+//
+// - offsets are from the start of the image, its bootdata_t header
+// - fileoffsets must be page aligned (multiple of 4096)
+// - with BOOTDATA_BOOTFS_FLAG_COMPRESSED_FILES, a file's filesize bytes are
+//   an LZ4 frame, whose content size is the size of the file itself, or
+//   none at all for an empty file
+
+#define BOOTFS_MAGIC "[BOOTFS]"
+#define BOOTFS_MAGIC_LEN 8
+
+typedef struct {
+    char magic[BOOTFS_MAGIC_LEN];
+
+    // Offset of the index, if any
+    uint32_t index_offset;
+
+    // Number of slots in the index, a power of two, or zero if there
+    // is no index
+    uint32_t index_slots;
+} bootfs_header_t;
+
+// The index is open addressed: a name is at the first slot with its hash,
+// from slot (hash % index_slots) on, and missing if an empty slot is
+// reached first.
+typedef struct {
+    // bootfs_hash() of the name, without its \0
+    uint32_t hash;
+
+    // Offset of the record, or zero for an empty slot
+    uint32_t dirent;
+} bootfs_index_slot_t;
+
+// FNV-1a
+static inline uint32_t bootfs_hash(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+__END_CDECLS;
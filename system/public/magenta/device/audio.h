@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <magenta/device/ioctl.h>
+#include <magenta/types.h>
 #include <magenta/device/ioctl-wrapper.h>
 
 __BEGIN_CDECLS
@@ -48,6 +49,34 @@ enum {
 // called with no arguments
 #define IOCTL_AUDIO_STOP                    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_AUDIO, 7)
 
+// sets how many 1ms frames of audio a sink keeps queued to the hardware
+// ahead of what is playing; fewer means lower latency, but less slack before
+// late writes cause dropouts
+// call with in_len = sizeof(uint32_t)
+#define IOCTL_AUDIO_SET_QUEUE_FRAMES        IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_AUDIO, 8)
+
+// returns a VMO holding a ring buffer the client maps and moves audio
+// through in place of write() or read(); it starts with an
+// audio_ring_buffer_t, with the ring itself at data_offset
+// a sink plays the ring round and round from position once started, so
+// the client keeps its writes ahead of position; a source fills it, and
+// the client reads behind position
+// must be called before IOCTL_AUDIO_START; read() and write() fail with
+// ERR_BAD_STATE from then until the device is closed
+// call with in_len = sizeof(uint32_t) (ring size in bytes, rounded down
+// to whole audio frames) and out_len = sizeof(mx_handle_t)
+#define IOCTL_AUDIO_GET_RING_BUFFER         IOCTL(IOCTL_KIND_GET_HANDLE, IOCTL_FAMILY_AUDIO, 9)
+
+typedef struct audio_ring_buffer {
+    // bytes a sink has taken from the ring, or a source has put in it,
+    // since the ring was created; the ring offset is position % size
+    volatile uint64_t position;
+    // size of the ring in bytes, a multiple of the audio frame size
+    uint32_t size;
+    // where the ring starts in the VMO
+    uint32_t data_offset;
+} audio_ring_buffer_t;
+
 IOCTL_WRAPPER_OUT(ioctl_audio_get_device_type, IOCTL_AUDIO_GET_DEVICE_TYPE, int);
 IOCTL_WRAPPER_OUT(ioctl_audio_get_sample_rate_count, IOCTL_AUDIO_GET_SAMPLE_RATE_COUNT, int);
 IOCTL_WRAPPER_VAROUT(ioctl_audio_get_sample_rates, IOCTL_AUDIO_GET_SAMPLE_RATES, uint32_t);
@@ -55,5 +84,7 @@ IOCTL_WRAPPER_OUT(ioctl_audio_get_sample_rate, IOCTL_AUDIO_GET_SAMPLE_RATE, uint
 IOCTL_WRAPPER_IN(ioctl_audio_set_sample_rate, IOCTL_AUDIO_SET_SAMPLE_RATE, uint32_t);
 IOCTL_WRAPPER(ioctl_audio_start, IOCTL_AUDIO_START);
 IOCTL_WRAPPER(ioctl_audio_stop, IOCTL_AUDIO_STOP);
+IOCTL_WRAPPER_IN(ioctl_audio_set_queue_frames, IOCTL_AUDIO_SET_QUEUE_FRAMES, uint32_t);
+IOCTL_WRAPPER_INOUT(ioctl_audio_get_ring_buffer, IOCTL_AUDIO_GET_RING_BUFFER, uint32_t, mx_handle_t);
 
 __END_CDECLS
@@ -4,8 +4,10 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <magenta/device/ioctl.h>
 #include <magenta/device/ioctl-wrapper.h>
+#include <magenta/types.h>
 
 #define IOCTL_BLOCK_GET_SIZE \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 1)
@@ -21,6 +23,42 @@
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 6)
 #define IOCTL_BLOCK_RAMDISK_CONFIG \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 7)
+// Runs a batch of reads and writes between the device and a VMO
+//   in: block_txn_batch_t, starting with the VMO handle
+//   out: none
+#define IOCTL_BLOCK_TXN_VMO \
+    IOCTL(IOCTL_KIND_SET_HANDLE, IOCTL_FAMILY_BLOCK, 8)
+// Sets up rings for queueing requests to the device, see block_fifo_t
+//   in: block_get_fifo_args_t
+//   out: block_fifo_t
+#define IOCTL_BLOCK_GET_FIFO \
+    IOCTL(IOCTL_KIND_GET_THREE_HANDLES, IOCTL_FAMILY_BLOCK, 9)
+// Sets the VMO that requests queued through the fifo read into and write from
+//   in: mx_handle_t representing a VMO
+//   out: none
+#define IOCTL_BLOCK_SET_FIFO_VMO \
+    IOCTL(IOCTL_KIND_SET_HANDLE, IOCTL_FAMILY_BLOCK, 10)
+// Sets how the block scheduler (the "sched" driver) handles requests
+//   in: block_sched_config_t
+//   out: none
+#define IOCTL_BLOCK_SET_SCHED_CONFIG \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 11)
+// Returns how the block scheduler handles requests
+//   in: none
+//   out: block_sched_config_t
+#define IOCTL_BLOCK_GET_SCHED_CONFIG \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 12)
+// Returns a handle to the VMO holding a ramdisk's blocks, to map them
+//   in: none
+//   out: mx_handle_t
+#define IOCTL_BLOCK_RAMDISK_GET_VMO \
+    IOCTL(IOCTL_KIND_GET_HANDLE, IOCTL_FAMILY_BLOCK, 13)
+// Returns the partition table of the disk a partition is on, as read when
+// the disk was bound, so it need not be read from the disk again
+//   in: none
+//   out: block_partition_table_t, followed by its entries
+#define IOCTL_BLOCK_GET_PARTITION_TABLE \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 14)
 
 // ssize_t ioctl_block_get_size(int fd, uint64_t* out);
 IOCTL_WRAPPER_OUT(ioctl_block_get_size, IOCTL_BLOCK_GET_SIZE, uint64_t);
@@ -40,10 +78,152 @@ IOCTL_WRAPPER_VAROUT(ioctl_block_get_name, IOCTL_BLOCK_GET_NAME, char);
 // ssize_t ioctl_block_rr_part(int fd);
 IOCTL_WRAPPER(ioctl_block_rr_part, IOCTL_BLOCK_RR_PART);
 
+typedef struct block_partition_entry {
+    uint8_t type[16];
+    uint8_t guid[16];
+    // in blocks, both inclusive
+    uint64_t first_block;
+    uint64_t last_block;
+    uint64_t flags;
+    // of the entry in the table on disk
+    uint32_t index;
+    uint32_t reserved;
+    // UTF-16LE, as on disk
+    uint8_t name[72];
+} block_partition_entry_t;
+
+// Only the entries in use are returned, in the order of the table on disk.
+typedef struct block_partition_table {
+    uint64_t block_size;
+    uint8_t disk_guid[16];
+    // the entry describing the partition asked
+    uint32_t self;
+    uint32_t count;
+    block_partition_entry_t entries[];
+} block_partition_table_t;
+
+// ssize_t ioctl_block_get_partition_table(int fd, block_partition_table_t* out, size_t out_len);
+IOCTL_WRAPPER_VAROUT(ioctl_block_get_partition_table, IOCTL_BLOCK_GET_PARTITION_TABLE,
+                     block_partition_table_t);
+
 typedef struct ramdisk_ioctl_config {
     uint64_t blk_size;
     uint64_t blk_count;
+    uint32_t flags;
+    uint32_t reserved;
 } ramdisk_ioctl_config_t;
 
+// Commit (and lock) all of the ramdisk's memory up front, rather than a
+// page at a time as the blocks are first written
+#define RAMDISK_FLAG_COMMIT (1u << 0)
+
+// The VMO handle IOCTL_BLOCK_RAMDISK_GET_VMO returns may be mapped to read
+// the ramdisk's blocks in place.  Only if the ramdisk was created with
+// RAMDISK_FLAG_COMMIT may it also be mapped to write them: its memory is
+// then locked, so it cannot be resized or decommitted from under the
+// device.  Writes through a mapping are seen at once by reads through the
+// device, and the other way around.
+
+#define BLOCK_TXN_OP_READ  1
+#define BLOCK_TXN_OP_WRITE 2
+
+typedef struct block_txn {
+    uint32_t opcode;
+    uint32_t reserved;
+    uint64_t vmo_offset;
+    uint64_t dev_offset;
+    uint64_t length;
+} block_txn_t;
+
+#define BLOCK_TXN_MAX 31
+
+// All requests in a batch are queued to the device together and may
+// complete in any order, so a batch should not both read and write the
+// same blocks.  Requests that follow on from the one before, on the
+// device and in the VMO, are merged.  The ioctl returns once every
+// request is done, with the first error seen, if any.
+typedef struct block_txn_batch {
+    mx_handle_t vmo;
+    uint32_t count;
+    block_txn_t txns[BLOCK_TXN_MAX];
+} block_txn_batch_t;
+
+// size of a batch holding n requests
+#define BLOCK_TXN_BATCH_SIZE(n) \
+    (sizeof(block_txn_batch_t) - (BLOCK_TXN_MAX - (n)) * sizeof(block_txn_t))
+
+// ssize_t ioctl_block_txn_vmo(int fd, const block_txn_batch_t* in, size_t in_len);
+IOCTL_WRAPPER_VARIN(ioctl_block_txn_vmo, IOCTL_BLOCK_TXN_VMO, block_txn_batch_t);
+
+// The fifo keeps requests in flight without a round trip each.  A ring of
+// requests and a ring of responses share entries_vmo, the requests first,
+// at offset 0, and the responses at rsp_offset.  The client produces requests into req_fifo, and
+// consumes the responses from rsp_fifo, with mx_fifo_op(), using entry
+// (index & (entries_count - 1)) of each ring.
+//
+// The device takes all the requests queued at once as a batch, as with
+// IOCTL_BLOCK_TXN_VMO, and responds to them together once they are done,
+// in the order they were queued.  Requests may be queued while a batch
+// runs, as there is room in the response ring for them.
+typedef struct block_fifo_request {
+    block_txn_t txn;
+    // returned in the response
+    uint64_t cookie;
+} block_fifo_request_t;
+
+typedef struct block_fifo_response {
+    mx_status_t status;
+    uint32_t reserved;
+    uint64_t cookie;
+} block_fifo_response_t;
+
+// entries_count must be a power of two, at most BLOCK_FIFO_MAX_ENTRIES
+#define BLOCK_FIFO_MAX_ENTRIES 1024
+
+typedef struct block_get_fifo_args {
+    uint32_t entries_count;
+} block_get_fifo_args_t;
+
+typedef struct block_fifo {
+    mx_handle_t entries_vmo;
+    mx_handle_t req_fifo;
+    mx_handle_t rsp_fifo;
+    uint32_t entries_count;
+    // where the response ring starts in entries_vmo
+    uint64_t rsp_offset;
+} block_fifo_t;
+
+// ssize_t ioctl_block_get_fifo(int fd, const block_get_fifo_args_t* in, block_fifo_t* out);
+IOCTL_WRAPPER_INOUT(ioctl_block_get_fifo, IOCTL_BLOCK_GET_FIFO, block_get_fifo_args_t, block_fifo_t);
+
+// ssize_t ioctl_block_set_fifo_vmo(int fd, const mx_handle_t* in);
+IOCTL_WRAPPER_IN(ioctl_block_set_fifo_vmo, IOCTL_BLOCK_SET_FIFO_VMO, mx_handle_t);
+
+// The block scheduler holds requests while the device is busy, issues
+// them in order of offset, sweeping upwards, and merges those that follow
+// on from each other.  A request that has waited deadline_ms goes next,
+// whatever its offset.  Requests from a client (a thread queueing them)
+// beyond client_depth wait their turn, so one client cannot fill the queue.
+typedef struct block_sched_config {
+    // largest request built by merging, in bytes, or zero not to merge
+    uint32_t max_merge;
+    uint32_t deadline_ms;
+    // requests a client may have queued or in flight, or zero for no limit
+    uint32_t client_depth;
+    // requests issued to the device at once, at least one
+    uint32_t device_depth;
+} block_sched_config_t;
+
+#define BLOCK_SCHED_MAX_MERGE (1024 * 1024)
+
+// ssize_t ioctl_block_set_sched_config(int fd, const block_sched_config_t* in);
+IOCTL_WRAPPER_IN(ioctl_block_set_sched_config, IOCTL_BLOCK_SET_SCHED_CONFIG, block_sched_config_t);
+
+// ssize_t ioctl_block_get_sched_config(int fd, block_sched_config_t* out);
+IOCTL_WRAPPER_OUT(ioctl_block_get_sched_config, IOCTL_BLOCK_GET_SCHED_CONFIG, block_sched_config_t);
+
 // ssize_t ioctl_block_ramdisk_config(int fd, const ramdisk_ioctl_config_t* in);
 IOCTL_WRAPPER_IN(ioctl_block_ramdisk_config, IOCTL_BLOCK_RAMDISK_CONFIG, ramdisk_ioctl_config_t);
+
+// ssize_t ioctl_block_ramdisk_get_vmo(int fd, mx_handle_t* out);
+IOCTL_WRAPPER_OUT(ioctl_block_ramdisk_get_vmo, IOCTL_BLOCK_RAMDISK_GET_VMO, mx_handle_t);
@@ -33,6 +33,17 @@
 #define IOCTL_ETHERNET_SET_IO_BUF \
     IOCTL(IOCTL_KIND_SET_HANDLE, IOCTL_FAMILY_ETH, 3)
 
+// An entry names a packet buffer in the VMO set with IOCTL_ETHERNET_SET_IO_BUF,
+// by its offset into the rx or tx region. The buffer belongs to the driver
+// from when the entry is queued (the fifo head passes it) until it is
+// returned (the tail does), so that the driver may have the hardware read
+// and write it directly:
+// - an rx entry may come back naming another of the rx buffers the client
+//   gave the driver, with the length of the packet now in it
+// - a tx entry comes back once its packet is sent, and its buffer may not
+//   be written until then
+// Drivers write packets straight to rx buffers of at least their MTU that do
+// not cross a page boundary, and when the regions are page aligned.
 typedef struct eth_fifo_entry {
     uint32_t offset;
     uint16_t length;
@@ -40,6 +51,10 @@ typedef struct eth_fifo_entry {
     uint64_t cookie;
 } eth_fifo_entry_t;
 
+// rx entry flags, set by the driver: the hardware verified the packet's
+// TCP or UDP checksum, so the client need not
+#define ETH_FIFO_RX_CSUM_OK (1u << 0)
+
 typedef struct eth_fifo {
     mx_handle_t entries_vmo;
     mx_handle_t rx_fifo;
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <magenta/device/ioctl.h>
 #include <magenta/device/ioctl-wrapper.h>
+#include <magenta/types.h>
 
 #define IOCTL_INPUT_GET_PROTOCOL \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_INPUT, 0)
@@ -26,6 +27,8 @@
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_INPUT, 7)
 #define IOCTL_INPUT_SET_REPORT \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_INPUT, 8)
+#define IOCTL_INPUT_SET_READ_MODE \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_INPUT, 9)
 
 enum {
     INPUT_PROTO_NONE = 0,
@@ -39,6 +42,22 @@ enum {
     INPUT_REPORT_FEATURE = 3,
 };
 
+// With INPUT_READ_SINGLE (the default) each read() returns one report. With
+// INPUT_READ_BATCHED a read() returns as many of the pending reports as fit,
+// each preceded by an input_report_hdr_t. Changing the mode discards any
+// reports not yet read.
+enum {
+    INPUT_READ_SINGLE = 0,
+    INPUT_READ_BATCHED = 1,
+};
+
+typedef struct input_report_hdr {
+    // when the driver received the report, on the monotonic clock
+    mx_time_t time;
+    // bytes of report data that follow, including any report id
+    uint16_t len;
+} __attribute__((packed)) input_report_hdr_t;
+
 typedef uint8_t input_report_id_t;
 typedef uint8_t input_report_type_t;
 typedef uint16_t input_report_size_t;
@@ -103,3 +122,6 @@ IOCTL_WRAPPER_IN_VAROUT(ioctl_input_get_report, IOCTL_INPUT_GET_REPORT,
 
 // ssize_t ioctl_input_set_report(int fd, const input_set_report_t* in, size_t in_len);
 IOCTL_WRAPPER_VARIN(ioctl_input_set_report, IOCTL_INPUT_SET_REPORT, input_set_report_t);
+
+// ssize_t ioctl_input_set_read_mode(int fd, const uint32_t* in);
+IOCTL_WRAPPER_IN(ioctl_input_set_read_mode, IOCTL_INPUT_SET_READ_MODE, uint32_t);
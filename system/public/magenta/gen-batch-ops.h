@@ -0,0 +1,12 @@
+// Copyright 2026 The Fuchsia Authors. All rights reserved.
+// This is a GENERATED file. The license governing this file can be found in the LICENSE file.
+
+#define MX_BATCH_OP_handle_close 7
+#define MX_BATCH_OP_object_signal 12
+#define MX_BATCH_OP_object_signal_peer 13
+#define MX_BATCH_OP_channel_write 21
+#define MX_BATCH_OP_socket_write 26
+#define MX_BATCH_OP_port_queue 56
+#define MX_BATCH_OP_vmo_read 62
+#define MX_BATCH_OP_vmo_write 63
+
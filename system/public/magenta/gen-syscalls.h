@@ -1,4 +1,4 @@
-// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Copyright 2026 The Fuchsia Authors. All rights reserved.
 // This is a GENERATED file. The license governing this file can be found in the LICENSE file.
 
 extern mx_time_t mx_time_get(
@@ -221,6 +221,32 @@ extern mx_status_t _mx_channel_write(
     const mx_handle_t handles[],
     uint32_t num_handles) __attribute__((__leaf__));
 
+extern mx_status_t mx_channel_read_many(
+    mx_handle_t handle,
+    uint32_t options,
+    mx_channel_msg_t msgs[],
+    uint32_t count,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_channel_read_many(
+    mx_handle_t handle,
+    uint32_t options,
+    mx_channel_msg_t msgs[],
+    uint32_t count,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
+extern mx_status_t mx_channel_write_many(
+    uint32_t options,
+    const mx_channel_msg_t msgs[],
+    uint32_t count,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_channel_write_many(
+    uint32_t options,
+    const mx_channel_msg_t msgs[],
+    uint32_t count,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
 extern mx_status_t mx_channel_call(
     mx_handle_t handle,
     uint32_t options,
@@ -277,6 +303,16 @@ extern mx_status_t _mx_socket_read(
     size_t size,
     size_t actual[1]) __attribute__((__leaf__));
 
+extern mx_status_t mx_socket_get_ring(
+    mx_handle_t handle,
+    uint32_t options,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_socket_get_ring(
+    mx_handle_t handle,
+    uint32_t options,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
 extern void mx_thread_exit(void) __attribute__((__leaf__)) __attribute__((__noreturn__));
 
 extern void _mx_thread_exit(void) __attribute__((__leaf__)) __attribute__((__noreturn__));
@@ -335,6 +371,18 @@ extern mx_status_t _mx_thread_write_state(
     const void* buffer,
     uint32_t buffer_len) __attribute__((__leaf__));
 
+extern mx_status_t mx_thread_set_deadline(
+    mx_handle_t rsrc_handle,
+    mx_handle_t handle,
+    mx_time_t runtime,
+    mx_time_t period) __attribute__((__leaf__));
+
+extern mx_status_t _mx_thread_set_deadline(
+    mx_handle_t rsrc_handle,
+    mx_handle_t handle,
+    mx_time_t runtime,
+    mx_time_t period) __attribute__((__leaf__));
+
 extern void mx_process_exit(
     int retcode) __attribute__((__leaf__)) __attribute__((__noreturn__));
 
@@ -411,6 +459,28 @@ extern mx_status_t _mx_job_create(
     uint32_t options,
     mx_handle_t out[1]) __attribute__((__leaf__));
 
+extern mx_status_t mx_job_set_cpu_limits(
+    mx_handle_t job,
+    uint32_t weight,
+    mx_time_t period,
+    mx_time_t quota) __attribute__((__leaf__));
+
+extern mx_status_t _mx_job_set_cpu_limits(
+    mx_handle_t job,
+    uint32_t weight,
+    mx_time_t period,
+    mx_time_t quota) __attribute__((__leaf__));
+
+extern mx_status_t mx_job_set_memory_limits(
+    mx_handle_t job,
+    uint64_t soft_limit,
+    uint64_t hard_limit) __attribute__((__leaf__));
+
+extern mx_status_t _mx_job_set_memory_limits(
+    mx_handle_t job,
+    uint64_t soft_limit,
+    uint64_t hard_limit) __attribute__((__leaf__));
+
 extern mx_status_t mx_task_resume(
     mx_handle_t task_handle,
     uint32_t options) __attribute__((__leaf__));
@@ -453,6 +523,18 @@ extern mx_status_t _mx_futex_wait(
     int current_value,
     mx_time_t timeout) __attribute__((__leaf__));
 
+extern mx_status_t mx_futex_wait_pi(
+    mx_futex_t value_ptr[1],
+    int current_value,
+    mx_handle_t owner,
+    mx_time_t timeout) __attribute__((__leaf__));
+
+extern mx_status_t _mx_futex_wait_pi(
+    mx_futex_t value_ptr[1],
+    int current_value,
+    mx_handle_t owner,
+    mx_time_t timeout) __attribute__((__leaf__));
+
 extern mx_status_t mx_futex_wake(
     mx_futex_t value_ptr[1],
     uint32_t count) __attribute__((__leaf__));
@@ -545,6 +627,22 @@ extern mx_status_t _mx_port_wait(
     void* packet,
     size_t size) __attribute__((__leaf__));
 
+extern mx_status_t mx_port_wait_many(
+    mx_handle_t handle,
+    mx_time_t timeout,
+    void* packets,
+    size_t size,
+    size_t packet_size,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_port_wait_many(
+    mx_handle_t handle,
+    mx_time_t timeout,
+    void* packets,
+    size_t size,
+    size_t packet_size,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
 extern mx_status_t mx_port_bind(
     mx_handle_t handle,
     uint64_t key,
@@ -557,6 +655,18 @@ extern mx_status_t _mx_port_bind(
     mx_handle_t source,
     mx_signals_t signals) __attribute__((__leaf__));
 
+extern mx_status_t mx_batch_submit(
+    mx_handle_t ring,
+    mx_handle_t port,
+    uint32_t max_ops,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_batch_submit(
+    mx_handle_t ring,
+    mx_handle_t port,
+    uint32_t max_ops,
+    uint32_t actual[1]) __attribute__((__leaf__));
+
 extern mx_status_t mx_vmo_create(
     uint64_t size,
     uint32_t options,
@@ -627,6 +737,34 @@ extern mx_status_t _mx_vmo_op_range(
     void* buffer,
     size_t buffer_size) __attribute__((__leaf__));
 
+extern mx_status_t mx_vmo_clone(
+    mx_handle_t handle,
+    uint32_t options,
+    uint64_t offset,
+    uint64_t size,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_vmo_clone(
+    mx_handle_t handle,
+    uint32_t options,
+    uint64_t offset,
+    uint64_t size,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
+extern mx_status_t mx_vmo_move_pages(
+    mx_handle_t handle,
+    uint64_t offset,
+    mx_handle_t src_handle,
+    uint64_t src_offset,
+    uint64_t len) __attribute__((__leaf__));
+
+extern mx_status_t _mx_vmo_move_pages(
+    mx_handle_t handle,
+    uint64_t offset,
+    mx_handle_t src_handle,
+    uint64_t src_offset,
+    uint64_t len) __attribute__((__leaf__));
+
 extern mx_status_t mx_cprng_draw(
     void* buffer,
     size_t len,
@@ -665,6 +803,14 @@ extern mx_status_t _mx_fifo_op(
     uint64_t val,
     mx_fifo_state_t out[1]) __attribute__((__leaf__));
 
+extern mx_status_t mx_fifo_get_state_vmo(
+    mx_handle_t handle,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_fifo_get_state_vmo(
+    mx_handle_t handle,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
 extern mx_status_t mx_log_create(
     uint32_t options,
     mx_handle_t out[1]) __attribute__((__leaf__));
@@ -735,6 +881,16 @@ extern mx_status_t _mx_ktrace_write(
     uint32_t arg0,
     uint32_t arg1) __attribute__((__leaf__));
 
+extern mx_status_t mx_ktrace_stream_vmo(
+    mx_handle_t handle,
+    uint32_t cpu,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
+extern mx_status_t _mx_ktrace_stream_vmo(
+    mx_handle_t handle,
+    uint32_t cpu,
+    mx_handle_t out[1]) __attribute__((__leaf__));
+
 extern mx_handle_t mx_debug_transfer_handle(
     mx_handle_t proc,
     mx_handle_t handle) __attribute__((__leaf__));
@@ -793,6 +949,16 @@ extern mx_status_t mx_interrupt_wait(
 extern mx_status_t _mx_interrupt_wait(
     mx_handle_t handle) __attribute__((__leaf__));
 
+extern mx_status_t mx_interrupt_set_affinity(
+    mx_handle_t handle,
+    uint32_t cpu,
+    uint32_t options) __attribute__((__leaf__));
+
+extern mx_status_t _mx_interrupt_set_affinity(
+    mx_handle_t handle,
+    uint32_t cpu,
+    uint32_t options) __attribute__((__leaf__));
+
 extern mx_status_t mx_mmap_device_io(
     mx_handle_t handle,
     uint32_t io_addr,
@@ -17,6 +17,8 @@ KTRACE_DEF(0x022,NAME,PROC_NAME,META) // pid, 0, name[]
 KTRACE_DEF(0x023,NAME,SYSCALL_NAME,META) // num, 0, name[]
 KTRACE_DEF(0x024,NAME,IRQ_NAME,META) // num, 0, name[]
 KTRACE_DEF(0x025,NAME,PROBE_NAME,META) // num, 0, name[]
+KTRACE_DEF(0x026,NAME,USER_NAME,USER) // num, pid, name[]
+KTRACE_DEF(0x027,NAME,BOOT_NAME,META) // num, 0, name[]
 
 KTRACE_DEF(0x030,16B,IRQ_ENTER,IRQ) // (irqn << 8) | cpu
 KTRACE_DEF(0x031,16B,IRQ_EXIT,IRQ) // (irqn << 8) | cpu
@@ -26,6 +28,9 @@ KTRACE_DEF(0x033,16B,SYSCALL_EXIT,IRQ) // (n << 8) | cpu
 KTRACE_DEF(0x034,32B,PAGE_FAULT,IRQ) // virtual_address_hi, virtual_address_lo, flags, cpu
 
 KTRACE_DEF(0x040,32B,CONTEXT_SWITCH,SCHEDULER) // to-tid, (state<<16|cpu), from-kt, to-kt
+KTRACE_DEF(0x041,32B,THREAD_WAKEUP,SCHEDULER) // wakee-tid, waker-tid, cpu, wakee-kt
+KTRACE_DEF(0x042,32B,SCHED_LATENCY,SCHEDULER) // tid, waker-tid, latency_ns, (reason<<16|cpu)
+KTRACE_DEF(0x043,32B,DEADLINE_OVERRUN,SCHEDULER) // tid, overrun_ns, overruns, cpu
 
 // events from 0x100 on all share the tag/tid/ts common header
 
@@ -51,4 +56,21 @@ KTRACE_DEF(0x143,32B,PORT_QUEUE,IPC) // id, size
 KTRACE_DEF(0x150,32B,WAIT_ONE,IPC) // id, signals, timeoutlo, timeouthi
 KTRACE_DEF(0x151,32B,WAIT_ONE_DONE,IPC) // id, status, pending
 
+KTRACE_DEF(0x160,32B,LOCK_CONTEND,LOCKS) // lock_lo, lock_hi, wait_ns, caller_lo
+KTRACE_DEF(0x161,32B,LOCK_STAT,LOCKS) // lock_lo, lock_hi, contentions, total_wait_us
+KTRACE_DEF(0x162,32B,LOCK_HOLD_STAT,LOCKS) // lock_lo, lock_hi, holds, total_hold_us
+KTRACE_DEF(0x163,32B,LOCK_CALLER,LOCKS) // lock_lo, lock_hi, caller_lo, contentions
+
+KTRACE_DEF(0x170,16B,PROFILE_SAMPLE,PROFILE) // pc[], size from the tag
+
+KTRACE_DEF(0x180,32B,USER_DURATION_BEGIN,USER) // name, 0, arg_lo, arg_hi
+KTRACE_DEF(0x181,32B,USER_DURATION_END,USER) // name, 0, arg_lo, arg_hi
+KTRACE_DEF(0x182,32B,USER_COUNTER,USER) // name, 0, value_lo, value_hi
+KTRACE_DEF(0x183,32B,USER_FLOW_BEGIN,USER) // name, 0, flow_lo, flow_hi
+KTRACE_DEF(0x184,32B,USER_FLOW_STEP,USER) // name, 0, flow_lo, flow_hi
+KTRACE_DEF(0x185,32B,USER_FLOW_END,USER) // name, 0, flow_lo, flow_hi
+
+KTRACE_DEF(0x190,32B,BOOT_BEGIN,META) // num, 0, ts_lo, ts_hi
+KTRACE_DEF(0x191,32B,BOOT_END,META) // num, 0, ts_lo, ts_hi
+
 #undef KTRACE_DEF
@@ -45,6 +45,9 @@ __BEGIN_CDECLS
 #define KTRACE_GRP_IPC            0x010
 #define KTRACE_GRP_IRQ            0x020
 #define KTRACE_GRP_PROBE          0x040
+#define KTRACE_GRP_LOCKS          0x080
+#define KTRACE_GRP_PROFILE        0x100
+#define KTRACE_GRP_USER           0x200 // only written by ulib/trace
 
 #define KTRACE_GRP_TO_MASK(grp)   ((grp) << 20)
 
@@ -67,6 +70,22 @@ typedef struct ktrace_rec_32b {
     uint32_t d;
 } ktrace_rec_32b_t;
 
+// Most pcs a TAG_PROFILE_SAMPLE record holds, filling the largest record.
+#define KTRACE_SAMPLE_MAX_PCS     (13)
+
+// A TAG_PROFILE_SAMPLE record, holding as many of |pc| as its size says:
+// the pc sampled, then its callers innermost first. Callers are only
+// walked for samples taken in the kernel.
+typedef struct ktrace_rec_sample {
+    uint32_t tag;
+    uint32_t tid;
+    uint64_t ts;
+    uint64_t pc[KTRACE_SAMPLE_MAX_PCS];
+} ktrace_rec_sample_t;
+
+static_assert(sizeof(ktrace_rec_sample_t) == KTRACE_LEN(0xF),
+              "ktrace_rec_sample_t is not the largest record");
+
 typedef struct ktrace_rec_name {
     uint32_t tag;
     uint32_t id;
@@ -87,5 +106,35 @@ enum {
 #define KTRACE_ACTION_STOP      2 // options ignored
 #define KTRACE_ACTION_REWIND    3 // options ignored
 #define KTRACE_ACTION_NEW_PROBE 4 // options ignored, ptr = name
+#define KTRACE_ACTION_START_STREAM 5 // options = grpmask, 0 = all
+#define KTRACE_ACTION_PROFILE_START 6 // options = cycles between samples
+#define KTRACE_ACTION_PROFILE_STOP  7 // options ignored
+
+// With KTRACE_ACTION_START_STREAM each cpu writes its records to a ring of
+// its own instead of the one global buffer, overwriting the oldest records
+// once the ring is full rather than stopping. mx_ktrace_stream_vmo() returns
+// a read-only VMO holding a cpu's ring, which is a ktrace_stream_header_t
+// followed by |size| bytes of records at KTRACE_STREAM_DATA_OFFSET.
+//
+// |head| counts the bytes ever written to the stream, the record at position
+// p being at offset p % size. Records never straddle the end of the ring: a
+// tag of 0 marks the rest of it as padding, the next record being at the
+// start. To drain a stream, read |head|, copy out the records between the
+// last position read and it, and then read |head| again. The writer may
+// have overwritten anything before that second head + KTRACE_STREAM_SLACK
+// - size, in which case the reader picks up again at the next start of the
+// ring, where a record always begins.
+typedef struct ktrace_stream_header {
+    uint64_t head;
+    uint32_t size;          // a power of two
+    uint32_t cpu;
+    uint64_t reserved[6];
+} ktrace_stream_header_t;
+
+#define KTRACE_STREAM_DATA_OFFSET (64)
+#define KTRACE_STREAM_SLACK       (256)
+
+static_assert(sizeof(ktrace_stream_header_t) == KTRACE_STREAM_DATA_OFFSET,
+              "ktrace_stream_header_t is not KTRACE_STREAM_DATA_OFFSET bytes");
 
 __END_CDECLS
\ No newline at end of file
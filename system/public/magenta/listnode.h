@@ -245,6 +245,19 @@ static inline bool list_is_empty(list_node_t* list) {
     return (list->next == list) ? true : false;
 }
 
+// Moves all of the nodes on splice_from to just after pos, leaving splice_from
+// empty.  To append them to a list, pass the list's tail as pos.
+static inline void list_splice_after(list_node_t* splice_from, list_node_t* pos) {
+    if (list_is_empty(splice_from)) {
+        return;
+    }
+    splice_from->next->prev = pos;
+    splice_from->prev->next = pos->next;
+    pos->next->prev = splice_from->prev;
+    pos->next = splice_from->next;
+    list_initialize(splice_from);
+}
+
 static inline size_t list_length(list_node_t* list) {
     size_t cnt = 0;
     list_node_t* node = list;
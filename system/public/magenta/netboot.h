@@ -29,6 +29,23 @@
 #define NB_ACK                0 // arg=0 or -err, NB_READ: data=data
 #define NB_FILE_RECEIVED      0x70000001 // arg=size
 
+// NB_OPEN flag for a windowed transfer: blocks of NB_WINDOW_BLOCK_SIZE bytes
+// are read and written by number, several in flight at once and in any
+// order, and the ack of each NB_READ or NB_WRITE has arg=blocknum (or -err).
+// The ack of the open has arg=how many blocks may be in flight; a server
+// without windowed transfers fails the open, which is then retried without.
+#define NB_OPEN_WINDOW        0x40000000
+#define NB_WINDOW_BLOCK_SIZE  1408
+
+// NB_SEND_FILE data of filename, \0, NB_SEND_FILE_WINDOW: the file is sent
+// windowed, to a bootloader that advertised a "window" (the most blocks it
+// takes in flight). The bootloader acks NB_DATA every few blocks, and for
+// each block that is not at the offset it has, with arg=offset it has; the
+// sender goes back to that offset when it is acked again and again, or when
+// no ack comes. Blocks may then be NB_MAX_DATA bytes.
+#define NB_SEND_FILE_WINDOW   "window"
+#define NB_MAX_DATA           1436
+
 #define NB_ADVERTISE          0x77777777
 
 #define NB_ERROR              0x80000000
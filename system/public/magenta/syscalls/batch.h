@@ -0,0 +1,56 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/types.h>
+#include <magenta/syscalls/port.h>
+
+// The MX_BATCH_OP_* numbers of the syscalls an operation can run.
+#include <magenta/gen-batch-ops.h>
+
+__BEGIN_CDECLS
+
+// Defines and structures for mx_batch_submit()
+
+// Most arguments an operation passes to its syscall.
+#define MX_BATCH_OP_MAX_ARGS 8u
+
+// One syscall to run. Pointer arguments are addresses in the submitting
+// process, as if the process made the syscall itself.
+typedef struct mx_batch_op {
+    uint32_t op;            // MX_BATCH_OP_*
+    uint32_t reserved;
+    uint64_t user_data;     // returned as the completion's key
+    uint64_t args[MX_BATCH_OP_MAX_ARGS];
+} mx_batch_op_t;
+
+// The header at the start of a batch ring VMO. The submitter fills in
+// |size| and then queues operations by storing them and advancing |tail|;
+// mx_batch_submit() runs them and advances |head|. Both indexes count up
+// freely and wrap around, an operation's slot being its index modulo |size|.
+typedef struct mx_batch_ring {
+    uint32_t head;
+    uint32_t reserved0[7];
+    uint32_t tail;
+    uint32_t reserved1[7];
+    // Slots in the ring, a power of two.
+    uint32_t size;
+    uint32_t reserved2[7];
+} mx_batch_ring_t;
+
+// The slots follow the header at this offset.
+#define MX_BATCH_RING_OPS_OFFSET 128u
+
+#define MX_PORT_PKT_TYPE_BATCH 4u
+
+// Queued to the completion port for each operation run.
+typedef struct mx_batch_packet {
+    mx_packet_header_t hdr;     // key is the operation's user_data
+    int64_t result;             // what the syscall returned
+    uint32_t op;
+    uint32_t reserved;
+} mx_batch_packet_t;
+
+__END_CDECLS
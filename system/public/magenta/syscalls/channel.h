@@ -10,3 +10,8 @@
 
 // Mask for all the valid MX_CHANNEL_READ_... flags:
 #define MX_CHANNEL_READ_MASK                1u
+
+#define MX_CHANNEL_WRITE_MOVE_PAGES         1u
+
+// Mask for all the valid MX_CHANNEL_WRITE_... flags:
+#define MX_CHANNEL_WRITE_MASK               1u
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <magenta/types.h>
+#include <magenta/syscalls/debug.h>
 
 __BEGIN_CDECLS
 
@@ -95,6 +96,33 @@ typedef struct mx_exception_report {
     mx_exception_context_t context;
 } mx_exception_report_t;
 
+#define MX_EXCEPTION_SNAPSHOT_STACK_SIZE 2048u
+
+// The state of a thread at an architectural exception. Ports bound with
+// MX_EXCEPTION_PORT_SNAPSHOT get it right after the report, so that a crash
+// handler can print registers and a backtrace without reading them back one
+// syscall at a time. report.header.size then includes it.
+typedef struct mx_exception_snapshot {
+    // The general registers (MX_THREAD_STATE_REGSET0) for report.context.arch_id.
+    union {
+        mx_x86_64_general_regs_t x86_64;
+        mx_aarch64_general_regs_t arm_64;
+    } regs;
+
+    // |stack| holds the |stack_size| bytes of memory at the stack pointer,
+    // |stack_addr|. There can be fewer than MX_EXCEPTION_SNAPSHOT_STACK_SIZE
+    // if the stack couldn't all be read.
+    mx_vaddr_t stack_addr;
+    uint32_t stack_size;
+    // MX_EXCEPTION_SNAPSHOT_* below.
+    uint32_t flags;
+    uint8_t stack[MX_EXCEPTION_SNAPSHOT_STACK_SIZE];
+} mx_exception_snapshot_t;
+
+// |regs| and |stack_addr| are valid. If not, the registers could not be read
+// and the snapshot is empty.
+#define MX_EXCEPTION_SNAPSHOT_REGS 1u
+
 // The status argument to _magenta_mark_exception_handled.
 // Negative values are for internal use only.
 typedef enum {
@@ -133,4 +161,8 @@ typedef enum {
 // When binding an exception port to a process, set the process's debugger
 // exception port.
 
+#define MX_EXCEPTION_PORT_SNAPSHOT (2)
+// Architectural exceptions are reported with an mx_exception_snapshot_t of
+// the thread's state, in an mx_exception_snapshot_packet_t.
+
 __END_CDECLS
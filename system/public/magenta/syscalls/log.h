@@ -33,4 +33,12 @@ typedef struct mx_log_record {
 #define MX_LOG_FLAG_WAIT      0x80000000
 #define MX_LOG_FLAG_READABLE  0x40000000
 
+// Passed to mx_log_read() to read as many records as fit in the buffer.
+// Each record starts 8 byte aligned.
+// Passed to mx_log_write() to write each '\n' separated line of the buffer
+// as its own record, up to MX_LOG_WRITE_BATCH_MAX bytes in all.
+#define MX_LOG_FLAG_BATCH     0x20000000
+
+#define MX_LOG_WRITE_BATCH_MAX 4096
+
 __END_CDECLS
@@ -20,6 +20,12 @@ typedef enum {
     MX_INFO_RESOURCE_CHILDREN,      // mx_rrec_t[n]
     MX_INFO_RESOURCE_RECORDS,       // mx_rrec_t[n]
     MX_INFO_VMAR,                   // mx_info_vmar_t
+    MX_INFO_CPU_SCHED_LATENCY,      // mx_info_cpu_sched_latency_t[n]
+    MX_INFO_TASK_MEMORY,            // mx_info_task_memory_t[1]
+    MX_INFO_KCOUNTERS,              // mx_info_kcounter_t[n]
+    MX_INFO_SYSCALL_STATS,          // mx_info_syscall_stats_t[n]
+    MX_INFO_JOB_TASKS,              // mx_info_task_record_t[n]
+    MX_INFO_KERNEL_STALLS,          // mx_info_kernel_stall_t[n]
 } mx_object_info_topic_t;
 
 typedef enum {
@@ -77,6 +83,112 @@ typedef struct mx_info_vmar {
     size_t len;
 } mx_info_vmar_t;
 
+typedef struct mx_info_task_memory {
+    // Bytes committed in the VMOs mapped into the process, or for a job into
+    // the processes of the job and of its child jobs. A VMO counts in full
+    // once per process, however much of it is mapped and however often.
+    uint64_t committed_bytes;
+    // Of those, bytes in VMOs no other process has mapped.
+    uint64_t private_bytes;
+    // Of those, bytes in VMOs other processes have mapped too. For a job,
+    // VMOs shared between its processes count once for each of them.
+    uint64_t shared_bytes;
+} mx_info_task_memory_t;
+
+// Task states reported in mx_info_task_record_t.
+#define MX_TASK_STATE_NEW       0u  // created, not yet started
+#define MX_TASK_STATE_RUNNING   1u
+#define MX_TASK_STATE_DYING     2u  // killed or exiting, not yet dead
+#define MX_TASK_STATE_DEAD      3u
+
+// Returned for a job, one record for the job itself and one for each job,
+// process and thread below it. A job's record comes before those of its
+// processes and child jobs, and a process's before those of its threads.
+typedef struct mx_info_task_record {
+    uint32_t type;                // MX_OBJ_TYPE_JOB, _PROCESS or _THREAD
+    uint32_t state;               // MX_TASK_STATE_*
+    mx_koid_t koid;
+    // The job a job or process is in, or the process a thread is in.
+    mx_koid_t parent_koid;
+    char name[MX_MAX_NAME_LEN];
+    // Time a thread has spent running. For a process, summed over its
+    // threads that have not exited; zero for a job.
+    uint64_t runtime_ns;
+    // As in mx_info_task_memory_t; zero for a thread.
+    uint64_t committed_bytes;
+    uint64_t private_bytes;
+    uint64_t shared_bytes;
+} mx_info_task_record_t;
+
+#define MX_SCHED_LATENCY_BUCKETS 32
+
+typedef struct mx_sched_latency_hist {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    // |buckets[i]| counts latencies in [2^(i-1), 2^i) nanoseconds; the
+    // last bucket also counts everything longer.
+    uint64_t buckets[MX_SCHED_LATENCY_BUCKETS];
+} mx_sched_latency_hist_t;
+
+// Returned for the root resource, one record per cpu.
+typedef struct mx_info_cpu_sched_latency {
+    uint32_t cpu;
+    uint32_t reserved;
+
+    // Time from a blocked, sleeping or new thread becoming ready to it
+    // running on this cpu.
+    mx_sched_latency_hist_t wakeup;
+
+    // Time from a running thread being preempted or yielding to it
+    // running again on this cpu.
+    mx_sched_latency_hist_t preempt;
+} mx_info_cpu_sched_latency_t;
+
+// Returned for the root resource, one record per kernel counter.
+typedef struct mx_info_kcounter {
+    char name[MX_MAX_NAME_LEN];
+    // Summed over every cpu.
+    int64_t value;
+} mx_info_kcounter_t;
+
+// Returned for the root resource by kernels built with syscall stats, one
+// record per syscall.
+typedef struct mx_info_syscall_stats {
+    uint32_t syscall;   // the MX_SYS_ number
+    uint32_t reserved;
+    char name[MX_MAX_NAME_LEN];
+
+    // Time from entering the syscall to returning from it, summed over
+    // every cpu. Calls that never return are counted as taking no time.
+    mx_sched_latency_hist_t latency;
+} mx_info_syscall_stats_t;
+
+// Values for mx_info_kernel_stall_t.type.
+#define MX_KERNEL_STALL_TIMER               0u
+#define MX_KERNEL_STALL_IRQS_OFF            1u
+
+#define MX_KERNEL_STALL_BACKTRACE_DEPTH     8
+
+// Returned for the root resource by kernels built with the stall detector,
+// one record per recent stall, oldest first.
+typedef struct mx_info_kernel_stall {
+    // Counts up from 0 across every stall, including ones no longer kept,
+    // so gaps between reads show up as jumps.
+    uint64_t seq;
+    mx_time_t end_time;     // MX_CLOCK_MONOTONIC
+    uint64_t duration_ns;
+    uint32_t cpu;
+    uint32_t type;
+    // The thread that was running, or 0 for a kernel thread.
+    mx_koid_t tid;
+    // Kernel address interrupts were disabled at, for MX_KERNEL_STALL_IRQS_OFF.
+    uint64_t start_pc;
+    uint32_t backtrace_count;
+    uint32_t reserved;
+    uint64_t backtrace[MX_KERNEL_STALL_BACKTRACE_DEPTH];
+} mx_info_kernel_stall_t;
+
 
 // Object properties.
 
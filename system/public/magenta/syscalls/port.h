@@ -37,4 +37,13 @@ typedef struct mx_exception_packet {
     mx_exception_report_t report;
 } mx_exception_packet_t;
 
+// What ports bound with MX_EXCEPTION_PORT_SNAPSHOT receive for architectural
+// exceptions. Other reports still arrive as mx_exception_packet_t; tell them
+// apart by report.header.size.
+typedef struct mx_exception_snapshot_packet {
+    mx_packet_header_t hdr;
+    mx_exception_report_t report;
+    mx_exception_snapshot_t snapshot;
+} mx_exception_snapshot_packet_t;
+
 __END_CDECLS
@@ -132,6 +132,9 @@ typedef uint32_t mx_signals_t;
 // Job
 #define MX_JOB_NO_PROCESSES         MX_OBJECT_SIGNAL_3
 #define MX_JOB_NO_JOBS              MX_OBJECT_SIGNAL_4
+#define MX_JOB_MEMORY_PRESSURE      MX_OBJECT_SIGNAL_5
+#define MX_JOB_MEMORY_SOFT_LIMIT    MX_OBJECT_SIGNAL_6
+#define MX_JOB_MEMORY_HARD_LIMIT    MX_OBJECT_SIGNAL_7
 
 // Process
 #define MX_PROCESS_SIGNALED         MX_OBJECT_SIGNAL_3
@@ -154,6 +157,16 @@ typedef struct {
     uint32_t rd_num_handles;
 } mx_channel_call_args_t;
 
+// Structure for mx_channel_read_many() and mx_channel_write_many():
+typedef struct {
+    mx_handle_t channel;        // channel to write to, ignored by reads
+    uint32_t num_bytes;         // reads set these to the message's sizes
+    uint32_t num_handles;
+    uint32_t reserved;
+    void* bytes;
+    mx_handle_t* handles;
+} mx_channel_msg_t;
+
 // Structure for mx_handle_wait_many():
 typedef struct {
     mx_handle_t handle;
@@ -168,6 +181,9 @@ typedef struct mx_waitset_result {
     mx_signals_t observed;
 } mx_waitset_result_t;
 
+// Options for mx_waitset_create():
+#define MX_WAITSET_EDGE_TRIGGERED   ((uint32_t)1u)
+
 typedef uint32_t mx_rights_t;
 #define MX_RIGHT_NONE             ((mx_rights_t)0u)
 #define MX_RIGHT_DUPLICATE        ((mx_rights_t)1u << 0)
@@ -194,6 +210,18 @@ typedef uint32_t mx_rights_t;
 #define MX_VMO_OP_CACHE_CLEAN            8u
 #define MX_VMO_OP_CACHE_CLEAN_INVALIDATE 9u
 
+// VM Object creation options
+#define MX_VMO_CREATE_LARGE_PAGES        1u
+#define MX_VMO_CREATE_DISCARDABLE        2u
+#define MX_VMO_CREATE_NUMA_INTERLEAVE    4u
+#define MX_VMO_CREATE_NUMA_BIND          8u
+// the numa node MX_VMO_CREATE_NUMA_BIND binds to, in the top byte of the options
+#define MX_VMO_CREATE_NUMA_NODE(n)       ((uint32_t)(n) << 24)
+#define MX_VMO_CREATE_NUMA_NODE_MASK     0xff000000u
+
+// VM Object clone flags
+#define MX_VMO_CLONE_COPY_ON_WRITE       1u
+
 // flags to vmar routines
 #define MX_VM_FLAG_PERM_READ          (1u << 0)
 #define MX_VM_FLAG_PERM_WRITE         (1u << 1)
@@ -205,6 +233,7 @@ typedef uint32_t mx_rights_t;
 #define MX_VM_FLAG_CAN_MAP_READ       (1u << 7)
 #define MX_VM_FLAG_CAN_MAP_WRITE      (1u << 8)
 #define MX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
+#define MX_VM_FLAG_MAP_SEQUENTIAL     (1u << 10)
 
 // compatibility flag for vmar routines
 // TODO(teisenbe): Move all users of this to using subregions.
@@ -235,8 +264,39 @@ typedef int64_t mx_rel_off_t;
 // interrupt flags
 #define MX_FLAG_REMAP_IRQ  0x1
 
+// Options for mx_interrupt_set_affinity().
+#define MX_INTERRUPT_AFFINITY_BIND_WAITER  0x1u
+
 // Socket flags and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
+#define MX_SOCKET_RING_SYNC                 2u
+
+// Options for mx_socket_create(). The size field holds log2 of the bytes
+// each direction can buffer, and zero picks the default.
+#define MX_SOCKET_SHARED_RING               1u
+#define MX_SOCKET_SIZE_SHIFT                8u
+#define MX_SOCKET_SIZE_MASK                 (0xffu << MX_SOCKET_SIZE_SHIFT)
+#define MX_SOCKET_SIZE(log2)                ((uint32_t)(log2) << MX_SOCKET_SIZE_SHIFT)
+#define MX_SOCKET_SIZE_MIN_LOG2             12u
+#define MX_SOCKET_SIZE_MAX_LOG2             24u
+
+// Options for mx_socket_get_ring().
+#define MX_SOCKET_RING_RX                   0u
+#define MX_SOCKET_RING_TX                   1u
+
+// Control block at the start of a shared socket ring VMO. The data follows at
+// MX_SOCKET_RING_DATA_OFFSET. |head| and |tail| are offsets into the data,
+// and the ring is empty when they are equal and full when |head| is one byte
+// behind |tail|.
+typedef struct mx_socket_ring {
+    uint64_t head;              // advanced by the writer
+    uint64_t reserved0[7];
+    uint64_t tail;              // advanced by the reader
+    uint64_t reserved1[7];
+    uint64_t size;              // bytes of data, a power of two
+} mx_socket_ring_t;
+
+#define MX_SOCKET_RING_DATA_OFFSET          4096u
 
 // Flags which can be used to to control cache policy for APIs which map memory.
 typedef enum {
@@ -259,6 +319,7 @@ typedef enum {
     MX_FIFO_OP_ADVANCE_TAIL       = 2,
     MX_FIFO_OP_PRODUCER_EXCEPTION = 3,
     MX_FIFO_OP_CONSUMER_EXCEPTION = 4,
+    MX_FIFO_OP_SYNC               = 5,
 } mx_fifo_op_t;
 
 #define MX_FIFO_PRODUCER_RIGHTS \
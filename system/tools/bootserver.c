@@ -32,6 +32,29 @@ static const char spinner[] = {'|', '/', '-', '\\'};
 static const int MAX_READ_RETRIES = 10;
 static const int MAX_SEND_RETRIES = 10000;
 static int64_t us_between_packets = 20;
+static size_t window_block_size = NB_MAX_DATA;
+
+static void print_error(uint32_t cmd) {
+    switch (cmd) {
+    case NB_ERROR:
+        fprintf(stderr, "\n%s: error: Generic error\n", appname);
+        break;
+    case NB_ERROR_BAD_CMD:
+        fprintf(stderr, "\n%s: error: Bad command\n", appname);
+        break;
+    case NB_ERROR_BAD_PARAM:
+        fprintf(stderr, "\n%s: error: Bad parameter\n", appname);
+        break;
+    case NB_ERROR_TOO_LARGE:
+        fprintf(stderr, "\n%s: error: File too large\n", appname);
+        break;
+    case NB_ERROR_BAD_FILE:
+        fprintf(stderr, "\n%s: error: Bad file\n", appname);
+        break;
+    default:
+        fprintf(stderr, "\n%s: error: Unknown command 0x%08X\n", appname, cmd);
+    }
+}
 
 static int io_rcv(int s, nbmsg* msg, nbmsg* ack) {
     for (int i = 0; i < MAX_READ_RETRIES; i++) {
@@ -73,25 +96,7 @@ static int io_rcv(int s, nbmsg* msg, nbmsg* ack) {
             return 0;
         }
 
-        switch (ack->cmd) {
-        case NB_ERROR:
-            fprintf(stderr, "\n%s: error: Generic error\n", appname);
-            break;
-        case NB_ERROR_BAD_CMD:
-            fprintf(stderr, "\n%s: error: Bad command\n", appname);
-            break;
-        case NB_ERROR_BAD_PARAM:
-            fprintf(stderr, "\n%s: error: Bad parameter\n", appname);
-            break;
-        case NB_ERROR_TOO_LARGE:
-            fprintf(stderr, "\n%s: error: File too large\n", appname);
-            break;
-        case NB_ERROR_BAD_FILE:
-            fprintf(stderr, "\n%s: error: Bad file\n", appname);
-            break;
-        default:
-            fprintf(stderr, "\n%s: error: Unknown command 0x%08X\n", appname, ack->cmd);
-        }
+        print_error(ack->cmd);
         return -1;
     }
     fprintf(stderr, "\n%s: error: Unexpected code path\n", appname);
@@ -219,22 +224,136 @@ static ssize_t xread(xferdata* xd, void* data, size_t len) {
 // 1280 is friendlier
 #define PAYLOAD_SIZE 1280
 
-static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, bool boot) {
+// A windowed transfer goes back to the last offset acked when it is acked
+// this many more times, or after this many reads time out in a row
+#define WINDOW_DUP_ACKS 3
+#define WINDOW_MAX_TIMEOUTS 40
+// and keeps at most this many blocks in flight, whatever is advertised
+#define WINDOW_MAX 256
+
+typedef struct {
+    bool is_redirected;
+    struct timeval begin;
+    int count;
+    int spin;
+} progress;
+
+static void show_progress(progress* p, size_t current_pos, long sz, bool force) {
+    if (p->is_redirected) {
+        if (p->count++ > 8 * 1024) {
+            fprintf(stderr, "%.01f%%\n", 100.0 * (float)current_pos / (float)sz);
+            p->count = 0;
+        }
+    } else {
+        if (p->count++ > 1024 || force) {
+            p->count = 0;
+            float bw = 0;
+
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            int64_t us_since_begin = ((int64_t)(now.tv_sec - p->begin.tv_sec) * 1000000 + ((int64_t)now.tv_usec - (int64_t)p->begin.tv_usec));
+            if (us_since_begin >= 1000000) {
+                bw = (float)current_pos / (1024.0 * 1024.0 * (float)(us_since_begin / 1000000));
+            }
+
+            fprintf(stderr, "\33[2K\r");
+            if (sz > 0) {
+                fprintf(stderr, "%c %.01f%%", spinner[(p->spin++) % 4], 100.0 * (float)current_pos / (float)sz);
+            } else {
+                fprintf(stderr, "%c", spinner[(p->spin++) % 4]);
+            }
+            if (bw > 0.1) {
+                fprintf(stderr, " %.01fMB/s", bw);
+            }
+        }
+    }
+}
+
+// Sends a file windowed (see NB_SEND_FILE_WINDOW): rather than spacing
+// packets out, up to window blocks past the offset last acked are kept in
+// flight, so the bootloader's acks set the pace.
+static int xfer_window(int s, xferdata* xd, long sz, unsigned window,
+                       nbmsg* msg, nbmsg* ack, size_t* acked, progress* p) {
+    size_t limit = window * window_block_size;
+    size_t next = 0;
+    // acks asked for by blocks sent before going back are stale
+    uint32_t rewind_cookie = 0;
+    int dups = 0;
+    int timeouts = 0;
+
+    for (;;) {
+        while ((next < (size_t)sz) && ((next - *acked) < limit)) {
+            ssize_t r = xread(xd, msg->data, window_block_size);
+            if (r <= 0) {
+                fprintf(stderr, "\n%s: error: Reading file\n", appname);
+                return -1;
+            }
+            msg->magic = NB_MAGIC;
+            msg->cookie = cookie++;
+            msg->cmd = (next + r >= (size_t)sz) ? NB_LAST_DATA : NB_DATA;
+            msg->arg = next;
+            if (io_send(s, msg, sizeof(nbmsg) + r)) {
+                return -1;
+            }
+            next += r;
+        }
+        show_progress(p, *acked, sz, false);
+
+        bool rewind = false;
+        ssize_t r = read(s, ack, 2048);
+        if (r < 0) {
+            if ((errno != EAGAIN) || (++timeouts == WINDOW_MAX_TIMEOUTS)) {
+                fprintf(stderr, "\n%s: error: Socket read error %d\n", appname, errno);
+                return -1;
+            }
+            rewind = true;
+        } else if ((r < (ssize_t)sizeof(nbmsg)) || (ack->magic != NB_MAGIC)) {
+            continue;
+        } else if (ack->cmd == NB_FILE_RECEIVED) {
+            *acked = sz;
+            show_progress(p, *acked, sz, true);
+            return 0;
+        } else if (ack->cmd != NB_ACK) {
+            print_error(ack->cmd);
+            return -1;
+        } else if ((ack->arg > *acked) && (ack->arg <= next)) {
+            *acked = ack->arg;
+            dups = 0;
+            timeouts = 0;
+        } else if ((ack->arg == *acked) && (ack->cookie >= rewind_cookie) &&
+                   (*acked < next) && (++dups == WINDOW_DUP_ACKS)) {
+            rewind = true;
+        }
+
+        if (rewind) {
+            next = *acked;
+            rewind_cookie = cookie;
+            dups = 0;
+            if (fseek(xd->fp, next, SEEK_SET)) {
+                fprintf(stderr, "\n%s: error: Failed to rewind to %zu\n", appname, next);
+                return -1;
+            }
+        }
+    }
+}
+
+static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, bool boot,
+                unsigned window) {
     xferdata xd;
     char msgbuf[2048];
     char ackbuf[2048];
     char tmp[INET6_ADDRSTRLEN];
     struct timeval tv;
-    struct timeval begin, end;
+    struct timeval end;
     nbmsg* msg = (void*)msgbuf;
     nbmsg* ack = (void*)ackbuf;
     int s, r;
-    int count = 0, spin = 0;
     int status = -1;
     size_t current_pos = 0;
-
-    // This only works on POSIX systems
-    bool is_redirected = !isatty(fileno(stdout));
+    progress prog = {
+        // This only works on POSIX systems
+        .is_redirected = !isatty(fileno(stdout)),
+    };
 
     if (!strcmp(fn, "(cmdline)")) {
         xd.fp = NULL;
@@ -264,7 +383,7 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
         goto done;
     }
     fprintf(stderr, "%s: sending '%s'...\n", appname, fn);
-    gettimeofday(&begin, NULL);
+    gettimeofday(&prog.begin, NULL);
     tv.tv_sec = 0;
     tv.tv_usec = 250 * 1000;
     setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
@@ -275,14 +394,31 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
         goto done;
     }
 
+    // windowed transfers seek back in a file
+    if ((xd.fp == NULL) || (sz <= 0)) {
+        window = 0;
+    }
+
     msg->cmd = NB_SEND_FILE;
     msg->arg = sz;
     strcpy((void*)msg->data, name);
-    if (io(s, msg, sizeof(nbmsg) + strlen(name) + 1, ack, true)) {
+    size_t len = strlen(name) + 1;
+    if (window) {
+        memcpy(msg->data + len, NB_SEND_FILE_WINDOW, sizeof(NB_SEND_FILE_WINDOW));
+        len += sizeof(NB_SEND_FILE_WINDOW);
+    }
+    if (io(s, msg, sizeof(nbmsg) + len, ack, true)) {
         fprintf(stderr, "%s: error: Failed to start transfer\n", appname);
         goto done;
     }
 
+    if (window) {
+        if (xfer_window(s, &xd, sz, window, msg, ack, &current_pos, &prog)) {
+            goto done;
+        }
+        goto sent;
+    }
+
     msg->cmd = NB_DATA;
     msg->arg = 0;
 
@@ -297,34 +433,7 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
             goto done;
         }
 
-        if (is_redirected) {
-            if (count++ > 8 * 1024) {
-                fprintf(stderr, "%.01f%%\n", 100.0 * (float)msg->arg / (float)sz);
-                count = 0;
-            }
-        } else {
-            if (count++ > 1024 || r == 0) {
-                count = 0;
-                float bw = 0;
-
-                struct timeval now;
-                gettimeofday(&now, NULL);
-                int64_t us_since_begin = ((int64_t)(now.tv_sec - begin.tv_sec) * 1000000 + ((int64_t)now.tv_usec - (int64_t)begin.tv_usec));
-                if (us_since_begin >= 1000000) {
-                    bw = (float)current_pos / (1024.0 * 1024.0 * (float)(us_since_begin / 1000000));
-                }
-
-                fprintf(stderr, "\33[2K\r");
-                if (sz > 0) {
-                    fprintf(stderr, "%c %.01f%%", spinner[(spin++) % 4], 100.0 * (float)current_pos / (float)sz);
-                } else {
-                    fprintf(stderr, "%c", spinner[(spin++) % 4]);
-                }
-                if (bw > 0.1) {
-                    fprintf(stderr, " %.01fMB/s", bw);
-                }
-            }
-        }
+        show_progress(&prog, current_pos, sz, r == 0);
 
         if (r == 0) {
             fprintf(stderr, "\n%s: Reached end of file, waiting for confirmation.\n", appname);
@@ -375,6 +484,7 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
         msg->arg = current_pos;
     } while (!completed);
 
+sent:
     status = 0;
 
     if (boot) {
@@ -390,13 +500,13 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
     }
 done:
     gettimeofday(&end, NULL);
-    if (end.tv_usec < begin.tv_usec) {
+    if (end.tv_usec < prog.begin.tv_usec) {
         end.tv_sec -= 1;
         end.tv_usec += 1000000;
     }
     fprintf(stderr, "%s: %s %ldMB %d.%06d sec\n\n", appname,
-            fn, current_pos / (1024 * 1024), (int)(end.tv_sec - begin.tv_sec),
-            (int)(end.tv_usec - begin.tv_usec));
+            fn, current_pos / (1024 * 1024), (int)(end.tv_sec - prog.begin.tv_sec),
+            (int)(end.tv_usec - prog.begin.tv_usec));
     if (s >= 0) {
         close(s);
     }
@@ -406,13 +516,38 @@ done:
     return status;
 }
 
+// Returns the window the bootloader advertises, or 0 if it takes blocks
+// only in sequence. The advertisement is \0 terminated keys and values.
+static unsigned advert_window(const char* data, size_t len) {
+    const char* end = data + len;
+    while (data < end) {
+        const char* key = data;
+        data += strnlen(data, end - data) + 1;
+        if (data >= end) {
+            break;
+        }
+        const char* val = data;
+        data += strnlen(data, end - data) + 1;
+        if (data > end) {
+            break;
+        }
+        if (!strcmp(key, "window")) {
+            unsigned long window = strtoul(val, NULL, 10);
+            return window > WINDOW_MAX ? WINDOW_MAX : window;
+        }
+    }
+    return 0;
+}
+
 void usage(void) {
     fprintf(stderr,
             "usage:   %s [ <option> ]* <kernel> [ <ramdisk> ] [ -- [ <kerneloption> ]* ]\n"
             "\n"
             "options:\n"
             "  -1  only boot once, then exit\n"
-            "  -a  only boot device with this IPv6 address\n",
+            "  -a  only boot device with this IPv6 address\n"
+            "  -b  block size of windowed transfers (at most 1436)\n"
+            "  -w  send in sequence even to bootloaders offering a window\n",
             appname);
     exit(1);
 }
@@ -435,6 +570,7 @@ int main(int argc, char** argv) {
     const char* kernel_fn = NULL;
     const char* ramdisk_fn = NULL;
     int once = 0;
+    bool windowed = true;
     int status;
 
     cmdline[0] = 0;
@@ -469,6 +605,22 @@ int main(int argc, char** argv) {
             fprintf(stderr, "packet spacing set to %" PRId64 " microseconds\n", us_between_packets);
             argc--;
             argv++;
+        } else if (!strcmp(argv[1], "-b")) {
+            if (argc <= 2) {
+                fprintf(stderr, "'-b' option requires an argument (bytes per block)\n");
+                return -1;
+            }
+            errno = 0;
+            long long size = strtoll(argv[2], NULL, 10);
+            if (errno != 0 || size <= 0 || size > NB_MAX_DATA) {
+                fprintf(stderr, "invalid arg for -b: %s\n", argv[2]);
+                return -1;
+            }
+            window_block_size = size;
+            argc--;
+            argv++;
+        } else if (!strcmp(argv[1], "-w")) {
+            windowed = false;
         } else if (!strcmp(argv[1], "-a")) {
             if (argc <= 1) {
                 fprintf(stderr, "'-a' option requires a valid ipv6 address\n");
@@ -564,18 +716,19 @@ int main(int argc, char** argv) {
         fprintf(stderr, "%s: got beacon from [%s]%d\n", appname,
                 inet_ntop(AF_INET6, &ra.sin6_addr, tmp, sizeof(tmp)),
                 ntohs(ra.sin6_port));
+        unsigned window = windowed ? advert_window((const char*)msg->data, r - sizeof(nbmsg)) : 0;
         if (cmdline[0]) {
-            status = xfer(&ra, "(cmdline)", cmdline, false);
+            status = xfer(&ra, "(cmdline)", cmdline, false, 0);
         } else {
             status = 0;
         }
         if ((status == 0) && ramdisk_fn) {
-            status = xfer(&ra, ramdisk_fn, "ramdisk.bin", false);
+            status = xfer(&ra, ramdisk_fn, "ramdisk.bin", false, window);
         } else {
             status = 0;
         }
         if (status == 0) {
-            xfer(&ra, kernel_fn, "kernel.bin", true);
+            xfer(&ra, kernel_fn, "kernel.bin", true, window);
         }
         if (once) {
             break;
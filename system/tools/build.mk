@@ -17,7 +17,7 @@ ALL_TOOLS := $(BOOTSERVER) $(LOGLISTENER) $(NETRUNCMD) $(NETCP) $(SYSGEN)
 LZ4_ROOT := third_party/ulib/lz4
 LZ4_CFLAGS := -O3 -I$(LZ4_ROOT)/include/lz4
 LZ4_SRCS := $(patsubst %,$(LZ4_ROOT)/%, \
-    lz4.c lz4frame.c lz4hc.c xxhash.c)
+    lz4.c lz4frame.c lz4frame_mt.c lz4hc.c xxhash.c)
 LZ4_OBJS := $(patsubst $(LZ4_ROOT)/%.c,$(BUILDDIR)/tools/lz4/%.o,$(LZ4_SRCS))
 LZ4_LIB := $(BUILDDIR)/tools/lz4/liblz4.a
 
@@ -34,7 +34,7 @@ $(LZ4_LIB): $(LZ4_OBJS)
 # mkbootfs
 MKBOOTFS := $(BUILDDIR)/tools/mkbootfs
 MKBOOTFS_CFLAGS := -I$(LZ4_ROOT)/include/lz4
-MKBOOTFS_LDFLAGS := -L$(BUILDDIR)/tools/lz4 -Bstatic -llz4 -Bdynamic
+MKBOOTFS_LDFLAGS := -L$(BUILDDIR)/tools/lz4 -Bstatic -llz4 -Bdynamic -lpthread
 
 $(BUILDDIR)/tools/mkbootfs: system/tools/mkbootfs.c $(LZ4_LIB)
 	@echo compiling $@
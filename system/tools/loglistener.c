@@ -15,9 +15,13 @@
 #include <unistd.h>
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
 
-#define MAX_LOG_DATA 1280
+#define MAX_LOG_DATA 1440
+
+// how many packets netsvc keeps in flight
+#define LOG_WINDOW 8
 
 typedef struct logpacket {
     uint32_t magic;
@@ -32,6 +36,7 @@ int main(int argc, char** argv) {
     char tmp[INET6_ADDRSTRLEN];
     int r, s, n = 1;
     uint32_t last_seqno = 0;
+    bool have_seqno = false;
 
     // Make stdout line buffered.
     setvbuf(stdout, NULL, _IOLBF, 0);
@@ -77,11 +82,17 @@ int main(int argc, char** argv) {
         }
         if (pkt->magic != 0xaeae1123)
             continue;
-        if (pkt->seqno != last_seqno) {
+        // Print packets in order and ack the newest one printed.  Anything
+        // past a gap is dropped and sent again.  A seqno far from ours
+        // means netsvc restarted, or we did, so start over from it.
+        uint32_t delta = pkt->seqno - last_seqno;
+        if (!have_seqno || (delta == 1) || ((delta > LOG_WINDOW) && (-delta > LOG_WINDOW))) {
             buf[r] = 0;
             printf("%s", pkt->data);
             last_seqno = pkt->seqno;
+            have_seqno = true;
         }
+        pkt->seqno = last_seqno;
         sendto(s, buf, 8, 0, (struct sockaddr*)&ra, rlen);
     }
 
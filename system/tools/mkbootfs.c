@@ -19,23 +19,14 @@
 #include <sys/stat.h>
 
 #include <lz4frame.h>
+#include <lz4frame_mt.h>
 
 #include <magenta/bootdata.h>
+#include <magenta/bootfs.h>
 
 int verbose = 0;
 
-char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
-
-// BOOTFS is a trivial "filesystem" format
-//
-// It has a 16 byte magic/version value (FSMAGIC)
-// Followed by a series of records of:
-//   namelength (32bit le)
-//   filesize   (32bit le)
-//   fileoffset (32bit le)
-//   namedata   (namelength bytes, includes \0)
-//
-// - fileoffsets must be page aligned (multiple of 4096)
+// The format is described in <magenta/bootfs.h>
 
 #define FSENTRYSZ 12
 
@@ -49,6 +40,8 @@ struct fsentry {
     uint32_t length;
 
     char *srcpath;
+    // the file's contents as they are stored, if they are compressed
+    void *data;
 };
 typedef struct fs {
     fsentry *first;
@@ -363,6 +356,46 @@ static const copy_ops copy_compress = {
     .copy_finish = compress_finish,
 };
 
+// Compresses each file into an LZ4 frame of its own, for the image to be
+// written with BOOTDATA_BOOTFS_FLAG_COMPRESSED_FILES, updating its length to
+// that of the frame. The blocks of a file are compressed on a thread per cpu.
+int compress_entries(fs *fs) {
+    for (fsentry *e = fs->first; e != NULL; e = e->next) {
+        if (e->length == 0) {
+            // A frame can't say its content size is zero, so empty files
+            // are stored as nothing.
+            continue;
+        }
+        void *src;
+        if ((src = malloc(e->length)) == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        if (copyfile(src, e->srcpath, e->length, NULL) < 0) {
+            free(src);
+            return -1;
+        }
+        LZ4F_preferences_t prefs = lz4_prefs;
+        prefs.frameInfo.contentSize = e->length;
+        size_t bound = LZ4F_compressFrameBound(e->length, &prefs);
+        if ((e->data = malloc(bound)) == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            free(src);
+            return -1;
+        }
+        size_t wrote = LZ4F_compressFrame_mt(e->data, bound, src, e->length, &prefs, 0);
+        free(src);
+        if (check_and_log_lz4_error(wrote, "could not compress file")) {
+            return -1;
+        }
+        if (verbose) {
+            fprintf(stderr, "%08x -> %08zx %s\n", e->length, wrote, e->name);
+        }
+        e->length = wrote;
+    }
+    return 0;
+}
+
 #define PAGEALIGN(n) (((n) + 4095) & (~4095))
 #define PAGEFILL(n) (PAGEALIGN(n) - (n))
 
@@ -370,11 +403,13 @@ char fill[4096];
 
 #define CHECK_WRITE(w) if ((w) < 0) goto fail
 
-int export_userfs(const char *fn, fs *fs, unsigned hsz, uint64_t outsize, bool compressed) {
+int export_userfs(const char *fn, fs *fs, unsigned hsz, uint32_t index_slots,
+                  uint64_t outsize, bool compressed, bool compressed_files) {
     uint32_t n;
     fsentry *e;
     int fd;
     const copy_ops* op = compressed ? &copy_compress : &copy_passthrough;
+    bootfs_index_slot_t* index = NULL;
 
     fd = open(fn, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (fd < 0) {
@@ -408,7 +443,33 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz, uint64_t outsize, bool c
         dst += wrote;
     }
 
-    CHECK_WRITE(wrote = op->copy_data(dst, FSMAGIC, sizeof(FSMAGIC), cookie));
+    // Index the records by name
+    bootfs_header_t fshdr = {
+        .magic = BOOTFS_MAGIC,
+        .index_offset = hsz - (index_slots * sizeof(bootfs_index_slot_t)),
+        .index_slots = index_slots,
+    };
+    if (index_slots > 0) {
+        if ((index = calloc(index_slots, sizeof(*index))) == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            goto fail;
+        }
+        uint32_t dirent = sizeof(bootdata_t) + sizeof(fshdr);
+        for (e = fs->first; e != NULL; e = e->next) {
+            // A repeated name goes to a later slot, so the first one is
+            // found, as by walking the records.
+            uint32_t hash = bootfs_hash(e->name, e->namelen - 1);
+            uint32_t slot = hash & (index_slots - 1);
+            while (index[slot].dirent != 0) {
+                slot = (slot + 1) & (index_slots - 1);
+            }
+            index[slot].hash = hash;
+            index[slot].dirent = dirent;
+            dirent += FSENTRYSZ + e->namelen;
+        }
+    }
+
+    CHECK_WRITE(wrote = op->copy_data(dst, &fshdr, sizeof(fshdr), cookie));
     dst += wrote;
 
     fsentry* last_entry = NULL;
@@ -430,6 +491,13 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz, uint64_t outsize, bool c
     CHECK_WRITE(wrote = op->copy_data(dst, fill, 12, cookie));
     dst += wrote;
 
+    if (index) {
+        CHECK_WRITE(wrote = op->copy_data(dst, index, index_slots * sizeof(*index), cookie));
+        dst += wrote;
+        free(index);
+        index = NULL;
+    }
+
     n = PAGEFILL(hsz);
     if (n) {
         CHECK_WRITE(wrote = op->copy_data(dst, fill, n, cookie));
@@ -440,7 +508,11 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz, uint64_t outsize, bool c
         if (verbose) {
             fprintf(stderr, "%08x %08x %s\n", e->offset, e->length, e->name);
         }
-        CHECK_WRITE(wrote = op->copy_file(dst, e->srcpath, e->length, cookie));
+        if (e->data) {
+            CHECK_WRITE(wrote = op->copy_data(dst, e->data, e->length, cookie));
+        } else {
+            CHECK_WRITE(wrote = op->copy_file(dst, e->srcpath, e->length, cookie));
+        }
         dst += wrote;
         n = PAGEFILL(e->length);
         if (n) {
@@ -476,7 +548,8 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz, uint64_t outsize, bool c
         .type = BOOTDATA_TYPE_BOOTFS,
         .insize = wrote,
         .outsize = compressed ? outsize : wrote,
-        .flags = compressed ? BOOTDATA_BOOTFS_FLAG_COMPRESSED : 0
+        .flags = (compressed ? BOOTDATA_BOOTFS_FLAG_COMPRESSED : 0) |
+                 (compressed_files ? BOOTDATA_BOOTFS_FLAG_COMPRESSED_FILES : 0),
     };
     // Note: this is a memcpy rather than an op->copy_data, since it's written
     // outside the area that's potentially compressed.
@@ -496,6 +569,7 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz, uint64_t outsize, bool c
 
 fail:
     fprintf(stderr, "error: failed writing '%s'\n", fn);
+    free(index);
     munmap(dst_start, dstsize);
 fail2:
     close(fd);
@@ -510,6 +584,7 @@ int main(int argc, char **argv) {
     unsigned hsz = 0;
     uint64_t off;
     bool compressed = false;
+    bool compressed_files = false;
 
     argc--;
     argv++;
@@ -528,10 +603,14 @@ int main(int argc, char **argv) {
             argc--;
             argv++;
         } else if (!strcmp(cmd,"-h")) {
-            fprintf(stderr, "usage: mkbootfs [-v] [-o <fsimage>] <manifests>...\n");
+            fprintf(stderr, "usage: mkbootfs [-v] [-c | -f] [-o <fsimage>] <manifests>...\n"
+                    "  -c  compress the whole image\n"
+                    "  -f  compress each file, to be decompressed when first used\n");
             return 0;
         } else if (!strcmp(cmd,"-c")) {
             compressed = true;
+        } else if (!strcmp(cmd,"-f")) {
+            compressed_files = true;
         } else {
             fprintf(stderr, "unknown option: %s\n", cmd);
             return -1;
@@ -543,6 +622,10 @@ int main(int argc, char **argv) {
         fprintf(stderr, "no manifest files given\n");
         return -1;
     }
+    if (compressed && compressed_files) {
+        fprintf(stderr, "-c and -f cannot be used together\n");
+        return -1;
+    }
     for (i = 0; i < argc; i++) {
         char *path = argv[i];
         if (path[0] == '@') {
@@ -560,15 +643,34 @@ int main(int argc, char **argv) {
         }
     }
 
+    // the offsets below are of the files as stored
+    if (compressed_files && compress_entries(&fs) < 0) {
+        return -1;
+    }
+
     // account for bootdata
     hsz += sizeof(bootdata_t);
 
-    // account for the magic
-    hsz += sizeof(FSMAGIC);
+    // account for the bootfs header
+    hsz += sizeof(bootfs_header_t);
 
     // account for the end-of-records record
     hsz += 12;
 
+    // account for the index, which is kept at most half full
+    uint32_t entries = 0;
+    for (e = fs.first; e != NULL; e = e->next) {
+        entries++;
+    }
+    uint32_t index_slots = 0;
+    if (entries > 0) {
+        index_slots = 1;
+        while (index_slots < 2 * entries) {
+            index_slots *= 2;
+        }
+    }
+    hsz += index_slots * sizeof(bootfs_index_slot_t);
+
     off = PAGEALIGN(hsz);
     fsentry* last_entry = NULL;
     for (e = fs.first; e != NULL; e = e->next) {
@@ -583,5 +685,5 @@ int main(int argc, char **argv) {
     if (last_entry && last_entry->length == 0) {
         off += sizeof(fill);
     }
-    return export_userfs(output_file, &fs, hsz, off, compressed);
+    return export_userfs(output_file, &fs, hsz, index_slots, off, compressed, compressed_files);
 }
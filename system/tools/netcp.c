@@ -8,6 +8,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -22,23 +23,257 @@
 #include <unistd.h>
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <magenta/netboot.h>
 
 static const char* appname;
 
+// Windowed transfers keep up to a window of blocks in flight, each request
+// and ack naming its block. When acks stop coming, the blocks not acked are
+// asked for (or sent) again; those that were are not.
+#define WINDOW_MAX 64
+#define WINDOW_TIMEOUT_MS 100
+#define WINDOW_RETRIES 20
+
+typedef struct {
+    struct nbmsg_t hdr;
+    uint8_t data[NB_WINDOW_BLOCK_SIZE + 1];
+} block_msg;
+
+typedef struct {
+    uint8_t data[NB_WINDOW_BLOCK_SIZE];
+    size_t len;
+    // pull: it arrived; push: it was acked
+    bool done;
+} window_slot;
+
+static void window_send(int s, uint32_t cookie, uint32_t cmd, uint32_t blocknum,
+                        const void* data, size_t len) {
+    block_msg out;
+    out.hdr.magic = NB_MAGIC;
+    out.hdr.cookie = cookie;
+    out.hdr.cmd = cmd;
+    out.hdr.arg = blocknum;
+    memcpy(out.data, data, len);
+    // the server takes the last byte for a terminator
+    out.data[len] = 0;
+    write(s, &out, sizeof(out.hdr) + len + 1);
+}
+
+// Returns the size of the next ack of the transfer, 0 when none came in
+// time, or -1 on error.
+static ssize_t window_recv(int s, uint32_t cookie, block_msg* in) {
+    struct pollfd fds = {
+        .fd = s,
+        .events = POLLIN,
+    };
+    for (;;) {
+        int r = poll(&fds, 1, WINDOW_TIMEOUT_MS);
+        if (r <= 0) {
+            return r;
+        }
+        ssize_t n = recv(s, in, sizeof(*in), 0);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                continue;
+            }
+            return -1;
+        }
+        // anything else is a stray ack of an earlier request
+        if ((n >= (ssize_t)sizeof(in->hdr)) && (in->hdr.magic == NB_MAGIC) &&
+            (in->hdr.cookie == cookie) && (in->hdr.cmd == NB_ACK)) {
+            if ((int32_t)in->hdr.arg < 0) {
+                errno = -(int32_t)in->hdr.arg;
+                return -1;
+            }
+            return n;
+        }
+    }
+}
+
+// Drops the acks of repeats, which would otherwise be taken for strays by
+// the next netboot_txn().
+static void window_drain(int s) {
+    block_msg in;
+    while (recv(s, &in, sizeof(in), MSG_DONTWAIT) > 0)
+        ;
+}
+
+static int pull_windowed(int s, int fd, unsigned window, int* total) {
+    window_slot* slots = calloc(window, sizeof(window_slot));
+    if (slots == NULL) {
+        return -1;
+    }
+    uint32_t cookie = netboot_cookie();
+    // blocks from base to next were asked for; end is the first past the
+    // end of the file, once a short one came
+    uint32_t base = 0;
+    uint32_t next = 0;
+    uint32_t end = UINT32_MAX;
+    int retries = 0;
+    int r = -1;
+    block_msg in;
+    while (base < end) {
+        while ((next < base + window) && (next < end)) {
+            window_send(s, cookie, NB_READ, next++, NULL, 0);
+        }
+        ssize_t n = window_recv(s, cookie, &in);
+        if (n < 0) {
+            fprintf(stderr, "%s: error reading block %u (%d)\n", appname, base, errno);
+            goto done;
+        }
+        if (n == 0) {
+            if (retries++ == WINDOW_RETRIES) {
+                fprintf(stderr, "%s: timed out reading block %u\n", appname, base);
+                goto done;
+            }
+            for (uint32_t b = base; b < MIN(next, end); b++) {
+                if (!slots[b % window].done) {
+                    window_send(s, cookie, NB_READ, b, NULL, 0);
+                }
+            }
+            continue;
+        }
+        retries = 0;
+
+        uint32_t b = in.hdr.arg;
+        if ((b < base) || (b >= MIN(next, end)) || slots[b % window].done) {
+            // a repeat
+            continue;
+        }
+        window_slot* slot = &slots[b % window];
+        slot->len = MIN(n - sizeof(in.hdr), NB_WINDOW_BLOCK_SIZE);
+        memcpy(slot->data, in.data, slot->len);
+        slot->done = true;
+        if (slot->len < NB_WINDOW_BLOCK_SIZE) {
+            end = b + 1;
+        }
+
+        // what arrived in order goes to the file
+        while ((base < end) && slots[base % window].done) {
+            slot = &slots[base % window];
+            if (write(fd, slot->data, slot->len) < (ssize_t)slot->len) {
+                fprintf(stderr, "%s: pull short local write: %s\n",
+                        appname, strerror(errno));
+                goto done;
+            }
+            *total += slot->len;
+            slot->done = false;
+            base++;
+        }
+    }
+    r = 0;
+done:
+    window_drain(s);
+    free(slots);
+    return r;
+}
+
+// Reads a whole block from the file, unless it ends first.
+static ssize_t read_block(int fd, uint8_t* data) {
+    size_t len = 0;
+    while (len < NB_WINDOW_BLOCK_SIZE) {
+        ssize_t n = read(fd, data + len, NB_WINDOW_BLOCK_SIZE - len);
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    return len;
+}
+
+static int push_windowed(int s, int fd, unsigned window, int* total) {
+    window_slot* slots = calloc(window, sizeof(window_slot));
+    if (slots == NULL) {
+        return -1;
+    }
+    uint32_t cookie = netboot_cookie();
+    // blocks from base to next were sent
+    uint32_t base = 0;
+    uint32_t next = 0;
+    bool eof = false;
+    int retries = 0;
+    int r = -1;
+    block_msg in;
+    for (;;) {
+        while (!eof && (next < base + window)) {
+            window_slot* slot = &slots[next % window];
+            ssize_t len = read_block(fd, slot->data);
+            if (len < 0) {
+                fprintf(stderr, "%s: error reading block %u (%d)\n", appname, next, errno);
+                goto done;
+            }
+            if (len < NB_WINDOW_BLOCK_SIZE) {
+                eof = true;
+                if (len == 0) {
+                    break;
+                }
+            }
+            slot->len = len;
+            slot->done = false;
+            window_send(s, cookie, NB_WRITE, next++, slot->data, len);
+            *total += len;
+        }
+        if (base == next) {
+            break;
+        }
+
+        ssize_t n = window_recv(s, cookie, &in);
+        if (n < 0) {
+            fprintf(stderr, "%s: error writing block %u (%d)\n", appname, base, errno);
+            goto done;
+        }
+        if (n == 0) {
+            if (retries++ == WINDOW_RETRIES) {
+                fprintf(stderr, "%s: timed out writing block %u\n", appname, base);
+                goto done;
+            }
+            for (uint32_t b = base; b < next; b++) {
+                window_slot* slot = &slots[b % window];
+                if (!slot->done) {
+                    window_send(s, cookie, NB_WRITE, b, slot->data, slot->len);
+                }
+            }
+            continue;
+        }
+        retries = 0;
+
+        uint32_t b = in.hdr.arg;
+        if ((b >= base) && (b < next)) {
+            slots[b % window].done = true;
+        }
+        while ((base < next) && slots[base % window].done) {
+            base++;
+        }
+    }
+    r = 0;
+done:
+    window_drain(s);
+    free(slots);
+    return r;
+}
+
 static int pull_file(int s, const char* dst, const char* src) {
     int r;
     msg in, out;
     size_t src_len = strlen(src);
 
     out.hdr.cmd = NB_OPEN;
-    out.hdr.arg = O_RDONLY;
+    out.hdr.arg = O_RDONLY | NB_OPEN_WINDOW;
     memcpy(out.data, src, src_len);
     out.data[src_len] = 0;
 
     r = netboot_txn(s, &in, &out, sizeof(out.hdr) + src_len + 1);
+    if ((r < 0) && (errno == EINVAL)) {
+        // a server without windowed transfers
+        out.hdr.arg = O_RDONLY;
+        r = netboot_txn(s, &in, &out, sizeof(out.hdr) + src_len + 1);
+    }
     if (r < 0) {
         fprintf(stderr, "%s: error opening remote file %s (%d)\n",
                 appname, src, errno);
@@ -59,9 +294,15 @@ static int pull_file(int s, const char* dst, const char* src) {
         return -1;
     }
 
+    unsigned window = MIN((unsigned)in.hdr.arg, WINDOW_MAX);
     int n = 0;
     int blocknum = 0;
-    for (;;) {
+    if ((window > 0) && (pull_windowed(s, fd, window, &n) < 0)) {
+        close(fd);
+        return -1;
+    }
+    // without a window, one block at a time
+    while (window == 0) {
         memset(&out, 0, sizeof(out));
         out.hdr.cmd = NB_READ;
         out.hdr.arg = blocknum;
@@ -114,13 +355,18 @@ static int push_file(int s, const char* dst, const char* src) {
     const char* ptr;
 
     out.hdr.cmd = NB_OPEN;
-    out.hdr.arg = O_WRONLY;
+    out.hdr.arg = O_WRONLY | NB_OPEN_WINDOW;
     memcpy(out.data, dst, dst_len);
     out.data[dst_len] = 0;
 
 again:
     r = netboot_txn(s, &in, &out, sizeof(out.hdr) + dst_len + 1);
     if (r < 0) {
+        if ((errno == EINVAL) && (out.hdr.arg & NB_OPEN_WINDOW)) {
+            // a server without windowed transfers
+            out.hdr.arg = O_WRONLY;
+            goto again;
+        }
         if (errno == EISDIR) {
             ptr = strrchr(src, '/');
             if (!ptr) {
@@ -150,10 +396,16 @@ again:
         return -1;
     }
 
+    unsigned window = MIN((unsigned)in.hdr.arg, WINDOW_MAX);
     int n = 0;
     int len = 0;
     int blocknum = 0;
-    for (;;) {
+    if ((window > 0) && (push_windowed(s, fd, window, &n) < 0)) {
+        close(fd);
+        return -1;
+    }
+    // without a window, one block at a time
+    while (window == 0) {
         memset(&out, 0, sizeof(out));
         out.hdr.cmd = NB_WRITE;
         out.hdr.arg = blocknum;
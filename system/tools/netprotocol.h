@@ -18,3 +18,6 @@ struct sockaddr_in6;
 int netboot_open(const char* hostname, unsigned port, struct sockaddr_in6* addr_out);
 
 int netboot_txn(int s, msg* in, msg* out, int outlen);
+
+// Returns a cookie no netboot_txn() uses, for requests sent without it.
+uint32_t netboot_cookie(void);
@@ -473,6 +473,7 @@ struct GenParams {
     const char* switch_var;
     const char* switch_type;
     std::map<string, string> attributes;
+    size_t max_args;
 };
 
 bool generate_file_header(std::ofstream& os) {
@@ -508,6 +509,19 @@ bool is_vdso(const Syscall& sc) {
         sc.attributes.begin(), sc.attributes.end(), "vdsocall") != sc.attributes.end();
 }
 
+// A "vdsofast" syscall is a real syscall whose vDSO entry point is C code that answers
+// what it can from the vDSO's read-only data, calling the syscall itself only as a fallback.
+bool is_vdso_fast(const Syscall& sc) {
+    return std::find(
+        sc.attributes.begin(), sc.attributes.end(), "vdsofast") != sc.attributes.end();
+}
+
+// A "batchable" syscall can also be run as an operation of mx_batch_submit().
+bool is_batchable(const Syscall& sc) {
+    return std::find(
+        sc.attributes.begin(), sc.attributes.end(), "batchable") != sc.attributes.end();
+}
+
 bool is_noreturn(const Syscall& sc) {
     return std::find(
         sc.attributes.begin(), sc.attributes.end(), "noreturn") != sc.attributes.end();
@@ -598,6 +612,84 @@ bool generate_legacy_header(
     return os.good();
 }
 
+bool generate_vdso_fallback_header(
+    int index, const GenParams& gp, std::ofstream& os, const Syscall& sc) {
+    if (!is_vdso_fast(sc))
+        return true;
+    return generate_legacy_header(index, gp, os, sc);
+}
+
+// The C type an argument is passed as, with arrays passed as pointers.
+string arg_c_type(const TypeSpec& arg) {
+    auto overrided = override_type(arg.to_string());
+    if (overrided != arg.to_string())
+        return overrided;
+    if (!arg.arr_spec)
+        return arg.type;
+    return (arg.arr_spec->kind == ArraySpec::IN ? "const " : "") + arg.type + "*";
+}
+
+bool generate_batch_code(int index, const GenParams& gp, std::ofstream& os, const Syscall& sc) {
+    if (!is_batchable(sc))
+        return true;
+    if (is_vdso(sc) || is_noreturn(sc) || sc.ret_spec.empty() ||
+        sc.arg_spec.size() > gp.max_args) {
+        fprintf(stderr, "error: %s cannot be batchable\n", sc.name.c_str());
+        return false;
+    }
+    os << "    case " << index << ":\n"
+       << "        " << gp.switch_var << " = static_cast<int64_t>(" << gp.name_prefix
+       << sc.name << "(";
+    for (size_t i = 0; i < sc.arg_spec.size(); i++) {
+        os << (i ? ",\n            " : "\n            ")
+           << "(" << arg_c_type(sc.arg_spec[i]) << ")" << gp.switch_type << "[" << i << "]";
+    }
+    os << "));\n"
+       << "        break;\n";
+    return os.good();
+}
+
+// A wrapper around a syscall's kernel entry point recording how long each
+// call takes, for kernels built WITH_SYSCALL_STATS.
+bool generate_stats_code(int index, const GenParams& gp, std::ofstream& os, const Syscall& sc) {
+    if (is_vdso(sc))
+        return true;
+    bool returns = !sc.ret_spec.empty();
+    os << "static " << override_type(returns ? sc.ret_spec[0].to_string() : string()) << " "
+       << gp.entry_prefix << gp.name_prefix << sc.name << "(";
+    for (size_t i = 0; i < sc.arg_spec.size(); i++) {
+        os << (i ? ",\n    " : "\n    ") << arg_c_type(sc.arg_spec[i]) << " "
+           << sc.arg_spec[i].name;
+    }
+    os << ") {\n"
+       << "    uint64_t start = syscall_stats_begin();\n";
+
+    string call = gp.name_prefix + sc.name + "(";
+    for (size_t i = 0; i < sc.arg_spec.size(); i++)
+        call += (i ? ", " : "") + sc.arg_spec[i].name;
+    call += ")";
+
+    if (returns) {
+        os << "    auto ret = " << call << ";\n"
+           << "    syscall_stats_end(" << index << ", start);\n"
+           << "    return ret;\n";
+    } else {
+        // calls that don't return are counted on the way in
+        os << "    syscall_stats_end(" << index << ", start);\n"
+           << "    " << call << ";\n";
+    }
+    os << "}\n\n";
+    return os.good();
+}
+
+bool generate_batch_numbers_header(
+    int index, const GenParams& gp, std::ofstream& os, const Syscall& sc) {
+    if (!is_batchable(sc))
+        return true;
+    os << gp.entry_prefix << sc.name << " " << index << "\n";
+    return os.good();
+}
+
 bool generate_legacy_code(int index, const GenParams& gp, std::ofstream& os, const Syscall& sc) {
     if (is_vdso(sc))
         return true;
@@ -612,8 +704,8 @@ bool generate_legacy_assembly_x64(
     if (is_vdso(sc))
         return true;
     // SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) m_syscall nargs64, mx_##name, n
-    os << gp.entry_prefix << " " << sc.arg_spec.size() << " "
-       << gp.name_prefix << sc.name << " " << index << "\n";
+    os << (is_vdso_fast(sc) ? "m_syscall_fallback" : gp.entry_prefix) << " "
+       << sc.arg_spec.size() << " " << gp.name_prefix << sc.name << " " << index << "\n";
     return os.good();
 }
 
@@ -622,7 +714,8 @@ bool generate_legacy_assembly_arm64(
     if (is_vdso(sc))
         return true;
     // SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) m_syscall mx_##name, n
-    os << gp.entry_prefix << " " << gp.name_prefix << sc.name << " " << index << "\n";
+    os << (is_vdso_fast(sc) ? "m_syscall_fallback" : gp.entry_prefix) << " "
+       << gp.name_prefix << sc.name << " " << index << "\n";
     return os.good();
 }
 
@@ -653,6 +746,11 @@ const std::map<string, string> user_attrs = {
     {"*", "__attribute__((__leaf__))"},
 };
 
+// The syscall entry points behind "vdsofast" calls are internal to the vDSO.
+const std::map<string, string> vdso_fallback_attrs = {
+    {"*", "__attribute__((visibility(\"hidden\")))"},
+};
+
 enum GenType : uint32_t {
     UserHeaderC,
     KernelHeaderCPP,
@@ -661,6 +759,11 @@ enum GenType : uint32_t {
     KernelAsmArm64,
     SyscallNumberHeader,
     TraceInfo,
+    VdsoFallbackHeader,
+    KernelBatchCodeCPP,
+    BatchNumberHeader,
+    KernelStatsCodeCPP,
+    KernelStatsSwitchCPP,
     Max
 };
 
@@ -719,7 +822,58 @@ const GenParams gen_params[] = {
     {
         generate_trace_info,
         ".trace.inc",
-    }
+    },
+    // Declarations of the syscall entry points that "vdsofast" calls fall
+    // back to, for the vDSO's own use.  (VdsoFallbackHeader)
+    {
+        generate_vdso_fallback_header,
+        ".vdso-fallback.h",     // file postfix.
+        "extern",               // function prefix.
+        "SYSCALL_mx_",          // function name prefix.
+        "void",                 // no-args special type
+        nullptr,                // switch var (does not apply)
+        nullptr,                // switch type (does not apply)
+        vdso_fallback_attrs,    // attributes dictionary
+    },
+    // The kernel C++ code running batchable syscalls for
+    // mx_batch_submit(). A switch statement set.  (KernelBatchCodeCPP)
+    {
+        generate_batch_code,
+        ".batch.inc",       // file postfix.
+        nullptr,            // no function prefix.
+        "sys_",             // function name prefix.
+        nullptr,            // no-args (does not apply)
+        "result",           // switch var name
+        "args",             // array of arguments
+        {},                 // no attributes
+        8u,                 // arguments an operation carries
+    },
+    // A C header defining MX_BATCH_OP_* operation numbers for the batchable
+    // syscalls.  (BatchNumberHeader)
+    {
+        generate_batch_numbers_header,
+        ".batch-ops.h",       // file postfix.
+        "#define MX_BATCH_OP_", // macro prefix.
+    },
+    // The kernel C++ code wrapping each syscall to record its latency, for
+    // kernels built WITH_SYSCALL_STATS.  (KernelStatsCodeCPP)
+    {
+        generate_stats_code,
+        ".stats.inc",       // file postfix.
+        "stats_",           // wrapper name prefix.
+        "sys_",             // function name prefix.
+    },
+    // The syscall switch statement set calling those wrappers instead of
+    // the syscalls themselves.  (KernelStatsSwitchCPP)
+    {
+        generate_legacy_code,
+        ".stats-switch.inc",  // file postfix.
+        nullptr,            // no function prefix.
+        "stats_sys_",       // function name prefix.
+        nullptr,            // no-args (does not apply)
+        "sfunc",            // switch var name
+        "syscall_func"      // switch var type
+    },
 };
 
 class SygenGenerator {
@@ -888,6 +1042,16 @@ int main(int argc, char* argv[]) {
         return 1;
     if (!generator.Generate(GenType::TraceInfo, output_prefix))
         return 1;
+    if (!generator.Generate(GenType::VdsoFallbackHeader, output_prefix))
+        return 1;
+    if (!generator.Generate(GenType::KernelBatchCodeCPP, output_prefix))
+        return 1;
+    if (!generator.Generate(GenType::BatchNumberHeader, output_prefix))
+        return 1;
+    if (!generator.Generate(GenType::KernelStatsCodeCPP, output_prefix))
+        return 1;
+    if (!generator.Generate(GenType::KernelStatsSwitchCPP, output_prefix))
+        return 1;
 
     return 0;
 }
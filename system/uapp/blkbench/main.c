@@ -0,0 +1,470 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include <magenta/device/block.h>
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+
+#include <mxio/io.h>
+
+// blkbench drives a block device through the fifo interface (see
+// block_fifo_t) with a mix of reads and writes, and reports throughput and
+// latency percentiles as JSON on stdout, for tracking across builds.
+//
+// Each thread opens the device for itself, and keeps up to the queue depth
+// of requests in flight. Sequential threads each sweep their own slice of
+// the region; random ones pick blocks anywhere in it.
+
+#define MAX_THREADS 16
+
+// latencies are counted in buckets of 1/8th of a power of two of ns
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS  (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    uint64_t hist[HIST_BUCKETS];
+} stats_t;
+
+typedef struct {
+    const char* dev;
+    bool random;
+    // percentage of requests that are reads
+    unsigned read_pct;
+    uint64_t block_size;
+    uint32_t depth;
+    uint32_t threads;
+    mx_time_t duration;
+    // the region of the device to use, in bytes
+    uint64_t offset;
+    uint64_t size;
+} config_t;
+
+typedef struct {
+    const config_t* cfg;
+    uint32_t nr;
+    thrd_t thread;
+    uint64_t seed;
+    mx_status_t status;
+    uint64_t errors;
+    stats_t read;
+    stats_t write;
+} worker_t;
+
+static unsigned hist_bucket(uint64_t ns) {
+    if (ns < HIST_SUB) {
+        return (unsigned)ns;
+    }
+    unsigned log = 63 - __builtin_clzll(ns);
+    unsigned sub = (unsigned)(ns >> (log - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (log - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// the middle of the latencies a bucket counts
+static uint64_t hist_value(unsigned bucket) {
+    if (bucket < HIST_SUB) {
+        return bucket;
+    }
+    unsigned log = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t base = (1ull << log) + ((uint64_t)(bucket % HIST_SUB) << (log - HIST_SUB_BITS));
+    return base + (1ull << (log - HIST_SUB_BITS)) / 2;
+}
+
+static void stats_add(stats_t* s, uint64_t bytes, uint64_t ns) {
+    if ((s->ops == 0) || (ns < s->lat_min)) {
+        s->lat_min = ns;
+    }
+    s->lat_max = MAX(s->lat_max, ns);
+    s->ops++;
+    s->bytes += bytes;
+    s->lat_sum += ns;
+    s->hist[hist_bucket(ns)]++;
+}
+
+static void stats_merge(stats_t* s, const stats_t* from) {
+    if (from->ops == 0) {
+        return;
+    }
+    if ((s->ops == 0) || (from->lat_min < s->lat_min)) {
+        s->lat_min = from->lat_min;
+    }
+    s->lat_max = MAX(s->lat_max, from->lat_max);
+    s->ops += from->ops;
+    s->bytes += from->bytes;
+    s->lat_sum += from->lat_sum;
+    for (unsigned n = 0; n < HIST_BUCKETS; n++) {
+        s->hist[n] += from->hist[n];
+    }
+}
+
+// the latency that permille thousandths of the requests took at most
+static uint64_t stats_percentile(const stats_t* s, unsigned permille) {
+    uint64_t want = (s->ops * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (unsigned n = 0; n < HIST_BUCKETS; n++) {
+        seen += s->hist[n];
+        if ((seen >= want) && (seen > 0)) {
+            return MIN(MAX(hist_value(n), s->lat_min), s->lat_max);
+        }
+    }
+    return s->lat_max;
+}
+
+static void stats_print(const char* name, const stats_t* s, mx_time_t elapsed) {
+    uint64_t ms = MAX(elapsed / 1000000, 1u);
+    printf("  \"%s\": {\"ops\": %" PRIu64 ", \"bytes\": %" PRIu64 ", "
+           "\"iops\": %" PRIu64 ", \"bw_bytes\": %" PRIu64 ",\n", name, s->ops, s->bytes,
+           s->ops * 1000 / ms, s->bytes * 1000 / ms);
+    printf("    \"lat_ns\": {\"min\": %" PRIu64 ", \"mean\": %" PRIu64 ", \"max\": %" PRIu64 ", "
+           "\"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", "
+           "\"p99.9\": %" PRIu64 "}}",
+           s->lat_min, s->ops ? s->lat_sum / s->ops : 0, s->lat_max,
+           stats_percentile(s, 500), stats_percentile(s, 900), stats_percentile(s, 990),
+           stats_percentile(s, 999));
+}
+
+// xorshift64*
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ull;
+}
+
+static int worker_thread(void* arg) {
+    worker_t* w = arg;
+    const config_t* cfg = w->cfg;
+    mx_handle_t vmo = MX_HANDLE_INVALID;
+    block_fifo_t fifo = {};
+    uintptr_t entries = 0;
+    size_t entries_size = 0;
+    mx_time_t* started = NULL;
+    bool* reading = NULL;
+    uint32_t* free_slots = NULL;
+
+    int fd = open(cfg->dev, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "blkbench: cannot open %s\n", cfg->dev);
+        w->status = ERR_IO;
+        return 0;
+    }
+
+    // at least as many ring entries as requests in flight
+    block_get_fifo_args_t args = { .entries_count = 1 };
+    while (args.entries_count < cfg->depth) {
+        args.entries_count <<= 1;
+    }
+    ssize_t r;
+    if ((r = ioctl_block_get_fifo(fd, &args, &fifo)) != sizeof(fifo)) {
+        fprintf(stderr, "blkbench: cannot get a fifo for %s: %zd\n", cfg->dev, r);
+        w->status = (r < 0) ? (mx_status_t)r : ERR_IO;
+        goto done;
+    }
+    entries_size = fifo.rsp_offset + fifo.entries_count * sizeof(block_fifo_response_t);
+    if ((w->status = mx_vmar_map(mx_vmar_root_self(), 0, fifo.entries_vmo, 0, entries_size,
+                                 MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                                 &entries)) != NO_ERROR) {
+        entries = 0;
+        goto done;
+    }
+    block_fifo_request_t* reqs = (block_fifo_request_t*)entries;
+    block_fifo_response_t* rsps = (block_fifo_response_t*)(entries + fifo.rsp_offset);
+
+    // each request in flight has a block of the VMO to itself
+    mx_handle_t dup;
+    if ((w->status = mx_vmo_create(cfg->depth * cfg->block_size, 0, &vmo)) != NO_ERROR) {
+        goto done;
+    }
+    if ((w->status = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &dup)) != NO_ERROR) {
+        goto done;
+    }
+    if ((r = ioctl_block_set_fifo_vmo(fd, &dup)) < 0) {
+        w->status = (mx_status_t)r;
+        goto done;
+    }
+
+    started = calloc(cfg->depth, sizeof(mx_time_t));
+    reading = calloc(cfg->depth, sizeof(bool));
+    free_slots = calloc(cfg->depth, sizeof(uint32_t));
+    if ((started == NULL) || (reading == NULL) || (free_slots == NULL)) {
+        w->status = ERR_NO_MEMORY;
+        goto done;
+    }
+    uint32_t nfree = cfg->depth;
+    for (uint32_t n = 0; n < cfg->depth; n++) {
+        free_slots[n] = cfg->depth - 1 - n;
+    }
+
+    // sequential threads each take their own slice of the region
+    uint64_t blocks = cfg->size / cfg->block_size;
+    uint64_t first = 0;
+    if (!cfg->random) {
+        blocks = MAX(blocks / cfg->threads, 1u);
+        first = (w->nr * blocks) % (cfg->size / cfg->block_size);
+    }
+    uint64_t next = 0;
+
+    mx_fifo_state_t state;
+    if ((w->status = mx_fifo_op(fifo.req_fifo, MX_FIFO_OP_READ_STATE, 0, &state)) != NO_ERROR) {
+        goto done;
+    }
+    uint64_t head = state.head;
+
+    mx_time_t end = mx_time_get(MX_CLOCK_MONOTONIC) + cfg->duration;
+    for (;;) {
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        bool stopping = (now >= end);
+        if (stopping && (nfree == cfg->depth)) {
+            break;
+        }
+
+        // fill the queue back up
+        uint32_t queued = 0;
+        while (!stopping && (nfree > 0)) {
+            uint32_t slot = free_slots[--nfree];
+            uint64_t block;
+            if (cfg->random) {
+                block = next_random(&w->seed) % blocks;
+            } else {
+                block = first + next;
+                next = (next + 1) % blocks;
+            }
+            block_fifo_request_t* req = &reqs[(head + queued) & (fifo.entries_count - 1)];
+            memset(req, 0, sizeof(*req));
+            bool read = (next_random(&w->seed) % 100) < cfg->read_pct;
+            req->txn.opcode = read ? BLOCK_TXN_OP_READ : BLOCK_TXN_OP_WRITE;
+            req->txn.vmo_offset = slot * cfg->block_size;
+            req->txn.dev_offset = cfg->offset + block * cfg->block_size;
+            req->txn.length = cfg->block_size;
+            req->cookie = slot;
+            started[slot] = now;
+            reading[slot] = read;
+            queued++;
+        }
+        if (queued > 0) {
+            if ((w->status = mx_fifo_op(fifo.req_fifo, MX_FIFO_OP_ADVANCE_HEAD, queued,
+                                        &state)) != NO_ERROR) {
+                goto done;
+            }
+            head += queued;
+        }
+
+        // and take in what is done
+        if ((w->status = mx_handle_wait_one(fifo.rsp_fifo, MX_FIFO_NOT_EMPTY, MX_SEC(10),
+                                            NULL)) != NO_ERROR) {
+            fprintf(stderr, "blkbench: thread %u: no responses: %d\n", w->nr, w->status);
+            goto done;
+        }
+        if ((w->status = mx_fifo_op(fifo.rsp_fifo, MX_FIFO_OP_READ_STATE, 0,
+                                    &state)) != NO_ERROR) {
+            goto done;
+        }
+        now = mx_time_get(MX_CLOCK_MONOTONIC);
+        uint64_t n = state.head - state.tail;
+        for (uint64_t i = 0; i < n; i++) {
+            const block_fifo_response_t* rsp =
+                &rsps[(state.tail + i) & (fifo.entries_count - 1)];
+            uint32_t slot = (uint32_t)rsp->cookie;
+            if (slot >= cfg->depth) {
+                w->status = ERR_IO;
+                goto done;
+            }
+            if (rsp->status != NO_ERROR) {
+                w->errors++;
+            } else if (reading[slot]) {
+                stats_add(&w->read, cfg->block_size, now - started[slot]);
+            } else {
+                stats_add(&w->write, cfg->block_size, now - started[slot]);
+            }
+            free_slots[nfree++] = slot;
+        }
+        if ((w->status = mx_fifo_op(fifo.rsp_fifo, MX_FIFO_OP_ADVANCE_TAIL, n,
+                                    &state)) != NO_ERROR) {
+            goto done;
+        }
+    }
+    w->status = NO_ERROR;
+
+done:
+    free(started);
+    free(reading);
+    free(free_slots);
+    if (entries != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), entries, entries_size);
+    }
+    if (fifo.entries_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(fifo.entries_vmo);
+        mx_handle_close(fifo.req_fifo);
+        mx_handle_close(fifo.rsp_fifo);
+    }
+    if (vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(vmo);
+    }
+    close(fd);
+    return 0;
+}
+
+static uint64_t arg_to_u64(const char* arg) {
+    char* end;
+    uint64_t n = strtoull(arg, &end, 0);
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; break;
+    case 'm': case 'M': n <<= 20; break;
+    case 'g': case 'G': n <<= 30; break;
+    }
+    return n;
+}
+
+static int usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] <dev>\n"
+            "  -w MODE   read, write, rw, randread, randwrite or randrw (default read)\n"
+            "  -m PCT    percentage of reads for rw and randrw (default 50)\n"
+            "  -b SIZE   block size in bytes (default 4k)\n"
+            "  -q DEPTH  requests in flight per thread (default 1, at most %u)\n"
+            "  -j N      threads (default 1, at most %u)\n"
+            "  -t SECS   how long to run (default 10)\n"
+            "  -o OFFSET start of the region to use (default 0)\n"
+            "  -s SIZE   size of the region to use (default to the end of the device)\n"
+            "Modes that write overwrite the device's contents.\n"
+            "Results are written to stdout as JSON.\n",
+            argv0, BLOCK_FIFO_MAX_ENTRIES, MAX_THREADS);
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    config_t cfg = {
+        .read_pct = 100,
+        .block_size = 4096,
+        .depth = 1,
+        .threads = 1,
+        .duration = MX_SEC(10),
+    };
+    const char* mode = "read";
+    unsigned mix = 50;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:m:b:q:j:t:o:s:h")) != -1) {
+        switch (opt) {
+        case 'w': mode = optarg; break;
+        case 'm': mix = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'b': cfg.block_size = arg_to_u64(optarg); break;
+        case 'q': cfg.depth = (uint32_t)arg_to_u64(optarg); break;
+        case 'j': cfg.threads = (uint32_t)arg_to_u64(optarg); break;
+        case 't': cfg.duration = MX_SEC(arg_to_u64(optarg)); break;
+        case 'o': cfg.offset = arg_to_u64(optarg); break;
+        case 's': cfg.size = arg_to_u64(optarg); break;
+        default: return usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        return usage(argv[0]);
+    }
+    cfg.dev = argv[optind];
+
+    const char* kind = mode;
+    if (strncmp(kind, "rand", 4) == 0) {
+        cfg.random = true;
+        kind += 4;
+    }
+    if (!strcmp(kind, "read")) {
+        cfg.read_pct = 100;
+    } else if (!strcmp(kind, "write")) {
+        cfg.read_pct = 0;
+    } else if (!strcmp(kind, "rw") && (mix <= 100)) {
+        cfg.read_pct = mix;
+    } else {
+        return usage(argv[0]);
+    }
+    if ((cfg.depth < 1) || (cfg.depth > BLOCK_FIFO_MAX_ENTRIES) ||
+        (cfg.threads < 1) || (cfg.threads > MAX_THREADS) || (cfg.block_size == 0)) {
+        return usage(argv[0]);
+    }
+
+    int fd = open(cfg.dev, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "blkbench: cannot open %s\n", cfg.dev);
+        return -1;
+    }
+    uint64_t dev_size, blksize;
+    if ((ioctl_block_get_size(fd, &dev_size) != sizeof(dev_size)) ||
+        (ioctl_block_get_blocksize(fd, &blksize) != sizeof(blksize))) {
+        fprintf(stderr, "blkbench: %s is not a block device\n", cfg.dev);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    if ((cfg.block_size % blksize) || (cfg.offset % blksize) || (cfg.offset >= dev_size)) {
+        fprintf(stderr, "blkbench: block size and offset must be multiples of %" PRIu64
+                " within the device\n", blksize);
+        return -1;
+    }
+    if ((cfg.size == 0) || (cfg.size > dev_size - cfg.offset)) {
+        cfg.size = dev_size - cfg.offset;
+    }
+    if (cfg.size < cfg.block_size) {
+        fprintf(stderr, "blkbench: region smaller than a block\n");
+        return -1;
+    }
+
+    static worker_t workers[MAX_THREADS];
+    mx_time_t t0 = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint32_t started = 0;
+    for (; started < cfg.threads; started++) {
+        worker_t* w = &workers[started];
+        w->cfg = &cfg;
+        w->nr = started;
+        w->seed = (t0 ^ (0x9e3779b97f4a7c15ull * (started + 1))) | 1;
+        if (thrd_create_with_name(&w->thread, worker_thread, w, "blkbench") != thrd_success) {
+            fprintf(stderr, "blkbench: cannot start thread %u\n", started);
+            break;
+        }
+    }
+    stats_t read = {};
+    stats_t write = {};
+    uint64_t errors = 0;
+    int rc = (started == cfg.threads) ? 0 : -1;
+    for (uint32_t n = 0; n < started; n++) {
+        thrd_join(workers[n].thread, NULL);
+        if (workers[n].status != NO_ERROR) {
+            fprintf(stderr, "blkbench: thread %u failed: %d\n", n, workers[n].status);
+            rc = -1;
+        }
+        stats_merge(&read, &workers[n].read);
+        stats_merge(&write, &workers[n].write);
+        errors += workers[n].errors;
+    }
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - t0;
+
+    printf("{\n");
+    printf("  \"device\": \"%s\", \"mode\": \"%s\", \"read_pct\": %u,\n",
+           cfg.dev, mode, cfg.read_pct);
+    printf("  \"block_size\": %" PRIu64 ", \"queue_depth\": %u, \"threads\": %u,\n",
+           cfg.block_size, cfg.depth, started);
+    printf("  \"offset\": %" PRIu64 ", \"size\": %" PRIu64 ",\n", cfg.offset, cfg.size);
+    printf("  \"runtime_ns\": %" PRIu64 ", \"errors\": %" PRIu64 ",\n", elapsed, errors);
+    stats_print("read", &read, elapsed);
+    printf(",\n");
+    stats_print("write", &write, elapsed);
+    printf("\n}\n");
+    return rc;
+}
@@ -0,0 +1,205 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <magenta/ktrace.h>
+
+// Prints the boot timeline from the kernel trace, bootloader to userspace:
+//
+//   magenta> boottime
+//   magenta> boottime /data/boot.trace
+//
+// The bootloader's and kernel's stages come as TAG_BOOT_* records, which
+// the kernel writes again whenever the trace is rewound. devmgr and devhost
+// mark service launches and driver binds with probes named "launch:<name>"
+// and "bind:<driver>", written 0 at the start and 1 at the end.
+
+#define MAX_STAGES 2048
+#define MAX_NAMES 2048
+#define MAX_OPEN 64
+#define NAME_LEN 32
+
+typedef struct stage {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+} stage_t;
+
+typedef struct name {
+    uint32_t id;
+    char str[NAME_LEN];
+} name_t;
+
+// a probe's start waiting for its end, on the thread that began it
+typedef struct open_probe {
+    uint32_t id;
+    uint32_t tid;
+    uint64_t start;
+} open_probe_t;
+
+static stage_t stages[MAX_STAGES];
+static uint32_t stage_count;
+
+// kernel stages by id, which keeps them once however many times replayed
+static stage_t* boot_stages[MAX_STAGES];
+
+static name_t boot_names[MAX_NAMES];
+static uint32_t boot_name_count;
+static name_t probe_names[MAX_NAMES];
+static uint32_t probe_name_count;
+
+static open_probe_t open_probes[MAX_OPEN];
+static uint32_t open_count;
+
+static const char* find_name(name_t* names, uint32_t count, uint32_t id) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (names[i].id == id)
+            return names[i].str;
+    }
+    return "?";
+}
+
+static void add_name(name_t* names, uint32_t* count, const ktrace_rec_name_t* rec) {
+    uint32_t len = KTRACE_LEN(rec->tag) - KTRACE_NAMESIZE;
+    if (len >= NAME_LEN)
+        len = NAME_LEN - 1;
+    name_t* n = NULL;
+    for (uint32_t i = 0; i < *count; i++) {
+        if (names[i].id == rec->id)
+            n = &names[i];
+    }
+    if (n == NULL) {
+        if (*count == MAX_NAMES)
+            return;
+        n = &names[(*count)++];
+    }
+    n->id = rec->id;
+    memcpy(n->str, rec->name, len);
+    n->str[len] = 0;
+}
+
+static stage_t* new_stage(void) {
+    return (stage_count < MAX_STAGES) ? &stages[stage_count++] : NULL;
+}
+
+static void boot_record(const ktrace_rec_32b_t* rec, bool end) {
+    if (rec->a >= MAX_STAGES)
+        return;
+    stage_t* s = boot_stages[rec->a];
+    if (s == NULL) {
+        if ((s = new_stage()) == NULL)
+            return;
+        boot_stages[rec->a] = s;
+    }
+    uint64_t ts = rec->c | ((uint64_t)rec->d << 32);
+    if (end) {
+        s->end = ts;
+    } else {
+        s->start = ts;
+    }
+}
+
+static void probe_record(const ktrace_rec_32b_t* rec) {
+    uint32_t id = KTRACE_EVENT(rec->tag) & 0x7FF;
+    if (rec->a == 0) {
+        if (open_count < MAX_OPEN) {
+            open_probes[open_count++] = (open_probe_t){ id, rec->tid, rec->ts };
+        }
+        return;
+    }
+    for (uint32_t i = open_count; i-- > 0;) {
+        open_probe_t* p = &open_probes[i];
+        if (p->id != id || p->tid != rec->tid)
+            continue;
+        stage_t* s = new_stage();
+        if (s != NULL) {
+            s->name = find_name(probe_names, probe_name_count, id);
+            s->start = p->start;
+            s->end = rec->ts;
+        }
+        *p = open_probes[--open_count];
+        return;
+    }
+}
+
+static int by_start(const void* a, const void* b) {
+    const stage_t* sa = a;
+    const stage_t* sb = b;
+    return (sa->start > sb->start) - (sa->start < sb->start);
+}
+
+int main(int argc, char** argv) {
+    const char* path = (argc > 1) ? argv[1] : "/dev/class/misc/ktrace";
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "cannot open '%s'\n", path);
+        return -1;
+    }
+
+    uint64_t ticks_per_ms = 0;
+    union {
+        ktrace_rec_32b_t rec;
+        ktrace_rec_name_t name;
+        uint8_t raw[KTRACE_LEN(0xF)];
+    } u;
+    while (fread(u.raw, KTRACE_HDRSIZE, 1, in) == 1) {
+        uint32_t len = KTRACE_LEN(u.rec.tag);
+        if (len < KTRACE_HDRSIZE) {
+            // the metadata records are written whole from the start
+            if (u.rec.tag == 0)
+                break;
+            fprintf(stderr, "bad record in '%s'\n", path);
+            return -1;
+        }
+        if (len > KTRACE_HDRSIZE && fread(u.raw + KTRACE_HDRSIZE, len - KTRACE_HDRSIZE, 1, in) != 1)
+            break;
+
+        uint32_t event = KTRACE_EVENT(u.rec.tag);
+        if (u.rec.tag == TAG_TICKS_PER_MS) {
+            ticks_per_ms = u.rec.a | ((uint64_t)u.rec.b << 32);
+        } else if (event == KTRACE_EVENT(TAG_BOOT_NAME)) {
+            add_name(boot_names, &boot_name_count, &u.name);
+        } else if (event == KTRACE_EVENT(TAG_PROBE_NAME)) {
+            add_name(probe_names, &probe_name_count, &u.name);
+        } else if (u.rec.tag == TAG_BOOT_BEGIN || u.rec.tag == TAG_BOOT_END) {
+            boot_record(&u.rec, u.rec.tag == TAG_BOOT_END);
+        } else if ((event & 0x800) && KTRACE_GROUP(u.rec.tag) == KTRACE_GRP_PROBE &&
+                   len >= 24) {
+            probe_record(&u.rec);
+        }
+    }
+    fclose(in);
+
+    for (uint32_t id = 0; id < MAX_STAGES; id++) {
+        if (boot_stages[id])
+            boot_stages[id]->name = find_name(boot_names, boot_name_count, id);
+    }
+    if (stage_count == 0) {
+        printf("boottime: no boot stages in '%s'\n", path);
+        return 0;
+    }
+    if (ticks_per_ms == 0)
+        ticks_per_ms = 1;
+
+    qsort(stages, stage_count, sizeof(stages[0]), by_start);
+    uint64_t base = stages[0].start;
+    uint64_t last = base;
+    printf("%10s %10s  stage\n", "start ms", "ms");
+    for (uint32_t i = 0; i < stage_count; i++) {
+        const stage_t* s = &stages[i];
+        uint64_t end = (s->end > s->start) ? s->end : s->start;
+        if (end > last)
+            last = end;
+        printf("%10.3f %10.3f  %s\n", (double)(s->start - base) / ticks_per_ms,
+               (double)(end - s->start) / ticks_per_ms, s->name);
+    }
+    printf("boottime: %.3f ms from the first stage to the end of the last\n",
+           (double)(last - base) / ticks_per_ms);
+    return 0;
+}
@@ -0,0 +1,477 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "benchmarks.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <magenta/compiler.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
+#include <mxtl/algorithm.h>
+
+void Endpoints::Serve() {
+    // The client sets |stop_| only once it has the reply to the round trip
+    // before, so the request seen after it is the last.
+    for (;;) {
+        Receive();
+        bool done = __atomic_load_n(&stop_, __ATOMIC_ACQUIRE);
+        Reply();
+        if (done)
+            return;
+    }
+}
+
+void Endpoints::Stop() {
+    __atomic_store_n(&stop_, true, __ATOMIC_RELEASE);
+    RoundTrip();
+}
+
+namespace {
+
+void duplicate_handles(uint32_t n, mx_handle_t src, mx_handle_t* dest) {
+    for (uint32_t i = 0; i < n; i++) {
+        __UNUSED mx_status_t status = mx_handle_duplicate(src, MX_RIGHT_SAME_RIGHTS, &dest[i]);
+        assert(status == NO_ERROR);
+    }
+}
+
+void close_handles(uint32_t n, const mx_handle_t* handles) {
+    for (uint32_t i = 0; i < n; i++) {
+        __UNUSED mx_status_t status = mx_handle_close(handles[i]);
+        assert(status == NO_ERROR);
+    }
+}
+
+void wait_one(mx_handle_t handle, mx_signals_t signals) {
+    __UNUSED mx_status_t status = mx_handle_wait_one(handle, signals, MX_TIME_INFINITE, nullptr);
+    assert(status == NO_ERROR);
+}
+
+// A message's bytes and handles, as sent or received.
+struct Message {
+    Message(uint32_t size, uint32_t handles)
+        : size(size), handles(handles) {
+        if (size) {
+            data.reset(new uint8_t[size]);
+            for (uint32_t i = 0; i < size; i++)
+                data[i] = static_cast<uint8_t>(i);
+        }
+        if (handles)
+            handle_buf.reset(new mx_handle_t[handles]);
+    }
+
+    void Write(mx_handle_t channel) {
+        __UNUSED mx_status_t status = mx_channel_write(channel, 0u, data.get(), size,
+                                                       handle_buf.get(), handles);
+        assert(status == NO_ERROR);
+    }
+
+    void Read(mx_handle_t channel) {
+        uint32_t r_size = size;
+        uint32_t r_handles = handles;
+        __UNUSED mx_status_t status = mx_channel_read(channel, 0u, data.get(), r_size, &r_size,
+                                                      handle_buf.get(), r_handles, &r_handles);
+        assert(status == NO_ERROR);
+        assert(r_size == size);
+        assert(r_handles == handles);
+    }
+
+    uint32_t size;
+    uint32_t handles;
+    mxtl::unique_ptr<uint8_t[]> data;
+    mxtl::unique_ptr<mx_handle_t[]> handle_buf;
+};
+
+// Writes and reads back on one thread, with |queue| messages left waiting
+// in the channel throughout.
+class ChannelLocal : public Endpoints {
+public:
+    explicit ChannelLocal(const TestArgs& args)
+        : msg_(args.size, args.handles) {
+        size_ = args.size;
+        handles_ = args.handles;
+
+        // We'll write to ch_[0] (and read from ch_[1]).
+        __UNUSED mx_status_t status = mx_channel_create(0u, &ch_[0], &ch_[1]);
+        assert(status == NO_ERROR);
+        // We'll send/receive duplicates of this handle.
+        status = mx_event_create(0u, &event_);
+        assert(status == NO_ERROR);
+
+        for (uint32_t i = 0; i < args.queue; i++) {
+            duplicate_handles(handles_, event_, msg_.handle_buf.get());
+            msg_.Write(ch_[0]);
+        }
+        duplicate_handles(handles_, event_, msg_.handle_buf.get());
+    }
+
+    ~ChannelLocal() {
+        close_handles(handles_, msg_.handle_buf.get());
+        close_handles(2, ch_);
+        mx_handle_close(event_);
+    }
+
+    void RoundTrip() override {
+        msg_.Write(ch_[0]);
+        msg_.Read(ch_[1]);
+    }
+
+private:
+    mx_handle_t ch_[2];
+    mx_handle_t event_;
+    Message msg_;
+};
+
+// The client writes, and waits for the server to write the message, handles
+// and all, back.
+class Channel : public Endpoints {
+public:
+    explicit Channel(const TestArgs& args, uint32_t min_size = 0)
+        : client_(mxtl::max(args.size, min_size), args.handles),
+          server_(mxtl::max(args.size, min_size), args.handles) {
+        size_ = client_.size;
+        handles_ = args.handles;
+        __UNUSED mx_status_t status = mx_channel_create(0u, &ch_[0], &ch_[1]);
+        assert(status == NO_ERROR);
+        status = mx_event_create(0u, &event_);
+        assert(status == NO_ERROR);
+        duplicate_handles(handles_, event_, client_.handle_buf.get());
+    }
+
+    ~Channel() {
+        close_handles(handles_, client_.handle_buf.get());
+        close_handles(2, ch_);
+        mx_handle_close(event_);
+    }
+
+    void RoundTrip() override {
+        client_.Write(ch_[0]);
+        wait_one(ch_[0], MX_CHANNEL_READABLE);
+        client_.Read(ch_[0]);
+    }
+
+protected:
+    void Receive() override {
+        wait_one(ch_[1], MX_CHANNEL_READABLE);
+        server_.Read(ch_[1]);
+    }
+
+    void Reply() override {
+        server_.Write(ch_[1]);
+    }
+
+    mx_handle_t ch_[2];
+    mx_handle_t event_;
+    Message client_;
+    Message server_;
+};
+
+// As Channel, with the client's half done by mx_channel_call(). The server
+// writes back the transaction id in the first four bytes as it got them.
+class ChannelCall : public Channel {
+public:
+    explicit ChannelCall(const TestArgs& args)
+        : Channel(args, sizeof(uint32_t)) {}
+
+    void RoundTrip() override {
+        mx_channel_call_args_t args = {
+            .wr_bytes = client_.data.get(),
+            .wr_handles = client_.handle_buf.get(),
+            .rd_bytes = client_.data.get(),
+            .rd_handles = client_.handle_buf.get(),
+            .wr_num_bytes = client_.size,
+            .wr_num_handles = client_.handles,
+            .rd_num_bytes = client_.size,
+            .rd_num_handles = client_.handles,
+        };
+        uint32_t r_size, r_handles;
+        mx_status_t read_status;
+        __UNUSED mx_status_t status = mx_channel_call(ch_[0], 0u, MX_TIME_INFINITE, &args,
+                                                      &r_size, &r_handles, &read_status);
+        assert(status == NO_ERROR);
+        assert(r_size == client_.size);
+        assert(r_handles == client_.handles);
+    }
+};
+
+// User packets queued to the server's port, and answered on the client's.
+class Port : public Endpoints {
+public:
+    explicit Port(const TestArgs& args) {
+        size_ = mxtl::min(args.size, static_cast<uint32_t>(sizeof(Packet::data)));
+        for (auto& port : port_) {
+            __UNUSED mx_status_t status = mx_port_create(0u, &port);
+            assert(status == NO_ERROR);
+        }
+        memset(&client_, 0, sizeof(client_));
+        client_.hdr.type = MX_PORT_PKT_TYPE_USER;
+    }
+
+    ~Port() {
+        close_handles(2, port_);
+    }
+
+    void RoundTrip() override {
+        Queue(port_[0], &client_);
+        Wait(port_[1], &client_);
+    }
+
+private:
+    struct Packet {
+        mx_packet_header_t hdr;
+        uint8_t data[MX_PORT_MAX_PKT_SIZE - sizeof(mx_packet_header_t)];
+    };
+
+    void Queue(mx_handle_t port, const Packet* packet) {
+        __UNUSED mx_status_t status = mx_port_queue(port, packet, sizeof(packet->hdr) + size_);
+        assert(status == NO_ERROR);
+    }
+
+    void Wait(mx_handle_t port, Packet* packet) {
+        __UNUSED mx_status_t status = mx_port_wait(port, MX_TIME_INFINITE, packet,
+                                                   sizeof(packet->hdr) + size_);
+        assert(status == NO_ERROR);
+    }
+
+    void Receive() override { Wait(port_[0], &server_); }
+    void Reply() override { Queue(port_[1], &server_); }
+
+    mx_handle_t port_[2];
+    Packet client_;
+    Packet server_;
+};
+
+// A user signal raised on the other end of an event pair, and cleared by
+// the end that sees it, either by waiting on the handle or on a wait set.
+class EventPair : public Endpoints {
+public:
+    explicit EventPair(bool waitsets)
+        : waitsets_(waitsets) {
+        __UNUSED mx_status_t status = mx_eventpair_create(0u, &ep_[0], &ep_[1]);
+        assert(status == NO_ERROR);
+        if (waitsets_) {
+            for (int i = 0; i < 2; i++) {
+                status = mx_waitset_create(0u, &ws_[i]);
+                assert(status == NO_ERROR);
+                status = mx_waitset_add(ws_[i], i, ep_[i], MX_USER_SIGNAL_0);
+                assert(status == NO_ERROR);
+            }
+        }
+    }
+
+    ~EventPair() {
+        if (waitsets_)
+            close_handles(2, ws_);
+        close_handles(2, ep_);
+    }
+
+    void RoundTrip() override {
+        Signal(0);
+        Wait(0);
+    }
+
+private:
+    void Signal(int end) {
+        __UNUSED mx_status_t status = mx_object_signal_peer(ep_[end], 0u, MX_USER_SIGNAL_0);
+        assert(status == NO_ERROR);
+    }
+
+    void Wait(int end) {
+        __UNUSED mx_status_t status;
+        if (waitsets_) {
+            mx_waitset_result_t result;
+            uint32_t count = 1;
+            status = mx_waitset_wait(ws_[end], MX_TIME_INFINITE, &result, &count);
+            assert(status == NO_ERROR);
+            assert(count == 1);
+        } else {
+            wait_one(ep_[end], MX_USER_SIGNAL_0);
+        }
+        status = mx_object_signal(ep_[end], MX_USER_SIGNAL_0, 0u);
+        assert(status == NO_ERROR);
+    }
+
+    void Receive() override { Wait(1); }
+    void Reply() override { Signal(1); }
+
+    bool waitsets_;
+    mx_handle_t ep_[2];
+    mx_handle_t ws_[2];
+};
+
+// An entry put on the request fifo, and one on the response fifo for it.
+class Fifo : public Endpoints {
+public:
+    explicit Fifo(const TestArgs& args) {
+        for (auto& fifo : fifo_) {
+            __UNUSED mx_status_t status = mx_fifo_create(4u, &fifo);
+            assert(status == NO_ERROR);
+        }
+    }
+
+    ~Fifo() {
+        close_handles(2, fifo_);
+    }
+
+    void RoundTrip() override {
+        Op(fifo_[0], MX_FIFO_OP_ADVANCE_HEAD);
+        wait_one(fifo_[1], MX_FIFO_NOT_EMPTY);
+        Op(fifo_[1], MX_FIFO_OP_ADVANCE_TAIL);
+    }
+
+private:
+    static void Op(mx_handle_t fifo, uint32_t op) {
+        mx_fifo_state_t state;
+        __UNUSED mx_status_t status = mx_fifo_op(fifo, op, 1u, &state);
+        assert(status == NO_ERROR);
+    }
+
+    void Receive() override {
+        wait_one(fifo_[0], MX_FIFO_NOT_EMPTY);
+        Op(fifo_[0], MX_FIFO_OP_ADVANCE_TAIL);
+    }
+
+    void Reply() override {
+        Op(fifo_[1], MX_FIFO_OP_ADVANCE_HEAD);
+    }
+
+    mx_handle_t fifo_[2];
+};
+
+// |size| bytes written to the server, and written back.
+class Socket : public Endpoints {
+public:
+    explicit Socket(const TestArgs& args)
+        : client_(mxtl::max(args.size, 1u), 0u), server_(mxtl::max(args.size, 1u), 0u) {
+        size_ = client_.size;
+        __UNUSED mx_status_t status = mx_socket_create(0u, &s_[0], &s_[1]);
+        assert(status == NO_ERROR);
+    }
+
+    ~Socket() {
+        close_handles(2, s_);
+    }
+
+    void RoundTrip() override {
+        Write(s_[0], client_.data.get());
+        Read(s_[0], client_.data.get());
+    }
+
+private:
+    // The message may be more than the socket holds at once.
+    void Write(mx_handle_t socket, const uint8_t* data) {
+        for (size_t done = 0; done < size_;) {
+            size_t actual;
+            mx_status_t status = mx_socket_write(socket, 0u, data + done, size_ - done, &actual);
+            if (status == ERR_SHOULD_WAIT) {
+                wait_one(socket, MX_SOCKET_WRITABLE);
+                continue;
+            }
+            assert(status == NO_ERROR);
+            done += actual;
+        }
+    }
+
+    void Read(mx_handle_t socket, uint8_t* data) {
+        for (size_t done = 0; done < size_;) {
+            size_t actual;
+            mx_status_t status = mx_socket_read(socket, 0u, data + done, size_ - done, &actual);
+            if (status == ERR_SHOULD_WAIT) {
+                wait_one(socket, MX_SOCKET_READABLE);
+                continue;
+            }
+            assert(status == NO_ERROR);
+            done += actual;
+        }
+    }
+
+    void Receive() override { Read(s_[1], server_.data.get()); }
+    void Reply() override { Write(s_[1], server_.data.get()); }
+
+    mx_handle_t s_[2];
+    Message client_;
+    Message server_;
+};
+
+// A count the client bumps and wakes the server for, and the server copies
+// to another that the client waits on.
+class Futex : public Endpoints {
+public:
+    explicit Futex(const TestArgs& args) {}
+
+    void RoundTrip() override {
+        int seq = ++seq_;
+        Set(&request_, seq);
+        WaitFor(&response_, seq);
+    }
+
+private:
+    static void Set(mx_futex_t* futex, int value) {
+        __atomic_store_n(futex, value, __ATOMIC_RELEASE);
+        mx_futex_wake(futex, 1u);
+    }
+
+    static void WaitFor(mx_futex_t* futex, int value) {
+        for (;;) {
+            int current = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+            if (current == value)
+                return;
+            // ERR_BAD_STATE just means it has changed already.
+            mx_futex_wait(futex, current, MX_TIME_INFINITE);
+        }
+    }
+
+    void Receive() override {
+        WaitFor(&request_, served_ + 1);
+        served_++;
+    }
+
+    void Reply() override { Set(&response_, served_); }
+
+    mx_futex_t request_ = 0;
+    mx_futex_t response_ = 0;
+    // touched only by the client and the server respectively
+    int seq_ = 0;
+    int served_ = 0;
+};
+
+template <typename T>
+mxtl::unique_ptr<Endpoints> create(const TestArgs& args) {
+    return mxtl::unique_ptr<Endpoints>(new T(args));
+}
+
+mxtl::unique_ptr<Endpoints> create_eventpair(const TestArgs& args) {
+    return mxtl::unique_ptr<Endpoints>(new EventPair(false));
+}
+
+mxtl::unique_ptr<Endpoints> create_waitset(const TestArgs& args) {
+    return mxtl::unique_ptr<Endpoints>(new EventPair(true));
+}
+
+}  // namespace
+
+const Benchmark kBenchmarks[] = {
+    {"channel-local", "mx_channel_write() then mx_channel_read() on one thread",
+     true, create<ChannelLocal>},
+    {"channel", "channel messages to a server thread and back", false, create<Channel>},
+    {"channel-call", "mx_channel_call() to a server thread", false, create<ChannelCall>},
+    {"port", "port packets to a server thread and back", false, create<Port>},
+    {"waitset", "event pair signals, waited for on wait sets", false, create_waitset},
+    {"eventpair", "event pair signals, waited for on the handles", false, create_eventpair},
+    {"fifo", "fifo entries to a server thread and back", false, create<Fifo>},
+    {"socket", "socket bytes to a server thread and back", false, create<Socket>},
+    {"futex", "futex wakes to a server thread and back", false, create<Futex>},
+};
+
+const size_t kNumBenchmarks = countof(kBenchmarks);
+
+const Benchmark* FindBenchmark(const char* name) {
+    for (const auto& benchmark : kBenchmarks) {
+        if (!strcmp(benchmark.name, name))
+            return &benchmark;
+    }
+    return nullptr;
+}
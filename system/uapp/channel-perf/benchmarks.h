@@ -0,0 +1,60 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mxtl/unique_ptr.h>
+
+struct TestArgs {
+    uint32_t size;
+    uint32_t handles;
+    uint32_t queue;
+};
+
+// A client and the server it makes round trips to. The server runs on a
+// thread of its own, unless the benchmark is local, in which case the
+// client does both ends of each round trip itself.
+class Endpoints {
+public:
+    virtual ~Endpoints() {}
+
+    // One round trip, made by the client.
+    virtual void RoundTrip() = 0;
+
+    // Answers round trips until the client calls Stop().
+    void Serve();
+    void Stop();
+
+    // The bytes and handles each message carries, which may differ from
+    // those asked for where the mechanism has limits of its own.
+    uint32_t size() const { return size_; }
+    uint32_t handles() const { return handles_; }
+
+protected:
+    // The server's half of a round trip.
+    virtual void Receive() {}
+    virtual void Reply() {}
+
+    uint32_t size_ = 0;
+    uint32_t handles_ = 0;
+
+private:
+    bool stop_ = false;
+};
+
+struct Benchmark {
+    const char* name;
+    const char* description;
+    // whether there is no server thread
+    bool local;
+    mxtl::unique_ptr<Endpoints> (*create)(const TestArgs& args);
+};
+
+extern const Benchmark kBenchmarks[];
+extern const size_t kNumBenchmarks;
+
+const Benchmark* FindBenchmark(const char* name);
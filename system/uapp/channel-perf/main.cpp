@@ -9,106 +9,199 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <threads.h>
 
 #include <magenta/compiler.h>
 #include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
 
+#include "benchmarks.h"
+#include "stats.h"
+
 namespace {
 
+constexpr uint32_t kMaxPairs = 32;
+// round trips made before the timing starts
+constexpr uint32_t kWarmup = 100;
+
 void argument_error(const char* argv0, const char* message) {
     fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
     exit(EXIT_FAILURE);
 }
 
-void duplicate_handles(uint32_t n, mx_handle_t src, mx_handle_t* dest) {
-    for (uint32_t i = 0; i < n; i++) {
-        assert(mx_handle_duplicate(src, MX_RIGHT_SAME_RIGHTS, &dest[i]) == 0);
+struct Client {
+    Endpoints* endpoints;
+    uint64_t duration_ticks;
+    uint64_t elapsed_ticks;
+    LatencyStats stats;
+};
+
+int client_thread(void* arg) {
+    Client* client = static_cast<Client*>(arg);
+    Endpoints* endpoints = client->endpoints;
+    for (uint32_t i = 0; i < kWarmup; i++)
+        endpoints->RoundTrip();
+
+    uint64_t ticks_per_second = mx_ticks_per_second();
+    uint64_t start = mx_ticks_get();
+    uint64_t now = start;
+    while (now - start < client->duration_ticks) {
+        uint64_t before = now;
+        endpoints->RoundTrip();
+        now = mx_ticks_get();
+        client->stats.Add((now - before) * 1000000000ull / ticks_per_second);
     }
+    client->elapsed_ticks = now - start;
+    return 0;
 }
 
-struct TestArgs {
-    uint32_t size;
-    uint32_t handles;
-    uint32_t queue;
-};
+int server_thread(void* arg) {
+    static_cast<Endpoints*>(arg)->Serve();
+    return 0;
+}
 
-void do_test(uint32_t duration, const TestArgs& test_args) {
-    __UNUSED mx_status_t status;
+bool json_output = false;
+bool json_first = true;
 
-    uint64_t duration_ns = duration * 1000000000ull;
+void report(const Benchmark& benchmark, const TestArgs& test_args, const Endpoints& endpoints,
+            uint32_t pairs, const LatencyStats& stats, double seconds) {
+    double rate = static_cast<double>(stats.count()) / seconds;
+    if (json_output) {
+        printf("%s\n  {\"benchmark\": \"%s\", \"size\": %" PRIu32 ", \"handles\": %" PRIu32
+               ", \"queue\": %" PRIu32 ", \"pairs\": %" PRIu32 ",\n"
+               "   \"round_trips\": %" PRIu64 ", \"round_trips_per_second\": %.0f, "
+               "\"bytes_per_second\": %.0f,\n"
+               "   \"lat_ns\": {\"min\": %" PRIu64 ", \"mean\": %" PRIu64 ", \"max\": %" PRIu64
+               ", \"p50\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"p99.9\": %" PRIu64 "}}",
+               json_first ? "" : ",", benchmark.name, endpoints.size(), endpoints.handles(),
+               benchmark.local ? test_args.queue : 0u, pairs,
+               stats.count(), rate, rate * endpoints.size(),
+               stats.min(), stats.mean(), stats.max(),
+               stats.Percentile(500), stats.Percentile(990), stats.Percentile(999));
+        json_first = false;
+        return;
+    }
+
+    printf("%s: %" PRIu32 " bytes, %" PRIu32 " handles", benchmark.name, endpoints.size(),
+           endpoints.handles());
+    if (benchmark.local) {
+        printf(" (%" PRIu32 " pre-queued)", test_args.queue);
+    } else {
+        printf(", %" PRIu32 " pair%s", pairs, pairs == 1 ? "" : "s");
+    }
+    printf(": %.0f iterations/second, latency p50 %" PRIu64 " p99 %" PRIu64
+           " p99.9 %" PRIu64 " ns\n",
+           rate, stats.Percentile(500), stats.Percentile(990), stats.Percentile(999));
+}
 
-    // We'll write to mp[0] (and read from mp[1]).
-    mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
-    status = mx_channel_create(0u, &mp[0], &mp[1]);
-    assert(status == NO_ERROR);
+// Runs |pairs| clients at once, each making round trips to a server of its
+// own. There is no way to place the threads on particular cpus, so they go
+// wherever the scheduler puts them.
+void do_test(uint32_t duration, const Benchmark& benchmark, const TestArgs& test_args,
+             uint32_t pairs) {
+    if (benchmark.local)
+        pairs = 1;
 
-    // We'll send/receive duplicates of this handle.
-    mx_handle_t event;
-    assert(mx_event_create(0u, &event) == NO_ERROR);
+    mxtl::unique_ptr<Endpoints> endpoints[kMaxPairs];
+    // (each client's stats are a few KB, which is too much for the stack)
+    mxtl::unique_ptr<Client[]> clients(new Client[pairs]);
+    thrd_t servers[kMaxPairs];
+    thrd_t threads[kMaxPairs];
+    uint64_t duration_ticks = duration * mx_ticks_per_second();
 
-    // Storage space for our messages' stuff.
-    mxtl::unique_ptr<uint8_t[]> data;
-    if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
-        for (uint32_t i = 0; i < test_args.size; i++)
-            data[i] = static_cast<uint8_t>(i);
+    for (uint32_t i = 0; i < pairs; i++) {
+        endpoints[i] = benchmark.create(test_args);
+        clients[i].endpoints = endpoints[i].get();
+        clients[i].duration_ticks = duration_ticks;
+        if (!benchmark.local) {
+            __UNUSED int ret = thrd_create_with_name(&servers[i], server_thread,
+                                                     endpoints[i].get(), "server");
+            assert(ret == thrd_success);
+        }
     }
-    mxtl::unique_ptr<mx_handle_t[]> handles;
-    if (test_args.handles)
-        handles.reset(new mx_handle_t[test_args.handles]);
-
-    // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
-    for (uint32_t i = 0; i < test_args.queue; i++) {
-        duplicate_handles(test_args.handles, event, handles.get());
-        status = mx_channel_write(mp[0], 0u, data.get(), test_args.size,
-                                  handles.get(), test_args.handles);
-        assert(status == NO_ERROR);
+    for (uint32_t i = 0; i < pairs; i++) {
+        __UNUSED int ret = thrd_create_with_name(&threads[i], client_thread, &clients[i],
+                                                 "client");
+        assert(ret == thrd_success);
     }
 
-    duplicate_handles(test_args.handles, event, handles.get());
-
-    static constexpr uint32_t big_it_size = 10000;
-    uint64_t big_its = 0;
-    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
-    uint64_t end_ns;
-    for (;;) {
-        big_its++;
-        for (uint32_t i = 0; i < big_it_size; i++) {
-            status = mx_channel_write(mp[0], 0, data.get(), test_args.size,
-                                      handles.get(), test_args.handles);
-            assert(status == NO_ERROR);
-
-            uint32_t r_size = test_args.size;
-            uint32_t r_handles = test_args.handles;
-            status = mx_channel_read(mp[1], 0u, data.get(), r_size, &r_size,
-                                     handles.get(), r_handles, &r_handles);
-            assert(status == NO_ERROR);
-            assert(r_size == test_args.size);
-            assert(r_handles == test_args.handles);
+    LatencyStats stats;
+    double seconds = 0.0;
+    for (uint32_t i = 0; i < pairs; i++) {
+        thrd_join(threads[i], nullptr);
+        if (!benchmark.local) {
+            endpoints[i]->Stop();
+            thrd_join(servers[i], nullptr);
         }
-
-        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
-        if ((end_ns - start_ns) >= duration_ns)
-            break;
+        stats.Merge(clients[i].stats);
+        seconds = mxtl::max(seconds, static_cast<double>(clients[i].elapsed_ticks) /
+                                         static_cast<double>(mx_ticks_per_second()));
     }
 
-    for (uint32_t i = 0; i < test_args.handles; i++) {
-        status = mx_handle_close(handles[i]);
-        assert(status == NO_ERROR);
+    report(benchmark, test_args, *endpoints[0], pairs, stats, seconds);
+}
+
+void do_suite(uint32_t duration) {
+    static constexpr TestArgs local_suite[] = {
+        {10, 0, 0},
+        {100, 0, 0},
+        {1000, 0, 0},
+        {10, 1, 0},
+        {100, 1, 0},
+        {1000, 1, 0},
+        {10, 2, 0},
+        {100, 2, 0},
+        {1000, 2, 0},
+        {10, 5, 0},
+        {100, 5, 0},
+        {1000, 5, 0},
+        {10, 0, 1},
+        {100, 0, 1},
+        {1000, 0, 1},
+    };
+    static constexpr TestArgs remote_suite[] = {
+        {16, 0, 0},
+        {1024, 0, 0},
+        {65536, 0, 0},
+        {16, 1, 0},
+        {16, 8, 0},
+    };
+
+    const Benchmark* local = FindBenchmark("channel-local");
+    for (size_t i = 0; i < countof(local_suite); i++)
+        do_test(duration, *local, local_suite[i], 1);
+
+    // A single pair, and then enough to occupy every cpu.
+    uint32_t most_pairs = mxtl::min(mxtl::max(mx_num_cpus() / 2, 1u), kMaxPairs);
+    for (size_t b = 0; b < kNumBenchmarks; b++) {
+        const Benchmark& benchmark = kBenchmarks[b];
+        if (benchmark.local)
+            continue;
+        for (uint32_t pairs = 1;; pairs = most_pairs) {
+            // Skip the sizes and handle counts that come out the same for a
+            // benchmark, as they do for those that do not use them.
+            TestArgs done[countof(remote_suite)];
+            size_t ndone = 0;
+            for (size_t i = 0; i < countof(remote_suite); i++) {
+                mxtl::unique_ptr<Endpoints> probe = benchmark.create(remote_suite[i]);
+                TestArgs used = {probe->size(), probe->handles(), 0};
+                probe.reset();
+                bool seen = false;
+                for (size_t j = 0; j < ndone; j++) {
+                    if (done[j].size == used.size && done[j].handles == used.handles)
+                        seen = true;
+                }
+                if (seen)
+                    continue;
+                done[ndone++] = used;
+                do_test(duration, benchmark, remote_suite[i], pairs);
+            }
+            if (pairs == most_pairs)
+                break;
+        }
     }
-    status = mx_handle_close(event);
-    assert(status == NO_ERROR);
-    status = mx_handle_close(mp[0]);
-    assert(status == NO_ERROR);
-    status = mx_handle_close(mp[1]);
-    assert(status == NO_ERROR);
-
-    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
-    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
 }
 
 }  // namespace
@@ -119,17 +212,23 @@ int main(int argc, char** argv) {
         "\n"
         "Options:\n"
         "  -h    show help (this)\n"
+        "  -l    list the benchmarks\n"
         "  -o    run single test (default)\n"
-        "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -s    run suite of every benchmark (ignores -b/-S/-H/-Q/-p)\n"
+        "  -b B  set benchmark to B (default: channel-local)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
-        "  -Q N  set message pre-queue count to N messages (default: 0)\n";
+        "  -Q N  set message pre-queue count to N messages (default: 0)\n"
+        "  -p N  set client/server thread pairs to N (default: 1)\n"
+        "  -j    write the results as JSON\n";
 
     bool run_suite = false;  // -o/-s
+    const Benchmark* benchmark = FindBenchmark("channel-local");  // -b
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
+    uint32_t pairs = 1;      // -p
     // Ignored when running a suite:
     TestArgs test_args = {
         10,                  // -S (size)
@@ -138,14 +237,14 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
-        // Our option values are always unsigned numbers.
+    while ((opt = getopt(argc, argv, "+hlosjb:n:d:S:H:Q:p:")) != -1) {
+        // Our option values are unsigned numbers, but for the benchmark.
         uint32_t value = 0;
-        if (optarg) {
+        if (optarg && opt != 'b') {
             errno = 0;
             char* endptr = nullptr;
             unsigned long long v = strtoull(optarg, &endptr, 10);
-            if (errno != 0 || *endptr != '\0' || value > UINT32_MAX)
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
                 argument_error(argv[0], "invalid numeric optional value");
             value = static_cast<uint32_t>(v);
         }
@@ -154,12 +253,25 @@ int main(int argc, char** argv) {
             case 'h':
                 printf(help, argv[0]);
                 return EXIT_SUCCESS;
+            case 'l':
+                for (size_t i = 0; i < kNumBenchmarks; i++)
+                    printf("%-14s %s\n", kBenchmarks[i].name, kBenchmarks[i].description);
+                return EXIT_SUCCESS;
             case 'o':
                 run_suite = false;
                 break;
             case 's':
                 run_suite = true;
                 break;
+            case 'j':
+                json_output = true;
+                break;
+            case 'b':
+                assert(optarg);
+                benchmark = FindBenchmark(optarg);
+                if (!benchmark)
+                    argument_error(argv[0], "unknown benchmark (see -l)");
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -180,6 +292,12 @@ int main(int argc, char** argv) {
                 assert(optarg);
                 test_args.queue = value;
                 break;
+            case 'p':
+                assert(optarg);
+                if (value < 1 || value > kMaxPairs)
+                    argument_error(argv[0], "thread pairs out of range");
+                pairs = value;
+                break;
             default:  // '?'
                 argument_error(argv[0], "invalid option");
                 break;
@@ -188,8 +306,10 @@ int main(int argc, char** argv) {
     if (optind < argc)
         argument_error(argv[0], "unexpected positional argument");
 
+    if (json_output)
+        printf("[");
     for (uint32_t i = 0; i < repeats; i++) {
-        if (repeats > 1u) {
+        if (repeats > 1u && !json_output) {
             if (i > 0u)
                 printf("\n");
             printf("Test iteration #%" PRIu32 " (of %" PRIu32 "):\n", i + 1,
@@ -197,29 +317,13 @@ int main(int argc, char** argv) {
         }
 
         if (run_suite) {
-            static constexpr TestArgs suite[] = {
-                {10, 0, 0},
-                {100, 0, 0},
-                {1000, 0, 0},
-                {10, 1, 0},
-                {100, 1, 0},
-                {1000, 1, 0},
-                {10, 2, 0},
-                {100, 2, 0},
-                {1000, 2, 0},
-                {10, 5, 0},
-                {100, 5, 0},
-                {1000, 5, 0},
-                {10, 0, 1},
-                {100, 0, 1},
-                {1000, 0, 1},
-            };
-            for (size_t i = 0; i < countof(suite); i++)
-                do_test(duration, suite[i]);
+            do_suite(duration);
         } else {
-            do_test(duration, test_args);
+            do_test(duration, *benchmark, test_args, pairs);
         }
     }
+    if (json_output)
+        printf("\n]\n");
 
     return EXIT_SUCCESS;
 }
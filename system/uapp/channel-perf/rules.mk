@@ -9,7 +9,9 @@ MODULE := $(LOCAL_DIR)
 MODULE_TYPE := userapp
 
 MODULE_SRCS += \
+    $(LOCAL_DIR)/benchmarks.cpp \
     $(LOCAL_DIR)/main.cpp \
+    $(LOCAL_DIR)/stats.cpp \
 
 MODULE_LIBS := ulib/magenta ulib/mxio ulib/musl ulib/mxcpp ulib/mxtl
 
@@ -0,0 +1,56 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stats.h"
+
+#include <mxtl/algorithm.h>
+
+unsigned LatencyStats::Bucket(uint64_t ns) {
+    if (ns < kSub)
+        return static_cast<unsigned>(ns);
+    unsigned log = 63 - __builtin_clzll(ns);
+    unsigned sub = static_cast<unsigned>(ns >> (log - kSubBits)) & (kSub - 1);
+    return (log - kSubBits + 1) * kSub + sub;
+}
+
+// The middle of the latencies a bucket counts.
+uint64_t LatencyStats::BucketValue(unsigned bucket) {
+    if (bucket < kSub)
+        return bucket;
+    unsigned log = bucket / kSub + kSubBits - 1;
+    uint64_t base = (1ull << log) + (static_cast<uint64_t>(bucket % kSub) << (log - kSubBits));
+    return base + (1ull << (log - kSubBits)) / 2;
+}
+
+void LatencyStats::Add(uint64_t ns) {
+    if (count_ == 0 || ns < min_)
+        min_ = ns;
+    max_ = mxtl::max(max_, ns);
+    count_++;
+    sum_ += ns;
+    hist_[Bucket(ns)]++;
+}
+
+void LatencyStats::Merge(const LatencyStats& other) {
+    if (other.count_ == 0)
+        return;
+    if (count_ == 0 || other.min_ < min_)
+        min_ = other.min_;
+    max_ = mxtl::max(max_, other.max_);
+    count_ += other.count_;
+    sum_ += other.sum_;
+    for (unsigned i = 0; i < kBuckets; i++)
+        hist_[i] += other.hist_[i];
+}
+
+uint64_t LatencyStats::Percentile(unsigned permille) const {
+    uint64_t want = (count_ * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < kBuckets; i++) {
+        seen += hist_[i];
+        if (seen >= want && seen > 0)
+            return mxtl::min(mxtl::max(BucketValue(i), min_), max_);
+    }
+    return max_;
+}
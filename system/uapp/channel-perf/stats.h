@@ -0,0 +1,37 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+// Latencies of a run, counted in buckets of 1/8th of a power of two of ns
+// so that the percentiles come out within about 6%.
+class LatencyStats {
+public:
+    void Add(uint64_t ns);
+    void Merge(const LatencyStats& other);
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return min_; }
+    uint64_t max() const { return max_; }
+    uint64_t mean() const { return count_ ? sum_ / count_ : 0; }
+
+    // The latency that |permille| thousandths of the samples took at most.
+    uint64_t Percentile(unsigned permille) const;
+
+private:
+    static constexpr unsigned kSubBits = 3;
+    static constexpr unsigned kSub = 1u << kSubBits;
+    static constexpr unsigned kBuckets = 64 * kSub;
+
+    static unsigned Bucket(uint64_t ns);
+    static uint64_t BucketValue(unsigned bucket);
+
+    uint64_t count_ = 0;
+    uint64_t min_ = 0;
+    uint64_t max_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t hist_[kBuckets] = {};
+};
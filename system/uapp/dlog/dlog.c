@@ -20,10 +20,17 @@ int main(int argc, char** argv) {
         printf("dlog: cannot open log\n");
     }
 
-    char buf[MX_LOG_RECORD_MAX];
-    mx_log_record_t* rec = (mx_log_record_t*)buf;
+    // read records a batch at a time, each record starting 8 byte aligned
+    uint64_t buf[16 * MX_LOG_RECORD_MAX / sizeof(uint64_t)];
     for (;;) {
-        if (mx_log_read(h, MX_LOG_RECORD_MAX, rec, tail ? MX_LOG_FLAG_WAIT : 0) > 0) {
+        mx_status_t n = mx_log_read(h, sizeof(buf), buf,
+                                    MX_LOG_FLAG_BATCH | (tail ? MX_LOG_FLAG_WAIT : 0));
+        if (n <= 0) {
+            break;
+        }
+        size_t off = 0;
+        while (off + sizeof(mx_log_record_t) <= (size_t)n) {
+            mx_log_record_t* rec = (mx_log_record_t*)((char*)buf + off);
             char tmp[64];
             snprintf(tmp, 64, "[%05d.%03d] %c ",
                      (int)(rec->timestamp / 1000000000ULL),
@@ -34,8 +41,7 @@ int main(int argc, char** argv) {
             if ((rec->datalen == 0) || (rec->data[rec->datalen - 1] != '\n')) {
                 write(1, "\n", 1);
             }
-        } else {
-            break;
+            off += (sizeof(mx_log_record_t) + rec->datalen + 7) & ~7;
         }
     }
     return 0;
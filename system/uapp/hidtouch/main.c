@@ -25,6 +25,8 @@
 #define VIRTUAL_CONSOLE "/dev/class/console/vc"
 #define CLEAR_BTN_SIZE 50
 #define I2C_HID_DEBUG 0
+// reports taken per read() at most
+#define READ_BATCH_SIZE 16
 
 // Array of colors for each finger
 uint32_t colors[] = {
@@ -277,7 +279,15 @@ int main(int argc, char* argv[]) {
         printf("failed to get max report size: %zd\n", ret);
         return -1;
     }
-    void* buf = malloc(max_rpt_sz);
+    // read every report pending at once, rather than one per call
+    uint32_t read_mode = INPUT_READ_BATCHED;
+    ret = ioctl_input_set_read_mode(touchfd, &read_mode);
+    if (ret < 0) {
+        printf("failed to set batched read mode: %zd\n", ret);
+        return -1;
+    }
+    size_t buf_sz = READ_BATCH_SIZE * (sizeof(input_report_hdr_t) + max_rpt_sz + 1);
+    uint8_t* buf = malloc(buf_sz);
     if (buf == NULL) {
         printf("no memory!\n");
         return -1;
@@ -292,15 +302,25 @@ int main(int argc, char* argv[]) {
 
     clear_screen((void*)fbo, &fb);
     while (1) {
-        ssize_t r = read(touchfd, buf, max_rpt_sz);
+        ssize_t r = read(touchfd, buf, buf_sz);
         if (r < 0) {
             printf("touchscreen read error: %zd (errno=%d)\n", r, errno);
             break;
         }
-        if (*(uint8_t*)buf == ACER12_RPT_ID_TOUCH) {
-            process_touchscreen_input(buf, r, vcfd, pixels32, &fb);
-        } else if (*(uint8_t*)buf == ACER12_RPT_ID_STYLUS) {
-            process_stylus_input(buf, r, vcfd, pixels32, &fb);
+        size_t off = 0;
+        while (off + sizeof(input_report_hdr_t) <= (size_t)r) {
+            input_report_hdr_t hdr;
+            memcpy(&hdr, buf + off, sizeof(hdr));
+            uint8_t* rpt = buf + off + sizeof(hdr);
+            off += sizeof(hdr) + hdr.len;
+            if (off > (size_t)r || hdr.len == 0) {
+                break;
+            }
+            if (*rpt == ACER12_RPT_ID_TOUCH) {
+                process_touchscreen_input(rpt, hdr.len, vcfd, pixels32, &fb);
+            } else if (*rpt == ACER12_RPT_ID_STYLUS) {
+                process_stylus_input(rpt, hdr.len, vcfd, pixels32, &fb);
+            }
         }
     }
 
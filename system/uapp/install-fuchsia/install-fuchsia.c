@@ -639,12 +639,28 @@ mx_status_t write_install_data(partition_flags parts_requested,
 
         time_t start;
         time(&start);
-        mx_status_t rc = write_partition(fd_src, fd_dst, &bytes_written);
+        install_stream_stats_t stats;
+        mx_status_t rc = write_lz4_stream(fd_src, fd_dst, &stats);
+        bool streamed = rc != ERR_NOT_SUPPORTED;
+        if (!streamed) {
+            // no block fifo, so write it out a piece at a time
+            rc = write_partition(fd_src, fd_dst, &bytes_written);
+        } else {
+            printf("\n");
+            bytes_written = stats.bytes_written;
+        }
         time_t end;
         time(&end);
 
         printf("%.f secs taken to write %zd bytes\n", difftime(end, start),
                bytes_written);
+        if (rc == NO_ERROR && streamed) {
+            printf("sha256 ");
+            for (size_t i = 0; i < sizeof(stats.sha256); i++) {
+                printf("%02x", stats.sha256[i]);
+            }
+            printf("\n");
+        }
         close(fd_dst);
         close(fd_src);
 
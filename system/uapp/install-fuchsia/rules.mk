@@ -10,7 +10,7 @@ MODULE_TYPE := userapp
 
 MODULE_SRCS += $(LOCAL_DIR)/install-fuchsia.c
 
-MODULE_STATIC_LIBS := ulib/gpt ulib/cksum ulib/lz4 ulib/installer
+MODULE_STATIC_LIBS := ulib/gpt ulib/cksum ulib/lz4 ulib/installer ulib/cryptolib
 
 MODULE_LIBS := ulib/magenta ulib/musl ulib/mxio ulib/fs-management
 
@@ -0,0 +1,118 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <magenta/ktrace.h>
+
+// Reports the hottest kernel stacks in a trace recorded with the profiler:
+//
+//   magenta> ktrace-stream -p 1000000 /data/prof.trace 10
+//   magenta> kprofile /data/prof.trace
+//
+// The stacks are printed as backtraces that scripts/symbolize picks up
+// from the console output, to be turned into function names and lines.
+
+#define MAX_STACKS 4096
+
+typedef struct stack {
+    uint32_t count;
+    uint32_t depth;
+    uint64_t pc[KTRACE_SAMPLE_MAX_PCS];
+} stack_t;
+
+static stack_t stacks[MAX_STACKS];
+static uint32_t stack_count;
+
+static uint64_t user_samples;
+static uint64_t dropped_samples;
+
+static void add_sample(const ktrace_rec_sample_t* rec) {
+    uint32_t depth = (KTRACE_LEN(rec->tag) - KTRACE_HDRSIZE) / sizeof(uint64_t);
+    if (depth == 0)
+        return;
+    for (uint32_t i = 0; i < stack_count; i++) {
+        stack_t* s = &stacks[i];
+        if (s->depth == depth && !memcmp(s->pc, rec->pc, depth * sizeof(uint64_t))) {
+            s->count++;
+            return;
+        }
+    }
+    if (stack_count == MAX_STACKS) {
+        dropped_samples++;
+        return;
+    }
+    stack_t* s = &stacks[stack_count++];
+    s->count = 1;
+    s->depth = depth;
+    memcpy(s->pc, rec->pc, depth * sizeof(uint64_t));
+}
+
+static int by_count(const void* a, const void* b) {
+    const stack_t* sa = a;
+    const stack_t* sb = b;
+    return (sa->count < sb->count) - (sa->count > sb->count);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: kprofile <file> [stacks]\n");
+        return -1;
+    }
+    uint32_t top = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 20;
+
+    FILE* in = fopen(argv[1], "r");
+    if (!in) {
+        fprintf(stderr, "cannot open '%s'\n", argv[1]);
+        return -1;
+    }
+
+    // a kernel sample's first pc is a kernel address, a user one's isn't
+    // and has no callers to symbolize
+    uint64_t samples = 0;
+    ktrace_rec_sample_t rec;
+    while (fread(&rec, KTRACE_HDRSIZE, 1, in) == 1) {
+        uint32_t len = KTRACE_LEN(rec.tag);
+        if (len < KTRACE_HDRSIZE) {
+            fprintf(stderr, "bad record in '%s'\n", argv[1]);
+            return -1;
+        }
+        if (len > KTRACE_HDRSIZE && fread(rec.pc, len - KTRACE_HDRSIZE, 1, in) != 1)
+            break;
+        if (KTRACE_EVENT(rec.tag) != KTRACE_EVENT(TAG_PROFILE_SAMPLE) ||
+            KTRACE_GROUP(rec.tag) != KTRACE_GRP_PROFILE)
+            continue;
+        samples++;
+        if (len > KTRACE_HDRSIZE && (int64_t)rec.pc[0] >= 0) {
+            user_samples++;
+            continue;
+        }
+        add_sample(&rec);
+    }
+    fclose(in);
+
+    if (samples == 0) {
+        printf("kprofile: no samples\n");
+        return 0;
+    }
+
+    qsort(stacks, stack_count, sizeof(stacks[0]), by_count);
+    for (uint32_t i = 0; i < stack_count && i < top; i++) {
+        const stack_t* s = &stacks[i];
+        printf("kprofile: %u samples (%.1f%%)\n", s->count, 100.0 * s->count / samples);
+        for (uint32_t n = 0; n < s->depth; n++)
+            printf("bt#%02u: %#llx\n", n, (unsigned long long)s->pc[n]);
+        printf("bt#%02u: end\n", s->depth);
+    }
+    printf("kprofile: %llu samples, %llu in userspace", (unsigned long long)samples,
+           (unsigned long long)user_samples);
+    if (dropped_samples)
+        printf(", %llu in stacks past the first %u", (unsigned long long)dropped_samples,
+               MAX_STACKS);
+    printf("\n");
+    return 0;
+}
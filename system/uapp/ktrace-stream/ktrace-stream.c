@@ -0,0 +1,185 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magenta/device/ktrace.h>
+#include <magenta/ktrace.h>
+#include <magenta/syscalls.h>
+
+// Streams kernel trace records from every cpu into a file until stopped:
+//
+//   magenta> ktrace-stream /data/test.trace 60
+//
+// With -p, the profiler also samples every cpu every <cycles> cycles, for
+// kprofile to report on.
+//
+// Each pass appends what every cpu wrote since the last one, so records are
+// grouped by cpu and only roughly in time order; sort them by timestamp.
+
+#define MAX_CPUS 32
+
+typedef struct stream {
+    volatile ktrace_stream_header_t* hdr;
+    const uint8_t* data;
+    uint64_t pos;   // next position to copy out
+    uint64_t lost;  // bytes overwritten before they were copied out
+} stream_t;
+
+static uint8_t copy[1 << 20];
+
+static uint64_t round_up(uint64_t n, uint64_t size) {
+    return (n + size - 1) & ~(size - 1);
+}
+
+static uint64_t load_head(stream_t* s) {
+    return __atomic_load_n(&s->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+// Copies out the records of |s| written since the last call.
+static int drain(stream_t* s, FILE* out) {
+    const uint64_t size = s->hdr->size;
+    uint64_t head = load_head(s);
+    if (head - s->pos > size - KTRACE_STREAM_SLACK) {
+        // overtaken: pick up at the start of the ring past the lost records
+        uint64_t pos = round_up(head - (size - KTRACE_STREAM_SLACK), size);
+        s->lost += pos - s->pos;
+        s->pos = pos;
+    }
+    if (head <= s->pos)
+        return 0;
+
+    uint64_t len = head - s->pos;
+    if (len > sizeof(copy))
+        len = sizeof(copy);
+    uint64_t off = s->pos & (size - 1);
+    uint64_t first = (size - off < len) ? size - off : len;
+    memcpy(copy, s->data + off, first);
+    memcpy(copy + first, s->data, len - first);
+
+    // anything the writer got round to while copying is garbage
+    uint64_t after = load_head(s);
+    if (after + KTRACE_STREAM_SLACK > size && s->pos < after + KTRACE_STREAM_SLACK - size) {
+        uint64_t pos = round_up(after + KTRACE_STREAM_SLACK - size, size);
+        s->lost += pos - s->pos;
+        s->pos = pos;
+        return 0;
+    }
+
+    uint64_t end = s->pos + len;
+    for (uint64_t i = 0; s->pos < end;) {
+        uint32_t tag;
+        memcpy(&tag, copy + i, sizeof(tag));
+        uint64_t rec_len = KTRACE_LEN(tag);
+        if (tag == 0) {
+            // padding up to the start of the ring
+            rec_len = size - (s->pos & (size - 1));
+        } else {
+            if (rec_len == 0 || i + rec_len > len)
+                break;
+            if (fwrite(copy + i, rec_len, 1, out) != 1)
+                return -1;
+        }
+        i += rec_len;
+        s->pos += rec_len;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    uint32_t period = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        if (opt != 'p')
+            goto usage;
+        period = (uint32_t)strtoul(optarg, NULL, 0);
+    }
+    if (optind >= argc) {
+usage:
+        fprintf(stderr, "usage: ktrace-stream [-p <cycles>] <file> [seconds]\n");
+        return -1;
+    }
+    const char* path = argv[optind];
+    long seconds = (optind + 1 < argc) ? strtol(argv[optind + 1], NULL, 0) : 10;
+
+    int fd;
+    if ((fd = open("/dev/class/misc/ktrace", O_RDWR)) < 0) {
+        fprintf(stderr, "cannot open trace device\n");
+        return -1;
+    }
+    mx_handle_t kth;
+    if (ioctl_ktrace_get_handle(fd, &kth) < 0) {
+        fprintf(stderr, "cannot get ktrace handle\n");
+        return -1;
+    }
+    close(fd);
+
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "cannot open '%s'\n", path);
+        return -1;
+    }
+
+    mx_status_t status = mx_ktrace_control(kth, KTRACE_ACTION_START_STREAM, 0, NULL);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "cannot start streaming: %d\n", status);
+        return -1;
+    }
+
+    if (period) {
+        status = mx_ktrace_control(kth, KTRACE_ACTION_PROFILE_START, period, NULL);
+        if (status != NO_ERROR) {
+            fprintf(stderr, "cannot start the profiler: %d\n", status);
+            return -1;
+        }
+    }
+
+    stream_t streams[MAX_CPUS];
+    uint32_t count = 0;
+    for (; count < MAX_CPUS; count++) {
+        mx_handle_t vmo;
+        if (mx_ktrace_stream_vmo(kth, count, &vmo) != NO_ERROR)
+            break;
+        uint64_t vmo_size;
+        uintptr_t addr;
+        if (mx_vmo_get_size(vmo, &vmo_size) != NO_ERROR ||
+            mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, vmo_size,
+                        MX_VM_FLAG_PERM_READ, &addr) != NO_ERROR) {
+            fprintf(stderr, "cannot map the stream of cpu %u\n", count);
+            return -1;
+        }
+        mx_handle_close(vmo);
+        streams[count].hdr = (volatile ktrace_stream_header_t*)addr;
+        streams[count].data = (const uint8_t*)addr + KTRACE_STREAM_DATA_OFFSET;
+        streams[count].pos = 0;
+        streams[count].lost = 0;
+    }
+
+    for (long ms = 0; ms < seconds * 1000; ms += 10) {
+        for (uint32_t cpu = 0; cpu < count; cpu++) {
+            if (drain(&streams[cpu], out) < 0) {
+                fprintf(stderr, "cannot write '%s'\n", path);
+                return -1;
+            }
+        }
+        mx_nanosleep(MX_MSEC(10));
+    }
+
+    if (period)
+        mx_ktrace_control(kth, KTRACE_ACTION_PROFILE_STOP, 0, NULL);
+    mx_ktrace_control(kth, KTRACE_ACTION_STOP, 0, NULL);
+    for (uint32_t cpu = 0; cpu < count; cpu++) {
+        drain(&streams[cpu], out);
+        if (streams[cpu].lost)
+            printf("cpu %u: %llu bytes overwritten before they were read\n",
+                   cpu, (unsigned long long)streams[cpu].lost);
+    }
+    fclose(out);
+    return 0;
+}
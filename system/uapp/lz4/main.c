@@ -14,6 +14,7 @@
 #include <unistd.h>
 
 #include <lz4/lz4frame.h>
+#include <lz4/lz4frame_mt.h>
 
 #define BLOCK_SIZE 65536
 
@@ -21,174 +22,223 @@
 #define PERM_644 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH
 
 static void usage(const char* arg0) {
-    printf("usage: %s [-1|-9] [-d] <input file> <output file>\n", arg0);
+    printf("usage: %s [-1|-9] [-d] [-t <threads>] <input file> <output file>\n", arg0);
     printf("   -1  fast compression (default)\n");
     printf("   -9  high compression (slower)\n");
     printf("   -d  decompress\n");
+    printf("   -t  threads to use (default: one per cpu)\n");
 }
 
-static int do_decompress(const char* infile, const char* outfile) {
-    int infd, outfd;
-
-    infd = open(infile, O_RDONLY);
-    if (infd < 0) {
+// Reads all of |infile| into a buffer of its own.
+static uint8_t* read_file(const char* infile, size_t* size) {
+    int fd = open(infile, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "could not open %s: %s\n", infile, strerror(errno));
-        return -1;
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "could not stat %s: %s\n", infile, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    uint8_t* buf = malloc(st.st_size ? st.st_size : 1);
+    if (!buf) {
+        fprintf(stderr, "out of memory\n");
+        close(fd);
+        return NULL;
     }
+    size_t pos = 0;
+    while (pos < (size_t)st.st_size) {
+        ssize_t nr = read(fd, buf + pos, st.st_size - pos);
+        if (nr <= 0) {
+            fprintf(stderr, "error reading %s: %s\n", infile,
+                    nr < 0 ? strerror(errno) : "file got shorter");
+            free(buf);
+            close(fd);
+            return NULL;
+        }
+        pos += nr;
+    }
+    close(fd);
+    *size = pos;
+    return buf;
+}
 
-    outfd = open(outfile, WR_NEWFILE, PERM_644);
-    if (outfd < 0) {
-        fprintf(stderr, "could not open %s: %s\n", outfile, strerror(errno));
-        close(infd);
-        return -1;
+static int write_all(int fd, const char* outfile, const uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t nw = write(fd, buf, len);
+        if (nw <= 0) {
+            fprintf(stderr, "could not write to %s", outfile);
+            if (nw < 0) {
+                fprintf(stderr, ": %s", strerror(errno));
+            }
+            fprintf(stderr, "\n");
+            return -1;
+        }
+        buf += nw;
+        len -= nw;
     }
+    return 0;
+}
 
+// The content size in the header of the frame at |p|, or 0 if it does not
+// say.
+static uint64_t frame_content_size(const uint8_t* p, size_t len) {
+    static const uint8_t magic[4] = { 0x04, 0x22, 0x4d, 0x18 };
+    if (len < 14 || memcmp(p, magic, sizeof(magic)) || !(p[4] & 0x08)) {
+        return 0;
+    }
+    uint64_t size = 0;
+    for (int i = 7; i >= 0; i--) {
+        size = (size << 8) | p[6 + i];
+    }
+    return size;
+}
+
+// Decompresses one frame a block at a time, for frames that do not say how
+// big they are.
+static ssize_t decompress_stream(const uint8_t* in, size_t len, int outfd, const char* outfile) {
     LZ4F_decompressionContext_t dctx;
     LZ4F_errorCode_t errc = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
     if (LZ4F_isError(errc)) {
         fprintf(stderr, "could not initialize decompression: %s\n", LZ4F_getErrorName(errc));
-        close(outfd);
-        close(infd);
         return -1;
     }
 
-    uint8_t inbuf[BLOCK_SIZE];
     uint8_t outbuf[BLOCK_SIZE];
-
-    // Read first 4 bytes to let LZ4 tell us how much it expects in the first
-    // pass.
-    size_t src_sz = 4;
-    size_t dst_sz = 0;
-    ssize_t nr = read(infd, inbuf, src_sz);
-    if (nr < (ssize_t)src_sz) {
-        fprintf(stderr, "could not read from %s", infile);
-        if (nr < 0) {
-            fprintf(stderr, ": %s", strerror(errno));
-        }
-        fprintf(stderr, "\n");
-        goto done;
-    }
-    size_t to_read = LZ4F_decompress(dctx, outbuf, &dst_sz, inbuf, &src_sz, NULL);
-    if (LZ4F_isError(to_read)) {
-        fprintf(stderr, "could not decompress %s: %s\n", infile, LZ4F_getErrorName(to_read));
-        goto done;
-    }
-    if (to_read > BLOCK_SIZE) {
-        to_read = BLOCK_SIZE;
+    size_t pos = 0;
+    for (;;) {
+        size_t dst_sz = BLOCK_SIZE;
+        size_t src_sz = len - pos;
+        size_t next = LZ4F_decompress(dctx, outbuf, &dst_sz, in + pos, &src_sz, NULL);
+        if (LZ4F_isError(next)) {
+            fprintf(stderr, "could not decompress: %s\n", LZ4F_getErrorName(next));
+            break;
+        }
+        pos += src_sz;
+        if (write_all(outfd, outfile, outbuf, dst_sz) < 0) {
+            break;
+        }
+        if (next == 0) {
+            LZ4F_freeDecompressionContext(dctx);
+            return pos;
+        }
+        if (src_sz == 0 && dst_sz == 0) {
+            fprintf(stderr, "could not decompress: the input is cut short\n");
+            break;
+        }
     }
+    LZ4F_freeDecompressionContext(dctx);
+    return -1;
+}
 
-    while ((nr = read(infd, inbuf, to_read)) > 0) {
-        src_sz = nr;
-        ssize_t pos = 0;
-        size_t next = 0;
+static int do_decompress(const char* infile, const char* outfile, unsigned nthreads) {
+    size_t len;
+    uint8_t* in = read_file(infile, &len);
+    if (!in) {
+        return -1;
+    }
 
-        while (pos < nr) {
-            dst_sz = BLOCK_SIZE;
-            next = LZ4F_decompress(dctx, outbuf, &dst_sz, inbuf + pos, &src_sz, NULL);
-            if (LZ4F_isError(next)) {
-                fprintf(stderr, "could not decompress %s: %s\n", infile, LZ4F_getErrorName(to_read));
-                goto done;
-            }
+    int outfd = open(outfile, WR_NEWFILE, PERM_644);
+    if (outfd < 0) {
+        fprintf(stderr, "could not open %s: %s\n", outfile, strerror(errno));
+        free(in);
+        return -1;
+    }
 
-            if (dst_sz) {
-                ssize_t nw = write(outfd, outbuf, dst_sz);
-                if (nw != (ssize_t)dst_sz) {
-                    fprintf(stderr, "could not write to %s", outfile);
-                    if (nw < 0) {
-                        fprintf(stderr, ": %s", strerror(errno));
-                    }
-                    fprintf(stderr, "\n");
-                    goto done;
-                }
+    // The input may be several frames one after the other. Those that say
+    // how big they are are decompressed whole, on all the threads.
+    int ret = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        uint64_t content = frame_content_size(in + pos, len - pos);
+        if (content == 0 || content > SIZE_MAX) {
+            ssize_t used = decompress_stream(in + pos, len - pos, outfd, outfile);
+            if (used < 0) {
+                ret = -1;
+                break;
             }
-            pos += src_sz;
-            src_sz = nr - pos;
+            pos += used;
+            continue;
         }
 
-        to_read = next;
-        if (to_read > BLOCK_SIZE || to_read == 0) {
-            to_read = BLOCK_SIZE;
+        uint8_t* out = malloc(content);
+        if (!out) {
+            fprintf(stderr, "out of memory\n");
+            ret = ENOMEM;
+            break;
         }
+        size_t used = len - pos;
+        size_t dsz = LZ4F_decompressFrame_mt(out, content, in + pos, &used, nthreads);
+        if (LZ4F_isError(dsz)) {
+            fprintf(stderr, "could not decompress %s: %s\n", infile, LZ4F_getErrorName(dsz));
+            free(out);
+            ret = -1;
+            break;
+        }
+        ret = write_all(outfd, outfile, out, dsz);
+        free(out);
+        if (ret < 0) {
+            break;
+        }
+        pos += used;
     }
 
-    if (nr < 0) {
-        fprintf(stderr, "error reading %s: %s\n", infile, strerror(errno));
-        goto done;
-    }
-
-done:
-    LZ4F_freeDecompressionContext(dctx);
     close(outfd);
-    close(infd);
-    return 0;
+    free(in);
+    return ret;
 }
 
-static int do_compress(const char* infile, const char* outfile, int clevel) {
-    int infd, outfd;
-
-    infd = open(infile, O_RDONLY);
-    if (infd < 0) {
-        fprintf(stderr, "could not open %s: %s\n", infile, strerror(errno));
+static int do_compress(const char* infile, const char* outfile, int clevel, unsigned nthreads) {
+    size_t len;
+    uint8_t* in = read_file(infile, &len);
+    if (!in) {
         return -1;
     }
 
-    outfd = open(outfile, WR_NEWFILE, PERM_644);
+    int outfd = open(outfile, WR_NEWFILE, PERM_644);
     if (outfd < 0) {
         fprintf(stderr, "could not open %s: %s\n", outfile, strerror(errno));
-        close(infd);
+        free(in);
         return -1;
     }
 
+    // The whole file goes in one frame that says how big it is, so that it
+    // can be decompressed in parallel too.
     LZ4F_preferences_t prefs;
     memset(&prefs, 0, sizeof(prefs));
     prefs.compressionLevel = clevel;
+    prefs.frameInfo.contentSize = len;
 
-    uint8_t inbuf[BLOCK_SIZE];
-    size_t outsize = LZ4F_compressFrameBound(BLOCK_SIZE, &prefs);
+    int ret = 0;
+    size_t outsize = LZ4F_compressFrameBound(len, &prefs);
     uint8_t* outbuf = malloc(outsize);
     if (!outbuf) {
         fprintf(stderr, "out of memory\n");
-        close(outfd);
-        close(infd);
-        return ENOMEM;
-    }
-
-    // TODO: do the whole file in one frame, using the LZ4F begin/update/end
-    // functions.
-    ssize_t nr = 0;
-    while ((nr = read(infd, inbuf, BLOCK_SIZE)) > 0) {
-        ssize_t csz = LZ4F_compressFrame(outbuf, outsize, inbuf, nr, &prefs);
-        if (LZ4F_isError(csz)) {
-            fprintf(stderr, "error compressing %s: %s\n", infile, LZ4F_getErrorName(csz));
-            goto done;
-        }
-
-        ssize_t nw = write(outfd, outbuf, csz);
-        if (nw != csz) {
-            fprintf(stderr, "could not write to %s", outfile);
-            if (nw < 0) {
-                fprintf(stderr, ": %s", strerror(errno));
-            }
-            fprintf(stderr, "\n");
-            goto done;
-        }
+        ret = ENOMEM;
+        goto done;
     }
 
-    if (nr < 0) {
-        fprintf(stderr, "error reading %s: %s\n", infile, strerror(errno));
+    size_t csz = LZ4F_compressFrame_mt(outbuf, outsize, in, len, &prefs, nthreads);
+    if (LZ4F_isError(csz)) {
+        fprintf(stderr, "error compressing %s: %s\n", infile, LZ4F_getErrorName(csz));
+        ret = -1;
         goto done;
     }
+    ret = write_all(outfd, outfile, outbuf, csz);
 
 done:
     free(outbuf);
     close(outfd);
-    close(infd);
-    return 0;
+    free(in);
+    return ret;
 }
 
 int main(int argc, char* argv[]) {
     int clevel = 1;
     bool decompress = false;
+    unsigned nthreads = 0;
     const char* infile = NULL;
     const char* outfile = NULL;
 
@@ -197,10 +247,18 @@ int main(int argc, char* argv[]) {
             decompress = true;
             continue;
         }
+        if (!strcmp("-1", argv[i])) {
+            clevel = 1;
+            continue;
+        }
         if (!strcmp("-9", argv[i])) {
             clevel = 9;
             continue;
         }
+        if (!strcmp("-t", argv[i]) && i + 1 < argc) {
+            nthreads = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
         if (!strcmp("-h", argv[i])) {
             usage(argv[0]);
             return 0;
@@ -235,8 +293,8 @@ int main(int argc, char* argv[]) {
     printf("\n");
 
     if (decompress) {
-        return do_decompress(infile, outfile);
+        return do_decompress(infile, outfile, nthreads);
     } else {
-        return do_compress(infile, outfile, clevel);
+        return do_compress(infile, outfile, clevel, nthreads);
     }
 }
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,10 @@
 
 #include <fs/trace.h>
 
+#ifdef __Fuchsia__
+#include <magenta/syscalls.h>
+#endif
+
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 
@@ -16,33 +21,369 @@
 #include "minfs-private.h"
 
 mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
-    off_t off = bno * kMinfsBlockSize;
+    // a write of this block may still be held back in the cache, perhaps
+    // in the middle of a transaction, so read it from there
+    if (lists_.DirtyCount() + lists_.CommittedCount() > 0) {
+        auto blk = hash_.find(bno);
+        if (blk.IsValid() && (blk->flags_ & (kBlockDirty | kBlockCommitted))) {
+            memcpy(data, blk->data_, kMinfsBlockSize);
+            return NO_ERROR;
+        }
+    }
+    off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
     trace(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
+    if (pread(fd_, data, kMinfsBlockSize, off) != kMinfsBlockSize) {
+        error("minfs: cannot read block %u\n", bno);
         return ERR_IO;
     }
-    if (read(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
-        error("minfs: cannot read block %u\n", bno);
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Readblks(uint32_t bno, uint32_t count, void* data) {
+    off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
+    ssize_t len = static_cast<ssize_t>(count) * kMinfsBlockSize;
+    trace(IO, "readblks() bno=%u count=%u off=%#llx\n", bno, count, (unsigned long long)off);
+    // one call, so concurrent readers can't move each other's file position
+    if (pread(fd_, data, len, off) != len) {
+        error("minfs: cannot read blocks %u-%u\n", bno, bno + count - 1);
         return ERR_IO;
     }
     return NO_ERROR;
 }
 
+// A held back write of the block must not land on top of a raw one, nor
+// may a replay of the journal put an older copy back over it. Flush() takes
+// care of both, as the journal is empty once everything is home.
+bool Bcache::Pending(uint32_t bno, uint32_t count) {
+    bool pending = false;
+    auto check = [bno, count, &pending](BlockNode* blk) {
+        if ((blk->bno_ >= bno) && (blk->bno_ - bno < count)) {
+            pending = true;
+        }
+    };
+    lists_.ForEachDirty(check);
+    lists_.ForEachCommitted(check);
+    return pending;
+}
+
 mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
-    off_t off = bno * kMinfsBlockSize;
-    trace(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd_, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return ERR_IO;
+    if (Pending(bno, 1)) {
+        Flush();
+    }
+    return WriteRaw(bno, data, 1);
+}
+
+mx_status_t Bcache::Writeblks(uint32_t bno, uint32_t count, const void* data) {
+    if (Pending(bno, count)) {
+        Flush();
     }
-    if (write(fd_, data, kMinfsBlockSize) != kMinfsBlockSize) {
+    return WriteRaw(bno, data, count);
+}
+
+mx_status_t Bcache::WriteRaw(uint32_t bno, const void* data, uint32_t count) {
+    off_t off = static_cast<off_t>(bno) * kMinfsBlockSize;
+    ssize_t len = static_cast<ssize_t>(count) * kMinfsBlockSize;
+    trace(IO, "writeblk() bno=%u count=%u off=%#llx\n", bno, count, (unsigned long long)off);
+    if (pwrite(fd_, data, len, off) != len) {
         error("minfs: cannot write block %u\n", bno);
         return ERR_IO;
     }
     return NO_ERROR;
 }
 
+mx_status_t Bcache::AttachJournal(uint32_t start, uint32_t count) {
+    // a record must be able to hold every block the cache can have dirty
+    if ((count < 1 + cache_blocks_) ||
+        ((sizeof(minfs_journal_t) + cache_blocks_ * sizeof(uint32_t)) > blocksize_)) {
+        return ERR_INVALID_ARGS;
+    }
+#ifdef __Fuchsia__
+    if (vmo_ != MX_HANDLE_INVALID) {
+        jnl_buf_ = reinterpret_cast<char*>(vmo_base_ + cache_blocks_ * blocksize_);
+    }
+#endif
+    if (jnl_buf_ == nullptr) {
+        jnl_storage_.reset(static_cast<char*>(malloc((1 + cache_blocks_) * blocksize_)));
+        if ((jnl_buf_ = jnl_storage_.get()) == nullptr) {
+            return ERR_NO_MEMORY;
+        }
+    }
+    // replay has emptied the journal; carry on the sequence it ended with,
+    // so records left over from before can never follow on from new ones
+    mx_status_t status;
+    if ((status = Readblk(start, jnl_buf_)) != NO_ERROR) {
+        return status;
+    }
+    minfs_journal_t* hdr = reinterpret_cast<minfs_journal_t*>(jnl_buf_);
+    jnl_seq_ = (hdr->magic == kMinfsJournalMagic) ? hdr->seq : 0;
+    jnl_block_ = start;
+    jnl_count_ = count;
+    jnl_next_ = 0;
+    return NO_ERROR;
+}
+
+// Appends the blocks of a transaction to the journal as one record, in a
+// single request.
+mx_status_t Bcache::JournalCommit(BlockNode** blks, uint32_t count) {
+    minfs_journal_t* hdr = reinterpret_cast<minfs_journal_t*>(jnl_buf_);
+    memset(jnl_buf_, 0, blocksize_);
+    hdr->magic = kMinfsJournalMagic;
+    hdr->count = count;
+    hdr->seq = jnl_seq_ + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        hdr->bno[i] = blks[i]->bno_;
+        memcpy(jnl_buf_ + (1 + i) * blocksize_, blks[i]->data_, blocksize_);
+    }
+    size_t len = (1 + count) * blocksize_;
+    size_t skip = offsetof(minfs_journal_t, seq);
+    hdr->checksum = fnv1a32(jnl_buf_ + skip, len - skip);
+    trace(BCACHE, "bcache_journal() seq=%llu count=%u\n", (unsigned long long)hdr->seq, count);
+
+    // the seq is only used up once the record is down, so a retry after a
+    // failure follows on from the record before it
+    uint32_t bno = jnl_block_ + jnl_next_;
+    mx_status_t status = ERR_NOT_SUPPORTED;
+#ifdef __Fuchsia__
+    if (vmo_ != MX_HANDLE_INVALID) {
+        block_txn_batch_t batch;
+        batch.count = 1;
+        batch.txns[0].opcode = BLOCK_TXN_OP_WRITE;
+        batch.txns[0].reserved = 0;
+        batch.txns[0].vmo_offset = reinterpret_cast<uintptr_t>(jnl_buf_) - vmo_base_;
+        batch.txns[0].dev_offset = (uint64_t)bno * blocksize_;
+        batch.txns[0].length = len;
+        status = RunTxns(vmo_, &batch);
+    }
+#endif
+    if (status == ERR_NOT_SUPPORTED) {
+        status = WriteRaw(bno, jnl_buf_, 1 + count);
+    }
+    if (status == NO_ERROR) {
+        jnl_seq_++;
+        jnl_next_ += 1 + count;
+    }
+    return status;
+}
+
+// Once every block in the log is home, empties it, keeping the last seq.
+mx_status_t Bcache::JournalReset() {
+    minfs_journal_t* hdr = reinterpret_cast<minfs_journal_t*>(jnl_buf_);
+    memset(jnl_buf_, 0, blocksize_);
+    hdr->magic = kMinfsJournalMagic;
+    hdr->count = 0;
+    hdr->seq = jnl_seq_;
+    size_t skip = offsetof(minfs_journal_t, seq);
+    hdr->checksum = fnv1a32(jnl_buf_ + skip, blocksize_ - skip);
+    trace(BCACHE, "bcache_checkpoint() seq=%llu\n", (unsigned long long)hdr->seq);
+    mx_status_t status;
+    if ((status = WriteRaw(jnl_block_, jnl_buf_, 1)) != NO_ERROR) {
+        return status;
+    }
+    jnl_next_ = 0;
+    return NO_ERROR;
+}
+
+#ifdef __Fuchsia__
+mx_status_t Bcache::AttachVmo(uint32_t num) {
+    // the blocks, then room to stage a journal record of all of them
+    vmo_size_ = (size_t)(num + 1 + num) * blocksize_;
+    mx_status_t status;
+    if ((status = mx_vmo_create(vmo_size_, 0, &vmo_)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo_, 0, vmo_size_,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                              &vmo_base_)) != NO_ERROR) {
+        mx_handle_close(vmo_);
+        vmo_ = MX_HANDLE_INVALID;
+        return status;
+    }
+    txn_vmo_ = true;
+    return NO_ERROR;
+}
+
+// Hands the batch to the block device, which consumes a duplicate of the
+// VMO handle.  Devices which do not take the ioctl are not asked again.
+mx_status_t Bcache::RunTxns(mx_handle_t vmo, block_txn_batch_t* batch) {
+    if (!txn_vmo_) {
+        return ERR_NOT_SUPPORTED;
+    }
+    mx_status_t status;
+    if ((status = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &batch->vmo)) != NO_ERROR) {
+        return status;
+    }
+    ssize_t r = ioctl_block_txn_vmo(fd_, batch, BLOCK_TXN_BATCH_SIZE(batch->count));
+    if (r == ERR_NOT_SUPPORTED) {
+        txn_vmo_ = false;
+    }
+    return (r < 0) ? static_cast<mx_status_t>(r) : NO_ERROR;
+}
+
+mx_status_t Bcache::VmoTxns(mx_handle_t vmo, block_txn_batch_t* batch) {
+    // as with Readblk() and Writeblk(), held back writes of these blocks
+    // have to reach the disk first
+    for (uint32_t i = 0; (i < batch->count) && (PendingCount() > 0); i++) {
+        if (Pending(static_cast<uint32_t>(batch->txns[i].dev_offset / blocksize_),
+                    static_cast<uint32_t>(batch->txns[i].length / blocksize_))) {
+            Flush();
+        }
+    }
+    return RunTxns(vmo, batch);
+}
+#endif
+
+mx_status_t Bcache::Load(BlockNode* blk) {
+#ifdef __Fuchsia__
+    block_txn_batch_t batch;
+    batch.count = 1;
+    batch.txns[0].opcode = BLOCK_TXN_OP_READ;
+    batch.txns[0].reserved = 0;
+    batch.txns[0].vmo_offset = reinterpret_cast<uintptr_t>(blk->data_) - vmo_base_;
+    batch.txns[0].dev_offset = (uint64_t)blk->bno_ * blocksize_;
+    batch.txns[0].length = blocksize_;
+    mx_status_t status = RunTxns(vmo_, &batch);
+    if (status != ERR_NOT_SUPPORTED) {
+        return status;
+    }
+#endif
+    return Readblk(blk->bno_, blk->data_);
+}
+
+bool Bcache::FlushDue() const {
+    return PendingCount() >= kMinfsMaxDirty;
+}
+
+static int bno_compare(const void* a, const void* b) {
+    uint32_t x = (*static_cast<BlockNode* const*>(a))->GetKey();
+    uint32_t y = (*static_cast<BlockNode* const*>(b))->GetKey();
+    return (x < y) ? -1 : (x > y);
+}
+
+// Writes the blocks to their home locations, in as few requests as possible.
+mx_status_t Bcache::WriteHome(BlockNode** blks, uint32_t count) {
+    mx_status_t status = NO_ERROR;
+    uint32_t i = 0;
+#ifdef __Fuchsia__
+    while ((i < count) && txn_vmo_) {
+        block_txn_batch_t batch;
+        batch.count = 0;
+        for (uint32_t j = i; (j < count) && (batch.count < BLOCK_TXN_MAX); j++) {
+            block_txn_t* txn = &batch.txns[batch.count++];
+            txn->opcode = BLOCK_TXN_OP_WRITE;
+            txn->reserved = 0;
+            txn->vmo_offset = reinterpret_cast<uintptr_t>(blks[j]->data_) - vmo_base_;
+            txn->dev_offset = (uint64_t)blks[j]->bno_ * blocksize_;
+            txn->length = blocksize_;
+        }
+        mx_status_t r = RunTxns(vmo_, &batch);
+        if (r == ERR_NOT_SUPPORTED) {
+            break;
+        }
+        if (r != NO_ERROR) {
+            error("minfs: cannot write %u blocks from %u\n", batch.count, blks[i]->bno_);
+            status = ERR_IO;
+        }
+        i += batch.count;
+    }
+#endif
+    for (; i < count; i++) {
+        if (WriteRaw(blks[i]->bno_, blks[i]->data_, 1) < 0) {
+            status = ERR_IO;
+        }
+    }
+    return status;
+}
+
+mx_status_t Bcache::Commit() {
+    if ((jnl_count_ == 0) || (lists_.DirtyCount() == 0)) {
+        return NO_ERROR;
+    }
+    trace(BCACHE, "bcache_commit() %u dirty\n", lists_.DirtyCount());
+
+    BlockNode* blks[kMinfsBlockCacheSize];
+    uint32_t count = 0;
+    lists_.ForEachDirty([&blks, &count](BlockNode* blk) { blks[count++] = blk; });
+    qsort(blks, count, sizeof(blks[0]), bno_compare);
+
+    // There is room unless the checkpoint after the last commit failed.
+    // It may be retried only while no committed block is dirty again.
+    if (jnl_next_ + 1 + count > jnl_count_) {
+        bool redirtied = false;
+        lists_.ForEachDirty([&redirtied](BlockNode* blk) {
+            redirtied |= (blk->flags_ & kBlockCommitted) != 0;
+        });
+        if (redirtied || (Checkpoint() != NO_ERROR)) {
+            error("minfs: journal full\n");
+            return ERR_IO;
+        }
+    }
+
+    // A failed record may be partly down, but replay will not trust it.
+    // The blocks stay dirty to go in the next one; none may go home first.
+    if (JournalCommit(blks, count) != NO_ERROR) {
+        error("minfs: cannot write journal record\n");
+        return ERR_IO;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        lists_.ClearDirty(blks[i]);
+        lists_.MarkCommitted(blks[i]);
+    }
+
+    // Checkpoint now if the next transaction might not fit. Nothing is
+    // dirty, so what goes home is exactly what the log holds.
+    if (jnl_next_ + 1 + cache_blocks_ > jnl_count_) {
+        return Checkpoint();
+    }
+    return NO_ERROR;
+}
+
+// Writes the committed blocks home, or without a journal the dirty ones,
+// then empties the journal. Must not run while a committed block is dirty
+// again, as its data would go home ahead of its commit.
+mx_status_t Bcache::Checkpoint() {
+    BlockNode* blks[kMinfsBlockCacheSize];
+    uint32_t count = 0;
+    if (jnl_count_ > 0) {
+        lists_.ForEachCommitted([&blks, &count](BlockNode* blk) { blks[count++] = blk; });
+    } else {
+        lists_.ForEachDirty([&blks, &count](BlockNode* blk) { blks[count++] = blk; });
+    }
+    if (count == 0) {
+        return NO_ERROR;
+    }
+    trace(BCACHE, "bcache_flush() %u blocks\n", count);
+
+    // in block order, so the device can merge neighbouring blocks
+    qsort(blks, count, sizeof(blks[0]), bno_compare);
+
+    // Until the log is emptied the blocks stay pending, and a failed
+    // checkpoint is simply done again.
+    mx_status_t status;
+    if ((status = WriteHome(blks, count)) != NO_ERROR) {
+        return status;
+    }
+    if ((jnl_count_ > 0) && ((status = JournalReset()) != NO_ERROR)) {
+        error("minfs: cannot empty journal\n");
+        return status;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (jnl_count_ > 0) {
+            lists_.ClearCommitted(blks[i]);
+        } else {
+            lists_.ClearDirty(blks[i]);
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Flush() {
+    mx_status_t status;
+    if ((status = Commit()) != NO_ERROR) {
+        return status;
+    }
+    return Checkpoint();
+}
+
 constexpr uint32_t kModeFind = 0;
 constexpr uint32_t kModeLoad = 1;
 constexpr uint32_t kModeZero = 2;
@@ -57,6 +398,7 @@ static const char* modestr(uint32_t mode) {
 }
 
 void Bcache::Invalidate() {
+    Flush();
     mxtl::RefPtr<BlockNode> blk;
     uint32_t n = 0;
     while ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
@@ -81,7 +423,7 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
         assert(!(blk->flags_ & kBlockBusy));
         lists_.Erase(blk, kBlockLRU);
         if (mode == kModeZero) {
-            blk->flags_ |= kBlockDirty;
+            lists_.MarkDirty(blk.get());
             memset(blk->data(), 0, blocksize_);
         }
         goto done;
@@ -92,6 +434,12 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
         if ((blk = lists_.PopFront(kBlockFree)) != nullptr) {
             // nothing extra to do
         } else if ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
+            // its held back write has to go out before it is reused; as
+            // other committed blocks may be dirty again, this commits the
+            // open transaction too
+            if (blk->flags_ & (kBlockDirty | kBlockCommitted)) {
+                Flush();
+            }
             // remove from hash, bno to be reassigned
             hash_.erase(*blk);
         } else {
@@ -101,9 +449,9 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
         hash_.insert(blk);
         assert(hash_.size() <= kMinfsBlockCacheSize);
         if (mode == kModeZero) {
-            blk->flags_ |= kBlockDirty;
+            lists_.MarkDirty(blk.get());
             memset(blk->data(), 0, blocksize_);
-        } else if (Readblk(bno, blk->data()) < 0) {
+        } else if (Load(blk.get()) < 0) {
             panic("bcache: bno %u read error!\n", bno);
         }
     }
@@ -128,11 +476,14 @@ void Bcache::Put(mxtl::RefPtr<BlockNode> blk, uint32_t flags) {
     assert(blk->flags_ & kBlockBusy);
     // remove from busy list
     lists_.Erase(blk, kBlockBusy);
-    if ((flags | blk->flags_) & kBlockDirty) {
+    if (flags & kBlockDirty) {
+        lists_.MarkDirty(blk.get());
+    }
+    if ((blk->flags_ & kBlockDirty) && !defer_writes_) {
+        lists_.ClearDirty(blk.get());
         if (Writeblk(blk->bno_, blk->data()) < 0) {
             error("block write error!\n");
         }
-        blk->flags_ &= ~kBlockDirty;
     }
     lists_.PushBack(mxtl::move(blk), kBlockLRU);
 }
@@ -154,6 +505,9 @@ mx_status_t Bcache::Read(uint32_t bno, void* data, uint32_t off, uint32_t len) {
 }
 
 int Bcache::Sync() {
+    if (Flush() < 0) {
+        return -1;
+    }
     return fsync(fd_);
 }
 
@@ -163,6 +517,13 @@ mx_status_t Bcache::Create(Bcache** out, int fd, uint32_t blockmax, uint32_t blo
     if (bc == nullptr) {
         return ERR_NO_MEMORY;
     }
+    bc->cache_blocks_ = num;
+#ifdef __Fuchsia__
+    if (bc->AttachVmo(num) != NO_ERROR) {
+        // the blocks fall back to the heap
+        error("minfs: cannot create block cache vmo\n");
+    }
+#endif
     while (num > 0) {
         mx_status_t status;
         if ((status = BlockNode::Create(bc.get())) != NO_ERROR) {
@@ -175,12 +536,21 @@ mx_status_t Bcache::Create(Bcache** out, int fd, uint32_t blockmax, uint32_t blo
 }
 
 int Bcache::Close() {
+    // leaves everything home, and nothing behind to replay
+    Flush();
     return close(fd_);
 }
 
 Bcache::Bcache(int fd, uint32_t blockmax, uint32_t blocksize) :
     fd_(fd), blockmax_(blockmax), blocksize_(blocksize) {}
-Bcache::~Bcache() {}
+Bcache::~Bcache() {
+#ifdef __Fuchsia__
+    if (vmo_ != MX_HANDLE_INVALID) {
+        mx_vmar_unmap(mx_vmar_root_self(), vmo_base_, vmo_size_);
+        mx_handle_close(vmo_);
+    }
+#endif
+}
 
 size_t BcacheLists::SizeAllSlow() const {
     return list_busy_.size_slow() + list_lru_.size_slow() + list_free_.size_slow();
@@ -214,6 +584,38 @@ mxtl::RefPtr<BlockNode> BcacheLists::Erase(mxtl::RefPtr<BlockNode> blk, uint32_t
     return ptr;
 }
 
+void BcacheLists::MarkDirty(BlockNode* blk) {
+    if (!(blk->flags_ & kBlockDirty)) {
+        blk->flags_ |= kBlockDirty;
+        list_dirty_.push_back(mxtl::RefPtr<BlockNode>(blk));
+        dirty_count_++;
+    }
+}
+
+void BcacheLists::ClearDirty(BlockNode* blk) {
+    if (blk->flags_ & kBlockDirty) {
+        blk->flags_ &= ~kBlockDirty;
+        list_dirty_.erase(*blk);
+        dirty_count_--;
+    }
+}
+
+void BcacheLists::MarkCommitted(BlockNode* blk) {
+    if (!(blk->flags_ & kBlockCommitted)) {
+        blk->flags_ |= kBlockCommitted;
+        list_committed_.push_back(mxtl::RefPtr<BlockNode>(blk));
+        committed_count_++;
+    }
+}
+
+void BcacheLists::ClearCommitted(BlockNode* blk) {
+    if (blk->flags_ & kBlockCommitted) {
+        blk->flags_ &= ~kBlockCommitted;
+        list_committed_.erase(*blk);
+        committed_count_--;
+    }
+}
+
 BcacheLists::LinkedList* BcacheLists::GetList(uint32_t block_type) {
     switch (block_type) {
         case kBlockBusy : return &list_busy_;
@@ -229,15 +631,23 @@ mx_status_t BlockNode::Create(Bcache* bc) {
     if (blk == nullptr) {
         return ERR_NO_MEMORY;
     }
-    blk->data_.reset(static_cast<char*>(malloc(bc->blocksize_)));
+#ifdef __Fuchsia__
+    if ((bc->vmo_ != MX_HANDLE_INVALID) && (bc->vmo_next_ + bc->blocksize_ <= bc->vmo_size_)) {
+        blk->data_ = reinterpret_cast<char*>(bc->vmo_base_ + bc->vmo_next_);
+        bc->vmo_next_ += bc->blocksize_;
+    }
+#endif
     if (blk->data_ == nullptr) {
-        return ERR_NO_MEMORY;
+        blk->storage_.reset(static_cast<char*>(malloc(bc->blocksize_)));
+        if ((blk->data_ = blk->storage_.get()) == nullptr) {
+            return ERR_NO_MEMORY;
+        }
     }
     bc->lists_.PushBack(mxtl::move(blk), kBlockFree);
     return NO_ERROR;
 }
 
-BlockNode::BlockNode() : flags_(kBlockFree) {}
+BlockNode::BlockNode() : flags_(kBlockFree), data_(nullptr) {}
 BlockNode::~BlockNode() {}
 
 #ifndef __Fuchsia__
@@ -18,11 +18,6 @@ uint32_t Bitmap::Mapcount() const {
     return (bitcount_ + 63) / 64;
 }
 
-// Get a pointer to the final 64-bit 'map'.
-uint64_t* Bitmap::End() const {
-    return map_.get() + Mapcount();
-}
-
 size_t Bitmap::BytesRequired() const {
     // round the allocated buffer size to a fs block size to ensure
     // that we don't partially write a block out
@@ -43,11 +38,27 @@ mx_status_t Bitmap::Init(uint32_t max) {
     if (map_ == nullptr) {
         return ERR_NO_MEMORY;
     }
+
+    leaves_ = 1;
+    while (static_cast<uint64_t>(leaves_) * kChunkBits < max) {
+        leaves_ *= 2;
+    }
+    summary_.reset(static_cast<summary_t*>(calloc(2 * leaves_, sizeof(summary_t))));
+    words_.reset(static_cast<word_summary_t*>(calloc(leaves_ * kChunkWords,
+                                                     sizeof(word_summary_t))));
+    if ((summary_ == nullptr) || (words_ == nullptr)) {
+        map_.reset();
+        summary_.reset();
+        words_.reset();
+        return ERR_NO_MEMORY;
+    }
+    Rescan();
     return NO_ERROR;
 }
 
 void Bitmap::Reset() {
     memset(map_.get(), 0, BytesRequired());
+    Rescan();
 }
 
 mx_status_t Bitmap::Resize(uint32_t max) {
@@ -55,6 +66,7 @@ mx_status_t Bitmap::Resize(uint32_t max) {
         return ERR_NO_MEMORY;
     }
     bitcount_ = max;
+    Rescan();
     return NO_ERROR;
 }
 
@@ -62,11 +74,13 @@ void Bitmap::Set(uint32_t n) {
     assert(n < bitcount_);
     // Shifting by 6 because 1 << 6 == 64
     map_.get()[n >> 6] |= (1ULL << (n & 63));
+    Update(n);
 }
 
 void Bitmap::Clr(uint32_t n) {
     assert(n < bitcount_);
     map_.get()[n >> 6] &= ~((1ULL << (n & 63)));
+    Update(n);
 }
 
 bool Bitmap::Get(uint32_t n) const {
@@ -74,29 +88,175 @@ bool Bitmap::Get(uint32_t n) const {
     return (map_.get()[n >> 6] & (1ULL << (n & 63))) != 0;
 }
 
+// The 64 bits starting at bit 'n' (a multiple of 64), with the ones past
+// the end of the map set.
+uint64_t Bitmap::Word(uint32_t n) const {
+    if (n >= bitcount_) {
+        return ~0ULL;
+    }
+    uint64_t v = map_.get()[n >> 6];
+    if (bitcount_ - n < 64) {
+        v |= ~0ULL << (bitcount_ - n);
+    }
+    return v;
+}
+
+// Summarizes two adjacent ranges, the first 'lsize' bits long and the
+// second 'rsize' bits long.
+Bitmap::summary_t Bitmap::Combine(const summary_t& l, uint64_t lsize,
+                                  const summary_t& r, uint64_t rsize) {
+    summary_t s;
+    s.pre = (l.pre == lsize) ? static_cast<uint32_t>(lsize + r.pre) : l.pre;
+    s.suf = (r.suf == rsize) ? static_cast<uint32_t>(rsize + l.suf) : r.suf;
+    s.best = l.best > r.best ? l.best : r.best;
+    if (l.suf + r.pre > s.best) {
+        s.best = l.suf + r.pre;
+    }
+    return s;
+}
+
+// Summarizes the 64 bits starting at bit 'n' (a multiple of 64).
+Bitmap::word_summary_t Bitmap::WordSummary(uint32_t n) const {
+    uint64_t v = Word(n);
+    word_summary_t w;
+    if (v == 0) {
+        w.pre = w.suf = w.best = 64;
+    } else if (v == ~0ULL) {
+        w.pre = w.suf = w.best = 0;
+    } else {
+        w.pre = static_cast<uint8_t>(__builtin_ctzll(v));
+        w.suf = static_cast<uint8_t>(__builtin_clzll(v));
+        // each step shortens every run of free bits by one
+        w.best = 0;
+        for (uint64_t f = ~v; f != 0; f &= (f >> 1)) {
+            w.best++;
+        }
+    }
+    return w;
+}
+
+// Combines the summaries of the chunk's words, which are kept up to date as
+// bits change, so no bit of the chunk has to be looked at again.
+Bitmap::summary_t Bitmap::ChunkSummary(uint32_t chunk) const {
+    const word_summary_t* words = words_.get() + chunk * kChunkWords;
+    summary_t s = {words[0].pre, words[0].suf, words[0].best};
+    for (uint32_t i = 1; i < kChunkWords; i++) {
+        summary_t w = {words[i].pre, words[i].suf, words[i].best};
+        s = Combine(s, i * 64, w, 64);
+    }
+    return s;
+}
+
+void Bitmap::Rescan() {
+    for (uint32_t i = 0; i < leaves_ * kChunkWords; i++) {
+        words_.get()[i] = WordSummary(i * 64);
+    }
+    summary_t* sum = summary_.get();
+    for (uint32_t chunk = 0; chunk < leaves_; chunk++) {
+        sum[leaves_ + chunk] = ChunkSummary(chunk);
+    }
+    uint64_t size = kChunkBits;
+    for (uint32_t level = leaves_ / 2; level > 0; level /= 2) {
+        for (uint32_t node = level; node < 2 * level; node++) {
+            sum[node] = Combine(sum[2 * node], size, sum[2 * node + 1], size);
+        }
+        size *= 2;
+    }
+}
+
+// Refreshes the summary of the word holding bit 'n', and of the chunk and
+// nodes above it.
+void Bitmap::Update(uint32_t n) {
+    words_.get()[n / 64] = WordSummary(n & ~63u);
+    summary_t* sum = summary_.get();
+    uint32_t node = leaves_ + n / kChunkBits;
+    sum[node] = ChunkSummary(n / kChunkBits);
+    for (uint64_t size = kChunkBits; node > 1; size *= 2) {
+        node /= 2;
+        sum[node] = Combine(sum[2 * node], size, sum[2 * node + 1], size);
+    }
+}
+
+// Looks bit by bit for a run of 'len' free bits in [start, end), given
+// there are 'run' free bits just before start.  Leaves 'run' counting
+// the free bits just before end.
+uint32_t Bitmap::ScanRun(uint32_t start, uint32_t end, uint32_t len, uint32_t* run) const {
+    for (uint32_t n = start; n < end;) {
+        uint64_t v = Word(n & ~63u);
+        if (((n & 63) == 0) && (n + 64 <= end) && ((v == 0) || (v == ~0ULL))) {
+            *run = (v == 0) ? *run + 64 : 0;
+            n += 64;
+        } else {
+            *run = (v & (1ULL << (n & 63))) ? 0 : *run + 1;
+            n++;
+        }
+        if (*run >= len) {
+            return n - *run;
+        }
+    }
+    return BITMAP_FAIL;
+}
+
+// Looks for a run of 'len' free bits in the chunks below 'node' (which
+// covers 'chunks' chunks from 'chunk'), starting no earlier than chunk
+// 'first', given there are 'run' free bits before those chunks.
+uint32_t Bitmap::FindIn(uint32_t node, uint32_t chunk, uint32_t chunks, uint32_t first,
+                        uint32_t len, uint32_t* run) const {
+    if (chunk + chunks <= first) {
+        return BITMAP_FAIL;
+    }
+    if (chunk >= first) {
+        const summary_t& s = summary_.get()[node];
+        uint64_t size = static_cast<uint64_t>(chunks) * kChunkBits;
+        if (*run + s.pre >= len) {
+            return chunk * kChunkBits - *run;
+        } else if (s.best < len) {
+            *run = (s.pre == size) ? *run + s.pre : s.suf;
+            return BITMAP_FAIL;
+        } else if (chunks == 1) {
+            uint64_t end = static_cast<uint64_t>(chunk + 1) * kChunkBits;
+            return ScanRun(chunk * kChunkBits,
+                           end < bitcount_ ? static_cast<uint32_t>(end) : bitcount_, len, run);
+        }
+    }
+    uint32_t half = chunks / 2;
+    uint32_t bit = FindIn(2 * node, chunk, half, first, len, run);
+    if (bit != BITMAP_FAIL) {
+        return bit;
+    }
+    return FindIn(2 * node + 1, chunk + half, half, first, len, run);
+}
+
+uint32_t Bitmap::Find(uint32_t minbit, uint32_t len) const {
+    if ((len == 0) || (minbit >= bitcount_)) {
+        return BITMAP_FAIL;
+    }
+    // the rest of the chunk minbit is in is looked at directly, the chunks
+    // after it through the summary
+    uint32_t chunk = minbit / kChunkBits;
+    uint64_t end = static_cast<uint64_t>(chunk + 1) * kChunkBits;
+    uint32_t run = 0;
+    uint32_t bit = ScanRun(minbit, end < bitcount_ ? static_cast<uint32_t>(end) : bitcount_,
+                           len, &run);
+    if (bit != BITMAP_FAIL) {
+        return bit;
+    }
+    return FindIn(1, 0, leaves_, chunk + 1, len, &run);
+}
+
 // minbit specifies a bit number which is the minimum to allocate at
 // to avoid making all allocations suffer, we round to the nearest
 // multiple of the sub-bitmap storage unit (a uint64_t).
 uint32_t Bitmap::Alloc(uint32_t minbit) {
-    uint64_t* bits = map_.get() + ((minbit + 63) >> 6);
-    while (bits < End()) {
-        uint64_t v = *bits;
-        uint32_t n;
-        if ((n = __builtin_ffsll(~v)) != 0) {
-            n--;
-            uint32_t ret = (uint32_t) (((bits - map_.get()) << 6) + n);
-            // If this is end-1, and the map is full
-            // we might attempt to use a bit past the
-            // end.  Ensure that we do not.
-            if (ret >= bitcount_) {
-                break;
-            }
-            *bits = v | (1ULL << n);
-            return ret;
-        }
-        bits++;
+    uint64_t start = (static_cast<uint64_t>(minbit) + 63) & ~63ULL;
+    if (start >= bitcount_) {
+        return BITMAP_FAIL;
     }
-    return BITMAP_FAIL;
+    uint32_t n = Find(static_cast<uint32_t>(start), 1);
+    if (n != BITMAP_FAIL) {
+        Set(n);
+    }
+    return n;
 }
 
 #define FAIL_IF(c) do { if (c) { error("fail: %s\n", #c); return -1; } } while (0)
@@ -144,11 +304,74 @@ int do_bitmap_test(void) {
     for (n = 0; n < 10; n++) {
         map[n] = -1;
     }
+    bm.Rescan();
     FAIL_IF(bm.Alloc(0) != 640);
 
     memset(map, 0xFF, bm.Capacity() / 8);
+    bm.Rescan();
     FAIL_IF(bm.Alloc(0) != BITMAP_FAIL);
 
+    // runs, including ones which cross the chunks of the summary
+    const uint32_t max = 5 * 4096 + 100;
+    Bitmap rm;
+    if (rm.Init(max)) {
+        error("init failed\n");
+        return -1;
+    }
+    FAIL_IF(rm.Find(0, max) != 0);
+    FAIL_IF(rm.Find(0, max + 1) != BITMAP_FAIL);
+    FAIL_IF(rm.Find(max - 1, 1) != max - 1);
+    for (n = 0; n < max; n++) {
+        rm.Set(n);
+    }
+    FAIL_IF(rm.Find(0, 1) != BITMAP_FAIL);
+    for (n = 4001; n <= 4200; n++) {
+        rm.Clr(n);
+    }
+    for (n = 12000; n < 13000; n++) {
+        rm.Clr(n);
+    }
+    for (n = max - 10; n < max; n++) {
+        rm.Clr(n);
+    }
+    FAIL_IF(rm.Find(0, 1) != 4001);
+    FAIL_IF(rm.Find(0, 200) != 4001);
+    FAIL_IF(rm.Find(0, 201) != 12000);
+    FAIL_IF(rm.Find(4050, 100) != 4050);
+    FAIL_IF(rm.Find(4150, 100) != 12000);
+    FAIL_IF(rm.Find(12500, 500) != 12500);
+    FAIL_IF(rm.Find(12500, 501) != BITMAP_FAIL);
+    FAIL_IF(rm.Find(0, 1001) != BITMAP_FAIL);
+    FAIL_IF(rm.Find(13000, 10) != max - 10);
+    FAIL_IF(rm.Find(13000, 11) != BITMAP_FAIL);
+    FAIL_IF(rm.Alloc(4002) != 4032);
+
+    // and against a plain scan, with the bits changing at random
+    rand32_t rnd = RAND32SEED(7);
+    rm.Reset();
+    for (n = 0; n < 2000; n++) {
+        uint32_t bit = rand32(&rnd) % max;
+        uint32_t count = 1 + rand32(&rnd) % 700;
+        for (uint32_t i = bit; (i < bit + count) && (i < max); i++) {
+            if (n & 1) {
+                rm.Set(i);
+            } else {
+                rm.Clr(i);
+            }
+        }
+        uint32_t minbit = rand32(&rnd) % max;
+        uint32_t len = 1 + rand32(&rnd) % 300;
+        uint32_t expect = BITMAP_FAIL;
+        for (uint32_t i = minbit, run = 0; i < max; i++) {
+            run = rm.Get(i) ? 0 : run + 1;
+            if (run == len) {
+                expect = i + 1 - len;
+                break;
+            }
+        }
+        FAIL_IF(rm.Find(minbit, len) != expect);
+    }
+
     warn("bitmap: ok\n");
     return 0;
 }
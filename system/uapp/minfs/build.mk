@@ -19,7 +19,7 @@ else
 MINFS_CFLAGS += -D_POSIX_C_SOURCE=200809L
 endif
 
-MINFS_LDFLAGS :=
+MINFS_LDFLAGS := -pthread
 
 FUSE_CFLAGS := -D_FILE_OFFSET_BITS=64
 ifeq ($(call TOBOOL,$(ENABLE_MINFS_FUSE_DEBUG)),true)
@@ -35,10 +35,10 @@ else
 FUSE_LDFLAGS += -lfuse
 endif
 
-SRCS += main.cpp test.cpp
+SRCS += main.cpp test.cpp image.cpp
 LIBMINFS_SRCS += host.cpp bitmap.cpp bcache.cpp
 LIBMINFS_SRCS += minfs.cpp minfs-ops.cpp minfs-check.cpp
-LIBFS_SRCS += vfs.c
+LIBFS_SRCS += vfs.c vfs-dcache.c
 LIBMXCPP_SRCS := new.cpp pure_virtual.cpp
 
 OBJS := $(patsubst %.cpp,$(BUILDDIR)/host/system/uapp/minfs/%.cpp.o,$(SRCS))
@@ -9,6 +9,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+class Bcache;
+
 #define PATH_PREFIX "::"
 #define PREFIX_SIZE 2
 
@@ -25,3 +27,7 @@ int emu_stat(const char* fn, struct stat* s);
 DIR* emu_opendir(const char* name);
 struct dirent* emu_readdir(DIR* dirp);
 int emu_closedir(DIR* dirp);
+
+// Writes a new filesystem holding the files listed in the manifest argv[0],
+// one "path/in/image=path/on/host" per line.
+int minfs_build_image(Bcache* bc, int argc, char** argv);
@@ -0,0 +1,488 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Builds a whole filesystem image from a manifest in one pass.
+//
+// Going through the vnode ops, every file costs a directory lookup, an inode
+// and bitmap read-modify-write, and one block write per data block.  Here the
+// whole tree is known up front, so it is laid out in memory first: inodes are
+// numbered breadth first, and each directory's dirents, then each file's data
+// followed by its indirect blocks, are given consecutive blocks in the same
+// order.  The data area is then streamed out in large sequential writes, and
+// the metadata (bitmaps, the used part of the inode table, the info block)
+// is written once at the end.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_free_ptr.h>
+
+#include "host.h"
+#include "minfs-private.h"
+
+namespace {
+
+constexpr uint32_t kPerIndirect = kMinfsBlockSize / sizeof(uint32_t);
+// blocks gathered up before each write to the image
+constexpr uint32_t kStageBlocks = 128;
+constexpr uint32_t kNodeBuckets = 4096;
+
+struct Node {
+    Node* parent;
+    Node* children;      // in manifest order
+    Node* children_tail;
+    Node* sibling;
+    Node* hash_next;     // (parent, name) lookup
+    Node* bfs_next;      // inode and allocation order
+    char* name;
+    uint8_t namelen;
+    bool dir;
+    char* src;           // host file, for files
+    uint32_t ino;
+    minfs_inode_t inode;
+};
+
+struct Image {
+    Bcache* bc;
+    minfs_info_t info;
+    Node* root;
+    Node* bucket[kNodeBuckets];
+    Bitmap abm;
+    Bitmap ibm;
+    // blocks staged for writing, starting at stage_bno
+    mxtl::unique_free_ptr<uint8_t> stage;
+    uint32_t stage_bno;
+    uint32_t stage_count;
+};
+
+uint32_t node_hash(const Node* parent, const char* name, size_t len) {
+    uint32_t h = fnv1a32(&parent, sizeof(parent));
+    h ^= fnv1a32(name, len);
+    return h % kNodeBuckets;
+}
+
+Node* node_new(Node* parent, const char* name, size_t len, bool dir) {
+    Node* n = static_cast<Node*>(calloc(1, sizeof(Node)));
+    if (n == nullptr) {
+        return nullptr;
+    }
+    if ((n->name = strndup(name, len)) == nullptr) {
+        free(n);
+        return nullptr;
+    }
+    n->parent = parent;
+    n->namelen = static_cast<uint8_t>(len);
+    n->dir = dir;
+    return n;
+}
+
+// Finds or adds the child 'name' of 'parent'.
+Node* node_child(Image* img, Node* parent, const char* name, size_t len, bool dir) {
+    uint32_t h = node_hash(parent, name, len);
+    for (Node* n = img->bucket[h]; n != nullptr; n = n->hash_next) {
+        if ((n->parent == parent) && (n->namelen == len) && !memcmp(n->name, name, len)) {
+            if (n->dir != dir) {
+                fprintf(stderr, "minfs: '%.*s' is both a file and a directory\n",
+                        static_cast<int>(len), name);
+                return nullptr;
+            }
+            return n;
+        }
+    }
+    Node* n = node_new(parent, name, len, dir);
+    if (n == nullptr) {
+        return nullptr;
+    }
+    n->hash_next = img->bucket[h];
+    img->bucket[h] = n;
+    if (parent->children_tail) {
+        parent->children_tail->sibling = n;
+    } else {
+        parent->children = n;
+    }
+    parent->children_tail = n;
+    return n;
+}
+
+// Adds the file 'dst' (a path within the image) with the contents of 'src'.
+mx_status_t image_add(Image* img, const char* dst, const char* src) {
+    Node* dir = img->root;
+    for (;;) {
+        while (*dst == '/') {
+            dst++;
+        }
+        const char* end = strchr(dst, '/');
+        size_t len = end ? end - dst : strlen(dst);
+        if (len == 0) {
+            fprintf(stderr, "minfs: no file name in manifest entry for '%s'\n", src);
+            return ERR_INVALID_ARGS;
+        }
+        if ((len > kMinfsMaxNameSize) ||
+            ((len == 1) && (dst[0] == '.')) ||
+            ((len == 2) && (dst[0] == '.') && (dst[1] == '.'))) {
+            fprintf(stderr, "minfs: bad name '%.*s'\n", static_cast<int>(len), dst);
+            return ERR_INVALID_ARGS;
+        }
+        if (end == nullptr) {
+            Node* n = node_child(img, dir, dst, len, false);
+            if (n == nullptr) {
+                return ERR_INVALID_ARGS;
+            }
+            if (n->src) {
+                fprintf(stderr, "minfs: '%s' appears twice, using '%s'\n", dst, src);
+                free(n->src);
+            }
+            if ((n->src = strdup(src)) == nullptr) {
+                return ERR_NO_MEMORY;
+            }
+            return NO_ERROR;
+        }
+        if ((dir = node_child(img, dir, dst, len, true)) == nullptr) {
+            return ERR_INVALID_ARGS;
+        }
+        dst = end;
+    }
+}
+
+mx_status_t image_read_manifest(Image* img, const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr) {
+        fprintf(stderr, "minfs: cannot open manifest '%s'\n", path);
+        return ERR_IO;
+    }
+    mx_status_t status = NO_ERROR;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        char* end = line + strlen(line);
+        while ((end > line) && ((end[-1] == '\n') || (end[-1] == '\r') || (end[-1] == ' '))) {
+            *--end = 0;
+        }
+        char* eq = strchr(line, '=');
+        if ((line[0] == '#') || (eq == nullptr)) {
+            continue;
+        }
+        *eq = 0;
+        if ((status = image_add(img, line, eq + 1)) != NO_ERROR) {
+            break;
+        }
+    }
+    fclose(fp);
+    return status;
+}
+
+uint32_t blocks_for(uint64_t size) {
+    return static_cast<uint32_t>((size + kMinfsBlockSize - 1) / kMinfsBlockSize);
+}
+
+// Numbers the inodes breadth first, works out each one's size, and gives
+// it its data blocks followed by its indirect blocks.
+mx_status_t image_layout(Image* img) {
+    uint32_t ino = kMinfsRootIno;
+    uint32_t bno = img->info.dat_block;
+    Node* tail = img->root;
+    for (Node* n = img->root; n != nullptr; n = n->bfs_next) {
+        if (ino >= img->info.inode_count) {
+            fprintf(stderr, "minfs: too many files (%u inodes)\n", img->info.inode_count);
+            return ERR_NO_RESOURCES;
+        }
+        minfs_inode_t* inode = &n->inode;
+        n->ino = ino++;
+        inode->link_count = 1;
+        img->ibm.Set(n->ino);
+
+        uint64_t size;
+        if (n->dir) {
+            inode->magic = kMinfsMagicDir;
+            size = DirentSize(1) + DirentSize(2);
+            inode->dirent_count = 2;
+            for (Node* c = n->children; c != nullptr; c = c->sibling) {
+                tail->bfs_next = c;
+                tail = c;
+                size += DirentSize(c->namelen);
+                inode->dirent_count++;
+            }
+            if (size > kMinfsMaxDirectorySize) {
+                fprintf(stderr, "minfs: directory '%s' has too many entries\n",
+                        n->name ? n->name : "/");
+                return ERR_NO_RESOURCES;
+            }
+        } else {
+            inode->magic = kMinfsMagicFile;
+            struct stat s;
+            if (stat(n->src, &s) < 0) {
+                fprintf(stderr, "minfs: cannot stat '%s'\n", n->src);
+                return ERR_IO;
+            }
+            size = s.st_size;
+            if (size > kMinfsMaxFileSize) {
+                fprintf(stderr, "minfs: '%s' is too large\n", n->src);
+                return ERR_FILE_BIG;
+            }
+        }
+        inode->size = static_cast<uint32_t>(size);
+
+        uint32_t count = blocks_for(size);
+        uint32_t indirect = 0;
+        if (count > kMinfsDirect) {
+            indirect = (count - kMinfsDirect + kPerIndirect - 1) / kPerIndirect;
+        }
+        if (count + indirect > img->info.block_count - bno) {
+            fprintf(stderr, "minfs: image is too small\n");
+            return ERR_NO_RESOURCES;
+        }
+        for (uint32_t i = 0; i < mxtl::min(count, kMinfsDirect); i++) {
+            inode->dnum[i] = bno + i;
+        }
+        for (uint32_t i = 0; i < indirect; i++) {
+            inode->inum[i] = bno + count + i;
+        }
+        inode->block_count = count + indirect;
+        bno += count + indirect;
+    }
+    for (uint32_t n = 0; n < bno; n++) {
+        img->abm.Set(n);
+    }
+    return NO_ERROR;
+}
+
+mx_status_t stage_flush(Image* img) {
+    if (img->stage_count == 0) {
+        return NO_ERROR;
+    }
+    mx_status_t status = img->bc->Writeblks(img->stage_bno, img->stage_count, img->stage.get());
+    img->stage_bno += img->stage_count;
+    img->stage_count = 0;
+    return status;
+}
+
+// Returns the next (zeroed) block of the data area to fill in.
+uint8_t* stage_block(Image* img) {
+    if ((img->stage_count == kStageBlocks) && (stage_flush(img) != NO_ERROR)) {
+        return nullptr;
+    }
+    uint8_t* data = img->stage.get() + img->stage_count++ * kMinfsBlockSize;
+    memset(data, 0, kMinfsBlockSize);
+    return data;
+}
+
+// The indirect blocks follow the node's data.
+mx_status_t write_indirect(Image* img, Node* n) {
+    uint32_t next = n->inode.dnum[0] + kMinfsDirect;
+    uint32_t end = n->inode.dnum[0] + blocks_for(n->inode.size);
+    for (uint32_t i = 0; (i < kMinfsIndirect) && (n->inode.inum[i] != 0); i++) {
+        uint32_t* entries = reinterpret_cast<uint32_t*>(stage_block(img));
+        if (entries == nullptr) {
+            return ERR_IO;
+        }
+        for (uint32_t j = 0; (j < kPerIndirect) && (next < end); j++) {
+            entries[j] = next++;
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t write_dirent(Image* img, uint8_t** blk, uint32_t* off, uint32_t ino,
+                         uint32_t type, const char* name, uint8_t namelen, bool last) {
+    uint8_t buf[kMinfsMaxDirentSize];
+    memset(buf, 0, sizeof(buf));
+    minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(buf);
+    uint32_t reclen = DirentSize(namelen);
+    de->ino = ino;
+    de->reclen = reclen | (last ? kMinfsReclenLast : 0);
+    de->namelen = namelen;
+    de->type = static_cast<uint8_t>(type);
+    memcpy(de->name, name, namelen);
+
+    // records may run on into the next block
+    for (uint32_t done = 0; done < reclen;) {
+        if (*off == kMinfsBlockSize) {
+            if ((*blk = stage_block(img)) == nullptr) {
+                return ERR_IO;
+            }
+            *off = 0;
+        }
+        uint32_t xfer = mxtl::min(reclen - done, kMinfsBlockSize - *off);
+        memcpy(*blk + *off, buf + done, xfer);
+        *off += xfer;
+        done += xfer;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t write_dir(Image* img, Node* n) {
+    uint8_t* blk = nullptr;
+    uint32_t off = kMinfsBlockSize;
+    uint32_t parent = n->parent ? n->parent->ino : n->ino;
+    mx_status_t status;
+    if (((status = write_dirent(img, &blk, &off, n->ino, kMinfsTypeDir, ".", 1, false)) != NO_ERROR) ||
+        ((status = write_dirent(img, &blk, &off, parent, kMinfsTypeDir, "..", 2,
+                                n->children == nullptr)) != NO_ERROR)) {
+        return status;
+    }
+    for (Node* c = n->children; c != nullptr; c = c->sibling) {
+        status = write_dirent(img, &blk, &off, c->ino,
+                              c->dir ? kMinfsTypeDir : kMinfsTypeFile,
+                              c->name, c->namelen, c->sibling == nullptr);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    return write_indirect(img, n);
+}
+
+mx_status_t write_file(Image* img, Node* n) {
+    uint32_t count = blocks_for(n->inode.size);
+    if (count == 0) {
+        return NO_ERROR;
+    }
+    int fd = open(n->src, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "minfs: cannot open '%s'\n", n->src);
+        return ERR_IO;
+    }
+    // read straight into the staging buffer, as many blocks at a time as fit
+    mx_status_t status = NO_ERROR;
+    uint64_t left = n->inode.size;
+    while (left > 0) {
+        if ((img->stage_count == kStageBlocks) && ((status = stage_flush(img)) != NO_ERROR)) {
+            break;
+        }
+        uint32_t room = kStageBlocks - img->stage_count;
+        size_t len = static_cast<size_t>(mxtl::min<uint64_t>(left, room * kMinfsBlockSize));
+        uint8_t* data = img->stage.get() + img->stage_count * kMinfsBlockSize;
+        uint32_t blocks = blocks_for(len);
+        memset(data + len, 0, blocks * kMinfsBlockSize - len);
+        for (size_t done = 0; done < len;) {
+            ssize_t r = read(fd, data + done, len - done);
+            if (r <= 0) {
+                fprintf(stderr, "minfs: cannot read '%s'\n", n->src);
+                status = ERR_IO;
+                break;
+            }
+            done += r;
+        }
+        if (status != NO_ERROR) {
+            break;
+        }
+        img->stage_count += blocks;
+        left -= len;
+    }
+    close(fd);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    return write_indirect(img, n);
+}
+
+mx_status_t write_metadata(Image* img) {
+    minfs_info_t* info = &img->info;
+    uint32_t abmblks = (info->block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+    uint32_t ibmblks = (info->inode_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+    mx_status_t status;
+    if (((status = img->bc->Writeblks(info->abm_block, abmblks, img->abm.data())) != NO_ERROR) ||
+        ((status = img->bc->Writeblks(info->ibm_block, ibmblks, img->ibm.data())) != NO_ERROR)) {
+        return status;
+    }
+
+    // the used part of the inode table; the rest is zeroed lazily
+    uint32_t inoblks = (info->inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
+    uint32_t used = 0;
+    for (Node* n = img->root; n != nullptr; n = n->bfs_next) {
+        used = n->ino / kMinfsInodesPerBlock + 1;
+    }
+    info->ino_init_count = used;
+    if (used == inoblks) {
+        info->flags &= ~kMinfsFlagLazyInodes;
+    }
+    size_t len = used * kMinfsBlockSize;
+    mxtl::unique_free_ptr<minfs_inode_t> table(static_cast<minfs_inode_t*>(calloc(1, len)));
+    if (table == nullptr) {
+        return ERR_NO_MEMORY;
+    }
+    for (Node* n = img->root; n != nullptr; n = n->bfs_next) {
+        table.get()[n->ino] = n->inode;
+    }
+    if ((status = img->bc->Writeblks(info->ino_block, used, table.get())) != NO_ERROR) {
+        return status;
+    }
+
+    // start with an empty journal
+    uint8_t blk[kMinfsBlockSize];
+    memset(blk, 0, sizeof(blk));
+    if ((status = img->bc->Writeblks(info->jnl_block, 1, blk)) != NO_ERROR) {
+        return status;
+    }
+
+    // and last, the info block which makes it all valid
+    memcpy(blk, info, sizeof(*info));
+    return img->bc->Writeblks(0, 1, blk);
+}
+
+void image_free(Image* img) {
+    for (uint32_t h = 0; h < kNodeBuckets; h++) {
+        Node* next;
+        for (Node* n = img->bucket[h]; n != nullptr; n = next) {
+            next = n->hash_next;
+            free(n->name);
+            free(n->src);
+            free(n);
+        }
+    }
+    free(img->root);
+    delete img;
+}
+
+}  // namespace
+
+int minfs_build_image(Bcache* bc, int argc, char** argv) {
+    if (argc != 1) {
+        fprintf(stderr, "manifest requires one argument\n");
+        return -1;
+    }
+
+    Image* img = new Image();
+    img->bc = bc;
+    minfs_init_info(&img->info, bc->Maxblk());
+    img->root = static_cast<Node*>(calloc(1, sizeof(Node)));
+    img->stage.reset(static_cast<uint8_t*>(malloc(kStageBlocks * kMinfsBlockSize)));
+    mx_status_t status = NO_ERROR;
+    if ((img->root == nullptr) || (img->stage == nullptr)) {
+        status = ERR_NO_MEMORY;
+    } else if ((status = img->abm.Init(img->info.block_count)) == NO_ERROR) {
+        status = img->ibm.Init(img->info.inode_count);
+    }
+    if (status == NO_ERROR) {
+        img->root->dir = true;
+        img->ibm.Set(0);
+        status = image_read_manifest(img, argv[0]);
+    }
+    if (status == NO_ERROR) {
+        status = image_layout(img);
+    }
+
+    // stream out the data area, in the order it was allocated
+    img->stage_bno = img->info.dat_block;
+    for (Node* n = img->root; (status == NO_ERROR) && (n != nullptr); n = n->bfs_next) {
+        status = n->dir ? write_dir(img, n) : write_file(img, n);
+    }
+    if (status == NO_ERROR) {
+        status = stage_flush(img);
+    }
+    if (status == NO_ERROR) {
+        status = write_metadata(img);
+    }
+    if ((status == NO_ERROR) && (bc->Sync() < 0)) {
+        status = ERR_IO;
+    }
+    if (status == NO_ERROR) {
+        minfs_dump_info(&img->info);
+    }
+    image_free(img);
+    return (status == NO_ERROR) ? 0 : -1;
+}
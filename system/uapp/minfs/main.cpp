@@ -28,7 +28,7 @@ int do_minfs_mount(Bcache* bc, int argc, char** argv) {
     if (minfs_mount(&vn, bc) < 0) {
         return -1;
     }
-    vfs_rpc_server(vn);
+    vfs_rpc_server(vn, bc);
     return 0;
 }
 #else
@@ -223,8 +223,9 @@ struct {
 } CMDS[] = {
     {"create", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
     {"mkfs", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
-    {"check", do_minfs_check, O_RDONLY, "check filesystem integrity"},
-    {"fsck", do_minfs_check, O_RDONLY, "check filesystem integrity"},
+    // checking replays the journal first, so it needs to write
+    {"check", do_minfs_check, O_RDWR, "replay the journal, then check filesystem integrity"},
+    {"fsck", do_minfs_check, O_RDWR, "replay the journal, then check filesystem integrity"},
 #ifdef __Fuchsia__
     {"mount", do_minfs_mount, O_RDWR, "mount filesystem"},
 #else
@@ -236,6 +237,7 @@ struct {
     {"mv", do_rename, O_RDWR, "rename file or directory"},
     {"rename", do_rename, O_RDWR, "rename file or directory"},
     {"ls", do_ls, O_RDWR, "list content of directory"},
+    {"manifest", minfs_build_image, O_RDWR | O_CREAT, "create filesystem from manifest"},
 #endif
 };
 
@@ -348,7 +350,8 @@ found:
             flags &= (~O_CREAT);
             goto found;
         }
-        fprintf(stderr, "error: cannot open '%s'\n", fn);
+        fprintf(stderr, "error: cannot open '%s'%s\n", fn,
+                ((flags & O_ACCMODE) == O_RDWR) ? " for writing" : "");
         return -1;
     }
 #endif
@@ -2,125 +2,266 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <mxtl/algorithm.h>
+#include <mxtl/unique_free_ptr.h>
+
 #include "minfs.h"
 #include "minfs-private.h"
 
-#define VERBOSE 1
+#define VERBOSE 0
 
-static mx_status_t get_inode(const Minfs* fs, minfs_inode_t* inode, uint32_t ino) {
-    if (ino >= fs->info.inode_count) {
-        error("check: ino %u out of range (>=%u)\n",
-              ino, fs->info.inode_count);
-        return ERR_OUT_OF_RANGE;
-    }
+// The check runs in two passes. First, worker threads take the inode table
+// a batch of blocks at a time and check every allocated inode in it: its
+// block references, and for a directory, its dirents, which are read in
+// runs of consecutive blocks. What the dirents say about the other inodes is
+// only recorded. Second, a single pass over those records checks what needs
+// the whole picture: '..' entries, and inodes no dirent names.
+
+// inode table blocks a worker takes, and reads, at a time
+constexpr uint32_t kCheckInodeBatch = 32;
+// most blocks of a directory read in one request
+constexpr uint32_t kCheckReadMax = 64;
+constexpr uint32_t kCheckThreadsMax = 4;
+// scans done sooner than this do not report their progress
+constexpr uint64_t kCheckReportMs = 1000;
+
+constexpr uint32_t kCheckPerIndirect = kMinfsBlockSize / sizeof(uint32_t);
+constexpr uint32_t kCheckMaxFileBlock = static_cast<uint32_t>(kMinfsMaxFileBlock);
+
+constexpr uint32_t kCheckNodeDir = 1;
+constexpr uint32_t kCheckNodeDotDot = 2;
+
+// what the inode scan learns of each inode, for the pass after it
+struct CheckNode {
+    uint32_t flags;
+    // dirents naming it, other than '.' and '..'
+    uint32_t refs;
+    // the lowest numbered directory naming it
+    uint32_t parent;
+    // for a directory, what its '..' names, and where
+    uint32_t dotdot;
+    uint32_t dotdot_eno;
+};
+
+struct CheckState {
+    const Minfs* fs;
+    const Bitmap* inode_map;
+    Bcache* bc;
+
+    // held across reads, since they share the file offset of the device
+    pthread_mutex_t io_lock;
+    // held to mark the bitmaps below
+    pthread_mutex_t map_lock;
+    Bitmap checked_inodes;
+    Bitmap checked_blocks;
+
+    mxtl::unique_free_ptr<CheckNode> nodes;
+
+    // the rest are only updated atomically
+    uint32_t next_batch;
+    uint32_t batches;
+    uint32_t done_batches;
+    uint32_t reported;
+    uint64_t start_ms;
+    uint32_t inodes;
+    uint32_t blocks;
+    // the first error which stops the check
     mx_status_t status;
-    uint32_t bno_of_ino = fs->info.ino_block + ino / kMinfsInodesPerBlock;
-    uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
-    if ((status = fs->bc->Read(bno_of_ino, inode, off_of_ino, kMinfsInodeSize)) < 0) {
-        return status;
-    }
-    if ((inode->magic != kMinfsMagicFile) && (inode->magic != kMinfsMagicDir)) {
-        error("check: ino %u has bad magic %#x\n", ino, inode->magic);
-        return ERR_IO_DATA_INTEGRITY;
-    }
-    return NO_ERROR;
-}
+};
+
+struct CheckWorker {
+    CheckState* chk;
+    pthread_t thread;
 
-#define CD_DUMP 1
-#define CD_RECURSE 2
+    mxtl::unique_free_ptr<char> itable;
+    // the block of each file block of the inode being checked
+    mxtl::unique_free_ptr<uint32_t> bnos;
+    mxtl::unique_free_ptr<char> dir;
 
-static mx_status_t get_inode_nth_bno(const Minfs* fs, minfs_inode_t* inode, uint32_t n,
-                                     uint32_t* bno_out) {
-    if (n < kMinfsDirect) {
-        *bno_out = inode->dnum[n];
+    mx_status_t Init(CheckState* state) {
+        chk = state;
+        itable.reset(static_cast<char*>(malloc(kCheckInodeBatch * kMinfsBlockSize)));
+        bnos.reset(static_cast<uint32_t*>(malloc(kCheckMaxFileBlock * sizeof(uint32_t))));
+        dir.reset(static_cast<char*>(malloc(kMinfsDirIndexBlock * kMinfsBlockSize)));
+        if ((itable == nullptr) || (bnos == nullptr) || (dir == nullptr)) {
+            return ERR_NO_MEMORY;
+        }
         return NO_ERROR;
     }
-    n -= kMinfsDirect;
-    uint32_t i = static_cast<uint32_t>(n / (kMinfsBlockSize / sizeof(uint32_t)));
-    uint32_t j = n % (kMinfsBlockSize / sizeof(uint32_t));
+};
 
-    if (i >= kMinfsIndirect) {
-        return ERR_OUT_OF_RANGE;
-    }
+static uint64_t check_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
 
-    uint32_t ibno;
-    if ((ibno = inode->inum[i]) == 0) {
-        *bno_out = 0;
-        return NO_ERROR;
-    }
-    mxtl::RefPtr<BlockNode> iblk;
-    if ((iblk = fs->bc->Get(ibno)) == nullptr) {
-        return ERR_NOT_FOUND;
-    }
-    uint32_t* ientry = static_cast<uint32_t*>(iblk->data());
-    *bno_out = ientry[j];
-    fs->bc->Put(mxtl::move(iblk), 0);
-    return NO_ERROR;
+static mx_status_t check_read(CheckState* chk, uint32_t bno, uint32_t count, void* data) {
+    pthread_mutex_lock(&chk->io_lock);
+    mx_status_t status = chk->bc->Readblks(bno, count, data);
+    pthread_mutex_unlock(&chk->io_lock);
+    return status;
 }
 
-// Convert 'single-block-reads' to generic reads, which may cross block
-// boundaries. This function works on directories too.
-static mx_status_t file_read(const Minfs* fs, minfs_inode_t* inode, void* data,
-                             size_t len, size_t off) {
-    if (off >= inode->size) {
-        return 0;
+// called with map_lock held
+static const char* check_data_block(CheckState* chk, uint32_t bno) {
+    const Minfs* fs = chk->fs;
+    if (bno < fs->info.dat_block) {
+        return "in metadata area";
+    }
+    if (bno >= fs->info.block_count) {
+        return "out of range";
+    }
+    if (!fs->block_map.Get(bno)) {
+        return "not allocated";
     }
-    if (len > (inode->size - off)) {
-        len = inode->size - off;
+    if (chk->checked_blocks.Get(bno)) {
+        return "double-allocated";
     }
+    chk->checked_blocks.Set(bno);
+    return nullptr;
+}
 
-    void* start = data;
-    uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
-    uint32_t adjust = off % kMinfsBlockSize;
+// Checks the blocks of a file, leaving the block of each file block in
+// w->bnos, up to *nblocks_out.
+static mx_status_t check_file(CheckWorker* w, minfs_inode_t* inode, uint32_t ino,
+                              uint32_t* nblocks_out) {
+    CheckState* chk = w->chk;
+    uint32_t* bnos = w->bnos.get();
+#if VERBOSE
+    for (unsigned n = 0; n < kMinfsDirect; n++) {
+        info("%d, ", inode->dnum[n]);
+    }
+    info("...\n");
+#endif
 
-    while ((len > 0) && (n < kMinfsMaxFileBlock)) {
-        uint32_t xfer;
-        if (len > (kMinfsBlockSize - adjust)) {
-            xfer = kMinfsBlockSize - adjust;
-        } else {
-            xfer = static_cast<uint32_t>(len);
+    // gather every block reference before taking the lock to check them
+    uint32_t nblocks = kMinfsDirect;
+    memcpy(bnos, inode->dnum, sizeof(inode->dnum));
+    for (unsigned n = 0; n < kMinfsIndirect; n++) {
+        uint32_t* entries = bnos + kMinfsDirect + n * kCheckPerIndirect;
+        uint32_t ibno = inode->inum[n];
+        if ((ibno == 0) || (ibno >= chk->fs->info.block_count)) {
+            // one out of range is reported below
+            memset(entries, 0, kMinfsBlockSize);
+            continue;
         }
-
-        uint32_t bno;
         mx_status_t status;
-        if ((status = get_inode_nth_bno(fs, inode, n, &bno)) != NO_ERROR) {
+        if ((status = check_read(chk, ibno, 1, entries)) < 0) {
             return status;
         }
+        nblocks = kMinfsDirect + (n + 1) * kCheckPerIndirect;
+    }
 
-        if ((status = fs->bc->Read(bno, data, adjust, xfer)) != NO_ERROR) {
-            return status;
+    uint32_t blocks = 0;
+    unsigned max = 0;
+    pthread_mutex_lock(&chk->map_lock);
+    // count and sanity-check indirect blocks
+    for (unsigned n = 0; n < kMinfsIndirect; n++) {
+        if (inode->inum[n]) {
+            const char* msg;
+            if ((msg = check_data_block(chk, inode->inum[n])) != nullptr) {
+                warn("check: ino#%u: indirect block %u(@%u): %s\n",
+                     ino, n, inode->inum[n], msg);
+            }
+            blocks++;
+        }
+    }
+    // count and sanity-check data blocks
+    for (unsigned n = 0; n < nblocks; n++) {
+        uint32_t bno = bnos[n];
+        if (bno) {
+            blocks++;
+            const char* msg;
+            if ((msg = check_data_block(chk, bno)) != nullptr) {
+                warn("check: ino#%u: block %u(@%u): %s\n", ino, n, bno, msg);
+            }
+            // a directory's index lies past its size
+            if ((inode->magic != kMinfsMagicDir) || (n < kMinfsDirIndexBlock)) {
+                max = n + 1;
+            }
         }
+    }
+    pthread_mutex_unlock(&chk->map_lock);
 
-        adjust = 0;
-        len -= xfer;
-        data = (void*)((uintptr_t)data + xfer);
-        n++;
+    if (max) {
+        unsigned sizeblocks = inode->size / kMinfsBlockSize;
+        if (sizeblocks > max) {
+            warn("check: ino#%u: filesize too large\n", ino);
+        } else if (sizeblocks < (max - 1)) {
+            warn("check: ino#%u: filesize too small\n", ino);
+        }
+    } else {
+        if (inode->size) {
+            warn("check: ino#%u: filesize too large\n", ino);
+        }
     }
+    if (blocks != inode->block_count) {
+        warn("check: ino#%u: block count %u, actual blocks %u\n",
+             ino, inode->block_count, blocks);
+    }
+    __atomic_fetch_add(&chk->blocks, blocks, __ATOMIC_RELAXED);
+    *nblocks_out = nblocks;
+    return NO_ERROR;
+}
 
-    return static_cast<mx_status_t>((uintptr_t) data - (uintptr_t) start);
+// Reads the dirents of a directory, whose blocks check_file() left in
+// w->bnos, into w->dir, a run of consecutive blocks at a time.
+static mx_status_t check_read_directory(CheckWorker* w, uint32_t nblocks, uint32_t len) {
+    CheckState* chk = w->chk;
+    const uint32_t* bnos = w->bnos.get();
+    uint32_t count = mxtl::min((len + kMinfsBlockSize - 1) / kMinfsBlockSize, nblocks);
+    for (uint32_t n = 0; n < count;) {
+        char* data = w->dir.get() + n * kMinfsBlockSize;
+        uint32_t bno = bnos[n];
+        if ((bno == 0) || (bno >= chk->fs->info.block_count)) {
+            memset(data, 0, kMinfsBlockSize);
+            n++;
+            continue;
+        }
+        uint32_t run = 1;
+        while ((n + run < count) && (run < kCheckReadMax) && (bnos[n + run] == bno + run)) {
+            run++;
+        }
+        mx_status_t status;
+        if ((status = check_read(chk, bno, run, data)) < 0) {
+            return status;
+        }
+        n += run;
+    }
+    return NO_ERROR;
 }
 
-static mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inode,
-                                   uint32_t ino, uint32_t parent, uint32_t flags) {
+static mx_status_t check_directory(CheckWorker* w, minfs_inode_t* inode, uint32_t ino,
+                                   uint32_t nblocks) {
+    CheckState* chk = w->chk;
+    CheckNode* nodes = chk->nodes.get();
     unsigned eno = 0;
     bool dot = false;
     bool dotdot = false;
     uint32_t dirent_count = 0;
 
+    uint32_t len = mxtl::min(inode->size, kMinfsDirIndexBlock * kMinfsBlockSize);
+    mx_status_t status;
+    if ((status = check_read_directory(w, nblocks, len)) < 0) {
+        return status;
+    }
+
     size_t off = 0;
     while (true) {
-        uint32_t data[MINFS_DIRENT_SIZE];
-        mx_status_t status = file_read(fs, inode, data, MINFS_DIRENT_SIZE, off);
-        if (status != MINFS_DIRENT_SIZE) {
+        if (off + MINFS_DIRENT_SIZE > len) {
             error("check: ino#%u: Could not read direnty at %zd\n", ino, off);
-            return status < 0 ? status : ERR_IO;
+            return ERR_IO;
         }
-        minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(data);
+        minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(w->dir.get() + off);
         uint32_t rlen = static_cast<uint32_t>(MinfsReclen(de, off));
         bool is_last = de->reclen & kMinfsReclenLast;
         if (!is_last && ((rlen < MINFS_DIRENT_SIZE) ||
@@ -129,14 +270,20 @@ static mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_
             return ERR_IO_DATA_INTEGRITY;
         }
         if (de->ino == 0) {
-            if (flags & CD_DUMP) {
-                info("ino#%u: de[%u]: <empty> reclen=%u\n", ino, eno, rlen);
-            }
+#if VERBOSE
+            info("ino#%u: de[%u]: <empty> reclen=%u\n", ino, eno, rlen);
+#endif
         } else {
-            if ((de->namelen == 0) || (de->namelen > (rlen - MINFS_DIRENT_SIZE))) {
+            if ((de->namelen == 0) || (de->namelen > (rlen - MINFS_DIRENT_SIZE)) ||
+                (off + MINFS_DIRENT_SIZE + de->namelen > len)) {
                 error("check: ino#%u: de[%u]: invalid namelen %u\n", ino, eno, de->namelen);
                 return ERR_IO_DATA_INTEGRITY;
             }
+            if (de->ino >= chk->fs->info.inode_count) {
+                error("check: ino %u out of range (>=%u)\n",
+                      de->ino, chk->fs->info.inode_count);
+                return ERR_OUT_OF_RANGE;
+            }
             if ((de->namelen == 1) && (de->name[0] == '.')) {
                 if (dot) {
                     error("check: ino#%u: multiple '.' entries\n", ino);
@@ -145,26 +292,28 @@ static mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_
                 if (de->ino != ino) {
                     error("check: ino#%u: de[%u]: '.' ino=%u (not self!)\n", ino, eno, de->ino);
                 }
-            }
-            if ((de->namelen == 2) && (de->name[0] == '.') && (de->name[1] == '.')) {
+            } else if ((de->namelen == 2) && (de->name[0] == '.') && (de->name[1] == '.')) {
                 if (dotdot) {
                     error("check: ino#%u: multiple '..' entries\n", ino);
                 }
                 dotdot = true;
-                if (de->ino != parent) {
-                    error("check: ino#%u: de[%u]: '..' ino=%u (not parent!)\n", ino, eno, de->ino);
-                }
-            }
-            //TODO: check for cycles (non-dot/dotdot dir ref already in checked bitmap)
-            if (flags & CD_DUMP) {
-                info("ino#%u: de[%u]: ino=%u type=%u '%.*s'\n",
-                     ino, eno, de->ino, de->type, de->namelen, de->name);
-            }
-            if (flags & CD_RECURSE) {
-                if ((status = check_inode(chk, fs, de->ino, ino)) < 0) {
-                    return status;
+                // only this thread checks this directory
+                nodes[ino].dotdot = de->ino;
+                nodes[ino].dotdot_eno = eno;
+                __atomic_fetch_or(&nodes[ino].flags, kCheckNodeDotDot, __ATOMIC_RELAXED);
+            } else {
+                CheckNode* node = &nodes[de->ino];
+                __atomic_fetch_add(&node->refs, 1, __ATOMIC_RELAXED);
+                uint32_t parent = __atomic_load_n(&node->parent, __ATOMIC_RELAXED);
+                while (((parent == 0) || (ino < parent)) &&
+                       !__atomic_compare_exchange_n(&node->parent, &parent, ino, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
                 }
             }
+#if VERBOSE
+            info("ino#%u: de[%u]: ino=%u type=%u '%.*s'\n",
+                 ino, eno, de->ino, de->type, de->namelen, de->name);
+#endif
             dirent_count++;
         }
         if (is_last) {
@@ -187,126 +336,243 @@ static mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_
     return NO_ERROR;
 }
 
-const char* check_data_block(CheckMaps* chk, const Minfs* fs, uint32_t bno) {
-    if (bno < fs->info.dat_block) {
-        return "in metadata area";
-    }
-    if (bno >= fs->info.block_count) {
-        return "out of range";
-    }
-    if (!fs->block_map.Get(bno)) {
-        return "not allocated";
-    }
-    if (chk->checked_blocks.Get(bno)) {
-        return "double-allocated";
+static mx_status_t check_inode(CheckWorker* w, minfs_inode_t* inode, uint32_t ino) {
+    CheckState* chk = w->chk;
+    if ((inode->magic != kMinfsMagicFile) && (inode->magic != kMinfsMagicDir)) {
+        error("check: ino %u has bad magic %#x\n", ino, inode->magic);
+        error("check: ino#%u: not readable\n", ino);
+        return ERR_IO_DATA_INTEGRITY;
     }
-    chk->checked_blocks.Set(bno);
-    return nullptr;
-}
+    pthread_mutex_lock(&chk->map_lock);
+    chk->checked_inodes.Set(ino);
+    pthread_mutex_unlock(&chk->map_lock);
+    __atomic_fetch_add(&chk->inodes, 1, __ATOMIC_RELAXED);
 
-mx_status_t check_file(CheckMaps* chk, const Minfs* fs,
-                       minfs_inode_t* inode, uint32_t ino) {
+    mx_status_t status;
+    uint32_t nblocks;
+    if (inode->magic == kMinfsMagicDir) {
 #if VERBOSE
-    for (unsigned n = 0; n < kMinfsDirect; n++) {
-        info("%d, ", inode->dnum[n]);
-    }
-    info("...\n");
+        info("ino#%u: DIR blks=%u links=%u\n",
+             ino, inode->block_count, inode->link_count);
 #endif
-
-    uint32_t blocks = 0;
-
-    // count and sanity-check indirect blocks
-    for (unsigned n = 0; n < kMinfsIndirect; n++) {
-        if (inode->inum[n]) {
-            const char* msg;
-            if ((msg = check_data_block(chk, fs, inode->inum[n])) != nullptr) {
-                warn("check: ino#%u: indirect block %u(@%u): %s\n",
-                     ino, n, inode->inum[n], msg);
-            }
-            blocks++;
+        __atomic_fetch_or(&chk->nodes.get()[ino].flags, kCheckNodeDir, __ATOMIC_RELAXED);
+        if ((status = check_file(w, inode, ino, &nblocks)) < 0) {
+            return status;
+        }
+        if ((status = check_directory(w, inode, ino, nblocks)) < 0) {
+            return status;
+        }
+    } else {
+#if VERBOSE
+        info("ino#%u: FILE blks=%u links=%u size=%u\n",
+             ino, inode->block_count, inode->link_count, inode->size);
+#endif
+        if ((status = check_file(w, inode, ino, &nblocks)) < 0) {
+            return status;
         }
     }
+    return NO_ERROR;
+}
 
-    // count and sanity-check data blocks
+static void check_fail(CheckState* chk, mx_status_t status) {
+    mx_status_t ok = NO_ERROR;
+    __atomic_compare_exchange_n(&chk->status, &ok, status, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
 
-    unsigned max = 0;
-    for (unsigned n = 0;;n++) {
+static void* check_worker(void* arg) {
+    CheckWorker* w = static_cast<CheckWorker*>(arg);
+    CheckState* chk = w->chk;
+    const minfs_info_t* info = &chk->fs->info;
+    uint32_t iblocks = minfs_ino_blocks_init(info);
+
+    while (__atomic_load_n(&chk->status, __ATOMIC_RELAXED) == NO_ERROR) {
+        uint32_t batch = __atomic_fetch_add(&chk->next_batch, 1, __ATOMIC_RELAXED);
+        if (batch >= chk->batches) {
+            break;
+        }
+        uint32_t first = batch * kCheckInodeBatch;
+        uint32_t count = mxtl::min(kCheckInodeBatch, iblocks - first);
         mx_status_t status;
-        uint32_t bno;
-        if ((status = get_inode_nth_bno(fs, inode, n, &bno)) < 0) {
-            if (status == ERR_OUT_OF_RANGE) {
+        if ((status = check_read(chk, info->ino_block + first, count, w->itable.get())) < 0) {
+            check_fail(chk, status);
+            break;
+        }
+        uint32_t ino = first * kMinfsInodesPerBlock;
+        uint32_t end = mxtl::min((first + count) * kMinfsInodesPerBlock, info->inode_count);
+        for (; ino < end; ino++) {
+            if ((ino == 0) || !chk->inode_map->Get(ino)) {
+                continue;
+            }
+            minfs_inode_t* inode = reinterpret_cast<minfs_inode_t*>(
+                w->itable.get() + (ino - first * kMinfsInodesPerBlock) * kMinfsInodeSize);
+            if (inode->magic == 0) {
+                // marked but never written: only an error once a dirent names
+                // it, which is checked after the scan
+                continue;
+            }
+            if ((status = check_inode(w, inode, ino)) < 0) {
+                check_fail(chk, status);
                 break;
-            } else {
-                return status;
             }
         }
-        if (bno) {
-            blocks++;
-            const char* msg;
-            if ((msg = check_data_block(chk, fs, bno)) != nullptr) {
-                warn("check: ino#%u: block %u(@%u): %s\n", ino, n, bno, msg);
+
+        // report each tenth of the table once, whichever worker gets there
+        uint32_t done = __atomic_add_fetch(&chk->done_batches, 1, __ATOMIC_RELAXED);
+        if (check_now_ms() - chk->start_ms < kCheckReportMs) {
+            continue;
+        }
+        uint32_t pct = (done * 10 / chk->batches) * 10;
+        uint32_t reported = __atomic_load_n(&chk->reported, __ATOMIC_RELAXED);
+        while (pct > reported) {
+            if (__atomic_compare_exchange_n(&chk->reported, &reported, pct, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                info("check: inode scan %u%%\n", pct);
+                break;
             }
-            max = n + 1;
         }
     }
-    if (max) {
-        unsigned sizeblocks = inode->size / kMinfsBlockSize;
-        if (sizeblocks > max) {
-            warn("check: ino#%u: filesize too large\n", ino);
-        } else if (sizeblocks < (max - 1)) {
-            warn("check: ino#%u: filesize too small\n", ino);
-        }
-    } else {
-        if (inode->size) {
-            warn("check: ino#%u: filesize too large\n", ino);
+    return nullptr;
+}
+
+// Reads the record at block off of the journal into *out, if it is complete
+// and follows on from seq. Returns ERR_NOT_FOUND where replay ends.
+static mx_status_t journal_read_record(Bcache* bc, const minfs_info_t* info, uint32_t off,
+                                       bool first, uint64_t seq,
+                                       mxtl::unique_free_ptr<char>* out) {
+    char bdata[kMinfsBlockSize];
+    if (bc->Readblk(info->jnl_block + off, bdata) < 0) {
+        return ERR_IO;
+    }
+    minfs_journal_t* hdr = reinterpret_cast<minfs_journal_t*>(bdata);
+    if ((hdr->magic != kMinfsJournalMagic) || (hdr->count == 0)) {
+        return ERR_NOT_FOUND;
+    }
+    // records left over from before the last checkpoint don't follow on
+    if (!first && (hdr->seq != seq + 1)) {
+        return ERR_NOT_FOUND;
+    }
+    uint32_t count = hdr->count;
+    if ((count >= info->jnl_count - off) ||
+        ((offsetof(minfs_journal_t, bno) + count * sizeof(uint32_t)) > kMinfsBlockSize)) {
+        warn("minfs: journal record of %u blocks is corrupt, ignored\n", count);
+        return ERR_NOT_FOUND;
+    }
+
+    // the whole record has to be read back before it can be trusted
+    mxtl::unique_free_ptr<char> buf(static_cast<char*>(malloc((1 + count) * kMinfsBlockSize)));
+    if (buf == nullptr) {
+        return ERR_NO_MEMORY;
+    }
+    memcpy(buf.get(), bdata, kMinfsBlockSize);
+    for (uint32_t i = 0; i < count; i++) {
+        if (bc->Readblk(info->jnl_block + off + 1 + i,
+                        buf.get() + (1 + i) * kMinfsBlockSize) < 0) {
+            return ERR_IO;
         }
     }
-    if (blocks != inode->block_count) {
-        warn("check: ino#%u: block count %u, actual blocks %u\n",
-             ino, inode->block_count, blocks);
+    hdr = reinterpret_cast<minfs_journal_t*>(buf.get());
+    size_t skip = offsetof(minfs_journal_t, seq);
+    if (fnv1a32(buf.get() + skip, (1 + count) * kMinfsBlockSize - skip) != hdr->checksum) {
+        // it never made it to disk in full, so none of it went home either
+        warn("minfs: journal record %llu incomplete, ignored\n", (unsigned long long)hdr->seq);
+        return ERR_NOT_FOUND;
     }
+    // anything the cache holds may be in a record: the info block, bitmaps,
+    // inodes and directory blocks out in the data area
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bno = hdr->bno[i];
+        if ((bno >= info->block_count) ||
+            ((bno >= info->jnl_block) && (bno - info->jnl_block < info->jnl_count))) {
+            warn("minfs: journal record %llu names bno %u, ignored\n",
+                 (unsigned long long)hdr->seq, bno);
+            return ERR_NOT_FOUND;
+        }
+    }
+    *out = mxtl::move(buf);
     return NO_ERROR;
 }
 
-mx_status_t check_inode(CheckMaps* chk, const Minfs* fs, uint32_t ino, uint32_t parent) {
-    if (chk->checked_inodes.Get(ino)) {
-        // we've been here before
+mx_status_t minfs_journal_replay(Bcache* bc, minfs_info_t* info) {
+    if (info->jnl_count == 0) {
         return NO_ERROR;
     }
-    chk->checked_inodes.Set(ino);
-    if (!fs->inode_map_.Get(ino)) {
-        warn("check: ino#%u: not marked in-use\n", ino);
-    }
+    // the records are applied in the order they were committed, each one
+    // over the blocks of those before it
     mx_status_t status;
-    minfs_inode_t inode;
-    if ((status = get_inode(fs, &inode, ino)) < 0) {
-        error("check: ino#%u: not readable\n", ino);
-        return status;
-    }
-    if (inode.magic == kMinfsMagicDir) {
-        info("ino#%u: DIR blks=%u links=%u\n",
-             ino, inode.block_count, inode.link_count);
-        if ((status = check_file(chk, fs, &inode, ino)) < 0) {
+    bool info_block = false;
+    uint32_t off = 0;
+    uint64_t seq = 0;
+    while (off < info->jnl_count) {
+        mxtl::unique_free_ptr<char> buf;
+        if ((status = journal_read_record(bc, info, off, off == 0, seq, &buf)) != NO_ERROR) {
+            if (status == ERR_NOT_FOUND) {
+                break;
+            }
             return status;
         }
-#if VERBOSE
-        if ((status = check_directory(chk, fs, &inode, ino, parent, CD_DUMP)) < 0) {
-            return status;
+        minfs_journal_t* hdr = reinterpret_cast<minfs_journal_t*>(buf.get());
+        info("minfs: replaying journal record %llu (%u blocks)\n",
+             (unsigned long long)hdr->seq, hdr->count);
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            if (bc->Writeblk(hdr->bno[i], buf.get() + (1 + i) * kMinfsBlockSize) < 0) {
+                return ERR_IO;
+            }
+            if (hdr->bno[i] == 0) {
+                info_block = true;
+            }
         }
-#endif
-        if ((status = check_directory(chk, fs, &inode, ino, parent, CD_RECURSE)) < 0) {
-            return status;
+        seq = hdr->seq;
+        off += 1 + hdr->count;
+    }
+    if (off == 0) {
+        return NO_ERROR;
+    }
+
+    // done with; they must not be applied again over later writes, but
+    // later records carry on their sequence
+    char bdata[kMinfsBlockSize];
+    memset(bdata, 0, sizeof(bdata));
+    minfs_journal_t* hdr = reinterpret_cast<minfs_journal_t*>(bdata);
+    hdr->magic = kMinfsJournalMagic;
+    hdr->seq = seq;
+    size_t skip = offsetof(minfs_journal_t, seq);
+    hdr->checksum = fnv1a32(bdata + skip, kMinfsBlockSize - skip);
+    if (bc->Writeblk(info->jnl_block, bdata) < 0) {
+        return ERR_IO;
+    }
+    // anything read before the replay is stale
+    bc->Invalidate();
+    if (info_block) {
+        if (bc->Read(0, info, 0, sizeof(*info)) < 0) {
+            return ERR_IO;
         }
-    } else {
-        info("ino#%u: FILE blks=%u links=%u size=%u\n",
-             ino, inode.block_count, inode.link_count, inode.size);
-        if ((status = check_file(chk, fs, &inode, ino)) < 0) {
-            return status;
+        if (minfs_check_info(info, bc->Maxblk())) {
+            return ERR_IO_DATA_INTEGRITY;
         }
     }
     return NO_ERROR;
 }
 
+// Checks an inode the scan skipped, though dirents name it.
+static mx_status_t check_named(CheckWorker* w, uint32_t ino) {
+    CheckState* chk = w->chk;
+    if (ino / kMinfsInodesPerBlock >= minfs_ino_blocks_init(&chk->fs->info)) {
+        error("check: ino#%u: past the inode table written so far\n", ino);
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    char bdata[kMinfsBlockSize];
+    mx_status_t status;
+    if ((status = check_read(chk, chk->fs->info.ino_block + ino / kMinfsInodesPerBlock,
+                             1, bdata)) < 0) {
+        error("check: ino#%u: not readable\n", ino);
+        return status;
+    }
+    minfs_inode_t* inode = reinterpret_cast<minfs_inode_t*>(
+        bdata + (ino % kMinfsInodesPerBlock) * kMinfsInodeSize);
+    return check_inode(w, inode, ino);
+}
+
 mx_status_t minfs_check(Bcache* bc) {
     mx_status_t status;
 
@@ -319,23 +585,113 @@ mx_status_t minfs_check(Bcache* bc) {
     if (minfs_check_info(&info, bc->Maxblk())) {
         return -1;
     }
+    if ((status = minfs_journal_replay(bc, &info)) < 0) {
+        error("minfs: cannot replay journal\n");
+        return status;
+    }
 
-    CheckMaps chk;
+    CheckState chk = {};
     if ((status = chk.checked_inodes.Init(info.inode_count)) < 0) {
         return status;
     }
     if ((status = chk.checked_blocks.Init(info.block_count)) < 0) {
         return status;
     }
+    chk.nodes.reset(static_cast<CheckNode*>(calloc(info.inode_count, sizeof(CheckNode))));
+    if (chk.nodes == nullptr) {
+        return ERR_NO_MEMORY;
+    }
     Minfs* fs;
     if ((status = Minfs::Create(&fs, bc, &info)) < 0) {
         return status;
     }
+    // the scan reads around the cache
+    if (bc->PendingCount() > 0) {
+        if ((status = bc->Flush()) < 0) {
+            return status;
+        }
+    }
+    chk.fs = fs;
+    chk.inode_map = &fs->inode_map_;
+    chk.bc = bc;
+    pthread_mutex_init(&chk.io_lock, nullptr);
+    pthread_mutex_init(&chk.map_lock, nullptr);
+    // only the part of the inode table written so far can hold inodes
+    uint32_t iblocks = minfs_ino_blocks_init(&info);
+    chk.batches = (iblocks + kCheckInodeBatch - 1) / kCheckInodeBatch;
+    for (uint32_t n = iblocks * kMinfsInodesPerBlock; n < info.inode_count; n++) {
+        if (fs->inode_map_.Get(n)) {
+            error("check: ino#%u: marked in-use past the inode table written so far\n", n);
+            return ERR_IO_DATA_INTEGRITY;
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t nthreads = static_cast<uint32_t>(mxtl::max(cpus, 1L));
+    nthreads = mxtl::min(mxtl::min(nthreads, kCheckThreadsMax), mxtl::max(chk.batches, 1u));
+    CheckWorker workers[kCheckThreadsMax];
+    for (uint32_t i = 0; i < nthreads; i++) {
+        if ((status = workers[i].Init(&chk)) < 0) {
+            return status;
+        }
+    }
 
-    //TODO: check root not a directory
-    if ((status = check_inode(&chk, fs, 1, 1)) < 0) {
+    uint64_t t0 = check_now_ms();
+    chk.start_ms = t0;
+    // this thread is the first worker
+    uint32_t started = 1;
+    while ((started < nthreads) &&
+           (pthread_create(&workers[started].thread, nullptr, check_worker,
+                           &workers[started]) == 0)) {
+        started++;
+    }
+    check_worker(&workers[0]);
+    for (uint32_t i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, nullptr);
+    }
+    if ((status = chk.status) < 0) {
         return status;
     }
+    uint64_t t1 = check_now_ms();
+
+    CheckNode* nodes = chk.nodes.get();
+    // those found only now may name more of their kind
+    bool again = true;
+    while (again) {
+        again = false;
+        for (uint32_t n = 1; n < info.inode_count; n++) {
+            if (((n == 1) || (nodes[n].refs > 0)) && !chk.checked_inodes.Get(n)) {
+                if (!fs->inode_map_.Get(n)) {
+                    warn("check: ino#%u: not marked in-use\n", n);
+                }
+                if ((status = check_named(&workers[0], n)) < 0) {
+                    return status;
+                }
+                again = true;
+            }
+        }
+    }
+
+    if (!(nodes[1].flags & kCheckNodeDir)) {
+        error("check: root ino#1 is not a directory\n");
+        return ERR_IO_DATA_INTEGRITY;
+    }
+
+    for (uint32_t n = 1; n < info.inode_count; n++) {
+        const CheckNode* node = &nodes[n];
+        if (!(node->flags & kCheckNodeDir)) {
+            continue;
+        }
+        if (node->refs > 1) {
+            warn("check: ino#%u: directory named by %u dirents\n", n, node->refs);
+        }
+        // an abandoned directory is reported below, as not in use
+        uint32_t parent = (n == 1) ? 1 : node->parent;
+        if ((node->flags & kCheckNodeDotDot) && (parent != 0) && (node->dotdot != parent)) {
+            error("check: ino#%u: de[%u]: '..' ino=%u (not parent!)\n",
+                  n, node->dotdot_eno, node->dotdot);
+        }
+    }
 
     unsigned missing = 0;
     for (unsigned n = info.dat_block; n < info.block_count; n++) {
@@ -351,9 +707,9 @@ mx_status_t minfs_check(Bcache* bc) {
     }
 
     missing = 0;
-    for (unsigned n = 1; n < info.inode_count; n++) {
+    for (unsigned n = 2; n < info.inode_count; n++) {
         if (fs->inode_map_.Get(n)) {
-            if (!chk.checked_inodes.Get(n)) {
+            if (nodes[n].refs == 0) {
                 missing++;
             }
         }
@@ -362,9 +718,16 @@ mx_status_t minfs_check(Bcache* bc) {
         error("check: %u allocated inode%s not in use\n",
               missing, missing > 1 ? "s" : "");
     }
+    uint64_t t2 = check_now_ms();
+
+    info("check: %u inodes, %u blocks: scan %llu ms on %u thread%s, cross-check %llu ms\n",
+         chk.inodes, chk.blocks, (unsigned long long)(t1 - t0), started,
+         started > 1 ? "s" : "", (unsigned long long)(t2 - t1));
+
+    pthread_mutex_destroy(&chk.io_lock);
+    pthread_mutex_destroy(&chk.map_lock);
 
-    //TODO: check allocated inodes that were abandoned
-    //TODO: check allocated blocks that were not accounted for
+    //TODO: check for cycles of directories cut off from the root
     //TODO: check unallocated inodes where magic != 0
     fprintf(stderr, "check: okay\n");
     return NO_ERROR;
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -93,8 +94,10 @@ static mx_status_t minfs_inode_destroy(vnode_t* vn) {
 
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
+// The index blocks of a directory stay; they are only freed with the inode.
 static mx_status_t vn_blocks_shrink(vnode_t* vn, uint32_t start) {
     mxtl::RefPtr<BlockNode> bitmap_blk = nullptr;
+    uint32_t end = VNODE_IS_DIR(vn) ? kMinfsDirIndexBlock : UINT32_MAX;
 
     // release direct blocks
     for (unsigned bno = start; bno < kMinfsDirect; bno++) {
@@ -136,10 +139,10 @@ static mx_status_t vn_blocks_shrink(vnode_t* vn, uint32_t start) {
                 continue;
             }
             unsigned bno = kMinfsDirect + indirect * direct_per_indirect + direct;
-            if (start > bno) {
+            if ((start > bno) || (bno >= end)) {
                 // This is a valid entry which exists in the indirect block
-                // BEFORE our truncation point. Don't delete it, and don't
-                // delete the indirect block.
+                // BEFORE our truncation point (or is part of a directory
+                // index). Don't delete it, and don't delete the indirect block.
                 delete_indirect = false;
                 continue;
             }
@@ -176,87 +179,153 @@ static mx_status_t vn_blocks_shrink(vnode_t* vn, uint32_t start) {
     return NO_ERROR;
 }
 
+static mx_status_t vn_get_bno(vnode_t* vn, uint32_t n, uint32_t* bno, bool alloc);
+
 #ifdef __Fuchsia__
-// Read data from disk at block 'bno', into the 'nth' logical block of the file.
-static mx_status_t vn_fill_block(vnode_t* vn, uint32_t n, uint32_t bno) {
-    // TODO(smklein): read directly from block device into vmo; no need to copy
-    // into an intermediate buffer.
-    char bdata[kMinfsBlockSize];
-    if (vn->fs->bc->Readblk(bno, bdata)) {
-        return ERR_IO;
+// Blocks at or past vmo_blocks were not on disk when the VMO was created,
+// so they only ever come into being in the VMO.
+static bool vn_block_loaded(vnode_t* vn, uint32_t n) {
+    return (n >= vn->vmo_blocks) || (vn->vmo_loaded[n / 64] & (1ULL << (n % 64)));
+}
+
+static void vn_mark_loaded(vnode_t* vn, uint32_t n) {
+    if (n < vn->vmo_blocks) {
+        vn->vmo_loaded[n / 64] |= (1ULL << (n % 64));
     }
-    mx_status_t status = vmo_write_exact(vn->vmo, bdata, n * kMinfsBlockSize, kMinfsBlockSize);
-    if (status != NO_ERROR) {
-        return status;
+}
+
+// Sends the queued transfers, falling back to one block at a time through
+// an intermediate buffer if the block device cannot take them.
+// Blocks that were read into the VMO are marked loaded.
+static mx_status_t vn_txn_flush(vnode_t* vn, block_txn_batch_t* batch) {
+    if (batch->count == 0) {
+        return NO_ERROR;
+    }
+    uint32_t done = 0;
+    mx_status_t status = vn->fs->bc->VmoTxns(vn->vmo, batch);
+    if (status == NO_ERROR) {
+        done = batch->count;
+    } else if (status == ERR_NOT_SUPPORTED) {
+        status = NO_ERROR;
+        for (; (done < batch->count) && (status == NO_ERROR); done++) {
+            block_txn_t* txn = &batch->txns[done];
+            uint32_t bno = static_cast<uint32_t>(txn->dev_offset / kMinfsBlockSize);
+            char bdata[kMinfsBlockSize];
+            if (txn->opcode == BLOCK_TXN_OP_READ) {
+                if (vn->fs->bc->Readblk(bno, bdata)) {
+                    status = ERR_IO;
+                } else {
+                    status = vmo_write_exact(vn->vmo, bdata, txn->vmo_offset, kMinfsBlockSize);
+                }
+            } else {
+                status = vmo_read_exact(vn->vmo, bdata, txn->vmo_offset, kMinfsBlockSize);
+                if ((status == NO_ERROR) && vn->fs->bc->Writeblk(bno, bdata)) {
+                    status = ERR_IO;
+                }
+            }
+        }
+        if (status != NO_ERROR) {
+            done--;
+        }
+    }
+    for (uint32_t i = 0; i < done; i++) {
+        if (batch->txns[i].opcode == BLOCK_TXN_OP_READ) {
+            vn_mark_loaded(vn, static_cast<uint32_t>(batch->txns[i].vmo_offset / kMinfsBlockSize));
+        }
+    }
+    batch->count = 0;
+    return status;
+}
+
+// Queues a transfer of the nth logical block of the file between its VMO and
+// disk block 'bno'.  Consecutive blocks of a file that are also consecutive on
+// disk are merged by the block device into a single I/O.
+static mx_status_t vn_txn_queue(vnode_t* vn, block_txn_batch_t* batch, uint16_t opcode,
+                                uint32_t n, uint32_t bno) {
+    block_txn_t* txn = &batch->txns[batch->count++];
+    txn->opcode = opcode;
+    txn->reserved = 0;
+    txn->vmo_offset = static_cast<uint64_t>(n) * kMinfsBlockSize;
+    txn->dev_offset = static_cast<uint64_t>(bno) * kMinfsBlockSize;
+    txn->length = kMinfsBlockSize;
+    if (batch->count == BLOCK_TXN_MAX) {
+        return vn_txn_flush(vn, batch);
     }
     return NO_ERROR;
 }
 
 // Since we cannot yet register the filesystem as a paging service (and cleanly
-// fault on pages when they are actually needed), we currently read an entire
-// file to a VMO when a file's data block are accessed.
-//
-// TODO(smklein): Even this hack can be optimized; a bitmap could be used to
-// track all 'empty/read/dirty' blocks for each vnode, rather than reading
-// the entire file.
+// fault on pages when they are actually needed), a file's data is read into a
+// VMO as it is accessed.  vn_load_blocks() must cover any block before the
+// VMO's copy of it is used.
 static mx_status_t vn_init_vmo(vnode_t* vn) {
     if (vn->vmo != MX_HANDLE_INVALID) {
         return NO_ERROR;
     }
 
     mx_status_t status;
+    uint32_t blocks = static_cast<uint32_t>(ROUNDUP(vn->inode.size, kMinfsBlockSize) / kMinfsBlockSize);
+    if ((vn->vmo_loaded = static_cast<uint64_t*>(calloc((blocks + 63) / 64, sizeof(uint64_t)))) == nullptr) {
+        return ERR_NO_MEMORY;
+    }
     if ((status = mx_vmo_create(ROUNDUP(vn->inode.size, kMinfsBlockSize), 0, &vn->vmo)) != NO_ERROR) {
         error("Failed to initialize vmo; error: %d\n", status);
+        free(vn->vmo_loaded);
+        vn->vmo_loaded = nullptr;
         return status;
     }
+    vn->vmo_blocks = blocks;
+    return NO_ERROR;
+}
 
-    // Initialize all direct blocks
-    uint32_t bno;
-    for (uint32_t d = 0; d < kMinfsDirect; d++) {
-        if ((bno = vn->inode.dnum[d]) != 0) {
-            if ((status = vn_fill_block(vn, d, bno)) != NO_ERROR) {
-                error("Failed to fill bno %u; error: %d\n", bno, status);
-                return status;
-            }
-        }
+// Reads blocks [start, end) of the file into its VMO, skipping the ones which
+// are already there.  The reads go to the device together.
+static mx_status_t vn_load_blocks(vnode_t* vn, uint32_t start, uint32_t end) {
+    if (end > vn->vmo_blocks) {
+        end = vn->vmo_blocks;
     }
-
-    // Initialize all indirect blocks
-    for (uint32_t i = 0; i < kMinfsIndirect; i++) {
-        uint32_t ibno;
-        mxtl::RefPtr<BlockNode> iblk;
-        if ((ibno = vn->inode.inum[i]) != 0) {
-            // TODO(smklein): Should there be a separate vmo for indirect blocks?
-            if ((iblk = vn->fs->bc->Get(ibno)) == nullptr) {
-                return ERR_IO;
-            }
-            uint32_t* ientry = static_cast<uint32_t*>(iblk->data());
-
-            const uint32_t direct_per_indirect = kMinfsBlockSize / sizeof(uint32_t);
-            for (uint32_t j = 0; j < direct_per_indirect; j++) {
-                if ((bno = ientry[j]) != 0) {
-                    uint32_t n = kMinfsDirect + i * direct_per_indirect + j;
-                    if ((status = vn_fill_block(vn, n, bno)) != NO_ERROR) {
-                        vn->fs->bc->Put(iblk, 0);
-                        return status;
-                    }
-                }
-            }
-            vn->fs->bc->Put(iblk, 0);
+    block_txn_batch_t batch;
+    batch.count = 0;
+    mx_status_t status;
+    for (uint32_t n = start; n < end; n++) {
+        if (vn_block_loaded(vn, n)) {
+            continue;
+        }
+        uint32_t bno;
+        if ((status = vn_get_bno(vn, n, &bno, false)) != NO_ERROR) {
+            vn_txn_flush(vn, &batch);
+            return status;
+        }
+        if (bno == 0) {
+            // holes read as the zeros the VMO started out with
+            vn_mark_loaded(vn, n);
+        } else if ((status = vn_txn_queue(vn, &batch, BLOCK_TXN_OP_READ, n, bno)) != NO_ERROR) {
+            error("Failed to fill bno %u; error: %d\n", bno, status);
+            return status;
         }
     }
-
-    return NO_ERROR;
+    return vn_txn_flush(vn, &batch);
 }
 #endif
 
+// New blocks go right after the previous block of the file where they can,
+// so files written sequentially end up contiguous on disk, and reading or
+// writing a run of their blocks turns into a single large I/O.
+static uint32_t vn_alloc_hint(vnode_t* vn, uint32_t n) {
+    uint32_t prev;
+    if ((n > 0) && (vn_get_bno(vn, n - 1, &prev, false) == NO_ERROR) && (prev != 0)) {
+        return prev + 1;
+    }
+    return 0;
+}
+
 // Get the bno corresponding to the nth logical block within the file.
 static mx_status_t vn_get_bno(vnode_t* vn, uint32_t n, uint32_t* bno, bool alloc) {
-    uint32_t hint = 0;
     // direct blocks are simple... is there an entry in dnum[]?
     if (n < kMinfsDirect) {
         if (((*bno = vn->inode.dnum[n]) == 0) && alloc) {
-            mx_status_t status = vn->fs->BlockNew(hint, bno, nullptr);
+            mx_status_t status = vn->fs->BlockNew(vn_alloc_hint(vn, n), vn->alloc_run,
+                                                  bno, nullptr);
             if (status != NO_ERROR) {
                 return status;
             }
@@ -290,7 +359,7 @@ static mx_status_t vn_get_bno(vnode_t* vn, uint32_t n, uint32_t* bno, bool alloc
             return NO_ERROR;
         }
         // allocate a new indirect block
-        mx_status_t status = vn->fs->BlockNew(0, &ibno, &iblk);
+        mx_status_t status = vn->fs->BlockNew(0, 1, &ibno, &iblk);
         if (status != NO_ERROR) {
             return ERR_NO_RESOURCES;
         }
@@ -307,7 +376,14 @@ static mx_status_t vn_get_bno(vnode_t* vn, uint32_t n, uint32_t* bno, bool alloc
 
     if (((*bno = ientry[j]) == 0) && alloc) {
         // allocate a new block
-        if (vn->fs->BlockNew(hint, bno, nullptr) != NO_ERROR) {
+        // the previous block is usually in this same (busy) indirect block
+        uint32_t hint;
+        if (j > 0) {
+            hint = (ientry[j - 1] != 0) ? ientry[j - 1] + 1 : 0;
+        } else {
+            hint = vn_alloc_hint(vn, n + kMinfsDirect);
+        }
+        if (vn->fs->BlockNew(hint, vn->alloc_run, bno, nullptr) != NO_ERROR) {
             vn->fs->bc->Put(iblk, iflags);
             return ERR_NO_RESOURCES;
         }
@@ -397,6 +473,276 @@ static mx_status_t do_next_dirent(minfs_dirent_t* de, de_off_t* offs) {
     return DIR_CB_NEXT;
 }
 
+// Acquires block 'n' of the directory index (0 being the header), allocating
+// it if it does not exist and 'alloc' is set.
+static mx_status_t dix_block_get(vnode_t* vn, uint32_t n, bool alloc,
+                                 mxtl::RefPtr<BlockNode>* out) {
+    uint32_t bno;
+    mx_status_t status;
+    if ((status = vn_get_bno(vn, kMinfsDirIndexBlock + n, &bno, false)) != NO_ERROR) {
+        return status;
+    }
+    if (bno != 0) {
+        *out = vn->fs->bc->Get(bno);
+    } else if (!alloc) {
+        return ERR_NOT_FOUND;
+    } else if ((status = vn_get_bno(vn, kMinfsDirIndexBlock + n, &bno, true)) != NO_ERROR) {
+        return status;
+    } else {
+        *out = vn->fs->bc->GetZero(bno);
+    }
+    return (*out == nullptr) ? ERR_IO : NO_ERROR;
+}
+
+// Reads the index header of 'vn', which must be current as of 'seq_num'.
+static mx_status_t dix_read_header(vnode_t* vn, minfs_dir_index_t* hdr, uint32_t seq_num) {
+    mxtl::RefPtr<BlockNode> blk;
+    mx_status_t status;
+    if ((status = dix_block_get(vn, 0, false, &blk)) != NO_ERROR) {
+        return status;
+    }
+    memcpy(hdr, blk->data(), sizeof(*hdr));
+    vn->fs->bc->Put(mxtl::move(blk), 0);
+    if ((hdr->magic != kMinfsDirIndexMagic) || (hdr->seq_num != seq_num) ||
+        (hdr->slots < kMinfsDirSlotsPerBlock) || (hdr->slots > kMinfsDirIndexMaxSlots) ||
+        (hdr->slots & (hdr->slots - 1))) {
+        return ERR_BAD_STATE;
+    }
+    return NO_ERROR;
+}
+
+static mx_status_t dix_write_header(vnode_t* vn, const minfs_dir_index_t* hdr) {
+    mxtl::RefPtr<BlockNode> blk;
+    mx_status_t status;
+    if ((status = dix_block_get(vn, 0, true, &blk)) != NO_ERROR) {
+        return status;
+    }
+    memcpy(blk->data(), hdr, sizeof(*hdr));
+    vn->fs->bc->Put(mxtl::move(blk), kBlockDirty);
+    return NO_ERROR;
+}
+
+// Makes sure a damaged index is not used again before it is rebuilt.
+static void dix_invalidate(vnode_t* vn) {
+    minfs_dir_index_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if (dix_write_header(vn, &hdr) != NO_ERROR) {
+        error("minfs: ino#%u: cannot invalidate directory index\n", vn->ino);
+    }
+}
+
+// Walks the probe sequence of 'hash' starting at *pos, stopping at the next
+// slot for a dirent with that hash (NO_ERROR, with its offset in *off), or
+// at the end of the sequence (ERR_NOT_FOUND).  *pos is left past the slot,
+// so the walk can be resumed if the dirent turns out to have another name.
+static mx_status_t dix_probe(vnode_t* vn, const minfs_dir_index_t* hdr, uint32_t hash,
+                             uint32_t* pos, size_t* off) {
+    mxtl::RefPtr<BlockNode> blk;
+    uint32_t blk_n = 0;
+    mx_status_t status = ERR_NOT_FOUND;
+    while (*pos - hash < hdr->slots) {
+        uint32_t s = *pos & (hdr->slots - 1);
+        uint32_t n = 1 + s / kMinfsDirSlotsPerBlock;
+        if (n != blk_n) {
+            if (blk != nullptr) {
+                vn->fs->bc->Put(mxtl::move(blk), 0);
+            }
+            if ((status = dix_block_get(vn, n, false, &blk)) != NO_ERROR) {
+                return status;
+            }
+            blk_n = n;
+        }
+        minfs_dir_slot_t* slot = static_cast<minfs_dir_slot_t*>(blk->data()) +
+                                 (s % kMinfsDirSlotsPerBlock);
+        if (slot->loc == 0) {
+            status = ERR_NOT_FOUND;
+            break;
+        }
+        (*pos)++;
+        if ((slot->loc & kMinfsDirSlotLive) && (slot->hash == hash)) {
+            *off = slot->loc & ~kMinfsDirSlotLive;
+            status = NO_ERROR;
+            break;
+        }
+    }
+    if (blk != nullptr) {
+        vn->fs->bc->Put(mxtl::move(blk), 0);
+    }
+    return status;
+}
+
+// Replaces the slot holding 'loc' in the probe sequence of 'hash' (or, if
+// 'loc' is 0, the first slot which is free) with 'newloc'.
+static mx_status_t dix_replace(vnode_t* vn, minfs_dir_index_t* hdr, uint32_t hash,
+                               uint32_t loc, uint32_t newloc) {
+    for (uint32_t i = 0; i < hdr->slots; i++) {
+        uint32_t s = (hash + i) & (hdr->slots - 1);
+        mxtl::RefPtr<BlockNode> blk;
+        mx_status_t status;
+        if ((status = dix_block_get(vn, 1 + s / kMinfsDirSlotsPerBlock, false, &blk)) != NO_ERROR) {
+            return status;
+        }
+        minfs_dir_slot_t* slot = static_cast<minfs_dir_slot_t*>(blk->data()) +
+                                 (s % kMinfsDirSlotsPerBlock);
+        bool match = loc ? ((slot->loc == loc) && (slot->hash == hash)) :
+                           ((slot->loc == 0) || (slot->loc == kMinfsDirSlotDeleted));
+        if (match) {
+            if (slot->loc & kMinfsDirSlotLive) {
+                hdr->used--;
+            } else if (slot->loc == kMinfsDirSlotDeleted) {
+                hdr->deleted--;
+            }
+            if (newloc & kMinfsDirSlotLive) {
+                hdr->used++;
+            } else if (newloc == kMinfsDirSlotDeleted) {
+                hdr->deleted++;
+            }
+            slot->hash = hash;
+            slot->loc = newloc;
+            vn->fs->bc->Put(mxtl::move(blk), kBlockDirty);
+            return NO_ERROR;
+        }
+        bool end = (slot->loc == 0);
+        vn->fs->bc->Put(mxtl::move(blk), 0);
+        if (end) {
+            break;
+        }
+    }
+    return ERR_NOT_FOUND;
+}
+
+// Builds the index of 'vn' from its dirents, with room for 'entries'
+// entries before it needs to grow.
+static mx_status_t dix_build(vnode_t* vn, uint32_t entries, minfs_dir_index_t* hdr) {
+    trace(MINFS, "dix_build() vn=%p(#%u) entries=%u\n", vn, vn->ino, entries);
+    mx_status_t status;
+    memset(hdr, 0, sizeof(*hdr));
+    if ((status = dix_write_header(vn, hdr)) != NO_ERROR) {
+        return status;
+    }
+    hdr->slots = kMinfsDirSlotsPerBlock;
+    while ((hdr->slots < 4 * entries) && (hdr->slots < kMinfsDirIndexMaxSlots)) {
+        hdr->slots *= 2;
+    }
+    for (uint32_t n = 1; n <= hdr->slots / kMinfsDirSlotsPerBlock; n++) {
+        mxtl::RefPtr<BlockNode> blk;
+        if ((status = dix_block_get(vn, n, true, &blk)) != NO_ERROR) {
+            return status;
+        }
+        memset(blk->data(), 0, kMinfsBlockSize);
+        vn->fs->bc->Put(mxtl::move(blk), kBlockDirty);
+    }
+
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    size_t off = 0;
+    while (true) {
+        size_t r;
+        if ((status = _fs_read(vn, data, kMinfsMaxDirentSize, off, &r)) != NO_ERROR) {
+            return status;
+        } else if ((status = validate_dirent(de, r, off)) != NO_ERROR) {
+            return status;
+        }
+        if (de->ino != 0) {
+            uint32_t loc = static_cast<uint32_t>(off) | kMinfsDirSlotLive;
+            if ((status = dix_replace(vn, hdr, fnv1a32(de->name, de->namelen), 0, loc)) != NO_ERROR) {
+                return status;
+            }
+        } else if (!(de->reclen & kMinfsReclenLast) && (hdr->hole == 0)) {
+            hdr->hole = static_cast<uint32_t>(off);
+        }
+        if (de->reclen & kMinfsReclenLast) {
+            break;
+        }
+        off += MinfsReclen(de, off);
+    }
+    hdr->tail = static_cast<uint32_t>(off);
+    hdr->magic = kMinfsDirIndexMagic;
+    hdr->seq_num = vn->inode.seq_num;
+    return dix_write_header(vn, hdr);
+}
+
+// Reads the index header of 'vn' if the index is current, first building
+// it if the directory is large enough to be indexed.
+static mx_status_t dix_open(vnode_t* vn, minfs_dir_index_t* hdr) {
+    mx_status_t status = dix_read_header(vn, hdr, vn->inode.seq_num);
+    if ((status == NO_ERROR) || (vn->inode.size < kMinfsDirIndexMinSize)) {
+        return status;
+    } else if ((status != ERR_NOT_FOUND) && (status != ERR_BAD_STATE)) {
+        return status;
+    }
+    if ((status = dix_build(vn, vn->inode.dirent_count, hdr)) != NO_ERROR) {
+        error("minfs: ino#%u: cannot build directory index: %d\n", vn->ino, status);
+        dix_invalidate(vn);
+    }
+    return status;
+}
+
+// Records the dirent 'de' just written at 'off' in the index of 'vn', if
+// it has a current one.
+static void dix_add(vnode_t* vn, const minfs_dirent_t* de, size_t off) {
+    minfs_dir_index_t hdr;
+    if (dix_read_header(vn, &hdr, vn->inode.seq_num) != NO_ERROR) {
+        return;
+    }
+    mx_status_t status;
+    if (2 * (hdr.used + hdr.deleted + 1) > hdr.slots) {
+        // the dirents already include this one
+        status = dix_build(vn, hdr.used + 1, &hdr);
+    } else {
+        uint32_t loc = static_cast<uint32_t>(off) | kMinfsDirSlotLive;
+        if ((status = dix_replace(vn, &hdr, fnv1a32(de->name, de->namelen), 0, loc)) == NO_ERROR) {
+            if (hdr.hole == off) {
+                hdr.hole = 0;
+            }
+            if (de->reclen & kMinfsReclenLast) {
+                hdr.tail = static_cast<uint32_t>(off);
+            }
+            status = dix_write_header(vn, &hdr);
+        }
+    }
+    if (status != NO_ERROR) {
+        dix_invalidate(vn);
+    }
+}
+
+// Drops the dirent 'de' at 'off' from the index of 'vn', if it has a current
+// one.  Its space now belongs to the free dirent 'de' at 'newoff'.
+static void dix_remove(vnode_t* vn, const minfs_dirent_t* de, size_t off, size_t newoff) {
+    minfs_dir_index_t hdr;
+    if (dix_read_header(vn, &hdr, vn->inode.seq_num) != NO_ERROR) {
+        return;
+    }
+    uint32_t loc = static_cast<uint32_t>(off) | kMinfsDirSlotLive;
+    if (dix_replace(vn, &hdr, fnv1a32(de->name, de->namelen), loc, kMinfsDirSlotDeleted) != NO_ERROR) {
+        dix_invalidate(vn);
+        return;
+    }
+    if (de->reclen & kMinfsReclenLast) {
+        hdr.tail = static_cast<uint32_t>(newoff);
+        if (hdr.hole >= newoff) {
+            hdr.hole = 0;
+        }
+    } else {
+        hdr.hole = static_cast<uint32_t>(newoff);
+    }
+    if (dix_write_header(vn, &hdr) != NO_ERROR) {
+        dix_invalidate(vn);
+    }
+}
+
+// Brings a current index of 'vn' up to the directory's new seq_num.
+static void dix_sync(vnode_t* vn) {
+    minfs_dir_index_t hdr;
+    if (dix_read_header(vn, &hdr, vn->inode.seq_num - 1) != NO_ERROR) {
+        return;
+    }
+    hdr.seq_num = vn->inode.seq_num;
+    if (dix_write_header(vn, &hdr) != NO_ERROR) {
+        dix_invalidate(vn);
+    }
+}
+
 static mx_status_t cb_dir_find(vnode_t* vndir, minfs_dirent_t* de, dir_args_t* args,
                                de_off_t* offs) {
     if ((de->ino != 0) && (de->namelen == args->len) &&
@@ -481,6 +827,7 @@ static mx_status_t do_unlink(vnode_t* vndir, vnode_t* vn, minfs_dirent_t* de,
     if (status != NO_ERROR) {
         return status;
     }
+    dix_remove(vndir, de, offs->off, off);
 
     if (de->reclen & kMinfsReclenLast) {
         // Truncating the directory merely removed unused space; if it fails,
@@ -611,6 +958,7 @@ static mx_status_t fill_dirent(vnode_t* vndir, minfs_dirent_t* de,
     if (status != NO_ERROR) {
         return status;
     }
+    dix_add(vndir, de, off);
     return DIR_CB_SAVE_SYNC;
 }
 
@@ -663,6 +1011,12 @@ static mx_status_t cb_dir_append(vnode_t* vndir, minfs_dirent_t* de,
 //  'offs': Offset info about where in the directory this direntry is located.
 //          Since 'func' may create / remove surrounding dirents, it is responsible for
 //          updating the offset information to access the next dirent.
+static void vn_dir_save(vnode_t* vn) {
+    vn->inode.seq_num++;
+    minfs_sync_vnode(vn, kMxFsSyncMtime);
+    dix_sync(vn);
+}
+
 static mx_status_t vn_dir_for_each(vnode_t* vn, dir_args_t* args,
                                    mx_status_t (*func)(vnode_t*, minfs_dirent_t*,
                                                        dir_args_t*, de_off_t* offs)) {
@@ -686,8 +1040,7 @@ static mx_status_t vn_dir_for_each(vnode_t* vn, dir_args_t* args,
         case DIR_CB_NEXT:
             break;
         case DIR_CB_SAVE_SYNC:
-            vn->inode.seq_num++;
-            minfs_sync_vnode(vn, kMxFsSyncMtime);
+            vn_dir_save(vn);
             return NO_ERROR;
         case DIR_CB_DONE:
         default:
@@ -697,6 +1050,72 @@ static mx_status_t vn_dir_for_each(vnode_t* vn, dir_args_t* args,
     return ERR_NOT_FOUND;
 }
 
+// Calls 'func' on the single dirent at 'off'.  Unlike vn_dir_for_each,
+// DIR_CB_NEXT is passed back to the caller.  The previous dirent is not
+// known, so an unlink leaves the freed space to itself.
+static mx_status_t vn_dir_at(vnode_t* vn, dir_args_t* args, size_t off,
+                             mx_status_t (*func)(vnode_t*, minfs_dirent_t*,
+                                                 dir_args_t*, de_off_t* offs)) {
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    de_off_t offs = {
+        .off = off,
+        .off_prev = off,
+    };
+    size_t r;
+    mx_status_t status = _fs_read(vn, data, kMinfsMaxDirentSize, off, &r);
+    if (status != NO_ERROR) {
+        return status;
+    } else if ((status = validate_dirent(de, r, off)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = func(vn, de, args, &offs)) == DIR_CB_SAVE_SYNC) {
+        vn_dir_save(vn);
+        return NO_ERROR;
+    }
+    return status;
+}
+
+// Like vn_dir_for_each, for callbacks which act on the dirent named by
+// args->name.  If the directory is indexed, only the dirents whose names
+// hash the same are visited.
+static mx_status_t vn_dir_lookup(vnode_t* vn, dir_args_t* args,
+                                 mx_status_t (*func)(vnode_t*, minfs_dirent_t*,
+                                                     dir_args_t*, de_off_t* offs)) {
+    minfs_dir_index_t hdr;
+    if (dix_open(vn, &hdr) != NO_ERROR) {
+        return vn_dir_for_each(vn, args, func);
+    }
+    uint32_t hash = fnv1a32(args->name, args->len);
+    uint32_t pos = hash;
+    size_t off = 0;
+    mx_status_t status;
+    while ((status = dix_probe(vn, &hdr, hash, &pos, &off)) == NO_ERROR) {
+        if ((status = vn_dir_at(vn, args, off, func)) != DIR_CB_NEXT) {
+            return status;
+        }
+    }
+    return status;
+}
+
+// Adds the dirent described by 'args' to the directory.  If the directory
+// is indexed, the most recently freed dirent and the end of the directory
+// are tried before falling back to a scan for free space.
+static mx_status_t vn_dir_append(vnode_t* vn, dir_args_t* args) {
+    minfs_dir_index_t hdr;
+    if (dix_open(vn, &hdr) == NO_ERROR) {
+        mx_status_t status;
+        if ((hdr.hole != 0) &&
+            ((status = vn_dir_at(vn, args, hdr.hole, cb_dir_append)) != DIR_CB_NEXT)) {
+            return status;
+        }
+        if ((status = vn_dir_at(vn, args, hdr.tail, cb_dir_append)) != DIR_CB_NEXT) {
+            return status;
+        }
+    }
+    return vn_dir_for_each(vn, args, cb_dir_append);
+}
+
 static void fs_release(vnode_t* vn) {
     trace(MINFS, "minfs_release() vn=%p(#%u)%s\n", vn, vn->ino,
           vn->inode.link_count ? "" : " link-count is zero");
@@ -706,6 +1125,7 @@ static void fs_release(vnode_t* vn) {
     list_delete(&vn->hashnode);
 #ifdef __Fuchsia__
     mx_handle_close(vn->vmo);
+    free(vn->vmo_loaded);
 #endif
     free(vn);
 }
@@ -752,7 +1172,31 @@ static mx_status_t _fs_read(vnode_t* vn, void* data, size_t len, size_t off, siz
 
     mx_status_t status;
 #ifdef __Fuchsia__
+    mtx_lock(&vn->fs->vmo_lock);
     if ((status = vn_init_vmo(vn)) != NO_ERROR) {
+        mtx_unlock(&vn->fs->vmo_lock);
+        return status;
+    }
+
+    // A read picking up where the last one left off is taken to be part
+    // of a stream, and the blocks it will want next are fetched along with
+    // this request's.  Any other read closes the window again.
+    if (off == vn->ra_offset) {
+        if (vn->ra_window == 0) {
+            vn->ra_window = kMinfsReadAheadMin;
+        } else if (vn->ra_window < kMinfsReadAheadMax) {
+            vn->ra_window *= 2;
+        }
+    } else {
+        vn->ra_window = 0;
+    }
+    vn->ra_offset = static_cast<uint32_t>(off + len);
+
+    uint32_t start = static_cast<uint32_t>(off / kMinfsBlockSize);
+    uint32_t end = static_cast<uint32_t>(ROUNDUP(off + len, kMinfsBlockSize) / kMinfsBlockSize);
+    status = vn_load_blocks(vn, start, end + vn->ra_window);
+    mtx_unlock(&vn->fs->vmo_lock);
+    if (status != NO_ERROR) {
         return status;
     } else if ((status = mx_vmo_read(vn->vmo, data, off, len, actual)) != NO_ERROR) {
         return status;
@@ -820,10 +1264,14 @@ static mx_status_t _fs_write(vnode_t* vn, const void* data, size_t len, size_t o
     if ((status = vn_init_vmo(vn)) != NO_ERROR) {
         return status;
     }
+    // blocks go from the VMO to the disk together, once they are all updated
+    block_txn_batch_t batch;
+    batch.count = 0;
 #endif
     const void* const start = data;
     uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
     size_t adjust = off % kMinfsBlockSize;
+    const uint64_t last = (off + len - 1) / kMinfsBlockSize;
 
     while ((len > 0) && (n < kMinfsMaxFileBlock)) {
         size_t xfer;
@@ -849,32 +1297,40 @@ static mx_status_t _fs_write(vnode_t* vn, const void* data, size_t len, size_t o
         // the file. As a consequence, an error is returned (ERR_IO) rather than
         // doing a partial read.
 
-        // Update this block of the in-memory VMO
+        // Update this block of the in-memory VMO, which has to hold the
+        // rest of a partially written block first
+        if (xfer != kMinfsBlockSize) {
+            if (vn_load_blocks(vn, n, n + 1) != NO_ERROR) {
+                vn_txn_flush(vn, &batch);
+                return ERR_IO;
+            }
+        } else {
+            vn_mark_loaded(vn, n);
+        }
         if ((status = vmo_write_exact(vn->vmo, data, xfer_off, xfer)) != NO_ERROR) {
+            vn_txn_flush(vn, &batch);
             return ERR_IO;
         }
 
         // Update this block on-disk
-        char bdata[kMinfsBlockSize];
-        // TODO(smklein): Can we write directly from the VMO to the block device,
-        // preventing the need for a 'bdata' variable?
-        if (xfer != kMinfsBlockSize) {
-            if (vmo_read_exact(vn->vmo, bdata, n * kMinfsBlockSize, kMinfsBlockSize) != NO_ERROR) {
-                return ERR_IO;
-            }
-        }
-        const void* wdata = (xfer != kMinfsBlockSize) ? bdata : data;
         uint32_t bno;
-        if (vn_get_bno(vn, n, &bno, true) != NO_ERROR) {
+        vn->alloc_run = static_cast<uint32_t>(last - n + 1);
+        status = vn_get_bno(vn, n, &bno, true);
+        vn->alloc_run = 0;
+        if (status != NO_ERROR) {
+            vn_txn_flush(vn, &batch);
             return ERR_IO;
         }
         assert(bno != 0);
-        if (vn->fs->bc->Writeblk(bno, wdata)) {
+        if (vn_txn_queue(vn, &batch, BLOCK_TXN_OP_WRITE, n, bno) != NO_ERROR) {
             return ERR_IO;
         }
 #else
         uint32_t bno;
-        if ((status = vn_get_bno(vn, n, &bno, true)) != NO_ERROR) {
+        vn->alloc_run = static_cast<uint32_t>(last - n + 1);
+        status = vn_get_bno(vn, n, &bno, true);
+        vn->alloc_run = 0;
+        if (status != NO_ERROR) {
             goto done;
         }
         assert(bno != 0);
@@ -895,6 +1351,11 @@ static mx_status_t _fs_write(vnode_t* vn, const void* data, size_t len, size_t o
     }
 
 done:
+#ifdef __Fuchsia__
+    if (vn_txn_flush(vn, &batch) != NO_ERROR) {
+        return ERR_IO;
+    }
+#endif
     len = (uintptr_t)data - (uintptr_t)start;
     if (len == 0) {
         // If more than zero bytes were requested, but zero bytes were written,
@@ -920,7 +1381,7 @@ static mx_status_t fs_lookup(vnode_t* vn, vnode_t** out, const char* name, size_
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = vn_dir_for_each(vn, &args, cb_dir_find)) < 0) {
+    if ((status = vn_dir_lookup(vn, &args, cb_dir_find)) < 0) {
         return status;
     }
     if ((status = vn->fs->VnodeGet(&vn, args.ino)) < 0) {
@@ -970,7 +1431,28 @@ typedef struct dircookie {
     uint32_t seqno;  // inode seq no
 } dircookie_t;
 
-static mx_status_t fs_readdir(vnode_t* vn, void* cookie, void* dirents, size_t len) {
+// Fill in one record, with the attributes of the entry's inode if plus.
+static mx_status_t fs_fill_dirent(vnode_t* vn, void* out, size_t len,
+                                  minfs_dirent_t* de, bool plus) {
+    if (!plus) {
+        return vfs_fill_dirent(reinterpret_cast<vdirent_t*>(out), len, de->name,
+                               de->namelen, de->type);
+    }
+    vnattr_t attr = {};
+    vnode_t* child;
+    if (vn->fs->VnodeGet(&child, de->ino) == NO_ERROR) {
+        fs_getattr(child, &attr);
+        vn_release(child);
+    } else {
+        attr.inode = de->ino;
+        attr.mode = DTYPE_TO_VTYPE(de->type);
+    }
+    return vfs_fill_dirent_plus(reinterpret_cast<vdirent_plus_t*>(out), len, de->name,
+                                de->namelen, &attr);
+}
+
+static mx_status_t fs_readdir_common(vnode_t* vn, void* cookie, void* dirents, size_t len,
+                                     bool plus) {
     trace(MINFS, "minfs_readdir() vn=%p(#%u) cookie=%p len=%zd\n", vn, vn->ino, cookie, len);
     dircookie_t* dc = reinterpret_cast<dircookie_t*>(cookie);
     vdirent_t* out = reinterpret_cast<vdirent_t*>(dirents);
@@ -1008,8 +1490,7 @@ static mx_status_t fs_readdir(vnode_t* vn, void* cookie, void* dirents, size_t l
         if (de->ino) {
             mx_status_t status;
             size_t len_remaining = len - (size_t)((uintptr_t)out - (uintptr_t)dirents);
-            if ((status = vfs_fill_dirent(out, len_remaining, de->name,
-                                          de->namelen, de->type)) < 0) {
+            if ((status = fs_fill_dirent(vn, out, len_remaining, de, plus)) < 0) {
                 // no more space
                 goto done;
             }
@@ -1035,6 +1516,14 @@ fail:
     return ERR_IO;
 }
 
+static mx_status_t fs_readdir(vnode_t* vn, void* cookie, void* dirents, size_t len) {
+    return fs_readdir_common(vn, cookie, dirents, len, false);
+}
+
+static mx_status_t fs_readdir_plus(vnode_t* vn, void* cookie, void* dirents, size_t len) {
+    return fs_readdir_common(vn, cookie, dirents, len, true);
+}
+
 static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
                              const char* name, size_t len, uint32_t mode) {
     trace(MINFS, "minfs_create() vn=%p(#%u) name='%.*s' mode=%#x\n",
@@ -1050,7 +1539,7 @@ static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
     args.len = len;
     // ensure file does not exist
     mx_status_t status;
-    if ((status = vn_dir_for_each(vndir, &args, cb_dir_find)) != ERR_NOT_FOUND) {
+    if ((status = vn_dir_lookup(vndir, &args, cb_dir_find)) != ERR_NOT_FOUND) {
         return ERR_ALREADY_EXISTS;
     }
 
@@ -1067,7 +1556,7 @@ static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
     args.ino = vn->ino;
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
-    if ((status = vn_dir_for_each(vndir, &args, cb_dir_append)) < 0) {
+    if ((status = vn_dir_append(vndir, &args)) < 0) {
         fs_release(vndir);
         return status;
     }
@@ -1083,6 +1572,7 @@ static mx_status_t fs_create(vnode_t* vndir, vnode_t** out,
         vn->inode.dirent_count = 2;
         minfs_sync_vnode(vn, kMxFsSyncDefault);
     }
+    vfs_dcache_forget(vndir, name, len);
     *out = vn;
     return NO_ERROR;
 }
@@ -1118,7 +1608,9 @@ static mx_status_t fs_unlink(vnode_t* vn, const char* name, size_t len, bool mus
     args.name = name;
     args.len = len;
     args.type = must_be_dir ? kMinfsTypeDir : 0;
-    return vn_dir_for_each(vn, &args, cb_dir_unlink);
+    // the cache's own reference would make a directory look open
+    vfs_dcache_forget(vn, name, len);
+    return vn_dir_lookup(vn, &args, cb_dir_unlink);
 }
 
 static mx_status_t fs_truncate(vnode_t* vn, size_t len) {
@@ -1166,6 +1658,10 @@ static mx_status_t _fs_truncate(vnode_t* vn, size_t len) {
             if (bno != 0) {
                 size_t adjust = len % kMinfsBlockSize;
 #ifdef __Fuchsia__
+                if ((r = vn_load_blocks(vn, static_cast<uint32_t>(len / kMinfsBlockSize),
+                                        static_cast<uint32_t>(len / kMinfsBlockSize) + 1)) != NO_ERROR) {
+                    return ERR_IO;
+                }
                 if ((r = vmo_read_exact(vn->vmo, bdata, len - adjust, adjust)) != NO_ERROR) {
                     return ERR_IO;
                 }
@@ -1256,13 +1752,17 @@ static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
     if ((newlen == 2) && (newname[0] == '.') && (newname[1] == '.'))
         return ERR_BAD_STATE;
 
+    // as for unlink, and before anything is looked up
+    vfs_dcache_forget(olddir, oldname, oldlen);
+    vfs_dcache_forget(newdir, newname, newlen);
+
     mx_status_t status;
     vnode_t* oldvn = nullptr;
     // acquire the 'oldname' node (it must exist)
     dir_args_t args = dir_args_t();
     args.name = oldname;
     args.len = oldlen;
-    if ((status = vn_dir_for_each(olddir, &args, cb_dir_find)) < 0) {
+    if ((status = vn_dir_lookup(olddir, &args, cb_dir_find)) < 0) {
         return status;
     } else if ((status = olddir->fs->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
@@ -1282,11 +1782,11 @@ static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
     args.len = newlen;
     args.ino = oldvn->ino;
     args.type = VNODE_IS_DIR(oldvn) ? kMinfsTypeDir : kMinfsTypeFile;
-    status = vn_dir_for_each(newdir, &args, cb_dir_attempt_rename);
+    status = vn_dir_lookup(newdir, &args, cb_dir_attempt_rename);
     if (status == ERR_NOT_FOUND) {
         // if 'newname' does not exist, create it
         args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newlen)));
-        if ((status = vn_dir_for_each(newdir, &args, cb_dir_append)) < 0) {
+        if ((status = vn_dir_append(newdir, &args)) < 0) {
             goto done;
         }
         status = NO_ERROR;
@@ -1304,7 +1804,7 @@ static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
         args.name = "..";
         args.len = 2;
         args.ino = newdir->ino;
-        if ((status = vn_dir_for_each(vn, &args, cb_dir_update_inode)) < 0) {
+        if ((status = vn_dir_lookup(vn, &args, cb_dir_update_inode)) < 0) {
             vn_release(vn);
             goto done;
         }
@@ -1318,7 +1818,7 @@ static mx_status_t fs_rename(vnode_t* olddir, vnode_t* newdir,
     // finally, remove oldname from its original position
     args.name = oldname;
     args.len = oldlen;
-    status = vn_dir_for_each(olddir, &args, cb_dir_force_unlink);
+    status = vn_dir_lookup(olddir, &args, cb_dir_force_unlink);
 done:
     vn_release(oldvn);
     return status;
@@ -1328,6 +1828,55 @@ static mx_status_t fs_sync(vnode_t* vn) {
     return vn->fs->bc->Sync();
 }
 
+#ifdef __Fuchsia__
+#define GET_VMO_RIGHTS (MX_RIGHT_READ | MX_RIGHT_EXECUTE | MX_RIGHT_MAP | \
+                        MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_GET_PROPERTY)
+
+// Hands out a read-only copy-on-write clone of the file's VMO, so that every
+// client mapping the file shares the pages already in it.  Until minfs can
+// page in on fault, the requested range is read into the VMO first.
+static ssize_t fs_get_vmo(vnode_t* vn, size_t off, size_t len, mx_handle_t* out, size_t* vmo_off) {
+    if (VNODE_IS_DIR(vn)) {
+        return ERR_NOT_SUPPORTED;
+    }
+    if (off > vn->inode.size) {
+        off = vn->inode.size;
+    }
+    if (len > vn->inode.size - off) {
+        len = vn->inode.size - off;
+    }
+
+    mx_status_t status;
+    mx_handle_t clone;
+    mtx_lock(&vn->fs->vmo_lock);
+    if ((status = vn_init_vmo(vn)) != NO_ERROR) {
+        mtx_unlock(&vn->fs->vmo_lock);
+        return status;
+    }
+    // clone offsets must be page aligned, so the data may start part way in
+    size_t start = off & ~(PAGE_SIZE - 1);
+    if (len == 0) {
+        status = mx_vmo_create(0, 0, &clone);
+        start = off;
+    } else if ((status = vn_load_blocks(vn, static_cast<uint32_t>(off / kMinfsBlockSize),
+                                        static_cast<uint32_t>(ROUNDUP(off + len, kMinfsBlockSize) /
+                                                              kMinfsBlockSize))) == NO_ERROR) {
+        status = mx_vmo_clone(vn->vmo, MX_VMO_CLONE_COPY_ON_WRITE, start, off + len - start, &clone);
+    }
+    mtx_unlock(&vn->fs->vmo_lock);
+    if (status != NO_ERROR) {
+        return status;
+    }
+
+    if ((status = mx_handle_replace(clone, GET_VMO_RIGHTS, out)) != NO_ERROR) {
+        mx_handle_close(clone);
+        return status;
+    }
+    *vmo_off = off - start;
+    return len;
+}
+#endif
+
 vnode_ops_t minfs_ops = {
     .release = fs_release,
     .open = fs_open,
@@ -1338,10 +1887,16 @@ vnode_ops_t minfs_ops = {
     .getattr = fs_getattr,
     .setattr = fs_setattr,
     .readdir = fs_readdir,
+    .readdir_plus = fs_readdir_plus,
     .create = fs_create,
     .ioctl = fs_ioctl,
     .unlink = fs_unlink,
     .truncate = fs_truncate,
     .rename = fs_rename,
     .sync = fs_sync,
+#ifdef __Fuchsia__
+    .get_vmo = fs_get_vmo,
+#else
+    .get_vmo = nullptr,
+#endif
 };
@@ -21,12 +21,22 @@ constexpr uint32_t kMxFsSyncMtime   = (1<<0);
 constexpr uint32_t kMxFsSyncCtime   = (1<<1);
 
 constexpr uint32_t kMinfsBlockCacheSize = 64;
+// with deferred writes, blocks are flushed after the request which brings
+// the number not yet home to this many
+constexpr uint32_t kMinfsMaxDirty = kMinfsBlockCacheSize / 2;
 
-// Used by fsck
-struct CheckMaps {
-    Bitmap checked_inodes;
-    Bitmap checked_blocks;
-};
+// room for a few records of every block of the cache, each with its header,
+// so checkpoints can wait for several transactions
+constexpr uint32_t kMinfsJournalBlocks = 4 * (1 + kMinfsBlockCacheSize);
+
+// sequential reads fetch this many blocks past the request, the window
+// doubling from the min with each further sequential read
+constexpr uint32_t kMinfsReadAheadMin = 4;
+constexpr uint32_t kMinfsReadAheadMax = 64;
+
+// a new block which cannot follow the previous one of its file starts a
+// free run of up to this many blocks, if the write needs that many
+constexpr uint32_t kMinfsAllocRunMax = 256;
 
 class Minfs {
 public:
@@ -45,7 +55,9 @@ public:
 
     // Allocate a new data block and bcache_get_zero() it.
     // Acquires the block if out_block is not null.
-    mx_status_t BlockNew(uint32_t hint, uint32_t* out_bno, mxtl::RefPtr<BlockNode>* out_block);
+    // 'run' is how many blocks are about to be allocated one after another.
+    mx_status_t BlockNew(uint32_t hint, uint32_t run, uint32_t* out_bno,
+                         mxtl::RefPtr<BlockNode>* out_block);
 
     // free ino in inode bitmap, release all blocks held by inode
     mx_status_t InoFree(const minfs_inode_t& inode, uint32_t ino);
@@ -64,10 +76,17 @@ public:
     Bcache* bc;
     Bitmap block_map;
     minfs_info_t info;
+#ifdef __Fuchsia__
+    // Reads are served concurrently with each other (see rpc.cpp). They hold
+    // this while they set up or load the VMO of a vnode, which covers the
+    // block cache behind it too.
+    mtx_t vmo_lock;
+#endif
 private:
     Minfs(Bcache* bc_, minfs_info_t* info_);
 
     mx_status_t InoNew(minfs_inode_t* inode, uint32_t* ino_out);
+    mx_status_t InoBlockInit(uint32_t ino_blk);
     mx_status_t LoadBitmaps();
 
     uint32_t abmblks_;
@@ -76,7 +95,6 @@ private:
     list_node_t vnode_hash_[kMinfsBuckets];
 
     // Fsck can introspect Minfs
-    friend mx_status_t check_inode(CheckMaps*, const Minfs*, uint32_t, uint32_t);
     friend mx_status_t minfs_check(Bcache*);
 };
 
@@ -87,16 +105,26 @@ struct vnode {
     Minfs* fs;
 
     uint32_t ino;
-    uint32_t reserved;
+    // while a write allocates blocks, the number it has left to allocate
+    uint32_t alloc_run;
 
     list_node_t hashnode;
 
 #ifdef __Fuchsia__
     // TODO(smklein): When we have can register MinFS as a pager service, and
     // it can properly handle pages faults on a vnode's contents, then we can
-    // avoid reading the entire file up-front. Until then, read the contents of
+    // let it fault in the blocks it needs. Until then, read the contents of
     // a VMO into memory when it is read/written.
     mx_handle_t vmo;
+    // one bit per block that was on disk when the vmo was created, set
+    // once the block has been read into the vmo
+    uint64_t* vmo_loaded;
+    uint32_t vmo_blocks;
+
+    // readahead: where a sequential reader will read next, and how far
+    // past its request to read for it
+    uint32_t ra_offset;
+    uint32_t ra_window;
 #endif
 
     minfs_inode_t inode;
@@ -112,15 +140,24 @@ extern vnode_ops_t minfs_ops;
 void minfs_sync_vnode(vnode_t* vn, uint32_t flags);
 
 mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max);
+// the number of leading blocks of the inode table which have been written
+uint32_t minfs_ino_blocks_init(const minfs_info_t* info);
 void minfs_dump_info(minfs_info_t* info);
 
+// fill in the info block of a new, empty filesystem of 'blocks' blocks
+void minfs_init_info(minfs_info_t* info, uint32_t blocks);
+
 int minfs_mkfs(Bcache* bc);
 
 mx_status_t minfs_check(Bcache* bc);
 
+// write the blocks of the complete journal records, if there are any, home
+// in order, and reread *info if a record held the info block
+mx_status_t minfs_journal_replay(Bcache* bc, minfs_info_t* info);
+
 mx_status_t minfs_mount(vnode_t** root_out, Bcache* bc);
 
 void minfs_dir_init(void* bdata, uint32_t ino_self, uint32_t ino_parent);
 
 // vfs dispatch
-mx_handle_t vfs_rpc_server(vnode_t* vn);
+mx_handle_t vfs_rpc_server(vnode_t* vn, Bcache* bc);
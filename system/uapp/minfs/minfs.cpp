@@ -9,6 +9,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
 
 #include "minfs-private.h"
@@ -19,7 +20,13 @@ void minfs_dump_info(minfs_info_t* info) {
     printf("minfs: inode bitmap @ %10u\n", info->ibm_block);
     printf("minfs: alloc bitmap @ %10u\n", info->abm_block);
     printf("minfs: inode table  @ %10u\n", info->ino_block);
+    if (info->flags & kMinfsFlagLazyInodes) {
+        printf("minfs: inode table written %u blocks\n", info->ino_init_count);
+    }
     printf("minfs: data blocks  @ %10u\n", info->dat_block);
+    if (info->jnl_count) {
+        printf("minfs: journal      @ %10u (%u blocks)\n", info->jnl_block, info->jnl_count);
+    }
 }
 
 mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max) {
@@ -42,10 +49,29 @@ mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max) {
         error("minfs: too large for device\n");
         return ERR_INVALID_ARGS;
     }
+    if (info->jnl_count &&
+        ((info->jnl_block < info->ino_block) ||
+         (info->jnl_block + info->jnl_count > info->dat_block))) {
+        error("minfs: journal %u+%u outside of metadata area\n",
+              info->jnl_block, info->jnl_count);
+        return ERR_INVALID_ARGS;
+    }
+    if ((info->flags & kMinfsFlagLazyInodes) &&
+        (info->ino_init_count > (info->inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock)) {
+        error("minfs: %u inode table blocks written, past its end\n", info->ino_init_count);
+        return ERR_INVALID_ARGS;
+    }
     //TODO: validate layout
     return 0;
 }
 
+uint32_t minfs_ino_blocks_init(const minfs_info_t* info) {
+    if (info->flags & kMinfsFlagLazyInodes) {
+        return info->ino_init_count;
+    }
+    return (info->inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
+}
+
 static uint64_t minfs_current_utc_time(void) {
     // placeholder to provide changing values for file time (in unix epoch time)
     // TODO(orr) replace with syscall when RTC info is available
@@ -87,6 +113,9 @@ Minfs::Minfs(Bcache* bc_, minfs_info_t* info_) : bc(bc_) {
     for (size_t n = 0; n < kMinfsBuckets; n++) {
         list_initialize(vnode_hash_ + n);
     }
+#ifdef __Fuchsia__
+    mtx_init(&vmo_lock, mtx_plain);
+#endif
 }
 
 mx_status_t Minfs::InoFree(const minfs_inode_t& inode, uint32_t ino) {
@@ -155,6 +184,40 @@ mx_status_t Minfs::InoFree(const minfs_inode_t& inode, uint32_t ino) {
     return NO_ERROR;
 }
 
+// Inode table blocks past those written so far are zeroed this many at a
+// time, to spread the cost of updating the info block.
+constexpr uint32_t kMinfsInoInitBatch = 8;
+
+// Makes sure block ino_blk of the inode table has been written since mkfs,
+// zeroing it and any unwritten blocks before it.
+mx_status_t Minfs::InoBlockInit(uint32_t ino_blk) {
+    if (ino_blk < minfs_ino_blocks_init(&info)) {
+        return NO_ERROR;
+    }
+    uint32_t total = (info.inode_count + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
+    uint32_t end = mxtl::min(ino_blk + kMinfsInoInitBatch, total);
+
+    mxtl::RefPtr<BlockNode> blk;
+    for (uint32_t n = info.ino_init_count; n < end; n++) {
+        if ((blk = bc->GetZero(info.ino_block + n)) == nullptr) {
+            return ERR_IO;
+        }
+        bc->Put(blk, kBlockDirty);
+    }
+
+    // the blocks go out before the info block which says they are valid
+    if ((blk = bc->Get(0)) == nullptr) {
+        return ERR_IO;
+    }
+    info.ino_init_count = end;
+    if (end == total) {
+        info.flags &= ~kMinfsFlagLazyInodes;
+    }
+    memcpy(blk->data(), &info, sizeof(info));
+    bc->Put(blk, kBlockDirty);
+    return NO_ERROR;
+}
+
 mx_status_t Minfs::InoNew(minfs_inode_t* inode, uint32_t* ino_out) {
     uint32_t ino = inode_map_.Alloc(0);
     if (ino == BITMAP_FAIL) {
@@ -180,7 +243,8 @@ mx_status_t Minfs::InoNew(minfs_inode_t* inode, uint32_t* ino_out) {
 
     // obtain the block of the inode table we need
     mxtl::RefPtr<BlockNode> block_ino;
-    if ((block_ino = bc->Get(bno_of_ino)) == nullptr) {
+    if ((InoBlockInit(ino / kMinfsInodesPerBlock) != NO_ERROR) ||
+        ((block_ino = bc->Get(bno_of_ino)) == nullptr)) {
         inode_map_.Clr(ino);
         bc->Put(block_ibm, 0);
         return ERR_IO;
@@ -214,6 +278,7 @@ mx_status_t Minfs::VnodeNew(vnode_t** out, uint32_t type) {
     vn->inode.link_count = 1;
     vn->refcount = 1;
     vn->ops = &minfs_ops;
+    vn->flags = V_FLAG_DCACHE;
     mx_status_t status;
     if ((status = InoNew(&vn->inode, &vn->ino)) != NO_ERROR) {
         free(vn);
@@ -233,6 +298,10 @@ mx_status_t Minfs::VnodeGet(vnode_t** out, uint32_t ino) {
     if ((ino < 1) || (ino >= info.inode_count)) {
         return ERR_OUT_OF_RANGE;
     }
+    if (ino / kMinfsInodesPerBlock >= minfs_ino_blocks_init(&info)) {
+        error("minfs: ino#%u was never allocated\n", ino);
+        return ERR_IO_DATA_INTEGRITY;
+    }
     vnode_t* vn;
     uint32_t bucket = INO_HASH(ino);
     list_for_every_entry(vnode_hash_ + bucket, vn, vnode_t, hashnode) {
@@ -259,6 +328,7 @@ mx_status_t Minfs::VnodeGet(vnode_t** out, uint32_t ino) {
     vn->ino = ino;
     vn->refcount = 1;
     vn->ops = &minfs_ops;
+    vn->flags = V_FLAG_DCACHE;
     list_add_tail(vnode_hash_ + bucket, &vn->hashnode);
 
     *out = vn;
@@ -269,9 +339,27 @@ mx_status_t Minfs::VnodeGet(vnode_t** out, uint32_t ino) {
 // Return the underlying block (obtained via Bcache::Get()), if 'out_block' is not nullptr.
 //
 // If hint is nonzero it indicates which block number to start the search for
-// free blocks from.
-mx_status_t Minfs::BlockNew(uint32_t hint, uint32_t* out_bno, mxtl::RefPtr<BlockNode> *out_block) {
-    uint32_t bno = block_map.Alloc(hint);
+// free blocks from.  The hinted block itself is taken if it is free.
+// Otherwise, when more blocks are to follow, the new block starts the first
+// free run which can hold them (up to kMinfsAllocRunMax), or as many as
+// possible, so that they can still be contiguous.
+mx_status_t Minfs::BlockNew(uint32_t hint, uint32_t run, uint32_t* out_bno,
+                            mxtl::RefPtr<BlockNode> *out_block) {
+    uint32_t bno = BITMAP_FAIL;
+    if ((hint != 0) && (hint < block_map.Capacity()) && !block_map.Get(hint)) {
+        bno = hint;
+    } else {
+        for (run = mxtl::min(run, kMinfsAllocRunMax); (run > 1) && (bno == BITMAP_FAIL); run /= 2) {
+            if (((bno = block_map.Find(hint, run)) == BITMAP_FAIL) && (hint != 0)) {
+                bno = block_map.Find(0, run);
+            }
+        }
+    }
+    if (bno != BITMAP_FAIL) {
+        block_map.Set(bno);
+    } else {
+        bno = block_map.Alloc(hint);
+    }
     if ((bno == BITMAP_FAIL) && (hint != 0)) {
         bno = block_map.Alloc(0);
     }
@@ -380,6 +468,8 @@ mx_status_t Minfs::LoadBitmaps() {
             error("minfs: failed reading inode bitmap\n");
         }
     }
+    block_map.Rescan();
+    inode_map_.Rescan();
     return NO_ERROR;
 }
 
@@ -393,12 +483,19 @@ mx_status_t minfs_mount(vnode_t** out, Bcache* bc) {
     if (minfs_check_info(&info, bc->Maxblk())) {
         return -1;
     }
+    if (minfs_journal_replay(bc, &info) < 0) {
+        error("minfs: cannot replay journal\n");
+        return -1;
+    }
 
     Minfs* fs;
     if (Minfs::Create(&fs, bc, &info)) {
         error("minfs: mount failed\n");
         return -1;
     }
+    if (info.jnl_count && (bc->AttachJournal(info.jnl_block, info.jnl_count) < 0)) {
+        error("minfs: journal unusable, metadata writes are unordered\n");
+    }
 
     vnode_t* vn;
     if (fs->VnodeGet(&vn, kMinfsRootIno)) {
@@ -415,22 +512,19 @@ mx_status_t Minfs::Unmount() {
     return bc->Close();
 }
 
-int minfs_mkfs(Bcache* bc) {
-    uint32_t blocks = bc->Maxblk();
+void minfs_init_info(minfs_info_t* out, uint32_t blocks) {
     uint32_t inodes = 32768;
 
-    // determine how many blocks of inodes, allocation bitmaps,
-    // and inode bitmaps there are
+    // determine how many blocks of inodes and allocation bitmaps there are
     uint32_t inoblks = (inodes + kMinfsInodesPerBlock - 1) / kMinfsInodesPerBlock;
     uint32_t abmblks = (blocks + kMinfsBlockBits - 1) / kMinfsBlockBits;
-    uint32_t ibmblks = (inodes + kMinfsBlockBits - 1) / kMinfsBlockBits;
 
     minfs_info_t info;
     memset(&info, 0x00, sizeof(info));
     info.magic0 = kMinfsMagic0;
     info.magic1 = kMinfsMagic1;
     info.version = kMinfsVersion;
-    info.flags = kMinfsFlagClean;
+    info.flags = kMinfsFlagClean | kMinfsFlagLazyInodes;
     info.block_size = kMinfsBlockSize;
     info.inode_size = kMinfsInodeSize;
     info.block_count = blocks;
@@ -438,9 +532,22 @@ int minfs_mkfs(Bcache* bc) {
     info.ibm_block = 8;
     info.abm_block = 16;
     info.ino_block = info.abm_block + ((abmblks + 8) & (~7));
-    info.dat_block = info.ino_block + inoblks;
+    info.jnl_block = info.ino_block + inoblks;
+    info.jnl_count = kMinfsJournalBlocks;
+    info.dat_block = info.jnl_block + info.jnl_count;
+    // the rest of the inode table is zeroed as it comes into use
+    info.ino_init_count = 1;
+    memcpy(out, &info, sizeof(info));
+}
+
+int minfs_mkfs(Bcache* bc) {
+    minfs_info_t info;
+    minfs_init_info(&info, bc->Maxblk());
     minfs_dump_info(&info);
 
+    uint32_t abmblks = (info.block_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+    uint32_t ibmblks = (info.inode_count + kMinfsBlockBits - 1) / kMinfsBlockBits;
+
     Bitmap abm;
     Bitmap ibm;
     if (abm.Init(info.block_count)) {
@@ -482,12 +589,16 @@ int minfs_mkfs(Bcache* bc) {
         bc->Put(blk, kBlockDirty);
     }
 
-    // write inodes
-    for (uint32_t n = 0; n < inoblks; n++) {
+    // write the inodes in use
+    for (uint32_t n = 0; n < info.ino_init_count; n++) {
         blk = bc->GetZero(info.ino_block + n);
         bc->Put(blk, kBlockDirty);
     }
 
+    // start with an empty journal
+    blk = bc->GetZero(info.jnl_block);
+    bc->Put(blk, kBlockDirty);
+
 
     // setup root inode
     blk = bc->Get(info.ino_block);
@@ -12,6 +12,9 @@
 #include <mxtl/unique_free_ptr.h>
 
 #include <magenta/types.h>
+#ifdef __Fuchsia__
+#include <magenta/device/block.h>
+#endif
 
 #include <assert.h>
 #include <stdint.h>
@@ -27,6 +30,7 @@ constexpr uint32_t kMinfsVersion = 0x00000002;
 
 constexpr uint32_t kMinfsRootIno        = 1;
 constexpr uint32_t kMinfsFlagClean      = 1;
+constexpr uint32_t kMinfsFlagLazyInodes = 2;
 constexpr uint32_t kMinfsBlockSize      = 8192;
 constexpr uint32_t kMinfsBlockBits      = (kMinfsBlockSize * 8);
 constexpr uint32_t kMinfsInodeSize      = 256;
@@ -61,11 +65,15 @@ typedef struct {
     uint32_t abm_block;     // first blockno of block allocation bitmap
     uint32_t ino_block;     // first blockno of inode table
     uint32_t dat_block;     // first blockno available for file data
+    uint32_t jnl_block;     // first blockno of metadata journal
+    uint32_t jnl_count;     // blocks in the journal (0 if there is none)
+    uint32_t ino_init_count; // leading blocks of inode table written, with kMinfsFlagLazyInodes
 } minfs_info_t;
 
 // Notes:
 // - the ibm, abm, ino, and dat regions must be in that order
 //   and may not overlap
+// - the journal, if any, sits between the ino and dat regions
 // - the abm has an entry for every block on the volume, including
 //   the info block (0), the bitmaps, etc
 // - data blocks referenced from direct and indirect block tables
@@ -76,6 +84,11 @@ typedef struct {
 //     ino_block + ino / kMinfsInodesPerBlock
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
+// - with kMinfsFlagLazyInodes set, only the first ino_init_count blocks
+//   of the inode table have been written (zeroed) since mkfs; the rest
+//   hold whatever was on the disk before, and are zeroed as inodes in
+//   them are first allocated.  Once the whole table is written the flag
+//   is cleared.  Without the flag, the whole table is valid.
 
 typedef struct {
     uint32_t magic;
@@ -134,6 +147,65 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 //   record starts. If the MAX_DIR_SIZE is increased, this 'last' record will
 //   also increase in size.
 
+// Large directories also keep a hash table of their entries, in the file
+// blocks past the last one dirents can occupy: a header block at
+// kMinfsDirIndexBlock, followed by the slot blocks.  The dirents remain the
+// authoritative copy; the index only lets lookups skip the linear scan.
+constexpr uint32_t kMinfsDirIndexMagic = 0x78646e49;
+constexpr uint32_t kMinfsDirIndexBlock = kMinfsMaxDirectorySize / kMinfsBlockSize + 1;
+// directories are indexed once their dirents take up this many bytes
+constexpr uint32_t kMinfsDirIndexMinSize = 4 * kMinfsBlockSize;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq_num;               // directory seq_num the index matches
+    uint32_t slots;                 // a power of two
+    uint32_t used;                  // slots naming a dirent
+    uint32_t deleted;               // slots whose dirent was removed
+    uint32_t tail;                  // offset of the last dirent
+    uint32_t hole;                  // offset of a free dirent, or 0
+} minfs_dir_index_t;
+
+// Slots hash the dirent name with fnv1a32, and are probed linearly.
+// loc is 0 for a slot which was never used, and kMinfsDirSlotDeleted
+// for one which was; otherwise it is the dirent offset | kMinfsDirSlotLive.
+typedef struct {
+    uint32_t hash;
+    uint32_t loc;
+} minfs_dir_slot_t;
+
+constexpr uint32_t kMinfsDirSlotLive = 1;
+constexpr uint32_t kMinfsDirSlotDeleted = 2;
+constexpr uint32_t kMinfsDirSlotsPerBlock = kMinfsBlockSize / sizeof(minfs_dir_slot_t);
+// enough to keep the table at most half full in a directory of 1-byte names
+constexpr uint32_t kMinfsDirIndexMaxSlots = 2 * (kMinfsMaxDirectorySize / DirentSize(1) + 1);
+
+// Notes:
+// - an index whose seq_num does not match the directory inode is stale
+//   (something which does not know about the index changed the directory),
+//   and is rebuilt from the dirents before use
+// - tail and hole are hints for where to add a dirent; they always name the
+//   start of a dirent while the index is current
+// - index blocks are not part of the directory's size
+
+constexpr uint64_t kMinfsJournalMagic = (0x6c6e724a53466e4dULL);
+
+// The journal is a log of records, one per transaction, laid out one after
+// another from its start. A record is this header block, followed by copies
+// of the metadata blocks it commits, in the order listed in bno[]. The
+// checksum covers everything from seq to the end of the last copy, so a
+// record which did not reach the disk in full is never replayed. Replay
+// stops there, or at a record whose seq does not follow on, which is left
+// over from before the last checkpoint. A checkpoint, once every block in
+// the log is home, empties it by writing a header with a count of 0 and the
+// last seq at its start.
+typedef struct {
+    uint64_t magic;
+    uint32_t checksum;
+    uint32_t count;
+    uint64_t seq;
+    uint32_t bno[];
+} minfs_journal_t;
 
 // blocksize   8K    16K    32K
 // 16 dir =  128K   256K   512K
@@ -150,6 +222,8 @@ class Bcache;
 
 // Flag denoting if a block is dirty or not
 constexpr uint32_t kBlockDirty = 0x01;
+// Flag denoting a block committed to the journal but not yet written home
+constexpr uint32_t kBlockCommitted = 0x10;
 // Flag identifying block list on which a block exists.
 constexpr uint32_t kBlockBusy  = 0x02;
 constexpr uint32_t kBlockLRU   = 0x04;
@@ -170,11 +244,17 @@ public:
     struct TypeHashTraits {
         static NodeState& node_state(BlockNode& bn) { return bn.type_hash_state_; }
     };
+    struct TypeDirtyTraits {
+        static NodeState& node_state(BlockNode& bn) { return bn.type_dirty_state_; }
+    };
+    struct TypeCommittedTraits {
+        static NodeState& node_state(BlockNode& bn) { return bn.type_committed_state_; }
+    };
 
     // Create a single Block within a Block Cache
     static mx_status_t Create(Bcache* bc);
 
-    void* data() const { return data_.get(); }
+    void* data() const { return data_; }
 
     // Allow BlockNode to be placed in an mxtl::HashTable
     uint32_t GetKey() const { return bno_; }
@@ -186,15 +266,21 @@ private:
     friend class BcacheLists;
     friend struct TypeListTraits;
     friend struct TypeHashTraits;
+    friend struct TypeDirtyTraits;
+    friend struct TypeCommittedTraits;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(BlockNode);
     BlockNode();
 
     NodeState type_list_state_;
     NodeState type_hash_state_;
+    NodeState type_dirty_state_;
+    NodeState type_committed_state_;
     uint32_t flags_;
     uint32_t bno_;
-    mxtl::unique_free_ptr<char> data_;
+    char* data_;
+    // backs data_ unless the cache keeps its blocks in a VMO
+    mxtl::unique_free_ptr<char> storage_;
 };
 
 // Contains operations that act on Bcache's linked lists, updating their flags as they move from
@@ -205,14 +291,45 @@ public:
     mxtl::RefPtr<BlockNode> PopFront(uint32_t block_type);
     mxtl::RefPtr<BlockNode> Erase(mxtl::RefPtr<BlockNode> blk, uint32_t block_type);
 
+    // Dirty blocks are also kept on a list of their own, whichever of the
+    // busy or lru lists they are on, so write-back need not walk the hash.
+    void MarkDirty(BlockNode* blk);
+    void ClearDirty(BlockNode* blk);
+    uint32_t DirtyCount() const { return dirty_count_; }
+    template <typename Callback>
+    void ForEachDirty(Callback cb) {
+        for (auto& blk : list_dirty_) {
+            cb(&blk);
+        }
+    }
+
+    // Likewise the blocks committed to the journal and waiting to go home.
+    // A block may be on both lists, when changed again after its commit.
+    void MarkCommitted(BlockNode* blk);
+    void ClearCommitted(BlockNode* blk);
+    uint32_t CommittedCount() const { return committed_count_; }
+    template <typename Callback>
+    void ForEachCommitted(Callback cb) {
+        for (auto& blk : list_committed_) {
+            cb(&blk);
+        }
+    }
+
 private:
     using LinkedList = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>, BlockNode::TypeListTraits>;
+    using DirtyList = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>, BlockNode::TypeDirtyTraits>;
+    using CommittedList = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>,
+                                                 BlockNode::TypeCommittedTraits>;
     LinkedList* GetList(uint32_t block_type);
     size_t SizeAllSlow() const; // Used for debugging
 
     LinkedList list_busy_;  // Between Get() and Put(). In hash.
     LinkedList list_lru_;   // Available for re-use. In hash.
     LinkedList list_free_;  // Never been used. Not in hash.
+    DirtyList list_dirty_;  // Modified since last written back. In hash.
+    uint32_t dirty_count_ = 0;
+    CommittedList list_committed_;  // In the journal, not yet home. In hash.
+    uint32_t committed_count_ = 0;
 };
 
 class Bcache {
@@ -227,9 +344,23 @@ public:
     // These do not track blocks (or attempt to access the block cache)
     mx_status_t Readblk(uint32_t bno, void* data);
     mx_status_t Writeblk(uint32_t bno, const void* data);
+    // Reads count consecutive blocks in one request. Unlike Readblk, this
+    // does not look for held back writes of them: Flush() first if need be.
+    mx_status_t Readblks(uint32_t bno, uint32_t count, void* data);
+    // Writes count consecutive blocks in one request, for filling a disk
+    // which nothing has cached yet.
+    mx_status_t Writeblks(uint32_t bno, uint32_t count, const void* data);
 
     uint32_t Maxblk() const { return blockmax_; };
 
+#ifdef __Fuchsia__
+    // Moves whole blocks between the disk and some other VMO, such as the
+    // one holding a file's data, in a single request to the block device.
+    // Like the raw functions, these are not tracked by the cache.
+    // Returns ERR_NOT_SUPPORTED if the device cannot; use Readblk/Writeblk.
+    mx_status_t VmoTxns(mx_handle_t vmo, block_txn_batch_t* batch);
+#endif
+
     // acquire a block, reading from disk if necessary,
     // returning a handle and a pointer to the data
     mxtl::RefPtr<BlockNode> Get(uint32_t bno);
@@ -247,6 +378,30 @@ public:
     // drop all non-busy, non-dirty blocks
     void Invalidate();
 
+    // Hold dirty blocks back on Put() until Commit() or Flush(), instead of
+    // writing each one through.
+    void DeferWrites() { defer_writes_ = true; }
+    // End a transaction. With a journal, the blocks dirtied since the last
+    // commit are written there as one record, and stay cached until a
+    // checkpoint writes them home; the checkpoint is done here only if the
+    // journal could not take another record. Without one, they wait for
+    // Flush(). Nothing is written home if the record cannot be.
+    mx_status_t Commit();
+    // commit, then write back all blocks not yet home, sorted, in as few
+    // requests as possible
+    mx_status_t Flush();
+    // number of blocks waiting for Commit()
+    uint32_t DirtyCount() const { return lists_.DirtyCount(); }
+    // number of blocks waiting for Flush()
+    uint32_t PendingCount() const { return lists_.DirtyCount() + lists_.CommittedCount(); }
+    // true once enough blocks are pending that they should not wait any longer
+    bool FlushDue() const;
+
+    // Use the count blocks from start as a metadata journal: from then on
+    // Commit() appends the dirty blocks there, in one write, before any of
+    // them may be written to their home locations.
+    mx_status_t AttachJournal(uint32_t start, uint32_t count);
+
     int Sync();
     int Close();
 
@@ -256,6 +411,26 @@ private:
     Bcache(int fd, uint32_t blockmax, uint32_t blocksize);
 
     mxtl::RefPtr<BlockNode> Get(uint32_t bno, uint32_t mode);
+    mx_status_t Load(BlockNode* blk);
+    mx_status_t WriteRaw(uint32_t bno, const void* data, uint32_t count);
+    // true if a write of any of the count blocks from bno is held back
+    bool Pending(uint32_t bno, uint32_t count);
+    mx_status_t WriteHome(BlockNode** blks, uint32_t count);
+    mx_status_t Checkpoint();
+    mx_status_t JournalCommit(BlockNode** blks, uint32_t count);
+    mx_status_t JournalReset();
+
+#ifdef __Fuchsia__
+    // The cache's blocks live in one VMO, which is handed to the block
+    // device with IOCTL_BLOCK_TXN_VMO so many blocks move per request.
+    mx_status_t AttachVmo(uint32_t num);
+    mx_status_t RunTxns(mx_handle_t vmo, block_txn_batch_t* batch);
+    mx_handle_t vmo_ = MX_HANDLE_INVALID;
+    uintptr_t vmo_base_ = 0;
+    size_t vmo_size_ = 0;
+    size_t vmo_next_ = 0;
+    bool txn_vmo_ = false;
+#endif
 
     using HashTableBucket = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>, BlockNode::TypeHashTraits>;
     using HashTable = mxtl::HashTable<uint32_t, mxtl::RefPtr<BlockNode>, HashTableBucket>;
@@ -264,6 +439,17 @@ private:
     int fd_;
     uint32_t blockmax_;
     uint32_t blocksize_;
+    bool defer_writes_ = false;
+    uint32_t cache_blocks_ = 0;
+
+    // records are staged in jnl_buf_ and appended at jnl_next_ blocks into
+    // the journal; the blocks in them are exactly the committed ones
+    uint32_t jnl_block_ = 0;
+    uint32_t jnl_count_ = 0;
+    uint32_t jnl_next_ = 0;
+    uint64_t jnl_seq_ = 0;
+    char* jnl_buf_ = nullptr;
+    mxtl::unique_free_ptr<char> jnl_storage_;
 };
 
 // Allocation Bitmap (bitmap.c)
@@ -281,6 +467,15 @@ public:
     // returns BITMAP_FAIL if no bit is found
     uint32_t Alloc(uint32_t minbit);
 
+    // find the first run of 'len' available bits at or past minbit,
+    // return the first bitnumber of the run (nothing is set)
+    // returns BITMAP_FAIL if there is no such run
+    uint32_t Find(uint32_t minbit, uint32_t len) const;
+
+    // recompute the free space summary, which is needed after the bits
+    // were written directly through data() or GetBlock()
+    void Rescan();
+
     // This will never fail if the new maxbits is no larger
     // that the original maxbits.  The underlying storage will
     // not be reduced (so this is useful for creating a bitmap
@@ -312,10 +507,40 @@ public:
     }
 
 private:
+    // The summary is a complete binary tree over chunks of kChunkBits bits,
+    // each node holding the free bits at the start and end of its range and
+    // the longest run of free bits within it.  Bits past the end of the map
+    // count as allocated.  A chunk's summary is built from the summaries of
+    // its 64-bit words, which are kept too.
+    static constexpr uint32_t kChunkBits = 4096;
+    static constexpr uint32_t kChunkWords = kChunkBits / 64;
+    typedef struct {
+        uint32_t pre;
+        uint32_t suf;
+        uint32_t best;
+    } summary_t;
+    typedef struct {
+        uint8_t pre;
+        uint8_t suf;
+        uint8_t best;
+    } word_summary_t;
+
     uint32_t Mapcount() const;
-    uint64_t* End() const;
     size_t BytesRequired() const;
 
+    static summary_t Combine(const summary_t& l, uint64_t lsize,
+                             const summary_t& r, uint64_t rsize);
+    uint64_t Word(uint32_t n) const;
+    word_summary_t WordSummary(uint32_t n) const;
+    summary_t ChunkSummary(uint32_t chunk) const;
+    void Update(uint32_t n);
+    uint32_t ScanRun(uint32_t start, uint32_t end, uint32_t len, uint32_t* run) const;
+    uint32_t FindIn(uint32_t node, uint32_t chunk, uint32_t chunks, uint32_t first,
+                    uint32_t len, uint32_t* run) const;
+
     uint32_t bitcount_; // Number of addressable bits
     mxtl::unique_free_ptr<uint64_t> map_; // Underlying map of bits
+    uint32_t leaves_ = 0; // Chunks the summary has room for (a power of two)
+    mxtl::unique_free_ptr<summary_t> summary_; // Nodes 1..2*leaves_-1
+    mxtl::unique_free_ptr<word_summary_t> words_; // Every word of every chunk
 };
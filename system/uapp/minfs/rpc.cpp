@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +22,7 @@
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
 
+#include "minfs.h"
 
 struct vnode {
     VNODE_BASE_FIELDS
@@ -28,6 +30,52 @@ struct vnode {
 
 mtx_t vfs_lock = MTX_INIT;
 mxio_dispatcher_t* vfs_dispatcher;
+static Bcache* vfs_bcache;
+
+// Requests are served on up to this many threads, one per CPU. The
+// dispatcher keeps the requests of each connection in order; across
+// connections, those which only read share vfs_rwlock, while all others,
+// and the flusher, hold it exclusively. Taken before vfs_lock.
+#define MINFS_RPC_THREADS_MAX 8
+
+static pthread_rwlock_t vfs_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Dirty blocks are written back at most this long after a request first
+// leaves some behind, so the metadata updates of back to back requests
+// (creating and writing a run of small files, say) share disk writes.
+#define MINFS_FLUSH_DELAY MX_MSEC(100)
+
+static cnd_t vfs_flush_cond = CND_INIT;
+static mx_time_t vfs_flush_deadline;
+
+// Waits for a request to leave blocks behind which are not yet home, then
+// writes them back once MINFS_FLUSH_DELAY is up. The deadline is guarded by vfs_lock.
+static int vfs_flusher(void* arg) {
+    for (;;) {
+        mtx_lock(&vfs_lock);
+        while (vfs_flush_deadline == 0) {
+            cnd_wait(&vfs_flush_cond, &vfs_lock);
+        }
+        mx_time_t deadline = vfs_flush_deadline;
+        mtx_unlock(&vfs_lock);
+
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (now < deadline) {
+            // the blocks may be flushed meanwhile, and the deadline moved
+            mx_nanosleep(deadline - now);
+            continue;
+        }
+        // the vfs library holds vfs_lock around vnode ops, not vfs_rwlock,
+        // so take it too, as the handler does around its own flushes
+        pthread_rwlock_wrlock(&vfs_rwlock);
+        mtx_lock(&vfs_lock);
+        vfs_bcache->Flush();
+        vfs_flush_deadline = 0;
+        mtx_unlock(&vfs_lock);
+        pthread_rwlock_unlock(&vfs_rwlock);
+    }
+    return 0;
+}
 
 mx_status_t vfs_get_handles(vnode_t* vn, uint32_t flags, mx_handle_t* hnds,
                             uint32_t* type, void* extra, uint32_t* esize) {
@@ -40,8 +88,46 @@ mx_status_t vfs_get_handles(vnode_t* vn, uint32_t flags, mx_handle_t* hnds,
     return 1;
 }
 
+// Requests which change nothing but the state of their connection.
+static bool vfs_op_reads(uint32_t op) {
+    switch (MXRIO_OP(op)) {
+    case MXRIO_READ:
+    case MXRIO_READ_AT:
+    case MXRIO_SEEK:
+    case MXRIO_STAT:
+        return true;
+    default:
+        return false;
+    }
+}
+
 mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
-    return vfs_handler_generic(msg, rh, cookie);
+    mx_status_t r;
+    if (vfs_op_reads(msg->op)) {
+        pthread_rwlock_rdlock(&vfs_rwlock);
+        r = vfs_handler_generic(msg, rh, cookie);
+        pthread_rwlock_unlock(&vfs_rwlock);
+        return r;
+    }
+
+    pthread_rwlock_wrlock(&vfs_rwlock);
+    r = vfs_handler_generic(msg, rh, cookie);
+    // Between requests the metadata is consistent, so this is where the
+    // request's dirty blocks are committed, as one transaction. They go
+    // home right away once enough have built up, and otherwise together
+    // with those of the requests that follow.
+    mtx_lock(&vfs_lock);
+    vfs_bcache->Commit();
+    if (vfs_bcache->FlushDue()) {
+        vfs_bcache->Flush();
+        vfs_flush_deadline = 0;
+    } else if ((vfs_bcache->PendingCount() > 0) && (vfs_flush_deadline == 0)) {
+        vfs_flush_deadline = mx_time_get(MX_CLOCK_MONOTONIC) + MINFS_FLUSH_DELAY;
+        cnd_signal(&vfs_flush_cond);
+    }
+    mtx_unlock(&vfs_lock);
+    pthread_rwlock_unlock(&vfs_rwlock);
+    return r;
 }
 
 void vfs_notify_add(vnode_t* vn, const char* name, size_t len) {
@@ -58,10 +144,22 @@ ssize_t vfs_do_ioctl_watch_dir(vnode_t* vn, const void* in_buf, size_t in_len,
     return ERR_NOT_SUPPORTED;
 }
 
-mx_handle_t vfs_rpc_server(vnode_t* vn) {
+static int vfs_rpc_thread(void* arg) {
+    mxio_dispatcher_run(vfs_dispatcher);
+    return 0;
+}
+
+mx_handle_t vfs_rpc_server(vnode_t* vn, Bcache* bc) {
     vfs_iostate_t* ios;
     mx_status_t r;
 
+    vfs_bcache = bc;
+    thrd_t flusher;
+    if (thrd_create_with_name(&flusher, vfs_flusher, nullptr, "minfs-flusher") == thrd_success) {
+        thrd_detach(flusher);
+        bc->DeferWrites();
+    }
+
     if ((ios = (vfs_iostate_t*)calloc(1, sizeof(vfs_iostate_t))) == nullptr)
         return ERR_NO_MEMORY;
     ios->vn = vn;
@@ -91,6 +189,18 @@ mx_handle_t vfs_rpc_server(vnode_t* vn) {
     }
     //TODO: ref count
     //vn_acquire(vn);
+    uint32_t threads = mx_num_cpus();
+    if (threads > MINFS_RPC_THREADS_MAX) {
+        threads = MINFS_RPC_THREADS_MAX;
+    }
+    // this thread is the first of them
+    for (uint32_t n = 1; n < threads; n++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, vfs_rpc_thread, nullptr, "minfs-rpc") != thrd_success) {
+            break;
+        }
+        thrd_detach(t);
+    }
     mxio_dispatcher_run(vfs_dispatcher);
     return NO_ERROR;
 }
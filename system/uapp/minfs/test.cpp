@@ -306,6 +306,87 @@ int test_rename(void) {
     return 0;
 }
 
+// Enough entries for the directory to be indexed, with names of several
+// lengths so freed dirents do not all fit the next name.
+#define BIGDIR_COUNT 3000
+
+static void bigdir_name(char* buf, size_t len, const char* tag, int n) {
+    snprintf(buf, len, "::bigdir/%s%0*d", tag, 1 + (n % 7), n);
+}
+
+int test_bigdir(void) {
+    char name[64];
+    char other[64];
+    TRY(emu_mkdir("::bigdir", 0755));
+    for (int n = 0; n < BIGDIR_COUNT; n++) {
+        bigdir_name(name, sizeof(name), "file", n);
+        emu_close(TRY(emu_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)));
+    }
+    for (int n = 0; n < BIGDIR_COUNT; n++) {
+        bigdir_name(name, sizeof(name), "file", n);
+        EXPECT_FAIL(emu_open(name, O_RDWR | O_CREAT | O_EXCL, 0644));
+        emu_close(TRY(emu_open(name, O_RDWR, 0644)));
+    }
+    for (int n = 0; n < BIGDIR_COUNT; n += 2) {
+        bigdir_name(name, sizeof(name), "file", n);
+        TRY(emu_unlink(name));
+    }
+    for (int n = 0; n < BIGDIR_COUNT; n++) {
+        bigdir_name(name, sizeof(name), "file", n);
+        if (n % 2) {
+            emu_close(TRY(emu_open(name, O_RDWR, 0644)));
+        } else {
+            EXPECT_FAIL(emu_open(name, O_RDWR, 0644));
+        }
+    }
+    for (int n = 1; n < BIGDIR_COUNT; n += 4) {
+        bigdir_name(name, sizeof(name), "file", n);
+        bigdir_name(other, sizeof(other), "moved", n);
+        TRY(emu_rename(name, other));
+        EXPECT_FAIL(emu_open(name, O_RDWR, 0644));
+        emu_close(TRY(emu_open(other, O_RDWR, 0644)));
+    }
+    for (int n = 0; n < BIGDIR_COUNT; n += 2) {
+        bigdir_name(name, sizeof(name), "new", n);
+        emu_close(TRY(emu_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)));
+    }
+    for (int n = 0; n < BIGDIR_COUNT; n += 2) {
+        bigdir_name(name, sizeof(name), "new", n);
+        emu_close(TRY(emu_open(name, O_RDWR, 0644)));
+    }
+    return 0;
+}
+
+// Walks the same deep paths again and again, while the names along them
+// come and go, so cached lookups must follow every change.
+int test_deeppath(void) {
+    TRY(emu_mkdir("::a", 0755));
+    TRY(emu_mkdir("::a/b", 0755));
+    TRY(emu_mkdir("::a/b/c", 0755));
+    for (int n = 0; n < 3; n++) {
+        EXPECT_FAIL(emu_open("::a/b/c/file", O_RDWR, 0644));
+        emu_close(TRY(emu_open("::a/b/c/file", O_RDWR | O_CREAT | O_EXCL, 0644)));
+        emu_close(TRY(emu_open("::a/b/c/file", O_RDWR, 0644)));
+        TRY(emu_unlink("::a/b/c/file"));
+    }
+    emu_close(TRY(emu_open("::a/b/c/file", O_RDWR | O_CREAT | O_EXCL, 0644)));
+    TRY(emu_rename("::a/b", "::a/x"));
+    EXPECT_FAIL(emu_open("::a/b/c/file", O_RDWR, 0644));
+    emu_close(TRY(emu_open("::a/x/c/file", O_RDWR, 0644)));
+    TRY(emu_mkdir("::a/b", 0755));
+    EXPECT_FAIL(emu_open("::a/b/c/file", O_RDWR, 0644));
+    TRY(emu_rename("::a/x/c/file", "::a/b/file"));
+    EXPECT_FAIL(emu_open("::a/x/c/file", O_RDWR, 0644));
+    emu_close(TRY(emu_open("::a/b/file", O_RDWR, 0644)));
+    TRY(emu_unlink("::a/b/file"));
+    TRY(emu_unlink("::a/b"));
+    TRY(emu_unlink("::a/x/c"));
+    TRY(emu_unlink("::a/x"));
+    EXPECT_FAIL(emu_open("::a/x/c", O_RDONLY, 0644));
+    TRY(emu_unlink("::a"));
+    return 0;
+}
+
 int run_fs_tests(int argc, char** argv) {
     fprintf(stderr, "--- fs tests ---\n");
     if (argc > 0) {
@@ -321,6 +402,12 @@ int run_fs_tests(int argc, char** argv) {
         if (!strcmp(argv[0], "rename")) {
             return test_rename();
         }
+        if (!strcmp(argv[0], "bigdir")) {
+            return test_bigdir();
+        }
+        if (!strcmp(argv[0], "deeppath")) {
+            return test_deeppath();
+        }
         fprintf(stderr, "unknown test: %s\n", argv[0]);
         return -1;
     }
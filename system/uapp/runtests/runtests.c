@@ -3,16 +3,23 @@
 // found in the LICENSE file.
 
 #include <dirent.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <launchpad/launchpad.h>
 #include <limits.h>
 #include <magenta/listnode.h>
+#include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/object.h>
+#include <mxio/io.h>
+#include <poll.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
 
 typedef struct failure {
     list_node_t node;
@@ -47,7 +54,25 @@ static int failed_count = 0;
 // provided by the user.
 static int verbosity = -1;
 
-static void run_tests(const char* dirn) {
+// How long each test took the last time it ran, so that a parallel run can
+// start the slowest ones first.  Rewritten after every run.
+static const char* times_path = "/tmp/runtests.times";
+
+typedef struct test {
+    char path[64 + NAME_MAX];
+    const char* name;       // points into path
+    mx_time_t last_time;    // from times_path, 0 if unknown
+    mx_time_t time;
+    bool ran;
+} test_t;
+
+static test_t* tests;
+static size_t num_tests;
+
+// Guards failures, the counts and stdout while tests run in parallel.
+static mtx_t results_lock = MTX_INIT;
+
+static void find_tests(const char* dirn) {
     DIR* dir = opendir(dirn);
     if (dir == NULL) {
         return;
@@ -62,83 +87,333 @@ static void run_tests(const char* dirn) {
             continue;
         }
 
-        total_count++;
-        if (verbosity) {
-            printf(
-                "\n------------------------------------------------\n"
-                "RUNNING TEST: %s\n\n",
-                de->d_name);
+        test_t* grown = realloc(tests, (num_tests + 1) * sizeof(test_t));
+        if (grown == NULL) {
+            break;
         }
+        tests = grown;
+        test_t* test = &tests[num_tests++];
+        memset(test, 0, sizeof(*test));
+        strcpy(test->path, name);
+        test->name = test->path + strlen(dirn) + 1;
+    }
 
-        char verbose_opt[] = {'v','=', verbosity + '0', 0};
-        const char* argv[] = {name, verbose_opt};
-        int argc = verbosity >= 0 ? 2 : 1;
+    closedir(dir);
+}
 
-        launchpad_t* lp;
-        launchpad_create(0, name, &lp);
-        launchpad_load_from_file(lp, argv[0]);
-        launchpad_clone(lp, LP_CLONE_ALL);
-        launchpad_set_args(lp, argc, argv);
-        const char* errmsg;
-        mx_handle_t handle;
-        mx_status_t status = launchpad_go(lp, &handle, &errmsg);
-        if (status < 0) {
-            printf("FAILURE: Failed to launch %s: %d: %s\n", de->d_name, status, errmsg);
-            fail_test(&failures, de->d_name, FAILED_TO_LAUNCH, 0);
-            failed_count++;
-            continue;
+static void read_times(void) {
+    FILE* f = fopen(times_path, "r");
+    if (f == NULL) {
+        return;
+    }
+
+    uint64_t ms;
+    char path[64 + NAME_MAX];
+    while (fscanf(f, "%" SCNu64 " %s", &ms, path) == 2) {
+        for (size_t i = 0; i < num_tests; i++) {
+            if (!strcmp(tests[i].path, path)) {
+                tests[i].last_time = MX_MSEC(ms);
+                break;
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void write_times(void) {
+    FILE* f = fopen(times_path, "w");
+    if (f == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < num_tests; i++) {
+        if (tests[i].ran) {
+            fprintf(f, "%" PRIu64 " %s\n", tests[i].time / MX_MSEC(1), tests[i].path);
+        }
+    }
+    fclose(f);
+}
+
+// Slowest first; tests that haven't been timed yet go before all of them,
+// since for all we know they're the slowest of all.
+static int compare_last_time(const void* a, const void* b) {
+    mx_time_t ta = ((const test_t*)a)->last_time;
+    mx_time_t tb = ((const test_t*)b)->last_time;
+    if (ta == 0) ta = UINT64_MAX;
+    if (tb == 0) tb = UINT64_MAX;
+    return (ta < tb) - (ta > tb);
+}
+
+typedef struct output {
+    char* data;
+    size_t len;
+    size_t cap;
+} output_t;
+
+static void output_append(output_t* out, const char* data, size_t len) {
+    if (out->len + len > out->cap) {
+        size_t cap = out->cap ? out->cap : 4096;
+        while (cap < out->len + len) {
+            cap *= 2;
+        }
+        char* grown = realloc(out->data, cap);
+        if (grown == NULL) {
+            return;
         }
+        out->data = grown;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
 
+static void output_printf(output_t* out, const char* fmt, ...) __PRINTFLIKE(2, 3);
+static void output_printf(output_t* out, const char* fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    if (out == NULL) {
+        fwrite(buf, 1, len, stdout);
+    } else {
+        output_append(out, buf, len);
+    }
+}
+
+// Hands the new process a pipe for stdout and stderr in place of ours.
+static mx_status_t launch_buffered(launchpad_t* lp, int* fd_out) {
+    mx_handle_t handles[2];
+    uint32_t type;
+    mx_status_t status = mxio_pipe_half(&handles[0], &type);
+    if (status < 0) {
+        launchpad_abort(lp, status, "failed to create pipe");
+        return status;
+    }
+    int fd = status;
+    if ((status = mx_handle_duplicate(handles[0], MX_RIGHT_SAME_RIGHTS, &handles[1])) < 0) {
+        mx_handle_close(handles[0]);
+        close(fd);
+        launchpad_abort(lp, status, "failed to duplicate pipe");
+        return status;
+    }
+    launchpad_add_handle(lp, handles[0], MX_HND_INFO(MX_HND_INFO_TYPE(type), 1));
+    launchpad_add_handle(lp, handles[1], MX_HND_INFO(MX_HND_INFO_TYPE(type), 2));
+
+    launchpad_clone(lp, LP_CLONE_MXIO_ROOT | LP_CLONE_MXIO_CWD | LP_CLONE_ENVIRON);
+    *fd_out = fd;
+    return launchpad_get_status(lp);
+}
+
+// Collects what the test writes into |out| until it and anything it started
+// in its job are gone.
+static void collect_output(int fd, mx_handle_t proc, mx_handle_t job, output_t* out) {
+    bool killed = false;
+    for (;;) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, killed ? -1 : 100);
+        if (ready > 0) {
+            char buf[1024];
+            ssize_t len = read(fd, buf, sizeof(buf));
+            if (len > 0) {
+                output_append(out, buf, len);
+                continue;
+            }
+            if (len == 0 || errno != EAGAIN) {
+                break;
+            }
+        } else if (ready < 0) {
+            break;
+        }
+
+        // Once the test itself is done, don't wait on anything it left behind.
+        if (!killed &&
+            mx_handle_wait_one(proc, MX_PROCESS_SIGNALED, 0, NULL) == NO_ERROR) {
+            mx_task_kill(job);
+            killed = true;
+        }
+    }
+}
+
+// With |out| the test runs in a job of its own with its output collected
+// there, otherwise it shares our stdio.
+static void run_test(test_t* test, output_t* out) {
+    if (verbosity) {
+        output_printf(out,
+                      "\n------------------------------------------------\n"
+                      "RUNNING TEST: %s\n\n",
+                      test->name);
+    }
+
+    char verbose_opt[] = {'v','=', verbosity + '0', 0};
+    const char* argv[] = {test->path, verbose_opt};
+    int argc = verbosity >= 0 ? 2 : 1;
+
+    mx_handle_t job = MX_HANDLE_INVALID;
+    if (out != NULL && mx_job_create(mx_job_default(), 0, &job) < 0) {
+        job = MX_HANDLE_INVALID;
+    }
+
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    // launchpad_create() hands the test a handle to the job it runs in, so
+    // whatever it starts lands in the job too and goes away with it.
+    launchpad_t* lp;
+    launchpad_create(job, test->name, &lp);
+    launchpad_load_from_file(lp, argv[0]);
+    int fd = -1;
+    if (job != MX_HANDLE_INVALID) {
+        launch_buffered(lp, &fd);
+    } else {
+        launchpad_clone(lp, LP_CLONE_ALL);
+    }
+    launchpad_set_args(lp, argc, argv);
+    const char* errmsg;
+    mx_handle_t handle;
+    mx_status_t status = launchpad_go(lp, &handle, &errmsg);
+
+    if (status >= 0 && fd >= 0) {
+        collect_output(fd, handle, job, out);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    int cause = -1;
+    int rc = 0;
+    if (status < 0) {
+        output_printf(out, "FAILURE: Failed to launch %s: %d: %s\n", test->name, status, errmsg);
+        cause = FAILED_TO_LAUNCH;
+    } else {
         status = mx_handle_wait_one(handle, MX_PROCESS_SIGNALED,
                                     MX_TIME_INFINITE, NULL);
         if (status != NO_ERROR) {
-            printf("FAILURE: Failed to wait for process exiting %s: %d\n", de->d_name, status);
-            fail_test(&failures, de->d_name, FAILED_TO_WAIT, 0);
-            failed_count++;
-            continue;
+            output_printf(out, "FAILURE: Failed to wait for process exiting %s: %d\n",
+                          test->name, status);
+            cause = FAILED_TO_WAIT;
         }
+    }
+
+    test->time = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+    test->ran = true;
 
+    if (cause < 0) {
         // read the return code
         mx_info_process_t proc_info;
         status = mx_object_get_info(handle, MX_INFO_PROCESS, &proc_info, sizeof(proc_info), NULL, NULL);
-        mx_handle_close(handle);
 
         if (status < 0) {
-            printf("FAILURE: Failed to get process return code %s: %d\n", de->d_name, status);
-            fail_test(&failures, de->d_name, FAILED_TO_RETURN_CODE, 0);
-            failed_count++;
-            continue;
+            output_printf(out, "FAILURE: Failed to get process return code %s: %d\n",
+                          test->name, status);
+            cause = FAILED_TO_RETURN_CODE;
+        } else if (proc_info.return_code == 0) {
+            output_printf(out, "PASSED: %s passed (%" PRIu64 " ms)\n",
+                          test->name, test->time / MX_MSEC(1));
+        } else {
+            output_printf(out, "FAILED: %s exited with nonzero status: %d (%" PRIu64 " ms)\n",
+                          test->name, proc_info.return_code, test->time / MX_MSEC(1));
+            cause = FAILED_NONZERO_RETURN_CODE;
+            rc = proc_info.return_code;
         }
+    }
+    if (cause != FAILED_TO_LAUNCH) {
+        mx_handle_close(handle);
+    }
+    if (job != MX_HANDLE_INVALID) {
+        mx_task_kill(job);
+        mx_handle_close(job);
+    }
 
-        if (proc_info.return_code == 0) {
-            printf("PASSED: %s passed\n", de->d_name);
-        } else {
-            printf("FAILED: %s exited with nonzero status: %d\n", de->d_name, proc_info.return_code);
-            fail_test(&failures, de->d_name, FAILED_NONZERO_RETURN_CODE, proc_info.return_code);
-            failed_count++;
+    mtx_lock(&results_lock);
+    total_count++;
+    if (cause >= 0) {
+        fail_test(&failures, test->name, cause, rc);
+        failed_count++;
+    }
+    if (out != NULL) {
+        fwrite(out->data, 1, out->len, stdout);
+        fflush(stdout);
+    }
+    mtx_unlock(&results_lock);
+}
+
+static size_t next_test;
+
+static int parallel_worker(void* arg) {
+    for (;;) {
+        mtx_lock(&results_lock);
+        size_t i = next_test++;
+        mtx_unlock(&results_lock);
+        if (i >= num_tests) {
+            return 0;
         }
+
+        output_t out = {};
+        run_test(&tests[i], &out);
+        free(out.data);
     }
+}
 
-    closedir(dir);
+static void run_tests_parallel(int jobs) {
+    qsort(tests, num_tests, sizeof(test_t), compare_last_time);
+
+    thrd_t threads[jobs];
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (thrd_create(&threads[started], parallel_worker, NULL) != thrd_success) {
+            break;
+        }
+    }
+    if (started == 0) {
+        parallel_worker(NULL);
+    }
+    for (int i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
 }
 
 int main(int argc, char** argv) {
-    if (argc > 1) {
-        if (strcmp(argv[1], "-q") == 0) {
+    int jobs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
             verbosity = 0;
-        } else if (strcmp(argv[1], "-v") == 0) {
+        } else if (strcmp(argv[i], "-v") == 0) {
             printf("verbose output. enjoy.\n");
             verbosity = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            times_path = argv[++i];
         } else {
-            printf("unknown option. usage: %s [-q|-v]\n", argv[0]);
+            printf("unknown option. usage: %s [-q|-v] [-j <tests at once>] [-t <times file>]\n",
+                   argv[0]);
             return -1;
         }
     }
 
-    run_tests("/boot/test");
-    run_tests("/system/test");
+    find_tests("/boot/test");
+    find_tests("/system/test");
+    read_times();
+
+    mx_time_t start = mx_time_get(MX_CLOCK_MONOTONIC);
+    if (jobs > 1) {
+        run_tests_parallel(jobs);
+    } else {
+        for (size_t i = 0; i < num_tests; i++) {
+            run_test(&tests[i], NULL);
+        }
+    }
+    mx_time_t elapsed = mx_time_get(MX_CLOCK_MONOTONIC) - start;
+
+    write_times();
 
-    printf("\nSUMMARY: Ran %d tests: %d failed\n", total_count, failed_count);
+    printf("\nSUMMARY: Ran %d tests: %d failed (%" PRIu64 " ms)\n",
+           total_count, failed_count, elapsed / MX_MSEC(1));
 
     if (failed_count) {
         printf("\nThe following tests failed:\n");
@@ -163,5 +438,6 @@ int main(int argc, char** argv) {
         }
     }
 
+    free(tests);
     return 0;
 }
@@ -3,8 +3,10 @@
 // found in the LICENSE file.
 
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
 
@@ -14,7 +16,10 @@
 
 #include <magenta/syscalls.h>
 
-uint8_t buf[32 * 1024];
+// Files are hashed this many at a time, side by side.
+#define MAX_PARALLEL 8
+
+uint8_t buf[MAX_PARALLEL][32 * 1024];
 
 int usage(int argc, char** argv) {
     fprintf(stderr,
@@ -25,47 +30,100 @@ int usage(int argc, char** argv) {
     return 1;
 }
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        fprintf(stderr, "error: invalid arguments\n");
-        return usage(argc, argv);
+// Fills |out| from |fd|, short only at the end of the file.
+static ssize_t read_full(int fd, uint8_t* out, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t r = read(fd, out + off, len - off);
+        if (r < 0) {
+            return r;
+        }
+        if (r == 0) {
+            break;
+        }
+        off += r;
     }
+    return off;
+}
 
-    if (argv[1][0] == '-')
-        return usage(argc, argv);
-
-    for (int i = 1; i < argc; ++i) {
-        int fd = open(argv[i], O_RDONLY);
-        if (fd < 0) {
-            fprintf(stderr, "error: cannot open %s for read\n", argv[i]);
+// Hashes |n| files at once: each pass reads a buffer from every file not
+// yet done, and those buffers that are full are hashed together.
+static int hash_files(char** names, int n) {
+    int fds[MAX_PARALLEL];
+    clSHA256_CTX ctx[MAX_PARALLEL];
+    bool done[MAX_PARALLEL];
+
+    for (int i = 0; i < n; ++i) {
+        fds[i] = open(names[i], O_RDONLY);
+        if (fds[i] < 0) {
+            fprintf(stderr, "error: cannot open %s for read\n", names[i]);
             return 1;
         }
+        clSHA256_init(&ctx[i]);
+        done[i] = false;
+    }
 
-        clSHA256_CTX ctx;
-        clSHA256_init(&ctx);
+    int left = n;
+    while (left > 0) {
+        clSHA256_CTX* full_ctx[MAX_PARALLEL];
+        const void* full_data[MAX_PARALLEL];
+        int full = 0;
 
-        while (1) {
-            int r = read(fd, buf, sizeof(buf));
+        for (int i = 0; i < n; ++i) {
+            if (done[i]) {
+                continue;
+            }
+            ssize_t r = read_full(fds[i], buf[i], sizeof(buf[i]));
             if (r < 0) {
-                fprintf(stderr, "error: failure %d reading file\n", r);
+                fprintf(stderr, "error: failure %zd reading file\n", r);
                 return 1;
             }
-            if (r == 0) {
-                break;
+            if (r == (ssize_t)sizeof(buf[i])) {
+                full_ctx[full] = &ctx[i];
+                full_data[full] = buf[i];
+                full++;
+            } else {
+                clHASH_update(&ctx[i], buf[i], r);
+                close(fds[i]);
+                done[i] = true;
+                left--;
             }
-
-            clHASH_update(&ctx, buf, r);
         }
 
-        close(fd);
+        if (full > 0) {
+            clSHA256_update_multi(full_ctx, full_data, sizeof(buf[0]), full);
+        }
+    }
 
-        const uint8_t* hash = clHASH_final(&ctx);
+    for (int i = 0; i < n; ++i) {
+        const uint8_t* hash = clHASH_final(&ctx[i]);
 
         for (int ix = 0; ix != clSHA256_DIGEST_SIZE; ++ix) {
             printf("%02x", ((uint8_t*)hash)[ix]);
         }
 
-        printf("  %s\n", argv[i]);
+        printf("  %s\n", names[i]);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "error: invalid arguments\n");
+        return usage(argc, argv);
+    }
+
+    if (argv[1][0] == '-')
+        return usage(argc, argv);
+
+    for (int i = 1; i < argc; i += MAX_PARALLEL) {
+        int n = argc - i;
+        if (n > MAX_PARALLEL) {
+            n = MAX_PARALLEL;
+        }
+        if (hash_files(&argv[i], n) != 0) {
+            return 1;
+        }
     }
     return 0;
 }
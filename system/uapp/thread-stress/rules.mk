@@ -8,7 +8,9 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_TYPE := userapp
 
-MODULE_SRCS += $(LOCAL_DIR)/thread-stress.c
+MODULE_SRCS += \
+    $(LOCAL_DIR)/scaling.c \
+    $(LOCAL_DIR)/thread-stress.c \
 
 MODULE_NAME := thread-stress-test
 
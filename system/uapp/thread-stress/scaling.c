@@ -0,0 +1,403 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "scaling.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+
+// Every measurement is made with 1..N workers busy at once, a worker being
+// a pair of threads for the two ping-pongs, so that a run queue or a lock
+// shared across cpus shows up as a curve that flattens (or falls) instead
+// of growing with the cpus.
+
+typedef struct {
+    uint32_t max_level;
+    uint64_t duration_ns;
+    uint32_t rounds;
+} options_t;
+
+static uint64_t now_ns(void) {
+    return mx_time_get(MX_CLOCK_MONOTONIC);
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Returns how many of the |count| threads were started, each with its own
+// element of |args|. Those that were are for the caller to stop and join.
+static uint32_t start_threads(thrd_t* threads, uint32_t count, thrd_start_t fn,
+                              void* args, size_t arg_size, const char* name) {
+    for (uint32_t i = 0; i < count; i++) {
+        int ret = thrd_create_with_name(&threads[i], fn, (char*)args + i * arg_size, name);
+        if (ret != thrd_success) {
+            printf("Failed to create thread: %d\n", ret);
+            return i;
+        }
+    }
+    return count;
+}
+
+static void join_threads(thrd_t* threads, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        thrd_join(threads[i], NULL);
+}
+
+// Wakeup latency: the time from a futex wake to the woken thread running.
+
+enum { PING = 0, PONG = 1, DONE = 2 };
+
+typedef struct {
+    mx_futex_t state;
+    uint64_t sent_ns;
+    uint64_t* latencies;
+    uint32_t rounds;
+} wakeup_pair_t;
+
+static void wait_while(mx_futex_t* futex, int value) {
+    while (atomic_load(futex) == value)
+        mx_futex_wait(futex, value, MX_TIME_INFINITE);
+}
+
+static void set_and_wake(mx_futex_t* futex, int value) {
+    atomic_store(futex, value);
+    mx_futex_wake(futex, 1);
+}
+
+static int wakeup_ping(void* arg) {
+    wakeup_pair_t* pair = arg;
+    for (uint32_t i = 0; i < pair->rounds; i++) {
+        pair->sent_ns = now_ns();
+        set_and_wake(&pair->state, PONG);
+        wait_while(&pair->state, PONG);
+    }
+    set_and_wake(&pair->state, DONE);
+    return 0;
+}
+
+static int wakeup_pong(void* arg) {
+    wakeup_pair_t* pair = arg;
+    for (uint32_t i = 0;; i++) {
+        wait_while(&pair->state, PING);
+        if (atomic_load(&pair->state) == DONE)
+            break;
+        pair->latencies[i] = now_ns() - pair->sent_ns;
+        set_and_wake(&pair->state, PING);
+    }
+    return 0;
+}
+
+// Fills in the median and 99th percentile wakeup latencies of |level| pairs.
+static bool measure_wakeup(const options_t* opts, uint32_t level,
+                           uint64_t* p50, uint64_t* p99) {
+    uint64_t* latencies = calloc((size_t)level * opts->rounds, sizeof(uint64_t));
+    wakeup_pair_t* pairs = calloc(level, sizeof(wakeup_pair_t));
+    thrd_t* threads = calloc(level * 2, sizeof(thrd_t));
+    bool ok = latencies && pairs && threads;
+
+    if (ok) {
+        for (uint32_t i = 0; i < level; i++) {
+            atomic_init(&pairs[i].state, PING);
+            pairs[i].latencies = latencies + (size_t)i * opts->rounds;
+            pairs[i].rounds = opts->rounds;
+        }
+        uint32_t pongs = start_threads(threads, level, wakeup_pong, pairs, sizeof(*pairs),
+                                       "wakeup-pong");
+        uint32_t pings = 0;
+        if (pongs == level)
+            pings = start_threads(threads + level, level, wakeup_ping, pairs, sizeof(*pairs),
+                                  "wakeup-ping");
+        ok = pings == level;
+        // the pongs of pings that ran are told they are done by them
+        join_threads(threads + level, pings);
+        for (uint32_t i = pings; i < pongs; i++)
+            set_and_wake(&pairs[i].state, DONE);
+        join_threads(threads, pongs);
+    }
+
+    if (ok) {
+        size_t count = (size_t)level * opts->rounds;
+        qsort(latencies, count, sizeof(uint64_t), cmp_u64);
+        *p50 = latencies[count / 2];
+        *p99 = latencies[count * 99 / 100];
+    }
+    free(threads);
+    free(pairs);
+    free(latencies);
+    return ok;
+}
+
+// Yield ping-pong: two threads that each yield until it is their turn.
+
+typedef struct {
+    atomic_int turn;
+    atomic_bool* stop;
+    uint64_t handoffs[2];
+} yield_pair_t;
+
+typedef struct {
+    yield_pair_t* pair;
+    int self;
+} yield_arg_t;
+
+static int yield_thread(void* arg) {
+    yield_arg_t* ya = arg;
+    yield_pair_t* pair = ya->pair;
+    uint64_t handoffs = 0;
+
+    while (!atomic_load(pair->stop)) {
+        if (atomic_load(&pair->turn) != ya->self) {
+            mx_nanosleep(0);
+            continue;
+        }
+        atomic_store(&pair->turn, !ya->self);
+        handoffs++;
+    }
+    pair->handoffs[ya->self] = handoffs;
+    return 0;
+}
+
+// Returns the ns each handoff took, across all of |level| pairs at once.
+static bool measure_yield(const options_t* opts, uint32_t level, uint64_t* ns_per_handoff) {
+    atomic_bool stop;
+    atomic_init(&stop, false);
+    yield_pair_t* pairs = calloc(level, sizeof(yield_pair_t));
+    yield_arg_t* args = calloc(level * 2, sizeof(yield_arg_t));
+    thrd_t* threads = calloc(level * 2, sizeof(thrd_t));
+    bool ok = pairs && args && threads;
+
+    uint64_t elapsed = 0;
+    if (ok) {
+        for (uint32_t i = 0; i < level; i++) {
+            atomic_init(&pairs[i].turn, 0);
+            pairs[i].stop = &stop;
+            args[i * 2] = (yield_arg_t){ &pairs[i], 0 };
+            args[i * 2 + 1] = (yield_arg_t){ &pairs[i], 1 };
+        }
+        uint64_t start = now_ns();
+        uint32_t started = start_threads(threads, level * 2, yield_thread, args,
+                                         sizeof(*args), "yield");
+        ok = started == level * 2;
+        if (ok)
+            mx_nanosleep(opts->duration_ns);
+        atomic_store(&stop, true);
+        join_threads(threads, started);
+        elapsed = now_ns() - start;
+    }
+
+    if (ok) {
+        uint64_t handoffs = 0;
+        for (uint32_t i = 0; i < level; i++)
+            handoffs += pairs[i].handoffs[0] + pairs[i].handoffs[1];
+        *ns_per_handoff = handoffs ? elapsed * level / handoffs : 0;
+    }
+    free(threads);
+    free(args);
+    free(pairs);
+    return ok;
+}
+
+// Thread create/join: each worker makes and joins empty threads.
+
+typedef struct {
+    atomic_bool* stop;
+    uint64_t count;
+    bool failed;
+} churn_worker_t;
+
+static int empty_thread(void* arg) {
+    return 0;
+}
+
+static int churn_thread(void* arg) {
+    churn_worker_t* worker = arg;
+    while (!atomic_load(worker->stop)) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, empty_thread, NULL, "churn-child") != thrd_success ||
+            thrd_join(t, NULL) != thrd_success) {
+            worker->failed = true;
+            break;
+        }
+        worker->count++;
+    }
+    return 0;
+}
+
+// Returns the threads made and joined per second by |level| workers together.
+static bool measure_churn(const options_t* opts, uint32_t level, uint64_t* per_sec) {
+    atomic_bool stop;
+    atomic_init(&stop, false);
+    churn_worker_t* workers = calloc(level, sizeof(churn_worker_t));
+    thrd_t* threads = calloc(level, sizeof(thrd_t));
+    bool ok = workers && threads;
+
+    uint64_t elapsed = 0;
+    if (ok) {
+        for (uint32_t i = 0; i < level; i++)
+            workers[i].stop = &stop;
+        uint64_t start = now_ns();
+        uint32_t started = start_threads(threads, level, churn_thread, workers,
+                                         sizeof(*workers), "churn");
+        ok = started == level;
+        if (ok)
+            mx_nanosleep(opts->duration_ns);
+        atomic_store(&stop, true);
+        join_threads(threads, started);
+        elapsed = now_ns() - start;
+    }
+
+    if (ok) {
+        uint64_t count = 0;
+        for (uint32_t i = 0; i < level; i++) {
+            count += workers[i].count;
+            ok = ok && !workers[i].failed;
+        }
+        *per_sec = elapsed ? count * 1000000000ull / elapsed : 0;
+    }
+    free(threads);
+    free(workers);
+    return ok;
+}
+
+// Fairness: twice as many spinning threads as the level, so that the cpus
+// are shared once the level passes half of them, and what each got is
+// compared with Jain's index, (sum x)^2 / (n * sum x^2), which is 1 when all
+// got the same and 1/n when one got everything.
+
+typedef struct {
+    atomic_bool* stop;
+    uint64_t spins;
+} spinner_t;
+
+static int spin_thread(void* arg) {
+    spinner_t* spinner = arg;
+    uint64_t spins = 0;
+    while (!atomic_load_explicit(spinner->stop, memory_order_relaxed))
+        spins++;
+    spinner->spins = spins;
+    return 0;
+}
+
+// Fills in Jain's index and the least share over the greatest, in percent.
+static bool measure_fairness(const options_t* opts, uint32_t level,
+                             uint32_t* jain_pct, uint32_t* min_max_pct) {
+    uint32_t count = level * 2;
+    atomic_bool stop;
+    atomic_init(&stop, false);
+    spinner_t* spinners = calloc(count, sizeof(spinner_t));
+    thrd_t* threads = calloc(count, sizeof(thrd_t));
+    bool ok = spinners && threads;
+
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++)
+            spinners[i].stop = &stop;
+        uint32_t started = start_threads(threads, count, spin_thread, spinners,
+                                         sizeof(*spinners), "spin");
+        ok = started == count;
+        if (ok)
+            mx_nanosleep(opts->duration_ns);
+        atomic_store(&stop, true);
+        join_threads(threads, started);
+    }
+
+    if (ok) {
+        double sum = 0, sum_sq = 0;
+        uint64_t min = UINT64_MAX, max = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            double x = (double)spinners[i].spins;
+            sum += x;
+            sum_sq += x * x;
+            if (spinners[i].spins < min)
+                min = spinners[i].spins;
+            if (spinners[i].spins > max)
+                max = spinners[i].spins;
+        }
+        *jain_pct = sum_sq > 0 ? (uint32_t)(100 * sum * sum / (count * sum_sq)) : 0;
+        *min_max_pct = max ? (uint32_t)(min * 100 / max) : 0;
+    }
+    free(threads);
+    free(spinners);
+    return ok;
+}
+
+static void usage(const char* mode) {
+    printf("usage: thread-stress-test %s [-n <max workers>] [-t <ms>] [-r <rounds>]\n"
+           "  -n  measure with 1..n workers at once (default: the number of cpus)\n"
+           "  -t  how long each throughput and fairness measurement runs (default: 200)\n"
+           "  -r  wakeups each pair measures (default: 2000)\n",
+           mode);
+}
+
+int scaling_main(int argc, char** argv) {
+    options_t opts = {
+        .max_level = mx_num_cpus(),
+        .duration_ns = 200 * 1000000ull,
+        .rounds = 2000,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            opts.max_level = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            opts.duration_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+            break;
+        case 'r':
+            opts.rounds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.max_level == 0 || opts.rounds == 0 || opts.duration_ns == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("Scheduler scaling on %u cpus, 1..%u workers\n", mx_num_cpus(), opts.max_level);
+    printf("%7s %12s %12s %12s %8s %14s %8s %6s %8s\n",
+           "workers", "wake p50 ns", "wake p99 ns", "yield ns", "speedup",
+           "create/join/s", "speedup", "jain%", "min/max%");
+
+    uint64_t base_yield = 0;
+    uint64_t base_churn = 0;
+    for (uint32_t level = 1; level <= opts.max_level; level++) {
+        uint64_t p50, p99, yield_ns, churn;
+        uint32_t jain, min_max;
+        if (!measure_wakeup(&opts, level, &p50, &p99) ||
+            !measure_yield(&opts, level, &yield_ns) ||
+            !measure_churn(&opts, level, &churn) ||
+            !measure_fairness(&opts, level, &jain, &min_max)) {
+            printf("%7u failed\n", level);
+            return 1;
+        }
+        if (level == 1) {
+            base_yield = yield_ns;
+            base_churn = churn;
+        }
+        // the speedups are of throughput over that of one worker, so on an
+        // ideal scheduler they would equal the workers up to the cpus
+        uint64_t yield_speedup = yield_ns ? base_yield * level * 100 / yield_ns : 0;
+        uint64_t churn_speedup = base_churn ? churn * 100 / base_churn : 0;
+        printf("%7u %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %5" PRIu64 ".%02" PRIu64
+               " %14" PRIu64 " %5" PRIu64 ".%02" PRIu64 " %6u %8u\n",
+               level, p50, p99, yield_ns, yield_speedup / 100, yield_speedup % 100,
+               churn, churn_speedup / 100, churn_speedup % 100, jain, min_max);
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// Measures how the scheduler scales from one worker to one per cpu and
+// prints a line per level. |argv[0]| is the name of the mode.
+int scaling_main(int argc, char** argv);
@@ -3,10 +3,13 @@
 // found in the LICENSE file.
 
 #include <stdio.h>
+#include <string.h>
 #include <threads.h>
 
 #include <magenta/syscalls.h>
 
+#include "scaling.h"
+
 #define NUM_THREADS 1000
 
 static int thread_func(void* arg) {
@@ -28,6 +31,9 @@ static void thread_join(thrd_t thread) {
 }
 
 int main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "scale"))
+        return scaling_main(argc - 1, argv + 1);
+
     printf("Running thread stress test...\n");
     thrd_t thread[NUM_THREADS];
     while (true) {
@@ -10,6 +10,8 @@ MODULE_TYPE := userapp
 
 MODULE_SRCS += $(LOCAL_DIR)/traceme.c
 
+MODULE_STATIC_LIBS := ulib/trace
+
 MODULE_LIBS := ulib/magenta ulib/mxio ulib/musl
 
 include make/module.mk
@@ -7,11 +7,17 @@
 #include <unistd.h>
 
 #include <magenta/device/ktrace.h>
+#include <trace/trace.h>
 
 // 1. Run:            magenta> traceme
 // 2. Stop tracing:   magenta> dm ktraceoff
 // 3. Grab trace:     host> netcp :/dev/class/misc/ktrace test.trace
-// 4. Examine trace:  host> tracevic test.trace
+//                    host> netcp :/tmp/traceme.trace user.trace
+// 4. Examine trace:  host> cat user.trace >> test.trace
+//                    host> tracevic test.trace
+//
+// The userspace trace events in /tmp/traceme.trace share the kernel trace's
+// timebase and thread ids, so appending them gives one trace of both.
 
 int main(int argc, char** argv) {
     int fd;
@@ -37,11 +43,31 @@ int main(int argc, char** argv) {
     // once all probes are registered, you can close the device
     close(fd);
 
+    // userspace trace events go to a trace buffer of our own
+    if (trace_start(64 * 1024) < 0) {
+        fprintf(stderr, "cannot start userspace tracing\n");
+        return -1;
+    }
+    uint32_t hello = trace_name("hello");
+
     // use the ktrace handle to emit probes into the trace stream
     mx_ktrace_write(kth, id, 1, 0);
-    printf("hello, ktrace! id = %u\n", id);
+    {
+        TRACE_DURATION(hello);
+        printf("hello, ktrace! id = %u\n", id);
+        trace_counter(trace_name("probe-id"), id);
+    }
     mx_ktrace_write(kth, id, 2, 0);
 
+    size_t len;
+    const void* records = trace_records(&len);
+    if ((fd = open("/tmp/traceme.trace", O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+            write(fd, records, len) != (ssize_t)len) {
+        fprintf(stderr, "cannot write userspace trace\n");
+        return -1;
+    }
+    close(fd);
+
     return 0;
 }
 
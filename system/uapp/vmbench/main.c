@@ -0,0 +1,453 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <sys/param.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+
+// vmbench times the VMO and VMAR operations at each of a list of sizes and
+// thread counts, and reports rates and latency percentiles as JSON on
+// stdout, for tracking across builds.
+//
+// Each thread works on VMOs and mappings of its own, all in the root VMAR,
+// so more threads show how the operations scale on a shared address space:
+// the unmap and protect of one thread shoot down the TLBs of the cpus the
+// others run on.
+
+#define MAX_THREADS 16
+#define MAX_SIZES   16
+
+// latencies are counted in buckets of 1/8th of a power of two of ns
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS  (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    uint64_t hist[HIST_BUCKETS];
+} stats_t;
+
+typedef struct {
+    mx_time_t duration;
+    uint64_t sizes[MAX_SIZES];
+    uint32_t num_sizes;
+    uint32_t max_threads;
+    // the operation to run, or NULL for all of them
+    const char* only;
+} config_t;
+
+typedef struct worker worker_t;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    mx_status_t (*run)(worker_t* w);
+} bench_t;
+
+struct worker {
+    const bench_t* bench;
+    uint64_t size;
+    mx_time_t end;
+    thrd_t thread;
+    mx_status_t status;
+    stats_t stats;
+};
+
+static unsigned hist_bucket(uint64_t ns) {
+    if (ns < HIST_SUB) {
+        return (unsigned)ns;
+    }
+    unsigned log = 63 - __builtin_clzll(ns);
+    unsigned sub = (unsigned)(ns >> (log - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (log - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// the middle of the latencies a bucket counts
+static uint64_t hist_value(unsigned bucket) {
+    if (bucket < HIST_SUB) {
+        return bucket;
+    }
+    unsigned log = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t base = (1ull << log) + ((uint64_t)(bucket % HIST_SUB) << (log - HIST_SUB_BITS));
+    return base + (1ull << (log - HIST_SUB_BITS)) / 2;
+}
+
+static void stats_add(stats_t* s, uint64_t bytes, uint64_t ns) {
+    if ((s->ops == 0) || (ns < s->lat_min)) {
+        s->lat_min = ns;
+    }
+    s->lat_max = MAX(s->lat_max, ns);
+    s->ops++;
+    s->bytes += bytes;
+    s->lat_sum += ns;
+    s->hist[hist_bucket(ns)]++;
+}
+
+static void stats_merge(stats_t* s, const stats_t* from) {
+    if (from->ops == 0) {
+        return;
+    }
+    if ((s->ops == 0) || (from->lat_min < s->lat_min)) {
+        s->lat_min = from->lat_min;
+    }
+    s->lat_max = MAX(s->lat_max, from->lat_max);
+    s->ops += from->ops;
+    s->bytes += from->bytes;
+    s->lat_sum += from->lat_sum;
+    for (unsigned n = 0; n < HIST_BUCKETS; n++) {
+        s->hist[n] += from->hist[n];
+    }
+}
+
+// the latency that permille thousandths of the operations took at most
+static uint64_t stats_percentile(const stats_t* s, unsigned permille) {
+    uint64_t want = (s->ops * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (unsigned n = 0; n < HIST_BUCKETS; n++) {
+        seen += s->hist[n];
+        if ((seen >= want) && (seen > 0)) {
+            return MIN(MAX(hist_value(n), s->lat_min), s->lat_max);
+        }
+    }
+    return s->lat_max;
+}
+
+static mx_time_t now(void) {
+    return mx_time_get(MX_CLOCK_MONOTONIC);
+}
+
+static const uint32_t kRw = MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE;
+
+static mx_status_t bench_create(worker_t* w) {
+    while (now() < w->end) {
+        mx_handle_t vmo;
+        mx_time_t t0 = now();
+        mx_status_t status = mx_vmo_create(w->size, 0, &vmo);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        mx_handle_close(vmo);
+        stats_add(&w->stats, w->size, now() - t0);
+    }
+    return NO_ERROR;
+}
+
+static mx_status_t bench_commit(worker_t* w) {
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(w->size, 0, &vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    while (now() < w->end) {
+        mx_time_t t0 = now();
+        if ((status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, w->size, NULL, 0)) != NO_ERROR ||
+            (status = mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, w->size, NULL, 0)) != NO_ERROR) {
+            break;
+        }
+        stats_add(&w->stats, w->size, now() - t0);
+    }
+    mx_handle_close(vmo);
+    return status;
+}
+
+static mx_status_t bench_rw(worker_t* w, bool write) {
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(w->size, 0, &vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    uint8_t* buf = malloc(w->size);
+    if (buf == NULL) {
+        mx_handle_close(vmo);
+        return ERR_NO_MEMORY;
+    }
+    memset(buf, 0x5a, w->size);
+
+    // reads are of pages that are there, and writes are to them
+    size_t actual;
+    if ((status = mx_vmo_write(vmo, buf, 0, w->size, &actual)) == NO_ERROR) {
+        while (now() < w->end) {
+            mx_time_t t0 = now();
+            status = write ? mx_vmo_write(vmo, buf, 0, w->size, &actual)
+                           : mx_vmo_read(vmo, buf, 0, w->size, &actual);
+            if (status != NO_ERROR) {
+                break;
+            }
+            stats_add(&w->stats, actual, now() - t0);
+        }
+    }
+    free(buf);
+    mx_handle_close(vmo);
+    return status;
+}
+
+static mx_status_t bench_write(worker_t* w) {
+    return bench_rw(w, true);
+}
+
+static mx_status_t bench_read(worker_t* w) {
+    return bench_rw(w, false);
+}
+
+static mx_status_t bench_map(worker_t* w) {
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(w->size, 0, &vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    if ((status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, w->size, NULL, 0)) == NO_ERROR) {
+        while (now() < w->end) {
+            uintptr_t addr;
+            mx_time_t t0 = now();
+            if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, w->size, kRw,
+                                      &addr)) != NO_ERROR ||
+                (status = mx_vmar_unmap(mx_vmar_root_self(), addr, w->size)) != NO_ERROR) {
+                break;
+            }
+            stats_add(&w->stats, w->size, now() - t0);
+        }
+    }
+    mx_handle_close(vmo);
+    return status;
+}
+
+// An operation is the first touch of every page of a fresh mapping: only the
+// touches are timed, not the making and unmapping of the VMO.
+static mx_status_t bench_fault(worker_t* w) {
+    mx_status_t status = NO_ERROR;
+    while (now() < w->end) {
+        mx_handle_t vmo;
+        uintptr_t addr;
+        if ((status = mx_vmo_create(w->size, 0, &vmo)) != NO_ERROR) {
+            break;
+        }
+        if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, w->size, kRw,
+                                  &addr)) != NO_ERROR) {
+            mx_handle_close(vmo);
+            break;
+        }
+        volatile uint8_t* p = (volatile uint8_t*)addr;
+        mx_time_t t0 = now();
+        for (uint64_t off = 0; off < w->size; off += PAGE_SIZE) {
+            p[off] = 1;
+        }
+        stats_add(&w->stats, w->size, now() - t0);
+        mx_vmar_unmap(mx_vmar_root_self(), addr, w->size);
+        mx_handle_close(vmo);
+    }
+    return status;
+}
+
+static mx_status_t bench_protect(worker_t* w) {
+    mx_handle_t vmo;
+    uintptr_t addr;
+    mx_status_t status = mx_vmo_create(w->size, 0, &vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, w->size, kRw, &addr);
+    mx_handle_close(vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    // the pages are there to be protected
+    volatile uint8_t* p = (volatile uint8_t*)addr;
+    for (uint64_t off = 0; off < w->size; off += PAGE_SIZE) {
+        p[off] = 1;
+    }
+    for (uint64_t n = 0; now() < w->end; n++) {
+        uint32_t prot = (n & 1) ? kRw : MX_VM_FLAG_PERM_READ;
+        mx_time_t t0 = now();
+        if ((status = mx_vmar_protect(mx_vmar_root_self(), addr, w->size, prot)) != NO_ERROR) {
+            break;
+        }
+        stats_add(&w->stats, w->size, now() - t0);
+    }
+    mx_vmar_unmap(mx_vmar_root_self(), addr, w->size);
+    return status;
+}
+
+static const bench_t kBenchmarks[] = {
+    { "vmo_create", "mx_vmo_create and close", bench_create },
+    { "vmo_commit", "commit and decommit the whole VMO", bench_commit },
+    { "vmo_write", "mx_vmo_write of the whole VMO", bench_write },
+    { "vmo_read", "mx_vmo_read of the whole VMO", bench_read },
+    { "vmar_map", "map and unmap the whole committed VMO", bench_map },
+    { "fault", "first touch of every page of a mapping", bench_fault },
+    { "vmar_protect", "protect the whole mapping, read-only and back", bench_protect },
+};
+
+static int worker_thread(void* arg) {
+    worker_t* w = arg;
+    w->status = w->bench->run(w);
+    return 0;
+}
+
+// Runs |bench| at |size| on |threads| threads at once and prints the result
+// as an element of the "results" array.
+static int run_one(const config_t* cfg, const bench_t* bench, uint64_t size, uint32_t threads,
+                   bool first) {
+    static worker_t workers[MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+
+    mx_time_t t0 = now();
+    uint32_t started = 0;
+    for (; started < threads; started++) {
+        worker_t* w = &workers[started];
+        w->bench = bench;
+        w->size = size;
+        w->end = t0 + cfg->duration;
+        if (thrd_create_with_name(&w->thread, worker_thread, w, "vmbench") != thrd_success) {
+            fprintf(stderr, "vmbench: cannot start thread %u\n", started);
+            break;
+        }
+    }
+    stats_t stats = {};
+    int rc = (started == threads) ? 0 : -1;
+    for (uint32_t n = 0; n < started; n++) {
+        thrd_join(workers[n].thread, NULL);
+        if (workers[n].status != NO_ERROR) {
+            fprintf(stderr, "vmbench: %s of %" PRIu64 " bytes, thread %u failed: %d\n",
+                    bench->name, size, n, workers[n].status);
+            rc = -1;
+        }
+        stats_merge(&stats, &workers[n].stats);
+    }
+    mx_time_t elapsed = now() - t0;
+
+    uint64_t ms = MAX(elapsed / 1000000, 1u);
+    printf("%s\n    {\"op\": \"%s\", \"size\": %" PRIu64 ", \"threads\": %u, "
+           "\"runtime_ns\": %" PRIu64 ",\n", first ? "" : ",", bench->name, size, started,
+           elapsed);
+    // the pages an operation covers, which for "fault" is the faults taken
+    uint64_t pages = stats.bytes / PAGE_SIZE;
+    printf("     \"ops\": %" PRIu64 ", \"ops_per_sec\": %" PRIu64 ", "
+           "\"pages_per_sec\": %" PRIu64 ", \"bw_bytes\": %" PRIu64 ",\n",
+           stats.ops, stats.ops * 1000 / ms, pages * 1000 / ms, stats.bytes * 1000 / ms);
+    printf("     \"lat_ns\": {\"min\": %" PRIu64 ", \"mean\": %" PRIu64 ", \"max\": %" PRIu64 ", "
+           "\"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 "},\n",
+           stats.lat_min, stats.ops ? stats.lat_sum / stats.ops : 0, stats.lat_max,
+           stats_percentile(&stats, 500), stats_percentile(&stats, 900),
+           stats_percentile(&stats, 990));
+    printf("     \"status\": \"%s\"}", rc ? "failed" : "ok");
+    return rc;
+}
+
+static uint64_t arg_to_u64(const char* arg, char** endp) {
+    char* end;
+    uint64_t n = strtoull(arg, &end, 0);
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    }
+    if (endp != NULL) {
+        *endp = end;
+    }
+    return n;
+}
+
+// a comma separated list of sizes, each a multiple of the page size
+static bool parse_sizes(const char* arg, config_t* cfg) {
+    cfg->num_sizes = 0;
+    while (*arg != '\0') {
+        char* end;
+        uint64_t size = arg_to_u64(arg, &end);
+        if ((size == 0) || (size % PAGE_SIZE) || (cfg->num_sizes == MAX_SIZES) ||
+            ((*end != ',') && (*end != '\0'))) {
+            return false;
+        }
+        cfg->sizes[cfg->num_sizes++] = size;
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return cfg->num_sizes > 0;
+}
+
+static int usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -o OP     run only OP (default all of them)\n"
+            "  -s SIZES  comma separated sizes in bytes (default 4k,64k,1m,8m)\n"
+            "  -j N      run with 1, 2, 4... up to N threads (default the cpus, at most %u)\n"
+            "  -t MSECS  how long to run each case (default 100)\n"
+            "Operations:\n",
+            argv0, MAX_THREADS);
+    for (size_t n = 0; n < countof(kBenchmarks); n++) {
+        fprintf(stderr, "  %-13s %s\n", kBenchmarks[n].name, kBenchmarks[n].description);
+    }
+    fprintf(stderr, "Results are written to stdout as JSON.\n");
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    config_t cfg = {
+        .duration = MX_MSEC(100),
+        .sizes = { 4 << 10, 64 << 10, 1 << 20, 8 << 20 },
+        .num_sizes = 4,
+        .max_threads = MIN(mx_num_cpus(), MAX_THREADS),
+    };
+    int opt;
+    while ((opt = getopt(argc, argv, "o:s:j:t:h")) != -1) {
+        switch (opt) {
+        case 'o': cfg.only = optarg; break;
+        case 's':
+            if (!parse_sizes(optarg, &cfg)) {
+                return usage(argv[0]);
+            }
+            break;
+        case 'j': cfg.max_threads = (uint32_t)arg_to_u64(optarg, NULL); break;
+        case 't': cfg.duration = MX_MSEC(arg_to_u64(optarg, NULL)); break;
+        default: return usage(argv[0]);
+        }
+    }
+    if ((optind != argc) || (cfg.max_threads < 1) || (cfg.max_threads > MAX_THREADS) ||
+        (cfg.duration == 0)) {
+        return usage(argv[0]);
+    }
+    bool found = (cfg.only == NULL);
+    for (size_t n = 0; n < countof(kBenchmarks); n++) {
+        found = found || !strcmp(cfg.only, kBenchmarks[n].name);
+    }
+    if (!found) {
+        return usage(argv[0]);
+    }
+
+    printf("{\n  \"cpus\": %u, \"page_size\": %u,\n  \"results\": [", mx_num_cpus(),
+           (unsigned)PAGE_SIZE);
+    int rc = 0;
+    bool first = true;
+    for (size_t n = 0; n < countof(kBenchmarks); n++) {
+        const bench_t* bench = &kBenchmarks[n];
+        if ((cfg.only != NULL) && strcmp(cfg.only, bench->name)) {
+            continue;
+        }
+        for (uint32_t i = 0; i < cfg.num_sizes; i++) {
+            // the thread counts double, and the last is the most asked for
+            for (uint32_t threads = 1;; threads = MIN(threads * 2, cfg.max_threads)) {
+                if (run_one(&cfg, bench, cfg.sizes[i], threads, first)) {
+                    rc = -1;
+                }
+                first = false;
+                if (threads == cfg.max_threads) {
+                    break;
+                }
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+    return rc;
+}
@@ -24,6 +24,9 @@
 #define BUFFER_COUNT 2
 #define BUFFER_SIZE 16384
 
+// size of the ring buffer shared with the sink when playing with -r
+#define RING_SIZE 16384
+
 #define BUFFER_EMPTY 0
 #define BUFFER_BUSY 1
 #define BUFFER_FULL 2
@@ -163,6 +166,85 @@ static int do_play(int src_fd, int dest_fd, uint32_t sample_rate)
     return ret;
 }
 
+static audio_ring_buffer_t* ring;
+
+// plays through a ring buffer shared with the sink rather than write()
+static int do_play_ring(int src_fd, int dest_fd, uint32_t sample_rate)
+{
+    int ret = ioctl_audio_set_sample_rate(dest_fd, &sample_rate);
+    if (ret != NO_ERROR) {
+        printf("sample rate %d not supported\n", sample_rate);
+        return ret;
+    }
+
+    // the sink hands out its ring once per open, so keep it for every file
+    if (!ring) {
+        uint32_t ring_size = RING_SIZE;
+        mx_handle_t vmo;
+        if (ioctl_audio_get_ring_buffer(dest_fd, &ring_size, &vmo) != sizeof(vmo)) {
+            printf("sink has no ring buffer\n");
+            return -1;
+        }
+        uint64_t vmo_size;
+        uintptr_t addr;
+        if (mx_vmo_get_size(vmo, &vmo_size) != NO_ERROR ||
+            mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, vmo_size,
+                        MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr) != NO_ERROR) {
+            mx_handle_close(vmo);
+            return -1;
+        }
+        mx_handle_close(vmo);
+        ring = (audio_ring_buffer_t*)addr;
+    }
+    uint8_t* data = (uint8_t*)ring + ring->data_offset;
+    size_t size = ring->size;
+
+    // the sink plays on round the ring from position, so fill it first;
+    // once the file runs out, keep writing silence until the sink has
+    // played the last of it
+    uint64_t written = __atomic_load_n(&ring->position, __ATOMIC_ACQUIRE);
+    uint64_t end = UINT64_MAX;
+    bool started = false;
+    for (;;) {
+        uint64_t position = __atomic_load_n(&ring->position, __ATOMIC_ACQUIRE);
+        if (position >= end) {
+            break;
+        }
+        if (written < position) {
+            // fell behind the sink; skip what it has already played
+            written = position;
+        }
+        size_t space = size - (written - position);
+        if (space == 0) {
+            if (!started) {
+                ioctl_audio_start(dest_fd);
+                started = true;
+            }
+            mx_nanosleep(MX_MSEC(5));
+            continue;
+        }
+        size_t offset = written % size;
+        if (space > size - offset) {
+            space = size - offset;
+        }
+        ssize_t count = 0;
+        if (end == UINT64_MAX) {
+            count = read(src_fd, data + offset, space);
+            if (count <= 0) {
+                end = written;
+            }
+        }
+        if (count <= 0) {
+            memset(data + offset, 0, space);
+            count = space;
+        }
+        written += count;
+    }
+    ioctl_audio_stop(dest_fd);
+
+    return 0;
+}
+
 static int open_sink(void) {
     struct dirent* de;
     DIR* dir = opendir(DEV_AUDIO);
@@ -203,6 +285,8 @@ next:
 
 }
 
+static bool use_ring;
+
 static int play_file(const char* path, int dest_fd) {
     riff_wave_header riff_wave_header;
     chunk_header chunk_header;
@@ -251,7 +335,8 @@ static int play_file(const char* path, int dest_fd) {
 
     printf("playing %s\n", path);
 
-    int ret = do_play(src_fd, dest_fd, sample_rate);
+    int ret = use_ring ? do_play_ring(src_fd, dest_fd, sample_rate)
+                       : do_play(src_fd, dest_fd, sample_rate);
     close(src_fd);
     return ret;
 }
@@ -288,11 +373,18 @@ int main(int argc, char **argv) {
         return -1;
     }
 
+    // -r plays through a ring buffer shared with the sink
+    int first = 1;
+    if (argc > 1 && !strcmp(argv[1], "-r")) {
+        use_ring = true;
+        first = 2;
+    }
+
     int ret = 0;
-    if (argc == 1) {
+    if (argc == first) {
         ret = play_files("/data", dest_fd);
     } else {
-        for (int i = 1; i < argc && ret == 0; i++) {
+        for (int i = first; i < argc && ret == 0; i++) {
             ret = play_file(argv[i], dest_fd);
         }
     }
@@ -168,7 +168,11 @@ static mx_status_t bcm_vc_get_framebuffer(bcm_fb_desc_t* fb_desc) {
 
         mx_paddr_t pa;
 
-        txn->ops->physmap(txn, &pa);
+        ret = txn->ops->physmap(txn, &pa);
+        if (ret != NO_ERROR) {
+            txn->ops->release(txn);
+            return ret;
+        }
 
         // calculate offset in buffer that will provide 16 byte alignment (physical)
         uint32_t offset = (16 - (pa % 16)) % 16;
@@ -256,7 +260,11 @@ static mx_status_t bcm_get_property_tag(uint8_t* buf, const size_t len) {
 
     mx_paddr_t pa;
 
-    txn->ops->physmap(txn, &pa);
+    ret = txn->ops->physmap(txn, &pa);
+    if (ret != NO_ERROR) {
+        txn->ops->release(txn);
+        return ret;
+    }
 
     uint32_t offset = 0;
 
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <threads.h>
 
 // DDK includes
@@ -39,6 +40,11 @@
 #define FREE_REQ_CACHE_THRESHOLD 1024
 
 #define MAX_DEVICE_COUNT 65
+
+// Widths of the channel's transfer.size and transfer.packet_count fields.
+// Larger transfers are moved in pieces that fit them.
+#define MAX_CHANNEL_XFER_SIZE ((1 << 19) - 1)
+#define MAX_CHANNEL_PACKET_COUNT ((1 << 10) - 1)
 #define ROOT_HUB_DEVICE_ID (MAX_DEVICE_COUNT - 1)
 
 static volatile struct dwc_regs* regs;
@@ -98,6 +104,10 @@ typedef struct dwc_usb_transfer_request {
 
     uint32_t cspit_retries;
 
+    // The result, while the request waits to be completed.
+    mx_status_t status;
+    size_t actual;
+
     // DEBUG
     uint32_t request_id;
 } dwc_usb_transfer_request_t;
@@ -139,10 +149,14 @@ typedef struct dwc_usb {
     dwc_usb_transfer_request_t* rh_intr_req;
     usb_port_status_t root_port_status;
 
-    // Pertaining to the availability of channels on this device.
+    // Pertaining to the availability of channels on this device. A released
+    // channel is handed straight to the longest waiting interrupt endpoint,
+    // or failing that the longest waiting control or bulk endpoint, and only
+    // goes back on free_channels if nobody is waiting.
     mtx_t free_channel_mtx;
-    completion_t free_channel_completion;
     uint8_t free_channels;
+    list_node_t periodic_channel_waiters;
+    list_node_t async_channel_waiters;
     uint32_t next_device_address;
 
     // Assign a new request ID to each request so that we know when it's scheduled
@@ -157,8 +171,20 @@ typedef struct dwc_usb {
     mtx_t sof_waiters_mtx;
     uint n_sof_waiters;
     completion_t sof_waiters[NUM_HOST_CHANNELS];
+
+    // Requests waiting to be completed by the completion thread, so that the
+    // endpoint threads can go straight on to their next transfer.
+    mtx_t completed_reqs_mtx;
+    completion_t completed_reqs_completion;
+    list_node_t completed_reqs;
 } dwc_usb_t;
 
+typedef struct dwc_channel_waiter {
+    list_node_t node;
+    completion_t ready;
+    uint channel;
+} dwc_channel_waiter_t;
+
 typedef struct dwc_usb_endpoint {
     list_node_t node;
     uint8_t ep_address;
@@ -181,7 +207,7 @@ typedef struct dwc_usb_scheduler_thread_ctx {
 } dwc_usb_scheduler_thread_ctx_t;
 
 #define ALL_CHANNELS_FREE 0xff
-static uint acquire_channel_blocking(dwc_usb_t* dwc);
+static uint acquire_channel_blocking(dwc_usb_t* dwc, bool periodic);
 static void release_channel(uint ch, dwc_usb_t* dwc);
 
 #define MANUFACTURER_STRING 1
@@ -272,43 +298,74 @@ static inline bool is_control_request(dwc_usb_transfer_request_t* req) {
 }
 
 // Completes the iotxn associated with a request then cleans up the request.
+// Hands the request to the completion thread.
 static void complete_request(
     dwc_usb_transfer_request_t* req,
     mx_status_t status,
     size_t length,
     dwc_usb_t* dwc) {
-    if (req->setuptxn) {
-        req->setuptxn->ops->release(req->setuptxn);
-    }
-
     xprintf("Complete Request with Request ID = 0x%x, status = %d, "
             "length = %lu\n",
             req->request_id, status, length);
 
-    iotxn_t* txn = req->txn;
+    req->status = status;
+    req->actual = length;
 
-    // Invalidate caches over this region since the DMA engine may have moved
-    // data below us.
-    if (status == NO_ERROR) {
-        txn->ops->cacheop(txn, IOTXN_CACHE_INVALIDATE, txn->offset, length);
-    }
+    mtx_lock(&dwc->completed_reqs_mtx);
+    list_add_tail(&dwc->completed_reqs, &req->node);
+    mtx_unlock(&dwc->completed_reqs_mtx);
 
-    txn->ops->complete(txn, status, length);
+    completion_signal(&dwc->completed_reqs_completion);
+}
 
-    // Put this back on the free list of requests, but make sure the free list
-    // doesn't get too long.
-    mtx_lock(&dwc->free_req_mtx);
+// Completes requests in batches, in the order they finished, and returns
+// them to the free list.
+static int dwc_completion_thread(void* arg) {
+    dwc_usb_t* dwc = (dwc_usb_t*)arg;
 
-    if (dwc->free_req_count >= FREE_REQ_CACHE_THRESHOLD) {
-        // There are already too many requests on the free request list, just
-        // throw this one away.
-        free(req);
-    } else {
-        list_add_tail(&dwc->free_reqs, &req->node);
-        dwc->free_req_count++;
+    while (true) {
+        completion_wait(&dwc->completed_reqs_completion, MX_TIME_INFINITE);
+
+        list_node_t batch = LIST_INITIAL_VALUE(batch);
+        mtx_lock(&dwc->completed_reqs_mtx);
+        list_splice_after(&dwc->completed_reqs, &batch);
+        completion_reset(&dwc->completed_reqs_completion);
+        mtx_unlock(&dwc->completed_reqs_mtx);
+
+        dwc_usb_transfer_request_t* req;
+        list_for_every_entry (&batch, req, dwc_usb_transfer_request_t, node) {
+            if (req->setuptxn) {
+                req->setuptxn->ops->release(req->setuptxn);
+            }
+
+            iotxn_t* txn = req->txn;
+
+            // Invalidate caches over this region since the DMA engine may have
+            // moved data below us.
+            if (req->status == NO_ERROR) {
+                txn->ops->cacheop(txn, IOTXN_CACHE_INVALIDATE, txn->offset, req->actual);
+            }
+
+            txn->ops->complete(txn, req->status, req->actual);
+        }
+
+        // Put the requests back on the free list of requests, but make sure
+        // the free list doesn't get too long.
+        mtx_lock(&dwc->free_req_mtx);
+        while ((req = list_remove_head_type(&batch, dwc_usb_transfer_request_t, node)) != NULL) {
+            if (dwc->free_req_count >= FREE_REQ_CACHE_THRESHOLD) {
+                // There are already too many requests on the free request
+                // list, just throw this one away.
+                free(req);
+            } else {
+                list_add_tail(&dwc->free_reqs, &req->node);
+                dwc->free_req_count++;
+            }
+        }
+        mtx_unlock(&dwc->free_req_mtx);
     }
 
-    mtx_unlock(&dwc->free_req_mtx);
+    return -1;
 }
 
 static void dwc_complete_root_port_status_txn(dwc_usb_t* dwc) {
@@ -441,6 +498,15 @@ static void dwc_iotxn_queue_hw(dwc_usb_t* dwc,
         req->ctrl_phase = CTRL_PHASE_SETUP;
     }
 
+    // Map the data now. Later physmap() calls hand back the same buffer, so
+    // a transfer can't fail to find its data part way through.
+    mx_paddr_t phys_addr;
+    mx_status_t status = txn->ops->physmap(txn, &phys_addr);
+    if (status != NO_ERROR) {
+        complete_request(req, status, 0, dwc);
+        return;
+    }
+
     // Writeback any items pending on the cache. We don't want these to be
     // flushed during a DMA op.
     txn->ops->cacheop(txn, IOTXN_CACHE_CLEAN, txn->offset, txn->length);
@@ -818,11 +884,15 @@ static void dwc_handle_irq(dwc_usb_t* dwc) {
     }
 
     if (interrupts.host_channel_intr) {
-        uint32_t chintr = regs->host_channels_interrupt;
-
-        for (uint32_t ch = 0; ch < NUM_HOST_CHANNELS; ch++) {
-            if ((1 << ch) & chintr) {
-                dwc_handle_channel_irq(ch, dwc);
+        // Channels that halt while we're saving the state of the others are
+        // picked up here too, rather than costing another trip through the
+        // interrupt thread.
+        uint32_t chintr;
+        while ((chintr = regs->host_channels_interrupt) != 0) {
+            for (uint32_t ch = 0; ch < NUM_HOST_CHANNELS; ch++) {
+                if ((1 << ch) & chintr) {
+                    dwc_handle_channel_irq(ch, dwc);
+                }
             }
         }
     }
@@ -1047,42 +1117,39 @@ static int dwc_root_hub_txn_worker(void* arg) {
     return -1;
 }
 
-static uint acquire_channel_blocking(dwc_usb_t* dwc) {
-    int next_channel = -1;
-
-    while (true) {
-        mtx_lock(&dwc->free_channel_mtx);
-
-        // A quick sanity check. We should never mark a channel that doesn't
-        // exist on the system as free.
-        assert((dwc->free_channels & ALL_CHANNELS_FREE) == dwc->free_channels);
+// Takes a free channel, or else waits in line for one. Interrupt endpoints
+// are periodic, and go ahead of the rest.
+static uint acquire_channel_blocking(dwc_usb_t* dwc, bool periodic) {
+    mtx_lock(&dwc->free_channel_mtx);
 
-        // Is there at least one channel that's free?
-        next_channel = -1;
-        if (dwc->free_channels) {
-            next_channel = __builtin_ctz(dwc->free_channels);
+    // A quick sanity check. We should never mark a channel that doesn't
+    // exist on the system as free.
+    assert((dwc->free_channels & ALL_CHANNELS_FREE) == dwc->free_channels);
 
-            // Mark the bit in the free_channel bitfield = 0, meaning the
-            // channel is in use.
-            dwc->free_channels &= (ALL_CHANNELS_FREE ^ (1 << next_channel));
-        }
+    // Channels are only free while nobody is waiting, so there's no queue to
+    // jump.
+    if (dwc->free_channels) {
+        uint channel = __builtin_ctz(dwc->free_channels);
 
-        if (next_channel == -1) {
-            completion_reset(&dwc->free_channel_completion);
-        }
+        // Mark the bit in the free_channel bitfield = 0, meaning the
+        // channel is in use.
+        dwc->free_channels &= (ALL_CHANNELS_FREE ^ (1 << channel));
 
         mtx_unlock(&dwc->free_channel_mtx);
+        return channel;
+    }
 
-        if (next_channel >= 0) {
-            return next_channel;
-        }
+    dwc_channel_waiter_t waiter = {
+        .ready = COMPLETION_INIT,
+    };
+    list_add_tail(periodic ? &dwc->periodic_channel_waiters : &dwc->async_channel_waiters,
+                  &waiter.node);
 
-        // We couldn't find a free channel, wait for somebody to tell us to
-        // wake up and attempt to acquire a channel again.
-        completion_wait(&dwc->free_channel_completion, MX_TIME_INFINITE);
-    }
+    mtx_unlock(&dwc->free_channel_mtx);
 
-    __UNREACHABLE;
+    // Whoever releases a channel next hands it to us.
+    completion_wait(&waiter.ready, MX_TIME_INFINITE);
+    return waiter.channel;
 }
 
 static void release_channel(uint ch, dwc_usb_t* dwc) {
@@ -1090,11 +1157,20 @@ static void release_channel(uint ch, dwc_usb_t* dwc) {
 
     mtx_lock(&dwc->free_channel_mtx);
 
-    dwc->free_channels |= (1 << ch);
+    dwc_channel_waiter_t* waiter =
+        list_remove_head_type(&dwc->periodic_channel_waiters, dwc_channel_waiter_t, node);
+    if (!waiter) {
+        waiter = list_remove_head_type(&dwc->async_channel_waiters, dwc_channel_waiter_t, node);
+    }
 
-    mtx_unlock(&dwc->free_channel_mtx);
+    if (waiter) {
+        waiter->channel = ch;
+        completion_signal(&waiter->ready);
+    } else {
+        dwc->free_channels |= (1 << ch);
+    }
 
-    completion_signal(&dwc->free_channel_completion);
+    mtx_unlock(&dwc->free_channel_mtx);
 }
 
 static void dwc_start_transaction(uint8_t chan,
@@ -1242,6 +1318,16 @@ static void dwc_start_transfer(uint8_t chan, dwc_usb_transfer_request_t* req,
             characteristics.low_speed = 1;
     }
 
+    // Anything the channel can't take in one go is queued again from where
+    // this piece ends, as for split transactions above.
+    uint32_t max_size = MIN(MAX_CHANNEL_XFER_SIZE,
+                            MAX_CHANNEL_PACKET_COUNT * characteristics.max_packet_size);
+    max_size -= max_size % characteristics.max_packet_size;
+    if (transfer.size > max_size) {
+        transfer.size = max_size;
+        req->short_attempt = true;
+    }
+
     assert(IS_WORD_ALIGNED(data));
     data = data ? data : (void*)0xffffff00;
     data += BCM_SDRAM_BUS_ADDR_BASE;
@@ -1363,13 +1449,12 @@ static bool handle_normal_channel_halted(uint channel,
                 req->complete_split = false;
                 req->next_data_toggle = chanptr->transfer.packet_id;
 
-                // Requeue the request, don't release the channel.
-                mtx_lock(&ep->pending_request_mtx);
-                list_add_head(&ep->pending_requests, &req->node);
-                mtx_unlock(&ep->pending_request_mtx);
-                completion_signal(&ep->request_pending_completion);
-
-                return true;
+                // Split transactions move one packet at a time, and large
+                // transfers one channel-sized piece at a time. Queue the
+                // next one on the channel we already hold instead of going
+                // back through the endpoint's scheduler.
+                dwc_start_transfer(channel, req, ep);
+                return false;
             }
 
             if ((usb_ep_type(&ep->desc) == USB_ENDPOINT_CONTROL) &&
@@ -1388,12 +1473,10 @@ static bool handle_normal_channel_halted(uint channel,
                     req->ctrl_phase++;
                 }
 
-                mtx_lock(&ep->pending_request_mtx);
-                list_add_head(&ep->pending_requests, &req->node);
-                mtx_unlock(&ep->pending_request_mtx);
-                completion_signal(&ep->request_pending_completion);
-
-                return true;
+                // All three phases run on the same channel, start the next
+                // one right away.
+                dwc_start_transfer(channel, req, ep);
+                return false;
             }
 
             release_channel(channel, dwc);
@@ -1569,7 +1652,7 @@ static int endpoint_request_scheduler_thread(void* arg) {
                 // We're going to use a single channel for all three phases
                 // of the request, so we're going to acquire one here and
                 // hold onto it until the transaction is complete.
-                channel = acquire_channel_blocking(dwc);
+                channel = acquire_channel_blocking(dwc, false);
 
                 // Allocate an iotxn for the SETUP packet.
                 mx_status_t status =
@@ -1602,11 +1685,11 @@ static int endpoint_request_scheduler_thread(void* arg) {
             return -1;
         } else if (usb_ep_type(&self->desc) == USB_ENDPOINT_BULK) {
             req->next_data_toggle = next_data_toggle;
-            channel = acquire_channel_blocking(dwc);
+            channel = acquire_channel_blocking(dwc, false);
             dwc_start_transfer(channel, req, self);
         } else if (usb_ep_type(&self->desc) == USB_ENDPOINT_INTERRUPT) {
             req->next_data_toggle = next_data_toggle;
-            channel = acquire_channel_blocking(dwc);
+            channel = acquire_channel_blocking(dwc, true);
             await_sof_if_necessary(channel, req, self, dwc);
             dwc_start_transfer(channel, req, self);
         }
@@ -1695,8 +1778,11 @@ static mx_status_t usb_dwc_bind(mx_driver_t* drv, mx_device_t* dev) {
         return ERR_NO_MEMORY;
     }
 
-    usb_dwc->free_channel_completion = COMPLETION_INIT;
     usb_dwc->free_channels = ALL_CHANNELS_FREE;
+    list_initialize(&usb_dwc->periodic_channel_waiters);
+    list_initialize(&usb_dwc->async_channel_waiters);
+    usb_dwc->completed_reqs_completion = COMPLETION_INIT;
+    list_initialize(&usb_dwc->completed_reqs);
     usb_dwc->next_device_address = 1;
     usb_dwc->DBG_reqid = 0x1;
 
@@ -1761,6 +1847,12 @@ static mx_status_t usb_dwc_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto error_return;
     }
 
+    // Thread that completes requests once they're done.
+    thrd_t completion_thread;
+    thrd_create_with_name(&completion_thread, dwc_completion_thread,
+                          usb_dwc, "dwc_completion_thread");
+    thrd_detach(completion_thread);
+
     // Thread that responds to requests for the root hub.
     thrd_t root_hub_txn_worker;
     thrd_create_with_name(&root_hub_txn_worker, dwc_root_hub_txn_worker,
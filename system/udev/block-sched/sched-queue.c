@@ -0,0 +1,174 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sched-queue.h"
+
+#include <string.h>
+
+// reads and writes without ordering constraints are the only ones reordered
+static bool sched_req_is_barrier(sched_req_t* req) {
+    iotxn_t* txn = req->txn;
+    return ((txn->opcode != IOTXN_OP_READ) && (txn->opcode != IOTXN_OP_WRITE)) ||
+           (txn->flags & (IOTXN_SYNC_BEFORE | IOTXN_SYNC_AFTER));
+}
+
+// Finds the calling thread's client, or a free one for it, or failing that
+// one to share.
+static sched_client_t* sched_client_get(sched_queue_t* q) {
+    thrd_t self = thrd_current();
+    sched_client_t* idle = NULL;
+    for (unsigned n = 0; n < SCHED_MAX_CLIENTS; n++) {
+        sched_client_t* client = &q->clients[n];
+        if (!client->used) {
+            if (idle == NULL) {
+                idle = client;
+            }
+        } else if (thrd_equal(client->thread, self)) {
+            return client;
+        }
+    }
+    if (idle == NULL) {
+        return &q->clients[(uintptr_t)self % SCHED_MAX_CLIENTS];
+    }
+    idle->used = true;
+    idle->thread = self;
+    return idle;
+}
+
+// Moves requests from the client's backlog into the queue, as its limit allows.
+static void sched_admit(sched_queue_t* q, sched_client_t* client) {
+    sched_req_t* req;
+    while ((q->config.client_depth == 0) || (client->depth < q->config.client_depth)) {
+        if ((req = list_remove_head_type(&client->backlog, sched_req_t, node)) == NULL) {
+            break;
+        }
+        client->depth++;
+        list_add_tail(&q->queue, &req->node);
+    }
+    if ((client->depth == 0) && list_is_empty(&client->backlog)) {
+        client->used = false;
+    }
+}
+
+// Picks the next request to issue: the oldest, if its deadline has passed,
+// else the first at or past the head, or failing that the first on the device.
+// Nothing queued after an ordered request goes before it.
+static sched_req_t* sched_pick(sched_queue_t* q, mx_time_t now) {
+    sched_req_t* oldest = list_peek_head_type(&q->queue, sched_req_t, node);
+    if ((oldest == NULL) || sched_req_is_barrier(oldest) || (oldest->deadline <= now)) {
+        return oldest;
+    }
+    sched_req_t* ahead = NULL;
+    sched_req_t* lowest = NULL;
+    sched_req_t* req;
+    list_for_every_entry (&q->queue, req, sched_req_t, node) {
+        if (sched_req_is_barrier(req)) {
+            break;
+        }
+        mx_off_t offset = req->txn->offset;
+        if ((offset >= q->head) && ((ahead == NULL) || (offset < ahead->txn->offset))) {
+            ahead = req;
+        }
+        if ((lowest == NULL) || (offset < lowest->txn->offset)) {
+            lowest = req;
+        }
+    }
+    return ahead ? ahead : lowest;
+}
+
+// Finds a waiting request that carries on where the run ends.
+static sched_req_t* sched_follower(sched_queue_t* q, iotxn_t* txn, mx_off_t end) {
+    sched_req_t* req;
+    list_for_every_entry (&q->queue, req, sched_req_t, node) {
+        if (sched_req_is_barrier(req)) {
+            break;
+        }
+        if ((req->txn->offset == end) && (req->txn->opcode == txn->opcode)) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+void sched_queue_init(sched_queue_t* q, const block_sched_config_t* config) {
+    memset(q, 0, sizeof(*q));
+    q->config = *config;
+    list_initialize(&q->queue);
+    for (unsigned n = 0; n < SCHED_MAX_CLIENTS; n++) {
+        list_initialize(&q->clients[n].backlog);
+    }
+}
+
+void sched_queue_set_config(sched_queue_t* q, const block_sched_config_t* config) {
+    q->config = *config;
+    // a higher limit lets in those waiting on the old one
+    for (unsigned n = 0; n < SCHED_MAX_CLIENTS; n++) {
+        if (q->clients[n].used) {
+            sched_admit(q, &q->clients[n]);
+        }
+    }
+}
+
+void sched_queue_add(sched_queue_t* q, sched_req_t* req, mx_time_t now) {
+    req->deadline = now + MX_MSEC(q->config.deadline_ms);
+    req->client = sched_client_get(q);
+    list_add_tail(&req->client->backlog, &req->node);
+    sched_admit(q, req->client);
+}
+
+sched_req_t* sched_queue_next_run(sched_queue_t* q, mx_time_t now, mx_off_t* length,
+                                  uint32_t* count) {
+    sched_req_t* run;
+    if ((q->inflight >= q->config.device_depth) || ((run = sched_pick(q, now)) == NULL)) {
+        return NULL;
+    }
+    list_delete(&run->node);
+    run->next = NULL;
+
+    // gather the requests the run can be merged with
+    *length = run->txn->length;
+    *count = 1;
+    if (!sched_req_is_barrier(run)) {
+        sched_req_t* last = run;
+        sched_req_t* req;
+        while ((req = sched_follower(q, run->txn, run->txn->offset + *length)) &&
+               (*length + req->txn->length <= q->config.max_merge)) {
+            list_delete(&req->node);
+            req->next = NULL;
+            last->next = req;
+            last = req;
+            *length += req->txn->length;
+            (*count)++;
+        }
+    }
+    q->head = run->txn->offset + *length;
+    q->inflight++;
+    return run;
+}
+
+void sched_queue_req_done(sched_queue_t* q, sched_req_t* req) {
+    req->client->depth--;
+    sched_admit(q, req->client);
+}
+
+void sched_queue_run_done(sched_queue_t* q) {
+    q->inflight--;
+}
+
+void sched_queue_take_all(sched_queue_t* q, list_node_t* list) {
+    sched_req_t* req;
+    while ((req = list_remove_head_type(&q->queue, sched_req_t, node)) != NULL) {
+        req->client->depth--;
+        list_add_tail(list, &req->node);
+    }
+    for (unsigned n = 0; n < SCHED_MAX_CLIENTS; n++) {
+        sched_client_t* client = &q->clients[n];
+        while ((req = list_remove_head_type(&client->backlog, sched_req_t, node)) != NULL) {
+            list_add_tail(list, &req->node);
+        }
+        if (client->depth == 0) {
+            client->used = false;
+        }
+    }
+}
@@ -0,0 +1,75 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <ddk/iotxn.h>
+
+#include <magenta/device/block.h>
+#include <magenta/listnode.h>
+#include <magenta/types.h>
+#include <stdbool.h>
+#include <threads.h>
+
+// The scheduler's queues and the policy that orders them, kept apart from
+// the driver so that they can be tested on their own. Nothing here locks:
+// the driver calls in with its device lock held.
+
+#define SCHED_MAX_CLIENTS 16
+
+typedef struct sched_client {
+    bool used;
+    thrd_t thread;
+    // requests waiting in the queue or in flight
+    uint32_t depth;
+    // requests over the limit, oldest first
+    list_node_t backlog;
+} sched_client_t;
+
+typedef struct sched_req {
+    list_node_t node;
+    iotxn_t* txn;
+    struct sched_device* dev;
+    sched_client_t* client;
+    // once past, the request goes next
+    mx_time_t deadline;
+    // the rest of the run the request was merged into
+    struct sched_req* next;
+} sched_req_t;
+
+typedef struct sched_queue {
+    block_sched_config_t config;
+    // requests waiting to be issued, oldest first
+    list_node_t queue;
+    // runs issued to the device and not yet done
+    uint32_t inflight;
+    // where the last run issued ended
+    mx_off_t head;
+    sched_client_t clients[SCHED_MAX_CLIENTS];
+} sched_queue_t;
+
+void sched_queue_init(sched_queue_t* q, const block_sched_config_t* config);
+
+// Changes the limits, letting in the requests waiting on the old ones.
+void sched_queue_set_config(sched_queue_t* q, const block_sched_config_t* config);
+
+// Adds a request from the calling thread, which waits in its client's backlog
+// if the client is at its limit.
+void sched_queue_add(sched_queue_t* q, sched_req_t* req, mx_time_t now);
+
+// Takes the next run to issue off the queue, or returns NULL if there is none
+// or the device already has device_depth runs in flight. The run is a list
+// linked through next, of count requests and length bytes.
+sched_req_t* sched_queue_next_run(sched_queue_t* q, mx_time_t now, mx_off_t* length,
+                                  uint32_t* count);
+
+// Marks a request issued by sched_queue_next_run() done, which may let in
+// another from its client's backlog. The run is still in flight until
+// sched_queue_run_done().
+void sched_queue_req_done(sched_queue_t* q, sched_req_t* req);
+
+void sched_queue_run_done(sched_queue_t* q);
+
+// Moves every request not yet issued, queued or held back, onto list.
+void sched_queue_take_all(sched_queue_t* q, list_node_t* list);
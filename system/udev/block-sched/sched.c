@@ -0,0 +1,357 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <ddk/completion.h>
+#include <ddk/device.h>
+#include <ddk/driver.h>
+#include <ddk/binding.h>
+#include <ddk/iotxn.h>
+#include <ddk/protocol/block.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+#include <magenta/listnode.h>
+#include <sys/param.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+#include "sched-queue.h"
+
+// This block device schedules the requests queued to it before passing them
+// to the underlying block device. While the device has device_depth requests
+// in flight, others wait, and are then issued in order of offset, sweeping
+// upwards from where the last one ended. Waiting requests that follow on from
+// each other are merged into one. See block_sched_config_t.
+//
+// The requests a client may have waiting or in flight are capped. A client is
+// the thread that queued them: each block fifo has its own, and a child's
+// requests come from whichever of its threads queued them.
+
+#define SCHED_DEFAULT_MAX_MERGE    (128 * 1024)
+#define SCHED_DEFAULT_DEADLINE_MS  50
+#define SCHED_DEFAULT_CLIENT_DEPTH 32
+#define SCHED_DEFAULT_DEVICE_DEPTH 16
+
+typedef struct sched_device {
+    mx_device_t device;
+
+    mtx_t lock;
+    sched_queue_t q;
+
+    thrd_t worker;
+    // signalled when a request is queued or a run is done
+    completion_t worker_completion;
+    bool dead;
+} sched_device_t;
+
+#define get_sched_device(dev) containerof(dev, sched_device_t, device)
+
+static void sched_req_done(sched_req_t* req, mx_status_t status, mx_off_t actual) {
+    sched_device_t* dev = req->dev;
+    mtx_lock(&dev->lock);
+    sched_queue_req_done(&dev->q, req);
+    mtx_unlock(&dev->lock);
+
+    iotxn_t* txn = req->txn;
+    free(req);
+    txn->ops->complete(txn, status, actual);
+}
+
+static void sched_run_done(sched_device_t* dev) {
+    mtx_lock(&dev->lock);
+    sched_queue_run_done(&dev->q);
+    // signalled under the lock, so release() cannot free the device under us
+    completion_signal(&dev->worker_completion);
+    mtx_unlock(&dev->lock);
+}
+
+static void sched_io_complete(iotxn_t* io, void* cookie) {
+    sched_req_t* req = cookie;
+    sched_device_t* dev = req->dev;
+    mx_status_t status = io->status;
+
+    if (req->next == NULL) {
+        // not merged: the request was issued as a clone of itself
+        mx_off_t actual = io->actual;
+        io->ops->release(io);
+        sched_req_done(req, status, actual);
+    } else {
+        // merged: each request is done with as much of it as the run did
+        void* buffer = NULL;
+        if ((status == NO_ERROR) && (io->opcode == IOTXN_OP_READ)) {
+            io->ops->mmap(io, &buffer);
+            if (buffer == NULL) {
+                status = ERR_NO_MEMORY;
+            }
+        }
+        mx_off_t offset = 0;
+        while (req != NULL) {
+            sched_req_t* next = req->next;
+            mx_off_t length = req->txn->length;
+            mx_off_t actual = 0;
+            if ((status == NO_ERROR) && (io->actual > offset)) {
+                actual = MIN(length, io->actual - offset);
+                if (buffer != NULL) {
+                    req->txn->ops->copyto(req->txn, buffer + offset, actual, 0);
+                }
+            }
+            sched_req_done(req, status, actual);
+            offset += length;
+            req = next;
+        }
+        io->ops->release(io);
+    }
+
+    sched_run_done(dev);
+}
+
+// Issues a request on its own.
+static void sched_issue_one(sched_device_t* dev, sched_req_t* req) {
+    iotxn_t* io;
+    mx_status_t status = req->txn->ops->clone(req->txn, &io, 0);
+    if (status != NO_ERROR) {
+        sched_req_done(req, status, 0);
+        sched_run_done(dev);
+        return;
+    }
+    req->next = NULL;
+    io->complete_cb = sched_io_complete;
+    io->cookie = req;
+    iotxn_queue(dev->device.parent, io);
+}
+
+// Issues each request of a run on its own, when they cannot be merged.
+static void sched_issue_each(sched_device_t* dev, sched_req_t* run, uint32_t count) {
+    mtx_lock(&dev->lock);
+    dev->q.inflight += count - 1;
+    mtx_unlock(&dev->lock);
+    while (run != NULL) {
+        sched_req_t* next = run->next;
+        sched_issue_one(dev, run);
+        run = next;
+    }
+}
+
+// Issues a run of requests, each following on from the one before, as one.
+static void sched_issue_run(sched_device_t* dev, sched_req_t* run, mx_off_t length,
+                            uint32_t count) {
+    if (count == 1) {
+        sched_issue_one(dev, run);
+        return;
+    }
+
+    iotxn_t* io;
+    if (iotxn_alloc(&io, 0, length, 0) != NO_ERROR) {
+        sched_issue_each(dev, run, count);
+        return;
+    }
+    io->opcode = run->txn->opcode;
+    io->offset = run->txn->offset;
+    io->length = length;
+    if (io->opcode == IOTXN_OP_WRITE) {
+        void* buffer = NULL;
+        io->ops->mmap(io, &buffer);
+        if (buffer == NULL) {
+            io->ops->release(io);
+            sched_issue_each(dev, run, count);
+            return;
+        }
+        mx_off_t offset = 0;
+        for (sched_req_t* req = run; req != NULL; req = req->next) {
+            req->txn->ops->copyfrom(req->txn, buffer + offset, req->txn->length, 0);
+            offset += req->txn->length;
+        }
+    }
+    io->complete_cb = sched_io_complete;
+    io->cookie = run;
+    iotxn_queue(dev->device.parent, io);
+}
+
+static int sched_worker_thread(void* arg) {
+    sched_device_t* dev = arg;
+    mtx_lock(&dev->lock);
+    while (!dev->dead) {
+        mx_off_t length;
+        uint32_t count;
+        sched_req_t* run = sched_queue_next_run(&dev->q, mx_time_get(MX_CLOCK_MONOTONIC),
+                                                &length, &count);
+        if (run == NULL) {
+            // wait here until a request is queued, or one is done
+            mtx_unlock(&dev->lock);
+            completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
+            completion_reset(&dev->worker_completion);
+            mtx_lock(&dev->lock);
+            continue;
+        }
+        mtx_unlock(&dev->lock);
+        sched_issue_run(dev, run, length, count);
+        mtx_lock(&dev->lock);
+    }
+    mtx_unlock(&dev->lock);
+    return 0;
+}
+
+// Stops the worker, waits for the runs in flight, and fails every request
+// that was never issued.
+static void sched_shutdown(sched_device_t* dev) {
+    mtx_lock(&dev->lock);
+    dev->dead = true;
+    mtx_unlock(&dev->lock);
+    completion_signal(&dev->worker_completion);
+    thrd_join(dev->worker, NULL);
+
+    mtx_lock(&dev->lock);
+    while (dev->q.inflight > 0) {
+        completion_reset(&dev->worker_completion);
+        mtx_unlock(&dev->lock);
+        completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
+        mtx_lock(&dev->lock);
+    }
+    list_node_t pending = LIST_INITIAL_VALUE(pending);
+    sched_queue_take_all(&dev->q, &pending);
+    mtx_unlock(&dev->lock);
+
+    sched_req_t* req;
+    while ((req = list_remove_head_type(&pending, sched_req_t, node)) != NULL) {
+        iotxn_t* txn = req->txn;
+        free(req);
+        txn->ops->complete(txn, ERR_REMOTE_CLOSED, 0);
+    }
+}
+
+// implement device protocol:
+
+static ssize_t sched_ioctl(mx_device_t* dev, uint32_t op, const void* cmd,
+                           size_t cmdlen, void* reply, size_t max) {
+    sched_device_t* device = get_sched_device(dev);
+    switch (op) {
+    case IOCTL_BLOCK_SET_SCHED_CONFIG: {
+        const block_sched_config_t* config = cmd;
+        if (cmdlen < sizeof(*config)) {
+            return ERR_INVALID_ARGS;
+        }
+        if ((config->device_depth == 0) || (config->max_merge > BLOCK_SCHED_MAX_MERGE)) {
+            return ERR_INVALID_ARGS;
+        }
+        mtx_lock(&device->lock);
+        sched_queue_set_config(&device->q, config);
+        mtx_unlock(&device->lock);
+        completion_signal(&device->worker_completion);
+        return NO_ERROR;
+    }
+    case IOCTL_BLOCK_GET_SCHED_CONFIG: {
+        block_sched_config_t* config = reply;
+        if (max < sizeof(*config)) {
+            return ERR_BUFFER_TOO_SMALL;
+        }
+        mtx_lock(&device->lock);
+        *config = device->q.config;
+        mtx_unlock(&device->lock);
+        return sizeof(*config);
+    }
+    default: {
+        mx_device_t* parent = dev->parent;
+        return parent->ops->ioctl(parent, op, cmd, cmdlen, reply, max);
+    }
+    }
+}
+
+static void sched_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    sched_device_t* device = get_sched_device(dev);
+
+    sched_req_t* req = calloc(1, sizeof(sched_req_t));
+    if (req == NULL) {
+        txn->ops->complete(txn, ERR_NO_MEMORY, 0);
+        return;
+    }
+    req->txn = txn;
+    req->dev = device;
+
+    mtx_lock(&device->lock);
+    if (device->dead) {
+        mtx_unlock(&device->lock);
+        free(req);
+        txn->ops->complete(txn, ERR_REMOTE_CLOSED, 0);
+        return;
+    }
+    sched_queue_add(&device->q, req, mx_time_get(MX_CLOCK_MONOTONIC));
+    mtx_unlock(&device->lock);
+
+    // hit the worker thread
+    completion_signal(&device->worker_completion);
+}
+
+static mx_off_t sched_getsize(mx_device_t* dev) {
+    mx_device_t* parent = dev->parent;
+    return parent->ops->get_size(parent);
+}
+
+static void sched_unbind(mx_device_t* dev) {
+    device_remove(dev);
+}
+
+static mx_status_t sched_release(mx_device_t* dev) {
+    sched_device_t* device = get_sched_device(dev);
+    sched_shutdown(device);
+    free(device);
+    return NO_ERROR;
+}
+
+static mx_protocol_device_t sched_proto = {
+    .ioctl = sched_ioctl,
+    .iotxn_queue = sched_iotxn_queue,
+    .get_size = sched_getsize,
+    .unbind = sched_unbind,
+    .release = sched_release,
+};
+
+static mx_status_t sched_bind(mx_driver_t* drv, mx_device_t* dev) {
+    sched_device_t* device = calloc(1, sizeof(sched_device_t));
+    if (!device) {
+        return ERR_NO_MEMORY;
+    }
+    char name[MX_DEVICE_NAME_MAX + 1];
+    snprintf(name, sizeof(name), "%.*s (sched)", (int)(sizeof(name) - sizeof(" (sched)")),
+             dev->name);
+    device_init(&device->device, drv, name, &sched_proto);
+
+    mtx_init(&device->lock, mtx_plain);
+    block_sched_config_t config = {
+        .max_merge = SCHED_DEFAULT_MAX_MERGE,
+        .deadline_ms = SCHED_DEFAULT_DEADLINE_MS,
+        .client_depth = SCHED_DEFAULT_CLIENT_DEPTH,
+        .device_depth = SCHED_DEFAULT_DEVICE_DEPTH,
+    };
+    sched_queue_init(&device->q, &config);
+    device->worker_completion = COMPLETION_INIT;
+
+    if (thrd_create_with_name(&device->worker, sched_worker_thread, device,
+                              "block-sched") != thrd_success) {
+        free(device);
+        return ERR_NO_RESOURCES;
+    }
+
+    device->device.protocol_id = MX_PROTOCOL_BLOCK;
+    mx_status_t status;
+    if ((status = device_add(&device->device, dev)) != NO_ERROR) {
+        sched_shutdown(device);
+        free(device);
+        return status;
+    }
+    return NO_ERROR;
+}
+
+mx_driver_t _driver_sched = {
+    .ops = {
+        .bind = sched_bind,
+    },
+    .flags = DRV_FLAG_NO_AUTOBIND,
+};
+
+MAGENTA_DRIVER_BEGIN(_driver_sched, "sched", "magenta", "0.1", 1)
+    BI_MATCH_IF(EQ, BIND_PROTOCOL, MX_PROTOCOL_BLOCK),
+MAGENTA_DRIVER_END(_driver_sched)
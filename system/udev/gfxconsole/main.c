@@ -812,6 +812,68 @@ static void display_flush(uint starty, uint endy)
     fb_display_protocol->flush(fb_device);
 }
 
+// Damage to the hw framebuffer since the last flush, [x0, x1) by [y0, y1).
+// Updates coalesce in it and go to the display at most once a frame.
+#define VC_FLUSH_INTERVAL MX_MSEC(16)
+
+static mtx_t damage_lock = MTX_INIT;
+static cnd_t damage_cnd = CND_INIT;
+static unsigned damage_x0, damage_y0, damage_x1, damage_y1;
+
+void vc_gfx_damage(unsigned x, unsigned y, unsigned w, unsigned h) {
+    if (!hw_gfx.flush || (w == 0) || (h == 0)) {
+        return;
+    }
+    mtx_lock(&damage_lock);
+    if (damage_x0 >= damage_x1) {
+        damage_x0 = x;
+        damage_y0 = y;
+        damage_x1 = x + w;
+        damage_y1 = y + h;
+        cnd_signal(&damage_cnd);
+    } else {
+        damage_x0 = MIN(damage_x0, x);
+        damage_y0 = MIN(damage_y0, y);
+        damage_x1 = MAX(damage_x1, x + w);
+        damage_y1 = MAX(damage_y1, y + h);
+    }
+    mtx_unlock(&damage_lock);
+}
+
+static int vc_flush_thread(void* arg) {
+    mx_time_t last = 0;
+    for (;;) {
+        mtx_lock(&damage_lock);
+        while (damage_x0 >= damage_x1) {
+            cnd_wait(&damage_cnd, &damage_lock);
+        }
+        mtx_unlock(&damage_lock);
+
+        // let further updates gather until the next frame is due
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (now < last + VC_FLUSH_INTERVAL) {
+            mx_nanosleep(last + VC_FLUSH_INTERVAL - now);
+        }
+
+        mtx_lock(&damage_lock);
+        unsigned x0 = damage_x0, y0 = damage_y0;
+        unsigned x1 = MIN(damage_x1, hw_gfx.width);
+        unsigned y1 = MIN(damage_y1, hw_gfx.height);
+        damage_x0 = damage_x1 = 0;
+        mtx_unlock(&damage_lock);
+
+        if ((x0 < x1) && (y0 < y1)) {
+            if (fb_display_protocol->flush_region) {
+                fb_display_protocol->flush_region(fb_device, x0, y0, x1 - x0, y1 - y0);
+            } else {
+                fb_display_protocol->flush(fb_device);
+            }
+        }
+        last = mx_time_get(MX_CLOCK_MONOTONIC);
+    }
+    return 0;
+}
+
 static mx_status_t vc_root_bind(mx_driver_t* drv, mx_device_t* dev) {
     if (vc_initialized) {
         // disallow multiple instances
@@ -846,8 +908,14 @@ static mx_status_t vc_root_bind(mx_driver_t* drv, mx_device_t* dev) {
     fb_display_protocol = disp;
 
     // if the underlying device requires flushes, set the pointer to a flush op
+    // and flush damage from a thread of its own
     if (disp->flush) {
         hw_gfx.flush = display_flush;
+        thrd_t t;
+        if (thrd_create_with_name(&t, vc_flush_thread, NULL, "vc-flush") != thrd_success) {
+            return ERR_NO_RESOURCES;
+        }
+        thrd_detach(t);
     }
 
     // publish the root vc device. opening this device will create a new vc
@@ -23,7 +23,7 @@ void vc_gfx_invalidate_all(vc_device_t* dev) {
         gfx_copylines(dev->hw_gfx, dev->st_gfx, 0, 0, dev->st_gfx->height);
         gfx_copylines(dev->hw_gfx, dev->gfx, 0, dev->st_gfx->height, dev->gfx->height - dev->st_gfx->height);
     }
-    gfx_flush(dev->hw_gfx);
+    vc_gfx_damage(0, 0, dev->hw_gfx->width, dev->hw_gfx->height);
 }
 
 void vc_gfx_invalidate_status(vc_device_t* dev) {
@@ -33,7 +33,7 @@ void vc_gfx_invalidate_status(vc_device_t* dev) {
         return;
     }
     gfx_copylines(dev->hw_gfx, dev->st_gfx, 0, 0, dev->st_gfx->height);
-    gfx_flush_rows(dev->hw_gfx, 0, dev->st_gfx->height);
+    vc_gfx_damage(0, 0, dev->hw_gfx->width, dev->st_gfx->height);
 }
 
 void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
@@ -42,11 +42,12 @@ void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, uns
     unsigned desty = dev->flags & VC_FLAG_FULLSCREEN ? y * dev->charh : dev->st_gfx->height + y * dev->charh;
     if ((x == 0) && (w == dev->columns)) {
         gfx_copylines(dev->hw_gfx, dev->gfx, y * dev->charh, desty, h * dev->charh);
+        vc_gfx_damage(0, desty, dev->hw_gfx->width, h * dev->charh);
     } else {
         gfx_blend(dev->hw_gfx, dev->gfx, x * dev->charw, y * dev->charh,
                   w * dev->charw, h * dev->charh, x * dev->charw, desty);
+        vc_gfx_damage(x * dev->charw, desty, w * dev->charw, h * dev->charh);
     }
-    gfx_flush_rows(dev->hw_gfx, desty, desty + h * dev->charh);
 }
 
 void vc_gfx_invalidate_region(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
@@ -55,8 +56,9 @@ void vc_gfx_invalidate_region(vc_device_t* dev, unsigned x, unsigned y, unsigned
     unsigned desty = dev->flags & VC_FLAG_FULLSCREEN ? y : dev->st_gfx->height + y;
     if ((x == 0) && (w == dev->columns)) {
         gfx_copylines(dev->hw_gfx, dev->gfx, y, desty, h);
+        vc_gfx_damage(0, desty, dev->hw_gfx->width, h);
     } else {
         gfx_blend(dev->hw_gfx, dev->gfx, x, y, w, h, x, desty);
+        vc_gfx_damage(x, desty, w, h);
     }
-    gfx_flush_rows(dev->hw_gfx, desty, desty + h);
 }
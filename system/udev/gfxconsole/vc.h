@@ -131,6 +131,8 @@ void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, uns
 // invalidates a region in pixels
 void vc_gfx_invalidate_region(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h);
 void vc_gfx_draw_char(vc_device_t* dev, vc_char_t ch, unsigned x, unsigned y);
+// marks a region of the hw framebuffer, in pixels, for the next flush
+void vc_gfx_damage(unsigned x, unsigned y, unsigned w, unsigned h);
 
 static inline uint32_t palette_to_color(vc_device_t* dev, uint8_t color) {
     assert(color <= MAX_COLOR);
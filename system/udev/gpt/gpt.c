@@ -36,10 +36,30 @@
 
 #define TXN_SIZE 0x4000 // 128 partition entries
 
+// the largest partition table read from the disk
+#define GPT_MAX_TABLE_SIZE (1024 * 1024)
+
+// The partition table as read at bind time, shared by all the partitions
+// of a disk and handed out by IOCTL_BLOCK_GET_PARTITION_TABLE.
+typedef struct gpt_table {
+    atomic_int refcount;
+    uint64_t blksize;
+    uint8_t disk_guid[GPT_GUID_LEN];
+    // the entries in use, in table order
+    uint32_t count;
+    block_partition_entry_t entries[];
+} gpt_table_t;
+
 typedef struct gptpart_device {
     mx_device_t device;
     gpt_entry_t gpt_entry;
     uint64_t blksize;
+    // the partition's extent on the parent, in bytes
+    uint64_t start;
+    uint64_t size;
+    gpt_table_t* table;
+    // of this partition in table->entries
+    uint32_t table_index;
     atomic_int writercount;
 } gptpart_device_t;
 
@@ -66,9 +86,13 @@ static void utf16_to_cstring(char* dst, uint8_t* src, size_t charcount) {
 }
 
 static uint64_t getsize(gptpart_device_t* dev) {
-    // last LBA is inclusive
-    uint64_t lbacount = dev->gpt_entry.last_lba - dev->gpt_entry.first_lba + 1;
-    return lbacount * dev->blksize;
+    return dev->size;
+}
+
+static void gpt_table_release(gpt_table_t* table) {
+    if (atomic_fetch_sub(&table->refcount, 1) == 1) {
+        free(table);
+    }
 }
 
 // implement device protocol:
@@ -100,6 +124,18 @@ static ssize_t gpt_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
         memcpy(guid, device->gpt_entry.guid, GPT_GUID_LEN);
         return GPT_GUID_LEN;
     }
+    case IOCTL_BLOCK_GET_PARTITION_TABLE: {
+        gpt_table_t* table = device->table;
+        block_partition_table_t* out = reply;
+        size_t len = sizeof(*out) + table->count * sizeof(block_partition_entry_t);
+        if (max < len) return ERR_BUFFER_TOO_SMALL;
+        out->block_size = table->blksize;
+        memcpy(out->disk_guid, table->disk_guid, GPT_GUID_LEN);
+        out->self = device->table_index;
+        out->count = table->count;
+        memcpy(out->entries, table->entries, table->count * sizeof(block_partition_entry_t));
+        return len;
+    }
     case IOCTL_BLOCK_GET_NAME: {
         char* name = reply;
         memset(name, 0, max);
@@ -116,22 +152,23 @@ static ssize_t gpt_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
     }
 }
 
+// Every txn to the partition passes through here on its way to the disk,
+// including those the devhost builds from IOCTL_BLOCK_TXN_VMO batches and
+// the block fifo, so the bounds are kept in bytes and the txn is passed on
+// as it is, with only its offset moved.
 static void gpt_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     gptpart_device_t* device = get_gptpart_device(dev);
-    // sanity check
-    uint64_t off_lba = txn->offset / device->blksize;
-    uint64_t first = device->gpt_entry.first_lba;
-    uint64_t last = device->gpt_entry.last_lba;
-    if (first + off_lba > last) {
+    if (txn->offset >= device->size) {
         xprintf("%s: offset 0x%" PRIx64 " is past the end of partition!\n", dev->name, txn->offset);
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
         return;
     }
     // constrain if too many bytes are requested
-    txn->length = MIN((last - (first + off_lba) + 1) * device->blksize, txn->length);
-    // adjust offset
-    txn->offset = first * device->blksize + txn->offset;
-    iotxn_queue(dev->parent, txn);
+    if (txn->length > device->size - txn->offset) {
+        txn->length = device->size - txn->offset;
+    }
+    txn->offset += device->start;
+    dev->parent->ops->iotxn_queue(dev->parent, txn);
 }
 
 static mx_off_t gpt_getsize(mx_device_t* dev) {
@@ -145,6 +182,7 @@ static void gpt_unbind(mx_device_t* dev) {
 
 static mx_status_t gpt_release(mx_device_t* dev) {
     gptpart_device_t* device = get_gptpart_device(dev);
+    gpt_table_release(device->table);
     free(device);
     return NO_ERROR;
 }
@@ -245,13 +283,22 @@ static int gpt_bind_thread(void* arg) {
 
     xprintf("gpt: found gpt header %u entries @ lba%" PRIu64 "\n", header.entries_count, header.entries);
 
-    // read partition table entries
-    size_t table_sz = header.entries_count * header.entries_sz;
+    // read the whole partition table, so that it can be handed out without
+    // going back to the disk
+    uint64_t table_sz = (uint64_t)header.entries_count * header.entries_sz;
+    if ((header.entries_sz < sizeof(gpt_entry_t)) || (table_sz > GPT_MAX_TABLE_SIZE)) {
+        xprintf("gpt: unsupported table of %u entries of %u bytes\n",
+                header.entries_count, header.entries_sz);
+        txn->ops->release(txn);
+        goto unbind;
+    }
+    table_sz = ((table_sz + blksize - 1) / blksize) * blksize;
     if (table_sz > TXN_SIZE) {
-        xprintf("gpt: partition table is bigger than the iotxn!\n");
-        // FIXME read the whole partition table. ok for now because on pixel2, this is
-        // enough to read the entries that actually contain valid data
-        table_sz = TXN_SIZE;
+        txn->ops->release(txn);
+        if ((status = iotxn_alloc(&txn, 0, table_sz, 0)) != NO_ERROR) {
+            xprintf("gpt: error %d allocating iotxn\n", status);
+            goto unbind;
+        }
     }
     txn->opcode = IOTXN_OP_READ;
     txn->offset = header.entries * blksize;
@@ -263,14 +310,64 @@ static int gpt_bind_thread(void* arg) {
     iotxn_queue(dev, txn);
     completion_wait(&completion, MX_TIME_INFINITE);
 
-    for (partitions = 0; partitions < header.entries_count; partitions++) {
-        if (partitions * header.entries_sz > txn->actual) break;
+    if (txn->status != NO_ERROR) {
+        xprintf("gpt: error %d reading partition table\n", txn->status);
+        txn->ops->release(txn);
+        goto unbind;
+    }
+
+    uint32_t entries_count = MIN(header.entries_count, txn->actual / header.entries_sz);
+    gpt_entry_t* entries = calloc(entries_count, sizeof(gpt_entry_t));
+    gpt_table_t* table = calloc(1, sizeof(gpt_table_t) +
+                                   entries_count * sizeof(block_partition_entry_t));
+    if (!entries || !table) {
+        xprintf("gpt: out of memory!\n");
+        free(entries);
+        free(table);
+        txn->ops->release(txn);
+        goto unbind;
+    }
+    for (uint32_t i = 0; i < entries_count; i++) {
+        txn->ops->copyfrom(txn, &entries[i], sizeof(gpt_entry_t), header.entries_sz * i);
+    }
+    txn->ops->release(txn);
+
+    // the bind thread's reference, dropped once the partitions hold theirs
+    atomic_init(&table->refcount, 1);
+    table->blksize = blksize;
+    memcpy(table->disk_guid, header.guid, GPT_GUID_LEN);
+    for (uint32_t i = 0; i < entries_count; i++) {
+        gpt_entry_t* entry = &entries[i];
+        if (entry->type[0] == 0) {
+            continue;
+        }
+        block_partition_entry_t* out = &table->entries[table->count++];
+        memcpy(out->type, entry->type, GPT_GUID_LEN);
+        memcpy(out->guid, entry->guid, GPT_GUID_LEN);
+        out->first_block = entry->first_lba;
+        out->last_block = entry->last_lba;
+        out->flags = entry->flags;
+        out->index = i;
+        memcpy(out->name, entry->name, GPT_NAME_LEN);
+    }
+
+    uint32_t table_index = 0;
+    for (partitions = 0; partitions < entries_count; partitions++) {
+        gpt_entry_t* entry = &entries[partitions];
+        if (entry->type[0] == 0) {
+            continue;
+        }
+        uint32_t index = table_index++;
+        if ((entry->last_lba < entry->first_lba) ||
+            (entry->last_lba >= UINT64_MAX / blksize)) {
+            xprintf("gpt: partition %u has a bad extent\n", partitions);
+            continue;
+        }
 
         gptpart_device_t* device = calloc(1, sizeof(gptpart_device_t));
         if (!device) {
             xprintf("gpt: out of memory!\n");
-            txn->ops->release(txn);
-            goto unbind;
+            break;
         }
 
         char name[128];
@@ -278,11 +375,12 @@ static int gpt_bind_thread(void* arg) {
         device_init(&device->device, drv, name, &gpt_proto);
 
         device->blksize = blksize;
-        txn->ops->copyfrom(txn, &device->gpt_entry, sizeof(gpt_entry_t), sizeof(gpt_entry_t) * partitions);
-        if (device->gpt_entry.type[0] == 0) {
-            free(device);
-            continue;
-        }
+        device->gpt_entry = *entry;
+        // last LBA is inclusive
+        device->start = entry->first_lba * blksize;
+        device->size = (entry->last_lba - entry->first_lba + 1) * blksize;
+        device->table = table;
+        device->table_index = index;
 
         char type_guid[GPT_GUID_STRLEN];
         uint8_to_guid_string(type_guid, device->gpt_entry.type);
@@ -294,15 +392,17 @@ static int gpt_bind_thread(void* arg) {
                 device->device.name, type_guid, partition_guid, pname);
 
         device->device.protocol_id = MX_PROTOCOL_BLOCK;
+        atomic_fetch_add(&table->refcount, 1);
         if (device_add(&device->device, dev) != NO_ERROR) {
             printf("gpt device_add failed\n");
+            gpt_table_release(table);
             free(device);
             continue;
         }
     }
 
-    txn->ops->release(txn);
-
+    gpt_table_release(table);
+    free(entries);
     return NO_ERROR;
 unbind:
     if (partitions == 0) {
@@ -6,11 +6,13 @@
 #include <ddk/driver.h>
 #include <ddk/binding.h>
 #include <ddk/common/hid.h>
+#include <ddk/iotxn.h>
 
 #include <magenta/types.h>
 #include <magenta/device/i2c.h>
 
 #include <endian.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +25,10 @@
 // Poll interval: 10 ms
 #define I2C_POLL_INTERVAL_USEC 10000
 
+// Reads queued on the bus at once, so the next poll can go out while the
+// bus is still busy with the last one.
+#define I2C_HID_READ_COUNT 2
+
 #define to_i2c_hid(d) containerof(d, i2c_hid_device_t, hiddev)
 
 typedef struct i2c_hid_desc {
@@ -48,6 +54,10 @@ typedef struct i2c_hid_device {
 
     i2c_hid_desc_t* hiddesc;
     thrd_t irq_thread;
+
+    // input report reads not queued on the bus
+    list_node_t free_reads;
+    mtx_t lock;
 } i2c_hid_device_t;
 
 static uint8_t* i2c_hid_prepare_write_read_buffer(uint8_t* buf, int wlen, int rlen) {
@@ -144,35 +154,63 @@ static inline size_t bcdtoa(uint16_t val, char str[static 6], bool pad) {
     return idx;
 }
 
+static void i2c_hid_read_complete(iotxn_t* txn, void* cookie) {
+    i2c_hid_device_t* dev = cookie;
+
+    if (txn->status != NO_ERROR || txn->actual < 2) {
+        printf("i2c-hid: short read (%d, %" PRIu64 " < 2)!!!\n", txn->status, txn->actual);
+        goto done;
+    }
+
+    uint8_t* buf;
+    txn->ops->mmap(txn, (void**)&buf);
+    uint16_t report_len = letoh16(*(uint16_t*)buf);
+    if (report_len == 0xffff || report_len == 0x3fff) {
+        // nothing to read
+        goto done;
+    }
+    if (txn->actual < report_len) {
+        printf("i2c-hid: short read (%" PRIu64 " < %u)!!!\n", txn->actual, report_len);
+        goto done;
+    }
+    hid_io_queue(&dev->hiddev, buf + 2, report_len - 2);
+
+done:
+    mtx_lock(&dev->lock);
+    list_add_tail(&dev->free_reads, &txn->node);
+    mtx_unlock(&dev->lock);
+}
+
 static int i2c_hid_irq_thread(void* arg) {
     i2c_hid_device_t* dev = (i2c_hid_device_t*)arg;
     uint16_t len = letoh16(dev->hiddesc->wMaxInputLength);
-    uint8_t* buf = malloc(len);
+
+    for (int i = 0; i < I2C_HID_READ_COUNT; i++) {
+        iotxn_t* txn;
+        if (iotxn_alloc(&txn, 0, len, 0) != NO_ERROR) {
+            break;
+        }
+        txn->opcode = IOTXN_OP_READ;
+        txn->complete_cb = i2c_hid_read_complete;
+        txn->cookie = dev;
+        list_add_tail(&dev->free_reads, &txn->node);
+    }
 
     // Until we have a way to map the GPIO associated with an i2c slave to an
-    // IRQ, we just poll.
+    // IRQ, we just poll.  Reports are handed up as the reads complete; if
+    // every read is still queued, the bus is behind and this poll is skipped.
     while (true) {
         usleep(I2C_POLL_INTERVAL_USEC);
-        ssize_t ret = dev->i2cdev->ops->read(dev->i2cdev, buf, len, 0);
-        if (ret < 2) {
-            printf("i2c-hid: short read (%zd < 2)!!!\n", ret);
-            continue;
-        }
-
-        uint16_t report_len = letoh16(*(uint16_t*)buf);
-        if (report_len == 0xffff || report_len == 0x3fff) {
-            // nothing to read
-            continue;
-        }
-        if (ret < report_len) {
-            printf("i2c-hid: short read (%zd < %u)!!!\n", ret, report_len);
-            continue;
+        mtx_lock(&dev->lock);
+        iotxn_t* txn = list_remove_head_type(&dev->free_reads, iotxn_t, node);
+        mtx_unlock(&dev->lock);
+        if (txn) {
+            txn->length = len;
+            iotxn_queue(dev->i2cdev, txn);
         }
-        hid_io_queue(&dev->hiddev, buf + 2, report_len - 2);
     }
 
     // TODO: figure out how to clean up
-    free(buf);
     return 0;
 }
 
@@ -199,6 +237,8 @@ static mx_status_t i2c_hid_bind(mx_driver_t* drv, mx_device_t* dev) {
         return ERR_NO_MEMORY;
     }
     i2chid->i2cdev = dev;
+    list_initialize(&i2chid->free_reads);
+    mtx_init(&i2chid->lock, mtx_plain);
     i2chid->hiddesc = malloc(desc_len);
 
     i2c_hid_prepare_write_read_buffer(buf, 2, desc_len);
@@ -17,9 +17,11 @@
 
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <threads.h>
 
 typedef mx_status_t status_t;
@@ -48,13 +50,38 @@ struct ethernet_device {
     // Buffer mappings
     uint8_t* rx_map;
     uint8_t* tx_map;
+    size_t rx_len;
+    size_t tx_len;
+    // where the buffers are, if their pages could be locked: the hardware
+    // then reads and writes them directly
+    mx_paddr_t* rx_pages;
+    mx_paddr_t* tx_pages;
+    // rx entries taken from the fifo, and the buffers of those that are
+    // neither with the hardware nor returned
+    uint64_t rx_taken;
+    eth_fifo_entry_t* rx_pool;
+    uint32_t rx_pool_count;
+    // tx entries taken from the fifo, and which of them are done (sent, or
+    // failed), as the fifo returns them in order; the hardware has the
+    // packets of tx_queued of them, the oldest from tx_sent on
+    uint64_t tx_taken;
+    uint64_t tx_sent;
+    uint32_t tx_queued;
+    bool* tx_done;
+    completion_t tx_reclaimed;
     // fifo threads
     thrd_t tx_thr;
 };
 
 #define get_eth_device(d) containerof(d, ethernet_device_t, dev)
 
-static void eth_handle_rx(ethernet_device_t* edev);
+// a client rx buffer, as the cookie of the descriptor it is given to
+#define ETH_RX_COOKIE(offset, length) (((uint64_t)(length) << 32) | (offset))
+#define ETH_RX_COOKIE_OFFSET(cookie) ((uint32_t)(cookie))
+#define ETH_RX_COOKIE_LENGTH(cookie) ((uint16_t)((cookie) >> 32))
+
+static uint32_t eth_handle_rx(ethernet_device_t* edev, uint32_t* out_bytes);
+static void eth_handle_tx_locked(ethernet_device_t* edev);
 
 static int irq_thread(void* arg) {
     ethernet_device_t* edev = arg;
@@ -70,10 +97,17 @@ static int irq_thread(void* arg) {
             mx_interrupt_complete(edev->irqh);
 
         mtx_lock(&edev->lock);
-        if (eth_handle_irq(&edev->eth) & ETH_IRQ_RX) {
-            eth_handle_rx(edev);
+        unsigned irq = eth_handle_irq(&edev->eth);
+        if (irq & ETH_IRQ_RX) {
+            uint32_t bytes;
+            uint32_t packets = eth_handle_rx(edev, &bytes);
+            eth_update_itr(&edev->eth, packets, bytes);
             device_state_set(&edev->dev, DEV_STATE_READABLE);
         }
+        if ((irq & ETH_IRQ_TX) && (edev->fifo.tx_fifo != MX_HANDLE_INVALID)) {
+            eth_handle_tx_locked(edev);
+            completion_signal(&edev->tx_reclaimed);
+        }
         mtx_unlock(&edev->lock);
 
         if (!edev->edge_triggered_irq)
@@ -92,57 +126,252 @@ static size_t eth_get_mtu(mx_device_t* dev) {
     return ETH_RXBUF_SIZE;
 }
 
-static void eth_handle_rx(ethernet_device_t* edev) {
+// Finds where a buffer of a locked region of the client's VMO is: as up to
+// max physically contiguous parts, returning how many, or 0 if it takes more
+// or cannot be reached.
+static uint32_t eth_buffer_parts(const mx_paddr_t* pages, size_t region_len, uint64_t offset,
+                                 size_t len, mx_paddr_t* phys, size_t* plen, uint32_t max) {
+    if ((pages == NULL) || (len == 0) || (offset + len > region_len)) {
+        return 0;
+    }
+    uint32_t parts = 0;
+    uint64_t end = offset + len;
+    while (offset < end) {
+        uint64_t page = offset / PAGE_SIZE;
+        mx_paddr_t addr = pages[page] + (offset % PAGE_SIZE);
+        size_t n = MIN(end, (page + 1) * PAGE_SIZE) - offset;
+        if ((parts > 0) && (phys[parts - 1] + plen[parts - 1] == addr)) {
+            plen[parts - 1] += n;
+        } else if (parts < max) {
+            phys[parts] = addr;
+            plen[parts] = n;
+            parts++;
+        } else {
+            return 0;
+        }
+        offset += n;
+    }
+    return parts;
+}
+
+// Drops the packets received until none are left, returning how many.
+static uint32_t eth_drop_rx(ethernet_device_t* edev, uint32_t* bytes) {
+    uint32_t packets = 0;
     mx_status_t status;
-    mx_fifo_state_t state;
+    uint64_t cookie;
+    void* data;
+    uint32_t flags;
+    while ((status = eth_rx(&edev->eth, &cookie, &data, &flags)) != ERR_SHOULD_WAIT) {
+        if (status >= 0) {
+            packets++;
+            *bytes += status;
+        }
+        eth_rx_refill(&edev->eth, 0, ETH_RX_OWN_BUFFER);
+    }
+    return packets;
+}
 
-    if (edev->fifo.rx_fifo == MX_HANDLE_INVALID) {
-        // No client has established a fifo, so drop the packet
-        eth_rx(&edev->eth, NULL);
-        return;
+// Takes a buffer of at least len bytes from the pool; where phys is given,
+// one the hardware can write a packet to directly.
+static bool eth_rx_pool_get(ethernet_device_t* edev, size_t len, mx_paddr_t* phys,
+                            eth_fifo_entry_t* out) {
+    for (uint32_t i = edev->rx_pool_count; i-- > 0;) {
+        eth_fifo_entry_t* buf = &edev->rx_pool[i];
+        size_t plen;
+        if ((buf->length < len) ||
+            ((phys != NULL) && (eth_buffer_parts(edev->rx_pages, edev->rx_len, buf->offset,
+                                                 ETH_RXBUF_SIZE, phys, &plen, 1) == 0))) {
+            continue;
+        }
+        *out = *buf;
+        *buf = edev->rx_pool[--edev->rx_pool_count];
+        return true;
+    }
+    return false;
+}
+
+// Fills the next entry the client is to get back with a buffer of its, which
+// need not be the one the entry was queued with.
+static void eth_rx_return(ethernet_device_t* edev, const mx_fifo_state_t* state,
+                          uint64_t* filled, uint32_t offset, uint16_t length, uint32_t flags) {
+    uint64_t entry_idx = (state->tail + *filled) & (edev->fifo.rx_entries_count - 1);
+    eth_fifo_entry_t* entry = &edev->rx_entries[entry_idx];
+    entry->offset = offset;
+    entry->length = length;
+    entry->flags = (flags & ETH_RX_CSUM_OK) ? ETH_FIFO_RX_CSUM_OK : 0;
+    (*filled)++;
+}
+
+// Hands the packets received to the client in one batch, returning how many
+// there were, as well as their bytes. Those the hardware wrote to the
+// client's buffers are returned as they are; those in the driver's own are
+// copied to a buffer from the pool, or dropped when there is none.
+static uint32_t eth_handle_rx(ethernet_device_t* edev, uint32_t* out_bytes) {
+    mx_status_t status;
+    mx_fifo_state_t state;
+    uint32_t packets = 0;
+    *out_bytes = 0;
+
+    if ((edev->fifo.rx_fifo == MX_HANDLE_INVALID) || (edev->rx_len == 0)) {
+        // No client has established a fifo, so drop the packets
+        packets = eth_drop_rx(edev, out_bytes);
+        eth_rx_flush(&edev->eth);
+        return packets;
     }
 
     status = mx_fifo_op(edev->fifo.rx_fifo, MX_FIFO_OP_READ_STATE, 0, &state);
     if (status != NO_ERROR) {
         printf("%s could not read rx fifo state (%d)\n", __func__, status);
-        return;
-    }
-    if (state.head == state.tail) {
-        eth_rx(&edev->eth, NULL);
-        return;
+        return 0;
     }
-    uint64_t num_fifo_entries = state.head - state.tail;
-    while (num_fifo_entries > 0) {
-        uint64_t entry_idx = state.tail & (edev->fifo.rx_entries_count - 1);
-        eth_fifo_entry_t* entry = &edev->rx_entries[entry_idx];
-        status = eth_rx(&edev->eth, &edev->rx_map[entry->offset]);
-        if (status == ERR_SHOULD_WAIT) {
-            // Done processing rx
-            break;
+
+    // the buffers of the entries queued since are the driver's until
+    // returned; a copy is kept, as the client may write the entries
+    uint64_t filled = 0;
+    while (edev->rx_taken < state.head) {
+        uint64_t entry_idx = edev->rx_taken & (edev->fifo.rx_entries_count - 1);
+        eth_fifo_entry_t buf = edev->rx_entries[entry_idx];
+        if (buf.offset + (size_t)buf.length > edev->rx_len) {
+            eth_rx_return(edev, &state, &filled, buf.offset, 0, 0);
+        } else {
+            edev->rx_pool[edev->rx_pool_count++] = buf;
         }
+        edev->rx_taken++;
+    }
+
+    uint64_t cookie;
+    void* data;
+    uint32_t flags;
+    while ((status = eth_rx(&edev->eth, &cookie, &data, &flags)) != ERR_SHOULD_WAIT) {
         if (status < 0) {
             printf("eth: could not read packet: %d\n", status);
-            break;
+            if (cookie != ETH_RX_OWN_BUFFER) {
+                eth_fifo_entry_t* buf = &edev->rx_pool[edev->rx_pool_count++];
+                buf->offset = ETH_RX_COOKIE_OFFSET(cookie);
+                buf->length = ETH_RX_COOKIE_LENGTH(cookie);
+            }
+        } else {
+            eth_fifo_entry_t buf;
+            if (cookie != ETH_RX_OWN_BUFFER) {
+                eth_rx_return(edev, &state, &filled, ETH_RX_COOKIE_OFFSET(cookie), status,
+                              flags);
+            } else if (eth_rx_pool_get(edev, status, NULL, &buf)) {
+                memcpy(&edev->rx_map[buf.offset], data, status);
+                eth_rx_return(edev, &state, &filled, buf.offset, status, flags);
+            }
+            // else the client has no room for it: it is dropped
+            packets++;
+            *out_bytes += status;
         }
-        entry->length = status;
-        // TODO: batch up fifo ops
-        mx_status_t status = mx_fifo_op(edev->fifo.rx_fifo, MX_FIFO_OP_ADVANCE_TAIL, 1u, &state);
+
+        // the descriptor takes the next packet in a client buffer, if one
+        // can be written to directly
+        eth_fifo_entry_t buf;
+        mx_paddr_t phys;
+        if (eth_rx_pool_get(edev, ETH_RXBUF_SIZE, &phys, &buf)) {
+            eth_rx_refill(&edev->eth, phys, ETH_RX_COOKIE(buf.offset, buf.length));
+        } else {
+            eth_rx_refill(&edev->eth, 0, ETH_RX_OWN_BUFFER);
+        }
+    }
+    if (filled > 0) {
+        status = mx_fifo_op(edev->fifo.rx_fifo, MX_FIFO_OP_ADVANCE_TAIL, filled, &state);
         if (status != NO_ERROR) {
             printf("%s could not advance rx fifo tail (%d)\n", __func__, status);
             // TODO: figure out what to do in this case. Current logic will
-            // drop the packet that we just received, which seems fine for
+            // drop the packets that we just received, which seems fine for
             // now.
         }
-        num_fifo_entries = state.head - state.tail;
+    }
+    eth_rx_flush(&edev->eth);
+    return packets;
+}
+
+// Queues the packets of the tx entries added since last time, sending them
+// from the client's buffers where the hardware can reach them, and returns
+// the entries done with, in order. The client may not reuse a buffer before
+// then.
+static void eth_handle_tx_locked(ethernet_device_t* edev) {
+    mx_fifo_state_t state;
+    mx_status_t status = mx_fifo_op(edev->fifo.tx_fifo, MX_FIFO_OP_READ_STATE, 0, &state);
+    if (status != NO_ERROR) {
+        printf("%s could not read tx fifo state (%d)\n", __func__, status);
+        return;
+    }
+    uint32_t mask = edev->fifo.tx_entries_count - 1;
+
+    // the oldest entries the hardware has are the ones it sent
+    uint32_t sent = eth_tx_reclaim(&edev->eth);
+    edev->tx_queued -= sent;
+    while (sent > 0) {
+        if (!edev->tx_done[edev->tx_sent & mask]) {
+            edev->tx_done[edev->tx_sent & mask] = true;
+            sent--;
+        }
+        edev->tx_sent++;
+    }
+
+    while (edev->tx_taken < state.head) {
+        uint64_t entry_idx = edev->tx_taken & mask;
+        eth_fifo_entry_t* entry = &edev->tx_entries[entry_idx];
+        uint32_t offset = entry->offset;
+        size_t len = entry->length;
+
+        mx_paddr_t phys[ETH_TX_PARTS];
+        size_t plen[ETH_TX_PARTS];
+        uint32_t parts = eth_buffer_parts(edev->tx_pages, edev->tx_len, offset, len,
+                                          phys, plen, ETH_TX_PARTS);
+        if (parts > 0) {
+            status = eth_tx_queue(&edev->eth, phys, plen, parts);
+        } else if (offset + len <= edev->tx_len) {
+            status = eth_tx(&edev->eth, &edev->tx_map[offset], len);
+        } else {
+            status = ERR_INVALID_ARGS;
+        }
+        if (status == ERR_NO_MEMORY) {
+            // the ring is full: the rest waits for some of it to be sent
+            break;
+        }
+        if (status < 0) {
+            printf("%s could not sent packet: %d\n", __func__, status);
+            edev->tx_done[entry_idx] = true;
+        } else {
+            edev->tx_done[entry_idx] = false;
+            edev->tx_queued++;
+        }
+        edev->tx_taken++;
+    }
+    eth_tx_flush(&edev->eth);
+
+    uint64_t done = 0;
+    while ((state.tail + done < edev->tx_taken) && edev->tx_done[(state.tail + done) & mask]) {
+        done++;
+    }
+    if (done > 0) {
+        status = mx_fifo_op(edev->fifo.tx_fifo, MX_FIFO_OP_ADVANCE_TAIL, done, &state);
+        if (status != NO_ERROR) {
+            printf("%s could not advance tx fifo tail (%d)\n", __func__, status);
+        }
     }
 }
 
 static int eth_tx_thread(void* arg) {
     ethernet_device_t* edev = (ethernet_device_t*)arg;
 
-    mx_fifo_state_t state;
     mx_status_t status;
     while (true) {
+        completion_reset(&edev->tx_reclaimed);
+        mtx_lock(&edev->lock);
+        eth_handle_tx_locked(edev);
+        bool queued = edev->tx_queued > 0;
+        mtx_unlock(&edev->lock);
+
+        if (queued) {
+            // entries still unreturned keep the fifo from looking empty; the
+            // irq thread queues more as it returns those sent
+            completion_wait(&edev->tx_reclaimed, MX_SEC(1));
+            continue;
+        }
         do {
             status = mx_handle_wait_one(edev->fifo.tx_fifo, MX_FIFO_NOT_EMPTY, MX_SEC(1), NULL);
             // TODO: deal with unbind/release for intel-ethernet
@@ -151,30 +380,6 @@ static int eth_tx_thread(void* arg) {
             printf("%s handle wait for tx fifo failed (%d)\n", __func__, status);
             break;
         }
-
-        status = mx_fifo_op(edev->fifo.tx_fifo, MX_FIFO_OP_READ_STATE, 0, &state);
-        if (status != NO_ERROR) {
-            printf("%s could not read tx fifo state (%d)\n", __func__, status);
-            break;
-        }
-
-        uint64_t num_fifo_entries = state.head - state.tail;
-        while (num_fifo_entries > 0) {
-            uint64_t entry_idx = state.tail & (edev->fifo.tx_entries_count - 1);
-            eth_fifo_entry_t* entry = &edev->tx_entries[entry_idx];
-
-            status = eth_tx(&edev->eth, &edev->tx_map[entry->offset], entry->length);
-            if (status < 0) {
-                printf("%s could not sent packet: %d\n", __func__, status);
-            }
-
-            // TODO: batch these up
-            mx_status_t status = mx_fifo_op(edev->fifo.tx_fifo, MX_FIFO_OP_ADVANCE_TAIL, 1u, &state);
-            if (status != NO_ERROR) {
-                printf("%s could not advance tx fifo tail (%d)\n", __func__, status);
-            }
-            num_fifo_entries = state.head - state.tail;
-        }
     }
     return 0;
 }
@@ -201,6 +406,14 @@ static ssize_t eth_get_fifo(ethernet_device_t* edev, const void* in_buf, size_t
         return status;
     }
 
+    // the driver's state for the entries it has
+    edev->rx_pool = calloc(fifo.rx_entries_count, sizeof(eth_fifo_entry_t));
+    edev->tx_done = calloc(fifo.tx_entries_count, sizeof(bool));
+    if ((edev->rx_pool == NULL) || (edev->tx_done == NULL)) {
+        status = ERR_NO_MEMORY;
+        goto clone_consumer_fail;
+    }
+
     // Set up the driver's copy
     status = eth_fifo_clone_consumer(&fifo, &edev->fifo);
     if (status != NO_ERROR) {
@@ -246,10 +459,34 @@ map_tx_entries_fail:
 map_rx_entries_fail:
     eth_fifo_cleanup(&edev->fifo);
 clone_consumer_fail:
+    free(edev->rx_pool);
+    free(edev->tx_done);
+    edev->rx_pool = NULL;
+    edev->tx_done = NULL;
     eth_fifo_cleanup(&fifo);
     return status;
 }
 
+// Locks a region of the client's buffer VMO in memory, returning where its
+// pages are, or NULL if they may move: its packets are copied then.
+static mx_paddr_t* eth_lock_region(mx_handle_t vmo, uint64_t offset, size_t len) {
+    if ((len == 0) || (offset % PAGE_SIZE) || (len % PAGE_SIZE)) {
+        return NULL;
+    }
+    if (mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, offset, len, NULL, 0) != NO_ERROR) {
+        return NULL;
+    }
+    size_t size = (len / PAGE_SIZE) * sizeof(mx_paddr_t);
+    mx_paddr_t* pages = malloc(size);
+    if ((pages == NULL) ||
+        (mx_vmo_op_range(vmo, MX_VMO_OP_LOOKUP, offset, len, pages, size) != NO_ERROR)) {
+        free(pages);
+        mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, offset, len, NULL, 0);
+        return NULL;
+    }
+    return pages;
+}
+
 static ssize_t eth_set_io_buf(ethernet_device_t* edev, const void* in_buf, size_t in_len) {
     if (in_len < sizeof(eth_set_io_buf_args_t) || !in_buf) return ERR_INVALID_ARGS;
 
@@ -269,6 +506,18 @@ static ssize_t eth_set_io_buf(ethernet_device_t* edev, const void* in_buf, size_
         printf("eth: could not map tx buffer: %d\n", status);
         goto map_tx_failed;
     }
+
+    mx_paddr_t* rx_pages = eth_lock_region(edev->io_vmo, args->rx_offset, args->rx_len);
+    mx_paddr_t* tx_pages = eth_lock_region(edev->io_vmo, args->tx_offset, args->tx_len);
+    if ((rx_pages == NULL) || (tx_pages == NULL)) {
+        printf("eth: buffers not locked, packets are copied\n");
+    }
+    mtx_lock(&edev->lock);
+    edev->rx_pages = rx_pages;
+    edev->tx_pages = tx_pages;
+    edev->rx_len = args->rx_len;
+    edev->tx_len = args->tx_len;
+    mtx_unlock(&edev->lock);
     return NO_ERROR;
 
 map_tx_failed:
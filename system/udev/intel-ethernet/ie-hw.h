@@ -18,6 +18,7 @@
 #define IE_ICS       0x00C8 // Interrupt Cause Set
 #define IE_IMS       0x00D0 // Interrupt Mask Set / Read
 #define IE_IMC       0x00D8 // Interrupt Mask Clear
+#define IE_ITR       0x00C4 // Interrupt Throttling
 
 #define IE_RCTL      0x0100 // Receive Control
 #define IE_RDBAL     0x2800 // RX Descriptor Base Low
@@ -25,7 +26,8 @@
 #define IE_RDLEN     0x2808 // RX Descriptor Length
 #define IE_RDH       0x2810 // RX Descriptor Head
 #define IE_RDT       0x2818 // RX Descriptor Tail
-#define IE_RDTR      0x3820 // RX Delay Timer
+#define IE_RDTR      0x2820 // RX Delay Timer
+#define IE_RADV      0x282C // RX Interrupt Absolute Delay Timer
 
 #define IE_TCTL      0x0400 // Transmit Control
 #define IE_TIPG      0x0410 // TX IPG
@@ -35,6 +37,7 @@
 #define IE_TDH       0x3810 // TX Descriptor Head
 #define IE_TDT       0x3818 // TX Descriptor Tail
 #define IE_TIDV      0x3820 // TX Interrupt Delay Value
+#define IE_TADV      0x382C // TX Interrupt Absolute Delay Value
 
 #define IE_TXDMAC    0x3000 // TX DMA Control
 #define IE_TXDCTL    0x3828 // TX Descriptor Control
@@ -103,6 +106,9 @@
 #define IE_RCTL_BSEX      (1 << 25) // Buffer Size Extension (x16)
 #define IE_RCTL_SECRC     (1 << 26) // Strip CRC Field
 
+#define IE_RXCSUM_IPOFL   (1 << 8) // IP Checksum Offload Enable
+#define IE_RXCSUM_TUOFL   (1 << 9) // TCP/UDP Checksum Offload Enable
+
 #define IE_TCTL_RST       (1 << 0) // TX Reset?
 #define IE_TCTL_EN        (1 << 1) // TX Enable
 #define IE_TCTL_PSP       (1 << 3) // Pad Short Packets (to 64b)
@@ -111,6 +117,9 @@
 #define IE_TCTL_COLD_FD   (0x40 << 12) // Collision Distance Full Duplex
 #define IE_TCTL_SWXOFF    (1 << 22) // XOFF TX (self-clearing)
 
+// ITR holds the least interval between interrupts, in 256ns units
+#define IE_ITR_INTERVAL(ints_per_sec) (1000000000u / ((ints_per_sec) * 256u))
+
 
 typedef struct ie_rxd {
     uint64_t addr;
@@ -3,12 +3,14 @@
 // found in the LICENSE file.
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <magenta/listnode.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
 #if _KERNEL
 //TODO: proper includes/defines kernel driver
@@ -44,7 +46,7 @@ unsigned eth_handle_irq(ethdev_t* eth) {
     return readl(IE_ICR);
 }
 
-status_t eth_rx(ethdev_t* eth, void* data) {
+status_t eth_rx(ethdev_t* eth, uint64_t* cookie, void** data, uint32_t* flags) {
     uint32_t n = eth->rx_rd_ptr;
     uint64_t info = eth->rxd[n].info;
 
@@ -52,22 +54,57 @@ status_t eth_rx(ethdev_t* eth, void* data) {
         return ERR_SHOULD_WAIT;
     }
 
-    // copy out packet
+    *cookie = eth->rx_cookies[n];
+    *data = eth->rxb + ETH_RXBUF_SIZE * n;
+    *flags = ((info & (IE_RXD_TCPCS | IE_RXD_TCPE | IE_RXD_IXSM)) == IE_RXD_TCPCS) ?
+             ETH_RX_CSUM_OK : 0;
     mx_status_t r = IE_RXD_LEN(info);
     if (r > ETH_RXBUF_SIZE) {
         // should not be possible, but...
         r = ERR_BAD_STATE;
-    } else if (data) {
-        memcpy(data, eth->rxb + ETH_RXBUF_SIZE * n, r);
     }
+    return r;
+}
 
-    // make buffer available to hw
+void eth_rx_refill(ethdev_t* eth, mx_paddr_t phys, uint64_t cookie) {
+    uint32_t n = eth->rx_rd_ptr;
+    if (cookie == ETH_RX_OWN_BUFFER) {
+        phys = eth->rxb_phys + ETH_RXBUF_SIZE * n;
+    }
+    eth->rxd[n].addr = phys;
+    eth->rx_cookies[n] = cookie;
+
+    // buffer is handed back to hw by eth_rx_flush()
     eth->rxd[n].info = 0;
-    writel(n, IE_RDT);
     n = (n + 1) & (ETH_RXBUF_COUNT - 1);
     eth->rx_rd_ptr = n;
+}
 
-    return r;
+void eth_rx_flush(ethdev_t* eth) {
+    // hw owns the buffers up to the one before the tail
+    uint32_t n = (eth->rx_rd_ptr - 1) & (ETH_RXBUF_COUNT - 1);
+    if (n != eth->rx_tail) {
+        eth->rx_tail = n;
+        writel(n, IE_RDT);
+    }
+}
+
+static uint32_t eth_tx_free(ethdev_t* eth) {
+    // one descriptor stays unused, so a full ring is not an empty one
+    return (eth->tx_rd_ptr - eth->tx_wr_ptr - 1) & (ETH_TXBUF_COUNT - 1);
+}
+
+static void eth_tx_desc(ethdev_t* eth, mx_paddr_t phys, size_t len, bool last,
+                        framebuf_t* frame) {
+    uint32_t n = eth->tx_wr_ptr;
+    eth->txd[n].addr = phys;
+    // status is reported for the last descriptor of a packet only
+    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_IFCS |
+                       (last ? (IE_TXD_EOP | IE_TXD_RS) : 0);
+    eth->tx_frames[n] = frame;
+
+    // hw is told of it by eth_tx_flush()
+    eth->tx_wr_ptr = (n + 1) & (ETH_TXBUF_COUNT - 1);
 }
 
 status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
@@ -75,42 +112,140 @@ status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
         return ERR_INVALID_ARGS;
     }
 
-    // reclaim completed buffers from hw
+    // obtain buffer, copy into it, setup descriptor
+    if (eth_tx_free(eth) == 0) {
+        return ERR_NO_MEMORY;
+    }
+    framebuf_t *frame = list_remove_head_type(&eth->free_frames, framebuf_t, node);
+    if (frame == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    memcpy(frame->data, data, len);
+    eth_tx_desc(eth, frame->phys, len, true, frame);
+    return len;
+}
+
+status_t eth_tx_queue(ethdev_t* eth, const mx_paddr_t* phys, const size_t* len,
+                      uint32_t parts) {
+    size_t total = 0;
+    for (uint32_t i = 0; i < parts; i++) {
+        total += len[i];
+    }
+    if ((parts == 0) || (parts > ETH_TX_PARTS) || (total < 60) || (total > ETH_TXBUF_DSIZE)) {
+        return ERR_INVALID_ARGS;
+    }
+    if (eth_tx_free(eth) < parts) {
+        return ERR_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < parts; i++) {
+        eth_tx_desc(eth, phys[i], len[i], i == (parts - 1), NULL);
+    }
+    return total;
+}
+
+void eth_tx_flush(ethdev_t* eth) {
+    if (eth->tx_wr_ptr != eth->tx_tail) {
+        eth->tx_tail = eth->tx_wr_ptr;
+        writel(eth->tx_tail, IE_TDT);
+    }
+}
+
+uint32_t eth_tx_reclaim(ethdev_t* eth) {
+    uint32_t packets = 0;
     uint32_t n = eth->tx_rd_ptr;
-    for (;;) {
-        uint64_t info = eth->txd[n].info;
-        if (!(info & IE_TXD_DONE)) {
+    while (n != eth->tx_wr_ptr) {
+        // find the last descriptor of the packet, which has its status
+        uint32_t last = n;
+        while (!(eth->txd[last].info & IE_TXD_EOP)) {
+            last = (last + 1) & (ETH_TXBUF_COUNT - 1);
+        }
+        if (!(eth->txd[last].info & IE_TXD_DONE)) {
             break;
         }
-        framebuf_t* frame = list_remove_head_type(&eth->busy_frames, framebuf_t, node);
-        if (frame == NULL) {
-            panic();
+        for (;;) {
+            if (eth->tx_frames[n] != NULL) {
+                list_add_tail(&eth->free_frames, &eth->tx_frames[n]->node);
+                eth->tx_frames[n] = NULL;
+            }
+            eth->txd[n].info = 0;
+            bool done = (n == last);
+            n = (n + 1) & (ETH_TXBUF_COUNT - 1);
+            if (done) {
+                break;
+            }
         }
-        // TODO: verify that this is the matching buffer to txd[n] addr?
-        list_add_tail(&eth->free_frames, &frame->node);
-        eth->txd[n].info = 0;
-        n = (n + 1) & (ETH_TXBUF_COUNT - 1);
+        packets++;
     }
     eth->tx_rd_ptr = n;
+    return packets;
+}
 
-    // obtain buffer, copy into it, setup descriptor
-    framebuf_t *frame = list_remove_head_type(&eth->free_frames, framebuf_t, node);
-    if (frame == NULL) {
-        return ERR_NO_MEMORY;
-    }
-
-    n = eth->tx_wr_ptr;
-    memcpy(frame->data, data, len);
-    eth->txd[n].addr = frame->phys;
-    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS;
-    list_add_tail(&eth->busy_frames, &frame->node);
+// Interrupt moderation, after the scheme of Intel's own drivers: a few
+// small packets get the interrupt rate of lowest latency, a stream of
+// large ones the lowest rate, as it fills the rings anyway.
+#define ETH_ITR_LOWEST_LATENCY 0
+#define ETH_ITR_LOW_LATENCY    1
+#define ETH_ITR_BULK_LATENCY   2
+
+static const uint32_t eth_itr_rates[] = {
+    [ETH_ITR_LOWEST_LATENCY] = 70000,
+    [ETH_ITR_LOW_LATENCY] = 20000,
+    [ETH_ITR_BULK_LATENCY] = 4000,
+};
+
+static void eth_set_itr(ethdev_t* eth, uint32_t rate) {
+    eth->itr_rate = rate;
+    writel(IE_ITR_INTERVAL(rate), IE_ITR);
+}
 
-    // inform hw of buffer availability
-    n = (n + 1) & (ETH_TXBUF_COUNT - 1);
-    eth->tx_wr_ptr = n;
-    writel(n, IE_TDT);
+void eth_update_itr(ethdev_t* eth, uint32_t packets, uint32_t bytes) {
+    if (packets == 0) {
+        return;
+    }
+    uint32_t class = eth->itr_class;
+    uint32_t bytes_per_packet = bytes / packets;
+    switch (class) {
+    case ETH_ITR_LOWEST_LATENCY:
+        if (bytes_per_packet > 8000) {
+            class = ETH_ITR_BULK_LATENCY;
+        } else if ((packets < 5) && (bytes > 512)) {
+            class = ETH_ITR_LOW_LATENCY;
+        }
+        break;
+    case ETH_ITR_LOW_LATENCY:
+        if (bytes > 10000) {
+            if ((packets < 10) || (bytes_per_packet > 1200)) {
+                class = ETH_ITR_BULK_LATENCY;
+            } else if (packets > 35) {
+                class = ETH_ITR_LOWEST_LATENCY;
+            }
+        } else if (bytes_per_packet > 2000) {
+            class = ETH_ITR_BULK_LATENCY;
+        } else if ((packets <= 2) && (bytes < 512)) {
+            class = ETH_ITR_LOWEST_LATENCY;
+        }
+        break;
+    case ETH_ITR_BULK_LATENCY:
+        if (bytes > 25000) {
+            if (packets > 35) {
+                class = ETH_ITR_LOW_LATENCY;
+            }
+        } else if (bytes < 6000) {
+            class = ETH_ITR_LOW_LATENCY;
+        }
+        break;
+    }
+    eth->itr_class = class;
 
-    return len;
+    // step up to a higher rate gradually, so one burst does not undo
+    // the moderation of a stream; step down at once
+    uint32_t rate = eth_itr_rates[class];
+    if (rate > eth->itr_rate) {
+        rate = MIN(eth->itr_rate + (rate >> 2), rate);
+    }
+    if (rate != eth->itr_rate) {
+        eth_set_itr(eth, rate);
+    }
 }
 
 status_t eth_reset_hw(ethdev_t* eth) {
@@ -144,7 +279,9 @@ void eth_init_hw(ethdev_t* eth) {
 
     // setup rx ring
     eth->rx_rd_ptr = 0;
-    writel(0, IE_RXCSUM);
+    eth->rx_tail = ETH_RXBUF_COUNT - 1;
+    // have TCP/UDP checksums verified, for the packets the hardware knows
+    writel(IE_RXCSUM_TUOFL, IE_RXCSUM);
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_RXDCTL);
     writel(eth->rxd_phys, IE_RDBAL);
     writel(eth->rxd_phys >> 32, IE_RDBAH);
@@ -155,23 +292,30 @@ void eth_init_hw(ethdev_t* eth) {
     // setup tx ring
     eth->tx_wr_ptr = 0;
     eth->tx_rd_ptr = 0;
+    eth->tx_tail = 0;
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_TXDCTL);
     writel(eth->txd_phys, IE_TDBAL);
     writel(eth->txd_phys >> 32, IE_TDBAH);
     writel(ETH_TXBUF_COUNT * 16, IE_TDLEN);
     writel(IE_TCTL_CT(15) | IE_TCTL_COLD_FD | IE_TCTL_EN, IE_TCTL);
 
+    // moderate irqs with ITR alone, rather than the rx delay timers
+    writel(0, IE_RDTR);
+    writel(0, IE_RADV);
+    eth->itr_class = ETH_ITR_LOW_LATENCY;
+    eth_set_itr(eth, eth_itr_rates[ETH_ITR_LOW_LATENCY]);
+
     // disable all irqs (write to "clear" mask)
     writel(0xFFFF, IE_IMC);
-    // enable rx irq (write to "set" mask)
-    writel(IE_INT_RXT0, IE_IMS);
+    // enable rx and tx irqs (write to "set" mask): packets sent from client
+    // memory are returned once the hardware is done with them
+    writel(IE_INT_RXT0 | IE_INT_TXDW, IE_IMS);
 }
 
 void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
     printf("eth: iomem @%p (phys %" PRIxPTR ")\n", iomem, iophys);
 
     list_initialize(&eth->free_frames);
-    list_initialize(&eth->busy_frames);
 
     eth->rxd = iomem;
     eth->rxd_phys = iophys;
@@ -192,6 +336,7 @@ void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
 
     for (int n = 0; n < ETH_RXBUF_COUNT; n++) {
         eth->rxd[n].addr = eth->rxb_phys + ETH_RXBUF_SIZE * n;
+        eth->rx_cookies[n] = ETH_RX_OWN_BUFFER;
     }
     for (int n = 0; n < ETH_TXBUF_COUNT - 1; n++) {
         framebuf_t *txb = iomem;
@@ -6,6 +6,21 @@
 
 #include "ie-hw.h"
 
+// with interrupts moderated, the rings hold what arrives between them
+#define ETH_RXBUF_SIZE  2048
+#define ETH_RXBUF_COUNT 128
+
+#define ETH_TXBUF_SIZE  2048
+#define ETH_TXBUF_COUNT 32
+#define ETH_TXBUF_HSIZE 128
+#define ETH_TXBUF_DSIZE (ETH_TXBUF_SIZE - ETH_TXBUF_HSIZE)
+
+#define ETH_DRING_SIZE 2048
+
+#define ETH_ALLOC ((ETH_RXBUF_SIZE * ETH_RXBUF_COUNT) + \
+                   (ETH_TXBUF_SIZE * ETH_TXBUF_COUNT) + \
+                   (ETH_DRING_SIZE * 2))
+
 typedef struct framebuf framebuf_t;
 typedef struct ethdev ethdev_t;
 
@@ -27,8 +42,22 @@ struct ethdev {
     uint32_t tx_rd_ptr;
     uint32_t rx_rd_ptr;
 
+    // what the hardware was last told of the rings
+    uint32_t tx_tail;
+    uint32_t rx_tail;
+
+    // adaptive interrupt moderation: the kind of traffic last seen,
+    // and the interrupt rate chosen for it
+    uint32_t itr_class;
+    uint32_t itr_rate;
+
     list_node_t free_frames;
-    list_node_t busy_frames;
+
+    // the client buffer each rx descriptor was given, by the cookie it
+    // came with, or ETH_RX_OWN_BUFFER
+    uint64_t rx_cookies[ETH_RXBUF_COUNT];
+    // the frame each tx descriptor's data was copied to, if any
+    framebuf_t* tx_frames[ETH_TXBUF_COUNT];
 
     // base physical addresses for
     // tx/rx rings and rx buffers
@@ -41,28 +70,44 @@ struct ethdev {
     uint8_t mac[6];
 };
 
-#define ETH_RXBUF_SIZE  2048
-#define ETH_RXBUF_COUNT 32
-
-#define ETH_TXBUF_SIZE  2048
-#define ETH_TXBUF_COUNT 8
-#define ETH_TXBUF_HSIZE 128
-#define ETH_TXBUF_DSIZE (ETH_TXBUF_SIZE - ETH_TXBUF_HSIZE)
-
-#define ETH_DRING_SIZE 2048
-
-#define ETH_ALLOC ((ETH_RXBUF_SIZE * ETH_RXBUF_COUNT) + \
-                   (ETH_TXBUF_SIZE * ETH_TXBUF_COUNT) + \
-                   (ETH_DRING_SIZE * 2))
-
 status_t eth_reset_hw(ethdev_t* eth);
 void eth_setup_buffers(ethdev_t* eth, void* iomem, uintptr_t iophys);
 void eth_init_hw(ethdev_t* eth);
 
 void eth_dump_regs(ethdev_t* eth);
 
-status_t eth_rx(ethdev_t* eth, void* data);
+// the descriptors eth_rx_refill() frees and eth_tx() and eth_tx_queue()
+// fill are handed to the hardware in batches, by eth_rx_flush() and
+// eth_tx_flush()
+
+// Returns the length of the packet in the next rx descriptor, what the
+// hardware checked of it, and the cookie of the buffer it is in: one
+// eth_rx_refill() gave the descriptor, or ETH_RX_OWN_BUFFER, with *data
+// pointing at the driver's own.
+#define ETH_RX_OWN_BUFFER UINT64_MAX
+#define ETH_RX_CSUM_OK (1u << 0) // TCP/UDP checksum verified
+status_t eth_rx(ethdev_t* eth, uint64_t* cookie, void** data, uint32_t* flags);
+// Gives the descriptor eth_rx() returned back to the hardware, with a
+// client buffer of ETH_RXBUF_SIZE bytes at phys, or the driver's own.
+void eth_rx_refill(ethdev_t* eth, mx_paddr_t phys, uint64_t cookie);
+void eth_rx_flush(ethdev_t* eth);
+
+// Queues a packet copied to one of the driver's frames.
 status_t eth_tx(ethdev_t* eth, const void* data, size_t len);
+// Queues a packet sent from client memory, where it stays until
+// eth_tx_reclaim() counts it: up to ETH_TX_PARTS physically contiguous parts.
+#define ETH_TX_PARTS 2
+status_t eth_tx_queue(ethdev_t* eth, const mx_paddr_t* phys, const size_t* len,
+                      uint32_t parts);
+void eth_tx_flush(ethdev_t* eth);
+// Frees the descriptors of packets sent, returning how many there were, in
+// the order they were queued.
+uint32_t eth_tx_reclaim(ethdev_t* eth);
+
+// adapts the interrupt rate to the packets and bytes received since the
+// last interrupt
+void eth_update_itr(ethdev_t* eth, uint32_t packets, uint32_t bytes);
 
 #define ETH_IRQ_RX IE_INT_RXT0
+#define ETH_IRQ_TX IE_INT_TXDW
 unsigned eth_handle_irq(ethdev_t* eth);
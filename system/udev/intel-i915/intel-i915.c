@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #define INTEL_I915_VID (0x8086)
 #define INTEL_I915_BROADWELL_DID (0x1616)
@@ -25,6 +26,21 @@
 #define BACKLIGHT_CTRL_OFFSET (0xc8250)
 #define BACKLIGHT_CTRL_BIT ((uint32_t)(1u << 31))
 
+// pipe A frame counter, which ticks at each vblank
+#define PIPE_FRMCNT_A_OFFSET (0x70040)
+// plane A surface address; a write takes effect at the next vblank, and
+// the live copy shows what is being scanned out
+#define DSPASURF_OFFSET (0x7019c)
+#define DSPASURFLIVE_OFFSET (0x701ac)
+#define DSPASURF_ADDR_MASK (0xfffff000u)
+
+// framebuffers in the aperture, after the firmware's, each aligned for the
+// display plane
+#define INTEL_I915_MAX_BUFFERS 3
+#define INTEL_I915_SURF_ALIGN (256 * 1024)
+
+#define INTEL_I915_VSYNC_POLL_INTERVAL MX_USEC(500)
+
 #define TRACE 0
 
 #if TRACE
@@ -47,6 +63,20 @@ typedef struct intel_i915_device {
 
     mx_display_info_t info;
     uint32_t flags;
+
+    // the framebuffers, and their graphics addresses for the display plane
+    void* buffers[INTEL_I915_MAX_BUFFERS];
+    uint32_t buffer_addrs[INTEL_I915_MAX_BUFFERS];
+    uint32_t buffer_count;
+
+    // page flips, under lock: the buffer being scanned out, and the one a
+    // flip is waiting on the next vblank for, if any
+    mtx_t lock;
+    uint32_t front;
+    int32_t pending;
+    mx_handle_t vsync_event;
+    thrd_t vsync_thread;
+    bool vsync_running;
 } intel_i915_device_t;
 
 #define FLAGS_BACKLIGHT 1
@@ -67,6 +97,79 @@ static void intel_i915_enable_backlight(intel_i915_device_t* dev, bool enable) {
     }
 }
 
+static inline uint32_t intel_i915_read32(intel_i915_device_t* dev, uint32_t offset) {
+    return pcie_read32((uint32_t*)((uint8_t*)dev->regs + offset));
+}
+
+static inline void intel_i915_write32(intel_i915_device_t* dev, uint32_t offset, uint32_t val) {
+    pcie_write32((uint32_t*)((uint8_t*)dev->regs + offset), val);
+}
+
+// Watches for vblanks, completing flips and signaling the vsync event at
+// each. The hardware interrupt is not hooked up, so this polls the frame
+// counter.
+static int intel_i915_vsync_thread(void* arg) {
+    intel_i915_device_t* dev = arg;
+    uint32_t frame = intel_i915_read32(dev, PIPE_FRMCNT_A_OFFSET);
+    for (;;) {
+        mx_nanosleep(INTEL_I915_VSYNC_POLL_INTERVAL);
+        uint32_t now = intel_i915_read32(dev, PIPE_FRMCNT_A_OFFSET);
+        if (now == frame) {
+            continue;
+        }
+        frame = now;
+
+        mtx_lock(&dev->lock);
+        if (dev->pending >= 0) {
+            uint32_t live = intel_i915_read32(dev, DSPASURFLIVE_OFFSET) & DSPASURF_ADDR_MASK;
+            if (live == dev->buffer_addrs[dev->pending]) {
+                dev->front = dev->pending;
+                dev->pending = -1;
+            }
+        }
+        mtx_unlock(&dev->lock);
+        mx_object_signal(dev->vsync_event, 0, MX_EVENT_SIGNALED);
+    }
+    return 0;
+}
+
+// starts the vsync thread the first time something needs it; called with
+// the lock held
+static mx_status_t intel_i915_start_vsync(intel_i915_device_t* dev) {
+    if (dev->vsync_running) {
+        return NO_ERROR;
+    }
+    if (thrd_create_with_name(&dev->vsync_thread, intel_i915_vsync_thread, dev,
+                              "intel-i915-vsync") != thrd_success) {
+        return ERR_NO_RESOURCES;
+    }
+    thrd_detach(dev->vsync_thread);
+    dev->vsync_running = true;
+    return NO_ERROR;
+}
+
+// Finds room for more framebuffers in the aperture after the one the
+// firmware set up, which the plane is scanning out now.
+static void intel_i915_init_buffers(intel_i915_device_t* dev) {
+    mx_display_info_t* di = &dev->info;
+    uint32_t pixelsize = (di->format == MX_PIXEL_FORMAT_RGB_565) ? 2 : 4;
+    uint64_t size = (uint64_t)di->stride * di->height * pixelsize;
+    size = (size + INTEL_I915_SURF_ALIGN - 1) & ~((uint64_t)INTEL_I915_SURF_ALIGN - 1);
+
+    uint32_t base = intel_i915_read32(dev, DSPASURF_OFFSET) & DSPASURF_ADDR_MASK;
+    dev->buffer_count = 0;
+    for (uint32_t i = 0; i < INTEL_I915_MAX_BUFFERS; i++) {
+        if ((i + 1) * size > dev->framebuffer_size) {
+            break;
+        }
+        dev->buffers[i] = (uint8_t*)dev->framebuffer + i * size;
+        dev->buffer_addrs[i] = base + i * (uint32_t)size;
+        dev->buffer_count++;
+    }
+    dev->front = 0;
+    dev->pending = -1;
+}
+
 // implement display protocol
 
 static mx_status_t intel_i915_set_mode(mx_device_t* dev, mx_display_info_t* info) {
@@ -87,10 +190,52 @@ static mx_status_t intel_i915_get_framebuffer(mx_device_t* dev, void** framebuff
     return NO_ERROR;
 }
 
+static mx_status_t intel_i915_get_framebuffers(mx_device_t* dev, void** framebuffers, uint32_t* count) {
+    intel_i915_device_t* device = get_i915_device(dev);
+    for (uint32_t i = 0; (i < *count) && (i < device->buffer_count); i++) {
+        framebuffers[i] = device->buffers[i];
+    }
+    *count = device->buffer_count;
+    return NO_ERROR;
+}
+
+static mx_status_t intel_i915_flip(mx_device_t* dev, uint32_t index) {
+    intel_i915_device_t* device = get_i915_device(dev);
+    if (index >= device->buffer_count) {
+        return ERR_INVALID_ARGS;
+    }
+    mx_status_t status = NO_ERROR;
+    mtx_lock(&device->lock);
+    if (device->pending >= 0) {
+        status = ERR_SHOULD_WAIT;
+    } else if (index != device->front) {
+        if ((status = intel_i915_start_vsync(device)) == NO_ERROR) {
+            device->pending = index;
+            intel_i915_write32(device, DSPASURF_OFFSET, device->buffer_addrs[index]);
+        }
+    }
+    mtx_unlock(&device->lock);
+    return status;
+}
+
+static mx_status_t intel_i915_get_vsync_event(mx_device_t* dev, mx_handle_t* event) {
+    intel_i915_device_t* device = get_i915_device(dev);
+    mtx_lock(&device->lock);
+    mx_status_t status = intel_i915_start_vsync(device);
+    mtx_unlock(&device->lock);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    return mx_handle_duplicate(device->vsync_event, MX_RIGHT_SAME_RIGHTS, event);
+}
+
 static mx_display_protocol_t intel_i915_display_proto = {
     .set_mode = intel_i915_set_mode,
     .get_mode = intel_i915_get_mode,
     .get_framebuffer = intel_i915_get_framebuffer,
+    .get_framebuffers = intel_i915_get_framebuffers,
+    .flip = intel_i915_flip,
+    .get_vsync_event = intel_i915_get_vsync_event,
 };
 
 // implement device protocol
@@ -190,6 +335,12 @@ static mx_status_t intel_i915_bind(mx_driver_t* drv, mx_device_t* dev) {
     }
     di->flags = MX_DISPLAY_FLAG_HW_FRAMEBUFFER;
 
+    mtx_init(&device->lock, mtx_plain);
+    if ((status = mx_event_create(0, &device->vsync_event)) < 0) {
+        goto fail;
+    }
+    intel_i915_init_buffers(device);
+
     // TODO remove when the gfxconsole moves to user space
     intel_i915_enable_backlight(device, true);
     mx_set_framebuffer(get_root_resource(), device->framebuffer, device->framebuffer_size,
@@ -204,6 +355,12 @@ static mx_status_t intel_i915_bind(mx_driver_t* drv, mx_device_t* dev) {
 
     return NO_ERROR;
 fail:
+    if (device->framebuffer_handle > 0) {
+        mx_handle_close(device->framebuffer_handle);
+    }
+    if (device->regs_handle > 0) {
+        mx_handle_close(device->regs_handle);
+    }
     free(device);
     return status;
 }
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/iotxn.h>
 #include <ddk/protocol/pci.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -297,6 +298,78 @@ static mx_protocol_device_t intel_serialio_i2c_device_proto = {
     .ioctl = &intel_serialio_i2c_ioctl,
 };
 
+static int intel_serialio_i2c_irq_thread(void* arg) {
+    intel_serialio_i2c_device_t* device = arg;
+    for (;;) {
+        mx_status_t status = mx_interrupt_wait(device->irq_handle);
+        if (status < 0) {
+            printf("i2c-controller: irq wait failed: %d\n", status);
+            mx_interrupt_complete(device->irq_handle);
+            break;
+        }
+        if (device->edge_triggered_irq)
+            mx_interrupt_complete(device->irq_handle);
+
+        // Mask everything until the waiting transfer asks for more; the
+        // conditions that raised this stay set for it to see.
+        *REG32(&device->regs->intr_mask) = 0;
+        completion_signal(&device->irq_completion);
+
+        if (!device->edge_triggered_irq)
+            mx_interrupt_complete(device->irq_handle);
+    }
+    return 0;
+}
+
+// The controller lock should already be held when entering this function.
+mx_status_t intel_serialio_i2c_wait_for_irq(
+    intel_serialio_i2c_device_t* device, uint32_t mask) {
+    const mx_time_t timeout = MX_SEC(2);
+
+    if (device->irq_handle <= 0) {
+        mx_time_t deadline = mx_time_get(MX_CLOCK_MONOTONIC) + timeout;
+        while (!(*REG32(&device->regs->raw_intr_stat) & mask)) {
+            if (mx_time_get(MX_CLOCK_MONOTONIC) > deadline)
+                return ERR_TIMED_OUT;
+        }
+        return NO_ERROR;
+    }
+
+    completion_reset(&device->irq_completion);
+    *REG32(&device->regs->intr_mask) = mask;
+    mx_status_t status = completion_wait(&device->irq_completion, timeout);
+    *REG32(&device->regs->intr_mask) = 0;
+    return status;
+}
+
+// Run the iotxns queued on our slaves, one at a time.
+static int intel_serialio_i2c_txn_thread(void* arg) {
+    intel_serialio_i2c_device_t* device = arg;
+    for (;;) {
+        completion_wait(&device->txn_completion, MX_TIME_INFINITE);
+
+        mtx_lock(&device->txn_lock);
+        iotxn_t* txn = list_remove_head_type(&device->txn_list, iotxn_t, node);
+        if (list_is_empty(&device->txn_list))
+            completion_reset(&device->txn_completion);
+        mtx_unlock(&device->txn_lock);
+        if (!txn)
+            continue;
+
+        void* buf;
+        txn->ops->mmap(txn, &buf);
+        i2c_slave_segment_t segment = {
+            .type = (txn->opcode == IOTXN_OP_READ) ? I2C_SEGMENT_TYPE_READ
+                                                   : I2C_SEGMENT_TYPE_WRITE,
+            .buf = buf,
+            .len = txn->length,
+        };
+        mx_status_t status = intel_serialio_i2c_slave_transfer(txn->context, &segment, 1);
+        txn->ops->complete(txn, status, (status == NO_ERROR) ? txn->length : 0);
+    }
+    return 0;
+}
+
 // The controller lock should already be held when entering this function.
 mx_status_t intel_serialio_i2c_reset_controller(
     intel_serialio_i2c_device_t* device) {
@@ -346,8 +419,8 @@ mx_status_t intel_serialio_i2c_reset_controller(
         (speed << CTL_SPEED) |
         (CTL_MASTER_MODE_ENABLED << CTL_MASTER_MODE);
 
-    //XXX Do we need this?
-    *REG32(&device->regs->intr_mask) = INTR_STOP_DETECTION;
+    // Interrupts stay masked until a transfer waits on them.
+    *REG32(&device->regs->intr_mask) = 0;
 
     *REG32(&device->regs->rx_tl) = 0;
     *REG32(&device->regs->tx_tl) = 0;
@@ -416,12 +489,13 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     if (status < 0)
         return status;
 
-    intel_serialio_i2c_device_t* device = malloc(sizeof(*device));
+    intel_serialio_i2c_device_t* device = calloc(1, sizeof(*device));
     if (!device)
         return ERR_NO_MEMORY;
 
     list_initialize(&device->slave_list);
-    memset(&device->mutex, 0, sizeof(device->mutex));
+    list_initialize(&device->txn_list);
+    device->irq_handle = MX_HANDLE_INVALID;
 
     const pci_config_t* pci_config;
     mx_handle_t config_handle = pci->get_config(dev, &pci_config);
@@ -445,6 +519,23 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     if (status < 0)
         goto fail;
 
+    uint32_t comp_param1 = *REG32(&device->regs->comp_param1);
+    device->tx_fifo_depth = ((comp_param1 >> COMP_PARAM1_TX_BUFFER_DEPTH) & 0xff) + 1;
+    device->rx_fifo_depth = ((comp_param1 >> COMP_PARAM1_RX_BUFFER_DEPTH) & 0xff) + 1;
+
+    // Transfers fall back to polling if we cannot get an interrupt.
+    if (pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1) == NO_ERROR) {
+        device->edge_triggered_irq = true;
+    } else if (pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_LEGACY, 1) == NO_ERROR) {
+        device->edge_triggered_irq = false;
+    }
+    mx_handle_t irq_handle = pci->map_interrupt(dev, 0);
+    if (irq_handle > 0) {
+        device->irq_handle = irq_handle;
+    } else {
+        printf("i2c-controller: no irq, polling instead\n");
+    }
+
     char name[MX_DEVICE_NAME_MAX];
     snprintf(name, sizeof(name), "i2c-bus-%04x", pci_config->device_id);
     device_init(&device->device, drv, name,
@@ -474,6 +565,18 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     if (status < 0)
         goto fail;
 
+    if (device->irq_handle > 0 &&
+        thrd_create_with_name(&device->irq_thread, intel_serialio_i2c_irq_thread,
+                              device, "i2c-irq") != thrd_success) {
+        status = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    if (thrd_create_with_name(&device->txn_thread, intel_serialio_i2c_txn_thread,
+                              device, "i2c-txn") != thrd_success) {
+        status = ERR_NO_RESOURCES;
+        goto fail;
+    }
+
     status = device_add(&device->device, dev);
     if (status < 0)
         goto fail;
@@ -495,6 +598,8 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     return NO_ERROR;
 
 fail:
+    if (device->irq_handle > 0)
+        mx_handle_close(device->irq_handle);
     if (device->regs_handle > 0)
         mx_handle_close(device->regs_handle);
     if (config_handle)
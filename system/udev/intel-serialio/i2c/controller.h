@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <ddk/completion.h>
 #include <magenta/types.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <magenta/listnode.h>
 #include <threads.h>
@@ -93,6 +95,11 @@ enum {
     INTR_RX_UNDER = 0,
 };
 
+enum {
+    COMP_PARAM1_TX_BUFFER_DEPTH = 16,
+    COMP_PARAM1_RX_BUFFER_DEPTH = 8,
+};
+
 enum {
     TAR_ADD_WIDTH = 12,
     TAR_ADD_WIDTH_7BIT = 0x0,
@@ -137,11 +144,34 @@ typedef struct intel_serialio_i2c_device {
 
     struct list_node slave_list;
 
+    // FIFO depths, in entries
+    uint32_t tx_fifo_depth;
+    uint32_t rx_fifo_depth;
+
+    // Transfers unmask the interrupts they are waiting for and sleep on
+    // irq_completion, which the irq thread signals.  Without an irq,
+    // irq_handle is invalid and they poll the raw status instead.
+    mx_handle_t irq_handle;
+    bool edge_triggered_irq;
+    thrd_t irq_thread;
+    completion_t irq_completion;
+
+    // iotxns queued on the slaves, which txn_thread runs one at a time
+    struct list_node txn_list;
+    mtx_t txn_lock;
+    completion_t txn_completion;
+    thrd_t txn_thread;
+
     mtx_t mutex;
 } intel_serialio_i2c_device_t;
 
 mx_status_t intel_serialio_i2c_reset_controller(
     intel_serialio_i2c_device_t* controller);
 
+// Waits for any of the interrupts in mask (bits numbered as INTR_*) to be
+// raised.  The controller lock should already be held.
+mx_status_t intel_serialio_i2c_wait_for_irq(
+    intel_serialio_i2c_device_t* controller, uint32_t mask);
+
 #define get_intel_serialio_i2c_device(dev) \
     containerof(dev, intel_serialio_i2c_device_t, device)
@@ -4,6 +4,7 @@
 
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/iotxn.h>
 #include <intel-serialio/reg.h>
 #include <magenta/types.h>
 #include <magenta/device/i2c.h>
@@ -19,8 +20,8 @@
 // Time out after 2 seconds.
 static const uint64_t timeout_ns = 2 * 1000 * 1000 * 1000;
 
-//TODO We should be using interrupts and yielding during long operations, but
-//the plumbing isn't all there for that apparently.
+// For the short waits around a transfer; the transfer itself sleeps on the
+// controller's interrupts.
 #define DO_UNTIL(condition, action)                                           \
     ({                                                                        \
         const uint64_t _wait_for_base_time = mx_time_get(MX_CLOCK_MONOTONIC); \
@@ -55,7 +56,7 @@ static int rx_fifo_empty(intel_serialio_i2c_device_t *controller) {
     return !(*REG32(&controller->regs->i2c_sta) & (0x1 << I2C_STA_RFNE));
 }
 
-static mx_status_t intel_serialio_i2c_slave_transfer(
+mx_status_t intel_serialio_i2c_slave_transfer(
     mx_device_t *dev, i2c_slave_segment_t *segments, int segment_count) {
     mx_status_t status = NO_ERROR;
 
@@ -108,64 +109,118 @@ static mx_status_t intel_serialio_i2c_slave_transfer(
     // Enable the controller.
     RMWREG32(&controller->regs->i2c_en, I2C_EN_ENABLE, 1, 1);
 
+    // Commands go into the TX FIFO as long as it has room, and read data
+    // comes out of the RX FIFO as it arrives, with no more reads
+    // outstanding than the RX FIFO can hold.  When neither can move, we
+    // sleep until the TX FIFO drains below its threshold or the RX FIFO
+    // fills to the number of bytes outstanding.
+    i2c_slave_segment_t* end_seg = segments + segment_count;
+    // The stop goes with the last byte of the last segment that has any.
+    i2c_slave_segment_t* stop_seg = end_seg;
+    while (stop_seg > segments && stop_seg[-1].len == 0)
+        stop_seg--;
+    i2c_slave_segment_t* cmd_seg = segments;
+    while (cmd_seg < end_seg && cmd_seg->len == 0)
+        cmd_seg++;
+    i2c_slave_segment_t* rx_seg = segments;
+    int cmd_pos = 0;
+    int rx_pos = 0;
+    uint32_t outstanding = 0;
     int last_type = I2C_SEGMENT_TYPE_END;
     if (segment_count)
         last_type = segments->type;
 
-    while (segment_count--) {
-        int len = segments->len;
-        uint8_t* buf = segments->buf;
-
-        // If this segment is in the same direction as the last, inject a
-        // restart at its start.
-        uint32_t restart = 0;
-        if (last_type == segments->type)
-            restart = 1;
-        while (len--) {
-            // Build the cmd register value.
-            uint32_t cmd = (restart << DATA_CMD_RESTART);
-            restart = 0;
-            switch (segments->type) {
-            case I2C_SEGMENT_TYPE_WRITE:
-                while (!(*REG32(&controller->regs->i2c_sta) &
-                         (0x1 << I2C_STA_TFNF))) {
-                    ;
-                }
-                cmd |= (*buf << DATA_CMD_DAT);
+    for (;;) {
+        // Skip past segments we are done reading into.
+        while (rx_seg < end_seg &&
+               (rx_seg->type != I2C_SEGMENT_TYPE_READ || rx_pos == rx_seg->len)) {
+            rx_seg++;
+            rx_pos = 0;
+        }
+        if (cmd_seg == end_seg && rx_seg == end_seg)
+            break;
+
+        bool progress = false;
+        uint32_t rxflr = *REG32(&controller->regs->rxflr);
+        while (rxflr-- && outstanding) {
+            rx_seg->buf[rx_pos++] = *REG32(&controller->regs->data_cmd);
+            outstanding--;
+            progress = true;
+            while (rx_seg < end_seg &&
+                   (rx_seg->type != I2C_SEGMENT_TYPE_READ || rx_pos == rx_seg->len)) {
+                rx_seg++;
+                rx_pos = 0;
+            }
+        }
+
+        uint32_t txflr = *REG32(&controller->regs->txflr);
+        while (cmd_seg < end_seg && txflr < controller->tx_fifo_depth &&
+               (cmd_seg->type == I2C_SEGMENT_TYPE_WRITE ||
+                outstanding < controller->rx_fifo_depth)) {
+            // If this segment is in the same direction as the last, inject a
+            // restart at its start.
+            uint32_t cmd = 0;
+            if (cmd_pos == 0 && last_type == cmd_seg->type)
+                cmd |= (0x1 << DATA_CMD_RESTART);
+            if (cmd_seg->type == I2C_SEGMENT_TYPE_WRITE) {
+                cmd |= (cmd_seg->buf[cmd_pos] << DATA_CMD_DAT);
                 cmd |= (DATA_CMD_CMD_WRITE << DATA_CMD_CMD);
-                break;
-            case I2C_SEGMENT_TYPE_READ:
+            } else {
                 cmd |= (DATA_CMD_CMD_READ << DATA_CMD_CMD);
-                break;
-            default:
-                // shouldn't be reachable
-                printf("invalid i2c segment type: %d\n", segments->type);
-                status = ERR_INVALID_ARGS;
-                goto transfer_finish_1;
+                outstanding++;
             }
-
-            if (!len && !segment_count)
+            cmd_pos++;
+            bool last_byte = cmd_pos >= cmd_seg->len;
+            if (last_byte && cmd_seg + 1 == stop_seg)
                 cmd |= (0x1 << DATA_CMD_STOP);
 
             // Write the cmd value.
             *REG32(&controller->regs->data_cmd) = cmd;
-
-            // If this is a read, extract the data.
-            if (segments->type == I2C_SEGMENT_TYPE_READ) {
-                while (!(*REG32(&controller->regs->i2c_sta) &
-                         (0x1 << I2C_STA_RFNE))) {
-                    ;
-                }
-                *buf = *REG32(&controller->regs->data_cmd);
+            txflr++;
+            progress = true;
+
+            if (last_byte) {
+                last_type = cmd_seg->type;
+                cmd_seg++;
+                cmd_pos = 0;
+                // Zero length segments have nothing to send.
+                while (cmd_seg < end_seg && cmd_seg->len == 0)
+                    cmd_seg++;
             }
+        }
 
-            buf++;
+        if (*REG32(&controller->regs->raw_intr_stat) & (0x1 << INTR_TX_ABORT)) {
+            status = ERR_IO;
+            goto transfer_finish_1;
         }
-        last_type = segments->type;
-        segments++;
+        if (progress)
+            continue;
+
+        uint32_t mask = (0x1 << INTR_TX_ABORT);
+        if (cmd_seg < end_seg && txflr >= controller->tx_fifo_depth) {
+            *REG32(&controller->regs->tx_tl) = controller->tx_fifo_depth / 2;
+            mask |= (0x1 << INTR_TX_EMPTY);
+        }
+        if (outstanding) {
+            *REG32(&controller->regs->rx_tl) = outstanding - 1;
+            mask |= (0x1 << INTR_RX_FULL);
+        }
+        status = intel_serialio_i2c_wait_for_irq(controller, mask);
+        if (status < 0)
+            goto transfer_finish_1;
     }
 
-    // Clear out the stop detect interrupt signal.
+    // Wait for the stop condition to go out, then clear it.
+    if (stop_seg > segments) {
+        status = intel_serialio_i2c_wait_for_irq(
+            controller, (0x1 << INTR_STOP_DETECTION) | (0x1 << INTR_TX_ABORT));
+        if (status < 0)
+            goto transfer_finish_1;
+        if (*REG32(&controller->regs->raw_intr_stat) & (0x1 << INTR_TX_ABORT)) {
+            status = ERR_IO;
+            goto transfer_finish_1;
+        }
+    }
     if (!DO_UNTIL(!stop_detected(controller),
                   *REG32(&controller->regs->clr_stop_det))) {
         status = ERR_TIMED_OUT;
@@ -323,12 +378,37 @@ static ssize_t intel_serialio_i2c_slave_ioctl(
     }
 }
 
+// Queue an iotxn for the controller's txn thread, which reads into it or
+// writes it out as a single segment, so a driver can have its next transfer
+// waiting while it handles the last one.
+
+static void intel_serialio_i2c_slave_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    if (txn->opcode != IOTXN_OP_READ && txn->opcode != IOTXN_OP_WRITE) {
+        txn->ops->complete(txn, ERR_NOT_SUPPORTED, 0);
+        return;
+    }
+    if (!dev->parent) {
+        txn->ops->complete(txn, ERR_BAD_STATE, 0);
+        return;
+    }
+
+    intel_serialio_i2c_device_t* controller =
+        get_intel_serialio_i2c_device(dev->parent);
+
+    txn->context = dev;
+    mtx_lock(&controller->txn_lock);
+    list_add_tail(&controller->txn_list, &txn->node);
+    completion_signal(&controller->txn_completion);
+    mtx_unlock(&controller->txn_lock);
+}
+
 // Implement the device protocol for the slave devices.
 
 static mx_protocol_device_t intel_serialio_i2c_slave_device_proto = {
     .read = &intel_serialio_i2c_slave_read,
     .write = &intel_serialio_i2c_slave_write,
     .ioctl = &intel_serialio_i2c_slave_ioctl,
+    .iotxn_queue = &intel_serialio_i2c_slave_iotxn_queue,
 };
 
 // Initialize a slave device structure.
@@ -7,6 +7,7 @@
 #include <ddk/binding.h>
 #include <ddk/device.h>
 #include <magenta/types.h>
+#include <magenta/device/i2c.h>
 #include <magenta/listnode.h>
 #include <stdint.h>
 
@@ -21,6 +22,9 @@ typedef struct intel_serialio_i2c_slave_device {
     struct list_node slave_list_node;
 } intel_serialio_i2c_slave_device_t;
 
+mx_status_t intel_serialio_i2c_slave_transfer(
+    mx_device_t* dev, i2c_slave_segment_t* segments, int segment_count);
+
 mx_status_t intel_serialio_i2c_slave_device_init(
     mx_device_t* cont, intel_serialio_i2c_slave_device_t* slave,
     uint8_t width, uint16_t address);
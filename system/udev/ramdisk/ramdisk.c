@@ -14,6 +14,7 @@
 #include <sys/param.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -29,6 +30,8 @@ typedef struct ram_device {
     uint64_t blk_count;
     mx_handle_t vmo;
     uintptr_t mapped_addr;
+    // the memory is committed and locked, see RAMDISK_FLAG_COMMIT
+    bool locked;
 } ram_device_t;
 
 #define get_ram_device(dev) containerof(dev, ram_device_t, device)
@@ -51,21 +54,56 @@ static ssize_t ramdisk_ioctl(mx_device_t* dev, uint32_t op, const void* cmd,
             return ERR_ALREADY_BOUND;
         }
         ramdisk_ioctl_config_t* config = (ramdisk_ioctl_config_t*)cmd;
+        if (config->flags & ~RAMDISK_FLAG_COMMIT) {
+            return ERR_INVALID_ARGS;
+        }
         ramdev->blk_size = config->blk_size;
         ramdev->blk_count = config->blk_count;
         mx_status_t status;
         if ((status = mx_vmo_create(sizebytes(ramdev), 0, &ramdev->vmo)) != NO_ERROR) {
             return status;
         }
+        if (config->flags & RAMDISK_FLAG_COMMIT) {
+            // locking commits the pages, and keeps them
+            status = mx_vmo_op_range(ramdev->vmo, MX_VMO_OP_LOCK, 0, sizebytes(ramdev), NULL, 0);
+            if (status == NO_ERROR) {
+                ramdev->locked = true;
+            } else if (status == ERR_NOT_SUPPORTED) {
+                status = mx_vmo_op_range(ramdev->vmo, MX_VMO_OP_COMMIT, 0, sizebytes(ramdev),
+                                         NULL, 0);
+            }
+            if (status != NO_ERROR) {
+                mx_handle_close(ramdev->vmo);
+                ramdev->vmo = MX_HANDLE_INVALID;
+                return status;
+            }
+        }
         if ((status = mx_vmar_map(mx_vmar_root_self(), 0, ramdev->vmo, 0, sizebytes(ramdev),
                                   MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
                                   &ramdev->mapped_addr)) != NO_ERROR) {
             mx_handle_close(ramdev->vmo);
             ramdev->vmo = MX_HANDLE_INVALID;
+            ramdev->locked = false;
             return status;
         }
         return NO_ERROR;
     }
+    case IOCTL_BLOCK_RAMDISK_GET_VMO: {
+        mx_handle_t* vmo = reply;
+        if (max < sizeof(*vmo)) return ERR_BUFFER_TOO_SMALL;
+        if (ramdev->vmo == MX_HANDLE_INVALID) return ERR_BAD_STATE;
+        // a shrunk VMO would fault the device's own mapping, so writes can
+        // only be let through while it is locked
+        mx_rights_t rights = MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_MAP;
+        if (ramdev->locked) {
+            rights |= MX_RIGHT_WRITE;
+        }
+        mx_status_t status = mx_handle_duplicate(ramdev->vmo, rights, vmo);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        return sizeof(*vmo);
+    }
     case IOCTL_BLOCK_GET_SIZE: {
         uint64_t* size = reply;
         if (max < sizeof(*size)) return ERR_BUFFER_TOO_SMALL;
@@ -138,6 +176,10 @@ static void ramdisk_unbind(mx_device_t* dev) {
 static mx_status_t ramdisk_release(mx_device_t* dev) {
     ram_device_t* device = get_ram_device(dev);
     if (device->vmo != MX_HANDLE_INVALID) {
+        mx_vmar_unmap(mx_vmar_root_self(), device->mapped_addr, sizebytes(device));
+        if (device->locked) {
+            mx_vmo_op_range(device->vmo, MX_VMO_OP_UNLOCK, 0, sizebytes(device), NULL, 0);
+        }
         mx_handle_close(device->vmo);
     }
     device->vmo = MX_HANDLE_INVALID;
@@ -60,10 +60,23 @@
 #define AHCI_PORT_FLAG_PRESENT     (1 << 1)
 #define AHCI_PORT_FLAG_SYNC_PAUSED (1 << 2) // port is paused until pending xfers are done
 
+// command completion coalescing: one interrupt per this many completions,
+// or once this many ms have passed since the first of them
+#define AHCI_CCC_COMPLETIONS 8
+#define AHCI_CCC_TIMEOUT_MS  1
+
+// the completion interrupts that coalescing stands in for
+#define AHCI_PORT_INT_COMPLETION (AHCI_PORT_INT_DHR | AHCI_PORT_INT_PS | AHCI_PORT_INT_SDB | \
+                                  AHCI_PORT_INT_DP)
+
+struct ahci_device;
+
 typedef struct ahci_port {
     int nr; // 0-based
     int flags;
 
+    struct ahci_device* dev;
+
     ahci_port_reg_t* regs;
     ahci_cl_t* cl;
     ahci_fis_t* fis;
@@ -76,6 +89,11 @@ typedef struct ahci_port {
 
     list_node_t txn_list;
     io_buffer_t buffer;
+
+    // each port issues its own commands, so one port filling its slots
+    // does not wait on the others
+    thrd_t worker_thread;
+    completion_t worker_completion;
 } ahci_port_t;
 
 typedef struct ahci_device {
@@ -90,14 +108,16 @@ typedef struct ahci_device {
     mx_handle_t irq_handle;
     thrd_t irq_thread;
 
-    thrd_t worker_thread;
-    completion_t worker_completion;
-
     thrd_t watchdog_thread;
     completion_t watchdog_completion;
 
     uint32_t cap;
 
+    // ports whose completions are coalesced, and the bit in is that
+    // reports them
+    uint32_t ccc_ports;
+    uint32_t ccc_irq;
+
     ahci_port_t ports[AHCI_MAX_PORTS];
 } ahci_device_t;
 
@@ -216,30 +236,40 @@ static bool cmd_is_queued(uint8_t cmd) {
 }
 
 static void ahci_port_complete_txn(ahci_device_t* dev, ahci_port_t* port, mx_status_t status) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
     iotxn_t* txn;
-    uint32_t sact = ahci_read(&port->regs->sact);
-    for (int i = 0; i < AHCI_MAX_COMMANDS; i++) {
+
+    mtx_lock(&port->lock);
+    // a command is done once the device clears its bit in both sact and ci,
+    // but after an error the hba stops leaving ci as it was
+    uint32_t active = ahci_read(&port->regs->sact);
+    if (status == NO_ERROR) {
+        active |= ahci_read(&port->regs->ci);
+    }
+    uint32_t finished = port->running & ~active;
+    while (finished) {
+        int i = __builtin_ctz(finished);
+        finished &= ~(1u << i);
         txn = port->commands[i];
-        if (txn == NULL) {
-            continue;
+        // clear state before calling the complete() hook
+        port->running &= ~(1u << i);
+        port->commands[i] = NULL;
+        if (txn != NULL) {
+            list_add_tail(&done, &txn->node);
         }
-        if (!(sact & (1 << i))) {
-            mtx_lock(&port->lock);
-            // clear state before calling the complete() hook
-            port->running &= ~(1 << i);
-            port->commands[i] = NULL;
+    }
+    // resume the port if paused for sync and no outstanding transactions
+    if ((port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) && !port->running) {
+        port->flags &= ~AHCI_PORT_FLAG_SYNC_PAUSED;
+    }
+    mtx_unlock(&port->lock);
 
-            // resume the port if paused for sync and no outstanding transactions
-            if ((port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) && !port->running) {
-                port->flags &= ~AHCI_PORT_FLAG_SYNC_PAUSED;
-            }
-            mtx_unlock(&port->lock);
+    // hit the worker thread to refill the slots before completing
+    completion_signal(&port->worker_completion);
 
-            txn->ops->complete(txn, status, txn->length);
-        }
+    while ((txn = list_remove_head_type(&done, iotxn_t, node)) != NULL) {
+        txn->ops->complete(txn, status, txn->length);
     }
-    // hit the worker thread to do the next txn
-    completion_signal(&dev->worker_completion);
 }
 
 static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot, iotxn_t* txn) {
@@ -255,12 +285,25 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
             port->flags &= ~AHCI_PORT_FLAG_SYNC_PAUSED;
         }
         txn->ops->complete(txn, NO_ERROR, txn->length);
-        completion_signal(&dev->worker_completion);
         return NO_ERROR;
     }
 
-    mx_paddr_t phys;
-    txn->ops->physmap(txn, &phys);
+    // the PRDT gathers from each run, DMA-able where it lies
+    iotxn_sg_t sg[AHCI_MAX_PRDS];
+    uint32_t nsg;
+    if (txn->ops->physmap_sg(txn, sg, countof(sg), &nsg) != NO_ERROR) {
+        mx_status_t status = txn->ops->physmap(txn, &sg[0].paddr);
+        if (status != NO_ERROR) {
+            // nothing went to the device, so don't leave the port paused for it
+            if ((port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) && !port->running) {
+                port->flags &= ~AHCI_PORT_FLAG_SYNC_PAUSED;
+            }
+            txn->ops->complete(txn, status, 0);
+            return status;
+        }
+        sg[0].length = txn->length;
+        nsg = 1;
+    }
 
     if (dev->cap & AHCI_CAP_NCQ) {
         if (pdata->cmd == SATA_CMD_READ_DMA_EXT) {
@@ -278,7 +321,6 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
     cl->prdtl_flags_cfl = 0;
     cl->cfl = 5; // 20 bytes
     cl->w = cmd_is_write(pdata->cmd) ? 1 : 0;
-    cl->prdtl = txn->length / AHCI_PRD_MAX_SIZE + 1;
     cl->prdbc = 0;
     memset(port->ct[slot], 0, sizeof(ahci_ct_t));
 
@@ -312,24 +354,36 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
         cfis[13] = 0; // normal priority
     }
 
-    ahci_prd_t* prd = NULL;
-    for (int i = 0; i < cl->prdtl; i++) {
-        prd = (ahci_prd_t*)((void*)port->ct[slot] + sizeof(ahci_ct_t)) + i;
-        prd->dba = LO32(phys);
-        prd->dbau = HI32(phys);
-        prd->dbc = ((txn->length - 1) & 0x3fffff); // 0-based byte count
-
-        phys += AHCI_PRD_MAX_SIZE;
+    ahci_prd_t* prds = (ahci_prd_t*)((void*)port->ct[slot] + sizeof(ahci_ct_t));
+    int nprd = 0;
+    for (uint32_t i = 0; i < nsg; i++) {
+        mx_paddr_t phys = sg[i].paddr;
+        size_t remaining = sg[i].length;
+        while (remaining > 0) {
+            if (nprd == AHCI_MAX_PRDS) {
+                txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+                return NO_ERROR;
+            }
+            size_t length = MIN(remaining, AHCI_PRD_MAX_SIZE);
+            ahci_prd_t* prd = &prds[nprd++];
+            prd->dba = LO32(phys);
+            prd->dbau = HI32(phys);
+            prd->dbc = ((length - 1) & 0x3fffff); // 0-based byte count
+            phys += length;
+            remaining -= length;
+        }
     }
+    cl->prdtl = nprd;
 
     port->running |= (1 << slot);
     port->commands[slot] = txn;
 
-    // start command
+    // start command: zeroes written to sact and ci are ignored, so there
+    // is no need to read them back first
     if (cmd_is_queued(pdata->cmd)) {
-        ahci_write(&port->regs->sact, ahci_read(&port->regs->sact) | (1 << slot));
+        ahci_write(&port->regs->sact, 1u << slot);
     }
-    ahci_write(&port->regs->ci, ahci_read(&port->regs->ci) | (1 << slot));
+    ahci_write(&port->regs->ci, 1u << slot);
 
     // set the watchdog
     // TODO: general timeout mechanism
@@ -448,63 +502,64 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     list_add_tail(&port->txn_list, &txn->node);
     mtx_unlock(&port->lock);
 
-    // hit the worker thread
-    completion_signal(&device->worker_completion);
+    // hit the port's worker thread
+    completion_signal(&port->worker_completion);
 }
 
-// worker thread (for iotxn queue):
+// worker threads (for iotxn queue), one per port:
 
-static int ahci_worker_thread(void* arg) {
-    ahci_device_t* dev = (ahci_device_t*)arg;
-    ahci_port_t* port;
-    iotxn_t* txn;
+// Issues commands until the port runs out of them, or of free slots.
+static void ahci_port_run_txns(ahci_device_t* dev, ahci_port_t* port) {
+    // slots the device or a command not yet completed still holds
+    uint32_t busy = ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci);
+    int ncs = (int)((dev->cap >> 8) & 0x1f);
     for (;;) {
-        // iterate all the ports and run commands
-        for (int i = 0; i < AHCI_MAX_PORTS; i++) {
-            port = &dev->ports[i];
-            mtx_lock(&port->lock);
-            if (!(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT))) {
-                goto next;
-            }
-            if (port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) {
-                goto next;
-            }
+        if (port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) {
+            return;
+        }
 
-            txn = list_peek_head_type(&port->txn_list, iotxn_t, node);
-            if (!txn) {
-                goto next;
-            }
+        iotxn_t* txn = list_peek_head_type(&port->txn_list, iotxn_t, node);
+        if (!txn) {
+            return;
+        }
 
-            // if IOTXN_SYNC_BEFORE, pause the port if there are transactions in flight
-            if ((txn->flags & IOTXN_SYNC_BEFORE) && port->running) {
-                port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
-                goto next;
-            }
+        // if IOTXN_SYNC_BEFORE, pause the port if there are transactions in flight
+        if ((txn->flags & IOTXN_SYNC_BEFORE) && port->running) {
+            port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
+            return;
+        }
 
-            // find a free command tag
-            sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-            int max = MIN(pdata->max_cmd, (int)((dev->cap >> 8) & 0x1f));
-            int i = 0;
-            for (i = 0; i <= max; i++) {
-                if (!ahci_port_cmd_busy(port, i)) break;
-            }
-            if (i > max) {
-                goto next;
-            }
+        // find a free command tag
+        sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+        int max = MIN(pdata->max_cmd, ncs);
+        uint32_t slots = (max >= 31) ? ~0u : ((1u << (max + 1)) - 1);
+        uint32_t idle = slots & ~(busy | port->running);
+        if (!idle) {
+            return;
+        }
+        int slot = __builtin_ctz(idle);
 
-            list_delete(&txn->node);
-            // if IOTXN_SYNC_AFTER, pause the port until this command is complete
-            if (txn->flags & IOTXN_SYNC_AFTER) {
-                port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
-            }
-            // run the command
-            ahci_do_txn(dev, port, i, txn);
-next:
-            mtx_unlock(&port->lock);
+        list_delete(&txn->node);
+        // if IOTXN_SYNC_AFTER, pause the port until this command is complete
+        if (txn->flags & IOTXN_SYNC_AFTER) {
+            port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
         }
-        // wait here until more commands are queued, or a port becomes idle
-        completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
-        completion_reset(&dev->worker_completion);
+        // run the command
+        ahci_do_txn(dev, port, slot, txn);
+    }
+}
+
+static int ahci_port_worker_thread(void* arg) {
+    ahci_port_t* port = (ahci_port_t*)arg;
+    ahci_device_t* dev = port->dev;
+    for (;;) {
+        mtx_lock(&port->lock);
+        ahci_port_run_txns(dev, port);
+        mtx_unlock(&port->lock);
+
+        // wait here until more commands are queued, or slots are freed
+        completion_wait(&port->worker_completion, MX_TIME_INFINITE);
+        completion_reset(&port->worker_completion);
     }
     return 0;
 }
@@ -531,9 +586,9 @@ static int ahci_watchdog_thread(void* arg) {
                     if (pdata->timeout < now) {
                         // time out
                         printf("ahci: txn time out on port %d\n", port->nr);
-                        iotxn_t* txn = port->commands[i];
-                        port->running &= ~(1 << i);
-                        port->commands[i] = NULL;
+                        iotxn_t* txn = port->commands[j];
+                        port->running &= ~(1 << j);
+                        port->commands[j] = NULL;
                         mtx_unlock(&port->lock);
                         txn->ops->complete(txn, ERR_TIMED_OUT, 0);
                         mtx_lock(&port->lock);
@@ -594,6 +649,15 @@ static int ahci_irq_thread(void* arg) {
         // handle interrupt for each port
         uint32_t is = ahci_read(&dev->regs->is);
         ahci_write(&dev->regs->is, is);
+        if (dev->ccc_ports && (is & dev->ccc_irq)) {
+            // coalesced completions say nothing of which ports they are on
+            is &= ~dev->ccc_irq;
+            for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+                if (dev->ccc_ports & (1u << i)) {
+                    ahci_port_complete_txn(dev, &dev->ports[i], NO_ERROR);
+                }
+            }
+        }
         for (int i = 0; is && i < AHCI_MAX_PORTS; i++) {
             if (is & 0x1) {
                 ahci_port_irq(dev, i);
@@ -635,6 +699,7 @@ static int ahci_init_thread(void* arg) {
     for (int i = 0; i < AHCI_MAX_PORTS; i++) {
         port = &dev->ports[i];
         port->nr = i;
+        port->dev = dev;
 
         if (!(port_map & (1 << i))) continue; // port not implemented
 
@@ -646,6 +711,20 @@ static int ahci_init_thread(void* arg) {
         if (status) goto fail;
     }
 
+    // coalesce completions across all ports, if the hba can
+    if (dev->cap & AHCI_CAP_CCCS) {
+        ahci_write(&dev->regs->ccc_ctl, 0);
+        ahci_write(&dev->regs->ccc_ctl, (AHCI_CCC_TIMEOUT_MS << AHCI_CCC_CTL_TV_SHIFT) |
+                                        (AHCI_CCC_COMPLETIONS << AHCI_CCC_CTL_CC_SHIFT));
+        ahci_write(&dev->regs->ccc_ports, port_map);
+        uint32_t ccc_ctl = ahci_read(&dev->regs->ccc_ctl);
+        ahci_write(&dev->regs->ccc_ctl, ccc_ctl | AHCI_CCC_CTL_EN);
+        dev->ccc_irq = 1u << ((ccc_ctl >> AHCI_CCC_CTL_INT_SHIFT) & AHCI_CCC_CTL_INT_MASK);
+        dev->ccc_ports = port_map;
+        xprintf("ahci: coalescing %d completions or %d ms\n",
+                AHCI_CCC_COMPLETIONS, AHCI_CCC_TIMEOUT_MS);
+    }
+
     // clear hba interrupts
     ahci_write(&dev->regs->is, ahci_read(&dev->regs->is));
 
@@ -662,8 +741,22 @@ static int ahci_init_thread(void* arg) {
         // enable port
         ahci_port_enable(port);
 
-        // enable interrupts
-        ahci_write(&port->regs->ie, AHCI_PORT_INT_MASK);
+        // enable interrupts, but for the completions the hba coalesces
+        uint32_t ie = AHCI_PORT_INT_MASK;
+        if (dev->ccc_ports & (1u << i)) {
+            ie &= ~AHCI_PORT_INT_COMPLETION;
+        }
+        ahci_write(&port->regs->ie, ie);
+
+        // start the port's worker thread
+        char name[32];
+        snprintf(name, sizeof(name), "ahci-port-%d", port->nr);
+        port->worker_completion = COMPLETION_INIT;
+        int ret = thrd_create_with_name(&port->worker_thread, ahci_port_worker_thread, port, name);
+        if (ret != thrd_success) {
+            xprintf("ahci.%d: error %d in worker thread create\n", port->nr, ret);
+            continue;
+        }
 
         // reset port
         ahci_port_reset(port);
@@ -764,14 +857,6 @@ static mx_status_t ahci_bind(mx_driver_t* drv, mx_device_t* dev) {
     device->watchdog_completion = COMPLETION_INIT;
     thrd_create_with_name(&device->watchdog_thread, ahci_watchdog_thread, device, "ahci-watchdog");
 
-    // start worker thread (for iotxn queue)
-    device->worker_completion = COMPLETION_INIT;
-    ret = thrd_create_with_name(&device->worker_thread, ahci_worker_thread, device, "ahci-worker");
-    if (ret != thrd_success) {
-        xprintf("ahci: error %d in worker thread create\n", ret);
-        goto fail;
-    }
-
     // add the device for the controller
     device_add(&device->device, dev);
 
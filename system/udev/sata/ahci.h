@@ -84,11 +84,18 @@ typedef struct {
     uint32_t vendor[4];     // vendor specific
 } __attribute__((packed)) ahci_port_reg_t;
 
-#define AHCI_CAP_NCQ (1 << 30)
+#define AHCI_CAP_CCCS (1 << 7)
+#define AHCI_CAP_NCQ  (1 << 30)
 #define AHCI_GHC_HR  (1 << 0)
 #define AHCI_GHC_IE  (1 << 1)
 #define AHCI_GHC_AE  (1 << 31)
 
+#define AHCI_CCC_CTL_EN        (1 << 0)
+#define AHCI_CCC_CTL_INT_SHIFT 3
+#define AHCI_CCC_CTL_INT_MASK  0x1f
+#define AHCI_CCC_CTL_CC_SHIFT  8
+#define AHCI_CCC_CTL_TV_SHIFT  16
+
 typedef struct {
     uint32_t cap;              // host capabilities
     uint32_t ghc;              // global host control
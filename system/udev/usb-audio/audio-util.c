@@ -3,8 +3,11 @@
 // found in the LICENSE file.
 
 #include <ddk/common/usb.h>
+#include <magenta/syscalls.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "usb-audio.h"
 
@@ -72,3 +75,91 @@ mx_status_t usb_audio_set_volume(mx_device_t* device, uint8_t interface_number,
                 USB_AUDIO_SET_CUR, USB_AUDIO_VOLUME_CONTROL << 8 | interface_number,
                 fu_id << 8, &volume16, sizeof(volume16));
 }
+
+mx_status_t usb_audio_ring_create(usb_audio_ring_t* ring, uint32_t size, int frame_size,
+                                  mx_handle_t* out_vmo) {
+    size -= size % frame_size;
+    if (size == 0) {
+        return ERR_INVALID_ARGS;
+    }
+    // the header gets a page to itself, so the ring is page aligned
+    size_t mapped_size = PAGE_SIZE + ((size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(mapped_size, 0, &vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    uintptr_t addr;
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, mapped_size,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr);
+    if (status != NO_ERROR) {
+        mx_handle_close(vmo);
+        return status;
+    }
+    status = mx_handle_duplicate(vmo, MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_MAP |
+                                      MX_RIGHT_TRANSFER, out_vmo);
+    if (status != NO_ERROR) {
+        mx_vmar_unmap(mx_vmar_root_self(), addr, mapped_size);
+        mx_handle_close(vmo);
+        return status;
+    }
+
+    ring->vmo = vmo;
+    ring->header = (audio_ring_buffer_t*)addr;
+    ring->data = (uint8_t*)addr + PAGE_SIZE;
+    ring->mapped_size = mapped_size;
+    ring->size = size;
+    ring->position = 0;
+    ring->header->position = 0;
+    ring->header->size = size;
+    ring->header->data_offset = PAGE_SIZE;
+    return NO_ERROR;
+}
+
+void usb_audio_ring_release(usb_audio_ring_t* ring) {
+    if (ring->header) {
+        mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)ring->header, ring->mapped_size);
+        mx_handle_close(ring->vmo);
+    }
+    memset(ring, 0, sizeof(*ring));
+}
+
+void usb_audio_ring_read(usb_audio_ring_t* ring, iotxn_t* txn, size_t length) {
+    uint64_t position = ring->position;
+    size_t size = ring->size;
+    size_t offset = position % size;
+    size_t txn_offset = 0;
+    while (length > 0) {
+        size_t chunk = size - offset;
+        if (chunk > length) {
+            chunk = length;
+        }
+        txn->ops->copyto(txn, ring->data + offset, chunk, txn_offset);
+        txn_offset += chunk;
+        length -= chunk;
+        position += chunk;
+        offset = 0;
+    }
+    ring->position = position;
+    __atomic_store_n(&ring->header->position, position, __ATOMIC_RELEASE);
+}
+
+void usb_audio_ring_write(usb_audio_ring_t* ring, const void* data, size_t length) {
+    uint64_t position = ring->position;
+    size_t size = ring->size;
+    size_t offset = position % size;
+    while (length > 0) {
+        size_t chunk = size - offset;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(ring->data + offset, data, chunk);
+        data += chunk;
+        length -= chunk;
+        position += chunk;
+        offset = 0;
+    }
+    ring->position = position;
+    __atomic_store_n(&ring->header->position, position, __ATOMIC_RELEASE);
+}
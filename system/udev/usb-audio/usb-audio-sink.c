@@ -17,6 +17,13 @@
 
 #define WRITE_REQ_COUNT 20
 
+// default number of USB frames (1ms each) queued ahead of the one playing
+#define DEFAULT_QUEUE_FRAMES 8
+
+// how far ahead of the current USB frame the next packet must be scheduled
+// for the controller to still pick it up in time
+#define MIN_FRAME_LEAD 3
+
 // Assume audio is paused and reset our timer logic
 // if no writes occur for 100ms
 #define WRITE_TIMEOUT_MS 100
@@ -30,9 +37,13 @@ typedef struct {
 
     // pool of free USB requests
     list_node_t free_write_reqs;
-    // mutex for synchronizing access to free_write_reqs, open and started
+    // requests taken from the pool to fill and queue to the controller, and
+    // how many may be at once
+    int in_flight;
+    int queue_frames;
+    // mutex for synchronizing access to free_write_reqs, in_flight, open and started
     mtx_t mutex;
-    // completion signals free_write_reqs not empty
+    // completion signals a request may be taken from free_write_reqs
     completion_t free_write_completion;
     // mutex used to synchronize ioctl_audio_start() and ioctl_audio_stop()
     mtx_t start_stop_mutex;
@@ -63,14 +74,23 @@ typedef struct {
     // the last signals we reported
     mx_signals_t signals;
 
+    // ring buffer the client plays from, if it asked for one; requests go
+    // straight back to the controller from it while we are started
+    usb_audio_ring_t ring;
+
 } usb_audio_sink_t;
 #define get_usb_audio_sink(dev) containerof(dev, usb_audio_sink_t, device)
 
+// called with sink->mutex held
+static bool write_req_available(usb_audio_sink_t* sink) {
+    return !list_is_empty(&sink->free_write_reqs) && sink->in_flight < sink->queue_frames;
+}
+
 static void update_signals(usb_audio_sink_t* sink) {
     mx_signals_t new_signals = 0;
     if (sink->dead) {
         new_signals |= (DEV_STATE_WRITABLE | DEV_STATE_ERROR);
-    } else if (!list_is_empty(&sink->free_write_reqs)) {
+    } else if (write_req_available(sink)) {
         new_signals |= DEV_STATE_WRITABLE;
     }
     if (new_signals != sink->signals) {
@@ -79,17 +99,74 @@ static void update_signals(usb_audio_sink_t* sink) {
     }
 }
 
+static uint64_t get_usb_current_frame(usb_audio_sink_t* sink) {
+    uint64_t result;
+    ssize_t rc = sink->usb_device->ops->ioctl(sink->usb_device, IOCTL_USB_GET_CURRENT_FRAME,
+                                              NULL, 0, &result, sizeof(result));
+    if (rc != sizeof(result)) {
+        printf("get_usb_current_frame failed %zu\n", rc);
+        return sink->last_usb_frame;
+    }
+    return result;
+}
+
+// picks the USB frame for the next packet, restarting the schedule if we
+// fell behind the controller, and returns how many audio frames go in it
+static uint64_t next_packet_frames(usb_audio_sink_t* sink, uint64_t* out_usb_frame) {
+    uint64_t current_frame = get_usb_current_frame(sink);
+    if (sink->last_usb_frame + 1 < current_frame + MIN_FRAME_LEAD) {
+        // we fell behind the controller (writes came in late), so the
+        // frame we were going to use is gone; restart the schedule just
+        // far enough ahead rather than queueing a packet it will miss
+        sink->start_usb_frame = current_frame + MIN_FRAME_LEAD - 1;
+        sink->last_usb_frame = sink->start_usb_frame;
+        sink->audio_frame_count = 0;
+    }
+
+    uint64_t usb_frame = sink->last_usb_frame + 1;
+    // total number of frames we should have sent by usb_frame
+    uint64_t total_audio_frames = ((usb_frame - sink->start_usb_frame) *
+                                   sink->sample_rate) / 1000;
+    *out_usb_frame = usb_frame;
+    return total_audio_frames - sink->audio_frame_count;
+}
+
+// fills txn with the next packet from the ring buffer and queues it
+// called with sink->mutex held
+static void ring_queue_packet(usb_audio_sink_t* sink, iotxn_t* txn) {
+    uint64_t usb_frame;
+    uint64_t audio_frames = next_packet_frames(sink, &usb_frame);
+    size_t length = audio_frames * sink->audio_frame_size;
+    usb_audio_ring_read(&sink->ring, txn, length);
+    txn->length = length;
+    usb_iotxn_set_frame(txn, usb_frame);
+    sink->last_usb_frame = usb_frame;
+    sink->audio_frame_count += audio_frames;
+    sink->in_flight++;
+    iotxn_queue(sink->usb_device, txn);
+}
+
 static void usb_audio_sink_write_complete(iotxn_t* txn, void* cookie) {
+    usb_audio_sink_t* sink = (usb_audio_sink_t*)cookie;
+
+    mtx_lock(&sink->mutex);
+    sink->in_flight--;
     if (txn->status == ERR_REMOTE_CLOSED) {
+        mtx_unlock(&sink->mutex);
         txn->ops->release(txn);
         return;
     }
-
-    usb_audio_sink_t* sink = (usb_audio_sink_t*)cookie;
-    // FIXME what to do with error here?
-    mtx_lock(&sink->mutex);
+    if (sink->ring.header && sink->started && !sink->dead) {
+        ring_queue_packet(sink, txn);
+        mtx_unlock(&sink->mutex);
+        return;
+    }
+    // a packet that missed its frame (ERR_IO_DATA_LOSS) or could not be
+    // scheduled is dropped; the next write resyncs to the current frame
     list_add_tail(&sink->free_write_reqs, &txn->node);
-    completion_signal(&sink->free_write_completion);
+    if (write_req_available(sink)) {
+        completion_signal(&sink->free_write_completion);
+    }
     update_signals(sink);
     mtx_unlock(&sink->mutex);
 }
@@ -109,22 +186,12 @@ static mx_status_t usb_audio_sink_release(mx_device_t* device) {
     while ((txn = list_remove_head_type(&sink->free_write_reqs, iotxn_t, node)) != NULL) {
         txn->ops->release(txn);
     }
+    usb_audio_ring_release(&sink->ring);
     free(sink->sample_rates);
     free(sink);
     return NO_ERROR;
 }
 
-static uint64_t get_usb_current_frame(usb_audio_sink_t* sink) {
-    uint64_t result;
-    ssize_t rc = sink->usb_device->ops->ioctl(sink->usb_device, IOCTL_USB_GET_CURRENT_FRAME,
-                                              NULL, 0, &result, sizeof(result));
-    if (rc != sizeof(result)) {
-        printf("get_usb_current_frame failed %zu\n", rc);
-        return sink->last_usb_frame;
-    }
-    return result;
-}
-
 static mx_status_t usb_audio_sink_start(usb_audio_sink_t* sink) {
     mx_status_t status = NO_ERROR;
 
@@ -144,6 +211,22 @@ static mx_status_t usb_audio_sink_start(usb_audio_sink_t* sink) {
     sink->start_usb_frame = 0;
     sink->cur_txn = NULL;
 
+    mtx_lock(&sink->mutex);
+    sink->started = true;
+    if (sink->ring.header) {
+        // play the ring on from position, and keep queue_frames packets of
+        // it queued from here on
+        sink->start_usb_frame = get_usb_current_frame(sink) + MIN_FRAME_LEAD - 1;
+        sink->last_usb_frame = sink->start_usb_frame;
+        sink->audio_frame_count = 0;
+        while (write_req_available(sink)) {
+            iotxn_t* txn = list_remove_head_type(&sink->free_write_reqs, iotxn_t, node);
+            ring_queue_packet(sink, txn);
+        }
+        update_signals(sink);
+    }
+    mtx_unlock(&sink->mutex);
+
 out:
     mtx_unlock(&sink->start_stop_mutex);
     return status;
@@ -161,6 +244,11 @@ static mx_status_t usb_audio_sink_stop(usb_audio_sink_t* sink) {
         goto out;
     }
 
+    // stop feeding the ring buffer to the controller
+    mtx_lock(&sink->mutex);
+    sink->started = false;
+    mtx_unlock(&sink->mutex);
+
     // switch back to primary interface
     if (sink->alternate_setting != 0) {
         usb_set_interface(sink->usb_device, sink->interface_number, 0);
@@ -195,6 +283,12 @@ static mx_status_t usb_audio_sink_close(mx_device_t* dev, uint32_t flags) {
     mtx_unlock(&sink->mutex);
     usb_audio_sink_stop(sink);
 
+    mtx_lock(&sink->start_stop_mutex);
+    mtx_lock(&sink->mutex);
+    usb_audio_ring_release(&sink->ring);
+    mtx_unlock(&sink->mutex);
+    mtx_unlock(&sink->start_stop_mutex);
+
     return NO_ERROR;
 }
 
@@ -204,6 +298,9 @@ static ssize_t usb_audio_sink_write(mx_device_t* dev, const void* data, size_t l
     if (sink->dead) {
         return ERR_REMOTE_CLOSED;
     }
+    if (sink->ring.header) {
+        return ERR_BAD_STATE;
+    }
 
     mx_status_t status = length;
 
@@ -213,8 +310,8 @@ static ssize_t usb_audio_sink_write(mx_device_t* dev, const void* data, size_t l
     if (sink->start_usb_frame == 0 || current_frame > sink->last_usb_frame + WRITE_TIMEOUT_MS) {
         // This is either the first time we are called or we have paused playing for awhile
         // so reset our counters
-        sink->start_usb_frame = current_frame;
-        sink->last_usb_frame = current_frame;
+        sink->start_usb_frame = current_frame + MIN_FRAME_LEAD - 1;
+        sink->last_usb_frame = sink->start_usb_frame;
         sink->audio_frame_count = 0;
     }
 
@@ -233,7 +330,10 @@ static ssize_t usb_audio_sink_write(mx_device_t* dev, const void* data, size_t l
             }
             mtx_lock(&sink->mutex);
             list_node_t* node = list_remove_head(&sink->free_write_reqs);
-            if (list_is_empty(&sink->free_write_reqs)) {
+            if (node) {
+                sink->in_flight++;
+            }
+            if (!write_req_available(sink)) {
                 completion_reset(&sink->free_write_completion);
             }
             mtx_unlock(&sink->mutex);
@@ -246,13 +346,11 @@ static ssize_t usb_audio_sink_write(mx_device_t* dev, const void* data, size_t l
             txn_offset = 0;
         }
 
-        uint64_t current_usb_frame = sink->last_usb_frame + 1;
-        // total number of frames we should have sent by current_usb_frame
-        uint64_t total_audio_frames = ((current_usb_frame - sink->start_usb_frame) *
-                                       sink->sample_rate) / 1000;
-        uint64_t current_audio_frames = total_audio_frames - sink->audio_frame_count;
+        uint64_t current_usb_frame;
+        uint64_t current_audio_frames = next_packet_frames(sink, &current_usb_frame);
         uint64_t packet_bytes = current_audio_frames * sink->audio_frame_size;
-        uint64_t copy = packet_bytes - txn_offset;
+        // leftover data from before a resync may fill more than a packet
+        uint64_t copy = (packet_bytes > txn_offset ? packet_bytes - txn_offset : 0);
         if (copy <= length) {
             txn->ops->copyto(txn, src, copy, txn_offset);
             txn->length = txn_offset + copy;
@@ -267,8 +365,8 @@ static ssize_t usb_audio_sink_write(mx_device_t* dev, const void* data, size_t l
         } else {
             // not enough data remaining - save for next time
             sink->cur_txn = txn;
-            txn->ops->copyto(txn, src, length, 0);
-            txn->length = length;
+            txn->ops->copyto(txn, src, length, txn_offset);
+            txn->length = txn_offset + length;
             length = 0;
         }
     }
@@ -331,6 +429,41 @@ static ssize_t usb_audio_sink_ioctl(mx_device_t* dev, uint32_t op, const void* i
         return usb_audio_sink_start(sink);
     case IOCTL_AUDIO_STOP:
         return usb_audio_sink_stop(sink);
+    case IOCTL_AUDIO_SET_QUEUE_FRAMES: {
+        if (in_len < sizeof(uint32_t)) return ERR_BUFFER_TOO_SMALL;
+        uint32_t queue_frames = *((uint32_t *)in_buf);
+        if (queue_frames < 1 || queue_frames > WRITE_REQ_COUNT) {
+            return ERR_INVALID_ARGS;
+        }
+        mtx_lock(&sink->mutex);
+        sink->queue_frames = queue_frames;
+        if (write_req_available(sink)) {
+            completion_signal(&sink->free_write_completion);
+        } else {
+            completion_reset(&sink->free_write_completion);
+        }
+        update_signals(sink);
+        mtx_unlock(&sink->mutex);
+        return NO_ERROR;
+    }
+    case IOCTL_AUDIO_GET_RING_BUFFER: {
+        mx_handle_t* reply = out_buf;
+        if (in_len < sizeof(uint32_t) || out_len < sizeof(*reply)) return ERR_BUFFER_TOO_SMALL;
+        uint32_t size = *((uint32_t *)in_buf);
+        mx_status_t status;
+        mtx_lock(&sink->start_stop_mutex);
+        mtx_lock(&sink->mutex);
+        if (sink->started || sink->cur_txn) {
+            status = ERR_BAD_STATE;
+        } else if (sink->ring.header) {
+            status = ERR_ALREADY_BOUND;
+        } else {
+            status = usb_audio_ring_create(&sink->ring, size, sink->audio_frame_size, reply);
+        }
+        mtx_unlock(&sink->mutex);
+        mtx_unlock(&sink->start_stop_mutex);
+        return (status == NO_ERROR) ? (ssize_t)sizeof(*reply) : status;
+    }
     }
 
     return ERR_NOT_SUPPORTED;
@@ -371,6 +504,7 @@ mx_status_t usb_audio_sink_create(mx_driver_t* driver, mx_device_t* device, int
     }
 
     list_initialize(&sink->free_write_reqs);
+    sink->queue_frames = DEFAULT_QUEUE_FRAMES;
 
     sink->usb_device = device;
     sink->ep_addr = ep->bEndpointAddress;
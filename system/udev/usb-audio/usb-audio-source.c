@@ -44,6 +44,11 @@ typedef struct {
 
     // the last signals we reported
     mx_signals_t signals;
+
+    // ring buffer the client reads from, if it asked for one; completed
+    // reads go into it and straight back to the controller while we are
+    // started
+    usb_audio_ring_t ring;
 } usb_audio_source_t;
 #define get_usb_audio_source(dev) containerof(dev, usb_audio_source_t, device)
 
@@ -60,6 +65,31 @@ static void update_signals(usb_audio_source_t* source) {
     }
 }
 
+// copies a completed read into the ring buffer, as stereo
+// called with source->mutex held
+static void ring_put_packet(usb_audio_source_t* source, iotxn_t* txn) {
+    void* data;
+    txn->ops->mmap(txn, &data);
+    if (source->channels == 2) {
+        usb_audio_ring_write(&source->ring, data, txn->actual);
+        return;
+    }
+    // expand mono to stereo a chunk at a time
+    const uint16_t* src = data;
+    size_t count = txn->actual / sizeof(uint16_t);
+    while (count > 0) {
+        uint16_t stereo[256];
+        size_t n = (count < countof(stereo) / 2) ? count : countof(stereo) / 2;
+        for (size_t i = 0; i < n; i++) {
+            stereo[2 * i] = src[i];
+            stereo[2 * i + 1] = src[i];
+        }
+        usb_audio_ring_write(&source->ring, stereo, n * 2 * sizeof(uint16_t));
+        src += n;
+        count -= n;
+    }
+}
+
 static void usb_audio_source_read_complete(iotxn_t* txn, void* cookie) {
     usb_audio_source_t* source = (usb_audio_source_t*)cookie;
 
@@ -71,6 +101,11 @@ static void usb_audio_source_read_complete(iotxn_t* txn, void* cookie) {
     mtx_lock(&source->mutex);
     if (!source->open) {
         list_add_tail(&source->free_read_reqs, &txn->node);
+    } else if (source->ring.header && source->started) {
+        if (txn->status == NO_ERROR && txn->actual > 0) {
+            ring_put_packet(source, txn);
+        }
+        iotxn_queue(source->usb_device, txn);
     } else if (txn->status == NO_ERROR && txn->actual > 0) {
         list_add_tail(&source->completed_reads, &txn->node);
         source->completed_read_count++;
@@ -106,6 +141,7 @@ static mx_status_t usb_audio_source_release(mx_device_t* device) {
     while ((txn = list_remove_head_type(&source->completed_reads, iotxn_t, node)) != NULL) {
         txn->ops->release(txn);
     }
+    usb_audio_ring_release(&source->ring);
     free(source->sample_rates);
     free(source);
     return NO_ERROR;
@@ -128,6 +164,10 @@ static mx_status_t usb_audio_source_start(usb_audio_source_t* source) {
         usb_set_interface(source->usb_device, source->interface_number, source->alternate_setting);
     }
 
+    mtx_lock(&source->mutex);
+    source->started = true;
+    mtx_unlock(&source->mutex);
+
     // queue up reads, including stale completed reads
     iotxn_t* txn;
     while ((txn = list_remove_head_type(&source->completed_reads, iotxn_t, node)) != NULL) {
@@ -155,6 +195,10 @@ static mx_status_t usb_audio_source_stop(usb_audio_source_t* source) {
         goto out;
     }
 
+    mtx_lock(&source->mutex);
+    source->started = false;
+    mtx_unlock(&source->mutex);
+
     // switch back to primary interface
     if (source->alternate_setting != 0) {
         usb_set_interface(source->usb_device, source->interface_number, 0);
@@ -189,6 +233,12 @@ static mx_status_t usb_audio_source_close(mx_device_t* dev, uint32_t flags) {
     mtx_unlock(&source->mutex);
     usb_audio_source_stop(source);
 
+    mtx_lock(&source->start_stop_mutex);
+    mtx_lock(&source->mutex);
+    usb_audio_ring_release(&source->ring);
+    mtx_unlock(&source->mutex);
+    mtx_unlock(&source->start_stop_mutex);
+
     return NO_ERROR;
 }
 
@@ -198,6 +248,9 @@ static ssize_t usb_audio_source_read(mx_device_t* dev, void* data, size_t length
     if (source->dead) {
         return ERR_REMOTE_CLOSED;
     }
+    if (source->ring.header) {
+        return ERR_BAD_STATE;
+    }
 
     mx_status_t status = 0;
 
@@ -301,6 +354,25 @@ static ssize_t usb_audio_source_ioctl(mx_device_t* dev, uint32_t op, const void*
         return usb_audio_source_start(source);
     case IOCTL_AUDIO_STOP:
         return usb_audio_source_stop(source);
+    case IOCTL_AUDIO_GET_RING_BUFFER: {
+        mx_handle_t* reply = out_buf;
+        if (in_len < sizeof(uint32_t) || out_len < sizeof(*reply)) return ERR_BUFFER_TOO_SMALL;
+        uint32_t size = *((uint32_t *)in_buf);
+        mx_status_t status;
+        mtx_lock(&source->start_stop_mutex);
+        mtx_lock(&source->mutex);
+        if (source->started) {
+            status = ERR_BAD_STATE;
+        } else if (source->ring.header) {
+            status = ERR_ALREADY_BOUND;
+        } else {
+            // the ring holds stereo, whatever the device sends
+            status = usb_audio_ring_create(&source->ring, size, 2 * sizeof(uint16_t), reply);
+        }
+        mtx_unlock(&source->mutex);
+        mtx_unlock(&source->start_stop_mutex);
+        return (status == NO_ERROR) ? (ssize_t)sizeof(*reply) : status;
+    }
     }
 
     return ERR_NOT_SUPPORTED;
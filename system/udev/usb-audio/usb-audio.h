@@ -5,6 +5,8 @@
 #pragma once
 
 #include <ddk/device.h>
+#include <ddk/iotxn.h>
+#include <magenta/device/audio.h>
 #include <magenta/hw/usb.h>
 #include <magenta/hw/usb-audio.h>
 
@@ -34,3 +36,26 @@ mx_status_t usb_audio_set_sample_rate(mx_device_t* usb_device, uint8_t ep_addr,
 
 // volume is in 0 - 100 range
 mx_status_t usb_audio_set_volume(mx_device_t* device, uint8_t interface_number, int fu_id, int volume);
+
+// ring buffer shared with a client through IOCTL_AUDIO_GET_RING_BUFFER
+typedef struct {
+    mx_handle_t vmo;
+    audio_ring_buffer_t* header;
+    uint8_t* data;
+    size_t mapped_size;
+    // the client can write to the header, so the driver keeps its own copies
+    // and only ever stores to it
+    size_t size;
+    uint64_t position;
+} usb_audio_ring_t;
+
+// creates the ring with room for size bytes of audio (rounded down to
+// frame_size) and returns a handle to its VMO for the client
+mx_status_t usb_audio_ring_create(usb_audio_ring_t* ring, uint32_t size, int frame_size,
+                                  mx_handle_t* out_vmo);
+void usb_audio_ring_release(usb_audio_ring_t* ring);
+
+// copies length bytes from the ring at position into txn, and advances position
+void usb_audio_ring_read(usb_audio_ring_t* ring, iotxn_t* txn, size_t length);
+// copies length bytes into the ring at position, and advances position
+void usb_audio_ring_write(usb_audio_ring_t* ring, const void* data, size_t length);
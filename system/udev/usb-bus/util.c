@@ -5,6 +5,7 @@
 #include <ddk/completion.h>
 #include <ddk/protocol/usb.h>
 #include <string.h>
+#include <threads.h>
 
 #include "usb-device.h"
 #include "util.h"
@@ -13,12 +14,30 @@ static void usb_device_control_complete(iotxn_t* txn, void* cookie) {
     completion_signal((completion_t*)cookie);
 }
 
+// most control requests are small, and drivers make them all the time
+#define CONTROL_POOL_COUNT 4
+#define CONTROL_POOL_DATA_SIZE 256
+
+static iotxn_pool_t* control_pool;
+static once_flag control_pool_once = ONCE_FLAG_INIT;
+
+static void control_pool_init(void) {
+    // failing which, iotxns are allocated as needed
+    iotxn_pool_create(&control_pool, CONTROL_POOL_COUNT, CONTROL_POOL_DATA_SIZE, 0);
+}
+
 mx_status_t usb_device_control(mx_device_t* hci_device, uint32_t device_id,
                                uint8_t request_type,  uint8_t request, uint16_t value,
                                uint16_t index, void* data, size_t length) {
     iotxn_t* txn;
+    mx_status_t status;
 
-    mx_status_t status = iotxn_alloc(&txn, 0, length, 0);
+    call_once(&control_pool_once, control_pool_init);
+    if ((control_pool != NULL) && (length <= CONTROL_POOL_DATA_SIZE)) {
+        status = iotxn_pool_alloc(control_pool, &txn);
+    } else {
+        status = iotxn_alloc(&txn, 0, length, 0);
+    }
     if (status != NO_ERROR) return status;
     txn->protocol = MX_PROTOCOL_USB;
     usb_protocol_data_t* proto_data = iotxn_pdata(txn, usb_protocol_data_t);
@@ -34,8 +34,11 @@
 #define ROUNDUP(a, b) (((a)+ ((b)-1)) & ~((b)-1))
 #define ALIGN(a, b) ROUNDUP(a, b)
 
-#define READ_REQ_COUNT 8
-#define WRITE_REQ_COUNT 4
+// Bulk-in transfers carry as many frames as RQCR lets the chip aggregate
+// (see ax88179_bulk_in_config), so at gigabit speeds each read in flight
+// holds about 150us of traffic
+#define READ_REQ_COUNT 16
+#define WRITE_REQ_COUNT 16
 #define USB_BUF_SIZE 24576
 #define INTR_REQ_SIZE 8
 #define RX_HEADER_SIZE 4
@@ -57,6 +60,8 @@ typedef struct {
     // pool of free USB bulk requests
     list_node_t free_read_reqs;
     list_node_t free_write_reqs;
+    // signaled when a write request is freed
+    completion_t write_freed;
 
     // list of received packets not yet queued into the rx fifo
     list_node_t completed_reads;
@@ -275,6 +280,7 @@ static void ax88179_write_complete(iotxn_t* request, void* cookie) {
 
     mtx_lock(&eth->mutex);
     list_add_tail(&eth->free_write_reqs, &request->node);
+    completion_signal(&eth->write_freed);
     update_signals_locked(eth);
     mtx_unlock(&eth->mutex);
 }
@@ -327,12 +333,18 @@ static void ax88179_handle_interrupt(ax88179_t* eth, iotxn_t* request) {
     mtx_unlock(&eth->mutex);
 }
 
+// Copies the next packet of the completed read into the rx fifo entry after
+// the *filled already filled, which the caller hands to the client all at
+// once by advancing the tail. An error drops the rest of the read.
 static mx_status_t process_one_packet(ax88179_t* eth, iotxn_t* completed_read,
-        mx_fifo_state_t* fifo_state) {
+        mx_fifo_state_t* fifo_state, uint64_t* filled) {
     xprintf("request len %" PRIu64"\n", completed_read->actual);
     size_t offset = eth->read_offset;
+    size_t packet = eth->packet;
+    eth->read_offset = 0;
+    eth->packet = 0;
 
-    uint64_t entry_idx = fifo_state->tail & (eth->fifo.rx_entries_count - 1);
+    uint64_t entry_idx = (fifo_state->tail + *filled) & (eth->fifo.rx_entries_count - 1);
     eth_fifo_entry_t* entry = &eth->rx_entries[entry_idx];
 
     if (completed_read->actual < 4) {
@@ -351,8 +363,8 @@ static mx_status_t process_one_packet(ax88179_t* eth, iotxn_t* completed_read,
         return ERR_IO_DATA_INTEGRITY;
     }
 
-    xprintf("next packet: %zd\n", eth->packet);
-    ptrdiff_t pkt_idx = eth->packet++ * sizeof(uint32_t);
+    xprintf("next packet: %zd\n", packet);
+    ptrdiff_t pkt_idx = packet++ * sizeof(uint32_t);
     uint32_t* pkt_hdr = (uint32_t*)(read_data + rxhdr->pkt_hdr_off + pkt_idx);
     if ((uintptr_t)pkt_hdr >= (uintptr_t)(read_data + completed_read->actual)) {
         printf("%s packet header out of bounds %p > %p\n", __func__, pkt_hdr,
@@ -385,33 +397,32 @@ static mx_status_t process_one_packet(ax88179_t* eth, iotxn_t* completed_read,
             printf("%s packet bigger than rx fifo entry length!!!\n", __func__);
             return ERR_BUFFER_TOO_SMALL;
         }
+
+        if (offset + pkt_len > rxhdr->pkt_hdr_off) {
+            printf("%s packet out of bounds\n", __func__);
+            return ERR_IO_DATA_INTEGRITY;
+        }
         xprintf("offset = %zd\n", offset);
 
         // Write the packet
         memcpy(&eth->rx_map[entry->offset], (void*)&read_data[offset + 2], pkt_len - 2);
         // Update the fifo entry
         entry->length = pkt_len - 2;
-        // Move the fifo pointer
-        mx_status_t status = mx_fifo_op(eth->fifo.rx_fifo, MX_FIFO_OP_ADVANCE_TAIL, 1u, fifo_state);
-        if (status != NO_ERROR) {
-            printf("%s could not advance rx fifo tail (%d)\n", __func__, status);
-        }
+        (*filled)++;
     }
 
     // Advance past this packet in the completed read
     offset += pkt_len;
     offset = ALIGN(offset, 8);
     if (offset >= rxhdr->pkt_hdr_off) {
-        offset = 0;
-        eth->packet = 0;
+        return NO_ERROR;
     }
 
 #if AX88179_DEBUG
-    if (offset != 0) {
-        printf("setting read offset to %zd\n", offset);
-    }
+    printf("setting read offset to %zd\n", offset);
 #endif
     eth->read_offset = offset;
+    eth->packet = packet;
 
     return NO_ERROR;
 }
@@ -472,12 +483,12 @@ static int ax88179_rx_thread(void* arg) {
                 break;
             }
             uint64_t num_fifo_entries = state.head - state.tail;
+            uint64_t filled = 0;
             iotxn_t* request = containerof(node, iotxn_t, node);
-            while (num_fifo_entries > 0) {
-                status = process_one_packet(eth, request, &state);
+            while (filled < num_fifo_entries) {
+                status = process_one_packet(eth, request, &state, &filled);
                 if (status != NO_ERROR) {
                     printf("%s could not process packet (%d)\n", __func__, status);
-                    // error???
                 }
                 if (eth->read_offset == 0) {
                     // Get the next completed read txn, if any
@@ -488,24 +499,32 @@ static int ax88179_rx_thread(void* arg) {
                         update_signals_locked(eth);
                         completion_reset(&eth->rx_complete);
                         mtx_unlock(&eth->mutex);
-                        goto wait_for_rx;
+                        break;
                     }
                     mtx_unlock(&eth->mutex);
                     request = containerof(node, iotxn_t, node);
                 }
+            }
 
-                num_fifo_entries = state.head - state.tail;
+            // Move the fifo pointer past all the packets received
+            if (filled > 0) {
+                status = mx_fifo_op(eth->fifo.rx_fifo, MX_FIFO_OP_ADVANCE_TAIL, filled, &state);
+                if (status != NO_ERROR) {
+                    printf("%s could not advance rx fifo tail (%d)\n", __func__, status);
+                }
             }
         }
-wait_for_rx: ;
     }
     return 0;
 }
 
-static mx_status_t send_one_packet(ax88179_t* eth, iotxn_t* request, mx_fifo_state_t *fifo_state) {
-    uint64_t entry_idx = fifo_state->tail & (eth->fifo.tx_entries_count - 1);
+// Queues the tx fifo entry after the *sent already sent, which the caller
+// returns to the client all at once by advancing the tail.
+static mx_status_t send_one_packet(ax88179_t* eth, iotxn_t* request, mx_fifo_state_t *fifo_state,
+                                   uint64_t* sent) {
+    uint64_t entry_idx = (fifo_state->tail + *sent) & (eth->fifo.tx_entries_count - 1);
     eth_fifo_entry_t* entry = &eth->tx_entries[entry_idx];
-    if (entry->length + sizeof(ax88179_tx_hdr_t) > 1500) {
+    if (entry->length + sizeof(ax88179_tx_hdr_t) > USB_BUF_SIZE) {
         printf("%s tx entry too large\n", __func__);
         return ERR_BUFFER_TOO_SMALL;
     }
@@ -519,15 +538,9 @@ static mx_status_t send_one_packet(ax88179_t* eth, iotxn_t* request, mx_fifo_sta
 
     memcpy((void*)(write_buffer + sizeof(*txhdr)), (void*)&eth->tx_map[entry->offset],
             entry->length);
-    request->length = entry->length + sizeof(txhdr);
+    request->length = entry->length + sizeof(*txhdr);
     iotxn_queue(eth->usb_device, request);
-
-    // Move the fifo pointer
-    // TODO: batch these up
-    mx_status_t status = mx_fifo_op(eth->fifo.tx_fifo, MX_FIFO_OP_ADVANCE_TAIL, 1u, fifo_state);
-    if (status != NO_ERROR) {
-        printf("%s could not advance tx fifo tail (%d)\n", __func__, status);
-    }
+    (*sent)++;
 
     return NO_ERROR;
 }
@@ -557,23 +570,39 @@ static int ax88179_tx_thread(void* arg) {
         if (state.head == state.tail) continue;
 
         uint64_t num_fifo_entries = state.head - state.tail;
-        while (num_fifo_entries > 0) {
+        uint64_t sent = 0;
+        while (sent < num_fifo_entries) {
             mtx_lock(&eth->mutex);
             list_node_t* node = list_remove_head(&eth->free_write_reqs);
+            if (!node) {
+                completion_reset(&eth->write_freed);
+            }
             mtx_unlock(&eth->mutex);
             if (!node) {
-                // drop packets when no outgoing buffers
-                // or do we use a completion to find out when there are new
-                // buffers?
+                // Hand back what was sent, and wait for a write to finish
+                // rather than spinning on the still non-empty fifo
                 break;
             }
-            status = send_one_packet(eth, containerof(node, iotxn_t, node), &state);
+            status = send_one_packet(eth, containerof(node, iotxn_t, node), &state, &sent);
             if (status != NO_ERROR) {
                 printf("%s could not send packet (%d)\n", __func__, status);
-                break;
-                // error???
+                // Drop the packet
+                mtx_lock(&eth->mutex);
+                list_add_tail(&eth->free_write_reqs, node);
+                mtx_unlock(&eth->mutex);
+                sent++;
             }
-            num_fifo_entries = state.head - state.tail;
+        }
+
+        // Move the fifo pointer past all the packets sent
+        if (sent > 0) {
+            status = mx_fifo_op(eth->fifo.tx_fifo, MX_FIFO_OP_ADVANCE_TAIL, sent, &state);
+            if (status != NO_ERROR) {
+                printf("%s could not advance tx fifo tail (%d)\n", __func__, status);
+            }
+        }
+        if (sent < num_fifo_entries) {
+            completion_wait(&eth->write_freed, MX_SEC(1));
         }
         mtx_lock(&eth->mutex);
         update_signals_locked(eth);
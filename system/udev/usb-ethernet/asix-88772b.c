@@ -292,17 +292,19 @@ mx_status_t ax88772b_recv(mx_device_t* device, void* buffer, size_t length) {
     if (remaining < 4) {
         printf("ax88772b_recv short packet\n");
         status = ERR_INTERNAL;
+        offset = 0;
         list_remove_head(&eth->completed_reads);
         requeue_read_request_locked(eth, request);
         goto out;
     }
 
+    // a read holds as many frames as fit, each after its own header
     uint8_t header[ETH_HEADER_SIZE];
-    request->ops->copyfrom(request, header, ETH_HEADER_SIZE, 0);
+    request->ops->copyfrom(request, header, ETH_HEADER_SIZE, offset);
     uint16_t length1 = (header[0] | (uint16_t)header[1] << 8) & 0x7FF;
     uint16_t length2 = (~(header[2] | (uint16_t)header[3] << 8)) & 0x7FF;
 
-    if (length1 != length2) {
+    if ((length1 != length2) || (length1 > remaining - ETH_HEADER_SIZE)) {
         printf("invalid header: length1: %d length2: %d offset %zu\n", length1, length2, offset);
         status = ERR_INTERNAL;
         offset = 0;
@@ -314,7 +316,7 @@ mx_status_t ax88772b_recv(mx_device_t* device, void* buffer, size_t length) {
         status = ERR_BUFFER_TOO_SMALL;
         goto out;
     }
-    request->ops->copyfrom(request, buffer, length1, ETH_HEADER_SIZE);
+    request->ops->copyfrom(request, buffer, length1, offset + ETH_HEADER_SIZE);
     status = length1;
     offset += (length1 + 4);
     if (offset & 1)
@@ -29,6 +29,10 @@
 #define WRITE_REQ_COUNT 4
 #define INTR_REQ_COUNT 4
 #define USB_BUF_SIZE 2048
+// Reads carry several frames each (LAN9514_HW_CFG_MEF), bursts of up to
+// USB_RX_BUF_SIZE bytes in high speed USB packets
+#define USB_HS_PACKET_SIZE 512
+#define USB_RX_BUF_SIZE (16 * 1024 + 5 * USB_HS_PACKET_SIZE)
 #define INTR_REQ_SIZE 4
 //#define ETH_HEADER_SIZE 4
 
@@ -337,6 +341,7 @@ mx_status_t lan9514_recv(mx_device_t* device, void* buffer, size_t length) {
     mx_status_t status = NO_ERROR;
 
     mtx_lock(&eth->mutex);
+    size_t offset = eth->read_offset;
 
     list_node_t* node = list_peek_head(&eth->completed_reads);
     if (!node) {
@@ -345,15 +350,25 @@ mx_status_t lan9514_recv(mx_device_t* device, void* buffer, size_t length) {
     }
     iotxn_t* request = containerof(node, iotxn_t, node);
 
+    // each frame follows its status word, and the next status word is
+    // 4 byte aligned
     uint32_t rx_status;
-
-    request->ops->copyfrom(request, &rx_status, sizeof(rx_status), 0);
+    if (request->actual - offset < sizeof(rx_status)) {
+        status = ERR_INTERNAL;
+        offset = 0;
+        list_remove_head(&eth->completed_reads);
+        requeue_read_request_locked(eth, request);
+        goto out;
+    }
+    request->ops->copyfrom(request, &rx_status, sizeof(rx_status), offset);
 
     uint32_t frame_len = (rx_status & LAN9514_RXSTATUS_FRAME_LEN) >> 16;
 
-    if (rx_status & LAN9514_RXSTATUS_ERROR_MASK) {
+    if ((rx_status & LAN9514_RXSTATUS_ERROR_MASK) ||
+        (frame_len > request->actual - offset - sizeof(rx_status))) {
         printf("invalid header: 0x%08x\n", rx_status);
         status = ERR_INTERNAL;
+        offset = 0;
         list_remove_head(&eth->completed_reads);
         requeue_read_request_locked(eth, request);
         goto out;
@@ -364,12 +379,17 @@ mx_status_t lan9514_recv(mx_device_t* device, void* buffer, size_t length) {
         goto out;
     }
 
-    request->ops->copyfrom(request, buffer, frame_len, sizeof(rx_status));
+    request->ops->copyfrom(request, buffer, frame_len, offset + sizeof(rx_status));
     status = frame_len;
 
-    list_remove_head(&eth->completed_reads);
+    offset = (offset + sizeof(rx_status) + frame_len + 3) & ~3;
+    if (offset >= request->actual) {
+        offset = 0;
+        list_remove_head(&eth->completed_reads);
+        requeue_read_request_locked(eth, request);
+    }
 out:
-    eth->read_offset = 0;
+    eth->read_offset = offset;
     update_signals_locked(eth);
     mtx_unlock(&eth->mutex);
     return status;
@@ -600,11 +620,17 @@ static mx_status_t lan9514_reset(lan9514_t* eth) {
     if (lan9514_write_register(eth, LAN9514_HW_CFG_REG, retval) < 0)
         goto fail;
 
+    if (lan9514_write_register(eth, LAN9514_BURST_CAP_REG,
+                               USB_RX_BUF_SIZE / USB_HS_PACKET_SIZE) < 0)
+        goto fail;
+
     if (lan9514_write_register(eth, LAN9514_BULK_IN_DLY_REG, LAN9514_BULK_IN_DLY_DEFAULT) < 0)
         goto fail;
 
+    // Several frames per bulk in transfer, up to the burst cap
     if (lan9514_read_register(eth, LAN9514_HW_CFG_REG, &retval) < 0)
         goto fail;
+    retval |= LAN9514_HW_CFG_MEF | LAN9514_HW_CFG_BCE;
     retval &= ~LAN9514_HW_CFG_RXDOFF;
     if (lan9514_write_register(eth, LAN9514_HW_CFG_REG, retval) < 0)
         goto fail;
@@ -796,12 +822,12 @@ static mx_status_t lan9514_bind(mx_driver_t* driver, mx_device_t* device) {
 
     mx_status_t status = NO_ERROR;
     for (int i = 0; i < READ_REQ_COUNT; i++) {
-        iotxn_t* req = usb_alloc_iotxn(bulk_in_addr, USB_BUF_SIZE, 0);
+        iotxn_t* req = usb_alloc_iotxn(bulk_in_addr, USB_RX_BUF_SIZE, 0);
         if (!req) {
             status = ERR_NO_MEMORY;
             goto fail;
         }
-        req->length = USB_BUF_SIZE;
+        req->length = USB_RX_BUF_SIZE;
         req->complete_cb = lan9514_read_complete;
         req->cookie = eth;
         list_add_head(&eth->free_read_reqs, &req->node);
@@ -48,7 +48,9 @@
 #define LAN9514_TX_CFG_FIFO_FLUSH       (0x00000001)
 
 #define LAN9514_HW_CFG_REG              (0x14)
+#define LAN9514_HW_CFG_BCE              (0x00000002)
 #define LAN9514_HW_CFG_LRST             (0x00000008)
+#define LAN9514_HW_CFG_MEF              (0x00000020)
 #define LAN9514_HW_CFG_BIR              (0x00001000)
 #define LAN9514_HW_CFG_RXDOFF           (0x00000600)
 
@@ -61,6 +63,8 @@
 #define LAN9514_LED_GPIO_CFG_FDX_LED    (0x00010000)
 
 #define LAN9514_AFC_CFG_REG             (0x2C)
+
+#define LAN9514_BURST_CAP_REG           (0x38)
 /* Hi watermark = 15.5Kb (~10 mtu pkts) */
 /* low watermark = 3k (~2 mtu pkts) */
 /* backpressure duration = ~ 350us */
@@ -21,6 +21,10 @@
 #define USB_HID_PROTOCOL_MOUSE  0x02
 
 #define USB_HID_DEBUG 0
+
+// interrupt requests kept queued per interface, so that the endpoint is still
+// polled at its full rate while a completed request is being handled
+#define USB_HID_INTR_REQ_COUNT 4
 #define to_usb_hid(d) containerof(d, usb_hid_device_t, hiddev)
 
 typedef struct usb_hid_device {
@@ -196,16 +200,24 @@ static mx_status_t usb_hid_bind(mx_driver_t* drv, mx_device_t* dev) {
             dev_class = HID_DEV_CLASS_POINTER;
         }
 
-        iotxn_t* usbtxn = usb_alloc_iotxn(endpt->bEndpointAddress, usb_ep_max_packet(endpt), 0);
-        if (usbtxn == NULL) {
-            usb_desc_iter_release(&iter);
-            free(usbhid);
-            return ERR_NO_MEMORY;
+        iotxn_t* usbtxns[USB_HID_INTR_REQ_COUNT];
+        for (int i = 0; i < USB_HID_INTR_REQ_COUNT; i++) {
+            usbtxns[i] = usb_alloc_iotxn(endpt->bEndpointAddress, usb_ep_max_packet(endpt), 0);
+            if (usbtxns[i] == NULL) {
+                while (i-- > 0) {
+                    usbtxns[i]->ops->release(usbtxns[i]);
+                }
+                usb_desc_iter_release(&iter);
+                free(usbhid);
+                return ERR_NO_MEMORY;
+            }
+            usbtxns[i]->length = usb_ep_max_packet(endpt);
+            usbtxns[i]->complete_cb = usb_interrupt_callback;
+            usbtxns[i]->cookie = usbhid;
+        }
+        for (int i = 0; i < USB_HID_INTR_REQ_COUNT; i++) {
+            iotxn_queue(usbhid->usbdev, usbtxns[i]);
         }
-        usbtxn->length = usb_ep_max_packet(endpt);
-        usbtxn->complete_cb = usb_interrupt_callback;
-        usbtxn->cookie = usbhid;
-        iotxn_queue(usbhid->usbdev, usbtxn);
 
         hid_init_device(&usbhid->hiddev, &usb_hid_bus_ops, usbhid->interface, boot_dev, dev_class);
         mx_status_t status = hid_add_device(drv, &usbhid->hiddev, dev);
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // clang-format off
 
 // SCSI commands
@@ -24,7 +26,7 @@
 #define UMS_READ16                   0x88
 #define UMS_WRITE16                  0x8A
 #define UMS_READ_CAPACITY16          0x9E
-#define UMS_READ12                   0x8A
+#define UMS_READ12                   0xA8
 #define UMS_WRITE12                  0xAA
 
 // control request values
@@ -67,4 +69,45 @@ typedef enum {CSW_SUCCESS, CSW_FAILED, CSW_PHASE_ERROR, CSW_INVALID,
 #define UMS_REQUEST_SENSE_TRANSFER_LENGTH          0x12
 #define UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH 0xFC
 #define UMS_READ_CAPACITY10_TRANSFER_LENGTH        0x08
-#define UMS_READ_CAPACITY16_TRANSFER_LENGTH        0x20
\ No newline at end of file
+#define UMS_READ_CAPACITY16_TRANSFER_LENGTH        0x20
+
+// interface protocols
+#define UMS_PROTOCOL_BULK_ONLY                     0x50
+#define UMS_PROTOCOL_UAS                           0x62
+
+// SCSI status
+#define SCSI_STATUS_GOOD                           0x00
+
+// USB Attached SCSI
+
+// pipe usage descriptor, following each endpoint descriptor of a UAS interface
+#define UAS_DT_PIPE_USAGE           0x24
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;    // UAS_DT_PIPE_USAGE
+    uint8_t bPipeID;
+    uint8_t reserved;
+} __attribute__ ((packed)) uas_pipe_usage_descriptor_t;
+
+#define UAS_PIPE_COMMAND            1
+#define UAS_PIPE_STATUS             2
+#define UAS_PIPE_DATA_IN            3
+#define UAS_PIPE_DATA_OUT           4
+
+// information unit IDs
+#define UAS_IU_COMMAND              0x01
+#define UAS_IU_SENSE                0x03
+#define UAS_IU_RESPONSE             0x04
+#define UAS_IU_READ_READY           0x06
+#define UAS_IU_WRITE_READY          0x07
+
+// command IU with a 16 byte CDB: IU ID, reserved, tag (be16), task attribute,
+// reserved, additional CDB length, reserved, LUN (8), CDB (16)
+#define UAS_COMMAND_IU_SIZE         32
+#define UAS_COMMAND_IU_CDB          16
+
+// IUs on the status pipe all start with IU ID, reserved and tag (be16).
+// sense IUs have the SCSI status at offset 6, response IUs their code at 7.
+#define UAS_IU_TAG                  2
+#define UAS_SENSE_IU_STATUS         6
+#define UAS_RESPONSE_IU_CODE        7
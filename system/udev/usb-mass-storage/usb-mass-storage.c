@@ -16,14 +16,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <threads.h>
 #include <unistd.h>
 
 #include "ums-hw.h"
 
-#define READ_REQ_COUNT 3
-#define WRITE_REQ_COUNT 3
-#define USB_BUF_SIZE 0x8000
+// Bulk-Only Transport has one command at a time. UAS devices take several,
+// told apart by tag; that is only done below SuperSpeed, where it works
+// without bulk streams, which the xHCI driver does not have.
+#define BOT_MAX_COMMANDS 1
+#define UAS_MAX_COMMANDS 16
+
+// most data one command moves: a transfer ring holds a transfer this long
+// even when its pages are scattered
+#define UMS_MAX_TRANSFER (1024 * 1024)
+
+// status IUs are mostly sense IUs, a 16 byte header and the sense data
+#define UAS_STATUS_BUF_SIZE 512
 
 // comment the next line if you don't want debug messages
 #define DEBUG 0
@@ -33,54 +43,105 @@
 # define DEBUG_PRINT(x) do {} while (0)
 #endif
 
+typedef struct ums ums_t;
+
 // used to implement IOCTL_DEVICE_SYNC
 typedef struct {
-    // iotxn we are waiting to complete
-    iotxn_t* iotxn;
+    // completes once the iotxns queued before seq have
+    uint64_t seq;
     // completion for IOCTL_DEVICE_SYNC to wait on
     completion_t completion;
     // node for ums_t.sync_nodes list
     list_node_t node;
 } ums_sync_node_t;
 
+// an iotxn, done as one or more commands
+typedef struct {
+    // node for ums_t.queued_txns list
+    list_node_t node;
+    iotxn_t* txn;
+    // order it was queued in
+    uint64_t seq;
+    // bytes of txn commands have been started for
+    uint64_t issued;
+    // commands yet to start, and started but not finished
+    uint32_t unissued;
+    uint32_t pending;
+    mx_status_t status;
+    // a command of the driver's own, rather than a read or write
+    uint8_t cdb[16];
+    uint8_t cdb_length;
+} ums_txn_t;
+
+// a command in flight
 typedef struct {
+    // node for ums_t.free_cmds list, while not in use
+    list_node_t node;
+    ums_t* msd;
+    // NULL while not in use
+    ums_txn_t* utxn;
+    // CBW, or UAS command IU
+    iotxn_t* cmd_req;
+    // CSW, for Bulk-Only Transport
+    iotxn_t* csw_req;
+    // a clone of the iotxn, or a copy of the part of it at offset
+    iotxn_t* data;
+    bool copy;
+    uint64_t offset;
+    uint32_t tag;
+    bool data_queued;
+    bool data_done;
+    bool status_done;
+    mx_status_t status;
+} ums_cmd_t;
+
+struct ums {
     mx_device_t device;
     mx_device_t* udev;
     mx_driver_t* driver;
 
-    uint32_t tag_send;      // next tag to send in CBW
-    uint32_t tag_receive;   // next tag we expect to receive in CSW
+    uint32_t tag;           // next tag to send in CBW
 
     uint8_t lun;
     uint64_t total_blocks;
     uint32_t block_size;
+    uint32_t max_transfer;  // per command, a multiple of block_size
 
     bool use_read_write_16; // use READ16 and WRITE16 if total_blocks > 0xFFFFFFFF
 
-    uint8_t bulk_in_addr;
-    uint8_t bulk_out_addr;
+    // USB Attached SCSI rather than Bulk-Only Transport, where the
+    // command and status pipes are the data pipes
+    bool uas;
+    uint8_t cmd_addr;
+    uint8_t status_addr;
+    uint8_t data_in_addr;
+    uint8_t data_out_addr;
 
-    // pool of free USB requests
-    list_node_t free_csw_reqs;
-    list_node_t free_read_reqs;
-    list_node_t free_write_reqs;
+    ums_cmd_t cmds[UAS_MAX_COMMANDS];
+    uint32_t cmd_count;
+    list_node_t free_cmds;
+    // UAS status reads, one for each command in flight
+    list_node_t free_status_reqs;
 
-    // list of queued io transactions
-    list_node_t queued_iotxns;
+    // iotxns with commands to start or finish, in the order queued
+    list_node_t queued_txns;
+    uint64_t next_seq;
 
     // list of active ums_sync_node_t
     list_node_t sync_nodes;
 
-    // list of received packets not yet read by upper layer
-    list_node_t completed_reads;
-    list_node_t completed_csws;
-
     mtx_t mutex;
-} ums_t;
+};
 #define get_ums(dev) containerof(dev, ums_t, device)
 
-static void ums_csw_complete(iotxn_t* csw_request, void* cookie);
-static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request);
+// what is found to do under the mutex, done once it is dropped
+typedef struct {
+    // USB requests to queue, in order
+    list_node_t reqs;
+    // ums_txn_t to complete
+    list_node_t done;
+    bool reset;
+} ums_work_t;
 
 static inline uint16_t read16be(uint8_t* ptr) {
     return betoh16(*((uint16_t*)ptr));
@@ -115,10 +176,10 @@ static mx_status_t ums_reset(ums_t* msd) {
                                             | USB_RECIP_INTERFACE, USB_REQ_RESET, 0x00, 0x00, NULL, 0);
     status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
                                            | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
-                                           msd->bulk_in_addr, NULL, 0);
+                                           msd->data_in_addr, NULL, 0);
     status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
                                            | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
-                                           msd->bulk_out_addr, NULL, 0);
+                                           msd->data_out_addr, NULL, 0);
     return status;
 }
 
@@ -128,123 +189,152 @@ static mx_status_t ums_get_max_lun(ums_t* msd, void* data) {
     return status;
 }
 
-static iotxn_t* get_free_write(ums_t* msd) {
-    list_node_t* node = list_remove_head(&msd->free_write_reqs);
-    if (!node) {
-        return NULL;
-    }
-    return containerof(node, iotxn_t, node);
-}
 
-static void ums_queue_request(ums_t* msd, iotxn_t* txn) {
-    iotxn_queue(msd->udev, txn);
+static void ums_work_init(ums_work_t* work) {
+    list_initialize(&work->reqs);
+    list_initialize(&work->done);
+    work->reset = false;
 }
 
-static mx_status_t ums_send_cbw(ums_t* msd, uint32_t transfer_length, uint8_t flags,
-                                uint8_t command_len, void* command) {
-    iotxn_t* txn = get_free_write(msd);
-    if (!txn) {
-        return ERR_BUFFER_TOO_SMALL;
+static void ums_work_finish(ums_t* msd, ums_work_t* work) {
+    if (work->reset) {
+        ums_reset(msd);
     }
-    // CBWs always have 31 bytes
-    txn->length = 31;
-
-    // first three blocks are 4 byte
-    uint32_t buf_32[3];
-    buf_32[0] = htole32(CBW_SIGNATURE);
-    buf_32[1] = htole32(msd->tag_send++);
-    buf_32[2] = htole32(transfer_length);
-    txn->ops->copyto(txn, buf_32, sizeof(buf_32), 0);
-
-    // get a 3 x 1 byte buffer and start at 12 because of uint32's
-    uint8_t buf_8[3];
-    buf_8[0] = flags;
-    buf_8[1] = msd->lun;
-    buf_8[2] = command_len;
-    txn->ops->copyto(txn, buf_8, sizeof(buf_8), sizeof(buf_32));
-
-    // copy command_len bytes from the command passed in into the command_len
-    txn->ops->copyto(txn, command, command_len, sizeof(buf_32) + sizeof(buf_8));
-    ums_queue_request(msd, txn);
-    return NO_ERROR;
-}
-
-static mx_status_t ums_queue_csw(ums_t* msd) {
-    list_node_t* csw_node = list_remove_head(&msd->free_csw_reqs);
-    if (!csw_node) {
-        DEBUG_PRINT(("UMS:error, no CSW reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
+    iotxn_t* req;
+    while ((req = list_remove_head_type(&work->reqs, iotxn_t, node)) != NULL) {
+        iotxn_queue(msd->udev, req);
+    }
+    ums_txn_t* utxn;
+    while ((utxn = list_remove_head_type(&work->done, ums_txn_t, node)) != NULL) {
+        iotxn_t* txn = utxn->txn;
+        mx_status_t status = utxn->status;
+        free(utxn);
+        txn->ops->complete(txn, status, status == NO_ERROR ? txn->length : 0);
     }
-    iotxn_t* csw_request = containerof(csw_node, iotxn_t, node);
-    csw_request->complete_cb = ums_csw_complete;
-    csw_request->cookie = msd;
-    ums_queue_request(msd, csw_request);
-    return NO_ERROR;
 }
 
-static void ums_read_csw_complete(iotxn_t* txn, void* cookie) {
-    completion_signal((completion_t *)cookie);
+// unblocks calls to IOCTL_DEVICE_SYNC whose iotxns have all completed
+static void ums_sync_check_locked(ums_t* msd) {
+    ums_txn_t* oldest = list_peek_head_type(&msd->queued_txns, ums_txn_t, node);
+    uint64_t seq = oldest ? oldest->seq : msd->next_seq;
+    ums_sync_node_t* sync_node;
+    ums_sync_node_t* temp;
+    list_for_every_entry_safe(&msd->sync_nodes, sync_node, temp, ums_sync_node_t, node) {
+        if (sync_node->seq <= seq) {
+            list_delete(&sync_node->node);
+            completion_signal(&sync_node->completion);
+        }
+    }
 }
 
-static mx_status_t ums_read_csw(ums_t* msd) {
-    list_node_t* csw_node = list_remove_head(&msd->free_csw_reqs);
-    if (!csw_node) {
-        DEBUG_PRINT(("UMS:error, no CSW reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
+static void ums_cmd_finish_locked(ums_t* msd, ums_cmd_t* cmd, ums_work_t* work) {
+    ums_txn_t* utxn = cmd->utxn;
+    if (cmd->data) {
+        cmd->data->ops->release(cmd->data);
+        cmd->data = NULL;
+    }
+    if ((cmd->status != NO_ERROR) && (utxn->status == NO_ERROR)) {
+        utxn->status = cmd->status;
+        // the rest of it is not worth starting
+        utxn->unissued = 0;
+    }
+    utxn->pending--;
+    cmd->utxn = NULL;
+    list_add_tail(&msd->free_cmds, &cmd->node);
+
+    if ((utxn->unissued == 0) && (utxn->pending == 0)) {
+        list_delete(&utxn->node);
+        list_add_tail(&work->done, &utxn->node);
+        ums_sync_check_locked(msd);
     }
+}
 
-    completion_t completion = COMPLETION_INIT;
-    iotxn_t* csw_request = containerof(csw_node, iotxn_t, node);
-    csw_request->complete_cb = ums_read_csw_complete;
-    csw_request->cookie = &completion;
-    ums_queue_request(msd, csw_request);
-    completion_wait(&completion, MX_TIME_INFINITE);
+static void ums_start_locked(ums_t* msd, ums_work_t* work);
 
-    csw_status_t csw_error = ums_verify_csw(msd, csw_request);
-    list_add_tail(&msd->free_csw_reqs, &csw_request->node);
+static void ums_data_complete(iotxn_t* data, void* cookie) {
+    ums_cmd_t* cmd = cookie;
+    ums_t* msd = cmd->msd;
+    ums_work_t work;
+    ums_work_init(&work);
 
-    if (csw_error == CSW_SUCCESS) {
-        return NO_ERROR;
-    } else if (csw_error == CSW_FAILED) {
-        return ERR_BAD_STATE;
-    } else {
-        // FIXME - best way to handle this?
-        // print error and then reset device due to it
-        DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
-        ums_reset(msd);
-        return ERR_INTERNAL;
+    mtx_lock(&msd->mutex);
+    if (data->status != NO_ERROR) {
+        if (cmd->status == NO_ERROR) {
+            cmd->status = data->status;
+        }
+    } else if (cmd->copy && (data->opcode == IOTXN_OP_READ)) {
+        void* buffer;
+        data->ops->mmap(data, &buffer);
+        iotxn_t* txn = cmd->utxn->txn;
+        txn->ops->copyto(txn, buffer, data->actual, cmd->offset);
+    }
+    cmd->data_done = true;
+    if (cmd->status_done) {
+        ums_cmd_finish_locked(msd, cmd, &work);
+        ums_start_locked(msd, &work);
     }
+    mtx_unlock(&msd->mutex);
+
+    ums_work_finish(msd, &work);
 }
 
-static mx_status_t ums_queue_read(ums_t* msd, uint16_t transfer_length) {
-    // read request sense response
-    list_node_t* read_node = list_remove_head(&msd->free_read_reqs);
-    if (!read_node) {
-        DEBUG_PRINT(("UMS:error, no read reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
+// sets up the data stage of a command, moving length bytes at cmd->offset
+static mx_status_t ums_data_init(ums_t* msd, ums_cmd_t* cmd, uint32_t length) {
+    iotxn_t* txn = cmd->utxn->txn;
+    iotxn_t* data;
+    mx_status_t status;
+    if (length == txn->length) {
+        // the device moves the data in place
+        status = txn->ops->clone(txn, &data, 0);
+    } else {
+        // a part of an iotxn cannot be cloned, so is copied
+        status = iotxn_alloc(&data, 0, length, 0);
+        if (status == NO_ERROR) {
+            data->opcode = txn->opcode;
+            data->length = length;
+            cmd->copy = true;
+            if (txn->opcode == IOTXN_OP_WRITE) {
+                void* buffer;
+                data->ops->mmap(data, &buffer);
+                txn->ops->copyfrom(txn, buffer, length, cmd->offset);
+            }
+        }
+    }
+    if (status != NO_ERROR) {
+        return status;
     }
-    iotxn_t* read_request = containerof(read_node, iotxn_t, node);
-    read_request->length = transfer_length;
-    ums_queue_request(msd, read_request);
+
+    data->protocol = MX_PROTOCOL_USB;
+    usb_protocol_data_t* pdata = iotxn_pdata(data, usb_protocol_data_t);
+    memset(pdata, 0, sizeof(*pdata));
+    pdata->ep_address = (txn->opcode == IOTXN_OP_READ) ? msd->data_in_addr : msd->data_out_addr;
+    data->complete_cb = ums_data_complete;
+    data->cookie = cmd;
+    cmd->data = data;
     return NO_ERROR;
 }
 
-static mx_status_t ums_queue_write(ums_t* msd, uint16_t transfer_length, iotxn_t* txn) {
-    list_node_t* write_node = list_remove_head(&msd->free_write_reqs);
-    if (!write_node) {
-        DEBUG_PRINT(("UMS:error, no write reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
+// builds the CDB to read or write blocks at lba, returning its length
+static uint8_t ums_rw_cdb(ums_t* msd, bool read, uint64_t lba, uint32_t blocks, uint8_t* cdb) {
+    if (msd->use_read_write_16) {
+        cdb[0] = read ? UMS_READ16 : UMS_WRITE16;
+        write64be(cdb + 2, lba);
+        write32be(cdb + 10, blocks);
+        return UMS_READ16_COMMAND_LENGTH;
+    } else if (blocks <= UINT16_MAX) {
+        cdb[0] = read ? UMS_READ10 : UMS_WRITE10;
+        write32be(cdb + 2, lba);
+        write16be(cdb + 7, blocks);
+        return UMS_READ10_COMMAND_LENGTH;
+    } else {
+        cdb[0] = read ? UMS_READ12 : UMS_WRITE12;
+        write32be(cdb + 2, lba);
+        write32be(cdb + 6, blocks);
+        return UMS_READ12_COMMAND_LENGTH;
     }
-    iotxn_t* write_request = containerof(write_node, iotxn_t, node);
-    write_request->length = transfer_length;
-    void* buffer;
-    write_request->ops->mmap(write_request, &buffer);
-    txn->ops->copyfrom(txn, buffer, (size_t)transfer_length, 0);
-    ums_queue_request(msd, write_request);
-    return NO_ERROR;
 }
 
-static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
+static csw_status_t ums_verify_csw(ums_cmd_t* cmd, iotxn_t* csw_request) {
     uint8_t buffer[UMS_COMMAND_STATUS_WRAPPER_SIZE];
     csw_request->ops->copyfrom(csw_request, buffer, sizeof(buffer), 0);
 
@@ -254,9 +344,9 @@ static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
         DEBUG_PRINT(("UMS:invalid csw sig, expected:%08x got:%08x \n", CSW_SIGNATURE, letoh32(ptr_32[0])));
         return CSW_INVALID;
     }
-    // check if tag matches the tag of last CBW
-    if (letoh32(ptr_32[1]) != msd->tag_receive++) {
-        DEBUG_PRINT(("UMS:csw tag mismatch, expected:%08x got in csw:%08x \n", msd->tag_receive - 1, letoh32(ptr_32[1])));
+    // check if tag matches the tag of the CBW
+    if (letoh32(ptr_32[1]) != cmd->tag) {
+        DEBUG_PRINT(("UMS:csw tag mismatch, expected:%08x got in csw:%08x \n", cmd->tag, letoh32(ptr_32[1])));
         return CSW_TAG_MISMATCH;
     }
     // check if success is true or not?
@@ -269,224 +359,322 @@ static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
     return CSW_SUCCESS;
 }
 
-static void ums_read_complete(iotxn_t* txn, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
-    list_add_tail(&msd->completed_reads, &txn->node);
+static void bot_csw_complete(iotxn_t* csw_request, void* cookie) {
+    ums_cmd_t* cmd = cookie;
+    ums_t* msd = cmd->msd;
+    ums_work_t work;
+    ums_work_init(&work);
+
+    mtx_lock(&msd->mutex);
+    csw_status_t csw_error = CSW_INVALID;
+    if (csw_request->status == NO_ERROR) {
+        csw_error = ums_verify_csw(cmd, csw_request);
+    }
+    if (csw_error == CSW_FAILED) {
+        cmd->status = ERR_BAD_STATE;
+    } else if (csw_error != CSW_SUCCESS) {
+        // print error and then reset device due to it
+        DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
+        cmd->status = ERR_INTERNAL;
+        work.reset = true;
+    }
+    cmd->status_done = true;
+    if (cmd->data_done) {
+        ums_cmd_finish_locked(msd, cmd, &work);
+        ums_start_locked(msd, &work);
+    }
+    mtx_unlock(&msd->mutex);
+
+    ums_work_finish(msd, &work);
 }
 
-static iotxn_t* pop_completed_read(ums_t* msd) {
-    list_node_t* node = list_remove_head(&msd->completed_reads);
-    if (!node) {
-        printf("msd->completed_reads empty in pop_completed_read\n");
-        return NULL;
+static void bot_send_command_locked(ums_t* msd, ums_cmd_t* cmd, uint8_t* cdb,
+                                    uint8_t cdb_length, uint32_t length, ums_work_t* work) {
+    iotxn_t* txn = cmd->cmd_req;
+    cmd->tag = msd->tag++;
+
+    // first three blocks are 4 byte
+    uint32_t buf_32[3];
+    buf_32[0] = htole32(CBW_SIGNATURE);
+    buf_32[1] = htole32(cmd->tag);
+    buf_32[2] = htole32(length);
+    txn->ops->copyto(txn, buf_32, sizeof(buf_32), 0);
+
+    // get a 3 x 1 byte buffer and start at 12 because of uint32's
+    uint8_t buf_8[3];
+    buf_8[0] = (cmd->utxn->txn->opcode == IOTXN_OP_READ) ? USB_DIR_IN : USB_DIR_OUT;
+    buf_8[1] = msd->lun;
+    buf_8[2] = cdb_length;
+    txn->ops->copyto(txn, buf_8, sizeof(buf_8), sizeof(buf_32));
+
+    // the rest of the CBW is the CDB, zero padded
+    txn->ops->copyto(txn, cdb, 16, sizeof(buf_32) + sizeof(buf_8));
+
+    list_add_tail(&work->reqs, &txn->node);
+    if (cmd->data) {
+        cmd->data_queued = true;
+        list_add_tail(&work->reqs, &cmd->data->node);
     }
-    return containerof(node, iotxn_t, node);
+    list_add_tail(&work->reqs, &cmd->csw_req->node);
 }
 
-static void ums_csw_complete(iotxn_t* csw_request, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
+// reports the status of a UAS command
+static void uas_cmd_status_locked(ums_t* msd, ums_cmd_t* cmd, mx_status_t status,
+                                  ums_work_t* work) {
+    if (cmd->status == NO_ERROR) {
+        cmd->status = status;
+    }
+    cmd->status_done = true;
+    // a device that fails a command may never have asked for its data
+    if (!cmd->data_queued) {
+        cmd->data_done = true;
+    }
+    if (cmd->data_done) {
+        ums_cmd_finish_locked(msd, cmd, work);
+    }
+}
 
-    // TODO: handle error case for CSW by setting iotxn to error and returning
-    iotxn_t* curr_txn = list_remove_head_type(&msd->queued_iotxns, iotxn_t, node);
+static void uas_status_complete(iotxn_t* req, void* cookie) {
+    ums_t* msd = cookie;
+    ums_work_t work;
+    ums_work_init(&work);
 
-    // unblock calls to IOCTL_DEVICE_SYNC that are waiting for curr_txn to complete
     mtx_lock(&msd->mutex);
-    ums_sync_node_t* sync_node;
-    list_for_every_entry(&msd->sync_nodes, sync_node, ums_sync_node_t, node) {
-        if (sync_node->iotxn == curr_txn) {
-            list_delete(&sync_node->node);
-            completion_signal(&sync_node->completion);
+    if (req->status != NO_ERROR) {
+        // there is no telling which command this was for, or that the
+        // others will hear how they went
+        printf("UMS: UAS status read failed: %d\n", req->status);
+        list_add_tail(&msd->free_status_reqs, &req->node);
+        for (uint32_t i = 0; i < msd->cmd_count; i++) {
+            ums_cmd_t* cmd = &msd->cmds[i];
+            if (cmd->utxn && !cmd->status_done) {
+                uas_cmd_status_locked(msd, cmd, req->status, &work);
+            }
         }
+        goto out;
     }
-    mtx_unlock(&msd->mutex);
 
-    csw_status_t csw_error = ums_verify_csw(msd, csw_request);
-    if (csw_error) {
-        // print error and then reset device due to it
-        DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
-        if (csw_error != CSW_FAILED) {
-            ums_reset(msd);
+    uint8_t iu[8];
+    memset(iu, 0, sizeof(iu));
+    req->ops->copyfrom(req, iu, MIN(sizeof(iu), req->actual), 0);
+    uint16_t tag = read16be(iu + UAS_IU_TAG);
+    ums_cmd_t* cmd = NULL;
+    if ((tag >= 1) && (tag <= msd->cmd_count) && msd->cmds[tag - 1].utxn) {
+        cmd = &msd->cmds[tag - 1];
+    }
+    if (!cmd) {
+        DEBUG_PRINT(("UMS: UAS IU %02x for unknown tag %u\n", iu[0], tag));
+        list_add_tail(&work.reqs, &req->node);
+        goto out;
+    }
+
+    switch (iu[0]) {
+    case UAS_IU_READ_READY:
+    case UAS_IU_WRITE_READY:
+        if (cmd->data && !cmd->data_queued) {
+            cmd->data_queued = true;
+            list_add_tail(&work.reqs, &cmd->data->node);
         }
-        list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-        curr_txn->ops->complete(curr_txn, ERR_BAD_STATE, 0);
-        return;
+        // the sense IU is yet to come
+        list_add_tail(&work.reqs, &req->node);
+        break;
+    case UAS_IU_SENSE:
+        list_add_tail(&msd->free_status_reqs, &req->node);
+        uas_cmd_status_locked(msd, cmd, (iu[UAS_SENSE_IU_STATUS] == SCSI_STATUS_GOOD) ?
+                              NO_ERROR : ERR_BAD_STATE, &work);
+        break;
+    case UAS_IU_RESPONSE:
+        DEBUG_PRINT(("UMS: UAS response %02x for tag %u\n", iu[UAS_RESPONSE_IU_CODE], tag));
+        list_add_tail(&msd->free_status_reqs, &req->node);
+        uas_cmd_status_locked(msd, cmd, ERR_IO, &work);
+        break;
+    default:
+        DEBUG_PRINT(("UMS: unexpected UAS IU %02x\n", iu[0]));
+        list_add_tail(&work.reqs, &req->node);
+        break;
+    }
+
+out:
+    ums_start_locked(msd, &work);
+    mtx_unlock(&msd->mutex);
+    ums_work_finish(msd, &work);
+}
+
+static void uas_send_command_locked(ums_t* msd, ums_cmd_t* cmd, uint8_t* cdb,
+                                    uint8_t cdb_length, ums_work_t* work) {
+    // the LUN is zero, as is the task attribute: a simple task
+    uint8_t iu[UAS_COMMAND_IU_SIZE];
+    memset(iu, 0, sizeof(iu));
+    iu[0] = UAS_IU_COMMAND;
+    write16be(iu + UAS_IU_TAG, cmd->tag);
+    memcpy(iu + UAS_COMMAND_IU_CDB, cdb, 16);
+    iotxn_t* txn = cmd->cmd_req;
+    txn->ops->copyto(txn, iu, sizeof(iu), 0);
+
+    iotxn_t* status_req = list_remove_head_type(&msd->free_status_reqs, iotxn_t, node);
+    list_add_tail(&work->reqs, &status_req->node);
+    list_add_tail(&work->reqs, &txn->node);
+}
+
+static void ums_start_cmd_locked(ums_t* msd, ums_cmd_t* cmd, ums_txn_t* utxn,
+                                 ums_work_t* work) {
+    iotxn_t* txn = utxn->txn;
+    uint32_t length = MIN(txn->length - utxn->issued, msd->max_transfer);
+    cmd->utxn = utxn;
+    cmd->offset = utxn->issued;
+    cmd->data = NULL;
+    cmd->copy = false;
+    cmd->data_queued = false;
+    cmd->data_done = (length == 0);
+    cmd->status_done = false;
+    cmd->status = NO_ERROR;
+    utxn->issued += length;
+    utxn->unissued--;
+    utxn->pending++;
+
+    uint8_t cdb[16];
+    uint8_t cdb_length;
+    memset(cdb, 0, sizeof(cdb));
+    if (utxn->cdb_length) {
+        memcpy(cdb, utxn->cdb, utxn->cdb_length);
+        cdb_length = utxn->cdb_length;
+    } else {
+        cdb_length = ums_rw_cdb(msd, txn->opcode == IOTXN_OP_READ,
+                                (txn->offset + cmd->offset) / msd->block_size,
+                                length / msd->block_size, cdb);
     }
-    // if head of iotxn list is a read iotxn and CSW reports success, then set its buffer to that
-    // of the latest read request, with limited length based on data residue field in CSW
-    if (curr_txn->opcode == IOTXN_OP_READ) {
-        iotxn_t* read_request = pop_completed_read(msd);
-        if (!read_request) {
-            list_add_tail(&msd->free_csw_reqs, &csw_request->node);
+
+    if (length > 0) {
+        mx_status_t status = ums_data_init(msd, cmd, length);
+        if (status != NO_ERROR) {
+            cmd->status = status;
+            cmd->data_done = cmd->status_done = true;
+            ums_cmd_finish_locked(msd, cmd, work);
             return;
         }
-        // data residue field is the 3rd uint32_t in csw buffer
-        uint32_t temp;
-        csw_request->ops->copyfrom(csw_request, &temp, sizeof(temp), 2 * sizeof(temp));
-        uint32_t residue = letoh32(temp);
-        uint32_t length = read_request->actual - residue;
-        void* buffer;
-        curr_txn->ops->mmap(curr_txn, &buffer);
-        read_request->ops->copyfrom(read_request, buffer, length, 0);
-        list_add_tail(&msd->free_read_reqs, &read_request->node);
     }
+    if (msd->uas) {
+        uas_send_command_locked(msd, cmd, cdb, cdb_length, work);
+    } else {
+        bot_send_command_locked(msd, cmd, cdb, cdb_length, length, work);
+    }
+}
 
-    list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-    curr_txn->ops->complete(curr_txn, NO_ERROR, curr_txn->length);
+// starts commands for queued iotxns in order, as far as there are free ones
+static void ums_start_locked(ums_t* msd, ums_work_t* work) {
+    ums_txn_t* utxn;
+    ums_txn_t* temp;
+    list_for_every_entry_safe(&msd->queued_txns, utxn, temp, ums_txn_t, node) {
+        while (utxn->unissued > 0) {
+            ums_cmd_t* cmd = list_remove_head_type(&msd->free_cmds, ums_cmd_t, node);
+            if (!cmd) {
+                return;
+            }
+            ums_start_cmd_locked(msd, cmd, utxn, work);
+        }
+    }
 }
 
-static void ums_write_complete(iotxn_t* txn, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
-    // FIXME what to do with error here?
-    list_add_tail(&msd->free_write_reqs, &txn->node);
+static void ums_queue_txn(ums_t* msd, iotxn_t* txn, ums_txn_t* utxn) {
+    utxn->txn = txn;
+    utxn->status = NO_ERROR;
+    if (utxn->cdb_length) {
+        utxn->unissued = 1;
+    } else {
+        utxn->unissued = (txn->length + msd->max_transfer - 1) / msd->max_transfer;
+    }
+
+    ums_work_t work;
+    ums_work_init(&work);
+    mtx_lock(&msd->mutex);
+    utxn->seq = msd->next_seq++;
+    list_add_tail(&msd->queued_txns, &utxn->node);
+    ums_start_locked(msd, &work);
+    mtx_unlock(&msd->mutex);
+    ums_work_finish(msd, &work);
 }
 
-static mx_status_t ums_inquiry(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
+static void ums_command_complete(iotxn_t* txn, void* cookie) {
+    completion_signal((completion_t*)cookie);
+}
 
-    // CBW Configuration
-    uint8_t command[UMS_INQUIRY_COMMAND_LENGTH];
-    memset(command, 0, UMS_INQUIRY_COMMAND_LENGTH);
-    // set command type
-    command[0] = UMS_INQUIRY;
-    // set allocated length in scsi command
-    command[4] = UMS_INQUIRY_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, UMS_INQUIRY_TRANSFER_LENGTH, USB_DIR_IN,
-                          UMS_INQUIRY_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
+// issues a command of the driver's own, with length bytes of data moving
+// in to data, or out of it
+static mx_status_t ums_command(ums_t* msd, uint8_t* cdb, uint8_t cdb_length, bool in,
+                               void* data, size_t length) {
+    ums_txn_t* utxn = calloc(1, sizeof(ums_txn_t));
+    if (!utxn) {
+        return ERR_NO_MEMORY;
     }
-
-    // read inquiry response
-    status = ums_queue_read(msd, UMS_INQUIRY_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
+    iotxn_t* txn;
+    mx_status_t status = iotxn_alloc(&txn, 0, length, 0);
+    if (status != NO_ERROR) {
+        free(utxn);
         return status;
     }
+    txn->opcode = in ? IOTXN_OP_READ : IOTXN_OP_WRITE;
+    txn->length = length;
+    if (!in) {
+        txn->ops->copyto(txn, data, length, 0);
+    }
+    completion_t completion = COMPLETION_INIT;
+    txn->complete_cb = ums_command_complete;
+    txn->cookie = &completion;
+    memcpy(utxn->cdb, cdb, cdb_length);
+    utxn->cdb_length = cdb_length;
 
-    // wait for CSW
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_INQUIRY_TRANSFER_LENGTH, 0);
+    ums_queue_txn(msd, txn, utxn);
+    completion_wait(&completion, MX_TIME_INFINITE);
+
+    status = txn->status;
+    if ((status == NO_ERROR) && in) {
+        txn->ops->copyfrom(txn, data, length, 0);
     }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
+    txn->ops->release(txn);
     return status;
 }
 
-static mx_status_t ums_test_unit_ready(ums_t* msd) {
-    mx_status_t status = NO_ERROR;
+static mx_status_t ums_inquiry(ums_t* msd, uint8_t* out_data) {
+    uint8_t command[UMS_INQUIRY_COMMAND_LENGTH];
+    memset(command, 0, UMS_INQUIRY_COMMAND_LENGTH);
+    // set command type
+    command[0] = UMS_INQUIRY;
+    // set allocated length in scsi command
+    command[4] = UMS_INQUIRY_TRANSFER_LENGTH;
+    return ums_command(msd, command, UMS_INQUIRY_COMMAND_LENGTH, true, out_data,
+                       UMS_INQUIRY_TRANSFER_LENGTH);
+}
 
-    // CBW Configuration
+static mx_status_t ums_test_unit_ready(ums_t* msd) {
     uint8_t command[UMS_TEST_UNIT_READY_COMMAND_LENGTH];
     memset(command, 0, UMS_TEST_UNIT_READY_COMMAND_LENGTH);
     // set command type
     command[0] = (char)UMS_TEST_UNIT_READY;
-    status = ums_send_cbw(msd, UMS_NO_TRANSFER_LENGTH, USB_DIR_IN,
-                          UMS_TEST_UNIT_READY_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    return ums_read_csw(msd);
+    return ums_command(msd, command, UMS_TEST_UNIT_READY_COMMAND_LENGTH, true, NULL,
+                       UMS_NO_TRANSFER_LENGTH);
 }
 
 static mx_status_t ums_request_sense(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
-    // CBW Configuration
     uint8_t command[UMS_REQUEST_SENSE_COMMAND_LENGTH];
     memset(command, 0, UMS_REQUEST_SENSE_COMMAND_LENGTH);
     // set command type
     command[0] = UMS_REQUEST_SENSE;
     // set allocated length in scsi command
     command[4] = UMS_REQUEST_SENSE_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, UMS_REQUEST_SENSE_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_REQUEST_SENSE_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, UMS_REQUEST_SENSE_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_REQUEST_SENSE_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
-}
-
-static mx_status_t ums_read_format_capacities(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
-    // CBW Configuration
-    uint8_t command[UMS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH];
-    memset(command, 0, UMS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH);
-    // set command type
-    command[0] = UMS_READ_FORMAT_CAPACITIES;
-    // set allocated length in scsi command
-    command[8] = UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // wait for CSW
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
+    return ums_command(msd, command, UMS_REQUEST_SENSE_COMMAND_LENGTH, true, out_data,
+                       UMS_REQUEST_SENSE_TRANSFER_LENGTH);
 }
 
 static mx_status_t ums_read_capacity10(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
-    // CBW Configuration
     uint8_t command[UMS_READ_CAPACITY10_COMMAND_LENGTH];
     memset(command, 0, UMS_READ_CAPACITY10_COMMAND_LENGTH);
     // set command type
     command[0] = UMS_READ_CAPACITY10;
-    status = ums_send_cbw(msd, UMS_READ_CAPACITY10_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_READ_CAPACITY10_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read capacity10 response
-    status = ums_queue_read(msd, UMS_READ_CAPACITY10_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_READ_CAPACITY10_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
+    return ums_command(msd, command, UMS_READ_CAPACITY10_COMMAND_LENGTH, true, out_data,
+                       UMS_READ_CAPACITY10_TRANSFER_LENGTH);
 }
 
 static mx_status_t ums_read_capacity16(ums_t* msd, uint8_t* out_data) {
-    mx_status_t status = NO_ERROR;
-
-    // CBW Configuration
     uint8_t command[UMS_READ_CAPACITY16_COMMAND_LENGTH];
     memset(command, 0, UMS_READ_CAPACITY16_COMMAND_LENGTH);
     // set command type
@@ -494,177 +682,8 @@ static mx_status_t ums_read_capacity16(ums_t* msd, uint8_t* out_data) {
     // service action = 10, not sure what that means
     command[1] = 0x10;
     command[13] = UMS_READ_CAPACITY16_TRANSFER_LENGTH;  // LSB of allocation length
-    status = ums_send_cbw(msd, UMS_READ_CAPACITY16_TRANSFER_LENGTH, USB_DIR_IN,
-                            UMS_READ_CAPACITY16_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // read capacity16 response
-    status = ums_queue_read(msd, UMS_READ_CAPACITY16_TRANSFER_LENGTH);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    status = ums_read_csw(msd);
-    iotxn_t* read_request = pop_completed_read(msd);
-    if (status == NO_ERROR) {
-        read_request->ops->copyfrom(read_request, out_data, UMS_READ_CAPACITY16_TRANSFER_LENGTH, 0);
-    }
-    list_add_tail(&msd->free_read_reqs, &read_request->node);
-    return status;
-}
-
-static mx_status_t ums_read(mx_device_t* device, iotxn_t* txn) {
-    if (txn->length > UINT32_MAX) return ERR_INVALID_ARGS;
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-
-    uint64_t lba = txn->offset/msd->block_size;
-    uint32_t num_blocks = txn->length/msd->block_size;
-    uint32_t transfer_length = txn->length;
-
-    // CBW Configuration
-
-    if (msd->use_read_write_16) {
-        uint8_t command[UMS_READ16_COMMAND_LENGTH];
-        memset(command, 0, UMS_READ16_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ16;
-        // set lba
-        write64be(command + 2, lba);
-        // set transfer length in blocks
-        write32be(command + 10, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN,
-                                UMS_READ16_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    } else if (num_blocks <= UINT16_MAX) {
-        uint8_t command[UMS_READ10_COMMAND_LENGTH];
-        memset(command, 0, UMS_READ10_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ10;
-        // set lba
-        write32be(command + 2, lba);
-        // set transfer length in blocks
-        write16be(command + 7, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN, UMS_READ10_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    } else {
-        uint8_t command[UMS_READ12_COMMAND_LENGTH];
-        memset(command, 0, UMS_READ12_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ12;
-        // set lba
-        write32be(command + 2, lba);
-        // set transfer length in blocks
-        write32be(command + 6, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN,
-            UMS_READ12_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, transfer_length);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // receive CSW
-    return ums_queue_csw(msd);
-}
-
-static mx_status_t ums_write(mx_device_t* device, iotxn_t* txn) {
-    if (txn->length > UINT32_MAX) return ERR_INVALID_ARGS;
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-
-    uint64_t lba = txn->offset/msd->block_size;
-    uint32_t num_blocks = txn->length/msd->block_size;
-    uint32_t transfer_length = txn->length;
-
-    if (msd->use_read_write_16) {
-        uint8_t command[UMS_WRITE16_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE16_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE16;
-        // set lba
-        uint64_t* lba_ptr = (uint64_t*)&(command[2]);
-        *lba_ptr = htobe64(lba);
-        // set transfer length
-        uint32_t* transfer_len_ptr = (uint32_t*)&(command[10]);
-        *transfer_len_ptr = htobe32(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE16_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    } else if (num_blocks <= UINT16_MAX) {
-        uint8_t command[UMS_WRITE10_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE10_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE10;
-        // set lba
-        uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-        *lba_ptr = htobe32(lba);
-        // set transfer length in blocks
-        uint16_t* transfer_len_ptr = (uint16_t*)&(command[7]);
-        *transfer_len_ptr = htobe16(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE10_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    } else {
-        uint8_t command[UMS_WRITE12_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE12_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE12;
-        // set lba
-        uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-        *lba_ptr = htobe32(lba);
-        // set transfer length
-        uint32_t* transfer_len_ptr = (uint32_t*)&(command[6]);
-        *transfer_len_ptr = htobe32(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE12_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
-    }
-
-    //write response
-    status = ums_queue_write(msd, transfer_length, txn);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // receive CSW
-    return ums_queue_csw(msd);
-}
-
-static mx_status_t ums_toggle_removable(mx_device_t* device, bool removable) {
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-
-    // CBW Configuration
-    uint8_t command[UMS_TOGGLE_REMOVABLE_COMMAND_LENGTH];
-    memset(command, 0, UMS_TOGGLE_REMOVABLE_COMMAND_LENGTH);
-    // set command type
-    command[0] = UMS_TOGGLE_REMOVABLE;
-    status = ums_send_cbw(msd, UMS_NO_TRANSFER_LENGTH, USB_DIR_OUT,
-                            UMS_TOGGLE_REMOVABLE_COMMAND_LENGTH, command);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
-    }
-
-    // receive CSW
-    return ums_read_csw(msd);
+    return ums_command(msd, command, UMS_READ_CAPACITY16_COMMAND_LENGTH, true, out_data,
+                       UMS_READ_CAPACITY16_TRANSFER_LENGTH);
 }
 
 static void ums_unbind(mx_device_t* device) {
@@ -674,14 +693,17 @@ static void ums_unbind(mx_device_t* device) {
 
 static mx_status_t ums_release(mx_device_t* device) {
     ums_t* msd = get_ums(device);
-    iotxn_t* txn;
-    while ((txn = list_remove_head_type(&msd->free_csw_reqs, iotxn_t, node)) != NULL) {
-        txn->ops->release(txn);
-    }
-    while ((txn = list_remove_head_type(&msd->free_read_reqs, iotxn_t, node)) != NULL) {
-        txn->ops->release(txn);
+    for (uint32_t i = 0; i < countof(msd->cmds); i++) {
+        ums_cmd_t* cmd = &msd->cmds[i];
+        if (cmd->cmd_req) {
+            cmd->cmd_req->ops->release(cmd->cmd_req);
+        }
+        if (cmd->csw_req) {
+            cmd->csw_req->ops->release(cmd->csw_req);
+        }
     }
-    while ((txn = list_remove_head_type(&msd->free_write_reqs, iotxn_t, node)) != NULL) {
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&msd->free_status_reqs, iotxn_t, node)) != NULL) {
         txn->ops->release(txn);
     }
 
@@ -691,38 +713,36 @@ static mx_status_t ums_release(mx_device_t* device) {
 
 static void ums_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     ums_t* msd = get_ums(dev);
-    mtx_lock(&msd->mutex);
 
     uint32_t block_size = msd->block_size;
     // offset must be aligned to block size
     if (txn->offset % block_size) {
         DEBUG_PRINT(("UMS:offset on iotxn (%" PRIu64 ") not aligned to block size(%d)\n", txn->offset, block_size));
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
-        goto out;
+        return;
     }
 
     if (txn->length % block_size) {
         DEBUG_PRINT(("UMS:length on iotxn (%" PRIu64 ") not aligned to block size(%d)\n", txn->length, block_size));
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
-        goto out;
+        return;
     }
 
-    mx_status_t status;
-    if (txn->opcode == IOTXN_OP_READ) {
-        status = ums_read(dev, txn);
-    }else if (txn->opcode == IOTXN_OP_WRITE) {
-        status = ums_write(dev, txn);
-    } else {
-        status = ERR_INVALID_ARGS;
+    if ((txn->opcode != IOTXN_OP_READ) && (txn->opcode != IOTXN_OP_WRITE)) {
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
-    if (status == NO_ERROR) {
-        list_add_tail(&msd->queued_iotxns, &txn->node);
-    } else {
-        txn->ops->complete(txn, status, 0);
+    if (txn->length == 0) {
+        txn->ops->complete(txn, NO_ERROR, 0);
+        return;
     }
 
-out:
-    mtx_unlock(&msd->mutex);
+    ums_txn_t* utxn = calloc(1, sizeof(ums_txn_t));
+    if (!utxn) {
+        txn->ops->complete(txn, ERR_NO_MEMORY, 0);
+        return;
+    }
+    ums_queue_txn(msd, txn, utxn);
 }
 
 static ssize_t ums_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
@@ -745,12 +765,12 @@ static ssize_t ums_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
         ums_sync_node_t node;
 
         mtx_lock(&msd->mutex);
-        if (list_is_empty(&msd->queued_iotxns)) {
+        if (list_is_empty(&msd->queued_txns)) {
             mtx_unlock(&msd->mutex);
             return NO_ERROR;
         }
         // queue a stack allocated sync node on ums_t.sync_nodes
-        node.iotxn = list_peek_tail_type(&msd->queued_iotxns, iotxn_t, node);
+        node.seq = msd->next_seq;
         completion_reset(&node.completion);
         list_add_head(&msd->sync_nodes, &node.node);
         mtx_unlock(&msd->mutex);
@@ -833,6 +853,13 @@ static int ums_start_thread(void* arg) {
         msd->total_blocks = read64be((uint8_t*)&read_capacity16_data);
         msd->block_size = read32be((uint8_t*)&read_capacity16_data + 8);
     }
+    if (msd->block_size == 0) {
+        printf("ums: device has no block size\n");
+        status = ERR_NOT_SUPPORTED;
+        goto fail;
+    }
+    msd->max_transfer = MAX(UMS_MAX_TRANSFER - UMS_MAX_TRANSFER % msd->block_size,
+                            msd->block_size);
 
     // Need to use READ16/WRITE16 if block addresses are greater than 32 bit
     msd->use_read_write_16 = msd->total_blocks > UINT32_MAX;
@@ -850,6 +877,40 @@ fail:
     return status;
 }
 
+// finds an alternate setting for UAS, and its pipes by pipe ID
+static usb_interface_descriptor_t* ums_find_uas(usb_desc_iter_t* iter, uint8_t* pipes) {
+    usb_interface_descriptor_t* uas_intf = NULL;
+    uint8_t ep_addr = 0;
+    usb_descriptor_header_t* header;
+    while ((header = usb_desc_iter_next(iter)) != NULL) {
+        if (header->bDescriptorType == USB_DT_INTERFACE) {
+            if (uas_intf && pipes[UAS_PIPE_COMMAND] && pipes[UAS_PIPE_STATUS] &&
+                pipes[UAS_PIPE_DATA_IN] && pipes[UAS_PIPE_DATA_OUT]) {
+                return uas_intf;
+            }
+            usb_interface_descriptor_t* intf = (usb_interface_descriptor_t*)header;
+            uas_intf = (intf->bInterfaceClass == USB_CLASS_MSC &&
+                        intf->bInterfaceProtocol == UMS_PROTOCOL_UAS) ? intf : NULL;
+            memset(pipes, 0, UAS_PIPE_DATA_OUT + 1);
+            ep_addr = 0;
+        } else if (uas_intf && header->bDescriptorType == USB_DT_ENDPOINT) {
+            usb_endpoint_descriptor_t* endp = (usb_endpoint_descriptor_t*)header;
+            ep_addr = (usb_ep_type(endp) == USB_ENDPOINT_BULK) ? endp->bEndpointAddress : 0;
+        } else if (uas_intf && ep_addr && header->bDescriptorType == UAS_DT_PIPE_USAGE) {
+            uas_pipe_usage_descriptor_t* usage = (uas_pipe_usage_descriptor_t*)header;
+            if (usage->bPipeID >= UAS_PIPE_COMMAND && usage->bPipeID <= UAS_PIPE_DATA_OUT) {
+                pipes[usage->bPipeID] = ep_addr;
+            }
+            ep_addr = 0;
+        }
+    }
+    if (uas_intf && pipes[UAS_PIPE_COMMAND] && pipes[UAS_PIPE_STATUS] &&
+        pipes[UAS_PIPE_DATA_IN] && pipes[UAS_PIPE_DATA_OUT]) {
+        return uas_intf;
+    }
+    return NULL;
+}
+
 static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
     // find our endpoints
     usb_desc_iter_t iter;
@@ -885,9 +946,28 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
         }
         endp = usb_desc_iter_next_endpoint(&iter);
     }
+
+    // UAS at SuperSpeed needs bulk streams
+    uint8_t pipes[UAS_PIPE_DATA_OUT + 1];
+    usb_interface_descriptor_t* uas_intf = NULL;
+    if (usb_get_speed(device) != USB_SPEED_SUPER) {
+        usb_desc_iter_reset(&iter);
+        uas_intf = ums_find_uas(&iter, pipes);
+    }
+    bool uas = false;
+    if (uas_intf) {
+        mx_status_t status = usb_set_interface(device, uas_intf->bInterfaceNumber,
+                                               uas_intf->bAlternateSetting);
+        if (status == NO_ERROR) {
+            uas = true;
+        } else {
+            printf("UMS: cannot select UAS alternate setting, using Bulk-Only Transport: %d\n",
+                   status);
+        }
+    }
     usb_desc_iter_release(&iter);
 
-    if (!bulk_in_addr || !bulk_out_addr) {
+    if (!uas && (!bulk_in_addr || !bulk_out_addr)) {
         DEBUG_PRINT(("UMS:ums_bind could not find endpoints\n"));
         return ERR_NOT_SUPPORTED;
     }
@@ -898,55 +978,71 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
         return ERR_NO_MEMORY;
     }
 
-    list_initialize(&msd->free_read_reqs);
-    list_initialize(&msd->free_csw_reqs);
-    list_initialize(&msd->free_write_reqs);
-    list_initialize(&msd->queued_iotxns);
-    list_initialize(&msd->completed_reads);
-    list_initialize(&msd->completed_csws);
+    list_initialize(&msd->free_cmds);
+    list_initialize(&msd->free_status_reqs);
+    list_initialize(&msd->queued_txns);
     list_initialize(&msd->sync_nodes);
 
     msd->udev = device;
     msd->driver = driver;
-    msd->bulk_in_addr = bulk_in_addr;
-    msd->bulk_out_addr = bulk_out_addr;
+    msd->uas = uas;
+    if (uas) {
+        msd->cmd_addr = pipes[UAS_PIPE_COMMAND];
+        msd->status_addr = pipes[UAS_PIPE_STATUS];
+        msd->data_in_addr = pipes[UAS_PIPE_DATA_IN];
+        msd->data_out_addr = pipes[UAS_PIPE_DATA_OUT];
+        msd->cmd_count = UAS_MAX_COMMANDS;
+    } else {
+        msd->cmd_addr = bulk_out_addr;
+        msd->status_addr = bulk_in_addr;
+        msd->data_in_addr = bulk_in_addr;
+        msd->data_out_addr = bulk_out_addr;
+        msd->cmd_count = BOT_MAX_COMMANDS;
+    }
+    // until the block size is known, for the driver's own commands
+    msd->max_transfer = UMS_MAX_TRANSFER;
 
     mx_status_t status = NO_ERROR;
-    for (int i = 0; i < READ_REQ_COUNT; i++) {
-        iotxn_t* txn = usb_alloc_iotxn(bulk_in_addr, USB_BUF_SIZE, 0);
-        if (!txn) {
+    for (uint32_t i = 0; i < msd->cmd_count; i++) {
+        ums_cmd_t* cmd = &msd->cmds[i];
+        cmd->msd = msd;
+        cmd->tag = i + 1;
+        size_t cmd_size = uas ? UAS_COMMAND_IU_SIZE : UMS_COMMAND_BLOCK_WRAPPER_SIZE;
+        cmd->cmd_req = usb_alloc_iotxn(msd->cmd_addr, cmd_size, 0);
+        if (!cmd->cmd_req) {
             status = ERR_NO_MEMORY;
             goto fail;
         }
-        txn->complete_cb = ums_read_complete;
-        txn->cookie = msd;
-        list_add_head(&msd->free_read_reqs, &txn->node);
-    }
-    for (int i = 0; i < READ_REQ_COUNT; i++) {
-        iotxn_t* txn = usb_alloc_iotxn(bulk_in_addr, UMS_COMMAND_STATUS_WRAPPER_SIZE, 0);
+        cmd->cmd_req->length = cmd_size;
+        // FIXME what to do with error here?
+        cmd->cmd_req->complete_cb = NULL;
+
+        iotxn_t* txn = usb_alloc_iotxn(msd->status_addr, uas ? UAS_STATUS_BUF_SIZE :
+                                       UMS_COMMAND_STATUS_WRAPPER_SIZE, 0);
         if (!txn) {
             status = ERR_NO_MEMORY;
             goto fail;
         }
-        txn->length = UMS_COMMAND_STATUS_WRAPPER_SIZE;
-        // complete_cb and cookie are set later
-        list_add_head(&msd->free_csw_reqs, &txn->node);
-    }
-    for (int i = 0; i < WRITE_REQ_COUNT; i++) {
-        iotxn_t* txn = usb_alloc_iotxn(bulk_out_addr, USB_BUF_SIZE, 0);
-        if (!txn) {
-            status = ERR_NO_MEMORY;
-            goto fail;
+        if (uas) {
+            txn->length = UAS_STATUS_BUF_SIZE;
+            txn->complete_cb = uas_status_complete;
+            txn->cookie = msd;
+            list_add_tail(&msd->free_status_reqs, &txn->node);
+        } else {
+            txn->length = UMS_COMMAND_STATUS_WRAPPER_SIZE;
+            txn->complete_cb = bot_csw_complete;
+            txn->cookie = cmd;
+            cmd->csw_req = txn;
         }
-        txn->complete_cb = ums_write_complete;
-        txn->cookie = msd;
-        list_add_head(&msd->free_write_reqs, &txn->node);
+        list_add_tail(&msd->free_cmds, &cmd->node);
     }
 
-    uint8_t lun = 0;
-    ums_get_max_lun(msd, (void*)&lun);
-    DEBUG_PRINT(("UMS:Max lun is: %02x\n", (unsigned char)lun));
-    msd->tag_send = msd->tag_receive = 8;
+    if (!uas) {
+        uint8_t lun = 0;
+        ums_get_max_lun(msd, (void*)&lun);
+        DEBUG_PRINT(("UMS:Max lun is: %02x\n", (unsigned char)lun));
+    }
+    msd->tag = 8;
     // TODO: get this lun from some sort of valid way. not sure how multilun support works
     msd->lun = 0;
     thrd_t thread;
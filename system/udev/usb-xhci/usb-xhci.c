@@ -28,6 +28,9 @@
 
 #define MAX_SLOTS 255
 
+// most runs of memory one transfer's data is gathered from
+#define XHCI_SG_MAX 32
+
 typedef struct usb_xhci {
     xhci_t xhci;
     // the device we implement
@@ -225,8 +228,16 @@ static mx_status_t xhci_do_iotxn_queue(xhci_t* xhci, iotxn_t* txn) {
     if (ep_index >= XHCI_NUM_EPS) {
          return ERR_INVALID_ARGS;
     }
-    mx_paddr_t phys_addr;
-    txn->ops->physmap(txn, &phys_addr);
+    iotxn_sg_t sg[XHCI_SG_MAX];
+    uint32_t nsg;
+    if (txn->ops->physmap_sg(txn, sg, countof(sg), &nsg) != NO_ERROR) {
+        mx_status_t status = txn->ops->physmap(txn, &sg[0].paddr);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        sg[0].length = txn->length;
+        nsg = 1;
+    }
 
     xhci_transfer_context_t* context = malloc(sizeof(xhci_transfer_context_t));
     if (!context) {
@@ -243,7 +254,7 @@ static mx_status_t xhci_do_iotxn_queue(xhci_t* xhci, iotxn_t* txn) {
     } else {
         direction = data->ep_address & USB_ENDPOINT_DIR_MASK;
     }
-    return xhci_queue_transfer(xhci, data->device_id, setup, phys_addr, txn->length,
+    return xhci_queue_transfer(xhci, data->device_id, setup, sg, nsg, txn->length,
                                  ep_index, direction, data->frame, context, &txn->node);
 }
 
@@ -271,12 +282,15 @@ void xhci_process_deferred_txns(xhci_t* xhci, xhci_transfer_ring_t* ring, bool c
 
     // requeue all deferred transactions
     // this will either add them to the transfer ring or put them back on deferred_txns list
+    // the endpoint's doorbell is rung once for all of them
+    xhci_defer_doorbells(xhci);
     while ((txn = list_remove_head_type(&list, iotxn_t, node)) != NULL) {
         mx_status_t status = xhci_do_iotxn_queue(xhci, txn);
         if (status != NO_ERROR && status != ERR_BUFFER_TOO_SMALL) {
             txn->ops->complete(txn, status, 0);
         }
     }
+    xhci_ring_deferred_doorbells(xhci);
 }
 
 static void xhci_iotxn_queue(mx_device_t* hci_device, iotxn_t* txn) {
@@ -183,7 +183,9 @@ typedef volatile struct {
 #define HCSPARAMS1_MAX_PORTS_BITS   8
 
 // HCSPARAMS2 register bits
+#define HCSPARAMS2_IST_START            0
 #define HCSPARAMS2_IST_BITS             4
+#define HCSPARAMS2_IST_FRAMES           (1 << 3)    // IST is in frames, not microframes
 #define HCSPARAMS2_ERST_MAX_START       4
 #define HCSPARAMS2_ERST_MAX_BITS        4
 #define HCSPARAMS2_MAX_SBBUF_HI_START   21
@@ -270,6 +272,8 @@ typedef volatile struct {
 // Interruptor register bits
 #define IMAN_IP         (1 << 0)    // Interrupt Pending
 #define IMAN_IE         (1 << 1)    // Interrupt Enable
+#define IMODI_START     0           // Interrupt Moderation Interval, in 250ns
+#define IMODI_BITS      16
 #define ERSTSZ_MASK     0x0000FFFF
 #define ERDP_DESI_START 0           // First bit of Dequeue ERST Segment Index
 #define ERDP_DESI_BITS  2           // Bit length of Dequeue ERST Segment Index
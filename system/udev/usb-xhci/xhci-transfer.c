@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <inttypes.h>
 #include <magenta/hw/usb.h>
 #include <stdio.h>
 #include <threads.h>
@@ -65,10 +66,11 @@ static mx_status_t xhci_reset_endpoint(xhci_t* xhci, uint32_t slot_id, uint32_t
     return (cc == TRB_CC_SUCCESS ? NO_ERROR : ERR_INTERNAL);
 }
 
-mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* setup, mx_paddr_t data,
-                        uint16_t length, int endpoint, int direction, uint64_t frame,
+mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* setup,
+                        const iotxn_sg_t* sg, uint32_t sg_count,
+                        size_t length, int endpoint, int direction, uint64_t frame,
                         xhci_transfer_context_t* context, list_node_t* txn_node) {
-    xprintf("xhci_queue_transfer slot_id: %d setup: %p endpoint: %d length: %d\n",
+    xprintf("xhci_queue_transfer slot_id: %d setup: %p endpoint: %d length: %zu\n",
             slot_id, setup, endpoint, length);
 
     if ((setup && endpoint != 0) || (!setup && endpoint == 0)) {
@@ -91,7 +93,13 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* set
 
     uint32_t interruptor_target = 0;
     size_t max_transfer_size = 1 << (XFER_TRB_XFER_LENGTH_BITS - 1);
-    size_t data_packets = (length ? (length + max_transfer_size - 1) / max_transfer_size : 0);
+    // one TRB per run, or more for those too long for a TRB
+    size_t data_packets = 0;
+    if (length) {
+        for (uint32_t n = 0; n < sg_count; n++) {
+            data_packets += (sg[n].length + max_transfer_size - 1) / max_transfer_size;
+        }
+    }
     size_t required_trbs = data_packets + 1;   // add 1 for event data TRB
     if (setup) {
         required_trbs += 2;
@@ -106,10 +114,11 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* set
     if (ep_type >= 4) ep_type -= 4;
     bool isochronous = (ep_type == USB_ENDPOINT_ISOCHRONOUS);
     if (isochronous) {
-        if (!data || !length) return ERR_INVALID_ARGS;
+        if (sg_count != 1 || !sg[0].paddr || !length) return ERR_INVALID_ARGS;
         // we currently do not support isoch buffers that span page boundaries
         // Section 3.2.11 in the XHCI spec describes how to handle this, but since
         // iotxn buffers are always close to the beginning of a page, this shouldn't be necessary.
+        mx_paddr_t data = sg[0].paddr;
         mx_paddr_t start_page = data & ~(xhci->page_size - 1);
         mx_paddr_t end_page = (data + length - 1) & ~(xhci->page_size - 1);
         if (start_page != end_page) {
@@ -123,9 +132,12 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* set
             return ERR_INVALID_ARGS;
         }
         uint64_t current_frame = xhci_get_current_frame(xhci);
-        if (frame < current_frame) {
-            printf("can't schedule transfer into the past\n");
-            return ERR_INVALID_ARGS;
+        if (frame < current_frame + xhci->isoch_threshold) {
+            // the controller may already be past it; callers keep a few
+            // frames queued ahead to stay clear of this
+            xprintf("can't schedule transfer for frame %" PRIu64 ", now %" PRIu64 "\n",
+                    frame, current_frame);
+            return ERR_OUT_OF_RANGE;
         }
         if (frame - current_frame >= 895) {
             // See XHCI spec, section 4.11.2.5
@@ -172,15 +184,22 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* set
 
     // Data Stage
     if (length > 0) {
-        size_t remaining = length;
+        uint32_t run = 0;
+        size_t run_offset = 0;
 
         for (size_t i = 0; i < data_packets; i++) {
+            size_t remaining = sg[run].length - run_offset;
             size_t transfer_size = (remaining > max_transfer_size ? max_transfer_size : remaining);
-            remaining -= transfer_size;
+            mx_paddr_t data = sg[run].paddr + run_offset;
+            run_offset += transfer_size;
+            if (run_offset == sg[run].length) {
+                run++;
+                run_offset = 0;
+            }
 
             xhci_trb_t* trb = ring->current;
             xhci_clear_trb(trb);
-            XHCI_WRITE64(&trb->ptr, data + (i * max_transfer_size));
+            XHCI_WRITE64(&trb->ptr, data);
             XHCI_SET_BITS32(&trb->status, XFER_TRB_XFER_LENGTH_START, XFER_TRB_XFER_LENGTH_BITS, transfer_size);
             uint32_t td_size = data_packets - i - 1;
             XHCI_SET_BITS32(&trb->status, XFER_TRB_TD_SIZE_START, XFER_TRB_TD_SIZE_BITS, td_size);
@@ -248,7 +267,7 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* set
     // update dequeue_ptr to TRB following this transaction
     context->dequeue_ptr = ring->current;
 
-    XHCI_WRITE32(&xhci->doorbells[slot_id], endpoint + 1);
+    xhci_ring_doorbell(xhci, slot_id, endpoint);
 
     mtx_unlock(&ring->mutex);
 
@@ -270,8 +289,10 @@ int xhci_control_request(xhci_t* xhci, uint32_t slot_id, uint8_t request_type, u
     xhci_sync_transfer_t xfer;
     xhci_sync_transfer_init(&xfer);
 
-    mx_status_t result = xhci_queue_transfer(xhci, slot_id, &setup, data, length, 0,
-                                             request_type & USB_DIR_MASK, 0, &xfer.context, NULL);
+    iotxn_sg_t sg = { .paddr = data, .length = length };
+    mx_status_t result = xhci_queue_transfer(xhci, slot_id, &setup, &sg, (length ? 1 : 0), length,
+                                             0, request_type & USB_DIR_MASK, 0, &xfer.context,
+                                             NULL);
     if (result != NO_ERROR)
         return result;
 
@@ -334,6 +355,12 @@ void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb) {
             // FIXME - better error for stall case?
             result = ERR_BAD_STATE;
             break;
+        case TRB_CC_MISSED_SERVICE_ERROR:
+            // an isochronous transfer that missed its frame: the endpoint
+            // carries on with the next
+            xprintf("TRB_CC_MISSED_SERVICE_ERROR\n");
+            result = ERR_IO_DATA_LOSS;
+            break;
         case TRB_CC_RING_UNDERRUN:
             // non-fatal error that happens when no transfers are available for isochronous endpoint
             xprintf("TRB_CC_RING_UNDERRUN\n");
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <ddk/iotxn.h>
 #include <magenta/types.h>
 
 #include "xhci.h"
@@ -22,8 +23,11 @@ typedef struct {
     list_node_t node;
 } xhci_transfer_context_t;
 
-mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* setup, mx_paddr_t data,
-                                uint16_t length, int ep, int direction, uint64_t frame,
+// the data is gathered from (or scattered to) the sg_count runs in sg,
+// which hold length bytes between them
+mx_status_t xhci_queue_transfer(xhci_t* xhci, uint32_t slot_id, usb_setup_t* setup,
+                                const iotxn_sg_t* sg, uint32_t sg_count,
+                                size_t length, int ep, int direction, uint64_t frame,
                                 xhci_transfer_context_t* context, list_node_t* txn_node);
 mx_status_t xhci_control_request(xhci_t* xhci, uint32_t slot_id, uint8_t request_type, uint8_t request,
                                  uint16_t value, uint16_t index, mx_paddr_t data, uint16_t length);
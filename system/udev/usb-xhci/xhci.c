@@ -158,6 +158,15 @@ mx_status_t xhci_init(xhci_t* xhci, void* mmio) {
     xhci->context_size = (XHCI_READ32(hccparams1) & HCCPARAMS1_CSZ ? 64 : 32);
     xhci->large_esit = !!(XHCI_READ32(hccparams2) & HCCPARAMS2_LEC);
 
+    // the controller reads isochronous TRBs this far ahead of the frame they
+    // are for, rounded up to whole frames
+    uint32_t ist = XHCI_GET_BITS32(hcsparams2, HCSPARAMS2_IST_START, HCSPARAMS2_IST_BITS);
+    if (ist & HCSPARAMS2_IST_FRAMES) {
+        xhci->isoch_threshold = (ist & ~HCSPARAMS2_IST_FRAMES) + 1;
+    } else {
+        xhci->isoch_threshold = (ist + 7) / 8 + 1;
+    }
+
     uint32_t scratch_pad_bufs = XHCI_GET_BITS32(hcsparams2, HCSPARAMS2_MAX_SBBUF_HI_START,
                                                 HCSPARAMS2_MAX_SBBUF_HI_BITS);
 
@@ -260,20 +269,33 @@ fail:
     return result;
 }
 
-static void xhci_update_erdp(xhci_t* xhci, int interruptor) {
+// at most one interrupt every 40us (in 250ns units): events closer together
+// than that are handled in one go
+#define XHCI_IMODI 160
+
+// events handled before the controller is told, so that it need not wait for
+// the whole burst to reuse the ring
+#define XHCI_ERDP_BATCH (EVENT_RING_SIZE / 4)
+
+// done_busy: the burst of events is handled, so the controller may interrupt
+// again
+static void xhci_update_erdp(xhci_t* xhci, int interruptor, bool done_busy) {
     xhci_event_ring_t* er = &xhci->event_rings[interruptor];
     xhci_intr_regs_t* intr_regs = &xhci->runtime_regs->intr_regs[interruptor];
 
     uint64_t erdp = xhci_virt_to_phys(xhci, (mx_vaddr_t)er->current);
-    erdp |= ERDP_EHB; // clear event handler busy
+    if (done_busy) {
+        erdp |= ERDP_EHB; // clear event handler busy
+    }
     XHCI_WRITE64(&intr_regs->erdp, erdp);
 }
 
 static void xhci_interruptor_init(xhci_t* xhci, int interruptor) {
     xhci_intr_regs_t* intr_regs = &xhci->runtime_regs->intr_regs[interruptor];
 
-    xhci_update_erdp(xhci, interruptor);
+    xhci_update_erdp(xhci, interruptor, true);
 
+    XHCI_SET_BITS32(&intr_regs->imod, IMODI_START, IMODI_BITS, XHCI_IMODI);
     XHCI_SET32(&intr_regs->iman, IMAN_IE, IMAN_IE);
     XHCI_SET32(&intr_regs->erstsz, ERSTSZ_MASK, ERST_ARRAY_SIZE);
     XHCI_WRITE64(&intr_regs->erstba, xhci_virt_to_phys(xhci,
@@ -325,6 +347,45 @@ void xhci_start(xhci_t* xhci) {
     xhci_start_device_thread(xhci);
 }
 
+void xhci_ring_doorbell(xhci_t* xhci, uint32_t slot_id, uint32_t endpoint) {
+    mtx_lock(&xhci->doorbell_mutex);
+    if (xhci->doorbell_defer_count > 0) {
+        xhci->slots[slot_id].doorbells_pending |= (1u << endpoint);
+        xhci->doorbell_slots[slot_id / 64] |= (1ull << (slot_id % 64));
+    } else {
+        XHCI_WRITE32(&xhci->doorbells[slot_id], endpoint + 1);
+    }
+    mtx_unlock(&xhci->doorbell_mutex);
+}
+
+void xhci_defer_doorbells(xhci_t* xhci) {
+    mtx_lock(&xhci->doorbell_mutex);
+    xhci->doorbell_defer_count++;
+    mtx_unlock(&xhci->doorbell_mutex);
+}
+
+void xhci_ring_deferred_doorbells(xhci_t* xhci) {
+    mtx_lock(&xhci->doorbell_mutex);
+    if (--xhci->doorbell_defer_count == 0) {
+        for (uint32_t word = 0; word < countof(xhci->doorbell_slots); word++) {
+            uint64_t slots = xhci->doorbell_slots[word];
+            xhci->doorbell_slots[word] = 0;
+            while (slots) {
+                uint32_t slot_id = word * 64 + __builtin_ctzll(slots);
+                slots &= slots - 1;
+                uint32_t pending = xhci->slots[slot_id].doorbells_pending;
+                xhci->slots[slot_id].doorbells_pending = 0;
+                while (pending) {
+                    uint32_t endpoint = __builtin_ctz(pending);
+                    pending &= pending - 1;
+                    XHCI_WRITE32(&xhci->doorbells[slot_id], endpoint + 1);
+                }
+            }
+        }
+    }
+    mtx_unlock(&xhci->doorbell_mutex);
+}
+
 void xhci_post_command(xhci_t* xhci, uint32_t command, uint64_t ptr, uint32_t control_bits,
                        xhci_command_context_t* context) {
     // FIXME - check that command ring is not full?
@@ -390,7 +451,12 @@ uint64_t xhci_get_current_frame(xhci_t* xhci) {
 static void xhci_handle_events(xhci_t* xhci, int interruptor) {
     xhci_event_ring_t* er = &xhci->event_rings[interruptor];
 
+    // completions tend to queue new transfers, whose doorbells are rung once
+    // the burst is handled
+    xhci_defer_doorbells(xhci);
+
     // process all TRBs with cycle bit matching our CCS
+    uint32_t handled = 0;
     while ((XHCI_READ32(&er->current->control) & TRB_C) == er->ccs) {
         uint32_t type = trb_get_type(er->current);
         switch (type) {
@@ -416,8 +482,13 @@ static void xhci_handle_events(xhci_t* xhci, int interruptor) {
             er->current = er->start;
             er->ccs ^= TRB_C;
         }
-        xhci_update_erdp(xhci, interruptor);
+        if (++handled % XHCI_ERDP_BATCH == 0) {
+            xhci_update_erdp(xhci, interruptor, false);
+        }
     }
+    xhci_update_erdp(xhci, interruptor, true);
+
+    xhci_ring_deferred_doorbells(xhci);
 }
 
 void xhci_handle_interrupt(xhci_t* xhci, bool legacy) {
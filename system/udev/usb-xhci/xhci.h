@@ -34,6 +34,8 @@ typedef struct xhci_slot {
     uint32_t port;
     uint32_t rh_port;
     usb_speed_t speed;
+    // endpoints whose doorbell is held back, a bit per endpoint index
+    uint32_t doorbells_pending;
 } xhci_slot_t;
 
 typedef struct xhci xhci_t;
@@ -69,6 +71,9 @@ struct xhci {
     size_t context_size;
     // true if controller supports large ESIT payloads
     bool large_esit;
+    // how many frames after the current one an isochronous transfer may be
+    // scheduled for, at the earliest
+    uint32_t isoch_threshold;
 
     // total number of ports for the root hub
     uint32_t rh_num_ports;
@@ -105,6 +110,13 @@ struct xhci {
     uint64_t mfindex_wrap_count;
    // time of last mfindex wrap
     mx_time_t last_mfindex_wrap;
+
+    // for xhci_ring_doorbell()
+    mtx_t doorbell_mutex;
+    // callers of xhci_defer_doorbells() yet to ring the doorbells they held back
+    uint32_t doorbell_defer_count;
+    // slots with doorbells held back, a bit per slot
+    uint64_t doorbell_slots[4];
 };
 
 mx_status_t xhci_init(xhci_t* xhci, void* mmio);
@@ -114,6 +126,14 @@ void xhci_post_command(xhci_t* xhci, uint32_t command, uint64_t ptr, uint32_t co
                        xhci_command_context_t* context);
 void xhci_wait_bits(volatile uint32_t* ptr, uint32_t bits, uint32_t expected);
 
+// Rings an endpoint's doorbell, or holds it back while doorbells are deferred.
+// Between xhci_defer_doorbells() and xhci_ring_deferred_doorbells(), each
+// endpoint's doorbell is rung once at the end, however many transfers are
+// queued to it.
+void xhci_ring_doorbell(xhci_t* xhci, uint32_t slot_id, uint32_t endpoint);
+void xhci_defer_doorbells(xhci_t* xhci);
+void xhci_ring_deferred_doorbells(xhci_t* xhci);
+
 // returns monotonically increasing frame count
 uint64_t xhci_get_current_frame(xhci_t* xhci);
 
@@ -8,7 +8,9 @@
 #include <hexdump/hexdump.h>
 #include <inttypes.h>
 #include <magenta/compiler.h>
+#include <magenta/new.h>
 #include <mxtl/auto_lock.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/param.h>
@@ -29,6 +31,7 @@
 #define VIRTIO_BLK_F_FLUSH    (1<<9)
 #define VIRTIO_BLK_F_TOPOLOGY (1<<10)
 #define VIRTIO_BLK_F_CONFIG_WCE (1<<11)
+#define VIRTIO_BLK_F_MQ       (1<<12)
 
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
@@ -132,32 +135,36 @@ mx_status_t BlockDevice::Init() {
     // ack and set the driver status bit
     StatusAcknowledgeDriver();
 
-    // XXX check features bits and ack/nak them
-
-    // allocate the main vring
-    auto err = vring_.Init(0, 128); // 128 matches legacy pci
-    if (err < 0) {
-        VIRTIO_ERROR("failed to allocate vring\n");
-        return err;
-    }
-
-    // allocate a queue of block requests
-    size_t size = sizeof(virtio_blk_req) * blk_req_count + sizeof(uint8_t) * blk_req_count;
-
-    mx_status_t r = map_contiguous_memory(size, (uintptr_t*)&blk_req_, &blk_req_pa_);
-    if (r < 0) {
-        VIRTIO_ERROR("cannot alloc blk_req buffers %d\n", r);
-        return r;
+    // take the features we know what to do with
+    uint32_t features = ReadDeviceFeatures() &
+                        (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_MQ | (1u << VIRTIO_RING_F_INDIRECT_DESC));
+    WriteDriverFeatures(features);
+    LTRACEF("features %#x\n", features);
+
+    // indirect descriptors let a request take one from the ring, however
+    // many segments it has, so more requests fit in the ring at once
+    indirect_ = !!(features & (1u << VIRTIO_RING_F_INDIRECT_DESC));
+    seg_max_ = indirect_ ? blk_indirect_seg_max : blk_data_seg_max;
+    if ((features & VIRTIO_BLK_F_SEG_MAX) && config_.seg_max > 0)
+        seg_max_ = MIN(seg_max_, config_.seg_max);
+
+    // and more queues let requests go in (and completions come back)
+    // without waiting on each other
+    queue_count_ = 1;
+    if ((features & VIRTIO_BLK_F_MQ) && config_.num_queues > 1)
+        queue_count_ = (uint16_t)MIN(config_.num_queues, blk_queue_max);
+    LTRACEF("%u queues, %u segments per request\n", queue_count_, seg_max_);
+
+    for (uint16_t n = 0; n < queue_count_; n++) {
+        AllocChecker ac;
+        queues_[n].reset(new (&ac) Queue(this));
+        if (!ac.check())
+            return ERR_NO_MEMORY;
+        auto err = InitQueue(queues_[n].get(), n);
+        if (err < 0)
+            return err;
     }
 
-    LTRACEF("allocated blk request at %p, physical address %#" PRIxPTR "\n", blk_req_, blk_req_pa_);
-
-    // responses are 32 words at the end of the allocated block
-    blk_res_pa_ = blk_req_pa_ + sizeof(virtio_blk_req) * blk_req_count;
-    blk_res_ = (uint8_t*)((uintptr_t)blk_req_ + sizeof(virtio_blk_req) * blk_req_count);
-
-    LTRACEF("allocated blk responses at %p, physical address %#" PRIxPTR "\n", blk_res_, blk_res_pa_);
-
     // start the interrupt thread
     StartIrqThread();
 
@@ -181,50 +188,83 @@ mx_status_t BlockDevice::Init() {
     return NO_ERROR;
 }
 
-void BlockDevice::IrqRingUpdate() {
-    LTRACE_ENTRY;
+mx_status_t BlockDevice::InitQueue(Queue* q, uint16_t index) {
+    q->index = index;
 
-    // parse our descriptor chain, add back to the free queue
-    auto free_chain = [this](vring_used_elem* used_elem) {
-        uint32_t i = (uint16_t)used_elem->id;
-        struct vring_desc* desc = vring_.DescFromIndex((uint16_t)i);
-        auto head_desc = desc; // save the first element
-        for (;;) {
-            int next;
+    auto err = q->ring.Init(index, blk_ring_size);
+    if (err < 0) {
+        VIRTIO_ERROR("failed to allocate vring %u\n", index);
+        return err;
+    }
 
-#if LOCAL_TRACE > 0
-            virtio_dump_desc(desc);
-#endif
+    // allocate the queue's block requests
+    size_t size = sizeof(blk_slot) * blk_slot_count;
+    mx_status_t r = map_contiguous_memory(size, (uintptr_t*)&q->slots, &q->slots_pa);
+    if (r < 0) {
+        VIRTIO_ERROR("cannot alloc blk_req buffers %d\n", r);
+        return r;
+    }
+    q->free_slots = ~0ull;
+    static_assert(blk_slot_count == 64, "free_slots has a bit per slot");
 
-            if (desc->flags & VRING_DESC_F_NEXT) {
-                next = desc->next;
-            } else {
-                /* end of chain */
-                next = -1;
-            }
+    LTRACEF("queue %u: requests at %p, physical address %#" PRIxPTR "\n",
+            index, q->slots, q->slots_pa);
+    return NO_ERROR;
+}
 
-            vring_.FreeDesc((uint16_t)i);
+void BlockDevice::IrqRingUpdate() {
+    LTRACE_ENTRY;
 
-            if (next < 0)
-                break;
-            i = next;
-            desc = vring_.DescFromIndex((uint16_t)i);
-        }
+    // the interrupt does not say which queue it is for
+    for (uint16_t n = 0; n < queue_count_; n++) {
+        QueueRingUpdate(queues_[n].get());
+    }
+}
 
-        // search our pending txn list to see if this completes it
-        iotxn_t* txn;
-        list_for_every_entry (&iotxn_list, txn, iotxn_t, node) {
-            if (txn->context == head_desc) {
-                LTRACEF("completes txn %p\n", txn);
-                list_delete(&txn->node);
-                txn->ops->complete(txn, NO_ERROR, txn->length);
+void BlockDevice::QueueRingUpdate(Queue* q) {
+    list_node done = LIST_INITIAL_VALUE(done);
+    iotxn_t* txn;
+
+    {
+        mxtl::AutoLock lock(q->lock);
+
+        // the head descriptor of each completed chain points into its slot
+        q->ring.IrqRingUpdate([q, &done](vring_used_elem* used_elem) {
+            uint16_t id = (uint16_t)used_elem->id;
+            size_t slot = (q->ring.DescFromIndex(id)->addr - q->slots_pa) / sizeof(blk_slot);
+            q->ring.FreeDescChain(id);
+
+            iotxn_t* txn = q->txns[slot];
+            q->txns[slot] = nullptr;
+            q->free_slots |= (1ull << slot);
+            LTRACEF("completes txn %p\n", txn);
+
+            txn->status = (q->slots[slot].status == VIRTIO_BLK_S_OK) ? NO_ERROR : ERR_IO;
+            list_add_tail(&done, &txn->node);
+        });
+
+        // the room made goes to those waiting for it, in order
+        bool started = false;
+        while ((txn = list_peek_head_type(&q->pending, iotxn_t, node)) != nullptr) {
+            mx_status_t status = StartTxnLocked(q, txn);
+            if (status == ERR_SHOULD_WAIT)
                 break;
+            list_delete(&txn->node);
+            if (status != NO_ERROR) {
+                txn->status = status;
+                list_add_tail(&done, &txn->node);
+                continue;
             }
+            started = true;
         }
-    };
+        if (started)
+            q->ring.Kick();
+    }
 
-    // tell the ring to find free chains and hand it back to our lambda
-    vring_.IrqRingUpdate(free_chain);
+    while ((txn = list_remove_head_type(&done, iotxn_t, node)) != nullptr) {
+        mx_status_t status = txn->status;
+        txn->ops->complete(txn, status, (status == NO_ERROR) ? txn->length : 0);
+    }
 }
 
 void BlockDevice::IrqConfigChange() {
@@ -234,10 +274,6 @@ void BlockDevice::IrqConfigChange() {
 void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
     LTRACEF("txn %p\n", txn);
 
-    mxtl::AutoLock lock(lock_);
-
-    bool write = (txn->opcode == IOTXN_OP_WRITE);
-
     // offset must be aligned to block size
     if (txn->offset % config_.blk_size) {
         TRACEF("offset %#" PRIx64 " is not aligned to sector size %u!\n", txn->offset, config_.blk_size);
@@ -248,68 +284,111 @@ void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
     // constrain to device capacity
     txn->length = MIN(txn->length, GetSize() - txn->offset);
 
-    // allocate and start filling out a block request
-    auto index = alloc_blk_req();
-    LTRACEF("request index %u\n", index);
-    auto req = &blk_req_[index];
-    req->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
-    req->ioprio = 0;
-    req->sector = txn->offset / 512;
-    LTRACEF("blk_req type %u ioprio %u sector %" PRIu64 "\n",
-            req->type, req->ioprio, req->sector);
-
-    /* put together a transfer */
-    uint16_t i;
-    auto desc = vring_.AllocDescChain(3, &i);
-    LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+    // spread the requests over the queues
+    Queue* q = queues_[__atomic_fetch_add(&next_queue_, 1, __ATOMIC_RELAXED) % queue_count_].get();
 
-    /* point the iotxn at this head descriptor */
-    txn->context = desc;
+    mx_status_t status = ERR_SHOULD_WAIT;
+    {
+        mxtl::AutoLock lock(q->lock);
 
-    /* set up the descriptor pointing to the head */
-    desc->addr = blk_req_pa_ + index * sizeof(virtio_blk_req);
-    desc->len = sizeof(struct virtio_blk_req);
-    desc->flags |= VRING_DESC_F_NEXT;
+        if (list_is_empty(&q->pending))
+            status = StartTxnLocked(q, txn);
+        if (status == NO_ERROR) {
+            /* kick it off */
+            q->ring.Kick();
+        } else if (status == ERR_SHOULD_WAIT) {
+            list_add_tail(&q->pending, &txn->node);
+        }
+    }
 
-#if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
-#endif
+    if (status != NO_ERROR && status != ERR_SHOULD_WAIT)
+        txn->ops->complete(txn, status, 0);
+}
 
-    /* set up the descriptor pointing to the buffer */
-    desc = vring_.DescFromIndex(desc->next);
+// Hands the iotxn to the device. Returns ERR_SHOULD_WAIT if the queue is out
+// of slots or descriptors for it, or an error if its data can't be mapped.
+mx_status_t BlockDevice::StartTxnLocked(Queue* q, iotxn_t* txn) {
+    if (q->free_slots == 0)
+        return ERR_SHOULD_WAIT;
+    unsigned int slot = __builtin_ctzll(q->free_slots);
+    blk_slot* bs = &q->slots[slot];
+    mx_paddr_t bs_pa = q->slots_pa + slot * sizeof(blk_slot);
 
-    mx_paddr_t pa;
-    txn->ops->physmap(txn, &pa);
+    bool write = (txn->opcode == IOTXN_OP_WRITE);
 
-    desc->addr = (uint64_t)pa;
-    desc->len = (uint32_t)txn->length;
+    /* find the runs of memory holding the data, one descriptor each */
+    iotxn_sg_t sg[blk_indirect_seg_max];
+    uint32_t nsg;
+    if (txn->ops->physmap_sg(txn, sg, seg_max_, &nsg) != NO_ERROR) {
+        mx_status_t status = txn->ops->physmap(txn, &sg[0].paddr);
+        if (status != NO_ERROR)
+            return status;
+        sg[0].length = txn->length;
+        nsg = 1;
+    }
 
-    if (!write)
-        desc->flags |= VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
-    desc->flags |= VRING_DESC_F_NEXT;
+    /* put together the descriptors: the header, the data, then the response */
+    uint16_t count = (uint16_t)(2 + nsg);
+    struct vring_desc descs[blk_indirect_seg_max + 2];
+    descs[0].addr = bs_pa + offsetof(blk_slot, req);
+    descs[0].len = sizeof(struct virtio_blk_req);
+    descs[0].flags = 0;
+    for (uint32_t n = 0; n < nsg; n++) {
+        descs[1 + n].addr = (uint64_t)sg[n].paddr;
+        descs[1 + n].len = (uint32_t)sg[n].length;
+        /* mark buffer as write-only if its a block read */
+        descs[1 + n].flags = write ? 0 : VRING_DESC_F_WRITE;
+    }
+    descs[count - 1].addr = bs_pa + offsetof(blk_slot, status);
+    descs[count - 1].len = 1;
+    descs[count - 1].flags = VRING_DESC_F_WRITE;
 
+    uint16_t i;
+    struct vring_desc* desc;
+    if (indirect_) {
+        /* one descriptor from the ring, pointing at the slot's table */
+        desc = q->ring.AllocDescChain(1, &i);
+        if (!desc)
+            return ERR_SHOULD_WAIT;
+        for (uint16_t n = 0; n < count; n++) {
+            bs->table[n] = descs[n];
+            if (n + 1 < count) {
+                bs->table[n].flags |= VRING_DESC_F_NEXT;
+                bs->table[n].next = (uint16_t)(n + 1);
+            }
+        }
+        desc->addr = bs_pa + offsetof(blk_slot, table);
+        desc->len = (uint32_t)(count * sizeof(struct vring_desc));
+        desc->flags = VRING_DESC_F_INDIRECT;
+    } else {
+        desc = q->ring.AllocDescChain(count, &i);
+        if (!desc)
+            return ERR_SHOULD_WAIT;
+        for (uint16_t n = 0; n < count; n++) {
+            if (n > 0)
+                desc = q->ring.DescFromIndex(desc->next);
+            desc->addr = descs[n].addr;
+            desc->len = descs[n].len;
+            desc->flags = (uint16_t)((desc->flags & VRING_DESC_F_NEXT) | descs[n].flags);
+        }
+    }
 #if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
+    virtio_dump_desc(q->ring.DescFromIndex(i));
 #endif
 
-    /* set up the descriptor pointing to the response */
-    desc = vring_.DescFromIndex(desc->next);
-    desc->addr = blk_res_pa_ + index;
-    desc->len = 1;
-    desc->flags = VRING_DESC_F_WRITE;
+    bs->req.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    bs->req.ioprio = 0;
+    bs->req.sector = txn->offset / 512;
+    bs->status = VIRTIO_BLK_S_IOERR;
+    LTRACEF("queue %u slot %u type %u sector %" PRIu64 "\n",
+            q->index, slot, bs->req.type, bs->req.sector);
 
-#if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
-#endif
-
-    // save the iotxn in a list
-    list_add_tail(&iotxn_list, &txn->node);
+    q->free_slots &= ~(1ull << slot);
+    q->txns[slot] = txn;
 
     /* submit the transfer */
-    vring_.SubmitChain(i);
-
-    /* kick it off */
-    vring_.Kick();
+    q->ring.SubmitChain(i);
+    return NO_ERROR;
 }
 
 } // namespace virtio
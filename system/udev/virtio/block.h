@@ -7,6 +7,8 @@
 #include "ring.h"
 
 #include <magenta/compiler.h>
+#include <mxtl/mutex.h>
+#include <mxtl/unique_ptr.h>
 #include <stdlib.h>
 
 namespace virtio {
@@ -36,9 +38,6 @@ private:
 
     void QueueReadWriteTxn(iotxn_t* txn);
 
-    // the main virtio ring
-    Ring vring_ = {this};
-
     // saved block device configuration out of the pci config BAR
     struct virtio_blk_config {
         uint64_t capacity;
@@ -50,6 +49,15 @@ private:
             uint8_t sectors;
         } geometry;
         uint32_t blk_size;
+        struct virtio_blk_topology {
+            uint8_t physical_block_exp;
+            uint8_t alignment_offset;
+            uint16_t min_io_size;
+            uint32_t opt_io_size;
+        } topology;
+        uint8_t writeback;
+        uint8_t unused0;
+        uint16_t num_queues;
     } config_ __PACKED = {};
 
     struct virtio_blk_req {
@@ -58,29 +66,58 @@ private:
         uint64_t sector;
     } __PACKED;
 
-    // a queue of block request/responses
-    static const size_t blk_req_count = 32;
-
-    mx_paddr_t blk_req_pa_ = 0;
-    virtio_blk_req* blk_req_ = nullptr;
-
-    mx_paddr_t blk_res_pa_ = 0;
-    uint8_t* blk_res_ = nullptr;
-
-    uint32_t blk_req_bitmap_ = 0;
-
-    unsigned int alloc_blk_req() {
-        unsigned int i = 31 - __builtin_clz(blk_req_bitmap_);
-        blk_req_bitmap_ |= (1 << i);
-        return i;
-    }
-
-    void free_blk_req(unsigned int i) {
-        blk_req_bitmap_ &= ~(1 << i);
-    }
-
-    // pending iotxns
-    list_node iotxn_list = LIST_INITIAL_VALUE(iotxn_list);
+    // virtqueues used, each with its own ring, lock and completions
+    static const size_t blk_queue_max = 4;
+
+    // descriptors in each ring; 128 matches legacy pci
+    static const uint16_t blk_ring_size = 128;
+
+    // requests each queue may have in flight
+    static const size_t blk_slot_count = 64;
+
+    // most descriptors one request's data is gathered from, in a chain of
+    // the ring's own descriptors or in an indirect table
+    static const size_t blk_data_seg_max = 16;
+    static const size_t blk_indirect_seg_max = 64;
+
+    // what the device is told about a request in flight, and what it answers
+    struct blk_slot {
+        // the request's descriptors, if indirect ones were negotiated:
+        // header, data and status
+        struct vring_desc table[blk_indirect_seg_max + 2];
+        virtio_blk_req req;
+        uint8_t status;
+    } __ALIGNED(16);
+
+    struct Queue {
+        explicit Queue(Device* device)
+            : ring(device) {}
+
+        mxtl::Mutex lock;
+        Ring ring;
+        uint16_t index = 0;
+
+        mx_paddr_t slots_pa = 0;
+        blk_slot* slots = nullptr;
+        // the iotxn in flight in each slot, and the slots without one
+        iotxn_t* txns[blk_slot_count] = {};
+        uint64_t free_slots = 0;
+
+        // iotxns waiting for a slot or descriptors, oldest first
+        list_node pending = LIST_INITIAL_VALUE(pending);
+    };
+
+    mx_status_t InitQueue(Queue* q, uint16_t index);
+    mx_status_t StartTxnLocked(Queue* q, iotxn_t* txn);
+    void QueueRingUpdate(Queue* q);
+
+    mxtl::unique_ptr<Queue> queues_[blk_queue_max];
+    uint16_t queue_count_ = 0;
+    uint32_t next_queue_ = 0;
+
+    // negotiated features
+    bool indirect_ = false;
+    uint32_t seg_max_ = blk_data_seg_max;
 };
 
 } // namespace virtio
@@ -293,6 +293,22 @@ void Device::SetRing(uint16_t index, uint16_t count, mx_paddr_t pa_desc, mx_padd
     }
 }
 
+uint16_t Device::GetRingSize(uint16_t index) {
+    if (trans_) {
+        if (bar0_pio_base_) {
+            outpw((bar0_pio_base_ + VIRTIO_PCI_QUEUE_SELECT) & 0xffff, index);
+            return inpw((bar0_pio_base_ + VIRTIO_PCI_QUEUE_SIZE) & 0xffff);
+        } else {
+            // XXX implement
+            assert(0);
+            return 0;
+        }
+    } else {
+        mmio_regs_.common_config->queue_select = index;
+        return mmio_regs_.common_config->queue_size;
+    }
+}
+
 void Device::RingKick(uint16_t ring_index) {
     LTRACEF("index %u\n", ring_index);
     if (trans_) {
@@ -337,4 +353,35 @@ void Device::StatusDriverOK() {
     }
 }
 
+uint32_t Device::ReadDeviceFeatures() {
+    if (trans_) {
+        if (bar0_pio_base_) {
+            return inpd((bar0_pio_base_ + VIRTIO_PCI_DEVICE_FEATURES) & 0xffff);
+        } else {
+            // XXX implement
+            assert(0);
+            return 0;
+        }
+    } else {
+        mmio_regs_.common_config->device_feature_select = 0;
+        return mmio_regs_.common_config->device_feature;
+    }
+}
+
+void Device::WriteDriverFeatures(uint32_t features) {
+    LTRACEF("features %#x\n", features);
+    if (trans_) {
+        if (bar0_pio_base_) {
+            outpd((bar0_pio_base_ + VIRTIO_PCI_DRIVER_FEATURES) & 0xffff, features);
+        } else {
+            // XXX implement
+            assert(0);
+        }
+    } else {
+        mmio_regs_.common_config->driver_feature_select = 0;
+        mmio_regs_.common_config->driver_feature = features;
+        mmio_regs_.common_config->device_status |= VIRTIO_STATUS_FEATURES_OK;
+    }
+}
+
 } // namespace virtio
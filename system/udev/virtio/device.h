@@ -38,6 +38,10 @@ public:
     void SetRing(uint16_t index, uint16_t count, mx_paddr_t pa_desc, mx_paddr_t pa_avail, mx_paddr_t pa_used);
     void RingKick(uint16_t ring_index);
 
+    // the number of descriptors the device has for a ring, or 0 if there is
+    // no such ring; legacy devices take no other
+    uint16_t GetRingSize(uint16_t index);
+
 protected:
     // read bytes out of BAR 0's config space
     uint8_t ReadConfigBar(uint16_t offset);
@@ -48,6 +52,10 @@ protected:
     void StatusAcknowledgeDriver();
     void StatusDriverOK();
 
+    // the first 32 feature bits, offered by the device and taken by the driver
+    uint32_t ReadDeviceFeatures();
+    void WriteDriverFeatures(uint32_t features);
+
     static int IrqThreadEntry(void* arg);
     void IrqWorker();
 
@@ -74,6 +74,15 @@ void GpuDevice::virtio_gpu_flush(mx_device_t* dev) {
     gd->Flush();
 }
 
+void GpuDevice::virtio_gpu_flush_region(mx_device_t* dev, unsigned x, unsigned y,
+                                        unsigned width, unsigned height) {
+    GpuDevice* gd = static_cast<GpuDevice*>(dev->ctx);
+
+    LTRACEF("dev %p, x %u y %u w %u h %u\n", gd, x, y, width, height);
+
+    gd->FlushRegion(x, y, width, height);
+}
+
 GpuDevice::GpuDevice(mx_driver_t* driver, mx_device_t* bus_device)
     : Device(driver, bus_device) {
 
@@ -94,16 +103,17 @@ static void dump_gpu_config(const volatile struct virtio_gpu_config* config) {
     LTRACEF("reserved 0x%x\n", config->reserved);
 }
 
-mx_status_t GpuDevice::send_command_response(const void* cmd, size_t cmd_len, void** _res, size_t res_len) {
-    LTRACEF("dev %p, cmd %p, cmd_len %zu, res %p, res_len %zu\n", this, cmd, cmd_len, _res, res_len);
-
+void* GpuDevice::queue_command(size_t offset, const void* cmd, size_t cmd_len, size_t res_len,
+                               uint16_t* head) {
     uint16_t i;
     struct vring_desc* desc = vring_.AllocDescChain(2, &i);
     assert(desc);
+    *head = i;
 
-    memcpy(gpu_req_, cmd, cmd_len);
+    void* req = (void*)((uint8_t*)gpu_req_ + offset);
+    memcpy(req, cmd, cmd_len);
 
-    desc->addr = gpu_req_pa_;
+    desc->addr = gpu_req_pa_ + offset;
     desc->len = (uint32_t)cmd_len;
     desc->flags |= VRING_DESC_F_NEXT;
 
@@ -111,9 +121,8 @@ mx_status_t GpuDevice::send_command_response(const void* cmd, size_t cmd_len, vo
     desc = vring_.DescFromIndex(desc->next);
     assert(desc);
 
-    void* res = (void*)((uint8_t*)gpu_req_ + cmd_len);
-    *_res = res;
-    mx_paddr_t res_phys = gpu_req_pa_ + cmd_len;
+    void* res = (void*)((uint8_t*)req + cmd_len);
+    mx_paddr_t res_phys = gpu_req_pa_ + offset + cmd_len;
     memset(res, 0, res_len);
 
     desc->addr = res_phys;
@@ -123,11 +132,21 @@ mx_status_t GpuDevice::send_command_response(const void* cmd, size_t cmd_len, vo
     /* submit the transfer */
     vring_.SubmitChain(i);
 
+    return res;
+}
+
+mx_status_t GpuDevice::send_command_response(const void* cmd, size_t cmd_len, void** _res, size_t res_len) {
+    LTRACEF("dev %p, cmd %p, cmd_len %zu, res %p, res_len %zu\n", this, cmd, cmd_len, _res, res_len);
+
+    *_res = queue_command(0, cmd, cmd_len, res_len, &sync_head_);
+    sync_pending_ = true;
+
     /* kick it off */
     vring_.Kick();
 
     /* wait for result */
-    cnd_wait(&request_cond_, request_lock_.GetInternal());
+    while (sync_pending_)
+        cnd_wait(&request_cond_, request_lock_.GetInternal());
 
     return NO_ERROR;
 }
@@ -266,94 +285,104 @@ mx_status_t GpuDevice::set_scanout(uint32_t scanout_id, uint32_t resource_id, ui
     return err;
 }
 
-mx_status_t GpuDevice::flush_resource(uint32_t resource_id, uint32_t width, uint32_t height) {
-    LTRACEF("dev %p, resource_id %u, width %u, height %u\n", this, resource_id, width, height);
+void GpuDevice::queue_flush(FlushSlot* slot, const virtio_gpu_rect& rect) {
+    LTRACEF("dev %p, x %u y %u w %u h %u\n", this, rect.x, rect.y, rect.width, rect.height);
 
-    /* grab a lock to keep this single message at a time */
-    mxtl::AutoLock lock(request_lock_);
+    static_assert(sizeof(virtio_gpu_transfer_to_host_2d) + sizeof(virtio_gpu_resource_flush) +
+                  2 * sizeof(virtio_gpu_ctrl_hdr) <= kFlushSlotSize, "flush slot too small");
+    static_assert(kFlushSlotOffset + kFlushSlots * kFlushSlotSize <= PAGE_SIZE,
+                  "flush slots do not fit the request page");
 
-    /* construct the request */
-    virtio_gpu_resource_flush req;
-    memset(&req, 0, sizeof(req));
+    size_t offset = kFlushSlotOffset + (slot - flush_slots_) * kFlushSlotSize;
 
-    req.hdr.type = VIRTIO_GPU_CMD_RESOURCE_FLUSH;
-    req.r.x = req.r.y = 0;
-    req.r.width = width;
-    req.r.height = height;
-    req.resource_id = resource_id;
+    /* transfer the rectangle to the host resource */
+    virtio_gpu_transfer_to_host_2d xfer;
+    memset(&xfer, 0, sizeof(xfer));
 
-    /* send the command and get a response */
-    virtio_gpu_ctrl_hdr* res;
-    auto err = send_command_response(&req, sizeof(req), (void**)&res, sizeof(*res));
-    assert(err == NO_ERROR);
+    xfer.hdr.type = VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D;
+    xfer.r = rect;
+    // where the rectangle starts in the backing, which is packed 4 bytes
+    // per pixel
+    xfer.offset = ((uint64_t)rect.y * pmode_.r.width + rect.x) * 4;
+    xfer.resource_id = display_resource_id_;
 
-    /* see if we got a valid response */
-    LTRACEF("response type 0x%x\n", res->type);
-    err = (res->type == VIRTIO_GPU_RESP_OK_NODATA) ? NO_ERROR : ERR_NO_MEMORY;
+    slot->res[0] = static_cast<virtio_gpu_ctrl_hdr*>(
+        queue_command(offset, &xfer, sizeof(xfer), sizeof(virtio_gpu_ctrl_hdr), &slot->heads[0]));
+    offset += sizeof(xfer) + sizeof(virtio_gpu_ctrl_hdr);
 
-    return err;
-}
-
-mx_status_t GpuDevice::transfer_to_host_2d(uint32_t resource_id, uint32_t width, uint32_t height) {
-    LTRACEF("dev %p, resource_id %u, width %u, height %u\n", this, resource_id, width, height);
+    /* then flush it to the scanout; the device runs control commands in order */
+    virtio_gpu_resource_flush flush;
+    memset(&flush, 0, sizeof(flush));
 
-    /* grab a lock to keep this single message at a time */
-    mxtl::AutoLock lock(request_lock_);
+    flush.hdr.type = VIRTIO_GPU_CMD_RESOURCE_FLUSH;
+    flush.r = rect;
+    flush.resource_id = display_resource_id_;
 
-    /* construct the request */
-    virtio_gpu_transfer_to_host_2d req;
-    memset(&req, 0, sizeof(req));
+    slot->res[1] = static_cast<virtio_gpu_ctrl_hdr*>(
+        queue_command(offset, &flush, sizeof(flush), sizeof(virtio_gpu_ctrl_hdr), &slot->heads[1]));
 
-    req.hdr.type = VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D;
-    req.r.x = req.r.y = 0;
-    req.r.width = width;
-    req.r.height = height;
-    req.offset = 0;
-    req.resource_id = resource_id;
-
-    /* send the command and get a response */
-    virtio_gpu_ctrl_hdr* res;
-    auto err = send_command_response(&req, sizeof(req), (void**)&res, sizeof(*res));
-    assert(err == NO_ERROR);
-
-    /* see if we got a valid response */
-    LTRACEF("response type 0x%x\n", res->type);
-    err = (res->type == VIRTIO_GPU_RESP_OK_NODATA) ? NO_ERROR : ERR_NO_MEMORY;
-
-    return err;
+    slot->pending = 2;
 }
 
 void GpuDevice::Flush() {
+    FlushRegion(0, 0, pmode_.r.width, pmode_.r.height);
+}
+
+void GpuDevice::FlushRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if ((x >= pmode_.r.width) || (y >= pmode_.r.height) || (width == 0) || (height == 0))
+        return;
+    uint32_t x1 = MIN(x + width, pmode_.r.width);
+    uint32_t y1 = MIN(y + height, pmode_.r.height);
+
     mxtl::AutoLock al(flush_lock_);
+    if (flush_pending_) {
+        // grow the pending rectangle to cover this one too
+        uint32_t px1 = flush_rect_.x + flush_rect_.width;
+        uint32_t py1 = flush_rect_.y + flush_rect_.height;
+        flush_rect_.x = MIN(flush_rect_.x, x);
+        flush_rect_.y = MIN(flush_rect_.y, y);
+        flush_rect_.width = MAX(px1, x1) - flush_rect_.x;
+        flush_rect_.height = MAX(py1, y1) - flush_rect_.y;
+    } else {
+        flush_rect_.x = x;
+        flush_rect_.y = y;
+        flush_rect_.width = x1 - x;
+        flush_rect_.height = y1 - y;
+    }
     flush_pending_ = true;
     cnd_signal(&flush_cond_);
 }
 
 void GpuDevice::virtio_gpu_flusher() {
     LTRACE_ENTRY;
+    size_t next_slot = 0;
     for (;;) {
+        virtio_gpu_rect rect;
         {
             mxtl::AutoLock al(flush_lock_);
-            if (!flush_pending_)
+            while (!flush_pending_)
                 cnd_wait(&flush_cond_, flush_lock_.GetInternal());
             flush_pending_ = false;
+            rect = flush_rect_;
         }
 
         LTRACEF("flushing\n");
 
-        /* transfer to host 2d */
-        auto err = transfer_to_host_2d(display_resource_id_, pmode_.r.width, pmode_.r.height);
-        if (err < 0) {
-            LTRACEF("failed to flush resource\n");
-            continue;
+        // Queue the transfer and flush without waiting for them. Only a
+        // slot's previous pair has to finish before it is reused, so the
+        // next update is gathered and queued while this one runs.
+        mxtl::AutoLock lock(request_lock_);
+        FlushSlot* slot = &flush_slots_[next_slot];
+        next_slot = (next_slot + 1) % kFlushSlots;
+        while (slot->pending)
+            cnd_wait(&request_cond_, request_lock_.GetInternal());
+        for (auto res : slot->res) {
+            if (res && (res->type != VIRTIO_GPU_RESP_OK_NODATA))
+                LTRACEF("failed to flush resource, response type 0x%x\n", res->type);
         }
 
-        /* resource flush */
-        err = flush_resource(display_resource_id_, pmode_.r.width, pmode_.r.height);
-        if (err < 0) {
-            LTRACEF("failed to flush resource\n");
-            continue;
-        }
+        queue_flush(slot, rect);
+        vring_.Kick();
     }
 }
 
@@ -433,6 +462,7 @@ mx_status_t GpuDevice::virtio_gpu_start() {
     display_proto_ops_.get_mode = virtio_gpu_get_mode;
     display_proto_ops_.get_framebuffer = virtio_gpu_get_framebuffer;
     display_proto_ops_.flush = virtio_gpu_flush;
+    display_proto_ops_.flush_region = virtio_gpu_flush_region;
 
     device_.protocol_id = MX_PROTOCOL_DISPLAY;
     device_.protocol_ops = &display_proto_ops_;
@@ -502,6 +532,8 @@ void GpuDevice::IrqRingUpdate() {
 
     // parse our descriptor chain, add back to the free queue
     auto free_chain = [this](vring_used_elem* used_elem) {
+        mxtl::AutoLock lock(request_lock_);
+
         uint32_t i = (uint16_t)used_elem->id;
         struct vring_desc* desc = vring_.DescFromIndex((uint16_t)i);
         __UNUSED auto head_desc = desc; // save the first element
@@ -523,10 +555,19 @@ void GpuDevice::IrqRingUpdate() {
             desc = vring_.DescFromIndex((uint16_t)i);
         }
 
-        // wack the request condition
-        request_lock_.Acquire();
-        cnd_signal(&request_cond_);
-        request_lock_.Release();
+        // mark whichever request this was done, and wack the request condition
+        uint16_t head = (uint16_t)used_elem->id;
+        if (sync_pending_ && (head == sync_head_)) {
+            sync_pending_ = false;
+        } else {
+            for (auto& slot : flush_slots_) {
+                for (uint16_t h : slot.heads) {
+                    if (slot.pending && (h == head))
+                        slot.pending--;
+                }
+            }
+        }
+        cnd_broadcast(&request_cond_);
     };
 
     // tell the ring to find free chains and hand it back to our lambda
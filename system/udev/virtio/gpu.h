@@ -30,6 +30,7 @@ public:
     const virtio_gpu_resp_display_info::virtio_gpu_display_one* pmode() const { return &pmode_; }
 
     void Flush();
+    void FlushRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
 
 private:
     // DDK driver hooks
@@ -37,15 +38,25 @@ private:
     static mx_status_t virtio_gpu_get_mode(mx_device_t* dev, mx_display_info_t* info);
     static mx_status_t virtio_gpu_get_framebuffer(mx_device_t* dev, void** framebuffer);
     static void virtio_gpu_flush(mx_device_t* dev);
+    static void virtio_gpu_flush_region(mx_device_t* dev, unsigned x, unsigned y,
+                                        unsigned width, unsigned height);
+
+    // a transfer and resource flush pair queued on the control ring
+    struct FlushSlot {
+        uint16_t heads[2];
+        virtio_gpu_ctrl_hdr* res[2];
+        unsigned pending;
+    };
 
     // internal routines
+    void* queue_command(size_t offset, const void* cmd, size_t cmd_len, size_t res_len,
+                        uint16_t* head);
     mx_status_t send_command_response(const void* cmd, size_t cmd_len, void** _res, size_t res_len);
     mx_status_t get_display_info();
     mx_status_t allocate_2d_resource(uint32_t* resource_id, uint32_t width, uint32_t height);
     mx_status_t attach_backing(uint32_t resource_id, mx_paddr_t ptr, size_t buf_len);
     mx_status_t set_scanout(uint32_t scanout_id, uint32_t resource_id, uint32_t width, uint32_t height);
-    mx_status_t flush_resource(uint32_t resource_id, uint32_t width, uint32_t height);
-    mx_status_t transfer_to_host_2d(uint32_t resource_id, uint32_t width, uint32_t height);
+    void queue_flush(FlushSlot* slot, const virtio_gpu_rect& rect);
 
     mx_status_t virtio_gpu_start();
     static int virtio_gpu_start_entry(void* arg);
@@ -57,9 +68,13 @@ private:
     // display protocol ops
     mx_display_protocol_t display_proto_ops_ = {};
 
-    // gpu op
+    // gpu op; synchronous requests use the start of the page, and each
+    // flush slot a region of its own after them
     void* gpu_req_ = nullptr;
     mx_paddr_t gpu_req_pa_ = 0;
+    static const size_t kFlushSlotOffset = 2048;
+    static const size_t kFlushSlotSize = 256;
+    static const size_t kFlushSlots = 2;
 
     // a saved copy of the display
     virtio_gpu_resp_display_info::virtio_gpu_display_one pmode_ = {};
@@ -75,9 +90,12 @@ private:
     void* fb_ = nullptr;
     mx_paddr_t fb_pa_ = 0;
 
-    // request condition
+    // request condition, and the requests in flight under request_lock_
     mxtl::Mutex request_lock_;
     cnd_t request_cond_ = {};
+    uint16_t sync_head_ = 0;
+    bool sync_pending_ = false;
+    FlushSlot flush_slots_[kFlushSlots] = {};
 
     // flush thread
     void virtio_gpu_flusher();
@@ -86,6 +104,8 @@ private:
     mxtl::Mutex flush_lock_;
     cnd_t flush_cond_ = {};
     bool flush_pending_ = false;
+    // what the pending flush covers
+    virtio_gpu_rect flush_rect_ = {};
 };
 
 } // namespace virtio
@@ -0,0 +1,681 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "net.h"
+
+#include <ddk/protocol/ethernet.h>
+#include <eth/eth-fifo.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <magenta/compiler.h>
+#include <magenta/new.h>
+#include <magenta/syscalls.h>
+#include <mxtl/auto_lock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define LOCAL_TRACE 0
+
+// clang-format off
+#define VIRTIO_NET_F_CSUM       (1<<0)
+#define VIRTIO_NET_F_GUEST_CSUM (1<<1)
+#define VIRTIO_NET_F_MAC        (1<<5)
+#define VIRTIO_NET_F_GUEST_TSO4 (1<<7)
+#define VIRTIO_NET_F_GUEST_TSO6 (1<<8)
+#define VIRTIO_NET_F_HOST_TSO4  (1<<11)
+#define VIRTIO_NET_F_HOST_TSO6  (1<<12)
+#define VIRTIO_NET_F_MRG_RXBUF  (1<<15)
+#define VIRTIO_NET_F_STATUS     (1<<16)
+#define VIRTIO_NET_F_CTRL_VQ    (1<<17)
+#define VIRTIO_NET_F_MQ         (1<<22)
+#define VIRTIO_F_ANY_LAYOUT     (1<<27)
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+
+#define VIRTIO_NET_CTRL_MQ              4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+
+#define VIRTIO_NET_OK  0
+#define VIRTIO_NET_ERR 1
+// clang-format on
+
+namespace virtio {
+
+static ethernet_protocol_t ethernet_ops = {};
+
+// Sets ts to sec seconds from now, for cnd_timedwait().
+static void deadline_after(struct timespec* ts, time_t sec) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += sec;
+}
+
+// DDK level ops
+
+ssize_t EthernetDevice::virtio_net_ioctl(mx_device_t* dev, uint32_t op, const void* in_buf, size_t in_len,
+                                         void* out_buf, size_t out_len) {
+    LTRACEF("dev %p, op %u\n", dev, op);
+
+    EthernetDevice* ed = static_cast<EthernetDevice*>(dev->ctx);
+
+    switch (op) {
+    case IOCTL_ETHERNET_GET_MAC_ADDR: {
+        if (out_len < ETH_MAC_SIZE)
+            return ERR_BUFFER_TOO_SMALL;
+        memcpy(out_buf, ed->mac_, ETH_MAC_SIZE);
+        return ETH_MAC_SIZE;
+    }
+    case IOCTL_ETHERNET_GET_MTU: {
+        size_t* mtu = static_cast<size_t*>(out_buf);
+        if (out_len < sizeof(*mtu))
+            return ERR_BUFFER_TOO_SMALL;
+        *mtu = eth_mtu;
+        return sizeof(*mtu);
+    }
+    case IOCTL_ETHERNET_GET_FIFO:
+        return ed->GetFifo(in_buf, in_len, out_buf, out_len);
+    case IOCTL_ETHERNET_SET_IO_BUF:
+        return ed->SetIoBuf(in_buf, in_len);
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
+EthernetDevice::EthernetDevice(mx_driver_t* driver, mx_device_t* bus_device)
+    : Device(driver, bus_device) {
+    // so that Bind() knows how much io space to allocate
+    bar0_size_ = 0x40;
+
+    cnd_init(&ctrl_cond_);
+    cnd_init(&tx_cond_);
+}
+
+EthernetDevice::~EthernetDevice() {
+    // TODO: clean up allocated physical memory
+    cnd_destroy(&ctrl_cond_);
+    cnd_destroy(&tx_cond_);
+}
+
+mx_status_t EthernetDevice::Init() {
+    LTRACE_ENTRY;
+
+    // reset the device
+    Reset();
+
+    // read our configuration
+    CopyDeviceConfig(&config_, sizeof(config_));
+
+    // ack and set the driver status bit
+    StatusAcknowledgeDriver();
+
+    // take the features we know what to do with; checksums and segmentation
+    // are left to the host only for received packets, as clients hand over
+    // neither partial checksums nor packets larger than the mtu
+    uint32_t features = ReadDeviceFeatures() &
+                        (VIRTIO_NET_F_MAC | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MRG_RXBUF |
+                         VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ | VIRTIO_F_ANY_LAYOUT);
+    if (!(features & VIRTIO_NET_F_CTRL_VQ))
+        features &= ~VIRTIO_NET_F_MQ;
+    WriteDriverFeatures(features);
+    LTRACEF("features %#x\n", features);
+
+    // mergeable rx buffers put each packet's header in its first buffer,
+    // rather than in a descriptor of its own, and let a packet span buffers
+    mrg_rxbuf_ = !!(features & VIRTIO_NET_F_MRG_RXBUF);
+    guest_csum_ = !!(features & VIRTIO_NET_F_GUEST_CSUM);
+    bool any_layout = !!(features & VIRTIO_F_ANY_LAYOUT);
+    hdr_size_ = mrg_rxbuf_ ? sizeof(virtio_net_hdr) : offsetof(virtio_net_hdr, num_buffers);
+    split_rx_ = !(mrg_rxbuf_ || any_layout);
+    split_tx_ = !any_layout;
+
+    if (features & VIRTIO_NET_F_MAC) {
+        memcpy(mac_, config_.mac, sizeof(mac_));
+    } else {
+        // any address will do: a random, locally administered one
+        size_t actual;
+        mx_cprng_draw(mac_, sizeof(mac_), &actual);
+        mac_[0] = (uint8_t)((mac_[0] & ~0x01) | 0x02);
+    }
+    LTRACEF("mac %02x:%02x:%02x:%02x:%02x:%02x\n",
+            mac_[0], mac_[1], mac_[2], mac_[3], mac_[4], mac_[5]);
+
+    // more queue pairs let the host take packets in and out in parallel
+    pair_count_ = 1;
+    if ((features & VIRTIO_NET_F_MQ) && config_.max_virtqueue_pairs > 1)
+        pair_count_ = (uint16_t)MIN(config_.max_virtqueue_pairs, eth_queue_pair_max);
+    LTRACEF("%u queue pairs\n", pair_count_);
+
+    for (uint16_t n = 0; n < pair_count_; n++) {
+        auto err = InitQueue(&rx_[n], (uint16_t)(2 * n), eth_buf_size);
+        if (err < 0)
+            return err;
+        err = InitQueue(&tx_[n], (uint16_t)(2 * n + 1), eth_buf_size);
+        if (err < 0)
+            return err;
+    }
+    if (pair_count_ > 1) {
+        // the control queue comes after all the pairs the device has
+        auto err = InitQueue(&ctrl_, (uint16_t)(2 * config_.max_virtqueue_pairs),
+                             sizeof(virtio_net_ctrl));
+        if (err < 0)
+            return err;
+    }
+
+    // give the device every rx buffer up front
+    for (uint16_t n = 0; n < pair_count_; n++) {
+        Queue* q = rx_[n].get();
+        uint16_t i;
+        struct vring_desc* desc;
+        while ((desc = q->ring.AllocDescChain(split_rx_ ? 2 : 1, &i)) != nullptr) {
+            mx_paddr_t pa = q->bufs_pa + i * q->buf_size;
+            if (split_rx_) {
+                desc->addr = pa;
+                desc->len = (uint32_t)hdr_size_;
+                desc->flags |= VRING_DESC_F_WRITE;
+                desc = q->ring.DescFromIndex(desc->next);
+                desc->addr = pa + hdr_size_;
+                desc->len = (uint32_t)(q->buf_size - hdr_size_);
+            } else {
+                desc->addr = pa;
+                desc->len = (uint32_t)q->buf_size;
+            }
+            desc->flags |= VRING_DESC_F_WRITE;
+            q->ring.SubmitChain(i);
+        }
+    }
+
+    // start the interrupt thread
+    StartIrqThread();
+
+    // set DRIVER_OK
+    StatusDriverOK();
+
+    for (uint16_t n = 0; n < pair_count_; n++) {
+        rx_[n]->ring.Kick();
+    }
+
+    // the device uses only the first pair until told otherwise
+    if (pair_count_ > 1) {
+        auto err = SendCtrl(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, pair_count_);
+        if (err < 0) {
+            VIRTIO_ERROR("cannot set %u queue pairs %d, using one\n", pair_count_, err);
+            pair_count_ = 1;
+        }
+    }
+
+    // initialize the mx_device and publish us
+    device_ops_.ioctl = &virtio_net_ioctl;
+    device_init(&device_, driver_, "virtio-net", &device_ops_);
+
+    // point the ctx of our embedded device structure at ourself
+    device_.ctx = this;
+
+    device_.protocol_id = MX_PROTOCOL_ETHERNET;
+    device_.protocol_ops = &ethernet_ops;
+    auto status = device_add(&device_, bus_device_);
+    if (status < 0)
+        return status;
+
+    return NO_ERROR;
+}
+
+mx_status_t EthernetDevice::InitQueue(mxtl::unique_ptr<Queue>* out, uint16_t index, size_t buf_size) {
+    uint16_t size = GetRingSize(index);
+    if (size == 0) {
+        VIRTIO_ERROR("no vring %u\n", index);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    AllocChecker ac;
+    out->reset(new (&ac) Queue(this));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    Queue* q = out->get();
+    q->index = index;
+    q->size = size;
+    q->buf_size = buf_size;
+
+    auto err = q->ring.Init(index, size);
+    if (err < 0) {
+        VIRTIO_ERROR("failed to allocate vring %u\n", index);
+        return err;
+    }
+
+    mx_status_t r = map_contiguous_memory(size * buf_size, (uintptr_t*)&q->bufs, &q->bufs_pa);
+    if (r < 0) {
+        VIRTIO_ERROR("cannot alloc buffers for vring %u %d\n", index, r);
+        return r;
+    }
+
+    LTRACEF("queue %u: %u descriptors, buffers at %p, physical address %#" PRIxPTR "\n",
+            index, size, q->bufs, q->bufs_pa);
+    return NO_ERROR;
+}
+
+// Sends a command on the control queue and waits for the device's answer.
+mx_status_t EthernetDevice::SendCtrl(uint8_t cls, uint8_t cmd, uint16_t data) {
+    mxtl::AutoLock lock(ctrl_lock_);
+
+    /* the command, its data, then the device's ack */
+    uint16_t i;
+    struct vring_desc* desc = ctrl_->ring.AllocDescChain(3, &i);
+    if (!desc)
+        return ERR_NO_RESOURCES;
+    virtio_net_ctrl* ctrl = reinterpret_cast<virtio_net_ctrl*>(ctrl_->bufs + i * ctrl_->buf_size);
+    mx_paddr_t pa = ctrl_->bufs_pa + i * ctrl_->buf_size;
+    ctrl->cls = cls;
+    ctrl->cmd = cmd;
+    ctrl->data = data;
+    ctrl->ack = VIRTIO_NET_ERR;
+
+    desc->addr = pa + offsetof(virtio_net_ctrl, cls);
+    desc->len = 2;
+    desc = ctrl_->ring.DescFromIndex(desc->next);
+    desc->addr = pa + offsetof(virtio_net_ctrl, data);
+    desc->len = sizeof(ctrl->data);
+    desc = ctrl_->ring.DescFromIndex(desc->next);
+    desc->addr = pa + offsetof(virtio_net_ctrl, ack);
+    desc->len = sizeof(ctrl->ack);
+    desc->flags |= VRING_DESC_F_WRITE;
+
+    ctrl_done_ = false;
+    ctrl_->ring.SubmitChain(i);
+    ctrl_->ring.Kick();
+
+    struct timespec deadline;
+    deadline_after(&deadline, 1);
+    while (!ctrl_done_) {
+        if (cnd_timedwait(&ctrl_cond_, ctrl_lock_.GetInternal(), &deadline) == thrd_timedout)
+            return ERR_TIMED_OUT;
+    }
+    return (ctrl->ack == VIRTIO_NET_OK) ? NO_ERROR : ERR_IO;
+}
+
+void EthernetDevice::IrqRingUpdate() {
+    LTRACE_ENTRY;
+
+    // the packets received go to the client's rx entries in one batch
+    mx_fifo_state_t state = {};
+    uint64_t room = 0;
+    if ((rx_entries_ != nullptr) && (rx_map_ != nullptr) &&
+        (mx_fifo_op(fifo_.rx_fifo, MX_FIFO_OP_READ_STATE, 0, &state) == NO_ERROR)) {
+        room = state.head - state.tail;
+    }
+    uint64_t filled = 0;
+
+    // the interrupt does not say which queue it is for
+    for (uint16_t n = 0; n < pair_count_; n++) {
+        RxRingUpdate(rx_[n].get(), &state, room, &filled);
+        TxRingUpdate(tx_[n].get());
+    }
+    if (ctrl_)
+        CtrlRingUpdate();
+
+    if (filled > 0) {
+        mx_status_t status = mx_fifo_op(fifo_.rx_fifo, MX_FIFO_OP_ADVANCE_TAIL, filled, &state);
+        if (status != NO_ERROR)
+            VIRTIO_ERROR("cannot advance rx fifo tail %d\n", status);
+    }
+}
+
+// Copies the packets received into the rx entries after the *filled already
+// filled, dropping those there is no room for, and gives the buffers straight
+// back to the device.
+void EthernetDevice::RxRingUpdate(Queue* q, const mx_fifo_state_t* state, uint64_t room,
+                                  uint64_t* filled) {
+    bool requeued = false;
+    q->ring.IrqRingUpdate([this, q, state, room, filled, &requeued](vring_used_elem* used_elem) {
+        uint16_t id = (uint16_t)used_elem->id;
+        uint8_t* data = q->bufs + id * q->buf_size;
+        size_t len = MIN(used_elem->len, q->buf_size);
+
+        if (q->merge_left == 0) {
+            // the first buffer of a packet starts with its header
+            virtio_net_hdr* hdr = reinterpret_cast<virtio_net_hdr*>(data);
+            bool valid = (len >= hdr_size_);
+            q->merge_left = (valid && mrg_rxbuf_ && hdr->num_buffers > 1) ? hdr->num_buffers : 1;
+            q->entry = nullptr;
+            if (valid && (*filled < room)) {
+                uint64_t entry_idx = (state->tail + *filled) & (fifo_.rx_entries_count - 1);
+                q->entry = &rx_entries_[entry_idx];
+                q->entry_copy = *q->entry;
+                q->entry_len = 0;
+                // a partial checksum is one the host vouches for
+                q->entry_copy.flags = (guest_csum_ && (hdr->flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM |
+                                                                     VIRTIO_NET_HDR_F_DATA_VALID)))
+                                          ? ETH_FIFO_RX_CSUM_OK
+                                          : 0;
+            }
+            data += MIN(len, hdr_size_);
+            len -= MIN(len, hdr_size_);
+        }
+
+        if (q->entry != nullptr) {
+            const eth_fifo_entry_t* entry = &q->entry_copy;
+            if ((q->entry_len + len > entry->length) || (entry->offset + (size_t)entry->length > rx_len_)) {
+                LTRACEF("packet too big for rx entry, dropped\n");
+                q->entry = nullptr;
+            } else {
+                memcpy(rx_map_ + entry->offset + q->entry_len, data, len);
+                q->entry_len += len;
+            }
+        }
+
+        // the descriptors still point at the buffer
+        q->ring.SubmitChain(id);
+        requeued = true;
+
+        if ((--q->merge_left == 0) && (q->entry != nullptr)) {
+            q->entry_copy.length = (uint16_t)q->entry_len;
+            *q->entry = q->entry_copy;
+            q->entry = nullptr;
+            (*filled)++;
+        }
+    });
+
+    // the device makes all the buffers of a packet used at once; should the
+    // rest of one come later, it is dropped, as the entry it was gathered
+    // into may be taken by then
+    q->entry = nullptr;
+
+    if (requeued)
+        q->ring.Kick();
+}
+
+void EthernetDevice::TxRingUpdate(Queue* q) {
+    mxtl::AutoLock lock(tx_lock_);
+
+    bool freed = false;
+    q->ring.IrqRingUpdate([q, &freed](vring_used_elem* used_elem) {
+        q->ring.FreeDescChain((uint16_t)used_elem->id);
+        freed = true;
+    });
+    if (freed)
+        cnd_signal(&tx_cond_);
+}
+
+void EthernetDevice::CtrlRingUpdate() {
+    mxtl::AutoLock lock(ctrl_lock_);
+
+    bool done = false;
+    ctrl_->ring.IrqRingUpdate([this, &done](vring_used_elem* used_elem) {
+        ctrl_->ring.FreeDescChain((uint16_t)used_elem->id);
+        done = true;
+    });
+    if (done) {
+        ctrl_done_ = true;
+        cnd_signal(&ctrl_cond_);
+    }
+}
+
+void EthernetDevice::IrqConfigChange() {
+    LTRACE_ENTRY;
+}
+
+// Picks the tx queue for a packet by hashing its addresses and ports, so that
+// the packets of a flow stay in order.
+uint16_t EthernetDevice::TxQueueFor(const uint8_t* frame, size_t len) const {
+    if ((pair_count_ == 1) || (len < 14))
+        return 0;
+
+    size_t addrs, addrs_len, ports;
+    uint8_t proto;
+    uint16_t type = (uint16_t)((frame[12] << 8) | frame[13]);
+    if ((type == 0x0800) && (len >= 14 + 20)) {
+        addrs = 14 + 12;
+        addrs_len = 8;
+        proto = frame[14 + 9];
+        ports = 14 + (frame[14] & 0xf) * 4;
+    } else if ((type == 0x86dd) && (len >= 14 + 40)) {
+        addrs = 14 + 8;
+        addrs_len = 32;
+        proto = frame[14 + 6];
+        ports = 14 + 40;
+    } else {
+        return 0;
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = addrs; i < addrs + addrs_len; i++) {
+        hash ^= frame[i];
+        hash *= 16777619u;
+    }
+    if (((proto == 6) || (proto == 17)) && (len >= ports + 4)) {
+        for (size_t i = ports; i < ports + 4; i++) {
+            hash ^= frame[i];
+            hash *= 16777619u;
+        }
+    }
+    return (uint16_t)(hash % pair_count_);
+}
+
+int EthernetDevice::TxThreadEntry(void* arg) {
+    EthernetDevice* ed = static_cast<EthernetDevice*>(arg);
+
+    ed->TxWorker();
+
+    return 0;
+}
+
+// Copies the packets of the tx entries into the tx rings, handing the entries
+// back as soon as they are, and waits for room when the rings are full.
+void EthernetDevice::TxWorker() {
+    for (;;) {
+        mx_status_t status;
+        do {
+            status = mx_handle_wait_one(fifo_.tx_fifo, MX_FIFO_NOT_EMPTY, MX_SEC(1), NULL);
+        } while (status == ERR_TIMED_OUT);
+        if (status != NO_ERROR) {
+            VIRTIO_ERROR("tx fifo wait failed %d\n", status);
+            break;
+        }
+
+        mx_fifo_state_t state;
+        status = mx_fifo_op(fifo_.tx_fifo, MX_FIFO_OP_READ_STATE, 0, &state);
+        if (status != NO_ERROR) {
+            VIRTIO_ERROR("cannot read tx fifo state %d\n", status);
+            break;
+        }
+
+        uint8_t* tx_map;
+        size_t tx_len;
+        {
+            mxtl::AutoLock lock(lock_);
+            tx_map = tx_map_;
+            tx_len = tx_len_;
+        }
+
+        mxtl::AutoLock lock(tx_lock_);
+
+        uint64_t count = state.head - state.tail;
+        uint64_t sent = 0;
+        uint32_t kick = 0;
+        bool full = false;
+        while (sent < count) {
+            uint64_t entry_idx = (state.tail + sent) & (fifo_.tx_entries_count - 1);
+            // the client may write its entries, so check and use a copy
+            const eth_fifo_entry_t entry = tx_entries_[entry_idx];
+            size_t len = entry.length;
+            if ((tx_map == nullptr) || (entry.offset + len > tx_len) ||
+                (hdr_size_ + len > eth_buf_size)) {
+                LTRACEF("bad tx entry, dropped\n");
+                sent++;
+                continue;
+            }
+            const uint8_t* frame = tx_map + entry.offset;
+
+            uint16_t n = TxQueueFor(frame, len);
+            Queue* q = tx_[n].get();
+            uint16_t i;
+            struct vring_desc* desc = q->ring.AllocDescChain(split_tx_ ? 2 : 1, &i);
+            if (!desc) {
+                full = true;
+                break;
+            }
+
+            // no offloads: the header is all zeroes
+            uint8_t* buf = q->bufs + i * q->buf_size;
+            mx_paddr_t pa = q->bufs_pa + i * q->buf_size;
+            memset(buf, 0, hdr_size_);
+            memcpy(buf + hdr_size_, frame, len);
+            if (split_tx_) {
+                desc->addr = pa;
+                desc->len = (uint32_t)hdr_size_;
+                desc = q->ring.DescFromIndex(desc->next);
+                desc->addr = pa + hdr_size_;
+                desc->len = (uint32_t)len;
+            } else {
+                desc->addr = pa;
+                desc->len = (uint32_t)(hdr_size_ + len);
+            }
+            q->ring.SubmitChain(i);
+            kick |= (1u << n);
+            sent++;
+        }
+
+        for (uint16_t n = 0; n < pair_count_; n++) {
+            if (kick & (1u << n))
+                tx_[n]->ring.Kick();
+        }
+
+        // the packets are copied, so the client has its buffers back
+        if (sent > 0) {
+            status = mx_fifo_op(fifo_.tx_fifo, MX_FIFO_OP_ADVANCE_TAIL, sent, &state);
+            if (status != NO_ERROR)
+                VIRTIO_ERROR("cannot advance tx fifo tail %d\n", status);
+        }
+
+        // rather than spin on the still non-empty fifo, wait for the device
+        // to send some of what it has
+        if (full) {
+            struct timespec deadline;
+            deadline_after(&deadline, 1);
+            cnd_timedwait(&tx_cond_, tx_lock_.GetInternal(), &deadline);
+        }
+    }
+}
+
+ssize_t EthernetDevice::GetFifo(const void* in_buf, size_t in_len, void* out_buf, size_t out_len) {
+    if (in_len < sizeof(eth_get_fifo_args_t) || !in_buf)
+        return ERR_INVALID_ARGS;
+    if (out_len < sizeof(eth_fifo_t) || !out_buf)
+        return ERR_INVALID_ARGS;
+
+    mxtl::AutoLock lock(lock_);
+
+    // For now, we can only have one fifo per instance
+    if (fifo_.entries_vmo != MX_HANDLE_INVALID)
+        return ERR_ALREADY_BOUND;
+
+    const eth_get_fifo_args_t* args = static_cast<const eth_get_fifo_args_t*>(in_buf);
+    eth_fifo_t* reply = static_cast<eth_fifo_t*>(out_buf);
+
+    // Create the fifo
+    eth_fifo_t fifo;
+    mx_status_t status = eth_fifo_create(args->rx_entries, args->tx_entries, args->options, &fifo);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("failed to create eth_fifo %d\n", status);
+        eth_fifo_cleanup(&fifo);
+        return status;
+    }
+
+    // Set up the driver's copy
+    eth_fifo_t mine;
+    eth_fifo_entry_t* rx_entries = nullptr;
+    eth_fifo_entry_t* tx_entries = nullptr;
+    status = eth_fifo_clone_consumer(&fifo, &mine);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("failed to clone consumer fifo %d\n", status);
+        goto clone_consumer_fail;
+    }
+    status = eth_fifo_map_rx_entries(&mine, &rx_entries);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("failed to map rx fifo entries %d\n", status);
+        goto map_rx_entries_fail;
+    }
+    status = eth_fifo_map_tx_entries(&mine, &tx_entries);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("failed to map tx fifo entries %d\n", status);
+        goto map_tx_entries_fail;
+    }
+
+    // Set up the caller's copy
+    status = eth_fifo_clone_producer(&fifo, reply);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("failed to clone producer fifo %d\n", status);
+        goto clone_producer_fail;
+    }
+
+    fifo_ = mine;
+    rx_entries_ = rx_entries;
+    tx_entries_ = tx_entries;
+
+    // Spawn the tx thread
+    if (thrd_create_with_name(&tx_thread_, TxThreadEntry, this, "virtio-net-tx") != thrd_success) {
+        VIRTIO_ERROR("failed to start tx thread\n");
+        status = ERR_BAD_STATE;
+        goto tx_thread_fail;
+    }
+    thrd_detach(tx_thread_);
+
+    eth_fifo_cleanup(&fifo);
+    return sizeof(*reply);
+
+tx_thread_fail:
+    fifo_ = {};
+    rx_entries_ = nullptr;
+    tx_entries_ = nullptr;
+    eth_fifo_cleanup(reply);
+clone_producer_fail:
+    mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)tx_entries, 0);
+map_tx_entries_fail:
+    mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)rx_entries, 0);
+map_rx_entries_fail:
+    eth_fifo_cleanup(&mine);
+clone_consumer_fail:
+    eth_fifo_cleanup(&fifo);
+    return status;
+}
+
+ssize_t EthernetDevice::SetIoBuf(const void* in_buf, size_t in_len) {
+    if (in_len < sizeof(eth_set_io_buf_args_t) || !in_buf)
+        return ERR_INVALID_ARGS;
+
+    const eth_set_io_buf_args_t* args = static_cast<const eth_set_io_buf_args_t*>(in_buf);
+
+    uintptr_t rx_map, tx_map;
+    mx_status_t status = mx_vmar_map(mx_vmar_root_self(), 0, args->io_buf_vmo, args->rx_offset,
+                                     args->rx_len, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &rx_map);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("cannot map rx buffer %d\n", status);
+        mx_handle_close(args->io_buf_vmo);
+        return status;
+    }
+    status = mx_vmar_map(mx_vmar_root_self(), 0, args->io_buf_vmo, args->tx_offset,
+                         args->tx_len, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &tx_map);
+    if (status != NO_ERROR) {
+        VIRTIO_ERROR("cannot map tx buffer %d\n", status);
+        mx_vmar_unmap(mx_vmar_root_self(), rx_map, 0);
+        mx_handle_close(args->io_buf_vmo);
+        return status;
+    }
+
+    mxtl::AutoLock lock(lock_);
+    io_vmo_ = args->io_buf_vmo;
+    rx_map_ = reinterpret_cast<uint8_t*>(rx_map);
+    tx_map_ = reinterpret_cast<uint8_t*>(tx_map);
+    rx_len_ = args->rx_len;
+    tx_len_ = args->tx_len;
+    return NO_ERROR;
+}
+
+} // namespace virtio
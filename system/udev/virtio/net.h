@@ -0,0 +1,140 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include "device.h"
+#include "ring.h"
+
+#include <magenta/compiler.h>
+#include <magenta/device/ethernet.h>
+#include <mxtl/mutex.h>
+#include <mxtl/unique_ptr.h>
+#include <stdlib.h>
+#include <threads.h>
+
+namespace virtio {
+
+class Ring;
+
+class EthernetDevice : public Device {
+public:
+    EthernetDevice(mx_driver_t* driver, mx_device_t* device);
+    virtual ~EthernetDevice();
+
+    virtual mx_status_t Init();
+
+    virtual void IrqRingUpdate();
+    virtual void IrqConfigChange();
+
+private:
+    // DDK driver hooks
+    static ssize_t virtio_net_ioctl(mx_device_t* dev, uint32_t op, const void* in_buf, size_t in_len,
+                                    void* out_buf, size_t out_len);
+
+    ssize_t GetFifo(const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
+    ssize_t SetIoBuf(const void* in_buf, size_t in_len);
+
+    // saved network device configuration out of the pci config BAR
+    struct virtio_net_config {
+        uint8_t mac[6];
+        uint16_t status;
+        uint16_t max_virtqueue_pairs;
+    } config_ __PACKED = {};
+
+    // what goes before every packet; num_buffers only with mergeable rx
+    // buffers
+    struct virtio_net_hdr {
+        uint8_t flags;
+        uint8_t gso_type;
+        uint16_t hdr_len;
+        uint16_t gso_size;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+        uint16_t num_buffers;
+    } __PACKED;
+
+    struct virtio_net_ctrl {
+        uint8_t cls;
+        uint8_t cmd;
+        uint16_t data;
+        uint8_t ack;
+    } __PACKED;
+
+    // rx and tx queue pairs used
+    static const uint16_t eth_queue_pair_max = 4;
+
+    // each descriptor chain's packet buffer; the mtu fits in one with its
+    // header
+    static const size_t eth_buf_size = 2048;
+    static const size_t eth_mtu = 1500;
+
+    struct Queue {
+        explicit Queue(Device* device)
+            : ring(device) {}
+
+        Ring ring;
+        uint16_t index = 0;
+        uint16_t size = 0;
+
+        // a buffer per descriptor, of which those that head a chain are used
+        mx_paddr_t bufs_pa = 0;
+        uint8_t* bufs = nullptr;
+        size_t buf_size = 0;
+
+        // rx: the buffers of the packet still to come, and the client's
+        // entry they are gathered into, if there was one for it; the client
+        // may write its entries, so a copy is used and written back at the end
+        uint16_t merge_left = 0;
+        eth_fifo_entry_t* entry = nullptr;
+        eth_fifo_entry_t entry_copy = {};
+        size_t entry_len = 0;
+    };
+
+    mx_status_t InitQueue(mxtl::unique_ptr<Queue>* out, uint16_t index, size_t buf_size);
+    void RxRingUpdate(Queue* q, const mx_fifo_state_t* state, uint64_t room, uint64_t* filled);
+    void TxRingUpdate(Queue* q);
+    void CtrlRingUpdate();
+    mx_status_t SendCtrl(uint8_t cls, uint8_t cmd, uint16_t data);
+    uint16_t TxQueueFor(const uint8_t* frame, size_t len) const;
+
+    static int TxThreadEntry(void* arg);
+    void TxWorker();
+
+    mxtl::unique_ptr<Queue> rx_[eth_queue_pair_max];
+    mxtl::unique_ptr<Queue> tx_[eth_queue_pair_max];
+    mxtl::unique_ptr<Queue> ctrl_;
+    uint16_t pair_count_ = 0;
+
+    // negotiated features
+    bool mrg_rxbuf_ = false;
+    bool guest_csum_ = false;
+    // whether a packet's header and data go in descriptors of their own
+    bool split_rx_ = false;
+    bool split_tx_ = false;
+    size_t hdr_size_ = 0;
+
+    uint8_t mac_[6] = {};
+
+    // the control queue, which takes one command at a time
+    mxtl::Mutex ctrl_lock_;
+    cnd_t ctrl_cond_ = {};
+    bool ctrl_done_ = false;
+
+    // the tx rings, which the tx thread waits on for room
+    mxtl::Mutex tx_lock_;
+    cnd_t tx_cond_ = {};
+
+    // the client's fifos and buffers, set up under lock_
+    eth_fifo_t fifo_ = {};
+    eth_fifo_entry_t* rx_entries_ = nullptr;
+    eth_fifo_entry_t* tx_entries_ = nullptr;
+    mx_handle_t io_vmo_ = MX_HANDLE_INVALID;
+    uint8_t* rx_map_ = nullptr;
+    uint8_t* tx_map_ = nullptr;
+    size_t rx_len_ = 0;
+    size_t tx_len_ = 0;
+    thrd_t tx_thread_ = {};
+};
+
+} // namespace virtio
@@ -149,7 +149,8 @@ void Ring::SubmitChain(uint16_t desc_index) {
     struct vring_avail* avail = ring_.avail;
 
     avail->ring[avail->idx & ring_.num_mask] = desc_index;
-    //mb();
+    // the descriptors must be seen before the index that publishes them
+    __atomic_thread_fence(__ATOMIC_RELEASE);
     avail->idx++;
 }
 
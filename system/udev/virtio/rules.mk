@@ -12,12 +12,13 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/block.cpp \
     $(LOCAL_DIR)/device.cpp \
     $(LOCAL_DIR)/gpu.cpp \
+    $(LOCAL_DIR)/net.cpp \
     $(LOCAL_DIR)/ring.cpp \
     $(LOCAL_DIR)/utils.cpp \
     $(LOCAL_DIR)/virtio_c.c \
     $(LOCAL_DIR)/virtio_driver.cpp \
 
-MODULE_STATIC_LIBS := ulib/ddk ulib/hexdump ulib/mx ulib/mxtl ulib/mxcpp
+MODULE_STATIC_LIBS := ulib/ddk ulib/eth ulib/hexdump ulib/mx ulib/mxtl ulib/mxcpp
 
 MODULE_LIBS := ulib/driver ulib/magenta ulib/musl
 
@@ -8,12 +8,28 @@
 #pragma GCC visibility push(hidden)
 
 #include <magenta/types.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // If the VMO holds a compressed bootdata, returns a handle to a new VMO with
 // the decompressed data and consumes the original VMO handle. Otherwise returns
 // the original handle.
 mx_handle_t decompress_vmo(mx_handle_t log, mx_handle_t vmar, mx_handle_t vmo);
 
+// Reads the content size from the header of the LZ4 frame of |srclen| bytes
+// at |src|. Only frames of the form mkbootfs writes can be decompressed:
+// with independent blocks of at most 64kB, no block checksums, and the
+// content size given. Returns an error, with a message for it in |*errmsg|,
+// for any other.
+mx_status_t lz4_frame_content_size(const void* src, size_t srclen, uint64_t* size,
+                                   const char** errmsg);
+
+// Decompresses the LZ4 frame of |srclen| bytes at |src| into the |dstlen|
+// bytes at |dst|, which must be its content size exactly. Returns an error,
+// with a message for it in |*errmsg|, if the frame is bad.
+mx_status_t lz4_frame_decompress(const void* src, size_t srclen, void* dst, size_t dstlen,
+                                 const char** errmsg);
+
 // Function prototypes for logging. These are used rather than stdio so that
 // userboot can log when stdio is not available.
 extern void print(mx_handle_t log, const char* s, ...) __attribute__((sentinel));
@@ -0,0 +1,148 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <bootdata/decompress.h>
+
+#include <string.h>
+
+#include <magenta/compiler.h>
+
+#include <lz4/lz4.h>
+
+// The LZ4 Frame format is used to compress a bootfs image, or its files, but
+// we cannot use the LZ4 library's decompression functions in userboot. The
+// following definitions are used in the reimplementation of LZ4 Frame
+// decompression, with a few restrictions on the frame options:
+//  - Blocks must be independent
+//  - No block checksums
+//  - Final content size must be included in frame header
+//  - Max block size is 64kB
+//
+//  See https://github.com/lz4/lz4/blob/dev/lz4_Frame_format.md for details.
+#define MX_LZ4_MAGIC 0x184D2204
+#define MX_LZ4_VERSION (1 << 6)
+
+typedef struct {
+    uint32_t magic;
+    uint8_t flag;
+    uint8_t block_desc;
+    uint64_t content_size;
+    uint8_t header_cksum;
+} __PACKED lz4_frame_desc;
+
+#define MX_LZ4_FLAG_VERSION       (1 << 6)
+#define MX_LZ4_FLAG_BLOCK_DEP     (1 << 5)
+#define MX_LZ4_FLAG_BLOCK_CKSUM   (1 << 4)
+#define MX_LZ4_FLAG_CONTENT_SZ    (1 << 3)
+#define MX_LZ4_FLAG_CONTENT_CKSUM (1 << 2)
+#define MX_LZ4_FLAG_RESERVED      0x03
+
+#define MX_LZ4_BLOCK_MAX_MASK     (7 << 4)
+#define MX_LZ4_BLOCK_64KB         (4 << 4)
+#define MX_LZ4_BLOCK_256KB        (5 << 4)
+#define MX_LZ4_BLOCK_1MB          (6 << 4)
+#define MX_LZ4_BLOCK_4MB          (7 << 4)
+
+#define FAIL(status, msg) do { *errmsg = msg; return status; } while (0)
+
+mx_status_t lz4_frame_content_size(const void* src, size_t srclen, uint64_t* size,
+                                   const char** errmsg) {
+    lz4_frame_desc fd;
+    if (srclen < sizeof(fd)) {
+        FAIL(ERR_INVALID_ARGS, "lz4 frame too short\n");
+    }
+    memcpy(&fd, src, sizeof(fd));
+
+    if (fd.magic != MX_LZ4_MAGIC) {
+        FAIL(ERR_INVALID_ARGS, "bad magic number for lz4 frame\n");
+    }
+    if ((fd.flag & MX_LZ4_FLAG_VERSION) != MX_LZ4_VERSION) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 version\n");
+    }
+    if ((fd.flag & MX_LZ4_FLAG_BLOCK_DEP) == 0) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 flag (blocks must be independent)\n");
+    }
+    if (fd.flag & MX_LZ4_FLAG_BLOCK_CKSUM) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 flag (block checksum must be disabled)\n");
+    }
+    if ((fd.flag & MX_LZ4_FLAG_CONTENT_SZ) == 0) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 flag (content size must be included)\n");
+    }
+    if (fd.flag & MX_LZ4_FLAG_RESERVED) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 flag (reserved bits in flg must be zero)\n");
+    }
+
+    if ((fd.block_desc & MX_LZ4_BLOCK_MAX_MASK) != MX_LZ4_BLOCK_64KB) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 flag (max block size must be 64k)\n");
+    }
+    if (fd.block_desc & ~MX_LZ4_BLOCK_MAX_MASK) {
+        FAIL(ERR_INVALID_ARGS, "bad lz4 flag (reserved bits in bd must be zero)\n");
+    }
+
+    // TODO: header checksum
+
+    *size = fd.content_size;
+    return NO_ERROR;
+}
+
+mx_status_t lz4_frame_decompress(const void* src, size_t srclen, void* dst, size_t dstlen,
+                                 const char** errmsg) {
+    uint64_t content_size;
+    mx_status_t status = lz4_frame_content_size(src, srclen, &content_size, errmsg);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    if (content_size != dstlen) {
+        FAIL(ERR_INVALID_ARGS, "lz4 content size does not match the expected size\n");
+    }
+
+    const uint8_t* data = (const uint8_t*)src + sizeof(lz4_frame_desc);
+    size_t left = srclen - sizeof(lz4_frame_desc);
+    uint8_t* out = dst;
+    size_t remaining = dstlen;
+
+    // Read each LZ4 block and decompress it. Block sizes are 32 bits, and
+    // a zero one ends the frame.
+    for (;;) {
+        uint32_t blocksize;
+        if (left < sizeof(blocksize)) {
+            FAIL(ERR_INVALID_ARGS, "lz4 frame truncated\n");
+        }
+        memcpy(&blocksize, data, sizeof(blocksize));
+        data += sizeof(blocksize);
+        left -= sizeof(blocksize);
+        if (blocksize == 0) {
+            break;
+        }
+
+        // If the data is uncompressed, the high bit is 1.
+        uint32_t actual = blocksize & 0x7fffffff;
+        if (actual > left) {
+            FAIL(ERR_INVALID_ARGS, "lz4 frame truncated\n");
+        }
+        if (blocksize >> 31) {
+            if (actual > remaining) {
+                FAIL(ERR_INVALID_ARGS, "lz4 frame larger than its content size\n");
+            }
+            memcpy(out, data, actual);
+            out += actual;
+            remaining -= actual;
+        } else {
+            int dcmp = LZ4_decompress_safe((const char*)data, (char*)out, actual,
+                                           remaining > INT32_MAX ? INT32_MAX : (int)remaining);
+            if (dcmp < 0) {
+                FAIL(ERR_BAD_STATE, "lz4 decompression failed\n");
+            }
+            out += dcmp;
+            remaining -= dcmp;
+        }
+        data += actual;
+        left -= actual;
+    }
+
+    if (remaining != 0) {
+        FAIL(ERR_INVALID_ARGS, "lz4 frame smaller than its content size\n");
+    }
+    return NO_ERROR;
+}
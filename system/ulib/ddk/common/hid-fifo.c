@@ -39,6 +39,24 @@ ssize_t mx_hid_fifo_peek(mx_hid_fifo_t* fifo, void* out) {
     return 1;
 }
 
+// Copies up to len bytes from the front of the fifo, leaving them in it.
+ssize_t mx_hid_fifo_peek_buf(mx_hid_fifo_t* fifo, void* buf, size_t len) {
+    if (!buf) return ERR_INVALID_ARGS;
+    if (fifo->empty) return 0;
+
+    len = min(mx_hid_fifo_size(fifo), len);
+    uint32_t tail = fifo->tail;
+    for (size_t c = len; c > 0; c--, tail = (tail + 1) & HID_FIFO_MASK) {
+        *(uint8_t*)buf++ = fifo->buf[tail];
+    }
+    return len;
+}
+
+void mx_hid_fifo_clear(mx_hid_fifo_t* fifo) {
+    fifo->head = fifo->tail = 0;
+    fifo->empty = true;
+}
+
 ssize_t mx_hid_fifo_read(mx_hid_fifo_t* fifo, void* buf, size_t len) {
     if (!buf) return ERR_INVALID_ARGS;
     if (fifo->empty) return 0;
@@ -6,6 +6,7 @@
 #include <ddk/common/hid-fifo.h>
 
 #include <magenta/listnode.h>
+#include <magenta/syscalls.h>
 
 #include <assert.h>
 #include <stdio.h>
@@ -14,6 +15,7 @@
 
 #define HID_FLAGS_DEAD         (1 << 0)
 #define HID_FLAGS_WRITE_FAILED (1 << 1)
+#define HID_FLAGS_BATCHED      (1 << 2)
 
 #define USB_HID_DEBUG 0
 
@@ -210,6 +212,29 @@ static void hid_cleanup_instance(mx_hid_instance_t* dev) {
     free(dev);
 }
 
+// Returns as many whole records (header and report) as fit in buf. Called
+// with the fifo lock held.
+static ssize_t hid_read_batched(mx_hid_instance_t* hid, void* buf, size_t count) {
+    size_t total = 0;
+    while (mx_hid_fifo_size(&hid->fifo) > 0) {
+        input_report_hdr_t hdr;
+        if (mx_hid_fifo_peek_buf(&hid->fifo, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+            printf("error reading hid device: truncated report header\n");
+            return ERR_BAD_STATE;
+        }
+        size_t xfer = sizeof(hdr) + hdr.len;
+        if (total + xfer > count) {
+            break;
+        }
+        mx_hid_fifo_read(&hid->fifo, (uint8_t*)buf + total, xfer);
+        total += xfer;
+    }
+    if (total == 0) {
+        return mx_hid_fifo_size(&hid->fifo) ? ERR_BUFFER_TOO_SMALL : ERR_SHOULD_WAIT;
+    }
+    return total;
+}
+
 static ssize_t hid_read_instance(mx_device_t* dev, void* buf, size_t count, mx_off_t off) {
     mx_hid_instance_t* hid = to_hid_instance(dev);
 
@@ -219,6 +244,14 @@ static ssize_t hid_read_instance(mx_device_t* dev, void* buf, size_t count, mx_o
 
     size_t left;
     mtx_lock(&hid->fifo.lock);
+    if (hid->flags & HID_FLAGS_BATCHED) {
+        ssize_t r = hid_read_batched(hid, buf, count);
+        if (mx_hid_fifo_size(&hid->fifo) == 0) {
+            device_state_clr(&hid->dev, DEV_STATE_READABLE);
+        }
+        mtx_unlock(&hid->fifo.lock);
+        return r;
+    }
     size_t xfer;
     uint8_t rpt_id = 0;
     if (hid->root->num_reports > 1) {
@@ -259,6 +292,26 @@ static ssize_t hid_read_instance(mx_device_t* dev, void* buf, size_t count, mx_o
     return r ? r : (ssize_t)ERR_SHOULD_WAIT;
 }
 
+static mx_status_t hid_set_read_mode(mx_hid_instance_t* hid, const void* in_buf, size_t in_len) {
+    if (in_len < sizeof(uint32_t)) return ERR_INVALID_ARGS;
+
+    uint32_t mode = *(const uint32_t*)in_buf;
+    if (mode != INPUT_READ_SINGLE && mode != INPUT_READ_BATCHED) return ERR_INVALID_ARGS;
+
+    // the fifo's contents are laid out for one mode or the other, so reports
+    // queued under the old mode are dropped
+    mtx_lock(&hid->fifo.lock);
+    mx_hid_fifo_clear(&hid->fifo);
+    if (mode == INPUT_READ_BATCHED) {
+        hid->flags |= HID_FLAGS_BATCHED;
+    } else {
+        hid->flags &= ~HID_FLAGS_BATCHED;
+    }
+    device_state_clr(&hid->dev, DEV_STATE_READABLE);
+    mtx_unlock(&hid->fifo.lock);
+    return NO_ERROR;
+}
+
 static ssize_t hid_ioctl_instance(mx_device_t* dev, uint32_t op,
         const void* in_buf, size_t in_len, void* out_buf, size_t out_len) {
     mx_hid_instance_t* hid = to_hid_instance(dev);
@@ -283,6 +336,8 @@ static ssize_t hid_ioctl_instance(mx_device_t* dev, uint32_t op,
         return hid_get_report(hid->root, in_buf, in_len, out_buf, out_len);
     case IOCTL_INPUT_SET_REPORT:
         return hid_set_report(hid->root, in_buf, in_len);
+    case IOCTL_INPUT_SET_READ_MODE:
+        return hid_set_read_mode(hid, in_buf, in_len);
     }
     return ERR_NOT_SUPPORTED;
 }
@@ -584,12 +639,27 @@ mx_protocol_device_t hid_device_proto = {
 };
 
 void hid_io_queue(mx_hid_device_t* hid, const uint8_t* buf, size_t len) {
+    input_report_hdr_t hdr = {
+        .time = mx_time_get(MX_CLOCK_MONOTONIC),
+        .len = len,
+    };
     mtx_lock(&hid->instance_lock);
     mx_hid_instance_t* instance;
     foreach_instance(hid, instance) {
         mtx_lock(&instance->fifo.lock);
         bool was_empty = mx_hid_fifo_size(&instance->fifo) == 0;
-        ssize_t wrote = mx_hid_fifo_write(&instance->fifo, buf, len);
+        ssize_t wrote;
+        if (instance->flags & HID_FLAGS_BATCHED) {
+            // the header and report go in together or not at all
+            if (sizeof(hdr) + len > HID_FIFO_SIZE - mx_hid_fifo_size(&instance->fifo)) {
+                wrote = ERR_BUFFER_TOO_SMALL;
+            } else {
+                mx_hid_fifo_write(&instance->fifo, &hdr, sizeof(hdr));
+                wrote = mx_hid_fifo_write(&instance->fifo, buf, len);
+            }
+        } else {
+            wrote = mx_hid_fifo_write(&instance->fifo, buf, len);
+        }
         if (wrote <= 0) {
             if (!(instance->flags & HID_FLAGS_WRITE_FAILED)) {
                 printf("%s: could not write to hid fifo (ret=%zd)\n",
@@ -10,6 +10,7 @@
 #include <magenta/types.h>
 #include <ddk/iotxn.h>
 #include <magenta/listnode.h>
+#include <threads.h>
 
 // for ssize_t:
 #include <unistd.h>
@@ -71,6 +72,10 @@ struct mx_device {
     void* ios;
     // iostate
 
+    mtx_t rpc_lock;
+    // held while an rpc request to the device is handled, so that drivers
+    // see one request at a time per device
+
     char name[MX_DEVICE_NAME_MAX + 1];
 };
 
@@ -97,6 +97,12 @@ struct iotxn {
     uint8_t extra[0];
 };
 
+// a run of physical memory holding part of an iotxn's data
+typedef struct {
+    mx_paddr_t paddr;
+    size_t length;
+} iotxn_sg_t;
+
 #define iotxn_to(txn, type) ((type*) (txn)->extra)
 #define iotxn_pdata(txn, type) ((type*) (txn)->protocol_data)
 
@@ -107,9 +113,32 @@ mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t
 
 // creates a new iotxn based on a provided VMO buffer, offset and size
 // this duplicates the provided vmo_handle
+//
+// The data is not copied: the range is locked (MX_VMO_OP_LOCK) until the
+// iotxn is released, and physmap() returns its physical address when the
+// pages are contiguous. Otherwise, or if the VMO cannot be locked, physmap()
+// goes through a temporary buffer as described below.
 mx_status_t iotxn_alloc_vmo(iotxn_t** out, mx_handle_t vmo_handle, size_t data_size,
                             mx_off_t data_offset, size_t extra_size);
 
+// A pool of iotxns of one size, for drivers that make many requests:
+// its iotxns are allocated up front, their buffers physically contiguous
+// and so already pinned, and go back to the pool when released, so that
+// taking one costs no memory allocation.  The pool grows by one if empty.
+// The data buffer is not cleared between uses.
+typedef struct iotxn_pool iotxn_pool_t;
+
+// creates a pool of count iotxns with payload space of data_size
+// and extra storage space of extra_size
+mx_status_t iotxn_pool_create(iotxn_pool_t** out, uint32_t count, size_t data_size,
+                              size_t extra_size);
+
+// takes an iotxn from the pool, which ops->release() gives back
+mx_status_t iotxn_pool_alloc(iotxn_pool_t* pool, iotxn_t** out);
+
+// frees the pool; iotxns still in use are freed as they are released
+void iotxn_pool_destroy(iotxn_pool_t* pool);
+
 // queue an iotxn against a device
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn);
 
@@ -139,8 +168,17 @@ struct iotxn_ops {
     // physmap() returns the physical start address of a buffer containing
     // the iotxn's buffer data (on WRITE ops) or a buffer that will be
     // copied back to the iotxn's buffer data (on READ ops).  This may
-    // be the buffer itself, or a temporary, depending on conditions.
-    void (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
+    // be the buffer itself, or a temporary, depending on conditions.  It
+    // fails if a temporary is needed and cannot be allocated.
+    mx_status_t (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
+
+    // physmap_sg() describes the first txn->length bytes of the iotxn's
+    // buffer data as runs of physical memory, in order, for devices that
+    // can gather from (or scatter to) several, so that no temporary buffer
+    // is needed.  It fills in up to max entries of sg and the count used,
+    // or returns ERR_BUFFER_TOO_SMALL if more are needed, in which case
+    // physmap() still works.
+    mx_status_t (*physmap_sg)(iotxn_t* txn, iotxn_sg_t* sg, uint32_t max, uint32_t* count);
 
     // mmap() returns a void* pointing at the data in the iotxn's buffer.
     // This may have to do an expensive memory map operation or copy data
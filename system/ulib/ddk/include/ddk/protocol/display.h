@@ -29,6 +29,23 @@ typedef struct mx_display_protocol {
 
     void (*flush)(mx_device_t* dev);
     // flushes the framebuffer
+
+    void (*flush_region)(mx_device_t* dev, unsigned x, unsigned y, unsigned width, unsigned height);
+    // flushes a rectangle of the framebuffer, in pixels; optional, and
+    // callers fall back to flush() without it
+
+    mx_status_t (*get_framebuffers)(mx_device_t* dev, void** framebuffers, uint32_t* count);
+    // gets the framebuffers that can be flipped between, the one from
+    // get_framebuffer() first; *count is the room in framebuffers going in
+    // and how many there are coming out; optional
+
+    mx_status_t (*flip)(mx_device_t* dev, uint32_t index);
+    // scans out the framebuffer at index from the next vblank on; returns
+    // ERR_SHOULD_WAIT while an earlier flip has not taken effect; optional
+
+    mx_status_t (*get_vsync_event)(mx_device_t* dev, mx_handle_t* event);
+    // returns an event that is signaled (MX_EVENT_SIGNALED) at each vblank,
+    // including the one a flip takes effect at; waiters clear it; optional
 } mx_display_protocol_t;
 
 __END_CDECLS;
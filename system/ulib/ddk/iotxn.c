@@ -8,6 +8,8 @@
 #include <ddk/device.h>
 #include <magenta/syscalls.h>
 #include <sys/param.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,8 +25,17 @@
     } while (0)
 #endif
 
-#define IOTXN_FLAG_CLONE (1 << 0)
-#define IOTXN_FLAG_FREE  (1 << 1)   // for double-free checking
+#define ROUNDUP(a, b) (((a) + ((b)-1)) & ~((b)-1))
+#define ROUNDDOWN(a, b) ((a) & ~((b)-1))
+
+#define IOTXN_FLAG_CLONE  (1 << 0)
+#define IOTXN_FLAG_FREE   (1 << 1)   // for double-free checking
+#define IOTXN_FLAG_VMO    (1 << 2)   // data is in a caller's VMO
+#define IOTXN_FLAG_PINNED (1 << 3)   // whose pages are locked while this txn lasts
+#define IOTXN_FLAG_UNLOCK (1 << 4)   // by this txn, which unlocks them on release
+
+// pages looked up at a time when checking a VMO range is contiguous
+#define IOTXN_LOOKUP_PAGES 64
 
 typedef struct iotxn_priv iotxn_priv_t;
 
@@ -39,9 +50,31 @@ struct iotxn_priv {
     // extra data, at the end of this ioxtn_t structure
     size_t extra_size;
 
+    // for IOTXN_FLAG_VMO txns, the data is at buffer.offset in
+    // buffer.vmo_handle, and buffer.phys is its physical address if the
+    // range is pinned and contiguous, or zero if physmap() has to go
+    // through the bounce buffer. mapping is made by the first mmap().
+    io_buffer_t bounce;
+    uintptr_t mapping;
+    size_t mapping_len;
+
+    // the pool this txn goes back to on release, if any
+    iotxn_pool_t* pool;
+
     iotxn_t txn; // must be at the end for extra data, only valid if not a clone
 };
 
+struct iotxn_pool {
+    mtx_t lock;
+    list_node_t free_list;
+    size_t data_size;
+    size_t extra_size;
+    // txns handed out and not yet released
+    uint32_t outstanding;
+    // once destroyed, the pool goes with its last outstanding txn
+    bool destroyed;
+};
+
 #define get_priv(iotxn) containerof(iotxn, iotxn_priv_t, txn)
 
 static list_node_t free_list = LIST_INITIAL_VALUE(free_list);
@@ -69,9 +102,25 @@ static void iotxn_copyto(iotxn_t* txn, const void* data, size_t length, size_t o
     memcpy(io_buffer_virt(&priv->buffer) + offset, data, count);
 }
 
-static void iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
+static mx_status_t iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
     iotxn_priv_t* priv = get_priv(txn);
     *addr = priv->buffer.phys;
+    return NO_ERROR;
+}
+
+static mx_status_t iotxn_physmap_sg(iotxn_t* txn, iotxn_sg_t* sg, uint32_t max,
+                                    uint32_t* count) {
+    iotxn_priv_t* priv = get_priv(txn);
+    size_t length = MIN(txn->length, priv->data_size);
+    if (length == 0) {
+        *count = 0;
+        return NO_ERROR;
+    }
+    if (max < 1) return ERR_BUFFER_TOO_SMALL;
+    sg[0].paddr = priv->buffer.phys;
+    sg[0].length = length;
+    *count = 1;
+    return NO_ERROR;
 }
 
 static void iotxn_mmap(iotxn_t* txn, void** data) {
@@ -116,6 +165,8 @@ out:
     return cpriv;
 }
 
+static void iotxn_pool_put(iotxn_priv_t* priv);
+
 static void iotxn_release(iotxn_t* txn) {
     xprintf("iotxn_release: txn=%p\n", txn);
     iotxn_priv_t* priv = get_priv(txn);
@@ -124,7 +175,9 @@ static void iotxn_release(iotxn_t* txn) {
         abort();
     }
 
-    if (priv->flags & IOTXN_FLAG_CLONE) {
+    if (priv->pool) {
+        iotxn_pool_put(priv);
+    } else if (priv->flags & IOTXN_FLAG_CLONE) {
         // close our io-buffer's copy of the VMO handle
         io_buffer_release(&priv->buffer);
 
@@ -168,6 +221,7 @@ static iotxn_ops_t ops = {
     .copyfrom = iotxn_copyfrom,
     .copyto = iotxn_copyto,
     .physmap = iotxn_physmap,
+    .physmap_sg = iotxn_physmap_sg,
     .mmap = iotxn_mmap,
     .clone = iotxn_clone,
     .release = iotxn_release,
@@ -192,7 +246,7 @@ mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t
     // found one that fits, skip allocation
     if (found) {
         list_delete(&txn->node);
-        memset(&txn, 0, sizeof(iotxn_t));
+        memset(txn, 0, sizeof(iotxn_t));
         memset(io_buffer_virt(&priv->buffer), 0, priv->buffer.size);
         priv->flags &= ~IOTXN_FLAG_FREE;
         mtx_unlock(&free_list_mutex);
@@ -221,18 +275,348 @@ out:
     return NO_ERROR;
 }
 
+static void iotxn_vmo_complete(iotxn_t* txn, mx_status_t status, mx_off_t actual) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (io_buffer_is_valid(&priv->bounce) && (txn->opcode == IOTXN_OP_READ) &&
+        (status == NO_ERROR)) {
+        size_t count = MIN(actual, priv->data_size);
+        size_t written;
+        mx_vmo_write(priv->buffer.vmo_handle, io_buffer_virt(&priv->bounce),
+                     priv->buffer.offset, count, &written);
+    }
+    iotxn_complete(txn, status, actual);
+}
+
+static void iotxn_vmo_copyfrom(iotxn_t* txn, void* data, size_t length, size_t offset) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (offset >= priv->data_size) return;
+    size_t count = MIN(length, priv->data_size - offset);
+    size_t actual;
+    mx_vmo_read(priv->buffer.vmo_handle, data, priv->buffer.offset + offset, count, &actual);
+}
+
+static void iotxn_vmo_copyto(iotxn_t* txn, const void* data, size_t length, size_t offset) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (offset >= priv->data_size) return;
+    size_t count = MIN(length, priv->data_size - offset);
+    size_t actual;
+    mx_vmo_write(priv->buffer.vmo_handle, data, priv->buffer.offset + offset, count, &actual);
+}
+
+static mx_status_t iotxn_vmo_physmap(iotxn_t* txn, mx_paddr_t* addr) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->buffer.phys) {
+        *addr = priv->buffer.phys;
+        return NO_ERROR;
+    }
+    // drivers expect one contiguous run, which the pages may not be
+    if (!io_buffer_is_valid(&priv->bounce)) {
+        mx_status_t status = io_buffer_init(&priv->bounce, ROUNDUP(priv->data_size, PAGE_SIZE),
+                                            IO_BUFFER_RW);
+        if (status != NO_ERROR) {
+            printf("iotxn: cannot allocate bounce buffer (%d)\n", status);
+            return status;
+        }
+        if (txn->opcode == IOTXN_OP_WRITE) {
+            size_t actual;
+            mx_vmo_read(priv->buffer.vmo_handle, io_buffer_virt(&priv->bounce),
+                        priv->buffer.offset, priv->data_size, &actual);
+        }
+    }
+    *addr = io_buffer_phys(&priv->bounce);
+    return NO_ERROR;
+}
+
+static mx_status_t iotxn_vmo_physmap_sg(iotxn_t* txn, iotxn_sg_t* sg, uint32_t max,
+                                        uint32_t* count) {
+    iotxn_priv_t* priv = get_priv(txn);
+    size_t length = MIN(txn->length, priv->data_size);
+    if (length == 0) {
+        *count = 0;
+        return NO_ERROR;
+    }
+    // pages that may move cannot go to the device, nor can those of a
+    // bounce buffer that is already in use
+    if (priv->buffer.phys || !(priv->flags & IOTXN_FLAG_PINNED) ||
+        io_buffer_is_valid(&priv->bounce)) {
+        if (max < 1) return ERR_BUFFER_TOO_SMALL;
+        mx_status_t status = iotxn_vmo_physmap(txn, &sg[0].paddr);
+        if (status != NO_ERROR) return status;
+        sg[0].length = length;
+        *count = 1;
+        return NO_ERROR;
+    }
+
+    mx_paddr_t pages[IOTXN_LOOKUP_PAGES];
+    mx_off_t offset = priv->buffer.offset;
+    mx_off_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    mx_off_t end = ROUNDUP(offset + length, PAGE_SIZE);
+    uint32_t n = 0;
+    for (mx_off_t off = start; off < end; off += IOTXN_LOOKUP_PAGES * PAGE_SIZE) {
+        size_t len = MIN(end - off, IOTXN_LOOKUP_PAGES * PAGE_SIZE);
+        mx_status_t status = mx_vmo_op_range(priv->buffer.vmo_handle, MX_VMO_OP_LOOKUP, off, len,
+                                             pages, sizeof(pages));
+        if (status < 0) return status;
+        for (size_t i = 0; i < len / PAGE_SIZE; i++) {
+            // the part of this page that holds data
+            mx_off_t page = off + i * PAGE_SIZE;
+            mx_off_t from = MAX(page, offset);
+            mx_off_t to = MIN(page + PAGE_SIZE, offset + length);
+            mx_paddr_t paddr = pages[i] + (from - page);
+            if ((n > 0) && (sg[n - 1].paddr + sg[n - 1].length == paddr)) {
+                sg[n - 1].length += to - from;
+                continue;
+            }
+            if (n == max) return ERR_BUFFER_TOO_SMALL;
+            sg[n].paddr = paddr;
+            sg[n].length = to - from;
+            n++;
+        }
+    }
+    *count = n;
+    return NO_ERROR;
+}
+
+static void iotxn_vmo_mmap(iotxn_t* txn, void** data) {
+    iotxn_priv_t* priv = get_priv(txn);
+    mx_off_t start = ROUNDDOWN(priv->buffer.offset, PAGE_SIZE);
+    if (!priv->mapping) {
+        size_t len = ROUNDUP(priv->buffer.offset + priv->data_size, PAGE_SIZE) - start;
+        mx_status_t status = mx_vmar_map(mx_vmar_root_self(), 0, priv->buffer.vmo_handle, start,
+                                         len, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                                         &priv->mapping);
+        if (status != NO_ERROR) {
+            printf("iotxn: cannot map vmo (%d)\n", status);
+            *data = NULL;
+            return;
+        }
+        priv->mapping_len = len;
+    }
+    *data = (void*)(priv->mapping + (priv->buffer.offset - start));
+}
+
+static void iotxn_vmo_cacheop(iotxn_t* txn, uint32_t op, size_t offset, size_t length) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (io_buffer_is_valid(&priv->bounce)) {
+        io_buffer_cache_op(&priv->bounce, op, offset, length);
+    } else {
+        io_buffer_cache_op(&priv->buffer, op, priv->buffer.offset + offset, length);
+    }
+}
+
+static void iotxn_vmo_release(iotxn_t* txn) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->flags & IOTXN_FLAG_UNLOCK) {
+        mx_vmo_op_range(priv->buffer.vmo_handle, MX_VMO_OP_UNLOCK, priv->buffer.offset,
+                        priv->data_size, NULL, 0);
+    }
+    if (priv->mapping) {
+        mx_vmar_unmap(mx_vmar_root_self(), priv->mapping, priv->mapping_len);
+        priv->mapping = 0;
+        priv->mapping_len = 0;
+    }
+    if (io_buffer_is_valid(&priv->bounce)) {
+        mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)priv->bounce.virt, priv->bounce.size);
+        io_buffer_release(&priv->bounce);
+    }
+    // the clone list hands this out again, to txns of either kind
+    priv->buffer.phys = 0;
+    priv->flags &= ~(IOTXN_FLAG_VMO | IOTXN_FLAG_PINNED | IOTXN_FLAG_UNLOCK);
+    iotxn_release(txn);
+}
+
+static mx_status_t iotxn_vmo_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
+    mx_status_t status = iotxn_clone(txn, out, extra_size);
+    if (status != NO_ERROR) return status;
+    // the clone shares the pin while it lasts, but makes its own mapping
+    // and bounce buffer if it needs them
+    iotxn_priv_t* cpriv = get_priv(*out);
+    cpriv->flags |= IOTXN_FLAG_VMO | (get_priv(txn)->flags & IOTXN_FLAG_PINNED);
+    cpriv->buffer.virt = NULL;
+    return NO_ERROR;
+}
+
+static iotxn_ops_t vmo_ops = {
+    .complete = iotxn_vmo_complete,
+    .copyfrom = iotxn_vmo_copyfrom,
+    .copyto = iotxn_vmo_copyto,
+    .physmap = iotxn_vmo_physmap,
+    .physmap_sg = iotxn_vmo_physmap_sg,
+    .mmap = iotxn_vmo_mmap,
+    .clone = iotxn_vmo_clone,
+    .release = iotxn_vmo_release,
+    .cacheop = iotxn_vmo_cacheop,
+};
+
+// Returns the physical address of the data if the pinned range is one
+// contiguous run of pages, zero if not.
+static mx_paddr_t iotxn_vmo_contiguous(mx_handle_t vmo_handle, mx_off_t offset, size_t size) {
+    mx_paddr_t pages[IOTXN_LOOKUP_PAGES];
+    mx_off_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    mx_off_t end = ROUNDUP(offset + size, PAGE_SIZE);
+    mx_paddr_t first = 0;
+    mx_paddr_t next = 0;
+    for (mx_off_t off = start; off < end; off += IOTXN_LOOKUP_PAGES * PAGE_SIZE) {
+        size_t len = MIN(end - off, IOTXN_LOOKUP_PAGES * PAGE_SIZE);
+        if (mx_vmo_op_range(vmo_handle, MX_VMO_OP_LOOKUP, off, len, pages, sizeof(pages)) < 0) {
+            return 0;
+        }
+        for (size_t n = 0; n < len / PAGE_SIZE; n++) {
+            if (off == start && n == 0) {
+                first = pages[0];
+            } else if (pages[n] != next) {
+                return 0;
+            }
+            next = pages[n] + PAGE_SIZE;
+        }
+    }
+    return first + (offset - start);
+}
+
 mx_status_t iotxn_alloc_vmo(iotxn_t** out, mx_handle_t vmo_handle, size_t data_size,
                             mx_off_t data_offset, size_t extra_size) {
+    xprintf("iotxn_alloc_vmo: vmo=%d data_size=0x%zx data_offset=0x%" PRIx64 "\n",
+            vmo_handle, data_size, data_offset);
+    if (data_size == 0) return ERR_INVALID_ARGS;
+
     iotxn_priv_t* priv = iotxn_get_clone(extra_size);
     if (!priv) return ERR_NO_MEMORY;
-
-    io_buffer_init_vmo(&priv->buffer, vmo_handle, data_offset, IO_BUFFER_RW);
+    memset(&priv->txn, 0, sizeof(iotxn_t));
+    priv->txn.ops = &vmo_ops;
+    priv->flags |= IOTXN_FLAG_VMO;
+
+    mx_status_t status = mx_handle_duplicate(vmo_handle, MX_RIGHT_SAME_RIGHTS,
+                                             &priv->buffer.vmo_handle);
+    if (status != NO_ERROR) {
+        iotxn_vmo_release(&priv->txn);
+        return status;
+    }
+    priv->buffer.size = data_size;
+    priv->buffer.offset = data_offset;
+    priv->buffer.virt = NULL;
+    priv->buffer.phys = 0;
     priv->data_size = data_size;
 
+    // the pages may be handed straight to the device only while they cannot
+    // move; VMOs that cannot be locked (clones) go through a bounce buffer
+    status = mx_vmo_op_range(priv->buffer.vmo_handle, MX_VMO_OP_LOCK, data_offset, data_size,
+                             NULL, 0);
+    if (status == NO_ERROR) {
+        priv->flags |= IOTXN_FLAG_PINNED | IOTXN_FLAG_UNLOCK;
+        priv->buffer.phys = iotxn_vmo_contiguous(priv->buffer.vmo_handle, data_offset, data_size);
+    } else if (status != ERR_NOT_SUPPORTED) {
+        iotxn_vmo_release(&priv->txn);
+        return status;
+    }
+
+    *out = &priv->txn;
+    return NO_ERROR;
+}
+
+static iotxn_priv_t* iotxn_pool_new(iotxn_pool_t* pool) {
+    iotxn_priv_t* priv = calloc(1, sizeof(iotxn_priv_t) + pool->extra_size);
+    if (!priv) return NULL;
+    if (pool->data_size > 0) {
+        if (io_buffer_init(&priv->buffer, pool->data_size, IO_BUFFER_RW) != NO_ERROR) {
+            free(priv);
+            return NULL;
+        }
+    }
+    priv->extra_size = pool->extra_size;
+    priv->data_size = pool->data_size;
+    priv->pool = pool;
+    return priv;
+}
+
+static void iotxn_pool_free(iotxn_priv_t* priv) {
+    if (io_buffer_is_valid(&priv->buffer)) {
+        mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)priv->buffer.virt, priv->buffer.size);
+        io_buffer_release(&priv->buffer);
+    }
+    free(priv);
+}
+
+static void iotxn_pool_put(iotxn_priv_t* priv) {
+    iotxn_pool_t* pool = priv->pool;
+    mtx_lock(&pool->lock);
+    pool->outstanding--;
+    if (!pool->destroyed) {
+        priv->flags |= IOTXN_FLAG_FREE;
+        list_add_head(&pool->free_list, &priv->txn.node);
+        mtx_unlock(&pool->lock);
+        return;
+    }
+    bool last = (pool->outstanding == 0);
+    mtx_unlock(&pool->lock);
+    iotxn_pool_free(priv);
+    if (last) {
+        free(pool);
+    }
+}
+
+mx_status_t iotxn_pool_create(iotxn_pool_t** out, uint32_t count, size_t data_size,
+                              size_t extra_size) {
+    iotxn_pool_t* pool = calloc(1, sizeof(iotxn_pool_t));
+    if (!pool) return ERR_NO_MEMORY;
+    mtx_init(&pool->lock, mtx_plain);
+    list_initialize(&pool->free_list);
+    pool->data_size = data_size;
+    pool->extra_size = extra_size;
+
+    for (uint32_t i = 0; i < count; i++) {
+        iotxn_priv_t* priv = iotxn_pool_new(pool);
+        if (!priv) {
+            iotxn_pool_destroy(pool);
+            return ERR_NO_MEMORY;
+        }
+        priv->flags |= IOTXN_FLAG_FREE;
+        list_add_tail(&pool->free_list, &priv->txn.node);
+    }
+    *out = pool;
+    return NO_ERROR;
+}
+
+mx_status_t iotxn_pool_alloc(iotxn_pool_t* pool, iotxn_t** out) {
+    mtx_lock(&pool->lock);
+    iotxn_t* txn = list_remove_head_type(&pool->free_list, iotxn_t, node);
+    pool->outstanding++;
+    mtx_unlock(&pool->lock);
+
+    iotxn_priv_t* priv;
+    if (txn) {
+        priv = get_priv(txn);
+        priv->flags &= ~IOTXN_FLAG_FREE;
+    } else {
+        // grown by one, which stays in the pool once released
+        xprintf("iotxn_pool_alloc: pool=%p empty\n", pool);
+        if ((priv = iotxn_pool_new(pool)) == NULL) {
+            mtx_lock(&pool->lock);
+            pool->outstanding--;
+            mtx_unlock(&pool->lock);
+            return ERR_NO_MEMORY;
+        }
+    }
+    memset(&priv->txn, 0, sizeof(iotxn_t));
+    priv->txn.ops = &ops;
     *out = &priv->txn;
     return NO_ERROR;
 }
 
+void iotxn_pool_destroy(iotxn_pool_t* pool) {
+    mtx_lock(&pool->lock);
+    pool->destroyed = true;
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&pool->free_list, iotxn_t, node)) != NULL) {
+        iotxn_pool_free(get_priv(txn));
+    }
+    bool last = (pool->outstanding == 0);
+    mtx_unlock(&pool->lock);
+
+    if (last) {
+        free(pool);
+    }
+}
+
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     dev->ops->iotxn_queue(dev, txn);
 }
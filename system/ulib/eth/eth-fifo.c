@@ -144,3 +144,15 @@ mx_status_t eth_fifo_map_tx_entries(eth_fifo_t* fifo, void* addr) {
     return mx_vmar_map(mx_vmar_root_self(), 0, fifo->entries_vmo, rx_entry_size,
             tx_entry_size, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, (uintptr_t*)addr);
 }
+
+mx_status_t eth_fifo_map_state(mx_handle_t fifo, mx_fifo_state_t** out) {
+    mx_handle_t vmo;
+    mx_status_t status = mx_fifo_get_state_vmo(fifo, &vmo);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, PAGE_SIZE,
+            MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, (uintptr_t*)out);
+    mx_handle_close(vmo);
+    return status;
+}
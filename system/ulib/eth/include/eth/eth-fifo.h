@@ -21,4 +21,8 @@ void eth_fifo_cleanup(eth_fifo_t* fifo);
 mx_status_t eth_fifo_map_rx_entries(eth_fifo_t* fifo, void* addr);
 mx_status_t eth_fifo_map_tx_entries(eth_fifo_t* fifo, void* addr);
 
+// Maps the head and tail of |fifo| (either of an eth_fifo_t's fifos) so they
+// can be advanced in place, see mx_fifo_get_state_vmo().
+mx_status_t eth_fifo_map_state(mx_handle_t fifo, mx_fifo_state_t** out);
+
 __END_CDECLS;
@@ -28,6 +28,10 @@
 #define V_FLAG_DEVICE 1
 #define V_FLAG_VMOFILE 2
 #define V_FLAG_MOUNT_READY 4
+// the results of lookup() in this directory may be cached (see vfs_lookup)
+#define V_FLAG_DCACHE 8
+// private to the cache: it has entries for names in this directory
+#define V_FLAG_DCACHE_KEY 16
 
 // On Fuchsia, the Block Device is transmitted by file descriptor, rather than
 // by path. This can prevent some racy behavior relating to FS start-up.
@@ -81,6 +85,16 @@ mx_status_t vfs_walk(vnode_t* vn, vnode_t** out,
 
 mx_status_t vfs_unlink(vnode_t* vn, const char* path, size_t len);
 
+// Name lookup cache (vfs-dcache.c)
+// Looks up a name like vn->ops->lookup(), answering from a cache of the
+// names found, or not found, before in directories flagged V_FLAG_DCACHE.
+mx_status_t vfs_lookup(vnode_t* vn, vnode_t** out, const char* name, size_t len);
+// A filesystem which flags its directories V_FLAG_DCACHE must call this
+// whenever a name is added to, removed from, or renamed in one of them.
+void vfs_dcache_forget(vnode_t* vn, const char* name, size_t len);
+// Drops the cached names of a directory, as it is released.
+void vfs_dcache_forget_dir(vnode_t* vn);
+
 mx_status_t vfs_rename(vnode_t* vn, const char* oldpath, const char* newpath,
                        const char** oldpathout, const char** newpathout);
 
@@ -92,6 +106,10 @@ ssize_t vfs_do_ioctl(vnode_t* vn, uint32_t op, const void* in_buf, size_t in_len
 mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
                             const char* name, size_t len, uint32_t type);
 
+// Like vfs_fill_dirent, for the records of readdir_plus.
+mx_status_t vfs_fill_dirent_plus(vdirent_plus_t* de, size_t delen,
+                                 const char* name, size_t len, const vnattr_t* attr);
+
 mx_status_t vfs_install_remote(vnode_t* vn, mx_handle_t h);
 mx_status_t vfs_uninstall_remote(vnode_t* vn);
 mx_status_t vfs_uninstall_all(void);
@@ -0,0 +1,168 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <magenta/listnode.h>
+
+#include "vfs-internal.h"
+
+// The name lookup cache remembers what lookup() said about a name in a
+// directory: the vnode it found, which the entry holds a reference to, or
+// that it found nothing. Walking the same directories again is then served
+// from memory. Only directories flagged V_FLAG_DCACHE are cached, and their
+// filesystem calls vfs_dcache_forget() whenever one of their names changes.
+// Entries are reused least recently used first.
+//
+// Like the walk itself, the cache relies on vfs_lock for exclusion.
+
+#define DCACHE_ENTRIES 256
+#define DCACHE_BUCKETS 64
+#define DCACHE_NAME_MAX 47
+
+typedef struct dcache_entry {
+    list_node_t hash_node;
+    // most recently used at the head, free ones at the tail
+    list_node_t lru_node;
+    // NULL while free
+    vnode_t* dir;
+    // NULL when the name was not found
+    vnode_t* vn;
+    uint32_t hash;
+    uint8_t len;
+    char name[DCACHE_NAME_MAX];
+} dcache_entry_t;
+
+static dcache_entry_t dcache[DCACHE_ENTRIES];
+static list_node_t dcache_hash[DCACHE_BUCKETS];
+static list_node_t dcache_lru = LIST_INITIAL_VALUE(dcache_lru);
+
+static void dcache_init(void) {
+    if (!list_is_empty(&dcache_lru)) {
+        return;
+    }
+    for (unsigned n = 0; n < DCACHE_BUCKETS; n++) {
+        list_initialize(&dcache_hash[n]);
+    }
+    for (unsigned n = 0; n < DCACHE_ENTRIES; n++) {
+        list_add_tail(&dcache_lru, &dcache[n].lru_node);
+    }
+}
+
+static uint32_t dcache_hash_of(vnode_t* dir, const char* name, size_t len) {
+    uint32_t hash = 2166136261u ^ (uint32_t)((uintptr_t)dir >> 4);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static dcache_entry_t* dcache_find(vnode_t* dir, const char* name, size_t len, uint32_t hash) {
+    dcache_entry_t* de;
+    list_for_every_entry(&dcache_hash[hash % DCACHE_BUCKETS], de, dcache_entry_t, hash_node) {
+        if ((de->hash == hash) && (de->dir == dir) && (de->len == len) &&
+            (memcmp(de->name, name, len) == 0)) {
+            return de;
+        }
+    }
+    return NULL;
+}
+
+// Frees the entry, returning the vnode it held (if any), which the caller
+// releases once done with the cache: that may free more entries.
+static vnode_t* dcache_drop(dcache_entry_t* de) {
+    vnode_t* vn = de->vn;
+    list_delete(&de->hash_node);
+    list_delete(&de->lru_node);
+    list_add_tail(&dcache_lru, &de->lru_node);
+    de->dir = NULL;
+    de->vn = NULL;
+    return vn;
+}
+
+static void dcache_insert(vnode_t* dir, vnode_t* vn, const char* name, size_t len,
+                          uint32_t hash) {
+    dcache_entry_t* de = containerof(list_peek_tail(&dcache_lru), dcache_entry_t, lru_node);
+    vnode_t* evicted = NULL;
+    if (de->dir != NULL) {
+        evicted = dcache_drop(de);
+    }
+    de->dir = dir;
+    de->vn = vn;
+    if (vn != NULL) {
+        vn_acquire(vn);
+    }
+    de->hash = hash;
+    de->len = (uint8_t)len;
+    memcpy(de->name, name, len);
+    list_add_head(&dcache_hash[hash % DCACHE_BUCKETS], &de->hash_node);
+    list_delete(&de->lru_node);
+    list_add_head(&dcache_lru, &de->lru_node);
+    dir->flags |= V_FLAG_DCACHE_KEY;
+    if (evicted != NULL) {
+        vn_release(evicted);
+    }
+}
+
+mx_status_t vfs_lookup(vnode_t* dir, vnode_t** out, const char* name, size_t len) {
+    // '.' and '..' are left to the filesystem: a rename moves '..' without
+    // the name changing
+    if (!(dir->flags & V_FLAG_DCACHE) || (len > DCACHE_NAME_MAX) ||
+        ((len == 1) && (name[0] == '.')) ||
+        ((len == 2) && (name[0] == '.') && (name[1] == '.'))) {
+        return dir->ops->lookup(dir, out, name, len);
+    }
+    dcache_init();
+    uint32_t hash = dcache_hash_of(dir, name, len);
+    dcache_entry_t* de = dcache_find(dir, name, len, hash);
+    if (de != NULL) {
+        trace(WALK, "vfs_lookup: dir=%p name='%.*s' (cached)\n", dir, (int)len, name);
+        list_delete(&de->lru_node);
+        list_add_head(&dcache_lru, &de->lru_node);
+        if (de->vn == NULL) {
+            return ERR_NOT_FOUND;
+        }
+        vn_acquire(de->vn);
+        *out = de->vn;
+        return NO_ERROR;
+    }
+    mx_status_t r = dir->ops->lookup(dir, out, name, len);
+    if (r == NO_ERROR) {
+        dcache_insert(dir, *out, name, len, hash);
+    } else if (r == ERR_NOT_FOUND) {
+        dcache_insert(dir, NULL, name, len, hash);
+    }
+    return r;
+}
+
+void vfs_dcache_forget(vnode_t* dir, const char* name, size_t len) {
+    if (!(dir->flags & V_FLAG_DCACHE_KEY) || (len > DCACHE_NAME_MAX)) {
+        return;
+    }
+    dcache_entry_t* de = dcache_find(dir, name, len, dcache_hash_of(dir, name, len));
+    if (de != NULL) {
+        vnode_t* vn = dcache_drop(de);
+        if (vn != NULL) {
+            vn_release(vn);
+        }
+    }
+}
+
+void vfs_dcache_forget_dir(vnode_t* dir) {
+    if (!(dir->flags & V_FLAG_DCACHE_KEY)) {
+        return;
+    }
+    for (unsigned n = 0; n < DCACHE_ENTRIES; n++) {
+        if (dcache[n].dir == dir) {
+            vnode_t* vn = dcache_drop(&dcache[n]);
+            if (vn != NULL) {
+                vn_release(vn);
+            }
+        }
+    }
+    dir->flags &= ~V_FLAG_DCACHE_KEY;
+}
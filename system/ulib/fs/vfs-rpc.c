@@ -318,6 +318,22 @@ mx_status_t vfs_handler_generic(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         }
         return r;
     }
+    case MXRIO_READDIR_PLUS: {
+        if (vn->ops->readdir_plus == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        if (arg > MXIO_CHUNK_SIZE) {
+            return ERR_INVALID_ARGS;
+        }
+        mx_status_t r;
+        mtx_lock(&vfs_lock);
+        r = vn->ops->readdir_plus(vn, &ios->dircookie, msg->data, arg);
+        mtx_unlock(&vfs_lock);
+        if (r >= 0) {
+            msg->datalen = r;
+        }
+        return r;
+    }
     case MXRIO_IOCTL_1H: {
         if ((len > MXIO_IOCTL_MAX_INPUT) ||
             (arg > (ssize_t)sizeof(msg->data)) ||
@@ -404,6 +420,30 @@ mx_status_t vfs_handler_generic(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
     case MXRIO_SYNC: {
         return vn->ops->sync(vn);
     }
+    case MXRIO_GET_VMO: {
+        if (vn->ops->get_vmo == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        uint64_t want;
+        if ((len != sizeof(want)) || (msg->arg2.off < 0)) {
+            return ERR_INVALID_ARGS;
+        }
+        if ((ios->io_flags & O_ACCMODE) == O_WRONLY) {
+            return ERR_ACCESS_DENIED;
+        }
+        memcpy(&want, msg->data, sizeof(want));
+        size_t vmo_off;
+        ssize_t r = vn->ops->get_vmo(vn, msg->arg2.off, want, &msg->handle[0], &vmo_off);
+        if (r < 0) {
+            return r;
+        }
+        uint64_t avail = r;
+        memcpy(msg->data, &avail, sizeof(avail));
+        msg->datalen = sizeof(avail);
+        msg->arg2.off = vmo_off;
+        msg->hcount = 1;
+        return NO_ERROR;
+    }
     case MXRIO_UNLINK:
         return vfs_unlink(vn, (const char*)msg->data, len);
     default:
@@ -80,7 +80,7 @@ static mx_status_t vfs_walk_next(vnode_t* vn, vnode_t** out, const char* path,
     size_t len = nextpath - path;
     nextpath++;
     trace(WALK, "vfs_walk: vn=%p name='%.*s' nextpath='%s'\n", vn, (int)len, path, nextpath);
-    mx_status_t r = vn->ops->lookup(vn, out, path, len);
+    mx_status_t r = vfs_lookup(vn, out, path, len);
     assert(r <= 0);
     if (*oldvn) {
         // release the old vnode, even if there was an error
@@ -196,7 +196,7 @@ mx_status_t vfs_open(vnode_t* vndir, vnode_t** out, const char* path,
         }
     } else {
     try_open:
-        r = vndir->ops->lookup(vndir, &vn, path, len);
+        r = vfs_lookup(vndir, &vn, path, len);
         vn_release(vndir);
         if (r < 0) {
             return r;
@@ -311,6 +311,23 @@ mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
     return sz;
 }
 
+mx_status_t vfs_fill_dirent_plus(vdirent_plus_t* de, size_t delen,
+                                 const char* name, size_t len, const vnattr_t* attr) {
+    size_t sz = sizeof(vdirent_plus_t) + len + 1;
+
+    // round up to uint64 aligned, for the attributes of the next entry
+    if (sz & 7)
+        sz = (sz + 7) & (~7);
+    if (sz > delen)
+        return ERR_INVALID_ARGS;
+    de->size = sz;
+    de->type = VTYPE_TO_DTYPE(attr->mode);
+    de->attr = *attr;
+    memcpy(de->name, name, len);
+    de->name[len] = 0;
+    return sz;
+}
+
 ssize_t vfs_do_ioctl(vnode_t* vn, uint32_t op, const void* in_buf,
                      size_t in_len, void* out_buf, size_t out_len) {
     switch (op) {
@@ -370,6 +387,7 @@ void vn_release(vnode_t* vn) {
     if (vn->refcount == 0) {
         assert(!(vn->remote > 0));
         trace(VFS, "vfs_release: vn=%p\n", vn);
+        vfs_dcache_forget_dir(vn);
         vn->ops->release(vn);
     }
 }
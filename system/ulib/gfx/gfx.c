@@ -21,6 +21,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define TRACE 0
 
 #if TRACE
@@ -214,154 +220,146 @@ void gfx_putchar(gfx_surface* surface, const gfx_font* font, unsigned ch, unsign
     surface->putchar(surface, font, ch, x, y, fg, bg);
 }
 
-static void copyrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint8_t* src = &((const uint8_t*)surface->ptr)[x + y * surface->stride];
-    uint8_t* dest = &((uint8_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+// Row kernels. SSE2 and NEON are part of the x86-64 and arm64 baselines, so
+// the vector paths need no feature check; which kernel a surface uses is
+// picked by its format in gfx_init_surface().
 
-    if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
+static void fill32(uint32_t* dest, uint32_t color, size_t count) {
+#if defined(__SSE2__)
+    if (count >= 16) {
+        while ((uintptr_t)dest & 15) {
+            *dest++ = color;
+            count--;
         }
-    } else {
-        // copy backwards
-        src += (height-1) * surface->stride + (width-1);
-        dest += (height-1) * surface->stride + (width-1);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
+        __m128i c = _mm_set1_epi32((int)color);
+        for (; count >= 16; count -= 16, dest += 16) {
+            _mm_store_si128((__m128i*)dest, c);
+            _mm_store_si128((__m128i*)(dest + 4), c);
+            _mm_store_si128((__m128i*)(dest + 8), c);
+            _mm_store_si128((__m128i*)(dest + 12), c);
+        }
+        for (; count >= 4; count -= 4, dest += 4) {
+            _mm_store_si128((__m128i*)dest, c);
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (count >= 16) {
+        uint32x4_t c = vdupq_n_u32(color);
+        for (; count >= 16; count -= 16, dest += 16) {
+            vst1q_u32(dest, c);
+            vst1q_u32(dest + 4, c);
+            vst1q_u32(dest + 8, c);
+            vst1q_u32(dest + 12, c);
         }
+        for (; count >= 4; count -= 4, dest += 4) {
+            vst1q_u32(dest, c);
+        }
+    }
+#endif
+    while (count--) {
+        *dest++ = color;
     }
 }
 
-static void fillrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
-    uint8_t* dest = &((uint8_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    uint8_t color8 = (uint8_t)(surface->translate_color(color));
+static void fill16(uint16_t* dest, uint16_t color, size_t count) {
+    if (count && ((uintptr_t)dest & 2)) {
+        *dest++ = color;
+        count--;
+    }
+    fill32((uint32_t*)dest, color | ((uint32_t)color << 16), count / 2);
+    if (count & 1) {
+        dest[count - 1] = color;
+    }
+}
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color8;
-            dest++;
+// Writes count ARGB8888 pixels as RGB565.
+static void convert_32_to_565(uint16_t* dest, const uint32_t* src, size_t count) {
+#if defined(__SSE2__)
+    const __m128i rmask = _mm_set1_epi32(0x1f << 11);
+    const __m128i gmask = _mm_set1_epi32(0x3f << 5);
+    const __m128i bmask = _mm_set1_epi32(0x1f);
+    for (; count >= 8; count -= 8, src += 8, dest += 8) {
+        __m128i out[2];
+        for (int i = 0; i < 2; i++) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+            __m128i v = _mm_and_si128(_mm_srli_epi32(p, 8), rmask);
+            v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 5), gmask));
+            v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 3), bmask));
+            // sign extend so the saturating pack keeps all 16 bits
+            out[i] = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
         }
-        dest += stride_diff;
+        _mm_storeu_si128((__m128i*)dest, _mm_packs_epi32(out[0], out[1]));
+    }
+#elif defined(__ARM_NEON)
+    const uint32x4_t rmask = vdupq_n_u32(0x1f << 11);
+    const uint32x4_t gmask = vdupq_n_u32(0x3f << 5);
+    const uint32x4_t bmask = vdupq_n_u32(0x1f);
+    for (; count >= 4; count -= 4, src += 4, dest += 4) {
+        uint32x4_t p = vld1q_u32(src);
+        uint32x4_t v = vandq_u32(vshrq_n_u32(p, 8), rmask);
+        v = vorrq_u32(v, vandq_u32(vshrq_n_u32(p, 5), gmask));
+        v = vorrq_u32(v, vandq_u32(vshrq_n_u32(p, 3), bmask));
+        vst1_u16(dest, vmovn_u32(v));
+    }
+#endif
+    while (count--) {
+        *dest++ = (uint16_t)ARGB8888_to_RGB565(*src++);
     }
 }
 
-static void copyrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint16_t* src = &((const uint16_t*)surface->ptr)[x + y * surface->stride];
-    uint16_t* dest = &((uint16_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+// Copies a rectangle within a surface a row at a time, in the order that
+// keeps overlapping source rows intact.
+static void copyrect(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
+    size_t stride = surface->stride * surface->pixelsize;
+    size_t len = width * surface->pixelsize;
+    const uint8_t* src = (const uint8_t*)surface->ptr + x * surface->pixelsize + y * stride;
+    uint8_t* dest = (uint8_t*)surface->ptr + x2 * surface->pixelsize + y2 * stride;
 
     if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest += stride;
+            src += stride;
         }
     } else {
-        // copy backwards
-        src += (height-1) * surface->stride + (width-1);
-        dest += (height-1) * surface->stride + (width-1);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
+        src += (height - 1) * stride;
+        dest += (height - 1) * stride;
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest -= stride;
+            src -= stride;
         }
     }
 }
 
-static void fillrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
-    uint16_t* dest = &((uint16_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+static void fillrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
+    uint8_t* dest = &((uint8_t*)surface->ptr)[x + y * surface->stride];
 
-    uint16_t color16 = (uint16_t)(surface->translate_color(color));
+    uint8_t color8 = (uint8_t)(surface->translate_color(color));
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color16;
-            dest++;
-        }
-        dest += stride_diff;
+    for (unsigned i = 0; i < height; i++) {
+        memset(dest, color8, width);
+        dest += surface->stride;
     }
 }
 
-static void copyrect32(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint32_t* src = &((const uint32_t*)surface->ptr)[x + y * surface->stride];
-    uint32_t* dest = &((uint32_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+static void fillrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
+    uint16_t* dest = &((uint16_t*)surface->ptr)[x + y * surface->stride];
 
-    if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += (height-1) * surface->stride + (width-1);
-        dest += (height-1) * surface->stride + (width-1);
+    uint16_t color16 = (uint16_t)(surface->translate_color(color));
 
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
+    for (unsigned i = 0; i < height; i++) {
+        fill16(dest, color16, width);
+        dest += surface->stride;
     }
 }
 
 static void fillrect32(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
     uint32_t* dest = &((uint32_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color;
-            dest++;
-        }
-        dest += stride_diff;
+    for (unsigned i = 0; i < height; i++) {
+        fill32(dest, color, width);
+        dest += surface->stride;
     }
 }
 
@@ -465,8 +463,6 @@ void gfx_surface_blend(struct gfx_surface* target, struct gfx_surface* source, u
  * @brief  Copy pixels from source to dest.
  */
 void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned srcy, unsigned width, unsigned height, unsigned destx, unsigned desty) {
-    assert(target->format == source->format);
-
     xprintf("target %p, source %p, srcx %u, srcy %u, width %u, height %u, destx %u, desty %u\n", target, source, srcx, srcy, width, height, destx, desty);
 
     if (destx >= target->width)
@@ -490,26 +486,7 @@ void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned
         height = source->height - srcy;
 
     // XXX total hack to deal with various blends
-    if (source->format == MX_PIXEL_FORMAT_RGB_565 && target->format == MX_PIXEL_FORMAT_RGB_565) {
-        // 16 bit to 16 bit
-        const uint16_t* src = &((const uint16_t*)source->ptr)[srcx + srcy * source->stride];
-        uint16_t* dest = &((uint16_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
-    } else if (source->format == MX_PIXEL_FORMAT_ARGB_8888 && target->format == MX_PIXEL_FORMAT_ARGB_8888) {
+    if (source->format == MX_PIXEL_FORMAT_ARGB_8888 && target->format == MX_PIXEL_FORMAT_ARGB_8888) {
         // both are 32 bit modes, both alpha
         const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
         uint32_t* dest = &((uint32_t*)target->ptr)[destx + desty * target->stride];
@@ -529,43 +506,34 @@ void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned
             dest += dest_stride_diff;
             src += source_stride_diff;
         }
-    } else if (source->format == MX_PIXEL_FORMAT_RGB_x888 && target->format == MX_PIXEL_FORMAT_RGB_x888) {
-        // both are 32 bit modes, no alpha
-        const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
-        uint32_t* dest = &((uint32_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+    } else if ((source->format == target->format) &&
+               ((source->format == MX_PIXEL_FORMAT_RGB_565) ||
+                (source->format == MX_PIXEL_FORMAT_RGB_x888) ||
+                (source->format == MX_PIXEL_FORMAT_MONO_1))) {
+        // same format, no alpha
+        size_t dest_stride = target->stride * target->pixelsize;
+        size_t source_stride = source->stride * source->pixelsize;
+        const uint8_t* src = (const uint8_t*)source->ptr + srcx * source->pixelsize + srcy * source_stride;
+        uint8_t* dest = (uint8_t*)target->ptr + destx * target->pixelsize + desty * dest_stride;
+
+        xprintf("w %u h %u dstride %zu sstride %zu\n", width, height, dest_stride, source_stride);
+
+        for (unsigned i = 0; i < height; i++) {
+            memcpy(dest, src, width * source->pixelsize);
+            dest += dest_stride;
+            src += source_stride;
         }
-    } else if (source->format == MX_PIXEL_FORMAT_MONO_1 && target->format == MX_PIXEL_FORMAT_MONO_1) {
-        // both are 8 bit modes, no alpha
-        const uint8_t* src = &((const uint8_t*)source->ptr)[srcx + srcy * source->stride];
-        uint8_t* dest = &((uint8_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
+    } else if (((source->format == MX_PIXEL_FORMAT_RGB_x888) ||
+                (source->format == MX_PIXEL_FORMAT_ARGB_8888)) &&
+               (target->format == MX_PIXEL_FORMAT_RGB_565)) {
+        // 32 bit to 16 bit, dropping alpha
+        const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
+        uint16_t* dest = &((uint16_t*)target->ptr)[destx + desty * target->stride];
 
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
+        for (unsigned i = 0; i < height; i++) {
+            convert_32_to_565(dest, src, width);
+            dest += target->stride;
+            src += source->stride;
         }
     } else {
         xprintf("gfx_surface_blend: unimplemented colorspace combination (source %d target %d)\n", source->format, target->format);
@@ -644,7 +612,7 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
     switch (format) {
     case MX_PIXEL_FORMAT_RGB_565:
         surface->translate_color = &ARGB8888_to_RGB565;
-        surface->copyrect = &copyrect16;
+        surface->copyrect = &copyrect;
         surface->fillrect = &fillrect16;
         surface->putpixel = &putpixel16;
         surface->putchar = &putchar16;
@@ -654,7 +622,7 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
     case MX_PIXEL_FORMAT_RGB_x888:
     case MX_PIXEL_FORMAT_ARGB_8888:
         surface->translate_color = NULL;
-        surface->copyrect = &copyrect32;
+        surface->copyrect = &copyrect;
         surface->fillrect = &fillrect32;
         surface->putpixel = &putpixel32;
         surface->putchar = &putchar32;
@@ -663,7 +631,7 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
         break;
     case MX_PIXEL_FORMAT_MONO_1:
         surface->translate_color = &ARGB8888_to_Luma;
-        surface->copyrect = &copyrect8;
+        surface->copyrect = &copyrect;
         surface->fillrect = &fillrect8;
         surface->putpixel = &putpixel8;
         surface->putchar = &putchar8;
@@ -672,7 +640,7 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
         break;
     case MX_PIXEL_FORMAT_RGB_332:
         surface->translate_color = &ARGB8888_to_RGB332;
-        surface->copyrect = &copyrect8;
+        surface->copyrect = &copyrect;
         surface->fillrect = &fillrect8;
         surface->putpixel = &putpixel8;
         surface->putchar = &putchar8;
@@ -681,7 +649,7 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
         break;
     case MX_PIXEL_FORMAT_RGB_2220:
         surface->translate_color = &ARGB8888_to_RGB2220;
-        surface->copyrect = &copyrect8;
+        surface->copyrect = &copyrect;
         surface->fillrect = &fillrect8;
         surface->putpixel = &putpixel8;
         surface->putchar = &putchar8;
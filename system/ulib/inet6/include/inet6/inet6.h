@@ -130,7 +130,9 @@ char* ip6toa(char* _out, void* ip6addr);
 
 // provided by inet6.c
 void ip6_init(void* macaddr);
-void eth_recv(void* data, size_t len);
+// flags: what the interface checked of the packet
+#define ETH_RECV_CSUM_OK 1 // its UDP checksum is known good
+void eth_recv(void* data, size_t len, uint32_t flags);
 
 // provided by interface driver
 void* eth_get_buffer(size_t len);
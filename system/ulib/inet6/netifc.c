@@ -365,7 +365,8 @@ static int netifc_fifo_poll(void) {
         while (entries < NET_BUFFERS) {
             uint64_t entry_idx = state.head & (NET_BUFFERS - 1);
             entry = &rx_entries[entry_idx];
-            netifc_recv(&rx_map[entry->offset], entry->length);
+            netifc_recv(&rx_map[entry->offset], entry->length,
+                        (entry->flags & ETH_FIFO_RX_CSUM_OK) ? ETH_RECV_CSUM_OK : 0);
             // requeue entry
             // TODO: batch these up
             entry->length = NET_BUFFERSZ;
@@ -412,7 +413,7 @@ int netifc_poll(void) {
                 continue;
             }
 #endif
-            netifc_recv(buffer, r);
+            netifc_recv(buffer, r, 0);
         }
         if (errno == ENOTCONN) {
             return -1;
@@ -38,3 +38,18 @@ gpt_partition_t** sort_partitions(gpt_partition_t** parts,
 
 size_t find_available_space(gpt_device_t* device, size_t blocks_req,
                             size_t block_count, size_t block_size);
+
+typedef struct install_stream_stats {
+    // compressed bytes read and image bytes written
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    // SHA-256 of the image as written
+    uint8_t sha256[32];
+} install_stream_stats_t;
+
+// Decompresses the LZ4 frame read from src onto the block device dest,
+// from its start.  Reading, decompressing, hashing and writing each run on
+// a thread of their own, and the image is written through the device's
+// block fifo in large requests.  Returns ERR_NOT_SUPPORTED, having read
+// nothing, if dest has no block fifo.
+mx_status_t write_lz4_stream(int src, int dest, install_stream_stats_t* stats);
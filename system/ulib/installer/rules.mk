@@ -8,8 +8,10 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_TYPE := userlib
 
-MODULE_SRCS += $(LOCAL_DIR)/lib-installer.c
+MODULE_SRCS += \
+    $(LOCAL_DIR)/lib-installer.c \
+    $(LOCAL_DIR)/stream.c
 
-MODULE_STATIC_LIBS := ulib/gpt
+MODULE_STATIC_LIBS := ulib/gpt ulib/cryptolib ulib/lz4
 
 include make/module.mk
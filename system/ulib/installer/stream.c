@@ -0,0 +1,562 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <lib/crypto/cryptolib.h>
+#include <lz4/lz4frame.h>
+#include <magenta/compiler.h>
+#include <magenta/device/block.h>
+#include <magenta/syscalls.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <installer/lib-installer.h>
+
+/*
+ * The image moves through the pipeline in two kinds of buffer. Compressed
+ * input is read into IN_BUFS buffers of IN_SIZE, which the decompressor
+ * takes in turn. It decompresses into OUT_BUFS slices of OUT_SIZE, which
+ * share one VMO so that the block device can write them straight out of it
+ * from its fifo. Each full slice goes both to the hasher and to the
+ * writer, and is reused once both are done with it.
+ */
+#define IN_BUFS 4
+#define IN_SIZE (256 * 1024)
+#define OUT_BUFS 8
+#define OUT_SIZE (1024 * 1024)
+// each request to the device, as big as the devhost will pass on whole
+#define TXN_SIZE (64 * 1024)
+#define TXNS_PER_OUT (OUT_SIZE / TXN_SIZE)
+// room in the fifo for every slice to be in flight at once
+#define FIFO_ENTRIES (OUT_BUFS * TXNS_PER_OUT)
+
+// the writer is woken to queue more slices with this, on its event
+#define SIGNAL_WORK MX_USER_SIGNAL_0
+
+// A ring of buffer indices, under the stream lock.
+typedef struct {
+    uint32_t idx[OUT_BUFS];
+    uint32_t head;
+    uint32_t tail;
+} buf_queue_t;
+
+typedef struct {
+    int src;
+    int dest;
+    uint64_t dev_size;
+    uint64_t block_size;
+
+    // everything below is under lock; cond is signaled on any change
+    mtx_t lock;
+    cnd_t cond;
+    // the first error anywhere, which stops every thread
+    mx_status_t status;
+
+    uint8_t* in[IN_BUFS];
+    size_t in_len[IN_BUFS];
+    buf_queue_t in_free;
+    buf_queue_t in_full;
+    // no more input will be queued after what is in in_full
+    bool in_eof;
+
+    uintptr_t out;
+    mx_handle_t out_vmo;
+    // bytes of each slice that are image, and where they go on the device
+    size_t out_len[OUT_BUFS];
+    uint64_t out_offset[OUT_BUFS];
+    // the hasher and the writer each hold a reference while busy with it
+    uint32_t out_refs[OUT_BUFS];
+    buf_queue_t out_free;
+    buf_queue_t to_hash;
+    buf_queue_t to_write;
+    // no more slices will be queued after those already queued
+    bool out_eof;
+
+    // the writer waits on this and the response fifo together
+    mx_handle_t writer_event;
+    block_fifo_t fifo;
+    uintptr_t fifo_entries;
+    uint64_t fifo_entries_size;
+
+    clSHA256_CTX sha;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} stream_t;
+
+static void queue_push(buf_queue_t* q, uint32_t idx) {
+    q->idx[q->head++ % OUT_BUFS] = idx;
+}
+
+static bool queue_empty(const buf_queue_t* q) {
+    return q->head == q->tail;
+}
+
+static uint32_t queue_pop(buf_queue_t* q) {
+    return q->idx[q->tail++ % OUT_BUFS];
+}
+
+static void stream_fail(stream_t* s, mx_status_t status) {
+    mtx_lock(&s->lock);
+    if (s->status == NO_ERROR) {
+        s->status = status;
+    }
+    cnd_broadcast(&s->cond);
+    mtx_unlock(&s->lock);
+    mx_object_signal(s->writer_event, 0, SIGNAL_WORK);
+}
+
+// Called with the lock held, once the hasher or the writer is done with a slice.
+static void out_release_locked(stream_t* s, uint32_t idx) {
+    if (--s->out_refs[idx] == 0) {
+        queue_push(&s->out_free, idx);
+        cnd_broadcast(&s->cond);
+    }
+}
+
+static int reader_thread(void* arg) {
+    stream_t* s = arg;
+    for (;;) {
+        mtx_lock(&s->lock);
+        while (queue_empty(&s->in_free) && (s->status == NO_ERROR)) {
+            cnd_wait(&s->cond, &s->lock);
+        }
+        if (s->status != NO_ERROR) {
+            mtx_unlock(&s->lock);
+            return 0;
+        }
+        uint32_t idx = queue_pop(&s->in_free);
+        mtx_unlock(&s->lock);
+
+        ssize_t r = read(s->src, s->in[idx], IN_SIZE);
+        if (r < 0) {
+            fprintf(stderr, "Error reading disk image: %s\n", strerror(errno));
+            stream_fail(s, ERR_IO);
+            return 0;
+        }
+
+        mtx_lock(&s->lock);
+        if (r == 0) {
+            queue_push(&s->in_free, idx);
+            s->in_eof = true;
+        } else {
+            s->in_len[idx] = r;
+            s->bytes_read += r;
+            queue_push(&s->in_full, idx);
+        }
+        cnd_broadcast(&s->cond);
+        mtx_unlock(&s->lock);
+        if (r == 0) {
+            return 0;
+        }
+    }
+}
+
+static int hasher_thread(void* arg) {
+    stream_t* s = arg;
+    mtx_lock(&s->lock);
+    for (;;) {
+        while (queue_empty(&s->to_hash) && !s->out_eof && (s->status == NO_ERROR)) {
+            cnd_wait(&s->cond, &s->lock);
+        }
+        if ((s->status != NO_ERROR) || queue_empty(&s->to_hash)) {
+            break;
+        }
+        uint32_t idx = queue_pop(&s->to_hash);
+        mtx_unlock(&s->lock);
+
+        clHASH_update(&s->sha, (const uint8_t*)s->out + idx * OUT_SIZE, (int)s->out_len[idx]);
+
+        mtx_lock(&s->lock);
+        out_release_locked(s, idx);
+    }
+    mtx_unlock(&s->lock);
+    return 0;
+}
+
+// Queues the writes of slice idx to the fifo, which always has room for them.
+static mx_status_t writer_queue(stream_t* s, uint32_t idx, uint64_t* head) {
+    block_fifo_request_t* reqs = (block_fifo_request_t*)s->fifo_entries;
+    size_t len = s->out_len[idx];
+    // the device takes whole blocks; the slice past the image is zeroed
+    len = ((len + s->block_size - 1) / s->block_size) * s->block_size;
+    uint32_t n = 0;
+    for (size_t off = 0; off < len; off += TXN_SIZE, n++) {
+        block_fifo_request_t* req = &reqs[(*head + n) & (s->fifo.entries_count - 1)];
+        memset(req, 0, sizeof(*req));
+        req->txn.opcode = BLOCK_TXN_OP_WRITE;
+        req->txn.vmo_offset = idx * OUT_SIZE + off;
+        req->txn.dev_offset = s->out_offset[idx] + off;
+        req->txn.length = (len - off < TXN_SIZE) ? len - off : TXN_SIZE;
+        // the last request of each slice says which slice is done
+        req->cookie = (off + TXN_SIZE >= len) ? idx : UINT64_MAX;
+    }
+    mx_fifo_state_t state;
+    mx_status_t status = mx_fifo_op(s->fifo.req_fifo, MX_FIFO_OP_ADVANCE_HEAD, n, &state);
+    *head += n;
+    return status;
+}
+
+// Takes in the responses there are, releasing the slices whose writes are
+// done.  Requests complete in the order they were queued.
+static mx_status_t writer_reap(stream_t* s, uint32_t* inflight) {
+    const block_fifo_response_t* rsps =
+        (const block_fifo_response_t*)(s->fifo_entries + s->fifo.rsp_offset);
+    mx_fifo_state_t state;
+    mx_status_t status;
+    if ((status = mx_fifo_op(s->fifo.rsp_fifo, MX_FIFO_OP_READ_STATE, 0, &state)) != NO_ERROR) {
+        return status;
+    }
+    uint64_t n = state.head - state.tail;
+    for (uint64_t i = 0; i < n; i++) {
+        const block_fifo_response_t* rsp =
+            &rsps[(state.tail + i) & (s->fifo.entries_count - 1)];
+        if (rsp->status != NO_ERROR) {
+            fprintf(stderr, "Error writing to partition, it may be corrupt: %d\n", rsp->status);
+            return rsp->status;
+        }
+        if (rsp->cookie != UINT64_MAX) {
+            uint32_t idx = (uint32_t)rsp->cookie;
+            mtx_lock(&s->lock);
+            s->bytes_written += s->out_len[idx];
+            out_release_locked(s, idx);
+            mtx_unlock(&s->lock);
+            (*inflight)--;
+        }
+    }
+    return mx_fifo_op(s->fifo.rsp_fifo, MX_FIFO_OP_ADVANCE_TAIL, n, &state);
+}
+
+static int writer_thread(void* arg) {
+    stream_t* s = arg;
+    mx_status_t status;
+    uint32_t inflight = 0;
+    mx_fifo_state_t state;
+    if ((status = mx_fifo_op(s->fifo.req_fifo, MX_FIFO_OP_READ_STATE, 0, &state)) != NO_ERROR) {
+        stream_fail(s, status);
+        return 0;
+    }
+    uint64_t head = state.head;
+
+    for (;;) {
+        // clear the wakeup before looking, so that none is missed
+        mx_object_signal(s->writer_event, SIGNAL_WORK, 0);
+        mtx_lock(&s->lock);
+        bool done = (s->status != NO_ERROR) ||
+                    (s->out_eof && queue_empty(&s->to_write) && (inflight == 0));
+        uint32_t batch[OUT_BUFS];
+        uint32_t count = 0;
+        while (!queue_empty(&s->to_write)) {
+            batch[count++] = queue_pop(&s->to_write);
+        }
+        mtx_unlock(&s->lock);
+        if (done) {
+            return 0;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            if ((status = writer_queue(s, batch[i], &head)) != NO_ERROR) {
+                stream_fail(s, status);
+                return 0;
+            }
+            inflight++;
+        }
+
+        mx_wait_item_t items[2] = {
+            { .handle = s->fifo.rsp_fifo, .waitfor = MX_FIFO_NOT_EMPTY },
+            { .handle = s->writer_event, .waitfor = SIGNAL_WORK },
+        };
+        if (inflight == 0) {
+            status = mx_handle_wait_one(s->writer_event, SIGNAL_WORK, MX_TIME_INFINITE, NULL);
+        } else {
+            status = mx_handle_wait_many(items, countof(items), MX_TIME_INFINITE);
+        }
+        if (status == NO_ERROR && (inflight > 0) && (items[0].pending & MX_FIFO_NOT_EMPTY)) {
+            status = writer_reap(s, &inflight);
+        }
+        if (status != NO_ERROR) {
+            stream_fail(s, status);
+            return 0;
+        }
+    }
+}
+
+// Hands a filled slice to the hasher and the writer.
+static mx_status_t out_queue(stream_t* s, uint32_t idx, size_t len, uint64_t offset) {
+    if (offset + len > s->dev_size) {
+        fprintf(stderr, "Disk image is larger than the partition\n");
+        return ERR_OUT_OF_RANGE;
+    }
+    // zero the tail of the last block
+    size_t end = ((len + s->block_size - 1) / s->block_size) * s->block_size;
+    memset((uint8_t*)s->out + idx * OUT_SIZE + len, 0, end - len);
+
+    mtx_lock(&s->lock);
+    s->out_len[idx] = len;
+    s->out_offset[idx] = offset;
+    s->out_refs[idx] = 2;
+    queue_push(&s->to_hash, idx);
+    queue_push(&s->to_write, idx);
+    cnd_broadcast(&s->cond);
+    mtx_unlock(&s->lock);
+    return mx_object_signal(s->writer_event, 0, SIGNAL_WORK);
+}
+
+// Runs on the calling thread, between the reader and the hasher and writer.
+static mx_status_t decompress(stream_t* s) {
+    LZ4F_decompressionContext_t dctx;
+    LZ4F_errorCode_t err = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(err)) {
+        fprintf(stderr, "Error creating decompression context: %s\n", LZ4F_getErrorName(err));
+        return ERR_INTERNAL;
+    }
+
+    mx_status_t status = NO_ERROR;
+    uint32_t out_idx = 0;
+    bool have_out = false;
+    size_t out_len = 0;
+    uint64_t offset = 0;
+    // zero once a frame is complete
+    size_t hint = 1;
+    uint64_t MB_10s = 0;
+    for (;;) {
+        mtx_lock(&s->lock);
+        while (queue_empty(&s->in_full) && !s->in_eof && (s->status == NO_ERROR)) {
+            cnd_wait(&s->cond, &s->lock);
+        }
+        if ((s->status != NO_ERROR) || queue_empty(&s->in_full)) {
+            status = s->status;
+            mtx_unlock(&s->lock);
+            break;
+        }
+        uint32_t in_idx = queue_pop(&s->in_full);
+        mtx_unlock(&s->lock);
+
+        const uint8_t* in = s->in[in_idx];
+        size_t in_len = s->in_len[in_idx];
+        while (in_len > 0) {
+            if (!have_out) {
+                mtx_lock(&s->lock);
+                while (queue_empty(&s->out_free) && (s->status == NO_ERROR)) {
+                    cnd_wait(&s->cond, &s->lock);
+                }
+                status = s->status;
+                if (status == NO_ERROR) {
+                    out_idx = queue_pop(&s->out_free);
+                    have_out = true;
+                    out_len = 0;
+                }
+                mtx_unlock(&s->lock);
+                if (status != NO_ERROR) {
+                    goto done;
+                }
+            }
+            size_t dst_len = OUT_SIZE - out_len;
+            size_t src_len = in_len;
+            hint = LZ4F_decompress(dctx, (uint8_t*)s->out + out_idx * OUT_SIZE + out_len,
+                                   &dst_len, in, &src_len, NULL);
+            if (LZ4F_isError(hint)) {
+                fprintf(stderr, "Error decompressing disk image: %s\n", LZ4F_getErrorName(hint));
+                status = ERR_IO;
+                goto done;
+            }
+            in += src_len;
+            in_len -= src_len;
+            out_len += dst_len;
+            if (out_len == OUT_SIZE) {
+                if ((status = out_queue(s, out_idx, out_len, offset)) != NO_ERROR) {
+                    goto done;
+                }
+                offset += out_len;
+                have_out = false;
+
+                mtx_lock(&s->lock);
+                uint64_t written = s->bytes_written / (10 * 1024 * 1024);
+                mtx_unlock(&s->lock);
+                if (written != MB_10s) {
+                    printf("   %" PRIu64 "0MB written.\r", written);
+                    fflush(stdout);
+                    MB_10s = written;
+                }
+            }
+        }
+
+        mtx_lock(&s->lock);
+        queue_push(&s->in_free, in_idx);
+        cnd_broadcast(&s->cond);
+        mtx_unlock(&s->lock);
+    }
+    if ((status == NO_ERROR) && (hint != 0)) {
+        fprintf(stderr, "Disk image is truncated\n");
+        status = ERR_IO;
+    }
+    if ((status == NO_ERROR) && have_out && (out_len > 0)) {
+        status = out_queue(s, out_idx, out_len, offset);
+        have_out = false;
+    }
+
+done:
+    if (have_out) {
+        mtx_lock(&s->lock);
+        queue_push(&s->out_free, out_idx);
+        mtx_unlock(&s->lock);
+    }
+    LZ4F_freeDecompressionContext(dctx);
+    return status;
+}
+
+// Sets up the block fifo of s->dest, writing from the slices' VMO.
+static mx_status_t fifo_setup(stream_t* s) {
+    block_get_fifo_args_t args = { .entries_count = FIFO_ENTRIES };
+    ssize_t r;
+    if ((r = ioctl_block_get_fifo(s->dest, &args, &s->fifo)) != sizeof(s->fifo)) {
+        s->fifo.entries_vmo = MX_HANDLE_INVALID;
+        return ERR_NOT_SUPPORTED;
+    }
+    mx_status_t status;
+    if ((status = mx_vmo_get_size(s->fifo.entries_vmo, &s->fifo_entries_size)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = mx_vmar_map(mx_vmar_root_self(), 0, s->fifo.entries_vmo, 0,
+                              s->fifo_entries_size,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                              &s->fifo_entries)) != NO_ERROR) {
+        s->fifo_entries = 0;
+        return status;
+    }
+    mx_handle_t dup;
+    if ((status = mx_handle_duplicate(s->out_vmo, MX_RIGHT_SAME_RIGHTS, &dup)) != NO_ERROR) {
+        return status;
+    }
+    if ((r = ioctl_block_set_fifo_vmo(s->dest, &dup)) < 0) {
+        return (mx_status_t)r;
+    }
+    return NO_ERROR;
+}
+
+static mx_status_t stream_init(stream_t* s) {
+    ssize_t r;
+    if ((r = ioctl_block_get_blocksize(s->dest, &s->block_size)) < 0) {
+        return (mx_status_t)r;
+    }
+    if ((r = ioctl_block_get_size(s->dest, &s->dev_size)) < 0) {
+        return (mx_status_t)r;
+    }
+    if ((s->block_size == 0) || (TXN_SIZE % s->block_size)) {
+        fprintf(stderr, "Unsupported block size %" PRIu64 "\n", s->block_size);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    mtx_init(&s->lock, mtx_plain);
+    cnd_init(&s->cond);
+    for (uint32_t i = 0; i < IN_BUFS; i++) {
+        if ((s->in[i] = malloc(IN_SIZE)) == NULL) {
+            return ERR_NO_MEMORY;
+        }
+        queue_push(&s->in_free, i);
+    }
+    for (uint32_t i = 0; i < OUT_BUFS; i++) {
+        queue_push(&s->out_free, i);
+    }
+
+    mx_status_t status;
+    if ((status = mx_vmo_create(OUT_BUFS * OUT_SIZE, 0, &s->out_vmo)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = mx_vmar_map(mx_vmar_root_self(), 0, s->out_vmo, 0, OUT_BUFS * OUT_SIZE,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                              &s->out)) != NO_ERROR) {
+        s->out = 0;
+        return status;
+    }
+    if ((status = mx_event_create(0, &s->writer_event)) != NO_ERROR) {
+        return status;
+    }
+    clSHA256_init(&s->sha);
+    return fifo_setup(s);
+}
+
+static void stream_free(stream_t* s) {
+    for (uint32_t i = 0; i < IN_BUFS; i++) {
+        free(s->in[i]);
+    }
+    if (s->fifo_entries != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), s->fifo_entries, s->fifo_entries_size);
+    }
+    if (s->fifo.entries_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(s->fifo.entries_vmo);
+        mx_handle_close(s->fifo.req_fifo);
+        mx_handle_close(s->fifo.rsp_fifo);
+    }
+    if (s->out != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), s->out, OUT_BUFS * OUT_SIZE);
+    }
+    if (s->out_vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(s->out_vmo);
+    }
+    if (s->writer_event != MX_HANDLE_INVALID) {
+        mx_handle_close(s->writer_event);
+    }
+    free(s);
+}
+
+mx_status_t write_lz4_stream(int src, int dest, install_stream_stats_t* stats) {
+    stream_t* s = calloc(1, sizeof(stream_t));
+    if (s == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    s->src = src;
+    s->dest = dest;
+    s->out_vmo = MX_HANDLE_INVALID;
+    s->writer_event = MX_HANDLE_INVALID;
+    s->fifo.entries_vmo = MX_HANDLE_INVALID;
+
+    mx_status_t status = stream_init(s);
+    if (status != NO_ERROR) {
+        stream_free(s);
+        return status;
+    }
+
+    thrd_t threads[3];
+    int (*funcs[3])(void*) = { reader_thread, hasher_thread, writer_thread };
+    const char* names[3] = { "install-read", "install-hash", "install-write" };
+    uint32_t started = 0;
+    for (; started < countof(threads); started++) {
+        if (thrd_create_with_name(&threads[started], funcs[started], s,
+                                  names[started]) != thrd_success) {
+            status = ERR_NO_RESOURCES;
+            break;
+        }
+    }
+
+    if (status == NO_ERROR) {
+        status = decompress(s);
+    }
+    if (status != NO_ERROR) {
+        stream_fail(s, status);
+    } else {
+        mtx_lock(&s->lock);
+        s->out_eof = true;
+        cnd_broadcast(&s->cond);
+        mtx_unlock(&s->lock);
+        mx_object_signal(s->writer_event, 0, SIGNAL_WORK);
+    }
+    for (uint32_t i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    if (status == NO_ERROR) {
+        status = s->status;
+    }
+    if ((status == NO_ERROR) && (stats != NULL)) {
+        stats->bytes_read = s->bytes_read;
+        stats->bytes_written = s->bytes_written;
+        memcpy(stats->sha256, clHASH_final(&s->sha), sizeof(stats->sha256));
+    }
+    stream_free(s);
+    return status;
+}
@@ -134,6 +134,45 @@ mx_status_t launchpad_load_from_fd(launchpad_t* lp, int fd);
 mx_status_t launchpad_load_from_vmo(launchpad_t* lp, mx_handle_t vmo);
 
 
+// PROGRAM TEMPLATES
+// A template holds a program already prepared for loading, so that
+// launching the same program many times doesn't repeat the work of
+// reading its ELF headers and looking up its PT_INTERP through the
+// loader service.  The template keeps the VM objects of the program,
+// its dynamic linker and the vDSO, which each new process maps its
+// read-only segments from and makes copy-on-write clones of for its
+// writable segments.
+// A template is never changed once created, so it can be used by many
+// threads at once.
+// -------------------------------------------------------------------
+
+typedef struct launchpad_template launchpad_template_t;
+
+// Prepare the ELF PIE binary in a VM object for loading.  This
+// consumes the VM object.  If the binary has a PT_INTERP, the dynamic
+// linker is looked up once, here, through a loader service of the
+// calling process's own.  The vDSO is the one launchpad_get_vdso_vmo
+// returns at the time of the call.  As with launchpad_elf_load, a
+// negative 'vmo' argument is just returned as the error.
+mx_status_t launchpad_template_create(mx_handle_t vmo,
+                                      launchpad_template_t** result);
+
+// Prepare the ELF PIE binary at path for loading.
+mx_status_t launchpad_template_create_from_file(const char* path,
+                                                launchpad_template_t** result);
+
+// Free a template.  Launchpads loaded from it are not affected.
+void launchpad_template_destroy(launchpad_template_t* tmpl);
+
+// Load the program prepared in a template, as launchpad_load_from_vmo
+// would load the VM object the template was created from: this maps
+// the program or its dynamic linker, passes the program's VM object to
+// the dynamic linker, and loads and adds the vDSO.  The template is
+// not consumed.
+mx_status_t launchpad_load_from_template(launchpad_t* lp,
+                                         launchpad_template_t* tmpl);
+
+
 // ADDING ARGUMENTS, ENVIRONMENT, AND HANDLES
 // These functions setup arguments, environment, or handles to be
 // passed to the new process via the processargs protocol.
@@ -442,6 +442,14 @@ static mx_status_t setup_loader_svc(launchpad_t* lp) {
     return NO_ERROR;
 }
 
+// Passes the executable's 'vmo' to the dynamic linker loaded in its place.
+static void set_exec_vmo(launchpad_t* lp, mx_handle_t vmo) {
+    if (lp->special_handles[HND_EXEC_VMO] != MX_HANDLE_INVALID)
+        mx_handle_close(lp->special_handles[HND_EXEC_VMO]);
+    lp->special_handles[HND_EXEC_VMO] = vmo;
+    lp->loader_message = true;
+}
+
 // Consumes 'vmo' on success, not on failure.
 static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
                                  const char* interp, size_t interp_len) {
@@ -464,12 +472,8 @@ static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
     }
     mx_handle_close(interp_vmo);
 
-    if (status == NO_ERROR) {
-        if (lp->special_handles[HND_EXEC_VMO] != MX_HANDLE_INVALID)
-            mx_handle_close(lp->special_handles[HND_EXEC_VMO]);
-        lp->special_handles[HND_EXEC_VMO] = vmo;
-        lp->loader_message = true;
-    }
+    if (status == NO_ERROR)
+        set_exec_vmo(lp, vmo);
 
     return status;
 }
@@ -988,3 +992,144 @@ mx_status_t launchpad_load_from_fd(launchpad_t* lp, int fd) {
 mx_status_t launchpad_load_from_vmo(launchpad_t* lp, mx_handle_t vmo) {
     return launchpad_elf_load_with_vdso(lp, vmo);
 }
+
+struct launchpad_template {
+    mx_handle_t vmo;
+    elf_load_info_t* elf;
+    // The dynamic linker, if the program has a PT_INTERP.
+    mx_handle_t interp_vmo;
+    elf_load_info_t* interp_elf;
+    mx_handle_t vdso_vmo;
+    elf_load_info_t* vdso_elf;
+    size_t stack_size;
+};
+
+void launchpad_template_destroy(launchpad_template_t* tmpl) {
+    if (tmpl == NULL)
+        return;
+    if (tmpl->elf != NULL)
+        elf_load_destroy(tmpl->elf);
+    if (tmpl->interp_elf != NULL)
+        elf_load_destroy(tmpl->interp_elf);
+    if (tmpl->vdso_elf != NULL)
+        elf_load_destroy(tmpl->vdso_elf);
+    mx_handle_t handles[] = { tmpl->vmo, tmpl->interp_vmo, tmpl->vdso_vmo };
+    close_handles(handles, sizeof(handles) / sizeof(handles[0]));
+    free(tmpl);
+}
+
+static mx_status_t template_find_interp(launchpad_template_t* tmpl) {
+    char* interp;
+    size_t interp_len;
+    mx_status_t status = elf_load_get_interp(tmpl->elf, tmpl->vmo,
+                                             &interp, &interp_len);
+    if (status != NO_ERROR || interp == NULL)
+        return status;
+
+    mx_handle_t loader_svc = mxio_loader_service(NULL, NULL);
+    if (loader_svc < 0) {
+        free(interp);
+        return loader_svc;
+    }
+    mx_handle_t interp_vmo = loader_svc_rpc(
+        loader_svc, LOADER_SVC_OP_LOAD_OBJECT, interp, interp_len);
+    mx_handle_close(loader_svc);
+    free(interp);
+    if (interp_vmo < 0)
+        return interp_vmo;
+
+    tmpl->interp_vmo = interp_vmo;
+    return elf_load_start(interp_vmo, &tmpl->interp_elf);
+}
+
+mx_status_t launchpad_template_create(mx_handle_t vmo,
+                                      launchpad_template_t** result) {
+    if (vmo < 0)
+        return vmo;
+    if (vmo == MX_HANDLE_INVALID)
+        return ERR_INVALID_ARGS;
+
+    launchpad_template_t* tmpl = calloc(1, sizeof(*tmpl));
+    if (tmpl == NULL) {
+        mx_handle_close(vmo);
+        return ERR_NO_MEMORY;
+    }
+    tmpl->vmo = vmo;
+
+    mx_status_t status = elf_load_start(vmo, &tmpl->elf);
+    if (status == NO_ERROR) {
+        tmpl->stack_size = elf_load_get_stack_size(tmpl->elf);
+        status = template_find_interp(tmpl);
+    }
+    if (status == NO_ERROR) {
+        mx_handle_t vdso = launchpad_get_vdso_vmo();
+        if (vdso < 0) {
+            status = vdso;
+        } else {
+            tmpl->vdso_vmo = vdso;
+            status = elf_load_start(vdso, &tmpl->vdso_elf);
+        }
+    }
+
+    if (status != NO_ERROR) {
+        launchpad_template_destroy(tmpl);
+        return status;
+    }
+    *result = tmpl;
+    return NO_ERROR;
+}
+
+mx_status_t launchpad_template_create_from_file(const char* path,
+                                                launchpad_template_t** result) {
+    return launchpad_template_create(launchpad_vmo_from_file(path), result);
+}
+
+mx_status_t launchpad_load_from_template(launchpad_t* lp,
+                                         launchpad_template_t* tmpl) {
+    if (lp->error)
+        return lp->error;
+
+    mx_status_t status;
+    if (tmpl->interp_elf == NULL) {
+        status = elf_load_finish(lp_vmar(lp), tmpl->elf, tmpl->vmo,
+                                 &lp->base, &lp->entry);
+        if (status != NO_ERROR)
+            return lp_error(lp, status,
+                            "load_from_template: elf_load_finish() failed");
+        lp->loader_message = false;
+    } else {
+        status = setup_loader_svc(lp);
+        if (status != NO_ERROR)
+            return lp_error(lp, status,
+                            "load_from_template: no loader service");
+        status = elf_load_finish(lp_vmar(lp), tmpl->interp_elf,
+                                 tmpl->interp_vmo, &lp->base, &lp->entry);
+        if (status != NO_ERROR)
+            return lp_error(lp, status,
+                            "load_from_template: elf_load_finish() failed for PT_INTERP");
+        mx_handle_t vmo;
+        status = mx_handle_duplicate(tmpl->vmo, MX_RIGHT_SAME_RIGHTS, &vmo);
+        if (status != NO_ERROR)
+            return lp_error(lp, status,
+                            "load_from_template: mx_handle_duplicate() failed");
+        set_exec_vmo(lp, vmo);
+    }
+    if (tmpl->stack_size > 0)
+        launchpad_set_stack_size(lp, tmpl->stack_size);
+
+    status = elf_load_finish(lp_vmar(lp), tmpl->vdso_elf, tmpl->vdso_vmo,
+                             &lp->vdso_base, NULL);
+    if (status != NO_ERROR)
+        return lp_error(lp, status,
+                        "load_from_template: elf_load_finish() failed for vDSO");
+    mx_handle_t vdso;
+    status = mx_handle_duplicate(tmpl->vdso_vmo, MX_RIGHT_SAME_RIGHTS, &vdso);
+    if (status != NO_ERROR)
+        return lp_error(lp, status,
+                        "load_from_template: mx_handle_duplicate() failed for vDSO");
+    status = launchpad_add_handle(lp, vdso,
+                                  MX_HND_INFO(MX_HND_TYPE_VDSO_VMO, 0));
+    if (status != NO_ERROR)
+        mx_handle_close(vdso);
+    return status;
+}
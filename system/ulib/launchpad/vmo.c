@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <magenta/syscalls.h>
+#include <mxio/io.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -41,6 +42,16 @@ static ssize_t my_pread (int fd, void* buf, size_t nbytes, off_t offset) {
 mx_handle_t launchpad_vmo_from_fd(int fd) {
     mx_handle_t current_vmar_handle = mx_vmar_root_self();
 
+    // If the file can hand us a VMO with its contents at the start,
+    // there is no need to copy it.
+    mx_handle_t file_vmo;
+    size_t file_off, file_len;
+    if (mxio_get_vmo(fd, &file_vmo, &file_off, &file_len) == NO_ERROR) {
+        if (file_off == 0)
+            return file_vmo;
+        mx_handle_close(file_vmo);
+    }
+
     struct stat st;
     if (fstat(fd, &st) < 0)
         return ERR_IO;
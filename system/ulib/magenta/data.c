@@ -14,4 +14,7 @@ const struct vdso_constants DATA_CONSTANTS = {
     0xdeadbeef,
     0,
     0,
+    0,
+    0,
+    0,
 };
@@ -1,4 +1,4 @@
-// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Copyright 2026 The Fuchsia Authors. All rights reserved.
 // This is a GENERATED file. The license governing this file can be found in the LICENSE file.
 
 #define MX_SYS_time_get 0
@@ -23,99 +23,113 @@
 #define MX_SYS_channel_create 19
 #define MX_SYS_channel_read 20
 #define MX_SYS_channel_write 21
-#define MX_SYS_channel_call 22
-#define MX_SYS_socket_create 23
-#define MX_SYS_socket_write 24
-#define MX_SYS_socket_read 25
-#define MX_SYS_thread_exit 26
-#define MX_SYS_thread_create 27
-#define MX_SYS_thread_start 28
-#define MX_SYS_thread_read_state 29
-#define MX_SYS_thread_write_state 30
-#define MX_SYS_process_exit 31
-#define MX_SYS_process_create 32
-#define MX_SYS_process_start 33
-#define MX_SYS_process_read_memory 34
-#define MX_SYS_process_write_memory 35
-#define MX_SYS_job_create 36
-#define MX_SYS_task_resume 37
-#define MX_SYS_task_kill 38
-#define MX_SYS_event_create 39
-#define MX_SYS_eventpair_create 40
-#define MX_SYS_futex_wait 41
-#define MX_SYS_futex_wake 42
-#define MX_SYS_futex_requeue 43
-#define MX_SYS_waitset_create 44
-#define MX_SYS_waitset_add 45
-#define MX_SYS_waitset_remove 46
-#define MX_SYS_waitset_wait 47
-#define MX_SYS_port_create 48
-#define MX_SYS_port_queue 49
-#define MX_SYS_port_wait 50
-#define MX_SYS_port_bind 51
-#define MX_SYS_vmo_create 52
-#define MX_SYS_vmo_read 53
-#define MX_SYS_vmo_write 54
-#define MX_SYS_vmo_get_size 55
-#define MX_SYS_vmo_set_size 56
-#define MX_SYS_vmo_op_range 57
-#define MX_SYS_cprng_draw 58
-#define MX_SYS_cprng_add_entropy 59
-#define MX_SYS_fifo_create 60
-#define MX_SYS_fifo_op 61
-#define MX_SYS_log_create 62
-#define MX_SYS_log_write 63
-#define MX_SYS_log_read 64
-#define MX_SYS_ktrace_read 65
-#define MX_SYS_ktrace_control 66
-#define MX_SYS_ktrace_write 67
-#define MX_SYS_debug_transfer_handle 68
-#define MX_SYS_debug_read 69
-#define MX_SYS_debug_write 70
-#define MX_SYS_debug_send_command 71
-#define MX_SYS_interrupt_create 72
-#define MX_SYS_interrupt_complete 73
-#define MX_SYS_interrupt_wait 74
-#define MX_SYS_mmap_device_io 75
-#define MX_SYS_mmap_device_memory 76
-#define MX_SYS_io_mapping_get_info 77
-#define MX_SYS_vmo_create_contiguous 78
-#define MX_SYS_vmar_allocate 79
-#define MX_SYS_vmar_destroy 80
-#define MX_SYS_vmar_map 81
-#define MX_SYS_vmar_unmap 82
-#define MX_SYS_vmar_protect 83
-#define MX_SYS_bootloader_fb_get_info 84
-#define MX_SYS_set_framebuffer 85
-#define MX_SYS_clock_adjust 86
-#define MX_SYS_pci_get_nth_device 87
-#define MX_SYS_pci_claim_device 88
-#define MX_SYS_pci_enable_bus_master 89
-#define MX_SYS_pci_enable_pio 90
-#define MX_SYS_pci_reset_device 91
-#define MX_SYS_pci_map_mmio 92
-#define MX_SYS_pci_io_write 93
-#define MX_SYS_pci_io_read 94
-#define MX_SYS_pci_map_interrupt 95
-#define MX_SYS_pci_map_config 96
-#define MX_SYS_pci_query_irq_mode_caps 97
-#define MX_SYS_pci_set_irq_mode 98
-#define MX_SYS_pci_init 99
-#define MX_SYS_pci_add_subtract_io_range 100
-#define MX_SYS_acpi_uefi_rsdp 101
-#define MX_SYS_acpi_cache_flush 102
-#define MX_SYS_resource_create 103
-#define MX_SYS_resource_get_handle 104
-#define MX_SYS_resource_do_action 105
-#define MX_SYS_resource_connect 106
-#define MX_SYS_resource_accept 107
-#define MX_SYS_syscall_test_0 108
-#define MX_SYS_syscall_test_1 109
-#define MX_SYS_syscall_test_2 110
-#define MX_SYS_syscall_test_3 111
-#define MX_SYS_syscall_test_4 112
-#define MX_SYS_syscall_test_5 113
-#define MX_SYS_syscall_test_6 114
-#define MX_SYS_syscall_test_7 115
-#define MX_SYS_syscall_test_8 116
+#define MX_SYS_channel_read_many 22
+#define MX_SYS_channel_write_many 23
+#define MX_SYS_channel_call 24
+#define MX_SYS_socket_create 25
+#define MX_SYS_socket_write 26
+#define MX_SYS_socket_read 27
+#define MX_SYS_socket_get_ring 28
+#define MX_SYS_thread_exit 29
+#define MX_SYS_thread_create 30
+#define MX_SYS_thread_start 31
+#define MX_SYS_thread_read_state 32
+#define MX_SYS_thread_write_state 33
+#define MX_SYS_thread_set_deadline 34
+#define MX_SYS_process_exit 35
+#define MX_SYS_process_create 36
+#define MX_SYS_process_start 37
+#define MX_SYS_process_read_memory 38
+#define MX_SYS_process_write_memory 39
+#define MX_SYS_job_create 40
+#define MX_SYS_job_set_cpu_limits 41
+#define MX_SYS_job_set_memory_limits 42
+#define MX_SYS_task_resume 43
+#define MX_SYS_task_kill 44
+#define MX_SYS_event_create 45
+#define MX_SYS_eventpair_create 46
+#define MX_SYS_futex_wait 47
+#define MX_SYS_futex_wait_pi 48
+#define MX_SYS_futex_wake 49
+#define MX_SYS_futex_requeue 50
+#define MX_SYS_waitset_create 51
+#define MX_SYS_waitset_add 52
+#define MX_SYS_waitset_remove 53
+#define MX_SYS_waitset_wait 54
+#define MX_SYS_port_create 55
+#define MX_SYS_port_queue 56
+#define MX_SYS_port_wait 57
+#define MX_SYS_port_wait_many 58
+#define MX_SYS_port_bind 59
+#define MX_SYS_batch_submit 60
+#define MX_SYS_vmo_create 61
+#define MX_SYS_vmo_read 62
+#define MX_SYS_vmo_write 63
+#define MX_SYS_vmo_get_size 64
+#define MX_SYS_vmo_set_size 65
+#define MX_SYS_vmo_op_range 66
+#define MX_SYS_vmo_clone 67
+#define MX_SYS_vmo_move_pages 68
+#define MX_SYS_cprng_draw 69
+#define MX_SYS_cprng_add_entropy 70
+#define MX_SYS_fifo_create 71
+#define MX_SYS_fifo_op 72
+#define MX_SYS_fifo_get_state_vmo 73
+#define MX_SYS_log_create 74
+#define MX_SYS_log_write 75
+#define MX_SYS_log_read 76
+#define MX_SYS_ktrace_read 77
+#define MX_SYS_ktrace_control 78
+#define MX_SYS_ktrace_write 79
+#define MX_SYS_ktrace_stream_vmo 80
+#define MX_SYS_debug_transfer_handle 81
+#define MX_SYS_debug_read 82
+#define MX_SYS_debug_write 83
+#define MX_SYS_debug_send_command 84
+#define MX_SYS_interrupt_create 85
+#define MX_SYS_interrupt_complete 86
+#define MX_SYS_interrupt_wait 87
+#define MX_SYS_interrupt_set_affinity 88
+#define MX_SYS_mmap_device_io 89
+#define MX_SYS_mmap_device_memory 90
+#define MX_SYS_io_mapping_get_info 91
+#define MX_SYS_vmo_create_contiguous 92
+#define MX_SYS_vmar_allocate 93
+#define MX_SYS_vmar_destroy 94
+#define MX_SYS_vmar_map 95
+#define MX_SYS_vmar_unmap 96
+#define MX_SYS_vmar_protect 97
+#define MX_SYS_bootloader_fb_get_info 98
+#define MX_SYS_set_framebuffer 99
+#define MX_SYS_clock_adjust 100
+#define MX_SYS_pci_get_nth_device 101
+#define MX_SYS_pci_claim_device 102
+#define MX_SYS_pci_enable_bus_master 103
+#define MX_SYS_pci_enable_pio 104
+#define MX_SYS_pci_reset_device 105
+#define MX_SYS_pci_map_mmio 106
+#define MX_SYS_pci_io_write 107
+#define MX_SYS_pci_io_read 108
+#define MX_SYS_pci_map_interrupt 109
+#define MX_SYS_pci_map_config 110
+#define MX_SYS_pci_query_irq_mode_caps 111
+#define MX_SYS_pci_set_irq_mode 112
+#define MX_SYS_pci_init 113
+#define MX_SYS_pci_add_subtract_io_range 114
+#define MX_SYS_acpi_uefi_rsdp 115
+#define MX_SYS_acpi_cache_flush 116
+#define MX_SYS_resource_create 117
+#define MX_SYS_resource_get_handle 118
+#define MX_SYS_resource_do_action 119
+#define MX_SYS_resource_connect 120
+#define MX_SYS_resource_accept 121
+#define MX_SYS_syscall_test_0 122
+#define MX_SYS_syscall_test_1 123
+#define MX_SYS_syscall_test_2 124
+#define MX_SYS_syscall_test_3 125
+#define MX_SYS_syscall_test_4 126
+#define MX_SYS_syscall_test_5 127
+#define MX_SYS_syscall_test_6 128
+#define MX_SYS_syscall_test_7 129
+#define MX_SYS_syscall_test_8 130
 
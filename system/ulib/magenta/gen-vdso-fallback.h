@@ -0,0 +1,10 @@
+// Copyright 2026 The Fuchsia Authors. All rights reserved.
+// This is a GENERATED file. The license governing this file can be found in the LICENSE file.
+
+extern mx_time_t SYSCALL_mx_time_get(
+    uint32_t clock_id) __attribute__((visibility("hidden")));
+
+extern mx_time_t _SYSCALL_mx_time_get(
+    uint32_t clock_id) __attribute__((visibility("hidden")));
+
+
@@ -0,0 +1,22 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+
+#include <magenta/compiler.h>
+#include "private.h"
+
+mx_time_t _mx_time_get(uint32_t clock_id) {
+    if (clock_id == MX_CLOCK_MONOTONIC && DATA_CONSTANTS.monotonic_from_ticks) {
+        // Scale the ticks the same way the kernel does, in 32.64 fixed point
+        // rounded to the nearest nanosecond.
+        uint64_t ticks = vdso_read_ticks();
+        unsigned __int128 frac = (unsigned __int128)ticks * DATA_CONSTANTS.ns_per_tick_frac;
+        return ticks * DATA_CONSTANTS.ns_per_tick_int +
+            (uint64_t)((frac + ((unsigned __int128)1 << 63)) >> 64);
+    }
+    return SYSCALL_mx_time_get(clock_id);
+}
+
+__typeof(mx_time_get) mx_time_get __attribute__((weak, alias("_mx_time_get")));
@@ -4,8 +4,32 @@
 
 #pragma once
 
+#include <magenta/types.h>
+
 // This defines the struct shared with the kernel.
 #include <lib/vdso-constants.h>
 
 extern const struct vdso_constants DATA_CONSTANTS
     __attribute__((visibility("hidden")));
+
+// The syscalls behind "vdsofast" calls.
+#include "gen-vdso-fallback.h"
+
+static inline uint64_t vdso_read_ticks(void) {
+#if __aarch64__
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, pmccntr_el0" : "=r" (ticks));
+    return ticks;
+#elif __x86_64__
+    uint32_t ticks_low;
+    uint32_t ticks_high;
+    __asm__ volatile("rdtsc" : "=a" (ticks_low), "=d" (ticks_high));
+    return ((uint64_t)ticks_high << 32) | ticks_low;
+#elif __i386__
+    uint64_t ticks;
+    __asm__ volatile("rdtsc" : "=A" (ticks));
+    return ticks;
+#else
+#error Unsupported architecture
+#endif
+}
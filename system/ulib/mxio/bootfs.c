@@ -8,23 +8,15 @@
 #include <string.h>
 
 #include <magenta/bootdata.h>
+#include <magenta/bootfs.h>
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
 
 #define BOOTFS_MAX_NAME_LEN 256
 
-static const char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
-
-// BOOTFS is a trivial "filesystem" format
-//
-// It has a 16 byte magic/version value (FSMAGIC)
-// Followed by a series of records of:
-//   namelength (32bit le)
-//   filesize   (32bit le)
-//   fileoffset (32bit le)
-//   namedata   (namelength bytes, includes \0)
+// The format is described in <magenta/bootfs.h>.
 //
-// - fileoffsets must be page aligned (multiple of 4096)
+// The index is of no use here, where all the records are wanted.
 
 #define NLEN 0
 #define FSIZ 1
@@ -32,7 +24,7 @@ static const char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
 
 struct bootfs_magic {
     bootdata_t boothdr;
-    char fsmagic[16];
+    bootfs_header_t fshdr;
 };
 
 void bootfs_parse(mx_handle_t vmo, size_t len,
@@ -52,8 +44,8 @@ void bootfs_parse(mx_handle_t vmo, size_t len,
         return;
     }
 
-    // This field is obsolete, so skip if it doesn't match
-    if (!memcmp(boot_data.fsmagic, FSMAGIC, sizeof(FSMAGIC))) {
+    // Older images may lack the header, so skip it only if it matches
+    if (!memcmp(boot_data.fshdr.magic, BOOTFS_MAGIC, BOOTFS_MAGIC_LEN)) {
         off += sizeof(boot_data);
     } else {
         off += sizeof(boot_data.boothdr);
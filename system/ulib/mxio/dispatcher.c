@@ -15,91 +15,215 @@
 
 #define MXDEBUG 0
 
+// Handlers are named in port packets by their slot in the dispatcher's
+// handler table and a generation count, bumped each time the slot is
+// reused.  With several threads draining the port, one thread may pull
+// a packet for a handler just before another destroys it, so handlers
+// are recycled rather than freed, and packets naming an old generation
+// are dropped.
 typedef struct {
     list_node_t node;
     mx_handle_t h;
     uint32_t flags;
     void* cb;
     void* cookie;
+
+    uint32_t index;
+    uint32_t gen;
+
+    // Events waiting for the thread running this handler, if any.
+    // Guarded by the dispatcher's lock.
+    uint32_t pending_reads;
+    uint32_t pending;
 } handler_t;
 
 #define FLAG_DISCONNECTED 1
+#define FLAG_BUSY 2
+
+#define PENDING_PEER_CLOSED 1
+#define PENDING_DESTROY 2
+#define PENDING_CLOSE_CB 4
+
+#define HANDLER_KEY(handler) (((uint64_t)(handler)->index << 32) | (handler)->gen)
 
 struct mxio_dispatcher {
     mtx_t lock;
     list_node_t list;
+    list_node_t free_list;
+    handler_t** handlers;
+    uint32_t handler_count;
+    uint32_t handler_alloc;
     mx_handle_t ioport;
     mxio_dispatcher_cb_t cb;
-    thrd_t t;
+    bool started;
+    int threads;
 };
 
 static void mxio_dispatcher_destroy(mxio_dispatcher_t* md) {
     mx_handle_close(md->ioport);
+    for (uint32_t i = 0; i < md->handler_count; i++) {
+        free(md->handlers[i]);
+    }
+    free(md->handlers);
     free(md);
 }
 
+// called with the lock held
+static handler_t* lookup_handler(mxio_dispatcher_t* md, uint64_t key) {
+    uint32_t index = (uint32_t)(key >> 32);
+    if (index >= md->handler_count) {
+        return NULL;
+    }
+    handler_t* handler = md->handlers[index];
+    return handler->gen == (uint32_t)key ? handler : NULL;
+}
+
+// called with the lock held
+static handler_t* alloc_handler(mxio_dispatcher_t* md) {
+    handler_t* handler = list_remove_head_type(&md->free_list, handler_t, node);
+    if (handler != NULL) {
+        return handler;
+    }
+    if (md->handler_count == md->handler_alloc) {
+        uint32_t alloc = md->handler_alloc ? md->handler_alloc * 2 : 16;
+        handler_t** handlers = realloc(md->handlers, alloc * sizeof(handler_t*));
+        if (handlers == NULL) {
+            return NULL;
+        }
+        md->handlers = handlers;
+        md->handler_alloc = alloc;
+    }
+    if ((handler = calloc(1, sizeof(handler_t))) == NULL) {
+        return NULL;
+    }
+    handler->index = md->handler_count;
+    md->handlers[md->handler_count++] = handler;
+    return handler;
+}
+
 static void destroy_handler(mxio_dispatcher_t* md, handler_t* handler, bool need_close_cb) {
     if (need_close_cb) {
         md->cb(0, handler->cb, handler->cookie);
     }
     mtx_lock(&md->lock);
     list_delete(&handler->node);
+    handler->gen++;
+    handler->flags = 0;
+    list_add_head(&md->free_list, &handler->node);
     mtx_unlock(&md->lock);
-    free(handler);
 }
 
 static void disconnect_handler(mxio_dispatcher_t* md, handler_t* handler, bool need_close_cb) {
+    // flag so we know to ignore further events
+    mtx_lock(&md->lock);
+    handler->flags |= FLAG_DISCONNECTED;
+    handler->pending_reads = 0;
+    handler->pending &= ~PENDING_PEER_CLOSED;
+    mtx_unlock(&md->lock);
+
     // close handle, so we get no further messages
     mx_handle_close(handler->h);
 
     // send a synthetic message so we know when it's safe to destroy
     mx_io_packet_t packet;
-    packet.hdr.key = (uint64_t)(uintptr_t)handler;
+    packet.hdr.key = HANDLER_KEY(handler);
     packet.signals = need_close_cb ? MX_PORT_SIGNALED : 0;
     mx_port_queue(md->ioport, &packet, sizeof(packet));
+}
 
-    // flag so we know to ignore further events
-    handler->flags |= FLAG_DISCONNECTED;
+// Runs the events pending for a handler until there are none left.
+// Only one thread at a time does this for a given handler, the one
+// that set FLAG_BUSY, so each handler sees its messages in order.
+// Called with the lock held, and returns with it released.
+static void run_handler(mxio_dispatcher_t* md, handler_t* handler) {
+    for (;;) {
+        uint32_t pending = handler->pending;
+        bool read = !(pending & PENDING_DESTROY) && handler->pending_reads > 0;
+        if (pending & PENDING_DESTROY) {
+            handler->pending = 0;
+        } else if (read) {
+            handler->pending_reads--;
+        } else if (pending & PENDING_PEER_CLOSED) {
+            handler->pending &= ~PENDING_PEER_CLOSED;
+        } else {
+            handler->flags &= ~FLAG_BUSY;
+            mtx_unlock(&md->lock);
+            return;
+        }
+        mtx_unlock(&md->lock);
+
+        if (pending & PENDING_DESTROY) {
+            destroy_handler(md, handler, pending & PENDING_CLOSE_CB);
+            return;
+        }
+        if (read) {
+            mx_status_t r;
+            if ((r = md->cb(handler->h, handler->cb, handler->cookie)) != 0) {
+                if (r == ERR_DISPATCHER_NO_WORK) {
+                    printf("mxio: dispatcher found no work to do!\n");
+                } else {
+                    disconnect_handler(md, handler, r < 0);
+                }
+            }
+        } else {
+            // synthesize a close
+            disconnect_handler(md, handler, true);
+        }
+        mtx_lock(&md->lock);
+    }
 }
 
 static int mxio_dispatcher_thread(void* _md) {
     mxio_dispatcher_t* md = _md;
     mx_status_t r;
 
-again:
     for (;;) {
         mx_io_packet_t packet;
         if ((r = mx_port_wait(md->ioport, MX_TIME_INFINITE, &packet, sizeof(packet))) < 0) {
             printf("dispatcher: ioport wait failed %d\n", r);
             break;
         }
-        handler_t* handler = (void*)(uintptr_t)packet.hdr.key;
+        mtx_lock(&md->lock);
+        handler_t* handler = lookup_handler(md, packet.hdr.key);
+        if (handler == NULL) {
+            // a late event for a handler since destroyed
+            mtx_unlock(&md->lock);
+            continue;
+        }
         if (handler->flags & FLAG_DISCONNECTED) {
             // handler is awaiting gc
             // ignore events for it until we get the synthetic "destroy" event
             if (packet.hdr.type == MX_PORT_PKT_TYPE_USER) {
-                destroy_handler(md, handler, packet.signals & MX_PORT_SIGNALED);
-            }
-            continue;
-        }
-        if (packet.signals & MX_CHANNEL_READABLE) {
-            if ((r = md->cb(handler->h, handler->cb, handler->cookie)) != 0) {
-                if (r == ERR_DISPATCHER_NO_WORK) {
-                    printf("mxio: dispatcher found no work to do!\n");
-                } else {
-                    disconnect_handler(md, handler, r < 0);
-                    continue;
+                handler->pending |= PENDING_DESTROY;
+                if (packet.signals & MX_PORT_SIGNALED) {
+                    handler->pending |= PENDING_CLOSE_CB;
                 }
             }
+        } else {
+            if (packet.signals & MX_CHANNEL_READABLE) {
+                handler->pending_reads++;
+            }
+            if (packet.signals & MX_CHANNEL_PEER_CLOSED) {
+                handler->pending |= PENDING_PEER_CLOSED;
+            }
         }
-        if (packet.signals & MX_CHANNEL_PEER_CLOSED) {
-            // synthesize a close
-            disconnect_handler(md, handler, true);
+        if ((handler->pending_reads == 0 && handler->pending == 0) ||
+            (handler->flags & FLAG_BUSY)) {
+            // nothing to do, or the thread running the handler will do it
+            mtx_unlock(&md->lock);
+            continue;
         }
+        handler->flags |= FLAG_BUSY;
+        run_handler(md, handler);
     }
 
     printf("dispatcher: FATAL ERROR, EXITING\n");
-    mxio_dispatcher_destroy(md);
+    mtx_lock(&md->lock);
+    bool last = --md->threads == 0;
+    mtx_unlock(&md->lock);
+    if (last) {
+        mxio_dispatcher_destroy(md);
+    }
     return NO_ERROR;
 }
 
@@ -110,6 +234,7 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
     }
     xprintf("mxio_dispatcher_create: %p\n", md);
     list_initialize(&md->list);
+    list_initialize(&md->free_list);
     mtx_init(&md->lock, mtx_plain);
     mx_status_t status;
     if ((status = mx_port_create(0u, &md->ioport)) < 0) {
@@ -121,25 +246,41 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
     return NO_ERROR;
 }
 
-mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
-    mx_status_t r;
+mx_status_t mxio_dispatcher_start_threads(mxio_dispatcher_t* md, const char* name,
+                                          uint32_t count) {
+    if (count == 0) {
+        return ERR_INVALID_ARGS;
+    }
     mtx_lock(&md->lock);
-    if (md->t == NULL) {
-        if (thrd_create_with_name(&md->t, mxio_dispatcher_thread, md, name) != thrd_success) {
-            mxio_dispatcher_destroy(md);
-            r = ERR_NO_RESOURCES;
-        } else {
-            thrd_detach(md->t);
-            r = NO_ERROR;
+    if (md->started) {
+        mtx_unlock(&md->lock);
+        return ERR_BAD_STATE;
+    }
+    md->started = true;
+    uint32_t n;
+    for (n = 0; n < count; n++) {
+        thrd_t t;
+        if (thrd_create_with_name(&t, mxio_dispatcher_thread, md, name) != thrd_success) {
+            break;
         }
-    } else {
-        r = ERR_BAD_STATE;
+        thrd_detach(t);
+        md->threads++;
     }
     mtx_unlock(&md->lock);
-    return r;
+    if (n == 0) {
+        mxio_dispatcher_destroy(md);
+    }
+    return n == count ? NO_ERROR : ERR_NO_RESOURCES;
+}
+
+mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
+    return mxio_dispatcher_start_threads(md, name, 1);
 }
 
 void mxio_dispatcher_run(mxio_dispatcher_t* md) {
+    mtx_lock(&md->lock);
+    md->threads++;
+    mtx_unlock(&md->lock);
     mxio_dispatcher_thread(md);
 }
 
@@ -147,25 +288,29 @@ mx_status_t mxio_dispatcher_add(mxio_dispatcher_t* md, mx_handle_t h, void* cb,
     handler_t* handler;
     mx_status_t r;
 
-    if ((handler = malloc(sizeof(handler_t))) == NULL) {
+    mtx_lock(&md->lock);
+    if ((handler = alloc_handler(md)) == NULL) {
+        mtx_unlock(&md->lock);
         return ERR_NO_MEMORY;
     }
     handler->h = h;
     handler->flags = 0;
     handler->cb = cb;
     handler->cookie = cookie;
+    handler->pending_reads = 0;
+    handler->pending = 0;
 
-    mtx_lock(&md->lock);
     list_add_tail(&md->list, &handler->node);
-    if ((r = mx_port_bind(md->ioport, (uint64_t)(uintptr_t)handler, h,
+    if ((r = mx_port_bind(md->ioport, HANDLER_KEY(handler), h,
                              MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED)) < 0) {
         list_delete(&handler->node);
+        handler->gen++;
+        list_add_head(&md->free_list, &handler->node);
     }
     mtx_unlock(&md->lock);
 
     if (r < 0) {
         printf("dispatcher: failed to bind: %d\n", r);
-        free(handler);
     }
     return r;
 }
@@ -20,52 +20,48 @@
 // TODO: should use a system default
 #define MAX_WAIT_EVENTS 1024
 
-typedef struct mxio_epoll_cookie {
-    list_node_t node;
+// An epoll instance watches its descriptors through one edge-triggered
+// waitset, so each descriptor is registered once and a wait only hears
+// about descriptors whose signals were newly asserted.  Those go on a
+// ready list.  Level-triggered descriptors that have been reported stay
+// on it and are re-checked by the next wait, as Linux does, so the cost
+// of a wait follows the number of ready descriptors, not registered ones.
+//
+// Waitset cookies carry the fd and a generation count, so a wait that
+// races with EPOLL_CTL_MOD or EPOLL_CTL_DEL drops stale results instead
+// of following a freed entry.
+
+typedef struct mxio_epoll_entry {
+    list_node_t ready_node;
     mxio_t* io;
     struct epoll_event ep_event;
-    int fd;
-} mxio_epoll_cookie_t;
+    mx_handle_t h;
+    mx_signals_t signals;
+    uint32_t gen;
+    mx_signals_t observed;  // as reported by the waitset, if has_observed
+    bool has_observed;
+    bool disarmed;          // EPOLLONESHOT entry that has fired
+} mxio_epoll_entry_t;
 
 typedef struct mxio_epoll {
     mxio_t io;
     mx_handle_t h;
-    mtx_t cookies_lock;
-    list_node_t cookies;
+    mtx_t lock;
+    uint32_t gen;
+    list_node_t ready;
+    mxio_epoll_entry_t* entries[MAX_MXIO_FD];
 } mxio_epoll_t;
 
-static void mxio_epoll_cookie_add(mxio_epoll_t* epio,
-                                  mxio_epoll_cookie_t* cookie) {
-    mtx_lock(&epio->cookies_lock);
-    list_add_head(&epio->cookies, &cookie->node);
-    mtx_unlock(&epio->cookies_lock);
-}
+#define ENTRY_KEY(fd, gen) (((uint64_t)(fd) << 32) | (gen))
+#define KEY_FD(key) ((int)((key) >> 32))
+#define KEY_GEN(key) ((uint32_t)(key))
 
-static mxio_epoll_cookie_t* mxio_epoll_cookie_get(mxio_epoll_t* epio, int fd,
-                                                  bool remove) {
-    mxio_epoll_cookie_t* cookie = NULL;
-    mxio_epoll_cookie_t* entry = NULL;
-    mtx_lock(&epio->cookies_lock);
-    list_for_every_entry(&epio->cookies, entry, mxio_epoll_cookie_t, node) {
-        // doesn't have to be _safe as we break immediately after deletion
-        if (entry->fd == fd) {
-            if (remove) {
-                list_delete(&entry->node);
-            }
-            cookie = entry;
-            break;
-        }
+static void mxio_epoll_entry_free(mxio_epoll_entry_t* entry) {
+    if (list_in_list(&entry->ready_node)) {
+        list_delete(&entry->ready_node);
     }
-    mtx_unlock(&epio->cookies_lock);
-    return cookie;
-}
-
-static mxio_epoll_cookie_t* mxio_epoll_cookie_find(mxio_epoll_t* epio, int fd) {
-    return mxio_epoll_cookie_get(epio, fd, false);
-}
-
-static mxio_epoll_cookie_t* mxio_epoll_cookie_remove(mxio_epoll_t* epio, int fd) {
-    return mxio_epoll_cookie_get(epio, fd, true);
+    mxio_release(entry->io);
+    free(entry);
 }
 
 static mx_status_t mxio_epoll_close(mxio_t* io) {
@@ -74,20 +70,22 @@ static mx_status_t mxio_epoll_close(mxio_t* io) {
     epio->h = MX_HANDLE_INVALID;
     mx_handle_close(h);
 
-    mxio_epoll_cookie_t* cookie;
-    mtx_lock(&epio->cookies_lock);
-    while ((cookie = list_remove_head_type(&epio->cookies, mxio_epoll_cookie_t,
-                                           node))) {
-        mxio_release(cookie->io);
-        free(cookie);
+    mtx_lock(&epio->lock);
+    for (int fd = 0; fd < MAX_MXIO_FD; fd++) {
+        if (epio->entries[fd] != NULL) {
+            mxio_epoll_entry_free(epio->entries[fd]);
+            epio->entries[fd] = NULL;
+        }
     }
-    mtx_unlock(&epio->cookies_lock);
+    mtx_unlock(&epio->lock);
     return NO_ERROR;
 }
 
 static mxio_ops_t mxio_epoll_ops = {
     .read = mxio_default_read,
     .write = mxio_default_write,
+    .readv = mxio_default_readv,
+    .writev = mxio_default_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .seek = mxio_default_seek,
@@ -99,6 +97,7 @@ static mxio_ops_t mxio_epoll_ops = {
     .wait_begin = mxio_default_wait_begin,
     .wait_end = mxio_default_wait_end,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_epoll_create(mx_handle_t h) {
@@ -111,15 +110,15 @@ mxio_t* mxio_epoll_create(mx_handle_t h) {
     atomic_init(&epio->io.refcount, 1);
     epio->io.flags |= MXIO_FLAG_EPOLL;
     epio->h = h;
-    mtx_init(&epio->cookies_lock, mtx_plain);
-    list_initialize(&epio->cookies);
+    mtx_init(&epio->lock, mtx_plain);
+    list_initialize(&epio->ready);
     return &epio->io;
 }
 
 mx_status_t mxio_epoll(mxio_t** out) {
     mx_handle_t h;
     mx_status_t status;
-    if ((status = mx_waitset_create(0, &h)) < 0) {
+    if ((status = mx_waitset_create(MX_WAITSET_EDGE_TRIGGERED, &h)) < 0) {
         return status;
     }
     mxio_t* io;
@@ -175,35 +174,34 @@ int epoll_ctl(int epfd, int op, int fd, struct epoll_event* ep_event) {
         goto fail_no_io;
     }
 
-    mxio_epoll_cookie_t* cookie;
+    mtx_lock(&epio->lock);
+    mxio_epoll_entry_t* entry = epio->entries[fd];
     switch (op) {
     case EPOLL_CTL_ADD:
-        if (mxio_epoll_cookie_find(epio, fd) != NULL)  {
+        if (entry != NULL)  {
             r = ERR_ALREADY_EXISTS;
             goto end;
         }
-        // create a new cookie
-        cookie = calloc(1, sizeof(mxio_epoll_cookie_t));
-        if (cookie == NULL) {
+        // create a new entry
+        entry = calloc(1, sizeof(mxio_epoll_entry_t));
+        if (entry == NULL) {
             r = ERR_NO_MEMORY;
             goto end;
         }
         mxio_acquire(io);
-        cookie->io = io;
-        cookie->fd = fd;
+        entry->io = io;
         break;
     case EPOLL_CTL_MOD:
     case EPOLL_CTL_DEL:
-        // or retrieve an existing cookie and remove the current epoll event
-        cookie = mxio_epoll_cookie_remove(epio, fd);
-        if (cookie == NULL) {
+        // or take the existing entry out of the waitset
+        if (entry == NULL) {
             r = ERR_NOT_FOUND;
             goto end;
         }
-        if ((r = mx_waitset_remove(epio->h, (uint64_t)(uintptr_t)cookie)) < 0) {
-            mxio_epoll_cookie_add(epio, cookie);
+        if ((r = mx_waitset_remove(epio->h, ENTRY_KEY(fd, entry->gen))) < 0) {
             goto end;
         }
+        epio->entries[fd] = NULL;
         break;
     default:
         r = ERR_INVALID_ARGS;
@@ -211,30 +209,38 @@ int epoll_ctl(int epfd, int op, int fd, struct epoll_event* ep_event) {
     }
 
     if (op == EPOLL_CTL_DEL) {
-        // free the cookie
-        mxio_release(cookie->io);
-        free(cookie);
+        mxio_epoll_entry_free(entry);
     } else {
-        // or add a new epoll event and put the cookie into the list
+        // (re)register the entry with the waitset; if its signals are
+        // already asserted the waitset reports it straight away
         mx_handle_t h = MX_HANDLE_INVALID;
         mx_signals_t signals = 0;
         io->ops->wait_begin(io, ep_event->events, &h, &signals);
         if (h == MX_HANDLE_INVALID) {
             // wait operation is not applicable to the handle
+            mxio_epoll_entry_free(entry);
             r = ERR_INVALID_ARGS;
             goto end;
         }
 
-        cookie->ep_event = *ep_event;
-        if ((r = mx_waitset_add(epio->h, (uint64_t)(uintptr_t)cookie, h, signals)) < 0) {
-            mxio_release(cookie->io);
-            free(cookie);
+        if (list_in_list(&entry->ready_node)) {
+            list_delete(&entry->ready_node);
+        }
+        entry->ep_event = *ep_event;
+        entry->h = h;
+        entry->signals = signals;
+        entry->gen = ++epio->gen;
+        entry->has_observed = false;
+        entry->disarmed = false;
+        if ((r = mx_waitset_add(epio->h, ENTRY_KEY(fd, entry->gen), h, signals)) < 0) {
+            mxio_epoll_entry_free(entry);
             goto end;
         }
-        mxio_epoll_cookie_add(epio, cookie);
+        epio->entries[fd] = entry;
     }
 
  end:
+    mtx_unlock(&epio->lock);
     mxio_release(io);
  fail_no_io:
     mxio_release(&epio->io);
@@ -242,6 +248,66 @@ int epoll_ctl(int epfd, int op, int fd, struct epoll_event* ep_event) {
     return STATUS(r);
 }
 
+// Put the entries behind waitset results on the ready list.
+// Called with the epoll lock held.
+static void mxio_epoll_queue(mxio_epoll_t* epio, mx_waitset_result_t* results,
+                             uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        mxio_epoll_entry_t* entry = epio->entries[KEY_FD(results[i].cookie)];
+        if ((entry == NULL) || (entry->gen != KEY_GEN(results[i].cookie)) ||
+            (results[i].status != NO_ERROR) || entry->disarmed) {
+            // removed, modified, closed, or waiting to be re-armed
+            continue;
+        }
+        entry->observed = results[i].observed;
+        entry->has_observed = true;
+        if (!list_in_list(&entry->ready_node)) {
+            list_add_tail(&epio->ready, &entry->ready_node);
+        }
+    }
+}
+
+// Report events for the entries on the ready list, in turn.  Each one
+// visited leaves the head of the list, and level-triggered ones that are
+// still ready go back on the tail.  Called with the epoll lock held.
+static int mxio_epoll_report(mxio_epoll_t* epio, struct epoll_event* ep_events,
+                             int maxevents) {
+    int n = 0;
+    size_t count = list_length(&epio->ready);
+    while ((count-- > 0) && (n < maxevents)) {
+        mxio_epoll_entry_t* entry =
+            list_remove_head_type(&epio->ready, mxio_epoll_entry_t, ready_node);
+        mx_signals_t observed = entry->observed;
+        if (!entry->has_observed) {
+            // reported before, see whether it still is ready
+            mx_handle_wait_one(entry->h, entry->signals, 0, &observed);
+        }
+        entry->has_observed = false;
+        if (!(observed & entry->signals)) {
+            continue;
+        }
+
+        uint32_t events;
+        entry->io->ops->wait_end(entry->io, observed, &events);
+        // mask unrequested events except HUP/ERR
+        events &= entry->ep_event.events | EPOLLHUP | EPOLLERR;
+        if (events == 0) {
+            continue;
+        }
+        ep_events[n].events = events;
+        ep_events[n].data = entry->ep_event.data;
+        n++;
+
+        if (entry->ep_event.events & EPOLLONESHOT) {
+            // nothing more until EPOLL_CTL_MOD re-arms it
+            entry->disarmed = true;
+        } else if (!(entry->ep_event.events & EPOLLET)) {
+            list_add_tail(&epio->ready, &entry->ready_node);
+        }
+    }
+    return n;
+}
+
 int epoll_wait(int epfd, struct epoll_event* ep_events, int maxevents, int timeout) {
     if (maxevents <= 0 || timeout < -1) {
         return ERRNO(EINVAL);
@@ -263,28 +329,47 @@ int epoll_wait(int epfd, struct epoll_event* ep_events, int maxevents, int timeo
     mxio_epoll_t* epio = (mxio_epoll_t*)io;
 
     mx_status_t r;
-    uint32_t num_results = maxevents;
+    int n;
     mx_waitset_result_t results[maxevents];
-    mx_time_t tmo = (timeout >= 0) ? MX_MSEC(timeout) : MX_TIME_INFINITE;
-
-    if ((r = mx_waitset_wait(epio->h, tmo, results, &num_results)) < 0) {
-        mxio_release(io);
-        return (r == ERR_TIMED_OUT) ? 0 : ERROR(r);
-    }
-
-    for (uint32_t i = 0; i < num_results; i++) {
-        mxio_epoll_cookie_t* cookie = (mxio_epoll_cookie_t*)(uintptr_t)results[i].cookie;
-        mxio_t* io = cookie->io;
-        uint32_t events;
-
-        io->ops->wait_end(io, results[i].observed, &events);
-        // mask unrequested events except HUP/ERR
-        ep_events[i].events = events & (cookie->ep_event.events | EPOLLHUP | EPOLLERR);
+    mx_time_t deadline = (timeout >= 0) ?
+        mx_time_get(MX_CLOCK_MONOTONIC) + MX_MSEC(timeout) : MX_TIME_INFINITE;
+
+    // Pick up new edges without blocking and report what is ready.  Only
+    // if nothing is, block (without the lock) for more and try again.
+    mx_time_t tmo = 0;
+    mtx_lock(&epio->lock);
+    for (;;) {
+        uint32_t num_results = maxevents;
+        if (tmo != 0) {
+            mtx_unlock(&epio->lock);
+        }
+        r = mx_waitset_wait(epio->h, tmo, results, &num_results);
+        if (tmo != 0) {
+            mtx_lock(&epio->lock);
+        }
+        if (r == NO_ERROR) {
+            mxio_epoll_queue(epio, results, num_results);
+        } else if (r != ERR_TIMED_OUT) {
+            n = ERROR(r);
+            break;
+        }
 
-        ep_events[i].data = cookie->ep_event.data;
+        if (((n = mxio_epoll_report(epio, ep_events, maxevents)) > 0) || (timeout == 0)) {
+            break;
+        }
+        if (deadline == MX_TIME_INFINITE) {
+            tmo = MX_TIME_INFINITE;
+        } else {
+            mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+            if (now >= deadline) {
+                break;
+            }
+            tmo = deadline - now;
+        }
     }
+    mtx_unlock(&epio->lock);
     mxio_release(io);
-    return (int)num_results;
+    return n;
 }
 
 int epoll_pwait(int epfd, struct epoll_event* events, int maxevents, int timeout, const sigset_t* sigmask) {
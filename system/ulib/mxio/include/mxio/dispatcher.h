@@ -29,7 +29,17 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
 // create a thread for a dispatcher and start it running
 mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name);
 
+// create count threads for a dispatcher and start them running
+//
+// The threads share the dispatcher's handles: the handler for one handle
+// is never called on two threads at once, and sees its messages in order,
+// but handlers for different handles may run in parallel, so they must
+// be safe to call concurrently with each other.
+mx_status_t mxio_dispatcher_start_threads(mxio_dispatcher_t* md, const char* name,
+                                          uint32_t count);
+
 // run the dispatcher loop on the current thread, never to return
+// (this may be done in addition to starting threads for it)
 void mxio_dispatcher_run(mxio_dispatcher_t* md);
 
 // add a pipe and handler to a dispatcher
@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <dirent.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 #include <unistd.h> // for ssize_t
 
 #include <magenta/types.h>
@@ -17,6 +19,11 @@
 // and be used for all of stdio
 #define MXIO_FLAG_USE_FOR_STDIO 0x8000
 
+// flag on MX_HND_TYPE_MXIO_LOGGER handle args in processargs
+// instructing that the logger batch up lines before writing them
+// (see mxio_logger_create_etc())
+#define MXIO_FLAG_LOGGER_BUFFERED 0x4000
+
 #define MXIO_NONBLOCKING 1
 
 #define MXIO_PROTOCOL_UNDEFINED 0
@@ -58,6 +65,16 @@ int mxio_handle_fd(mx_handle_t h, mx_signals_t signals_in, mx_signals_t signals_
 // invoke a raw mxio ioctl
 ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
 
+// get a read-only VMO holding the contents of the file behind fd
+// the file's data is the len bytes starting at off within the VMO
+// later writes to the file may or may not show through, as with vmo clones
+mx_status_t mxio_get_vmo(int fd, mx_handle_t* vmo, size_t* off, size_t* len);
+
+// like readdir, but also fills in *s with the attributes of the entry
+// where the filesystem can, these come back with the listing itself
+// rather than costing a stat per entry
+struct dirent* mxio_readdir_stat(DIR* dir, struct stat* s);
+
 // create a pipe, installing one half in a fd, returning the other
 // for transport to another process
 mx_status_t mxio_pipe_half(mx_handle_t* handle, uint32_t* type);
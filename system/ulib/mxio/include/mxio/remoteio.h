@@ -44,7 +44,10 @@ __BEGIN_CDECLS
 #define MXRIO_GETADDRINFO  0x00000017
 #define MXRIO_SETATTR      0x00000018
 #define MXRIO_SYNC         0x00000019
-#define MXRIO_NUM_OPS      26
+#define MXRIO_GET_VMO      0x0000001a
+#define MXRIO_READDIR_PLUS 0x0000001b
+#define MXRIO_SENDFILE    (0x0000001c | MXRIO_ONE_HANDLE)
+#define MXRIO_NUM_OPS      29
 
 #define MXRIO_OP(n)        ((n) & 0x3FF) // opcode
 #define MXRIO_HC(n)        (((n) >> 8) & 3) // handle count
@@ -57,7 +60,8 @@ __BEGIN_CDECLS
     "read_at", "write_at", "truncate", "rename", \
     "connect", "bind", "listen", "getsockname", \
     "getpeername", "getsockopt", "setsockopt", "getaddrinfo", \
-    "setattr", "sync" }
+    "setattr", "sync", "get_vmo", "readdir_plus", \
+    "sendfile" }
 
 const char* mxio_opname(uint32_t op);
 
@@ -142,6 +146,7 @@ struct mxrio_msg {
 // SEEK        whence     offset   -                 offset      -               -
 // STAT        maxreply   0        -                 0           <vnattr_t>      -
 // READDIR     maxreply   0        -                 0           <vndirent_t[]>  -
+// READDIR_PLUS maxreply  0        -                 0           <vdirent_plus_t[]> -
 // IOCTL       out_len    opcode   <in_bytes>        0           <out_bytes>     -
 // UNLINK      0          0        <name>            0           -               -
 // TRUNCATE    0          offset   -                 0           -               -
@@ -156,6 +161,8 @@ struct mxrio_msg {
 // GETADDRINFO maxreply   0        <getaddrinfo>     0           <getaddrinfo>   -
 // SETATTR     0          0        <vnattr>          0           -               -
 // SYNC        0          0        0                 0           -               -
+// GET_VMO     0          offset   <uint64:len>      vmooffset   <uint64:len>    vmohandle
+// SENDFILE    0          vmooffset <uint64:len>     0           -               -
 //
 // proposed:
 //
@@ -163,11 +170,19 @@ struct mxrio_msg {
 // MKDIR       0          0        <name>            0           -               -
 // SYMLINK     namelen    0        <name><path>      0           -               -
 // READLINK    maxreply   0        -                 0           <path>          -
-// MMAP        flags      offset   <uint64:len>      offset      -               vmohandle
 // FLUSH       0          0        -                 0           -               -
 // LINK*       0          0        <name>            0           -               -
 //
 // on response arg32 is always mx_status, and may be positive for read/write calls
 // * handle[0] used to pass reference to target object
+//
+// GET_VMO asks for a read-only VMO holding len bytes of the file starting
+// at offset.  The reply gives the offset within the VMO where those bytes
+// begin and how many of them are available (less than len at end of file).
+//
+// SENDFILE passes a read-only VMO in handle[0] to a socket server, asking
+// it to send len bytes of it starting at vmooffset, after any data already
+// written to the socket.  The server reads the pages straight out of the
+// VMO.  The reply arg is how many bytes it took, which may be fewer.
 
 __END_CDECLS
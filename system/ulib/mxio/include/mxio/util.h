@@ -55,6 +55,12 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e);
 // entire log-lines and flush them on newline or buffer full.
 mxio_t* mxio_logger_create(mx_handle_t);
 
+// like mxio_logger_create(), with flags
+// MXIO_FLAG_LOGGER_BUFFERED holds complete lines back briefly so
+// that many go to the log with one syscall; lines still held when
+// the process dies without closing the logger are lost
+mxio_t* mxio_logger_create_etc(mx_handle_t, uint32_t flags);
+
 // Type of the hook for mxio_loader_service.  The first argument is
 // the one passed to mxio_loader_service, and the second is the file
 // name passed to dlopen or found in a DT_NEEDED entry.
@@ -45,6 +45,7 @@ typedef struct vnode_ops vnode_ops_t;
 
 typedef struct vnattr vnattr_t;
 typedef struct vdirent vdirent_t;
+typedef struct vdirent_plus vdirent_plus_t;
 
 typedef struct vdircookie {
     uint64_t n;
@@ -86,6 +87,10 @@ struct vnode_ops {
     // the readdir implementation to maintain state across calls.
     // To "rewind" and start from the beginning, cookie may be zero'd.
 
+    mx_status_t (*readdir_plus)(vnode_t* vn, void* cookie, void* dirents, size_t len);
+    // Optional. Like readdir, but fills vdirent_plus_t records, which also
+    // carry the attributes of each entry. Shares the cookie with readdir.
+
     mx_status_t (*create)(vnode_t* vn, vnode_t** out, const char* name, size_t len, uint32_t mode);
     // Create a new node under vn.
     // Name is len bytes long, and does not include a null terminator.
@@ -108,6 +113,11 @@ struct vnode_ops {
 
     mx_status_t (*sync)(vnode_t* vn);
     // Syncs the vnode with its underlying storage
+
+    ssize_t (*get_vmo)(vnode_t* vn, size_t off, size_t len, mx_handle_t* out, size_t* vmo_off);
+    // Optional. Returns a read-only VMO holding the data of vn from off,
+    // with that data starting at *vmo_off within the VMO.
+    // On success, returns the number of bytes available (at most len).
 };
 
 struct vnattr {
@@ -160,6 +170,14 @@ struct vdirent {
     char name[0];
 };
 
+// records are uint64 aligned
+struct vdirent_plus {
+    uint32_t size;
+    uint32_t type;
+    vnattr_t attr;
+    char name[0];
+};
+
 void vn_acquire(vnode_t* vn);
 void vn_release(vnode_t* vn);
 
@@ -0,0 +1,108 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <magenta/types.h>
+#include <mxio/io.h>
+
+#include "private.h"
+
+// Finds the elements from *i on that fit in a buffer together, skipping
+// empty ones.  Returns their total length, or 0 if the next element has to
+// go on its own; *end is left after the last of them either way.
+static size_t gather_run(const struct iovec* iov, int iovcnt, int* i, int* end) {
+    while (*i < iovcnt && iov[*i].iov_len == 0) {
+        (*i)++;
+    }
+    size_t len = 0;
+    int n = *i;
+    while (n < iovcnt && iov[n].iov_len <= MXIO_CHUNK_SIZE - len) {
+        len += iov[n].iov_len;
+        n++;
+    }
+    // a lone element that fills the buffer may as well go straight through
+    if (n == *i + 1 && len == MXIO_CHUNK_SIZE) {
+        len = 0;
+    }
+    *end = (len == 0) ? *i + 1 : n;
+    return len;
+}
+
+ssize_t mxio_readv_gathered(mxio_t* io, const struct iovec* iov, int iovcnt, mxio_read_fn read) {
+    uint8_t buf[MXIO_CHUNK_SIZE];
+    ssize_t count = 0;
+    int i = 0;
+    while (i < iovcnt) {
+        int end;
+        size_t len = gather_run(iov, iovcnt, &i, &end);
+        if (i == iovcnt) {
+            break;
+        }
+
+        ssize_t r;
+        if (len == 0) {
+            len = iov[i].iov_len;
+            r = read(io, iov[i].iov_base, len, count > 0);
+        } else {
+            r = read(io, buf, len, count > 0);
+            size_t done = 0;
+            for (int n = i; r > 0 && done < (size_t)r; n++) {
+                size_t xfer = iov[n].iov_len;
+                if (xfer > (size_t)r - done) {
+                    xfer = (size_t)r - done;
+                }
+                memcpy(iov[n].iov_base, buf + done, xfer);
+                done += xfer;
+            }
+        }
+        if (r < 0) {
+            return count ? count : r;
+        }
+        count += r;
+        if ((size_t)r < len) {
+            break;
+        }
+        i = end;
+    }
+    return count;
+}
+
+ssize_t mxio_writev_gathered(mxio_t* io, const struct iovec* iov, int iovcnt, mxio_write_fn write) {
+    uint8_t buf[MXIO_CHUNK_SIZE];
+    ssize_t count = 0;
+    int i = 0;
+    while (i < iovcnt) {
+        int end;
+        size_t len = gather_run(iov, iovcnt, &i, &end);
+        if (i == iovcnt) {
+            break;
+        }
+
+        ssize_t r;
+        if (len == 0) {
+            len = iov[i].iov_len;
+            r = write(io, iov[i].iov_base, len, count > 0);
+        } else {
+            size_t done = 0;
+            for (int n = i; n < end; n++) {
+                memcpy(buf + done, iov[n].iov_base, iov[n].iov_len);
+                done += iov[n].iov_len;
+            }
+            r = write(io, buf, len, count > 0);
+        }
+        if (r < 0) {
+            return count ? count : r;
+        }
+        count += r;
+        if ((size_t)r < len) {
+            break;
+        }
+        i = end;
+    }
+    return count;
+}
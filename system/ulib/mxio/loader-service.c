@@ -11,6 +11,8 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <threads.h>
 #include <unistd.h>
@@ -43,42 +45,101 @@ static const char* libpaths[] = {
     "/boot/lib",
 };
 
-static mx_handle_t default_load_object(void* ignored, const char* fn) {
-    char buffer[8192];
-    char path[PATH_MAX];
-    mx_handle_t vmo = 0;
-    mx_status_t err = ERR_IO;
-
-    struct stat s;
-    int fd;
-
-    for (unsigned n = 0; n < sizeof(libpaths)/sizeof(libpaths[0]); n++) {
-        snprintf(path, PATH_MAX, "%s/%s", libpaths[n], fn);
+// Libraries loaded before are handed out again as read-only duplicates of
+// the VMO they were loaded into, so their pages are shared by every
+// process using them, and a process start doesn't have to read them in
+// again. The dynamic linker and elfload copy or clone writable segments
+// rather than mapping the VMO writable, so read-only handles are enough.
+//
+// An entry is keyed by the path it was opened at, and is only reused
+// while the file's inode, size and modification time are unchanged.
+// Files whose contents match (the same library under /system/lib and
+// /boot/lib, say) share one VMO.
+
+#define CACHE_MAX 64
+
+#define CACHE_VMO_RIGHTS (MX_RIGHT_READ | MX_RIGHT_EXECUTE | MX_RIGHT_MAP | \
+                          MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_GET_PROPERTY)
+
+typedef struct cache_entry {
+    char* path;
+    mx_handle_t vmo;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    uint64_t hash;
+    uint64_t last_use;
+} cache_entry_t;
+
+static mtx_t cache_lock = MTX_INIT;
+static cache_entry_t cache[CACHE_MAX];
+static uint64_t cache_clock;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+    const uint8_t* p = data;
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-        if ((fd = open(path, O_RDONLY)) >= 0) {
-            goto found;
+static bool vmos_equal(mx_handle_t a, mx_handle_t b, size_t size) {
+    char abuf[4096], bbuf[4096];
+    for (size_t off = 0; off < size; off += sizeof(abuf)) {
+        size_t xfer = (size - off > sizeof(abuf)) ? sizeof(abuf) : size - off;
+        size_t an, bn;
+        if (mx_vmo_read(a, abuf, off, xfer, &an) < 0 ||
+            mx_vmo_read(b, bbuf, off, xfer, &bn) < 0 ||
+            an != xfer || bn != xfer || memcmp(abuf, bbuf, xfer)) {
+            return false;
         }
     }
-    fprintf(stderr, "dlsvc: could not open '%s'\n", path);
-    return ERR_NOT_FOUND;
+    return true;
+}
 
-found:
-    if (fstat(fd, &s) < 0) {
-        fprintf(stderr, "dlsvc: could not stat '%s'\n", path);
-        goto fail;
+// Returns the entry for path, or a free or least recently used one to
+// replace. Called with cache_lock held.
+static cache_entry_t* cache_slot(const char* path) {
+    cache_entry_t* slot = &cache[0];
+    for (unsigned n = 0; n < CACHE_MAX; n++) {
+        cache_entry_t* e = &cache[n];
+        if (e->path && !strcmp(e->path, path))
+            return e;
+        if (!e->path) {
+            if (slot->path)
+                slot = e;
+        } else if (slot->path && e->last_use < slot->last_use) {
+            slot = e;
+        }
     }
+    return slot;
+}
 
-    if ((err = mx_vmo_create(s.st_size, 0, &vmo)) < 0) {
-        goto fail;
+static void cache_entry_clear(cache_entry_t* e) {
+    free(e->path);
+    mx_handle_close(e->vmo);
+    memset(e, 0, sizeof(*e));
+}
+
+// Reads the file into a new VMO, hashing its contents on the way.
+static mx_handle_t load_file(int fd, const char* path, size_t size, uint64_t* hash) {
+    char buffer[8192];
+    mx_handle_t vmo = 0;
+    mx_status_t err;
+
+    if ((err = mx_vmo_create(size, 0, &vmo)) < 0) {
+        return err;
     }
 
+    uint64_t h = 14695981039346656037ull;
     size_t off = 0;
-    size_t size = s.st_size;
     ssize_t r;
     while (size > 0) {
         size_t xfer = (size > sizeof(buffer)) ? sizeof(buffer) : size;
         if ((r = read(fd, buffer, xfer)) < 0) {
             fprintf(stderr, "dlsvc: read error @%zd in '%s'\n", off, path);
+            err = ERR_IO;
             goto fail;
         }
         size_t n;
@@ -89,15 +150,100 @@ found:
             err = ERR_IO;
             goto fail;
         }
+        h = fnv1a(h, buffer, xfer);
         off += xfer;
         size -= xfer;
     }
-    close(fd);
+    *hash = h;
     return vmo;
 
 fail:
+    mx_handle_close(vmo);
+    return err;
+}
+
+static mx_handle_t default_load_object(void* ignored, const char* fn) {
+    char path[PATH_MAX];
+    mx_handle_t vmo = 0;
+    mx_status_t err = ERR_IO;
+
+    struct stat s;
+    int fd;
+
+    for (unsigned n = 0; n < sizeof(libpaths)/sizeof(libpaths[0]); n++) {
+        snprintf(path, PATH_MAX, "%s/%s", libpaths[n], fn);
+
+        if ((fd = open(path, O_RDONLY)) >= 0) {
+            goto found;
+        }
+    }
+    fprintf(stderr, "dlsvc: could not open '%s'\n", path);
+    return ERR_NOT_FOUND;
+
+found:
+    if (fstat(fd, &s) < 0) {
+        fprintf(stderr, "dlsvc: could not stat '%s'\n", path);
+        goto fail;
+    }
+
+    mtx_lock(&cache_lock);
+    cache_entry_t* e = cache_slot(path);
+    if (e->path && e->ino == s.st_ino && e->size == s.st_size && e->mtime == s.st_mtime) {
+        e->last_use = ++cache_clock;
+        err = mx_handle_duplicate(e->vmo, CACHE_VMO_RIGHTS, &vmo);
+        mtx_unlock(&cache_lock);
+        close(fd);
+        return (err < 0) ? err : vmo;
+    }
+    mtx_unlock(&cache_lock);
+
+    uint64_t hash;
+    if ((vmo = load_file(fd, path, s.st_size, &hash)) < 0) {
+        err = vmo;
+        goto fail;
+    }
     close(fd);
+
+    mtx_lock(&cache_lock);
+    // share the VMO of any other file with the same contents
+    for (unsigned n = 0; n < CACHE_MAX; n++) {
+        cache_entry_t* other = &cache[n];
+        if (other->path && other->hash == hash && other->size == s.st_size &&
+            vmos_equal(other->vmo, vmo, s.st_size)) {
+            mx_handle_t shared;
+            if (mx_handle_duplicate(other->vmo, MX_RIGHT_SAME_RIGHTS, &shared) == NO_ERROR) {
+                mx_handle_close(vmo);
+                vmo = shared;
+            }
+            break;
+        }
+    }
+    e = cache_slot(path);
+    if (e->path)
+        cache_entry_clear(e);
+    mx_handle_t ro;
+    err = mx_handle_duplicate(vmo, CACHE_VMO_RIGHTS, &ro);
     mx_handle_close(vmo);
+    if (err < 0) {
+        mtx_unlock(&cache_lock);
+        return err;
+    }
+    if ((e->path = strdup(path)) != NULL &&
+        mx_handle_duplicate(ro, MX_RIGHT_SAME_RIGHTS, &e->vmo) == NO_ERROR) {
+        e->ino = s.st_ino;
+        e->size = s.st_size;
+        e->mtime = s.st_mtime;
+        e->hash = hash;
+        e->last_use = ++cache_clock;
+    } else {
+        free(e->path);
+        e->path = NULL;
+    }
+    mtx_unlock(&cache_lock);
+    return ro;
+
+fail:
+    close(fd);
     return err;
 }
 
@@ -4,8 +4,12 @@
 
 #include <mxio/io.h>
 
+#include <mxio/remoteio.h>
+#include <mxio/util.h>
+
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 
 #include <magenta/syscalls.h>
@@ -14,16 +18,103 @@
 
 #include "private.h"
 
+// In buffered mode, complete lines collect in |batch| and go out with
+// one MX_LOG_FLAG_BATCH write once it is full, once LOG_BATCH_LINES
+// lines are waiting, or LOG_BATCH_DELAY after the first of them was
+// written, whichever comes first. fsync() and close() flush as well.
+#define LOG_BATCH_LINES 32
+#define LOG_BATCH_DELAY MX_MSEC(50)
+
 typedef struct mxio_log mxio_log_t;
 struct mxio_log {
     mxio_t io;
     mx_handle_t handle;
+    uint32_t flags;
+
+    mtx_t lock;
+    cnd_t cond;
+    bool flusher;
+    bool closed;
+    uint32_t lines;
+    size_t fill;
+    mx_time_t deadline;
+    char batch[MX_LOG_WRITE_BATCH_MAX];
 };
 
 #define LOGBUF_MAX (MX_LOG_RECORD_MAX - sizeof(mx_log_record_t))
 
+static void log_flush_locked(mxio_log_t* log_io) {
+    if (log_io->fill > 0) {
+        mx_log_write(log_io->handle, log_io->fill, log_io->batch, MX_LOG_FLAG_BATCH);
+        log_io->fill = 0;
+        log_io->lines = 0;
+    }
+}
+
+// Flushes batches that sit for LOG_BATCH_DELAY without filling up.
+static int log_flusher(void* arg) {
+    mxio_log_t* log_io = arg;
+    mtx_lock(&log_io->lock);
+    while (!log_io->closed) {
+        if (log_io->fill == 0) {
+            cnd_wait(&log_io->cond, &log_io->lock);
+            continue;
+        }
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        if (now < log_io->deadline) {
+            mx_time_t delay = log_io->deadline - now;
+            mtx_unlock(&log_io->lock);
+            mx_nanosleep(delay);
+            mtx_lock(&log_io->lock);
+            continue;
+        }
+        log_flush_locked(log_io);
+    }
+    mtx_unlock(&log_io->lock);
+    mxio_release(&log_io->io);
+    return 0;
+}
+
+static void log_emit(mxio_log_t* log_io, const char* data, size_t len) {
+    if (!(log_io->flags & MXIO_FLAG_LOGGER_BUFFERED)) {
+        mx_log_write(log_io->handle, len, data, 0);
+        return;
+    }
+
+    mtx_lock(&log_io->lock);
+    if ((log_io->fill + len + 1) > sizeof(log_io->batch)) {
+        log_flush_locked(log_io);
+    }
+    memcpy(log_io->batch + log_io->fill, data, len);
+    log_io->batch[log_io->fill + len] = '\n';
+    log_io->fill += len + 1;
+    if (++log_io->lines >= LOG_BATCH_LINES) {
+        log_flush_locked(log_io);
+    } else if (log_io->lines == 1) {
+        log_io->deadline = mx_time_get(MX_CLOCK_MONOTONIC) + LOG_BATCH_DELAY;
+        if (!log_io->flusher) {
+            thrd_t t;
+            mxio_acquire(&log_io->io);
+            if (thrd_create_with_name(&t, log_flusher, log_io, "mxio-log-flusher") == thrd_success) {
+                thrd_detach(t);
+                log_io->flusher = true;
+            } else {
+                // without a flusher, nothing may come along to flush
+                // later, so don't hold on to anything
+                mxio_release(&log_io->io);
+                log_io->flags &= ~MXIO_FLAG_LOGGER_BUFFERED;
+                log_flush_locked(log_io);
+            }
+        }
+        cnd_signal(&log_io->cond);
+    }
+    mtx_unlock(&log_io->lock);
+}
+
 static ssize_t log_write(mxio_t* io, const void* _data, size_t len) {
-    static thread_local struct {
+    // libmxio is always loaded at startup, so its TLS is in the static
+    // block and initial-exec saves a __tls_get_addr call per write
+    static thread_local __attribute__((tls_model("initial-exec"))) struct {
         unsigned next;
         char data[LOGBUF_MAX];
     }* logbuf = NULL;
@@ -42,7 +133,7 @@ static ssize_t log_write(mxio_t* io, const void* _data, size_t len) {
     while (len-- > 0) {
         char c = *data++;
         if (c == '\n') {
-            mx_log_write(log_io->handle, logbuf->next, logbuf->data, 0);
+            log_emit(log_io, logbuf->data, logbuf->next);
             logbuf->next = 0;
             continue;
         }
@@ -51,7 +142,7 @@ static ssize_t log_write(mxio_t* io, const void* _data, size_t len) {
         }
         logbuf->data[logbuf->next++] = c;
         if (logbuf->next == LOGBUF_MAX) {
-            mx_log_write(log_io->handle, logbuf->next, logbuf->data, 0);
+            log_emit(log_io, logbuf->data, logbuf->next);
             logbuf->next = 0;
             continue;
         }
@@ -59,8 +150,26 @@ static ssize_t log_write(mxio_t* io, const void* _data, size_t len) {
     return r;
 }
 
+static mx_status_t log_misc(mxio_t* io, uint32_t op, int64_t off, uint32_t maxreply, void* ptr, size_t len) {
+    mxio_log_t* log_io = (mxio_log_t*)io;
+    switch (op) {
+    case MXRIO_SYNC:
+        mtx_lock(&log_io->lock);
+        log_flush_locked(log_io);
+        mtx_unlock(&log_io->lock);
+        return NO_ERROR;
+    default:
+        return mxio_default_misc(io, op, off, maxreply, ptr, len);
+    }
+}
+
 static mx_status_t log_close(mxio_t* io) {
     mxio_log_t* log_io = (mxio_log_t*)io;
+    mtx_lock(&log_io->lock);
+    log_flush_locked(log_io);
+    log_io->closed = true;
+    cnd_signal(&log_io->cond);
+    mtx_unlock(&log_io->lock);
     mx_handle_t h = log_io->handle;
     log_io->handle = 0;
     mx_handle_close(h);
@@ -81,10 +190,12 @@ static mx_status_t log_clone(mxio_t* io, mx_handle_t* handles, uint32_t* types)
 static mxio_ops_t log_io_ops = {
     .read = mxio_default_read,
     .write = log_write,
+    .readv = mxio_default_readv,
+    .writev = mxio_default_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .seek = mxio_default_seek,
-    .misc = mxio_default_misc,
+    .misc = log_misc,
     .close = log_close,
     .open = mxio_default_open,
     .clone = log_clone,
@@ -92,9 +203,10 @@ static mxio_ops_t log_io_ops = {
     .wait_begin = mxio_default_wait_begin,
     .wait_end = mxio_default_wait_end,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
-mxio_t* mxio_logger_create(mx_handle_t handle) {
+mxio_t* mxio_logger_create_etc(mx_handle_t handle, uint32_t flags) {
     mxio_log_t* log = calloc(1, sizeof(mxio_log_t));
     if (log == NULL) {
         return NULL;
@@ -103,5 +215,12 @@ mxio_t* mxio_logger_create(mx_handle_t handle) {
     log->io.magic = MXIO_MAGIC;
     atomic_init(&log->io.refcount, 1);
     log->handle = handle;
+    log->flags = flags & MXIO_FLAG_LOGGER_BUFFERED;
+    mtx_init(&log->lock, mtx_plain);
+    cnd_init(&log->cond);
     return &log->io;
 }
+
+mxio_t* mxio_logger_create(mx_handle_t handle) {
+    return mxio_logger_create_etc(handle, 0);
+}
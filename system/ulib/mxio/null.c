@@ -27,6 +27,43 @@ ssize_t mxio_default_write(mxio_t* io, const void* _data, size_t len) {
     return len;
 }
 
+// one read or write per element
+ssize_t mxio_default_readv(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    ssize_t count = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        ssize_t r = io->ops->read(io, iov[i].iov_base, iov[i].iov_len);
+        if (r < 0) {
+            return count ? count : r;
+        }
+        count += r;
+        if ((size_t)r < iov[i].iov_len) {
+            break;
+        }
+    }
+    return count;
+}
+
+ssize_t mxio_default_writev(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    ssize_t count = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        ssize_t r = io->ops->write(io, iov[i].iov_base, iov[i].iov_len);
+        if (r < 0) {
+            return count ? count : r;
+        }
+        count += r;
+        if ((size_t)r < iov[i].iov_len) {
+            break;
+        }
+    }
+    return count;
+}
+
 ssize_t mxio_default_recvmsg(mxio_t* io, struct msghdr* msg, int flags) {
     return ERR_WRONG_TYPE;
 }
@@ -76,9 +113,15 @@ ssize_t mxio_default_posix_ioctl(mxio_t* io, int req, va_list va) {
     return ERR_NOT_SUPPORTED;
 }
 
+mx_status_t mxio_default_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len) {
+    return ERR_NOT_SUPPORTED;
+}
+
 static mxio_ops_t mx_null_ops = {
     .read = mxio_default_read,
     .write = mxio_default_write,
+    .readv = mxio_default_readv,
+    .writev = mxio_default_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .seek = mxio_default_seek,
@@ -91,6 +134,7 @@ static mxio_ops_t mx_null_ops = {
     .wait_end = mxio_default_wait_end,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_null_create(void) {
@@ -90,6 +90,24 @@ static ssize_t mx_pipe_read(mxio_t* io, void* data, size_t len) {
     return _read(p->h, data, len, io->flags & MXIO_FLAG_NONBLOCK);
 }
 
+static ssize_t mx_pipe_read_some(mxio_t* io, void* data, size_t len, bool nonblock) {
+    mx_pipe_t* p = (mx_pipe_t*)io;
+    return _read(p->h, data, len, nonblock || (io->flags & MXIO_FLAG_NONBLOCK));
+}
+
+static ssize_t mx_pipe_write_some(mxio_t* io, const void* data, size_t len, bool nonblock) {
+    mx_pipe_t* p = (mx_pipe_t*)io;
+    return _write(p->h, data, len, nonblock || (io->flags & MXIO_FLAG_NONBLOCK));
+}
+
+static ssize_t mx_pipe_readv(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    return mxio_readv_gathered(io, iov, iovcnt, mx_pipe_read_some);
+}
+
+static ssize_t mx_pipe_writev(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    return mxio_writev_gathered(io, iov, iovcnt, mx_pipe_write_some);
+}
+
 static mx_status_t mx_pipe_close(mxio_t* io) {
     mx_pipe_t* p = (mx_pipe_t*)io;
     mx_handle_t h = p->h;
@@ -176,6 +194,8 @@ static ssize_t mx_pipe_posix_ioctl(mxio_t* io, int req, va_list va) {
 static mxio_ops_t mx_pipe_ops = {
     .read = mx_pipe_read,
     .write = mx_pipe_write,
+    .readv = mx_pipe_readv,
+    .writev = mx_pipe_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .seek = mxio_default_seek,
@@ -188,6 +208,7 @@ static mxio_ops_t mx_pipe_ops = {
     .wait_end = mx_pipe_wait_end,
     .unwrap = mx_pipe_unwrap,
     .posix_ioctl = mx_pipe_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_pipe_create(mx_handle_t h) {
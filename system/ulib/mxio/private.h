@@ -10,6 +10,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 typedef struct mxio mxio_t;
 
@@ -29,6 +30,8 @@ typedef struct mxio_ops {
     ssize_t (*read_at)(mxio_t* io, void* data, size_t len, off_t offset);
     ssize_t (*write)(mxio_t* io, const void* data, size_t len);
     ssize_t (*write_at)(mxio_t* io, const void* data, size_t len, off_t offset);
+    ssize_t (*readv)(mxio_t* io, const struct iovec* iov, int iovcnt);
+    ssize_t (*writev)(mxio_t* io, const struct iovec* iov, int iovcnt);
     ssize_t (*recvmsg)(mxio_t* io, struct msghdr* msg, int flags);
     ssize_t (*sendmsg)(mxio_t* io, const struct msghdr* msg, int flags);
     off_t (*seek)(mxio_t* io, off_t offset, int whence);
@@ -41,6 +44,7 @@ typedef struct mxio_ops {
     void (*wait_end)(mxio_t* io, mx_signals_t signals, uint32_t* events);
     ssize_t (*ioctl)(mxio_t* io, uint32_t op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
     ssize_t (*posix_ioctl)(mxio_t* io, int req, va_list va);
+    mx_status_t (*get_vmo)(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len);
 } mxio_ops_t;
 
 // mxio_t flags
@@ -151,12 +155,28 @@ void mxio_socket_set_dgram_ops(mxio_t* io);
 
 mx_status_t mxio_socket_posix_ioctl(mxio_t* io, int req, va_list va);
 mx_status_t mxio_socket_shutdown(mxio_t* io, int how);
+// hands len bytes of vmo from off to a stream socket's server to send
+// consumes vmo, returns bytes taken or ERR_NOT_SUPPORTED
+ssize_t mxio_socket_sendfile(mxio_t* io, mx_handle_t vmo, uint64_t off, size_t len);
+
+// Vectored io in terms of a plain read or write, for implementations where
+// each call costs a syscall or a message.  Runs of elements smaller than
+// MXIO_CHUNK_SIZE go through a buffer together, so take one call between
+// them; bigger elements go straight through.  Stops at the first short
+// transfer.  Calls after the first are made with nonblock set, so that
+// having got something, the caller doesn't wait for more.
+typedef ssize_t (*mxio_read_fn)(mxio_t* io, void* data, size_t len, bool nonblock);
+typedef ssize_t (*mxio_write_fn)(mxio_t* io, const void* data, size_t len, bool nonblock);
+ssize_t mxio_readv_gathered(mxio_t* io, const struct iovec* iov, int iovcnt, mxio_read_fn read);
+ssize_t mxio_writev_gathered(mxio_t* io, const struct iovec* iov, int iovcnt, mxio_write_fn write);
 
 // unsupported / do-nothing hooks shared by implementations
 ssize_t mxio_default_read(mxio_t* io, void* _data, size_t len);
 ssize_t mxio_default_read_at(mxio_t* io, void* _data, size_t len, off_t offset);
 ssize_t mxio_default_write(mxio_t* io, const void* _data, size_t len);
 ssize_t mxio_default_write_at(mxio_t* io, const void* _data, size_t len, off_t offset);
+ssize_t mxio_default_readv(mxio_t* io, const struct iovec* iov, int iovcnt);
+ssize_t mxio_default_writev(mxio_t* io, const struct iovec* iov, int iovcnt);
 ssize_t mxio_default_recvmsg(mxio_t* io, struct msghdr* msg, int flags);
 ssize_t mxio_default_sendmsg(mxio_t* io, const struct msghdr* msg, int flags);
 off_t mxio_default_seek(mxio_t* io, off_t offset, int whence);
@@ -169,6 +189,7 @@ void mxio_default_wait_begin(mxio_t* io, uint32_t events, mx_handle_t* handle, m
 void mxio_default_wait_end(mxio_t* io, mx_signals_t signals, uint32_t* _events);
 mx_status_t mxio_default_unwrap(mxio_t* io, mx_handle_t* handles, uint32_t* types);
 ssize_t mxio_default_posix_ioctl(mxio_t* io, int req, va_list va);
+mx_status_t mxio_default_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len);
 
 void __mxio_startup_handles_init(uint32_t num, mx_handle_t handles[],
                                  uint32_t handle_info[])
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <threads.h>
 
 #include <magenta/device/ioctl.h>
@@ -22,6 +23,7 @@
 #include <mxio/remoteio.h>
 #include <mxio/socket.h>
 #include <mxio/util.h>
+#include <mxio/vfs.h>
 
 #include "private.h"
 
@@ -40,8 +42,32 @@ struct mxrio {
 
     // transaction id used for synchronous remoteio calls
     atomic_uint_fast32_t txid;
+
+    // Readahead for sequential reads of regular files.  ra_buf holds
+    // data the server has sent past the reader's seek offset: the bytes
+    // from ra_pos to ra_len are next in the file.  The lock also keeps
+    // one thread at a time reading pipelined replies off the channel.
+    mtx_t ra_lock;
+    int ra_kind;
+    bool ra_seq;
+    uint32_t ra_chunks;
+    uint8_t* ra_buf;
+    size_t ra_pos;
+    size_t ra_len;
 };
 
+// values of ra_kind, found out with a stat the first time it matters
+#define RA_UNKNOWN 0
+#define RA_FILE 1
+#define RA_NONE 2
+
+// Up to this many READ or READ_AT requests are outstanding at once.
+#define MXRIO_PIPELINE_MAX 8
+
+// The readahead window doubles on each sequential read, up to this many
+// chunks.
+#define MXRIO_READAHEAD_MAX 8
+
 static pthread_key_t rchannel_key;
 
 static void rchannel_cleanup(void* data) {
@@ -231,6 +257,10 @@ fail_discard_handles:
     return r;
 }
 
+static mx_status_t mxrio_misc(mxio_t* io, uint32_t op, int64_t off,
+                              uint32_t maxreply, void* ptr, size_t len);
+static void readahead_sync(mxrio_t* rio);
+
 static ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
                            size_t in_len, void* out_buf, size_t out_len) {
     mxrio_t* rio = (mxrio_t*)io;
@@ -241,6 +271,7 @@ static ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     if (in_len > MXIO_IOCTL_MAX_INPUT || out_len > MXIO_CHUNK_SIZE) {
         return ERR_INVALID_ARGS;
     }
+    readahead_sync(rio);
 
     memset(&msg, 0, MXRIO_HDR_SZ);
     msg.op = MXRIO_IOCTL;
@@ -329,6 +360,7 @@ static ssize_t write_common(uint32_t op, mxio_t* io, const void* _data, size_t l
     mxrio_msg_t msg;
     ssize_t xfer;
 
+    readahead_sync(rio);
     while (len > 0) {
         xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
 
@@ -410,11 +442,231 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
     return count ? count : r;
 }
 
+// Reads the reply to a pipelined request, leaving the server's status
+// for it in msg->arg.
+static mx_status_t mxrio_read_reply(mxrio_t* rio, mxrio_msg_t* msg, uint32_t txid) {
+    for (;;) {
+        uint32_t dsize;
+        uint32_t hcount;
+        mx_status_t r = mx_channel_read(rio->h, 0, msg, MXRIO_HDR_SZ + MXIO_CHUNK_SIZE, &dsize,
+                                        msg->handle, MXIO_MAX_HANDLES, &hcount);
+        if (r == ERR_SHOULD_WAIT) {
+            mx_signals_t pending;
+            if ((r = mx_handle_wait_one(rio->h, MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                        MX_TIME_INFINITE, &pending)) < 0) {
+                return r;
+            }
+            if (!(pending & MX_CHANNEL_READABLE)) {
+                return ERR_REMOTE_CLOSED;
+            }
+            continue;
+        }
+        if (r < 0) {
+            return r;
+        }
+        discard_handles(msg->handle, hcount);
+        if (!is_message_reply_valid(msg, dsize) ||
+            (MXRIO_OP(msg->op) != MXRIO_STATUS) || (msg->txid != txid)) {
+            return ERR_IO;
+        }
+        return NO_ERROR;
+    }
+}
+
+// Reads len bytes into data, and for MXRIO_READ ra_len bytes more into
+// the readahead buffer, sending up to MXRIO_PIPELINE_MAX requests before
+// waiting for their replies.  The server handles the requests on a
+// channel in order, so the replies to READ requests make up one stream,
+// whatever their lengths; READ_AT stops at the first short read, as
+// read_common() does.  Called with ra_lock held.
+static ssize_t read_pipelined(mxrio_t* rio, uint32_t op, uint8_t* data, size_t len,
+                              off_t offset, size_t ra_len) {
+    const size_t total = len + ra_len;
+    size_t asked = 0;
+    size_t got = 0;
+    // bytes sent after a failed READ, to be given back to the server
+    size_t ahead = 0;
+    mx_status_t status = NO_ERROR;
+    // stop sending requests; failed: stop keeping the data of replies
+    bool stop = false;
+    bool failed = false;
+    mxrio_msg_t msg;
+
+    while (!stop && asked < total) {
+        uint32_t txids[MXRIO_PIPELINE_MAX];
+        uint32_t sizes[MXRIO_PIPELINE_MAX];
+        uint32_t n = 0;
+        while (n < MXRIO_PIPELINE_MAX && asked < total) {
+            size_t xfer = (total - asked > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : total - asked;
+            memset(&msg, 0, MXRIO_HDR_SZ);
+            msg.txid = atomic_fetch_add(&rio->txid, 1);
+            msg.op = op;
+            msg.arg = xfer;
+            if (op == MXRIO_READ_AT)
+                msg.arg2.off = offset + asked;
+            mx_status_t r;
+            if ((r = mx_channel_write(rio->h, 0, &msg, MXRIO_HDR_SZ, NULL, 0)) < 0) {
+                status = r;
+                stop = true;
+                break;
+            }
+            txids[n] = msg.txid;
+            sizes[n++] = xfer;
+            asked += xfer;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            mx_status_t r;
+            if ((r = mxrio_read_reply(rio, &msg, txids[i])) < 0) {
+                // the channel is no good any more
+                return got ? (ssize_t)(got < len ? got : len) : r;
+            }
+            if ((r = msg.arg) > (int)msg.datalen || r > (int)sizes[i]) {
+                r = ERR_IO;
+            }
+            if (failed) {
+                if (r > 0 && op == MXRIO_READ)
+                    ahead += r;
+                continue;
+            }
+            if (r < 0) {
+                status = r;
+                stop = failed = true;
+                continue;
+            }
+            if (got < len) {
+                size_t part = (len - got < (size_t)r) ? len - got : (size_t)r;
+                memcpy(data + got, msg.data, part);
+                if ((size_t)r > part)
+                    memcpy(rio->ra_buf, msg.data + part, r - part);
+            } else {
+                memcpy(rio->ra_buf + (got - len), msg.data, r);
+            }
+            got += r;
+            // stop asking at a short read; past it, READ_AT replies don't
+            // follow on, but READ replies still do
+            if ((uint32_t)r < sizes[i]) {
+                stop = true;
+                if (op == MXRIO_READ_AT)
+                    failed = true;
+            }
+        }
+    }
+
+    if (ahead > 0) {
+        memset(&msg, 0, MXRIO_HDR_SZ);
+        msg.op = MXRIO_SEEK;
+        msg.arg2.off = -(off_t)ahead;
+        msg.arg = SEEK_CUR;
+        if (mxrio_txn(rio, &msg) >= 0)
+            discard_handles(msg.handle, msg.hcount);
+    }
+
+    rio->ra_pos = 0;
+    rio->ra_len = got > len ? got - len : 0;
+    if (got > len)
+        got = len;
+    return (got || status >= 0) ? (ssize_t)got : status;
+}
+
+// Finds out whether the file is a regular one, which readahead and
+// pipelining are limited to: reading ahead of a device or a directory
+// would take data the caller hasn't asked for.
+static bool is_regular_file(mxrio_t* rio) {
+    if (rio->ra_kind == RA_UNKNOWN) {
+        vnattr_t attr;
+        mx_status_t r = mxrio_misc(&rio->io, MXRIO_STAT, 0, sizeof(attr), &attr, 0);
+        rio->ra_kind = (r >= 0 && S_ISREG(attr.mode)) ? RA_FILE : RA_NONE;
+    }
+    return rio->ra_kind == RA_FILE;
+}
+
+// Drops the data read ahead of the reader, moving the server's seek
+// offset back to where the reader has got to, unless seeking anyway.
+// Returns how far back the server now is of where it was.  Called with
+// ra_lock held.
+static size_t readahead_drop(mxrio_t* rio, bool seek_back) {
+    size_t ahead = rio->ra_len - rio->ra_pos;
+    rio->ra_pos = 0;
+    rio->ra_len = 0;
+    rio->ra_seq = false;
+    rio->ra_chunks = 0;
+    if (ahead > 0 && seek_back) {
+        mxrio_msg_t msg;
+        memset(&msg, 0, MXRIO_HDR_SZ);
+        msg.op = MXRIO_SEEK;
+        msg.arg2.off = -(off_t)ahead;
+        msg.arg = SEEK_CUR;
+        if (mxrio_txn(rio, &msg) >= 0)
+            discard_handles(msg.handle, msg.hcount);
+    }
+    return ahead;
+}
+
+// For everything that uses or moves the seek offset, or changes the
+// file, other than reads.
+static void readahead_sync(mxrio_t* rio) {
+    mtx_lock(&rio->ra_lock);
+    readahead_drop(rio, true);
+    mtx_unlock(&rio->ra_lock);
+}
+
 static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
-    return read_common(MXRIO_READ, io, _data, len, 0);
+    mxrio_t* rio = (mxrio_t*)io;
+    uint8_t* data = _data;
+
+    mtx_lock(&rio->ra_lock);
+    size_t count = rio->ra_len - rio->ra_pos;
+    if (count > len)
+        count = len;
+    if (count > 0) {
+        memcpy(data, rio->ra_buf + rio->ra_pos, count);
+        rio->ra_pos += count;
+    }
+    len -= count;
+    if (len == 0) {
+        mtx_unlock(&rio->ra_lock);
+        return count;
+    }
+
+    // Don't stat files for one-off small reads.
+    bool pipeline = (len > MXIO_CHUNK_SIZE || rio->ra_seq || rio->ra_kind != RA_UNKNOWN) &&
+                    is_regular_file(rio);
+    if (!pipeline) {
+        mtx_unlock(&rio->ra_lock);
+        ssize_t r = read_common(MXRIO_READ, io, data + count, len, 0);
+        return (r < 0) ? (count ? (ssize_t)count : r) : (ssize_t)count + r;
+    }
+
+    // Read ahead once reads turn out to be sequential.
+    size_t ra_len = 0;
+    if (rio->ra_seq) {
+        if (rio->ra_buf == NULL)
+            rio->ra_buf = malloc(MXRIO_READAHEAD_MAX * MXIO_CHUNK_SIZE);
+        if (rio->ra_buf != NULL) {
+            rio->ra_chunks = rio->ra_chunks ? rio->ra_chunks * 2 : 1;
+            if (rio->ra_chunks > MXRIO_READAHEAD_MAX)
+                rio->ra_chunks = MXRIO_READAHEAD_MAX;
+            ra_len = rio->ra_chunks * MXIO_CHUNK_SIZE;
+        }
+    }
+    ssize_t r = read_pipelined(rio, MXRIO_READ, data + count, len, 0, ra_len);
+    rio->ra_seq = true;
+    mtx_unlock(&rio->ra_lock);
+    return (r < 0) ? (count ? (ssize_t)count : r) : (ssize_t)count + r;
 }
 
 static ssize_t mxrio_read_at(mxio_t* io, void* _data, size_t len, off_t offset) {
+    mxrio_t* rio = (mxrio_t*)io;
+    if (len > MXIO_CHUNK_SIZE) {
+        mtx_lock(&rio->ra_lock);
+        if (is_regular_file(rio)) {
+            ssize_t r = read_pipelined(rio, MXRIO_READ_AT, _data, len, offset, 0);
+            mtx_unlock(&rio->ra_lock);
+            return r;
+        }
+        mtx_unlock(&rio->ra_lock);
+    }
     return read_common(MXRIO_READ_AT, io, _data, len, offset);
 }
 
@@ -423,12 +675,20 @@ static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
     mxrio_msg_t msg;
     mx_status_t r;
 
+    // The server is ahead of the reader by what has been read ahead.
+    mtx_lock(&rio->ra_lock);
+    size_t ahead = readahead_drop(rio, whence != SEEK_CUR);
+    if (whence == SEEK_CUR)
+        offset -= ahead;
+
     memset(&msg, 0, MXRIO_HDR_SZ);
     msg.op = MXRIO_SEEK;
     msg.arg2.off = offset;
     msg.arg = whence;
 
-    if ((r = mxrio_txn(rio, &msg)) < 0) {
+    r = mxrio_txn(rio, &msg);
+    mtx_unlock(&rio->ra_lock);
+    if (r < 0) {
         return r;
     }
 
@@ -448,6 +708,10 @@ static mx_status_t mxrio_close(mxio_t* io) {
         discard_handles(msg.handle, msg.hcount);
     }
 
+    free(rio->ra_buf);
+    rio->ra_buf = NULL;
+    rio->ra_pos = rio->ra_len = 0;
+
     mx_handle_t h = rio->h;
     rio->h = 0;
     mx_handle_close(h);
@@ -513,6 +777,9 @@ static mx_status_t mxrio_misc(mxio_t* io, uint32_t op, int64_t off,
     if ((len > MXIO_CHUNK_SIZE) || (maxreply > MXIO_CHUNK_SIZE)) {
         return ERR_INVALID_ARGS;
     }
+    if (op != MXRIO_STAT) {
+        readahead_sync(rio);
+    }
 
     memset(&msg, 0, MXRIO_HDR_SZ);
     msg.op = op;
@@ -648,6 +915,7 @@ static mx_status_t mxrio_open(mxio_t* io, const char* path, int32_t flags, uint3
 static mx_status_t mxrio_clone(mxio_t* io, mx_handle_t* handles, uint32_t* types) {
     mxrio_t* rio = (void*)io;
     mxrio_object_t info;
+    readahead_sync(rio);
     mx_status_t r = mxrio_getobject(rio, MXRIO_CLONE, "", 0, 0, &info);
     if (r < 0) {
         return r;
@@ -661,6 +929,7 @@ static mx_status_t mxrio_clone(mxio_t* io, mx_handle_t* handles, uint32_t* types
 
 mx_status_t __mxrio_clone(mx_handle_t h, mx_handle_t* handles, uint32_t* types) {
     mxrio_t rio;
+    memset(&rio, 0, sizeof(rio));
     rio.h = h;
     return mxrio_clone(&rio.io, handles, types);
 }
@@ -668,6 +937,8 @@ mx_status_t __mxrio_clone(mx_handle_t h, mx_handle_t* handles, uint32_t* types)
 static mx_status_t mxrio_unwrap(mxio_t* io, mx_handle_t* handles, uint32_t* types) {
     mxrio_t* rio = (void*)io;
     mx_status_t r;
+    readahead_sync(rio);
+    free(rio->ra_buf);
     handles[0] = rio->h;
     types[0] = MX_HND_TYPE_MXIO_REMOTE;
     if (rio->h2 != 0) {
@@ -714,11 +985,58 @@ static void mxrio_wait_end(mxio_t* io, mx_signals_t signals, uint32_t* _events)
     *_events = events;
 }
 
+static mx_status_t mxrio_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    mxrio_msg_t msg;
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_GET_VMO;
+    msg.arg2.off = 0;
+
+    // ask for the whole file, the server trims this to its size
+    uint64_t want = UINT64_MAX;
+    memcpy(msg.data, &want, sizeof(want));
+    msg.datalen = sizeof(want);
+
+    mx_status_t r;
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        return r;
+    }
+    uint64_t avail;
+    if ((msg.hcount != 1) || (msg.datalen != sizeof(avail)) || (msg.arg2.off < 0)) {
+        discard_handles(msg.handle, msg.hcount);
+        return ERR_IO;
+    }
+    memcpy(&avail, msg.data, sizeof(avail));
+    *out = msg.handle[0];
+    *off = msg.arg2.off;
+    *len = avail;
+    return NO_ERROR;
+}
+
+// files don't block, so each piece is a plain read or write
+static ssize_t mxrio_read_some(mxio_t* io, void* data, size_t len, bool nonblock) {
+    return mxrio_read(io, data, len);
+}
+
+static ssize_t mxrio_write_some(mxio_t* io, const void* data, size_t len, bool nonblock) {
+    return mxrio_write(io, data, len);
+}
+
+static ssize_t mxrio_readv(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    return mxio_readv_gathered(io, iov, iovcnt, mxrio_read_some);
+}
+
+static ssize_t mxrio_writev(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    return mxio_writev_gathered(io, iov, iovcnt, mxrio_write_some);
+}
+
 static mxio_ops_t mx_remote_ops = {
     .read = mxrio_read,
     .read_at = mxrio_read_at,
     .write = mxrio_write,
     .write_at = mxrio_write_at,
+    .readv = mxrio_readv,
+    .writev = mxrio_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .misc = mxrio_misc,
@@ -731,6 +1049,7 @@ static mxio_ops_t mx_remote_ops = {
     .wait_end = mxrio_wait_end,
     .unwrap = mxrio_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxrio_get_vmo,
 };
 
 mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
@@ -742,12 +1061,13 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     atomic_init(&rio->io.refcount, 1);
     rio->h = h;
     rio->h2 = e;
+    mtx_init(&rio->ra_lock, mtx_plain);
     return &rio->io;
 }
 
-static ssize_t mxsio_read_stream(mxio_t* io, void* data, size_t len) {
+static ssize_t mxsio_read_stream_some(mxio_t* io, void* data, size_t len, bool nonblock) {
     mxrio_t* rio = (mxrio_t*)io;
-    int nonblock = rio->io.flags & MXIO_FLAG_NONBLOCK;
+    nonblock = nonblock || (rio->io.flags & MXIO_FLAG_NONBLOCK);
 
     // TODO: let the generic read() to do this loop
     for (;;) {
@@ -778,9 +1098,9 @@ static ssize_t mxsio_read_stream(mxio_t* io, void* data, size_t len) {
     }
 }
 
-static ssize_t mxsio_write_stream(mxio_t* io, const void* data, size_t len) {
+static ssize_t mxsio_write_stream_some(mxio_t* io, const void* data, size_t len, bool nonblock) {
     mxrio_t* rio = (mxrio_t*)io;
-    int nonblock = rio->io.flags & MXIO_FLAG_NONBLOCK;
+    nonblock = nonblock || (rio->io.flags & MXIO_FLAG_NONBLOCK);
 
     // TODO: let the generic write() to do this loop
     for (;;) {
@@ -809,6 +1129,22 @@ static ssize_t mxsio_write_stream(mxio_t* io, const void* data, size_t len) {
     }
 }
 
+static ssize_t mxsio_read_stream(mxio_t* io, void* data, size_t len) {
+    return mxsio_read_stream_some(io, data, len, false);
+}
+
+static ssize_t mxsio_write_stream(mxio_t* io, const void* data, size_t len) {
+    return mxsio_write_stream_some(io, data, len, false);
+}
+
+static ssize_t mxsio_readv_stream(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    return mxio_readv_gathered(io, iov, iovcnt, mxsio_read_stream_some);
+}
+
+static ssize_t mxsio_writev_stream(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    return mxio_writev_gathered(io, iov, iovcnt, mxsio_write_stream_some);
+}
+
 static ssize_t mxsio_recvmsg_stream(mxio_t* io, struct msghdr* msg, int flags) {
     // TODO: support flags and control messages
     if (io->flags & MXIO_FLAG_SOCKET_CONNECTED) {
@@ -819,19 +1155,7 @@ static ssize_t mxsio_recvmsg_stream(mxio_t* io, struct msghdr* msg, int flags) {
     } else {
         return ERR_BAD_STATE;
     }
-    ssize_t total = 0;
-    for (int i = 0; i < msg->msg_iovlen; i++) {
-        struct iovec *iov = &msg->msg_iov[i];
-        ssize_t n = mxsio_read_stream(io, iov->iov_base, iov->iov_len);
-        if (n < 0) {
-            return n;
-        }
-        total += n;
-        if ((size_t)n != iov->iov_len) {
-            break;
-        }
-    }
-    return total;
+    return mxsio_readv_stream(io, msg->msg_iov, msg->msg_iovlen);
 }
 
 static ssize_t mxsio_sendmsg_stream(mxio_t* io, const struct msghdr* msg, int flags) {
@@ -844,22 +1168,12 @@ static ssize_t mxsio_sendmsg_stream(mxio_t* io, const struct msghdr* msg, int fl
     } else {
         return ERR_BAD_STATE;
     }
-    ssize_t total = 0;
     for (int i = 0; i < msg->msg_iovlen; i++) {
-        struct iovec *iov = &msg->msg_iov[i];
-        if (iov->iov_len <= 0) {
+        if (msg->msg_iov[i].iov_len <= 0) {
             return ERR_INVALID_ARGS;
         }
-        ssize_t n = mxsio_write_stream(io, iov->iov_base, iov->iov_len);
-        if (n < 0) {
-            return n;
-        }
-        total += n;
-        if ((size_t)n != iov->iov_len) {
-            break;
-        }
     }
-    return total;
+    return mxsio_writev_stream(io, msg->msg_iov, msg->msg_iovlen);
 }
 
 static void mxsio_wait_begin_stream(mxio_t* io, uint32_t events, mx_handle_t* handle, mx_signals_t* _signals) {
@@ -1164,6 +1478,8 @@ static void mxsio_wait_end_dgram(mxio_t* io, mx_signals_t signals, uint32_t* _ev
 static mxio_ops_t mxio_socket_stream_ops = {
     .read = mxsio_read_stream,
     .write = mxsio_write_stream,
+    .readv = mxsio_readv_stream,
+    .writev = mxsio_writev_stream,
     .recvmsg = mxsio_recvmsg_stream,
     .sendmsg = mxsio_sendmsg_stream,
     .seek = mxio_default_seek,
@@ -1176,11 +1492,14 @@ static mxio_ops_t mxio_socket_stream_ops = {
     .wait_end = mxsio_wait_end_stream,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxsio_posix_ioctl_stream,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 static mxio_ops_t mxio_socket_dgram_ops = {
     .read = mxsio_read_dgram,
     .write = mxsio_write_dgram,
+    .readv = mxio_default_readv,
+    .writev = mxio_default_writev,
     .recvmsg = mxsio_recvmsg_dgram,
     .sendmsg = mxsio_sendmsg_dgram,
     .seek = mxio_default_seek,
@@ -1193,6 +1512,7 @@ static mxio_ops_t mxio_socket_dgram_ops = {
     .wait_end = mxsio_wait_end_dgram,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl, // not supported
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_socket_create(mx_handle_t h, mx_handle_t s) {
@@ -1218,6 +1538,35 @@ void mxio_socket_set_dgram_ops(mxio_t* io) {
     rio->io.ops = &mxio_socket_dgram_ops;
 }
 
+ssize_t mxio_socket_sendfile(mxio_t* io, mx_handle_t vmo, uint64_t off, size_t len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    if (io->ops != &mxio_socket_stream_ops) {
+        mx_handle_close(vmo);
+        return ERR_NOT_SUPPORTED;
+    }
+    // the reply arg is an int32
+    if (len > INT32_MAX) {
+        len = INT32_MAX;
+    }
+
+    mxrio_msg_t msg;
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = MXRIO_SENDFILE;
+    msg.arg2.off = off;
+    uint64_t want = len;
+    memcpy(msg.data, &want, sizeof(want));
+    msg.datalen = sizeof(want);
+    msg.hcount = 1;
+    msg.handle[0] = vmo;
+
+    mx_status_t r;
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        return r;
+    }
+    discard_handles(msg.handle, msg.hcount);
+    return ((size_t)r > len) ? ERR_IO : r;
+}
+
 mx_status_t mxio_socket_shutdown(mxio_t* io, int how) {
     mxrio_t* rio = (mxrio_t*)io;
     if (how == SHUT_RD || how == SHUT_RDWR) {
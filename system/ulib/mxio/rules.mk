@@ -13,6 +13,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/bsdsocket.c \
     $(LOCAL_DIR)/dispatcher.c \
     $(LOCAL_DIR)/epoll.c \
+    $(LOCAL_DIR)/iovec.c \
     $(LOCAL_DIR)/logger.c \
     $(LOCAL_DIR)/null.c \
     $(LOCAL_DIR)/pipe.c \
@@ -15,6 +15,7 @@
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <utime.h>
@@ -350,6 +351,10 @@ void __libc_extensions_init(uint32_t handle_count,
         unsigned arg = MX_HND_INFO_ARG(handle_info[n]);
         mx_handle_t h = handle[n];
 
+        // Loggers may be asked to batch up their writes
+        uint32_t logger_flags = arg & MXIO_FLAG_LOGGER_BUFFERED;
+        arg &= (~MXIO_FLAG_LOGGER_BUFFERED);
+
         // MXIO uses this bit as a flag to say
         // that an fd should be duped into 0/1/2
         // and become all of stdin/out/err
@@ -384,7 +389,7 @@ void __libc_extensions_init(uint32_t handle_count,
             mxio_fdtab[arg]->dupcount++;
             break;
         case MX_HND_TYPE_MXIO_LOGGER:
-            mxio_fdtab[arg] = mxio_logger_create(h);
+            mxio_fdtab[arg] = mxio_logger_create_etc(h, logger_flags);
             mxio_fdtab[arg]->dupcount++;
             break;
         default:
@@ -499,6 +504,16 @@ ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_
     return r;
 }
 
+mx_status_t mxio_get_vmo(int fd, mx_handle_t* vmo, size_t* off, size_t* len) {
+    mxio_t* io;
+    if ((io = fd_to_io(fd)) == NULL) {
+        return ERR_BAD_HANDLE;
+    }
+    mx_status_t r = io->ops->get_vmo(io, vmo, off, len);
+    mxio_release(io);
+    return r;
+}
+
 mx_status_t mxio_wait_fd(int fd, uint32_t _events, uint32_t* _pending, mx_time_t timeout) {
     mx_status_t r = NO_ERROR;
     mxio_t* io;
@@ -548,6 +563,15 @@ mx_status_t mxio_wait_fd(int fd, uint32_t _events, uint32_t* _pending, mx_time_t
     return r;
 }
 
+static void vnattr_to_stat(const vnattr_t* attr, struct stat* s) {
+    memset(s, 0, sizeof(struct stat));
+    s->st_mode = attr->mode;
+    s->st_size = attr->size;
+    s->st_ino = attr->inode;
+    s->st_ctime = attr->create_time;
+    s->st_mtime = attr->modify_time;
+}
+
 int mxio_stat(mxio_t* io, struct stat* s) {
     vnattr_t attr;
     int r = io->ops->misc(io, MXRIO_STAT, 0, sizeof(attr), &attr, 0);
@@ -557,12 +581,7 @@ int mxio_stat(mxio_t* io, struct stat* s) {
     if (r < (int)sizeof(attr)) {
         return ERR_IO;
     }
-    memset(s, 0, sizeof(struct stat));
-    s->st_mode = attr.mode;
-    s->st_size = attr.size;
-    s->st_ino = attr.inode;
-    s->st_ctime = attr.create_time;
-    s->st_mtime = attr.modify_time;
+    vnattr_to_stat(&attr, s);
     return 0;
 }
 
@@ -607,43 +626,38 @@ int mxio_status_to_errno(mx_status_t status) {
 // centric posix-y io operations.
 
 ssize_t readv(int fd, const struct iovec* iov, int num) {
-    ssize_t count = 0;
+    if (num < 0 || num > IOV_MAX || (num > 0 && iov == NULL)) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
     ssize_t r;
-    while (num > 0) {
-        if (iov->iov_len != 0) {
-            r = read(fd, iov->iov_base, iov->iov_len);
-            if (r < 0) {
-                return count ? count : r;
-            }
-            if ((size_t)r < iov->iov_len) {
-                return count + r;
-            }
-            count += r;
+    for (;;) {
+        r = io->ops->readv(io, iov, num);
+        if (r != ERR_SHOULD_WAIT || io->flags & MXIO_FLAG_NONBLOCK) {
+            break;
         }
-        iov++;
-        num--;
+        mxio_wait_fd(fd, MXIO_EVT_READABLE, NULL, MX_TIME_INFINITE);
     }
-    return count;
+    mxio_release(io);
+    return STATUS(r);
 }
 
 ssize_t writev(int fd, const struct iovec* iov, int num) {
-    ssize_t count = 0;
-    ssize_t r;
-    while (num > 0) {
-        if (iov->iov_len != 0) {
-            r = write(fd, iov->iov_base, iov->iov_len);
-            if (r < 0) {
-                return count ? count : r;
-            }
-            if ((size_t)r < iov->iov_len) {
-                return count + r;
-            }
-            count += r;
-        }
-        iov++;
-        num--;
+    if (num < 0 || num > IOV_MAX || (num > 0 && iov == NULL)) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
     }
-    return count;
+    ssize_t r = STATUS(io->ops->writev(io, iov, num));
+    mxio_release(io);
+    return r;
 }
 
 int unlinkat(int dirfd, const char* path, int flags) {
@@ -694,6 +708,168 @@ ssize_t write(int fd, const void* buf, size_t count) {
     return r;
 }
 
+ssize_t pread(int fd, void* buf, size_t size, off_t ofs) {
+    if (buf == NULL) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
+    if (io->ops->read_at == NULL) {
+        mxio_release(io);
+        return ERRNO(ESPIPE);
+    }
+    mx_status_t status;
+    for (;;) {
+        status = io->ops->read_at(io, buf, size, ofs);
+        if (status != ERR_SHOULD_WAIT || io->flags & MXIO_FLAG_NONBLOCK) {
+            break;
+        }
+        mxio_wait_fd(fd, MXIO_EVT_READABLE, NULL, MX_TIME_INFINITE);
+    }
+    mxio_release(io);
+    return STATUS(status);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t size, off_t ofs) {
+    if (buf == NULL) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
+    if (io->ops->write_at == NULL) {
+        mxio_release(io);
+        return ERRNO(ESPIPE);
+    }
+    mx_status_t status;
+    for (;;) {
+        status = io->ops->write_at(io, buf, size, ofs);
+        if (status != ERR_SHOULD_WAIT || io->flags & MXIO_FLAG_NONBLOCK) {
+            break;
+        }
+        mxio_wait_fd(fd, MXIO_EVT_WRITABLE, NULL, MX_TIME_INFINITE);
+    }
+    mxio_release(io);
+    return STATUS(status);
+}
+
+// Writes all of data to out, returning how much that was before
+// any error, or the error if nothing was written.
+static ssize_t write_fully(mxio_t* out, const void* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = out->ops->write(out, (const char*)data + done, len - done);
+        if (r <= 0) {
+            return done ? (ssize_t)done : r;
+        }
+        done += r;
+    }
+    return done;
+}
+
+// Copies up to count bytes of in from pos to out.
+// Where the file has a VMO the data comes straight out of it, rather
+// than through the file's channel, and a stream socket whose server
+// takes MXRIO_SENDFILE is handed the VMO itself.
+static ssize_t sendfile_io(mxio_t* out, mxio_t* in, off_t pos, size_t count) {
+    char buf[MXIO_CHUNK_SIZE];
+    size_t done = 0;
+    ssize_t r = 0;
+
+    mx_handle_t vmo;
+    size_t vmo_off, len;
+    if (in->ops->get_vmo(in, &vmo, &vmo_off, &len) == NO_ERROR) {
+        if ((size_t)pos >= len) {
+            mx_handle_close(vmo);
+            return 0;
+        }
+        if (count > (len - pos)) {
+            count = len - pos;
+        }
+        uint64_t start = vmo_off + pos;
+
+        mx_handle_t dup;
+        if ((out->flags & MXIO_FLAG_SOCKET) &&
+            (mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &dup) == NO_ERROR)) {
+            if ((r = mxio_socket_sendfile(out, dup, start, count)) != ERR_NOT_SUPPORTED) {
+                mx_handle_close(vmo);
+                return r;
+            }
+        }
+
+        while (done < count) {
+            size_t n = (count - done) < sizeof(buf) ? (count - done) : sizeof(buf);
+            if ((r = mx_vmo_read(vmo, buf, start + done, n, &n)) < 0) {
+                break;
+            }
+            if ((r = write_fully(out, buf, n)) <= 0) {
+                break;
+            }
+            done += r;
+            if ((size_t)r < n) {
+                break;
+            }
+        }
+        mx_handle_close(vmo);
+        return done ? (ssize_t)done : r;
+    }
+
+    if (in->ops->read_at == NULL) {
+        return ERR_NOT_SUPPORTED;
+    }
+    while (done < count) {
+        size_t n = (count - done) < sizeof(buf) ? (count - done) : sizeof(buf);
+        if ((r = in->ops->read_at(in, buf, n, pos + done)) <= 0) {
+            break;
+        }
+        n = r;
+        if ((r = write_fully(out, buf, n)) <= 0) {
+            break;
+        }
+        done += r;
+        if ((size_t)r < n) {
+            break;
+        }
+    }
+    return done ? (ssize_t)done : r;
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+    mxio_t* in = fd_to_io(in_fd);
+    if (in == NULL) {
+        return ERRNO(EBADF);
+    }
+    mxio_t* out = fd_to_io(out_fd);
+    if (out == NULL) {
+        mxio_release(in);
+        return ERRNO(EBADF);
+    }
+
+    off_t pos = offset ? *offset : in->ops->seek(in, 0, SEEK_CUR);
+    ssize_t r;
+    if (pos < 0) {
+        r = offset ? ERR_INVALID_ARGS : pos;
+    } else if ((r = sendfile_io(out, in, pos, count)) > 0) {
+        if (offset) {
+            *offset = pos + r;
+        } else {
+            in->ops->seek(in, pos + r, SEEK_SET);
+        }
+    }
+    if (r == ERR_NOT_SUPPORTED) {
+        // Linux fails this way when in_fd can't be mapped
+        r = ERR_INVALID_ARGS;
+    }
+    mxio_release(out);
+    mxio_release(in);
+    return STATUS(r);
+}
+
 int close(int fd) {
     mtx_lock(&mxio_lock);
     if ((fd < 0) || (fd >= MAX_MXIO_FD) || (mxio_fdtab[fd] == NULL)) {
@@ -849,12 +1025,12 @@ off_t lseek(int fd, off_t offset, int whence) {
     return r;
 }
 
-static int getdirents(int fd, void* ptr, size_t len) {
+static mx_status_t getdirents(int fd, uint32_t op, void* ptr, size_t len) {
     mxio_t* io = fd_to_io(fd);
     if (io == NULL) {
-        return ERRNO(EBADF);
+        return ERR_BAD_HANDLE;
     }
-    int r = STATUS(io->ops->misc(io, MXRIO_READDIR, 0, len, ptr, 0));
+    mx_status_t r = io->ops->misc(io, op, 0, len, ptr, 0);
     mxio_release(io);
     return r;
 }
@@ -1196,9 +1372,11 @@ int chdir(const char* path) {
 struct __dirstream {
     mtx_t lock;
     int fd;
+    bool plus;     // data holds vdirent_plus_t records
+    bool no_plus;  // the server does not do READDIR_PLUS
     size_t size;
     uint8_t* ptr;
-    uint8_t data[DIR_BUFSIZE];
+    uint8_t data[DIR_BUFSIZE] __ALIGNED(8);
     struct dirent de;
 };
 
@@ -1243,30 +1421,58 @@ int closedir(DIR* dir) {
     return 0;
 }
 
-struct dirent* readdir(DIR* dir) {
+// Returns the next entry, and its attributes in *s if s is not NULL.
+// Those come with the listing when the server does READDIR_PLUS,
+// and from a stat of the entry otherwise.
+static struct dirent* readdir_common(DIR* dir, struct stat* s) {
     mtx_lock(&dir->lock);
     struct dirent* de = &dir->de;
     for (;;) {
-        if (dir->size >= sizeof(vdirent_t)) {
+        size_t hdrsize = dir->plus ? sizeof(vdirent_plus_t) : sizeof(vdirent_t);
+        if (dir->size >= hdrsize) {
             vdirent_t* vde = (void*)dir->ptr;
             if (dir->size >= vde->size) {
                 de->d_ino = 0;
                 de->d_off = 0;
                 de->d_reclen = 0;
-                de->d_type = vde->type;
-                strcpy(de->d_name, vde->name);
+                if (dir->plus) {
+                    vdirent_plus_t* vdp = (void*)dir->ptr;
+                    de->d_type = vdp->type;
+                    strcpy(de->d_name, vdp->name);
+                    if (s != NULL) {
+                        vnattr_to_stat(&vdp->attr, s);
+                    }
+                } else {
+                    de->d_type = vde->type;
+                    strcpy(de->d_name, vde->name);
+                    if ((s != NULL) && (fstatat(dir->fd, de->d_name, s, 0) < 0)) {
+                        memset(s, 0, sizeof(struct stat));
+                    }
+                }
                 dir->ptr += vde->size;
                 dir->size -= vde->size;
                 break;
             }
             dir->size = 0;
         }
-        int r = getdirents(dir->fd, dir->data, DIR_BUFSIZE);
+        mx_status_t r = ERR_NOT_SUPPORTED;
+        dir->plus = false;
+        if ((s != NULL) && !dir->no_plus) {
+            if ((r = getdirents(dir->fd, MXRIO_READDIR_PLUS, dir->data, DIR_BUFSIZE)) >= 0) {
+                dir->plus = true;
+            } else {
+                dir->no_plus = true;
+            }
+        }
+        if (!dir->plus) {
+            r = getdirents(dir->fd, MXRIO_READDIR, dir->data, DIR_BUFSIZE);
+        }
         if (r > 0) {
             dir->ptr = dir->data;
             dir->size = r;
             continue;
         }
+        STATUS(r);
         de = NULL;
         break;
     }
@@ -1274,6 +1480,14 @@ struct dirent* readdir(DIR* dir) {
     return de;
 }
 
+struct dirent* readdir(DIR* dir) {
+    return readdir_common(dir, NULL);
+}
+
+struct dirent* mxio_readdir_stat(DIR* dir, struct stat* s) {
+    return readdir_common(dir, s);
+}
+
 int dirfd(DIR* dir) {
     return dir->fd;
 }
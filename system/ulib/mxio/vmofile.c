@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <limits.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -47,6 +48,41 @@ static ssize_t vmofile_read(mxio_t* io, void* data, size_t len) {
     }
 }
 
+// takes the whole range at once, so the elements are read from consecutive
+// offsets whatever else uses the file meanwhile
+static ssize_t vmofile_readv(mxio_t* io, const struct iovec* iov, int iovcnt) {
+    vmofile_t* vf = (vmofile_t*)io;
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    mtx_lock(&vf->lock);
+    if (len > (vf->end - vf->ptr)) {
+        len = vf->end - vf->ptr;
+    }
+    mx_off_t at = vf->ptr;
+    vf->ptr += len;
+    mtx_unlock(&vf->lock);
+
+    size_t count = 0;
+    for (int i = 0; i < iovcnt && count < len; i++) {
+        size_t xfer = iov[i].iov_len;
+        if (xfer > len - count) {
+            xfer = len - count;
+        }
+        if (xfer == 0) {
+            continue;
+        }
+        mx_status_t status = mx_vmo_read(vf->vmo, iov[i].iov_base, at + count, xfer, &xfer);
+        if (status < 0) {
+            return count ? (ssize_t)count : status;
+        }
+        count += xfer;
+    }
+    return count;
+}
+
 static off_t vmofile_seek(mxio_t* io, off_t offset, int whence) {
     vmofile_t* vf = (vmofile_t*)io;
     mtx_lock(&vf->lock);
@@ -107,9 +143,32 @@ static mx_status_t vmofile_misc(mxio_t* io, uint32_t op, int64_t off, uint32_t m
     }
 }
 
+static mx_status_t vmofile_get_vmo(mxio_t* io, mx_handle_t* out, size_t* off, size_t* len) {
+    vmofile_t* vf = (vmofile_t*)io;
+    // clones must start on a page boundary, the file need not
+    mx_off_t start = vf->off & ~(PAGE_SIZE - 1);
+    mx_handle_t clone;
+    mx_status_t r = mx_vmo_clone(vf->vmo, MX_VMO_CLONE_COPY_ON_WRITE,
+                                 start, vf->end - start, &clone);
+    if (r < 0) {
+        return r;
+    }
+    mx_rights_t rights = MX_RIGHT_READ | MX_RIGHT_EXECUTE | MX_RIGHT_MAP |
+                         MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_GET_PROPERTY;
+    if ((r = mx_handle_replace(clone, rights, out)) < 0) {
+        mx_handle_close(clone);
+        return r;
+    }
+    *off = vf->off - start;
+    *len = vf->end - vf->off;
+    return NO_ERROR;
+}
+
 static mxio_ops_t vmofile_ops = {
     .read = vmofile_read,
     .write = mxio_default_write,
+    .readv = vmofile_readv,
+    .writev = mxio_default_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .seek = vmofile_seek,
@@ -122,6 +181,7 @@ static mxio_ops_t vmofile_ops = {
     .wait_end = mxio_default_wait_end,
     .unwrap = mxio_default_unwrap,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = vmofile_get_vmo,
 };
 
 mxio_t* mxio_vmofile_create(mx_handle_t h, mx_off_t off, mx_off_t len) {
@@ -68,6 +68,8 @@ static void mxwio_wait_end(mxio_t* io, mx_signals_t signals, uint32_t* _events)
 static mxio_ops_t mxio_waitable_ops = {
     .read = mxio_default_read,
     .write = mxio_default_write,
+    .readv = mxio_default_readv,
+    .writev = mxio_default_writev,
     .recvmsg = mxio_default_recvmsg,
     .sendmsg = mxio_default_sendmsg,
     .seek = mxio_default_seek,
@@ -79,6 +81,7 @@ static mxio_ops_t mxio_waitable_ops = {
     .wait_begin = mxwio_wait_begin,
     .wait_end = mxwio_wait_end,
     .posix_ioctl = mxio_default_posix_ioctl,
+    .get_vmo = mxio_default_get_vmo,
 };
 
 mxio_t* mxio_waitable_create(mx_handle_t h, mx_signals_t signals_in,
@@ -0,0 +1,172 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <assert.h>
+#include <mxtl/intrusive_pointer_traits.h>
+#include <mxtl/macros.h>
+
+// Usage Notes:
+//
+// mxtl::MpscQueue<> is an intrusive, lock-free, multi-producer/single-consumer
+// FIFO queue.  Any number of threads (or interrupt handlers) may push objects
+// onto the queue concurrently without taking a lock, while a single consumer
+// at a time pops them off in the order they were pushed.
+//
+// Like the other intrusive containers, the bookkeeping needed to be on the
+// queue lives in the objects themselves (see MpscQueueNodeState<T>), so
+// pushing and popping never allocate.  Unlike the other intrusive containers,
+// only raw unmanaged pointers (T*) are supported; there is no way to hand a
+// managed pointer's reference across threads without a lock.  It is up to the
+// user to keep objects alive while they are queued.
+//
+// Producers push onto an atomic LIFO list.  When the consumer runs out of
+// objects it has already claimed, it atomically takes the entire producer list
+// and reverses it into a private FIFO list.  Producers never wait for each
+// other or for the consumer, and each object is touched by the consumer
+// exactly once on the way out, so pop is O(1) amortized.
+//
+// The consumer side (pop, is_empty) is not thread safe.  If several threads
+// may consume, they must serialize themselves with their own lock.  Producers
+// need no such serialization.
+//
+// A typical use...
+//
+// struct Packet : public mxtl::MpscQueueable<Packet*> { ... };
+// mxtl::MpscQueue<Packet*> queue;
+//
+// /* Any thread */
+// queue.push(packet);
+// event_signal(&event, false);
+//
+// /* The consumer */
+// while ((packet = queue.pop()) != nullptr)
+//     Process(packet);
+//
+namespace mxtl {
+
+// MpscQueueNodeState<T>
+//
+// The state needed to be a member of an MpscQueue<T>.  All members of a
+// specific type MpscQueue<T> must expose a MpscQueueNodeState<T> to the queue
+// implementation via the supplied traits.  See DefaultMpscQueueTraits<T>
+template <typename T>
+struct MpscQueueNodeState {
+    using PtrTraits = internal::ContainerPtrTraits<T>;
+    static_assert(!PtrTraits::IsManaged, "MpscQueues only support unmanaged pointers");
+
+    constexpr MpscQueueNodeState() { }
+
+    bool IsValid() const { return true; }
+
+    T next_ = nullptr;
+};
+
+// DefaultMpscQueueTraits<T>
+//
+// The default implementation of traits needed to be a member of an MpscQueue.
+// Any valid traits implementation must expose a static node_state method
+// compatible with DefaultMpscQueueTraits<T>::node_state(...).  To use the
+// default traits, an object may...
+//
+// 1) Be friends with DefaultMpscQueueTraits<T> and have a private
+//    mpsc_node_state_ member.
+// 2) Have a public mpsc_node_state_ member (not recommended)
+// 3) Derive from MpscQueueable<T> (easiest)
+template <typename T>
+struct DefaultMpscQueueTraits {
+    using PtrTraits = internal::ContainerPtrTraits<T>;
+    static MpscQueueNodeState<T>& node_state(typename PtrTraits::RefType obj) {
+        return obj.mpsc_node_state_;
+    }
+};
+
+// MpscQueueable<T>
+//
+// A helper class which makes it simple to exist on an MpscQueue.  Simply
+// derive your object from MpscQueueable and you are done.
+template <typename T>
+struct MpscQueueable {
+private:
+    friend struct DefaultMpscQueueTraits<T>;
+    MpscQueueNodeState<T> mpsc_node_state_;
+};
+
+template <typename T, typename _NodeTraits = DefaultMpscQueueTraits<T>>
+class MpscQueue {
+public:
+    // Aliases used to reduce verbosity and expose types/traits to tests
+    using PtrTraits  = internal::ContainerPtrTraits<T>;
+    using NodeTraits = _NodeTraits;
+    using PtrType    = typename PtrTraits::PtrType;
+    using ValueType  = typename PtrTraits::ValueType;
+
+    static_assert(!PtrTraits::IsManaged, "MpscQueues only support unmanaged pointers");
+
+    constexpr MpscQueue() { }
+    ~MpscQueue() { DEBUG_ASSERT(is_empty()); }
+
+    // push
+    //
+    // Add an object to the back of the queue.  Safe to call from any number of
+    // threads concurrently with each other and with the consumer.
+    void push(PtrType ptr) {
+        DEBUG_ASSERT(ptr != nullptr);
+        auto& ns = NodeTraits::node_state(*ptr);
+
+        PtrType head = __atomic_load_n(&incoming_, __ATOMIC_RELAXED);
+        do {
+            ns.next_ = head;
+        } while (!__atomic_compare_exchange_n(&incoming_, &head, ptr, true,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    // pop
+    //
+    // Remove and return the object at the front of the queue, or nullptr if the
+    // queue is empty.  Consumer only.
+    PtrType pop() {
+        if (pending_ == nullptr) {
+            PtrType list = __atomic_exchange_n(&incoming_, nullptr, __ATOMIC_ACQUIRE);
+
+            // The producer list is newest-first.  Reverse it so that the
+            // oldest object comes out first.
+            while (list != nullptr) {
+                auto&   ns   = NodeTraits::node_state(*list);
+                PtrType next = ns.next_;
+                ns.next_ = pending_;
+                pending_ = list;
+                list     = next;
+            }
+
+            if (pending_ == nullptr)
+                return nullptr;
+        }
+
+        PtrType ret = pending_;
+        auto&   ns  = NodeTraits::node_state(*ret);
+        pending_ = ns.next_;
+        ns.next_ = nullptr;
+        return ret;
+    }
+
+    // is_empty
+    //
+    // True if there is nothing to pop.  Consumer only, and only a snapshot;
+    // producers may push at any time.
+    bool is_empty() const {
+        return (pending_ == nullptr) &&
+               (__atomic_load_n(&incoming_, __ATOMIC_RELAXED) == nullptr);
+    }
+
+private:
+    // MpscQueues may not currently be copied, assigned or moved.
+    DISALLOW_COPY_ASSIGN_AND_MOVE(MpscQueue);
+
+    PtrType incoming_ = nullptr;    // Pushed by producers, newest first.
+    PtrType pending_  = nullptr;    // Claimed by the consumer, oldest first.
+};
+
+}  // namespace mxtl
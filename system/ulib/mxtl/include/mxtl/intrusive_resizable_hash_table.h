@@ -0,0 +1,685 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <mxtl/intrusive_container_utils.h>
+#include <mxtl/intrusive_pointer_traits.h>
+#include <mxtl/intrusive_single_list.h>
+#include <mxtl/macros.h>
+
+// TODO(vtl): Rectify this difference.
+#ifdef _KERNEL
+#include <new.h>
+#else
+#include <magenta/new.h>
+#endif
+
+namespace mxtl {
+
+// Fwd decl of sanity checker class used by tests.
+namespace tests {
+namespace intrusive_containers {
+class ResizableHashTableChecker;
+}  // namespace tests
+}  // namespace intrusive_containers
+
+// DefaultResizableHashTraits
+//
+// Unlike the traits used by a fixed size HashTable, the hash traits of a
+// ResizableHashTable must not reduce the hash to a bucket index; the table
+// does that itself as its bucket count changes.  GetHash may return any value
+// of HashType.
+//
+// DefaultResizableHashTraits generates a compliant implementation of hash
+// traits which simply calls a static method of ObjType named GetHash which
+// takes a const reference to a KeyType and returns a HashType.
+template <typename KeyType,
+          typename ObjType,
+          typename HashType>
+struct DefaultResizableHashTraits {
+    static_assert(is_unsigned_integer<HashType>::value, "HashTypes must be unsigned integers");
+    static HashType GetHash(const KeyType& key) { return ObjType::GetHash(key); }
+};
+
+// ResizableHashTable
+//
+// An intrusive hash table whose bucket count follows the number of elements it
+// holds.  Nodes are the same intrusive bucket nodes a HashTable uses, so
+// inserting and erasing elements never allocates.  The only allocations are
+// of the bucket arrays themselves.
+//
+// The table starts out using kMinBuckets buckets stored inline in the table.
+// When an insert pushes the load above kMaxLoadFactor elements per bucket, a
+// bucket array twice the size is allocated and the table begins rehashing into
+// it incrementally; each subsequent insert moves a couple of buckets over, so
+// no single operation pays for rehashing the whole table.  Until the rehash
+// finishes, lookups consult whichever array currently holds the key's bucket.
+// If the larger array cannot be allocated, the table simply keeps its current
+// buckets and chains get longer.
+//
+// Bucket indices are taken from the high bits of a Fibonacci (multiplicative)
+// hash of the user's hash value, so hash functions do not need to be
+// particularly well distributed in their low bits.
+//
+// Erase operations never move elements between buckets, so erasing while
+// iterating behaves exactly as it does for a HashTable.  Inserts may rehash,
+// and invalidate all outstanding iterators.  The table does not shrink as
+// elements are erased; clear() returns it to its inline buckets.
+template <typename  _KeyType,
+          typename  _PtrType,
+          typename  _BucketType = SinglyLinkedList<_PtrType>,
+          typename  _HashType   = size_t,
+          size_t    _MinBuckets = 16,
+          typename  _KeyTraits  = DefaultKeyedObjectTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType>,
+          typename  _HashTraits = DefaultResizableHashTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType,
+                                    _HashType>>
+class ResizableHashTable {
+private:
+    // Private fwd decls of the iterator implementation.
+    template <typename IterTraits> class iterator_impl;
+    struct iterator_traits;
+    struct const_iterator_traits;
+
+public:
+    // Pointer types/traits
+    using PtrType      = _PtrType;
+    using PtrTraits    = internal::ContainerPtrTraits<PtrType>;
+    using ValueType    = typename PtrTraits::ValueType;
+
+    // Key types/traits
+    using KeyType      = _KeyType;
+    using KeyTraits    = _KeyTraits;
+
+    // Hash types/traits
+    using HashType     = _HashType;
+    using HashTraits   = _HashTraits;
+
+    // Bucket types/traits
+    using BucketType   = _BucketType;
+    using NodeTraits   = typename BucketType::NodeTraits;
+
+    // Declarations of the standard iterator types.
+    using iterator       = iterator_impl<iterator_traits>;
+    using const_iterator = iterator_impl<const_iterator_traits>;
+
+    // An alias for the type of this specific ResizableHashTable<...> and its
+    // test sanity checker.
+    using ContainerType = ResizableHashTable<_KeyType, _PtrType, _BucketType, _HashType,
+                                             _MinBuckets, _KeyTraits, _HashTraits>;
+    using CheckerType   = ::mxtl::tests::intrusive_containers::ResizableHashTableChecker;
+
+    // The number of buckets stored inline in the table, and the number the
+    // table returns to when cleared.  Must be a power of two.
+    static constexpr size_t kMinBuckets = _MinBuckets;
+
+    // The average chain length at which an insert starts growing the table.
+    static constexpr size_t kMaxLoadFactor = 2;
+
+    // The number of buckets moved from the old bucket array to the new one by
+    // each insert while the table is growing.  Growing doubles the bucket
+    // count, and it takes at least twice the old bucket count worth of inserts
+    // to need to grow again, so any value >= 1 finishes the move in time.
+    static constexpr size_t kMigrateBatch = 2;
+
+    // Hash tables only support constant order erase if their underlying bucket
+    // type does.
+    static constexpr bool SupportsConstantOrderErase = BucketType::SupportsConstantOrderErase;
+    static constexpr bool SupportsConstantOrderSize = true;
+    static constexpr bool IsAssociative = true;
+    static constexpr bool IsSequenced = false;
+
+    static_assert((kMinBuckets >= 2) && !(kMinBuckets & (kMinBuckets - 1)),
+                  "ResizableHashTables must start with a power of two (>= 2) buckets");
+    static_assert(is_unsigned_integer<HashType>::value, "HashTypes must be unsigned integers");
+
+    ResizableHashTable() { }
+    ~ResizableHashTable() {
+        DEBUG_ASSERT(PtrTraits::IsManaged || is_empty());
+        FreeBuckets(old_buckets_);
+        FreeBuckets(buckets_);
+    }
+
+    // Standard begin/end, cbegin/cend iterator accessors.
+    iterator begin()              { return       iterator(this,       iterator::BEGIN); }
+    const_iterator begin()  const { return const_iterator(this, const_iterator::BEGIN); }
+    const_iterator cbegin() const { return const_iterator(this, const_iterator::BEGIN); }
+
+    iterator end()              { return       iterator(this,       iterator::END); }
+    const_iterator end()  const { return const_iterator(this, const_iterator::END); }
+    const_iterator cend() const { return const_iterator(this, const_iterator::END); }
+
+    // make_iterator : construct an iterator out of a reference to an object.
+    iterator make_iterator(ValueType& obj) {
+        size_t ndx = GetBucketNdx(KeyTraits::GetKey(obj));
+        return iterator(this, ndx, GetBucket(ndx).make_iterator(obj));
+    }
+
+    void insert(const PtrType& ptr) { insert(PtrType(ptr)); }
+    void insert(PtrType&& ptr) {
+        DEBUG_ASSERT(ptr != nullptr);
+        MaintainForInsert();
+
+        KeyType key = KeyTraits::GetKey(*ptr);
+        BucketType& bucket = GetBucket(GetBucketNdx(key));
+
+        // Duplicate keys are disallowed.  Debug assert if someone tries to to
+        // insert an element with a duplicate key.  If the user thought that
+        // there might be a duplicate key in the ResizableHashTable already,
+        // he/she should have used insert_or_find() instead.
+        DEBUG_ASSERT(FindInBucket(bucket, key).IsValid() == false);
+
+        bucket.push_front(mxtl::move(ptr));
+        ++count_;
+    }
+
+    // insert_or_find
+    //
+    // Insert the element pointed to by ptr if it is not already in the
+    // ResizableHashTable, or find the element that the ptr collided with
+    // instead.
+    //
+    // 'iter' is an optional out parameter pointer to an iterator which
+    // will reference either the newly inserted item, or the item whose key
+    // collided with ptr.
+    //
+    // insert_or_find returns true if there was no collision and the item was
+    // successfully inserted, otherwise it returns false.
+    //
+    bool insert_or_find(const PtrType& ptr, iterator* iter = nullptr) {
+        return insert_or_find(PtrType(ptr), iter);
+    }
+
+    bool insert_or_find(PtrType&& ptr, iterator* iter = nullptr) {
+        DEBUG_ASSERT(ptr != nullptr);
+        MaintainForInsert();
+
+        KeyType key         = KeyTraits::GetKey(*ptr);
+        size_t  ndx         = GetBucketNdx(key);
+        auto&   bucket      = GetBucket(ndx);
+        auto    bucket_iter = FindInBucket(bucket, key);
+
+        if (bucket_iter.IsValid()) {
+            if (iter) *iter = iterator(this, ndx, bucket_iter);
+            return false;
+        }
+
+        bucket.push_front(mxtl::move(ptr));
+        ++count_;
+        if (iter) *iter = iterator(this, ndx, bucket.begin());
+        return true;
+    }
+
+    iterator find(const KeyType& key) {
+        size_t ndx         = GetBucketNdx(key);
+        auto&  bucket      = GetBucket(ndx);
+        auto   bucket_iter = FindInBucket(bucket, key);
+
+        return bucket_iter.IsValid() ? iterator(this, ndx, bucket_iter)
+                                     : iterator(this, iterator::END);
+    }
+
+    const_iterator find(const KeyType& key) const {
+        size_t      ndx         = GetBucketNdx(key);
+        const auto& bucket      = GetBucket(ndx);
+        auto        bucket_iter = FindInBucket(bucket, key);
+
+        return bucket_iter.IsValid() ? const_iterator(this, ndx, bucket_iter)
+                                     : const_iterator(this, const_iterator::END);
+    }
+
+    PtrType erase(const KeyType& key) {
+        BucketType& bucket = GetBucket(GetBucketNdx(key));
+
+        PtrType ret = internal::KeyEraseUtils<BucketType, KeyTraits>::erase(bucket, key);
+        if (ret != nullptr)
+            --count_;
+
+        return ret;
+    }
+
+    PtrType erase(const iterator& iter) {
+        if (!iter.IsValid())
+            return PtrType(nullptr);
+
+        return direct_erase(GetBucket(iter.bucket_ndx_), *iter);
+    }
+
+    PtrType erase(ValueType& obj) {
+        return direct_erase(GetBucket(GetBucketNdx(KeyTraits::GetKey(obj))), obj);
+    }
+
+    // clear
+    //
+    // Clear out the all of the hashtable buckets and return to the inline
+    // bucket array.  For managed pointer types, this will release all
+    // references held by the hashtable to the objects which were in it.
+    void clear() {
+        for (size_t i = 0; i < total_bucket_count(); ++i)
+            GetBucket(i).clear();
+        count_ = 0;
+        ResetBuckets();
+    }
+
+    // clear_unsafe
+    //
+    // Perform a clear_unsafe on all buckets and reset the internal count to
+    // zero.  See comments in mxtl/intrusive_single_list.h
+    // Think carefully before calling this!
+    void clear_unsafe() {
+        static_assert(PtrTraits::IsManaged == false,
+                     "clear_unsafe is not allowed for containers of managed pointers");
+
+        for (size_t i = 0; i < total_bucket_count(); ++i)
+            GetBucket(i).clear_unsafe();
+
+        count_ = 0;
+        ResetBuckets();
+    }
+
+    size_t size()         const { return count_; }
+    bool   is_empty()     const { return count_ == 0; }
+
+    // The number of buckets the table is (or is in the process of) hashing
+    // into.
+    size_t bucket_count() const { return bucket_count_; }
+
+    // erase_if
+    //
+    // Find the first member of the hash table which satisfies the predicate
+    // given by 'fn' and erase it from the list, returning a referenced pointer
+    // to the removed element.  Return nullptr if no member satisfies the
+    // predicate.
+    template <typename UnaryFn>
+    PtrType erase_if(UnaryFn fn) {
+        if (is_empty())
+            return PtrType(nullptr);
+
+        for (size_t i = 0; i < total_bucket_count(); ++i) {
+            auto& bucket = GetBucket(i);
+            if (!bucket.is_empty()) {
+                PtrType ret = bucket.erase_if(fn);
+                if (ret != nullptr) {
+                    --count_;
+                    return ret;
+                }
+            }
+        }
+
+        return PtrType(nullptr);
+    }
+
+    // find_if
+    //
+    // Find the first member of the hash table which satisfies the predicate
+    // given by 'fn' and return an iterator to it.  Return end() if no member
+    // satisfies the predicate.
+    template <typename UnaryFn>
+    const_iterator find_if(UnaryFn fn) const {
+        for (auto iter = begin(); iter.IsValid(); ++iter)
+            if (fn(*iter))
+                return iter;
+
+        return end();
+    }
+
+    template <typename UnaryFn>
+    iterator find_if(UnaryFn fn) {
+        for (auto iter = begin(); iter.IsValid(); ++iter)
+            if (fn(*iter))
+                return iter;
+
+        return end();
+    }
+
+private:
+    // The traits of a non-const iterator
+    struct iterator_traits {
+        using RefType    = typename PtrTraits::RefType;
+        using RawPtrType = typename PtrTraits::RawPtrType;
+        using IterType   = typename BucketType::iterator;
+
+        static IterType BucketBegin(BucketType& bucket) { return bucket.begin(); }
+        static IterType BucketEnd  (BucketType& bucket) { return bucket.end(); }
+    };
+
+    // The traits of a const iterator
+    struct const_iterator_traits {
+        using RefType    = typename PtrTraits::ConstRefType;
+        using RawPtrType = typename PtrTraits::ConstRawPtrType;
+        using IterType   = typename BucketType::const_iterator;
+
+        static IterType BucketBegin(const BucketType& bucket) { return bucket.cbegin(); }
+        static IterType BucketEnd  (const BucketType& bucket) { return bucket.cend(); }
+    };
+
+    // The shared implementation of the iterator.  Iterators walk a single
+    // combined index space; the buckets of the old array (if the table is in
+    // the middle of growing) come first, followed by the buckets of the
+    // current array.  See GetBucket.
+    template <class IterTraits>
+    class iterator_impl {
+    public:
+        iterator_impl() { }
+        iterator_impl(const iterator_impl& other) {
+            hash_table_ = other.hash_table_;
+            bucket_ndx_ = other.bucket_ndx_;
+            iter_       = other.iter_;
+        }
+
+        iterator_impl& operator=(const iterator_impl& other) {
+            hash_table_ = other.hash_table_;
+            bucket_ndx_ = other.bucket_ndx_;
+            iter_       = other.iter_;
+            return *this;
+        }
+
+        bool IsValid() const { return iter_.IsValid(); }
+        bool operator==(const iterator_impl& other) const { return iter_ == other.iter_; }
+        bool operator!=(const iterator_impl& other) const { return iter_ != other.iter_; }
+
+        // Prefix
+        iterator_impl& operator++() {
+            if (!IsValid()) return *this;
+            DEBUG_ASSERT(hash_table_);
+
+            // Bump the bucket iterator and go looking for a new bucket if the
+            // iterator has become invalid.
+            ++iter_;
+            advance_if_invalid_iter();
+
+            return *this;
+        }
+
+        iterator_impl& operator--() {
+            // If we have never been bound to a ResizableHashTable instance, the
+            // we had better be invalid.
+            if (!hash_table_) {
+                DEBUG_ASSERT(!IsValid());
+                return *this;
+            }
+
+            // Back up the bucket iterator.  If it is still valid, then we are done.
+            --iter_;
+            if (iter_.IsValid())
+                return *this;
+
+            // If the iterator is invalid after backing up, check previous
+            // buckets to see if they contain any nodes.
+            while (bucket_ndx_) {
+                --bucket_ndx_;
+                auto& bucket = GetBucket(bucket_ndx_);
+                if (!bucket.is_empty()) {
+                    iter_ = --IterTraits::BucketEnd(bucket);
+                    DEBUG_ASSERT(iter_.IsValid());
+                    return *this;
+                }
+            }
+
+            // Looks like we have backed up past the beginning.  Update the
+            // bookkeeping to point at the end of the last bucket.
+            bucket_ndx_ = last_bucket_ndx();
+            iter_ = IterTraits::BucketEnd(GetBucket(bucket_ndx_));
+
+            return *this;
+        }
+
+        // Postfix
+        iterator_impl operator++(int) {
+            iterator_impl ret(*this);
+            ++(*this);
+            return ret;
+        }
+
+        iterator_impl operator--(int) {
+            iterator_impl ret(*this);
+            --(*this);
+            return ret;
+        }
+
+        typename PtrTraits::PtrType CopyPointer()          { return iter_.CopyPointer(); }
+        typename IterTraits::RefType operator*()     const { return iter_.operator*(); }
+        typename IterTraits::RawPtrType operator->() const { return iter_.operator->(); }
+
+    private:
+        friend ContainerType;
+        using IterType = typename IterTraits::IterType;
+
+        enum BeginTag { BEGIN };
+        enum EndTag { END };
+
+        iterator_impl(const ContainerType* hash_table, BeginTag)
+            : hash_table_(hash_table),
+              bucket_ndx_(0),
+              iter_(IterTraits::BucketBegin(GetBucket(0))) {
+            advance_if_invalid_iter();
+        }
+
+        iterator_impl(const ContainerType* hash_table, EndTag)
+            : hash_table_(hash_table),
+              bucket_ndx_(last_bucket_ndx()),
+              iter_(IterTraits::BucketEnd(GetBucket(last_bucket_ndx()))) { }
+
+        iterator_impl(const ContainerType* hash_table, size_t bucket_ndx, const IterType& iter)
+            : hash_table_(hash_table),
+              bucket_ndx_(bucket_ndx),
+              iter_(iter) { }
+
+        BucketType& GetBucket(size_t ndx) {
+            return const_cast<ContainerType*>(hash_table_)->GetBucket(ndx);
+        }
+
+        size_t last_bucket_ndx() const { return hash_table_->total_bucket_count() - 1; }
+
+        void advance_if_invalid_iter() {
+            // If the iterator has run off the end of it's current bucket, then
+            // check to see if there are nodes in any of the remaining buckets.
+            if (!iter_.IsValid()) {
+                size_t last = last_bucket_ndx();
+                while (bucket_ndx_ < last) {
+                    ++bucket_ndx_;
+                    auto& bucket = GetBucket(bucket_ndx_);
+
+                    if (!bucket.is_empty()) {
+                        iter_ = IterTraits::BucketBegin(bucket);
+                        DEBUG_ASSERT(iter_.IsValid());
+                        break;
+                    } else if (bucket_ndx_ == last) {
+                        iter_ = IterTraits::BucketEnd(bucket);
+                    }
+                }
+            }
+        }
+
+        const ContainerType* hash_table_ = nullptr;
+        size_t bucket_ndx_ = 0;
+        IterType iter_;
+    };
+
+    PtrType direct_erase(BucketType& bucket, ValueType& obj) {
+        PtrType ret = internal::DirectEraseUtils<BucketType>::erase(bucket, obj);
+
+        if (ret != nullptr)
+            --count_;
+
+        return ret;
+    }
+
+    static typename BucketType::iterator FindInBucket(BucketType& bucket,
+                                                      const KeyType& key) {
+        return bucket.find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    static typename BucketType::const_iterator FindInBucket(const BucketType& bucket,
+                                                            const KeyType& key) {
+        return bucket.find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    // The test framework's 'checker' class is our friend.
+    friend CheckerType;
+
+    // Iterators need to access our bucket arrays in order to iterate.
+    friend iterator;
+    friend const_iterator;
+
+    // Hash tables may not currently be copied, assigned or moved.
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ResizableHashTable);
+
+    // Reduce a user hash to an index into an array of (1 << shift) buckets by
+    // keeping the top bits of a Fibonacci hash.  Doubling the array splits
+    // bucket N into buckets 2N and 2N + 1.
+    static size_t HashToNdx(HashType hash, uint32_t shift) {
+        DEBUG_ASSERT((shift > 0) && (shift < 64));
+        return static_cast<size_t>((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull)
+                                   >> (64 - shift));
+    }
+
+    static constexpr uint32_t Log2(size_t val) {
+        return (val <= 1) ? 0 : 1 + Log2(val >> 1);
+    }
+
+    size_t total_bucket_count() const { return old_bucket_count_ + bucket_count_; }
+
+    // Buckets are addressed by a combined index.  Indices below
+    // old_bucket_count_ refer to the bucket array being migrated away from
+    // (empty unless the table is growing), the rest to the current array.
+    BucketType& GetBucket(size_t ndx) {
+        DEBUG_ASSERT(ndx < total_bucket_count());
+        return (ndx < old_bucket_count_) ? old_buckets_[ndx]
+                                         : buckets_[ndx - old_bucket_count_];
+    }
+
+    const BucketType& GetBucket(size_t ndx) const {
+        return const_cast<ContainerType*>(this)->GetBucket(ndx);
+    }
+
+    // The combined index of the bucket which currently holds (or would hold)
+    // key.  While growing, keys whose old bucket has not yet been migrated
+    // still live in the old array.
+    size_t GetBucketNdx(const KeyType& key) const {
+        HashType hash = HashTraits::GetHash(key);
+
+        if (old_bucket_count_) {
+            size_t old_ndx = HashToNdx(hash, bucket_shift_ - 1);
+            if (old_ndx >= migrate_ndx_)
+                return old_ndx;
+        }
+
+        return old_bucket_count_ + HashToNdx(hash, bucket_shift_);
+    }
+
+    // Called before every insert.  Moves some buckets along if we are in the
+    // middle of growing, and starts growing if the table has become too
+    // heavily loaded.
+    void MaintainForInsert() {
+        if (old_bucket_count_)
+            MigrateBuckets(kMigrateBatch);
+
+        if ((count_ + 1) <= (bucket_count_ * kMaxLoadFactor))
+            return;
+
+        // We should always have finished the previous migration by the time we
+        // need to grow again, but make certain of it.
+        if (old_bucket_count_)
+            MigrateBuckets(old_bucket_count_);
+
+        if (bucket_shift_ >= ((sizeof(size_t) * 8) - 2))
+            return;
+
+        size_t new_count = bucket_count_ << 1;
+        AllocChecker ac;
+        BucketType* new_buckets = new (&ac) BucketType[new_count];
+        if (!ac.check())
+            return;
+
+        old_buckets_      = buckets_;
+        old_bucket_count_ = bucket_count_;
+        migrate_ndx_      = 0;
+        buckets_          = new_buckets;
+        bucket_count_     = new_count;
+        ++bucket_shift_;
+    }
+
+    // Move the contents of up to 'count' old buckets into the current bucket
+    // array, releasing the old array once it has been emptied.
+    void MigrateBuckets(size_t count) {
+        DEBUG_ASSERT(old_bucket_count_);
+
+        while (count-- && (migrate_ndx_ < old_bucket_count_)) {
+            BucketType& src = old_buckets_[migrate_ndx_++];
+            while (!src.is_empty()) {
+                PtrType ptr = src.pop_front();
+                size_t ndx = HashToNdx(HashTraits::GetHash(KeyTraits::GetKey(*ptr)),
+                                       bucket_shift_);
+                buckets_[ndx].push_front(mxtl::move(ptr));
+            }
+        }
+
+        if (migrate_ndx_ >= old_bucket_count_) {
+            FreeBuckets(old_buckets_);
+            old_buckets_      = nullptr;
+            old_bucket_count_ = 0;
+            migrate_ndx_      = 0;
+        }
+    }
+
+    void FreeBuckets(BucketType* buckets) {
+        if ((buckets != nullptr) && (buckets != inline_buckets_))
+            delete[] buckets;
+    }
+
+    // Return to the inline bucket array.  All buckets must already be empty.
+    void ResetBuckets() {
+        DEBUG_ASSERT(is_empty());
+        FreeBuckets(old_buckets_);
+        FreeBuckets(buckets_);
+        old_buckets_      = nullptr;
+        old_bucket_count_ = 0;
+        migrate_ndx_      = 0;
+        buckets_          = inline_buckets_;
+        bucket_count_     = kMinBuckets;
+        bucket_shift_     = Log2(kMinBuckets);
+    }
+
+    size_t      count_            = 0UL;
+    BucketType* buckets_          = inline_buckets_;
+    size_t      bucket_count_     = kMinBuckets;
+    uint32_t    bucket_shift_     = Log2(kMinBuckets);
+    BucketType* old_buckets_      = nullptr;
+    size_t      old_bucket_count_ = 0UL;
+    size_t      migrate_ndx_      = 0UL;
+    BucketType  inline_buckets_[kMinBuckets];
+};
+
+// Explicit declaration of constexpr storage.  Appologies for the macro, but the
+// template declarations are just too hideous with it.
+#define RESIZABLE_HASH_TABLE_PROP(_type, _name) \
+template <typename KeyType, typename PtrType, typename BucketType, typename HashType, \
+          size_t MinBuckets, typename KeyTraits, typename HashTraits> \
+constexpr _type ResizableHashTable<KeyType, PtrType, BucketType, HashType, \
+                                   MinBuckets, KeyTraits, HashTraits>::_name
+
+RESIZABLE_HASH_TABLE_PROP(size_t, kMinBuckets);
+RESIZABLE_HASH_TABLE_PROP(size_t, kMaxLoadFactor);
+RESIZABLE_HASH_TABLE_PROP(size_t, kMigrateBatch);
+RESIZABLE_HASH_TABLE_PROP(bool, SupportsConstantOrderErase);
+RESIZABLE_HASH_TABLE_PROP(bool, SupportsConstantOrderSize);
+RESIZABLE_HASH_TABLE_PROP(bool, IsAssociative);
+RESIZABLE_HASH_TABLE_PROP(bool, IsSequenced);
+
+#undef RESIZABLE_HASH_TABLE_PROP
+
+}  // namespace mxtl
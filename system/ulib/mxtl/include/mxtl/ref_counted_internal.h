@@ -19,6 +19,18 @@ protected:
         // TODO(jamesr): Replace uses of GCC builtins with something safer.
         __atomic_fetch_add(&ref_count_, 1, __ATOMIC_RELAXED);
     }
+    // Like AddRef(), but fails instead of reviving an object whose count has
+    // already dropped to zero, i.e. one that is being destroyed.
+    bool AddRefMaybeInDestructor() __WARN_UNUSED_RESULT {
+        DEBUG_ASSERT(adopted_);
+        int old = __atomic_load_n(&ref_count_, __ATOMIC_RELAXED);
+        do {
+            if (old == 0)
+                return false;
+        } while (!__atomic_compare_exchange_n(&ref_count_, &old, old + 1, true,
+                                              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+        return true;
+    }
     // Returns true if the object should self-delete.
     bool Release() __WARN_UNUSED_RESULT {
         DEBUG_ASSERT(adopted_);
@@ -19,6 +19,9 @@ RefPtr<T> AdoptRef(T* ptr);
 template <typename T>
 RefPtr<T> WrapRefPtr(T* ptr);
 
+template <typename T>
+RefPtr<T> MakeRefPtrUpgradeFromRaw(T* ptr);
+
 namespace internal {
 template <typename T>
 RefPtr<T> MakeRefPtrNoAdopt(T* ptr);
@@ -189,6 +192,7 @@ private:
     friend class RefPtr;
     friend RefPtr<T> AdoptRef<T>(T*);
     friend RefPtr<T> internal::MakeRefPtrNoAdopt<T>(T*);
+    friend RefPtr<T> MakeRefPtrUpgradeFromRaw<T>(T*);
 
     enum AdoptTag { ADOPT };
     enum NoAdoptTag { NO_ADOPT };
@@ -235,6 +239,18 @@ inline RefPtr<T> WrapRefPtr(T* ptr) {
     return RefPtr<T>(ptr);
 }
 
+// Constructs a RefPtr from a raw pointer to an object that may be in the middle
+// of being destroyed, returning null if it is. The caller must keep the memory
+// valid across the call, typically by holding a lock that the object's
+// destructor takes before it finishes, e.g. to remove the object from a list
+// the raw pointer was found on.
+template <typename T>
+inline RefPtr<T> MakeRefPtrUpgradeFromRaw(T* ptr) {
+    if (!ptr || !ptr->AddRefMaybeInDestructor())
+        return nullptr;
+    return RefPtr<T>(ptr, RefPtr<T>::NO_ADOPT);
+}
+
 namespace internal {
 // Constructs a RefPtr from a T* without attempt to either AddRef or Adopt the
 // pointer.  Used by the internals of some intrusive container classes to store
@@ -16,6 +16,14 @@
 #include <mxtl/unique_ptr.h>
 #include <stdlib.h>
 
+#if _KERNEL
+#include <arch/ops.h>
+#include <kernel/spinlock.h>
+#include <new.h>
+#else
+#include <threads.h>
+#endif
+
 // Usage Notes:
 //
 // mxtl::SlabAllocator<> is a utility class which implements a slab-style
@@ -93,6 +101,32 @@
 //
 // mxtl::SlabAllocator<UnlockedStaticSlabAllocator<mxtl::unique_ptr<MyObject>> allocator;
 //
+// :: Magazines ::
+//
+// With a single lock per allocator, every allocation and free serializes on
+// that lock.  Allocators which are hammered from many threads at once may set
+// the MAGAZINE_SIZE parameter of SlabAllocatorTraits<> (default 0, meaning no
+// magazines) to give the allocator a set of small caches of free objects
+// ("magazines") which sit in front of the shared free list and slabs.
+//
+// In the kernel there is one magazine per cpu.  In user mode there is a fixed
+// set of magazines and each thread is assigned one by hashing its thread
+// handle, so threads only contend when they happen to share a magazine.  Each
+// magazine has its own lock (a spinlock in the kernel, LockType in user mode),
+// so a thread using its own magazine never touches the allocator's lock.
+//
+// When a magazine runs dry, it is refilled with MAGAZINE_SIZE / 2 objects taken
+// from the shared free list (or carved from slabs) under a single acquisition
+// of the allocator lock.  When a magazine is full, half of it is flushed back
+// to the shared free list the same way.  If the shared pool is exhausted, an
+// allocation will raid the other magazines before failing.  Objects only move
+// between the magazines and the shared pool with the allocator lock held, as
+// does the raid, so it finds every free object and the max_slabs limit still
+// describes exactly how many objects may be live at once.
+//
+// CachingSlabAllocatorTraits and StaticCachingSlabAllocatorTraits are provided
+// as a shorthand for mutex protected allocators with magazines.
+//
 // :: Object Requirements ::
 //
 // Objects must be small enough that at least 1 can be allocated from a slab
@@ -253,7 +287,8 @@ namespace mxtl {
 template <typename T,
           size_t   SLAB_SIZE,
           typename LockType,
-          bool     IsStaticAllocator> struct SlabAllocatorTraits;
+          bool     IsStaticAllocator,
+          size_t   MAGAZINE_SIZE> struct SlabAllocatorTraits;
 template <typename SATraits, typename = void> class SlabAllocator;
 template <typename SATraits, typename = void> class SlabAllocated;
 
@@ -309,6 +344,175 @@ struct SlabOriginSetter<SATraits,
                                  internal::SlabAllocator<SATraits>* origin) { }
 };
 
+// SlabMagazines<>
+//
+// The set of magazines which cache free objects in front of an allocator's
+// shared free list.  See "Magazines" above.  Magazines hold objects which have
+// already been converted to free list entries.
+template <typename EntryType, size_t MagazineSize, typename LockType>
+class SlabMagazines {
+public:
+    using FreeList = SinglyLinkedList<EntryType*>;
+
+    static_assert(MagazineSize >= 2, "Magazines must hold at least 2 objects");
+
+    SlabMagazines() { }
+    DISALLOW_COPY_ASSIGN_AND_MOVE(SlabMagazines);
+
+    // Take an object from the calling thread's magazine, or nullptr if it is
+    // empty.
+    EntryType* Pop() {
+        MagazineAccess mag(this);
+        EntryType* ret = mag->list.pop_front();
+        if (ret != nullptr)
+            --mag->count;
+        return ret;
+    }
+
+    // Put an object into the calling thread's magazine if there is room for it.
+    bool TryPush(EntryType* entry) {
+        MagazineAccess mag(this);
+        if (mag->count >= MagazineSize)
+            return false;
+        mag->list.push_front(entry);
+        ++mag->count;
+        return true;
+    }
+
+    // The rest are called with the allocator's lock held, so that objects only
+    // ever move between the magazines and the shared free list while Steal()
+    // cannot be looking for them.
+
+    // Put an object into the calling thread's magazine.  If the magazine is
+    // full, half of its contents are moved to 'overflow' for the caller to
+    // return to the shared free list.
+    void Push(EntryType* entry, FreeList* overflow) {
+        MagazineAccess mag(this);
+        if (mag->count >= MagazineSize) {
+            for (size_t i = 0; i < (MagazineSize / 2); ++i)
+                overflow->push_front(mag->list.pop_front());
+            mag->count -= MagazineSize / 2;
+        }
+        mag->list.push_front(entry);
+        ++mag->count;
+    }
+
+    // Move as much of 'batch' as will fit into the calling thread's magazine.
+    // Anything which does not fit is left in 'batch'.
+    void Refill(FreeList* batch) {
+        MagazineAccess mag(this);
+        while ((mag->count < MagazineSize) && !batch->is_empty()) {
+            mag->list.push_front(batch->pop_front());
+            ++mag->count;
+        }
+    }
+
+    // Take an object from any magazine at all.  Used as a last resort when the
+    // shared pool is exhausted.
+    EntryType* Steal() {
+        for (size_t i = 0; i < kMagazineCount; ++i) {
+            MagazineAccess mag(this, i);
+            EntryType* ret = mag->list.pop_front();
+            if (ret != nullptr) {
+                --mag->count;
+                return ret;
+            }
+        }
+        return nullptr;
+    }
+
+    // Empty every magazine into 'out'.  Only safe when no one else can be
+    // using the allocator.
+    void DrainUnsafe(FreeList* out) {
+        for (auto& mag : magazines_) {
+            while (!mag.list.is_empty())
+                out->push_front(mag.list.pop_front());
+            mag.count = 0;
+        }
+    }
+
+private:
+    // Each magazine lives on its own cache line(s) so that threads using
+    // different magazines do not false-share.
+    struct Magazine {
+#if _KERNEL
+        SpinLock lock;
+#else
+        LockType lock;
+#endif
+        FreeList list;
+        size_t   count = 0;
+    } __ALIGNED(64);
+
+#if _KERNEL
+    static constexpr size_t kMagazineCount = SMP_MAX_CPUS;
+
+    // Locks the current cpu's magazine (or a specific one) with interrupts
+    // disabled, so that we cannot migrate while using it.
+    class MagazineAccess {
+    public:
+        explicit MagazineAccess(SlabMagazines* mags) {
+            arch_interrupt_save(&irq_state_, SPIN_LOCK_FLAG_INTERRUPTS);
+            mag_ = &mags->magazines_[arch_curr_cpu_num()];
+            mag_->lock.Acquire();
+        }
+        MagazineAccess(SlabMagazines* mags, size_t ndx) {
+            arch_interrupt_save(&irq_state_, SPIN_LOCK_FLAG_INTERRUPTS);
+            mag_ = &mags->magazines_[ndx];
+            mag_->lock.Acquire();
+        }
+        ~MagazineAccess() {
+            mag_->lock.Release();
+            arch_interrupt_restore(irq_state_, SPIN_LOCK_FLAG_INTERRUPTS);
+        }
+        Magazine* operator->() const { return mag_; }
+        DISALLOW_COPY_ASSIGN_AND_MOVE(MagazineAccess);
+
+    private:
+        spin_lock_saved_state_t irq_state_;
+        Magazine* mag_;
+    };
+#else
+    static constexpr size_t kMagazineCount = 16;
+
+    static size_t CurrentNdx() {
+        uint64_t id = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(thrd_current()));
+        return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> 60) % kMagazineCount;
+    }
+
+    // Locks the calling thread's magazine (or a specific one).
+    class MagazineAccess {
+    public:
+        explicit MagazineAccess(SlabMagazines* mags) : MagazineAccess(mags, CurrentNdx()) { }
+        MagazineAccess(SlabMagazines* mags, size_t ndx) : mag_(&mags->magazines_[ndx]) {
+            mag_->lock.Acquire();
+        }
+        ~MagazineAccess() { mag_->lock.Release(); }
+        Magazine* operator->() const { return mag_; }
+        DISALLOW_COPY_ASSIGN_AND_MOVE(MagazineAccess);
+
+    private:
+        Magazine* mag_;
+    };
+#endif
+
+    Magazine magazines_[kMagazineCount];
+};
+
+// Allocators without magazines carry no magazine state at all.
+template <typename EntryType, typename LockType>
+class SlabMagazines<EntryType, 0, LockType> {
+public:
+    using FreeList = SinglyLinkedList<EntryType*>;
+
+    EntryType* Pop() { return nullptr; }
+    bool TryPush(EntryType* entry) { return false; }
+    void Push(EntryType* entry, FreeList* overflow) { overflow->push_front(entry); }
+    void Refill(FreeList* batch) { }
+    EntryType* Steal() { return nullptr; }
+    void DrainUnsafe(FreeList* out) { }
+};
+
 template <typename SATraits>
 class SlabAllocator {
 public:
@@ -343,6 +547,15 @@ public:
         // destructing, and we are already screwed.
         __UNUSED size_t allocated_count = 0;
 
+        // Return anything cached in magazines to the free list so that it is
+        // accounted for below.
+        FreeList cached;
+        magazines_.DrainUnsafe(&cached);
+        while (!cached.is_empty()) {
+            this->inc_free_list_size();
+            this->free_list_.push_front(cached.pop_front());
+        }
+
         while (!slab_list_.is_empty()) {
             Slab* free_me = slab_list_.pop_front();
             allocated_count += free_me->alloc_count();
@@ -379,9 +592,11 @@ protected:
     friend class ::mxtl::SlabAllocator<SATraits>;
     friend class ::mxtl::SlabAllocated<SATraits>;
 
-    static constexpr size_t SLAB_SIZE = SATraits::SLAB_SIZE;
+    static constexpr size_t SLAB_SIZE     = SATraits::SLAB_SIZE;
+    static constexpr size_t MAGAZINE_SIZE = SATraits::MAGAZINE_SIZE;
 
     struct FreeListEntry : public SinglyLinkedListable<FreeListEntry*> { };
+    using FreeList = SinglyLinkedList<FreeListEntry*>;
 
     class Slab {
     public:
@@ -412,8 +627,39 @@ protected:
     static_assert(SlabAllocationCount > 0, "SLAB_SIZE too small to hold even 1 chunk");
 
     void* Allocate() {
+        if (!MAGAZINE_SIZE) {
+            AutoLock alloc_lock(this->alloc_lock_);
+            return AllocateLocked();
+        }
+
+        // Try the calling thread's magazine first.
+        void* mem = magazines_.Pop();
+        if (mem != nullptr)
+            return mem;
+
+        // The magazine is empty.  Grab a batch of objects from the shared pool
+        // with a single trip through the lock, keep one, and stash the rest in
+        // the magazine.  The batch goes into the magazine before the lock is
+        // dropped, so no free object is ever out of sight of Steal().
         AutoLock alloc_lock(this->alloc_lock_);
+        mem = AllocateLocked();
+        if (mem == nullptr)
+            return magazines_.Steal();
+
+        FreeList batch;
+        for (size_t i = 1; i < (MAGAZINE_SIZE / 2); ++i) {
+            void* extra = AllocateLocked();
+            if (extra == nullptr)
+                break;
+            batch.push_front(new (extra) FreeListEntry);
+        }
+        magazines_.Refill(&batch);
+        ReturnBatchToFreeListLocked(&batch);
+
+        return mem;
+    }
 
+    void* AllocateLocked() {
         // If we can alloc from the free list, do so.
         if (!this->free_list_.is_empty()) {
             this->dec_free_list_size();
@@ -430,7 +676,11 @@ protected:
 
         // If we are allowed to allocate new slabs, try to do so.
         if (slab_count_ < max_slabs_) {
+#if _KERNEL
+            void* slab_mem = memalign(alignof(Slab), SLAB_SIZE);
+#else
             void* slab_mem = aligned_alloc(alignof(Slab), SLAB_SIZE);
+#endif
             if (slab_mem != nullptr) {
                 Slab* slab = new (slab_mem) Slab();
 
@@ -447,6 +697,20 @@ protected:
 
     void ReturnToFreeList(void* ptr) {
         FreeListEntry* free_obj = new (ptr) FreeListEntry;
+
+        if (MAGAZINE_SIZE) {
+            // Cache the object in the calling thread's magazine.  If it is
+            // full, take the lock and move half of it back to the shared free
+            // list along the way.
+            if (magazines_.TryPush(free_obj))
+                return;
+            AutoLock alloc_lock(alloc_lock_);
+            FreeList overflow;
+            magazines_.Push(free_obj, &overflow);
+            ReturnBatchToFreeListLocked(&overflow);
+            return;
+        }
+
         {
             AutoLock alloc_lock(alloc_lock_);
             inc_free_list_size();
@@ -454,7 +718,17 @@ protected:
         }
     }
 
+    void ReturnBatchToFreeListLocked(FreeList* batch) {
+        while (!batch->is_empty()) {
+            inc_free_list_size();
+            free_list_.push_front(batch->pop_front());
+        }
+    }
+
+    using MagazinesType = SlabMagazines<FreeListEntry, MAGAZINE_SIZE, typename SATraits::LockType>;
+
     typename SATraits::LockType      alloc_lock_;
+    MagazinesType                    magazines_;
     SinglyLinkedList<FreeListEntry*> free_list_;
     SinglyLinkedList<Slab*>          slab_list_;
     const size_t                     max_slabs_;
@@ -503,6 +777,10 @@ inline void* SlabAllocator<SATraits>::Slab::Allocate() {
 // ++ IsStaticAllocator
 //  Selects between a static or instanced allocator type.
 //
+// ++ MAGAZINE_SIZE
+//  The number of free objects each per-cpu/per-thread magazine may cache.
+//  Defaults to 0 (no magazines).  See "Magazines" above.
+//
 // Instanced allocators allow multiple allocation pools to be created, each with
 // their own quota, but require an extra pointer-per-object of overhead
 // (provided by SlabAllocated<>) when used with managed pointers in order to be
@@ -516,7 +794,8 @@ inline void* SlabAllocator<SATraits>::Slab::Allocate() {
 template <typename T,
           size_t   _SLAB_SIZE         = DEFAULT_SLAB_ALLOCATOR_SLAB_SIZE,
           typename _LockType          = ::mxtl::Mutex,
-          bool     _IsStaticAllocator = false>
+          bool     _IsStaticAllocator = false,
+          size_t   _MAGAZINE_SIZE     = 0>
 struct SlabAllocatorTraits {
     using PtrTraits     = internal::SlabAllocatorPtrTraits<T>;
     using PtrType       = typename PtrTraits::PtrType;
@@ -525,6 +804,7 @@ struct SlabAllocatorTraits {
 
     static constexpr size_t SLAB_SIZE = _SLAB_SIZE;
     static constexpr bool   IsStaticAllocator = _IsStaticAllocator;
+    static constexpr size_t MAGAZINE_SIZE = _MAGAZINE_SIZE;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -597,6 +877,14 @@ template <typename T,
 using UnlockedSlabAllocatorTraits =
     SlabAllocatorTraits<T, SLAB_SIZE, ::mxtl::NullLock>;
 
+constexpr size_t DEFAULT_SLAB_ALLOCATOR_MAGAZINE_SIZE = 32;
+
+template <typename T,
+          size_t   SLAB_SIZE     = DEFAULT_SLAB_ALLOCATOR_SLAB_SIZE,
+          size_t   MAGAZINE_SIZE = DEFAULT_SLAB_ALLOCATOR_MAGAZINE_SIZE>
+using CachingSlabAllocatorTraits =
+    SlabAllocatorTraits<T, SLAB_SIZE, ::mxtl::Mutex, false, MAGAZINE_SIZE>;
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Implementation of a static slab allocator.
@@ -659,6 +947,12 @@ template <typename T,
           size_t   SLAB_SIZE = DEFAULT_SLAB_ALLOCATOR_SLAB_SIZE>
 using UnlockedStaticSlabAllocatorTraits = SlabAllocatorTraits<T, SLAB_SIZE, ::mxtl::NullLock, true>;
 
+template <typename T,
+          size_t   SLAB_SIZE     = DEFAULT_SLAB_ALLOCATOR_SLAB_SIZE,
+          size_t   MAGAZINE_SIZE = DEFAULT_SLAB_ALLOCATOR_MAGAZINE_SIZE>
+using StaticCachingSlabAllocatorTraits =
+    SlabAllocatorTraits<T, SLAB_SIZE, ::mxtl::Mutex, true, MAGAZINE_SIZE>;
+
 // Shorthand for declaring the global storage required for a static allocator
 #define DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(ALLOC_TRAITS, ...) \
 template<> ::mxtl::SlabAllocator<typename ALLOC_TRAITS>::InternalAllocatorType \
@@ -447,6 +447,10 @@ public:
     // specified size and alignment.  Note; the alignment must be a power of
     // two.  Pass 1 if alignment does not matter.
     //
+    // Regions are chosen best-fit using the size index.  Only a bounded number
+    // of badly aligned candidates are considered before falling back to the
+    // smallest region which can satisfy any alignment.
+    //
     // Possible return values
     // ++ ERR_BAD_STATE : Allocator has no RegionPool assigned.
     // ++ ERR_NO_MEMORY : not enough bookkeeping memory available in our
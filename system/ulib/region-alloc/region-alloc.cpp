@@ -6,6 +6,11 @@
 #include <region-alloc/region-alloc.h>
 #include <string.h>
 
+// The number of badly aligned candidates GetRegion will look at in the size
+// index before jumping ahead to regions which are large enough to satisfy any
+// alignment.
+static constexpr size_t kMaxAlignmentProbes = 8;
+
 // Support for Pool allocated bookkeeping
 RegionAllocator::RegionPool::RefPtr RegionAllocator::RegionPool::Create(size_t slab_size,
                                                                         size_t max_memory) {
@@ -386,7 +391,16 @@ mx_status_t RegionAllocator::GetRegion(uint64_t size,
     // Consider all of the regions which are large enough to hold our
     // allocation.  Stop as soon as we find one which can satisfy the alignment
     // restrictions.
+    //
+    // Any region which is at least (size + alignment - 1) bytes long can hold
+    // the allocation no matter where it starts, so there is no point in walking
+    // an arbitrarily long run of regions which are big enough but badly
+    // aligned.  After kMaxAlignmentProbes misses, skip straight to the smallest
+    // region which is guaranteed to fit.
     uint64_t aligned_base;
+    uint64_t guaranteed_size = size + mask;
+    bool     probing = (guaranteed_size > size);
+    size_t   probes = 0;
     while (iter.IsValid()) {
         DEBUG_ASSERT(iter->size >= size);
         aligned_base = (iter->base + mask) & inv_mask;
@@ -400,6 +414,14 @@ mx_status_t RegionAllocator::GetRegion(uint64_t size,
         if ((aligned_base >= iter->base) && (overhead <= leftover))
             break;
 
+        if (probing && (++probes >= kMaxAlignmentProbes)) {
+            probing = false;
+            if (iter->size < guaranteed_size) {
+                iter = avail_regions_by_size_.lower_bound({ .base = 0, .size = guaranteed_size });
+                continue;
+            }
+        }
+
         ++iter;
     }
 
@@ -8,6 +8,8 @@
 #include <magenta/types.h>
 
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 __BEGIN_CDECLS
 
@@ -43,6 +45,33 @@ void mxr_mutex_unlock(mxr_mutex_t* mutex);
 // mxr_mutex_unlock() will wake that thread.
 void mxr_mutex_lock_with_waiter(mxr_mutex_t* mutex);
 
+// Adaptive spinning, for mutexes built on something other than
+// mxr_mutex_t to spin the same way. Before blocking on |lock|, spin
+// calling mxr_spin_pause() up to mxr_spin_begin(lock) times while it
+// stays held, then report with mxr_spin_end() how many times that was
+// and whether the lock was taken.
+int mxr_spin_begin(const void* lock);
+void mxr_spin_pause(void);
+void mxr_spin_end(const void* lock, int spun, bool acquired);
+
+// Contention counters, for the mutexes of the process using this copy of
+// the runtime. Counting is off unless enabled, and only costs anything
+// when a mutex is contended.
+typedef struct {
+    uint64_t contended;     // locks that found the mutex held
+    uint64_t spin_acquired; // of those, how many took it by spinning
+    uint64_t spins;         // spin iterations
+    uint64_t waits;         // blocks in the kernel waiting for a mutex
+    uint64_t wakes;         // unlocks that woke a waiter
+} mxr_mutex_stats_t;
+
+void mxr_mutex_stats_enable(bool enable);
+void mxr_mutex_stats_get(mxr_mutex_stats_t* stats, bool reset);
+
+// For mutexes not built on mxr_mutex_t to count waits and wakes.
+void mxr_mutex_stats_wait(void);
+void mxr_mutex_stats_wake(void);
+
 #pragma GCC visibility pop
 
 __END_CDECLS
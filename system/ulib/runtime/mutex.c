@@ -6,6 +6,7 @@
 
 #include <magenta/syscalls.h>
 #include <stdatomic.h>
+#include <stdint.h>
 
 // This mutex implementation is based on Ulrich Drepper's paper "Futexes
 // Are Tricky" (dated November 5, 2011; see
@@ -21,6 +22,96 @@ enum {
     LOCKED_WITH_WAITERS = 2
 };
 
+// Spinning adapts to how long each mutex is usually held, as in glibc's
+// PTHREAD_MUTEX_ADAPTIVE_NP: a thread spins up to twice the number of
+// iterations it took to get the mutex recently, plus a little. The
+// mutex itself has no room for the estimate, so it is kept in a small
+// table indexed by the mutex's address, which mutexes may share.
+#define SPIN_MAX 100
+#define SPIN_SLOTS 64
+
+static atomic_int spin_estimate[SPIN_SLOTS];
+
+static struct {
+    atomic_bool enabled;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t spin_acquired;
+    _Atomic uint64_t spins;
+    _Atomic uint64_t waits;
+    _Atomic uint64_t wakes;
+} stats;
+
+static inline atomic_int* spin_slot(const void* lock) {
+    uintptr_t addr = (uintptr_t)lock;
+    return &spin_estimate[(addr ^ (addr >> 12)) / sizeof(int) % SPIN_SLOTS];
+}
+
+static inline void stats_add(_Atomic uint64_t* counter, uint64_t n) {
+    if (atomic_load_explicit(&stats.enabled, memory_order_relaxed))
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+int mxr_spin_begin(const void* lock) {
+    int limit = atomic_load_explicit(spin_slot(lock), memory_order_relaxed) * 2 + 10;
+    return limit < SPIN_MAX ? limit : SPIN_MAX;
+}
+
+void mxr_spin_pause(void) {
+#if defined(__x86_64__)
+    __asm__ volatile("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+void mxr_spin_end(const void* lock, int spun, bool acquired) {
+    // Spinning that didn't get the lock counts as though none was worth
+    // doing, so that mutexes held for long soon stop being spun on much,
+    // until taking them by spinning starts to work again.
+    if (spun > 0) {
+        atomic_int* slot = spin_slot(lock);
+        int estimate = atomic_load_explicit(slot, memory_order_relaxed);
+        int sample = acquired ? spun : 0;
+        atomic_store_explicit(slot, estimate + (sample - estimate) / 8,
+                              memory_order_relaxed);
+    }
+
+    stats_add(&stats.contended, 1);
+    stats_add(&stats.spins, spun);
+    if (acquired)
+        stats_add(&stats.spin_acquired, 1);
+}
+
+void mxr_mutex_stats_wait(void) {
+    stats_add(&stats.waits, 1);
+}
+
+void mxr_mutex_stats_wake(void) {
+    stats_add(&stats.wakes, 1);
+}
+
+void mxr_mutex_stats_enable(bool enable) {
+    atomic_store(&stats.enabled, enable);
+}
+
+void mxr_mutex_stats_get(mxr_mutex_stats_t* out, bool reset) {
+    if (reset) {
+        out->contended = atomic_exchange(&stats.contended, 0);
+        out->spin_acquired = atomic_exchange(&stats.spin_acquired, 0);
+        out->spins = atomic_exchange(&stats.spins, 0);
+        out->waits = atomic_exchange(&stats.waits, 0);
+        out->wakes = atomic_exchange(&stats.wakes, 0);
+    } else {
+        out->contended = atomic_load(&stats.contended);
+        out->spin_acquired = atomic_load(&stats.spin_acquired);
+        out->spins = atomic_load(&stats.spins);
+        out->waits = atomic_load(&stats.waits);
+        out->wakes = atomic_load(&stats.wakes);
+    }
+}
+
 static mx_status_t futex_wait_abstime(mx_futex_t* futex_addr,
                                       int expected_value, mx_time_t abstime) {
     if (abstime == MX_TIME_INFINITE)
@@ -35,6 +126,32 @@ static mx_status_t futex_wait_abstime(mx_futex_t* futex_addr,
     return _mx_futex_wait(futex_addr, expected_value, relative_time);
 }
 
+// Spins for a while in the hope that the mutex is only held briefly,
+// since taking it as soon as it is unlocked is much cheaper than
+// blocking in the kernel and being woken. Stops early once there are
+// waiters, since they are blocked already: the mutex is likely held for
+// long, and taking it ahead of them would be unfair. Updates |*old_state|
+// if the mutex isn't taken.
+static bool spin_lock(mxr_mutex_t* mutex, int final_state, int* old_state) {
+    int limit = mxr_spin_begin(mutex);
+    int spun = 0;
+    bool acquired = false;
+    int state = *old_state;
+    while (spun < limit && state != LOCKED_WITH_WAITERS) {
+        mxr_spin_pause();
+        spun++;
+        state = atomic_load_explicit(&mutex->futex, memory_order_relaxed);
+        if (state == UNLOCKED &&
+            atomic_compare_exchange_strong(&mutex->futex, &state, final_state)) {
+            acquired = true;
+            break;
+        }
+    }
+    mxr_spin_end(mutex, spun, acquired);
+    *old_state = state;
+    return acquired;
+}
+
 // On success, this will leave the mutex in the LOCKED_WITH_WAITERS state.
 static mx_status_t lock_slow_path(mxr_mutex_t* mutex, mx_time_t abstime,
                                   int old_state) {
@@ -45,6 +162,7 @@ static mx_status_t lock_slow_path(mxr_mutex_t* mutex, mx_time_t abstime,
             (old_state == LOCKED_WITHOUT_WAITERS &&
              atomic_compare_exchange_strong(&mutex->futex, &old_state,
                                             LOCKED_WITH_WAITERS))) {
+            mxr_mutex_stats_wait();
             mx_status_t status = futex_wait_abstime(
                 &mutex->futex, LOCKED_WITH_WAITERS, abstime);
             if (status == ERR_TIMED_OUT)
@@ -80,6 +198,8 @@ mx_status_t __mxr_mutex_timedlock(mxr_mutex_t* mutex, mx_time_t abstime) {
                                        LOCKED_WITHOUT_WAITERS)) {
         return NO_ERROR;
     }
+    if (spin_lock(mutex, LOCKED_WITHOUT_WAITERS, &old_state))
+        return NO_ERROR;
     return lock_slow_path(mutex, abstime, old_state);
 }
 
@@ -95,6 +215,8 @@ void mxr_mutex_lock_with_waiter(mxr_mutex_t* mutex) {
                                        LOCKED_WITH_WAITERS)) {
         return;
     }
+    if (spin_lock(mutex, LOCKED_WITH_WAITERS, &old_state))
+        return;
     mx_status_t status = lock_slow_path(mutex, MX_TIME_INFINITE, old_state);
     if (status != NO_ERROR)
         __builtin_trap();
@@ -110,6 +232,7 @@ void mxr_mutex_unlock(mxr_mutex_t* mutex) {
             break;
 
         case LOCKED_WITH_WAITERS: {
+            mxr_mutex_stats_wake();
             mx_status_t status = _mx_futex_wake(&mutex->futex, 1);
             if (status != NO_ERROR)
                 __builtin_trap();
@@ -0,0 +1,93 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <magenta/compiler.h>
+#include <magenta/types.h>
+
+__BEGIN_CDECLS;
+
+// Userspace trace events, written into a trace buffer VMO of the process's
+// own as records in the kernel's ktrace format. Timestamps come from the
+// clock ktrace uses and records carry the thread's koid as their tid, so a
+// trace buffer merges with a kernel trace by sorting the records of both by
+// timestamp.
+//
+// Events name what they trace by an id from trace_name(), which records the
+// name in the buffer. Until trace_start() is called, and once the buffer is
+// full, events are dropped at the cost of a load and a branch.
+
+// The buffer is a trace_buffer_header_t followed by |size| bytes of records
+// at TRACE_BUFFER_DATA_OFFSET. |head| counts the bytes handed out to
+// records, and may pass |size| once the buffer fills up. A record is
+// reserved before it is written, its tag being stored last: a tag of 0 is a
+// record that is still being written.
+typedef struct trace_buffer_header {
+    uint32_t magic;
+    uint32_t version;       // KTRACE_VERSION
+    uint64_t head;
+    uint64_t size;
+    uint64_t ticks_per_ms;  // of the timestamps, as TAG_TICKS_PER_MS reports
+    mx_koid_t pid;
+    uint64_t reserved[3];
+} trace_buffer_header_t;
+
+#define TRACE_BUFFER_MAGIC       (0x54524345) // 'TRCE'
+#define TRACE_BUFFER_DATA_OFFSET (64)
+
+static_assert(sizeof(trace_buffer_header_t) == TRACE_BUFFER_DATA_OFFSET,
+              "trace_buffer_header_t is not TRACE_BUFFER_DATA_OFFSET bytes");
+
+// Creates and maps a trace buffer holding |size| bytes of records and starts
+// tracing into it. Tracing can only be started once.
+mx_status_t trace_start(size_t size);
+
+// Returns a read-only handle to the trace buffer's VMO, for a process
+// collecting the trace.
+mx_status_t trace_get_vmo(mx_handle_t* out);
+
+// Returns the records written to the trace buffer so far, or NULL with
+// *len set to 0 if tracing has not been started.
+const void* trace_records(size_t* len);
+
+// Returns the id of |name|, recording the name in the trace buffer the first
+// time it is asked for. Names longer than 31 characters are cut short.
+uint32_t trace_name(const char* name);
+
+// The clock trace records are timestamped with, the same one ktrace uses.
+uint64_t trace_timestamp(void);
+
+// Marks the beginning and end of something the thread is doing. |arg| is
+// recorded with the event.
+void trace_duration_begin(uint32_t name, uint64_t arg);
+void trace_duration_end(uint32_t name, uint64_t arg);
+
+// Records the value of a counter.
+void trace_counter(uint32_t name, uint64_t value);
+
+// Flow events tie together work on different threads or in different
+// processes, such as a request passing through a server: one begin, any
+// number of steps and one end, sharing a |flow_id| unique to the flow.
+void trace_flow_begin(uint32_t name, uint64_t flow_id);
+void trace_flow_step(uint32_t name, uint64_t flow_id);
+void trace_flow_end(uint32_t name, uint64_t flow_id);
+
+static inline void trace_duration_cleanup(uint32_t* name) {
+    trace_duration_end(*name, 0);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Traces the rest of the enclosing scope as a duration named |name|.
+#define TRACE_DURATION(name)                                                 \
+    uint32_t TRACE_CONCAT(__trace_duration_, __LINE__)                      \
+        __attribute__((cleanup(trace_duration_cleanup))) = (name);          \
+    trace_duration_begin(TRACE_CONCAT(__trace_duration_, __LINE__), 0)
+
+__END_CDECLS;
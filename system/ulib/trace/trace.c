@@ -0,0 +1,204 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <limits.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/ktrace.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <magenta/threads.h>
+#include <trace/trace.h>
+
+#define MAX_NAMES 256
+#define MAX_NAME_LEN 31
+
+static trace_buffer_header_t* trace_hdr;
+static uint8_t* trace_data;
+static mx_handle_t trace_vmo = MX_HANDLE_INVALID;
+static mx_koid_t trace_pid;
+
+static mtx_t names_lock = MTX_INIT;
+static char names[MAX_NAMES][MAX_NAME_LEN + 1];
+static uint32_t name_count;
+
+static __thread mx_koid_t trace_tid;
+
+static mx_koid_t get_koid(mx_handle_t handle) {
+    mx_info_handle_basic_t info;
+    if (mx_object_get_info(handle, MX_INFO_HANDLE_BASIC, &info, sizeof(info), NULL, NULL) < 0)
+        return 0;
+    return info.koid;
+}
+
+static uint32_t current_tid(void) {
+    if (trace_tid == 0)
+        trace_tid = get_koid(thrd_get_mx_handle(thrd_current()));
+    return (uint32_t)trace_tid;
+}
+
+uint64_t trace_timestamp(void) {
+#if __x86_64__
+    // ktrace timestamps with the raw tsc
+    return mx_ticks_get();
+#else
+    return mx_time_get(MX_CLOCK_MONOTONIC);
+#endif
+}
+
+static uint64_t trace_ticks_per_ms(void) {
+#if __x86_64__
+    return mx_ticks_per_second() / 1000;
+#else
+    return 1000000;
+#endif
+}
+
+// Hands out |len| bytes of the buffer for a record, or NULL if it is full.
+static void* trace_reserve(uint32_t len) {
+    trace_buffer_header_t* hdr = __atomic_load_n(&trace_hdr, __ATOMIC_ACQUIRE);
+    if (hdr == NULL)
+        return NULL;
+    uint64_t off = __atomic_fetch_add(&hdr->head, len, __ATOMIC_RELAXED);
+    if (off + len > hdr->size)
+        return NULL;
+    return trace_data + off;
+}
+
+// Publishes a record by storing its tag now the rest of it is written.
+static void trace_commit(void* rec, uint32_t tag) {
+    __atomic_store_n((uint32_t*)rec, tag, __ATOMIC_RELEASE);
+}
+
+static void trace_event(uint32_t tag, uint32_t name, uint64_t value) {
+    uint64_t ts = trace_timestamp();
+    ktrace_rec_32b_t* rec = trace_reserve(sizeof(ktrace_rec_32b_t));
+    if (rec == NULL)
+        return;
+    rec->tid = current_tid();
+    rec->ts = ts;
+    rec->a = name;
+    rec->b = 0;
+    rec->c = (uint32_t)value;
+    rec->d = (uint32_t)(value >> 32);
+    trace_commit(rec, tag);
+}
+
+static void trace_write_name(uint32_t id, const char* name) {
+    uint32_t len = (uint32_t)strnlen(name, MAX_NAME_LEN);
+    uint32_t tag = (TAG_USER_NAME & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
+    ktrace_rec_name_t* rec = trace_reserve(KTRACE_LEN(tag));
+    if (rec == NULL)
+        return;
+    rec->id = id;
+    rec->arg = (uint32_t)trace_pid;
+    memset(rec->name, 0, KTRACE_LEN(tag) - KTRACE_NAMEOFF);
+    memcpy(rec->name, name, len);
+    trace_commit(rec, tag);
+}
+
+mx_status_t trace_start(size_t size) {
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (size == 0)
+        return ERR_INVALID_ARGS;
+
+    mtx_lock(&names_lock);
+    if (trace_vmo != MX_HANDLE_INVALID) {
+        mtx_unlock(&names_lock);
+        return ERR_BAD_STATE;
+    }
+
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(TRACE_BUFFER_DATA_OFFSET + size, 0, &vmo);
+    if (status < 0) {
+        mtx_unlock(&names_lock);
+        return status;
+    }
+    uintptr_t addr;
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, TRACE_BUFFER_DATA_OFFSET + size,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr);
+    if (status < 0) {
+        mx_handle_close(vmo);
+        mtx_unlock(&names_lock);
+        return status;
+    }
+
+    trace_buffer_header_t* hdr = (trace_buffer_header_t*)addr;
+    hdr->magic = TRACE_BUFFER_MAGIC;
+    hdr->version = KTRACE_VERSION;
+    hdr->head = 0;
+    hdr->size = size;
+    hdr->ticks_per_ms = trace_ticks_per_ms();
+    hdr->pid = trace_pid = get_koid(mx_process_self());
+    trace_data = (uint8_t*)addr + TRACE_BUFFER_DATA_OFFSET;
+    trace_vmo = vmo;
+    __atomic_store_n(&trace_hdr, hdr, __ATOMIC_RELEASE);
+
+    // names asked for before tracing started
+    for (uint32_t i = 0; i < name_count; i++)
+        trace_write_name(i + 1, names[i]);
+    mtx_unlock(&names_lock);
+    return NO_ERROR;
+}
+
+mx_status_t trace_get_vmo(mx_handle_t* out) {
+    if (__atomic_load_n(&trace_hdr, __ATOMIC_ACQUIRE) == NULL)
+        return ERR_BAD_STATE;
+    return mx_handle_duplicate(trace_vmo, MX_RIGHT_READ | MX_RIGHT_MAP | MX_RIGHT_DUPLICATE |
+                               MX_RIGHT_TRANSFER, out);
+}
+
+const void* trace_records(size_t* len) {
+    trace_buffer_header_t* hdr = __atomic_load_n(&trace_hdr, __ATOMIC_ACQUIRE);
+    if (hdr == NULL) {
+        *len = 0;
+        return NULL;
+    }
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    *len = head < hdr->size ? head : hdr->size;
+    return trace_data;
+}
+
+uint32_t trace_name(const char* name) {
+    mtx_lock(&names_lock);
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < name_count; i++) {
+        if (!strncmp(names[i], name, MAX_NAME_LEN)) {
+            id = i + 1;
+            break;
+        }
+    }
+    if (id == 0 && name_count < MAX_NAMES) {
+        strncpy(names[name_count], name, MAX_NAME_LEN);
+        id = ++name_count;
+        trace_write_name(id, name);
+    }
+    mtx_unlock(&names_lock);
+    return id;
+}
+
+void trace_duration_begin(uint32_t name, uint64_t arg) {
+    trace_event(TAG_USER_DURATION_BEGIN, name, arg);
+}
+
+void trace_duration_end(uint32_t name, uint64_t arg) {
+    trace_event(TAG_USER_DURATION_END, name, arg);
+}
+
+void trace_counter(uint32_t name, uint64_t value) {
+    trace_event(TAG_USER_COUNTER, name, value);
+}
+
+void trace_flow_begin(uint32_t name, uint64_t flow_id) {
+    trace_event(TAG_USER_FLOW_BEGIN, name, flow_id);
+}
+
+void trace_flow_step(uint32_t name, uint64_t flow_id) {
+    trace_event(TAG_USER_FLOW_STEP, name, flow_id);
+}
+
+void trace_flow_end(uint32_t name, uint64_t flow_id) {
+    trace_event(TAG_USER_FLOW_END, name, flow_id);
+}
@@ -0,0 +1,213 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <ddk/iotxn.h>
+#include <magenta/types.h>
+#include <unittest/unittest.h>
+
+#include "../../udev/block-sched/sched-queue.h"
+
+#define BLOCK 512
+#define MAX_REQS 8
+
+typedef struct {
+    sched_queue_t q;
+    iotxn_t txns[MAX_REQS];
+    sched_req_t reqs[MAX_REQS];
+    unsigned count;
+} test_queue_t;
+
+static void test_queue_init(test_queue_t* t, uint32_t max_merge, uint32_t client_depth,
+                            uint32_t device_depth) {
+    memset(t, 0, sizeof(*t));
+    block_sched_config_t config = {
+        .max_merge = max_merge,
+        .deadline_ms = 50,
+        .client_depth = client_depth,
+        .device_depth = device_depth,
+    };
+    sched_queue_init(&t->q, &config);
+}
+
+// Queues a request for the block at offset, at time now.
+static sched_req_t* test_queue_add(test_queue_t* t, uint32_t opcode, uint32_t flags,
+                                   mx_off_t block, mx_time_t now) {
+    unsigned n = t->count++;
+    iotxn_t* txn = &t->txns[n];
+    txn->opcode = opcode;
+    txn->flags = flags;
+    txn->offset = block * BLOCK;
+    txn->length = BLOCK;
+    sched_req_t* req = &t->reqs[n];
+    req->txn = txn;
+    sched_queue_add(&t->q, req, now);
+    return req;
+}
+
+// Takes the next run, checks it starts at block and has count requests, and
+// finishes it.
+static bool test_queue_expect(test_queue_t* t, mx_time_t now, mx_off_t block, uint32_t count) {
+    mx_off_t length;
+    uint32_t actual;
+    sched_req_t* run = sched_queue_next_run(&t->q, now, &length, &actual);
+    ASSERT_NONNULL(run, "no run to issue");
+    ASSERT_EQ(run->txn->offset, block * BLOCK, "wrong run issued");
+    ASSERT_EQ(actual, count, "wrong number of requests merged");
+    ASSERT_EQ(length, count * BLOCK, "wrong run length");
+    while (run != NULL) {
+        sched_req_t* next = run->next;
+        sched_queue_req_done(&t->q, run);
+        run = next;
+    }
+    sched_queue_run_done(&t->q);
+    return true;
+}
+
+static bool sched_test_elevator(void) {
+    BEGIN_TEST;
+    test_queue_t t;
+    test_queue_init(&t, 0, 0, 1);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 8, 0);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 2, 0);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 5, 0);
+
+    // only device_depth runs are in flight at once
+    mx_off_t length;
+    uint32_t count;
+    sched_req_t* run = sched_queue_next_run(&t.q, 0, &length, &count);
+    ASSERT_NONNULL(run, "");
+    EXPECT_EQ(run->txn->offset, 2u * BLOCK, "lowest offset goes first");
+    EXPECT_NULL(sched_queue_next_run(&t.q, 0, &length, &count), "device is busy");
+    sched_queue_req_done(&t.q, run);
+    sched_queue_run_done(&t.q);
+
+    // sweeps upwards, then wraps around
+    test_queue_add(&t, IOTXN_OP_READ, 0, 1, 0);
+    ASSERT_TRUE(test_queue_expect(&t, 0, 5, 1), "");
+    ASSERT_TRUE(test_queue_expect(&t, 0, 8, 1), "");
+    ASSERT_TRUE(test_queue_expect(&t, 0, 1, 1), "");
+    EXPECT_NULL(sched_queue_next_run(&t.q, 0, &length, &count), "queue is empty");
+    END_TEST;
+}
+
+static bool sched_test_merge(void) {
+    BEGIN_TEST;
+    test_queue_t t;
+    test_queue_init(&t, 3 * BLOCK, 0, 1);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 1, 0);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 0, 0);
+    test_queue_add(&t, IOTXN_OP_WRITE, 0, 3, 0);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 2, 0);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 3, 0);
+
+    // reads merge up to max_merge, and never with writes
+    ASSERT_TRUE(test_queue_expect(&t, 0, 0, 3), "");
+    ASSERT_TRUE(test_queue_expect(&t, 0, 3, 1), "");
+    ASSERT_TRUE(test_queue_expect(&t, 0, 3, 1), "");
+    END_TEST;
+}
+
+static bool sched_test_deadline(void) {
+    BEGIN_TEST;
+    test_queue_t t;
+    test_queue_init(&t, 0, 0, 1);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 5, 0);
+    ASSERT_TRUE(test_queue_expect(&t, 0, 5, 1), "");
+    test_queue_add(&t, IOTXN_OP_READ, 0, 1, 0);
+    test_queue_add(&t, IOTXN_OP_READ, 0, 9, MX_MSEC(10));
+    test_queue_add(&t, IOTXN_OP_READ, 0, 7, MX_MSEC(10));
+
+    ASSERT_TRUE(test_queue_expect(&t, MX_MSEC(20), 7, 1), "");
+    // the request at block 1 has waited too long, so it goes before block 9
+    ASSERT_TRUE(test_queue_expect(&t, MX_MSEC(60), 1, 1), "");
+    ASSERT_TRUE(test_queue_expect(&t, MX_MSEC(60), 9, 1), "");
+    END_TEST;
+}
+
+static bool sched_test_barrier(void) {
+    BEGIN_TEST;
+    test_queue_t t;
+    test_queue_init(&t, 4 * BLOCK, 0, 1);
+    test_queue_add(&t, IOTXN_OP_WRITE, 0, 6, 0);
+    test_queue_add(&t, IOTXN_OP_WRITE, IOTXN_SYNC_BEFORE, 7, 0);
+    test_queue_add(&t, IOTXN_OP_WRITE, 0, 0, 0);
+
+    // nothing queued after the ordered write goes before it, or merges with it
+    ASSERT_TRUE(test_queue_expect(&t, 0, 6, 1), "");
+    ASSERT_TRUE(test_queue_expect(&t, 0, 7, 1), "");
+    ASSERT_TRUE(test_queue_expect(&t, 0, 0, 1), "");
+    END_TEST;
+}
+
+static bool sched_test_client_depth(void) {
+    BEGIN_TEST;
+    test_queue_t t;
+    test_queue_init(&t, 0, 2, 4);
+    for (mx_off_t block = 0; block < 4; block++) {
+        test_queue_add(&t, IOTXN_OP_READ, 0, block, 0);
+    }
+
+    // the other two wait in the client's backlog
+    mx_off_t length;
+    uint32_t count;
+    sched_req_t* first = sched_queue_next_run(&t.q, 0, &length, &count);
+    ASSERT_NONNULL(first, "");
+    sched_req_t* second = sched_queue_next_run(&t.q, 0, &length, &count);
+    ASSERT_NONNULL(second, "");
+    EXPECT_NULL(sched_queue_next_run(&t.q, 0, &length, &count), "client is at its limit");
+
+    // finishing one lets the next in
+    sched_queue_req_done(&t.q, first);
+    sched_queue_run_done(&t.q);
+    ASSERT_TRUE(test_queue_expect(&t, 0, 2, 1), "");
+    sched_queue_req_done(&t.q, second);
+    sched_queue_run_done(&t.q);
+    ASSERT_TRUE(test_queue_expect(&t, 0, 3, 1), "");
+    EXPECT_FALSE(t.q.clients[0].used, "idle client is freed");
+    END_TEST;
+}
+
+static bool sched_test_take_all(void) {
+    BEGIN_TEST;
+    test_queue_t t;
+    test_queue_init(&t, 0, 2, 1);
+    for (mx_off_t block = 0; block < 4; block++) {
+        test_queue_add(&t, IOTXN_OP_READ, 0, block, 0);
+    }
+    mx_off_t length;
+    uint32_t count;
+    sched_req_t* run = sched_queue_next_run(&t.q, 0, &length, &count);
+    ASSERT_NONNULL(run, "");
+
+    // takes the queued request and those in the backlog, not the one issued
+    list_node_t pending = LIST_INITIAL_VALUE(pending);
+    sched_queue_take_all(&t.q, &pending);
+    EXPECT_EQ(list_length(&pending), 3u, "");
+    sched_req_t* req;
+    list_for_every_entry (&pending, req, sched_req_t, node) {
+        EXPECT_TRUE(req != run, "issued request taken");
+    }
+    EXPECT_NULL(sched_queue_next_run(&t.q, 0, &length, &count), "queue is empty");
+
+    sched_queue_req_done(&t.q, run);
+    sched_queue_run_done(&t.q);
+    EXPECT_EQ(t.q.inflight, 0u, "");
+    EXPECT_FALSE(t.q.clients[0].used, "idle client is freed");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(block_sched_tests)
+RUN_TEST(sched_test_elevator)
+RUN_TEST(sched_test_merge)
+RUN_TEST(sched_test_deadline)
+RUN_TEST(sched_test_barrier)
+RUN_TEST(sched_test_client_depth)
+RUN_TEST(sched_test_take_all)
+END_TEST_CASE(block_sched_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
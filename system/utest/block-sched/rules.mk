@@ -0,0 +1,22 @@
+# Copyright 2017 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := usertest
+
+# the scheduler's queue is tested on its own, without the driver around it
+MODULE_SRCS += \
+    $(LOCAL_DIR)/block-sched.c \
+    system/udev/block-sched/sched-queue.c
+
+MODULE_NAME := block-sched-test
+
+MODULE_STATIC_LIBS := ulib/ddk
+
+MODULE_LIBS := ulib/unittest ulib/mxio ulib/magenta ulib/musl
+
+include make/module.mk
@@ -0,0 +1,177 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/batch.h>
+#include <magenta/syscalls/port.h>
+#include <unittest/unittest.h>
+
+#define RING_SIZE 4u
+
+static mx_handle_t make_ring(uint32_t size) {
+    mx_handle_t ring;
+    if (mx_vmo_create(MX_BATCH_RING_OPS_OFFSET + size * sizeof(mx_batch_op_t), 0, &ring) < 0)
+        return MX_HANDLE_INVALID;
+    mx_batch_ring_t header = {};
+    header.size = size;
+    size_t actual;
+    mx_vmo_write(ring, &header, 0, sizeof(header), &actual);
+    return ring;
+}
+
+// Stores op in the ring and advances the tail past it.
+static bool push_op(mx_handle_t ring, const mx_batch_op_t* op) {
+    mx_batch_ring_t header;
+    size_t actual;
+    ASSERT_EQ(mx_vmo_read(ring, &header, 0, sizeof(header), &actual), NO_ERROR, "");
+    uint64_t offset = MX_BATCH_RING_OPS_OFFSET +
+        (header.tail & (header.size - 1)) * sizeof(mx_batch_op_t);
+    ASSERT_EQ(mx_vmo_write(ring, op, offset, sizeof(*op), &actual), NO_ERROR, "");
+    header.tail++;
+    ASSERT_EQ(mx_vmo_write(ring, &header.tail, offsetof(mx_batch_ring_t, tail),
+                           sizeof(header.tail), &actual), NO_ERROR, "");
+    return true;
+}
+
+static bool wait_completion(mx_handle_t port, uint64_t key, uint32_t op, int64_t result) {
+    mx_batch_packet_t packet;
+    ASSERT_EQ(mx_port_wait(port, 0u, &packet, sizeof(packet)), NO_ERROR, "no completion");
+    EXPECT_EQ(packet.hdr.type, MX_PORT_PKT_TYPE_BATCH, "wrong packet type");
+    EXPECT_EQ(packet.hdr.key, key, "wrong key");
+    EXPECT_EQ(packet.op, op, "wrong op");
+    EXPECT_EQ(packet.result, result, "wrong result");
+    return true;
+}
+
+static bool submit_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ring = make_ring(RING_SIZE);
+    ASSERT_NEQ(ring, MX_HANDLE_INVALID, "");
+    mx_handle_t port;
+    ASSERT_EQ(mx_port_create(0u, &port), NO_ERROR, "");
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(4096u, 0, &vmo), NO_ERROR, "");
+
+    const char data[] = "batched";
+    size_t written = 0u;
+    mx_batch_op_t ops[3] = {};
+    ops[0].op = MX_BATCH_OP_object_signal;
+    ops[0].user_data = 1u;
+    ops[0].args[0] = event;
+    ops[0].args[1] = 0u;
+    ops[0].args[2] = MX_USER_SIGNAL_0;
+    ops[1].op = MX_BATCH_OP_vmo_write;
+    ops[1].user_data = 2u;
+    ops[1].args[0] = vmo;
+    ops[1].args[1] = (uintptr_t)data;
+    ops[1].args[2] = 16u;
+    ops[1].args[3] = sizeof(data);
+    ops[1].args[4] = (uintptr_t)&written;
+    ops[2].op = 0xffffu;
+    ops[2].user_data = 3u;
+    for (int i = 0; i < 3; i++)
+        ASSERT_TRUE(push_op(ring, &ops[i]), "");
+
+    uint32_t actual = 0u;
+    ASSERT_EQ(mx_batch_submit(ring, port, UINT32_MAX, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 3u, "not every op ran");
+
+    ASSERT_TRUE(wait_completion(port, 1u, MX_BATCH_OP_object_signal, NO_ERROR), "");
+    ASSERT_TRUE(wait_completion(port, 2u, MX_BATCH_OP_vmo_write, NO_ERROR), "");
+    ASSERT_TRUE(wait_completion(port, 3u, 0xffffu, ERR_NOT_SUPPORTED), "");
+
+    mx_signals_t pending;
+    EXPECT_EQ(mx_handle_wait_one(event, MX_USER_SIGNAL_0, 0u, &pending), NO_ERROR, "");
+    EXPECT_EQ(written, sizeof(data), "");
+    char buf[sizeof(data)];
+    size_t len;
+    ASSERT_EQ(mx_vmo_read(vmo, buf, 16u, sizeof(buf), &len), NO_ERROR, "");
+    EXPECT_EQ(memcmp(buf, data, sizeof(data)), 0, "vmo_write op wrote the wrong bytes");
+
+    mx_batch_ring_t header;
+    ASSERT_EQ(mx_vmo_read(ring, &header, 0, sizeof(header), &len), NO_ERROR, "");
+    EXPECT_EQ(header.head, header.tail, "head not advanced");
+
+    mx_handle_close(vmo);
+    mx_handle_close(event);
+    mx_handle_close(port);
+    mx_handle_close(ring);
+    END_TEST;
+}
+
+static bool max_ops_and_wrap_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ring = make_ring(RING_SIZE);
+    ASSERT_NEQ(ring, MX_HANDLE_INVALID, "");
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+
+    // Go around the ring a few times, two ops per submit but one per call.
+    mx_batch_op_t op = {};
+    op.op = MX_BATCH_OP_object_signal;
+    op.args[0] = event;
+    op.args[2] = MX_USER_SIGNAL_0;
+    for (int round = 0; round < 8; round++) {
+        ASSERT_TRUE(push_op(ring, &op), "");
+        ASSERT_TRUE(push_op(ring, &op), "");
+        uint32_t actual = 0u;
+        ASSERT_EQ(mx_batch_submit(ring, MX_HANDLE_INVALID, 1u, &actual), NO_ERROR, "");
+        EXPECT_EQ(actual, 1u, "max_ops not honoured");
+        ASSERT_EQ(mx_batch_submit(ring, MX_HANDLE_INVALID, 1u, &actual), NO_ERROR, "");
+        EXPECT_EQ(actual, 1u, "");
+        ASSERT_EQ(mx_batch_submit(ring, MX_HANDLE_INVALID, 1u, &actual), NO_ERROR, "");
+        EXPECT_EQ(actual, 0u, "ran an op that was not queued");
+    }
+
+    mx_handle_close(event);
+    mx_handle_close(ring);
+    END_TEST;
+}
+
+static bool bad_ring_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ring = make_ring(3u);
+    ASSERT_NEQ(ring, MX_HANDLE_INVALID, "");
+    uint32_t actual;
+    EXPECT_EQ(mx_batch_submit(ring, MX_HANDLE_INVALID, 1u, &actual), ERR_INVALID_ARGS,
+              "size not a power of two");
+
+    // A tail more than a ring ahead of the head.
+    mx_batch_ring_t header = {};
+    header.size = 2u;
+    header.tail = 3u;
+    size_t len;
+    ASSERT_EQ(mx_vmo_write(ring, &header, 0, sizeof(header), &len), NO_ERROR, "");
+    EXPECT_EQ(mx_batch_submit(ring, MX_HANDLE_INVALID, 1u, &actual), ERR_BAD_STATE, "");
+
+    // Slots running off the end of the vmo.
+    header.size = 1024u;
+    header.tail = 0u;
+    ASSERT_EQ(mx_vmo_write(ring, &header, 0, sizeof(header), &len), NO_ERROR, "");
+    EXPECT_EQ(mx_batch_submit(ring, MX_HANDLE_INVALID, 1u, &actual), ERR_INVALID_ARGS, "");
+
+    mx_handle_close(ring);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(batch_tests)
+RUN_TEST(submit_test)
+RUN_TEST(max_ops_and_wrap_test)
+RUN_TEST(bad_ring_test)
+END_TEST_CASE(batch_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <magenta/syscalls.h>
+#include <magenta/threads.h>
 #include <unittest/unittest.h>
 #include <inttypes.h>
 #include <stddef.h>
@@ -239,12 +240,64 @@ static bool test_timeout_elapsed(void) {
     END_TEST;
 }
 
+static int test_stats_helper(void* arg) {
+    timeout_args* args = (timeout_args*)arg;
+    mtx_lock(&args->mutex);
+    mx_object_signal(args->start_event, 0, MX_EVENT_SIGNALED);
+    // hold the mutex long enough for the main thread to block on it
+    mx_nanosleep(MX_MSEC(10));
+    mtx_unlock(&args->mutex);
+    return 0;
+}
+
+static bool test_contention_stats(void) {
+    BEGIN_TEST;
+
+    mtx_stats_t stats;
+    mtx_stats_enable(true);
+    mtx_stats_get(&stats, true);
+
+    timeout_args args;
+    ASSERT_EQ(thrd_success, mtx_init(&args.mutex, mtx_plain), "could not create mutex");
+    ASSERT_EQ(mx_event_create(0, &args.start_event), NO_ERROR, "could not create event");
+
+    thrd_t helper;
+    ASSERT_EQ(thrd_create(&helper, test_stats_helper, &args), thrd_success, "");
+    ASSERT_EQ(mx_handle_wait_one(args.start_event, MX_EVENT_SIGNALED, MX_TIME_INFINITE, NULL),
+              NO_ERROR, "failed to wait");
+    ASSERT_EQ(mtx_lock(&args.mutex), thrd_success, "failed to lock");
+    ASSERT_EQ(mtx_unlock(&args.mutex), thrd_success, "failed to unlock");
+    ASSERT_EQ(thrd_join(helper, NULL), thrd_success, "failed to join");
+
+    mtx_stats_get(&stats, true);
+    EXPECT_GE(stats.contended, 1u, "contended lock not counted");
+    EXPECT_GE(stats.waits, 1u, "wait not counted");
+    EXPECT_GE(stats.wakes, 1u, "wake not counted");
+
+    // nothing is counted once disabled
+    mtx_stats_enable(false);
+    mx_object_signal(args.start_event, MX_EVENT_SIGNALED, 0);
+    thrd_create(&helper, test_stats_helper, &args);
+    mx_handle_wait_one(args.start_event, MX_EVENT_SIGNALED, MX_TIME_INFINITE, NULL);
+    mtx_lock(&args.mutex);
+    mtx_unlock(&args.mutex);
+    thrd_join(helper, NULL);
+    mtx_stats_get(&stats, false);
+    EXPECT_EQ(stats.contended, 0u, "counted while disabled");
+
+    mtx_destroy(&args.mutex);
+    ASSERT_EQ(mx_handle_close(args.start_event), NO_ERROR, "failed to close event");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(mtx_tests)
 RUN_TEST(test_initializer)
 RUN_TEST(test_mutexes)
 RUN_TEST(test_try_mutexes)
 RUN_TEST(test_static_initializer)
 RUN_TEST(test_timeout_elapsed)
+RUN_TEST(test_contention_stats)
 END_TEST_CASE(mtx_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -8,6 +8,7 @@
 #include <magenta/syscalls/channel.h>
 #include <magenta/syscalls/object.h>
 #include <unittest/unittest.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -635,6 +636,129 @@ static int call_server(void* ptr) {
     return 0;
 }
 
+static bool channel_move_pages(void) {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 8;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(size * 2, 0, &vmo), NO_ERROR, "");
+
+    uintptr_t addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size * 2,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr), NO_ERROR, "");
+    uint32_t* src = (uint32_t*)addr;
+    uint32_t* dst = (uint32_t*)(addr + size);
+
+    mx_handle_t h[2];
+    ASSERT_EQ(mx_channel_create(0, &h[0], &h[1]), NO_ERROR, "");
+
+    // a page aligned message, read into a page aligned buffer and into an unaligned one
+    uint32_t* buf = malloc(size + sizeof(uint32_t));
+    ASSERT_NONNULL(buf, "");
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < size / sizeof(uint32_t); i++)
+            src[i] = (uint32_t)(i + pass);
+        ASSERT_EQ(mx_channel_write(h[0], MX_CHANNEL_WRITE_MOVE_PAGES, src, size, NULL, 0u),
+                  NO_ERROR, "");
+
+        uint32_t* out = (pass == 0) ? dst : buf + 1;
+        uint32_t actual;
+        ASSERT_EQ(mx_channel_read(h[1], 0u, out, size, &actual, NULL, 0u, NULL), NO_ERROR, "");
+        EXPECT_EQ(actual, size, "");
+        bool match = true;
+        for (size_t i = 0; i < size / sizeof(uint32_t); i++)
+            match = match && out[i] == (uint32_t)(i + pass);
+        EXPECT_TRUE(match, "moved message contents");
+    }
+    free(buf);
+
+    // too small to move is just copied
+    static const uint32_t small = 0xdeadbeef;
+    ASSERT_EQ(mx_channel_write(h[0], MX_CHANNEL_WRITE_MOVE_PAGES, &small, sizeof(small),
+                               NULL, 0u), NO_ERROR, "");
+    uint32_t in = 0;
+    ASSERT_EQ(mx_channel_read(h[1], 0u, &in, sizeof(in), NULL, NULL, 0u, NULL), NO_ERROR, "");
+    EXPECT_EQ(in, small, "");
+
+    // unknown flags are rejected rather than ignored
+    EXPECT_EQ(mx_channel_write(h[0], ~MX_CHANNEL_WRITE_MASK, &small, sizeof(small), NULL, 0u),
+              ERR_NOT_SUPPORTED, "");
+
+    mx_handle_close(h[0]);
+    mx_handle_close(h[1]);
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), addr, size * 2), NO_ERROR, "");
+    mx_handle_close(vmo);
+
+    END_TEST;
+}
+
+static bool channel_read_write_many(void) {
+    BEGIN_TEST;
+
+    mx_handle_t a[2], b[2];
+    ASSERT_EQ(mx_channel_create(0, &a[0], &a[1]), NO_ERROR, "");
+    ASSERT_EQ(mx_channel_create(0, &b[0], &b[1]), NO_ERROR, "");
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+
+    // three messages to one channel, with a handle in the second, and one to another
+    uint32_t data[4] = { 1u, 2u, 3u, 4u };
+    mx_channel_msg_t wr[4] = {
+        { .channel = a[0], .num_bytes = sizeof(uint32_t), .bytes = &data[0] },
+        { .channel = a[0], .num_bytes = sizeof(uint32_t), .num_handles = 1u,
+          .bytes = &data[1], .handles = &event },
+        { .channel = a[0], .num_bytes = sizeof(uint32_t), .bytes = &data[2] },
+        { .channel = b[0], .num_bytes = sizeof(uint32_t), .bytes = &data[3] },
+    };
+    uint32_t actual = 0u;
+    ASSERT_EQ(mx_channel_write_many(0u, wr, 4u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 4u, "");
+
+    // the handle went with the message
+    EXPECT_EQ(mx_handle_close(event), ERR_BAD_HANDLE, "");
+
+    // the first two fit, the third doesn't
+    uint32_t in[3] = {};
+    mx_handle_t handle = MX_HANDLE_INVALID;
+    mx_channel_msg_t rd[3] = {
+        { .num_bytes = sizeof(uint32_t), .bytes = &in[0] },
+        { .num_bytes = sizeof(uint32_t), .num_handles = 1u, .bytes = &in[1], .handles = &handle },
+        { .num_bytes = 0u, .bytes = &in[2] },
+    };
+    ASSERT_EQ(mx_channel_read_many(a[1], 0u, rd, 3u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 2u, "");
+    EXPECT_EQ(in[0], 1u, "");
+    EXPECT_EQ(in[1], 2u, "");
+    EXPECT_EQ(rd[1].num_handles, 1u, "");
+    EXPECT_NEQ(handle, MX_HANDLE_INVALID, "");
+    EXPECT_EQ(rd[2].num_bytes, sizeof(uint32_t), "size the third message needs");
+    EXPECT_EQ(mx_handle_close(handle), NO_ERROR, "");
+
+    // the third is still there, and then there are none
+    rd[0].num_bytes = sizeof(uint32_t);
+    ASSERT_EQ(mx_channel_read_many(a[1], 0u, rd, 3u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(in[0], 3u, "");
+    EXPECT_EQ(mx_channel_read_many(a[1], 0u, rd, 3u, &actual), ERR_SHOULD_WAIT, "");
+    EXPECT_EQ(actual, 0u, "");
+
+    ASSERT_EQ(mx_channel_read_many(b[1], 0u, rd, 1u, &actual), NO_ERROR, "");
+    EXPECT_EQ(in[0], 4u, "");
+
+    // writing stops at the first bad channel
+    wr[1].channel = MX_HANDLE_INVALID;
+    wr[1].num_handles = 0u;
+    EXPECT_EQ(mx_channel_write_many(0u, wr, 4u, &actual), ERR_BAD_HANDLE, "");
+    EXPECT_EQ(actual, 1u, "");
+
+    mx_handle_close(a[0]);
+    mx_handle_close(a[1]);
+    mx_handle_close(b[0]);
+    mx_handle_close(b[1]);
+
+    END_TEST;
+}
+
 static bool channel_call(void) {
     BEGIN_TEST;
 
@@ -780,6 +904,8 @@ RUN_TEST(channel_non_transferable)
 RUN_TEST(channel_duplicate_handles)
 RUN_TEST(channel_multithread_read)
 RUN_TEST(channel_may_discard)
+RUN_TEST(channel_move_pages)
+RUN_TEST(channel_read_write_many)
 RUN_TEST(channel_call)
 RUN_TEST(channel_call2)
 RUN_TEST(channel_nest)
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -223,12 +224,91 @@ static bool exception_test(void) {
     END_TEST;
 }
 
+static bool mapped_state_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t fifo;
+    ASSERT_EQ(mx_fifo_create(4, &fifo), 0, "Error during fifo create");
+    ASSERT_EQ(mx_fifo_op(fifo, MX_FIFO_OP_ADVANCE_HEAD, 1, NULL), 0, "Error advancing head");
+
+    // The state moves into the page, keeping its value.
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_fifo_get_state_vmo(fifo, &vmo), 0, "Error getting state vmo");
+    uintptr_t addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, PAGE_SIZE,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr), 0,
+              "Error mapping state");
+    mx_handle_close(vmo);
+    mx_fifo_state_t* shared = (mx_fifo_state_t*)addr;
+    ASSERT_EQ(shared->head, 1u, "Bad mapped state");
+    ASSERT_EQ(shared->tail, 0u, "Bad mapped state");
+
+    // The producer fills it in place; the signals only follow on a sync.
+    __atomic_store_n(&shared->head, 4u, __ATOMIC_SEQ_CST);
+    check_signals(fifo, MX_FIFO_NOT_EMPTY | MX_FIFO_NOT_FULL);
+    mx_fifo_state_t state;
+    reset_state(&state);
+    ASSERT_EQ(mx_fifo_op(fifo, MX_FIFO_OP_SYNC, 0, &state), 0, "Error syncing");
+    ASSERT_EQ(state.head, 4u, "Bad fifo state");
+    ASSERT_EQ(state.tail, 0u, "Bad fifo state");
+    check_signals(fifo, MX_FIFO_NOT_EMPTY | MX_FIFO_FULL);
+
+    // Syscall advances show up in the page.
+    ASSERT_EQ(mx_fifo_op(fifo, MX_FIFO_OP_ADVANCE_TAIL, 2, NULL), 0, "Error advancing tail");
+    ASSERT_EQ(__atomic_load_n(&shared->tail, __ATOMIC_SEQ_CST), 2u, "Bad mapped state");
+    check_signals(fifo, MX_FIFO_NOT_EMPTY | MX_FIFO_NOT_FULL);
+
+    __atomic_store_n(&shared->tail, 4u, __ATOMIC_SEQ_CST);
+    ASSERT_EQ(mx_fifo_op(fifo, MX_FIFO_OP_SYNC, 0, NULL), 0, "Error syncing");
+    check_signals(fifo, MX_FIFO_EMPTY | MX_FIFO_NOT_FULL);
+
+    // A later call hands out the same page.
+    ASSERT_EQ(mx_fifo_get_state_vmo(fifo, &vmo), 0, "Error getting state vmo");
+    uint64_t head = 0;
+    size_t actual;
+    ASSERT_EQ(mx_vmo_read(vmo, &head, 0, sizeof(head), &actual), 0, "Error reading state");
+    ASSERT_EQ(head, 4u, "Bad mapped state");
+    mx_handle_close(vmo);
+
+    // An impossible state is refused and leaves the signals alone.
+    __atomic_store_n(&shared->head, 100u, __ATOMIC_SEQ_CST);
+    ASSERT_EQ(mx_fifo_op(fifo, MX_FIFO_OP_SYNC, 0, NULL), ERR_OUT_OF_RANGE, "Expected failure");
+    check_signals(fifo, MX_FIFO_EMPTY | MX_FIFO_NOT_FULL);
+
+    // The kernel works on the page too, so it can't be shrunk or decommitted.
+    ASSERT_EQ(mx_fifo_get_state_vmo(fifo, &vmo), 0, "Error getting state vmo");
+    EXPECT_EQ(mx_vmo_set_size(vmo, 0u), ERR_BAD_STATE, "Shrinking should fail");
+    EXPECT_EQ(mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0u, PAGE_SIZE, NULL, 0u), ERR_BAD_STATE,
+              "Decommitting should fail");
+    mx_handle_close(vmo);
+
+    // A handle that is neither producer nor consumer can look but not touch.
+    mx_handle_t reader;
+    ASSERT_EQ(mx_handle_duplicate(fifo, MX_RIGHT_READ | MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER,
+                                  &reader), 0, "Error duplicating fifo");
+    ASSERT_EQ(mx_fifo_get_state_vmo(reader, &vmo), 0, "Error getting state vmo");
+    uintptr_t ro_addr;
+    EXPECT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, PAGE_SIZE,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &ro_addr),
+              ERR_ACCESS_DENIED, "Mapping should be read only");
+    EXPECT_EQ(mx_vmo_set_size(vmo, 2 * PAGE_SIZE), ERR_ACCESS_DENIED, "Resizing should fail");
+    mx_handle_close(vmo);
+    EXPECT_EQ(mx_fifo_op(reader, MX_FIFO_OP_SYNC, 0, NULL), ERR_ACCESS_DENIED,
+              "Syncing should be denied");
+    mx_handle_close(reader);
+
+    mx_vmar_unmap(mx_vmar_root_self(), addr, PAGE_SIZE);
+    ASSERT_GE(mx_handle_close(fifo), 0, "Error closing fifo");
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(fifo_tests)
 RUN_TEST(basic_test)
 RUN_TEST(advance_too_many_test)
 RUN_TEST(restrict_rights_test)
 RUN_TEST(multithreaded_test)
 RUN_TEST(exception_test)
+RUN_TEST(mapped_state_test)
 END_TEST_CASE(fifo_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -62,6 +62,59 @@ static bool test_futex_wait_bad_address() {
     END_TEST;
 }
 
+static bool test_futex_wait_pi_bad_owner() {
+    BEGIN_TEST;
+    int futex_value = 123;
+    mx_status_t rc = mx_futex_wait_pi(&futex_value, futex_value, MX_HANDLE_INVALID, 0);
+    ASSERT_EQ(rc, ERR_BAD_HANDLE, "Futex PI wait should have returned bad handle");
+
+    // A thread can't lend its priority to itself.
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+    rc = mx_futex_wait_pi(&futex_value, futex_value, self, 0);
+    ASSERT_EQ(rc, ERR_INVALID_ARGS, "Futex PI wait should have returned invalid_arg");
+
+    // Naming the owner requires the right to read it.
+    mx_handle_t no_read;
+    ASSERT_EQ(mx_handle_duplicate(self, MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER, &no_read),
+              NO_ERROR, "Error duplicating thread handle");
+    rc = mx_futex_wait_pi(&futex_value, futex_value, no_read, 0);
+    EXPECT_EQ(rc, ERR_ACCESS_DENIED, "Futex PI wait should have returned access_denied");
+    ASSERT_EQ(mx_handle_close(no_read), NO_ERROR, "Error closing handle");
+    END_TEST;
+}
+
+static mx_handle_t pi_owner_handle;
+static volatile int pi_futex_value;
+static volatile mx_status_t pi_wait_result;
+
+static int pi_waiter_thread(void* arg) {
+    pi_wait_result = mx_futex_wait_pi((mx_futex_t*)&pi_futex_value, 1, pi_owner_handle,
+                                      MX_TIME_INFINITE);
+    return 0;
+}
+
+// The owner named by a PI wait keeps running and can wake the waiter as usual.
+static bool test_futex_wait_pi_wakeup() {
+    BEGIN_TEST;
+    pi_owner_handle = thrd_get_mx_handle(thrd_current());
+    pi_futex_value = 1;
+    pi_wait_result = ERR_INTERNAL;
+
+    thrd_t thread;
+    ASSERT_EQ(thrd_create_with_name(&thread, pi_waiter_thread, NULL, "pi_waiter"),
+              thrd_success, "Error during thread creation");
+    mx_nanosleep(100 * 1000 * 1000);
+
+    pi_futex_value = 0;
+    ASSERT_EQ(mx_futex_wake((mx_futex_t*)&pi_futex_value, 1), NO_ERROR, "Error in wake");
+    ASSERT_EQ(thrd_join(thread, NULL), thrd_success, "Error during join");
+
+    // The waiter may not have blocked before the value changed.
+    EXPECT_TRUE(pi_wait_result == NO_ERROR || pi_wait_result == ERR_BAD_STATE,
+                "Futex PI wait returned an unexpected status");
+    END_TEST;
+}
+
 // This starts a thread which waits on a futex.  We can do futex_wake()
 // operations and then test whether or not this thread has been woken up.
 class TestThread {
@@ -331,6 +384,40 @@ bool test_futex_requeue() {
     END_TEST;
 }
 
+// Test that futex_requeue() with a zero wake count moves waiters from several
+// futexes onto one without waking them, as a condition variable broadcast does
+// when it hands its waiters over to the mutex.
+bool test_futex_requeue_without_wake() {
+    BEGIN_TEST;
+    volatile int cond_values[4] = {100, 101, 102, 103};
+    volatile int mutex_value = 200;
+    TestThread thread1(&cond_values[0]);
+    TestThread thread2(&cond_values[1]);
+    TestThread thread3(&cond_values[2]);
+    TestThread thread4(&cond_values[3]);
+
+    for (auto& cond_value : cond_values) {
+        mx_status_t rc = mx_futex_requeue(
+            const_cast<int*>(&cond_value), 0, cond_value,
+            const_cast<int*>(&mutex_value), INT_MAX);
+        ASSERT_EQ(rc, NO_ERROR, "Error in requeue");
+    }
+    thread1.assert_thread_not_woken();
+    thread2.assert_thread_not_woken();
+    thread3.assert_thread_not_woken();
+    thread4.assert_thread_not_woken();
+
+    // All of them now wait on mutex_value, in the order they were moved.
+    check_futex_wake(&mutex_value, 1);
+    thread1.assert_thread_woken();
+    thread2.assert_thread_not_woken();
+    check_futex_wake(&mutex_value, INT_MAX);
+    thread2.assert_thread_woken();
+    thread3.assert_thread_woken();
+    thread4.assert_thread_woken();
+    END_TEST;
+}
+
 // Test the case where futex_wait() times out after having been moved to a
 // different queue by futex_requeue().  Check that futex_wait() removes
 // itself from the correct queue in that case.
@@ -473,6 +560,8 @@ RUN_TEST(test_futex_wait_value_mismatch);
 RUN_TEST(test_futex_wait_timeout);
 RUN_TEST(test_futex_wait_timeout_elapsed);
 RUN_TEST(test_futex_wait_bad_address);
+RUN_TEST(test_futex_wait_pi_bad_owner);
+RUN_TEST(test_futex_wait_pi_wakeup);
 RUN_TEST(test_futex_wakeup);
 RUN_TEST(test_futex_wakeup_limit);
 RUN_TEST(test_futex_wakeup_address);
@@ -482,6 +571,7 @@ RUN_TEST(test_futex_unqueued_on_timeout_3);
 RUN_TEST(test_futex_requeue_value_mismatch);
 RUN_TEST(test_futex_requeue_same_addr);
 RUN_TEST(test_futex_requeue);
+RUN_TEST(test_futex_requeue_without_wake);
 RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_futex_thread_killed);
 RUN_TEST(test_futex_misaligned);
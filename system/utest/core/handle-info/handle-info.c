@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/object.h>
@@ -81,9 +82,55 @@ bool handle_rights_test(void) {
     END_TEST;
 }
 
+#define LOOKUP_THREADS 4
+#define LOOKUP_ROUNDS 2000
+
+static mx_handle_t lookup_handles[LOOKUP_THREADS];
+
+static int lookup_thread(void* arg) {
+    mx_handle_t event = *(mx_handle_t*)arg;
+    for (int i = 0; i < LOOKUP_ROUNDS; i++) {
+        if (mx_object_signal(event, 0u, MX_USER_SIGNAL_0) != NO_ERROR)
+            return -1;
+    }
+    return 0;
+}
+
+// Handle lookups don't take the handle table lock, so race them against handles of the same
+// process being created and closed.
+bool handle_lookup_race_test(void) {
+    BEGIN_TEST;
+
+    thrd_t threads[LOOKUP_THREADS];
+    for (int i = 0; i < LOOKUP_THREADS; i++) {
+        ASSERT_EQ(mx_event_create(0u, &lookup_handles[i]), NO_ERROR, "");
+        ASSERT_EQ(thrd_create(&threads[i], lookup_thread, &lookup_handles[i]), thrd_success, "");
+    }
+
+    for (int i = 0; i < LOOKUP_ROUNDS; i++) {
+        mx_handle_t duped;
+        ASSERT_EQ(mx_handle_duplicate(lookup_handles[i % LOOKUP_THREADS], MX_RIGHT_SAME_RIGHTS,
+                                      &duped), NO_ERROR, "");
+        ASSERT_EQ(mx_object_signal(duped, MX_USER_SIGNAL_0, 0u), NO_ERROR, "");
+        ASSERT_EQ(mx_handle_close(duped), NO_ERROR, "");
+        EXPECT_EQ(mx_object_signal(duped, 0u, MX_USER_SIGNAL_0), ERR_BAD_HANDLE,
+                  "closed handle should be invalid");
+    }
+
+    for (int i = 0; i < LOOKUP_THREADS; i++) {
+        int result;
+        ASSERT_EQ(thrd_join(threads[i], &result), thrd_success, "");
+        EXPECT_EQ(result, 0, "lookup of a live handle failed");
+        ASSERT_EQ(mx_handle_close(lookup_handles[i]), NO_ERROR, "");
+    }
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_info_tests)
 RUN_TEST(handle_info_test)
 RUN_TEST(handle_rights_test)
+RUN_TEST(handle_lookup_race_test)
 END_TEST_CASE(handle_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -158,6 +158,70 @@ static bool thread_pool_test(void)
     END_TEST;
 }
 
+#define NUM_PRODUCERS 8
+#define PACKETS_PER_PRODUCER 500
+
+typedef struct producer_info {
+    mx_handle_t port;
+    uint64_t key;
+    volatile mx_status_t error;
+} producer_info_t;
+
+static int thread_producer(void* arg)
+{
+    producer_info_t* pinfo = arg;
+    mx_user_packet_t us_pkt = {};
+    us_pkt.hdr.key = pinfo->key;
+
+    for (uint64_t seq = 0; seq != PACKETS_PER_PRODUCER; ++seq) {
+        us_pkt.param[0] = seq;
+        mx_status_t status = mx_port_queue(pinfo->port, &us_pkt, sizeof(us_pkt));
+        if (status != NO_ERROR) {
+            pinfo->error = status;
+            break;
+        }
+    }
+    return 0;
+}
+
+static bool many_producers_test(void)
+{
+    BEGIN_TEST;
+
+    mx_handle_t port;
+    ASSERT_EQ(mx_port_create(0u, &port), NO_ERROR, "could not create ioport");
+
+    producer_info_t pinfo[NUM_PRODUCERS];
+    thrd_t threads[NUM_PRODUCERS];
+    for (size_t ix = 0; ix != NUM_PRODUCERS; ++ix) {
+        pinfo[ix] = (producer_info_t){port, ix, NO_ERROR};
+        int ret = thrd_create_with_name(&threads[ix], thread_producer, &pinfo[ix], "producer");
+        ASSERT_EQ(ret, thrd_success, "could not create thread");
+    }
+
+    // every packet arrives, and each producer's arrive in the order it queued them
+    uint64_t next_seq[NUM_PRODUCERS] = {};
+    bool in_order = true;
+    for (size_t ix = 0; ix != NUM_PRODUCERS * PACKETS_PER_PRODUCER; ++ix) {
+        mx_user_packet_t us_pkt;
+        ASSERT_EQ(mx_port_wait(port, MX_TIME_INFINITE, &us_pkt, sizeof(us_pkt)), NO_ERROR, "");
+        ASSERT_LT(us_pkt.hdr.key, (uint64_t)NUM_PRODUCERS, "bad key");
+        in_order = in_order && (us_pkt.param[0] == next_seq[us_pkt.hdr.key]);
+        next_seq[us_pkt.hdr.key]++;
+    }
+    EXPECT_TRUE(in_order, "packets out of order");
+
+    for (size_t ix = 0; ix != NUM_PRODUCERS; ++ix) {
+        EXPECT_EQ(thrd_join(threads[ix], NULL), thrd_success, "failed to wait");
+        EXPECT_EQ(pinfo[ix].error, NO_ERROR, "queue failed");
+        EXPECT_EQ(next_seq[ix], (uint64_t)PACKETS_PER_PRODUCER, "missing packets");
+    }
+
+    EXPECT_EQ(mx_handle_close(port), NO_ERROR, "failed to close ioport");
+
+    END_TEST;
+}
+
 static bool bind_basic_test(void)
 {
     BEGIN_TEST;
@@ -466,15 +530,74 @@ static bool port_timeout(void) {
     END_TEST;
 }
 
+static bool wait_many_test(void) {
+    BEGIN_TEST;
+    mx_status_t status;
+    mx_handle_t port;
+
+    status = mx_port_create(0u, &port);
+    EXPECT_EQ(status, 0, "");
+
+    mx_user_packet_t out[4] = {};
+    uint32_t actual = 0u;
+    status = mx_port_wait_many(port, 0ull, out, sizeof(out), sizeof(out[0]), &actual);
+    EXPECT_EQ(status, ERR_TIMED_OUT, "");
+
+    for (uint64_t ix = 0; ix != 6u; ++ix) {
+        const mx_user_packet_t in = {{ix, 0u, 0u}, {ix * 10u}};
+        status = mx_port_queue(port, &in, sizeof(in));
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+
+    // the first four come out in order, leaving two queued
+    status = mx_port_wait_many(port, MX_TIME_INFINITE, out, sizeof(out), sizeof(out[0]), &actual);
+    EXPECT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, 4u, "");
+    for (uint64_t ix = 0; ix != 4u; ++ix) {
+        EXPECT_EQ(out[ix].hdr.key, ix, "key mismatch");
+        EXPECT_EQ(out[ix].hdr.type, MX_PORT_PKT_TYPE_USER, "type mismatch");
+        EXPECT_EQ(out[ix].param[0], ix * 10u, "payload mismatch");
+    }
+
+    status = mx_port_wait_many(port, 0ull, out, sizeof(out), sizeof(out[0]), &actual);
+    EXPECT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(actual, 2u, "");
+    EXPECT_EQ(out[0].hdr.key, 4u, "key mismatch");
+    EXPECT_EQ(out[1].hdr.key, 5u, "key mismatch");
+
+    // a packet bigger than a slot stays queued
+    const mx_user_packet_t big = {{9u, 0u, 0u}, {}};
+    status = mx_port_queue(port, &big, sizeof(big));
+    EXPECT_EQ(status, NO_ERROR, "");
+
+    mx_packet_header_t small[2];
+    status = mx_port_wait_many(port, 0ull, small, sizeof(small), sizeof(small[0]), &actual);
+    EXPECT_EQ(status, ERR_BUFFER_TOO_SMALL, "");
+
+    status = mx_port_wait_many(port, 0ull, out, sizeof(out[0]) - 1u, sizeof(out[0]), &actual);
+    EXPECT_EQ(status, ERR_BUFFER_TOO_SMALL, "");
+
+    status = mx_port_wait_many(port, 0ull, out, sizeof(out), sizeof(out[0]), NULL);
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(out[0].hdr.key, 9u, "key mismatch");
+
+    status = mx_handle_close(port);
+    EXPECT_EQ(status, NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
 RUN_TEST(thread_pool_test)
+RUN_TEST(many_producers_test)
 RUN_TEST(bind_basic_test)
 RUN_TEST(bind_channels_test)
 RUN_TEST(bind_sockets_test)
 RUN_TEST(bind_channels_playback)
 RUN_TEST(port_timeout)
+RUN_TEST(wait_many_test)
 END_TEST_CASE(port_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -128,9 +129,161 @@ static bool wait_test(void) {
     END_TEST;
 }
 
+static bool cpu_limits_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t job_parent = mx_job_default();
+    ASSERT_NEQ(job_parent, MX_HANDLE_INVALID, "");
+
+    mx_handle_t job_child;
+    ASSERT_EQ(mx_job_create(job_parent, 0u, &job_child), NO_ERROR, "");
+
+    // Out of range weights and bandwidth limits are rejected.
+    ASSERT_EQ(mx_job_set_cpu_limits(job_child, 0u, 0u, 0u), ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_job_set_cpu_limits(job_child, 1001u, 0u, 0u), ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_job_set_cpu_limits(job_child, 100u, 1000u, 1000u), ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_job_set_cpu_limits(job_child, 100u, MX_MSEC(10), 0u), ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_job_set_cpu_limits(MX_HANDLE_INVALID, 100u, 0u, 0u), ERR_BAD_HANDLE, "");
+
+    // A capped job still makes progress.
+    ASSERT_EQ(mx_job_set_cpu_limits(job_child, 50u, MX_MSEC(10), MX_MSEC(2)), NO_ERROR, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+
+    mx_handle_t process, thread;
+    ASSERT_EQ(start_mini_process(job_child, event, &process, &thread), NO_ERROR, "");
+    mx_nanosleep(MX_MSEC(50));
+    ASSERT_EQ(mx_task_kill(process), NO_ERROR, "");
+
+    mx_signals_t signals;
+    ASSERT_EQ(mx_handle_wait_one(
+        process, MX_TASK_TERMINATED, MX_TIME_INFINITE, &signals), NO_ERROR, "");
+
+    // Lifting the cap succeeds, as the caller is outside the job. Loosening
+    // it from inside is tested by job-limits-test.
+    ASSERT_EQ(mx_job_set_cpu_limits(job_child, 100u, 0u, 0u), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(thread), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(process), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(event), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(job_child), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool memory_limits_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t job_parent = mx_job_default();
+    ASSERT_NEQ(job_parent, MX_HANDLE_INVALID, "");
+
+    mx_handle_t job_child;
+    ASSERT_EQ(mx_job_create(job_parent, 0u, &job_child), NO_ERROR, "");
+
+    // A soft limit above the hard limit is rejected.
+    ASSERT_EQ(mx_job_set_memory_limits(job_child, 2u * PAGE_SIZE, PAGE_SIZE),
+              ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_job_set_memory_limits(job_child, UINT64_MAX, 0u), ERR_OUT_OF_RANGE, "");
+    ASSERT_EQ(mx_job_set_memory_limits(MX_HANDLE_INVALID, 0u, 0u), ERR_BAD_HANDLE, "");
+
+    // Nothing is committed to the new job, so neither limit signal is asserted.
+    ASSERT_EQ(mx_job_set_memory_limits(job_child, PAGE_SIZE, 4u * PAGE_SIZE), NO_ERROR, "");
+    mx_signals_t signals = 0u;
+    ASSERT_EQ(mx_handle_wait_one(job_child,
+                                 MX_JOB_MEMORY_SOFT_LIMIT | MX_JOB_MEMORY_HARD_LIMIT,
+                                 0u, &signals), ERR_TIMED_OUT, "");
+    ASSERT_EQ(signals & (MX_JOB_MEMORY_SOFT_LIMIT | MX_JOB_MEMORY_HARD_LIMIT), 0u, "");
+
+    // Clearing the limits succeeds, as the caller is outside the job.
+    // Committing past them is tested by job-limits-test, which can launch a
+    // process into the job to create VMOs charged to it.
+    ASSERT_EQ(mx_job_set_memory_limits(job_child, 0u, 0u), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(job_child), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static mx_koid_t get_koid(mx_handle_t handle) {
+    mx_info_handle_basic_t info;
+    if (mx_object_get_info(handle, MX_INFO_HANDLE_BASIC, &info, sizeof(info),
+                           NULL, NULL) != NO_ERROR)
+        return MX_KOID_INVALID;
+    return info.koid;
+}
+
+static bool task_records_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t job_parent = mx_job_default();
+    ASSERT_NEQ(job_parent, MX_HANDLE_INVALID, "");
+
+    mx_handle_t job_child, job_grandchild;
+    ASSERT_EQ(mx_job_create(job_parent, 0u, &job_child), NO_ERROR, "");
+    ASSERT_EQ(mx_job_create(job_child, 0u, &job_grandchild), NO_ERROR, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+
+    mx_handle_t process, thread;
+    ASSERT_EQ(start_mini_process(job_child, event, &process, &thread), NO_ERROR, "");
+
+    // With no buffer, only the number of records is returned: the two jobs,
+    // the process and its thread.
+    size_t actual, avail;
+    ASSERT_EQ(mx_object_get_info(job_child, MX_INFO_JOB_TASKS, NULL, 0u, &actual, &avail),
+              NO_ERROR, "");
+    ASSERT_EQ(actual, 0u, "");
+    ASSERT_EQ(avail, 4u, "");
+
+    mx_info_task_record_t records[4];
+    ASSERT_EQ(mx_object_get_info(job_child, MX_INFO_JOB_TASKS, records, sizeof(records),
+                                 &actual, &avail), NO_ERROR, "");
+    ASSERT_EQ(actual, 4u, "");
+    ASSERT_EQ(avail, 4u, "");
+
+    // The job comes first, then its process and the process's thread, then
+    // the child job.
+    EXPECT_EQ(records[0].type, (uint32_t)MX_OBJ_TYPE_JOB, "");
+    EXPECT_EQ(records[0].koid, get_koid(job_child), "");
+    EXPECT_EQ(records[0].parent_koid, get_koid(job_parent), "");
+    EXPECT_EQ(records[1].type, (uint32_t)MX_OBJ_TYPE_PROCESS, "");
+    EXPECT_EQ(records[1].koid, get_koid(process), "");
+    EXPECT_EQ(records[1].parent_koid, records[0].koid, "");
+    EXPECT_EQ(records[1].state, MX_TASK_STATE_RUNNING, "");
+    EXPECT_EQ(records[2].type, (uint32_t)MX_OBJ_TYPE_THREAD, "");
+    EXPECT_EQ(records[2].koid, get_koid(thread), "");
+    EXPECT_EQ(records[2].parent_koid, records[1].koid, "");
+    EXPECT_LE(records[1].runtime_ns, records[2].runtime_ns, "");
+    EXPECT_EQ(records[3].type, (uint32_t)MX_OBJ_TYPE_JOB, "");
+    EXPECT_EQ(records[3].koid, get_koid(job_grandchild), "");
+    EXPECT_EQ(records[3].parent_koid, records[0].koid, "");
+
+    // Processes are not jobs.
+    ASSERT_EQ(mx_object_get_info(process, MX_INFO_JOB_TASKS, records, sizeof(records),
+                                 &actual, &avail), ERR_WRONG_TYPE, "");
+
+    ASSERT_EQ(mx_task_kill(process), NO_ERROR, "");
+    mx_signals_t signals;
+    ASSERT_EQ(mx_handle_wait_one(
+        process, MX_TASK_TERMINATED, MX_TIME_INFINITE, &signals), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(thread), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(process), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(event), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(job_grandchild), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(job_child), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(job_tests)
 RUN_TEST(basic_test)
 RUN_TEST(create_test)
 RUN_TEST(kill_test)
 RUN_TEST(wait_test)
+RUN_TEST(cpu_limits_test)
+RUN_TEST(memory_limits_test)
+RUN_TEST(task_records_test)
 END_TEST_CASE(job_tests)
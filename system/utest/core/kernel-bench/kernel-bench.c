@@ -0,0 +1,31 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+#include <unittest/unittest.h>
+#include <string.h>
+
+extern mx_handle_t root_resource;
+
+// Runs the kernel's own benchmarks, which print their results to the kernel
+// log, so that they run with the rest of the tests.
+static bool test_kernel_benchmarks(void) {
+    BEGIN_TEST;
+
+    if (root_resource == MX_HANDLE_INVALID) {
+        unittest_printf("no root resource handle, skipping\n");
+        END_TEST;
+    }
+
+    static const char cmd[] = "kb all";
+    ASSERT_EQ(mx_debug_send_command(root_resource, cmd, strlen(cmd)), NO_ERROR,
+              "kernel benchmarks failed");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(kernel_bench_tests)
+RUN_TEST(test_kernel_benchmarks);
+END_TEST_CASE(kernel_bench_tests)
@@ -0,0 +1,188 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/log.h>
+#include <unittest/unittest.h>
+
+#define NUM_THREADS 4
+#define NUM_WRITES 32
+
+static mx_handle_t write_log;
+
+static int writer_thread(void* arg) {
+    int id = (int)(uintptr_t)arg;
+    char msg[32];
+    for (int i = 0; i < NUM_WRITES; i++) {
+        snprintf(msg, sizeof(msg), "log-test %d %d", id, i);
+        if (mx_log_write(write_log, strlen(msg), msg, 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Reads the log until it runs dry, counting the records the writer threads
+// wrote. Returns the number read.
+static int read_until_empty(mx_handle_t h, uint32_t flags, bool seen[NUM_THREADS][NUM_WRITES]) {
+    uint64_t buf[8 * MX_LOG_RECORD_MAX / sizeof(uint64_t)];
+    int count = 0;
+    for (;;) {
+        mx_status_t n = mx_log_read(h, sizeof(buf), buf, flags);
+        if (n <= 0)
+            break;
+        size_t off = 0;
+        while (off + sizeof(mx_log_record_t) <= (size_t)n) {
+            mx_log_record_t* rec = (mx_log_record_t*)((char*)buf + off);
+            char msg[MX_LOG_RECORD_MAX];
+            memcpy(msg, rec->data, rec->datalen);
+            msg[rec->datalen] = 0;
+            int id, i;
+            if (sscanf(msg, "log-test %d %d", &id, &i) == 2 &&
+                id >= 0 && id < NUM_THREADS && i >= 0 && i < NUM_WRITES) {
+                seen[id][i] = true;
+            }
+            count++;
+            off += (sizeof(mx_log_record_t) + rec->datalen + 7) & ~7;
+        }
+    }
+    return count;
+}
+
+static bool concurrent_write_test(uint32_t read_flags) {
+    BEGIN_TEST;
+
+    mx_handle_t read_log;
+    ASSERT_EQ(mx_log_create(MX_LOG_FLAG_READABLE, &read_log), NO_ERROR, "");
+    ASSERT_EQ(mx_log_create(0, &write_log), NO_ERROR, "");
+
+    thrd_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        ASSERT_EQ(thrd_create(&threads[i], writer_thread, (void*)(uintptr_t)i), thrd_success, "");
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int ret;
+        ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+        EXPECT_EQ(ret, 0, "log write failed");
+    }
+
+    static bool seen[NUM_THREADS][NUM_WRITES];
+    memset(seen, 0, sizeof(seen));
+    read_until_empty(read_log, read_flags, seen);
+    for (int id = 0; id < NUM_THREADS; id++) {
+        for (int i = 0; i < NUM_WRITES; i++) {
+            EXPECT_TRUE(seen[id][i], "record missing from the log");
+        }
+    }
+
+    mx_handle_close(write_log);
+    mx_handle_close(read_log);
+    END_TEST;
+}
+
+static bool concurrent_write_read_one_test(void) {
+    return concurrent_write_test(0);
+}
+
+static bool concurrent_write_read_batch_test(void) {
+    return concurrent_write_test(MX_LOG_FLAG_BATCH);
+}
+
+static bool batch_read_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t h;
+    ASSERT_EQ(mx_log_create(MX_LOG_FLAG_READABLE, &h), NO_ERROR, "");
+    const char msg[] = "log-test batch";
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(mx_log_write(h, sizeof(msg) - 1, msg, 0), NO_ERROR, "");
+    }
+
+    // one record doesn't fit
+    char small[sizeof(mx_log_record_t) / 2];
+    EXPECT_EQ(mx_log_read(h, sizeof(small), small, MX_LOG_FLAG_BATCH), ERR_BUFFER_TOO_SMALL, "");
+
+    // a batch read returns more than one record, each 8 byte aligned
+    uint64_t buf[8 * MX_LOG_RECORD_MAX / sizeof(uint64_t)];
+    mx_status_t n = mx_log_read(h, sizeof(buf), buf, MX_LOG_FLAG_BATCH);
+    ASSERT_GT(n, 0, "");
+    mx_log_record_t* rec = (mx_log_record_t*)buf;
+    size_t first = (sizeof(mx_log_record_t) + rec->datalen + 7) & ~7;
+    EXPECT_GT((size_t)n, first, "batch read returned one record");
+
+    mx_handle_close(h);
+    END_TEST;
+}
+
+#define NUM_BATCH_LINES 40
+#define LONG_LINE_LEN 300
+
+static bool batch_write_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t h;
+    ASSERT_EQ(mx_log_create(MX_LOG_FLAG_READABLE, &h), NO_ERROR, "");
+
+    char batch[MX_LOG_WRITE_BATCH_MAX + 1];
+    size_t len = 0;
+    for (int i = 0; i < NUM_BATCH_LINES; i++) {
+        len += snprintf(batch + len, sizeof(batch) - len, "log-batch %d\n", i);
+    }
+    // too long for one record, so it is split
+    len += snprintf(batch + len, sizeof(batch) - len, "log-batch-long ");
+    memset(batch + len, 'x', LONG_LINE_LEN);
+    len += LONG_LINE_LEN;
+    ASSERT_EQ(mx_log_write(h, len, batch, MX_LOG_FLAG_BATCH), NO_ERROR, "");
+
+    EXPECT_EQ(mx_log_write(h, sizeof(batch), batch, MX_LOG_FLAG_BATCH), ERR_OUT_OF_RANGE, "");
+
+    bool seen[NUM_BATCH_LINES] = {};
+    bool seen_long = false;
+    uint64_t buf[8 * MX_LOG_RECORD_MAX / sizeof(uint64_t)];
+    for (;;) {
+        mx_status_t n = mx_log_read(h, sizeof(buf), buf, MX_LOG_FLAG_BATCH);
+        if (n <= 0)
+            break;
+        size_t off = 0;
+        while (off + sizeof(mx_log_record_t) <= (size_t)n) {
+            mx_log_record_t* rec = (mx_log_record_t*)((char*)buf + off);
+            char msg[MX_LOG_RECORD_MAX];
+            memcpy(msg, rec->data, rec->datalen);
+            msg[rec->datalen] = 0;
+            int i;
+            if (!strncmp(msg, "log-batch-long ", 15)) {
+                EXPECT_EQ(rec->datalen, MX_LOG_RECORD_MAX - sizeof(mx_log_record_t),
+                          "long line should fill a record");
+                seen_long = true;
+            } else if (sscanf(msg, "log-batch %d", &i) == 1 && i >= 0 && i < NUM_BATCH_LINES) {
+                EXPECT_EQ(strchr(msg, '\n'), NULL, "record includes the newline");
+                seen[i] = true;
+            }
+            off += (sizeof(mx_log_record_t) + rec->datalen + 7) & ~7;
+        }
+    }
+    for (int i = 0; i < NUM_BATCH_LINES; i++) {
+        EXPECT_TRUE(seen[i], "line missing from the log");
+    }
+    EXPECT_TRUE(seen_long, "long line missing from the log");
+
+    mx_handle_close(h);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(log_tests)
+RUN_TEST(concurrent_write_read_one_test)
+RUN_TEST(concurrent_write_read_batch_test)
+RUN_TEST(batch_read_test)
+RUN_TEST(batch_write_test)
+END_TEST_CASE(log_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -72,8 +72,41 @@ bool tls_test(void) {
     END_TEST;
 }
 
+static __thread int tls_value;
+
+static void* dirty_tls(void* arg) {
+    bool* clean = arg;
+    *clean = tls_value == 0 && pthread_getspecific(tsd_key) == NULL;
+    tls_value = 1;
+    pthread_setspecific(tsd_key, &tls_value);
+    return NULL;
+}
+
+// Thread stacks are reused once their threads are joined or detached, but
+// every new thread must still start with fresh TLS and tsd.
+bool tls_reused_stack_test(void) {
+    BEGIN_TEST;
+    ASSERT_EQ(pthread_key_create(&tsd_key, NULL), 0, "Error during key creation");
+
+    for (int i = 0; i < 20; i++) {
+        bool clean = false;
+        pthread_t thread;
+        ASSERT_EQ(pthread_create(&thread, NULL, dirty_tls, &clean), 0, "Error creating thread");
+        if (i % 4 == 3) {
+            // Leave the stack to be reclaimed after the thread exits.
+            ASSERT_EQ(pthread_detach(thread), 0, "Error detaching thread");
+            mx_nanosleep(MX_MSEC(10));
+        } else {
+            ASSERT_EQ(pthread_join(thread, NULL), 0, "Error joining thread");
+        }
+        EXPECT_TRUE(clean, "new thread saw an old thread's TLS or tsd");
+    }
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(tls_tests)
 RUN_TEST(tls_test)
+RUN_TEST(tls_reused_stack_test)
 END_TEST_CASE(tls_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -8,7 +8,10 @@
 #include <magenta/syscalls/port.h>
 #include <magenta/syscalls/resource.h>
 #include <unittest/unittest.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <threads.h>
 
 extern mx_handle_t root_resource;
 
@@ -139,7 +142,249 @@ static bool test_resource_connect(void) {
     END_TEST;
 }
 
+static bool test_resource_sched_latency(void) {
+    BEGIN_TEST;
+
+    mx_handle_t rrh = root_resource;
+    ASSERT_NEQ(rrh, MX_HANDLE_INVALID, "no root resource handle");
+
+    size_t count, avail;
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_CPU_SCHED_LATENCY, NULL, 0, &count, &avail),
+              NO_ERROR, "");
+    ASSERT_EQ(count, 0u, "");
+    ASSERT_GT(avail, 0u, "no cpus");
+
+    // sleeping wakes us up, so some cpu must have recorded a wakeup latency
+    ASSERT_EQ(mx_nanosleep(MX_MSEC(1)), NO_ERROR, "");
+
+    mx_info_cpu_sched_latency_t info[32];
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_CPU_SCHED_LATENCY, info, sizeof(info), &count, &avail),
+              NO_ERROR, "");
+    ASSERT_GT(count, 0u, "");
+
+    uint64_t wakeups = 0;
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(info[i].cpu, i, "");
+        uint64_t sum = 0;
+        for (int b = 0; b < MX_SCHED_LATENCY_BUCKETS; b++)
+            sum += info[i].wakeup.buckets[b];
+        EXPECT_EQ(sum, info[i].wakeup.count, "buckets don't add up");
+        wakeups += info[i].wakeup.count;
+    }
+    EXPECT_GT(wakeups, 0u, "no wakeups recorded");
+
+    // only the root resource may read these
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0, &event), NO_ERROR, "");
+    EXPECT_NEQ(mx_object_get_info(event, MX_INFO_CPU_SCHED_LATENCY, info, sizeof(info), &count, &avail),
+               NO_ERROR, "");
+    mx_handle_close(event);
+
+    END_TEST;
+}
+
+static int64_t kcounter_value(const mx_info_kcounter_t* info, size_t count, const char* name) {
+    for (size_t i = 0; i < count; i++) {
+        if (!strcmp(info[i].name, name))
+            return info[i].value;
+    }
+    return -1;
+}
+
+static bool test_resource_kcounters(void) {
+    BEGIN_TEST;
+
+    mx_handle_t rrh = root_resource;
+    ASSERT_NEQ(rrh, MX_HANDLE_INVALID, "no root resource handle");
+
+    size_t count, avail;
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_KCOUNTERS, NULL, 0, &count, &avail),
+              NO_ERROR, "");
+    ASSERT_EQ(count, 0u, "");
+    ASSERT_GT(avail, 0u, "no counters");
+
+    static mx_info_kcounter_t before[256], after[256];
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_KCOUNTERS, before, sizeof(before), &count, &avail),
+              NO_ERROR, "");
+    ASSERT_EQ(count, avail, "");
+    int64_t syscalls = kcounter_value(before, count, "kernel.syscalls");
+    int64_t switches = kcounter_value(before, count, "kernel.context_switches");
+    ASSERT_GE(syscalls, 0, "no syscall counter");
+    ASSERT_GE(switches, 0, "no context switch counter");
+
+    // sleeping is a syscall that switches away from us and back
+    ASSERT_EQ(mx_nanosleep(MX_MSEC(1)), NO_ERROR, "");
+
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_KCOUNTERS, after, sizeof(after), &count, &avail),
+              NO_ERROR, "");
+    EXPECT_GT(kcounter_value(after, count, "kernel.syscalls"), syscalls, "");
+    EXPECT_GT(kcounter_value(after, count, "kernel.context_switches"), switches, "");
+
+    // only the root resource may read these
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0, &event), NO_ERROR, "");
+    EXPECT_NEQ(mx_object_get_info(event, MX_INFO_KCOUNTERS, after, sizeof(after), &count, &avail),
+               NO_ERROR, "");
+    mx_handle_close(event);
+
+    END_TEST;
+}
+
+static bool test_resource_fault_around_counter(void) {
+    BEGIN_TEST;
+
+    mx_handle_t rrh = root_resource;
+    ASSERT_NEQ(rrh, MX_HANDLE_INVALID, "no root resource handle");
+
+    const size_t pages = 32;
+    const size_t len = pages * PAGE_SIZE;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(len, 0, &vmo), NO_ERROR, "");
+    ASSERT_EQ(mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, len, NULL, 0), NO_ERROR, "");
+
+    uintptr_t addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, len,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_MAP_SEQUENTIAL, &addr),
+              NO_ERROR, "");
+
+    static mx_info_kcounter_t before[256], after[256];
+    size_t count, avail;
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_KCOUNTERS, before, sizeof(before), &count, &avail),
+              NO_ERROR, "");
+    int64_t mapped = kcounter_value(before, count, "vm.fault_around_pages");
+    ASSERT_GE(mapped, 0, "no fault-around counter");
+
+    // the first touch should map the rest of the committed range ahead of it
+    volatile const uint8_t* p = (volatile const uint8_t*)addr;
+    for (size_t i = 0; i < pages; i++)
+        (void)p[i * PAGE_SIZE];
+
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_KCOUNTERS, after, sizeof(after), &count, &avail),
+              NO_ERROR, "");
+    EXPECT_GE(kcounter_value(after, count, "vm.fault_around_pages") - mapped,
+              (int64_t)(pages - 1), "fault-around did not map the committed pages");
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), addr, len), NO_ERROR, "");
+    mx_handle_close(vmo);
+
+    END_TEST;
+}
+
+#define STATS_WORKERS 4
+#define STATS_WORKER_CALLS 1000
+
+// yields are nanosleep calls too, so each worker adds STATS_WORKER_CALLS to its count
+static int syscall_stats_worker(void* arg) {
+    for (int i = 0; i < STATS_WORKER_CALLS; i++)
+        mx_nanosleep(0);
+    return 0;
+}
+
+static uint64_t nanosleep_count(const mx_info_syscall_stats_t* info, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!strcmp(info[i].name, "nanosleep"))
+            return info[i].latency.count;
+    }
+    return 0;
+}
+
+static bool test_resource_syscall_stats(void) {
+    BEGIN_TEST;
+
+    mx_handle_t rrh = root_resource;
+    ASSERT_NEQ(rrh, MX_HANDLE_INVALID, "no root resource handle");
+
+    size_t count, avail;
+    mx_status_t status = mx_object_get_info(rrh, MX_INFO_SYSCALL_STATS, NULL, 0, &count, &avail);
+    if (status == ERR_NOT_SUPPORTED) {
+        unittest_printf("kernel built without syscall stats\n");
+        return true;
+    }
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_GT(avail, 0u, "");
+
+    static mx_info_syscall_stats_t info[256];
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_SYSCALL_STATS, info, sizeof(info), &count, &avail),
+              NO_ERROR, "");
+    uint64_t calls = nanosleep_count(info, count);
+
+    // make syscalls from several cpus at once, and wait for all of them to
+    // be counted before looking at the histograms
+    thrd_t workers[STATS_WORKERS];
+    for (int i = 0; i < STATS_WORKERS; i++)
+        ASSERT_EQ(thrd_create(&workers[i], syscall_stats_worker, NULL), thrd_success, "");
+    for (int i = 0; i < STATS_WORKERS; i++)
+        ASSERT_EQ(thrd_join(workers[i], NULL), thrd_success, "");
+
+    ASSERT_EQ(mx_nanosleep(MX_MSEC(1)), NO_ERROR, "");
+
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_SYSCALL_STATS, info, sizeof(info), &count, &avail),
+              NO_ERROR, "");
+    EXPECT_GE(nanosleep_count(info, count) - calls,
+              (uint64_t)(STATS_WORKERS * STATS_WORKER_CALLS + 1), "calls went uncounted");
+    bool found = false;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t sum = 0;
+        for (int b = 0; b < MX_SCHED_LATENCY_BUCKETS; b++)
+            sum += info[i].latency.buckets[b];
+        EXPECT_EQ(sum, info[i].latency.count, "buckets don't add up");
+        if (!strcmp(info[i].name, "nanosleep")) {
+            EXPECT_GT(info[i].latency.count, 0u, "");
+            EXPECT_GE(info[i].latency.max_ns, (uint64_t)MX_MSEC(1), "slept for less than 1ms");
+            found = true;
+        }
+    }
+    EXPECT_TRUE(found, "no stats for nanosleep");
+
+    END_TEST;
+}
+
+static bool test_resource_kernel_stalls(void) {
+    BEGIN_TEST;
+
+    mx_handle_t rrh = root_resource;
+    ASSERT_NEQ(rrh, MX_HANDLE_INVALID, "no root resource handle");
+
+    size_t count, avail;
+    mx_status_t status = mx_object_get_info(rrh, MX_INFO_KERNEL_STALLS, NULL, 0, &count, &avail);
+    if (status == ERR_NOT_SUPPORTED) {
+        unittest_printf("kernel built without the stall detector\n");
+        return true;
+    }
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(count, 0u, "");
+
+    // whether there are any depends on the machine, but those there are must
+    // be in order and make sense
+    static mx_info_kernel_stall_t info[128];
+    ASSERT_EQ(mx_object_get_info(rrh, MX_INFO_KERNEL_STALLS, info, sizeof(info), &count, &avail),
+              NO_ERROR, "");
+    EXPECT_LE(count, avail, "");
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0)
+            EXPECT_GT(info[i].seq, info[i - 1].seq, "out of order");
+        EXPECT_GT(info[i].duration_ns, 0u, "");
+        EXPECT_LE(info[i].backtrace_count, (uint32_t)MX_KERNEL_STALL_BACKTRACE_DEPTH, "");
+        EXPECT_TRUE(info[i].type == MX_KERNEL_STALL_TIMER ||
+                    info[i].type == MX_KERNEL_STALL_IRQS_OFF, "bad type");
+    }
+
+    // only the root resource may read these
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0, &event), NO_ERROR, "");
+    EXPECT_NEQ(mx_object_get_info(event, MX_INFO_KERNEL_STALLS, info, sizeof(info), &count, &avail),
+               NO_ERROR, "");
+    mx_handle_close(event);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(resource_tests)
 RUN_TEST(test_resource_actions);
 RUN_TEST(test_resource_connect);
+RUN_TEST(test_resource_sched_latency);
+RUN_TEST(test_resource_kcounters);
+RUN_TEST(test_resource_fault_around_counter);
+RUN_TEST(test_resource_syscall_stats);
+RUN_TEST(test_resource_kernel_stalls);
 END_TEST_CASE(resource_tests)
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 static mx_signals_t get_satisfied_signals(mx_handle_t handle) {
@@ -328,6 +329,133 @@ static bool socket_short_write(void) {
     END_TEST;
 }
 
+static bool socket_sized(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_handle_t h0, h1;
+
+    status = mx_socket_create(MX_SOCKET_SIZE(MX_SOCKET_SIZE_MIN_LOG2 - 1), &h0, &h1);
+    ASSERT_EQ(status, ERR_INVALID_ARGS, "");
+    status = mx_socket_create(MX_SOCKET_SIZE(MX_SOCKET_SIZE_MAX_LOG2 + 1), &h0, &h1);
+    ASSERT_EQ(status, ERR_INVALID_ARGS, "");
+
+    status = mx_socket_create(MX_SOCKET_SIZE(12), &h0, &h1);
+    ASSERT_EQ(status, NO_ERROR, "");
+
+    // One byte of the ring always stays free.
+    static char buffer[8192];
+    size_t written = 0;
+    status = mx_socket_write(h0, 0u, buffer, sizeof(buffer), &written);
+    ASSERT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(written, 4095u, "");
+    EXPECT_EQ(get_satisfied_signals(h0), 0u, "");
+
+    // Only shared ring sockets hand out their ring.
+    mx_handle_t vmo;
+    status = mx_socket_get_ring(h0, MX_SOCKET_RING_RX, &vmo);
+    EXPECT_EQ(status, ERR_NOT_SUPPORTED, "");
+
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
+static mx_socket_ring_t* map_ring(mx_handle_t socket, uint32_t which, size_t size) {
+    mx_handle_t vmo;
+    if (mx_socket_get_ring(socket, which, &vmo) != NO_ERROR)
+        return NULL;
+    uintptr_t addr = 0;
+    mx_status_t status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0,
+                                     MX_SOCKET_RING_DATA_OFFSET + size,
+                                     MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr);
+    mx_handle_close(vmo);
+    return status == NO_ERROR ? (mx_socket_ring_t*)addr : NULL;
+}
+
+static bool socket_shared_ring(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_handle_t h0, h1;
+    const size_t size = 1u << 12;
+
+    status = mx_socket_create(MX_SOCKET_SHARED_RING | MX_SOCKET_SIZE(12), &h0, &h1);
+    ASSERT_EQ(status, NO_ERROR, "");
+
+    mx_handle_t vmo;
+    status = mx_socket_get_ring(h0, 2u, &vmo);
+    EXPECT_EQ(status, ERR_INVALID_ARGS, "");
+
+    // The kernel works on the ring too, so it can't be shrunk or decommitted.
+    ASSERT_EQ(mx_socket_get_ring(h0, MX_SOCKET_RING_TX, &vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_vmo_set_size(vmo, 0u), ERR_BAD_STATE, "");
+    EXPECT_EQ(mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0u, MX_SOCKET_RING_DATA_OFFSET + size,
+                              NULL, 0u), ERR_BAD_STATE, "");
+    mx_handle_close(vmo);
+
+    // h0 writes straight into the ring h1 reads from.
+    mx_socket_ring_t* tx = map_ring(h0, MX_SOCKET_RING_TX, size);
+    ASSERT_NONNULL(tx, "");
+    EXPECT_EQ(tx->size, size, "");
+    EXPECT_EQ(tx->head, 0u, "");
+    EXPECT_EQ(tx->tail, 0u, "");
+
+    char* data = (char*)tx + MX_SOCKET_RING_DATA_OFFSET;
+    memcpy(data, "hello", 5);
+    __atomic_store_n(&tx->head, 5u, __ATOMIC_RELEASE);
+
+    // Nothing is signaled until the writer syncs the empty to non-empty transition.
+    EXPECT_EQ(get_satisfied_signals(h1), MX_SOCKET_WRITABLE, "");
+    status = mx_socket_write(h0, MX_SOCKET_RING_SYNC, NULL, 0u, NULL);
+    ASSERT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(get_satisfied_signals(h1), MX_SOCKET_READABLE | MX_SOCKET_WRITABLE, "");
+
+    // The kernel path sees the same ring.
+    char rbuf[8] = {};
+    size_t count;
+    status = mx_socket_read(h1, 0u, rbuf, sizeof(rbuf), &count);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(count, 5u, "");
+    EXPECT_EQ(memcmp(rbuf, "hello", 5), 0, "");
+    EXPECT_EQ(__atomic_load_n(&tx->tail, __ATOMIC_ACQUIRE), 5u, "");
+    EXPECT_EQ(get_satisfied_signals(h1), MX_SOCKET_WRITABLE, "");
+
+    // And the other way around: a syscall write read straight from the ring.
+    mx_socket_ring_t* rx = map_ring(h1, MX_SOCKET_RING_RX, size);
+    ASSERT_NONNULL(rx, "");
+    EXPECT_EQ((uintptr_t)rx->head, 5u, "");
+    status = mx_socket_write(h0, 0u, "abc", 3u, &count);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_EQ(count, 3u, "");
+    EXPECT_EQ(__atomic_load_n(&rx->head, __ATOMIC_ACQUIRE), 8u, "");
+    EXPECT_EQ(memcmp((char*)rx + MX_SOCKET_RING_DATA_OFFSET + 5, "abc", 3), 0, "");
+
+    // Fill the ring by hand; syncing clears the writer's WRITABLE.
+    __atomic_store_n(&tx->head, 4u, __ATOMIC_RELEASE);
+    __atomic_store_n(&tx->tail, 5u, __ATOMIC_RELEASE);
+    status = mx_socket_write(h0, MX_SOCKET_RING_SYNC, NULL, 0u, NULL);
+    ASSERT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(get_satisfied_signals(h0), 0u, "");
+    status = mx_socket_write(h0, 0u, "x", 1u, &count);
+    EXPECT_EQ(status, ERR_SHOULD_WAIT, "");
+
+    // The reader drains it by hand and syncs the full to non-full transition.
+    __atomic_store_n(&rx->tail, 4u, __ATOMIC_RELEASE);
+    status = mx_socket_read(h1, MX_SOCKET_RING_SYNC, NULL, 0u, NULL);
+    ASSERT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(get_satisfied_signals(h0), MX_SOCKET_WRITABLE, "");
+    EXPECT_EQ(get_satisfied_signals(h1), MX_SOCKET_WRITABLE, "");
+
+    mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)tx, MX_SOCKET_RING_DATA_OFFSET + size);
+    mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)rx, MX_SOCKET_RING_DATA_OFFSET + size);
+    mx_handle_close(h0);
+    mx_handle_close(h1);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(socket_tests)
 RUN_TEST(socket_basic)
 RUN_TEST(socket_signals)
@@ -335,6 +463,8 @@ RUN_TEST(socket_half_close)
 RUN_TEST(socket_bytes_outstanding)
 RUN_TEST(socket_bytes_outstanding_half_close)
 RUN_TEST(socket_short_write)
+RUN_TEST(socket_sized)
+RUN_TEST(socket_shared_ring)
 END_TEST_CASE(socket_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -4,6 +4,7 @@
 // found in the LICENSE file.
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include <magenta/syscalls.h>
@@ -13,6 +14,13 @@
 
 static const char kThreadName[] = "test-thread";
 
+#ifdef BUILD_COMBINED_TESTS
+extern mx_handle_t root_resource;
+#else
+// run on its own, the test has no resource to make reservations with
+static const mx_handle_t root_resource = MX_HANDLE_INVALID;
+#endif
+
 static void test_thread_fn(void* arg) {
     // Note: You shouldn't use C standard library functions from this thread.
     mx_nanosleep(MX_MSEC(100));
@@ -157,6 +165,94 @@ static bool test_kill_wait_thread(void) {
     END_TEST;
 }
 
+// Finds how long thread has run, from the task records of the job the test
+// runs in.
+static bool get_thread_runtime(mx_handle_t thread, uint64_t* runtime_ns) {
+    mx_info_handle_basic_t info;
+    ASSERT_EQ(mx_object_get_info(thread, MX_INFO_HANDLE_BASIC, &info, sizeof(info),
+                                 NULL, NULL), NO_ERROR, "");
+
+    size_t actual, avail;
+    ASSERT_EQ(mx_object_get_info(mx_job_default(), MX_INFO_JOB_TASKS, NULL, 0u,
+                                 &actual, &avail), NO_ERROR, "");
+    // leave room for tasks created in the meantime
+    avail += 16u;
+    mx_info_task_record_t* records = malloc(avail * sizeof(*records));
+    ASSERT_NONNULL(records, "");
+    mx_status_t status = mx_object_get_info(mx_job_default(), MX_INFO_JOB_TASKS, records,
+                                            avail * sizeof(*records), &actual, &avail);
+    bool found = false;
+    for (size_t i = 0; status == NO_ERROR && i < actual; i++) {
+        if (records[i].koid == info.koid) {
+            *runtime_ns = records[i].runtime_ns;
+            found = true;
+        }
+    }
+    free(records);
+    ASSERT_EQ(status, NO_ERROR, "");
+    ASSERT_TRUE(found, "no task record for the thread");
+    return true;
+}
+
+static bool test_deadline_thread(void) {
+    BEGIN_TEST;
+
+    if (root_resource == MX_HANDLE_INVALID) {
+        unittest_printf("no root resource handle, skipping\n");
+        END_TEST;
+    }
+
+    mxr_thread_t* thread = NULL;
+    ASSERT_TRUE(start_thread(busy_thread_fn, NULL, &thread), "");
+    mx_handle_t handle = mxr_thread_get_handle(thread);
+
+    // Only a resource holder may make a reservation.
+    EXPECT_EQ(mx_thread_set_deadline(MX_HANDLE_INVALID, handle, MX_MSEC(2), MX_MSEC(10)),
+              ERR_BAD_HANDLE, "");
+    EXPECT_EQ(mx_thread_set_deadline(handle, handle, MX_MSEC(2), MX_MSEC(10)),
+              ERR_WRONG_TYPE, "");
+
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, MX_MSEC(2), MX_USEC(500)),
+              ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, MX_MSEC(20), MX_MSEC(10)),
+              ERR_INVALID_ARGS, "");
+    // Budgets are counted out in milliseconds.
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, MX_USEC(500), MX_MSEC(10)),
+              ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, MX_HANDLE_INVALID, MX_MSEC(2), MX_MSEC(10)),
+              ERR_BAD_HANDLE, "");
+
+    // No cpu can give a thread all of its time.
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, MX_MSEC(10), MX_MSEC(10)),
+              ERR_NO_RESOURCES, "");
+
+    // The busy thread gets its budget in every period, and no more than that
+    // and a millisecond of overrun, over some ten periods.
+    uint64_t before, after;
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, MX_MSEC(2), MX_MSEC(10)),
+              NO_ERROR, "");
+    ASSERT_TRUE(get_thread_runtime(handle, &before), "");
+    mx_nanosleep(MX_MSEC(100));
+    ASSERT_TRUE(get_thread_runtime(handle, &after), "");
+    EXPECT_GE(after - before, MX_MSEC(2) * 9, "thread didn't get its budget");
+    EXPECT_LE(after - before, MX_MSEC(2 + 1) * 11, "thread overran its budget");
+
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, MX_MSEC(1), MX_MSEC(5)),
+              NO_ERROR, "");
+    ASSERT_TRUE(get_thread_runtime(handle, &before), "");
+    mx_nanosleep(MX_MSEC(100));
+    ASSERT_TRUE(get_thread_runtime(handle, &after), "");
+    EXPECT_GE(after - before, MX_MSEC(1) * 19, "thread didn't get its budget");
+    EXPECT_LE(after - before, MX_MSEC(1 + 1) * 21, "thread overran its budget");
+
+    EXPECT_EQ(mx_thread_set_deadline(root_resource, handle, 0u, 0u), NO_ERROR, "");
+
+    ASSERT_EQ(mx_task_kill(handle), NO_ERROR, "");
+    ASSERT_EQ(mxr_thread_join(thread), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(threads_tests)
 RUN_TEST(threads_test)
 RUN_TEST(test_thread_start_on_initial_thread)
@@ -164,6 +260,7 @@ RUN_TEST(test_thread_start_with_zero_instruction_pointer)
 RUN_TEST(test_kill_busy_thread)
 RUN_TEST(test_kill_sleep_thread)
 RUN_TEST(test_kill_wait_thread)
+RUN_TEST(test_deadline_thread)
 END_TEST_CASE(threads_tests)
 
 #ifndef BUILD_COMBINED_TESTS
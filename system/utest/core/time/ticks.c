@@ -4,6 +4,7 @@
 // found in the LICENSE file.
 
 #include <magenta/syscalls.h>
+#include <stdint.h>
 #include <unittest/unittest.h>
 
 // Calculation of elapsed time using ticks.
@@ -23,8 +24,45 @@ static bool elapsed_time_using_ticks(void) {
     END_TEST;
 }
 
+// The monotonic clock may be read in the vDSO, check it agrees with the kernel's.
+static bool monotonic_time_agrees_with_kernel(void) {
+    BEGIN_TEST;
+
+    mx_time_t last = mx_time_get(MX_CLOCK_MONOTONIC);
+    for (int i = 0; i < 1000; i++) {
+        mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+        ASSERT_GE(now, last, "Monotonic time went backwards");
+        last = now;
+    }
+
+    // MX_CLOCK_UTC always comes from the kernel, as its monotonic clock plus an
+    // offset. Bracket each read of it with reads of the monotonic clock: if the
+    // two clocks agree, every bracket allows the same offset, however far apart
+    // the samples are.
+    int64_t offset_min = INT64_MIN;
+    int64_t offset_max = INT64_MAX;
+    for (int i = 0; i < 5; i++) {
+        if (i > 0)
+            ASSERT_EQ(mx_nanosleep(MX_MSEC(20)), NO_ERROR, "");
+        mx_time_t before = mx_time_get(MX_CLOCK_MONOTONIC);
+        mx_time_t utc = mx_time_get(MX_CLOCK_UTC);
+        mx_time_t after = mx_time_get(MX_CLOCK_MONOTONIC);
+        ASSERT_GE(after, before, "Monotonic time went backwards");
+        int64_t low = (int64_t)(utc - after);
+        int64_t high = (int64_t)(utc - before);
+        if (low > offset_min)
+            offset_min = low;
+        if (high < offset_max)
+            offset_max = high;
+        ASSERT_LE(offset_min, offset_max, "Monotonic time disagrees with the kernel's");
+    }
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(ticks_tests)
 RUN_TEST(elapsed_time_using_ticks)
+RUN_TEST(monotonic_time_agrees_with_kernel)
 END_TEST_CASE(ticks_tests)
 
 #ifndef BUILD_COMBINED_TESTS
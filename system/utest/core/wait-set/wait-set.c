@@ -378,6 +378,72 @@ bool wait_set_wait_cancelled_test(void) {
     END_TEST;
 }
 
+bool wait_set_edge_triggered_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ev[2];
+    ASSERT_EQ(mx_event_create(0u, &ev[0]), 0, "mx_event_create() failed");
+    ASSERT_EQ(mx_event_create(0u, &ev[1]), 0, "mx_event_create() failed");
+
+    mx_handle_t ws;
+    ASSERT_EQ(mx_waitset_create(0xf0, &ws), ERR_INVALID_ARGS, "");
+    ASSERT_EQ(mx_waitset_create(MX_WAITSET_EDGE_TRIGGERED, &ws), NO_ERROR, "");
+    ASSERT_GT(ws, 0, "mx_waitset_create() failed");
+
+    // An entry whose signals are already asserted when it's added triggers once.
+    ASSERT_EQ(mx_object_signal(ev[0], 0u, MX_USER_SIGNAL_0), NO_ERROR, "");
+    const uint64_t cookie0 = 1u;
+    EXPECT_EQ(mx_waitset_add(ws, cookie0, ev[0], MX_USER_SIGNAL_0), NO_ERROR, "");
+    const uint64_t cookie1 = 2u;
+    EXPECT_EQ(mx_waitset_add(ws, cookie1, ev[1], MX_USER_SIGNAL_0), NO_ERROR, "");
+
+    mx_waitset_result_t results[5] = {};
+    uint32_t num_results = 5u;
+    ASSERT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_waitset_wait()");
+    EXPECT_TRUE(check_results(num_results, results, cookie0, NO_ERROR, MX_USER_SIGNAL_0), "");
+
+    // The signal is still asserted, but the trigger has been consumed.
+    num_results = 5u;
+    EXPECT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), ERR_TIMED_OUT, "");
+
+    // Asserting an unwatched signal doesn't trigger, a fresh assertion of a watched one does.
+    ASSERT_EQ(mx_object_signal(ev[0], 0u, MX_USER_SIGNAL_1), NO_ERROR, "");
+    num_results = 5u;
+    EXPECT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), ERR_TIMED_OUT, "");
+
+    ASSERT_EQ(mx_object_signal(ev[0], MX_USER_SIGNAL_0, 0u), NO_ERROR, "");
+    ASSERT_EQ(mx_object_signal(ev[0], 0u, MX_USER_SIGNAL_0), NO_ERROR, "");
+    ASSERT_EQ(mx_object_signal(ev[1], 0u, MX_USER_SIGNAL_0), NO_ERROR, "");
+
+    // Asking for fewer results than are triggered leaves the rest for the next wait.
+    num_results = 1u;
+    ASSERT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_waitset_wait()");
+    uint64_t first = results[0].cookie;
+    num_results = 5u;
+    ASSERT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_waitset_wait()");
+    EXPECT_NEQ(results[0].cookie, first, "same entry reported twice");
+
+    num_results = 5u;
+    EXPECT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), ERR_TIMED_OUT, "");
+
+    // Closing a handle is reported once.
+    EXPECT_EQ(mx_handle_close(ev[1]), NO_ERROR, "");
+    num_results = 5u;
+    ASSERT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_waitset_wait()");
+    EXPECT_TRUE(check_results(num_results, results, cookie1, ERR_HANDLE_CLOSED, 0u), "");
+    num_results = 5u;
+    EXPECT_EQ(mx_waitset_wait(ws, 0u, results, &num_results), ERR_TIMED_OUT, "");
+
+    EXPECT_EQ(mx_handle_close(ws), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(ev[0]), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(wait_set_tests)
 RUN_TEST(wait_set_create_test)
 RUN_TEST(wait_set_add_remove_test)
@@ -386,6 +452,7 @@ RUN_TEST(wait_set_wait_single_thread_1_test)
 RUN_TEST(wait_set_wait_single_thread_2_test)
 RUN_TEST(wait_set_wait_threaded_test)
 RUN_TEST(wait_set_wait_cancelled_test)
+RUN_TEST(wait_set_edge_triggered_test)
 END_TEST_CASE(wait_set_tests)
 
 #ifndef BUILD_COMBINED_TESTS
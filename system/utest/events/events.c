@@ -244,6 +244,40 @@ static bool reset_test(void) {
     END_TEST;
 }
 
+static int wait_user_signal_0_fn(void* arg) {
+    mx_handle_t event = *(mx_handle_t*)arg;
+    mx_signals_t observed = 0u;
+    if (mx_handle_wait_one(event, MX_USER_SIGNAL_0, MX_TIME_INFINITE, &observed) != NO_ERROR)
+        return -1;
+    return (int)observed;
+}
+
+// Waiters are only told about changes to the signals they wait for, but still observe the
+// others.
+static bool unwatched_signals_test(void) {
+    BEGIN_TEST;
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "Error during event creation");
+
+    thrd_t threads[4];
+    for (size_t i = 0; i < countof(threads); i++)
+        ASSERT_EQ(thrd_create(&threads[i], wait_user_signal_0_fn, &event), thrd_success, "");
+
+    mx_nanosleep(MX_MSEC(50));
+    ASSERT_EQ(mx_object_signal(event, 0u, MX_USER_SIGNAL_1), NO_ERROR, "");
+    ASSERT_EQ(mx_object_signal(event, 0u, MX_USER_SIGNAL_0), NO_ERROR, "");
+
+    for (size_t i = 0; i < countof(threads); i++) {
+        int observed;
+        ASSERT_EQ(thrd_join(threads[i], &observed), thrd_success, "");
+        EXPECT_EQ((mx_signals_t)observed & (MX_USER_SIGNAL_0 | MX_USER_SIGNAL_1),
+                  MX_USER_SIGNAL_0 | MX_USER_SIGNAL_1, "unwatched signal not observed");
+    }
+
+    ASSERT_EQ(mx_handle_close(event), NO_ERROR, "error during handle close");
+    END_TEST;
+}
+
 static bool wait_many_failures_test(void) {
     BEGIN_TEST;
 
@@ -278,6 +312,7 @@ RUN_TEST(basic_test)
 RUN_TEST(user_signals_test)
 RUN_TEST(wait_signals_test)
 RUN_TEST(reset_test)
+RUN_TEST(unwatched_signals_test)
 RUN_TEST(wait_many_failures_test)
 END_TEST_CASE(event_tests)
 
@@ -17,6 +17,7 @@
 #include <magenta/compiler.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
+#include <magenta/syscalls/debug.h>
 #include <magenta/syscalls/exception.h>
 #include <magenta/syscalls/port.h>
 #include <magenta/threads.h>
@@ -463,6 +464,65 @@ static bool debugger_handler_test(void)
     END_TEST;
 }
 
+static bool snapshot_test(void)
+{
+    BEGIN_TEST;
+    unittest_printf("exception snapshot test\n");
+
+    mx_handle_t child, our_channel;
+    start_test_child(NULL, &child, &our_channel);
+    mx_handle_t eport = tu_io_port_create(0);
+    tu_set_exception_port(child, eport, 0, MX_EXCEPTION_PORT_SNAPSHOT);
+
+    send_msg(our_channel, MSG_CRASH);
+    static mx_exception_snapshot_packet_t packet;
+    ASSERT_EQ(mx_port_wait(eport, MX_TIME_INFINITE, &packet, sizeof(packet)), NO_ERROR,
+              "mx_port_wait failed");
+    const mx_exception_report_t* report = &packet.report;
+    const mx_exception_snapshot_t* snapshot = &packet.snapshot;
+    EXPECT_EQ(report->header.type, (uint32_t)MX_EXCP_FATAL_PAGE_FAULT, "bad exception type");
+    ASSERT_EQ(report->header.size, sizeof(*report) + sizeof(*snapshot), "no snapshot");
+    ASSERT_EQ(snapshot->flags & MX_EXCEPTION_SNAPSHOT_REGS, MX_EXCEPTION_SNAPSHOT_REGS,
+              "no registers in snapshot");
+    EXPECT_GT(snapshot->stack_size, 0u, "no stack in snapshot");
+
+    // The snapshot should match what we'd have read from the thread.
+    mx_handle_t thread;
+    ASSERT_EQ(mx_object_get_child(child, report->context.tid, MX_RIGHT_SAME_RIGHTS, &thread),
+              NO_ERROR, "mx_object_get_child failed");
+#if defined(__x86_64__)
+    mx_x86_64_general_regs_t regs;
+    uint32_t regs_size;
+    ASSERT_EQ(mx_thread_read_state(thread, MX_THREAD_STATE_REGSET0, &regs, sizeof(regs),
+                                   &regs_size), NO_ERROR, "mx_thread_read_state failed");
+    EXPECT_EQ(memcmp(&regs, &snapshot->regs.x86_64, sizeof(regs)), 0, "registers differ");
+    EXPECT_EQ(snapshot->stack_addr, regs.rsp, "stack address isn't the stack pointer");
+    EXPECT_EQ(report->context.arch.pc, regs.rip, "pc differs");
+#elif defined(__aarch64__)
+    mx_aarch64_general_regs_t regs;
+    uint32_t regs_size;
+    ASSERT_EQ(mx_thread_read_state(thread, MX_THREAD_STATE_REGSET0, &regs, sizeof(regs),
+                                   &regs_size), NO_ERROR, "mx_thread_read_state failed");
+    EXPECT_EQ(memcmp(&regs, &snapshot->regs.arm_64, sizeof(regs)), 0, "registers differ");
+    EXPECT_EQ(snapshot->stack_addr, regs.sp, "stack address isn't the stack pointer");
+#endif
+
+    uint8_t stack[64];
+    size_t stack_read;
+    ASSERT_EQ(mx_process_read_memory(child, snapshot->stack_addr, stack, sizeof(stack),
+                                     &stack_read), NO_ERROR, "mx_process_read_memory failed");
+    EXPECT_EQ(memcmp(stack, snapshot->stack, stack_read), 0, "stack differs");
+
+    tu_handle_close(thread);
+    resume_thread_from_exception(child, report->context.tid, MX_RESUME_NOT_HANDLED);
+    tu_process_wait_signaled(child);
+
+    tu_handle_close(child);
+    tu_handle_close(eport);
+    tu_handle_close(our_channel);
+    END_TEST;
+}
+
 static bool process_start_test(void)
 {
     BEGIN_TEST;
@@ -676,6 +736,7 @@ RUN_TEST(process_set_close_set_test);
 RUN_TEST(thread_set_close_set_test);
 RUN_TEST(process_handler_test);
 RUN_TEST(thread_handler_test);
+RUN_TEST(snapshot_test);
 RUN_TEST(process_start_test);
 RUN_TEST(process_gone_notification_test);
 RUN_TEST(thread_gone_notification_test);
@@ -0,0 +1,203 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests of the limits jobs place on their processes. Limits are checked
+// against the job of the calling process, and VMOs are charged to the job of
+// the process that creates them, so the tests run a copy of this program in
+// a child job.
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <launchpad/launchpad.h>
+#include <magenta/compiler.h>
+#include <magenta/processargs.h>
+#include <magenta/syscalls.h>
+#include <mxio/util.h>
+#include <test-utils/test-utils.h>
+#include <unittest/unittest.h>
+
+// argv[0]
+static char* program_path;
+
+static const char test_child_name[] = "test-child";
+static const char cpu_child_name[] = "cpu-child";
+
+// The limits the child runs under. Whatever the child commits starting up
+// must fit well under the soft limit.
+#define SOFT_LIMIT (1024u * 1024u)
+#define HARD_LIMIT (2u * SOFT_LIMIT)
+#define VMO_SIZE (2u * HARD_LIMIT)
+
+// The cpu limits the cpu child runs under.
+#define CPU_WEIGHT 50u
+#define CPU_PERIOD MX_MSEC(10)
+#define CPU_QUOTA MX_MSEC(5)
+
+// The child's return codes, one for each check it fails.
+enum {
+    CHILD_OK,
+    CHILD_NO_EVENT,
+    CHILD_CLEAR_ALLOWED,
+    CHILD_RAISE_ALLOWED,
+    CHILD_TIGHTEN_DENIED,
+    CHILD_VMO_CREATE_FAILED,
+    CHILD_WRONG_ERROR,
+    CHILD_COMMITTED_TOO_FEW,
+    CHILD_COMMITTED_TOO_MANY,
+    CHILD_WAIT_FAILED,
+    CHILD_WEIGHT_RAISED,
+    CHILD_CAP_REMOVED,
+    CHILD_QUOTA_RAISED,
+    CHILD_PERIOD_SHORTENED,
+    CHILD_CPU_TIGHTEN_DENIED,
+};
+
+// Runs in the job whose limits are under test. Commits pages until the hard
+// limit refuses one, then holds on to them until the parent has seen the
+// job's signals.
+static int test_child(void) {
+    mx_handle_t event = mxio_get_startup_handle(MX_HND_TYPE_USER0);
+    if (event == MX_HANDLE_INVALID)
+        return CHILD_NO_EVENT;
+
+    // From inside the job, the limits may be tightened but not loosened.
+    mx_handle_t job = mx_job_default();
+    if (mx_job_set_memory_limits(job, 0u, 0u) != ERR_ACCESS_DENIED)
+        return CHILD_CLEAR_ALLOWED;
+    if (mx_job_set_memory_limits(job, SOFT_LIMIT, 2u * HARD_LIMIT) != ERR_ACCESS_DENIED)
+        return CHILD_RAISE_ALLOWED;
+    if (mx_job_set_memory_limits(job, SOFT_LIMIT, HARD_LIMIT) != NO_ERROR)
+        return CHILD_TIGHTEN_DENIED;
+
+    mx_handle_t vmo;
+    if (mx_vmo_create(VMO_SIZE, 0u, &vmo) != NO_ERROR)
+        return CHILD_VMO_CREATE_FAILED;
+
+    uint64_t offset = 0u;
+    mx_status_t status;
+    while ((status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, offset, PAGE_SIZE,
+                                     NULL, 0u)) == NO_ERROR)
+        offset += PAGE_SIZE;
+    if (status != ERR_NO_MEMORY)
+        return CHILD_WRONG_ERROR;
+    if (offset <= HARD_LIMIT - SOFT_LIMIT)
+        return CHILD_COMMITTED_TOO_FEW;
+    if (offset > HARD_LIMIT)
+        return CHILD_COMMITTED_TOO_MANY;
+
+    if (mx_handle_wait_one(event, MX_EVENT_SIGNALED, MX_TIME_INFINITE, NULL) != NO_ERROR)
+        return CHILD_WAIT_FAILED;
+    return CHILD_OK;
+}
+
+// Runs in the job whose cpu limits are under test, and tries to loosen them.
+static int cpu_child(void) {
+    mx_handle_t job = mx_job_default();
+    if (mx_job_set_cpu_limits(job, 2u * CPU_WEIGHT, CPU_PERIOD, CPU_QUOTA) != ERR_ACCESS_DENIED)
+        return CHILD_WEIGHT_RAISED;
+    if (mx_job_set_cpu_limits(job, CPU_WEIGHT, 0u, 0u) != ERR_ACCESS_DENIED)
+        return CHILD_CAP_REMOVED;
+    if (mx_job_set_cpu_limits(job, CPU_WEIGHT, CPU_PERIOD, 2u * CPU_QUOTA) != ERR_ACCESS_DENIED)
+        return CHILD_QUOTA_RAISED;
+    if (mx_job_set_cpu_limits(job, CPU_WEIGHT, CPU_PERIOD / 2u, CPU_QUOTA) != ERR_ACCESS_DENIED)
+        return CHILD_PERIOD_SHORTENED;
+    if (mx_job_set_cpu_limits(job, CPU_WEIGHT / 2u, 2u * CPU_PERIOD, CPU_QUOTA) != NO_ERROR)
+        return CHILD_CPU_TIGHTEN_DENIED;
+    return CHILD_OK;
+}
+
+// Starts this program in |job| as |child_name|, passing it |handle| if it's
+// valid.
+static mx_handle_t launch_child(mx_handle_t job, const char* child_name, mx_handle_t handle) {
+    const char* argv[] = { program_path, child_name };
+    launchpad_t* lp;
+    launchpad_create(job, child_name, &lp);
+    launchpad_load_from_file(lp, program_path);
+    launchpad_clone(lp, LP_CLONE_MXIO_ALL | LP_CLONE_ENVIRON);
+    launchpad_set_args(lp, countof(argv), argv);
+    if (handle != MX_HANDLE_INVALID)
+        launchpad_add_handle(lp, handle, MX_HND_TYPE_USER0);
+    mx_handle_t process;
+    const char* errmsg;
+    if (launchpad_go(lp, &process, &errmsg) != NO_ERROR) {
+        unittest_printf("launchpad_go failed: %s\n", errmsg);
+        return MX_HANDLE_INVALID;
+    }
+    return process;
+}
+
+static bool memory_limits_commit_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t job;
+    ASSERT_EQ(mx_job_create(mx_job_default(), 0u, &job), NO_ERROR, "");
+    ASSERT_EQ(mx_job_set_memory_limits(job, SOFT_LIMIT, HARD_LIMIT), NO_ERROR, "");
+
+    mx_handle_t event, child_event;
+    ASSERT_EQ(mx_event_create(0u, &event), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_duplicate(event, MX_RIGHT_SAME_RIGHTS, &child_event), NO_ERROR, "");
+
+    mx_handle_t process = launch_child(job, test_child_name, child_event);
+    ASSERT_NEQ(process, MX_HANDLE_INVALID, "");
+
+    // Once the child is refused a page, the job is past both limits.
+    mx_signals_t signals = 0u;
+    EXPECT_EQ(mx_handle_wait_one(job, MX_JOB_MEMORY_HARD_LIMIT,
+                                 MX_SEC(10), &signals), NO_ERROR, "");
+    EXPECT_EQ(signals & (MX_JOB_MEMORY_SOFT_LIMIT | MX_JOB_MEMORY_HARD_LIMIT),
+              MX_JOB_MEMORY_SOFT_LIMIT | MX_JOB_MEMORY_HARD_LIMIT, "");
+
+    ASSERT_EQ(mx_object_signal(event, 0u, MX_EVENT_SIGNALED), NO_ERROR, "");
+    tu_process_wait_signaled(process);
+    EXPECT_EQ(tu_process_get_return_code(process), CHILD_OK, "child check failed");
+
+    // From outside the job, the limits may be lifted.
+    EXPECT_EQ(mx_job_set_memory_limits(job, 0u, 0u), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(process), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(event), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(job), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool cpu_limits_tighten_only_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t job;
+    ASSERT_EQ(mx_job_create(mx_job_default(), 0u, &job), NO_ERROR, "");
+    ASSERT_EQ(mx_job_set_cpu_limits(job, CPU_WEIGHT, CPU_PERIOD, CPU_QUOTA), NO_ERROR, "");
+
+    mx_handle_t process = launch_child(job, cpu_child_name, MX_HANDLE_INVALID);
+    ASSERT_NEQ(process, MX_HANDLE_INVALID, "");
+    tu_process_wait_signaled(process);
+    EXPECT_EQ(tu_process_get_return_code(process), CHILD_OK, "child check failed");
+
+    // From outside the job, the cap may be lifted.
+    EXPECT_EQ(mx_job_set_cpu_limits(job, 100u, 0u, 0u), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(process), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(job), NO_ERROR, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(job_limits_tests)
+RUN_TEST(memory_limits_commit_test)
+RUN_TEST(cpu_limits_tighten_only_test)
+END_TEST_CASE(job_limits_tests)
+
+int main(int argc, char** argv) {
+    program_path = argv[0];
+
+    if (argc >= 2 && strcmp(argv[1], test_child_name) == 0)
+        return test_child();
+    if (argc >= 2 && strcmp(argv[1], cpu_child_name) == 0)
+        return cpu_child();
+
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -17,6 +17,8 @@
 
 #include <mxio/util.h>
 
+#include <string.h>
+
 #include <unittest/unittest.h>
 
 // argv[0]
@@ -26,6 +28,10 @@ static const char dynld_path[] = "/boot/lib/ld.so.1";
 
 static const char test_inferior_child_name[] = "inferior";
 
+// Passed as argv[1] to run this program as the child of template_test.
+static const char test_template_child_arg[] = "template-child";
+static const int test_template_child_exit = 17;
+
 static bool launchpad_test(void)
 {
     BEGIN_TEST;
@@ -68,14 +74,75 @@ static bool launchpad_test(void)
     END_TEST;
 }
 
+static bool template_test(void)
+{
+    BEGIN_TEST;
+
+    launchpad_template_t* tmpl = NULL;
+    mx_status_t status = launchpad_template_create_from_file(program_path, &tmpl);
+    ASSERT_EQ(status, NO_ERROR, "launchpad_template_create_from_file");
+
+    mx_handle_t dynld_vmo = launchpad_vmo_from_file(dynld_path);
+    ASSERT_GT(dynld_vmo, 0, "launchpad_vmo_from_file");
+    elf_load_header_t header;
+    uintptr_t phoff;
+    status = elf_load_prepare(dynld_vmo, &header, &phoff);
+    ASSERT_EQ(status, NO_ERROR, "elf_load_prepare");
+    mx_handle_close(dynld_vmo);
+
+    // Stamp out a few processes from the one template and run them.
+    for (int i = 0; i < 3; ++i) {
+        launchpad_t* lp = NULL;
+        status = launchpad_create(MX_HANDLE_INVALID, test_inferior_child_name, &lp);
+        ASSERT_EQ(status, NO_ERROR, "launchpad_create");
+
+        status = launchpad_load_from_template(lp, tmpl);
+        ASSERT_EQ(status, NO_ERROR, "launchpad_load_from_template");
+
+        // The dynamic linker is what gets loaded, as with launchpad_elf_load.
+        mx_vaddr_t base, entry;
+        status = launchpad_get_base_address(lp, &base);
+        ASSERT_EQ(status, NO_ERROR, "launchpad_get_base_address");
+        status = launchpad_get_entry_address(lp, &entry);
+        ASSERT_EQ(status, NO_ERROR, "launchpad_get_entry_address");
+        ASSERT_EQ(entry, base + header.e_entry, "bad value for base or entry");
+
+        const char* argv[] = { program_path, test_template_child_arg };
+        status = launchpad_set_args(lp, countof(argv), argv);
+        ASSERT_EQ(status, NO_ERROR, "launchpad_set_args");
+
+        mx_handle_t proc;
+        const char* errmsg;
+        status = launchpad_go(lp, &proc, &errmsg);
+        ASSERT_EQ(status, NO_ERROR, errmsg);
+
+        mx_signals_t signals;
+        status = mx_handle_wait_one(proc, MX_TASK_TERMINATED, MX_TIME_INFINITE, &signals);
+        ASSERT_EQ(status, NO_ERROR, "mx_handle_wait_one");
+        mx_info_process_t info;
+        status = mx_object_get_info(proc, MX_INFO_PROCESS, &info, sizeof(info), NULL, NULL);
+        ASSERT_EQ(status, NO_ERROR, "mx_object_get_info");
+        EXPECT_EQ(info.return_code, test_template_child_exit, "child exit code");
+        mx_handle_close(proc);
+    }
+
+    launchpad_template_destroy(tmpl);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(launchpad_tests)
 RUN_TEST(launchpad_test);
+RUN_TEST(template_test);
 END_TEST_CASE(launchpad_tests)
 
 int main(int argc, char **argv)
 {
     program_path = argv[0];
 
+    if (argc >= 2 && strcmp(argv[1], test_template_child_arg) == 0)
+        return test_template_child_exit;
+
     bool success = unittest_run_all_tests(argc, argv);
 
     return success ? 0 : -1;
@@ -0,0 +1,185 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unittest/unittest.h>
+
+static const size_t sizes[] = {
+    0, 1, 15, 16, 17, 100, 256, 257, 1000, 4096, 10000, 32768, 32769, 100000, 1 << 20,
+};
+
+static bool sizes_test(void) {
+    BEGIN_TEST;
+
+    for (size_t i = 0; i < countof(sizes); i++) {
+        size_t n = sizes[i];
+        uint8_t* p = malloc(n);
+        ASSERT_NONNULL(p, "malloc failed");
+        EXPECT_EQ((uintptr_t)p % 16, 0u, "malloc result not 16 byte aligned");
+        EXPECT_GE(malloc_usable_size(p), n, "usable size too small");
+        memset(p, 0xa5, n);
+        free(p);
+    }
+
+    END_TEST;
+}
+
+static bool calloc_test(void) {
+    BEGIN_TEST;
+
+    // dirty some memory of each size first, so calloc has it to reuse
+    for (size_t i = 0; i < countof(sizes); i++) {
+        void* p = malloc(sizes[i]);
+        ASSERT_NONNULL(p, "malloc failed");
+        memset(p, 0xa5, sizes[i]);
+        free(p);
+    }
+    for (size_t i = 0; i < countof(sizes); i++) {
+        uint8_t* p = calloc(1, sizes[i]);
+        ASSERT_NONNULL(p, "calloc failed");
+        for (size_t j = 0; j < sizes[i]; j++) {
+            if (p[j] != 0) {
+                EXPECT_EQ(p[j], 0, "calloc memory not zeroed");
+                break;
+            }
+        }
+        free(p);
+    }
+
+    END_TEST;
+}
+
+static bool realloc_test(void) {
+    BEGIN_TEST;
+
+    uint8_t* p = NULL;
+    size_t prev = 0;
+    for (size_t n = 1; n <= (1 << 20); n *= 3) {
+        p = realloc(p, n);
+        ASSERT_NONNULL(p, "realloc failed");
+        for (size_t j = 0; j < prev; j++) {
+            if (p[j] != (uint8_t)j) {
+                EXPECT_EQ(p[j], (uint8_t)j, "realloc lost contents");
+                break;
+            }
+        }
+        for (size_t j = prev; j < n; j++)
+            p[j] = (uint8_t)j;
+        prev = n;
+    }
+    // and shrinking
+    p = realloc(p, 10);
+    ASSERT_NONNULL(p, "realloc failed");
+    for (size_t j = 0; j < 10; j++)
+        EXPECT_EQ(p[j], (uint8_t)j, "realloc lost contents");
+    free(p);
+
+    END_TEST;
+}
+
+static bool memalign_test(void) {
+    BEGIN_TEST;
+
+    for (size_t align = 8; align <= (1 << 16); align *= 2) {
+        for (size_t i = 0; i < countof(sizes); i++) {
+            void* p = NULL;
+            ASSERT_EQ(posix_memalign(&p, align, sizes[i]), 0, "posix_memalign failed");
+            EXPECT_EQ((uintptr_t)p % align, 0u, "posix_memalign result misaligned");
+            EXPECT_GE(malloc_usable_size(p), sizes[i], "usable size too small");
+            memset(p, 0xa5, sizes[i]);
+            free(p);
+        }
+    }
+
+    END_TEST;
+}
+
+#define NUM_THREADS 8
+#define NUM_LIVE 256
+#define NUM_ROUNDS 20000
+
+static int churn_thread(void* arg) {
+    uintptr_t seed = (uintptr_t)arg;
+    uint8_t* live[NUM_LIVE] = {};
+    size_t len[NUM_LIVE] = {};
+
+    for (int i = 0; i < NUM_ROUNDS; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t slot = (seed >> 8) % NUM_LIVE;
+        if (live[slot]) {
+            // check nothing else wrote over it
+            for (size_t j = 0; j < len[slot]; j++) {
+                if (live[slot][j] != (uint8_t)(slot + len[slot]))
+                    return -1;
+            }
+            free(live[slot]);
+        }
+        len[slot] = (seed >> 16) % ((seed & 1) ? 64 : 4096);
+        live[slot] = malloc(len[slot]);
+        if (!live[slot])
+            return -1;
+        memset(live[slot], (uint8_t)(slot + len[slot]), len[slot]);
+    }
+    for (size_t slot = 0; slot < NUM_LIVE; slot++)
+        free(live[slot]);
+    return 0;
+}
+
+static bool threads_test(void) {
+    BEGIN_TEST;
+
+    thrd_t threads[NUM_THREADS];
+    for (uintptr_t i = 0; i < NUM_THREADS; i++) {
+        ASSERT_EQ(thrd_create(&threads[i], churn_thread, (void*)(i + 1)), thrd_success, "");
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int ret;
+        ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+        EXPECT_EQ(ret, 0, "heap corrupted");
+    }
+
+    END_TEST;
+}
+
+// Memory malloced on one thread and freed on another.
+static void* passed[NUM_LIVE];
+
+static int free_thread(void* arg) {
+    for (size_t i = 0; i < NUM_LIVE; i++)
+        free(passed[i]);
+    return 0;
+}
+
+static bool cross_thread_free_test(void) {
+    BEGIN_TEST;
+
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < NUM_LIVE; i++) {
+            passed[i] = malloc(i * 8);
+            ASSERT_NONNULL(passed[i], "malloc failed");
+        }
+        thrd_t t;
+        ASSERT_EQ(thrd_create(&t, free_thread, NULL), thrd_success, "");
+        ASSERT_EQ(thrd_join(t, NULL), thrd_success, "");
+    }
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(malloc_tests)
+RUN_TEST(sizes_test)
+RUN_TEST(calloc_test)
+RUN_TEST(realloc_test)
+RUN_TEST(memalign_test)
+RUN_TEST(threads_test)
+RUN_TEST(cross_thread_free_test)
+END_TEST_CASE(malloc_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
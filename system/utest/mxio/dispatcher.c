@@ -0,0 +1,111 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/dispatcher.h>
+#include <unittest/unittest.h>
+
+#define NUM_CHANNELS 8
+#define NUM_MESSAGES 200
+#define NUM_THREADS 4
+
+typedef struct {
+    atomic_int running;
+    uint32_t next;
+    bool out_of_order;
+    bool overlapped;
+    atomic_bool closed;
+} channel_state_t;
+
+static channel_state_t channels[NUM_CHANNELS];
+static atomic_int messages_seen;
+static atomic_int max_running;
+static atomic_int running;
+
+static mx_status_t dispatch_cb(mx_handle_t h, void* cb, void* cookie) {
+    channel_state_t* state = cookie;
+    if (h == 0) {
+        atomic_store(&state->closed, true);
+        return NO_ERROR;
+    }
+    if (atomic_fetch_add(&state->running, 1) != 0)
+        state->overlapped = true;
+    int now = atomic_fetch_add(&running, 1) + 1;
+    int max = atomic_load(&max_running);
+    while (now > max && !atomic_compare_exchange_weak(&max_running, &max, now))
+        ;
+
+    uint32_t seq;
+    uint32_t actual;
+    mx_status_t r = mx_channel_read(h, 0, &seq, sizeof(seq), &actual, NULL, 0, NULL);
+    if (r == NO_ERROR) {
+        if (seq != state->next)
+            state->out_of_order = true;
+        state->next = seq + 1;
+        // give the other threads a chance to pick up other channels
+        mx_nanosleep(MX_USEC(10));
+        atomic_fetch_add(&messages_seen, 1);
+    }
+
+    atomic_fetch_sub(&running, 1);
+    atomic_fetch_sub(&state->running, 1);
+    return r == NO_ERROR ? NO_ERROR : ERR_DISPATCHER_NO_WORK;
+}
+
+static bool dispatcher_threads_test(void) {
+    BEGIN_TEST;
+
+    mxio_dispatcher_t* md;
+    ASSERT_EQ(mxio_dispatcher_create(&md, dispatch_cb), NO_ERROR, "");
+
+    mx_handle_t peers[NUM_CHANNELS];
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        mx_handle_t h;
+        ASSERT_EQ(mx_channel_create(0, &h, &peers[i]), NO_ERROR, "");
+        ASSERT_EQ(mxio_dispatcher_add(md, h, NULL, &channels[i]), NO_ERROR, "");
+    }
+    ASSERT_EQ(mxio_dispatcher_start_threads(md, "dispatcher-test", NUM_THREADS), NO_ERROR, "");
+    EXPECT_EQ(mxio_dispatcher_start(md, "dispatcher-test"), ERR_BAD_STATE,
+              "dispatcher started twice");
+
+    for (uint32_t seq = 0; seq < NUM_MESSAGES; seq++) {
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            ASSERT_EQ(mx_channel_write(peers[i], 0, &seq, sizeof(seq), NULL, 0), NO_ERROR, "");
+        }
+    }
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        mx_handle_close(peers[i]);
+    }
+
+    // Wait for every channel to be drained and then closed.
+    for (int tries = 0; tries < 10000; tries++) {
+        bool done = atomic_load(&messages_seen) == NUM_CHANNELS * NUM_MESSAGES;
+        for (int i = 0; done && i < NUM_CHANNELS; i++) {
+            done = atomic_load(&channels[i].closed);
+        }
+        if (done)
+            break;
+        mx_nanosleep(MX_MSEC(1));
+    }
+
+    EXPECT_EQ(atomic_load(&messages_seen), NUM_CHANNELS * NUM_MESSAGES, "messages lost");
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        EXPECT_TRUE(atomic_load(&channels[i].closed), "no close callback");
+        EXPECT_EQ(channels[i].next, (uint32_t)NUM_MESSAGES, "");
+        EXPECT_FALSE(channels[i].out_of_order, "messages handled out of order");
+        EXPECT_FALSE(channels[i].overlapped, "handler called on two threads at once");
+    }
+    unittest_printf("at most %d handlers ran at once\n", atomic_load(&max_running));
+    EXPECT_LE(atomic_load(&max_running), NUM_THREADS, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(dispatcher_tests)
+RUN_TEST(dispatcher_threads_test);
+END_TEST_CASE(dispatcher_tests)
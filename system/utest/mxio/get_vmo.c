@@ -0,0 +1,128 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/io.h>
+#include <unittest/unittest.h>
+
+#define FILE_SIZE (5 * PAGE_SIZE + 321)
+
+static const char test_path[] = "/tmp/get-vmo-test";
+
+// The VMO for a memfs file holds its data and cannot be written through.
+static bool memfs_get_vmo_test(void) {
+    BEGIN_TEST;
+    uint8_t* buf = malloc(FILE_SIZE);
+    uint8_t* out = malloc(FILE_SIZE);
+    ASSERT_NONNULL(buf, "");
+    ASSERT_NONNULL(out, "");
+    for (size_t i = 0; i < FILE_SIZE; i++)
+        buf[i] = (uint8_t)(i * 13);
+
+    int fd = open(test_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0, "cannot create test file");
+    ASSERT_EQ(write(fd, buf, FILE_SIZE), FILE_SIZE, "");
+
+    mx_handle_t vmo;
+    size_t off, len;
+    ASSERT_EQ(mxio_get_vmo(fd, &vmo, &off, &len), NO_ERROR, "");
+    EXPECT_EQ(off, 0u, "");
+    ASSERT_EQ(len, (size_t)FILE_SIZE, "");
+
+    size_t actual;
+    ASSERT_EQ(mx_vmo_read(vmo, out, off, len, &actual), NO_ERROR, "");
+    ASSERT_EQ(actual, len, "");
+    EXPECT_EQ(memcmp(buf, out, FILE_SIZE), 0, "wrong data in vmo");
+
+    uint8_t byte = 0xff;
+    EXPECT_EQ(mx_vmo_write(vmo, &byte, 0, 1, &actual), ERR_ACCESS_DENIED,
+              "vmo should be read-only");
+
+    mx_handle_close(vmo);
+    close(fd);
+
+    fd = open(test_path, O_WRONLY);
+    ASSERT_GE(fd, 0, "");
+    EXPECT_EQ(mxio_get_vmo(fd, &vmo, &off, &len), ERR_ACCESS_DENIED,
+              "write-only files should not hand out their data");
+    close(fd);
+
+    unlink(test_path);
+    free(buf);
+    free(out);
+    END_TEST;
+}
+
+// Files without a VMO behind them say so.
+static bool unsupported_get_vmo_test(void) {
+    BEGIN_TEST;
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0, "");
+    mx_handle_t vmo;
+    size_t off, len;
+    EXPECT_EQ(mxio_get_vmo(fds[0], &vmo, &off, &len), ERR_NOT_SUPPORTED, "");
+    close(fds[0]);
+    close(fds[1]);
+
+    int fd = open("/tmp", O_RDONLY | O_DIRECTORY);
+    ASSERT_GE(fd, 0, "");
+    EXPECT_EQ(mxio_get_vmo(fd, &vmo, &off, &len), ERR_NOT_SUPPORTED, "");
+    close(fd);
+    END_TEST;
+}
+
+// mmap() of a file maps the VMO behind it where it can, and copies otherwise.
+static bool mmap_file_test(void) {
+    BEGIN_TEST;
+    uint8_t* buf = malloc(FILE_SIZE);
+    ASSERT_NONNULL(buf, "");
+    for (size_t i = 0; i < FILE_SIZE; i++)
+        buf[i] = (uint8_t)(i * 7);
+
+    int fd = open(test_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0, "cannot create test file");
+    ASSERT_EQ(write(fd, buf, FILE_SIZE), FILE_SIZE, "");
+
+    uint8_t* map = mmap(NULL, FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NEQ(map, MAP_FAILED, "read-only shared mmap failed");
+    EXPECT_EQ(memcmp(map, buf, FILE_SIZE), 0, "wrong data in shared mapping");
+    EXPECT_EQ(munmap(map, FILE_SIZE), 0, "");
+
+    map = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_PRIVATE, fd, 2 * PAGE_SIZE);
+    ASSERT_NEQ(map, MAP_FAILED, "mmap at an offset failed");
+    EXPECT_EQ(memcmp(map, buf + 2 * PAGE_SIZE, PAGE_SIZE), 0, "wrong data at offset");
+    EXPECT_EQ(munmap(map, PAGE_SIZE), 0, "");
+
+    // private writes stay private
+    map = mmap(NULL, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ASSERT_NEQ(map, MAP_FAILED, "writable private mmap failed");
+    EXPECT_EQ(memcmp(map, buf, FILE_SIZE), 0, "wrong data in private mapping");
+    map[0] = (uint8_t)~buf[0];
+    uint8_t byte;
+    ASSERT_EQ(pread(fd, &byte, 1, 0), 1, "");
+    EXPECT_EQ(byte, buf[0], "private mapping wrote through to the file");
+    EXPECT_EQ(munmap(map, FILE_SIZE), 0, "");
+
+    EXPECT_EQ(mmap(NULL, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0), MAP_FAILED,
+              "shared writable mappings are not supported");
+
+    close(fd);
+    unlink(test_path);
+    free(buf);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(get_vmo_tests)
+RUN_TEST(memfs_get_vmo_test);
+RUN_TEST(unsupported_get_vmo_test);
+RUN_TEST(mmap_file_test);
+END_TEST_CASE(get_vmo_tests)
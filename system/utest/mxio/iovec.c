@@ -0,0 +1,112 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <mxio/io.h>
+#include <unittest/unittest.h>
+
+// a few small elements, then one bigger than a chunk, then a small one
+#define BIG_SIZE (MXIO_CHUNK_SIZE + 100)
+
+static const char file_path[] = "/tmp/iovec-test";
+
+static uint8_t* make_data(size_t len) {
+    uint8_t* data = malloc(len);
+    if (data != NULL) {
+        for (size_t i = 0; i < len; i++)
+            data[i] = (uint8_t)(i * 13);
+    }
+    return data;
+}
+
+static void fill_iov(struct iovec* iov, uint8_t* base) {
+    static const size_t sizes[] = {5, 0, 11, 3, BIG_SIZE, 7};
+    for (size_t i = 0; i < 6; i++) {
+        iov[i].iov_base = base;
+        iov[i].iov_len = sizes[i];
+        base += sizes[i];
+    }
+}
+
+#define IOV_TOTAL (5 + 11 + 3 + BIG_SIZE + 7)
+
+static bool iovec_file_test(void) {
+    BEGIN_TEST;
+    uint8_t* data = make_data(IOV_TOTAL);
+    uint8_t* buf = calloc(1, IOV_TOTAL);
+    ASSERT_NONNULL(data, "");
+    ASSERT_NONNULL(buf, "");
+    struct iovec iov[6];
+
+    int fd = open(file_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0, "");
+    fill_iov(iov, data);
+    EXPECT_EQ(writev(fd, iov, 6), IOV_TOTAL, "");
+    EXPECT_EQ(lseek(fd, 0, SEEK_CUR), IOV_TOTAL, "file position not advanced");
+
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0, "");
+    fill_iov(iov, buf);
+    EXPECT_EQ(readv(fd, iov, 6), IOV_TOTAL, "");
+    EXPECT_EQ(memcmp(buf, data, IOV_TOTAL), 0, "wrong data read");
+
+    // short at the end of the file
+    ASSERT_EQ(lseek(fd, IOV_TOTAL - 10, SEEK_SET), IOV_TOTAL - 10, "");
+    EXPECT_EQ(readv(fd, iov, 6), 10, "");
+    EXPECT_EQ(memcmp(buf, data + IOV_TOTAL - 10, 10), 0, "wrong data read");
+
+    close(fd);
+    unlink(file_path);
+    free(buf);
+    free(data);
+    END_TEST;
+}
+
+static bool iovec_pipe_test(void) {
+    BEGIN_TEST;
+    uint8_t* data = make_data(IOV_TOTAL);
+    uint8_t* buf = calloc(1, IOV_TOTAL);
+    ASSERT_NONNULL(data, "");
+    ASSERT_NONNULL(buf, "");
+    struct iovec iov[6];
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0, "");
+    fill_iov(iov, data);
+    EXPECT_EQ(writev(fds[1], iov, 6), IOV_TOTAL, "");
+
+    // whatever comes out at a time, it all comes out in order
+    size_t got = 0;
+    while (got < IOV_TOTAL) {
+        struct iovec rd[2] = {
+            {.iov_base = buf + got, .iov_len = 1},
+            {.iov_base = buf + got + 1, .iov_len = IOV_TOTAL - got - 1},
+        };
+        ssize_t r = readv(fds[0], rd, 2);
+        ASSERT_GT(r, 0, "");
+        got += r;
+    }
+    EXPECT_EQ(memcmp(buf, data, IOV_TOTAL), 0, "wrong data read");
+
+    // nothing to read doesn't block a nonblocking reader
+    ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0, "");
+    struct iovec one = {.iov_base = buf, .iov_len = 1};
+    EXPECT_EQ(readv(fds[0], &one, 1), -1, "");
+
+    close(fds[0]);
+    close(fds[1]);
+    free(buf);
+    free(data);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(iovec_tests)
+RUN_TEST(iovec_file_test);
+RUN_TEST(iovec_pipe_test);
+END_TEST_CASE(iovec_tests)
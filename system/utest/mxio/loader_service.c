@@ -0,0 +1,70 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <magenta/processargs.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <mxio/util.h>
+#include <unittest/unittest.h>
+
+static mx_handle_t load_object(mx_handle_t svc, const char* name) {
+    struct {
+        mx_loader_svc_msg_t header;
+        char data[64];
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.opcode = LOADER_SVC_OP_LOAD_OBJECT;
+    strncpy(msg.data, name, sizeof(msg.data) - 1);
+
+    mx_handle_t handle = MX_HANDLE_INVALID;
+    mx_channel_call_args_t call = {
+        .wr_bytes = &msg,
+        .wr_num_bytes = sizeof(msg.header) + strlen(msg.data) + 1,
+        .rd_bytes = &msg,
+        .rd_num_bytes = sizeof(msg),
+        .rd_handles = &handle,
+        .rd_num_handles = 1,
+    };
+    uint32_t actual_bytes, actual_handles;
+    mx_status_t read_status;
+    mx_status_t status = mx_channel_call(svc, 0, MX_TIME_INFINITE, &call,
+                                         &actual_bytes, &actual_handles, &read_status);
+    if (status < 0)
+        return status;
+    return (msg.header.arg < 0) ? msg.header.arg : handle;
+}
+
+static bool cached_vmo_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t svc = mxio_loader_service(NULL, NULL);
+    ASSERT_GT(svc, 0, "could not start loader service");
+
+    mx_handle_t vmo1 = load_object(svc, "libc.so");
+    ASSERT_GT(vmo1, 0, "could not load libc.so");
+    mx_handle_t vmo2 = load_object(svc, "libc.so");
+    ASSERT_GT(vmo2, 0, "could not load libc.so");
+
+    // both are handles to the same read-only VMO
+    mx_info_handle_basic_t info1, info2;
+    ASSERT_EQ(mx_object_get_info(vmo1, MX_INFO_HANDLE_BASIC, &info1, sizeof(info1), NULL, NULL),
+              NO_ERROR, "");
+    ASSERT_EQ(mx_object_get_info(vmo2, MX_INFO_HANDLE_BASIC, &info2, sizeof(info2), NULL, NULL),
+              NO_ERROR, "");
+    EXPECT_EQ(info1.koid, info2.koid, "library VMO not reused");
+    EXPECT_EQ(info1.rights & MX_RIGHT_WRITE, 0u, "library VMO is writable");
+
+    EXPECT_LT(load_object(svc, "no-such-library.so"), 0, "loaded a missing library");
+
+    mx_handle_close(vmo1);
+    mx_handle_close(vmo2);
+    mx_handle_close(svc);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(loader_service_test)
+RUN_TEST(cached_vmo_test);
+END_TEST_CASE(loader_service_test)
@@ -11,6 +11,7 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <magenta/compiler.h>
 #include <magenta/syscalls.h>
 #include <mxio/io.h>
 #include <unittest/unittest.h>
@@ -60,6 +61,100 @@ bool epoll_test(void) {
     END_TEST;
 }
 
+bool epoll_edge_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t h = MX_HANDLE_INVALID;
+    ASSERT_EQ(NO_ERROR, mx_event_create(0u, &h), "mx_event_create() failed");
+    int fd = mxio_handle_fd(h, MX_USER_SIGNAL_0, MX_USER_SIGNAL_1, false);
+    ASSERT_GT(fd, 0, "mxio_handle_fd() failed");
+
+    int epollfd = epoll_create(0);
+    ASSERT_GT(epollfd, 0, "epoll_create() failed");
+
+    struct epoll_event ev, events[4];
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u32 = 7;
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev), "epoll_ctl() failed");
+
+    ASSERT_EQ(NO_ERROR, mx_object_signal(h, 0u, MX_USER_SIGNAL_0), "");
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 1, "");
+    EXPECT_EQ(events[0].data.u32, 7u, "");
+
+    // Still asserted, but no new edge.
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 0, "");
+
+    // A fresh assertion is reported again.
+    ASSERT_EQ(NO_ERROR, mx_object_signal(h, MX_USER_SIGNAL_0, 0u), "");
+    ASSERT_EQ(NO_ERROR, mx_object_signal(h, 0u, MX_USER_SIGNAL_0), "");
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 1, "");
+
+    // One-shot entries fire once until re-armed.
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev), "epoll_ctl() failed");
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 1, "");
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 0, "");
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev), "epoll_ctl() failed");
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 1, "");
+
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL), "epoll_ctl() failed");
+    EXPECT_EQ(epoll_wait(epollfd, events, countof(events), 0), 0, "");
+
+    close(epollfd);
+    close(fd);
+
+    END_TEST;
+}
+
+#define NUM_EPOLL_FDS 200
+
+bool epoll_many_test(void) {
+    BEGIN_TEST;
+
+    int epollfd = epoll_create(0);
+    ASSERT_GT(epollfd, 0, "epoll_create() failed");
+
+    mx_handle_t handles[NUM_EPOLL_FDS];
+    int fds[NUM_EPOLL_FDS];
+    for (int i = 0; i < NUM_EPOLL_FDS; i++) {
+        ASSERT_EQ(NO_ERROR, mx_event_create(0u, &handles[i]), "");
+        fds[i] = mxio_handle_fd(handles[i], MX_USER_SIGNAL_0, MX_USER_SIGNAL_1, false);
+        ASSERT_GT(fds[i], 0, "mxio_handle_fd() failed");
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_ADD, fds[i], &ev), "epoll_ctl() failed");
+    }
+
+    // Only the signaled descriptors are reported, level-triggered ones
+    // until they are no longer ready.
+    ASSERT_EQ(NO_ERROR, mx_object_signal(handles[3], 0u, MX_USER_SIGNAL_0), "");
+    ASSERT_EQ(NO_ERROR, mx_object_signal(handles[150], 0u, MX_USER_SIGNAL_0), "");
+    struct epoll_event events[8];
+    for (int pass = 0; pass < 2; pass++) {
+        ASSERT_EQ(epoll_wait(epollfd, events, countof(events), 0), 2, "");
+        uint32_t seen = events[0].data.u32 + events[1].data.u32;
+        EXPECT_EQ(seen, 153u, "wrong descriptors reported");
+    }
+    ASSERT_EQ(NO_ERROR, mx_object_signal(handles[3], MX_USER_SIGNAL_0, 0u), "");
+    ASSERT_EQ(epoll_wait(epollfd, events, countof(events), 0), 1, "");
+    EXPECT_EQ(events[0].data.u32, 150u, "");
+
+    // With room for one event at a time, both ready descriptors take turns.
+    ASSERT_EQ(NO_ERROR, mx_object_signal(handles[3], 0u, MX_USER_SIGNAL_0), "");
+    ASSERT_EQ(epoll_wait(epollfd, events, 1, 0), 1, "");
+    uint32_t first = events[0].data.u32;
+    ASSERT_EQ(epoll_wait(epollfd, events, 1, 0), 1, "");
+    EXPECT_NEQ(events[0].data.u32, first, "one descriptor starved the other");
+
+    for (int i = 0; i < NUM_EPOLL_FDS; i++) {
+        close(fds[i]);
+    }
+    close(epollfd);
+
+    END_TEST;
+}
+
 bool close_test(void) {
     BEGIN_TEST;
 
@@ -130,6 +225,8 @@ bool pipe_test(void) {
 
 BEGIN_TEST_CASE(mxio_handle_fd_test)
 RUN_TEST(epoll_test);
+RUN_TEST(epoll_edge_test);
+RUN_TEST(epoll_many_test);
 RUN_TEST(close_test);
 RUN_TEST(pipe_test);
 END_TEST_CASE(mxio_handle_fd_test)
@@ -0,0 +1,89 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <magenta/compiler.h>
+#include <mxio/io.h>
+#include <unittest/unittest.h>
+
+#define TEST_DIR "/tmp/readdir-stat-test"
+
+static const struct {
+    const char* name;
+    size_t size;
+} test_files[] = {
+    {"empty", 0},
+    {"small", 17},
+    {"large", 9000},
+};
+
+// Entries come back with the same attributes that stat reports.
+static bool readdir_stat_test(void) {
+    BEGIN_TEST;
+    char path[PATH_MAX];
+    char buf[9000];
+    memset(buf, 'x', sizeof(buf));
+
+    ASSERT_EQ(mkdir(TEST_DIR, 0755), 0, "");
+    ASSERT_EQ(mkdir(TEST_DIR "/subdir", 0755), 0, "");
+    for (size_t i = 0; i < countof(test_files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", TEST_DIR, test_files[i].name);
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        ASSERT_GE(fd, 0, "");
+        ASSERT_EQ(write(fd, buf, test_files[i].size), (ssize_t)test_files[i].size, "");
+        close(fd);
+    }
+
+    DIR* dir = opendir(TEST_DIR);
+    ASSERT_NONNULL(dir, "");
+    size_t seen = 0;
+    bool seen_subdir = false;
+    struct dirent* de;
+    struct stat s;
+    while ((de = mxio_readdir_stat(dir, &s)) != NULL) {
+        if (!strcmp(de->d_name, "subdir")) {
+            EXPECT_TRUE(S_ISDIR(s.st_mode), "subdir should be a directory");
+            EXPECT_EQ(de->d_type, DT_DIR, "");
+            seen_subdir = true;
+            continue;
+        }
+        for (size_t i = 0; i < countof(test_files); i++) {
+            if (strcmp(de->d_name, test_files[i].name)) {
+                continue;
+            }
+            EXPECT_TRUE(S_ISREG(s.st_mode), "file should be regular");
+            EXPECT_EQ(de->d_type, DT_REG, "");
+            EXPECT_EQ((size_t)s.st_size, test_files[i].size, "wrong size");
+
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", TEST_DIR, de->d_name);
+            ASSERT_EQ(stat(path, &st), 0, "");
+            EXPECT_EQ(s.st_ino, st.st_ino, "inode differs from stat");
+            EXPECT_EQ(s.st_mode, st.st_mode, "mode differs from stat");
+            seen++;
+        }
+    }
+    closedir(dir);
+    EXPECT_EQ(seen, countof(test_files), "missing entries");
+    EXPECT_TRUE(seen_subdir, "missing subdir");
+
+    for (size_t i = 0; i < countof(test_files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", TEST_DIR, test_files[i].name);
+        EXPECT_EQ(unlink(path), 0, "");
+    }
+    EXPECT_EQ(rmdir(TEST_DIR "/subdir"), 0, "");
+    EXPECT_EQ(rmdir(TEST_DIR), 0, "");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(readdir_stat_tests)
+RUN_TEST(readdir_stat_test);
+END_TEST_CASE(readdir_stat_tests)
@@ -0,0 +1,113 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magenta/compiler.h>
+#include <mxio/io.h>
+#include <unittest/unittest.h>
+
+#define FILE_SIZE (40 * MXIO_CHUNK_SIZE + 123)
+
+static const char test_path[] = "/tmp/remoteio-read-test";
+
+static uint8_t expected(size_t off) {
+    return (uint8_t)(off * 7 + (off >> 11));
+}
+
+static bool make_file(uint8_t* buf) {
+    BEGIN_HELPER;
+    for (size_t i = 0; i < FILE_SIZE; i++)
+        buf[i] = expected(i);
+    int fd = open(test_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0, "cannot create test file");
+    ASSERT_EQ(write(fd, buf, FILE_SIZE), FILE_SIZE, "");
+    close(fd);
+    END_HELPER;
+}
+
+static bool check(const uint8_t* buf, size_t off, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != expected(off + i))
+            return false;
+    }
+    return true;
+}
+
+// Small sequential reads, which read ahead, must see the file in order
+// and agree with the seek offset.
+static bool sequential_read_test(void) {
+    BEGIN_TEST;
+    uint8_t* buf = malloc(FILE_SIZE);
+    ASSERT_NONNULL(buf, "");
+    ASSERT_TRUE(make_file(buf), "");
+
+    int fd = open(test_path, O_RDWR);
+    ASSERT_GE(fd, 0, "");
+    size_t off = 0;
+    size_t sizes[] = { 1, 100, 4096, 3000, 9000, 17 };
+    for (int i = 0; off < FILE_SIZE; i++) {
+        size_t len = sizes[i % countof(sizes)];
+        ssize_t r = read(fd, buf, len);
+        ASSERT_GT(r, 0, "read failed");
+        ASSERT_LE((size_t)r, len, "");
+        ASSERT_TRUE(check(buf, off, r), "wrong data");
+        off += r;
+        if (i % 16 == 0)
+            ASSERT_EQ(lseek(fd, 0, SEEK_CUR), (off_t)off, "seek offset out of step");
+    }
+    EXPECT_EQ(read(fd, buf, 10), 0, "no end of file");
+
+    // Seeking back drops what was read ahead.
+    ASSERT_EQ(lseek(fd, 5, SEEK_SET), 5, "");
+    ASSERT_EQ(read(fd, buf, 10), 10, "");
+    EXPECT_TRUE(check(buf, 5, 10), "wrong data after seek");
+
+    // So does writing: the write lands at the reader's offset.
+    uint8_t patch[3] = { 0xaa, 0xbb, 0xcc };
+    ASSERT_EQ(write(fd, patch, sizeof(patch)), (ssize_t)sizeof(patch), "");
+    ASSERT_EQ(lseek(fd, 0, SEEK_CUR), 18, "write at the wrong offset");
+    ASSERT_EQ(pread(fd, buf, 4, 14), 4, "");
+    EXPECT_EQ(buf[0], expected(14), "");
+    EXPECT_EQ(buf[1], 0xaa, "");
+    EXPECT_EQ(buf[3], 0xcc, "");
+
+    close(fd);
+    unlink(test_path);
+    free(buf);
+    END_TEST;
+}
+
+// Large reads are pipelined and must come back whole.
+static bool large_read_test(void) {
+    BEGIN_TEST;
+    uint8_t* buf = malloc(FILE_SIZE);
+    ASSERT_NONNULL(buf, "");
+    ASSERT_TRUE(make_file(buf), "");
+    memset(buf, 0, FILE_SIZE);
+
+    int fd = open(test_path, O_RDONLY);
+    ASSERT_GE(fd, 0, "");
+    ASSERT_EQ(read(fd, buf, FILE_SIZE), FILE_SIZE, "short read");
+    EXPECT_TRUE(check(buf, 0, FILE_SIZE), "wrong data");
+
+    memset(buf, 0, FILE_SIZE);
+    size_t off = 3 * MXIO_CHUNK_SIZE + 5;
+    ASSERT_EQ(pread(fd, buf, FILE_SIZE, off), (ssize_t)(FILE_SIZE - off), "short pread");
+    EXPECT_TRUE(check(buf, off, FILE_SIZE - off), "wrong data from pread");
+
+    close(fd);
+    unlink(test_path);
+    free(buf);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(remoteio_read_tests)
+RUN_TEST(sequential_read_test);
+RUN_TEST(large_read_test);
+END_TEST_CASE(remoteio_read_tests)
@@ -9,7 +9,14 @@ MODULE := $(LOCAL_DIR)
 MODULE_TYPE := usertest
 
 MODULE_SRCS += \
-    $(LOCAL_DIR)/mxio_handle_fd.c
+    $(LOCAL_DIR)/dispatcher.c \
+    $(LOCAL_DIR)/get_vmo.c \
+    $(LOCAL_DIR)/iovec.c \
+    $(LOCAL_DIR)/loader_service.c \
+    $(LOCAL_DIR)/mxio_handle_fd.c \
+    $(LOCAL_DIR)/readdir_stat.c \
+    $(LOCAL_DIR)/remoteio_read.c \
+    $(LOCAL_DIR)/sendfile.c
 
 MODULE_NAME := mxio-test
 
@@ -0,0 +1,102 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include <unittest/unittest.h>
+
+#define FILE_SIZE 20000
+
+static const char in_path[] = "/tmp/sendfile-test-in";
+static const char out_path[] = "/tmp/sendfile-test-out";
+
+static bool check_file(const char* path, const uint8_t* expect, size_t len) {
+    BEGIN_HELPER;
+    uint8_t* buf = malloc(len + 1);
+    ASSERT_NONNULL(buf, "");
+    int fd = open(path, O_RDONLY);
+    ASSERT_GE(fd, 0, "");
+    EXPECT_EQ(read(fd, buf, len + 1), (ssize_t)len, "wrong output size");
+    EXPECT_EQ(memcmp(buf, expect, len), 0, "wrong output data");
+    close(fd);
+    free(buf);
+    END_HELPER;
+}
+
+static bool sendfile_file_test(void) {
+    BEGIN_TEST;
+    uint8_t* data = malloc(FILE_SIZE);
+    ASSERT_NONNULL(data, "");
+    for (size_t i = 0; i < FILE_SIZE; i++)
+        data[i] = (uint8_t)(i * 7);
+
+    int in = open(in_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(in, 0, "");
+    ASSERT_EQ(write(in, data, FILE_SIZE), FILE_SIZE, "");
+    ASSERT_EQ(lseek(in, 0, SEEK_SET), 0, "");
+
+    // with an offset, the file position is left alone
+    int out = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(out, 0, "");
+    off_t off = 100;
+    EXPECT_EQ(sendfile(out, in, &off, FILE_SIZE), FILE_SIZE - 100, "");
+    EXPECT_EQ(off, FILE_SIZE, "offset not advanced");
+    EXPECT_EQ(lseek(in, 0, SEEK_CUR), 0, "file position moved");
+    EXPECT_EQ(sendfile(out, in, &off, FILE_SIZE), 0, "expected end of file");
+    close(out);
+    ASSERT_TRUE(check_file(out_path, data + 100, FILE_SIZE - 100), "");
+
+    // without one, it reads from and advances the file position
+    out = open(out_path, O_RDWR | O_TRUNC);
+    ASSERT_GE(out, 0, "");
+    ASSERT_EQ(lseek(in, 10, SEEK_SET), 10, "");
+    EXPECT_EQ(sendfile(out, in, NULL, 5000), 5000, "");
+    EXPECT_EQ(lseek(in, 0, SEEK_CUR), 5010, "file position not advanced");
+    EXPECT_EQ(sendfile(out, in, NULL, FILE_SIZE), FILE_SIZE - 5010, "");
+    close(out);
+    ASSERT_TRUE(check_file(out_path, data + 10, FILE_SIZE - 10), "");
+
+    close(in);
+    unlink(in_path);
+    unlink(out_path);
+    free(data);
+    END_TEST;
+}
+
+static bool sendfile_pipe_test(void) {
+    BEGIN_TEST;
+    int in = open(in_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(in, 0, "");
+    ASSERT_EQ(write(in, "hello sendfile", 14), 14, "");
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0, "");
+    off_t off = 6;
+    EXPECT_EQ(sendfile(fds[1], in, &off, 100), 8, "");
+    char buf[16];
+    EXPECT_EQ(read(fds[0], buf, sizeof(buf)), 8, "");
+    EXPECT_EQ(memcmp(buf, "sendfile", 8), 0, "");
+
+    // the input has to be a file
+    off = 0;
+    EXPECT_EQ(sendfile(in, fds[0], &off, 10), -1, "");
+    EXPECT_EQ(errno, EINVAL, "");
+
+    close(fds[0]);
+    close(fds[1]);
+    close(in);
+    unlink(in_path);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(sendfile_tests)
+RUN_TEST(sendfile_file_test);
+RUN_TEST(sendfile_pipe_test);
+END_TEST_CASE(sendfile_tests)
@@ -0,0 +1,68 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unittest/unittest.h>
+#include <mxtl/intrusive_resizable_hash_table.h>
+#include <mxtl/tests/intrusive_containers/intrusive_doubly_linked_list_checker.h>
+#include <mxtl/tests/intrusive_containers/intrusive_singly_linked_list_checker.h>
+#include <mxtl/tests/intrusive_containers/test_environment_utils.h>
+
+namespace mxtl {
+namespace tests {
+namespace intrusive_containers {
+
+// The resizable hash table sanity checker implementation is shared across
+// ResizableHashTables of all bucket types.
+class ResizableHashTableChecker {
+public:
+    template <typename ContainerType>
+    static bool SanityCheck(const ContainerType& container) {
+        using BucketType    = typename ContainerType::BucketType;
+        using BucketChecker = typename BucketType::CheckerType;
+        using KeyTraits     = typename ContainerType::KeyTraits;
+
+        BEGIN_TEST;
+
+        // The bucket count must always be a power of two no smaller than the
+        // inline bucket count.  If we are in the middle of growing, the old
+        // array must be exactly half the size of the new one.
+        ASSERT_GE(container.bucket_count_, ContainerType::kMinBuckets, "");
+        ASSERT_EQ(0u, container.bucket_count_ & (container.bucket_count_ - 1), "");
+        if (container.old_bucket_count_) {
+            ASSERT_NONNULL(container.old_buckets_, "");
+            ASSERT_EQ(container.bucket_count_, container.old_bucket_count_ << 1, "");
+            ASSERT_LT(container.migrate_ndx_, container.old_bucket_count_, "");
+        } else {
+            ASSERT_NULL(container.old_buckets_, "");
+        }
+
+        // Demand that every bucket pass its sanity check.  Keep a running total
+        // of the total size of the ResizableHashTable in the process.
+        size_t total_size = 0;
+        for (size_t i = 0; i < container.total_bucket_count(); ++i) {
+            const auto& bucket = container.GetBucket(i);
+            ASSERT_TRUE(BucketChecker::SanityCheck(bucket), "");
+            total_size += SizeUtils<BucketType>::size(bucket);
+
+            // Old buckets which have already been migrated must be empty.
+            if (i < container.migrate_ndx_)
+                EXPECT_TRUE(bucket.is_empty(), "");
+
+            // For every element in the bucket, make sure that it lives in the
+            // bucket a lookup of its key would search.
+            for (const auto& obj : bucket)
+                ASSERT_EQ(container.GetBucketNdx(KeyTraits::GetKey(obj)), i, "");
+        }
+
+        EXPECT_EQ(container.size(), total_size, "");
+
+        END_TEST;
+    }
+};
+
+}  // namespace intrusive_containers
+}  // namespace tests
+}  // namespace mxtl
@@ -0,0 +1,117 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/cpp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unittest/unittest.h>
+#include <mxtl/intrusive_mpsc_queue.h>
+
+namespace {
+
+static constexpr size_t kProducerCount = 4;
+static constexpr size_t kItemsPerProducer = 2000;
+
+struct Item : public mxtl::MpscQueueable<Item*> {
+    size_t producer;
+    size_t seq;
+};
+
+struct Producer {
+    mxtl::MpscQueue<Item*>* queue;
+    Item* items;
+    size_t id;
+};
+
+static void* produce(void* arg) {
+    Producer* p = reinterpret_cast<Producer*>(arg);
+    for (size_t i = 0u; i < kItemsPerProducer; ++i) {
+        p->items[i].producer = p->id;
+        p->items[i].seq = i;
+        p->queue->push(&p->items[i]);
+    }
+    return nullptr;
+}
+
+static bool mpsc_queue_fifo_test() {
+    BEGIN_TEST;
+
+    mxtl::MpscQueue<Item*> queue;
+    Item items[16];
+
+    EXPECT_TRUE(queue.is_empty(), "");
+    EXPECT_NULL(queue.pop(), "");
+
+    // Interleave pushes and pops so that pops drain both the consumer's
+    // claimed list and newly pushed items.  Order must be preserved.
+    size_t pushed = 0u, popped = 0u;
+    while (popped < countof(items)) {
+        for (size_t i = 0u; (i < 3) && (pushed < countof(items)); ++i) {
+            items[pushed].seq = pushed;
+            queue.push(&items[pushed++]);
+        }
+        EXPECT_FALSE(queue.is_empty(), "");
+
+        Item* item = queue.pop();
+        ASSERT_NONNULL(item, "");
+        EXPECT_EQ(popped++, item->seq, "");
+    }
+
+    EXPECT_TRUE(queue.is_empty(), "");
+    EXPECT_NULL(queue.pop(), "");
+
+    END_TEST;
+}
+
+static bool mpsc_queue_multi_producer_test() {
+    BEGIN_TEST;
+
+    mxtl::MpscQueue<Item*> queue;
+    AllocChecker ac;
+    Item* items = new (&ac) Item[kProducerCount * kItemsPerProducer];
+    ASSERT_TRUE(ac.check(), "");
+
+    Producer producers[kProducerCount];
+    pthread_t threads[kProducerCount];
+    for (size_t i = 0u; i < kProducerCount; ++i) {
+        producers[i] = { &queue, items + (i * kItemsPerProducer), i };
+        int res = pthread_create(&threads[i], NULL, &produce, &producers[i]);
+        ASSERT_LE(0, res, "Failed to create producer thread!");
+    }
+
+    // Consume concurrently with the producers.  Every item must come out
+    // exactly once, and each producer's items must come out in the order they
+    // were pushed.
+    size_t next_seq[kProducerCount] = { };
+    size_t received = 0u;
+    while (received < (kProducerCount * kItemsPerProducer)) {
+        Item* item = queue.pop();
+        if (item == nullptr) {
+            sched_yield();
+            continue;
+        }
+
+        ASSERT_LT(item->producer, kProducerCount, "");
+        EXPECT_EQ(next_seq[item->producer], item->seq, "");
+        next_seq[item->producer] = item->seq + 1;
+        ++received;
+    }
+
+    for (size_t i = 0u; i < kProducerCount; ++i) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(kItemsPerProducer, next_seq[i], "");
+    }
+
+    EXPECT_TRUE(queue.is_empty(), "");
+    delete[] items;
+
+    END_TEST;
+}
+
+}  // namespace
+
+BEGIN_TEST_CASE(mpsc_queue_tests)
+RUN_NAMED_TEST("FIFO order",      mpsc_queue_fifo_test)
+RUN_NAMED_TEST("Multi producer",  mpsc_queue_multi_producer_test)
+END_TEST_CASE(mpsc_queue_tests);
@@ -0,0 +1,285 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <unittest/unittest.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/intrusive_resizable_hash_table.h>
+#include <mxtl/tests/intrusive_containers/associative_container_test_environment.h>
+#include <mxtl/tests/intrusive_containers/intrusive_resizable_hash_table_checker.h>
+#include <mxtl/tests/intrusive_containers/test_thunks.h>
+
+namespace mxtl {
+namespace tests {
+namespace intrusive_containers {
+
+using OtherKeyType  = uint16_t;
+using OtherHashType = uint32_t;
+
+// Start the containers out with very few buckets so that the standard
+// container tests exercise growing and migrating.
+static constexpr size_t kRHTMinBuckets = 2;
+
+template <typename PtrType>
+struct RHTOtherHashTraits {
+    using ObjType = typename ::mxtl::internal::ContainerPtrTraits<PtrType>::ValueType;
+    using BucketStateType = DoublyLinkedListNodeState<PtrType>;
+
+    // Linked List Traits
+    static BucketStateType& node_state(ObjType& obj) {
+        return obj.other_container_state_.bucket_state_;
+    }
+
+    // Keyed Object Traits
+    static OtherKeyType GetKey(const ObjType& obj) {
+        return obj.other_container_state_.key_;
+    }
+
+    static bool LessThan(const OtherKeyType& key1, const OtherKeyType& key2) {
+        return key1 <  key2;
+    }
+
+    static bool EqualTo(const OtherKeyType& key1, const OtherKeyType& key2) {
+        return key1 == key2;
+    }
+
+    // Hash Traits
+    static OtherHashType GetHash(const OtherKeyType& key) {
+        return static_cast<OtherHashType>(key * 0xaee58187);
+    }
+
+    // Set key is a trait which is only used by the tests, not by the containers
+    // themselves.
+    static void SetKey(ObjType& obj, OtherKeyType key) {
+        obj.other_container_state_.key_ = key;
+    }
+};
+
+template <typename PtrType>
+struct RHTOtherHashState {
+private:
+    friend struct RHTOtherHashTraits<PtrType>;
+    OtherKeyType key_;
+    typename RHTOtherHashTraits<PtrType>::BucketStateType bucket_state_;
+};
+
+template <typename PtrType>
+class RHTDLLTraits {
+public:
+    using ObjType = typename ::mxtl::internal::ContainerPtrTraits<PtrType>::ValueType;
+
+    using ContainerType           = ResizableHashTable<size_t,
+                                                       PtrType,
+                                                       DoublyLinkedList<PtrType>,
+                                                       size_t,
+                                                       kRHTMinBuckets>;
+    using ContainableBaseClass    = DoublyLinkedListable<PtrType>;
+    using ContainerStateType      = DoublyLinkedListNodeState<PtrType>;
+    using KeyType                 = typename ContainerType::KeyType;
+    using HashType                = typename ContainerType::HashType;
+
+    using OtherContainerTraits    = RHTOtherHashTraits<PtrType>;
+    using OtherContainerStateType = RHTOtherHashState<PtrType>;
+    using OtherBucketType         = DoublyLinkedList<PtrType, OtherContainerTraits>;
+    using OtherContainerType      = ResizableHashTable<OtherKeyType,
+                                                       PtrType,
+                                                       OtherBucketType,
+                                                       OtherHashType,
+                                                       kRHTMinBuckets,
+                                                       OtherContainerTraits,
+                                                       OtherContainerTraits>;
+
+    // ResizableHashTables do their own reduction of the hash to a bucket
+    // index; do not limit the range of the test objects' hash.
+    using TestObjBaseType  = HashedTestObjBase<typename ContainerType::KeyType,
+                                               typename ContainerType::HashType,
+                                               static_cast<size_t>(-1)>;
+};
+
+DEFINE_TEST_OBJECTS(RHTDLL);
+using UMTE = DEFINE_TEST_THUNK(Associative, RHTDLL, Unmanaged);
+using UPTE = DEFINE_TEST_THUNK(Associative, RHTDLL, UniquePtr);
+using RPTE = DEFINE_TEST_THUNK(Associative, RHTDLL, RefPtr);
+
+// Grow a table from its inline buckets well past the point where a fixed size
+// table would have degenerated into long chains, checking that every element
+// remains reachable while buckets are being migrated.
+struct GrowTestObj : public SinglyLinkedListable<GrowTestObj*> {
+    explicit GrowTestObj(size_t key) : key_(key) { }
+    size_t GetKey() const { return key_; }
+    static size_t GetHash(const size_t& key) { return key; }
+    const size_t key_;
+};
+
+static bool resizable_hash_table_grow_test() {
+    BEGIN_TEST;
+
+    static constexpr size_t kObjCount = 1024;
+    using TableType = ResizableHashTable<size_t, GrowTestObj*>;
+
+    AllocChecker ac;
+    GrowTestObj* objs = static_cast<GrowTestObj*>(
+            operator new[](sizeof(GrowTestObj) * kObjCount, &ac));
+    ASSERT_TRUE(ac.check(), "");
+    for (size_t i = 0; i < kObjCount; ++i)
+        new (&objs[i]) GrowTestObj(i);
+
+    TableType table;
+    EXPECT_EQ(TableType::kMinBuckets, table.bucket_count(), "");
+
+    for (size_t i = 0; i < kObjCount; ++i) {
+        table.insert(&objs[i]);
+        EXPECT_LE(table.size(), table.bucket_count() * TableType::kMaxLoadFactor, "");
+
+        // Every element inserted so far must still be found, no matter which
+        // bucket array currently holds it.
+        if (!(i & 0x3f)) {
+            EXPECT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+            for (size_t j = 0; j <= i; ++j) {
+                auto iter = table.find(j);
+                ASSERT_TRUE(iter.IsValid(), "");
+                EXPECT_EQ(&objs[j], &(*iter), "");
+            }
+        }
+    }
+
+    EXPECT_EQ(kObjCount, table.size(), "");
+    EXPECT_LT(TableType::kMinBuckets, table.bucket_count(), "");
+    EXPECT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+
+    // Iteration must visit every element exactly once.
+    size_t visited = 0;
+    for (auto& obj : table) {
+        EXPECT_LT(obj.GetKey(), kObjCount, "");
+        ++visited;
+    }
+    EXPECT_EQ(kObjCount, visited, "");
+
+    // Erasing never shrinks the table; clearing returns it to its inline
+    // buckets.
+    size_t grown_count = table.bucket_count();
+    for (size_t i = 0; i < kObjCount; i += 2)
+        EXPECT_EQ(&objs[i], table.erase(i), "");
+    EXPECT_EQ(kObjCount / 2, table.size(), "");
+    EXPECT_EQ(grown_count, table.bucket_count(), "");
+    EXPECT_TRUE(ResizableHashTableChecker::SanityCheck(table), "");
+
+    table.clear();
+    EXPECT_TRUE(table.is_empty(), "");
+    EXPECT_EQ(TableType::kMinBuckets, table.bucket_count(), "");
+
+    operator delete[](objs);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(resizable_hashtable_dll_tests)
+//////////////////////////////////////////
+// General container specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("Clear (unmanaged)",            UMTE::ClearTest)
+RUN_NAMED_TEST("Clear (unique)",               UPTE::ClearTest)
+RUN_NAMED_TEST("Clear (RefPtr)",               RPTE::ClearTest)
+
+RUN_NAMED_TEST("ClearUnsafe (unmanaged)",      UMTE::ClearUnsafeTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("ClearUnsafe (unique)",         UPTE::ClearUnsafeTest)
+RUN_NAMED_TEST("ClearUnsafe (RefPtr)",         RPTE::ClearUnsafeTest)
+#endif
+
+RUN_NAMED_TEST("IsEmpty (unmanaged)",          UMTE::IsEmptyTest)
+RUN_NAMED_TEST("IsEmpty (unique)",             UPTE::IsEmptyTest)
+RUN_NAMED_TEST("IsEmpty (RefPtr)",             RPTE::IsEmptyTest)
+
+RUN_NAMED_TEST("Iterate (unmanaged)",          UMTE::IterateTest)
+RUN_NAMED_TEST("Iterate (unique)",             UPTE::IterateTest)
+RUN_NAMED_TEST("Iterate (RefPtr)",             RPTE::IterateTest)
+
+RUN_NAMED_TEST("IterErase (unmanaged)",        UMTE::IterEraseTest)
+RUN_NAMED_TEST("IterErase (unique)",           UPTE::IterEraseTest)
+RUN_NAMED_TEST("IterErase (RefPtr)",           RPTE::IterEraseTest)
+
+RUN_NAMED_TEST("DirectErase (unmanaged)",      UMTE::DirectEraseTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("DirectErase (unique)",         UPTE::DirectEraseTest)
+#endif
+RUN_NAMED_TEST("DirectErase (RefPtr)",         RPTE::DirectEraseTest)
+
+RUN_NAMED_TEST("MakeIterator (unmanaged)",     UMTE::MakeIteratorTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("MakeIterator (unique)",        UPTE::MakeIteratorTest)
+#endif
+RUN_NAMED_TEST("MakeIterator (RefPtr)",        RPTE::MakeIteratorTest)
+
+RUN_NAMED_TEST("ReverseIterErase (unmanaged)", UMTE::ReverseIterEraseTest)
+RUN_NAMED_TEST("ReverseIterErase (unique)",    UPTE::ReverseIterEraseTest)
+RUN_NAMED_TEST("ReverseIterErase (RefPtr)",    RPTE::ReverseIterEraseTest)
+
+RUN_NAMED_TEST("ReverseIterate (unmanaged)",   UMTE::ReverseIterateTest)
+RUN_NAMED_TEST("ReverseIterate (unique)",      UPTE::ReverseIterateTest)
+RUN_NAMED_TEST("ReverseIterate (RefPtr)",      RPTE::ReverseIterateTest)
+
+// Hash tables do not support swapping or Rvalue operations (Assignment or
+// construction) as doing so would be an O(n) operation (With 'n' == to the
+// number of buckets in the hashtable)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("Swap (unmanaged)",             UMTE::SwapTest)
+RUN_NAMED_TEST("Swap (unique)",                UPTE::SwapTest)
+RUN_NAMED_TEST("Swap (RefPtr)",                RPTE::SwapTest)
+
+RUN_NAMED_TEST("Rvalue Ops (unmanaged)",       UMTE::RvalueOpsTest)
+RUN_NAMED_TEST("Rvalue Ops (unique)",          UPTE::RvalueOpsTest)
+RUN_NAMED_TEST("Rvalue Ops (RefPtr)",          RPTE::RvalueOpsTest)
+#endif
+
+RUN_NAMED_TEST("Scope (unique)",               UPTE::ScopeTest)
+RUN_NAMED_TEST("Scope (RefPtr)",               RPTE::ScopeTest)
+
+RUN_NAMED_TEST("TwoContainer (unmanaged)",     UMTE::TwoContainerTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("TwoContainer (unique)",        UPTE::TwoContainerTest)
+#endif
+RUN_NAMED_TEST("TwoContainer (RefPtr)",        RPTE::TwoContainerTest)
+
+RUN_NAMED_TEST("IterCopyPointer (unmanaged)",  UMTE::IterCopyPointerTest)
+#if TEST_WILL_NOT_COMPILE || 0
+RUN_NAMED_TEST("IterCopyPointer (unique)",     UPTE::IterCopyPointerTest)
+#endif
+RUN_NAMED_TEST("IterCopyPointer (RefPtr)",     RPTE::IterCopyPointerTest)
+
+RUN_NAMED_TEST("EraseIf (unmanaged)",          UMTE::EraseIfTest)
+RUN_NAMED_TEST("EraseIf (unique)",             UPTE::EraseIfTest)
+RUN_NAMED_TEST("EraseIf (RefPtr)",             RPTE::EraseIfTest)
+
+RUN_NAMED_TEST("FindIf (unmanaged)",           UMTE::FindIfTest)
+RUN_NAMED_TEST("FindIf (unique)",              UPTE::FindIfTest)
+RUN_NAMED_TEST("FindIf (RefPtr)",              RPTE::FindIfTest)
+
+//////////////////////////////////////////
+// Associative container specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("InsertByKey (unmanaged)",      UMTE::InsertByKeyTest)
+RUN_NAMED_TEST("InsertByKey (unique)",         UPTE::InsertByKeyTest)
+RUN_NAMED_TEST("InsertByKey (RefPtr)",         RPTE::InsertByKeyTest)
+
+RUN_NAMED_TEST("FindByKey (unmanaged)",        UMTE::FindByKeyTest)
+RUN_NAMED_TEST("FindByKey (unique)",           UPTE::FindByKeyTest)
+RUN_NAMED_TEST("FindByKey (RefPtr)",           RPTE::FindByKeyTest)
+
+RUN_NAMED_TEST("EraseByKey (unmanaged)",       UMTE::EraseByKeyTest)
+RUN_NAMED_TEST("EraseByKey (unique)",          UPTE::EraseByKeyTest)
+RUN_NAMED_TEST("EraseByKey (RefPtr)",          RPTE::EraseByKeyTest)
+
+RUN_NAMED_TEST("InsertOrFind (unmanaged)",     UMTE::InsertOrFindTest)
+RUN_NAMED_TEST("InsertOrFind (unique)",        UPTE::InsertOrFindTest)
+RUN_NAMED_TEST("InsertOrFind (RefPtr)",        RPTE::InsertOrFindTest)
+
+//////////////////////////////////////////
+// Resizing specific tests.
+//////////////////////////////////////////
+RUN_NAMED_TEST("Grow",                         resizable_hash_table_grow_test)
+END_TEST_CASE(resizable_hashtable_dll_tests);
+
+}  // namespace intrusive_containers
+}  // namespace tests
+}  // namespace mxtl
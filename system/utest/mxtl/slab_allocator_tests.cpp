@@ -8,6 +8,7 @@
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
+#include <pthread.h>
 #include <unittest/unittest.h>
 
 namespace {
@@ -23,23 +24,28 @@ enum class ConstructType {
 class TestBase {
 public:
     // Various constructor forms to exercise SlabAllocator::New
-    TestBase()                       : ctype_(ConstructType::DEFAULT)    { ++allocated_obj_count_; }
-    explicit TestBase(const size_t&) : ctype_(ConstructType::LVALUE_REF) { ++allocated_obj_count_; }
-    explicit TestBase(size_t&&)      : ctype_(ConstructType::RVALUE_REF) { ++allocated_obj_count_; }
+    TestBase()                       : ctype_(ConstructType::DEFAULT)    { Inc(); }
+    explicit TestBase(const size_t&) : ctype_(ConstructType::LVALUE_REF) { Inc(); }
+    explicit TestBase(size_t&&)      : ctype_(ConstructType::RVALUE_REF) { Inc(); }
     explicit TestBase(const size_t&, size_t&&)
         : ctype_(ConstructType::L_THEN_R_REF) {
-        ++allocated_obj_count_;
+        Inc();
     }
 
-    virtual ~TestBase() { --allocated_obj_count_; }
+    virtual ~TestBase() { __atomic_sub_fetch(&allocated_obj_count_, 1, __ATOMIC_RELAXED); }
 
     ConstructType ctype() const { return ctype_; }
 
-    static void Reset() { allocated_obj_count_ = 0; }
-    static size_t allocated_obj_count() { return allocated_obj_count_; }
+    static void Reset() { __atomic_store_n(&allocated_obj_count_, 0, __ATOMIC_RELAXED); }
+    static size_t allocated_obj_count() {
+        return __atomic_load_n(&allocated_obj_count_, __ATOMIC_RELAXED);
+    }
     const uint8_t* payload() const { return payload_; }
 
 private:
+    // The threaded tests construct and destroy objects from several threads.
+    static void Inc() { __atomic_add_fetch(&allocated_obj_count_, 1, __ATOMIC_RELAXED); }
+
     const ConstructType ctype_;
     uint8_t             payload_[13];   // 13 bytes, just to make the size/alignment strange
 
@@ -50,11 +56,12 @@ private:
 size_t TestBase::allocated_obj_count_;
 
 // Traits which define the various test flavors.
-template <typename LockType>
+template <typename LockType, size_t MagazineSize = 0>
 struct UnmanagedTestTraits {
     class ObjType;
     using PtrType       = ObjType*;
-    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType>;
+    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType,
+                                                    false, MagazineSize>;
     using AllocatorType = mxtl::SlabAllocator<AllocTraits>;
     using RefList       = mxtl::DoublyLinkedList<PtrType>;
 
@@ -76,11 +83,12 @@ struct UnmanagedTestTraits {
     static constexpr size_t MaxAllocs(size_t slabs) { return AllocatorType::AllocsPerSlab * slabs; }
 };
 
-template <typename LockType>
+template <typename LockType, size_t MagazineSize = 0>
 struct UniquePtrTestTraits {
     class ObjType;
     using PtrType       = mxtl::unique_ptr<ObjType>;
-    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType>;
+    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType,
+                                                    false, MagazineSize>;
     using AllocatorType = mxtl::SlabAllocator<AllocTraits>;
     using RefList       = mxtl::DoublyLinkedList<PtrType>;
 
@@ -102,11 +110,12 @@ struct UniquePtrTestTraits {
     static constexpr size_t MaxAllocs(size_t slabs) { return AllocatorType::AllocsPerSlab * slabs; }
 };
 
-template <typename LockType>
+template <typename LockType, size_t MagazineSize = 0>
 struct RefPtrTestTraits {
     class ObjType;
     using PtrType       = mxtl::RefPtr<ObjType>;
-    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType>;
+    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType,
+                                                    false, MagazineSize>;
     using AllocatorType = mxtl::SlabAllocator<AllocTraits>;
     using RefList       = mxtl::DoublyLinkedList<PtrType>;
 
@@ -210,11 +219,12 @@ bool slab_test() {
     END_TEST;
 }
 
-template <typename LockType>
+template <typename LockType, size_t MagazineSize = 0>
 struct StaticUnmanagedTestTraits {
     class ObjType;
     using PtrType       = ObjType*;
-    using AllocTraits   = mxtl::StaticSlabAllocatorTraits<PtrType, 1024, LockType>;
+    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType,
+                                                    true, MagazineSize>;
     using AllocatorType = mxtl::SlabAllocator<AllocTraits>;
     using RefList       = mxtl::DoublyLinkedList<PtrType>;
 
@@ -236,11 +246,12 @@ struct StaticUnmanagedTestTraits {
     static constexpr bool   IsManaged = false;
 };
 
-template <typename LockType>
+template <typename LockType, size_t MagazineSize = 0>
 struct StaticUniquePtrTestTraits {
     class ObjType;
     using PtrType       = mxtl::unique_ptr<ObjType>;
-    using AllocTraits   = mxtl::StaticSlabAllocatorTraits<PtrType, 1024, LockType>;
+    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType,
+                                                    true, MagazineSize>;
     using AllocatorType = mxtl::SlabAllocator<AllocTraits>;
     using RefList       = mxtl::DoublyLinkedList<PtrType>;
 
@@ -262,11 +273,12 @@ struct StaticUniquePtrTestTraits {
     static constexpr bool   IsManaged = false;
 };
 
-template <typename LockType>
+template <typename LockType, size_t MagazineSize = 0>
 struct StaticRefPtrTestTraits {
     class ObjType;
     using PtrType       = mxtl::RefPtr<ObjType>;
-    using AllocTraits   = mxtl::StaticSlabAllocatorTraits<PtrType, 1024, LockType>;
+    using AllocTraits   = mxtl::SlabAllocatorTraits<PtrType, 1024, LockType,
+                                                    true, MagazineSize>;
     using AllocatorType = mxtl::SlabAllocator<AllocTraits>;
     using RefList       = mxtl::DoublyLinkedList<PtrType>;
 
@@ -373,6 +385,86 @@ bool static_slab_test() {
 
     END_TEST;
 }
+// Hammer a caching allocator from several threads at once.  Each thread
+// repeatedly allocates a handful of objects and frees them again, so objects
+// flow between the threads' magazines and the shared free list.  Every
+// allocation must succeed, since the threads never hold more than the
+// allocator's capacity between them.  When kFull is set, the threads hold the
+// whole capacity between them, so an allocation can only succeed by finding
+// the objects other threads have just freed into their own magazines.
+template <typename Traits>
+struct ThreadedTestArgs {
+    typename Traits::AllocatorType* allocator;
+    size_t count;
+    bool ok;
+};
+
+template <typename Traits>
+static void* threaded_slab_worker(void* arg) {
+    auto args = reinterpret_cast<ThreadedTestArgs<Traits>*>(arg);
+
+    AllocChecker ac;
+    mxtl::unique_ptr<typename Traits::PtrType[]> ptrs(
+        new (&ac) typename Traits::PtrType[args->count]);
+    if (!ac.check()) {
+        args->ok = false;
+        return nullptr;
+    }
+
+    args->ok = true;
+    for (size_t pass = 0; pass < 1000; ++pass) {
+        for (size_t i = 0; i < args->count; ++i) {
+            ptrs[i] = args->allocator->New(pass);
+            if (ptrs[i] == nullptr)
+                args->ok = false;
+        }
+        for (size_t i = 0; i < args->count; ++i) {
+            if (ptrs[i] != nullptr)
+                Traits::ReleasePtr(*args->allocator, ptrs[i]);
+        }
+    }
+
+    return nullptr;
+}
+
+template <typename Traits, bool kFull = false>
+bool threaded_slab_test() {
+    BEGIN_TEST;
+
+    static constexpr size_t kThreadCount = 4;
+    typename Traits::AllocatorType allocator(Traits::MaxSlabs);
+    const size_t max_allocs = Traits::MaxAllocs(Traits::MaxSlabs);
+    ASSERT_LE(kThreadCount * 8, max_allocs, "");
+
+    TestBase::Reset();
+
+    ThreadedTestArgs<Traits> args[kThreadCount];
+    pthread_t threads[kThreadCount];
+    for (size_t i = 0; i < kThreadCount; ++i) {
+        size_t count = 8;
+        if (kFull) {
+            count = max_allocs / kThreadCount;
+            if (i == 0)
+                count += max_allocs % kThreadCount;
+        }
+        args[i] = { &allocator, count, false };
+        int res = pthread_create(&threads[i], NULL, &threaded_slab_worker<Traits>, &args[i]);
+        ASSERT_LE(0, res, "Failed to create worker thread!");
+    }
+
+    for (size_t i = 0; i < kThreadCount; ++i) {
+        pthread_join(threads[i], NULL);
+        EXPECT_TRUE(args[i].ok, "Allocation failed when it should not have!");
+    }
+
+    EXPECT_EQ(0u, TestBase::allocated_obj_count(), "");
+
+    // Everything which went into the magazines must still be allocatable.
+    EXPECT_TRUE(do_slab_test<Traits>(allocator, max_allocs + 4),
+                "Over-capacity allocator test failed");
+
+    END_TEST;
+}
 }  // anon namespace
 
 using MutexLock = ::mxtl::Mutex;
@@ -386,6 +478,17 @@ DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(StaticUnmanagedTestTraits<NullLock>::Alloc
 DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(StaticUniquePtrTestTraits<NullLock>::AllocTraits, 1);
 DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(StaticRefPtrTestTraits<NullLock>::AllocTraits, 1);
 
+// Keep the magazines small so that the tests exercise refilling and flushing.
+static constexpr size_t kTestMagazineSize = 8;
+
+using StaticUnmanagedCachingTestTraits = StaticUnmanagedTestTraits<MutexLock, kTestMagazineSize>;
+using StaticUniquePtrCachingTestTraits = StaticUniquePtrTestTraits<MutexLock, kTestMagazineSize>;
+using StaticRefPtrCachingTestTraits    = StaticRefPtrTestTraits<MutexLock, kTestMagazineSize>;
+
+DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(StaticUnmanagedCachingTestTraits::AllocTraits, 1);
+DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(StaticUniquePtrCachingTestTraits::AllocTraits, 1);
+DECLARE_STATIC_SLAB_ALLOCATOR_STORAGE(StaticRefPtrCachingTestTraits::AllocTraits, 1);
+
 BEGIN_TEST_CASE(slab_allocator_tests)
 RUN_NAMED_TEST("Unmanaged Single Slab (mutex)", (slab_test<UnmanagedTestTraits<MutexLock>, 1>))
 RUN_NAMED_TEST("Unmanaged Multi Slab  (mutex)", (slab_test<UnmanagedTestTraits<MutexLock>>))
@@ -408,4 +511,30 @@ RUN_NAMED_TEST("Static RefPtr    (mutex)", (static_slab_test<StaticRefPtrTestTra
 RUN_NAMED_TEST("Static Unmanaged (unlock)", (static_slab_test<StaticUnmanagedTestTraits<NullLock>>))
 RUN_NAMED_TEST("Static UniquePtr (unlock)", (static_slab_test<StaticUniquePtrTestTraits<NullLock>>))
 RUN_NAMED_TEST("Static RefPtr    (unlock)", (static_slab_test<StaticRefPtrTestTraits<NullLock>>))
+
+RUN_NAMED_TEST("Unmanaged Single Slab (caching)",
+               (slab_test<UnmanagedTestTraits<MutexLock, kTestMagazineSize>, 1>))
+RUN_NAMED_TEST("Unmanaged Multi Slab  (caching)",
+               (slab_test<UnmanagedTestTraits<MutexLock, kTestMagazineSize>>))
+RUN_NAMED_TEST("UniquePtr Single Slab (caching)",
+               (slab_test<UniquePtrTestTraits<MutexLock, kTestMagazineSize>, 1>))
+RUN_NAMED_TEST("UniquePtr Multi Slab  (caching)",
+               (slab_test<UniquePtrTestTraits<MutexLock, kTestMagazineSize>>))
+RUN_NAMED_TEST("RefPtr Single Slab    (caching)",
+               (slab_test<RefPtrTestTraits<MutexLock, kTestMagazineSize>, 1>))
+RUN_NAMED_TEST("RefPtr Multi Slab     (caching)",
+               (slab_test<RefPtrTestTraits<MutexLock, kTestMagazineSize>>))
+
+RUN_NAMED_TEST("Static Unmanaged (caching)", (static_slab_test<StaticUnmanagedCachingTestTraits>))
+RUN_NAMED_TEST("Static UniquePtr (caching)", (static_slab_test<StaticUniquePtrCachingTestTraits>))
+RUN_NAMED_TEST("Static RefPtr    (caching)", (static_slab_test<StaticRefPtrCachingTestTraits>))
+
+RUN_NAMED_TEST("Unmanaged Threaded (caching)",
+               (threaded_slab_test<UnmanagedTestTraits<MutexLock, kTestMagazineSize>>))
+RUN_NAMED_TEST("RefPtr Threaded    (caching)",
+               (threaded_slab_test<RefPtrTestTraits<MutexLock, kTestMagazineSize>>))
+RUN_NAMED_TEST("Unmanaged Threaded Full (caching)",
+               (threaded_slab_test<UnmanagedTestTraits<MutexLock, kTestMagazineSize>, true>))
+RUN_NAMED_TEST("RefPtr Threaded Full    (caching)",
+               (threaded_slab_test<RefPtrTestTraits<MutexLock, kTestMagazineSize>, true>))
 END_TEST_CASE(slab_allocator_tests);
@@ -17,17 +17,23 @@
 #include <magenta/syscalls.h>
 #include <unittest/unittest.h>
 
-int get_ramdisk(uint64_t blk_size, uint64_t blk_count) {
+int get_ramdisk_flags(uint64_t blk_size, uint64_t blk_count, uint32_t flags) {
     int fd = open("/dev/misc/ramdisk", O_RDWR);
     ASSERT_GE(fd, 0, "Could not open ramdisk device");
     ramdisk_ioctl_config_t config;
+    memset(&config, 0, sizeof(config));
     config.blk_size = blk_size;
     config.blk_count = blk_count;
+    config.flags = flags;
     ssize_t r = ioctl_block_ramdisk_config(fd, &config);
     ASSERT_EQ(r, NO_ERROR, "Failed to acquire ramdisk");
     return fd;
 }
 
+int get_ramdisk(uint64_t blk_size, uint64_t blk_count) {
+    return get_ramdisk_flags(blk_size, blk_count, 0);
+}
+
 bool ramdisk_test_simple(void) {
     uint8_t buf[PAGE_SIZE];
     uint8_t out[PAGE_SIZE];
@@ -114,10 +120,151 @@ bool ramdisk_test_multiple(void) {
     END_TEST;
 }
 
+// Queues the requests with cookies first up to first + count, and checks
+// that their responses come back in order, failing from cookie bad on.
+static bool ramdisk_fifo_run(const block_fifo_t* fifo, const block_fifo_response_t* rsps,
+                             uint64_t first, uint64_t count, uint64_t bad) {
+    BEGIN_HELPER;
+    mx_fifo_state_t state;
+    ASSERT_EQ(mx_fifo_op(fifo->req_fifo, MX_FIFO_OP_ADVANCE_HEAD, count, &state), NO_ERROR, "");
+    uint64_t done = first;
+    while (done < first + count) {
+        ASSERT_EQ(mx_handle_wait_one(fifo->rsp_fifo, MX_FIFO_NOT_EMPTY, MX_SEC(10), NULL),
+                  NO_ERROR, "");
+        ASSERT_EQ(mx_fifo_op(fifo->rsp_fifo, MX_FIFO_OP_READ_STATE, 0, &state), NO_ERROR, "");
+        uint64_t n = state.head - state.tail;
+        for (uint64_t i = 0; i < n; i++, done++) {
+            const block_fifo_response_t* rsp = &rsps[(state.tail + i) & (fifo->entries_count - 1)];
+            ASSERT_EQ(rsp->cookie, done, "");
+            ASSERT_EQ(rsp->status, (done < bad) ? NO_ERROR : ERR_INVALID_ARGS, "");
+        }
+        ASSERT_EQ(mx_fifo_op(fifo->rsp_fifo, MX_FIFO_OP_ADVANCE_TAIL, n, &state), NO_ERROR, "");
+    }
+    END_HELPER;
+}
+
+bool ramdisk_test_fifo(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk(PAGE_SIZE, 512);
+
+    block_get_fifo_args_t args = { .entries_count = 16 };
+    block_fifo_t fifo;
+    ASSERT_EQ(ioctl_block_get_fifo(fd, &args, &fifo), (ssize_t) sizeof(fifo), "");
+    ASSERT_EQ(ioctl_block_get_fifo(fd, &args, &fifo), ERR_ALREADY_BOUND, "");
+    uintptr_t entries;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, fifo.entries_vmo, 0,
+                          fifo.rsp_offset + fifo.entries_count * sizeof(block_fifo_response_t),
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &entries),
+              NO_ERROR, "");
+    block_fifo_request_t* reqs = (block_fifo_request_t*)entries;
+    block_fifo_response_t* rsps = (block_fifo_response_t*)(entries + fifo.rsp_offset);
+
+    const size_t vmo_size = 8 * PAGE_SIZE;
+    mx_handle_t vmo, dup;
+    ASSERT_EQ(mx_vmo_create(vmo_size, 0, &vmo), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &dup), NO_ERROR, "");
+    ASSERT_EQ(ioctl_block_set_fifo_vmo(fd, &dup), NO_ERROR, "");
+    uint8_t buf[PAGE_SIZE];
+    size_t actual;
+    for (unsigned i = 0; i < 4; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        ASSERT_EQ(mx_vmo_write(vmo, buf, i * PAGE_SIZE, sizeof(buf), &actual), NO_ERROR, "");
+    }
+
+    // Write four blocks scattered across the device, then read each one
+    // into the other half of the VMO, and one more past the end of the VMO
+    static const uint64_t blocks[4] = { 7, 3, 4, 100 };
+    for (unsigned i = 0; i < 9; i++) {
+        block_fifo_request_t* req = &reqs[i & (fifo.entries_count - 1)];
+        memset(req, 0, sizeof(*req));
+        req->cookie = i;
+        req->txn.opcode = (i < 4) ? BLOCK_TXN_OP_WRITE : BLOCK_TXN_OP_READ;
+        req->txn.vmo_offset = (i < 4) ? i * PAGE_SIZE : (i - 4) * PAGE_SIZE + vmo_size / 2;
+        req->txn.dev_offset = blocks[i % 4] * PAGE_SIZE;
+        req->txn.length = PAGE_SIZE;
+    }
+    ASSERT_TRUE(ramdisk_fifo_run(&fifo, rsps, 0, 4, 4), "");
+    ASSERT_TRUE(ramdisk_fifo_run(&fifo, rsps, 4, 5, 8), "");
+
+    uint8_t out[PAGE_SIZE];
+    for (unsigned i = 0; i < 4; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        ASSERT_EQ(mx_vmo_read(vmo, out, vmo_size / 2 + i * PAGE_SIZE, sizeof(out), &actual),
+                  NO_ERROR, "");
+        ASSERT_EQ(memcmp(out, buf, sizeof(out)), 0, "");
+    }
+    // The writes went where they were asked to
+    ASSERT_EQ(lseek(fd, 3 * PAGE_SIZE, SEEK_SET), 3 * PAGE_SIZE, "");
+    ASSERT_EQ(read(fd, out, sizeof(out)), (ssize_t) sizeof(out), "");
+    memset(buf, 'b', sizeof(buf));
+    ASSERT_EQ(memcmp(out, buf, sizeof(out)), 0, "");
+
+    mx_vmar_unmap(mx_vmar_root_self(), entries,
+                  fifo.rsp_offset + fifo.entries_count * sizeof(block_fifo_response_t));
+    mx_handle_close(fifo.entries_vmo);
+    mx_handle_close(fifo.req_fifo);
+    mx_handle_close(fifo.rsp_fifo);
+    mx_handle_close(vmo);
+    close(fd);
+    END_TEST;
+}
+
+bool ramdisk_test_vmo(void) {
+    uint8_t buf[PAGE_SIZE];
+    uint8_t out[PAGE_SIZE];
+    const size_t dev_size = PAGE_SIZE * 64;
+
+    BEGIN_TEST;
+    int fd = get_ramdisk_flags(PAGE_SIZE, 64, RAMDISK_FLAG_COMMIT);
+    mx_handle_t vmo;
+    ASSERT_EQ(ioctl_block_ramdisk_get_vmo(fd, &vmo), (ssize_t) sizeof(vmo), "");
+    uintptr_t addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, dev_size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr), NO_ERROR, "");
+    // The device's memory is locked
+    ASSERT_EQ(mx_vmo_set_size(vmo, PAGE_SIZE), ERR_BAD_STATE, "");
+
+    // What goes through the device shows up in the mapping
+    memset(buf, 'a', sizeof(buf));
+    ASSERT_EQ(lseek(fd, 2 * PAGE_SIZE, SEEK_SET), 2 * PAGE_SIZE, "");
+    ASSERT_EQ(write(fd, buf, sizeof(buf)), (ssize_t) sizeof(buf), "");
+    ASSERT_EQ(memcmp((void*) (addr + 2 * PAGE_SIZE), buf, sizeof(buf)), 0, "");
+
+    // and the other way around
+    memset((void*) (addr + 5 * PAGE_SIZE), 'b', PAGE_SIZE);
+    memset(buf, 'b', sizeof(buf));
+    ASSERT_EQ(lseek(fd, 5 * PAGE_SIZE, SEEK_SET), 5 * PAGE_SIZE, "");
+    ASSERT_EQ(read(fd, out, sizeof(out)), (ssize_t) sizeof(out), "");
+    ASSERT_EQ(memcmp(out, buf, sizeof(out)), 0, "");
+
+    mx_vmar_unmap(mx_vmar_root_self(), addr, dev_size);
+    mx_handle_close(vmo);
+    close(fd);
+
+    // A lazily committed ramdisk may only be mapped to read
+    fd = get_ramdisk(PAGE_SIZE, 64);
+    ASSERT_EQ(ioctl_block_ramdisk_get_vmo(fd, &vmo), (ssize_t) sizeof(vmo), "");
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, dev_size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr),
+              ERR_ACCESS_DENIED, "");
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, dev_size,
+                          MX_VM_FLAG_PERM_READ, &addr), NO_ERROR, "");
+    memset(buf, 'c', sizeof(buf));
+    ASSERT_EQ(write(fd, buf, sizeof(buf)), (ssize_t) sizeof(buf), "");
+    ASSERT_EQ(memcmp((void*) addr, buf, sizeof(buf)), 0, "");
+
+    mx_vmar_unmap(mx_vmar_root_self(), addr, dev_size);
+    mx_handle_close(vmo);
+    close(fd);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(ramdisk_tests)
 RUN_TEST(ramdisk_test_simple)
 RUN_TEST(ramdisk_test_bad_requests)
 RUN_TEST(ramdisk_test_multiple)
+RUN_TEST(ramdisk_test_fifo)
+RUN_TEST(ramdisk_test_vmo)
 END_TEST_CASE(ramdisk_tests)
 
 int main(int argc, char** argv) {
@@ -156,6 +156,37 @@ static bool ralloc_by_size_test() {
     END_TEST;
 }
 
+static bool ralloc_by_size_fragmented_test() {
+    BEGIN_TEST;
+
+    RegionAllocator alloc(RegionAllocator::RegionPool::Create(REGION_POOL_SLAB_SIZE,
+                                                              REGION_POOL_MAX_SIZE));
+
+    // Add a long run of regions which are large enough to hold a 4KB
+    // allocation, but which can never hold one which is 4KB aligned.
+    for (uint64_t i = 0; i < 32; ++i) {
+        ralloc_region_t frag = { .base = (i << 16) + 0x800, .size = 0x1001 };
+        ASSERT_EQ(NO_ERROR, alloc.AddRegion(frag), "");
+    }
+
+    // Then add a region which can just barely hold the allocation, and a much
+    // larger region which could hold it anywhere.
+    const ralloc_region_t tight = { .base = 0x80000800, .size = 0x2000 };
+    const ralloc_region_t large = { .base = 0x90000000, .size = 0x100000 };
+    ASSERT_EQ(NO_ERROR, alloc.AddRegion(tight), "");
+    ASSERT_EQ(NO_ERROR, alloc.AddRegion(large), "");
+
+    // The allocation should skip past the badly aligned fragments and come
+    // from the smallest region which can satisfy it.
+    RegionAllocator::Region::UPtr region;
+    EXPECT_EQ(NO_ERROR, alloc.GetRegion(0x1000, 0x1000, region), "");
+    ASSERT_NONNULL(region, "");
+    EXPECT_TRUE(region_contains_region(&tight, region.get()), "");
+    EXPECT_EQ(0u, region->base & 0xfff, "");
+
+    END_TEST;
+}
+
 static bool ralloc_specific_test() {
     BEGIN_TEST;
 
@@ -244,6 +275,7 @@ static bool ralloc_subtract_test() {
 BEGIN_TEST_CASE(ralloc_tests)
 RUN_NAMED_TEST("Region Pools",   ralloc_region_pools_test)
 RUN_NAMED_TEST("Alloc by size",  ralloc_by_size_test)
+RUN_NAMED_TEST("Alloc by size (fragmented)", ralloc_by_size_fragmented_test)
 RUN_NAMED_TEST("Alloc specific", ralloc_specific_test)
 RUN_NAMED_TEST("Add/Overlap",    ralloc_add_overlap_test)
 RUN_NAMED_TEST("Subtract",       ralloc_subtract_test)
@@ -0,0 +1,173 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <limits.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/ktrace.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+#include <magenta/threads.h>
+#include <trace/trace.h>
+#include <unittest/unittest.h>
+
+// The tests share the one trace buffer a process gets, so each one looks
+// only at the records it added.
+
+static size_t trace_len(void) {
+    size_t len;
+    trace_records(&len);
+    return len;
+}
+
+static const ktrace_rec_32b_t* record_at(size_t off) {
+    size_t len;
+    const uint8_t* data = trace_records(&len);
+    return (const ktrace_rec_32b_t*)(data + off);
+}
+
+static mx_koid_t self_koid(mx_handle_t handle) {
+    mx_info_handle_basic_t info;
+    mx_object_get_info(handle, MX_INFO_HANDLE_BASIC, &info, sizeof(info), NULL, NULL);
+    return info.koid;
+}
+
+bool trace_not_started_test(void) {
+    BEGIN_TEST;
+    size_t len;
+    EXPECT_NULL(trace_records(&len), "");
+    EXPECT_EQ(len, 0u, "");
+    mx_handle_t vmo;
+    EXPECT_EQ(trace_get_vmo(&vmo), ERR_BAD_STATE, "");
+
+    // dropped, but the name is kept for when tracing starts
+    uint32_t early = trace_name("early");
+    EXPECT_NEQ(early, 0u, "");
+    trace_counter(early, 1);
+    END_TEST;
+}
+
+bool trace_start_test(void) {
+    BEGIN_TEST;
+    ASSERT_EQ(trace_start(16 * 1024), NO_ERROR, "");
+    EXPECT_EQ(trace_start(16 * 1024), ERR_BAD_STATE, "can only start once");
+
+    // the name from before starting is the only record
+    const ktrace_rec_name_t* rec = (const ktrace_rec_name_t*)record_at(0);
+    EXPECT_EQ(KTRACE_EVENT(rec->tag), KTRACE_EVENT(TAG_USER_NAME), "");
+    EXPECT_EQ(rec->id, trace_name("early"), "");
+    EXPECT_EQ(rec->arg, (uint32_t)self_koid(mx_process_self()), "");
+    EXPECT_EQ(strcmp(rec->name, "early"), 0, "");
+    EXPECT_EQ(trace_len(), (size_t)KTRACE_LEN(rec->tag), "");
+    END_TEST;
+}
+
+bool trace_duration_test(void) {
+    BEGIN_TEST;
+    uint32_t name = trace_name("duration");
+    size_t start = trace_len();
+    uint64_t before = trace_timestamp();
+    {
+        TRACE_DURATION(name);
+        trace_counter(name, 0x123456789ull);
+    }
+    uint64_t after = trace_timestamp();
+
+    ASSERT_EQ(trace_len() - start, 3 * sizeof(ktrace_rec_32b_t), "");
+    const ktrace_rec_32b_t* begin = record_at(start);
+    const ktrace_rec_32b_t* counter = begin + 1;
+    const ktrace_rec_32b_t* end = begin + 2;
+    EXPECT_EQ(begin->tag, (uint32_t)TAG_USER_DURATION_BEGIN, "");
+    EXPECT_EQ(counter->tag, (uint32_t)TAG_USER_COUNTER, "");
+    EXPECT_EQ(end->tag, (uint32_t)TAG_USER_DURATION_END, "");
+
+    mx_koid_t tid = self_koid(thrd_get_mx_handle(thrd_current()));
+    for (const ktrace_rec_32b_t* rec = begin; rec <= end; rec++) {
+        EXPECT_EQ(rec->tid, (uint32_t)tid, "");
+        EXPECT_EQ(rec->a, name, "");
+    }
+    EXPECT_EQ(counter->c, 0x23456789u, "");
+    EXPECT_EQ(counter->d, 0x1u, "");
+
+    EXPECT_LE(before, begin->ts, "");
+    EXPECT_LE(begin->ts, counter->ts, "");
+    EXPECT_LE(counter->ts, end->ts, "");
+    EXPECT_LE(end->ts, after, "");
+    END_TEST;
+}
+
+static int flow_thread(void* arg) {
+    trace_flow_step(trace_name("flow"), (uintptr_t)arg);
+    return 0;
+}
+
+bool trace_flow_test(void) {
+    BEGIN_TEST;
+    uint32_t name = trace_name("flow");
+    size_t start = trace_len();
+    trace_flow_begin(name, 42);
+    thrd_t t;
+    ASSERT_EQ(thrd_create(&t, flow_thread, (void*)42), thrd_success, "");
+    ASSERT_EQ(thrd_join(t, NULL), thrd_success, "");
+    trace_flow_end(name, 42);
+
+    ASSERT_EQ(trace_len() - start, 3 * sizeof(ktrace_rec_32b_t), "");
+    const ktrace_rec_32b_t* rec = record_at(start);
+    EXPECT_EQ(rec[0].tag, (uint32_t)TAG_USER_FLOW_BEGIN, "");
+    EXPECT_EQ(rec[1].tag, (uint32_t)TAG_USER_FLOW_STEP, "");
+    EXPECT_EQ(rec[2].tag, (uint32_t)TAG_USER_FLOW_END, "");
+    EXPECT_NEQ(rec[1].tid, rec[0].tid, "the step is on another thread");
+    EXPECT_EQ(rec[2].tid, rec[0].tid, "");
+    for (int i = 0; i < 3; i++)
+        EXPECT_EQ(rec[i].c, 42u, "");
+    END_TEST;
+}
+
+bool trace_vmo_test(void) {
+    BEGIN_TEST;
+    mx_handle_t vmo;
+    ASSERT_EQ(trace_get_vmo(&vmo), NO_ERROR, "");
+
+    uintptr_t addr;
+    EXPECT_NEQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, PAGE_SIZE,
+                           MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr),
+               NO_ERROR, "the vmo is read-only");
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, PAGE_SIZE,
+                          MX_VM_FLAG_PERM_READ, &addr), NO_ERROR, "");
+
+    const trace_buffer_header_t* hdr = (const trace_buffer_header_t*)addr;
+    EXPECT_EQ(hdr->magic, (uint32_t)TRACE_BUFFER_MAGIC, "");
+    EXPECT_EQ(hdr->version, (uint32_t)KTRACE_VERSION, "");
+    EXPECT_EQ(hdr->size, 16u * 1024, "");
+    EXPECT_EQ(hdr->head, trace_len(), "");
+    EXPECT_EQ(hdr->pid, self_koid(mx_process_self()), "");
+    EXPECT_NEQ(hdr->ticks_per_ms, 0u, "");
+
+    mx_vmar_unmap(mx_vmar_root_self(), addr, PAGE_SIZE);
+    mx_handle_close(vmo);
+    END_TEST;
+}
+
+bool trace_full_test(void) {
+    BEGIN_TEST;
+    uint32_t name = trace_name("full");
+    for (int i = 0; i < 1024; i++)
+        trace_counter(name, i);
+    EXPECT_EQ(trace_len(), 16u * 1024, "stops at the end of the buffer");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(trace_tests)
+RUN_TEST(trace_not_started_test)
+RUN_TEST(trace_start_test)
+RUN_TEST(trace_duration_test)
+RUN_TEST(trace_flow_test)
+RUN_TEST(trace_vmo_test)
+RUN_TEST(trace_full_test)
+END_TEST_CASE(trace_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
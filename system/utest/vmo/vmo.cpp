@@ -36,6 +36,79 @@ bool vmo_create_test() {
     END_TEST;
 }
 
+bool vmo_create_discardable_test() {
+    BEGIN_TEST;
+
+    mx_handle_t vmo;
+    mx_status_t status = mx_vmo_create(PAGE_SIZE, MX_VMO_CREATE_DISCARDABLE, &vmo);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+
+    // behaves like any other vmo until the kernel needs the memory back
+    uint32_t val = 1;
+    size_t actual;
+    status = mx_vmo_write(vmo, &val, 0, sizeof(val), &actual);
+    EXPECT_EQ(NO_ERROR, status, "vmo_write");
+    status = mx_vmo_read(vmo, &val, 0, sizeof(val), &actual);
+    EXPECT_EQ(NO_ERROR, status, "vmo_read");
+
+    // locking needs write access
+    mx_handle_t ro_vmo;
+    status = mx_handle_duplicate(vmo, MX_RIGHT_READ, &ro_vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_duplicate");
+    status = mx_vmo_op_range(ro_vmo, MX_VMO_OP_LOCK, 0, PAGE_SIZE, nullptr, 0);
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "vmo_op_range lock");
+    mx_handle_close(ro_vmo);
+
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    // unknown options are rejected
+    status = mx_vmo_create(PAGE_SIZE, 1u << 31, &vmo);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "vm_object_create");
+
+    END_TEST;
+}
+
+bool vmo_create_numa_test() {
+    BEGIN_TEST;
+
+    // every system has a node 0 to bind to, and can interleave over however many it has
+    const uint32_t policies[] = {
+        MX_VMO_CREATE_NUMA_BIND | MX_VMO_CREATE_NUMA_NODE(0),
+        MX_VMO_CREATE_NUMA_INTERLEAVE,
+    };
+    for (uint32_t options : policies) {
+        mx_handle_t vmo;
+        mx_status_t status = mx_vmo_create(PAGE_SIZE * 8, options, &vmo);
+        EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+
+        status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, PAGE_SIZE * 8, nullptr, 0);
+        EXPECT_EQ(NO_ERROR, status, "vmo_op_range commit");
+
+        uint32_t val = 1;
+        size_t actual;
+        status = mx_vmo_write(vmo, &val, PAGE_SIZE * 3, sizeof(val), &actual);
+        EXPECT_EQ(NO_ERROR, status, "vmo_write");
+
+        status = mx_handle_close(vmo);
+        EXPECT_EQ(NO_ERROR, status, "handle_close");
+    }
+
+    // a node without a binding, both policies at once and nodes past the last are rejected
+    const uint32_t bad_options[] = {
+        MX_VMO_CREATE_NUMA_NODE(1),
+        MX_VMO_CREATE_NUMA_BIND | MX_VMO_CREATE_NUMA_INTERLEAVE,
+        MX_VMO_CREATE_NUMA_BIND | MX_VMO_CREATE_NUMA_NODE(255),
+    };
+    for (uint32_t options : bad_options) {
+        mx_handle_t vmo;
+        mx_status_t status = mx_vmo_create(PAGE_SIZE, options, &vmo);
+        EXPECT_EQ(ERR_INVALID_ARGS, status, "vm_object_create");
+    }
+
+    END_TEST;
+}
+
 bool vmo_read_write_test() {
     BEGIN_TEST;
 
@@ -482,6 +555,16 @@ bool vmo_commit_test() {
     status = mx_vmar_unmap(mx_vmar_root_self(), ptr3, size);
     EXPECT_EQ(NO_ERROR, status, "vm_unmap");
 
+    // committing and decommitting need write access
+    mx_handle_t ro_vmo;
+    status = mx_handle_duplicate(vmo, MX_RIGHT_READ, &ro_vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_duplicate");
+    status = mx_vmo_op_range(ro_vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0);
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "vm commit");
+    status = mx_vmo_op_range(ro_vmo, MX_VMO_OP_DECOMMIT, 0, size, nullptr, 0);
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "vm decommit");
+    mx_handle_close(ro_vmo);
+
     // close the handle
     status = mx_handle_close(vmo);
     EXPECT_EQ(NO_ERROR, status, "handle_close");
@@ -489,8 +572,279 @@ bool vmo_commit_test() {
     END_TEST;
 }
 
+bool vmo_clone_test() {
+    BEGIN_TEST;
+
+    mx_handle_t vmo, clone;
+    mx_status_t status;
+    uintptr_t ptr, clone_ptr;
+    size_t n;
+
+    // create a vmo and write a pattern into its first two pages
+    const size_t size = PAGE_SIZE * 4;
+
+    status = mx_vmo_create(size, 0, &vmo);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+
+    uint32_t val = 1;
+    status = mx_vmo_write(vmo, &val, 0, sizeof(val), &n);
+    EXPECT_EQ(NO_ERROR, status, "vmo_write");
+    val = 2;
+    status = mx_vmo_write(vmo, &val, PAGE_SIZE, sizeof(val), &n);
+    EXPECT_EQ(NO_ERROR, status, "vmo_write");
+
+    // only copy-on-write clones of page aligned offsets are supported
+    status = mx_vmo_clone(vmo, 0, 0, size, &clone);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "clone with bad options");
+    status = mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, 1, size, &clone);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "clone with unaligned offset");
+
+    // clone it starting at the second page
+    status = mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, PAGE_SIZE, size, &clone);
+    EXPECT_EQ(NO_ERROR, status, "vmo_clone");
+
+    uint64_t clone_size;
+    status = mx_vmo_get_size(clone, &clone_size);
+    EXPECT_EQ(NO_ERROR, status, "vmo_get_size");
+    EXPECT_EQ(size, clone_size, "clone size");
+
+    // map both of them
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                         MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &ptr);
+    EXPECT_EQ(NO_ERROR, status, "map");
+    status = mx_vmar_map(mx_vmar_root_self(), 0, clone, 0, size,
+                         MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &clone_ptr);
+    EXPECT_EQ(NO_ERROR, status, "map clone");
+
+    volatile uint32_t* p = (volatile uint32_t*)ptr;
+    volatile uint32_t* c = (volatile uint32_t*)clone_ptr;
+
+    // the clone starts out with the original's contents, reading zeros past its end
+    EXPECT_EQ(2u, c[0], "clone contents");
+    EXPECT_EQ(0u, c[PAGE_SIZE / sizeof(uint32_t)], "clone contents");
+    EXPECT_EQ(0u, c[3 * PAGE_SIZE / sizeof(uint32_t)], "clone contents past original");
+
+    // writes to the clone, through a mapping or not, don't show up in the original
+    c[0] = 3;
+    EXPECT_EQ(3u, c[0], "clone write");
+    EXPECT_EQ(2u, p[PAGE_SIZE / sizeof(uint32_t)], "original after clone write");
+
+    val = 4;
+    status = mx_vmo_write(clone, &val, PAGE_SIZE, sizeof(val), &n);
+    EXPECT_EQ(NO_ERROR, status, "vmo_write clone");
+    EXPECT_EQ(4u, c[PAGE_SIZE / sizeof(uint32_t)], "clone write");
+    EXPECT_EQ(0u, p[2 * PAGE_SIZE / sizeof(uint32_t)], "original after clone write");
+
+    // and once written, the clone's pages are its own
+    p[PAGE_SIZE / sizeof(uint32_t)] = 5;
+    EXPECT_EQ(3u, c[0], "clone after original write");
+
+    status = mx_vmar_unmap(mx_vmar_root_self(), ptr, size);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    status = mx_vmar_unmap(mx_vmar_root_self(), clone_ptr, size);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    // the clone outlives the handle to the original
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    status = mx_vmo_read(clone, &val, 0, sizeof(val), &n);
+    EXPECT_EQ(NO_ERROR, status, "vmo_read clone");
+    EXPECT_EQ(3u, val, "clone contents after close");
+
+    status = mx_handle_close(clone);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_move_pages_test() {
+    BEGIN_TEST;
+
+    mx_handle_t src, dst;
+    mx_status_t status;
+    uintptr_t ptr;
+    size_t n;
+
+    const size_t size = PAGE_SIZE * 4;
+
+    status = mx_vmo_create(size, 0, &src);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+    status = mx_vmo_create(size, 0, &dst);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+
+    // put a value in the first two pages of the source and in every page of the destination
+    for (uint32_t i = 0; i < 2; i++) {
+        uint32_t val = i + 1;
+        status = mx_vmo_write(src, &val, i * PAGE_SIZE, sizeof(val), &n);
+        EXPECT_EQ(NO_ERROR, status, "vmo_write");
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        uint32_t val = 10;
+        status = mx_vmo_write(dst, &val, i * PAGE_SIZE, sizeof(val), &n);
+        EXPECT_EQ(NO_ERROR, status, "vmo_write");
+    }
+
+    // map the destination so we can see it change underneath the mapping
+    status = mx_vmar_map(mx_vmar_root_self(), 0, dst, 0, size, MX_VM_FLAG_PERM_READ, &ptr);
+    EXPECT_EQ(NO_ERROR, status, "map");
+    EXPECT_EQ(10u, *reinterpret_cast<volatile uint32_t*>(ptr + PAGE_SIZE), "mapped contents");
+
+    // bad arguments
+    status = mx_vmo_move_pages(dst, 1, src, 0, PAGE_SIZE);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "unaligned offset");
+    status = mx_vmo_move_pages(dst, 0, src, 0, size + PAGE_SIZE);
+    EXPECT_EQ(ERR_OUT_OF_RANGE, status, "past the end");
+    status = mx_vmo_move_pages(src, 0, src, PAGE_SIZE, 2 * PAGE_SIZE);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "overlapping ranges");
+
+    // move the first three pages of the source, one of them never committed,
+    // to the destination starting at its second page
+    status = mx_vmo_move_pages(dst, PAGE_SIZE, src, 0, 3 * PAGE_SIZE);
+    EXPECT_EQ(NO_ERROR, status, "vmo_move_pages");
+
+    const uint32_t expected[] = { 10, 1, 2, 0 };
+    for (uint32_t i = 0; i < countof(expected); i++) {
+        uint32_t val = 0xff;
+        status = mx_vmo_read(dst, &val, i * PAGE_SIZE, sizeof(val), &n);
+        EXPECT_EQ(NO_ERROR, status, "vmo_read");
+        EXPECT_EQ(expected[i], val, "destination contents");
+        EXPECT_EQ(expected[i], *reinterpret_cast<volatile uint32_t*>(ptr + i * PAGE_SIZE),
+                  "mapped contents");
+
+        // the source is left empty
+        val = 0xff;
+        status = mx_vmo_read(src, &val, i * PAGE_SIZE, sizeof(val), &n);
+        EXPECT_EQ(NO_ERROR, status, "vmo_read");
+        EXPECT_EQ(0u, val, "source contents");
+    }
+
+    status = mx_vmar_unmap(mx_vmar_root_self(), ptr, size);
+    EXPECT_EQ(NO_ERROR, status, "unmap");
+
+    mx_handle_close(src);
+    mx_handle_close(dst);
+
+    END_TEST;
+}
+
+bool vmo_task_memory_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 4;
+    mx_handle_t vmo;
+    ASSERT_EQ(NO_ERROR, mx_vmo_create(size, 0, &vmo), "vm_object_create");
+
+    uintptr_t ptr;
+    ASSERT_EQ(NO_ERROR, mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                                    MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &ptr), "map");
+
+    mx_info_task_memory_t before, after;
+    size_t actual, avail;
+    ASSERT_EQ(NO_ERROR, mx_object_get_info(mx_process_self(), MX_INFO_TASK_MEMORY,
+                                           &before, sizeof(before), &actual, &avail), "get info");
+    EXPECT_EQ(1u, actual, "actual");
+    EXPECT_EQ(1u, avail, "avail");
+    EXPECT_EQ(before.private_bytes + before.shared_bytes, before.committed_bytes, "committed");
+
+    // committing pages of a vmo only this process maps makes them private
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0), "commit");
+    ASSERT_EQ(NO_ERROR, mx_object_get_info(mx_process_self(), MX_INFO_TASK_MEMORY,
+                                           &after, sizeof(after), nullptr, nullptr), "get info");
+    EXPECT_EQ(before.private_bytes + size, after.private_bytes, "private after commit");
+    EXPECT_EQ(before.shared_bytes, after.shared_bytes, "shared after commit");
+
+    // a second mapping in the same process doesn't count the pages again
+    uintptr_t ptr2;
+    EXPECT_EQ(NO_ERROR, mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                                    MX_VM_FLAG_PERM_READ, &ptr2), "map2");
+    ASSERT_EQ(NO_ERROR, mx_object_get_info(mx_process_self(), MX_INFO_TASK_MEMORY,
+                                           &after, sizeof(after), nullptr, nullptr), "get info");
+    EXPECT_EQ(before.private_bytes + size, after.private_bytes, "private after map2");
+    EXPECT_EQ(NO_ERROR, mx_vmar_unmap(mx_vmar_root_self(), ptr2, size), "unmap2");
+
+    // decommitting gives them back
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_DECOMMIT, 0, size, nullptr, 0),
+              "decommit");
+    ASSERT_EQ(NO_ERROR, mx_object_get_info(mx_process_self(), MX_INFO_TASK_MEMORY,
+                                           &after, sizeof(after), nullptr, nullptr), "get info");
+    EXPECT_EQ(before.private_bytes, after.private_bytes, "private after decommit");
+
+    // the job's totals include this process's
+    if (mx_job_default() != MX_HANDLE_INVALID) {
+        ASSERT_EQ(NO_ERROR, mx_object_get_info(mx_job_default(), MX_INFO_TASK_MEMORY,
+                                               &after, sizeof(after), nullptr, nullptr),
+                  "job info");
+        EXPECT_GE(after.committed_bytes, before.committed_bytes, "job committed");
+    }
+
+    // too small a buffer, and the wrong kind of object
+    EXPECT_EQ(ERR_BUFFER_TOO_SMALL, mx_object_get_info(mx_process_self(), MX_INFO_TASK_MEMORY,
+                                                       &after, sizeof(after) - 1, &actual, &avail),
+              "small buffer");
+    EXPECT_EQ(0u, actual, "actual");
+    EXPECT_EQ(1u, avail, "avail");
+    EXPECT_EQ(ERR_WRONG_TYPE, mx_object_get_info(vmo, MX_INFO_TASK_MEMORY,
+                                                 &after, sizeof(after), nullptr, nullptr),
+              "wrong type");
+
+    EXPECT_EQ(NO_ERROR, mx_vmar_unmap(mx_vmar_root_self(), ptr, size), "unmap");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_sequential_map_test() {
+    BEGIN_TEST;
+
+    mx_handle_t vmo;
+    mx_status_t status;
+    uintptr_t ptr;
+    size_t n;
+
+    // create a vmo with every other page resident
+    const size_t size = PAGE_SIZE * 32;
+
+    status = mx_vmo_create(size, 0, &vmo);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+
+    for (size_t i = 0; i < size / PAGE_SIZE; i += 2) {
+        uint32_t val = static_cast<uint32_t>(i);
+        status = mx_vmo_write(vmo, &val, i * PAGE_SIZE, sizeof(val), &n);
+        EXPECT_EQ(NO_ERROR, status, "vmo_write");
+    }
+
+    // the sequential hint is not valid for a vmar
+    mx_handle_t vmar;
+    uintptr_t vmar_addr;
+    status = mx_vmar_allocate(mx_vmar_root_self(), 0, size,
+                              MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_MAP_SEQUENTIAL,
+                              &vmar, &vmar_addr);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "vmar_allocate");
+
+    // map it hinted as sequential and scan it, faulting around already resident pages
+    status = mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                         MX_VM_FLAG_PERM_READ | MX_VM_FLAG_MAP_SEQUENTIAL, &ptr);
+    EXPECT_EQ(NO_ERROR, status, "map");
+
+    for (size_t i = 0; i < size / PAGE_SIZE; i++) {
+        uint32_t expected = (i % 2) ? 0u : static_cast<uint32_t>(i);
+        EXPECT_EQ(expected, *(volatile uint32_t*)(ptr + i * PAGE_SIZE), "scan");
+    }
+
+    status = mx_vmar_unmap(mx_vmar_root_self(), ptr, size);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(vmo_tests)
 RUN_TEST(vmo_create_test);
+RUN_TEST(vmo_create_discardable_test);
+RUN_TEST(vmo_create_numa_test);
 RUN_TEST(vmo_read_write_test);
 RUN_TEST(vmo_map_test);
 RUN_TEST(vmo_read_only_map_test);
@@ -498,6 +852,10 @@ RUN_TEST(vmo_resize_test);
 RUN_TEST(vmo_rights_test);
 RUN_TEST(vmo_lookup_test);
 RUN_TEST(vmo_commit_test);
+RUN_TEST(vmo_clone_test);
+RUN_TEST(vmo_sequential_map_test);
+RUN_TEST(vmo_move_pages_test);
+RUN_TEST(vmo_task_memory_test);
 END_TEST_CASE(vmo_tests)
 
 int main(int argc, char** argv) {
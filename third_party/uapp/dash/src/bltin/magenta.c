@@ -17,6 +17,7 @@
 
 #include <hexdump/hexdump.h>
 #include <magenta/syscalls.h>
+#include <mxio/io.h>
 
 int mxc_dump(int argc, char** argv) {
     int fd;
@@ -74,8 +75,6 @@ static const char* modestr(uint32_t mode) {
 int mxc_ls(int argc, char** argv) {
     const char* dirn;
     struct stat s;
-    char tmp[2048];
-    size_t dirln;
     struct dirent* de;
     DIR* dir;
 
@@ -88,7 +87,6 @@ int mxc_ls(int argc, char** argv) {
     } else {
         dirn = argv[1];
     }
-    dirln = strlen(dirn);
 
     if (argc > 2) {
         fprintf(stderr, "usage: ls [ <file_or_directory> ]\n");
@@ -102,12 +100,7 @@ int mxc_ls(int argc, char** argv) {
         printf("%s %8jd %s\n", modestr(s.st_mode), (intmax_t)s.st_size, dirn);
         return 0;
     }
-    while((de = readdir(dir)) != NULL) {
-        memset(&s, 0, sizeof(struct stat));
-        if ((strlen(de->d_name) + dirln + 2) <= sizeof(tmp)) {
-            snprintf(tmp, sizeof(tmp), "%s/%s", dirn, de->d_name);
-            stat(tmp, &s);
-        }
+    while((de = mxio_readdir_stat(dir, &s)) != NULL) {
         printf("%s %8jd %s\n", modestr(s.st_mode), (intmax_t)s.st_size, de->d_name);
     }
     closedir(dir);
@@ -0,0 +1,150 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Hardware CRC-32 (the zlib/ethernet polynomial, bit-reflected) for crc32().
+//
+// Both work on the raw shift register, without the inversion crc32() does
+// on the way in and out, so crc32() can hand them the bulk of a buffer and
+// finish the rest with its tables.
+//
+// x86-64 folds the buffer 64 bytes at a time with carry-less multiplies
+// (PCLMULQDQ), as described in Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction", then reduces it to 32 bits with
+// a Barrett reduction.  SSE4.2's crc32 instruction uses the Castagnoli
+// polynomial, so it is no use here.  Whether the cpu has PCLMULQDQ is
+// checked once, at first use.
+//
+// arm64 has CRC32X and friends for this very polynomial.  There is no way
+// to ask for the cpu's features from userspace, so they are used when the
+// compiler was told the cpu has them (the cortex-a53 and later do).
+//
+// The kernel keeps to the tables, as it does not save the vector registers.
+
+#include "crc32-accel.h"
+
+#include <string.h>
+
+#if CRC32_ACCEL && defined(__x86_64__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CRC32_TARGET __attribute__((target("pclmul,sse4.1")))
+
+// x^(4*128+32) mod P and x^(4*128-32) mod P, folding across 64 bytes
+static const uint64_t k1k2[2] = { 0x154442bd4, 0x1c6e41596 };
+// x^(128+32) mod P and x^(128-32) mod P, folding across 16 bytes
+static const uint64_t k3k4[2] = { 0x1751997d0, 0x0ccaa009e };
+// x^64 mod P, folding 64 bits into 32
+static const uint64_t k5[2] = { 0x163cd6124, 0 };
+// P and floor(x^64 / P), for the Barrett reduction
+static const uint64_t poly_mu[2] = { 0x1db710641, 0x1f7011641 };
+static const uint64_t mask32[2] = { 0xffffffff, 0 };
+
+CRC32_TARGET static inline __m128i fold(__m128i x, __m128i k, __m128i data) {
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), data);
+}
+
+CRC32_TARGET static uint32_t crc32_pclmul(uint32_t crc, const unsigned char* buf, size_t len) {
+    const __m128i* p = (const __m128i*)buf;
+    __m128i x1 = _mm_loadu_si128(p + 0);
+    __m128i x2 = _mm_loadu_si128(p + 1);
+    __m128i x3 = _mm_loadu_si128(p + 2);
+    __m128i x4 = _mm_loadu_si128(p + 3);
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    p += 4;
+    len -= 64;
+
+    __m128i k = _mm_loadu_si128((const __m128i*)k1k2);
+    while (len >= 64) {
+        x1 = fold(x1, k, _mm_loadu_si128(p + 0));
+        x2 = fold(x2, k, _mm_loadu_si128(p + 1));
+        x3 = fold(x3, k, _mm_loadu_si128(p + 2));
+        x4 = fold(x4, k, _mm_loadu_si128(p + 3));
+        p += 4;
+        len -= 64;
+    }
+
+    // down to 128 bits, then take in what is left 16 bytes at a time
+    k = _mm_loadu_si128((const __m128i*)k3k4);
+    x1 = fold(x1, k, x2);
+    x1 = fold(x1, k, x3);
+    x1 = fold(x1, k, x4);
+    while (len >= 16) {
+        x1 = fold(x1, k, _mm_loadu_si128(p++));
+        len -= 16;
+    }
+
+    // 128 bits to 64, appending the 32 zero bits the CRC is defined with
+    __m128i t = _mm_clmulepi64_si128(k, x1, 0x01);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+
+    // 64 bits to 32
+    __m128i mask = _mm_loadu_si128((const __m128i*)mask32);
+    t = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, _mm_loadu_si128((const __m128i*)k5), 0x00);
+    x1 = _mm_xor_si128(x1, t);
+
+    // and the Barrett reduction
+    k = _mm_loadu_si128((const __m128i*)poly_mu);
+    t = x1;
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_xor_si128(x1, t);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+// 0 if not yet checked, 1 if usable, -1 if not
+static int pclmul_state;
+
+static bool pclmul_usable(void) {
+    int state = __atomic_load_n(&pclmul_state, __ATOMIC_RELAXED);
+    if (state == 0) {
+        unsigned eax, ebx, ecx, edx;
+        state = -1;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+            (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)) {
+            state = 1;
+        }
+        __atomic_store_n(&pclmul_state, state, __ATOMIC_RELAXED);
+    }
+    return state > 0;
+}
+
+uint32_t crc32_accel(uint32_t crc, const unsigned char** buf, size_t* len) {
+    if ((*len < 64) || !pclmul_usable()) {
+        return crc;
+    }
+    size_t n = *len & ~(size_t)15;
+    crc = crc32_pclmul(crc, *buf, n);
+    *buf += n;
+    *len -= n;
+    return crc;
+}
+
+#elif CRC32_ACCEL && defined(__aarch64__)
+
+#include <arm_acle.h>
+
+uint32_t crc32_accel(uint32_t crc, const unsigned char** buf, size_t* len) {
+    const unsigned char* p = *buf;
+    size_t n = *len;
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32d(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    *buf = p;
+    *len = n;
+    return crc;
+}
+
+#endif
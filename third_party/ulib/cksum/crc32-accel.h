@@ -0,0 +1,23 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(_KERNEL) && \
+    (defined(__x86_64__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)))
+#define CRC32_ACCEL 1
+#else
+#define CRC32_ACCEL 0
+#endif
+
+#if CRC32_ACCEL
+// Runs the raw (not inverted) crc over as much of *buf as the hardware
+// path takes, advancing *buf and *len past it, and returns the new crc.
+// Leaves them alone if the cpu cannot help.
+uint32_t crc32_accel(uint32_t crc, const unsigned char** buf, size_t* len);
+#endif
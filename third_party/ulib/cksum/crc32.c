@@ -29,6 +29,7 @@
 #endif /* MAKECRCH */
 
 #include "zutil.h"      /* for STDC and FAR definitions */
+#include "crc32-accel.h"  /* for crc32_accel() */
 
 #define local static
 
@@ -226,6 +227,13 @@ unsigned long ZEXPORT crc32(crc, buf, len)
     }
 #endif /* BYFOUR */
     crc = crc ^ 0xffffffffUL;
+#if CRC32_ACCEL
+    {
+        size_t left = len;
+        crc = crc32_accel((uint32_t)crc, &buf, &left);
+        len = (uInt)left;
+    }
+#endif /* CRC32_ACCEL */
     while (len >= 8) {
         DO8;
         len -= 8;
@@ -18,6 +18,8 @@
 
 #include <string.h>
 
+#include "sha256-accel.h"
+
 // Generic HASH code section ===========================================
 
 static void _HASH_update(clHASH_CTX* ctx, const void* data, int len) {
@@ -108,85 +110,123 @@ int clEqual(const uint8_t* a, int a_len, const uint8_t* b, int b_len) {
 
 // SHA256 code section ==================================================
 
-static void _SHA256_transform(clHASH_CTX* ctx) {
-  static const uint32_t _SHA256_K[64] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+const uint32_t _clSHA256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
 #define _ROR(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
 #define _SHR(value, bits) ((value) >> (bits))
 
+void _clSHA256_blocks_portable(uint32_t state[8], const uint8_t* p,
+                               size_t nblocks) {
   uint32_t W[64];
   uint32_t A, B, C, D, E, F, G, H;
-  const uint8_t* p = ctx->buf;
   int t;
 
-  for(t = 0; t < 16; ++t) {
-    uint32_t tmp =  *p++ << 24;
-    tmp |= *p++ << 16;
-    tmp |= *p++ << 8;
-    tmp |= *p++;
-    W[t] = tmp;
-  }
+  for (; nblocks > 0; --nblocks) {
+    for(t = 0; t < 16; ++t) {
+      uint32_t tmp =  *p++ << 24;
+      tmp |= *p++ << 16;
+      tmp |= *p++ << 8;
+      tmp |= *p++;
+      W[t] = tmp;
+    }
 
-  for(; t < 64; t++) {
-    uint32_t s0 = _ROR(W[t-15], 7) ^ _ROR(W[t-15], 18) ^ _SHR(W[t-15], 3);
-    uint32_t s1 = _ROR(W[t-2], 17) ^ _ROR(W[t-2], 19) ^ _SHR(W[t-2], 10);
-    W[t] = W[t-16] + s0 + W[t-7] + s1;
-  }
+    for(; t < 64; t++) {
+      uint32_t s0 = _ROR(W[t-15], 7) ^ _ROR(W[t-15], 18) ^ _SHR(W[t-15], 3);
+      uint32_t s1 = _ROR(W[t-2], 17) ^ _ROR(W[t-2], 19) ^ _SHR(W[t-2], 10);
+      W[t] = W[t-16] + s0 + W[t-7] + s1;
+    }
 
-  A = ctx->state[0];
-  B = ctx->state[1];
-  C = ctx->state[2];
-  D = ctx->state[3];
-  E = ctx->state[4];
-  F = ctx->state[5];
-  G = ctx->state[6];
-  H = ctx->state[7];
-
-  for(t = 0; t < 64; t++) {
-    uint32_t s0 = _ROR(A, 2) ^ _ROR(A, 13) ^ _ROR(A, 22);
-    uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
-    uint32_t t2 = s0 + maj;
-    uint32_t s1 = _ROR(E, 6) ^ _ROR(E, 11) ^ _ROR(E, 25);
-    uint32_t ch = (E & F) ^ ((~E) & G);
-    uint32_t t1 = H + s1 + ch + _SHA256_K[t] + W[t];
-
-    H = G;
-    G = F;
-    F = E;
-    E = D + t1;
-    D = C;
-    C = B;
-    B = A;
-    A = t1 + t2;
-  }
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
+
+    for(t = 0; t < 64; t++) {
+      uint32_t s0 = _ROR(A, 2) ^ _ROR(A, 13) ^ _ROR(A, 22);
+      uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
+      uint32_t t2 = s0 + maj;
+      uint32_t s1 = _ROR(E, 6) ^ _ROR(E, 11) ^ _ROR(E, 25);
+      uint32_t ch = (E & F) ^ ((~E) & G);
+      uint32_t t1 = H + s1 + ch + _clSHA256_K[t] + W[t];
+
+      H = G;
+      G = F;
+      F = E;
+      E = D + t1;
+      D = C;
+      C = B;
+      B = A;
+      A = t1 + t2;
+    }
 
-  ctx->state[0] += A;
-  ctx->state[1] += B;
-  ctx->state[2] += C;
-  ctx->state[3] += D;
-  ctx->state[4] += E;
-  ctx->state[5] += F;
-  ctx->state[6] += G;
-  ctx->state[7] += H;
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
+  }
+}
 
 #undef _SHR
 #undef _ROR
+
+static void _SHA256_transform(clHASH_CTX* ctx) {
+  _clSHA256_blocks(ctx->state, ctx->buf, 1);
+}
+
+// Like _HASH_update, but hands whole blocks of the data straight to the
+// block function rather than copying them through ctx->buf.
+static void _SHA256_update(clHASH_CTX* ctx, const void* data, int len) {
+  int i = (int) (ctx->count & 63);
+  const uint8_t* p = (const uint8_t*)data;
+
+  ctx->count += len;
+
+  if (i > 0) {
+    int n = 64 - i;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(ctx->buf + i, p, n);
+    p += n;
+    len -= n;
+    i += n;
+    if (i < 64) {
+      return;
+    }
+    _SHA256_transform(ctx);
+  }
+
+  if (len >= 64) {
+    _clSHA256_blocks(ctx->state, p, len / 64);
+    p += len & ~63;
+    len &= 63;
+  }
+
+  memcpy(ctx->buf, p, len);
 }
 
 const uint8_t* clSHA256(const void* data, int len, uint8_t* digest) {
@@ -209,7 +249,7 @@ static const uint8_t kExpectedPadRsa2kSha256[clSHA256_DIGEST_SIZE] = {
 
 static const clHASH_vtab _SHA256_vtab = {
   clSHA256_init,
-  _HASH_update,
+  _SHA256_update,
   _HASH_final,
   _SHA256_transform,
   clSHA256_DIGEST_SIZE,
@@ -101,6 +101,13 @@ void clSHA256_init(clSHA256_CTX* ctx);
 void clHMAC_SHA256_init(clHMAC_CTX* ctx, const void* key, int len);
 const uint8_t* clSHA256(const void* data, int len, uint8_t* digest);
 
+// Updates each of the |n| SHA256 contexts in |ctxs| with |len| bytes of its
+// own message, at |data[i]|.  Where the cpu allows, the contexts' blocks are
+// hashed side by side in vector lanes, which beats updating them one at a
+// time.  Not available in the kernel.
+void clSHA256_update_multi(clSHA256_CTX* const* ctxs, const void* const* data,
+                           int len, int n);
+
 // Safe compare interface --------------------------------
 
 // Returns 0 if equal.
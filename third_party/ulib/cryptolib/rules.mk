@@ -5,6 +5,7 @@ MODULE := $(LOCAL_DIR)
 MODULE_TYPE := userlib
 
 MODULE_SRCS += \
-    $(LOCAL_DIR)/cryptolib.c
+    $(LOCAL_DIR)/cryptolib.c \
+    $(LOCAL_DIR)/sha256-accel.c
 
 include make/module.mk
@@ -0,0 +1,275 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// SHA256 with the instructions the cpu has: the SHA extensions where there
+// are any, and otherwise vector lanes for hashing several messages at once.
+// The implementation is picked at the first use.
+
+// The intrinsics headers come first: some of them test __OPTIMIZE, which
+// magenta/compiler.h defines as a macro.
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <lib/crypto/cryptolib.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "sha256-accel.h"
+
+#define MAX_LANES 8
+
+struct sha256_impl {
+    // hashes one message
+    void (*blocks)(uint32_t state[8], const uint8_t* data, size_t nblocks);
+    // hashes |nlanes| messages of the same length at once, if non-null
+    void (*lanes)(uint32_t* const* states, const uint8_t* const* data, size_t nblocks);
+    int nlanes;
+};
+
+static inline uint32_t load_be32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is always there on x86-64, so it is the fallback for lanes.
+#define VEC __m128i
+#define LANES 4
+#define V_LOAD(p) _mm_load_si128((const __m128i*)(p))
+#define V_STORE(p, v) _mm_store_si128((__m128i*)(p), v)
+#define V_SET1(x) _mm_set1_epi32((int)(x))
+#define V_ADD _mm_add_epi32
+#define V_XOR _mm_xor_si128
+#define V_AND _mm_and_si128
+#define V_OR _mm_or_si128
+#define V_ANDNOT _mm_andnot_si128
+#define V_SHR _mm_srli_epi32
+#define V_SHL _mm_slli_epi32
+#define FN sha256_lanes_sse2
+#define FN_ATTR
+#include "sha256-lanes.inc"
+#undef VEC
+#undef LANES
+#undef V_LOAD
+#undef V_STORE
+#undef V_SET1
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ANDNOT
+#undef V_SHR
+#undef V_SHL
+#undef FN
+#undef FN_ATTR
+
+#define VEC __m256i
+#define LANES 8
+#define V_LOAD(p) _mm256_load_si256((const __m256i*)(p))
+#define V_STORE(p, v) _mm256_store_si256((__m256i*)(p), v)
+#define V_SET1(x) _mm256_set1_epi32((int)(x))
+#define V_ADD _mm256_add_epi32
+#define V_XOR _mm256_xor_si256
+#define V_AND _mm256_and_si256
+#define V_OR _mm256_or_si256
+#define V_ANDNOT _mm256_andnot_si256
+#define V_SHR _mm256_srli_epi32
+#define V_SHL _mm256_slli_epi32
+#define FN sha256_lanes_avx2
+#define FN_ATTR __attribute__((target("avx2")))
+#include "sha256-lanes.inc"
+
+// After Intel's "New Instructions Supporting the Secure Hash Algorithm on
+// Intel Architecture Processors": the state is kept as ABEF and CDGH, and
+// each sha256rnds2 does two rounds.
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t* data, size_t nblocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);              // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);        // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);     // CDGH
+
+    for (; nblocks > 0; --nblocks, data += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w[4];
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + g * 16)), bswap);
+            } else {
+                // W[t..t+3] from the four groups before it
+                __m128i x = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                x = _mm_add_epi32(x, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+                w[g & 3] = _mm_sha256msg2_epu32(x, w[(g + 3) & 3]);
+            }
+            __m128i msg = _mm_add_epi32(
+                w[g & 3], _mm_loadu_si128((const __m128i*)&_clSHA256_K[g * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);           // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);        // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);     // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);        // ABEF
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+static bool cpu_has_sha(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3))
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1u << 29)) != 0;
+}
+
+static bool cpu_has_avx2(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX))
+        return false;
+    // the system has to save the ymm registers too
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6)
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & bit_AVX2) != 0;
+}
+
+static const struct sha256_impl impl_shani = { sha256_blocks_shani, NULL, 1 };
+static const struct sha256_impl impl_avx2 = {
+    _clSHA256_blocks_portable, sha256_lanes_avx2, 8 };
+static const struct sha256_impl impl_sse2 = {
+    _clSHA256_blocks_portable, sha256_lanes_sse2, 4 };
+
+static const struct sha256_impl* sha256_select(void) {
+    // One message through the SHA extensions is about as fast as a lane
+    // each, so they are used for everything.
+    if (cpu_has_sha())
+        return &impl_shani;
+    if (cpu_has_avx2())
+        return &impl_avx2;
+    return &impl_sse2;
+}
+
+#elif defined(__aarch64__)
+
+// NEON is always there on arm64.
+#define VEC uint32x4_t
+#define LANES 4
+#define V_LOAD(p) vld1q_u32(p)
+#define V_STORE(p, v) vst1q_u32(p, v)
+#define V_SET1(x) vdupq_n_u32(x)
+#define V_ADD vaddq_u32
+#define V_XOR veorq_u32
+#define V_AND vandq_u32
+#define V_OR vorrq_u32
+#define V_ANDNOT(a, b) vbicq_u32(b, a)
+#define V_SHR vshrq_n_u32
+#define V_SHL vshlq_n_u32
+#define FN sha256_lanes_neon
+#define FN_ATTR
+#include "sha256-lanes.inc"
+
+static const struct sha256_impl impl_neon = {
+    _clSHA256_blocks_portable, sha256_lanes_neon, 4 };
+
+static const struct sha256_impl* sha256_select(void) {
+    return &impl_neon;
+}
+
+#else
+
+static const struct sha256_impl impl_portable = {
+    _clSHA256_blocks_portable, NULL, 1 };
+
+static const struct sha256_impl* sha256_select(void) {
+    return &impl_portable;
+}
+
+#endif
+
+static const struct sha256_impl* sha256_impl(void) {
+    // Racing threads pick the same one, so there is no need to lock.
+    static const struct sha256_impl* impl;
+    const struct sha256_impl* p = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (p == NULL) {
+        p = sha256_select();
+        __atomic_store_n(&impl, p, __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+void _clSHA256_blocks(uint32_t state[8], const uint8_t* data, size_t nblocks) {
+    sha256_impl()->blocks(state, data, nblocks);
+}
+
+void clSHA256_update_multi(clSHA256_CTX* const* ctxs, const void* const* data,
+                           int len, int n) {
+    const struct sha256_impl* impl = sha256_impl();
+    size_t nblocks = (len > 0) ? (size_t)len / 64 : 0;
+
+    // Only contexts that are all at a block boundary can go through the
+    // lanes together; the rest is left to the single-message path.
+    bool aligned = true;
+    for (int i = 0; i < n; i++) {
+        if (ctxs[i]->count & 63)
+            aligned = false;
+    }
+    if (impl->lanes == NULL || !aligned || nblocks == 0) {
+        for (int i = 0; i < n; i++) {
+            clHASH_update(ctxs[i], data[i], len);
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; i += impl->nlanes) {
+        if (n - i == 1) {
+            impl->blocks(ctxs[i]->state, data[i], nblocks);
+            break;
+        }
+        // Lanes without a message of their own hash a copy of the first.
+        uint32_t spare[8];
+        uint32_t* states[MAX_LANES];
+        const uint8_t* ptrs[MAX_LANES];
+        for (int l = 0; l < impl->nlanes; l++) {
+            if (i + l < n) {
+                states[l] = ctxs[i + l]->state;
+                ptrs[l] = data[i + l];
+            } else {
+                memcpy(spare, ctxs[i]->state, sizeof(spare));
+                states[l] = spare;
+                ptrs[l] = data[i];
+            }
+        }
+        impl->lanes(states, ptrs, nblocks);
+    }
+
+    size_t done = nblocks * 64;
+    for (int i = 0; i < n; i++) {
+        ctxs[i]->count += done;
+        clHASH_update(ctxs[i], (const uint8_t*)data[i] + done, len - (int)done);
+    }
+}
@@ -0,0 +1,30 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Internal interface between cryptolib.c and the accelerated SHA256 code.
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+extern const uint32_t _clSHA256_K[64];
+
+// Runs the SHA256 compression function over |nblocks| 64-byte blocks.
+void _clSHA256_blocks_portable(uint32_t state[8], const uint8_t* data,
+                               size_t nblocks);
+
+#if _KERNEL
+// The kernel does not use the vector registers, so it always hashes
+// portably.
+#define _clSHA256_blocks _clSHA256_blocks_portable
+#else
+// As above, with the fastest implementation the cpu supports.
+void _clSHA256_blocks(uint32_t state[8], const uint8_t* data, size_t nblocks);
+#endif
+
+__END_CDECLS
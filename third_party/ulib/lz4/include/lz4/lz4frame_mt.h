@@ -0,0 +1,39 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Whole frames compressed and decompressed on several threads. The blocks
+// of a frame with independent blocks do not refer to each other, so each
+// thread takes the next block there is to do. The frames are ordinary LZ4
+// frames, readable by LZ4F_decompress(). |nthreads| of 0 is a thread for
+// each cpu.
+
+#pragma once
+
+#include "lz4frame.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+// Like LZ4F_compressFrame(), with up to |nthreads| threads. The blocks are
+// always independent. A content checksum, or a frame of a single block, is
+// done by LZ4F_compressFrame() on the calling thread.
+size_t LZ4F_compressFrame_mt(void* dstBuffer, size_t dstMaxSize,
+                             const void* srcBuffer, size_t srcSize,
+                             const LZ4F_preferences_t* preferencesPtr,
+                             unsigned nthreads);
+
+// Decompresses the frame at the start of |srcBuffer| into |dstBuffer|, with
+// up to |nthreads| threads, and returns the size decompressed or an error
+// code. *|srcSizePtr| is the size of |srcBuffer|, and is set to that of the
+// frame, which may be followed by more.
+// Frames of linked blocks, or with blocks that do not each decompress to the
+// frame's block size, are done by LZ4F_decompress() on the calling thread.
+size_t LZ4F_decompressFrame_mt(void* dstBuffer, size_t dstCapacity,
+                               const void* srcBuffer, size_t* srcSizePtr,
+                               unsigned nthreads);
+
+#if defined (__cplusplus)
+}
+#endif
@@ -0,0 +1,401 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lz4.h"
+#include "lz4hc.h"
+#include "lz4frame_static.h"
+#include "lz4frame_mt.h"
+#include "xxhash.h"
+
+#define MAX_THREADS 32
+// the lowest level lz4frame.c compresses with lz4hc
+#define MIN_HC_LEVEL 3
+#define BLOCK_UNCOMPRESSED (1u << 31)
+#define LZ4F_MAGIC 0x184D2204U
+
+static void write_le32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static size_t block_size(LZ4F_blockSizeID_t id) {
+    if (id == LZ4F_default)
+        id = LZ4F_max64KB;
+    return (size_t)64 * 1024 << (2 * (id - LZ4F_max64KB));
+}
+
+static unsigned thread_count(unsigned nthreads, size_t nblocks) {
+    if (nthreads == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (n > 0) ? (unsigned)n : 1;
+    }
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if (nthreads > nblocks)
+        nthreads = (unsigned)nblocks;
+    return nthreads;
+}
+
+// The calling thread is one of the workers; the rest are started here, and
+// those that cannot be are done without.
+typedef struct {
+    pthread_t threads[MAX_THREADS];
+    unsigned count;
+} workers_t;
+
+static void workers_start(workers_t* w, void* (*fn)(void*), void* job, unsigned nthreads) {
+    w->count = 0;
+    for (unsigned i = 1; i < nthreads; i++) {
+        if (pthread_create(&w->threads[w->count], NULL, fn, job) == 0)
+            w->count++;
+    }
+}
+
+static void workers_join(workers_t* w) {
+    for (unsigned i = 0; i < w->count; i++) {
+        pthread_join(w->threads[i], NULL);
+    }
+}
+
+typedef struct {
+    const uint8_t* src;
+    size_t src_size;
+    size_t block_size;
+    size_t count;
+    int level;
+    // block i, with its size header, goes to out + i * (block_size + 4)
+    uint8_t* out;
+    size_t* out_size;
+    // the next block to take
+    size_t next;
+} compress_job_t;
+
+static void* compress_worker(void* arg) {
+    compress_job_t* job = arg;
+    bool hc = job->level >= MIN_HC_LEVEL;
+    void* state = malloc(hc ? LZ4_sizeofStateHC() : LZ4_sizeofState());
+    if (state == NULL)
+        return NULL;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count)
+            break;
+        size_t offset = i * job->block_size;
+        int n = (int)(job->src_size - offset < job->block_size ?
+                      job->src_size - offset : job->block_size);
+        const char* src = (const char*)job->src + offset;
+        uint8_t* out = job->out + i * (job->block_size + 4);
+
+        // As LZ4F_compressBlock(): a block that does not get smaller is
+        // stored as it is.
+        int csize = hc ?
+            LZ4_compress_HC_extStateHC(state, src, (char*)out + 4, n, n - 1, job->level) :
+            LZ4_compress_fast_extState(state, src, (char*)out + 4, n, n - 1, 1);
+        if (csize <= 0) {
+            write_le32(out, (uint32_t)n | BLOCK_UNCOMPRESSED);
+            memcpy(out + 4, src, n);
+            csize = n;
+        } else {
+            write_le32(out, (uint32_t)csize);
+        }
+        job->out_size[i] = (size_t)csize + 4;
+    }
+
+    free(state);
+    return NULL;
+}
+
+size_t LZ4F_compressFrame_mt(void* dstBuffer, size_t dstMaxSize,
+                             const void* srcBuffer, size_t srcSize,
+                             const LZ4F_preferences_t* preferencesPtr,
+                             unsigned nthreads) {
+    LZ4F_preferences_t prefs;
+    if (preferencesPtr != NULL) {
+        prefs = *preferencesPtr;
+    } else {
+        memset(&prefs, 0, sizeof(prefs));
+    }
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    prefs.autoFlush = 1;
+
+    size_t bsize = block_size(prefs.frameInfo.blockSizeID);
+    size_t count = (srcSize + bsize - 1) / bsize;
+    nthreads = thread_count(nthreads, count);
+    if (nthreads <= 1 || prefs.frameInfo.contentChecksumFlag)
+        return LZ4F_compressFrame(dstBuffer, dstMaxSize, srcBuffer, srcSize, &prefs);
+
+    if (prefs.frameInfo.contentSize != 0)
+        prefs.frameInfo.contentSize = srcSize;
+    if (dstMaxSize < LZ4F_compressFrameBound(srcSize, &prefs))
+        return (size_t)-LZ4F_ERROR_dstMaxSize_tooSmall;
+
+    uint8_t* dst = dstBuffer;
+    LZ4F_compressionContext_t cctx;
+    size_t r = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+    if (LZ4F_isError(r))
+        return r;
+    r = LZ4F_compressBegin(cctx, dst, dstMaxSize, &prefs);
+    LZ4F_freeCompressionContext(cctx);
+    if (LZ4F_isError(r))
+        return r;
+    size_t pos = r;
+
+    compress_job_t job = {
+        .src = srcBuffer,
+        .src_size = srcSize,
+        .block_size = bsize,
+        .count = count,
+        .level = prefs.compressionLevel,
+        .out = malloc(count * (bsize + 4)),
+        .out_size = malloc(count * sizeof(size_t)),
+        .next = 0,
+    };
+    if (job.out == NULL || job.out_size == NULL) {
+        free(job.out);
+        free(job.out_size);
+        return (size_t)-LZ4F_ERROR_allocation_failed;
+    }
+
+    workers_t workers;
+    workers_start(&workers, compress_worker, &job, nthreads);
+    compress_worker(&job);
+    workers_join(&workers);
+
+    // Only a worker with its state takes blocks, so none were taken if
+    // every allocation failed.
+    if (job.next < count) {
+        free(job.out);
+        free(job.out_size);
+        return (size_t)-LZ4F_ERROR_allocation_failed;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(dst + pos, job.out + i * (bsize + 4), job.out_size[i]);
+        pos += job.out_size[i];
+    }
+    write_le32(dst + pos, 0);
+    pos += 4;
+
+    free(job.out);
+    free(job.out_size);
+    return pos;
+}
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t size;
+} block_t;
+
+typedef struct {
+    const block_t* blocks;
+    size_t count;
+    size_t block_size;
+    uint8_t* dst;
+    size_t dst_capacity;
+    // set when a block fails, or one but the last comes out short
+    int failed;
+    int short_block;
+    size_t last_size;
+    size_t next;
+} decompress_job_t;
+
+static void* decompress_worker(void* arg) {
+    decompress_job_t* job = arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count)
+            break;
+        size_t offset = i * job->block_size;
+        size_t room = job->dst_capacity - offset;
+        if (room > job->block_size)
+            room = job->block_size;
+        uint8_t* out = job->dst + offset;
+        const block_t* b = &job->blocks[i];
+
+        size_t n;
+        if (b->size & BLOCK_UNCOMPRESSED) {
+            n = b->size & ~BLOCK_UNCOMPRESSED;
+            if (n > room) {
+                __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            memcpy(out, b->data, n);
+        } else {
+            int r = LZ4_decompress_safe((const char*)b->data, (char*)out,
+                                        (int)b->size, (int)room);
+            if (r < 0) {
+                __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            n = (size_t)r;
+        }
+
+        if (i == job->count - 1) {
+            job->last_size = n;
+        } else if (n != job->block_size) {
+            __atomic_store_n(&job->short_block, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// Decompresses the rest of the frame, adding what it reads to *|consumed|.
+static size_t decompress_serial(LZ4F_decompressionContext_t dctx,
+                                uint8_t* dst, size_t dstCapacity,
+                                const uint8_t* src, size_t srcSize, size_t* consumed) {
+    size_t pos = 0;
+    for (;;) {
+        size_t dsize = dstCapacity - pos;
+        size_t ssize = srcSize;
+        size_t r = LZ4F_decompress(dctx, dst + pos, &dsize, src, &ssize, NULL);
+        if (LZ4F_isError(r))
+            return r;
+        pos += dsize;
+        src += ssize;
+        srcSize -= ssize;
+        *consumed += ssize;
+        if (r == 0)
+            return pos;
+        if (dsize == 0 && ssize == 0) {
+            return (size_t)-(srcSize == 0 ? LZ4F_ERROR_frameHeader_incomplete :
+                                            LZ4F_ERROR_dstMaxSize_tooSmall);
+        }
+    }
+}
+
+// Finds the blocks of the frame after its header, or returns 0 if the
+// frame does not hold together, which is left to LZ4F_decompress() to
+// report.
+static size_t find_blocks(const uint8_t* p, const uint8_t* end, size_t bsize,
+                          block_t* blocks, size_t max_blocks, const uint8_t** tail) {
+    size_t count = 0;
+    for (;;) {
+        if (end - p < 4)
+            return 0;
+        uint32_t v = read_le32(p);
+        p += 4;
+        if (v == 0)
+            break;
+        size_t len = v & ~BLOCK_UNCOMPRESSED;
+        if (len > bsize || (size_t)(end - p) < len || count == max_blocks)
+            return 0;
+        blocks[count].data = p;
+        blocks[count].size = v;
+        count++;
+        p += len;
+    }
+    *tail = p;
+    return count;
+}
+
+size_t LZ4F_decompressFrame_mt(void* dstBuffer, size_t dstCapacity,
+                               const void* srcBuffer, size_t* srcSizePtr,
+                               unsigned nthreads) {
+    const uint8_t* src = srcBuffer;
+    size_t srcSize = *srcSizePtr;
+    *srcSizePtr = 0;
+    const uint8_t* end = src + srcSize;
+
+    LZ4F_decompressionContext_t dctx;
+    size_t r = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(r))
+        return r;
+    // LZ4F_getFrameInfo() goes on into the blocks when given more than the
+    // header, so it gets just that.
+    if (srcSize < 7 || read_le32(src) != LZ4F_MAGIC) {
+        r = decompress_serial(dctx, dstBuffer, dstCapacity, src, srcSize, srcSizePtr);
+        LZ4F_freeDecompressionContext(dctx);
+        return r;
+    }
+    size_t hsize = (src[4] & 0x08) ? 15 : 7;
+    if (hsize > srcSize)
+        hsize = srcSize;
+    LZ4F_frameInfo_t info;
+    r = LZ4F_getFrameInfo(dctx, &info, src, &hsize);
+    if (LZ4F_isError(r)) {
+        LZ4F_freeDecompressionContext(dctx);
+        return r;
+    }
+    *srcSizePtr = hsize;
+
+    // Every block but the last fills its block size, so there is no point
+    // looking at more of them than fit.
+    size_t bsize = block_size(info.blockSizeID);
+    size_t max_blocks = dstCapacity / bsize + 1;
+    block_t* blocks = NULL;
+    size_t count = 0;
+    const uint8_t* tail = NULL;
+    if (info.blockMode == LZ4F_blockIndependent &&
+        thread_count(nthreads, max_blocks) > 1) {
+        size_t most = (srcSize - hsize) / 4;
+        if (most > max_blocks)
+            most = max_blocks;
+        blocks = malloc(most * sizeof(block_t));
+        if (blocks != NULL)
+            count = find_blocks(src + hsize, end, bsize, blocks, most, &tail);
+    }
+    nthreads = thread_count(nthreads, count);
+    if (nthreads <= 1) {
+        free(blocks);
+        r = decompress_serial(dctx, dstBuffer, dstCapacity, src + hsize, srcSize - hsize,
+                              srcSizePtr);
+        LZ4F_freeDecompressionContext(dctx);
+        return r;
+    }
+
+    decompress_job_t job = {
+        .blocks = blocks,
+        .count = count,
+        .block_size = bsize,
+        .dst = dstBuffer,
+        .dst_capacity = dstCapacity,
+    };
+    workers_t workers;
+    workers_start(&workers, decompress_worker, &job, nthreads);
+    decompress_worker(&job);
+    workers_join(&workers);
+    free(blocks);
+
+    if (job.failed) {
+        LZ4F_freeDecompressionContext(dctx);
+        return (size_t)-LZ4F_ERROR_decompressionFailed;
+    }
+    if (job.short_block) {
+        // The blocks are all right, but not where they were put.
+        r = decompress_serial(dctx, dstBuffer, dstCapacity, src + hsize, srcSize - hsize,
+                              srcSizePtr);
+        LZ4F_freeDecompressionContext(dctx);
+        return r;
+    }
+    LZ4F_freeDecompressionContext(dctx);
+
+    size_t total = (count - 1) * bsize + job.last_size;
+    if (info.contentSize != 0 && info.contentSize != total)
+        return (size_t)-LZ4F_ERROR_frameSize_wrong;
+    if (info.contentChecksumFlag) {
+        if (end - tail < 4)
+            return (size_t)-LZ4F_ERROR_frameHeader_incomplete;
+        if (XXH32(dstBuffer, total, 0) != read_le32(tail))
+            return (size_t)-LZ4F_ERROR_contentChecksum_invalid;
+        tail += 4;
+    }
+    *srcSizePtr = tail - src;
+    return total;
+}
@@ -7,6 +7,7 @@ MODULE_TYPE := userlib
 MODULE_SRCS += \
     $(LOCAL_DIR)/lz4.c \
     $(LOCAL_DIR)/lz4frame.c \
+    $(LOCAL_DIR)/lz4frame_mt.c \
     $(LOCAL_DIR)/lz4hc.c \
     $(LOCAL_DIR)/xxhash.c
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <magenta/types.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <threads.h>
 
 #ifdef __cplusplus
@@ -14,6 +16,22 @@ extern "C" {
 // execution of the C11 thread.
 mx_handle_t thrd_get_mx_handle(thrd_t t);
 
+// Counts of how contended the process's mutexes are, mtx_t and
+// pthread_mutex_t alike. Nothing is counted until mtx_stats_enable(true)
+// is called, and counting only costs anything when a mutex is contended.
+typedef struct mtx_stats {
+    uint64_t contended;     // locks that found the mutex held
+    uint64_t spin_acquired; // of those, how many took it by spinning
+    uint64_t spins;         // spin iterations
+    uint64_t waits;         // blocks in the kernel waiting for a mutex
+    uint64_t wakes;         // unlocks that woke a waiter
+} mtx_stats_t;
+
+void mtx_stats_enable(bool enable);
+
+// Reads the counters, setting them back to 0 if |reset| is true.
+void mtx_stats_get(mtx_stats_t* stats, bool reset);
+
 // Converts a threads.h-style status value to an |mx_status_t|.
 static inline mx_status_t __PURE thrd_status_to_mx_status(int thrd_status) {
     switch (thrd_status) {
@@ -247,21 +247,18 @@ static Sym* gnu_lookup_filtered(uint32_t h1, uint32_t* hashtab, struct dso* dso,
 #define ARCH_SYM_REJECT_UND(s) 0
 #endif
 
-static struct symdef find_sym(struct dso* dso, const char* s, int need_def) {
-    uint32_t h = 0, gh, gho, *ght;
-    size_t ghm = 0;
+static struct symdef find_sym_hashed(struct dso* dso, const char* s, uint32_t gh,
+                                     int need_def) {
+    uint32_t h = 0, *ght;
+    int maskbits = 8 * sizeof(size_t);
+    uint32_t gho = gh / maskbits;
+    size_t ghm = 1ul << gh % maskbits;
     struct symdef def = {};
     for (; dso; dso = dso->next) {
         Sym* sym;
         if (!dso->global)
             continue;
         if ((ght = dso->ghashtab)) {
-            if (!ghm) {
-                gh = gnu_hash(s);
-                int maskbits = 8 * sizeof ghm;
-                gho = gh / maskbits;
-                ghm = 1ul << gh % maskbits;
-            }
             sym = gnu_lookup_filtered(gh, ght, dso, s, gho, ghm);
         } else {
             if (!h)
@@ -291,15 +288,87 @@ static struct symdef find_sym(struct dso* dso, const char* s, int need_def) {
     return def;
 }
 
+static struct symdef find_sym(struct dso* dso, const char* s, int need_def) {
+    return find_sym_hashed(dso, s, gnu_hash(s), need_def);
+}
+
+/* Symbol lookup cache for the relocations done at startup. Large
+ * programs refer to the same symbols (memcpy, malloc, ...) from most of
+ * their libraries, and each reference would otherwise search every
+ * library in turn. While the initial libraries are relocated the set of
+ * global libraries doesn't change, so a symbol's definition can be
+ * remembered the first time it's found. Copy relocations, which search
+ * from head->next, bypass the cache, as do lookups at dlopen time. */
+#define SYMCACHE_SIZE 2048
+
+struct symcache_entry {
+    const char* name;
+    uint32_t gh;
+    int need_def;
+    struct symdef def;
+};
+
+static struct symcache_entry* symcache;
+static size_t symcache_used;
+
+static void symcache_init(void) {
+    symcache = calloc(SYMCACHE_SIZE, sizeof(*symcache));
+    symcache_used = 0;
+}
+
+static void symcache_free(void) {
+    free(symcache);
+    symcache = NULL;
+}
+
+static struct symdef find_sym_cached(const char* s, int need_def) {
+    uint32_t gh = gnu_hash(s);
+    if (!symcache)
+        return find_sym_hashed(head, s, gh, need_def);
+
+    size_t i = gh & (SYMCACHE_SIZE - 1);
+    for (;; i = (i + 1) & (SYMCACHE_SIZE - 1)) {
+        struct symcache_entry* e = &symcache[i];
+        if (!e->name)
+            break;
+        if (e->gh == gh && e->need_def == need_def &&
+            (e->name == s || !strcmp(e->name, s)))
+            return e->def;
+    }
+
+    struct symdef def = find_sym_hashed(head, s, gh, need_def);
+    // only found definitions are kept, so that errors are reported for
+    // every reference; the table stays at most three quarters full
+    if (def.sym && symcache_used < SYMCACHE_SIZE / 4 * 3) {
+        symcache[i] = (struct symcache_entry){
+            .name = s, .gh = gh, .need_def = need_def, .def = def};
+        symcache_used++;
+    }
+    return def;
+}
+
 __attribute__((__visibility__("hidden"))) ptrdiff_t __tlsdesc_static(void), __tlsdesc_dynamic(void);
 
+/* Initial-exec TLS is reached at a fixed offset from the thread pointer,
+ * which only the modules loaded at startup have: their blocks are laid
+ * out in the static TLS area every thread is created with.  A module
+ * loaded later gets its TLS through the DTV, so code using initial-exec
+ * accesses to it cannot work. */
+static void check_static_tls(struct dso* dso, struct dso* def, const char* name) {
+    if (runtime && def->tls_id > static_tls_cnt) {
+        error("Error relocating %s: initial-exec TLS symbol %s is in %s, "
+              "which was not loaded at startup",
+              dso->name, name, def->name);
+        longjmp(*rtld_fail, 1);
+    }
+}
+
 static void do_relocs(struct dso* dso, size_t* rel, size_t rel_size, size_t stride) {
     unsigned char* base = dso->base;
     Sym* syms = dso->syms;
     char* strings = dso->strings;
     Sym* sym;
     const char* name;
-    void* ctx;
     int type;
     int sym_index;
     struct symdef def;
@@ -327,9 +396,13 @@ static void do_relocs(struct dso* dso, size_t* rel, size_t rel_size, size_t stri
         if (sym_index) {
             sym = syms + sym_index;
             name = strings + sym->st_name;
-            ctx = type == REL_COPY ? head->next : head;
-            def = (sym->st_info & 0xf) == STT_SECTION ? (struct symdef){.dso = dso, .sym = sym}
-                                                      : find_sym(ctx, name, type == REL_PLT);
+            if ((sym->st_info & 0xf) == STT_SECTION) {
+                def = (struct symdef){.dso = dso, .sym = sym};
+            } else if (type == REL_COPY) {
+                def = find_sym(head->next, name, 0);
+            } else {
+                def = find_sym_cached(name, type == REL_PLT);
+            }
             if (!def.sym && (sym->st_shndx != SHN_UNDEF || sym->st_info >> 4 != STB_WEAK)) {
                 error("Error relocating %s: %s: symbol not found", dso->name, name);
                 if (runtime)
@@ -403,13 +476,16 @@ static void do_relocs(struct dso* dso, size_t* rel, size_t rel_size, size_t stri
             break;
 #ifdef TLS_ABOVE_TP
         case REL_TPOFF:
+            check_static_tls(dso, def.dso, sym ? name : "(local)");
             *reloc_addr = tls_val + def.dso->tls.offset + TPOFF_K + addend;
             break;
 #else
         case REL_TPOFF:
+            check_static_tls(dso, def.dso, sym ? name : "(local)");
             *reloc_addr = tls_val - def.dso->tls.offset + addend;
             break;
         case REL_TPOFF_NEG:
+            check_static_tls(dso, def.dso, sym ? name : "(local)");
             *reloc_addr = def.dso->tls.offset - tls_val + addend;
             break;
 #endif
@@ -1329,8 +1405,10 @@ static void* dls3(mx_handle_t thread_self, mx_handle_t exec_vmo, int argc, char*
 
     /* The main program must be relocated LAST since it may contin
      * copy relocations which depend on libraries' relocations. */
+    symcache_init();
     reloc_all(app.next);
     reloc_all(&app);
+    symcache_free();
 
     update_tls_size();
 
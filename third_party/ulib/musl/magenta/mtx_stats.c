@@ -0,0 +1,16 @@
+#include <magenta/threads.h>
+
+#include <assert.h>
+#include <runtime/mutex.h>
+#include <stddef.h>
+
+static_assert(sizeof(mtx_stats_t) == sizeof(mxr_mutex_stats_t), "");
+static_assert(offsetof(mtx_stats_t, wakes) == offsetof(mxr_mutex_stats_t, wakes), "");
+
+void mtx_stats_enable(bool enable) {
+    mxr_mutex_stats_enable(enable);
+}
+
+void mtx_stats_get(mtx_stats_t* stats, bool reset) {
+    mxr_mutex_stats_get((mxr_mutex_stats_t*)stats, reset);
+}
@@ -22,6 +22,7 @@ static void dummy_0(void) {}
 weak_alias(dummy_0, __acquire_ptc);
 weak_alias(dummy_0, __dl_thread_cleanup);
 weak_alias(dummy_0, __do_orphaned_stdio_locks);
+weak_alias(dummy_0, __malloc_thread_cleanup);
 weak_alias(dummy_0, __pthread_tsd_run_dtors);
 weak_alias(dummy_0, __release_ptc);
 
@@ -56,26 +57,6 @@ static void start_c11(void* arg) {
     pthread_exit((void*)(intptr_t)start(self->start_arg));
 }
 
-// Allocate stack_size via a vmo, and place the pointer to it in *stack_out.
-static mx_status_t allocate_stack(size_t stack_size, size_t guard_size, uintptr_t* stack_out) {
-    // TODO(kulakowski) Implement guard pages. For now, bypass all the
-    // guard page arithmetic and just map the entire size. When we can
-    // break up mapped regions and have PROT_NONE, the guard stuff is
-    // easy to reintroduce.
-
-    mx_handle_t thread_stack_vmo;
-    mx_status_t status = _mx_vmo_create(stack_size, 0, &thread_stack_vmo);
-    if (status < 0)
-        return status;
-
-    status = _mx_vmar_map(
-        _mx_vmar_root_self(), 0, thread_stack_vmo, 0, stack_size,
-        MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, stack_out);
-    _mx_handle_close(thread_stack_vmo);
-
-    return status;
-}
-
 int pthread_create(pthread_t* restrict res, const pthread_attr_t* restrict attrp, void* (*entry)(void*), void* restrict arg) {
     pthread_attr_t attr = {};
     if (attrp)
@@ -96,7 +77,8 @@ int pthread_create(pthread_t* restrict res, const pthread_attr_t* restrict attrp
     size_t guard_size = round_up_to_page(DEFAULT_GUARD_SIZE + attr._a_guardsize);
     size_t size = guard_size + round_up_to_page(DEFAULT_STACK_SIZE + attr._a_stacksize + libc.tls_size + __pthread_tsd_size);
     uintptr_t addr = 0u;
-    status = allocate_stack(size, guard_size, &addr);
+    bool zeroed;
+    status = __allocate_thread_stack(size, &addr, &zeroed);
     if (status < 0) {
         __release_ptc();
         mxr_thread_destroy(mxr_thread);
@@ -106,6 +88,9 @@ int pthread_create(pthread_t* restrict res, const pthread_attr_t* restrict attrp
     unsigned char* tsd = map + size - __pthread_tsd_size;
     unsigned char* stack = tsd - libc.tls_size;
     unsigned char* stack_limit = map + guard_size;
+    // A reused mapping still holds the last thread's TLS and tsd.
+    if (!zeroed)
+        memset(stack, 0, libc.tls_size + __pthread_tsd_size);
 
     mxr_thread_entry_t start = attr.__c11 ? start_c11 : start_pthread;
     struct pthread* self = __pthread_self();
@@ -146,8 +131,7 @@ int pthread_create(pthread_t* restrict res, const pthread_attr_t* restrict attrp
 
     if (status != NO_ERROR) {
         atomic_fetch_sub(&libc.thread_count, 1);
-        if (map)
-            _mx_vmar_unmap(_mx_vmar_root_self(), (uintptr_t)map, size);
+        __release_thread_stack(map);
         mxr_thread_destroy(mxr_thread);
         return status == ERR_ACCESS_DENIED ? EPERM : EAGAIN;
     }
@@ -228,6 +212,7 @@ _Noreturn void pthread_exit(void* result) {
 
     __do_orphaned_stdio_locks();
     __dl_thread_cleanup();
+    __malloc_thread_cleanup();
 
     mxr_thread_exit(mxr_thread);
 }
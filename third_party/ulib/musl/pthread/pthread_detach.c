@@ -2,10 +2,20 @@
 #include <threads.h>
 
 static int __pthread_detach(pthread_t t) {
+    // Hold on to the thread so its stack can be reclaimed once it exits.
+    mx_handle_t handle = MX_HANDLE_INVALID;
+    if (t->map_base != NULL)
+        _mx_handle_duplicate(mxr_thread_get_handle(t->mxr_thread),
+                             MX_RIGHT_SAME_RIGHTS, &handle);
+
     switch (mxr_thread_detach(t->mxr_thread)) {
     case NO_ERROR:
+        if (handle != MX_HANDLE_INVALID)
+            __release_exiting_thread_stack(t->map_base, handle);
         return 0;
     default:
+        if (handle != MX_HANDLE_INVALID)
+            _mx_handle_close(handle);
         return EINVAL;
     }
 }
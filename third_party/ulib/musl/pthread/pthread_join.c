@@ -1,10 +1,18 @@
 #include "pthread_impl.h"
 
 int pthread_join(pthread_t t, void** res) {
+    // The thread can still be running on its stack for a moment after it
+    // is done, so make sure it is gone before the stack is reused.
+    mx_status_t status = _mx_handle_wait_one(mxr_thread_get_handle(t->mxr_thread),
+                                             MX_THREAD_SIGNALED, MX_TIME_INFINITE, NULL);
+    if (status != NO_ERROR)
+        return EINVAL;
+
     switch (mxr_thread_join(t->mxr_thread)) {
     case NO_ERROR:
         if (res)
             *res = t->result;
+        __release_thread_stack(t->map_base);
         return 0;
     default:
         return EINVAL;
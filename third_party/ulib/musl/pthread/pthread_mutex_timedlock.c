@@ -1,5 +1,7 @@
 #include "pthread_impl.h"
 
+#include <runtime/mutex.h>
+
 int pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec* restrict at) {
     if ((m->_m_type & 15) == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, EBUSY))
         return 0;
@@ -10,11 +12,17 @@ int pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec*
     if (r != EBUSY)
         return r;
 
-    int spins = 100;
-    while (spins-- && m->_m_lock && !m->_m_waiters)
-        a_spin();
+    // spin the way mxr_mutex_t does, with the same opt-in counting
+    int limit = mxr_spin_begin(m);
+    int spun = 0;
+    while (spun < limit && m->_m_lock && !m->_m_waiters) {
+        mxr_spin_pause();
+        spun++;
+    }
+    r = pthread_mutex_trylock(m);
+    mxr_spin_end(m, spun, r != EBUSY);
 
-    while ((r = pthread_mutex_trylock(m)) == EBUSY) {
+    for (; r == EBUSY; r = pthread_mutex_trylock(m)) {
         if (!(r = m->_m_lock) || ((r & 0x40000000) && (m->_m_type & 4)))
             continue;
         if ((m->_m_type & 3) == PTHREAD_MUTEX_ERRORCHECK &&
@@ -24,6 +32,7 @@ int pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec*
         a_inc(&m->_m_waiters);
         t = r | 0x80000000;
         a_cas(&m->_m_lock, r, t);
+        mxr_mutex_stats_wait();
         r = __timedwait(&m->_m_lock, t, CLOCK_REALTIME, at);
         a_dec(&m->_m_waiters);
         if (r)
@@ -2,6 +2,8 @@
 
 #include "futex_impl.h"
 
+#include <runtime/mutex.h>
+
 int pthread_mutex_unlock(pthread_mutex_t* m) {
     int waiters = m->_m_waiters;
     int cont;
@@ -14,7 +16,9 @@ int pthread_mutex_unlock(pthread_mutex_t* m) {
             return m->_m_count--, 0;
     }
     cont = a_swap(&m->_m_lock, (type & 8) ? 0x40000000 : 0);
-    if (waiters || cont < 0)
+    if (waiters || cont < 0) {
+        mxr_mutex_stats_wake();
         __wake(&m->_m_lock, 1);
+    }
     return 0;
 }
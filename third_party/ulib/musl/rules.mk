@@ -57,6 +57,7 @@ LOCAL_SRCS := \
     $(LOCAL_DIR)/magenta/debug.c \
     $(LOCAL_DIR)/magenta/internal.c \
     $(LOCAL_DIR)/magenta/linuxisms.c \
+    $(LOCAL_DIR)/magenta/mtx_stats.c \
     $(LOCAL_DIR)/magenta/thrd_get_mx_handle.c \
     $(LOCAL_DIR)/pthread/pthread_atfork.c \
     $(LOCAL_DIR)/pthread/pthread_attr_destroy.c \
@@ -339,10 +340,6 @@ LOCAL_SRCS := \
     $(LOCAL_DIR)/src/locale/wcsxfrm.c \
     $(LOCAL_DIR)/src/malloc/aligned_alloc.c \
     $(LOCAL_DIR)/src/malloc/calloc.c \
-    $(LOCAL_DIR)/src/malloc/expand_heap.c \
-    $(LOCAL_DIR)/src/malloc/malloc.c \
-    $(LOCAL_DIR)/src/malloc/malloc_usable_size.c \
-    $(LOCAL_DIR)/src/malloc/memalign.c \
     $(LOCAL_DIR)/src/malloc/posix_memalign.c \
     $(LOCAL_DIR)/src/math/__expo2.c \
     $(LOCAL_DIR)/src/math/__expo2f.c \
@@ -875,6 +872,7 @@ LOCAL_SRCS := \
     $(LOCAL_DIR)/src/thread/mtx_timedlock.c \
     $(LOCAL_DIR)/src/thread/mtx_trylock.c \
     $(LOCAL_DIR)/src/thread/mtx_unlock.c \
+    $(LOCAL_DIR)/src/thread/stack_cache.c \
     $(LOCAL_DIR)/src/thread/thrd_create.c \
     $(LOCAL_DIR)/src/thread/thrd_exit.c \
     $(LOCAL_DIR)/src/thread/thrd_join.c \
@@ -1126,6 +1124,24 @@ error Unsupported architecture for musl build!
 
 endif
 
+# USE_THREAD_CACHE_MALLOC=true builds libc.so with the thread-caching
+# allocator in place of musl's own, for programs with many threads that
+# contend in malloc and free.
+USE_THREAD_CACHE_MALLOC ?= false
+
+ifeq ($(call TOBOOL,$(USE_THREAD_CACHE_MALLOC)),true)
+LOCAL_SRCS += \
+    $(LOCAL_DIR)/src/malloc/thread_cache.c \
+
+else
+LOCAL_SRCS += \
+    $(LOCAL_DIR)/src/malloc/expand_heap.c \
+    $(LOCAL_DIR)/src/malloc/malloc.c \
+    $(LOCAL_DIR)/src/malloc/malloc_usable_size.c \
+    $(LOCAL_DIR)/src/malloc/memalign.c \
+
+endif
+
 # Include src/string sources
 include $(LOCAL_DIR)/src/string/rules.mk
 
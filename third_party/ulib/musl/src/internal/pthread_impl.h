@@ -48,6 +48,7 @@ struct pthread {
     uintptr_t canary_at_end;
     void** dtv_copy;
     mxr_thread_t* mxr_thread;
+    void* malloc_cache;
 };
 
 struct __timer {
@@ -144,3 +145,15 @@ static inline int __rt_sigqueueinfo(pid_t pid, int sig, siginfo_t* info) {
 
 #define DEFAULT_STACK_SIZE 81920
 #define DEFAULT_GUARD_SIZE PAGE_SIZE
+
+// Map |size| bytes for a new thread's guard, stack, TLS and tsd, reusing the
+// mapping of a thread that has gone if there is one.  *zeroed says whether
+// the memory is known to be all zero.
+mx_status_t __allocate_thread_stack(size_t size, uintptr_t* base, bool* zeroed);
+
+// Give back the mapping of a thread that is no longer running.
+void __release_thread_stack(unsigned char* map_base);
+
+// Give back the mapping of a detached thread, once |thread| (which this
+// takes ownership of) is signaled.
+void __release_exiting_thread_stack(unsigned char* map_base, mx_handle_t thread);
@@ -0,0 +1,498 @@
+#include "libc.h"
+#include "pthread_impl.h"
+#include <errno.h>
+#include <limits.h>
+#include <magenta/syscalls.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/* A thread-caching allocator, built in place of malloc.c when
+ * USE_THREAD_CACHE_MALLOC is set.
+ *
+ * Small allocations come from spans: SPAN_SIZE aligned pieces of one
+ * big heap VMO, each carved into objects of one size class. Every
+ * thread keeps a free list per size class that it allocates from and
+ * frees to without locking, moving objects to and from the spans of the
+ * class in batches under the class's lock. A span whose objects are all
+ * free goes back to the span pool, with its pages decommitted.
+ *
+ * Large allocations get a VMO and mapping each, which free unmaps. */
+
+#if !_LP64
+#error "the thread-caching allocator needs a 64-bit address space"
+#endif
+
+// Address space reserved for spans
+#define HEAP_REGION_SIZE (1ULL << 40)
+
+#define SPAN_SIZE (256 * 1024)
+#define SPAN_HEADER_SIZE 64
+
+#define ALIGN 16
+#define MAX_SMALL (32 * 1024)
+#define NUM_CLASSES 44
+
+// Bytes of each size class a thread cache holds on to
+#define CACHE_CLASS_BYTES (32 * 1024)
+#define CACHE_MIN_COUNT 2
+#define CACHE_MAX_COUNT 128
+
+struct span {
+    // in the class's list of spans with objects to hand out
+    struct span *next, *prev;
+    void* free;
+    char* bump;
+    size_t size;
+    uint32_t cls;
+    uint32_t inuse;
+    int listed;
+};
+
+_Static_assert(sizeof(struct span) <= SPAN_HEADER_SIZE, "span header too big");
+
+struct large {
+    uintptr_t base;
+    size_t len;
+};
+
+_Static_assert(sizeof(struct large) == ALIGN, "large header not ALIGN bytes");
+
+struct central {
+    mtx_t lock;
+    struct span* spans;
+};
+
+struct cache_list {
+    void* head;
+    uint32_t count;
+    uint32_t max;
+};
+
+struct thread_cache {
+    struct cache_list lists[NUM_CLASSES];
+};
+
+static struct {
+    _Atomic uintptr_t base;
+    mx_handle_t vmo;
+    mtx_t lock;
+    // spans never handed out start at next, freed ones are on free_spans
+    uintptr_t next;
+    struct span* free_spans;
+    struct central classes[NUM_CLASSES];
+} heap;
+
+static mtx_t heap_init_lock;
+
+static inline int size_class(size_t n) {
+    if (n <= 256)
+        return n ? (n - 1) / 16 : 0;
+    // four classes for each power of two
+    size_t m = n - 1;
+    int k = 63 - __builtin_clzl(m);
+    return 16 + (k - 8) * 4 + ((m >> (k - 2)) & 3);
+}
+
+static inline size_t class_size(int cls) {
+    if (cls < 16)
+        return (size_t)(cls + 1) * 16;
+    int k = (cls - 16) / 4 + 8;
+    int sub = (cls - 16) % 4;
+    return ((size_t)1 << k) + ((size_t)(sub + 1) << (k - 2));
+}
+
+static inline int is_small(const void* p) {
+    uintptr_t base = atomic_load_explicit(&heap.base, memory_order_relaxed);
+    return base && (uintptr_t)p - base < HEAP_REGION_SIZE;
+}
+
+static inline struct span* span_of(const void* p) {
+    return (struct span*)((uintptr_t)p & -(uintptr_t)SPAN_SIZE);
+}
+
+// Returns the start of the object holding p, which memalign may have
+// handed out a pointer into the middle of.
+static inline char* object_of(struct span* s, const void* p) {
+    char* objs = (char*)s + SPAN_HEADER_SIZE;
+    return objs + ((const char*)p - objs) / s->size * s->size;
+}
+
+static int heap_init(void) {
+    int ret = 0;
+    mtx_lock(&heap_init_lock);
+    if (atomic_load_explicit(&heap.base, memory_order_relaxed))
+        goto done;
+
+    mx_handle_t vmo, vmar;
+    uintptr_t addr;
+    if (_mx_vmo_create(HEAP_REGION_SIZE, 0, &vmo) != NO_ERROR) {
+        ret = -1;
+        goto done;
+    }
+    if (_mx_vmar_allocate(_mx_vmar_root_self(), 0, HEAP_REGION_SIZE,
+                          MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_CAN_MAP_WRITE |
+                          MX_VM_FLAG_CAN_MAP_SPECIFIC,
+                          &vmar, &addr) != NO_ERROR) {
+        _mx_handle_close(vmo);
+        ret = -1;
+        goto done;
+    }
+    mx_status_t status = _mx_vmar_map(vmar, 0, vmo, 0, HEAP_REGION_SIZE,
+                                      MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE |
+                                      MX_VM_FLAG_SPECIFIC,
+                                      &addr);
+    _mx_handle_close(vmar);
+    if (status != NO_ERROR) {
+        _mx_handle_close(vmo);
+        ret = -1;
+        goto done;
+    }
+
+    heap.vmo = vmo;
+    heap.next = (addr + SPAN_SIZE - 1) & -(uintptr_t)SPAN_SIZE;
+    atomic_store_explicit(&heap.base, addr, memory_order_release);
+
+done:
+    mtx_unlock(&heap_init_lock);
+    return ret;
+}
+
+static struct span* span_alloc(int cls) {
+    if (!atomic_load_explicit(&heap.base, memory_order_acquire) && heap_init() < 0)
+        return NULL;
+
+    mtx_lock(&heap.lock);
+    struct span* s = heap.free_spans;
+    if (s) {
+        heap.free_spans = s->next;
+    } else if (heap.next + SPAN_SIZE <= heap.base + HEAP_REGION_SIZE) {
+        s = (struct span*)heap.next;
+        heap.next += SPAN_SIZE;
+    }
+    mtx_unlock(&heap.lock);
+    if (!s)
+        return NULL;
+
+    s->next = s->prev = NULL;
+    s->free = NULL;
+    s->bump = (char*)s + SPAN_HEADER_SIZE;
+    s->size = class_size(cls);
+    s->cls = cls;
+    s->inuse = 0;
+    s->listed = 0;
+    return s;
+}
+
+// Gives back the pages of a span with nothing in use. The first page
+// stays, to keep its header.
+static void span_free(struct span* s) {
+    _mx_vmo_op_range(heap.vmo, MX_VMO_OP_DECOMMIT,
+                     (uintptr_t)s - heap.base + PAGE_SIZE, SPAN_SIZE - PAGE_SIZE, NULL, 0);
+
+    mtx_lock(&heap.lock);
+    s->next = heap.free_spans;
+    heap.free_spans = s;
+    mtx_unlock(&heap.lock);
+}
+
+static void span_link(struct central* c, struct span* s) {
+    s->prev = NULL;
+    s->next = c->spans;
+    if (c->spans)
+        c->spans->prev = s;
+    c->spans = s;
+    s->listed = 1;
+}
+
+static void span_unlink(struct central* c, struct span* s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        c->spans = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+    s->listed = 0;
+}
+
+// Takes up to count objects of cls from its spans, returning them as a
+// list through *out. Returns the number taken, 0 if out of memory.
+static uint32_t central_alloc(int cls, uint32_t count, void** out) {
+    struct central* c = &heap.classes[cls];
+    void* list = NULL;
+    uint32_t n = 0;
+
+    mtx_lock(&c->lock);
+    while (n < count) {
+        struct span* s = c->spans;
+        if (!s) {
+            // drop the lock for the span pool so other classes aren't held up
+            mtx_unlock(&c->lock);
+            s = span_alloc(cls);
+            mtx_lock(&c->lock);
+            if (!s)
+                break;
+            span_link(c, s);
+        }
+        char* end = (char*)s + SPAN_SIZE;
+        while (n < count) {
+            void* obj;
+            if (s->free) {
+                obj = s->free;
+                s->free = *(void**)obj;
+            } else if (s->bump + s->size <= end) {
+                obj = s->bump;
+                s->bump += s->size;
+            } else {
+                break;
+            }
+            *(void**)obj = list;
+            list = obj;
+            s->inuse++;
+            n++;
+        }
+        if (!s->free && s->bump + s->size > end)
+            span_unlink(c, s);
+    }
+    mtx_unlock(&c->lock);
+
+    *out = list;
+    return n;
+}
+
+// Returns a list of objects of cls to their spans.
+static void central_free(int cls, void* list) {
+    struct central* c = &heap.classes[cls];
+    struct span* empty = NULL;
+
+    mtx_lock(&c->lock);
+    while (list) {
+        void* obj = list;
+        list = *(void**)obj;
+
+        struct span* s = span_of(obj);
+        *(void**)obj = s->free;
+        s->free = obj;
+        if (!s->listed)
+            span_link(c, s);
+        // keep the class's last span for the next allocation
+        if (--s->inuse == 0 && (c->spans != s || s->next)) {
+            span_unlink(c, s);
+            s->next = empty;
+            empty = s;
+        }
+    }
+    mtx_unlock(&c->lock);
+
+    while (empty) {
+        struct span* s = empty;
+        empty = s->next;
+        span_free(s);
+    }
+}
+
+static struct thread_cache* get_cache(void) {
+    // the dynamic linker mallocs before there is a thread pointer
+    if (!mxr_tp_get())
+        return NULL;
+    pthread_t self = __pthread_self();
+    struct thread_cache* tc = self->malloc_cache;
+    if (tc)
+        return tc;
+
+    int cls = size_class(sizeof(struct thread_cache));
+    if (!central_alloc(cls, 1, (void**)&tc))
+        return NULL;
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        size_t count = CACHE_CLASS_BYTES / class_size(i);
+        if (count < CACHE_MIN_COUNT)
+            count = CACHE_MIN_COUNT;
+        if (count > CACHE_MAX_COUNT)
+            count = CACHE_MAX_COUNT;
+        tc->lists[i].head = NULL;
+        tc->lists[i].count = 0;
+        tc->lists[i].max = count;
+    }
+    self->malloc_cache = tc;
+    return tc;
+}
+
+// Called by pthread_exit to give back what the thread had cached.
+void __malloc_thread_cleanup(void) {
+    pthread_t self = __pthread_self();
+    struct thread_cache* tc = self->malloc_cache;
+    if (!tc)
+        return;
+    self->malloc_cache = NULL;
+
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        if (tc->lists[i].head)
+            central_free(i, tc->lists[i].head);
+    }
+    *(void**)tc = NULL;
+    central_free(size_class(sizeof(struct thread_cache)), tc);
+}
+
+static void* small_alloc(int cls) {
+    struct thread_cache* tc = get_cache();
+    if (!tc) {
+        void* obj;
+        return central_alloc(cls, 1, &obj) ? obj : NULL;
+    }
+
+    struct cache_list* l = &tc->lists[cls];
+    if (!l->head) {
+        l->count = central_alloc(cls, (l->max + 1) / 2, &l->head);
+        if (!l->count)
+            return NULL;
+    }
+    void* obj = l->head;
+    l->head = *(void**)obj;
+    l->count--;
+    return obj;
+}
+
+static void small_free(void* obj) {
+    int cls = span_of(obj)->cls;
+    struct thread_cache* tc = get_cache();
+    if (!tc) {
+        *(void**)obj = NULL;
+        central_free(cls, obj);
+        return;
+    }
+
+    struct cache_list* l = &tc->lists[cls];
+    *(void**)obj = l->head;
+    l->head = obj;
+    if (++l->count <= l->max)
+        return;
+
+    // give back the half of the list not used most recently
+    uint32_t keep = l->max / 2;
+    void* last = l->head;
+    for (uint32_t i = 1; i < keep; i++)
+        last = *(void**)last;
+    void* rest = *(void**)last;
+    *(void**)last = NULL;
+    l->count = keep;
+    central_free(cls, rest);
+}
+
+static void* large_alloc(size_t n, size_t align) {
+    if (n > SIZE_MAX / 2 - align - PAGE_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t len = (n + sizeof(struct large) + align - ALIGN + PAGE_SIZE - 1) & -PAGE_SIZE;
+
+    mx_handle_t vmo;
+    uintptr_t base;
+    if (_mx_vmo_create(len, 0, &vmo) != NO_ERROR) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    mx_status_t status = _mx_vmar_map(_mx_vmar_root_self(), 0, vmo, 0, len,
+                                      MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &base);
+    _mx_handle_close(vmo);
+    if (status != NO_ERROR) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    uintptr_t p = (base + sizeof(struct large) + align - 1) & -align;
+    struct large* hdr = (struct large*)p - 1;
+    hdr->base = base;
+    hdr->len = len;
+    return (void*)p;
+}
+
+static void large_free(void* p) {
+    struct large* hdr = (struct large*)p - 1;
+    _mx_vmar_unmap(_mx_vmar_root_self(), hdr->base, hdr->len);
+}
+
+static size_t usable_size(void* p) {
+    if (is_small(p)) {
+        struct span* s = span_of(p);
+        return object_of(s, p) + s->size - (char*)p;
+    }
+    struct large* hdr = (struct large*)p - 1;
+    return hdr->base + hdr->len - (uintptr_t)p;
+}
+
+void* malloc(size_t n) {
+    if (n > MAX_SMALL)
+        return large_alloc(n, ALIGN);
+    void* p = small_alloc(size_class(n));
+    if (!p)
+        errno = ENOMEM;
+    return p;
+}
+
+void* __malloc0(size_t n) {
+    void* p = malloc(n);
+    // large allocations are fresh pages
+    if (p && n <= MAX_SMALL)
+        memset(p, 0, n);
+    return p;
+}
+
+void free(void* p) {
+    if (!p)
+        return;
+    if (is_small(p)) {
+        small_free(object_of(span_of(p), p));
+    } else {
+        large_free(p);
+    }
+}
+
+void* realloc(void* p, size_t n) {
+    if (!p)
+        return malloc(n);
+
+    size_t old = usable_size(p);
+    // grow into the rest of the object, or shrink in place unless that
+    // would leave more than half of it unused
+    if (n <= old && (n > old / 2 || old <= ALIGN)) {
+        return p;
+    }
+
+    void* new = malloc(n);
+    if (!new)
+        return NULL;
+    memcpy(new, p, n < old ? n : old);
+    free(p);
+    return new;
+}
+
+void* __memalign(size_t align, size_t len) {
+    if ((align & -align) != align) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (len > SIZE_MAX - align) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (align <= ALIGN)
+        return malloc(len);
+    if (len + align - 1 > MAX_SMALL)
+        return large_alloc(len, align);
+
+    // free finds the start of the object again from any pointer into it
+    char* mem = malloc(len + align - 1);
+    if (!mem)
+        return NULL;
+    return (void*)(((uintptr_t)mem + align - 1) & -align);
+}
+
+weak_alias(__memalign, memalign);
+
+size_t malloc_usable_size(void* p) {
+    return p ? usable_size(p) : 0;
+}
@@ -12,9 +12,82 @@
 static void dummy(void) {}
 weak_alias(dummy, __vm_wait);
 
+// Provided by mxio, when it is linked in, for mapping files.
+mx_status_t mxio_get_vmo(int fd, mx_handle_t* vmo, size_t* off, size_t* len)
+    __attribute__((weak));
+
 #define UNIT SYSCALL_MMAP2_UNIT
 #define OFF_MASK ((-0x2000ULL << (8 * sizeof(long) - 1)) | (UNIT - 1))
 
+// Finds a VMO to map len bytes of the file behind fd from, starting at off.
+//
+// Shared read-only mappings, and private ones whose pages stay read-only, map
+// the filesystem's VMO for the file, so they share its pages with every other
+// mapping and read of the file.  Where the file's data in that VMO is not page
+// aligned, or the mapping runs past it, or the mapping is private and
+// writable, the data is copied into a fresh VMO instead.  Shared writable
+// mappings are not supported yet.
+static mx_status_t map_file_vmo(int fd, off_t off, size_t len, int prot, int flags,
+                                mx_handle_t* vmo_out, uint64_t* vmo_off_out) {
+    if (&mxio_get_vmo == NULL)
+        return ERR_NOT_SUPPORTED;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE))
+        return ERR_NOT_SUPPORTED;
+
+    mx_handle_t file_vmo;
+    size_t file_off, file_len;
+    mx_status_t status = mxio_get_vmo(fd, &file_vmo, &file_off, &file_len);
+    if (status < 0)
+        return status;
+
+    uint64_t vmo_size;
+    if ((status = _mx_vmo_get_size(file_vmo, &vmo_size)) < 0) {
+        _mx_handle_close(file_vmo);
+        return status;
+    }
+
+    uint64_t data_off = file_off + off;
+    if (!(prot & PROT_WRITE) && (data_off % PAGE_SIZE) == 0 &&
+        data_off <= vmo_size && len <= vmo_size - data_off) {
+        *vmo_out = file_vmo;
+        *vmo_off_out = data_off;
+        return NO_ERROR;
+    }
+    if (flags & MAP_SHARED) {
+        _mx_handle_close(file_vmo);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // Past the end of the file reads as zero.
+    mx_handle_t copy;
+    if ((status = _mx_vmo_create(len, 0, &copy)) < 0) {
+        _mx_handle_close(file_vmo);
+        return status;
+    }
+    size_t avail = (size_t)off < file_len ? file_len - off : 0;
+    if (avail > len)
+        avail = len;
+    char buf[1024];
+    for (size_t done = 0; done < avail && status >= 0;) {
+        size_t chunk = avail - done < sizeof(buf) ? avail - done : sizeof(buf);
+        size_t actual;
+        status = _mx_vmo_read(file_vmo, buf, data_off + done, chunk, &actual);
+        if (status >= 0 && actual == 0)
+            break;
+        if (status >= 0)
+            status = _mx_vmo_write(copy, buf, done, actual, &actual);
+        done += actual;
+    }
+    _mx_handle_close(file_vmo);
+    if (status < 0) {
+        _mx_handle_close(copy);
+        return status;
+    }
+    *vmo_out = copy;
+    *vmo_off_out = 0;
+    return NO_ERROR;
+}
+
 void* __mmap(void* start, size_t len, int prot, int flags, int fd, off_t off) {
     if (off & OFF_MASK) {
         errno = EINVAL;
@@ -44,49 +117,57 @@ void* __mmap(void* start, size_t len, int prot, int flags, int fd, off_t off) {
 
     //printf("__mmap start %p, len %zu prot %u flags %u fd %d off %llx\n", start, len, prot, flags, fd, off);
 
-    // look for a specific case that we can handle, from pthread_create
-    if ((flags & MAP_ANON) && (fd < 0)) {
-        // round up to page size
-        len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-
-        // build magenta flags for this
-        uint32_t mx_flags = 0;
-        mx_flags |= (prot & PROT_READ) ? MX_VM_FLAG_PERM_READ : 0;
-        mx_flags |= (prot & PROT_WRITE) ? MX_VM_FLAG_PERM_WRITE : 0;
-        mx_flags |= (prot & PROT_EXEC) ? MX_VM_FLAG_PERM_EXECUTE : 0;
-
-        size_t offset = 0;
-        if (flags & MAP_FIXED) {
-            mx_flags |= MX_VM_FLAG_SPECIFIC;
-
-            mx_info_vmar_t info;
-            mx_status_t status = mx_object_get_info(_mx_vmar_root_self(),
-                                                    MX_INFO_VMAR, &info,
-                                                    sizeof(info), NULL, NULL);
-            if (status < 0 || (uintptr_t)start < info.base) {
-                return MAP_FAILED;
-            }
-            offset = (uintptr_t)start - info.base;
+    // round up to page size
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // build magenta flags for this
+    uint32_t mx_flags = 0;
+    mx_flags |= (prot & PROT_READ) ? MX_VM_FLAG_PERM_READ : 0;
+    mx_flags |= (prot & PROT_WRITE) ? MX_VM_FLAG_PERM_WRITE : 0;
+    mx_flags |= (prot & PROT_EXEC) ? MX_VM_FLAG_PERM_EXECUTE : 0;
+
+    size_t offset = 0;
+    if (flags & MAP_FIXED) {
+        mx_flags |= MX_VM_FLAG_SPECIFIC;
+
+        mx_info_vmar_t info;
+        mx_status_t status = mx_object_get_info(_mx_vmar_root_self(),
+                                                MX_INFO_VMAR, &info,
+                                                sizeof(info), NULL, NULL);
+        if (status < 0 || (uintptr_t)start < info.base) {
+            return MAP_FAILED;
         }
+        offset = (uintptr_t)start - info.base;
+    }
 
-        mx_handle_t vmo;
+    mx_handle_t vmo;
+    uint64_t vmo_off = 0;
+    if ((flags & MAP_ANON) && (fd < 0)) {
         if (_mx_vmo_create(len, 0, &vmo) < 0)
             return MAP_FAILED;
-
-        uintptr_t ptr = 0;
-        mx_status_t status = _mx_vmar_map(_mx_vmar_root_self(), offset, vmo, 0,
-                                          len, mx_flags, &ptr);
-        _mx_handle_close(vmo);
         // TODO: map this as shared if we ever implement forking
+    } else if (flags & MAP_ANON) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    } else {
+        mx_status_t status = map_file_vmo(fd, off, len, prot, flags, &vmo, &vmo_off);
         if (status < 0) {
+            errno = status == ERR_ACCESS_DENIED ? EACCES :
+                    status == ERR_NOT_SUPPORTED ? ENODEV :
+                    status == ERR_BAD_HANDLE ? EBADF : ENOMEM;
             return MAP_FAILED;
         }
+    }
 
-        return (void*)ptr;
-    } else {
-        // TODO(kulakowski) mxio file mapping
+    uintptr_t ptr = 0;
+    mx_status_t status = _mx_vmar_map(_mx_vmar_root_self(), offset, vmo, vmo_off,
+                                      len, mx_flags, &ptr);
+    _mx_handle_close(vmo);
+    if (status < 0) {
         return MAP_FAILED;
     }
+
+    return (void*)ptr;
 }
 
 weak_alias(__mmap, mmap);
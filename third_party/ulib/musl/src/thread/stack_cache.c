@@ -0,0 +1,180 @@
+#define _ALL_SOURCE
+#include "pthread_impl.h"
+
+#include <magenta/syscalls.h>
+#include <stdbool.h>
+#include <threads.h>
+
+// Thread stacks, together with the TLS and tsd above them, are mapped from
+// a VMO of their own.  Rather than creating, mapping and unmapping one for
+// every thread, mappings go back into a cache when their thread is gone and
+// the next thread of the same size picks them up.
+//
+// Up to CACHE_COMMITTED_MAX cached mappings keep their pages, so that they
+// can be reused straight away.  Past that, the pages a thread dirtied are
+// decommitted and only the address range (and VMO) is kept, up to
+// CACHE_MAX mappings in all.  Past that they are unmapped.
+#define CACHE_COMMITTED_MAX 4
+#define CACHE_MAX 16
+
+// Lives at the bottom of each mapping, in the guard area below the stack,
+// which the thread itself never touches.
+struct stack_mapping {
+    struct stack_mapping* next;
+    uintptr_t base;
+    size_t size;
+    mx_handle_t vmo;
+    // While the mapping is waiting for a detached thread to exit.
+    mx_handle_t thread;
+    bool committed;
+};
+
+static mtx_t lock = MTX_INIT;
+static struct stack_mapping* cached;
+static struct stack_mapping* exiting;
+static size_t cached_count;
+static size_t committed_count;
+
+static void destroy(struct stack_mapping* m) {
+    mx_handle_t vmo = m->vmo;
+    _mx_vmar_unmap(_mx_vmar_root_self(), m->base, m->size);
+    _mx_handle_close(vmo);
+}
+
+// Called with the lock held.  Returns the mapping if it should be destroyed
+// instead, once the lock is dropped.
+static struct stack_mapping* cache_locked(struct stack_mapping* m) {
+    if (cached_count == CACHE_MAX)
+        return m;
+
+    if (committed_count == CACHE_COMMITTED_MAX) {
+        // Keep the page holding *m.
+        _mx_vmo_op_range(m->vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE, m->size - PAGE_SIZE, NULL, 0);
+        m->committed = false;
+    } else {
+        m->committed = true;
+        committed_count++;
+    }
+
+    m->next = cached;
+    cached = m;
+    cached_count++;
+    return NULL;
+}
+
+// Called with the lock held.  Moves the mappings of detached threads that
+// have since exited into the cache, and returns a list of any that didn't fit.
+static struct stack_mapping* reap_exiting_locked(void) {
+    struct stack_mapping* overflow = NULL;
+    struct stack_mapping** link = &exiting;
+    while (*link != NULL) {
+        struct stack_mapping* m = *link;
+        if (_mx_handle_wait_one(m->thread, MX_THREAD_SIGNALED, 0, NULL) != NO_ERROR) {
+            link = &m->next;
+            continue;
+        }
+        *link = m->next;
+        _mx_handle_close(m->thread);
+        m->thread = MX_HANDLE_INVALID;
+        if (cache_locked(m) != NULL) {
+            m->next = overflow;
+            overflow = m;
+        }
+    }
+    return overflow;
+}
+
+static void destroy_list(struct stack_mapping* list) {
+    while (list != NULL) {
+        struct stack_mapping* next = list->next;
+        destroy(list);
+        list = next;
+    }
+}
+
+mx_status_t __allocate_thread_stack(size_t size, uintptr_t* base_out, bool* zeroed_out) {
+    struct stack_mapping* found = NULL;
+
+    mtx_lock(&lock);
+    struct stack_mapping* overflow = exiting != NULL ? reap_exiting_locked() : NULL;
+    // Prefer a mapping that still has its pages.
+    for (struct stack_mapping** link = &cached; *link != NULL; link = &(*link)->next) {
+        struct stack_mapping* m = *link;
+        if (m->size != size)
+            continue;
+        if (found == NULL || m->committed) {
+            found = m;
+            if (m->committed)
+                break;
+        }
+    }
+    if (found != NULL) {
+        struct stack_mapping** link = &cached;
+        while (*link != found)
+            link = &(*link)->next;
+        *link = found->next;
+        cached_count--;
+        if (found->committed)
+            committed_count--;
+    }
+    mtx_unlock(&lock);
+
+    destroy_list(overflow);
+
+    if (found != NULL) {
+        *base_out = found->base;
+        // Decommitted pages come back zero.
+        *zeroed_out = !found->committed;
+        return NO_ERROR;
+    }
+
+    mx_handle_t vmo;
+    mx_status_t status = _mx_vmo_create(size, 0, &vmo);
+    if (status < 0)
+        return status;
+
+    // TODO(kulakowski) Implement guard pages. For now, bypass all the
+    // guard page arithmetic and just map the entire size. When we can
+    // break up mapped regions and have PROT_NONE, the guard stuff is
+    // easy to reintroduce.
+    uintptr_t base;
+    status = _mx_vmar_map(_mx_vmar_root_self(), 0, vmo, 0, size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &base);
+    if (status < 0) {
+        _mx_handle_close(vmo);
+        return status;
+    }
+
+    struct stack_mapping* m = (struct stack_mapping*)base;
+    m->base = base;
+    m->size = size;
+    m->vmo = vmo;
+    m->thread = MX_HANDLE_INVALID;
+
+    *base_out = base;
+    *zeroed_out = true;
+    return NO_ERROR;
+}
+
+void __release_thread_stack(unsigned char* map_base) {
+    struct stack_mapping* m = (struct stack_mapping*)map_base;
+
+    mtx_lock(&lock);
+    struct stack_mapping* overflow = exiting != NULL ? reap_exiting_locked() : NULL;
+    struct stack_mapping* rejected = cache_locked(m);
+    mtx_unlock(&lock);
+
+    destroy_list(overflow);
+    if (rejected != NULL)
+        destroy(rejected);
+}
+
+void __release_exiting_thread_stack(unsigned char* map_base, mx_handle_t thread) {
+    struct stack_mapping* m = (struct stack_mapping*)map_base;
+    m->thread = thread;
+
+    mtx_lock(&lock);
+    m->next = exiting;
+    exiting = m;
+    mtx_unlock(&lock);
+}